@@ -0,0 +1,3352 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+/*
+ * Microbenchmarks for the cryptographic primitives and hot core paths.
+ *
+ * Each benchmark is run for a number of warmup samples and then for a
+ * number of measured samples. A sample is a calibrated batch of
+ * operations that takes at least ZT_BENCHMARK_MIN_SAMPLE_NS. Results are
+ * printed to stdout as JSON with the median and p99 time per operation,
+ * so that runs can be compared across releases. Built with
+ * ZT_MUTEX_PROFILING=1, contention statistics for every lock taken during
+ * the run follow the results.
+ *
+ * Usage: zerotier-benchmark [-s <samples>] [-w <warmup samples>] [<options>] [<name filter>]
+ *
+ * Options for the end to end loopback benchmark:
+ *   -f <bytes>    Ethernet frame payload size (default 1400)
+ *   -r <rules>    Extra non-matching rule groups before the final accept (default 0)
+ *   -t <threads>  Sending threads, each with its own wire and receiving thread (default 1)
+ *   -n <nodes>    Nodes, of which the first sends to all the others (default 2)
+ *   -c            Allow frame compression (default off)
+ *   -b <frames>   Frames handed to the node per call, with frame aggregation on if more than 1 (default 1)
+ *   -z            Pass frames and wire packets in buffers lent by the core (ignores -b)
+ *
+ * Options for the rule evaluation benchmark:
+ *   -F <file>     Compiled rule set, e.g. from node rule-compiler/cli.js <rules> (may be repeated)
+ *   -P <file>     pcapng file of frames (e.g. from GET /capture) to evaluate as well as synthetic ones
+ *
+ * Options for the contention benchmark:
+ *   -T <threads>  Most threads, doubling from 1 (default: number of CPUs, at least 2)
+ *
+ * Options for the root footprint benchmark:
+ *   -N <peers>    Synthetic peers the root is filled with (default 100000)
+ *
+ * Options for the busy polling benchmark:
+ *   -B <usec>     Microseconds to spin before waiting when busy polling (default 1000)
+ *
+ * Options for replaying traffic recorded with POST /record (only run if -p is given):
+ *   -p <file>     Recording to replay
+ *   -H <path>     Home path of the node that made it, for its identity and state (default .)
+ *   -R            Replay at recorded speed instead of as fast as possible
+ *
+ * The tap benchmark (tap/...) creates real taps and so must be run as root.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "include/ZeroTierOne.h"
+
+#include "node/Constants.hpp"
+#include "node/Utils.hpp"
+#include "node/Identity.hpp"
+#include "node/Packet.hpp"
+#include "node/Salsa20.hpp"
+#include "node/Poly1305.hpp"
+#include "node/AES.hpp"
+#include "node/C25519.hpp"
+#include "node/World.hpp"
+#include "node/Node.hpp"
+#include "node/Topology.hpp"
+#include "node/Peer.hpp"
+#include "node/Path.hpp"
+#include "node/Hashtable.hpp"
+#include "node/Multicaster.hpp"
+#include "node/Network.hpp"
+#include "node/NetworkConfig.hpp"
+#include "node/Capability.hpp"
+#include "node/Tag.hpp"
+#include "node/Switch.hpp"
+#include "node/Trace.hpp"
+#include "node/Shaper.hpp"
+#include "node/StateSnapshot.hpp"
+
+#include "controller/EmbeddedNetworkController.hpp"
+
+#include "osdep/OSUtils.hpp"
+#include "osdep/WireRecorder.hpp"
+#include "osdep/Phy.hpp"
+
+#ifdef __APPLE__
+#include "osdep/OSXEthernetTap.hpp"
+namespace ZeroTier { typedef OSXEthernetTap EthernetTap; }
+#endif
+#ifdef __LINUX__
+#include "osdep/LinuxEthernetTap.hpp"
+namespace ZeroTier { typedef LinuxEthernetTap EthernetTap; }
+#endif
+#ifdef __FreeBSD__
+#include "osdep/BSDEthernetTap.hpp"
+namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
+#endif
+#ifdef __NetBSD__
+#include "osdep/NetBSDEthernetTap.hpp"
+namespace ZeroTier { typedef NetBSDEthernetTap EthernetTap; }
+#endif
+#ifdef __OpenBSD__
+#include "osdep/BSDEthernetTap.hpp"
+namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
+#endif
+
+#include "version.h"
+
+#define ZT_BENCHMARK_MIN_SAMPLE_NS 1000000ULL
+#define ZT_BENCHMARK_DEFAULT_SAMPLES 101
+#define ZT_BENCHMARK_DEFAULT_WARMUP 10
+#define ZT_BENCHMARK_NODE_RX_MS 1000
+#define ZT_BENCHMARK_TOPOLOGY_PEERS 250000
+#define ZT_BENCHMARK_TIERING_PEERS 100000
+#define ZT_BENCHMARK_SNAPSHOT_PEERS 100000
+#define ZT_BENCHMARK_SNAPSHOT_GROUPS 100
+#define ZT_BENCHMARK_SNAPSHOT_GROUP_MEMBERS 1000
+#define ZT_BENCHMARK_HELLO_STORM_PEERS 64
+#define ZT_BENCHMARK_HELLO_STORM_BURST 16
+#define ZT_BENCHMARK_HASHTABLE_ENTRIES 100000
+#define ZT_BENCHMARK_MULTICAST_LIMIT 32
+
+// Limits for the memory budget benchmark in builds that don't set their own
+#define ZT_BENCHMARK_MEMORY_MAX_PEERS 4096
+#define ZT_BENCHMARK_MEMORY_MAX_MULTICAST_MEMBERS 16384
+#define ZT_BENCHMARK_MEMORY_MULTICAST_GROUPS 16
+#define ZT_BENCHMARK_FILTER_PORTS 31
+
+// Root footprint benchmark: peers by default and at most, members per network, and one in this many peers also has an IPv6 path
+#define ZT_BENCHMARK_ROOT_PEERS 100000
+#define ZT_BENCHMARK_ROOT_MAX_PEERS 16000000
+#define ZT_BENCHMARK_ROOT_NETWORK_SIZE 100
+#define ZT_BENCHMARK_ROOT_IPV6_EVERY 3
+
+// Peers restored per snapshot, so their HELLO IDs are still remembered when answered
+#define ZT_BENCHMARK_ROOT_CHUNK 1024
+
+// Each path sends a keepalive this often and every ZT_PEER_PING_PERIOD one of them is a HELLO, simulated in steps
+#define ZT_BENCHMARK_ROOT_KEEPALIVE_MS 15000
+#define ZT_BENCHMARK_ROOT_STEP_MS 500
+
+// One in this many relayed packets has its latency sampled
+#define ZT_BENCHMARK_ROOT_LATENCY_SAMPLE 16
+#define ZT_BENCHMARK_CONTENTION_MS 500
+#define ZT_BENCHMARK_CONTENTION_PEERS 10000
+#define ZT_BENCHMARK_CONTENTION_GROUPS 64
+#define ZT_BENCHMARK_CONTENTION_FLOWS 1024
+
+// Keys drawn in advance for the contention benchmark, and one in this many operations has its latency sampled
+#define ZT_BENCHMARK_CONTENTION_KEYS 65536
+#define ZT_BENCHMARK_CONTENTION_LATENCY_SAMPLE 64
+#define ZT_BENCHMARK_LOOPBACK_MS 2000
+#define ZT_BENCHMARK_LOOPBACK_WARMUP_MS 250
+#define ZT_BENCHMARK_LOOPBACK_SETUP_MS 10000
+#define ZT_BENCHMARK_LOOPBACK_MAX_NODES 16
+
+// Packets each in-memory wire holds before dropping, and the depth at which senders wait
+#define ZT_BENCHMARK_LOOPBACK_WIRE_SLOTS 256
+#define ZT_BENCHMARK_LOOPBACK_WIRE_INFLIGHT 64
+
+// One in this many delivered frames has its latency sampled
+#define ZT_BENCHMARK_LOOPBACK_LATENCY_SAMPLE 16
+
+// Datagrams sent (after some not measured) and the gap between them for the busy polling benchmark
+#define ZT_BENCHMARK_BUSY_POLL_DATAGRAMS 5000
+#define ZT_BENCHMARK_BUSY_POLL_WARMUP 100
+#define ZT_BENCHMARK_BUSY_POLL_INTERVAL_US 200
+
+// Measured and warmup time per frame size for the tap benchmark, and one in this many frames has its latency sampled
+#define ZT_BENCHMARK_TAP_MS 1000
+#define ZT_BENCHMARK_TAP_WARMUP_MS 100
+#define ZT_BENCHMARK_TAP_LATENCY_SAMPLE 16
+
+// Tap network ID, MAC and IP (in the RFC 2544 benchmarking range), and UDP port frames from the host are sent to
+#define ZT_BENCHMARK_TAP_NWID 0xbe7c4a9000000001ULL
+#define ZT_BENCHMARK_TAP_MAC 0x32bd7a4c0d01ULL
+#define ZT_BENCHMARK_TAP_IP "198.18.0.1/24"
+#define ZT_BENCHMARK_TAP_PORT 45999
+
+using namespace ZeroTier;
+
+static unsigned int benchSamples = ZT_BENCHMARK_DEFAULT_SAMPLES;
+static unsigned int benchWarmup = ZT_BENCHMARK_DEFAULT_WARMUP;
+static const char *benchFilter = (const char *)0;
+static bool benchFirstResult = true;
+
+static unsigned int loopbackFrameBytes = 1400;
+static unsigned int loopbackRules = 0;
+static unsigned int loopbackThreads = 1;
+static unsigned int loopbackNodes = 2;
+static bool loopbackCompression = false;
+static unsigned int loopbackBatch = 1;
+static bool loopbackLend = false;
+
+static std::vector<const char *> ruleFiles;
+static const char *rulesPcap = (const char *)0;
+
+static unsigned int contentionThreads = std::max(2U,std::min(64U,std::thread::hardware_concurrency()));
+
+static unsigned long rootPeers = ZT_BENCHMARK_ROOT_PEERS;
+
+static unsigned long busyPollSpin = 1000;
+
+static const char *replayPath = (const char *)0;
+static const char *replayHome = (const char *)0;
+static bool replayRealtime = false;
+
+// Written by benchmarks so that the compiler can't discard their work
+static volatile uint64_t benchSink = 0;
+
+static inline uint64_t nowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<typename F>
+static inline uint64_t timeBatch(F &f,const unsigned int ops)
+{
+	const uint64_t start = nowNs();
+	for(unsigned int i=0;i<ops;++i)
+		f();
+	return (nowNs() - start);
+}
+
+/**
+ * Print one JSON result object
+ *
+ * @param fmt printf() format of the object's members, without braces
+ */
+static void benchResult(const char *fmt,...)
+{
+	va_list ap;
+	printf("%s\n    {",(benchFirstResult) ? "" : ",");
+	va_start(ap,fmt);
+	vprintf(fmt,ap);
+	va_end(ap);
+	printf("}");
+	fflush(stdout);
+	benchFirstResult = false;
+}
+
+/**
+ * Run and report one benchmark
+ *
+ * @param name Benchmark name
+ * @param bytes Bytes processed per operation or 0 if not applicable
+ * @param f Function to call once per operation
+ */
+template<typename F>
+static void bench(const char *name,const unsigned int bytes,F f)
+{
+	if ((benchFilter)&&(!strstr(name,benchFilter)))
+		return;
+
+	// Calibrate the number of operations per sample
+	unsigned int ops = 1;
+	for(;;) {
+		const uint64_t t = timeBatch(f,ops);
+		if ((t >= ZT_BENCHMARK_MIN_SAMPLE_NS)||(ops >= 0x10000000))
+			break;
+		const uint64_t want = (t > 0) ? ((((uint64_t)ops * ZT_BENCHMARK_MIN_SAMPLE_NS) / t) + 1) : ((uint64_t)ops * 16);
+		ops = (unsigned int)std::min((uint64_t)0x10000000,std::max((uint64_t)ops * 2,want));
+	}
+
+	for(unsigned int s=0;s<benchWarmup;++s)
+		timeBatch(f,ops);
+
+	std::vector<double> perOp;
+	perOp.reserve(benchSamples);
+	for(unsigned int s=0;s<benchSamples;++s)
+		perOp.push_back((double)timeBatch(f,ops) / (double)ops);
+	std::sort(perOp.begin(),perOp.end());
+
+	const double median = (perOp.size() & 1) ? perOp[perOp.size() / 2] : ((perOp[(perOp.size() / 2) - 1] + perOp[perOp.size() / 2]) / 2.0);
+	const double p99 = perOp[std::min(perOp.size() - 1,(size_t)((perOp.size() * 99 + 99) / 100) - 1)];
+
+	char rate[64];
+	rate[0] = 0;
+	if ((bytes)&&(median > 0.0))
+		OSUtils::ztsnprintf(rate,sizeof(rate),",\"medianMiBPerSec\":%.2f",((double)bytes / (median / 1000000000.0)) / 1048576.0);
+	benchResult("\"name\":\"%s\",\"bytes\":%u,\"opsPerSample\":%u,\"samples\":%u,\"medianNs\":%.1f,\"p99Ns\":%.1f,\"minNs\":%.1f%s",name,bytes,ops,(unsigned int)perOp.size(),median,p99,perOp.front(),rate);
+}
+
+// Payload sizes: minimal frame, small frame, typical MTU, and bulk
+static const unsigned int benchPayloadSizes[4] = { 64,512,1400,8192 };
+
+static const uint8_t benchKey[32] = { 0x0f,0x62,0xb5,0x08,0x5b,0xae,0x01,0x54,0xa7,0xfa,0x4d,0xa0,0xf3,0x46,0x99,0xec,0x3f,0x92,0xe5,0x38,0x8b,0xde,0x31,0x84,0xd7,0x2a,0x7d,0xd0,0x23,0x76,0xc9,0x1c };
+static const uint8_t benchIv[8] = { 0x28,0x8f,0xf6,0x5d,0xc4,0x2b,0x92,0xf9 };
+
+static void benchSalsa20(uint8_t *buf)
+{
+	char name[64];
+	for(unsigned int k=0;k<4;++k) {
+		const unsigned int len = benchPayloadSizes[k];
+		Salsa20 s20(benchKey,benchIv);
+		OSUtils::ztsnprintf(name,sizeof(name),"salsa2012/%u",len);
+		bench(name,len,[&]() { s20.crypt12(buf,buf,len); });
+	}
+	benchSink += buf[0];
+}
+
+static void benchPoly1305(uint8_t *buf)
+{
+	char name[64];
+	uint8_t tag[16];
+	for(unsigned int k=0;k<4;++k) {
+		const unsigned int len = benchPayloadSizes[k];
+		OSUtils::ztsnprintf(name,sizeof(name),"poly1305/%u",len);
+		bench(name,len,[&]() { Poly1305::compute(tag,buf,len,benchKey); buf[0] ^= tag[0]; });
+	}
+	benchSink += buf[0];
+}
+
+// Builds a FRAME-like packet with a payload that is partly compressible
+static void makeBenchPacket(Packet &p,const unsigned int payloadLen)
+{
+	p.reset(Address(0x1122334455ULL),Address(0x5544332211ULL),Packet::VERB_FRAME);
+	for(unsigned int i=0;i<payloadLen;++i)
+		p.append((uint8_t)((i & 64) ? (i * 7) : (i & 15)));
+}
+
+static void benchArmor()
+{
+	char name[64];
+	for(unsigned int k=0;k<4;++k) {
+		const unsigned int len = benchPayloadSizes[k];
+		Packet p;
+		makeBenchPacket(p,len);
+		OSUtils::ztsnprintf(name,sizeof(name),"armor/%u",len);
+		bench(name,len,[&]() { p.armor(benchKey,true); });
+
+		// Dearmoring consumes the packet, so every operation starts from a
+		// copy of an armored one; the copy is included in the time.
+		makeBenchPacket(p,len);
+		p.armor(benchKey,true);
+		Packet tmp;
+		OSUtils::ztsnprintf(name,sizeof(name),"dearmor/%u",len);
+		bench(name,len,[&]() { tmp = p; benchSink += (uint64_t)tmp.dearmor(benchKey); });
+
+		// One recipient of a multicast fan-out: the shared packet is either
+		// copied whole and armored, or only its header is copied and the
+		// payload is armored straight from it as a tail.
+		makeBenchPacket(p,len);
+		OSUtils::ztsnprintf(name,sizeof(name),"fanout-copy/%u",len);
+		bench(name,len,[&]() { tmp = p; tmp.armor(benchKey,true); benchSink += tmp[ZT_PACKET_IDX_MAC]; });
+		OSUtils::ztsnprintf(name,sizeof(name),"fanout-tail/%u",len);
+		bench(name,len,[&]() {
+			Packet h(p.data(),ZT_PACKET_IDX_PAYLOAD);
+			h.armor(benchKey,true,p.field(ZT_PACKET_IDX_PAYLOAD,p.size() - ZT_PACKET_IDX_PAYLOAD),p.size() - ZT_PACKET_IDX_PAYLOAD);
+			benchSink += h[ZT_PACKET_IDX_MAC];
+		});
+
+		// The AES-256-GCM cipher suite, with whichever AES kernel is in use
+		const AES aes(benchKey);
+		makeBenchPacket(p,len);
+		OSUtils::ztsnprintf(name,sizeof(name),"armor-aes/%u",len);
+		bench(name,len,[&]() { p.armor(aes); });
+		makeBenchPacket(p,len);
+		p.armor(aes);
+		OSUtils::ztsnprintf(name,sizeof(name),"dearmor-aes/%u",len);
+		bench(name,len,[&]() { tmp = p; benchSink += (uint64_t)tmp.dearmor(benchKey,&aes); });
+	}
+}
+
+static void benchCompress()
+{
+	char name[64];
+	for(unsigned int k=1;k<4;++k) {
+		const unsigned int len = benchPayloadSizes[k];
+		Packet p,tmp;
+		makeBenchPacket(p,len);
+		OSUtils::ztsnprintf(name,sizeof(name),"lz4-compress/%u",len);
+		bench(name,len,[&]() { tmp = p; benchSink += (uint64_t)tmp.compress(); });
+
+		tmp = p;
+		tmp.compress();
+		Packet tmp2;
+		OSUtils::ztsnprintf(name,sizeof(name),"lz4-uncompress/%u",len);
+		bench(name,len,[&]() { tmp2 = tmp; benchSink += (uint64_t)tmp2.uncompress(); });
+
+		OSUtils::ztsnprintf(name,sizeof(name),"lz4-dict-compress/%u",len);
+		bench(name,len,[&]() { tmp = p; benchSink += (uint64_t)tmp.compress(true); });
+
+		tmp = p;
+		tmp.compress(true);
+		OSUtils::ztsnprintf(name,sizeof(name),"lz4-dict-uncompress/%u",len);
+		bench(name,len,[&]() { tmp2 = tmp; benchSink += (uint64_t)tmp2.uncompress(); });
+	}
+}
+
+static void benchIdentity()
+{
+	Identity a,b;
+	a.generate();
+	b.generate();
+	bench("identity-validate",0,[&]() { benchSink += (uint64_t)a.locallyValidate(); });
+
+	const C25519::Pair ka(C25519::generate());
+	const C25519::Pair kb(C25519::generate());
+	uint8_t key[64];
+	bench("c25519-agree",0,[&]() { C25519::agree(ka,kb.pub,key,sizeof(key)); benchSink += key[0]; });
+
+	uint8_t msg[256];
+	for(unsigned int i=0;i<sizeof(msg);++i)
+		msg[i] = (uint8_t)i;
+	C25519::Signature sig;
+	bench("ed25519-sign/256",sizeof(msg),[&]() { sig = C25519::sign(ka,msg,sizeof(msg)); benchSink += sig.data[0]; });
+	sig = C25519::sign(ka,msg,sizeof(msg));
+	bench("ed25519-verify/256",sizeof(msg),[&]() { benchSink += (uint64_t)C25519::verify(ka.pub,msg,sizeof(msg),sig); });
+
+	// Each backend this build and CPU support, the one in use above included
+	char name[64];
+	const C25519::Backend bestBackend = C25519::backend();
+	for(int b=(int)C25519::BACKEND_REF;b<=(int)C25519::BACKEND_AMD64;++b) {
+		if (!C25519::setBackend((C25519::Backend)b))
+			continue;
+		const char *const bn = C25519::backendName((C25519::Backend)b);
+		OSUtils::ztsnprintf(name,sizeof(name),"c25519-agree/%s",bn);
+		bench(name,0,[&]() { C25519::agree(ka,kb.pub,key,sizeof(key)); benchSink += key[0]; });
+		OSUtils::ztsnprintf(name,sizeof(name),"ed25519-sign/256/%s",bn);
+		bench(name,sizeof(msg),[&]() { sig = C25519::sign(ka,msg,sizeof(msg)); benchSink += sig.data[0]; });
+		OSUtils::ztsnprintf(name,sizeof(name),"ed25519-verify/256/%s",bn);
+		bench(name,sizeof(msg),[&]() { benchSink += (uint64_t)C25519::verify(ka.pub,msg,sizeof(msg),sig); });
+	}
+	C25519::setBackend(bestBackend);
+}
+
+// Hash as the previous chained Hashtable did, to compare against it with a
+// node-per-entry std::unordered_map
+template<typename K>
+struct BenchChainedHash
+{
+	inline std::size_t operator()(const K &k) const { return (std::size_t)k.hashCode(); }
+};
+template<>
+struct BenchChainedHash<uint64_t>
+{
+	inline std::size_t operator()(const uint64_t i) const { return (std::size_t)(i ^ (i >> 32)); }
+};
+
+template<typename K>
+static void benchHashtableKeys(const char *keyName,const std::vector<K> &keys,const std::vector<K> &missing)
+{
+	char name[64];
+	const std::size_t n = keys.size();
+
+	Hashtable<K,uint64_t> ht;
+	std::unordered_map< K,uint64_t,BenchChainedHash<K> > um;
+	for(std::size_t i=0;i<n;++i) {
+		ht.set(keys[i],(uint64_t)i);
+		um[keys[i]] = (uint64_t)i;
+	}
+
+	std::size_t c = 0;
+	OSUtils::ztsnprintf(name,sizeof(name),"hashtable-get/%s",keyName);
+	bench(name,0,[&]() { const uint64_t *v = ht.get(keys[c]); benchSink += (v) ? *v : 0; if (++c == n) c = 0; });
+	OSUtils::ztsnprintf(name,sizeof(name),"chained-get/%s",keyName);
+	bench(name,0,[&]() { typename std::unordered_map< K,uint64_t,BenchChainedHash<K> >::const_iterator v(um.find(keys[c])); benchSink += (v != um.end()) ? v->second : 0; if (++c == n) c = 0; });
+
+	OSUtils::ztsnprintf(name,sizeof(name),"hashtable-miss/%s",keyName);
+	bench(name,0,[&]() { benchSink += (uint64_t)ht.contains(missing[c]); if (++c == n) c = 0; });
+	OSUtils::ztsnprintf(name,sizeof(name),"chained-miss/%s",keyName);
+	bench(name,0,[&]() { benchSink += (uint64_t)um.count(missing[c]); if (++c == n) c = 0; });
+
+	OSUtils::ztsnprintf(name,sizeof(name),"hashtable-set-erase/%s",keyName);
+	bench(name,0,[&]() { ht.set(missing[c],1); ht.erase(missing[c]); if (++c == n) c = 0; });
+	OSUtils::ztsnprintf(name,sizeof(name),"chained-set-erase/%s",keyName);
+	bench(name,0,[&]() { um[missing[c]] = 1; um.erase(missing[c]); if (++c == n) c = 0; });
+
+	// One operation is a walk over every entry
+	OSUtils::ztsnprintf(name,sizeof(name),"hashtable-iterate/%s",keyName);
+	bench(name,0,[&]() {
+		typename Hashtable<K,uint64_t>::Iterator i(ht);
+		K *k = (K *)0;
+		uint64_t *v = (uint64_t *)0;
+		uint64_t sum = 0;
+		while (i.next(k,v))
+			sum += *v;
+		benchSink += sum;
+	});
+	OSUtils::ztsnprintf(name,sizeof(name),"chained-iterate/%s",keyName);
+	bench(name,0,[&]() {
+		uint64_t sum = 0;
+		for(typename std::unordered_map< K,uint64_t,BenchChainedHash<K> >::const_iterator i(um.begin());i!=um.end();++i)
+			sum += i->second;
+		benchSink += sum;
+	});
+}
+
+/*
+ * Hash tables: Hashtable against a chained, node-per-entry table with the
+ * same hash the old Hashtable used, for the key types the core uses most.
+ * Each has ZT_BENCHMARK_HASHTABLE_ENTRIES entries; misses and set/erase use
+ * keys that are not in the table.
+ */
+static void benchHashtable()
+{
+	std::vector<Address> addrs,addrsMissing;
+	std::vector<Path::HashKey> paths,pathsMissing;
+	std::vector<uint64_t> nwids,nwidsMissing;
+	for(unsigned int i=0;i<(ZT_BENCHMARK_HASHTABLE_ENTRIES * 2);++i) {
+		uint64_t r[2];
+		Utils::getSecureRandom(r,sizeof(r));
+		const bool miss = (i & 1) != 0;
+		(miss ? addrsMissing : addrs).push_back(Address(r[0] & 0xffffffffffULL));
+		// Realistic paths: IPv4 endpoints in a few /16s on the default port or nearby ones
+		const InetAddress ip(Utils::hton((uint32_t)(0x0a000000 | ((uint32_t)r[1] & 0x0003ffff))),9993 + (unsigned int)((r[1] >> 32) % 4));
+		(miss ? pathsMissing : paths).push_back(Path::HashKey((int64_t)((r[1] >> 40) & 3),ip));
+		// Network IDs: a handful of controllers, each with sequential network numbers
+		(miss ? nwidsMissing : nwids).push_back(((r[0] >> 40) & 0xf) << 24 | (uint64_t)(i >> 1) | ((uint64_t)miss << 23));
+	}
+
+	benchHashtableKeys("address",addrs,addrsMissing);
+	benchHashtableKeys("path",paths,pathsMissing);
+	benchHashtableKeys("nwid",nwids,nwidsMissing);
+
+	// Worst single insert while growing a table from empty, which is what a
+	// caller holding a lock around the table actually waits for
+	if ((!benchFilter)||(strstr("hashtable-grow",benchFilter))) {
+		Hashtable<Address,uint64_t> ht;
+		uint64_t worst = 0,total = 0;
+		for(unsigned int i=0;i<(ZT_BENCHMARK_HASHTABLE_ENTRIES * 10);++i) {
+			const Address a((uint64_t)i * 0x9e3779b1ULL);
+			const uint64_t t = nowNs();
+			ht.set(a,i);
+			const uint64_t dt = nowNs() - t;
+			total += dt;
+			worst = std::max(worst,dt);
+		}
+		benchResult("\"name\":\"hashtable-grow\",\"entries\":%lu,\"meanNs\":%.1f,\"maxNs\":%llu",ht.size(),(double)total / (double)ht.size(),(unsigned long long)worst);
+	}
+}
+
+// Minimal host for a Node: everything it sends is dropped, and there is no
+// stored state unless a BenchHost is given as the user pointer, which can
+// supply a moon and remembers the last HELLO the node sent
+struct BenchHost
+{
+	BenchHost() : lastHelloId(0) {}
+	std::string moon;
+	uint64_t lastHelloId;
+};
+static int benchStateGet(ZT_Node *,void *uptr,void *,enum ZT_StateObjectType type,const uint64_t [2],void *data,unsigned int maxlen)
+{
+	const BenchHost *const host = reinterpret_cast<const BenchHost *>(uptr);
+	if ((host)&&(type == ZT_STATE_OBJECT_MOON)&&(host->moon.length() > 0)&&(host->moon.length() <= maxlen)) {
+		memcpy(data,host->moon.data(),host->moon.length());
+		return (int)host->moon.length();
+	}
+	return -1;
+}
+static void benchStatePut(ZT_Node *,void *,void *,enum ZT_StateObjectType,const uint64_t [2],const void *,int) {}
+static int benchWireSend(ZT_Node *,void *uptr,void *,int64_t,const struct sockaddr_storage *,const void *data,unsigned int len,unsigned int)
+{
+	BenchHost *const host = reinterpret_cast<BenchHost *>(uptr);
+	if ((host)&&(len >= ZT_PROTO_MIN_PACKET_LENGTH)&&((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_VERB] & 0x1f) == Packet::VERB_HELLO)) // HELLO is never encrypted
+		host->lastHelloId = Utils::ntoh(*reinterpret_cast<const uint64_t *>(data));
+	return 0;
+}
+static void benchFrame(ZT_Node *,void *,void *,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *,unsigned int) {}
+static int benchNetworkConfig(ZT_Node *,void *,void *,uint64_t,void **,enum ZT_VirtualNetworkConfigOperation,const ZT_VirtualNetworkConfig *) { return 0; }
+static void benchEvent(ZT_Node *,void *,void *,enum ZT_Event,const void *) {}
+
+// Creates a Node with the callbacks above, or returns NULL on failure
+static ZT_Node *benchNewNode(void *host,const int64_t now,ZT_WirePacketSendFunction wireSend = benchWireSend)
+{
+	ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.stateGetFunction = benchStateGet;
+	cb.statePutFunction = benchStatePut;
+	cb.wirePacketSendFunction = wireSend;
+	cb.virtualNetworkFrameFunction = benchFrame;
+	cb.virtualNetworkConfigFunction = benchNetworkConfig;
+	cb.eventCallback = benchEvent;
+	ZT_Node *node = (ZT_Node *)0;
+	if (ZT_Node_new(&node,host,(void *)0,&cb,now) != ZT_RESULT_OK)
+		return (ZT_Node *)0;
+	return node;
+}
+
+// Makes an identity with a random address and self's public key. These are
+// not validated, so peers can share one public key and skip key agreement,
+// which would otherwise dominate setup time. Returns false if the address
+// is reserved.
+static bool benchSyntheticIdentity(const Identity &self,Identity &id)
+{
+	char pub[ZT_C25519_PUBLIC_KEY_LEN * 2 + 1];
+	Utils::hex(self.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN,pub);
+	uint64_t a = 0;
+	Utils::getSecureRandom(&a,sizeof(a));
+	char ids[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+	OSUtils::ztsnprintf(ids,sizeof(ids),"%.10llx:0:%s",(unsigned long long)(a & 0xffffffffffULL),pub);
+	return id.fromString(ids);
+}
+
+// Introduces a peer to a Node with a HELLO, just as it would arrive on the wire
+static void benchHello(ZT_Node *node,const Identity &nodeId,const Identity &pid,const uint8_t key[ZT_PEER_SECRET_KEY_LENGTH],const InetAddress &from,int64_t now)
+{
+	volatile int64_t nextDeadline = 0;
+	Packet hello(nodeId.address(),pid.address(),Packet::VERB_HELLO);
+	hello.append((unsigned char)ZT_PROTO_VERSION);
+	hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+	hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+	hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+	hello.append((uint64_t)now);
+	pid.serialize(hello,false);
+	hello.armor(key,false);
+	ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&from),hello.data(),hello.size(),&nextDeadline);
+}
+
+// A network config as a controller would issue it to a member of a mid-sized
+// private network: a few routes and addresses, a rule set, capabilities, tags
+// and a signed certificate of membership
+static void benchMakeConfig(NetworkConfig &nc,const Identity &controller,const Identity &member,const int64_t now)
+{
+	nc.networkId = (controller.address().toInt() << 24) | 0x000001ULL;
+	nc.timestamp = now;
+	nc.credentialTimeMaxDelta = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+	nc.revision = 1234;
+	nc.issuedTo = member.address();
+	nc.flags = ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
+	nc.type = ZT_NETWORK_TYPE_PRIVATE;
+	nc.mtu = ZT_DEFAULT_MTU;
+	nc.multicastLimit = 32;
+	Utils::scopy(nc.name,sizeof(nc.name),"benchmark-network");
+
+	for(unsigned int i=0;i<4;++i) {
+		*reinterpret_cast<InetAddress *>(&(nc.routes[i].target)) = InetAddress(Utils::hton((uint32_t)(0x0a930000 + (i << 8))),24);
+		nc.routes[i].flags = 0;
+		nc.routes[i].metric = (uint16_t)i;
+	}
+	nc.routeCount = 4;
+	nc.staticIps[0] = InetAddress("10.147.17.23/24");
+	nc.staticIps[1] = InetAddress("fd80:56c2:e21c:0:199:9382:e3b6:5e9b/88");
+	nc.staticIpCount = 2;
+	nc.specialists[0] = controller.address().toInt() | ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE;
+	nc.specialistCount = 1;
+
+	ZT_VirtualNetworkRule *r = nc.rules;
+	static const uint16_t etherTypes[3] = { ZT_ETHERTYPE_IPV4,ZT_ETHERTYPE_ARP,ZT_ETHERTYPE_IPV6 };
+	for(unsigned int i=0;i<3;++i) {
+		r->t = 0x80 | ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+		(r++)->v.etherType = etherTypes[i];
+	}
+	(r++)->t = ZT_NETWORK_RULE_ACTION_DROP;
+	for(unsigned int i=0;i<8;++i) {
+		r->t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+		(r++)->v.ipProtocol = 0x06;
+		r->t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+		r->v.port[0] = r->v.port[1] = (uint16_t)(20 + (i * 1000));
+		++r;
+		(r++)->t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+	}
+	(r++)->t = ZT_NETWORK_RULE_ACTION_DROP;
+	nc.ruleCount = (unsigned int)(r - nc.rules);
+
+	for(unsigned int i=0;i<4;++i) {
+		ZT_VirtualNetworkRule cr[6];
+		memset(cr,0,sizeof(cr));
+		cr[0].t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+		cr[0].v.ipProtocol = 0x06;
+		cr[1].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+		cr[1].v.port[0] = 22;
+		cr[1].v.port[1] = (uint16_t)(22 + i);
+		cr[2].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		cr[3].t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+		cr[3].v.ipProtocol = 0x11;
+		cr[4].t = ZT_NETWORK_RULE_MATCH_TAGS_EQUAL;
+		cr[4].v.tag.id = i;
+		cr[4].v.tag.value = 1;
+		cr[5].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		nc.capabilities[i] = Capability(1000 + i,nc.networkId,now,1,cr,6);
+		nc.capabilities[i].sign(controller,member.address());
+	}
+	nc.capabilityCount = 4;
+	for(unsigned int i=0;i<8;++i) {
+		nc.tags[i] = Tag(nc.networkId,now,member.address(),i,(i & 1) ? 1 : 0);
+		nc.tags[i].sign(controller);
+	}
+	nc.tagCount = 8;
+
+	nc.com = CertificateOfMembership(now,nc.credentialTimeMaxDelta,nc.networkId,member.address());
+	nc.com.sign(controller);
+}
+
+/*
+ * Serialization and the small structures every hot path is built from:
+ * Buffer, Dictionary and InetAddress, network configs as members receive
+ * them, and the credentials (COM, Capability, Tag) carried in them and in
+ * NETWORK_CREDENTIALS packets.
+ */
+static void benchSerialization()
+{
+	// Build a packet-sized buffer of mixed fields and read it back
+	Buffer<ZT_PROTO_MAX_PACKET_LENGTH> *const b = new Buffer<ZT_PROTO_MAX_PACKET_LENGTH>();
+	uint8_t blob[64];
+	Utils::getSecureRandom(blob,sizeof(blob));
+	bench("buffer-append/1400",1400,[&]() {
+		b->clear();
+		while (b->size() < 1400) {
+			b->append((uint8_t)0x01);
+			b->append((uint16_t)0x0203);
+			b->append((uint32_t)0x04050607);
+			b->append((uint64_t)0x08090a0b0c0d0e0fULL);
+			b->append(blob,13);
+		}
+		benchSink += b->size();
+	});
+	bench("buffer-at/1400",1400,[&]() {
+		uint64_t sum = 0;
+		for(unsigned int i=0;(i+28)<=b->size();i+=28)
+			sum += (uint64_t)(*b)[i] + b->at<uint16_t>(i + 1) + b->at<uint32_t>(i + 3) + b->at<uint64_t>(i + 7);
+		benchSink += sum;
+	});
+	delete b;
+
+	// A dictionary of the size and mix of keys of a small config or meta-data
+	static const char *const dkeys[16] = { "v","nwid","ts","r","id","f","mtu","ml","t","n","C","R","I","A","S","ctmd" };
+	Dictionary<4096> *const d = new Dictionary<4096>();
+	bench("dictionary-add/16",0,[&]() {
+		d->clear();
+		for(unsigned int i=0;i<14;++i)
+			d->add(dkeys[i],(uint64_t)(0x8056c2e21c000001ULL + i));
+		d->add(dkeys[14],"some value with = and \\n escapes\n");
+		d->add(dkeys[15],reinterpret_cast<const char *>(blob),(int)sizeof(blob));
+		benchSink += d->sizeBytes();
+	});
+	char dv[256];
+	unsigned int dk = 0;
+	bench("dictionary-get/16",0,[&]() {
+		benchSink += d->getUI(dkeys[dk & 7]) + (uint64_t)d->get(dkeys[8 + (dk & 7)],dv,sizeof(dv));
+		++dk;
+	});
+	delete d;
+
+	static const char *const ipStrings[4] = { "10.147.17.23/9993","192.168.195.4/44123","fd80:56c2:e21c:0:199:9382:e3b6:5e9b/9993","2001:db8:1234::17/9993" };
+	InetAddress ips[4];
+	unsigned int ipi = 0;
+	bench("inetaddress-parse",0,[&]() { benchSink += (uint64_t)ips[ipi & 3].fromString(ipStrings[ipi & 3]); ++ipi; });
+	bench("inetaddress-compare",0,[&]() {
+		const InetAddress &a = ips[ipi & 3];
+		const InetAddress &b = ips[(ipi >> 2) & 3];
+		benchSink += (uint64_t)(a == b) + (uint64_t)(a < b) + (uint64_t)a.ipsEqual(b);
+		++ipi;
+	});
+	bench("inetaddress-hash",0,[&]() { benchSink += ips[ipi & 3].hashCode(); ++ipi; });
+
+	Identity controller,member;
+	controller.generate(0);
+	member.generate(0);
+	const int64_t now = OSUtils::now();
+	NetworkConfig *const nc = new NetworkConfig();
+	NetworkConfig *const nc2 = new NetworkConfig();
+	Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *const ncd = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	benchMakeConfig(*nc,controller,member,now);
+	nc->toDictionary(*ncd,false);
+	const unsigned int ncBytes = ncd->sizeBytes();
+	bench("netconf-to-dictionary",ncBytes,[&]() { benchSink += (uint64_t)nc->toDictionary(*ncd,false); });
+	bench("netconf-from-dictionary",ncBytes,[&]() { benchSink += (uint64_t)nc2->fromDictionary(*ncd); });
+
+	// A peer's COM checked against ours, as on every frame from a private network member
+	CertificateOfMembership theirs(now - 1000,nc->credentialTimeMaxDelta,nc->networkId,Address(0x1122334455ULL));
+	theirs.sign(controller);
+	bench("com-agrees",0,[&]() { benchSink += (uint64_t)nc->com.agreesWith(theirs); });
+
+	Buffer<ZT_PROTO_MAX_PACKET_LENGTH> *const cb = new Buffer<ZT_PROTO_MAX_PACKET_LENGTH>();
+	nc->com.serialize(*cb);
+	const unsigned int comBytes = cb->size();
+	CertificateOfMembership com2;
+	bench("com-serialize",comBytes,[&]() { cb->clear(); nc->com.serialize(*cb); benchSink += cb->size(); });
+	bench("com-deserialize",comBytes,[&]() { benchSink += com2.deserialize(*cb,0); });
+
+	cb->clear();
+	nc->capabilities[0].serialize(*cb);
+	const unsigned int capBytes = cb->size();
+	Capability *const cap2 = new Capability();
+	bench("capability-serialize",capBytes,[&]() { cb->clear(); nc->capabilities[0].serialize(*cb); benchSink += cb->size(); });
+	bench("capability-deserialize",capBytes,[&]() { benchSink += cap2->deserialize(*cb,0); });
+	delete cap2;
+
+	cb->clear();
+	nc->tags[0].serialize(*cb);
+	const unsigned int tagBytes = cb->size();
+	Tag tag2;
+	bench("tag-serialize",tagBytes,[&]() { cb->clear(); nc->tags[0].serialize(*cb); benchSink += cb->size(); });
+	bench("tag-deserialize",tagBytes,[&]() { benchSink += tag2.deserialize(*cb,0); });
+
+	delete cb;
+	delete ncd;
+	delete nc2;
+	delete nc;
+}
+
+/*
+ * Receive processing scaling: N threads feed authenticated NOP packets from
+ * N different peers (each at its own remote address, as sharding in
+ * OneService would arrange) into one Node, and total packets per second is
+ * reported for each thread count. This exercises dearmoring and the locks
+ * taken on the receive path (Topology, Path, Peer) under contention.
+ */
+static void benchNodeRx()
+{
+	static const unsigned int threadCounts[4] = { 1,2,4,8 };
+	if ((benchFilter)&&(!strstr("node-rx",benchFilter)))
+		return;
+
+	int64_t now = OSUtils::now();
+	ZT_Node *const node = benchNewNode((void *)0,now);
+	if (!node)
+		return;
+	ZT_NodeStatus st;
+	ZT_Node_status(node,&st);
+	const Identity nodeId(st.publicIdentity);
+
+	const unsigned int maxThreads = threadCounts[3];
+	std::vector<Packet> nops(maxThreads);
+	std::vector<InetAddress> from(maxThreads);
+	for(unsigned int t=0;t<maxThreads;++t) {
+		Identity pid;
+		pid.generate(0);
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		pid.agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+		from[t] = InetAddress(Utils::hton((uint32_t)(0x0a000001 + ((t + 1) << 8))),9993); // distinct /24s, see InetAddress::rateGateHash()
+		benchHello(node,nodeId,pid,key,from[t],now);
+
+		nops[t].reset(nodeId.address(),pid.address(),Packet::VERB_NOP);
+		for(unsigned int i=0;i<64;++i)
+			nops[t].append((uint8_t)i);
+		nops[t].armor(key,true);
+	}
+
+	for(unsigned int k=0;k<4;++k) {
+		const unsigned int threads = threadCounts[k];
+		std::atomic_bool go(false),stop(false);
+		std::vector<uint64_t> counts(threads,0);
+		std::vector<std::thread> workers;
+		for(unsigned int t=0;t<threads;++t) {
+			workers.push_back(std::thread([&,t]() {
+				volatile int64_t dl = 0;
+				const Packet &p = nops[t];
+				const struct sockaddr_storage *const fa = reinterpret_cast<const struct sockaddr_storage *>(&(from[t]));
+				uint64_t c = 0;
+				while (!go)
+					std::this_thread::yield();
+				while (!stop) {
+					ZT_Node_processWirePacket(node,(void *)0,now,1,fa,p.data(),p.size(),&dl);
+					++c;
+				}
+				counts[t] = c;
+			}));
+		}
+		const uint64_t start = nowNs();
+		go = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_NODE_RX_MS));
+		stop = true;
+		for(std::vector<std::thread>::iterator w(workers.begin());w!=workers.end();++w)
+			w->join();
+		const uint64_t elapsed = nowNs() - start;
+
+		uint64_t total = 0;
+		for(unsigned int t=0;t<threads;++t)
+			total += counts[t];
+		benchResult("\"name\":\"node-rx/%ut\",\"threads\":%u,\"bytes\":%u,\"packets\":%llu,\"packetsPerSec\":%.0f",threads,threads,nops[0].size(),(unsigned long long)total,(double)total / ((double)elapsed / 1000000000.0));
+	}
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Relaying: a Node that is a root of a moon (so it relays for anyone) is
+ * fed packets from one peer addressed to another, and relayed packets per
+ * second and the relay path cache hit rate are reported.
+ */
+static void benchRelay()
+{
+	if ((benchFilter)&&(!strstr("relay",benchFilter)))
+		return;
+
+	BenchHost host;
+	int64_t now = OSUtils::now();
+	ZT_Node *const node = benchNewNode((void *)&host,now);
+	if (!node)
+		return;
+	ZT_NodeStatus st;
+	ZT_Node_status(node,&st);
+	const Identity nodeId(st.publicIdentity);
+
+	const uint64_t moonId = 0x00000000deadbeefULL;
+	{
+		std::vector<World::Root> roots;
+		roots.push_back(World::Root());
+		roots.back().identity = nodeId;
+		const C25519::Pair kp(C25519::generate());
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> tmp;
+		World::make(World::TYPE_MOON,moonId,(uint64_t)now,kp.pub,roots,kp).serialize(tmp,false);
+		host.moon.assign((const char *)tmp.data(),tmp.size());
+	}
+	ZT_Node_orbit(node,(void *)0,moonId,0);
+
+	Identity a,b;
+	a.generate(0);
+	b.generate(0);
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+	const InetAddress fromA(Utils::hton((uint32_t)0x0a000101),9993),fromB(Utils::hton((uint32_t)0x0a000201),9993);
+	a.agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+	benchHello(node,nodeId,a,key,fromA,now);
+	b.agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+	host.lastHelloId = 0;
+	benchHello(node,nodeId,b,key,fromB,now);
+	if (host.lastHelloId) {
+		// Answer the node's HELLO back to B so it learns B's path
+		volatile int64_t dl = 0;
+		Packet ok(nodeId.address(),b.address(),Packet::VERB_OK);
+		ok.append((unsigned char)Packet::VERB_HELLO);
+		ok.append(host.lastHelloId);
+		ok.append((uint64_t)now);
+		ok.append((unsigned char)ZT_PROTO_VERSION);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok.armor(key,true);
+		ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&fromB),ok.data(),ok.size(),&dl);
+	}
+
+	a.agree(b,key,ZT_PEER_SECRET_KEY_LENGTH);
+	Packet p(b.address(),a.address(),Packet::VERB_NOP);
+	for(unsigned int i=0;i<64;++i)
+		p.append((uint8_t)i);
+	p.armor(key,true);
+
+	uint64_t r0,h0,m0;
+	reinterpret_cast<Node *>(node)->relayStats(r0,h0,m0);
+	volatile int64_t dl = 0;
+	uint64_t c = 0;
+	const uint64_t start = nowNs();
+	const uint64_t end = start + ((uint64_t)ZT_BENCHMARK_NODE_RX_MS * 1000000ULL);
+	uint64_t t;
+	do {
+		for(unsigned int i=0;i<256;++i)
+			ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&fromA),p.data(),p.size(),&dl);
+		c += 256;
+	} while ((t = nowNs()) < end);
+	const uint64_t elapsed = t - start;
+	uint64_t r,h,m;
+	reinterpret_cast<Node *>(node)->relayStats(r,h,m);
+	r -= r0; h -= h0; m -= m0;
+
+	benchResult("\"name\":\"relay\",\"bytes\":%u,\"packets\":%llu,\"relayed\":%llu,\"relayedPerSec\":%.0f,\"cacheHitRate\":%.4f",p.size(),(unsigned long long)c,(unsigned long long)r,(double)r / ((double)elapsed / 1000000000.0),((h + m) > 0) ? ((double)h / (double)(h + m)) : 0.0);
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * HELLO storm: a node gets HELLOs from new peers, each followed by a burst
+ * of packets from a peer it already knows, once with key agreement and
+ * identity validation done inline and once with crypto worker threads.
+ * Reported are the time the receiving thread spent per HELLO, the longest
+ * single call into the node, and how many of the new peers were learned.
+ */
+static void benchHelloStorm()
+{
+	static const unsigned int workerCounts[2] = { 0,4 };
+	if ((benchFilter)&&(!strstr("hello-storm",benchFilter)))
+		return;
+
+	std::vector<Identity> ids(ZT_BENCHMARK_HELLO_STORM_PEERS);
+	for(std::vector<Identity>::iterator i(ids.begin());i!=ids.end();++i)
+		i->generate(0);
+	Identity known;
+	known.generate(0);
+
+	for(unsigned int w=0;w<2;++w) {
+		int64_t now = OSUtils::now();
+		ZT_Node *const node = benchNewNode((void *)0,now);
+		if (!node)
+			return;
+		ZT_NodeStatus st;
+		ZT_Node_status(node,&st);
+		const Identity nodeId(st.publicIdentity);
+
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		const InetAddress fromKnown("fd00::1/9993"); // IPv6 so its validation doesn't rate limit any of the IPv4 prefixes below
+		known.agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+		benchHello(node,nodeId,known,key,fromKnown,now);
+		Packet nop(nodeId.address(),known.address(),Packet::VERB_NOP);
+		nop.append((uint64_t)0);
+		nop.armor(key,true);
+
+		// HELLOs are built ahead of time so only the node's side is timed
+		std::vector<Packet> hellos(ids.size());
+		for(unsigned int i=0;i<(unsigned int)ids.size();++i) {
+			Packet &h = hellos[i];
+			h.reset(nodeId.address(),ids[i].address(),Packet::VERB_HELLO);
+			h.append((unsigned char)ZT_PROTO_VERSION);
+			h.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+			h.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+			h.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			h.append((uint64_t)now);
+			ids[i].serialize(h,false);
+			ids[i].agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+			h.armor(key,false);
+		}
+
+		ZT_Node_setCryptoWorkers(node,workerCounts[w]);
+		volatile int64_t dl = 0;
+		uint64_t worst = 0;
+		const uint64_t start = nowNs();
+		for(unsigned int i=0;i<(unsigned int)hellos.size();++i) {
+			// Each HELLO from its own /24 so the per-prefix validation rate limit doesn't apply
+			const InetAddress from(Utils::hton((uint32_t)(0x0b000001 + (i << 8))),9993);
+			uint64_t t = nowNs();
+			ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&from),hellos[i].data(),hellos[i].size(),&dl);
+			worst = std::max(worst,nowNs() - t);
+			for(unsigned int k=0;k<ZT_BENCHMARK_HELLO_STORM_BURST;++k) {
+				t = nowNs();
+				ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&fromKnown),nop.data(),nop.size(),&dl);
+				worst = std::max(worst,nowNs() - t);
+			}
+		}
+		const uint64_t ioNs = nowNs() - start;
+
+		// Wait up to a few seconds for the workers to finish
+		unsigned long learned = 0;
+		for(unsigned int k=0;k<5000;++k) {
+			ZT_Node_processBackgroundTasks(node,(void *)0,now,&dl);
+			learned = 0;
+			ZT_PeerList *const pl = ZT_Node_peers(node);
+			if (pl) {
+				for(unsigned long p=0;p<pl->peerCount;++p) {
+					for(std::vector<Identity>::const_iterator i(ids.begin());i!=ids.end();++i) {
+						if (i->address().toInt() == pl->peers[p].address) {
+							++learned;
+							break;
+						}
+					}
+				}
+				ZT_Node_freeQueryResult(node,pl);
+			}
+			if (learned == (unsigned long)ids.size())
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		const uint64_t totalNs = nowNs() - start;
+
+		benchResult("\"name\":\"hello-storm\",\"workers\":%u,\"hellos\":%u,\"burst\":%u,\"ioMsPerHello\":%.3f,\"maxCallUs\":%.1f,\"learned\":%lu,\"seconds\":%.3f",workerCounts[w],(unsigned int)ids.size(),(unsigned int)ZT_BENCHMARK_HELLO_STORM_BURST,((double)ioNs / 1000000.0) / (double)ids.size(),(double)worst / 1000.0,learned,(double)totalNs / 1000000000.0);
+
+		ZT_Node_delete(node);
+	}
+}
+
+/*
+ * Peer table contention: a Topology holding a few hundred thousand peers
+ * is hit with lookups of random known addresses from several threads while
+ * one more thread walks the whole table with eachPeer() as the periodic
+ * tasks do. Lookups per second and full walks completed are reported for
+ * each lookup thread count.
+ */
+static void benchTopology()
+{
+	static const unsigned int threadCounts[4] = { 1,2,4,8 };
+	if ((benchFilter)&&(!strstr("topology",benchFilter)))
+		return;
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	{
+		// A private Topology so the node's own background work doesn't interfere
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		env.identity.generate(0);
+		Topology topo(&env,(void *)0);
+
+		// Peers share one public key and agreed key (see benchSyntheticIdentity())
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		std::vector<Address> addrs;
+		addrs.reserve(ZT_BENCHMARK_TOPOLOGY_PEERS);
+		while (addrs.size() < ZT_BENCHMARK_TOPOLOGY_PEERS) {
+			Identity pid;
+			if (!benchSyntheticIdentity(env.identity,pid))
+				continue;
+			topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,pid,key)));
+			addrs.push_back(pid.address());
+		}
+
+		for(unsigned int k=0;k<4;++k) {
+			const unsigned int threads = threadCounts[k];
+			std::atomic_bool go(false),stop(false);
+			std::vector<uint64_t> counts(threads,0);
+			uint64_t walks = 0;
+			std::vector<std::thread> workers;
+			for(unsigned int t=0;t<threads;++t) {
+				workers.push_back(std::thread([&,t]() {
+					uint64_t c = 0,found = 0,r = (uint64_t)t + 1;
+					while (!go)
+						std::this_thread::yield();
+					while (!stop) {
+						for(unsigned int i=0;i<64;++i) {
+							r ^= r << 13; r ^= r >> 7; r ^= r << 17; // xorshift64
+							if (topo.getPeerNoCache(addrs[(size_t)(r % addrs.size())]))
+								++found;
+						}
+						c += 64;
+					}
+					counts[t] = c;
+					benchSink += found;
+				}));
+			}
+			workers.push_back(std::thread([&]() {
+				while (!go)
+					std::this_thread::yield();
+				while (!stop) {
+					uint64_t alive = 0;
+					topo.eachPeer([&alive](Topology &t,const SharedPtr<Peer> &p) {
+						if (p->lastReceive())
+							++alive;
+					});
+					benchSink += alive;
+					++walks;
+				}
+			}));
+			const uint64_t start = nowNs();
+			go = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_NODE_RX_MS));
+			stop = true;
+			for(std::vector<std::thread>::iterator w(workers.begin());w!=workers.end();++w)
+				w->join();
+			const uint64_t elapsed = nowNs() - start;
+
+			uint64_t total = 0;
+			for(unsigned int t=0;t<threads;++t)
+				total += counts[t];
+			benchResult("\"name\":\"topology/%ut\",\"threads\":%u,\"peers\":%lu,\"lookups\":%llu,\"lookupsPerSec\":%.0f,\"walks\":%llu",threads,threads,topo.peerCount(),(unsigned long long)total,(double)total / ((double)elapsed / 1000000000.0),(unsigned long long)walks);
+		}
+	}
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Peer tiering: a Topology full of idle peers is demoted to cold records by
+ * its periodic tasks, then every peer is looked up again, rebuilding it from
+ * its record. Memory before and after demotion and the time to promote a
+ * peer are reported.
+ */
+static void benchPeerTiering()
+{
+	if ((benchFilter)&&(!strstr("peer-tiering",benchFilter)))
+		return;
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	{
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		env.identity.generate(0);
+		Topology topo(&env,(void *)0);
+		topo.setColdPeerTimeout(ZT_PEER_COLD_TIMEOUT_MIN);
+
+		// Shared public key as in the topology benchmark
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		std::vector<Address> addrs;
+		addrs.reserve(ZT_BENCHMARK_TIERING_PEERS);
+		while (addrs.size() < ZT_BENCHMARK_TIERING_PEERS) {
+			Identity pid;
+			if (!benchSyntheticIdentity(env.identity,pid))
+				continue;
+			topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,pid,key)));
+			addrs.push_back(pid.address());
+		}
+
+		ZT_MemoryUsage hot;
+		memset(&hot,0,sizeof(hot));
+		topo.memoryUsage(&hot);
+
+		// New peers were last heard from at time 0, so at this time they are idle but not yet dead
+		const uint64_t ds = nowNs();
+		topo.doPeriodicTasks((void *)0,ZT_PEER_ACTIVITY_TIMEOUT / 2);
+		const uint64_t demoteNs = nowNs() - ds;
+		ZT_MemoryUsage cold;
+		memset(&cold,0,sizeof(cold));
+		topo.memoryUsage(&cold);
+
+		uint64_t promoted = 0;
+		const uint64_t ps = nowNs();
+		for(std::vector<Address>::const_iterator a(addrs.begin());a!=addrs.end();++a) {
+			if (topo.getPeer((void *)0,*a))
+				++promoted;
+		}
+		const uint64_t promoteNs = nowNs() - ps;
+
+		benchResult("\"name\":\"peer-tiering\",\"peers\":%lu,\"hotBytes\":%llu,\"coldPeers\":%llu,\"coldBytes\":%llu,\"remainingHotBytes\":%llu,\"bytesPerHotPeer\":%.0f,\"bytesPerColdPeer\":%.0f,\"demoteMs\":%.1f,\"promoted\":%llu,\"promoteUs\":%.2f",
+			(unsigned long)addrs.size(),
+			(unsigned long long)hot.peerBytes,
+			(unsigned long long)cold.coldPeers,
+			(unsigned long long)cold.coldPeerBytes,
+			(unsigned long long)cold.peerBytes,
+			(double)hot.peerBytes / (double)hot.peers,
+			(cold.coldPeers) ? ((double)cold.coldPeerBytes / (double)cold.coldPeers) : 0.0,
+			(double)demoteNs / 1000000.0,
+			(unsigned long long)promoted,
+			(promoted) ? (((double)promoteNs / 1000.0) / (double)promoted) : 0.0);
+	}
+
+	ZT_Node_delete(node);
+}
+
+// Time to save a root sized core state snapshot and restore it into empty tables
+static void benchStateSnapshot()
+{
+	if ((benchFilter)&&(!strstr("state-snapshot",benchFilter)))
+		return;
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	{
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		env.identity.generate(0);
+		const int64_t now = OSUtils::now();
+		Topology topo(&env,(void *)0);
+		Multicaster mc(&env);
+
+		// Shared public key as in the topology benchmark
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		unsigned long peers = 0;
+		while (peers < ZT_BENCHMARK_SNAPSHOT_PEERS) {
+			Identity pid;
+			if (!benchSyntheticIdentity(env.identity,pid))
+				continue;
+			SharedPtr<Peer> p(new Peer(&env,env.identity,pid,key));
+			p->restoreLastReceive(now);
+			topo.addPeer((void *)0,p);
+			++peers;
+		}
+		for(unsigned int g=0;g<ZT_BENCHMARK_SNAPSHOT_GROUPS;++g) {
+			const MulticastGroup mg(MAC(0x01005e000000ULL + g),0);
+			for(unsigned int m=0;m<ZT_BENCHMARK_SNAPSHOT_GROUP_MEMBERS;++m)
+				mc.add((void *)0,now,0x8056c2e21c000001ULL,mg,Address(((uint64_t)(m + 1) * 0x9e3779b1ULL) & 0xffffffffffULL));
+		}
+
+		const uint64_t ss0 = nowNs();
+		StateSnapshot ss(env.identity.address(),now);
+		topo.saveState(ss);
+		mc.saveState(ss);
+		const uint64_t saveNs = nowNs() - ss0;
+
+		Topology topo2(&env,(void *)0);
+		Multicaster mc2(&env);
+		unsigned long restoredPeers = 0,restoredMembers = 0;
+		Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> *const b = new Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE>();
+		const uint64_t rs0 = nowNs();
+		StateSnapshot::Reader r(ss.data().data(),(unsigned long)ss.data().length(),env.identity.address());
+		StateSnapshot::RecordType t;
+		while (r.next(t,*b)) {
+			if (topo2.restoreState((void *)0,now,t,*b))
+				++restoredPeers;
+			restoredMembers += mc2.restoreState((void *)0,now,t,*b);
+		}
+		const uint64_t restoreNs = nowNs() - rs0;
+		delete b;
+
+		benchResult("\"name\":\"state-snapshot\",\"peers\":%lu,\"multicastMembers\":%lu,\"bytes\":%lu,\"saveMs\":%.1f,\"restoredPeers\":%lu,\"restoredMembers\":%lu,\"restoreMs\":%.1f,\"restoreUsPerPeer\":%.2f",
+			peers,
+			ss.items(StateSnapshot::RECORD_MULTICAST_MEMBERS),
+			(unsigned long)ss.data().length(),
+			(double)saveNs / 1000000.0,
+			restoredPeers,
+			restoredMembers,
+			(double)restoreNs / 1000000.0,
+			(restoredPeers) ? (((double)restoreNs / 1000.0) / (double)restoredPeers) : 0.0);
+	}
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Multicast membership: answering a GATHER for a random subset of a large
+ * group, refreshing a member on LIKE, and a member leaving and rejoining.
+ */
+static void benchMulticast()
+{
+	static const unsigned int groupSizes[2] = { 1000,20000 };
+	if ((benchFilter)&&(!strstr("multicast",benchFilter)))
+		return;
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	for(unsigned int gi=0;gi<2;++gi) {
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		Multicaster mc(&env);
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const MulticastGroup bcast(MAC(0xffffffffffffULL),0);
+		const int64_t now = OSUtils::now();
+		std::vector<Address> members;
+		for(unsigned int i=0;i<groupSizes[gi];++i) {
+			members.push_back(Address(((uint64_t)(i + 1) * 0x9e3779b1ULL) & 0xffffffffffULL));
+			mc.add((void *)0,now,nwid,bcast,members.back());
+		}
+
+		char name[64];
+		Buffer<ZT_PROTO_MAX_PACKET_LENGTH> outp;
+		OSUtils::ztsnprintf(name,sizeof(name),"multicast-gather/%u",groupSizes[gi]);
+		bench(name,0,[&]() {
+			outp.clear();
+			benchSink += mc.gather(Address(),nwid,bcast,outp,ZT_BENCHMARK_MULTICAST_LIMIT);
+		});
+		unsigned int ptr = 0;
+		OSUtils::ztsnprintf(name,sizeof(name),"multicast-like/%u",groupSizes[gi]);
+		bench(name,0,[&]() {
+			mc.add((void *)0,now,nwid,bcast,members[ptr++ % members.size()]);
+		});
+		OSUtils::ztsnprintf(name,sizeof(name),"multicast-rejoin/%u",groupSizes[gi]);
+		bench(name,0,[&]() {
+			const Address &a = members[ptr++ % members.size()];
+			mc.remove(nwid,bcast,a);
+			mc.add((void *)0,now,nwid,bcast,a);
+		});
+	}
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Memory budget: the peer table and multicast groups are filled with four
+ * times as many entries as their limits (ZT_MAX_PEERS and
+ * ZT_MAX_MULTICAST_MEMBERS, or the defaults above if those are 0) and what
+ * they hold afterward is reported next to the fixed size queues, giving the
+ * worst case for the build. Compare a normal build with one made with
+ * ZT_SMALL_FOOTPRINT=1. The identity validation cache is estimated at 100
+ * bytes per entry rather than filled.
+ */
+static void benchMemoryBudget()
+{
+	if ((benchFilter)&&(!strstr("memory-budget",benchFilter)))
+		return;
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	const unsigned long maxPeers = (ZT_MAX_PEERS) ? (unsigned long)ZT_MAX_PEERS : (unsigned long)ZT_BENCHMARK_MEMORY_MAX_PEERS;
+	const unsigned long maxMembers = (ZT_MAX_MULTICAST_MEMBERS) ? (unsigned long)ZT_MAX_MULTICAST_MEMBERS : (unsigned long)ZT_BENCHMARK_MEMORY_MAX_MULTICAST_MEMBERS;
+
+	ZT_MemoryUsage mu;
+	ZT_Node_memoryUsage(node,&mu);
+	const uint64_t rxQueueMaxBytes = (mu.rxQueueBytes / ZT_RX_QUEUE_SIZE) * ZT_RX_QUEUE_MAX_SIZE;
+	const uint64_t txQueueBytes = mu.txQueueBytes;
+	const uint64_t switchBytes = sizeof(Switch);
+	const uint64_t identityCacheBytes = (uint64_t)ZT_IDENTITY_VALIDATION_CACHE_SIZE * 100ULL;
+
+	{
+		// Private tables, as in the topology and multicast benchmarks
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		env.identity.generate(0);
+		Topology topo(&env,(void *)0);
+		topo.setMaxPeers(maxPeers);
+		Multicaster mc(&env);
+		mc.setMaxMembers(maxMembers);
+
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		unsigned long added = 0;
+		while (added < (maxPeers * 4)) {
+			Identity pid;
+			if (!benchSyntheticIdentity(env.identity,pid))
+				continue;
+			topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,pid,key)));
+			++added;
+		}
+
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const int64_t now = OSUtils::now();
+		for(unsigned long i=0;i<(maxMembers * 4);++i) {
+			const MulticastGroup g(MAC(0xffffffffffffULL),(uint32_t)(i % ZT_BENCHMARK_MEMORY_MULTICAST_GROUPS));
+			mc.add((void *)0,now + (int64_t)i,nwid,g,Address(((uint64_t)(i + 1) * 0x9e3779b1ULL) & 0xffffffffffULL));
+		}
+
+		memset(&mu,0,sizeof(mu));
+		topo.memoryUsage(&mu);
+		mc.memoryUsage(&mu);
+	}
+
+	const uint64_t total = mu.peerBytes + mu.pathBytes + mu.multicastBytes + rxQueueMaxBytes + switchBytes + identityCacheBytes;
+	benchResult("\"name\":\"memory-budget\",\"smallFootprint\":%s,\"maxPeers\":%lu,\"peersAdded\":%lu,\"peers\":%llu,\"peerBytes\":%llu,\"peersEvicted\":%llu,\"maxMulticastMembers\":%lu,\"multicastMembers\":%llu,\"multicastBytes\":%llu,\"membersEvicted\":%llu,\"rxQueueMaxBytes\":%llu,\"txQueueBytes\":%llu,\"switchBytes\":%llu,\"identityCacheBytes\":%llu,\"totalBytes\":%llu",
+#ifdef ZT_SMALL_FOOTPRINT
+		"true",
+#else
+		"false",
+#endif
+		maxPeers,maxPeers * 4,(unsigned long long)mu.peers,(unsigned long long)mu.peerBytes,(unsigned long long)mu.peersEvicted,
+		maxMembers,(unsigned long long)mu.multicastMembers,(unsigned long long)mu.multicastBytes,(unsigned long long)mu.multicastMembersEvicted,
+		(unsigned long long)rxQueueMaxBytes,(unsigned long long)txQueueBytes,(unsigned long long)switchBytes,(unsigned long long)identityCacheBytes,(unsigned long long)total);
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Root footprint: a node that is the root of a moon is filled with synthetic
+ * peers (-N) from state snapshots, as a restarted root would be, and each
+ * path it then sends a HELLO to is confirmed with an OK(HELLO) from the peer
+ * behind it. Every peer has an IPv4 path, every third one an IPv6 path as
+ * well, and each is subscribed to its network's broadcast group and to an
+ * IPv6 solicited node group. Synthetic peers share one public key so that
+ * only the root's side of key agreement is paid for.
+ *
+ * A minute of keepalives then plays out in simulated time: every path sends
+ * a HELLO once a minute and an ECHO every 15 seconds in between, as leaves
+ * do, and background tasks run whenever they are due. Last, for a second of
+ * real time, peers send each other a mix of packet sizes through the root
+ * alongside keepalives at the same rate. Reported are resident memory and
+ * the core's own accounting per peer, milliseconds spent in background tasks
+ * and on keepalives per second, relayed packets per second and the time the
+ * root took to relay one.
+ */
+struct BenchRoot : public BenchHost
+{
+	struct Hello
+	{
+		uint64_t packetId;
+		Address to;
+		InetAddress at;
+	};
+
+	BenchRoot() : collectHellos(false) {}
+	bool collectHellos;
+	std::vector<Hello> hellos;
+};
+static int benchRootWireSend(ZT_Node *,void *uptr,void *,int64_t,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int)
+{
+	BenchRoot *const root = static_cast<BenchRoot *>(reinterpret_cast<BenchHost *>(uptr));
+	if ((root->collectHellos)&&(len >= ZT_PROTO_MIN_PACKET_LENGTH)&&((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_VERB] & 0x1f) == Packet::VERB_HELLO)) {
+		root->hellos.push_back(BenchRoot::Hello());
+		BenchRoot::Hello &h = root->hellos.back();
+		h.packetId = Utils::ntoh(*reinterpret_cast<const uint64_t *>(data));
+		h.to.setTo(reinterpret_cast<const uint8_t *>(data) + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+		h.at = addr;
+	}
+	return 0;
+}
+
+static inline unsigned int benchRootPathCount(const unsigned long i) { return ((i % ZT_BENCHMARK_ROOT_IPV6_EVERY) == 0) ? 2 : 1; }
+static inline InetAddress benchRootPath(const unsigned long i,const unsigned int p)
+{
+	if (p == 0)
+		return InetAddress(Utils::hton((uint32_t)(0x0b000000 + i)),(unsigned int)(20000 + (i % 40000)));
+	uint8_t ip[16];
+	memset(ip,0,sizeof(ip));
+	ip[0] = 0x2a;
+	ip[1] = 0x0b;
+	for(unsigned int k=0;k<4;++k)
+		ip[15 - k] = (uint8_t)(i >> (k * 8));
+	return InetAddress(ip,16,9993);
+}
+
+// Resident set size of this process, or its peak where the current size isn't available
+static uint64_t benchRssBytes()
+{
+#ifdef __LINUX__
+	FILE *f = fopen("/proc/self/statm","r");
+	if (f) {
+		unsigned long long size = 0,resident = 0;
+		const int n = fscanf(f,"%llu %llu",&size,&resident);
+		fclose(f);
+		if (n == 2)
+			return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+	}
+#endif
+	struct rusage ru;
+	memset(&ru,0,sizeof(ru));
+	getrusage(RUSAGE_SELF,&ru);
+#ifdef __APPLE__
+	return (uint64_t)ru.ru_maxrss; // bytes on macOS
+#else
+	return (uint64_t)ru.ru_maxrss * 1024ULL;
+#endif
+}
+
+static void benchRootFootprint()
+{
+	static const unsigned int relayMix[8] = { 1400,1400,1400,1400,576,576,128,64 };
+	if ((benchFilter)&&(!strstr("root-footprint",benchFilter)))
+		return;
+
+	BenchRoot root;
+	int64_t now = OSUtils::now();
+	ZT_Node *const node = benchNewNode((void *)static_cast<BenchHost *>(&root),now,benchRootWireSend);
+	if (!node)
+		return;
+	ZT_NodeStatus st;
+	ZT_Node_status(node,&st);
+	const Identity nodeId(st.publicIdentity);
+
+	const uint64_t moonId = 0x00000000deadbeefULL;
+	{
+		std::vector<World::Root> roots;
+		roots.push_back(World::Root());
+		roots.back().identity = nodeId;
+		const C25519::Pair kp(C25519::generate());
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> tmp;
+		World::make(World::TYPE_MOON,moonId,(uint64_t)now,kp.pub,roots,kp).serialize(tmp,false);
+		root.moon.assign((const char *)tmp.data(),tmp.size());
+	}
+	ZT_Node_orbit(node,(void *)0,moonId,0);
+
+	Identity shared;
+	shared.generate(0);
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+	shared.agree(nodeId,key,ZT_PEER_SECRET_KEY_LENGTH);
+
+	// Multiplying by an odd constant modulo 2^40 gives every peer its own address
+	const unsigned long peers = rootPeers;
+	const uint64_t networks = std::max(1UL,peers / ZT_BENCHMARK_ROOT_NETWORK_SIZE);
+	std::vector<uint64_t> addrs;
+	addrs.reserve(peers);
+	for(uint64_t k=1;addrs.size()<peers;++k) {
+		const Address a(k * 0x9e3779b1ULL);
+		if ((!a.isReserved())&&(a != nodeId.address()))
+			addrs.push_back(a.toInt());
+	}
+	unsigned long paths = 0;
+	for(unsigned long i=0;i<peers;++i)
+		paths += benchRootPathCount(i);
+
+	volatile int64_t dl = 0;
+	const uint64_t rss0 = benchRssBytes();
+
+	unsigned long restoredPeers = 0,restoredMembers = 0;
+	Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> *const b = new Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE>();
+	root.collectHellos = true;
+	const uint64_t fillStart = nowNs();
+	for(unsigned long c=0;c<peers;c+=ZT_BENCHMARK_ROOT_CHUNK) {
+		StateSnapshot ss(nodeId.address(),now);
+		for(unsigned long i=c,e=std::min(peers,c + ZT_BENCHMARK_ROOT_CHUNK);i<e;++i) {
+			const Address a(addrs[i]);
+
+			// <[8] last receive> and the entry Peer::serializeForCache() would write
+			b->clear();
+			b->append((uint64_t)now);
+			b->append((uint8_t)1);
+			a.appendTo(*b);
+			b->append((uint8_t)0);
+			b->append(shared.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+			b->append((uint8_t)0);
+			b->append((uint16_t)ZT_PROTO_VERSION);
+			b->append((uint16_t)ZEROTIER_ONE_VERSION_MAJOR);
+			b->append((uint16_t)ZEROTIER_ONE_VERSION_MINOR);
+			b->append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			b->append((uint16_t)benchRootPathCount(i));
+			for(unsigned int p=0;p<benchRootPathCount(i);++p)
+				benchRootPath(i,p).serialize(*b);
+			ss.add(StateSnapshot::RECORD_PEER,*b);
+
+			const uint64_t nwid = (nodeId.address().toInt() << 24) | (uint64_t)(i % networks);
+			for(unsigned int g=0;g<2;++g) {
+				b->clear();
+				b->append(nwid);
+				MAC((g == 0) ? 0xffffffffffffULL : (0x3333ff000000ULL | (addrs[i] & 0xffffffULL))).appendTo(*b);
+				b->append((uint32_t)0);
+				b->append((uint16_t)1);
+				a.appendTo(*b);
+				b->append((uint64_t)now);
+				ss.add(StateSnapshot::RECORD_MULTICAST_MEMBERS,*b);
+			}
+		}
+		ZT_StateSnapshot rs;
+		ZT_Node_restoreSnapshot(node,(void *)0,now,ss.data().data(),(unsigned long)ss.data().length(),&rs);
+		restoredPeers += rs.peers;
+		restoredMembers += rs.multicastMembers;
+
+		for(std::vector<BenchRoot::Hello>::const_iterator h(root.hellos.begin());h!=root.hellos.end();++h) {
+			Packet ok(nodeId.address(),h->to,Packet::VERB_OK);
+			ok.append((unsigned char)Packet::VERB_HELLO);
+			ok.append(h->packetId);
+			ok.append((uint64_t)now);
+			ok.append((unsigned char)ZT_PROTO_VERSION);
+			ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+			ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+			ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			ok.armor(key,true);
+			ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&(h->at)),ok.data(),ok.size(),&dl);
+		}
+		root.hellos.clear();
+	}
+	const uint64_t fillNs = nowNs() - fillStart;
+	root.collectHellos = false;
+	std::vector<BenchRoot::Hello>().swap(root.hellos);
+	delete b;
+
+	ZT_MemoryUsage mu;
+	ZT_Node_memoryUsage(node,&mu);
+	const uint64_t rss1 = benchRssBytes();
+
+	Packet kp;
+	const Address nodeAddress(nodeId.address());
+	auto keepalive = [&](const unsigned long i,const unsigned int p,const bool hello,const int64_t t) -> uint64_t {
+		const Address a(addrs[i]);
+		const InetAddress at(benchRootPath(i,p));
+		if (hello) {
+			kp.reset(nodeAddress,a,Packet::VERB_HELLO);
+			kp.append((unsigned char)ZT_PROTO_VERSION);
+			kp.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+			kp.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+			kp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			kp.append((uint64_t)t);
+			a.appendTo(kp);
+			kp.append((uint8_t)0);
+			kp.append(shared.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+			kp.append((uint8_t)0);
+			kp.armor(key,false);
+		} else {
+			kp.reset(nodeAddress,a,Packet::VERB_ECHO);
+			kp.armor(key,true);
+		}
+		const uint64_t s = nowNs();
+		ZT_Node_processWirePacket(node,(void *)0,t,1,reinterpret_cast<const struct sockaddr_storage *>(&at),kp.data(),kp.size(),&dl);
+		return (nowNs() - s);
+	};
+	auto background = [&](const int64_t t) -> uint64_t {
+		if (t < dl)
+			return 0;
+		const uint64_t s = nowNs();
+		ZT_Node_processBackgroundTasks(node,(void *)0,t,&dl);
+		return (nowNs() - s);
+	};
+
+	// Peers take turns by slot, and each keepalive of a peer's turn in this ping period that is its own is a HELLO
+	const unsigned long slots = ZT_BENCHMARK_ROOT_KEEPALIVE_MS / ZT_BENCHMARK_ROOT_STEP_MS;
+	const unsigned long perPing = ZT_PEER_PING_PERIOD / ZT_BENCHMARK_ROOT_KEEPALIVE_MS;
+	uint64_t backgroundNs = 0,keepaliveNs = 0,keepalives = 0;
+	const int64_t simStart = now;
+	for(unsigned long k=0;k<(ZT_PEER_PING_PERIOD / ZT_BENCHMARK_ROOT_STEP_MS);++k) {
+		now = simStart + (int64_t)(k * ZT_BENCHMARK_ROOT_STEP_MS);
+		for(unsigned long i=(k % slots);i<peers;i+=slots) {
+			for(unsigned int p=0;p<benchRootPathCount(i);++p) {
+				keepaliveNs += keepalive(i,p,(((i / slots) % perPing) == ((k / slots) % perPing)),now);
+				++keepalives;
+			}
+		}
+		backgroundNs += background(now);
+	}
+	const double simSeconds = (double)ZT_PEER_PING_PERIOD / 1000.0;
+
+	uint64_t r0,h0,m0;
+	reinterpret_cast<Node *>(node)->relayStats(r0,h0,m0);
+	uint8_t *const rp = new uint8_t[ZT_DEFAULT_MTU];
+	Utils::getSecureRandom(rp,ZT_DEFAULT_MTU);
+	rp[ZT_PACKET_IDX_FLAGS] = 0;
+	std::vector<uint64_t> lat;
+	uint64_t relayCalls = 0,busyKeepalives = 0,x = 0x9e3779b97f4a7c15ULL;
+	unsigned long kaPeer = 0;
+	const double keepalivesPerNs = ((double)paths / (double)ZT_BENCHMARK_ROOT_KEEPALIVE_MS) / 1000000.0;
+	const int64_t busyStart = now + ZT_BENCHMARK_ROOT_STEP_MS;
+	const uint64_t start = nowNs();
+	const uint64_t end = start + ((uint64_t)ZT_BENCHMARK_NODE_RX_MS * 1000000ULL);
+	uint64_t t;
+	while ((t = nowNs()) < end) {
+		now = busyStart + (int64_t)((t - start) / 1000000ULL);
+		const uint64_t due = (uint64_t)(keepalivesPerNs * (double)(t - start));
+		while (busyKeepalives < due) {
+			for(unsigned int p=0;p<benchRootPathCount(kaPeer);++p) {
+				keepalive(kaPeer,p,((busyKeepalives % perPing) == 0),now);
+				++busyKeepalives;
+			}
+			kaPeer = (kaPeer + 1) % peers;
+		}
+		background(now);
+
+		for(unsigned int k=0;k<64;++k) {
+			x ^= x << 13; x ^= x >> 7; x ^= x << 17; // xorshift64
+			const unsigned long src = (unsigned long)(x % peers);
+			const unsigned long dst = (unsigned long)((x >> 32) % peers);
+			if (src == dst)
+				continue;
+			const unsigned int len = relayMix[relayCalls & 7];
+			memcpy(rp,&x,8);
+			Address(addrs[dst]).copyTo(rp + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH);
+			Address(addrs[src]).copyTo(rp + ZT_PACKET_IDX_SOURCE,ZT_ADDRESS_LENGTH);
+			const InetAddress from(benchRootPath(src,0));
+			if ((relayCalls % ZT_BENCHMARK_ROOT_LATENCY_SAMPLE) == 0) {
+				const uint64_t s = nowNs();
+				ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&from),rp,len,&dl);
+				lat.push_back(nowNs() - s);
+			} else {
+				ZT_Node_processWirePacket(node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&from),rp,len,&dl);
+			}
+			++relayCalls;
+		}
+	}
+	const uint64_t elapsed = t - start;
+	delete [] rp;
+	uint64_t r,h,m;
+	reinterpret_cast<Node *>(node)->relayStats(r,h,m);
+	r -= r0;
+	std::sort(lat.begin(),lat.end());
+
+	benchResult("\"name\":\"root-footprint\",\"peers\":%lu,\"restoredPeers\":%lu,\"paths\":%llu,\"multicastMembers\":%lu,\"fillSeconds\":%.3f,\"rssBytesPerPeer\":%.0f,\"coreBytesPerPeer\":%.0f,\"keepalives\":%llu,\"keepaliveNs\":%.0f,\"keepaliveMsPerSec\":%.1f,\"backgroundMsPerSec\":%.2f,\"relayPackets\":%llu,\"relayed\":%llu,\"relayedPerSec\":%.0f,\"medianRelayNs\":%llu,\"p99RelayNs\":%llu",
+		peers,
+		restoredPeers,
+		(unsigned long long)mu.paths,
+		restoredMembers,
+		(double)fillNs / 1000000000.0,
+		(rss1 > rss0) ? ((double)(rss1 - rss0) / (double)peers) : 0.0,
+		(double)(mu.peerBytes + mu.pathBytes + mu.multicastBytes) / (double)peers,
+		(unsigned long long)keepalives,
+		(keepalives) ? ((double)keepaliveNs / (double)keepalives) : 0.0,
+		((double)keepaliveNs / 1000000.0) / simSeconds,
+		((double)backgroundNs / 1000000.0) / simSeconds,
+		(unsigned long long)relayCalls,
+		(unsigned long long)r,
+		(double)r / ((double)elapsed / 1000000000.0),
+		(unsigned long long)((lat.empty()) ? 0 : lat[lat.size() / 2]),
+		(unsigned long long)((lat.empty()) ? 0 : lat[std::min(lat.size() - 1,(lat.size() * 99) / 100)]));
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Rule evaluation: Network::filterOutgoingPacket() and filterIncomingPacket()
+ * with a built-in rule set (only IP and ARP, then a list of allowed TCP
+ * ports) and any compiled rule sets given with -F, which may use
+ * capabilities and tags. Both we and the remote member hold every
+ * capability and tag in the set, signed by the network's controller, with
+ * each tag at its default or first enumerated value.
+ *
+ * Each synthetic frame is timed as one repeated flow, which the flow cache
+ * answers if the rule set is big enough to use it, and as a new flow every
+ * time (the source MAC cycles through more values than the cache holds), so
+ * rules are always evaluated. Frames from a pcapng file given with -P, e.g.
+ * from GET /capture, are replayed in order, grouped by verdict. Results are
+ * named filter[-uncached]/<rule set>/<direction>/<frame>/<verdict>.
+ */
+struct BenchRuleSet
+{
+	std::string name;
+	std::vector<ZT_VirtualNetworkRule> rules;
+	std::vector< std::pair< uint32_t,std::vector<ZT_VirtualNetworkRule> > > capabilities;
+	std::vector< std::pair<uint32_t,uint32_t> > tags; // ID, value
+};
+
+struct BenchFilterFrame
+{
+	std::string name;
+	MAC macSource;
+	MAC macDest;
+	unsigned int etherType;
+	std::vector<uint8_t> data;
+};
+
+// Reads rule compiler output (node rule-compiler/cli.js <rules>) or a controller network object
+static bool benchLoadRuleSet(const char *path,BenchRuleSet &rs)
+{
+	std::string buf;
+	if (!OSUtils::readFile(path,buf))
+		return false;
+	try {
+		nlohmann::json j(OSUtils::jsonParse(buf));
+		nlohmann::json &cfg = (j.count("config")) ? j["config"] : j;
+
+		nlohmann::json &rules = cfg["rules"];
+		for(unsigned long i=0;((rules.is_array())&&(i<rules.size())&&(rs.rules.size()<ZT_MAX_NETWORK_RULES));++i) {
+			ZT_VirtualNetworkRule r;
+			if (EmbeddedNetworkController::parseRule(rules[i],r))
+				rs.rules.push_back(r);
+		}
+
+		nlohmann::json &caps = cfg["capabilities"];
+		for(unsigned long i=0;((caps.is_array())&&(i<caps.size())&&(rs.capabilities.size()<ZT_MAX_NETWORK_CAPABILITIES));++i) {
+			rs.capabilities.push_back(std::pair< uint32_t,std::vector<ZT_VirtualNetworkRule> >((uint32_t)OSUtils::jsonInt(caps[i]["id"],0ULL),std::vector<ZT_VirtualNetworkRule>()));
+			nlohmann::json &cr = caps[i]["rules"];
+			for(unsigned long k=0;((cr.is_array())&&(k<cr.size())&&(rs.capabilities.back().second.size()<ZT_MAX_CAPABILITY_RULES));++k) {
+				ZT_VirtualNetworkRule r;
+				if (EmbeddedNetworkController::parseRule(cr[k],r))
+					rs.capabilities.back().second.push_back(r);
+			}
+		}
+
+		// The compiler gives a tag's enumerated values separately, by tag name
+		nlohmann::json &tags = cfg["tags"];
+		nlohmann::json &tagsByName = j["tagsByName"];
+		for(unsigned long i=0;((tags.is_array())&&(i<tags.size())&&(rs.tags.size()<ZT_MAX_NETWORK_TAGS));++i) {
+			const uint32_t id = (uint32_t)OSUtils::jsonInt(tags[i]["id"],0ULL);
+			uint64_t value = 0;
+			if (tags[i]["default"].is_number()) {
+				value = OSUtils::jsonInt(tags[i]["default"],0ULL);
+			} else if (tagsByName.is_object()) {
+				for(nlohmann::json::iterator t(tagsByName.begin());t!=tagsByName.end();++t) {
+					nlohmann::json &enums = t.value()["enums"];
+					if ((OSUtils::jsonInt(t.value()["id"],0ULL) == id)&&(enums.is_object())&&(enums.size() > 0)) {
+						value = OSUtils::jsonInt(enums.begin().value(),0ULL);
+						break;
+					}
+				}
+			}
+			rs.tags.push_back(std::pair<uint32_t,uint32_t>(id,(uint32_t)value));
+		}
+	} catch ( ... ) {
+		return false;
+	}
+
+	const char *n = strrchr(path,ZT_PATH_SEPARATOR);
+	rs.name = (n) ? (n + 1) : path;
+	if (rs.name.find('.') != std::string::npos)
+		rs.name = rs.name.substr(0,rs.name.find('.'));
+	return (rs.rules.size() > 0);
+}
+
+// Ethernet frames from the enhanced packet blocks of a pcapng file
+static void benchLoadPcapng(const char *path,std::vector<BenchFilterFrame> &frames)
+{
+	std::string buf;
+	if ((!OSUtils::readFile(path,buf))||(buf.length() < 28))
+		return;
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(buf.data());
+	const bool le = (d[8] == 0x4d); // byte order magic 0x1a2b3c4d
+	unsigned long p = 0;
+	while ((p + 12) <= buf.length()) {
+		const uint8_t *const b = d + p;
+		const uint32_t type = (le) ? (b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24)) : (((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]);
+		const uint32_t len = (le) ? (b[4] | (b[5] << 8) | (b[6] << 16) | ((uint32_t)b[7] << 24)) : (((uint32_t)b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7]);
+		if ((len < 12)||((p + len) > buf.length()))
+			break;
+		if ((type == 6)&&(len >= 32)) {
+			const uint8_t *const c = b + 20;
+			const uint32_t caplen = (le) ? (c[0] | (c[1] << 8) | (c[2] << 16) | ((uint32_t)c[3] << 24)) : (((uint32_t)c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3]);
+			const uint8_t *const f = b + 28;
+			if ((caplen >= 14)&&((28 + caplen) <= len)) {
+				BenchFilterFrame fr;
+				fr.name = "recorded";
+				fr.macDest.setTo(f,6);
+				fr.macSource.setTo(f + 6,6);
+				fr.etherType = ((unsigned int)f[12] << 8) | (unsigned int)f[13];
+				fr.data.assign(f + 14,f + caplen);
+				frames.push_back(fr);
+			}
+		}
+		p += len;
+	}
+}
+
+// An IPv4 or IPv6 TCP or UDP header with the given destination port, or for other ethertypes an empty payload
+static BenchFilterFrame benchFilterFrame(const char *name,const unsigned int etherType,const uint8_t ipProtocol,const unsigned int dport,const MAC &src,const MAC &dst)
+{
+	BenchFilterFrame f;
+	f.name = name;
+	f.macSource = src;
+	f.macDest = dst;
+	f.etherType = etherType;
+	if (etherType == ZT_ETHERTYPE_IPV4) {
+		f.data.resize(40,0);
+		f.data[0] = 0x45;
+		f.data[3] = 40;
+		f.data[8] = 64;
+		f.data[9] = ipProtocol;
+		f.data[12] = 10; f.data[13] = 147; f.data[14] = 17; f.data[15] = 1;
+		f.data[16] = 10; f.data[17] = 147; f.data[18] = 17; f.data[19] = 2;
+		f.data[20] = 0xc0; f.data[21] = 0x01;
+		f.data[22] = (uint8_t)(dport >> 8);
+		f.data[23] = (uint8_t)dport;
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		f.data.resize(60,0);
+		f.data[0] = 0x60;
+		f.data[5] = 20;
+		f.data[6] = ipProtocol;
+		f.data[7] = 64;
+		f.data[8] = 0xfd; f.data[23] = 1;
+		f.data[24] = 0xfd; f.data[39] = 2;
+		f.data[40] = 0xc0; f.data[41] = 0x01;
+		f.data[42] = (uint8_t)(dport >> 8);
+		f.data[43] = (uint8_t)dport;
+	} else {
+		f.data.resize(28,0);
+	}
+	return f;
+}
+
+static void benchRules()
+{
+	if ((benchFilter)&&(!strstr("filter",benchFilter))&&(strncmp(benchFilter,"filter",6) != 0))
+		return;
+
+	std::vector<BenchRuleSet> sets(1);
+	{
+		// A typical rule set: only IP and ARP, then a list of allowed TCP ports
+		BenchRuleSet &rs = sets[0];
+		rs.name = "ports";
+		ZT_VirtualNetworkRule r;
+		memset(&r,0,sizeof(r));
+		static const uint16_t allowedEtherTypes[3] = { ZT_ETHERTYPE_IPV4,ZT_ETHERTYPE_ARP,ZT_ETHERTYPE_IPV6 };
+		for(unsigned int i=0;i<3;++i) {
+			r.t = 0x80 | ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+			r.v.etherType = allowedEtherTypes[i];
+			rs.rules.push_back(r);
+		}
+		r.t = ZT_NETWORK_RULE_ACTION_DROP;
+		rs.rules.push_back(r);
+		for(unsigned int i=0;i<ZT_BENCHMARK_FILTER_PORTS;++i) {
+			r.t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+			r.v.ipProtocol = 0x06;
+			rs.rules.push_back(r);
+			r.t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+			r.v.port[0] = r.v.port[1] = (uint16_t)(1000 + (i * 10));
+			rs.rules.push_back(r);
+			r.t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+			rs.rules.push_back(r);
+		}
+		r.t = ZT_NETWORK_RULE_ACTION_DROP;
+		rs.rules.push_back(r);
+	}
+	for(std::vector<const char *>::const_iterator f(ruleFiles.begin());f!=ruleFiles.end();++f) {
+		sets.push_back(BenchRuleSet());
+		if (!benchLoadRuleSet(*f,sets.back())) {
+			fprintf(stderr,"filter: unable to read compiled rules from %s" ZT_EOL_S,*f);
+			sets.pop_back();
+		}
+	}
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	{
+		// A private environment with the parts credential checks and pushes use
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		env.identity.generate(0);
+		Trace trace(&env);
+		Switch sw(&env);
+		Topology topo(&env,(void *)0);
+		Shaper shaper(&env,OSUtils::now());
+		env.t = &trace;
+		env.sw = &sw;
+		env.topology = &topo;
+		env.shaper = &shaper;
+
+		Identity controller,remote;
+		controller.generate(0);
+		remote.generate(0);
+		topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,controller)));
+		const SharedPtr<Peer> remotePeer(topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,remote))));
+		const uint64_t nwid = (controller.address().toInt() << 24) | 0x000001ULL;
+		const int64_t now = OSUtils::now();
+		const MAC macLocal(env.identity.address(),nwid),macRemote(remote.address(),nwid);
+
+		std::vector<BenchFilterFrame> synthetic;
+		synthetic.push_back(benchFilterFrame("ipv4-tcp-22",ZT_ETHERTYPE_IPV4,0x06,22,macLocal,macRemote));
+		synthetic.push_back(benchFilterFrame("ipv4-tcp-1300",ZT_ETHERTYPE_IPV4,0x06,1000 + ((ZT_BENCHMARK_FILTER_PORTS - 1) * 10),macLocal,macRemote));
+		synthetic.push_back(benchFilterFrame("ipv4-tcp-999",ZT_ETHERTYPE_IPV4,0x06,999,macLocal,macRemote));
+		synthetic.push_back(benchFilterFrame("ipv4-udp-53",ZT_ETHERTYPE_IPV4,0x11,53,macLocal,macRemote));
+		synthetic.push_back(benchFilterFrame("ipv6-tcp-443",ZT_ETHERTYPE_IPV6,0x06,443,macLocal,macRemote));
+		synthetic.push_back(benchFilterFrame("arp",ZT_ETHERTYPE_ARP,0,0,macLocal,macRemote));
+		synthetic.push_back(benchFilterFrame("lldp",0x88cc,0,0,macLocal,macRemote));
+		std::vector<BenchFilterFrame> recorded;
+		if (rulesPcap) {
+			benchLoadPcapng(rulesPcap,recorded);
+			if (recorded.empty())
+				fprintf(stderr,"filter: no Ethernet frames in %s" ZT_EOL_S,rulesPcap);
+		}
+
+		for(std::vector<BenchRuleSet>::const_iterator rs(sets.begin());rs!=sets.end();++rs) {
+			NetworkConfig *const nconf = new NetworkConfig();
+			nconf->networkId = nwid;
+			nconf->timestamp = now;
+			nconf->credentialTimeMaxDelta = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+			nconf->revision = 1;
+			nconf->issuedTo = env.identity.address();
+			nconf->type = ZT_NETWORK_TYPE_PRIVATE;
+			nconf->mtu = ZT_DEFAULT_MTU;
+			nconf->ruleCount = (unsigned int)rs->rules.size();
+			memcpy(nconf->rules,rs->rules.data(),sizeof(ZT_VirtualNetworkRule) * rs->rules.size());
+			for(std::vector< std::pair< uint32_t,std::vector<ZT_VirtualNetworkRule> > >::const_iterator c(rs->capabilities.begin());c!=rs->capabilities.end();++c) {
+				Capability &cap = nconf->capabilities[nconf->capabilityCount++];
+				cap = Capability(c->first,nwid,now,1,c->second.data(),(unsigned int)c->second.size());
+				cap.sign(controller,env.identity.address());
+			}
+			for(std::vector< std::pair<uint32_t,uint32_t> >::const_iterator t(rs->tags.begin());t!=rs->tags.end();++t) {
+				Tag &tag = nconf->tags[nconf->tagCount++];
+				tag = Tag(nwid,now,env.identity.address(),t->first,t->second);
+				tag.sign(controller);
+			}
+			SharedPtr<Network> nw(new Network(&env,(void *)0,nwid,(void *)0,nconf));
+
+			// The remote member's credentials, as it would have pushed them
+			for(std::vector< std::pair< uint32_t,std::vector<ZT_VirtualNetworkRule> > >::const_iterator c(rs->capabilities.begin());c!=rs->capabilities.end();++c) {
+				Capability cap(c->first,nwid,now,1,c->second.data(),(unsigned int)c->second.size());
+				cap.sign(controller,remote.address());
+				nw->addCredential((void *)0,cap);
+			}
+			for(std::vector< std::pair<uint32_t,uint32_t> >::const_iterator t(rs->tags.begin());t!=rs->tags.end();++t) {
+				Tag tag(nwid,now,remote.address(),t->first,t->second);
+				tag.sign(controller);
+				nw->addCredential((void *)0,tag);
+			}
+
+			char name[256];
+			for(unsigned int dir=0;dir<2;++dir) {
+				const char *const dirName = (dir) ? "in" : "out";
+				// Outgoing frames are from us to the remote member and incoming ones the other way around
+				const Address &ztSource = (dir) ? remote.address() : env.identity.address();
+				const Address &ztDest = (dir) ? env.identity.address() : remote.address();
+				for(std::vector<BenchFilterFrame>::const_iterator f(synthetic.begin());f!=synthetic.end();++f) {
+					const MAC &macSource = (dir) ? f->macDest : f->macSource;
+					const MAC &macDest = (dir) ? f->macSource : f->macDest;
+					const bool accept = (dir) ?
+						(nw->filterIncomingPacket((void *)0,remotePeer,ztDest,macSource,macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0) > 0) :
+						nw->filterOutgoingPacket((void *)0,true,ztSource,ztDest,macSource,macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0);
+					OSUtils::ztsnprintf(name,sizeof(name),"filter/%s/%s/%s/%s",rs->name.c_str(),dirName,f->name.c_str(),(accept) ? "accept" : "drop");
+					if (dir) {
+						bench(name,0,[&]() { benchSink += (uint64_t)nw->filterIncomingPacket((void *)0,remotePeer,ztDest,macSource,macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0); });
+					} else {
+						bench(name,0,[&]() { benchSink += (uint64_t)nw->filterOutgoingPacket((void *)0,true,ztSource,ztDest,macSource,macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0); });
+					}
+
+					uint64_t m = 0;
+					OSUtils::ztsnprintf(name,sizeof(name),"filter-uncached/%s/%s/%s/%s",rs->name.c_str(),dirName,f->name.c_str(),(accept) ? "accept" : "drop");
+					if (dir) {
+						bench(name,0,[&]() {
+							const MAC ms(macSource.toInt() ^ ((++m % (ZT_NETWORK_FLOW_CACHE_SIZE * 2)) << 8));
+							benchSink += (uint64_t)nw->filterIncomingPacket((void *)0,remotePeer,ztDest,ms,macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0);
+						});
+					} else {
+						bench(name,0,[&]() {
+							const MAC ms(macSource.toInt() ^ ((++m % (ZT_NETWORK_FLOW_CACHE_SIZE * 2)) << 8));
+							benchSink += (uint64_t)nw->filterOutgoingPacket((void *)0,true,ztSource,ztDest,ms,macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0);
+						});
+					}
+				}
+
+				if (!recorded.empty()) {
+					std::vector<const BenchFilterFrame *> byVerdict[2];
+					for(std::vector<BenchFilterFrame>::const_iterator f(recorded.begin());f!=recorded.end();++f) {
+						const bool accept = (dir) ?
+							(nw->filterIncomingPacket((void *)0,remotePeer,ztDest,f->macSource,f->macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0) > 0) :
+							nw->filterOutgoingPacket((void *)0,true,ztSource,ztDest,f->macSource,f->macDest,f->data.data(),(unsigned int)f->data.size(),f->etherType,0);
+						byVerdict[(accept) ? 1 : 0].push_back(&(*f));
+					}
+					for(unsigned int v=0;v<2;++v) {
+						const std::vector<const BenchFilterFrame *> &fl = byVerdict[v];
+						if (fl.empty())
+							continue;
+						std::size_t c = 0;
+						OSUtils::ztsnprintf(name,sizeof(name),"filter/%s/%s/recorded/%s",rs->name.c_str(),dirName,(v) ? "accept" : "drop");
+						if (dir) {
+							bench(name,0,[&]() {
+								const BenchFilterFrame &f = *fl[c];
+								benchSink += (uint64_t)nw->filterIncomingPacket((void *)0,remotePeer,ztDest,f.macSource,f.macDest,f.data.data(),(unsigned int)f.data.size(),f.etherType,0);
+								if (++c == fl.size()) c = 0;
+							});
+						} else {
+							bench(name,0,[&]() {
+								const BenchFilterFrame &f = *fl[c];
+								benchSink += (uint64_t)nw->filterOutgoingPacket((void *)0,true,ztSource,ztDest,f.macSource,f.macDest,f.data.data(),(unsigned int)f.data.size(),f.etherType,0);
+								if (++c == fl.size()) c = 0;
+							});
+						}
+					}
+				}
+			}
+
+			delete nconf;
+		}
+	}
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * Contention: the core's shared structures are hammered from 1 to N
+ * threads (-T, by default the number of CPUs but at least 2) to see how
+ * they scale. Keys are drawn from a Zipf distribution, so as with real
+ * traffic a few peers, groups and flows are hot and most are cold. For
+ * each structure and thread count this reports operations per second,
+ * scaling (operations per second over the single thread figure times the
+ * thread count, 1.0 being perfect) and the latency of one in every
+ * ZT_BENCHMARK_CONTENTION_LATENCY_SAMPLE operations.
+ *
+ *   topology-get     Topology::getPeer() of known peers
+ *   switch-rx        Fragments of unassembled packets into the RX queue
+ *   switch-tx        Switch::send() to unknown peers, queued awaiting WHOIS
+ *   multicaster-add  Multicaster::add() of members to groups
+ *   multicaster-send Multicaster::send() to a group of known members
+ *   network-filter   Network::filterOutgoingPacket() of frames across flows
+ *   random           Utils::getSecureRandom() of 16 bytes
+ */
+
+// Fills out with indices of 0 to n-1 drawn from a Zipf distribution with exponent 1
+static void benchZipf(std::vector<uint32_t> &out,const unsigned int n)
+{
+	std::vector<double> cdf(n);
+	double sum = 0.0;
+	for(unsigned int i=0;i<n;++i)
+		cdf[i] = (sum += 1.0 / (double)(i + 1));
+	out.resize(ZT_BENCHMARK_CONTENTION_KEYS);
+	for(std::vector<uint32_t>::iterator k(out.begin());k!=out.end();++k) {
+		uint64_t r;
+		Utils::getSecureRandom(&r,sizeof(r));
+		const double u = ((double)(r >> 11) / 9007199254740992.0) * sum;
+		*k = (uint32_t)std::min((std::size_t)(n - 1),(std::size_t)(std::lower_bound(cdf.begin(),cdf.end(),u) - cdf.begin()));
+	}
+}
+
+static inline uint32_t benchZipfKey(const std::vector<uint32_t> &z,const uint64_t n) { return z[(std::size_t)(n % ZT_BENCHMARK_CONTENTION_KEYS)]; }
+
+// Runs op(thread,n) over and over on each thread, with n counting that thread's calls
+template<typename F>
+static void benchContentionRun(const char *structure,F op)
+{
+	char name[64];
+	OSUtils::ztsnprintf(name,sizeof(name),"contention/%s/",structure);
+	if ((benchFilter)&&(!strstr(name,benchFilter))&&(strncmp(benchFilter,name,strlen(name)) != 0))
+		return;
+
+	double single = 0.0;
+	for(unsigned int threads=1;;threads=std::min(threads * 2,contentionThreads)) {
+		std::atomic_bool go(false),stop(false);
+		std::vector<uint64_t> counts(threads,0);
+		std::vector< std::vector<uint64_t> > lat(threads);
+		std::vector<std::thread> workers;
+		for(unsigned int t=0;t<threads;++t) {
+			workers.push_back(std::thread([&,t]() {
+				std::vector<uint64_t> &l = lat[t];
+				uint64_t n = (uint64_t)t * (ZT_BENCHMARK_CONTENTION_KEYS / 64); // threads start at different keys
+				const uint64_t n0 = n;
+				while (!go)
+					std::this_thread::yield();
+				while (!stop) {
+					for(unsigned int i=1;i<ZT_BENCHMARK_CONTENTION_LATENCY_SAMPLE;++i)
+						op(t,n++);
+					const uint64_t s = nowNs();
+					op(t,n++);
+					l.push_back(nowNs() - s);
+				}
+				counts[t] = n - n0;
+			}));
+		}
+		const uint64_t start = nowNs();
+		go = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_CONTENTION_MS));
+		stop = true;
+		for(std::vector<std::thread>::iterator w(workers.begin());w!=workers.end();++w)
+			w->join();
+		const uint64_t elapsed = nowNs() - start;
+
+		uint64_t total = 0;
+		std::vector<uint64_t> all;
+		for(unsigned int t=0;t<threads;++t) {
+			total += counts[t];
+			all.insert(all.end(),lat[t].begin(),lat[t].end());
+		}
+		std::sort(all.begin(),all.end());
+		const double perSec = (double)total / ((double)elapsed / 1000000000.0);
+		if (threads == 1)
+			single = perSec;
+		benchResult("\"name\":\"contention/%s/%ut\",\"threads\":%u,\"ops\":%llu,\"opsPerSec\":%.0f,\"scaling\":%.3f,\"medianLatencyNs\":%llu,\"p99LatencyNs\":%llu,\"p999LatencyNs\":%llu",
+			structure,threads,threads,
+			(unsigned long long)total,
+			perSec,
+			(single > 0.0) ? (perSec / (single * (double)threads)) : 0.0,
+			(unsigned long long)((all.empty()) ? 0 : all[all.size() / 2]),
+			(unsigned long long)((all.empty()) ? 0 : all[std::min(all.size() - 1,(all.size() * 99) / 100)]),
+			(unsigned long long)((all.empty()) ? 0 : all[std::min(all.size() - 1,(all.size() * 999) / 1000)]));
+
+		if (threads >= contentionThreads)
+			break;
+	}
+}
+
+static void benchContention()
+{
+	if ((benchFilter)&&(!strstr("contention",benchFilter))&&(strncmp(benchFilter,"contention/",11) != 0))
+		return;
+
+	ZT_Node *const node = benchNewNode((void *)0,OSUtils::now());
+	if (!node)
+		return;
+
+	{
+		// A private environment so the node's own background work doesn't interfere
+		RuntimeEnvironment env(reinterpret_cast<Node *>(node));
+		env.identity.generate(0);
+		Trace trace(&env);
+		Switch sw(&env);
+		Multicaster mc(&env);
+		Topology topo(&env,(void *)0);
+		Shaper shaper(&env,OSUtils::now());
+		env.t = &trace;
+		env.sw = &sw;
+		env.mc = &mc;
+		env.topology = &topo;
+		env.shaper = &shaper;
+		const int64_t now = OSUtils::now();
+
+		// Peers share one public key and skip key agreement, as in benchTopology()
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		std::vector<Address> peers,unknown;
+		std::vector<InetAddress> paths;
+		while (peers.size() < ZT_BENCHMARK_CONTENTION_PEERS) {
+			Identity pid;
+			if ((!benchSyntheticIdentity(env.identity,pid))||(pid.address() == env.identity.address()))
+				continue;
+			topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,pid,key)));
+			peers.push_back(pid.address());
+			paths.push_back(InetAddress(Utils::hton((uint32_t)(0x0a000000 + (uint32_t)peers.size())),9993));
+			uint64_t a = 0;
+			Utils::getSecureRandom(&a,sizeof(a));
+			unknown.push_back(Address(a & 0xffffffffffULL));
+		}
+		std::vector<uint32_t> zipfPeers,zipfGroups,zipfFlows;
+		benchZipf(zipfPeers,ZT_BENCHMARK_CONTENTION_PEERS);
+		benchZipf(zipfGroups,ZT_BENCHMARK_CONTENTION_GROUPS);
+		benchZipf(zipfFlows,ZT_BENCHMARK_CONTENTION_FLOWS);
+
+		Identity controller;
+		controller.generate(0);
+		topo.addPeer((void *)0,SharedPtr<Peer>(new Peer(&env,env.identity,controller)));
+		NetworkConfig *const nconf = new NetworkConfig();
+		benchMakeConfig(*nconf,controller,env.identity,now);
+		const SharedPtr<Network> nw(new Network(&env,(void *)0,nconf->networkId,(void *)0,nconf));
+		const uint64_t nwid = nconf->networkId;
+		const MulticastGroup bcast(MAC(0xffffffffffffULL),0);
+		for(unsigned int i=0;i<ZT_BENCHMARK_MULTICAST_LIMIT;++i)
+			mc.add((void *)0,now,nwid,bcast,peers[i]);
+		std::vector<MulticastGroup> groups;
+		for(unsigned int i=0;i<ZT_BENCHMARK_CONTENTION_GROUPS;++i)
+			groups.push_back(MulticastGroup(MAC(0x01005e000000ULL + i),0));
+
+		// Flows alternate between ports the rules accept and ones they drop
+		std::vector<BenchFilterFrame> flows;
+		const MAC macLocal(env.identity.address(),nwid);
+		for(unsigned int i=0;i<ZT_BENCHMARK_CONTENTION_FLOWS;++i)
+			flows.push_back(benchFilterFrame("",ZT_ETHERTYPE_IPV4,0x06,(i & 1) ? (20 + ((i % 8) * 1000)) : (30000 + i),macLocal,MAC(peers[i],nwid)));
+
+		benchContentionRun("topology-get",[&](unsigned int,uint64_t n) {
+			benchSink += (uint64_t)(topo.getPeer((void *)0,peers[benchZipfKey(zipfPeers,n)]) ? 1 : 0);
+		});
+
+		std::vector< std::vector<uint8_t> > fragments(contentionThreads,std::vector<uint8_t>(ZT_PROTO_MIN_FRAGMENT_LENGTH + 128,0));
+		benchContentionRun("switch-rx",[&](unsigned int t,uint64_t n) {
+			// Fragments 1 and 2 of 3 of packets whose heads never come
+			uint8_t *const f = fragments[t].data();
+			const uint64_t packetId = ((uint64_t)t << 48) | (n >> 1);
+			memcpy(f,&packetId,8);
+			env.identity.address().copyTo(f + ZT_PACKET_FRAGMENT_IDX_DEST,ZT_ADDRESS_LENGTH);
+			f[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] = ZT_PACKET_FRAGMENT_INDICATOR;
+			f[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] = (uint8_t)(0x30 | (1 + (n & 1)));
+			sw.onRemotePacket((void *)0,1,paths[benchZipfKey(zipfPeers,n)],f,(unsigned int)fragments[t].size());
+		});
+
+		benchContentionRun("switch-tx",[&](unsigned int,uint64_t n) {
+			Packet p(unknown[benchZipfKey(zipfPeers,n)],env.identity.address(),Packet::VERB_NOP);
+			p.append((uint64_t)n);
+			sw.send((void *)0,p,true);
+		});
+
+		benchContentionRun("multicaster-add",[&](unsigned int,uint64_t n) {
+			mc.add((void *)0,now,nwid,groups[benchZipfKey(zipfGroups,n)],peers[benchZipfKey(zipfPeers,n + 1)]);
+		});
+
+		const BenchFilterFrame &mf = flows[0];
+		benchContentionRun("multicaster-send",[&](unsigned int,uint64_t) {
+			mc.send((void *)0,now,nw,Address(),bcast,MAC(),mf.etherType,mf.data.data(),(unsigned int)mf.data.size());
+		});
+
+		benchContentionRun("network-filter",[&](unsigned int,uint64_t n) {
+			const BenchFilterFrame &f = flows[benchZipfKey(zipfFlows,n)];
+			benchSink += (uint64_t)nw->filterOutgoingPacket((void *)0,true,env.identity.address(),f.macDest.toAddress(nwid),f.macSource,f.macDest,f.data.data(),(unsigned int)f.data.size(),f.etherType,0);
+		});
+
+		benchContentionRun("random",[&](unsigned int,uint64_t) {
+			uint8_t r[16];
+			Utils::getSecureRandom(r,sizeof(r));
+			benchSink += r[0];
+		});
+
+		delete nconf;
+	}
+
+	ZT_Node_delete(node);
+}
+
+/*
+ * End to end data path: several Nodes in this process are joined to one
+ * public network and connected by in-memory wires. Frames are injected at
+ * the first node's virtual port and pass through Switch, the outbound
+ * filter, armoring, the wire, dearmoring and the inbound filter to the
+ * other nodes' virtual network frame callbacks, which stand in for taps.
+ *
+ * Each sending thread has its own wire, a locked ring of packets drained
+ * by its own receiving thread, so that threads only meet inside the core.
+ * A sender waits while its wire holds ZT_BENCHMARK_LOOPBACK_WIRE_INFLIGHT
+ * packets, so latency (timestamped in the frame, taken at the callback)
+ * includes at most that much queueing. Delivered frames per second,
+ * Gbit/s of frame payload and sampled per-frame latency are reported.
+ */
+struct BenchLoopback;
+
+struct BenchWirePacket
+{
+	unsigned int to;
+	unsigned int from;
+	unsigned int len;
+	uint8_t data[ZT_MAX_PHYSMTU];
+};
+
+struct BenchWire
+{
+	BenchWire() :
+		head(0),
+		tail(0),
+		depth(0),
+		drops(0),
+		packets(0),
+		frames(0),
+		bytes(0) {}
+
+	inline bool push(const unsigned int to,const unsigned int from,const void *data,const unsigned int len)
+	{
+		if (len > ZT_MAX_PHYSMTU)
+			return false;
+		Mutex::Lock _l(lock);
+		if ((head - tail) >= ZT_BENCHMARK_LOOPBACK_WIRE_SLOTS) {
+			++drops;
+			return false;
+		}
+		++packets;
+		BenchWirePacket &p = slots[head++ % ZT_BENCHMARK_LOOPBACK_WIRE_SLOTS];
+		p.to = to;
+		p.from = from;
+		p.len = len;
+		memcpy(p.data,data,len);
+		depth.store((unsigned int)(head - tail),std::memory_order_relaxed);
+		return true;
+	}
+
+	inline bool pop(BenchWirePacket &p)
+	{
+		Mutex::Lock _l(lock);
+		if (head == tail)
+			return false;
+		const BenchWirePacket &s = slots[tail++ % ZT_BENCHMARK_LOOPBACK_WIRE_SLOTS];
+		p.to = s.to;
+		p.from = s.from;
+		p.len = s.len;
+		memcpy(p.data,s.data,s.len);
+		depth.store((unsigned int)(head - tail),std::memory_order_relaxed);
+		return true;
+	}
+
+	Mutex lock;
+	BenchWirePacket slots[ZT_BENCHMARK_LOOPBACK_WIRE_SLOTS];
+	uint64_t head,tail; // guarded by lock
+	std::atomic<unsigned int> depth;
+	uint64_t drops; // guarded by lock
+	uint64_t packets; // guarded by lock
+
+	// Written only by this wire's receiving thread
+	std::atomic<uint64_t> frames;
+	std::atomic<uint64_t> bytes;
+	std::vector<uint64_t> latencies;
+};
+
+struct BenchLoopNode
+{
+	BenchLoopback *lb;
+	unsigned int index;
+	ZT_Node *node;
+	Identity id;
+	InetAddress addr;
+};
+
+struct BenchLoopback
+{
+	BenchLoopback() : measuring(false) {}
+	std::vector<BenchLoopNode> nodes;
+	std::vector<BenchWire *> wires;
+	std::atomic_bool measuring;
+};
+
+static void benchLoopStatePut(ZT_Node *,void *uptr,void *,enum ZT_StateObjectType type,const uint64_t [2],const void *data,int len)
+{
+	// Keep each node's generated identity so HELLOs can be made up for it
+	if ((type == ZT_STATE_OBJECT_IDENTITY_SECRET)&&(len > 0)) {
+		BenchLoopNode *const n = reinterpret_cast<BenchLoopNode *>(uptr);
+		n->id.fromString(std::string(reinterpret_cast<const char *>(data),(std::size_t)len).c_str());
+	}
+}
+static int benchLoopWireSend(ZT_Node *,void *uptr,void *tptr,int64_t,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int)
+{
+	const BenchLoopNode *const n = reinterpret_cast<const BenchLoopNode *>(uptr);
+	BenchWire *const w = (tptr) ? reinterpret_cast<BenchWire *>(tptr) : n->lb->wires[0];
+	for(std::vector<BenchLoopNode>::const_iterator to(n->lb->nodes.begin());to!=n->lb->nodes.end();++to) {
+		if ((to->index != n->index)&&(to->addr == *reinterpret_cast<const InetAddress *>(addr)))
+			return (w->push(to->index,n->index,data,len)) ? 0 : -1;
+	}
+	return -1; // roots, controllers and anything else not in this process are unreachable
+}
+static void benchLoopFrame(ZT_Node *,void *uptr,void *tptr,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *data,unsigned int len)
+{
+	BenchWire *const w = reinterpret_cast<BenchWire *>(tptr);
+	if ((!w)||(len < 36))
+		return;
+	const BenchLoopNode *const n = reinterpret_cast<const BenchLoopNode *>(uptr);
+	const uint64_t f = w->frames.load(std::memory_order_relaxed) + 1;
+	w->frames.store(f,std::memory_order_relaxed);
+	w->bytes.store(w->bytes.load(std::memory_order_relaxed) + len,std::memory_order_relaxed);
+	if (((f % ZT_BENCHMARK_LOOPBACK_LATENCY_SAMPLE) == 0)&&(n->lb->measuring.load(std::memory_order_relaxed))) {
+		uint64_t sent;
+		memcpy(&sent,reinterpret_cast<const uint8_t *>(data) + 28,8);
+		w->latencies.push_back(nowNs() - sent);
+	}
+}
+
+static void benchLoopFrameBuffer(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,ZT_FrameBuffer *fb)
+{
+	benchLoopFrame(node,uptr,tptr,nwid,nuptr,sourceMac,destMac,etherType,vlanId,reinterpret_cast<const uint8_t *>(fb->data),fb->length);
+	ZT_Node_freeFrameBuffer(node,fb);
+}
+
+// A public network, so no certificates are needed, whose extra rules are all evaluated and never match
+static void benchLoopConfig(NetworkConfig &nc,const uint64_t nwid,const Address &issuedTo,const int64_t now)
+{
+	nc.networkId = nwid;
+	nc.issuedTo = issuedTo;
+	nc.timestamp = now;
+	nc.revision = 1;
+	nc.type = ZT_NETWORK_TYPE_PUBLIC;
+	nc.mtu = ZT_DEFAULT_MTU;
+	nc.multicastLimit = 0;
+	nc.flags = (loopbackCompression) ? 0 : ZT_NETWORKCONFIG_FLAG_DISABLE_COMPRESSION;
+	Utils::scopy(nc.name,sizeof(nc.name),"benchmark");
+	ZT_VirtualNetworkRule *r = nc.rules;
+	for(unsigned int i=0;i<loopbackRules;++i) {
+		r->t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+		(r++)->v.ipProtocol = 0x06; // frames are UDP, so none of these match
+		r->t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+		r->v.port[0] = r->v.port[1] = 1000 + (i * 10);
+		++r;
+		(r++)->t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+	}
+	(r++)->t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+	nc.ruleCount = (unsigned int)(r - nc.rules);
+}
+
+// True once the first node has a live direct path to every other
+static bool benchLoopConnected(const BenchLoopback &lb)
+{
+	ZT_PeerList *pl = ZT_Node_peers(lb.nodes[0].node);
+	if (!pl)
+		return false;
+	unsigned int connected = 0;
+	for(unsigned long i=0;i<pl->peerCount;++i) {
+		for(std::vector<BenchLoopNode>::const_iterator n(lb.nodes.begin() + 1);n!=lb.nodes.end();++n) {
+			if (pl->peers[i].address == n->id.address().toInt()) {
+				for(unsigned int k=0;k<pl->peers[i].pathCount;++k) {
+					if (pl->peers[i].paths[k].preferred) {
+						++connected;
+						break;
+					}
+				}
+			}
+		}
+	}
+	ZT_Node_freeQueryResult(lb.nodes[0].node,pl);
+	return (connected == (lb.nodes.size() - 1));
+}
+
+static void benchLoopback()
+{
+	if ((benchFilter)&&(!strstr("loopback",benchFilter)))
+		return;
+
+	const uint64_t nwid = 0x8056c2e21c000001ULL;
+	ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = (loopbackLend) ? 2 : 0;
+	cb.stateGetFunction = benchStateGet;
+	cb.statePutFunction = benchLoopStatePut;
+	cb.wirePacketSendFunction = benchLoopWireSend;
+	cb.virtualNetworkFrameFunction = benchLoopFrame;
+	cb.virtualNetworkConfigFunction = benchNetworkConfig;
+	cb.eventCallback = benchEvent;
+	if (loopbackLend)
+		cb.virtualNetworkFrameBufferFunction = benchLoopFrameBuffer;
+
+	BenchLoopback lb;
+	lb.nodes.resize(loopbackNodes);
+	for(unsigned int t=0;t<loopbackThreads;++t)
+		lb.wires.push_back(new BenchWire());
+	int64_t now = OSUtils::now();
+	bool ok = true;
+	for(unsigned int i=0;i<loopbackNodes;++i) {
+		BenchLoopNode &n = lb.nodes[i];
+		n.lb = &lb;
+		n.index = i;
+		n.node = (ZT_Node *)0;
+		n.addr = InetAddress(Utils::hton((uint32_t)(0x0a000001 + ((i + 1) << 8))),9993);
+		if (ZT_Node_new(&(n.node),(void *)&n,(void *)0,&cb,now) != ZT_RESULT_OK) {
+			ok = false;
+			break;
+		}
+		ZT_Node_join(n.node,nwid,(void *)&n,(void *)0);
+		ZT_Node_setFrameAggregation(n.node,(loopbackBatch > 1) ? 1 : 0);
+		NetworkConfig *const nc = new NetworkConfig();
+		benchLoopConfig(*nc,nwid,n.id.address(),now);
+		reinterpret_cast<Node *>(n.node)->network(nwid)->setConfiguration((void *)0,*nc,false);
+		delete nc;
+	}
+
+	std::atomic_bool go(false),stop(false);
+	std::vector<std::thread> receivers;
+	if (ok) {
+		for(unsigned int t=0;t<loopbackThreads;++t) {
+			receivers.push_back(std::thread([&lb,&stop,t]() {
+				BenchWire *const w = lb.wires[t];
+				BenchWirePacket *const p = new BenchWirePacket();
+				volatile int64_t dl = 0;
+				while (!stop) {
+					if (w->pop(*p)) {
+						if (loopbackLend) {
+							// Stands in for a recv() straight into the lent buffer
+							ZT_Node *const node = lb.nodes[p->to].node;
+							ZT_FrameBuffer *const fb = ZT_Node_getFrameBuffer(node);
+							fb->data = reinterpret_cast<uint8_t *>(fb->data) - fb->headroom;
+							memcpy(fb->data,p->data,p->len);
+							fb->length = p->len;
+							fb->headroom = 0;
+							fb->tailroom = ZT_FRAME_BUFFER_SIZE - p->len;
+							ZT_Node_processWirePacketBuffer(node,(void *)w,OSUtils::now(),1,reinterpret_cast<const struct sockaddr_storage *>(&(lb.nodes[p->from].addr)),fb,&dl);
+						} else ZT_Node_processWirePacket(lb.nodes[p->to].node,(void *)w,OSUtils::now(),1,reinterpret_cast<const struct sockaddr_storage *>(&(lb.nodes[p->from].addr)),p->data,p->len,&dl);
+					} else std::this_thread::yield();
+				}
+				delete p;
+			}));
+		}
+
+		// A HELLO from each other node starts the first node's real HELLO/OK
+		// exchange with it, after which both have confirmed direct paths
+		for(unsigned int i=1;i<loopbackNodes;++i) {
+			uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+			lb.nodes[i].id.agree(lb.nodes[0].id,key,ZT_PEER_SECRET_KEY_LENGTH);
+			benchHello(lb.nodes[0].node,lb.nodes[0].id,lb.nodes[i].id,key,lb.nodes[i].addr,now);
+		}
+		const int64_t deadline = OSUtils::now() + ZT_BENCHMARK_LOOPBACK_SETUP_MS;
+		while (!(ok = benchLoopConnected(lb))) {
+			if (OSUtils::now() > deadline)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+
+	std::vector<std::thread> senders;
+	if (ok) {
+		for(unsigned int t=0;t<loopbackThreads;++t) {
+			senders.push_back(std::thread([&lb,&go,&stop,t,nwid]() {
+				BenchWire *const w = lb.wires[t];
+				const BenchLoopNode &to = lb.nodes[1 + (t % (lb.nodes.size() - 1))];
+				const MAC src(lb.nodes[0].id.address(),nwid),dst(to.id.address(),nwid);
+
+				// IPv4 UDP with a flow per thread, a send timestamp, then partly compressible filler
+				std::vector<uint8_t> frame(loopbackFrameBytes);
+				for(unsigned int i=36;i<loopbackFrameBytes;++i)
+					frame[i] = (uint8_t)((i & 64) ? (i * 7) : (i & 15));
+				frame[0] = 0x45;
+				frame[2] = (uint8_t)(loopbackFrameBytes >> 8);
+				frame[3] = (uint8_t)loopbackFrameBytes;
+				frame[8] = 64;
+				frame[9] = 0x11;
+				frame[12] = 10; frame[15] = 1;
+				frame[16] = 10; frame[19] = 2;
+				frame[20] = (uint8_t)((10000 + t) >> 8);
+				frame[21] = (uint8_t)(10000 + t);
+				frame[22] = 0x27;
+				frame[23] = 0x0f;
+
+				// With -b the same frame is handed over that many times per call, as a tap read batch would be
+				std::vector<ZT_VirtualNetworkFrame> batch(loopbackBatch);
+				for(std::vector<ZT_VirtualNetworkFrame>::iterator f(batch.begin());f!=batch.end();++f) {
+					memset(&(*f),0,sizeof(ZT_VirtualNetworkFrame));
+					f->sourceMac = src.toInt();
+					f->destMac = dst.toInt();
+					f->etherType = ZT_ETHERTYPE_IPV4;
+					f->data = frame.data();
+					f->length = loopbackFrameBytes;
+				}
+
+				volatile int64_t dl = 0;
+				while (!go)
+					std::this_thread::yield();
+				while (!stop) {
+					if (w->depth.load(std::memory_order_relaxed) >= ZT_BENCHMARK_LOOPBACK_WIRE_INFLIGHT) {
+						std::this_thread::yield();
+						continue;
+					}
+					const uint64_t ts = nowNs();
+					memcpy(frame.data() + 28,&ts,8);
+					if (loopbackLend) {
+						// Stands in for a tap read straight into the lent buffer after its headroom
+						ZT_FrameBuffer *const fb = ZT_Node_getFrameBuffer(lb.nodes[0].node);
+						memcpy(fb->data,frame.data(),loopbackFrameBytes);
+						fb->length = loopbackFrameBytes;
+						fb->tailroom -= loopbackFrameBytes;
+						ZT_Node_processVirtualNetworkFrameBuffer(lb.nodes[0].node,(void *)w,OSUtils::now(),nwid,src.toInt(),dst.toInt(),ZT_ETHERTYPE_IPV4,0,fb,&dl);
+					} else if (loopbackBatch > 1)
+						ZT_Node_processVirtualNetworkFrames(lb.nodes[0].node,(void *)w,OSUtils::now(),nwid,batch.data(),loopbackBatch,&dl);
+					else ZT_Node_processVirtualNetworkFrame(lb.nodes[0].node,(void *)w,OSUtils::now(),nwid,src.toInt(),dst.toInt(),ZT_ETHERTYPE_IPV4,0,frame.data(),loopbackFrameBytes,&dl);
+				}
+			}));
+		}
+
+		go = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_LOOPBACK_WARMUP_MS));
+		uint64_t f0 = 0,b0 = 0,p0 = 0;
+		for(std::vector<BenchWire *>::const_iterator w(lb.wires.begin());w!=lb.wires.end();++w) {
+			f0 += (*w)->frames.load(std::memory_order_relaxed);
+			b0 += (*w)->bytes.load(std::memory_order_relaxed);
+			Mutex::Lock _l((*w)->lock);
+			p0 += (*w)->packets;
+		}
+		lb.measuring = true;
+		const uint64_t start = nowNs();
+		std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_LOOPBACK_MS));
+		lb.measuring = false;
+		uint64_t f1 = 0,b1 = 0,p1 = 0;
+		for(std::vector<BenchWire *>::const_iterator w(lb.wires.begin());w!=lb.wires.end();++w) {
+			f1 += (*w)->frames.load(std::memory_order_relaxed);
+			b1 += (*w)->bytes.load(std::memory_order_relaxed);
+			Mutex::Lock _l((*w)->lock);
+			p1 += (*w)->packets;
+		}
+		const double elapsed = (double)(nowNs() - start) / 1000000000.0;
+		stop = true;
+		for(std::vector<std::thread>::iterator t(senders.begin());t!=senders.end();++t)
+			t->join();
+		for(std::vector<std::thread>::iterator t(receivers.begin());t!=receivers.end();++t)
+			t->join();
+
+		std::vector<uint64_t> lat;
+		uint64_t drops = 0;
+		for(std::vector<BenchWire *>::const_iterator w(lb.wires.begin());w!=lb.wires.end();++w) {
+			lat.insert(lat.end(),(*w)->latencies.begin(),(*w)->latencies.end());
+			drops += (*w)->drops;
+		}
+		std::sort(lat.begin(),lat.end());
+
+		benchResult("\"name\":\"loopback/%u/%ur/%ut\",\"nodes\":%u,\"threads\":%u,\"bytes\":%u,\"rules\":%u,\"compression\":%s,\"batch\":%u,\"lent\":%s,\"frames\":%llu,\"framesPerSec\":%.0f,\"wirePacketsPerSec\":%.0f,\"gbitPerSec\":%.3f,\"medianLatencyNs\":%llu,\"p99LatencyNs\":%llu,\"wireDrops\":%llu",
+			loopbackFrameBytes,loopbackRules,loopbackThreads,
+			loopbackNodes,loopbackThreads,loopbackFrameBytes,loopbackRules,(loopbackCompression) ? "true" : "false",loopbackBatch,(loopbackLend) ? "true" : "false",
+			(unsigned long long)(f1 - f0),
+			(double)(f1 - f0) / elapsed,
+			(double)(p1 - p0) / elapsed,
+			((double)(b1 - b0) * 8.0) / (elapsed * 1000000000.0),
+			(unsigned long long)((lat.empty()) ? 0 : lat[lat.size() / 2]),
+			(unsigned long long)((lat.empty()) ? 0 : lat[std::min(lat.size() - 1,(lat.size() * 99) / 100)]),
+			(unsigned long long)drops);
+	} else {
+		stop = true;
+		for(std::vector<std::thread>::iterator t(receivers.begin());t!=receivers.end();++t)
+			t->join();
+		fprintf(stderr,"loopback: nodes did not connect" ZT_EOL_S);
+	}
+
+	for(std::vector<BenchLoopNode>::iterator n(lb.nodes.begin());n!=lb.nodes.end();++n) {
+		if (n->node)
+			ZT_Node_delete(n->node);
+	}
+	for(std::vector<BenchWire *>::iterator w(lb.wires.begin());w!=lb.wires.end();++w)
+		delete *w;
+}
+
+/*
+ * Busy polling: one thread sends a timestamped datagram over loopback every
+ * ZT_BENCHMARK_BUSY_POLL_INTERVAL_US and another receives them through a
+ * Phy<>, first waiting for them normally and then spinning for -B
+ * microseconds before waiting (see Phy::setBusyPoll()). One-way latency is
+ * the time each was handed to the handler minus its timestamp, so with the
+ * sender idle in between it is mostly the cost of waking the receiver.
+ */
+struct BenchPollHandler
+{
+	BenchPollHandler() : received(0) {}
+	std::vector<uint64_t> latencies;
+	unsigned long received;
+
+	inline void phyOnDatagrams(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *datagrams,unsigned int count)
+	{
+		const uint64_t now = nowNs();
+		for(unsigned int i=0;i<count;++i) {
+			uint64_t ts;
+			if (datagrams[i].len < sizeof(ts))
+				continue;
+			memcpy(&ts,datagrams[i].data,sizeof(ts));
+			if (++received > ZT_BENCHMARK_BUSY_POLL_WARMUP)
+				latencies.push_back(now - ts);
+		}
+	}
+	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success) {}
+	inline void phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from) {}
+	inline void phyOnTcpClose(PhySocket *sock,void **uptr) {}
+	inline void phyOnTcpData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnTcpWritable(PhySocket *sock,void **uptr) {}
+#ifdef __UNIX_LIKE__
+	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool b) {}
+#endif
+	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
+};
+
+static void benchBusyPollMode(const unsigned long spin)
+{
+	char name[64];
+	OSUtils::ztsnprintf(name,sizeof(name),"busypoll/%luus",spin);
+	if ((benchFilter)&&(!strstr(name,benchFilter)))
+		return;
+
+	BenchPollHandler rh,sh;
+	Phy<BenchPollHandler *> rx(&rh,false,true),tx(&sh,false,true);
+	rx.setBusyPoll(spin,false);
+
+	struct sockaddr_in a;
+	memset(&a,0,sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = Utils::hton((uint32_t)0x7f000001);
+	PhySocket *const rs = rx.udpBind((const struct sockaddr *)&a);
+	PhySocket *const ts = tx.udpBind((const struct sockaddr *)&a);
+	socklen_t al = sizeof(a);
+	if ((!rs)||(!ts)||(getsockname(Phy<BenchPollHandler *>::getDescriptor(rs),(struct sockaddr *)&a,&al) != 0)) {
+		fprintf(stderr,"%s: unable to bind loopback UDP sockets" ZT_EOL_S,name);
+		return;
+	}
+
+	std::atomic_bool done(false);
+	std::thread sender([&tx,ts,&a,&done]() {
+		for(unsigned int i=0;i<(ZT_BENCHMARK_BUSY_POLL_WARMUP + ZT_BENCHMARK_BUSY_POLL_DATAGRAMS);++i) {
+			std::this_thread::sleep_for(std::chrono::microseconds(ZT_BENCHMARK_BUSY_POLL_INTERVAL_US));
+			const uint64_t now = nowNs();
+			tx.udpSend(ts,(const struct sockaddr *)&a,&now,sizeof(now));
+		}
+		done = true;
+	});
+	while (!done)
+		rx.poll(10);
+	sender.join();
+	for(int i=0;i<10;++i) // stragglers
+		rx.poll(1);
+
+	std::vector<uint64_t> &lat = rh.latencies;
+	std::sort(lat.begin(),lat.end());
+	benchResult("\"name\":\"%s\",\"spinUs\":%lu,\"datagrams\":%llu,\"medianLatencyNs\":%llu,\"p99LatencyNs\":%llu,\"maxLatencyNs\":%llu",
+		name,spin,
+		(unsigned long long)lat.size(),
+		(unsigned long long)((lat.empty()) ? 0 : lat[lat.size() / 2]),
+		(unsigned long long)((lat.empty()) ? 0 : lat[std::min(lat.size() - 1,(lat.size() * 99) / 100)]),
+		(unsigned long long)((lat.empty()) ? 0 : lat.back()));
+}
+
+static void benchBusyPoll()
+{
+	benchBusyPollMode(0);
+	if (busyPollSpin)
+		benchBusyPollMode(busyPollSpin);
+}
+
+/*
+ * Tap: frames go through the platform's tap driver on its own, with no
+ * node involved. For each frame size, "put" calls put() as fast as it can
+ * with frames addressed to a MAC the host doesn't have, so the kernel takes
+ * and drops them, and its latency is the time put() takes. "host" sends UDP
+ * datagrams from sockets bound to the tap's IP to its subnet's broadcast
+ * address, so the host stack writes them out through the tap to the
+ * handler, and its latency is from send to handler. CPU time and context
+ * switches are for the whole process, so they include the tap's threads
+ * and the senders. On Linux syscalls are the read and write calls counted
+ * in /proc/self/io, so select(), epoll and io_uring submissions are not
+ * among them, and every size is run again with each of the tap setups
+ * local.conf can pick, with one host sender per queue. Creating a tap
+ * needs root, and the benchmark is skipped if it can't.
+ */
+struct BenchTap
+{
+	BenchTap() : frames(0),measuring(false) {}
+	std::atomic<uint64_t> frames;
+	std::atomic_bool measuring;
+	Mutex lock;
+	std::vector<uint64_t> latencies;
+};
+static void benchTapHandler(void *arg,void *,uint64_t,const ZT_VirtualNetworkFrame *frames,unsigned int count)
+{
+	BenchTap *const bt = reinterpret_cast<BenchTap *>(arg);
+	const uint64_t now = nowNs();
+	for(unsigned int i=0;i<count;++i) {
+		if ((frames[i].etherType != ZT_ETHERTYPE_IPV4)||(frames[i].length < 20))
+			continue;
+		const uint8_t *const ip = reinterpret_cast<const uint8_t *>(frames[i].data);
+		const unsigned int ihl = (ip[0] & 0xf) * 4;
+		if ((ip[9] != 0x11)||(frames[i].length < (ihl + 16))||(((((unsigned int)ip[ihl + 2]) << 8) | (unsigned int)ip[ihl + 3]) != ZT_BENCHMARK_TAP_PORT))
+			continue;
+		if (((++bt->frames % ZT_BENCHMARK_TAP_LATENCY_SAMPLE) == 0)&&(bt->measuring)) {
+			uint64_t ts;
+			memcpy(&ts,ip + ihl + 8,sizeof(ts));
+			Mutex::Lock _l(bt->lock);
+			bt->latencies.push_back(now - ts);
+		}
+	}
+}
+
+struct BenchTapUsage
+{
+	uint64_t cpuNs;
+	uint64_t switches;
+	uint64_t syscalls;
+};
+static void benchTapUsage(BenchTapUsage &u)
+{
+	struct rusage ru;
+	memset(&ru,0,sizeof(ru));
+	getrusage(RUSAGE_SELF,&ru);
+	u.cpuNs = ((uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL) + ((uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL);
+	u.switches = (uint64_t)(ru.ru_nvcsw + ru.ru_nivcsw);
+	u.syscalls = 0;
+#ifdef __LINUX__
+	FILE *f = fopen("/proc/self/io","r");
+	if (f) {
+		char l[128];
+		unsigned long long n;
+		while (fgets(l,sizeof(l),f)) {
+			if ((sscanf(l,"syscr: %llu",&n) == 1)||(sscanf(l,"syscw: %llu",&n) == 1))
+				u.syscalls += (uint64_t)n;
+		}
+		fclose(f);
+	}
+#endif
+}
+
+static void benchTapResult(const char *name,const uint64_t frames,const uint64_t drops,const uint64_t elapsed,const BenchTapUsage &before,const BenchTapUsage &after,std::vector<uint64_t> &lat)
+{
+	const double n = (frames) ? (double)frames : 1.0;
+	std::sort(lat.begin(),lat.end());
+	char syscalls[64];
+	syscalls[0] = 0;
+#ifdef __LINUX__
+	OSUtils::ztsnprintf(syscalls,sizeof(syscalls),"\"syscallsPerFrame\":%.3f,",(double)(after.syscalls - before.syscalls) / n);
+#endif
+	benchResult("\"name\":\"%s\",\"frames\":%llu,\"framesPerSec\":%.0f,\"drops\":%llu,\"cpuNsPerFrame\":%.1f,\"contextSwitchesPerFrame\":%.4f,%s\"medianLatencyNs\":%llu,\"p99LatencyNs\":%llu",
+		name,
+		(unsigned long long)frames,
+		(double)frames / ((double)elapsed / 1000000000.0),
+		(unsigned long long)drops,
+		(double)(after.cpuNs - before.cpuNs) / n,
+		(double)(after.switches - before.switches) / n,
+		syscalls,
+		(unsigned long long)((lat.empty()) ? 0 : lat[lat.size() / 2]),
+		(unsigned long long)((lat.empty()) ? 0 : lat[std::min(lat.size() - 1,(lat.size() * 99) / 100)]));
+}
+
+static void benchTapPut(EthernetTap *tap,const char *setup,const unsigned int bytes)
+{
+	char name[64];
+	OSUtils::ztsnprintf(name,sizeof(name),"tap/%s/put/%u",setup,bytes);
+	if ((benchFilter)&&(!strstr(name,benchFilter)))
+		return;
+
+	std::vector<uint8_t> frame(bytes);
+	Utils::getSecureRandom(frame.data(),bytes);
+	const MAC from(ZT_BENCHMARK_TAP_MAC + 1),to(ZT_BENCHMARK_TAP_MAC + 2);
+	std::vector<uint64_t> lat;
+	BenchTapUsage before,after;
+	uint64_t frames = 0,start = nowNs(),end = start + (ZT_BENCHMARK_TAP_WARMUP_MS * 1000000ULL),now = start;
+#ifdef __LINUX__
+	uint64_t drops = 0;
+#endif
+	for(bool measuring=false;;) {
+		for(unsigned int i=0;i<ZT_BENCHMARK_TAP_LATENCY_SAMPLE;++i)
+			tap->put(from,to,ZT_ETHERTYPE_IPV4,frame.data(),bytes);
+		const uint64_t t = nowNs();
+		tap->put(from,to,ZT_ETHERTYPE_IPV4,frame.data(),bytes);
+		now = nowNs();
+		if (measuring) {
+			frames += ZT_BENCHMARK_TAP_LATENCY_SAMPLE + 1;
+			lat.push_back(now - t);
+		}
+		if (now >= end) {
+			if (measuring)
+				break;
+			measuring = true;
+			benchTapUsage(before);
+#ifdef __LINUX__
+			drops = tap->outputDrops();
+#endif
+			start = nowNs();
+			end = start + (ZT_BENCHMARK_TAP_MS * 1000000ULL);
+		}
+	}
+	benchTapUsage(after);
+#ifdef __LINUX__
+	drops = tap->outputDrops() - drops;
+#else
+	const uint64_t drops = 0;
+#endif
+	benchTapResult(name,frames,drops,now - start,before,after,lat);
+}
+
+static void benchTapHost(BenchTap &bt,const char *setup,const unsigned int bytes,const unsigned int senders)
+{
+	char name[64];
+	OSUtils::ztsnprintf(name,sizeof(name),"tap/%s/host/%u",setup,bytes);
+	if ((benchFilter)&&(!strstr(name,benchFilter)))
+		return;
+
+	// Ethernet payload is IPv4 and UDP headers and then a send timestamp
+	const unsigned int len = std::max(bytes,28U + 8U) - 28;
+	std::atomic_bool done(false);
+	std::atomic<uint64_t> sent(0);
+	std::vector<std::thread> threads;
+	for(unsigned int s=0;s<senders;++s) {
+		threads.push_back(std::thread([len,&done,&sent]() {
+			const int fd = (int)socket(AF_INET,SOCK_DGRAM,0);
+			if (fd < 0)
+				return;
+			int one = 1;
+			setsockopt(fd,SOL_SOCKET,SO_BROADCAST,(const char *)&one,sizeof(one));
+			const InetAddress local(ZT_BENCHMARK_TAP_IP),bcast(local.broadcast());
+			struct sockaddr_in a;
+			memcpy(&a,&local,sizeof(a));
+			a.sin_port = 0;
+			// Each sender has its own source port and so its own flow
+			if (bind(fd,(const struct sockaddr *)&a,sizeof(a)) == 0) {
+				memcpy(&a,&bcast,sizeof(a));
+				a.sin_port = Utils::hton((uint16_t)ZT_BENCHMARK_TAP_PORT);
+				std::vector<uint8_t> d(len);
+				while (!done) {
+					const uint64_t now = nowNs();
+					memcpy(d.data(),&now,sizeof(now));
+					if (sendto(fd,(const char *)d.data(),len,0,(const struct sockaddr *)&a,sizeof(a)) > 0)
+						++sent;
+				}
+			}
+			close(fd);
+		}));
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_TAP_WARMUP_MS));
+	{
+		Mutex::Lock _l(bt.lock);
+		bt.latencies.clear();
+	}
+	BenchTapUsage before,after;
+	benchTapUsage(before);
+	const uint64_t start = nowNs(),frames0 = bt.frames,sent0 = sent;
+	bt.measuring = true;
+	std::this_thread::sleep_for(std::chrono::milliseconds(ZT_BENCHMARK_TAP_MS));
+	bt.measuring = false;
+	const uint64_t end = nowNs(),frames = bt.frames - frames0,sentn = sent - sent0;
+	benchTapUsage(after);
+	done = true;
+	for(std::vector<std::thread>::iterator t(threads.begin());t!=threads.end();++t)
+		t->join();
+
+	std::vector<uint64_t> lat;
+	{
+		Mutex::Lock _l(bt.lock);
+		lat.swap(bt.latencies);
+	}
+	benchTapResult(name,frames,(sentn > frames) ? (sentn - frames) : 0,end - start,before,after,lat);
+}
+
+static const unsigned int benchTapFrameSizes[4] = { 64,512,1400,ZT_DEFAULT_MTU };
+
+static void benchTapSetup(const char *setup,const unsigned int senders)
+{
+	if (benchFilter) {
+		bool selected = false;
+		for(unsigned int s=0;s<4;++s) {
+			char name[64];
+			OSUtils::ztsnprintf(name,sizeof(name),"tap/%s/put/%u",setup,benchTapFrameSizes[s]);
+			selected |= (strstr(name,benchFilter) != (const char *)0);
+			OSUtils::ztsnprintf(name,sizeof(name),"tap/%s/host/%u",setup,benchTapFrameSizes[s]);
+			selected |= (strstr(name,benchFilter) != (const char *)0);
+		}
+		if (!selected)
+			return;
+	}
+
+	char home[64];
+	Utils::scopy(home,sizeof(home),"/tmp/zt-benchmark-tap-XXXXXX");
+	if (!mkdtemp(home)) {
+		fprintf(stderr,"tap/%s: unable to create temporary home path" ZT_EOL_S,setup);
+		return;
+	}
+	BenchTap bt;
+	EthernetTap *tap = (EthernetTap *)0;
+	try {
+		tap = new EthernetTap(home,MAC(ZT_BENCHMARK_TAP_MAC),ZT_DEFAULT_MTU,0,ZT_BENCHMARK_TAP_NWID,"zt-benchmark",benchTapHandler,&bt);
+	} catch (std::exception &e) {
+		fprintf(stderr,"tap/%s: unable to create tap (skipped): %s" ZT_EOL_S,setup,e.what());
+	} catch ( ... ) {
+		fprintf(stderr,"tap/%s: unable to create tap (skipped)" ZT_EOL_S,setup);
+	}
+	if (tap) {
+		tap->setEnabled(true);
+		const bool ip = tap->addIp(InetAddress(ZT_BENCHMARK_TAP_IP));
+		if (!ip)
+			fprintf(stderr,"tap/%s: unable to assign " ZT_BENCHMARK_TAP_IP " to tap (host frames skipped)" ZT_EOL_S,setup);
+		for(unsigned int s=0;s<4;++s) {
+			benchTapPut(tap,setup,benchTapFrameSizes[s]);
+			if (ip)
+				benchTapHost(bt,setup,benchTapFrameSizes[s],senders);
+		}
+		delete tap;
+	}
+	::unlink((std::string(home) + ZT_PATH_SEPARATOR_S + "devicemap").c_str());
+	::rmdir(home);
+}
+
+static void benchTap()
+{
+#ifdef __LINUX__
+	// Setups OneService picks from local.conf (see LinuxEthernetTap), each on a new tap
+	static const struct { const char *name; bool ioUring; unsigned int queues; bool offload; unsigned int outputQueue; unsigned int threads; } setups[6] = {
+		{ "default",false,1,false,0,0 },
+		{ "queues4",false,4,false,0,0 },
+		{ "io-uring",true,1,false,0,0 },
+		{ "offload",false,1,true,0,0 },
+		{ "output-queue",false,1,false,1024,0 },
+		{ "shared-thread",false,1,false,0,1 }
+	};
+	for(unsigned int i=0;i<6;++i) {
+		LinuxEthernetTap::setIoUring(setups[i].ioUring);
+		LinuxEthernetTap::setQueues(setups[i].queues);
+		LinuxEthernetTap::setOffload(setups[i].offload);
+		LinuxEthernetTap::setOutputQueue(setups[i].outputQueue);
+		LinuxEthernetTap::setThreads(setups[i].threads);
+		benchTapSetup(setups[i].name,setups[i].queues);
+	}
+	LinuxEthernetTap::setIoUring(false);
+	LinuxEthernetTap::setQueues(1);
+	LinuxEthernetTap::setOffload(false);
+	LinuxEthernetTap::setOutputQueue(0);
+	LinuxEthernetTap::setThreads(0);
+#else
+	benchTapSetup("default",1);
+#endif
+}
+
+/*
+ * Replay: datagrams recorded at a node through POST /record are fed to a
+ * Node that has that node's identity and state (from its home directory),
+ * in order and with the recorded timestamps as its clock, so background
+ * tasks run when they would have. Replies and frames are counted and
+ * discarded. By default datagrams are processed as fast as possible,
+ * giving packets per second for real traffic from e.g. a busy root; with
+ * -R they are paced to recorded speed, which suits profiling with perf.
+ *
+ * Peers are only known if their HELLOs are in the recording or their
+ * state is in peers.d, so a short recording of a node with no peer cache
+ * will mostly be dropped while waiting for WHOIS replies that never come.
+ */
+struct BenchReplay
+{
+	BenchReplay() : packetsSent(0),bytesSent(0),frames(0) {}
+	std::string home;
+	uint64_t packetsSent;
+	uint64_t bytesSent;
+	uint64_t frames;
+};
+static int benchReplayStateGet(ZT_Node *,void *uptr,void *,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{
+	const BenchReplay *const r = reinterpret_cast<const BenchReplay *>(uptr);
+	char p[4096];
+	switch(type) {
+		case ZT_STATE_OBJECT_IDENTITY_PUBLIC:
+			OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",r->home.c_str());
+			break;
+		case ZT_STATE_OBJECT_IDENTITY_SECRET:
+			OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",r->home.c_str());
+			break;
+		case ZT_STATE_OBJECT_PLANET:
+			OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",r->home.c_str());
+			break;
+		case ZT_STATE_OBJECT_MOON:
+			OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d" ZT_PATH_SEPARATOR_S "%.16llx.moon",r->home.c_str(),(unsigned long long)id[0]);
+			break;
+		case ZT_STATE_OBJECT_NETWORK_CONFIG:
+			OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.conf",r->home.c_str(),(unsigned long long)id[0]);
+			break;
+		case ZT_STATE_OBJECT_PEER:
+			OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d" ZT_PATH_SEPARATOR_S "%.10llx.peer",r->home.c_str(),(unsigned long long)id[0]);
+			break;
+		default:
+			return -1;
+	}
+	FILE *f = fopen(p,"rb");
+	if (!f)
+		return -1;
+	const int n = (int)fread(data,1,maxlen,f);
+	fclose(f);
+	return n;
+}
+static int benchReplayWireSend(ZT_Node *,void *uptr,void *,int64_t,const struct sockaddr_storage *,const void *,unsigned int len,unsigned int)
+{
+	BenchReplay *const r = reinterpret_cast<BenchReplay *>(uptr);
+	++r->packetsSent;
+	r->bytesSent += len;
+	return 0;
+}
+static void benchReplayFrame(ZT_Node *,void *uptr,void *,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *,unsigned int)
+{
+	++reinterpret_cast<BenchReplay *>(uptr)->frames;
+}
+
+static void benchReplay()
+{
+	if ((!replayPath)||((benchFilter)&&(!strstr("replay",benchFilter))))
+		return;
+
+	WireRecorder::Reader rd;
+	if (!rd.open(replayPath)) {
+		fprintf(stderr,"replay: %s is not a wire recording" ZT_EOL_S,replayPath);
+		return;
+	}
+
+	BenchReplay r;
+	r.home = (replayHome) ? replayHome : ".";
+	ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.stateGetFunction = benchReplayStateGet;
+	cb.statePutFunction = benchStatePut;
+	cb.wirePacketSendFunction = benchReplayWireSend;
+	cb.virtualNetworkFrameFunction = benchReplayFrame;
+	cb.virtualNetworkConfigFunction = benchNetworkConfig;
+	cb.eventCallback = benchEvent;
+	ZT_Node *node = (ZT_Node *)0;
+	int64_t now = rd.start();
+	if (ZT_Node_new(&node,(void *)&r,(void *)0,&cb,now) != ZT_RESULT_OK)
+		return;
+	ZT_NodeStatus st;
+	ZT_Node_status(node,&st);
+	if (st.address != rd.address())
+		fprintf(stderr,"replay: recording was made by %.10llx but %s holds the identity of %.10llx" ZT_EOL_S,(unsigned long long)rd.address(),r.home.c_str(),(unsigned long long)st.address);
+
+	// Join networks and orbit moons as the service would have
+	std::vector<std::string> d(OSUtils::listDirectory((r.home + ZT_PATH_SEPARATOR_S "networks.d").c_str()));
+	for(std::vector<std::string>::iterator f(d.begin());f!=d.end();++f) {
+		if ((f->length() == 21)&&(f->substr(16) == ".conf"))
+			ZT_Node_join(node,Utils::hexStrToU64(f->substr(0,16).c_str()),(void *)0,(void *)0);
+	}
+	d = OSUtils::listDirectory((r.home + ZT_PATH_SEPARATOR_S "moons.d").c_str());
+	for(std::vector<std::string>::iterator f(d.begin());f!=d.end();++f) {
+		if ((f->length() == 21)&&(f->substr(16) == ".moon"))
+			ZT_Node_orbit(node,(void *)0,Utils::hexStrToU64(f->substr(0,16).c_str()),0);
+	}
+
+	ZT_Metrics *const m0 = new ZT_Metrics();
+	ZT_Metrics *const m1 = new ZT_Metrics();
+	ZT_Node_metrics(node,m0);
+
+	WireRecorder::Record *const rec = new WireRecorder::Record();
+	volatile int64_t nextDeadline = 0;
+	uint64_t packets = 0,bytes = 0;
+	int64_t last = now;
+	const uint64_t start = nowNs();
+	while (rd.next(*rec)) {
+		now = std::max(now,rec->timestamp); // clock never goes backwards
+		if (replayRealtime) {
+			const uint64_t due = start + ((uint64_t)(now - rd.start()) * 1000000ULL);
+			const uint64_t t = nowNs();
+			if (due > t)
+				std::this_thread::sleep_for(std::chrono::nanoseconds(due - t));
+		}
+		if (now >= nextDeadline)
+			ZT_Node_processBackgroundTasks(node,(void *)0,now,&nextDeadline);
+		const int64_t sock = (rec->socket == ZT_WIRE_RECORDER_SOCKET_TCP) ? -1 : (int64_t)(rec->socket + 1);
+		ZT_Node_processWirePacket(node,(void *)0,now,sock,reinterpret_cast<const struct sockaddr_storage *>(&(rec->from)),rec->data,rec->len,&nextDeadline);
+		++packets;
+		bytes += rec->len;
+		last = now;
+	}
+	const uint64_t elapsed = nowNs() - start;
+	ZT_Node_metrics(node,m1);
+
+	uint64_t in = 0,drops = 0;
+	for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v)
+		in += m1->packetsIn[v] - m0->packetsIn[v];
+	for(unsigned int k=0;k<ZT_METRICS_DROP_REASON_COUNT;++k)
+		drops += m1->drops[k] - m0->drops[k];
+
+	benchResult("\"name\":\"replay\",\"realtime\":%s,\"packets\":%llu,\"bytes\":%llu,\"recordedSeconds\":%.3f,\"seconds\":%.3f,\"packetsPerSec\":%.0f,\"decoded\":%llu,\"drops\":%llu,\"packetsSent\":%llu,\"bytesSent\":%llu,\"frames\":%llu",
+		(replayRealtime) ? "true" : "false",
+		(unsigned long long)packets,
+		(unsigned long long)bytes,
+		(double)(last - rd.start()) / 1000.0,
+		(double)elapsed / 1000000000.0,
+		(elapsed) ? ((double)packets / ((double)elapsed / 1000000000.0)) : 0.0,
+		(unsigned long long)in,
+		(unsigned long long)drops,
+		(unsigned long long)r.packetsSent,
+		(unsigned long long)r.bytesSent,
+		(unsigned long long)r.frames);
+
+	delete rec;
+	delete m1;
+	delete m0;
+	ZT_Node_delete(node);
+}
+
+#ifdef ZT_MUTEX_PROFILING
+static bool lockMoreContended(const ZT_LockProfile &a,const ZT_LockProfile &b) { return (a.waitNanoseconds > b.waitNanoseconds); }
+#endif
+
+int main(int argc,char **argv)
+{
+	for(int i=1;i<argc;++i) {
+		if ((!strcmp(argv[i],"-s"))&&((i + 1) < argc)) {
+			benchSamples = std::max(1,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-w"))&&((i + 1) < argc)) {
+			benchWarmup = (unsigned int)std::max(0,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-f"))&&((i + 1) < argc)) {
+			loopbackFrameBytes = (unsigned int)std::min(ZT_DEFAULT_MTU,std::max(64,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-r"))&&((i + 1) < argc)) {
+			loopbackRules = (unsigned int)std::min((ZT_MAX_NETWORK_RULES - 1) / 3,std::max(0,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-t"))&&((i + 1) < argc)) {
+			loopbackThreads = (unsigned int)std::min(64,std::max(1,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-n"))&&((i + 1) < argc)) {
+			loopbackNodes = (unsigned int)std::min(ZT_BENCHMARK_LOOPBACK_MAX_NODES,std::max(2,atoi(argv[++i])));
+		} else if (!strcmp(argv[i],"-c")) {
+			loopbackCompression = true;
+		} else if ((!strcmp(argv[i],"-b"))&&((i + 1) < argc)) {
+			loopbackBatch = (unsigned int)std::min(256,std::max(1,atoi(argv[++i])));
+		} else if (!strcmp(argv[i],"-z")) {
+			loopbackLend = true;
+		} else if ((!strcmp(argv[i],"-F"))&&((i + 1) < argc)) {
+			ruleFiles.push_back(argv[++i]);
+		} else if ((!strcmp(argv[i],"-P"))&&((i + 1) < argc)) {
+			rulesPcap = argv[++i];
+		} else if ((!strcmp(argv[i],"-T"))&&((i + 1) < argc)) {
+			contentionThreads = (unsigned int)std::min(64,std::max(1,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-N"))&&((i + 1) < argc)) {
+			rootPeers = std::min((unsigned long)ZT_BENCHMARK_ROOT_MAX_PEERS,std::max(1000UL,strtoul(argv[++i],(char **)0,10)));
+		} else if ((!strcmp(argv[i],"-B"))&&((i + 1) < argc)) {
+			busyPollSpin = (unsigned long)std::min(1000000,std::max(0,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-p"))&&((i + 1) < argc)) {
+			replayPath = argv[++i];
+		} else if ((!strcmp(argv[i],"-H"))&&((i + 1) < argc)) {
+			replayHome = argv[++i];
+		} else if (!strcmp(argv[i],"-R")) {
+			replayRealtime = true;
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr,"Usage: %s [-s <samples>] [-w <warmup samples>] [-f <frame bytes>] [-r <rules>] [-t <threads>] [-n <nodes>] [-c] [-b <frames per call>] [-z] [-F <compiled rules>] [-P <pcapng>] [-T <threads>] [-N <peers>] [-B <spin usec>] [-p <recording> [-H <home path>] [-R]] [<name filter>]" ZT_EOL_S,argv[0]);
+			return 1;
+		} else {
+			benchFilter = argv[i];
+		}
+	}
+
+	uint8_t *const buf = new uint8_t[16384];
+	Utils::getSecureRandom(buf,16384);
+
+	printf("{\n  \"version\":\"%d.%d.%d\",\n  \"salsa2012Kernel\":\"%s\",\n  \"poly1305Kernel\":\"%s\",\n  \"aesKernel\":\"%s\",\n  \"c25519Backend\":\"%s\",\n  \"warmup\":%u,\n  \"samples\":%u,\n  \"results\":[",ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION,Salsa20::kernelName(Salsa20::kernel()),Poly1305::kernelName(Poly1305::kernel()),AES::kernelName(AES::kernel()),C25519::backendName(C25519::backend()),benchWarmup,benchSamples);
+
+	benchSalsa20(buf);
+	benchPoly1305(buf);
+	benchArmor();
+	benchCompress();
+	benchIdentity();
+	benchHashtable();
+	benchSerialization();
+	benchNodeRx();
+	benchRelay();
+	benchHelloStorm();
+	benchTopology();
+	benchPeerTiering();
+	benchStateSnapshot();
+	benchMulticast();
+	benchMemoryBudget();
+	benchRootFootprint();
+	benchRules();
+	benchContention();
+	benchLoopback();
+	benchBusyPoll();
+	benchTap();
+	benchReplay();
+
+	printf("\n  ]");
+#ifdef ZT_MUTEX_PROFILING
+	// Locks taken while benchmarking, most contended first
+	std::vector<ZT_LockProfile> locks(256);
+	locks.resize(MutexProfile::snapshot(locks.data(),(unsigned int)locks.size()));
+	std::sort(locks.begin(),locks.end(),lockMoreContended);
+	printf(",\n  \"locks\":[");
+	bool firstLock = true;
+	for(std::vector<ZT_LockProfile>::const_iterator l(locks.begin());l!=locks.end();++l) {
+		if (!l->acquisitions)
+			continue;
+		uint64_t held = 0;
+		for(unsigned int b=0;b<ZT_LOCK_PROFILE_HOLD_BUCKETS;++b)
+			held += l->hold[b];
+		printf("%s\n    {\"name\":\"%s\",\"acquisitions\":%llu,\"contended\":%llu,\"waitNs\":%llu,\"meanHoldNs\":%.1f,\"hold\":[",(firstLock) ? "" : ",",l->name,(unsigned long long)l->acquisitions,(unsigned long long)l->contended,(unsigned long long)l->waitNanoseconds,(held) ? ((double)l->holdNanoseconds / (double)held) : 0.0);
+		for(unsigned int b=0;b<ZT_LOCK_PROFILE_HOLD_BUCKETS;++b)
+			printf("%s%llu",(b) ? "," : "",(unsigned long long)l->hold[b]);
+		printf("]}");
+		firstLock = false;
+	}
+	printf("\n  ]");
+#endif
+	printf("\n}\n");
+
+	delete [] buf;
+	return 0;
+}
@@ -20,6 +20,7 @@
 #include "EmbeddedNetworkController.hpp"
 
 #include <chrono>
+#include <map>
 #include <algorithm>
 #include <stdexcept>
 
@@ -27,6 +28,109 @@ using json = nlohmann::json;
 
 namespace ZeroTier {
 
+// IP addresses as 128-bit integers (high, low) for allocation tracking; IPv4 uses only the low 32 bits
+typedef std::pair<uint64_t,uint64_t> _IpKey;
+typedef std::map<_IpKey,_IpKey> _IpRuns;
+
+static inline bool _ipKey(const InetAddress &ip,_IpKey &k)
+{
+	if (ip.ss_family == AF_INET) {
+		k.first = 0;
+		k.second = (uint64_t)Utils::ntoh((uint32_t)reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr);
+		return true;
+	} else if (ip.ss_family == AF_INET6) {
+		uint64_t w[2];
+		memcpy(w,reinterpret_cast<const struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
+		k.first = Utils::ntoh(w[0]);
+		k.second = Utils::ntoh(w[1]);
+		return true;
+	}
+	return false;
+}
+
+static inline InetAddress _ipFromKey(const int family,const _IpKey &k,const unsigned int port)
+{
+	if (family == AF_INET)
+		return InetAddress(Utils::hton((uint32_t)k.second),port);
+	uint64_t w[2];
+	w[0] = Utils::hton(k.first);
+	w[1] = Utils::hton(k.second);
+	return InetAddress((const void *)w,16,port);
+}
+
+static inline _IpKey _ipNext(const _IpKey &k) { return _IpKey(k.first + ((k.second == 0xffffffffffffffffULL) ? 1ULL : 0ULL),k.second + 1ULL); }
+static inline _IpKey _ipPrev(const _IpKey &k) { return _IpKey(k.first - ((k.second == 0) ? 1ULL : 0ULL),k.second - 1ULL); }
+
+static void _ipRunsAdd(_IpRuns &runs,const _IpKey &k)
+{
+	_IpRuns::iterator next(runs.upper_bound(k));
+	_IpRuns::iterator prev(runs.end());
+	if (next != runs.begin()) {
+		prev = next;
+		--prev;
+		if (!(prev->second < k))
+			return; // already allocated
+	}
+	const bool joinPrev = ((prev != runs.end())&&(_ipNext(prev->second) == k));
+	const bool joinNext = ((next != runs.end())&&(_ipNext(k) == next->first));
+	if (joinPrev) {
+		if (joinNext) {
+			prev->second = next->second;
+			runs.erase(next);
+		} else {
+			prev->second = k;
+		}
+	} else if (joinNext) {
+		const _IpKey last(next->second);
+		runs.erase(next);
+		runs[k] = last;
+	} else {
+		runs[k] = k;
+	}
+}
+
+static void _ipRunsRemove(_IpRuns &runs,const _IpKey &k)
+{
+	_IpRuns::iterator r(runs.upper_bound(k));
+	if (r == runs.begin())
+		return;
+	--r;
+	if (r->second < k)
+		return;
+	const _IpKey last(r->second);
+	if (r->first == k)
+		runs.erase(r);
+	else r->second = _ipPrev(k);
+	if (k < last)
+		runs[_ipNext(k)] = last;
+}
+
+// Finds the first unallocated address in [from,to], skipping over whole runs at a time
+static bool _ipRunsFirstFree(const _IpRuns &runs,_IpKey from,const _IpKey &to,const bool v4,_IpKey &found)
+{
+	while (!(to < from)) {
+		_IpRuns::const_iterator r(runs.upper_bound(from));
+		if (r != runs.begin()) {
+			--r;
+			if (!(r->second < from)) {
+				if (!(r->second < to))
+					return false;
+				from = _ipNext(r->second);
+				continue;
+			}
+		}
+		if ((v4)&&((from.second & 0xffULL) == 0xffULL)) {
+			if (!(from < to))
+				return false;
+			from = _ipNext(from);
+			continue;
+		}
+		found = from;
+		return true;
+	}
+	return false;
+}
+
 void DB::initNetwork(nlohmann::json &network)
 {
 	if (!network.count("private")) network["private"] = true;
@@ -34,6 +138,8 @@ void DB::initNetwork(nlohmann::json &network)
 	if (!network.count("name")) network["name"] = "";
 	if (!network.count("multicastLimit")) network["multicastLimit"] = (uint64_t)32;
 	if (!network.count("enableBroadcast")) network["enableBroadcast"] = true;
+	if (!network.count("arpEmulation")) network["arpEmulation"] = false;
+	if (!network.count("ndpProxy")) network["ndpProxy"] = false;
 	if (!network.count("v4AssignMode")) network["v4AssignMode"] = {{"zt",false}};
 	if (!network.count("v6AssignMode")) network["v6AssignMode"] = {{"rfc4193",false},{"zt",false},{"6plane",false}};
 	if (!network.count("authTokens")) network["authTokens"] = {{}};
@@ -42,6 +148,7 @@ void DB::initNetwork(nlohmann::json &network)
 	if (!network.count("routes")) network["routes"] = nlohmann::json::array();
 	if (!network.count("ipAssignmentPools")) network["ipAssignmentPools"] = nlohmann::json::array();
 	if (!network.count("mtu")) network["mtu"] = ZT_DEFAULT_MTU;
+	if (!network.count("rateLimit")) network["rateLimit"] = 0;
 	if (!network.count("remoteTraceTarget")) network["remoteTraceTarget"] = nlohmann::json();
 	if (!network.count("removeTraceLevel")) network["remoteTraceLevel"] = 0;
 	if (!network.count("rules")) {
@@ -100,7 +207,11 @@ DB::DB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path
 	_controller(nc),
 	_myId(myId),
 	_myAddress(myId.address()),
-	_path((path) ? path : "")
+	_path((path) ? path : ""),
+	_changes(0),
+	_committedWrites(0),
+	_committedRecords(0),
+	_committedMicroseconds(0)
 {
 	char tmp[32];
 	_myAddress.toString(tmp);
@@ -111,7 +222,203 @@ DB::~DB()
 {
 }
 
-bool DB::get(const uint64_t networkId,nlohmann::json &network)
+#define ZT_DB_MEMBER_HAS_ID 0x0001
+#define ZT_DB_MEMBER_HAS_NWID 0x0002
+#define ZT_DB_MEMBER_HAS_ADDRESS 0x0004
+#define ZT_DB_MEMBER_HAS_OBJTYPE 0x0008
+#define ZT_DB_MEMBER_HAS_REVISION 0x0010
+#define ZT_DB_MEMBER_HAS_LAST_AUTHORIZED_TIME 0x0020
+#define ZT_DB_MEMBER_HAS_LAST_DEAUTHORIZED_TIME 0x0040
+#define ZT_DB_MEMBER_HAS_IP_ASSIGNMENTS 0x0080
+#define ZT_DB_MEMBER_HAS_TAGS 0x0100
+#define ZT_DB_MEMBER_HAS_CAPABILITIES 0x0200
+#define ZT_DB_MEMBER_HAS_AUTHORIZED 0x0400
+#define ZT_DB_MEMBER_AUTHORIZED 0x0800
+#define ZT_DB_MEMBER_HAS_ACTIVE_BRIDGE 0x1000
+#define ZT_DB_MEMBER_ACTIVE_BRIDGE 0x2000
+#define ZT_DB_MEMBER_HAS_NO_AUTO_ASSIGN_IPS 0x4000
+#define ZT_DB_MEMBER_NO_AUTO_ASSIGN_IPS 0x8000
+
+// True if j is a string of exactly this many lower case hex digits, which we'd format identically
+static bool _memberHexField(const nlohmann::json &j,const unsigned int digits,uint64_t &v)
+{
+	if (!j.is_string())
+		return false;
+	const std::string &s = j.get_ref<const std::string &>();
+	if (s.length() != digits)
+		return false;
+	char tmp[24];
+	v = Utils::hexStrToU64(s.c_str());
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.*llx",(int)digits,(unsigned long long)v);
+	return (s == tmp);
+}
+
+static bool _memberU32Field(const nlohmann::json &j,uint32_t &v)
+{
+	if ((!j.is_number_unsigned())||(j.get<uint64_t>() > 0xffffffffULL))
+		return false;
+	v = (uint32_t)j.get<uint64_t>();
+	return true;
+}
+
+void DB::_Member::set(const nlohmann::json &m)
+{
+	_flags = 0;
+	_ipAssignments.clear();
+	_tags.clear();
+	_capabilities.clear();
+	nlohmann::json rest(nlohmann::json::object());
+	for(auto i=m.begin();i!=m.end();++i) {
+		const std::string &k = i.key();
+		const nlohmann::json &v = i.value();
+		bool typed = false;
+		if (k == "id") {
+			if ((typed = _memberHexField(v,10,_id)))
+				_flags |= ZT_DB_MEMBER_HAS_ID;
+		} else if (k == "nwid") {
+			if ((typed = _memberHexField(v,16,_nwid)))
+				_flags |= ZT_DB_MEMBER_HAS_NWID;
+		} else if (k == "address") {
+			if ((typed = _memberHexField(v,10,_address)))
+				_flags |= ZT_DB_MEMBER_HAS_ADDRESS;
+		} else if (k == "objtype") {
+			if ((typed = ((v.is_string())&&(v.get_ref<const std::string &>() == "member"))))
+				_flags |= ZT_DB_MEMBER_HAS_OBJTYPE;
+		} else if ((k == "revision")||(k == "lastAuthorizedTime")||(k == "lastDeauthorizedTime")) {
+			if ((typed = v.is_number_unsigned())) {
+				if (k == "revision") {
+					_revision = v;
+					_flags |= ZT_DB_MEMBER_HAS_REVISION;
+				} else if (k == "lastAuthorizedTime") {
+					_lastAuthorizedTime = v;
+					_flags |= ZT_DB_MEMBER_HAS_LAST_AUTHORIZED_TIME;
+				} else {
+					_lastDeauthorizedTime = v;
+					_flags |= ZT_DB_MEMBER_HAS_LAST_DEAUTHORIZED_TIME;
+				}
+			}
+		} else if ((k == "authorized")||(k == "activeBridge")||(k == "noAutoAssignIps")) {
+			if ((typed = v.is_boolean())) {
+				const bool b = v;
+				if (k == "authorized")
+					_flags |= ZT_DB_MEMBER_HAS_AUTHORIZED | ((b) ? ZT_DB_MEMBER_AUTHORIZED : 0);
+				else if (k == "activeBridge")
+					_flags |= ZT_DB_MEMBER_HAS_ACTIVE_BRIDGE | ((b) ? ZT_DB_MEMBER_ACTIVE_BRIDGE : 0);
+				else _flags |= ZT_DB_MEMBER_HAS_NO_AUTO_ASSIGN_IPS | ((b) ? ZT_DB_MEMBER_NO_AUTO_ASSIGN_IPS : 0);
+			}
+		} else if (k == "ipAssignments") {
+			if ((typed = v.is_array())) {
+				char tmp[64];
+				for(auto ip=v.begin();ip!=v.end();++ip) {
+					if (ip->is_string()) {
+						const std::string &ips = ip->get_ref<const std::string &>();
+						_ipAssignments.push_back(InetAddress(ips.c_str()));
+						if ((_ipAssignments.back().ss_family)&&(_ipAssignments.back().port() == 0)&&(ips == _ipAssignments.back().toIpString(tmp)))
+							continue;
+					}
+					typed = false;
+					break;
+				}
+				if (typed)
+					_flags |= ZT_DB_MEMBER_HAS_IP_ASSIGNMENTS;
+				else _ipAssignments.clear();
+			}
+		} else if (k == "tags") {
+			if ((typed = v.is_array())) {
+				for(auto t=v.begin();t!=v.end();++t) {
+					std::pair<uint32_t,uint32_t> tag;
+					if ((t->is_array())&&(t->size() == 2)&&(_memberU32Field((*t)[0],tag.first))&&(_memberU32Field((*t)[1],tag.second))) {
+						_tags.push_back(tag);
+					} else {
+						typed = false;
+						break;
+					}
+				}
+				if (typed)
+					_flags |= ZT_DB_MEMBER_HAS_TAGS;
+				else _tags.clear();
+			}
+		} else if (k == "capabilities") {
+			if ((typed = v.is_array())) {
+				for(auto c=v.begin();c!=v.end();++c) {
+					uint32_t cap;
+					if (_memberU32Field(*c,cap)) {
+						_capabilities.push_back(cap);
+					} else {
+						typed = false;
+						break;
+					}
+				}
+				if (typed)
+					_flags |= ZT_DB_MEMBER_HAS_CAPABILITIES;
+				else _capabilities.clear();
+			}
+		}
+		if (!typed)
+			rest[k] = v;
+	}
+	_ipAssignments.shrink_to_fit();
+	_tags.shrink_to_fit();
+	_capabilities.shrink_to_fit();
+	_rest = nlohmann::json::to_msgpack(rest);
+	_rest.shrink_to_fit();
+}
+
+void DB::_Member::get(nlohmann::json &m) const
+{
+	char tmp[64];
+	m = nlohmann::json::from_msgpack(_rest);
+	if ((_flags & ZT_DB_MEMBER_HAS_ID) != 0) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)_id);
+		m["id"] = tmp;
+	}
+	if ((_flags & ZT_DB_MEMBER_HAS_NWID) != 0) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)_nwid);
+		m["nwid"] = tmp;
+	}
+	if ((_flags & ZT_DB_MEMBER_HAS_ADDRESS) != 0) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)_address);
+		m["address"] = tmp;
+	}
+	if ((_flags & ZT_DB_MEMBER_HAS_OBJTYPE) != 0)
+		m["objtype"] = "member";
+	if ((_flags & ZT_DB_MEMBER_HAS_REVISION) != 0)
+		m["revision"] = _revision;
+	if ((_flags & ZT_DB_MEMBER_HAS_LAST_AUTHORIZED_TIME) != 0)
+		m["lastAuthorizedTime"] = _lastAuthorizedTime;
+	if ((_flags & ZT_DB_MEMBER_HAS_LAST_DEAUTHORIZED_TIME) != 0)
+		m["lastDeauthorizedTime"] = _lastDeauthorizedTime;
+	if ((_flags & ZT_DB_MEMBER_HAS_AUTHORIZED) != 0)
+		m["authorized"] = ((_flags & ZT_DB_MEMBER_AUTHORIZED) != 0);
+	if ((_flags & ZT_DB_MEMBER_HAS_ACTIVE_BRIDGE) != 0)
+		m["activeBridge"] = ((_flags & ZT_DB_MEMBER_ACTIVE_BRIDGE) != 0);
+	if ((_flags & ZT_DB_MEMBER_HAS_NO_AUTO_ASSIGN_IPS) != 0)
+		m["noAutoAssignIps"] = ((_flags & ZT_DB_MEMBER_NO_AUTO_ASSIGN_IPS) != 0);
+	if ((_flags & ZT_DB_MEMBER_HAS_IP_ASSIGNMENTS) != 0) {
+		nlohmann::json &ips = m["ipAssignments"];
+		ips = nlohmann::json::array();
+		for(auto ip=_ipAssignments.begin();ip!=_ipAssignments.end();++ip)
+			ips.push_back(ip->toIpString(tmp));
+	}
+	if ((_flags & ZT_DB_MEMBER_HAS_TAGS) != 0) {
+		nlohmann::json &tags = m["tags"];
+		tags = nlohmann::json::array();
+		for(auto t=_tags.begin();t!=_tags.end();++t) {
+			nlohmann::json tag(nlohmann::json::array());
+			tag.push_back(t->first);
+			tag.push_back(t->second);
+			tags.push_back(tag);
+		}
+	}
+	if ((_flags & ZT_DB_MEMBER_HAS_CAPABILITIES) != 0) {
+		nlohmann::json &caps = m["capabilities"];
+		caps = nlohmann::json::array();
+		for(auto c=_capabilities.begin();c!=_capabilities.end();++c)
+			caps.push_back(*c);
+	}
+}
+
+bool DB::get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network)
 {
 	waitForReady();
 	std::shared_ptr<_Network> nw;
@@ -122,14 +429,11 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network)
 			return false;
 		nw = nwi->second;
 	}
-	{
-		std::lock_guard<std::mutex> l2(nw->lock);
-		network = nw->config;
-	}
+	network = std::atomic_load(&(nw->config));
 	return true;
 }
 
-bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t memberId,nlohmann::json &member)
+bool DB::get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network,const uint64_t memberId,nlohmann::json &member)
 {
 	waitForReady();
 	std::shared_ptr<_Network> nw;
@@ -140,18 +444,20 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t mem
 			return false;
 		nw = nwi->second;
 	}
+	network = std::atomic_load(&(nw->config));
+	std::shared_ptr<const _Member> m;
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
-		network = nw->config;
-		auto m = nw->members.find(memberId);
-		if (m == nw->members.end())
+		auto mi = nw->members.find(memberId);
+		if (mi == nw->members.end())
 			return false;
-		member = m->second;
+		m = mi->second;
 	}
+	m->get(member);
 	return true;
 }
 
-bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t memberId,nlohmann::json &member,NetworkSummaryInfo &info)
+bool DB::get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network,const uint64_t memberId,nlohmann::json &member,NetworkSummaryInfo &info)
 {
 	waitForReady();
 	std::shared_ptr<_Network> nw;
@@ -162,19 +468,21 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t mem
 			return false;
 		nw = nwi->second;
 	}
+	network = std::atomic_load(&(nw->config));
+	std::shared_ptr<const _Member> m;
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
-		network = nw->config;
 		_fillSummaryInfo(nw,info);
-		auto m = nw->members.find(memberId);
-		if (m == nw->members.end())
+		auto mi = nw->members.find(memberId);
+		if (mi == nw->members.end())
 			return false;
-		member = m->second;
+		m = mi->second;
 	}
+	m->get(member);
 	return true;
 }
 
-bool DB::get(const uint64_t networkId,nlohmann::json &network,std::vector<nlohmann::json> &members)
+bool DB::get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network,std::vector<nlohmann::json> &members)
 {
 	waitForReady();
 	std::shared_ptr<_Network> nw;
@@ -185,12 +493,46 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network,std::vector<nlohma
 			return false;
 		nw = nwi->second;
 	}
+	network = std::atomic_load(&(nw->config));
+	std::vector< std::shared_ptr<const _Member> > packed;
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
-		network = nw->config;
+		packed.reserve(nw->members.size());
 		for(auto m=nw->members.begin();m!=nw->members.end();++m)
-			members.push_back(m->second);
+			packed.push_back(m->second);
 	}
+	// Unpack outside the lock since this can be a lot of members
+	members.reserve(members.size() + packed.size());
+	for(auto m=packed.begin();m!=packed.end();++m) {
+		members.push_back(nlohmann::json());
+		(*m)->get(members.back());
+	}
+	return true;
+}
+
+bool DB::get(const uint64_t networkId,nlohmann::json &network)
+{
+	std::shared_ptr<const nlohmann::json> n;
+	if (!get(networkId,n))
+		return false;
+	network = (n) ? *n : nlohmann::json();
+	return true;
+}
+
+bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t memberId,nlohmann::json &member)
+{
+	std::shared_ptr<const nlohmann::json> n;
+	const bool r = get(networkId,n,memberId,member);
+	network = (n) ? *n : nlohmann::json();
+	return r;
+}
+
+bool DB::get(const uint64_t networkId,nlohmann::json &network,std::vector<nlohmann::json> &members)
+{
+	std::shared_ptr<const nlohmann::json> n;
+	if (!get(networkId,n,members))
+		return false;
+	network = (n) ? *n : nlohmann::json();
 	return true;
 }
 
@@ -212,6 +554,75 @@ bool DB::summary(const uint64_t networkId,NetworkSummaryInfo &info)
 	return true;
 }
 
+bool DB::findFreeIp(const uint64_t networkId,const InetAddress &rangeStart,const InetAddress &rangeEnd,const std::vector<InetAddress> &routes,const InetAddress &preferred,InetAddress &ip)
+{
+	const int family = (int)rangeStart.ss_family;
+	const bool v4 = (family == AF_INET);
+	const unsigned int maxBits = (v4) ? 32 : 128;
+	_IpKey s,e,p;
+	if (((int)rangeEnd.ss_family != family)||(!_ipKey(rangeStart,s))||(!_ipKey(rangeEnd,e))||(e < s))
+		return false;
+	if (((int)preferred.ss_family != family)||(!_ipKey(preferred,p))||(p < s)||(e < p))
+		p = s;
+
+	// Intersect the pool with each route, keeping the route's netmask bits
+	std::vector< std::pair< std::pair<_IpKey,_IpKey>,unsigned int > > segments;
+	for(std::vector<InetAddress>::const_iterator r(routes.begin());r!=routes.end();++r) {
+		_IpKey rk;
+		const unsigned int bits = r->netmaskBits();
+		if (((int)r->ss_family != family)||(bits == 0)||(bits > maxBits)||(!_ipKey(*r,rk)))
+			continue;
+		_IpKey hm;
+		if (v4) {
+			hm.first = 0;
+			hm.second = (bits >= 32) ? 0ULL : (0xffffffffULL >> bits);
+		} else {
+			hm.first = (bits >= 64) ? 0ULL : (0xffffffffffffffffULL >> bits);
+			hm.second = (bits >= 128) ? 0ULL : ((bits <= 64) ? 0xffffffffffffffffULL : (0xffffffffffffffffULL >> (bits - 64)));
+		}
+		const _IpKey rs(rk.first & ~hm.first,rk.second & ~hm.second);
+		const _IpKey re(rs.first | hm.first,rs.second | hm.second);
+		const _IpKey a((s < rs) ? rs : s);
+		const _IpKey b((re < e) ? re : e);
+		if (!(b < a))
+			segments.push_back(std::pair< std::pair<_IpKey,_IpKey>,unsigned int >(std::pair<_IpKey,_IpKey>(a,b),bits));
+	}
+	if (segments.empty())
+		return false;
+	std::sort(segments.begin(),segments.end());
+
+	std::shared_ptr<_Network> nw;
+	{
+		std::lock_guard<std::mutex> l(_networks_l);
+		auto nwi = _networks.find(networkId);
+		if (nwi != _networks.end())
+			nw = nwi->second;
+	}
+	_IpRuns none;
+	std::unique_lock<std::mutex> l2;
+	if (nw)
+		l2 = std::unique_lock<std::mutex>(nw->lock);
+	const _IpRuns &runs = (nw) ? nw->allocatedIps[(v4) ? 0 : 1] : none;
+
+	// First look from the preferred address onward, then wrap around to what comes before it
+	_IpKey found;
+	for(unsigned int pass=0;pass<2;++pass) {
+		for(auto seg=segments.begin();seg!=segments.end();++seg) {
+			const _IpKey &a = seg->first.first;
+			const _IpKey &b = seg->first.second;
+			bool ok;
+			if (pass == 0)
+				ok = ((!(b < p))&&(_ipRunsFirstFree(runs,(a < p) ? p : a,b,v4,found)));
+			else ok = ((a < p)&&(_ipRunsFirstFree(runs,a,(b < p) ? b : _ipPrev(p),v4,found)));
+			if (ok) {
+				ip = _ipFromKey(family,found,seg->second);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 void DB::networks(std::vector<uint64_t> &networks)
 {
 	waitForReady();
@@ -221,8 +632,42 @@ void DB::networks(std::vector<uint64_t> &networks)
 		networks.push_back(n->first);
 }
 
+void DB::commitStats(CommitStats &cs)
+{
+	cs.commits = _committedWrites.load(std::memory_order_relaxed);
+	cs.records = _committedRecords.load(std::memory_order_relaxed);
+	cs.microseconds = _committedMicroseconds.load(std::memory_order_relaxed);
+	cs.backlog = 0;
+}
+
+void DB::memoryUsage(uint64_t &networks,uint64_t &members,uint64_t &bytes) const
+{
+	// Hash and tree nodes are counted as their contents plus a few pointers
+	static const uint64_t nodeOverhead = 3 * sizeof(void *);
+	networks = 0;
+	members = 0;
+	bytes = 0;
+	std::lock_guard<std::mutex> l(_networks_l);
+	for(auto n=_networks.begin();n!=_networks.end();++n) {
+		std::lock_guard<std::mutex> l2(n->second->lock);
+		const _Network &nw = *(n->second);
+		++networks;
+		members += nw.members.size();
+		const std::shared_ptr<const nlohmann::json> config(std::atomic_load(&(nw.config)));
+		bytes += sizeof(_Network) + nodeOverhead + ((config) ? config->dump().length() : 0);
+		for(auto m=nw.members.begin();m!=nw.members.end();++m)
+			bytes += sizeof(_Member) + sizeof(std::shared_ptr<const _Member>) + sizeof(uint64_t) + nodeOverhead + m->second->heapBytes();
+		bytes += (nw.activeBridgeMembers.size() + nw.authorizedMembers.size()) * (sizeof(uint64_t) + nodeOverhead);
+		bytes += (nw.allocatedIps[0].size() + nw.allocatedIps[1].size()) * ((4 * sizeof(uint64_t)) + nodeOverhead);
+	}
+	bytes += _networkByMember.size() * ((2 * sizeof(uint64_t)) + nodeOverhead);
+}
+
 void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool push)
 {
+	if (push)
+		++_changes;
+
 	uint64_t memberId = 0;
 	uint64_t networkId = 0;
 	bool isAuth = false;
@@ -252,9 +697,10 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 						json &ipj = ips[i];
 						if (ipj.is_string()) {
 							const std::string ips = ipj;
+							_IpKey k;
 							InetAddress ipa(ips.c_str());
-							ipa.setPort(0);
-							nw->allocatedIps.erase(ipa);
+							if (_ipKey(ipa,k))
+								_ipRunsRemove(nw->allocatedIps[(ipa.ss_family == AF_INET) ? 0 : 1],k);
 						}
 					}
 				}
@@ -278,7 +724,9 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 		{
 			std::lock_guard<std::mutex> l(nw->lock);
 
-			nw->members[memberId] = memberConfig;
+			std::shared_ptr<_Member> m(new _Member());
+			m->set(memberConfig);
+			nw->members[memberId] = m;
 
 			if (OSUtils::jsonBool(memberConfig["activeBridge"],false))
 				nw->activeBridgeMembers.insert(memberId);
@@ -291,9 +739,10 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 					json &ipj = ips[i];
 					if (ipj.is_string()) {
 						const std::string ips = ipj;
+						_IpKey k;
 						InetAddress ipa(ips.c_str());
-						ipa.setPort(0);
-						nw->allocatedIps.insert(ipa);
+						if (_ipKey(ipa,k))
+							_ipRunsAdd(nw->allocatedIps[(ipa.ss_family == AF_INET) ? 0 : 1],k);
 					}
 				}
 			}
@@ -330,6 +779,9 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 
 void DB::_networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool push)
 {
+	if (push)
+		++_changes;
+
 	if (networkConfig.is_object()) {
 		const std::string ids = networkConfig["id"];
 		const uint64_t id = Utils::hexStrToU64(ids.c_str());
@@ -342,10 +794,7 @@ void DB::_networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool
 					nw2.reset(new _Network);
 				nw = nw2;
 			}
-			{
-				std::lock_guard<std::mutex> l2(nw->lock);
-				nw->config = networkConfig;
-			}
+			std::atomic_store(&(nw->config),std::shared_ptr<const nlohmann::json>(new nlohmann::json(networkConfig)));
 			if (push)
 				_controller->onNetworkUpdate(id);
 		}
@@ -359,14 +808,36 @@ void DB::_networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool
 	}
 }
 
+void DB::_loadRecord(nlohmann::json &record,const bool replace)
+{
+	nlohmann::json old;
+	const std::string objtype = record["objtype"];
+	const uint64_t id = OSUtils::jsonIntHex(record["id"],0ULL);
+	if (objtype == "network") {
+		if (replace)
+			get(id,old);
+		_networkChanged(old,record,false);
+	} else if (objtype == "member") {
+		if (replace) {
+			std::shared_ptr<const nlohmann::json> network;
+			get(OSUtils::jsonIntHex(record["nwid"],0ULL),network,id,old);
+		}
+		_memberChanged(old,record,false);
+	}
+}
+
+void DB::_loadNetworkErase(const uint64_t networkId)
+{
+	nlohmann::json network,nullJson;
+	if ((networkId)&&(get(networkId,network)))
+		_networkChanged(network,nullJson,false);
+}
+
 void DB::_fillSummaryInfo(const std::shared_ptr<_Network> &nw,NetworkSummaryInfo &info)
 {
 	for(auto ab=nw->activeBridgeMembers.begin();ab!=nw->activeBridgeMembers.end();++ab)
 		info.activeBridges.push_back(Address(*ab));
 	std::sort(info.activeBridges.begin(),info.activeBridges.end());
-	for(auto ip=nw->allocatedIps.begin();ip!=nw->allocatedIps.end();++ip)
-		info.allocatedIps.push_back(*ip);
-	std::sort(info.allocatedIps.begin(),info.allocatedIps.end());
 	info.authorizedMemberCount = (unsigned long)nw->authorizedMembers.size();
 	info.totalMemberCount = (unsigned long)nw->members.size();
 	info.mostRecentDeauthTime = nw->mostRecentDeauthTime;
@@ -25,6 +25,7 @@
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/BlockingQueue.hpp"
 
+#include <map>
 #include <memory>
 #include <string>
 #include <thread>
@@ -32,6 +33,7 @@
 #include <unordered_set>
 #include <vector>
 #include <atomic>
+#include <chrono>
 
 #include "../ext/json/json.hpp"
 
@@ -52,12 +54,23 @@ public:
 	{
 		NetworkSummaryInfo() : authorizedMemberCount(0),totalMemberCount(0),mostRecentDeauthTime(0) {}
 		std::vector<Address> activeBridges;
-		std::vector<InetAddress> allocatedIps;
 		unsigned long authorizedMemberCount;
 		unsigned long totalMemberCount;
 		int64_t mostRecentDeauthTime;
 	};
 
+	/**
+	 * Writes to the backing store since startup
+	 */
+	struct CommitStats
+	{
+		CommitStats() : commits(0),records(0),microseconds(0),backlog(0) {}
+		uint64_t commits; // writes, each of one or more records
+		uint64_t records;
+		uint64_t microseconds; // total time spent writing
+		uint64_t backlog; // records saved but not yet written
+	};
+
 	/**
 	 * Ensure that all network fields are present
 	 */
@@ -90,15 +103,57 @@ public:
 		return (_networks.find(networkId) != _networks.end());
 	}
 
+	/**
+	 * Get networks and members
+	 *
+	 * Network configs are immutable snapshots that are replaced as a whole when
+	 * the network changes, so the overloads taking a shared pointer to one don't
+	 * copy it and it can be used without holding any lock. Those taking a JSON
+	 * object copy the snapshot, for callers that are going to change it. Member
+	 * records are also shared and only unpacked after the network's lock has been
+	 * released.
+	 */
+	bool get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network);
+	bool get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network,const uint64_t memberId,nlohmann::json &member);
+	bool get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network,const uint64_t memberId,nlohmann::json &member,NetworkSummaryInfo &info);
+	bool get(const uint64_t networkId,std::shared_ptr<const nlohmann::json> &network,std::vector<nlohmann::json> &members);
 	bool get(const uint64_t networkId,nlohmann::json &network);
 	bool get(const uint64_t networkId,nlohmann::json &network,const uint64_t memberId,nlohmann::json &member);
-	bool get(const uint64_t networkId,nlohmann::json &network,const uint64_t memberId,nlohmann::json &member,NetworkSummaryInfo &info);
 	bool get(const uint64_t networkId,nlohmann::json &network,std::vector<nlohmann::json> &members);
 
 	bool summary(const uint64_t networkId,NetworkSummaryInfo &info);
 
 	void networks(std::vector<uint64_t> &networks);
 
+	/**
+	 * Get approximate memory held by the in-memory copy of the database
+	 *
+	 * This walks every network and member, so it's for occasional monitoring.
+	 *
+	 * @param networks Result parameter, set to number of networks
+	 * @param members Result parameter, set to number of members in all networks
+	 * @param bytes Result parameter, set to approximate bytes used by networks and members
+	 */
+	void memoryUsage(uint64_t &networks,uint64_t &members,uint64_t &bytes) const;
+
+	/**
+	 * Find an unallocated IP for auto-assignment
+	 *
+	 * The search starts at the preferred address and wraps around to the start
+	 * of the pool, so it only fails if every address in the pool that falls
+	 * within one of the supplied routes is already taken. IPv4 addresses ending
+	 * in .255 are never returned.
+	 *
+	 * @param networkId Network ID
+	 * @param rangeStart First address in pool
+	 * @param rangeEnd Last address in pool (inclusive)
+	 * @param routes Route targets (netmask bits in port) that assigned addresses must fall within
+	 * @param preferred Address to try first (ignored if not within pool)
+	 * @param ip Result parameter, set to free address with its route's netmask bits in port
+	 * @return True if a free address was found
+	 */
+	bool findFreeIp(const uint64_t networkId,const InetAddress &rangeStart,const InetAddress &rangeEnd,const std::vector<InetAddress> &routes,const InetAddress &preferred,InetAddress &ip);
+
 	virtual void save(nlohmann::json *orig,nlohmann::json &record) = 0;
 
 	virtual void eraseNetwork(const uint64_t networkId) = 0;
@@ -107,15 +162,74 @@ public:
 
 	virtual void nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress) = 0;
 
+	/**
+	 * @return Network and member changes applied since startup, not counting those loaded at startup
+	 */
+	inline uint64_t changes() const { return _changes.load(std::memory_order_relaxed); }
+
+	/**
+	 * @param cs Result parameter, set to commit counters (all zero if nothing is stored)
+	 */
+	virtual void commitStats(CommitStats &cs);
+
 protected:
+	/**
+	 * Compact in-memory form of a member record
+	 *
+	 * Commonly present fields are kept typed and whatever is left is packed as
+	 * MessagePack, which costs far less than a tree of JSON nodes. A field is only
+	 * kept typed if converting it back gives exactly the same JSON value.
+	 */
+	class _Member
+	{
+	public:
+		_Member() : _flags(0) {}
+
+		/**
+		 * @param m Member JSON object
+		 */
+		void set(const nlohmann::json &m);
+
+		/**
+		 * @param m Result parameter, set to member JSON object
+		 */
+		void get(nlohmann::json &m) const;
+
+		/**
+		 * @return Bytes of heap memory held beyond sizeof(_Member)
+		 */
+		inline unsigned long heapBytes() const
+		{
+			return (unsigned long)(
+				(_ipAssignments.capacity() * sizeof(InetAddress)) +
+				(_tags.capacity() * sizeof(std::pair<uint32_t,uint32_t>)) +
+				(_capabilities.capacity() * sizeof(uint32_t)) +
+				_rest.capacity());
+		}
+
+	private:
+		uint32_t _flags; // which typed fields are present, and boolean values
+		uint64_t _id;
+		uint64_t _nwid;
+		uint64_t _address;
+		uint64_t _revision;
+		uint64_t _lastAuthorizedTime;
+		uint64_t _lastDeauthorizedTime;
+		std::vector<InetAddress> _ipAssignments;
+		std::vector< std::pair<uint32_t,uint32_t> > _tags;
+		std::vector<uint32_t> _capabilities;
+		std::vector<uint8_t> _rest;
+	};
+
 	struct _Network
 	{
 		_Network() : mostRecentDeauthTime(0) {}
-		nlohmann::json config;
-		std::unordered_map<uint64_t,nlohmann::json> members;
+		std::shared_ptr<const nlohmann::json> config; // replaced with std::atomic_store(), never changed once published
+		std::unordered_map< uint64_t,std::shared_ptr<const _Member> > members; // likewise replaced rather than changed
 		std::unordered_set<uint64_t> activeBridgeMembers;
 		std::unordered_set<uint64_t> authorizedMembers;
-		std::unordered_set<InetAddress,InetAddress::Hasher> allocatedIps;
+		// Allocated addresses as runs of first -> last, [0] for IPv4 and [1] for IPv6
+		std::map< std::pair<uint64_t,uint64_t>,std::pair<uint64_t,uint64_t> > allocatedIps[2];
 		int64_t mostRecentDeauthTime;
 		std::mutex lock;
 	};
@@ -124,6 +238,37 @@ protected:
 	void _networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool push);
 	void _fillSummaryInfo(const std::shared_ptr<_Network> &nw,NetworkSummaryInfo &info);
 
+	/**
+	 * Apply a stored network or member record while loading (without pushing)
+	 *
+	 * @param record Network or member record
+	 * @param replace If false the object is known not to be loaded yet, which skips looking it up
+	 */
+	void _loadRecord(nlohmann::json &record,const bool replace);
+
+	/**
+	 * Apply a stored network deletion while loading (without pushing)
+	 *
+	 * @param networkId Network ID
+	 */
+	void _loadNetworkErase(const uint64_t networkId);
+
+	// Monotonic clock for timing writes
+	static inline uint64_t _microseconds() { return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+	/**
+	 * Count a write to the backing store
+	 *
+	 * @param records Records written
+	 * @param microseconds Time the write took
+	 */
+	inline void _committed(const uint64_t records,const uint64_t microseconds)
+	{
+		_committedWrites.fetch_add(1,std::memory_order_relaxed);
+		_committedRecords.fetch_add(records,std::memory_order_relaxed);
+		_committedMicroseconds.fetch_add(microseconds,std::memory_order_relaxed);
+	}
+
 	EmbeddedNetworkController *const _controller;
 	const Identity _myId;
 	const Address _myAddress;
@@ -133,6 +278,9 @@ protected:
 	std::unordered_map< uint64_t,std::shared_ptr<_Network> > _networks;
 	std::unordered_multimap< uint64_t,uint64_t > _networkByMember;
 	mutable std::mutex _networks_l;
+
+	std::atomic<uint64_t> _changes;
+	std::atomic<uint64_t> _committedWrites,_committedRecords,_committedMicroseconds;
 };
 
 } // namespace ZeroTier
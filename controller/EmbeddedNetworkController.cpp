@@ -33,6 +33,7 @@
 #include <map>
 #include <thread>
 #include <memory>
+#include <chrono>
 
 #include "../include/ZeroTierOne.h"
 #include "../version.h"
@@ -44,6 +45,7 @@
 #include "../node/NetworkConfig.hpp"
 #include "../node/Dictionary.hpp"
 #include "../node/MAC.hpp"
+#include "../node/Probes.hpp"
 
 using json = nlohmann::json;
 
@@ -56,10 +58,26 @@ using json = nlohmann::json;
 // Global maximum size of arrays in JSON objects
 #define ZT_CONTROLLER_MAX_ARRAY_SIZE 16384
 
+// A cached config is resent for at most this fraction of its credential time max delta, so
+// members holding credentials from it and from fresh configs still agree with each other
+#define ZT_CONTROLLER_CONFIG_CACHE_MAX_AGE_DIVISOR 4
+
 namespace ZeroTier {
 
 namespace {
 
+// Field of an object that may be a shared snapshot, without inserting it as operator[] would
+static const json &_jsonField(const json &o,const char *k)
+{
+	static const json nullJson;
+	if (o.is_object()) {
+		const json::const_iterator f(o.find(k));
+		if (f != o.end())
+			return *f;
+	}
+	return nullJson;
+}
+
 static json _renderRule(ZT_VirtualNetworkRule &rule)
 {
 	char tmp[128];
@@ -248,18 +266,18 @@ static json _renderRule(ZT_VirtualNetworkRule &rule)
 	return r;
 }
 
-static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
+static bool _parseRule(const json &r,ZT_VirtualNetworkRule &rule)
 {
 	if (!r.is_object())
 		return false;
 
-	const std::string t(OSUtils::jsonString(r["type"],""));
+	const std::string t(OSUtils::jsonString(_jsonField(r,"type"),""));
 	memset(&rule,0,sizeof(ZT_VirtualNetworkRule));
 
-	if (OSUtils::jsonBool(r["not"],false))
+	if (OSUtils::jsonBool(_jsonField(r,"not"),false))
 		rule.t = 0x80;
 	else rule.t = 0x00;
-	if (OSUtils::jsonBool(r["or"],false))
+	if (OSUtils::jsonBool(_jsonField(r,"or"),false))
 		rule.t |= 0x40;
 
 	bool tag = false;
@@ -271,100 +289,100 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 		return true;
 	} else if (t == "ACTION_TEE") {
 		rule.t |= ZT_NETWORK_RULE_ACTION_TEE;
-		rule.v.fwd.address = Utils::hexStrToU64(OSUtils::jsonString(r["address"],"0").c_str()) & 0xffffffffffULL;
-		rule.v.fwd.flags = (uint32_t)(OSUtils::jsonInt(r["flags"],0ULL) & 0xffffffffULL);
-		rule.v.fwd.length = (uint16_t)(OSUtils::jsonInt(r["length"],0ULL) & 0xffffULL);
+		rule.v.fwd.address = Utils::hexStrToU64(OSUtils::jsonString(_jsonField(r,"address"),"0").c_str()) & 0xffffffffffULL;
+		rule.v.fwd.flags = (uint32_t)(OSUtils::jsonInt(_jsonField(r,"flags"),0ULL) & 0xffffffffULL);
+		rule.v.fwd.length = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"length"),0ULL) & 0xffffULL);
 		return true;
 	} else if (t == "ACTION_WATCH") {
 		rule.t |= ZT_NETWORK_RULE_ACTION_WATCH;
-		rule.v.fwd.address = Utils::hexStrToU64(OSUtils::jsonString(r["address"],"0").c_str()) & 0xffffffffffULL;
-		rule.v.fwd.flags = (uint32_t)(OSUtils::jsonInt(r["flags"],0ULL) & 0xffffffffULL);
-		rule.v.fwd.length = (uint16_t)(OSUtils::jsonInt(r["length"],0ULL) & 0xffffULL);
+		rule.v.fwd.address = Utils::hexStrToU64(OSUtils::jsonString(_jsonField(r,"address"),"0").c_str()) & 0xffffffffffULL;
+		rule.v.fwd.flags = (uint32_t)(OSUtils::jsonInt(_jsonField(r,"flags"),0ULL) & 0xffffffffULL);
+		rule.v.fwd.length = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"length"),0ULL) & 0xffffULL);
 		return true;
 	} else if (t == "ACTION_REDIRECT") {
 		rule.t |= ZT_NETWORK_RULE_ACTION_REDIRECT;
-		rule.v.fwd.address = Utils::hexStrToU64(OSUtils::jsonString(r["address"],"0").c_str()) & 0xffffffffffULL;
-		rule.v.fwd.flags = (uint32_t)(OSUtils::jsonInt(r["flags"],0ULL) & 0xffffffffULL);
+		rule.v.fwd.address = Utils::hexStrToU64(OSUtils::jsonString(_jsonField(r,"address"),"0").c_str()) & 0xffffffffffULL;
+		rule.v.fwd.flags = (uint32_t)(OSUtils::jsonInt(_jsonField(r,"flags"),0ULL) & 0xffffffffULL);
 		return true;
 	} else if (t == "ACTION_BREAK") {
 		rule.t |= ZT_NETWORK_RULE_ACTION_BREAK;
 		return true;
 	} else if (t == "MATCH_SOURCE_ZEROTIER_ADDRESS") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS;
-		rule.v.zt = Utils::hexStrToU64(OSUtils::jsonString(r["zt"],"0").c_str()) & 0xffffffffffULL;
+		rule.v.zt = Utils::hexStrToU64(OSUtils::jsonString(_jsonField(r,"zt"),"0").c_str()) & 0xffffffffffULL;
 		return true;
 	} else if (t == "MATCH_DEST_ZEROTIER_ADDRESS") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS;
-		rule.v.zt = Utils::hexStrToU64(OSUtils::jsonString(r["zt"],"0").c_str()) & 0xffffffffffULL;
+		rule.v.zt = Utils::hexStrToU64(OSUtils::jsonString(_jsonField(r,"zt"),"0").c_str()) & 0xffffffffffULL;
 		return true;
 	} else if (t == "MATCH_VLAN_ID") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_VLAN_ID;
-		rule.v.vlanId = (uint16_t)(OSUtils::jsonInt(r["vlanId"],0ULL) & 0xffffULL);
+		rule.v.vlanId = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"vlanId"),0ULL) & 0xffffULL);
 		return true;
 	} else if (t == "MATCH_VLAN_PCP") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_VLAN_PCP;
-		rule.v.vlanPcp = (uint8_t)(OSUtils::jsonInt(r["vlanPcp"],0ULL) & 0xffULL);
+		rule.v.vlanPcp = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"vlanPcp"),0ULL) & 0xffULL);
 		return true;
 	} else if (t == "MATCH_VLAN_DEI") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_VLAN_DEI;
-		rule.v.vlanDei = (uint8_t)(OSUtils::jsonInt(r["vlanDei"],0ULL) & 0xffULL);
+		rule.v.vlanDei = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"vlanDei"),0ULL) & 0xffULL);
 		return true;
 	} else if (t == "MATCH_MAC_SOURCE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_MAC_SOURCE;
-		const std::string mac(OSUtils::jsonString(r["mac"],"0"));
+		const std::string mac(OSUtils::jsonString(_jsonField(r,"mac"),"0"));
 		Utils::unhex(mac.c_str(),(unsigned int)mac.length(),rule.v.mac,6);
 		return true;
 	} else if (t == "MATCH_MAC_DEST") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_MAC_DEST;
-		const std::string mac(OSUtils::jsonString(r["mac"],"0"));
+		const std::string mac(OSUtils::jsonString(_jsonField(r,"mac"),"0"));
 		Utils::unhex(mac.c_str(),(unsigned int)mac.length(),rule.v.mac,6);
 		return true;
 	} else if (t == "MATCH_IPV4_SOURCE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IPV4_SOURCE;
-		InetAddress ip(OSUtils::jsonString(r["ip"],"0.0.0.0").c_str());
+		InetAddress ip(OSUtils::jsonString(_jsonField(r,"ip"),"0.0.0.0").c_str());
 		rule.v.ipv4.ip = reinterpret_cast<struct sockaddr_in *>(&ip)->sin_addr.s_addr;
 		rule.v.ipv4.mask = Utils::ntoh(reinterpret_cast<struct sockaddr_in *>(&ip)->sin_port) & 0xff;
 		if (rule.v.ipv4.mask > 32) rule.v.ipv4.mask = 32;
 		return true;
 	} else if (t == "MATCH_IPV4_DEST") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IPV4_DEST;
-		InetAddress ip(OSUtils::jsonString(r["ip"],"0.0.0.0").c_str());
+		InetAddress ip(OSUtils::jsonString(_jsonField(r,"ip"),"0.0.0.0").c_str());
 		rule.v.ipv4.ip = reinterpret_cast<struct sockaddr_in *>(&ip)->sin_addr.s_addr;
 		rule.v.ipv4.mask = Utils::ntoh(reinterpret_cast<struct sockaddr_in *>(&ip)->sin_port) & 0xff;
 		if (rule.v.ipv4.mask > 32) rule.v.ipv4.mask = 32;
 		return true;
 	} else if (t == "MATCH_IPV6_SOURCE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IPV6_SOURCE;
-		InetAddress ip(OSUtils::jsonString(r["ip"],"::0").c_str());
+		InetAddress ip(OSUtils::jsonString(_jsonField(r,"ip"),"::0").c_str());
 		ZT_FAST_MEMCPY(rule.v.ipv6.ip,reinterpret_cast<struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
 		rule.v.ipv6.mask = Utils::ntoh(reinterpret_cast<struct sockaddr_in6 *>(&ip)->sin6_port) & 0xff;
 		if (rule.v.ipv6.mask > 128) rule.v.ipv6.mask = 128;
 		return true;
 	} else if (t == "MATCH_IPV6_DEST") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IPV6_DEST;
-		InetAddress ip(OSUtils::jsonString(r["ip"],"::0").c_str());
+		InetAddress ip(OSUtils::jsonString(_jsonField(r,"ip"),"::0").c_str());
 		ZT_FAST_MEMCPY(rule.v.ipv6.ip,reinterpret_cast<struct sockaddr_in6 *>(&ip)->sin6_addr.s6_addr,16);
 		rule.v.ipv6.mask = Utils::ntoh(reinterpret_cast<struct sockaddr_in6 *>(&ip)->sin6_port) & 0xff;
 		if (rule.v.ipv6.mask > 128) rule.v.ipv6.mask = 128;
 		return true;
 	} else if (t == "MATCH_IP_TOS") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IP_TOS;
-		rule.v.ipTos.mask = (uint8_t)(OSUtils::jsonInt(r["mask"],0ULL) & 0xffULL);
-		rule.v.ipTos.value[0] = (uint8_t)(OSUtils::jsonInt(r["start"],0ULL) & 0xffULL);
-		rule.v.ipTos.value[1] = (uint8_t)(OSUtils::jsonInt(r["end"],0ULL) & 0xffULL);
+		rule.v.ipTos.mask = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"mask"),0ULL) & 0xffULL);
+		rule.v.ipTos.value[0] = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"start"),0ULL) & 0xffULL);
+		rule.v.ipTos.value[1] = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"end"),0ULL) & 0xffULL);
 		return true;
 	} else if (t == "MATCH_IP_PROTOCOL") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
-		rule.v.ipProtocol = (uint8_t)(OSUtils::jsonInt(r["ipProtocol"],0ULL) & 0xffULL);
+		rule.v.ipProtocol = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"ipProtocol"),0ULL) & 0xffULL);
 		return true;
 	} else if (t == "MATCH_ETHERTYPE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_ETHERTYPE;
-		rule.v.etherType = (uint16_t)(OSUtils::jsonInt(r["etherType"],0ULL) & 0xffffULL);
+		rule.v.etherType = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"etherType"),0ULL) & 0xffffULL);
 		return true;
 	} else if (t == "MATCH_ICMP") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_ICMP;
-		rule.v.icmp.type = (uint8_t)(OSUtils::jsonInt(r["icmpType"],0ULL) & 0xffULL);
-		json &code = r["icmpCode"];
+		rule.v.icmp.type = (uint8_t)(OSUtils::jsonInt(_jsonField(r,"icmpType"),0ULL) & 0xffULL);
+		const json &code = _jsonField(r,"icmpCode");
 		if (code.is_null()) {
 			rule.v.icmp.code = 0;
 			rule.v.icmp.flags = 0x00;
@@ -375,18 +393,18 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 		return true;
 	} else if (t == "MATCH_IP_SOURCE_PORT_RANGE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE;
-		rule.v.port[0] = (uint16_t)(OSUtils::jsonInt(r["start"],0ULL) & 0xffffULL);
-		rule.v.port[1] = (uint16_t)(OSUtils::jsonInt(r["end"],(uint64_t)rule.v.port[0]) & 0xffffULL);
+		rule.v.port[0] = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"start"),0ULL) & 0xffffULL);
+		rule.v.port[1] = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"end"),(uint64_t)rule.v.port[0]) & 0xffffULL);
 		return true;
 	} else if (t == "MATCH_IP_DEST_PORT_RANGE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
-		rule.v.port[0] = (uint16_t)(OSUtils::jsonInt(r["start"],0ULL) & 0xffffULL);
-		rule.v.port[1] = (uint16_t)(OSUtils::jsonInt(r["end"],(uint64_t)rule.v.port[0]) & 0xffffULL);
+		rule.v.port[0] = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"start"),0ULL) & 0xffffULL);
+		rule.v.port[1] = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"end"),(uint64_t)rule.v.port[0]) & 0xffffULL);
 		return true;
 	} else if (t == "MATCH_CHARACTERISTICS") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_CHARACTERISTICS;
 		if (r.count("mask")) {
-			json &v = r["mask"];
+			const json &v = _jsonField(r,"mask");
 			if (v.is_number()) {
 				rule.v.characteristics = v;
 			} else {
@@ -397,12 +415,12 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 		return true;
 	} else if (t == "MATCH_FRAME_SIZE_RANGE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE;
-		rule.v.frameSize[0] = (uint16_t)(OSUtils::jsonInt(r["start"],0ULL) & 0xffffULL);
-		rule.v.frameSize[1] = (uint16_t)(OSUtils::jsonInt(r["end"],(uint64_t)rule.v.frameSize[0]) & 0xffffULL);
+		rule.v.frameSize[0] = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"start"),0ULL) & 0xffffULL);
+		rule.v.frameSize[1] = (uint16_t)(OSUtils::jsonInt(_jsonField(r,"end"),(uint64_t)rule.v.frameSize[0]) & 0xffffULL);
 		return true;
 	} else if (t == "MATCH_RANDOM") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_RANDOM;
-		rule.v.randomProbability = (uint32_t)(OSUtils::jsonInt(r["probability"],0ULL) & 0xffffffffULL);
+		rule.v.randomProbability = (uint32_t)(OSUtils::jsonInt(_jsonField(r,"probability"),0ULL) & 0xffffffffULL);
 		return true;
 	} else if (t == "MATCH_TAGS_DIFFERENCE") {
 		rule.t |= ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE;
@@ -426,50 +444,204 @@ static bool _parseRule(json &r,ZT_VirtualNetworkRule &rule)
 		rule.t |= ZT_NETWORK_RULE_MATCH_TAG_RECEIVER;
 		tag = true;
 	} else if (t == "INTEGER_RANGE") {
-		json &s = r["start"];
+		const json &s = _jsonField(r,"start");
 		if (s.is_string()) {
 			std::string tmp = s;
 			rule.v.intRange.start = Utils::hexStrToU64(tmp.c_str());
 		} else {
 			rule.v.intRange.start = OSUtils::jsonInt(s,0ULL);
 		}
-		json &e = r["end"];
+		const json &e = _jsonField(r,"end");
 		if (e.is_string()) {
 			std::string tmp = e;
 			rule.v.intRange.end = (uint32_t)(Utils::hexStrToU64(tmp.c_str()) - rule.v.intRange.start);
 		} else {
 			rule.v.intRange.end = (uint32_t)(OSUtils::jsonInt(e,0ULL) - rule.v.intRange.start);
 		}
-		rule.v.intRange.idx = (uint16_t)OSUtils::jsonInt(r["idx"],0ULL);
-		rule.v.intRange.format = (OSUtils::jsonBool(r["little"],false)) ? 0x80 : 0x00;
-		rule.v.intRange.format |= (uint8_t)((OSUtils::jsonInt(r["bits"],1ULL) - 1) & 63);
+		rule.v.intRange.idx = (uint16_t)OSUtils::jsonInt(_jsonField(r,"idx"),0ULL);
+		rule.v.intRange.format = (OSUtils::jsonBool(_jsonField(r,"little"),false)) ? 0x80 : 0x00;
+		rule.v.intRange.format |= (uint8_t)((OSUtils::jsonInt(_jsonField(r,"bits"),1ULL) - 1) & 63);
 	}
 
 	if (tag) {
-		rule.v.tag.id = (uint32_t)(OSUtils::jsonInt(r["id"],0ULL) & 0xffffffffULL);
-		rule.v.tag.value = (uint32_t)(OSUtils::jsonInt(r["value"],0ULL) & 0xffffffffULL);
+		rule.v.tag.id = (uint32_t)(OSUtils::jsonInt(_jsonField(r,"id"),0ULL) & 0xffffffffULL);
+		rule.v.tag.value = (uint32_t)(OSUtils::jsonInt(_jsonField(r,"value"),0ULL) & 0xffffffffULL);
 		return true;
 	}
 
 	return false;
 }
 
+// Applies the writable fields in a member POST body, throws if a field has the wrong type
+static void _applyMemberChanges(json &member,json &b,const int64_t now)
+{
+	if (b.count("activeBridge")) member["activeBridge"] = OSUtils::jsonBool(b["activeBridge"],false);
+	if (b.count("noAutoAssignIps")) member["noAutoAssignIps"] = OSUtils::jsonBool(b["noAutoAssignIps"],false);
+
+	if (b.count("remoteTraceTarget")) {
+		const std::string rtt(OSUtils::jsonString(b["remoteTraceTarget"],""));
+		if (rtt.length() == 10) {
+			member["remoteTraceTarget"] = rtt;
+		} else {
+			member["remoteTraceTarget"] = json();
+		}
+	}
+	if (b.count("remoteTraceLevel")) member["remoteTraceLevel"] = OSUtils::jsonInt(b["remoteTraceLevel"],0ULL);
+
+	if (b.count("authorized")) {
+		const bool newAuth = OSUtils::jsonBool(b["authorized"],false);
+		if (newAuth != OSUtils::jsonBool(member["authorized"],false)) {
+			member["authorized"] = newAuth;
+			member[((newAuth) ? "lastAuthorizedTime" : "lastDeauthorizedTime")] = now;
+			if (newAuth) {
+				member["lastAuthorizedCredentialType"] = "api";
+				member["lastAuthorizedCredential"] = json();
+			}
+		}
+	}
+
+	if (b.count("ipAssignments")) {
+		json &ipa = b["ipAssignments"];
+		if (ipa.is_array()) {
+			json mipa(json::array());
+			for(unsigned long i=0;i<ipa.size();++i) {
+				std::string ips = ipa[i];
+				InetAddress ip(ips.c_str());
+				if ((ip.ss_family == AF_INET)||(ip.ss_family == AF_INET6)) {
+					char tmpip[64];
+					mipa.push_back(ip.toIpString(tmpip));
+					if (mipa.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE)
+						break;
+				}
+			}
+			member["ipAssignments"] = mipa;
+		}
+	}
+
+	if (b.count("tags")) {
+		json &tags = b["tags"];
+		if (tags.is_array()) {
+			std::map<uint64_t,uint64_t> mtags;
+			for(unsigned long i=0;i<tags.size();++i) {
+				json &tag = tags[i];
+				if ((tag.is_array())&&(tag.size() == 2))
+					mtags[OSUtils::jsonInt(tag[0],0ULL) & 0xffffffffULL] = OSUtils::jsonInt(tag[1],0ULL) & 0xffffffffULL;
+			}
+			json mtagsa = json::array();
+			for(std::map<uint64_t,uint64_t>::iterator t(mtags.begin());t!=mtags.end();++t) {
+				json ta = json::array();
+				ta.push_back(t->first);
+				ta.push_back(t->second);
+				mtagsa.push_back(ta);
+				if (mtagsa.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE)
+					break;
+			}
+			member["tags"] = mtagsa;
+		}
+	}
+
+	if (b.count("capabilities")) {
+		json &capabilities = b["capabilities"];
+		if (capabilities.is_array()) {
+			json mcaps = json::array();
+			for(unsigned long i=0;i<capabilities.size();++i) {
+				mcaps.push_back(OSUtils::jsonInt(capabilities[i],0ULL));
+				if (mcaps.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE)
+					break;
+			}
+			std::sort(mcaps.begin(),mcaps.end());
+			mcaps.erase(std::unique(mcaps.begin(),mcaps.end()),mcaps.end());
+			member["capabilities"] = mcaps;
+		}
+	}
+}
+
+// Monotonic clock for metrics
+static inline uint64_t _usNow() { return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+// Append one Prometheus text format sample, with HELP and TYPE lines if help is given
+static void _metric(std::string &out,const char *name,const char *type,const char *help,const char *labels,const uint64_t value)
+{
+	char tmp[512];
+	if (help) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+		out.append(tmp);
+	}
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s%s%s%s %llu\n",name,(labels) ? "{" : "",(labels) ? labels : "",(labels) ? "}" : "",(unsigned long long)value);
+	out.append(tmp);
+}
+
 } // anonymous namespace
 
 EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPath) :
 	_startTime(OSUtils::now()),
 	_node(node),
 	_path(dbPath),
-	_sender((NetworkController::Sender *)0)
+	_sender((NetworkController::Sender *)0),
+	_rqPending(0),
+	_rqRun(true),
+	_threadsStopped(false),
+	_memberStatusExpiry(ZT_CONTROLLER_MEMBER_STATUS_TICK,OSUtils::now()),
+	_pushRate(ZT_CONTROLLER_DEFAULT_PUSH_RATE),
+	_pushRun(true),
+	_signRun(true),
+	_signPeriodStart(0),
+	_signPeriodSignatures(0),
+	_signPeriodJobs(0),
+	_signPeriodLatency(0),
+	_signRate(0.0),
+	_signLatency(0.0),
+	_configCacheHits(0),
+	_configCacheMisses(0),
+	_policyCacheHits(0),
+	_policyCacheMisses(0),
+	_pushes(0)
 {
+	for(unsigned int i=0;i<ZT_CONTROLLER_REQUEST_DEDUP_SLOTS;++i)
+		_rqInFlight[i] = 0;
+	for(unsigned int i=0;i<OUTCOME_COUNT;++i)
+		_outcomes[i] = 0;
+	for(unsigned int i=0;i<STAGE_COUNT;++i) {
+		for(unsigned int b=0;b<ZT_CONTROLLER_METRICS_LATENCY_BUCKETS;++b)
+			_stages[i].buckets[b] = 0;
+		_stages[i].microseconds = 0;
+	}
 }
 
 EmbeddedNetworkController::~EmbeddedNetworkController()
 {
-	std::lock_guard<std::mutex> l(_threads_l);
-	_queue.stop();
-	for(auto t=_threads.begin();t!=_threads.end();++t)
+	// Threads still at work may call _startThreads(), so don't hold its lock while joining them
+	std::vector<std::thread> threads;
+	{
+		std::lock_guard<std::mutex> l(_threads_l);
+		_threadsStopped = true;
+		threads.swap(_threads);
+	}
+	{
+		std::lock_guard<std::mutex> l2(_rqWait_l);
+		_rqRun = false;
+	}
+	_rqWait.notify_all();
+	{
+		std::lock_guard<std::mutex> l2(_push_l);
+		_pushRun = false;
+	}
+	_pushWait.notify_all();
+	{
+		std::lock_guard<std::mutex> l2(_sign_l);
+		_signRun = false;
+	}
+	_signWait.notify_all();
+	for(auto t=threads.begin();t!=threads.end();++t)
 		t->join();
+	for(auto j=_signQueue.begin();j!=_signQueue.end();++j)
+		delete *j;
+	for(unsigned int s=0;s<ZT_CONTROLLER_REQUEST_SHARDS;++s) {
+		for(auto n=_rqShards[s].pending.begin();n!=_rqShards[s].pending.end();++n) {
+			for(auto qe=n->second.begin();qe!=n->second.end();++qe)
+				delete *qe;
+		}
+	}
 }
 
 void EmbeddedNetworkController::init(const Identity &signingId,Sender *sender)
@@ -480,10 +652,19 @@ void EmbeddedNetworkController::init(const Identity &signingId,Sender *sender)
 	_signingIdAddressString = signingId.address().toString(tmp);
 #ifdef ZT_CONTROLLER_USE_RETHINKDB
 	if ((_path.length() > 10)&&(_path.substr(0,10) == "rethinkdb:"))
-		_db.reset(new RethinkDB(this,_signingId,_path.c_str()));
+		_db.reset(new RethinkDB(this,_signingId,_path.c_str(),_instanceId));
 	else // else use FileDB after endif
 #endif
-		_db.reset(new FileDB(this,_signingId,_path.c_str()));
+#ifndef __WINDOWS__
+	if ((_path.length() > 7)&&(_path.substr(0,7) == "mapped:"))
+		_db.reset(new MappedDB(this,_signingId,_path.c_str() + 7));
+	else
+#endif
+	if (_path == "memory:")
+		_db.reset(new MemoryDB(this,_signingId));
+	else if ((_path.length() > 8)&&(_path.substr(0,8) == "journal:"))
+		_db.reset(new FileDB(this,_signingId,_path.c_str() + 8,true));
+	else _db.reset(new FileDB(this,_signingId,_path.c_str()));
 	_db->waitForReady();
 }
 
@@ -497,14 +678,44 @@ void EmbeddedNetworkController::request(
 	if (((!_signingId)||(!_signingId.hasPrivate()))||(_signingId.address().toInt() != (nwid >> 24))||(!_sender))
 		return;
 	_startThreads();
+
+	// Members retry while waiting, and a retry is answered by the request that's already queued
+	// or in progress. Pushes (no packet ID) are never dropped since they follow a change.
+	uint64_t dedupKey = 0;
+	if (requestPacketId) {
+		dedupKey = (nwid ^ (identity.address().toInt() * 0x9e3779b97f4a7c15ULL)) | 1ULL;
+		uint64_t expected = 0;
+		if (!_rqInFlight[dedupKey % ZT_CONTROLLER_REQUEST_DEDUP_SLOTS].compare_exchange_strong(expected,dedupKey)) {
+			if (expected == dedupKey) {
+				_outcomes[OUTCOME_DUPLICATE].fetch_add(1,std::memory_order_relaxed);
+				return;
+			}
+			dedupKey = 0; // slot is held by someone else, so just don't track this one
+		}
+	}
+
 	_RQEntry *qe = new _RQEntry;
 	qe->nwid = nwid;
 	qe->requestPacketId = requestPacketId;
 	qe->fromAddr = fromAddr;
 	qe->identity = identity;
 	qe->metaData = metaData;
+	qe->dedupKey = dedupKey;
 	qe->type = _RQEntry::RQENTRY_TYPE_REQUEST;
-	_queue.post(qe);
+
+	_RQShard &shard = _rqShards[nwid % ZT_CONTROLLER_REQUEST_SHARDS];
+	{
+		std::lock_guard<std::mutex> l(shard.lock);
+		std::deque<_RQEntry *> &q = shard.pending[nwid];
+		if (q.empty())
+			shard.networks.push_back(nwid);
+		q.push_back(qe);
+	}
+	{
+		std::lock_guard<std::mutex> l(_rqWait_l);
+		++_rqPending;
+	}
+	_rqWait.notify_one();
 }
 
 unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
@@ -522,7 +733,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 
 		if ((path.size() >= 2)&&(path[1].length() == 16)) {
 			const uint64_t nwid = Utils::hexStrToU64(path[1].c_str());
-			json network;
+			std::shared_ptr<const json> network;
 			if (!_db->get(nwid,network))
 				return 404;
 
@@ -540,6 +751,12 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 						responseBody = OSUtils::jsonDump(member);
 						responseContentType = "application/json";
 
+					} else if ((urlArgs.count("limit"))||(urlArgs.count("cursor"))||(urlArgs.count("authorized"))||(urlArgs.count("online"))||(urlArgs.count("since"))) {
+						// List a page of members and their revisions, in order of address and optionally filtered
+
+						_listMembers(nwid,network,urlArgs,responseBody);
+						responseContentType = "application/json";
+
 					} else {
 						// List members and their revisions
 
@@ -566,7 +783,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 			} else {
 				// Get network
 
-				responseBody = OSUtils::jsonDump(network);
+				responseBody = (network) ? OSUtils::jsonDump(*network) : std::string("null");
 				responseContentType = "application/json";
 				return 200;
 
@@ -592,12 +809,29 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 
 		} // else 404
 
+	} else if ((path.size() == 1)&&(path[0] == "metrics")) {
+
+		responseBody.clear();
+		_metricsText(responseBody);
+		responseContentType = "text/plain; version=0.0.4";
+		return 200;
+
 	} else {
 		// Controller status
 
 		char tmp[4096];
 		const bool dbOk = _db->isReady();
-		OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\n\t\"controller\": true,\n\t\"apiVersion\": %d,\n\t\"clock\": %llu,\n\t\"databaseReady\": %s\n}\n",ZT_NETCONF_CONTROLLER_API_VERSION,(unsigned long long)OSUtils::now(),dbOk ? "true" : "false");
+		const int64_t now = OSUtils::now();
+		double signRate,signLatency;
+		unsigned long signQueueDepth;
+		{
+			std::lock_guard<std::mutex> l(_sign_l);
+			const bool idle = ((now - _signPeriodStart) >= (ZT_CONTROLLER_SIGN_STATS_PERIOD * 2)); // nothing signed for a full period
+			signRate = (idle) ? 0.0 : _signRate;
+			signLatency = (idle) ? 0.0 : _signLatency;
+			signQueueDepth = (unsigned long)_signQueue.size();
+		}
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\n\t\"controller\": true,\n\t\"apiVersion\": %d,\n\t\"clock\": %llu,\n\t\"databaseReady\": %s,\n\t\"signaturesPerSecond\": %.1f,\n\t\"signQueueDepth\": %lu,\n\t\"signQueueLatency\": %.1f,\n\t\"databaseChanges\": %llu\n}\n",ZT_NETCONF_CONTROLLER_API_VERSION,(unsigned long long)now,dbOk ? "true" : "false",signRate,signQueueDepth,signLatency,(unsigned long long)_db->changes());
 		responseBody = tmp;
 		responseContentType = "application/json";
 		return dbOk ? 200 : 503;
@@ -649,91 +883,14 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					char addrs[24];
 					OSUtils::ztsnprintf(addrs,sizeof(addrs),"%.10llx",(unsigned long long)address);
 
-					json member,network;
+					std::shared_ptr<const json> network;
+					json member;
 					_db->get(nwid,network,address,member);
 					json origMember(member); // for detecting changes
 					DB::initMember(member);
 
 					try {
-						if (b.count("activeBridge")) member["activeBridge"] = OSUtils::jsonBool(b["activeBridge"],false);
-						if (b.count("noAutoAssignIps")) member["noAutoAssignIps"] = OSUtils::jsonBool(b["noAutoAssignIps"],false);
-
-						if (b.count("remoteTraceTarget")) {
-							const std::string rtt(OSUtils::jsonString(b["remoteTraceTarget"],""));
-							if (rtt.length() == 10) {
-								member["remoteTraceTarget"] = rtt;
-							} else {
-								member["remoteTraceTarget"] = json();
-							}
-						}
-						if (b.count("remoteTraceLevel")) member["remoteTraceLevel"] = OSUtils::jsonInt(b["remoteTraceLevel"],0ULL);
-
-						if (b.count("authorized")) {
-							const bool newAuth = OSUtils::jsonBool(b["authorized"],false);
-							if (newAuth != OSUtils::jsonBool(member["authorized"],false)) {
-								member["authorized"] = newAuth;
-								member[((newAuth) ? "lastAuthorizedTime" : "lastDeauthorizedTime")] = now;
-								if (newAuth) {
-									member["lastAuthorizedCredentialType"] = "api";
-									member["lastAuthorizedCredential"] = json();
-								}
-							}
-						}
-
-						if (b.count("ipAssignments")) {
-							json &ipa = b["ipAssignments"];
-							if (ipa.is_array()) {
-								json mipa(json::array());
-								for(unsigned long i=0;i<ipa.size();++i) {
-									std::string ips = ipa[i];
-									InetAddress ip(ips.c_str());
-									if ((ip.ss_family == AF_INET)||(ip.ss_family == AF_INET6)) {
-										char tmpip[64];
-										mipa.push_back(ip.toIpString(tmpip));
-										if (mipa.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE)
-											break;
-									}
-								}
-								member["ipAssignments"] = mipa;
-							}
-						}
-
-						if (b.count("tags")) {
-							json &tags = b["tags"];
-							if (tags.is_array()) {
-								std::map<uint64_t,uint64_t> mtags;
-								for(unsigned long i=0;i<tags.size();++i) {
-									json &tag = tags[i];
-									if ((tag.is_array())&&(tag.size() == 2))
-										mtags[OSUtils::jsonInt(tag[0],0ULL) & 0xffffffffULL] = OSUtils::jsonInt(tag[1],0ULL) & 0xffffffffULL;
-								}
-								json mtagsa = json::array();
-								for(std::map<uint64_t,uint64_t>::iterator t(mtags.begin());t!=mtags.end();++t) {
-									json ta = json::array();
-									ta.push_back(t->first);
-									ta.push_back(t->second);
-									mtagsa.push_back(ta);
-									if (mtagsa.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE)
-										break;
-								}
-								member["tags"] = mtagsa;
-							}
-						}
-
-						if (b.count("capabilities")) {
-							json &capabilities = b["capabilities"];
-							if (capabilities.is_array()) {
-								json mcaps = json::array();
-								for(unsigned long i=0;i<capabilities.size();++i) {
-									mcaps.push_back(OSUtils::jsonInt(capabilities[i],0ULL));
-									if (mcaps.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE)
-										break;
-								}
-								std::sort(mcaps.begin(),mcaps.end());
-								mcaps.erase(std::unique(mcaps.begin(),mcaps.end()),mcaps.end());
-								member["capabilities"] = mcaps;
-							}
-						}
+						_applyMemberChanges(member,b,now);
 					} catch ( ... ) {
 						responseBody = "{ \"message\": \"exception while processing parameters in JSON body\" }";
 						responseContentType = "application/json";
@@ -750,6 +907,16 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					responseContentType = "application/json";
 
 					return 200;
+				} else if ((path.size() == 3)&&(path[2] == "member")) {
+					// Change many members of this network at once
+					json networks;
+					networks[nwids] = b;
+					json results;
+					const unsigned int rc = _postMembers(networks,now,results,responseBody);
+					if (rc == 200)
+						responseBody = OSUtils::jsonDump(results[nwids]);
+					responseContentType = "application/json";
+					return rc;
 				} // else 404
 
 			} else {
@@ -783,7 +950,10 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 					if (b.count("name")) network["name"] = OSUtils::jsonString(b["name"],"");
 					if (b.count("private")) network["private"] = OSUtils::jsonBool(b["private"],true);
 					if (b.count("enableBroadcast")) network["enableBroadcast"] = OSUtils::jsonBool(b["enableBroadcast"],false);
+					if (b.count("arpEmulation")) network["arpEmulation"] = OSUtils::jsonBool(b["arpEmulation"],false);
+					if (b.count("ndpProxy")) network["ndpProxy"] = OSUtils::jsonBool(b["ndpProxy"],false);
 					if (b.count("multicastLimit")) network["multicastLimit"] = OSUtils::jsonInt(b["multicastLimit"],32ULL);
+					if (b.count("rateLimit")) network["rateLimit"] = OSUtils::jsonInt(b["rateLimit"],0ULL);
 					if (b.count("mtu")) network["mtu"] = std::max(std::min((unsigned int)OSUtils::jsonInt(b["mtu"],ZT_DEFAULT_MTU),(unsigned int)ZT_MAX_MTU),(unsigned int)ZT_MIN_MTU);
 
 					if (b.count("remoteTraceTarget")) {
@@ -1016,6 +1186,16 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpPOST(
 
 		} // else 404
 
+	} else if ((path.size() == 1)&&(path[0] == "member")) {
+		// Change members of any number of networks at once
+
+		json results;
+		const unsigned int rc = _postMembers(b,now,results,responseBody);
+		if (rc == 200)
+			responseBody = OSUtils::jsonDump(results);
+		responseContentType = "application/json";
+		return rc;
+
 	}
 
 	return 404;
@@ -1046,7 +1226,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 
 					{
 						std::lock_guard<std::mutex> l(_memberStatus_l);
-						_memberStatus.erase(_MemberStatusKey(nwid,address));
+						_eraseMemberStatus(nwid,address);
 					}
 
 					if (!member.size())
@@ -1060,12 +1240,18 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 				_db->get(nwid,network);
 				_db->eraseNetwork(nwid);
 
+				{
+					std::lock_guard<std::mutex> l(_networkPolicies_l);
+					_networkPolicies.erase(nwid);
+				}
+
 				{
 					std::lock_guard<std::mutex> l(_memberStatus_l);
-					for(auto i=_memberStatus.begin();i!=_memberStatus.end();) {
-						if (i->first.networkId == nwid)
-							_memberStatus.erase(i++);
-						else ++i;
+					auto bn = _memberStatusByNetwork.find(nwid);
+					if (bn != _memberStatusByNetwork.end()) {
+						for(auto m=bn->second.begin();m!=bn->second.end();++m)
+							_memberStatus.erase(_MemberStatusKey(nwid,*m));
+						_memberStatusByNetwork.erase(bn);
 					}
 				}
 
@@ -1135,40 +1321,262 @@ void EmbeddedNetworkController::handleRemoteTrace(const ZT_RemoteTrace &rt)
 	}
 }
 
+void EmbeddedNetworkController::setPushRate(const unsigned int perSecond)
+{
+	std::lock_guard<std::mutex> l(_push_l);
+	_pushRate = (perSecond) ? perSecond : ZT_CONTROLLER_DEFAULT_PUSH_RATE;
+}
+
+void EmbeddedNetworkController::setWorkerCpus(const std::vector<unsigned int> &cpus)
+{
+	std::lock_guard<std::mutex> l(_threads_l);
+	_workerCpus = cpus;
+}
+
+void EmbeddedNetworkController::setInstanceId(const std::string &id)
+{
+	_instanceId = id;
+}
+
+bool EmbeddedNetworkController::memoryUsage(uint64_t &networks,uint64_t &members,uint64_t &bytes) const
+{
+	if (!_db)
+		return false;
+	_db->memoryUsage(networks,members,bytes);
+	return true;
+}
+
 void EmbeddedNetworkController::onNetworkUpdate(const uint64_t networkId)
 {
-	// Send an update to all members of the network that are online
-	const int64_t now = OSUtils::now();
-	std::lock_guard<std::mutex> l(_memberStatus_l);
-	for(auto i=_memberStatus.begin();i!=_memberStatus.end();++i) {
-		if ((i->first.networkId == networkId)&&(i->second.online(now))&&(i->second.lastRequestMetaData))
-			request(networkId,InetAddress(),0,i->second.identity,i->second.lastRequestMetaData);
+	_forgetConfigs(networkId);
+
+	// Online members get the new config from _pushMain(), several changes in a row cause just one push
+	_startThreads();
+	{
+		std::lock_guard<std::mutex> l(_push_l);
+		if (!_pushQueued.insert(networkId).second)
+			return;
+		_pushQueue.push_back(networkId);
 	}
+	_pushWait.notify_one();
 }
 
 void EmbeddedNetworkController::onNetworkMemberUpdate(const uint64_t networkId,const uint64_t memberId)
 {
+	{
+		std::lock_guard<std::mutex> l(_configCache_l);
+		_configCache.erase(_MemberStatusKey(networkId,memberId));
+	}
+
+	// Members changed by a bulk POST get one push for the whole network once it's done
+	{
+		std::lock_guard<std::mutex> l(_push_l);
+		if (_pushHeld.find(networkId) != _pushHeld.end())
+			return;
+	}
+
 	// Push update to member if online
 	try {
 		std::lock_guard<std::mutex> l(_memberStatus_l);
-		_MemberStatus &ms = _memberStatus[_MemberStatusKey(networkId,memberId)];
-		if ((ms.online(OSUtils::now()))&&(ms.lastRequestMetaData))
-			request(networkId,InetAddress(),0,ms.identity,ms.lastRequestMetaData);
+		auto ms = _memberStatus.find(_MemberStatusKey(networkId,memberId));
+		if ((ms != _memberStatus.end())&&(ms->second.online(OSUtils::now()))&&(!ms->second.lastRequestMetaData.empty()))
+			request(networkId,InetAddress(),0,ms->second.identity,Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY>(ms->second.lastRequestMetaData.c_str()));
 	} catch ( ... ) {}
 }
 
 void EmbeddedNetworkController::onNetworkMemberDeauthorize(const uint64_t networkId,const uint64_t memberId)
 {
+	_forgetConfigs(networkId); // credentials issued before this still agree with the deauthorized member's
+
 	const int64_t now = OSUtils::now();
-	Revocation rev((uint32_t)_node->prng(),networkId,0,now,ZT_REVOCATION_FLAG_FAST_PROPAGATE,Address(memberId),Revocation::CREDENTIAL_TYPE_COM);
-	rev.sign(_signingId);
+	_SignJob *const job = new _SignJob();
+	job->revocation = Revocation((uint32_t)_node->prng(),networkId,0,now,ZT_REVOCATION_FLAG_FAST_PROPAGATE,Address(memberId),Revocation::CREDENTIAL_TYPE_COM);
+	{
+		std::lock_guard<std::mutex> l(_memberStatus_l);
+		auto bn = _memberStatusByNetwork.find(networkId);
+		if (bn != _memberStatusByNetwork.end()) {
+			for(auto m=bn->second.begin();m!=bn->second.end();++m) {
+				auto ms = _memberStatus.find(_MemberStatusKey(networkId,*m));
+				if ((ms != _memberStatus.end())&&(ms->second.online(now)))
+					job->revocationTo.push_back(Address(*m));
+			}
+		}
+	}
+	if (job->revocationTo.empty()) {
+		delete job;
+		return;
+	}
+	_queueSign(job);
+}
+
+void EmbeddedNetworkController::onMemberServedElsewhere(const uint64_t networkId,const uint64_t memberId,const int64_t servedAt)
+{
+	// The member comes back here if it fails over, and is pushed to by the other instance until then
+	std::lock_guard<std::mutex> l(_memberStatus_l);
+	auto ms = _memberStatus.find(_MemberStatusKey(networkId,memberId));
+	if ((ms != _memberStatus.end())&&(ms->second.lastRequestTime < servedAt))
+		_eraseMemberStatus(networkId,memberId);
+}
+
+bool EmbeddedNetworkController::parseRule(json &r,ZT_VirtualNetworkRule &rule) { return _parseRule(r,rule); }
+
+void EmbeddedNetworkController::_listMembers(const uint64_t nwid,std::shared_ptr<const json> &network,const std::map<std::string,std::string> &urlArgs,std::string &responseBody)
+{
+	std::map<std::string,std::string>::const_iterator a(urlArgs.find("limit"));
+	unsigned long limit = (a != urlArgs.end()) ? (unsigned long)Utils::strToU64(a->second.c_str()) : 0;
+	if ((!limit)||(limit > ZT_CONTROLLER_MAX_ARRAY_SIZE))
+		limit = ZT_CONTROLLER_MAX_ARRAY_SIZE;
+	a = urlArgs.find("cursor");
+	const uint64_t cursor = (a != urlArgs.end()) ? Utils::hexStrToU64(a->second.c_str()) : 0;
+	a = urlArgs.find("since");
+	const uint64_t since = (a != urlArgs.end()) ? Utils::strToU64(a->second.c_str()) : 0;
+	a = urlArgs.find("authorized");
+	const int authorized = (a != urlArgs.end()) ? (((a->second == "1")||(a->second == "true")) ? 1 : 0) : -1;
+	a = urlArgs.find("online");
+	const int online = (a != urlArgs.end()) ? (((a->second == "1")||(a->second == "true")) ? 1 : 0) : -1;
+
+	// Addresses and revisions of members after the cursor that pass the filters, in address order
+	std::vector< std::pair<uint64_t,uint64_t> > page;
 	{
+		std::vector<json> members;
+		_db->get(nwid,network,members);
+		page.reserve(members.size());
+		for(auto member=members.begin();member!=members.end();++member) {
+			const uint64_t address = OSUtils::jsonIntHex((*member)["id"],0ULL);
+			const uint64_t revision = OSUtils::jsonInt((*member)["revision"],0ULL);
+			if ((address <= cursor)||((since)&&(revision <= since)))
+				continue;
+			if ((authorized >= 0)&&(OSUtils::jsonBool((*member)["authorized"],false) != (authorized > 0)))
+				continue;
+			page.push_back(std::pair<uint64_t,uint64_t>(address,revision));
+		}
+	}
+	std::sort(page.begin(),page.end());
+
+	if (online >= 0) {
+		const int64_t now = OSUtils::now();
 		std::lock_guard<std::mutex> l(_memberStatus_l);
-		for(auto i=_memberStatus.begin();i!=_memberStatus.end();++i) {
-			if ((i->first.networkId == networkId)&&(i->second.online(now)))
-				_node->ncSendRevocation(Address(i->first.nodeId),rev);
+		unsigned long kept = 0;
+		for(unsigned long i=0;i<page.size();++i) {
+			auto ms = _memberStatus.find(_MemberStatusKey(nwid,page[i].first));
+			if (((ms != _memberStatus.end())&&(ms->second.online(now))) == (online > 0))
+				page[kept++] = page[i];
 		}
+		page.resize(kept);
+	}
+
+	const bool more = (page.size() > limit);
+	if (more)
+		page.resize(limit);
+
+	char tmp[128];
+	responseBody = "{\"members\":{";
+	responseBody.reserve((page.size() + 2) * 32);
+	for(unsigned long i=0;i<page.size();++i) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s\"%.10llx\":%llu",(i > 0) ? "," : "",(unsigned long long)page[i].first,(unsigned long long)page[i].second);
+		responseBody.append(tmp);
 	}
+	if (more)
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"},\"nextCursor\":\"%.10llx\"}",(unsigned long long)page.back().first);
+	else OSUtils::ztsnprintf(tmp,sizeof(tmp),"},\"nextCursor\":null}");
+	responseBody.append(tmp);
+}
+
+unsigned int EmbeddedNetworkController::_postMembers(json &networks,const int64_t now,json &results,std::string &responseBody)
+{
+	struct _MemberChange
+	{
+		uint64_t nwid;
+		json orig;
+		json member;
+	};
+
+	char tmp[256];
+	if (!networks.is_object()) {
+		responseBody = "{ \"message\": \"body is not a JSON object\" }";
+		return 400;
+	}
+
+	// Every change is built before any is saved, so a bad entry leaves the database as it was
+	std::vector<uint64_t> nwids;
+	std::vector<_MemberChange> changes;
+	for(json::iterator n(networks.begin());n!=networks.end();++n) {
+		if ((n.key().length() != 16)||(!n.value().is_object())) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"{ \"message\": \"invalid network ID or member object for network %.16s\" }",n.key().c_str());
+			responseBody = tmp;
+			return 400;
+		}
+		const uint64_t nwid = Utils::hexStrToU64(n.key().c_str());
+		std::shared_ptr<const json> network;
+		if (!_db->get(nwid,network)) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"{ \"message\": \"network %.16llx not found\" }",(unsigned long long)nwid);
+			responseBody = tmp;
+			return 404;
+		}
+		nwids.push_back(nwid);
+
+		for(json::iterator m(n.value().begin());m!=n.value().end();++m) {
+			if ((m.key().length() != 10)||(!m.value().is_object())) {
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"{ \"message\": \"invalid member address or object for member %.10s\" }",m.key().c_str());
+				responseBody = tmp;
+				return 400;
+			}
+			if (changes.size() >= ZT_CONTROLLER_MAX_ARRAY_SIZE) {
+				responseBody = "{ \"message\": \"too many members in one request\" }";
+				return 400;
+			}
+			const uint64_t address = Utils::hexStrToU64(m.key().c_str());
+			changes.push_back(_MemberChange());
+			_MemberChange &c = changes.back();
+			c.nwid = nwid;
+			_db->get(nwid,network,address,c.orig);
+			c.member = c.orig;
+			DB::initMember(c.member);
+			try {
+				_applyMemberChanges(c.member,m.value(),now);
+			} catch ( ... ) {
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"{ \"message\": \"exception while processing parameters for member %.10llx of network %.16llx\" }",(unsigned long long)address,(unsigned long long)nwid);
+				responseBody = tmp;
+				return 400;
+			}
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)address);
+			c.member["id"] = tmp;
+			c.member["address"] = tmp; // legacy
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+			c.member["nwid"] = tmp;
+			DB::cleanMember(c.member);
+		}
+	}
+
+	// Members saved while their network is held aren't pushed one by one, changed networks get one push each afterwards
+	{
+		std::lock_guard<std::mutex> l(_push_l);
+		for(auto nwid=nwids.begin();nwid!=nwids.end();++nwid)
+			++_pushHeld[*nwid];
+	}
+	std::set<uint64_t> changed;
+	results = json::object();
+	for(auto c=changes.begin();c!=changes.end();++c) {
+		if (c->orig != c->member)
+			changed.insert(c->nwid);
+		try {
+			_db->save(&(c->orig),c->member);
+		} catch ( ... ) {}
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)c->nwid);
+		results[tmp][OSUtils::jsonString(c->member["id"],"")] = OSUtils::jsonInt(c->member["revision"],0ULL);
+	}
+	{
+		std::lock_guard<std::mutex> l(_push_l);
+		for(auto nwid=nwids.begin();nwid!=nwids.end();++nwid) {
+			auto h = _pushHeld.find(*nwid);
+			if ((h != _pushHeld.end())&&(--h->second == 0))
+				_pushHeld.erase(h);
+		}
+	}
+	for(auto nwid=changed.begin();nwid!=changed.end();++nwid)
+		onNetworkUpdate(*nwid);
+
+	return 200;
 }
 
 void EmbeddedNetworkController::_request(
@@ -1180,7 +1588,8 @@ void EmbeddedNetworkController::_request(
 {
 	char nwids[24];
 	DB::NetworkSummaryInfo ns;
-	json network,member,origMember;
+	std::shared_ptr<const json> networkSnapshot;
+	json member,origMember;
 
 	if (!_db)
 		return;
@@ -1192,20 +1601,29 @@ void EmbeddedNetworkController::_request(
 
 	if (requestPacketId) {
 		std::lock_guard<std::mutex> l(_memberStatus_l);
-		_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,identity.address().toInt())];
-		if ((now - ms.lastRequestTime) <= ZT_NETCONF_MIN_REQUEST_PERIOD)
+		_MemberStatus &ms = _memberStatusFor(nwid,identity.address().toInt(),now);
+		if ((now - ms.lastRequestTime) <= ZT_NETCONF_MIN_REQUEST_PERIOD) {
+			_outcomes[OUTCOME_TOO_SOON].fetch_add(1,std::memory_order_relaxed);
 			return;
+		}
 		ms.lastRequestTime = now;
+	} else {
+		_pushes.fetch_add(1,std::memory_order_relaxed);
 	}
 
 	_db->nodeIsOnline(nwid,identity.address().toInt(),fromAddr);
 
 	Utils::hex(nwid,nwids);
-	_db->get(nwid,network,identity.address().toInt(),member,ns);
-	if ((!network.is_object())||(network.size() == 0)) {
+	uint64_t stageStart = _usNow();
+	_db->get(nwid,networkSnapshot,identity.address().toInt(),member,ns);
+	_timed(STAGE_DB,stageStart);
+	stageStart = _usNow();
+	if ((!networkSnapshot)||(!networkSnapshot->is_object())||(networkSnapshot->size() == 0)) {
+		_outcomes[OUTCOME_NOT_FOUND].fetch_add(1,std::memory_order_relaxed);
 		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_OBJECT_NOT_FOUND);
 		return;
 	}
+	const json &network = *networkSnapshot; // shared and immutable, so only ever read through _jsonField()
 	origMember = member;
 	const bool newMember = ((!member.is_object())||(member.size() == 0));
 	DB::initMember(member);
@@ -1218,10 +1636,12 @@ void EmbeddedNetworkController::_request(
 			// known member.
 			try {
 				if (Identity(haveIdStr.c_str()) != identity) {
+					_outcomes[OUTCOME_NOT_AUTHORIZED].fetch_add(1,std::memory_order_relaxed);
 					_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_ACCESS_DENIED);
 					return;
 				}
 			} catch ( ... ) {
+				_outcomes[OUTCOME_NOT_AUTHORIZED].fetch_add(1,std::memory_order_relaxed);
 				_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_ACCESS_DENIED);
 				return;
 			}
@@ -1247,7 +1667,7 @@ void EmbeddedNetworkController::_request(
 	json autoAuthCredentialType,autoAuthCredential;
 	if (OSUtils::jsonBool(member["authorized"],false)) {
 		authorized = true;
-	} else if (!OSUtils::jsonBool(network["private"],true)) {
+	} else if (!OSUtils::jsonBool(_jsonField(network,"private"),true)) {
 		authorized = true;
 		autoAuthorized = true;
 		autoAuthCredentialType = "public";
@@ -1257,8 +1677,7 @@ void EmbeddedNetworkController::_request(
 			presentedAuth[511] = (char)0; // sanity check
 			if ((strlen(presentedAuth) > 6)&&(!strncmp(presentedAuth,"token:",6))) {
 				const char *const presentedToken = presentedAuth + 6;
-				json authTokens(network["authTokens"]);
-				json &tokenExpires = authTokens[presentedToken];
+				const json &tokenExpires = _jsonField(_jsonField(network,"authTokens"),presentedToken);
 				if (tokenExpires.is_number()) {
 					if ((tokenExpires == 0)||(tokenExpires > now)) {
 						authorized = true;
@@ -1294,13 +1713,8 @@ void EmbeddedNetworkController::_request(
 
 			{
 				std::lock_guard<std::mutex> l(_memberStatus_l);
-				_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,identity.address().toInt())];
-
-				ms.vMajor = (int)vMajor;
-				ms.vMinor = (int)vMinor;
-				ms.vRev = (int)vRev;
-				ms.vProto = (int)vProto;
-				ms.lastRequestMetaData = metaData;
+				_MemberStatus &ms = _memberStatusFor(nwid,identity.address().toInt(),now);
+				ms.lastRequestMetaData.assign(metaData.data(),metaData.sizeBytes());
 				ms.identity = identity;
 			}
 		}
@@ -1308,6 +1722,7 @@ void EmbeddedNetworkController::_request(
 		// If they are not authorized, STOP!
 		DB::cleanMember(member);
 		_db->save(&origMember,member);
+		_outcomes[OUTCOME_NOT_AUTHORIZED].fetch_add(1,std::memory_order_relaxed);
 		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_ACCESS_DENIED);
 		return;
 	}
@@ -1329,43 +1744,78 @@ void EmbeddedNetworkController::_request(
 		}
 	}
 
+	const uint64_t networkRevision = OSUtils::jsonInt(_jsonField(network,"revision"),0ULL);
+	const bool rulesEngine = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0) > 0);
+	const _MemberStatusKey cacheKey(nwid,identity.address().toInt());
+
+	// If nothing about this member changed with this request and nothing else the config depends
+	// on did either, send the config that was built and signed for it last time.
+	if (member == origMember) {
+		std::string cached;
+		{
+			std::lock_guard<std::mutex> l(_configCache_l);
+			auto cc = _configCache.find(cacheKey);
+			if (cc != _configCache.end()) {
+				const _CachedConfig &c = cc->second;
+				if ( (c.networkRevision == networkRevision) &&
+				     (c.memberRevision == OSUtils::jsonInt(member["revision"],0ULL)) &&
+				     (c.credentialTimeMaxDelta == credentialtmd) &&
+				     (c.rulesEngine == rulesEngine) &&
+				     (c.activeBridges == ns.activeBridges) &&
+				     (c.timestamp > ns.mostRecentDeauthTime) &&
+				     ((now - c.timestamp) < (credentialtmd / ZT_CONTROLLER_CONFIG_CACHE_MAX_AGE_DIVISOR)) ) {
+					cached = c.dictionary;
+				} else {
+					_configCache.erase(cc);
+				}
+			}
+		}
+		if (cached.length() > 0) {
+			std::unique_ptr< Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> > d(new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>(cached.data(),(unsigned int)cached.length()));
+			std::unique_ptr<NetworkConfig> nc(new NetworkConfig());
+			if (nc->fromDictionary(*d)) {
+				uint64_t have[ZT_NETWORKCONFIG_DELTA_BLOBS];
+				const bool haveHashes = NetworkConfig::blobHashes(metaData,have);
+				_configCacheHits.fetch_add(1,std::memory_order_relaxed);
+				_timed(STAGE_BUILD,stageStart);
+				stageStart = _usNow();
+				_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*(nc.get()),metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6,(haveHashes) ? have : (const uint64_t *)0);
+				_timed(STAGE_SEND,stageStart);
+				_outcomes[OUTCOME_OK].fetch_add(1,std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+	_configCacheMisses.fetch_add(1,std::memory_order_relaxed);
+
+	const std::shared_ptr<const _NetworkPolicy> policy(_networkPolicy(nwid,networkSnapshot));
+
 	std::unique_ptr<NetworkConfig> nc(new NetworkConfig());
 
 	nc->networkId = nwid;
-	nc->type = OSUtils::jsonBool(network["private"],true) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
+	nc->type = (policy->isPrivate) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
 	nc->timestamp = now;
 	nc->credentialTimeMaxDelta = credentialtmd;
-	nc->revision = OSUtils::jsonInt(network["revision"],0ULL);
+	nc->revision = networkRevision;
 	nc->issuedTo = identity.address();
-	if (OSUtils::jsonBool(network["enableBroadcast"],true)) nc->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
-	Utils::scopy(nc->name,sizeof(nc->name),OSUtils::jsonString(network["name"],"").c_str());
-	nc->mtu = std::max(std::min((unsigned int)OSUtils::jsonInt(network["mtu"],ZT_DEFAULT_MTU),(unsigned int)ZT_MAX_MTU),(unsigned int)ZT_MIN_MTU);
-	nc->multicastLimit = (unsigned int)OSUtils::jsonInt(network["multicastLimit"],32ULL);
+	nc->flags = policy->flags;
+	Utils::scopy(nc->name,sizeof(nc->name),policy->name.c_str());
+	nc->mtu = policy->mtu;
+	nc->multicastLimit = policy->multicastLimit;
+	nc->rateLimit = policy->rateLimit;
 
 	std::string rtt(OSUtils::jsonString(member["remoteTraceTarget"],""));
 	if (rtt.length() == 10) {
 		nc->remoteTraceTarget = Address(Utils::hexStrToU64(rtt.c_str()));
 		nc->remoteTraceLevel = (Trace::Level)OSUtils::jsonInt(member["remoteTraceLevel"],0ULL);
 	} else {
-		rtt = OSUtils::jsonString(network["remoteTraceTarget"],"");
-		if (rtt.length() == 10) {
-			nc->remoteTraceTarget = Address(Utils::hexStrToU64(rtt.c_str()));
-		} else {
-			nc->remoteTraceTarget.zero();
-		}
-		nc->remoteTraceLevel = (Trace::Level)OSUtils::jsonInt(network["remoteTraceLevel"],0ULL);
+		nc->remoteTraceTarget = policy->remoteTraceTarget;
+		nc->remoteTraceLevel = policy->remoteTraceLevel;
 	}
 
 	for(std::vector<Address>::const_iterator ab(ns.activeBridges.begin());ab!=ns.activeBridges.end();++ab)
 		nc->addSpecialist(*ab,ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
 
-	json &v4AssignMode = network["v4AssignMode"];
-	json &v6AssignMode = network["v6AssignMode"];
-	json &ipAssignmentPools = network["ipAssignmentPools"];
-	json &routes = network["routes"];
-	json &rules = network["rules"];
-	json &capabilities = network["capabilities"];
-	json &tags = network["tags"];
 	json &memberCapabilities = member["capabilities"];
 	json &memberTags = member["tags"];
 
@@ -1376,61 +1826,32 @@ void EmbeddedNetworkController::_request(
 		nc->ruleCount = 1;
 		nc->rules[0].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
 	} else {
-		if (rules.is_array()) {
-			for(unsigned long i=0;i<rules.size();++i) {
-				if (nc->ruleCount >= ZT_MAX_NETWORK_RULES)
-					break;
-				if (_parseRule(rules[i],nc->rules[nc->ruleCount]))
-					++nc->ruleCount;
-			}
-		}
+		nc->ruleCount = (unsigned int)policy->rules.size();
+		if (nc->ruleCount)
+			ZT_FAST_MEMCPY(nc->rules,policy->rules.data(),sizeof(ZT_VirtualNetworkRule) * nc->ruleCount);
 
-		std::map< uint64_t,json * > capsById;
 		if (!memberCapabilities.is_array())
 			memberCapabilities = json::array();
-		if (capabilities.is_array()) {
-			for(unsigned long i=0;i<capabilities.size();++i) {
-				json &cap = capabilities[i];
-				if (cap.is_object()) {
-					const uint64_t id = OSUtils::jsonInt(cap["id"],0ULL) & 0xffffffffULL;
-					capsById[id] = &cap;
-					if ((newMember)&&(OSUtils::jsonBool(cap["default"],false))) {
-						bool have = false;
-						for(unsigned long i=0;i<memberCapabilities.size();++i) {
-							if (id == (OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL)) {
-								have = true;
-								break;
-							}
-						}
-						if (!have)
-							memberCapabilities.push_back(id);
+		if (newMember) {
+			for(auto id=policy->defaultCaps.begin();id!=policy->defaultCaps.end();++id) {
+				bool have = false;
+				for(unsigned long i=0;i<memberCapabilities.size();++i) {
+					if (*id == (OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL)) {
+						have = true;
+						break;
 					}
 				}
+				if (!have)
+					memberCapabilities.push_back(*id);
 			}
 		}
 		for(unsigned long i=0;i<memberCapabilities.size();++i) {
 			const uint64_t capId = OSUtils::jsonInt(memberCapabilities[i],0ULL) & 0xffffffffULL;
-			std::map< uint64_t,json * >::const_iterator ctmp = capsById.find(capId);
-			if (ctmp != capsById.end()) {
-				json *cap = ctmp->second;
-				if ((cap)&&(cap->is_object())&&(cap->size() > 0)) {
-					ZT_VirtualNetworkRule capr[ZT_MAX_CAPABILITY_RULES];
-					unsigned int caprc = 0;
-					json &caprj = (*cap)["rules"];
-					if ((caprj.is_array())&&(caprj.size() > 0)) {
-						for(unsigned long j=0;j<caprj.size();++j) {
-							if (caprc >= ZT_MAX_CAPABILITY_RULES)
-								break;
-							if (_parseRule(caprj[j],capr[caprc]))
-								++caprc;
-						}
-					}
-					nc->capabilities[nc->capabilityCount] = Capability((uint32_t)capId,nwid,now,1,capr,caprc);
-					if (nc->capabilities[nc->capabilityCount].sign(_signingId,identity.address()))
-						++nc->capabilityCount;
-					if (nc->capabilityCount >= ZT_MAX_NETWORK_CAPABILITIES)
-						break;
-				}
+			std::map<uint32_t,_NetworkPolicy::Cap>::const_iterator cap(policy->caps.find((uint32_t)capId));
+			if ((cap != policy->caps.end())&&(cap->second.valid)) {
+				nc->capabilities[nc->capabilityCount++] = Capability((uint32_t)capId,nwid,now,1,cap->second.rules.data(),(unsigned int)cap->second.rules.size()); // signed in _sign()
+				if (nc->capabilityCount >= ZT_MAX_NETWORK_CAPABILITIES)
+					break;
 			}
 		}
 
@@ -1442,61 +1863,34 @@ void EmbeddedNetworkController::_request(
 					memberTagsById[(uint32_t)(OSUtils::jsonInt(t[0],0ULL) & 0xffffffffULL)] = (uint32_t)(OSUtils::jsonInt(t[1],0ULL) & 0xffffffffULL);
 			}
 		}
-		if (tags.is_array()) { // check network tags array for defaults that are not present in member tags
-			for(unsigned long i=0;i<tags.size();++i) {
-				json &t = tags[i];
-				if (t.is_object()) {
-					const uint32_t id = (uint32_t)(OSUtils::jsonInt(t["id"],0) & 0xffffffffULL);
-					json &dfl = t["default"];
-					if ((dfl.is_number())&&(memberTagsById.find(id) == memberTagsById.end())) {
-						memberTagsById[id] = (uint32_t)(OSUtils::jsonInt(dfl,0) & 0xffffffffULL);
-						json mt = json::array();
-						mt.push_back(id);
-						mt.push_back(dfl);
-						memberTags.push_back(mt); // add default to member tags if not present
-					}
-				}
+		for(auto t=policy->defaultTags.begin();t!=policy->defaultTags.end();++t) { // add network tag defaults that are not present in member tags
+			if (memberTagsById.find(t->id) == memberTagsById.end()) {
+				memberTagsById[t->id] = t->value;
+				json mt = json::array();
+				mt.push_back(t->id);
+				mt.push_back(t->dfl);
+				memberTags.push_back(mt);
 			}
 		}
 		for(std::map< uint32_t,uint32_t >::const_iterator t(memberTagsById.begin());t!=memberTagsById.end();++t) {
 			if (nc->tagCount >= ZT_MAX_NETWORK_TAGS)
 				break;
-			nc->tags[nc->tagCount] = Tag(nwid,now,identity.address(),t->first,t->second);
-			if (nc->tags[nc->tagCount].sign(_signingId))
-				++nc->tagCount;
+			nc->tags[nc->tagCount++] = Tag(nwid,now,identity.address(),t->first,t->second);
 		}
 	}
 
-	if (routes.is_array()) {
-		for(unsigned long i=0;i<routes.size();++i) {
-			if (nc->routeCount >= ZT_MAX_NETWORK_ROUTES)
-				break;
-			json &route = routes[i];
-			json &target = route["target"];
-			json &via = route["via"];
-			if (target.is_string()) {
-				const InetAddress t(target.get<std::string>().c_str());
-				InetAddress v;
-				if (via.is_string()) v.fromString(via.get<std::string>().c_str());
-				if ((t.ss_family == AF_INET)||(t.ss_family == AF_INET6)) {
-					ZT_VirtualNetworkRoute *r = &(nc->routes[nc->routeCount]);
-					*(reinterpret_cast<InetAddress *>(&(r->target))) = t;
-					if (v.ss_family == t.ss_family)
-						*(reinterpret_cast<InetAddress *>(&(r->via))) = v;
-					++nc->routeCount;
-				}
-			}
-		}
-	}
+	nc->routeCount = (unsigned int)policy->routes.size();
+	if (nc->routeCount)
+		ZT_FAST_MEMCPY(nc->routes,policy->routes.data(),sizeof(ZT_VirtualNetworkRoute) * nc->routeCount);
 
 	const bool noAutoAssignIps = OSUtils::jsonBool(member["noAutoAssignIps"],false);
 
-	if ((v6AssignMode.is_object())&&(!noAutoAssignIps)) {
-		if ((OSUtils::jsonBool(v6AssignMode["rfc4193"],false))&&(nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
+	if (!noAutoAssignIps) {
+		if ((policy->v6Rfc4193)&&(nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
 			nc->staticIps[nc->staticIpCount++] = InetAddress::makeIpv6rfc4193(nwid,identity.address().toInt());
 			nc->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION;
 		}
-		if ((OSUtils::jsonBool(v6AssignMode["6plane"],false))&&(nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
+		if ((policy->v66plane)&&(nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
 			nc->staticIps[nc->staticIpCount++] = InetAddress::makeIpv66plane(nwid,identity.address().toInt());
 			nc->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION;
 		}
@@ -1536,123 +1930,90 @@ void EmbeddedNetworkController::_request(
 		ipAssignments = json::array();
 	}
 
-	if ( (ipAssignmentPools.is_array()) && ((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false))) && (!haveManagedIpv6AutoAssignment) && (!noAutoAssignIps) ) {
-		for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv6AutoAssignment));++p) {
-			json &pool = ipAssignmentPools[p];
-			if (pool.is_object()) {
-				InetAddress ipRangeStart(OSUtils::jsonString(pool["ipRangeStart"],"").c_str());
-				InetAddress ipRangeEnd(OSUtils::jsonString(pool["ipRangeEnd"],"").c_str());
-				if ( (ipRangeStart.ss_family == AF_INET6) && (ipRangeEnd.ss_family == AF_INET6) ) {
-					uint64_t s[2],e[2],x[2],xx[2];
-					ZT_FAST_MEMCPY(s,ipRangeStart.rawIpData(),16);
-					ZT_FAST_MEMCPY(e,ipRangeEnd.rawIpData(),16);
-					s[0] = Utils::ntoh(s[0]);
-					s[1] = Utils::ntoh(s[1]);
-					e[0] = Utils::ntoh(e[0]);
-					e[1] = Utils::ntoh(e[1]);
-					x[0] = s[0];
-					x[1] = s[1];
-
-					for(unsigned int trialCount=0;trialCount<1000;++trialCount) {
-						if ((trialCount == 0)&&(e[1] > s[1])&&((e[1] - s[1]) >= 0xffffffffffULL)) {
-							// First see if we can just cram a ZeroTier ID into the higher 64 bits. If so do that.
-							xx[0] = Utils::hton(x[0]);
-							xx[1] = Utils::hton(x[1] + identity.address().toInt());
-						} else {
-							// Otherwise pick random addresses -- this technically doesn't explore the whole range if the lower 64 bit range is >= 1 but that won't matter since that would be huge anyway
-							Utils::getSecureRandom((void *)xx,16);
-							if ((e[0] > s[0]))
-								xx[0] %= (e[0] - s[0]);
-							else xx[0] = 0;
-							if ((e[1] > s[1]))
-								xx[1] %= (e[1] - s[1]);
-							else xx[1] = 0;
-							xx[0] = Utils::hton(x[0] + xx[0]);
-							xx[1] = Utils::hton(x[1] + xx[1]);
-						}
-
-						InetAddress ip6((const void *)xx,16,0);
+	if ( (policy->v6Auto) && (!haveManagedIpv6AutoAssignment) && (!noAutoAssignIps) ) {
+		for(auto pool=policy->pools.begin();((pool!=policy->pools.end())&&(!haveManagedIpv6AutoAssignment));++pool) {
+			const InetAddress &ipRangeStart = pool->first;
+			const InetAddress &ipRangeEnd = pool->second;
+			if ( (ipRangeStart.ss_family == AF_INET6) && (ipRangeEnd.ss_family == AF_INET6) ) {
+				uint64_t s[2],e[2],xx[2];
+				ZT_FAST_MEMCPY(s,ipRangeStart.rawIpData(),16);
+				ZT_FAST_MEMCPY(e,ipRangeEnd.rawIpData(),16);
+				s[0] = Utils::ntoh(s[0]);
+				s[1] = Utils::ntoh(s[1]);
+				e[0] = Utils::ntoh(e[0]);
+				e[1] = Utils::ntoh(e[1]);
+
+				if ((e[1] > s[1])&&((e[1] - s[1]) >= 0xffffffffffULL)) {
+					// First see if we can just cram a ZeroTier ID into the lower 64 bits. If so do that.
+					xx[0] = Utils::hton(s[0]);
+					xx[1] = Utils::hton(s[1] + identity.address().toInt());
+				} else {
+					// Otherwise start from a random address in the pool
+					Utils::getSecureRandom((void *)xx,16);
+					if ((e[0] > s[0]))
+						xx[0] %= (e[0] - s[0]);
+					else xx[0] = 0;
+					if ((e[1] > s[1]))
+						xx[1] %= (e[1] - s[1]);
+					else xx[1] = 0;
+					xx[0] = Utils::hton(s[0] + xx[0]);
+					xx[1] = Utils::hton(s[1] + xx[1]);
+				}
 
-						// Check if this IP is within a local-to-Ethernet routed network
-						int routedNetmaskBits = 0;
-						for(unsigned int rk=0;rk<nc->routeCount;++rk) {
-							if ( (!nc->routes[rk].via.ss_family) && (nc->routes[rk].target.ss_family == AF_INET6) && (reinterpret_cast<const InetAddress *>(&(nc->routes[rk].target))->containsAddress(ip6)) )
-								routedNetmaskBits = reinterpret_cast<const InetAddress *>(&(nc->routes[rk].target))->netmaskBits();
-						}
+				// Only local-to-Ethernet routed networks are eligible
+				std::vector<InetAddress> localRoutes;
+				for(unsigned int rk=0;rk<nc->routeCount;++rk) {
+					if ( (!nc->routes[rk].via.ss_family) && (nc->routes[rk].target.ss_family == AF_INET6) )
+						localRoutes.push_back(*reinterpret_cast<const InetAddress *>(&(nc->routes[rk].target)));
+				}
 
-						// If it's routed, then try to claim and assign it and if successful end loop
-						if ( (routedNetmaskBits > 0) && (!std::binary_search(ns.allocatedIps.begin(),ns.allocatedIps.end(),ip6)) ) {
-							char tmpip[64];
-							const std::string ipStr(ip6.toIpString(tmpip));
-							if (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) {
-								ipAssignments.push_back(ipStr);
-								member["ipAssignments"] = ipAssignments;
-								ip6.setPort((unsigned int)routedNetmaskBits);
-								if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)
-									nc->staticIps[nc->staticIpCount++] = ip6;
-								haveManagedIpv6AutoAssignment = true;
-								break;
-							}
-						}
+				InetAddress ip6;
+				if (_db->findFreeIp(nwid,ipRangeStart,ipRangeEnd,localRoutes,InetAddress((const void *)xx,16,0),ip6)) {
+					char tmpip[64];
+					const std::string ipStr(ip6.toIpString(tmpip));
+					if (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) {
+						ipAssignments.push_back(ipStr);
+						member["ipAssignments"] = ipAssignments;
+						if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)
+							nc->staticIps[nc->staticIpCount++] = ip6;
+						haveManagedIpv6AutoAssignment = true;
 					}
 				}
 			}
 		}
 	}
 
-	if ( (ipAssignmentPools.is_array()) && ((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false))) && (!haveManagedIpv4AutoAssignment) && (!noAutoAssignIps) ) {
-		for(unsigned long p=0;((p<ipAssignmentPools.size())&&(!haveManagedIpv4AutoAssignment));++p) {
-			json &pool = ipAssignmentPools[p];
-			if (pool.is_object()) {
-				InetAddress ipRangeStartIA(OSUtils::jsonString(pool["ipRangeStart"],"").c_str());
-				InetAddress ipRangeEndIA(OSUtils::jsonString(pool["ipRangeEnd"],"").c_str());
-				if ( (ipRangeStartIA.ss_family == AF_INET) && (ipRangeEndIA.ss_family == AF_INET) ) {
-					uint32_t ipRangeStart = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeStartIA)->sin_addr.s_addr));
-					uint32_t ipRangeEnd = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeEndIA)->sin_addr.s_addr));
-					if ((ipRangeEnd < ipRangeStart)||(ipRangeStart == 0))
-						continue;
-					uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
-
-					// Start with the LSB of the member's address
-					uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
-
-					for(uint32_t k=ipRangeStart,trialCount=0;((k<=ipRangeEnd)&&(trialCount < 1000));++k,++trialCount) {
-						uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
-						++ipTrialCounter;
-						if ((ip & 0x000000ff) == 0x000000ff)
-							continue; // don't allow addresses that end in .255
-
-						// Check if this IP is within a local-to-Ethernet routed network
-						int routedNetmaskBits = -1;
-						for(unsigned int rk=0;rk<nc->routeCount;++rk) {
-							if (nc->routes[rk].target.ss_family == AF_INET) {
-								uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_addr.s_addr));
-								int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_port));
-								if ((ip & (0xffffffff << (32 - targetBits))) == targetIp) {
-									routedNetmaskBits = targetBits;
-									break;
-								}
-							}
-						}
+	if ( (policy->v4Auto) && (!haveManagedIpv4AutoAssignment) && (!noAutoAssignIps) ) {
+		for(auto pool=policy->pools.begin();((pool!=policy->pools.end())&&(!haveManagedIpv4AutoAssignment));++pool) {
+			InetAddress ipRangeStartIA(pool->first);
+			InetAddress ipRangeEndIA(pool->second);
+			if ( (ipRangeStartIA.ss_family == AF_INET) && (ipRangeEndIA.ss_family == AF_INET) ) {
+				uint32_t ipRangeStart = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeStartIA)->sin_addr.s_addr));
+				uint32_t ipRangeEnd = Utils::ntoh((uint32_t)(reinterpret_cast<struct sockaddr_in *>(&ipRangeEndIA)->sin_addr.s_addr));
+				if ((ipRangeEnd < ipRangeStart)||(ipRangeStart == 0))
+					continue;
+				uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
+
+				// Start with the LSB of the member's address
+				const uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
+				const uint32_t preferred = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
+
+				std::vector<InetAddress> routes;
+				for(unsigned int rk=0;rk<nc->routeCount;++rk) {
+					if (nc->routes[rk].target.ss_family == AF_INET)
+						routes.push_back(*reinterpret_cast<const InetAddress *>(&(nc->routes[rk].target)));
+				}
 
-						// If it's routed, then try to claim and assign it and if successful end loop
-						const InetAddress ip4(Utils::hton(ip),0);
-						if ( (routedNetmaskBits > 0) && (!std::binary_search(ns.allocatedIps.begin(),ns.allocatedIps.end(),ip4)) ) {
-							char tmpip[64];
-							const std::string ipStr(ip4.toIpString(tmpip));
-							if (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) {
-								ipAssignments.push_back(ipStr);
-								member["ipAssignments"] = ipAssignments;
-								if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
-									struct sockaddr_in *const v4ip = reinterpret_cast<struct sockaddr_in *>(&(nc->staticIps[nc->staticIpCount++]));
-									v4ip->sin_family = AF_INET;
-									v4ip->sin_port = Utils::hton((uint16_t)routedNetmaskBits);
-									v4ip->sin_addr.s_addr = Utils::hton(ip);
-								}
-								haveManagedIpv4AutoAssignment = true;
-								break;
-							}
-						}
+				InetAddress ip4;
+				if (_db->findFreeIp(nwid,ipRangeStartIA,ipRangeEndIA,routes,InetAddress(Utils::hton(preferred),0),ip4)) {
+					char tmpip[64];
+					const std::string ipStr(ip4.toIpString(tmpip));
+					if (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) {
+						ipAssignments.push_back(ipStr);
+						member["ipAssignments"] = ipAssignments;
+						if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)
+							nc->staticIps[nc->staticIpCount++] = ip4;
+						haveManagedIpv4AutoAssignment = true;
 					}
 				}
 			}
@@ -1664,48 +2025,523 @@ void EmbeddedNetworkController::_request(
 		nc->certificatesOfOwnership[0] = CertificateOfOwnership(nwid,now,identity.address(),1);
 		for(unsigned int i=0;i<nc->staticIpCount;++i)
 			nc->certificatesOfOwnership[0].addThing(nc->staticIps[i]);
-		nc->certificatesOfOwnership[0].sign(_signingId);
 		nc->certificateOfOwnershipCount = 1;
 	}
 
-	CertificateOfMembership com(now,credentialtmd,nwid,identity.address());
-	if (com.sign(_signingId)) {
-		nc->com = com;
-	} else {
-		_sender->ncSendError(nwid,requestPacketId,identity.address(),NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
-		return;
-	}
+	nc->com = CertificateOfMembership(now,credentialtmd,nwid,identity.address());
 
 	DB::cleanMember(member);
-	_db->save(&origMember,member);
-	_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*(nc.get()),metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	_db->save(&origMember,member); // this bumps the member's revision if anything changed
+
+	// Credentials are signed and the config is sent and cached by the signing threads
+	_SignJob *const job = new _SignJob();
+	job->nwid = nwid;
+	job->requestPacketId = requestPacketId;
+	job->to = identity.address();
+	job->legacy = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+	job->haveHashes = NetworkConfig::blobHashes(metaData,job->have);
+	nc->compact(); // don't hold space for the maximum of everything while waiting to be signed
+	job->nc = std::move(nc);
+	job->cacheKey = cacheKey;
+	job->cached.networkRevision = networkRevision;
+	job->cached.memberRevision = OSUtils::jsonInt(member["revision"],0ULL);
+	job->cached.credentialTimeMaxDelta = credentialtmd;
+	job->cached.rulesEngine = rulesEngine;
+	job->cached.activeBridges = ns.activeBridges;
+	job->cached.timestamp = now;
+	_timed(STAGE_BUILD,stageStart);
+	_queueSign(job);
+}
+
+void EmbeddedNetworkController::_forgetConfigs(const uint64_t networkId)
+{
+	std::lock_guard<std::mutex> l(_configCache_l);
+	for(auto i=_configCache.begin();i!=_configCache.end();) {
+		if (i->first.networkId == networkId)
+			i = _configCache.erase(i);
+		else ++i;
+	}
 }
 
 void EmbeddedNetworkController::_startThreads()
 {
 	std::lock_guard<std::mutex> l(_threads_l);
-	if (!_threads.empty())
+	if ((_threadsStopped)||(!_threads.empty()))
 		return;
-	const long hwc = std::max((long)std::thread::hardware_concurrency(),(long)1);
+	const std::vector<unsigned int> cpus(_workerCpus);
+	const long hwc = (cpus.empty()) ? std::max((long)std::thread::hardware_concurrency(),(long)1) : (long)cpus.size();
 	for(long t=0;t<hwc;++t) {
-		_threads.emplace_back([this]() {
+		_threads.emplace_back([this,t,cpus]() {
+			if (!cpus.empty())
+				Utils::pinThread(cpus[(unsigned long)t % cpus.size()]);
+			const unsigned int home = (unsigned int)(t % ZT_CONTROLLER_REQUEST_SHARDS);
 			for(;;) {
-				_RQEntry *qe = (_RQEntry *)0;
-				if (!_queue.get(qe))
-					break;
+				_RQEntry *const qe = _nextRequest(home);
+				if (!qe) {
+					std::unique_lock<std::mutex> l(_rqWait_l);
+					while ((_rqRun)&&(_rqPending <= 0))
+						_rqWait.wait(l);
+					if (!_rqRun)
+						break;
+					continue;
+				}
+				ZT_PROBE3(controller__request__start,qe->nwid,qe->identity.address().toInt(),qe->requestPacketId);
 				try {
-					if (qe) {
-						_request(qe->nwid,qe->fromAddr,qe->requestPacketId,qe->identity,qe->metaData);
-						delete qe;
-					}
+					_request(qe->nwid,qe->fromAddr,qe->requestPacketId,qe->identity,qe->metaData);
 				} catch (std::exception &e) {
+					_outcomes[OUTCOME_ERROR].fetch_add(1,std::memory_order_relaxed);
 					fprintf(stderr,"ERROR: exception in controller request handling thread: %s" ZT_EOL_S,e.what());
 				} catch ( ... ) {
+					_outcomes[OUTCOME_ERROR].fetch_add(1,std::memory_order_relaxed);
 					fprintf(stderr,"ERROR: exception in controller request handling thread: unknown exception" ZT_EOL_S);
 				}
+				ZT_PROBE3(controller__request__done,qe->nwid,qe->identity.address().toInt(),qe->requestPacketId);
+				if (qe->dedupKey)
+					_rqInFlight[qe->dedupKey % ZT_CONTROLLER_REQUEST_DEDUP_SLOTS] = 0;
+				delete qe;
 			}
 		});
 	}
+	_threads.emplace_back([this]() { _pushMain(); });
+	for(long t=0,tc=std::max(hwc / 2,(long)1);t<tc;++t) {
+		_threads.emplace_back([this,t,cpus]() {
+			if (!cpus.empty())
+				Utils::pinThread(cpus[(unsigned long)t % cpus.size()]);
+			_signMain();
+		});
+	}
+}
+
+EmbeddedNetworkController::_MemberStatus &EmbeddedNetworkController::_memberStatusFor(const uint64_t networkId,const uint64_t nodeId,const int64_t now)
+{
+	// Caller must hold _memberStatus_l
+
+	// Forget members that have gone quiet, pushing back entries that were refreshed since they were queued
+	std::vector<_MemberStatusExpiry> due;
+	_memberStatusExpiry.expire(now,due);
+	for(std::vector<_MemberStatusExpiry>::const_iterator e(due.begin());e!=due.end();++e) {
+		auto ms = _memberStatus.find(e->key);
+		if ((ms == _memberStatus.end())||(ms->second.expiresAt != e->deadline))
+			continue;
+		const int64_t deadline = ms->second.lastRequestTime + ZT_CONTROLLER_MEMBER_STATUS_TTL;
+		if (deadline > now) {
+			ms->second.expiresAt = deadline;
+			_memberStatusExpiry.add(deadline,_MemberStatusExpiry(e->key,deadline));
+		} else {
+			_eraseMemberStatus(e->key.networkId,e->key.nodeId);
+		}
+	}
+
+	const _MemberStatusKey k(networkId,nodeId);
+	std::pair< std::unordered_map< _MemberStatusKey,_MemberStatus,_MemberStatusHash >::iterator,bool > ms(_memberStatus.emplace(k,_MemberStatus()));
+	if (ms.second) {
+		_memberStatusByNetwork[networkId].insert(nodeId);
+		ms.first->second.expiresAt = now + ZT_CONTROLLER_MEMBER_STATUS_TTL;
+		_memberStatusExpiry.add(ms.first->second.expiresAt,_MemberStatusExpiry(k,ms.first->second.expiresAt));
+	}
+	return ms.first->second;
+}
+
+void EmbeddedNetworkController::_eraseMemberStatus(const uint64_t networkId,const uint64_t nodeId)
+{
+	// Caller must hold _memberStatus_l, and any slot left in _memberStatusExpiry is skipped when it comes due
+	_memberStatus.erase(_MemberStatusKey(networkId,nodeId));
+	auto bn = _memberStatusByNetwork.find(networkId);
+	if (bn != _memberStatusByNetwork.end()) {
+		bn->second.erase(nodeId);
+		if (bn->second.empty())
+			_memberStatusByNetwork.erase(bn);
+	}
+}
+
+void EmbeddedNetworkController::_timed(const _Stage stage,const uint64_t start)
+{
+	const uint64_t us = _usNow() - start;
+	unsigned int b = 0;
+	while ((b < (ZT_CONTROLLER_METRICS_LATENCY_BUCKETS - 1))&&(us >= (1ULL << b)))
+		++b;
+	_stages[stage].buckets[b].fetch_add(1,std::memory_order_relaxed);
+	_stages[stage].microseconds.fetch_add(us,std::memory_order_relaxed);
+}
+
+void EmbeddedNetworkController::_metricsText(std::string &out)
+{
+	static const char *const outcomeNames[OUTCOME_COUNT] = { "ok","not_authorized","not_found","error","duplicate","too_soon" };
+	static const char *const stageNames[STAGE_COUNT] = { "db","build","queue","sign","send" };
+	char labels[128],tmp[256];
+
+	for(unsigned int i=0;i<OUTCOME_COUNT;++i) {
+		OSUtils::ztsnprintf(labels,sizeof(labels),"outcome=\"%s\"",outcomeNames[i]);
+		_metric(out,"zerotier_controller_requests_total","counter",(i) ? (const char *)0 : "Config requests and pushes by outcome",labels,_outcomes[i].load(std::memory_order_relaxed));
+	}
+	_metric(out,"zerotier_controller_pushes_total","counter","Configs built to push to members after a change",(const char *)0,_pushes.load(std::memory_order_relaxed));
+
+	out.append("# HELP zerotier_controller_stage_seconds Time requests spent in each stage\n# TYPE zerotier_controller_stage_seconds histogram\n");
+	for(unsigned int i=0;i<STAGE_COUNT;++i) {
+		uint64_t count = 0;
+		for(unsigned int b=0;b<ZT_CONTROLLER_METRICS_LATENCY_BUCKETS;++b) {
+			count += _stages[i].buckets[b].load(std::memory_order_relaxed);
+			if (b == (ZT_CONTROLLER_METRICS_LATENCY_BUCKETS - 1))
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_controller_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",stageNames[i],(unsigned long long)count);
+			else OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_controller_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",stageNames[i],(double)(1ULL << b) / 1000000.0,(unsigned long long)count);
+			out.append(tmp);
+		}
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_controller_stage_seconds_sum{stage=\"%s\"} %.6f\nzerotier_controller_stage_seconds_count{stage=\"%s\"} %llu\n",stageNames[i],(double)_stages[i].microseconds.load(std::memory_order_relaxed) / 1000000.0,stageNames[i],(unsigned long long)count);
+		out.append(tmp);
+	}
+
+	_metric(out,"zerotier_controller_config_cache_total","counter","Signed config cache lookups by result","result=\"hit\"",_configCacheHits.load(std::memory_order_relaxed));
+	_metric(out,"zerotier_controller_config_cache_total","counter",(const char *)0,"result=\"miss\"",_configCacheMisses.load(std::memory_order_relaxed));
+	_metric(out,"zerotier_controller_policy_cache_total","counter","Compiled network policy lookups by result","result=\"hit\"",_policyCacheHits.load(std::memory_order_relaxed));
+	_metric(out,"zerotier_controller_policy_cache_total","counter",(const char *)0,"result=\"miss\"",_policyCacheMisses.load(std::memory_order_relaxed));
+
+	unsigned long pushQueue,signQueue,memberStatus,configCache;
+	{
+		std::lock_guard<std::mutex> l(_push_l);
+		pushQueue = (unsigned long)_pushQueue.size();
+	}
+	{
+		std::lock_guard<std::mutex> l(_sign_l);
+		signQueue = (unsigned long)_signQueue.size();
+	}
+	{
+		std::lock_guard<std::mutex> l(_memberStatus_l);
+		memberStatus = (unsigned long)_memberStatus.size();
+	}
+	{
+		std::lock_guard<std::mutex> l(_configCache_l);
+		configCache = (unsigned long)_configCache.size();
+	}
+	const long rqPending = _rqPending;
+	_metric(out,"zerotier_controller_queue_depth","gauge","Work waiting by queue (push counts networks)","queue=\"request\"",(uint64_t)std::max(rqPending,0L));
+	_metric(out,"zerotier_controller_queue_depth","gauge",(const char *)0,"queue=\"push\"",pushQueue);
+	_metric(out,"zerotier_controller_queue_depth","gauge",(const char *)0,"queue=\"sign\"",signQueue);
+	_metric(out,"zerotier_controller_member_status_entries","gauge","Members with recent requests tracked for pushes",(const char *)0,memberStatus);
+	_metric(out,"zerotier_controller_config_cache_entries","gauge","Signed configs cached",(const char *)0,configCache);
+
+	DB::CommitStats cs;
+	_db->commitStats(cs);
+	_metric(out,"zerotier_controller_db_commits_total","counter","Database writes",(const char *)0,cs.commits);
+	_metric(out,"zerotier_controller_db_committed_records_total","counter","Records written by database writes",(const char *)0,cs.records);
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"# HELP zerotier_controller_db_commit_seconds_total Time spent in database writes\n# TYPE zerotier_controller_db_commit_seconds_total counter\nzerotier_controller_db_commit_seconds_total %.6f\n",(double)cs.microseconds / 1000000.0);
+	out.append(tmp);
+	_metric(out,"zerotier_controller_db_commit_backlog","gauge","Records saved but not yet written",(const char *)0,cs.backlog);
+	_metric(out,"zerotier_controller_db_changes_total","counter","Network and member changes applied since startup",(const char *)0,_db->changes());
+}
+
+std::shared_ptr<const EmbeddedNetworkController::_NetworkPolicy> EmbeddedNetworkController::_networkPolicy(const uint64_t nwid,const std::shared_ptr<const json> &network)
+{
+	{
+		std::lock_guard<std::mutex> l(_networkPolicies_l);
+		auto p = _networkPolicies.find(nwid);
+		if ((p != _networkPolicies.end())&&(p->second->network == network)) {
+			_policyCacheHits.fetch_add(1,std::memory_order_relaxed);
+			return p->second;
+		}
+	}
+	_policyCacheMisses.fetch_add(1,std::memory_order_relaxed);
+
+	// Snapshots are replaced whenever the network changes, so this is once per network revision
+	std::shared_ptr<_NetworkPolicy> p(new _NetworkPolicy());
+	const json &n = *network;
+	p->network = network;
+	p->isPrivate = OSUtils::jsonBool(_jsonField(n,"private"),true);
+	p->flags = 0;
+	if (OSUtils::jsonBool(_jsonField(n,"enableBroadcast"),true)) p->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
+	if (OSUtils::jsonBool(_jsonField(n,"arpEmulation"),false)) p->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_ARP_EMULATION;
+	if (OSUtils::jsonBool(_jsonField(n,"ndpProxy"),false)) p->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_NDP_PROXY;
+	p->name = OSUtils::jsonString(_jsonField(n,"name"),"");
+	p->mtu = std::max(std::min((unsigned int)OSUtils::jsonInt(_jsonField(n,"mtu"),ZT_DEFAULT_MTU),(unsigned int)ZT_MAX_MTU),(unsigned int)ZT_MIN_MTU);
+	p->multicastLimit = (unsigned int)OSUtils::jsonInt(_jsonField(n,"multicastLimit"),32ULL);
+	p->rateLimit = OSUtils::jsonInt(_jsonField(n,"rateLimit"),0ULL) * 125ULL; // kbit/s to bytes/s
+	const std::string rtt(OSUtils::jsonString(_jsonField(n,"remoteTraceTarget"),""));
+	if (rtt.length() == 10)
+		p->remoteTraceTarget = Address(Utils::hexStrToU64(rtt.c_str()));
+	p->remoteTraceLevel = (Trace::Level)OSUtils::jsonInt(_jsonField(n,"remoteTraceLevel"),0ULL);
+
+	ZT_VirtualNetworkRule rule;
+	const json &rules = _jsonField(n,"rules");
+	if (rules.is_array()) {
+		for(unsigned long i=0;((i<rules.size())&&(p->rules.size() < ZT_MAX_NETWORK_RULES));++i) {
+			if (_parseRule(rules[i],rule))
+				p->rules.push_back(rule);
+		}
+	}
+
+	const json &capabilities = _jsonField(n,"capabilities");
+	if (capabilities.is_array()) {
+		for(unsigned long i=0;i<capabilities.size();++i) {
+			const json &cap = capabilities[i];
+			if (cap.is_object()) {
+				const uint32_t id = (uint32_t)(OSUtils::jsonInt(_jsonField(cap,"id"),0ULL) & 0xffffffffULL);
+				_NetworkPolicy::Cap &c = p->caps[id];
+				c.valid = (cap.size() > 0);
+				c.rules.clear();
+				const json &caprj = _jsonField(cap,"rules");
+				if (caprj.is_array()) {
+					for(unsigned long j=0;((j<caprj.size())&&(c.rules.size() < ZT_MAX_CAPABILITY_RULES));++j) {
+						if (_parseRule(caprj[j],rule))
+							c.rules.push_back(rule);
+					}
+				}
+				if (OSUtils::jsonBool(_jsonField(cap,"default"),false))
+					p->defaultCaps.push_back(id);
+			}
+		}
+	}
+
+	const json &tags = _jsonField(n,"tags");
+	if (tags.is_array()) {
+		for(unsigned long i=0;i<tags.size();++i) {
+			const json &t = tags[i];
+			if (t.is_object()) {
+				const json &dfl = _jsonField(t,"default");
+				if (dfl.is_number()) {
+					p->defaultTags.push_back(_NetworkPolicy::DefaultTag());
+					_NetworkPolicy::DefaultTag &dt = p->defaultTags.back();
+					dt.id = (uint32_t)(OSUtils::jsonInt(_jsonField(t,"id"),0) & 0xffffffffULL);
+					dt.value = (uint32_t)(OSUtils::jsonInt(dfl,0) & 0xffffffffULL);
+					dt.dfl = dfl;
+				}
+			}
+		}
+	}
+
+	const json &routes = _jsonField(n,"routes");
+	if (routes.is_array()) {
+		for(unsigned long i=0;((i<routes.size())&&(p->routes.size() < ZT_MAX_NETWORK_ROUTES));++i) {
+			const json &target = _jsonField(routes[i],"target");
+			const json &via = _jsonField(routes[i],"via");
+			if (target.is_string()) {
+				const InetAddress t(target.get<std::string>().c_str());
+				InetAddress v;
+				if (via.is_string()) v.fromString(via.get<std::string>().c_str());
+				if ((t.ss_family == AF_INET)||(t.ss_family == AF_INET6)) {
+					ZT_VirtualNetworkRoute r;
+					memset(&r,0,sizeof(r));
+					*(reinterpret_cast<InetAddress *>(&(r.target))) = t;
+					if (v.ss_family == t.ss_family)
+						*(reinterpret_cast<InetAddress *>(&(r.via))) = v;
+					p->routes.push_back(r);
+				}
+			}
+		}
+	}
+
+	const json &v4AssignMode = _jsonField(n,"v4AssignMode");
+	const json &v6AssignMode = _jsonField(n,"v6AssignMode");
+	p->v4Auto = OSUtils::jsonBool(_jsonField(v4AssignMode,"zt"),false);
+	p->v6Auto = OSUtils::jsonBool(_jsonField(v6AssignMode,"zt"),false);
+	p->v6Rfc4193 = OSUtils::jsonBool(_jsonField(v6AssignMode,"rfc4193"),false);
+	p->v66plane = OSUtils::jsonBool(_jsonField(v6AssignMode,"6plane"),false);
+
+	const json &ipAssignmentPools = _jsonField(n,"ipAssignmentPools");
+	if (ipAssignmentPools.is_array()) {
+		for(unsigned long i=0;i<ipAssignmentPools.size();++i) {
+			const json &pool = ipAssignmentPools[i];
+			if (pool.is_object())
+				p->pools.push_back(std::pair<InetAddress,InetAddress>(InetAddress(OSUtils::jsonString(_jsonField(pool,"ipRangeStart"),"").c_str()),InetAddress(OSUtils::jsonString(_jsonField(pool,"ipRangeEnd"),"").c_str())));
+		}
+	}
+
+	std::lock_guard<std::mutex> l(_networkPolicies_l);
+	_networkPolicies[nwid] = p;
+	return p;
+}
+
+void EmbeddedNetworkController::_pushMain()
+{
+	std::vector< std::pair<Identity,Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> > > targets;
+	std::chrono::steady_clock::time_point next(std::chrono::steady_clock::now());
+	std::unique_lock<std::mutex> l(_push_l);
+	for(;;) {
+		while ((_pushRun)&&(_pushQueue.empty()))
+			_pushWait.wait(l);
+		if (!_pushRun)
+			break;
+		const uint64_t nwid = _pushQueue.front();
+		_pushQueue.pop_front();
+		_pushQueued.erase(nwid); // further changes from here on queue another push
+		l.unlock();
+
+		targets.clear();
+		{
+			const int64_t now = OSUtils::now();
+			std::lock_guard<std::mutex> l2(_memberStatus_l);
+			auto bn = _memberStatusByNetwork.find(nwid);
+			if (bn != _memberStatusByNetwork.end()) {
+				for(auto m=bn->second.begin();m!=bn->second.end();++m) {
+					auto ms = _memberStatus.find(_MemberStatusKey(nwid,*m));
+					if ((ms != _memberStatus.end())&&(ms->second.online(now))&&(!ms->second.lastRequestMetaData.empty()))
+						targets.push_back(std::pair< Identity,Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> >(ms->second.identity,Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY>(ms->second.lastRequestMetaData.c_str())));
+				}
+			}
+		}
+
+		l.lock();
+		for(auto t=targets.begin();((t!=targets.end())&&(_pushRun));++t) {
+			// Paced so a big network doesn't flood the uplink or crowd out members' own requests
+			const std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+			if (next < now)
+				next = now;
+			else _pushWait.wait_until(l,next,[this]() { return (!_pushRun); });
+			next += std::chrono::microseconds(1000000 / _pushRate);
+			l.unlock();
+			request(nwid,InetAddress(),0,t->first,t->second);
+			l.lock();
+		}
+	}
+}
+
+void EmbeddedNetworkController::_queueSign(_SignJob *job)
+{
+	job->queued = OSUtils::now();
+	job->queuedAt = _usNow();
+	_startThreads();
+	{
+		std::lock_guard<std::mutex> l(_sign_l);
+		_signQueue.push_back(job);
+	}
+	_signWait.notify_one();
+}
+
+void EmbeddedNetworkController::_signMain()
+{
+	std::vector<_SignJob *> batch;
+	std::unique_lock<std::mutex> l(_sign_l);
+	for(;;) {
+		while ((_signRun)&&(_signQueue.empty()))
+			_signWait.wait(l);
+		if (!_signRun)
+			break;
+
+		// Take everything queued up to a limit so one lock and one stats update cover many requests
+		batch.clear();
+		while ((!_signQueue.empty())&&(batch.size() < ZT_CONTROLLER_SIGN_BATCH_MAX)) {
+			batch.push_back(_signQueue.front());
+			_signQueue.pop_front();
+		}
+		l.unlock();
+
+		const int64_t start = OSUtils::now();
+		int64_t latency = 0;
+		uint64_t signatures = 0;
+		for(auto j=batch.begin();j!=batch.end();++j) {
+			latency += start - (*j)->queued;
+			_timed(STAGE_QUEUE,(*j)->queuedAt);
+			try {
+				signatures += _sign(**j);
+			} catch ( ... ) {
+				fprintf(stderr,"ERROR: exception in controller signing thread: unknown exception" ZT_EOL_S);
+			}
+			delete *j;
+		}
+
+		const int64_t now = OSUtils::now();
+		l.lock();
+		if ((now - _signPeriodStart) >= ZT_CONTROLLER_SIGN_STATS_PERIOD) {
+			if ((_signPeriodStart)&&((now - _signPeriodStart) < (ZT_CONTROLLER_SIGN_STATS_PERIOD * 2))) {
+				_signRate = ((double)_signPeriodSignatures * 1000.0) / (double)(now - _signPeriodStart);
+				_signLatency = (_signPeriodJobs) ? ((double)_signPeriodLatency / (double)_signPeriodJobs) : 0.0;
+			} else {
+				_signRate = 0.0;
+				_signLatency = 0.0;
+			}
+			_signPeriodStart = now;
+			_signPeriodSignatures = 0;
+			_signPeriodJobs = 0;
+			_signPeriodLatency = 0;
+		}
+		_signPeriodSignatures += signatures;
+		_signPeriodJobs += (uint64_t)batch.size();
+		_signPeriodLatency += latency;
+	}
+}
+
+unsigned int EmbeddedNetworkController::_sign(_SignJob &job)
+{
+	unsigned int signatures = 0;
+	uint64_t stageStart = _usNow();
+
+	if (!job.nc) {
+		if (job.revocation.sign(_signingId)) {
+			++signatures;
+			for(auto a=job.revocationTo.begin();a!=job.revocationTo.end();++a)
+				_node->ncSendRevocation(*a,job.revocation);
+		}
+		return signatures;
+	}
+
+	NetworkConfig &nc = *job.nc;
+	if (!nc.com.sign(_signingId)) {
+		_outcomes[OUTCOME_ERROR].fetch_add(1,std::memory_order_relaxed);
+		_sender->ncSendError(job.nwid,job.requestPacketId,job.to,NetworkController::NC_ERROR_INTERNAL_SERVER_ERROR);
+		return signatures;
+	}
+	++signatures;
+
+	// Anything that fails to sign is left out, as it was when this was done while building the config
+	unsigned int n = 0;
+	for(unsigned int i=0;i<nc.capabilityCount;++i) {
+		if (nc.capabilities[i].sign(_signingId,job.to)) {
+			++signatures;
+			if (n != i)
+				nc.capabilities[n] = nc.capabilities[i];
+			++n;
+		}
+	}
+	nc.capabilityCount = n;
+	n = 0;
+	for(unsigned int i=0;i<nc.tagCount;++i) {
+		if (nc.tags[i].sign(_signingId)) {
+			++signatures;
+			if (n != i)
+				nc.tags[n] = nc.tags[i];
+			++n;
+		}
+	}
+	nc.tagCount = n;
+	for(unsigned int i=0;i<nc.certificateOfOwnershipCount;++i) {
+		if (nc.certificatesOfOwnership[i].sign(_signingId))
+			++signatures;
+	}
+
+	_timed(STAGE_SIGN,stageStart);
+	stageStart = _usNow();
+	_sender->ncSendConfig(job.nwid,job.requestPacketId,job.to,nc,job.legacy,(job.haveHashes) ? job.have : (const uint64_t *)0);
+	_timed(STAGE_SEND,stageStart);
+	_outcomes[OUTCOME_OK].fetch_add(1,std::memory_order_relaxed);
+
+	std::unique_ptr< Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> > d(new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>());
+	if (nc.toDictionary(*d,false)) {
+		job.cached.dictionary.assign(d->data(),d->sizeBytes());
+		std::lock_guard<std::mutex> l(_configCache_l);
+		_configCache[job.cacheKey] = job.cached;
+	}
+
+	return signatures;
+}
+
+EmbeddedNetworkController::_RQEntry *EmbeddedNetworkController::_nextRequest(const unsigned int home)
+{
+	// Start with our own shard and help out with the others when it's empty
+	for(unsigned int i=0;i<ZT_CONTROLLER_REQUEST_SHARDS;++i) {
+		_RQShard &shard = _rqShards[(home + i) % ZT_CONTROLLER_REQUEST_SHARDS];
+		std::lock_guard<std::mutex> l(shard.lock);
+		if (shard.networks.empty())
+			continue;
+		const uint64_t nwid = shard.networks.front();
+		shard.networks.pop_front();
+		auto q = shard.pending.find(nwid);
+		_RQEntry *const qe = q->second.front();
+		q->second.pop_front();
+		if (q->second.empty())
+			shard.pending.erase(q);
+		else shard.networks.push_back(nwid); // back of the line behind every other waiting network
+		--_rqPending;
+		return qe;
+	}
+	return (_RQEntry *)0;
 }
 
 } // namespace ZeroTier
@@ -23,18 +23,25 @@
 
 #include <string>
 #include <map>
+#include <memory>
 #include <vector>
 #include <set>
+#include <unordered_set>
 #include <list>
 #include <thread>
 #include <unordered_map>
 #include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 
 #include "../node/Constants.hpp"
 #include "../node/NetworkController.hpp"
 #include "../node/Utils.hpp"
 #include "../node/Address.hpp"
 #include "../node/InetAddress.hpp"
+#include "../node/Trace.hpp"
+#include "../node/TimerWheel.hpp"
 
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/Thread.hpp"
@@ -44,10 +51,36 @@
 
 #include "DB.hpp"
 #include "FileDB.hpp"
+#include "MappedDB.hpp"
+#include "MemoryDB.hpp"
 #ifdef ZT_CONTROLLER_USE_RETHINKDB
 #include "RethinkDB.hpp"
 #endif
 
+// Requests are queued in this many shards by network ID, each served round-robin across its networks
+#define ZT_CONTROLLER_REQUEST_SHARDS 16
+
+// Slots used to spot repeat requests from a member whose last request is still queued or being handled
+#define ZT_CONTROLLER_REQUEST_DEDUP_SLOTS 4096
+
+// Default maximum config pushes per second after network changes
+#define ZT_CONTROLLER_DEFAULT_PUSH_RATE 1000
+
+// Maximum signing jobs (configs or revocations) a signing thread takes from the queue at once
+#define ZT_CONTROLLER_SIGN_BATCH_MAX 32
+
+// Period over which signing rate and queue latency are averaged for controller status
+#define ZT_CONTROLLER_SIGN_STATS_PERIOD 1000
+
+// Members that haven't requested a config in this long are forgotten (they stop counting as online long before)
+#define ZT_CONTROLLER_MEMBER_STATUS_TTL (ZT_NETWORK_AUTOCONF_DELAY * 4)
+
+// Granularity of member status expiration
+#define ZT_CONTROLLER_MEMBER_STATUS_TICK 1000
+
+// Latency histogram buckets in controller metrics, doubling from 1 microsecond (the last is everything longer)
+#define ZT_CONTROLLER_METRICS_LATENCY_BUCKETS 21
+
 namespace ZeroTier {
 
 class Node;
@@ -95,14 +128,77 @@ public:
 
 	void handleRemoteTrace(const ZT_RemoteTrace &rt);
 
+	/**
+	 * Set how fast configs are pushed to members after a network changes
+	 *
+	 * @param perSecond Maximum pushes per second (0 for default)
+	 */
+	void setPushRate(const unsigned int perSecond);
+
+	/**
+	 * Pin request and signing workers to CPUs
+	 *
+	 * This must be called before the first request, since workers start
+	 * then. There is one request worker per CPU instead of one per core,
+	 * each pinned in turn, so the requests they build use memory on their
+	 * own NUMA node.
+	 *
+	 * @param cpus CPU numbers, or empty for one unpinned worker per core (default)
+	 */
+	void setWorkerCpus(const std::vector<unsigned int> &cpus);
+
+	/**
+	 * Name this controller as one instance of several sharing its identity and database
+	 *
+	 * Instances sharing a RethinkDB database all follow its change feeds, so
+	 * each has every network and member cached and can answer any member.
+	 * With an instance ID each also records which instance last answered a
+	 * member, and instances forget members another one has answered since,
+	 * so after a change only the instance a member is talking to pushes to
+	 * it. This must be called before init().
+	 *
+	 * @param id Instance ID unique among instances, or empty if this is the only one (default)
+	 */
+	void setInstanceId(const std::string &id);
+
+	/**
+	 * @return Instance ID or empty string if none
+	 */
+	inline const std::string &instanceId() const { return _instanceId; }
+
+	/**
+	 * Get approximate memory held by the controller's database
+	 *
+	 * @param networks Result parameter, set to number of networks
+	 * @param members Result parameter, set to number of members in all networks
+	 * @param bytes Result parameter, set to approximate bytes used by networks and members
+	 * @return False if the database isn't open yet
+	 */
+	bool memoryUsage(uint64_t &networks,uint64_t &members,uint64_t &bytes) const;
+
 	// Called on update via POST or by JSONDB on external update of network or network member records
 	void onNetworkUpdate(const uint64_t networkId);
 	void onNetworkMemberUpdate(const uint64_t networkId,const uint64_t memberId);
 	void onNetworkMemberDeauthorize(const uint64_t networkId,const uint64_t memberId);
 
+	// Called by the database when another instance has answered a member at servedAt (ms since epoch)
+	void onMemberServedElsewhere(const uint64_t networkId,const uint64_t memberId,const int64_t servedAt);
+
+	/**
+	 * Convert a rule from the JSON form used in network objects and output by the rule compiler
+	 *
+	 * @param r Rule object
+	 * @param rule Rule to fill
+	 * @return True if rule was recognized
+	 */
+	static bool parseRule(nlohmann::json &r,ZT_VirtualNetworkRule &rule);
+
 private:
 	void _request(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData);
 	void _startThreads();
+	void _forgetConfigs(const uint64_t networkId);
+	void _listMembers(const uint64_t nwid,std::shared_ptr<const nlohmann::json> &network,const std::map<std::string,std::string> &urlArgs,std::string &responseBody);
+	unsigned int _postMembers(nlohmann::json &networks,const int64_t now,nlohmann::json &results,std::string &responseBody);
 
 	struct _RQEntry
 	{
@@ -111,10 +207,18 @@ private:
 		InetAddress fromAddr;
 		Identity identity;
 		Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData;
+		uint64_t dedupKey; // nonzero if this entry holds a slot in _rqInFlight
 		enum {
 			RQENTRY_TYPE_REQUEST = 0
 		} type;
 	};
+	struct _RQShard
+	{
+		std::mutex lock;
+		std::unordered_map< uint64_t,std::deque<_RQEntry *> > pending; // by network ID
+		std::deque<uint64_t> networks; // networks with pending requests, in the order they're next served
+	};
+	_RQEntry *_nextRequest(const unsigned int home);
 	struct _MemberStatusKey
 	{
 		_MemberStatusKey() : networkId(0),nodeId(0) {}
@@ -125,13 +229,20 @@ private:
 	};
 	struct _MemberStatus
 	{
-		_MemberStatus() : lastRequestTime(0),vMajor(-1),vMinor(-1),vRev(-1),vProto(-1) {}
-		uint64_t lastRequestTime;
-		int vMajor,vMinor,vRev,vProto;
-		Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> lastRequestMetaData;
+		_MemberStatus() : lastRequestTime(0),expiresAt(0) {}
+		int64_t lastRequestTime;
+		int64_t expiresAt; // deadline of this entry's live slot in _memberStatusExpiry
+		std::string lastRequestMetaData; // only the used part of the request's metadata dictionary
 		Identity identity;
 		inline bool online(const int64_t now) const { return ((now - lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2)); }
 	};
+	struct _MemberStatusExpiry
+	{
+		_MemberStatusExpiry() : key(),deadline(0) {}
+		_MemberStatusExpiry(const _MemberStatusKey &k,const int64_t d) : key(k),deadline(d) {}
+		_MemberStatusKey key;
+		int64_t deadline;
+	};
 	struct _MemberStatusHash
 	{
 		inline std::size_t operator()(const _MemberStatusKey &networkIdNodeId) const
@@ -139,6 +250,106 @@ private:
 			return (std::size_t)(networkIdNodeId.networkId + networkIdNodeId.nodeId);
 		}
 	};
+	// Signed config last sent to a member and everything it was built from that isn't
+	// covered by the network's and member's revisions
+	struct _CachedConfig
+	{
+		uint64_t networkRevision;
+		uint64_t memberRevision;
+		int64_t credentialTimeMaxDelta;
+		bool rulesEngine;
+		std::vector<Address> activeBridges;
+		int64_t timestamp;
+		std::string dictionary; // NetworkConfig::toDictionary() without legacy fields
+	};
+
+	// Everything in a member's config that comes only from the network, compiled from one network snapshot
+	struct _NetworkPolicy
+	{
+		struct Cap
+		{
+			Cap() : valid(false) {}
+			bool valid; // false for an empty capability object, which is never issued
+			std::vector<ZT_VirtualNetworkRule> rules;
+		};
+		struct DefaultTag
+		{
+			uint32_t id;
+			uint32_t value;
+			nlohmann::json dfl; // as it's added to member records
+		};
+
+		std::shared_ptr<const nlohmann::json> network; // snapshot this was compiled from, held so its address identifies it
+		bool isPrivate;
+		uint64_t flags;
+		std::string name;
+		unsigned int mtu;
+		unsigned int multicastLimit;
+		uint64_t rateLimit;
+		Address remoteTraceTarget;
+		Trace::Level remoteTraceLevel;
+		std::vector<ZT_VirtualNetworkRule> rules;
+		std::map<uint32_t,Cap> caps;
+		std::vector<uint32_t> defaultCaps; // in network order, possibly repeated
+		std::vector<DefaultTag> defaultTags; // in network order
+		std::vector<ZT_VirtualNetworkRoute> routes;
+		bool v4Auto,v6Auto,v6Rfc4193,v66plane;
+		std::vector< std::pair<InetAddress,InetAddress> > pools;
+	};
+
+	// Config or revocation waiting for its credentials to be signed and then sent
+	struct _SignJob
+	{
+		int64_t queued;
+		uint64_t nwid;
+		uint64_t requestPacketId;
+		Address to;
+		bool legacy;
+		bool haveHashes;
+		uint64_t have[ZT_NETWORKCONFIG_DELTA_BLOBS]; // member's blob hashes if haveHashes, so unchanged blobs can be left out
+		std::unique_ptr<NetworkConfig> nc; // null for a revocation
+		_MemberStatusKey cacheKey;
+		_CachedConfig cached; // all fields but dictionary, which is set once nc is signed
+		Revocation revocation;
+		std::vector<Address> revocationTo;
+		uint64_t queuedAt; // steady clock microseconds, for metrics
+	};
+
+	// How requests ended and the stages they pass through, counted for /controller/metrics
+	enum _Outcome
+	{
+		OUTCOME_OK = 0,
+		OUTCOME_NOT_AUTHORIZED,
+		OUTCOME_NOT_FOUND,
+		OUTCOME_ERROR,
+		OUTCOME_DUPLICATE, // retry dropped while the first is queued
+		OUTCOME_TOO_SOON, // ignored under ZT_NETCONF_MIN_REQUEST_PERIOD
+		OUTCOME_COUNT
+	};
+	enum _Stage
+	{
+		STAGE_DB = 0, // network and member lookup
+		STAGE_BUILD, // everything up to queueing for signing or sending a cached config
+		STAGE_QUEUE, // waiting for a signing thread
+		STAGE_SIGN,
+		STAGE_SEND,
+		STAGE_COUNT
+	};
+	struct _StageStats
+	{
+		std::atomic<uint64_t> buckets[ZT_CONTROLLER_METRICS_LATENCY_BUCKETS];
+		std::atomic<uint64_t> microseconds;
+	};
+	void _timed(const _Stage stage,const uint64_t start);
+	void _metricsText(std::string &out);
+
+	_MemberStatus &_memberStatusFor(const uint64_t networkId,const uint64_t nodeId,const int64_t now);
+	void _eraseMemberStatus(const uint64_t networkId,const uint64_t nodeId);
+	std::shared_ptr<const _NetworkPolicy> _networkPolicy(const uint64_t nwid,const std::shared_ptr<const nlohmann::json> &network);
+	void _pushMain();
+	void _queueSign(_SignJob *job);
+	void _signMain();
+	unsigned int _sign(_SignJob &job);
 
 	const int64_t _startTime;
 	Node *const _node;
@@ -147,11 +358,55 @@ private:
 	std::string _signingIdAddressString;
 	NetworkController::Sender *_sender;
 	std::unique_ptr<DB> _db;
-	BlockingQueue< _RQEntry * > _queue;
+	_RQShard _rqShards[ZT_CONTROLLER_REQUEST_SHARDS];
+	std::atomic<uint64_t> _rqInFlight[ZT_CONTROLLER_REQUEST_DEDUP_SLOTS];
+	std::atomic<long> _rqPending;
+	bool _rqRun;
+	std::mutex _rqWait_l;
+	std::condition_variable _rqWait;
 	std::vector<std::thread> _threads;
+	std::vector<unsigned int> _workerCpus;
+	std::string _instanceId;
+	bool _threadsStopped; // set on destruction so work that arrives meanwhile doesn't start threads again
 	std::mutex _threads_l;
 	std::unordered_map< _MemberStatusKey,_MemberStatus,_MemberStatusHash > _memberStatus;
+	std::unordered_map< uint64_t,std::unordered_set<uint64_t> > _memberStatusByNetwork; // node IDs in _memberStatus by network
+	TimerWheel<_MemberStatusExpiry> _memberStatusExpiry;
 	std::mutex _memberStatus_l;
+
+	// Networks with config pushes waiting, each queued at most once
+	std::deque<uint64_t> _pushQueue;
+	std::set<uint64_t> _pushQueued;
+	std::map<uint64_t,unsigned int> _pushHeld; // networks being changed by bulk POSTs, whose members aren't pushed one by one
+	unsigned int _pushRate;
+	bool _pushRun;
+	std::mutex _push_l;
+	std::condition_variable _pushWait;
+	std::unordered_map< _MemberStatusKey,_CachedConfig,_MemberStatusHash > _configCache;
+	std::mutex _configCache_l;
+
+	// Compiled network policy by network ID, replaced when a request sees a newer network snapshot
+	std::unordered_map< uint64_t,std::shared_ptr<const _NetworkPolicy> > _networkPolicies;
+	std::mutex _networkPolicies_l;
+
+	// Signing stage, so request workers never wait on signatures
+	std::deque<_SignJob *> _signQueue;
+	bool _signRun;
+	std::mutex _sign_l;
+	std::condition_variable _signWait;
+	int64_t _signPeriodStart;
+	uint64_t _signPeriodSignatures;
+	uint64_t _signPeriodJobs;
+	int64_t _signPeriodLatency;
+	double _signRate; // signatures per second over the last full period
+	double _signLatency; // average ms from queueing to signing over the last full period
+
+	// Running totals since startup for /controller/metrics
+	std::atomic<uint64_t> _outcomes[OUTCOME_COUNT];
+	_StageStats _stages[STAGE_COUNT];
+	std::atomic<uint64_t> _configCacheHits,_configCacheMisses;
+	std::atomic<uint64_t> _policyCacheHits,_policyCacheMisses;
+	std::atomic<uint64_t> _pushes;
 };
 
 } // namespace ZeroTier
@@ -1,69 +1,138 @@
-/*
- * ZeroTier One - Network Virtualization Everywhere
- * Copyright (C) 2011-2018  ZeroTier, Inc.
- *
- * This program is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <http://www.gnu.org/licenses/>.
- */
-
 #include "FileDB.hpp"
 
+#include "../node/SHA512.hpp"
+
+#include <algorithm>
+
+#ifdef __WINDOWS__
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Each journal or snapshot record is a 32-bit big-endian payload length, the first 64 bits of
+// the payload's SHA-512, then the payload: an op ('P' put, 'D' delete network) followed by JSON.
+#define ZT_FILEDB_JOURNAL_RECORD_HEADER_SIZE 12
+#define ZT_FILEDB_JOURNAL_MAX_RECORD_SIZE 67108864
+
+// Maximum threads used to read and parse files at startup
+#define ZT_CONTROLLER_FILEDB_LOAD_THREADS_MAX 16
+
 namespace ZeroTier
 {
 
-FileDB::FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path) :
+static void _encodeRecord(std::string &out,const char op,const nlohmann::json &record)
+{
+	std::string payload;
+	payload.push_back(op);
+	payload.append(OSUtils::jsonDump(record,-1));
+	uint8_t h[ZT_FILEDB_JOURNAL_RECORD_HEADER_SIZE];
+	uint8_t digest[ZT_SHA512_DIGEST_LEN];
+	SHA512::hash(digest,payload.data(),(unsigned int)payload.length());
+	const uint32_t len = (uint32_t)payload.length();
+	h[0] = (uint8_t)(len >> 24);
+	h[1] = (uint8_t)(len >> 16);
+	h[2] = (uint8_t)(len >> 8);
+	h[3] = (uint8_t)len;
+	memcpy(h + 4,digest,8);
+	out.append((const char *)h,sizeof(h));
+	out.append(payload);
+}
+
+static bool _syncFile(FILE *f)
+{
+	if (fflush(f) != 0)
+		return false;
+#ifdef __WINDOWS__
+	return (_commit(_fileno(f)) == 0);
+#else
+	return (fsync(fileno(f)) == 0);
+#endif
+}
+
+FileDB::FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path,const bool journal) :
 	DB(nc,myId,path),
 	_networksPath(_path + ZT_PATH_SEPARATOR_S + "network"),
-	_tracePath(_path + ZT_PATH_SEPARATOR_S + "trace")
+	_tracePath(_path + ZT_PATH_SEPARATOR_S + "trace"),
+	_traceLog(_tracePath),
+	_journal(journal),
+	_journalPath(_path + ZT_PATH_SEPARATOR_S + "journal"),
+	_oldJournalPath(_path + ZT_PATH_SEPARATOR_S + "journal.old"),
+	_snapshotPath(_path + ZT_PATH_SEPARATOR_S + "snapshot"),
+	_journalFile((FILE *)0),
+	_journalSize(0),
+	_snapshotSize(0),
+	_pendingSeq(0),
+	_committedSeq(0),
+	_compactUpTo(0),
+	_run(true)
 {
 	OSUtils::mkdir(_path.c_str());
 	OSUtils::lockDownFile(_path.c_str(),true);
 	OSUtils::mkdir(_networksPath.c_str());
 	OSUtils::mkdir(_tracePath.c_str());
 
-	std::vector<std::string> networks(OSUtils::listDirectory(_networksPath.c_str(),false));
-	std::string buf;
-	for(auto n=networks.begin();n!=networks.end();++n) {
-		buf.clear();
-		if ((n->length() == 21)&&(OSUtils::readFile((_networksPath + ZT_PATH_SEPARATOR_S + *n).c_str(),buf))) {
-			try {
-				nlohmann::json network(OSUtils::jsonParse(buf));
-				const std::string nwids = network["id"];
-				if (nwids.length() == 16) {
-					nlohmann::json nullJson;
-					_networkChanged(nullJson,network,false);
-					std::string membersPath(_networksPath + ZT_PATH_SEPARATOR_S + nwids + ZT_PATH_SEPARATOR_S "member");
-					std::vector<std::string> members(OSUtils::listDirectory(membersPath.c_str(),false));
-					for(auto m=members.begin();m!=members.end();++m) {
-						buf.clear();
-						if ((m->length() == 15)&&(OSUtils::readFile((membersPath + ZT_PATH_SEPARATOR_S + *m).c_str(),buf))) {
-							try {
-								nlohmann::json member(OSUtils::jsonParse(buf));
-								const std::string addrs = member["id"];
-								if (addrs.length() == 10) {
-									nlohmann::json nullJson2;
-									_memberChanged(nullJson2,member,false);
-								}
-							} catch ( ... ) {}
-						}
-					}
-				}
-			} catch ( ... ) {}
+	if (!_journal) {
+		_loadFiles();
+		return;
+	}
+
+	// Replay order matters: the snapshot, then a journal left over from an unfinished compaction, then the current journal
+	bool rewrite = false;
+	if ((!OSUtils::fileExists(_snapshotPath.c_str()))&&(!OSUtils::fileExists(_oldJournalPath.c_str()))&&(!OSUtils::fileExists(_journalPath.c_str()))) {
+		_loadFiles();
+		rewrite = true;
+	} else {
+		if (!_replay(_snapshotPath,true))
+			fprintf(stderr,"WARNING: controller snapshot is damaged, some records could not be loaded: %s" ZT_EOL_S,_snapshotPath.c_str());
+		if (OSUtils::fileExists(_oldJournalPath.c_str())) {
+			_replay(_oldJournalPath,false);
+			rewrite = true;
+		}
+		if (!_replay(_journalPath,false)) {
+			// Usually a write torn by a crash; anything after it can't be trusted and appending past it would hide new records
+			fprintf(stderr,"WARNING: controller journal has a damaged tail, discarding it: %s" ZT_EOL_S,_journalPath.c_str());
+			rewrite = true;
+		}
+	}
+
+	if (rewrite) {
+		if (_writeSnapshot(_snapshotSize)) {
+			OSUtils::rm(_oldJournalPath.c_str());
+			OSUtils::rm(_journalPath.c_str());
+		} else {
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_snapshotPath.c_str());
 		}
+	} else {
+		const int64_t ss = OSUtils::getFileSize(_snapshotPath.c_str());
+		_snapshotSize = (ss > 0) ? (uint64_t)ss : 0;
 	}
+
+	const int64_t js = OSUtils::getFileSize(_journalPath.c_str());
+	_journalSize = (js > 0) ? (uint64_t)js : 0;
+	_journalFile = fopen(_journalPath.c_str(),"ab");
+	if (!_journalFile)
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_journalPath.c_str());
+
+	_journalThread = std::thread([this]() { _journalMain(); });
+	_compactThread = std::thread([this]() { _compactMain(); });
 }
 
-FileDB::~FileDB() {}
+FileDB::~FileDB()
+{
+	if (_journal) {
+		{
+			std::lock_guard<std::mutex> l(_journal_l);
+			_run = false;
+		}
+		_journal_c.notify_all();
+		_compact_c.notify_all();
+		_journalThread.join();
+		_compactThread.join();
+		if (_journalFile)
+			fclose(_journalFile);
+	}
+}
 
 bool FileDB::waitForReady() { return true; }
 bool FileDB::isReady() { return true; }
@@ -88,52 +157,88 @@ void FileDB::save(nlohmann::json *orig,nlohmann::json &record)
 				get(nwid,old);
 
 				if ((!old.is_object())||(old != record)) {
-					OSUtils::ztsnprintf(p1,sizeof(p1),"%s" ZT_PATH_SEPARATOR_S "%.16llx.json.new",_networksPath.c_str(),nwid);
-					OSUtils::ztsnprintf(p2,sizeof(p2),"%s" ZT_PATH_SEPARATOR_S "%.16llx.json",_networksPath.c_str(),nwid);
-					if (!OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1)))
-						fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,p1);
-					OSUtils::rename(p1,p2);
-
-					_networkChanged(old,record,true);
+					if (_journal) {
+						const uint64_t seq = _journalAppend('P',record);
+						try {
+							_networkChanged(old,record,true);
+						} catch ( ... ) {}
+						_journalApplied(seq);
+					} else {
+						const uint64_t start = _microseconds();
+						OSUtils::ztsnprintf(p1,sizeof(p1),"%s" ZT_PATH_SEPARATOR_S "%.16llx.json.new",_networksPath.c_str(),nwid);
+						OSUtils::ztsnprintf(p2,sizeof(p2),"%s" ZT_PATH_SEPARATOR_S "%.16llx.json",_networksPath.c_str(),nwid);
+						if (!OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1)))
+							fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,p1);
+						OSUtils::rename(p1,p2);
+						_committed(1,_microseconds() - start);
+						_networkChanged(old,record,true);
+					}
 				}
 			}
 		} else if (objtype == "member") {
 			const uint64_t id = OSUtils::jsonIntHex(record["id"],0ULL);
 			const uint64_t nwid = OSUtils::jsonIntHex(record["nwid"],0ULL);
 			if ((id)&&(nwid)) {
-				nlohmann::json network,old;
+				std::shared_ptr<const nlohmann::json> network;
+				nlohmann::json old;
 				get(nwid,network,id,old);
 
 				if ((!old.is_object())||(old != record)) {
-					OSUtils::ztsnprintf(pb,sizeof(pb),"%s" ZT_PATH_SEPARATOR_S "%.16llx" ZT_PATH_SEPARATOR_S "member",_networksPath.c_str(),(unsigned long long)nwid);
-					OSUtils::ztsnprintf(p1,sizeof(p1),"%s" ZT_PATH_SEPARATOR_S "%.10llx.json.new",pb,(unsigned long long)id);
-					if (!OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1))) {
-						OSUtils::ztsnprintf(p2,sizeof(p2),"%s" ZT_PATH_SEPARATOR_S "%.16llx",_networksPath.c_str(),(unsigned long long)nwid);
-						OSUtils::mkdir(p2);
-						OSUtils::mkdir(pb);
-						if (!OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1)))
-							fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,p1);
+					if (_journal) {
+						const uint64_t seq = _journalAppend('P',record);
+						try {
+							_memberChanged(old,record,true);
+						} catch ( ... ) {}
+						_journalApplied(seq);
+					} else {
+						const uint64_t start = _microseconds();
+						OSUtils::ztsnprintf(pb,sizeof(pb),"%s" ZT_PATH_SEPARATOR_S "%.16llx" ZT_PATH_SEPARATOR_S "member",_networksPath.c_str(),(unsigned long long)nwid);
+						OSUtils::ztsnprintf(p1,sizeof(p1),"%s" ZT_PATH_SEPARATOR_S "%.10llx.json.new",pb,(unsigned long long)id);
+						if (!OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1))) {
+							OSUtils::ztsnprintf(p2,sizeof(p2),"%s" ZT_PATH_SEPARATOR_S "%.16llx",_networksPath.c_str(),(unsigned long long)nwid);
+							OSUtils::mkdir(p2);
+							OSUtils::mkdir(pb);
+							if (!OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1)))
+								fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,p1);
+						}
+						OSUtils::ztsnprintf(p2,sizeof(p2),"%s" ZT_PATH_SEPARATOR_S "%.10llx.json",pb,(unsigned long long)id);
+						OSUtils::rename(p1,p2);
+						_committed(1,_microseconds() - start);
+						_memberChanged(old,record,true);
 					}
-					OSUtils::ztsnprintf(p2,sizeof(p2),"%s" ZT_PATH_SEPARATOR_S "%.10llx.json",pb,(unsigned long long)id);
-					OSUtils::rename(p1,p2);
-
-					_memberChanged(old,record,true);
 				}
 			}
 		} else if (objtype == "trace") {
-			const std::string id = record["id"];
-			if (id.length() > 0) {
-				OSUtils::ztsnprintf(p1,sizeof(p1),"%s" ZT_PATH_SEPARATOR_S "%s.json",_tracePath.c_str(),id.c_str());
-				OSUtils::writeFile(p1,OSUtils::jsonDump(record,-1));
-			}
+			_traceLog.append(record);
 		}
 	} catch ( ... ) {} // drop invalid records missing fields
 }
 
+void FileDB::commitStats(CommitStats &cs)
+{
+	DB::commitStats(cs);
+	if (_journal) {
+		std::lock_guard<std::mutex> l(_journal_l);
+		cs.backlog = _pendingSeq - _committedSeq;
+	}
+}
+
 void FileDB::eraseNetwork(const uint64_t networkId)
 {
 	nlohmann::json network,nullJson;
 	get(networkId,network);
+	if (_journal) {
+		char nwids[24];
+		OSUtils::ztsnprintf(nwids,sizeof(nwids),"%.16llx",(unsigned long long)networkId);
+		nlohmann::json d;
+		d["id"] = nwids;
+		const uint64_t seq = _journalAppend('D',d);
+		try {
+			_networkChanged(network,nullJson,true);
+		} catch ( ... ) {}
+		_journalApplied(seq);
+		return;
+	}
 	char p[16384];
 	OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.16llx.json",_networksPath.c_str(),networkId);
 	OSUtils::rm(p);
@@ -149,4 +254,256 @@ void FileDB::nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const
 	// Nothing to do here right now in the filesystem store mode since we can just get this from the peer list
 }
 
+// Reads and parses files across all cores, leaving a null entry in out for any that can't be read or parsed
+static void _parallelParse(const std::vector<std::string> &paths,std::vector<nlohmann::json> &out,uint64_t &bytes)
+{
+	out.clear();
+	out.resize(paths.size());
+	std::atomic<std::size_t> next(0);
+	std::atomic<uint64_t> total(0);
+	const long tc = std::min(std::max((long)std::thread::hardware_concurrency(),(long)1),std::min((long)ZT_CONTROLLER_FILEDB_LOAD_THREADS_MAX,(long)paths.size()));
+	std::vector<std::thread> threads;
+	for(long t=0;t<tc;++t) {
+		threads.emplace_back([&paths,&out,&next,&total]() {
+			std::string buf;
+			for(;;) {
+				const std::size_t i = next++;
+				if (i >= paths.size())
+					break;
+				buf.clear();
+				if (OSUtils::readFile(paths[i].c_str(),buf)) {
+					total += (uint64_t)buf.length();
+					try {
+						out[i] = OSUtils::jsonParse(buf);
+					} catch ( ... ) {}
+				}
+			}
+		});
+	}
+	for(auto t=threads.begin();t!=threads.end();++t)
+		t->join();
+	bytes += total;
+}
+
+void FileDB::_loadFiles()
+{
+	const int64_t start = OSUtils::now();
+	uint64_t bytes = 0;
+
+	std::vector<std::string> paths;
+	std::vector<std::string> networkFiles(OSUtils::listDirectory(_networksPath.c_str(),false));
+	for(auto n=networkFiles.begin();n!=networkFiles.end();++n) {
+		if (n->length() == 21)
+			paths.push_back(_networksPath + ZT_PATH_SEPARATOR_S + *n);
+	}
+	std::vector<nlohmann::json> networks;
+	_parallelParse(paths,networks,bytes);
+	std::size_t files = paths.size();
+
+	// Then all members of all networks at once, remembering where each network's members start
+	paths.clear();
+	std::vector<std::size_t> firstMember;
+	for(auto nw=networks.begin();nw!=networks.end();++nw) {
+		firstMember.push_back(paths.size());
+		try {
+			if (nw->is_object()) {
+				const std::string nwids = (*nw)["id"];
+				if (nwids.length() == 16) {
+					std::string membersPath(_networksPath + ZT_PATH_SEPARATOR_S + nwids + ZT_PATH_SEPARATOR_S "member");
+					std::vector<std::string> members(OSUtils::listDirectory(membersPath.c_str(),false));
+					for(auto m=members.begin();m!=members.end();++m) {
+						if (m->length() == 15)
+							paths.push_back(membersPath + ZT_PATH_SEPARATOR_S + *m);
+					}
+					continue;
+				}
+			}
+		} catch ( ... ) {}
+		*nw = nlohmann::json(); // not a valid network, so neither are its members
+	}
+	firstMember.push_back(paths.size());
+	std::vector<nlohmann::json> members;
+	_parallelParse(paths,members,bytes);
+	files += paths.size();
+
+	// Indexing in DB isn't built for concurrent loading, so merge everything in on this thread
+	for(std::size_t n=0;n<networks.size();++n) {
+		if (!networks[n].is_object())
+			continue;
+		nlohmann::json nullJson;
+		_networkChanged(nullJson,networks[n],false);
+		for(std::size_t m=firstMember[n];m<firstMember[n+1];++m) {
+			try {
+				nlohmann::json &member = members[m];
+				if (member.is_object()) {
+					const std::string addrs = member["id"];
+					if (addrs.length() == 10) {
+						nlohmann::json nullJson2;
+						_memberChanged(nullJson2,member,false);
+					}
+				}
+			} catch ( ... ) {}
+			members[m] = nlohmann::json(); // free as we go
+		}
+	}
+
+	if (files) {
+		const int64_t ms = std::max(OSUtils::now() - start,(int64_t)1);
+		fprintf(stderr,"NOTICE: %.10llx controller loaded %lu files (%.2f MB) in %lld ms (%.0f files/s, %.2f MB/s)" ZT_EOL_S,(unsigned long long)_myAddress.toInt(),(unsigned long)files,(double)bytes / 1048576.0,(long long)ms,((double)files * 1000.0) / (double)ms,((double)bytes * 1000.0) / ((double)ms * 1048576.0));
+	}
+}
+
+bool FileDB::_replay(const std::string &path,const bool first)
+{
+	std::string buf;
+	if (!OSUtils::readFile(path.c_str(),buf))
+		return true;
+	uint8_t digest[ZT_SHA512_DIGEST_LEN];
+	std::size_t ptr = 0;
+	while (ptr < buf.length()) {
+		if ((buf.length() - ptr) < ZT_FILEDB_JOURNAL_RECORD_HEADER_SIZE)
+			return false;
+		const uint8_t *const h = reinterpret_cast<const uint8_t *>(buf.data() + ptr);
+		const std::size_t len = ((std::size_t)h[0] << 24) | ((std::size_t)h[1] << 16) | ((std::size_t)h[2] << 8) | (std::size_t)h[3];
+		if ((len < 1)||(len > ZT_FILEDB_JOURNAL_MAX_RECORD_SIZE)||((buf.length() - (ptr + ZT_FILEDB_JOURNAL_RECORD_HEADER_SIZE)) < len))
+			return false;
+		const char *const payload = buf.data() + ptr + ZT_FILEDB_JOURNAL_RECORD_HEADER_SIZE;
+		SHA512::hash(digest,payload,(unsigned int)len);
+		if (memcmp(digest,h + 4,8) != 0)
+			return false;
+		ptr += ZT_FILEDB_JOURNAL_RECORD_HEADER_SIZE + len;
+
+		try {
+			nlohmann::json record(OSUtils::jsonParse(std::string(payload + 1,len - 1)));
+			if (payload[0] == 'D')
+				_loadNetworkErase(OSUtils::jsonIntHex(record["id"],0ULL));
+			else if (payload[0] == 'P')
+				_loadRecord(record,!first); // a snapshot holds each object once, later journal records replace what came before
+		} catch ( ... ) {} // skip records that are intact but not valid, as the per-file loader does
+	}
+	return true;
+}
+
+uint64_t FileDB::_journalAppend(const char op,const nlohmann::json &record)
+{
+	std::unique_lock<std::mutex> l(_journal_l);
+	_encodeRecord(_pending,op,record);
+	const uint64_t seq = ++_pendingSeq;
+	_unapplied.insert(seq);
+	_journal_c.notify_one();
+	while ((_run)&&(_committedSeq < seq))
+		_committed_c.wait(l);
+	return seq;
+}
+
+void FileDB::_journalApplied(const uint64_t seq)
+{
+	std::lock_guard<std::mutex> l(_journal_l);
+	_unapplied.erase(seq);
+	if ((_compactUpTo)&&((_unapplied.empty())||(*_unapplied.begin() > _compactUpTo)))
+		_compact_c.notify_one();
+}
+
+bool FileDB::_writeSnapshot(uint64_t &size)
+{
+	const std::string tmp(_snapshotPath + ".new");
+	FILE *f = fopen(tmp.c_str(),"wb");
+	if (!f)
+		return false;
+
+	bool ok = true;
+	size = 0;
+	std::string buf;
+	std::vector<uint64_t> nws;
+	networks(nws);
+	for(auto n=nws.begin();((n!=nws.end())&&(ok));++n) {
+		std::shared_ptr<const nlohmann::json> network;
+		std::vector<nlohmann::json> members;
+		if (!get(*n,network,members))
+			continue;
+		buf.clear();
+		if (network)
+			_encodeRecord(buf,'P',*network);
+		for(auto m=members.begin();m!=members.end();++m)
+			_encodeRecord(buf,'P',*m);
+		ok = (fwrite(buf.data(),1,buf.length(),f) == buf.length());
+		size += buf.length();
+	}
+	if (ok)
+		ok = _syncFile(f);
+	fclose(f);
+
+	if ((!ok)||(!OSUtils::rename(tmp.c_str(),_snapshotPath.c_str()))) {
+		OSUtils::rm(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+void FileDB::_journalMain()
+{
+	std::string batch;
+	std::unique_lock<std::mutex> l(_journal_l);
+	for(;;) {
+		while ((_run)&&(_pending.empty()))
+			_journal_c.wait(l);
+		if (_pending.empty())
+			break;
+
+		// Everything queued while the last sync was running goes out in this one
+		batch.clear();
+		batch.swap(_pending);
+		const uint64_t seq = _pendingSeq;
+		l.unlock();
+		const uint64_t start = _microseconds();
+		if ((!_journalFile)||(fwrite(batch.data(),1,batch.length(),_journalFile) != batch.length())||(!_syncFile(_journalFile)))
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_journalPath.c_str());
+		_committed(seq - _committedSeq,_microseconds() - start); // only this thread changes _committedSeq
+		l.lock();
+
+		_journalSize += batch.length();
+		_committedSeq = seq;
+		_committed_c.notify_all();
+
+		if ((!_compactUpTo)&&(_journalSize >= ZT_CONTROLLER_FILEDB_JOURNAL_COMPACT_MIN_SIZE)&&(_journalSize >= _snapshotSize)) {
+			// Start a new journal for whatever comes in while the snapshot is written. If an old one is
+			// still around a previous compaction failed, so keep appending here and just try again.
+			if ((_journalFile)&&(!OSUtils::fileExists(_oldJournalPath.c_str()))) {
+				fclose(_journalFile);
+				OSUtils::rename(_journalPath.c_str(),_oldJournalPath.c_str());
+				_journalFile = fopen(_journalPath.c_str(),"ab");
+				if (!_journalFile)
+					fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_journalPath.c_str());
+				_journalSize = 0;
+			}
+			_compactUpTo = seq;
+			_compact_c.notify_one();
+		}
+	}
+}
+
+void FileDB::_compactMain()
+{
+	std::unique_lock<std::mutex> l(_journal_l);
+	for(;;) {
+		// Wait until every record in the old journal has also been applied in memory
+		while ((_run)&&((!_compactUpTo)||((!_unapplied.empty())&&(*_unapplied.begin() <= _compactUpTo))))
+			_compact_c.wait(l);
+		if (!_run)
+			break; // the old journal, if any, is replayed on next start
+
+		l.unlock();
+		uint64_t size = 0;
+		const bool ok = _writeSnapshot(size);
+		if (ok)
+			OSUtils::rm(_oldJournalPath.c_str());
+		else fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_snapshotPath.c_str());
+		l.lock();
+
+		if (ok)
+			_snapshotSize = size;
+		_compactUpTo = 0;
+	}
+}
+
 } // namespace ZeroTier
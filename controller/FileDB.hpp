@@ -20,14 +20,38 @@
 #define ZT_CONTROLLER_FILEDB_HPP
 
 #include "DB.hpp"
+#include "TraceLog.hpp"
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <set>
+
+// Journal is compacted into a new snapshot once it's at least this big and at least as big as the snapshot
+#define ZT_CONTROLLER_FILEDB_JOURNAL_COMPACT_MIN_SIZE 16777216
 
 namespace ZeroTier
 {
 
+/**
+ * A controller database stored in the local filesystem
+ *
+ * By default each network and member is its own JSON file. In journal mode
+ * changes are instead appended to a checksummed journal (with concurrent
+ * saves committed together under one sync) that is periodically compacted
+ * in the background into a snapshot of everything. Startup is then a load
+ * of the snapshot plus a replay of the journal.
+ */
 class FileDB : public DB
 {
 public:
-	FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path);
+	/**
+	 * @param nc Controller
+	 * @param myId Controller identity
+	 * @param path Base path of database
+	 * @param journal If true use journal mode (existing per-object files are imported on first start)
+	 */
+	FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path,const bool journal = false);
 	virtual ~FileDB();
 
 	virtual bool waitForReady();
@@ -36,10 +60,40 @@ public:
 	virtual void eraseNetwork(const uint64_t networkId);
 	virtual void eraseMember(const uint64_t networkId,const uint64_t memberId);
 	virtual void nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress);
+	virtual void commitStats(CommitStats &cs);
 
 protected:
+	void _loadFiles();
+	bool _replay(const std::string &path,const bool first);
+	uint64_t _journalAppend(const char op,const nlohmann::json &record);
+	void _journalApplied(const uint64_t seq);
+	bool _writeSnapshot(uint64_t &size);
+	void _journalMain();
+	void _compactMain();
+
 	std::string _networksPath;
 	std::string _tracePath;
+	TraceLog _traceLog; // remote traces, kept apart from networks and members
+
+	const bool _journal;
+	std::string _journalPath;
+	std::string _oldJournalPath; // journal rotated out by a compaction in progress
+	std::string _snapshotPath;
+	FILE *_journalFile;
+	uint64_t _journalSize;
+	uint64_t _snapshotSize;
+	std::string _pending; // encoded records waiting for the next commit
+	uint64_t _pendingSeq;
+	uint64_t _committedSeq;
+	uint64_t _compactUpTo; // nonzero while compacting, all records up to this are in the old journal
+	std::set<uint64_t> _unapplied; // committed (or committing) but not yet in memory
+	bool _run;
+	std::mutex _journal_l;
+	std::condition_variable _journal_c;
+	std::condition_variable _committed_c;
+	std::condition_variable _compact_c;
+	std::thread _journalThread;
+	std::thread _compactThread;
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,385 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WINDOWS__
+
+#include "MappedDB.hpp"
+
+#include "../node/SHA512.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// The file starts with a header holding two superblocks, each a magic, a generation counter, the
+// committed end of the log and the first 64 bits of the SHA-512 of the rest. The one with the highest
+// generation that checks out is current. Records follow the header: a 32-bit big-endian payload
+// length, the first 64 bits of the payload's SHA-512, then the payload which is an op ('P' put,
+// 'D' delete network) followed by msgpack.
+#define ZT_MAPPEDDB_MAGIC 0x5a544d4442303031ULL // "ZTMDB001"
+#define ZT_MAPPEDDB_HEADER_SIZE 4096
+#define ZT_MAPPEDDB_SUPERBLOCK_SIZE 64
+#define ZT_MAPPEDDB_RECORD_HEADER_SIZE 12
+#define ZT_MAPPEDDB_MAX_RECORD_SIZE 67108864
+
+namespace ZeroTier
+{
+
+static inline void _mdbPut64(uint8_t *p,const uint64_t v)
+{
+	for(unsigned int i=0;i<8;++i)
+		p[i] = (uint8_t)(v >> (56 - (i * 8)));
+}
+
+static inline uint64_t _mdbGet64(const uint8_t *p)
+{
+	uint64_t v = 0;
+	for(unsigned int i=0;i<8;++i)
+		v = (v << 8) | (uint64_t)p[i];
+	return v;
+}
+
+static void _mdbEncodeRecord(std::string &out,const char op,const nlohmann::json &record)
+{
+	const std::size_t start = out.length();
+	out.append(ZT_MAPPEDDB_RECORD_HEADER_SIZE,(char)0);
+	out.push_back(op);
+	nlohmann::json::to_msgpack(record,out);
+	const uint32_t len = (uint32_t)(out.length() - (start + ZT_MAPPEDDB_RECORD_HEADER_SIZE));
+	uint8_t digest[ZT_SHA512_DIGEST_LEN];
+	SHA512::hash(digest,out.data() + start + ZT_MAPPEDDB_RECORD_HEADER_SIZE,(unsigned int)len);
+	out[start] = (char)(len >> 24);
+	out[start + 1] = (char)(len >> 16);
+	out[start + 2] = (char)(len >> 8);
+	out[start + 3] = (char)len;
+	memcpy(&(out[start + 4]),digest,8);
+}
+
+static bool _mdbWriteAll(const int fd,const void *data,std::size_t len,uint64_t off)
+{
+	const char *p = (const char *)data;
+	while (len) {
+		const ssize_t n = pwrite(fd,p,len,(off_t)off);
+		if (n <= 0) {
+			if ((n < 0)&&(errno == EINTR))
+				continue;
+			return false;
+		}
+		p += n;
+		len -= (std::size_t)n;
+		off += (uint64_t)n;
+	}
+	return true;
+}
+
+static inline bool _mdbSync(const int fd)
+{
+#ifdef __APPLE__
+	return (fsync(fd) == 0);
+#else
+	return (fdatasync(fd) == 0);
+#endif
+}
+
+MappedDB::MappedDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path) :
+	DB(nc,myId,path),
+	_dbPath(_path + ZT_PATH_SEPARATOR_S + "controller.mdb"),
+	_tracePath(_path + ZT_PATH_SEPARATOR_S + "trace"),
+	_traceLog(_tracePath),
+	_fd(-1),
+	_generation(0),
+	_end(ZT_MAPPEDDB_HEADER_SIZE),
+	_compactedSize(ZT_MAPPEDDB_HEADER_SIZE)
+{
+	OSUtils::mkdir(_path.c_str());
+	OSUtils::lockDownFile(_path.c_str(),true);
+	OSUtils::mkdir(_tracePath.c_str());
+
+	if (_open())
+		_load();
+	else fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_dbPath.c_str());
+}
+
+MappedDB::~MappedDB()
+{
+	if (_fd >= 0)
+		::close(_fd);
+}
+
+bool MappedDB::waitForReady() { return true; }
+bool MappedDB::isReady() { return true; }
+
+void MappedDB::save(nlohmann::json *orig,nlohmann::json &record)
+{
+	try {
+		if (orig) {
+			if (*orig != record) {
+				record["revision"] = OSUtils::jsonInt(record["revision"],0ULL) + 1;
+			}
+		} else {
+			record["revision"] = 1;
+		}
+
+		const std::string objtype = record["objtype"];
+		if (objtype == "network") {
+			const uint64_t nwid = OSUtils::jsonIntHex(record["id"],0ULL);
+			if (nwid) {
+				std::lock_guard<std::mutex> l(_l);
+				nlohmann::json old;
+				get(nwid,old);
+				if ((!old.is_object())||(old != record)) {
+					if (!_commit('P',record))
+						fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_dbPath.c_str());
+					_networkChanged(old,record,true);
+				}
+			}
+		} else if (objtype == "member") {
+			const uint64_t id = OSUtils::jsonIntHex(record["id"],0ULL);
+			const uint64_t nwid = OSUtils::jsonIntHex(record["nwid"],0ULL);
+			if ((id)&&(nwid)) {
+				std::lock_guard<std::mutex> l(_l);
+				std::shared_ptr<const nlohmann::json> network;
+				nlohmann::json old;
+				get(nwid,network,id,old);
+				if ((!old.is_object())||(old != record)) {
+					if (!_commit('P',record))
+						fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_dbPath.c_str());
+					_memberChanged(old,record,true);
+				}
+			}
+		} else if (objtype == "trace") {
+			_traceLog.append(record);
+		}
+	} catch ( ... ) {} // drop invalid records missing fields
+}
+
+void MappedDB::eraseNetwork(const uint64_t networkId)
+{
+	std::lock_guard<std::mutex> l(_l);
+	nlohmann::json network,nullJson;
+	get(networkId,network);
+	char nwids[24];
+	OSUtils::ztsnprintf(nwids,sizeof(nwids),"%.16llx",(unsigned long long)networkId);
+	nlohmann::json d;
+	d["id"] = nwids;
+	if (!_commit('D',d))
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_dbPath.c_str());
+	_networkChanged(network,nullJson,true);
+}
+
+void MappedDB::eraseMember(const uint64_t networkId,const uint64_t memberId)
+{
+}
+
+void MappedDB::nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress)
+{
+	// Nothing to do here, as with FileDB this comes from the peer list
+}
+
+bool MappedDB::_open()
+{
+	_fd = ::open(_dbPath.c_str(),O_RDWR|O_CREAT,0600);
+	if (_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(_fd,&st) != 0)
+		return false;
+	if (st.st_size == 0) {
+		// New store: an empty header then the first superblock
+		const std::string header(ZT_MAPPEDDB_HEADER_SIZE,(char)0);
+		if ((!_mdbWriteAll(_fd,header.data(),header.length(),0))||(!_writeSuperblock(_fd,1,ZT_MAPPEDDB_HEADER_SIZE))||(!_mdbSync(_fd)))
+			return false;
+		_generation = 1;
+	}
+	return true;
+}
+
+void MappedDB::_load()
+{
+	const int64_t start = OSUtils::now();
+
+	struct stat st;
+	if ((fstat(_fd,&st) != 0)||(st.st_size < ZT_MAPPEDDB_HEADER_SIZE)) {
+		fprintf(stderr,"WARNING: controller store is damaged, starting empty: %s" ZT_EOL_S,_dbPath.c_str());
+		return;
+	}
+	const uint64_t size = (uint64_t)st.st_size;
+	void *const m = mmap((void *)0,(std::size_t)size,PROT_READ,MAP_SHARED,_fd,0);
+	if (m == MAP_FAILED) {
+		fprintf(stderr,"WARNING: controller unable to read path: %s" ZT_EOL_S,_dbPath.c_str());
+		return;
+	}
+	madvise(m,(std::size_t)size,MADV_SEQUENTIAL);
+	const uint8_t *const base = (const uint8_t *)m;
+
+	uint8_t digest[ZT_SHA512_DIGEST_LEN];
+	_generation = 0;
+	for(unsigned int s=0;s<2;++s) {
+		const uint8_t *const sb = base + (s * ZT_MAPPEDDB_SUPERBLOCK_SIZE);
+		SHA512::hash(digest,sb,ZT_MAPPEDDB_SUPERBLOCK_SIZE - 8);
+		if ((_mdbGet64(sb) != ZT_MAPPEDDB_MAGIC)||(memcmp(digest,sb + ZT_MAPPEDDB_SUPERBLOCK_SIZE - 8,8) != 0))
+			continue;
+		const uint64_t g = _mdbGet64(sb + 8);
+		const uint64_t e = _mdbGet64(sb + 16);
+		if ((g > _generation)&&(e >= ZT_MAPPEDDB_HEADER_SIZE)&&(e <= size)) {
+			_generation = g;
+			_end = e;
+		}
+	}
+	if (!_generation) {
+		munmap(m,(std::size_t)size);
+		fprintf(stderr,"WARNING: controller store is damaged, starting empty: %s" ZT_EOL_S,_dbPath.c_str());
+		OSUtils::rename(_dbPath.c_str(),(_dbPath + ".damaged").c_str());
+		::close(_fd);
+		_end = ZT_MAPPEDDB_HEADER_SIZE;
+		if (!_open())
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_dbPath.c_str());
+		return;
+	}
+
+	// Only what a superblock committed is read, anything past it is a write torn by a crash
+	unsigned long records = 0;
+	uint64_t ptr = ZT_MAPPEDDB_HEADER_SIZE;
+	while ((ptr + ZT_MAPPEDDB_RECORD_HEADER_SIZE) <= _end) {
+		const uint8_t *const h = base + ptr;
+		const uint32_t len = ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | (uint32_t)h[3];
+		if ((len < 1)||(len > ZT_MAPPEDDB_MAX_RECORD_SIZE)||((ptr + ZT_MAPPEDDB_RECORD_HEADER_SIZE + len) > _end))
+			break;
+		const uint8_t *const payload = h + ZT_MAPPEDDB_RECORD_HEADER_SIZE;
+		SHA512::hash(digest,payload,len);
+		if (memcmp(digest,h + 4,8) != 0)
+			break;
+		ptr += ZT_MAPPEDDB_RECORD_HEADER_SIZE + len;
+
+		try {
+			nlohmann::json record(nlohmann::json::from_msgpack(payload + 1,payload + len));
+			if (payload[0] == 'D')
+				_loadNetworkErase(OSUtils::jsonIntHex(record["id"],0ULL));
+			else if (payload[0] == 'P')
+				_loadRecord(record,true);
+			++records;
+		} catch ( ... ) {} // skip records that are intact but not valid
+	}
+	munmap(m,(std::size_t)size);
+
+	if (ptr != _end)
+		fprintf(stderr,"WARNING: controller store is damaged, some records could not be loaded: %s" ZT_EOL_S,_dbPath.c_str());
+	if (size > _end) {
+		if (ftruncate(_fd,(off_t)_end) != 0)
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_dbPath.c_str());
+	}
+	_compactedSize = _end;
+
+	const int64_t ms = std::max(OSUtils::now() - start,(int64_t)1);
+	fprintf(stderr,"NOTICE: %.10llx controller loaded %lu records (%.1fMB) in %lldms (%.0f records/s, %.1fMB/s)" ZT_EOL_S,
+		(unsigned long long)_myAddress.toInt(),
+		records,
+		(double)_end / 1048576.0,
+		(long long)ms,
+		((double)records * 1000.0) / (double)ms,
+		((double)_end * 1000.0) / ((double)ms * 1048576.0));
+}
+
+bool MappedDB::_commit(const char op,const nlohmann::json &record)
+{
+	if (_fd < 0)
+		return false;
+
+	std::string buf;
+	_mdbEncodeRecord(buf,op,record);
+
+	// The record is durable before the superblock that makes it part of the store is written
+	const uint64_t start = _microseconds();
+	if ((!_mdbWriteAll(_fd,buf.data(),buf.length(),_end))||(!_mdbSync(_fd)))
+		return false;
+	if ((!_writeSuperblock(_fd,_generation + 1,_end + buf.length()))||(!_mdbSync(_fd)))
+		return false;
+	++_generation;
+	_end += buf.length();
+	_committed(1,_microseconds() - start);
+
+	if ((_end >= ZT_CONTROLLER_MAPPEDDB_COMPACT_MIN_SIZE)&&(_end >= (_compactedSize * 2))) {
+		if (!_compact())
+			fprintf(stderr,"WARNING: controller unable to write to path: %s.new" ZT_EOL_S,_dbPath.c_str());
+	}
+	return true;
+}
+
+bool MappedDB::_writeSuperblock(const int fd,const uint64_t generation,const uint64_t end)
+{
+	uint8_t sb[ZT_MAPPEDDB_SUPERBLOCK_SIZE];
+	memset(sb,0,sizeof(sb));
+	_mdbPut64(sb,ZT_MAPPEDDB_MAGIC);
+	_mdbPut64(sb + 8,generation);
+	_mdbPut64(sb + 16,end);
+	uint8_t digest[ZT_SHA512_DIGEST_LEN];
+	SHA512::hash(digest,sb,ZT_MAPPEDDB_SUPERBLOCK_SIZE - 8);
+	memcpy(sb + ZT_MAPPEDDB_SUPERBLOCK_SIZE - 8,digest,8);
+	return _mdbWriteAll(fd,sb,sizeof(sb),(generation & 1) * ZT_MAPPEDDB_SUPERBLOCK_SIZE);
+}
+
+bool MappedDB::_compact()
+{
+	// Called with _l held after the last commit was applied, so memory holds exactly what's in the store
+	const std::string tmp(_dbPath + ".new");
+	const int fd = ::open(tmp.c_str(),O_RDWR|O_CREAT|O_TRUNC,0600);
+	if (fd < 0)
+		return false;
+
+	bool ok = true;
+	uint64_t end = ZT_MAPPEDDB_HEADER_SIZE;
+	std::string buf(ZT_MAPPEDDB_HEADER_SIZE,(char)0);
+	ok = _mdbWriteAll(fd,buf.data(),buf.length(),0);
+	std::vector<uint64_t> nws;
+	networks(nws);
+	for(auto n=nws.begin();((n!=nws.end())&&(ok));++n) {
+		std::shared_ptr<const nlohmann::json> network;
+		std::vector<nlohmann::json> members;
+		if (!get(*n,network,members))
+			continue;
+		buf.clear();
+		if (network)
+			_mdbEncodeRecord(buf,'P',*network);
+		for(auto m=members.begin();m!=members.end();++m)
+			_mdbEncodeRecord(buf,'P',*m);
+		ok = _mdbWriteAll(fd,buf.data(),buf.length(),end);
+		end += buf.length();
+	}
+	if (ok)
+		ok = ((_mdbSync(fd))&&(_writeSuperblock(fd,1,end))&&(_mdbSync(fd)));
+
+	if ((!ok)||(!OSUtils::rename(tmp.c_str(),_dbPath.c_str()))) {
+		::close(fd);
+		OSUtils::rm(tmp.c_str());
+		return false;
+	}
+	::close(_fd);
+	_fd = fd;
+	_generation = 1;
+	_end = end;
+	_compactedSize = end;
+	return true;
+}
+
+} // namespace ZeroTier
+
+#endif // !__WINDOWS__
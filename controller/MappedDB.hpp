@@ -0,0 +1,84 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WINDOWS__
+
+#ifndef ZT_CONTROLLER_MAPPEDDB_HPP
+#define ZT_CONTROLLER_MAPPEDDB_HPP
+
+#include "DB.hpp"
+#include "TraceLog.hpp"
+
+#include <mutex>
+
+// Store is rewritten from memory once it's at least this big and twice the size it had after the last rewrite
+#define ZT_CONTROLLER_MAPPEDDB_COMPACT_MIN_SIZE 33554432
+
+namespace ZeroTier
+{
+
+/**
+ * A controller database kept in a single memory-mapped file
+ *
+ * Records are stored as msgpack in a log that follows a header with two
+ * alternating superblocks. Each save appends and syncs its record and then
+ * commits it by writing the other superblock, so a crash leaves either the
+ * old or the new state and never a partial one. Startup maps the file and
+ * decodes it in place without per-object I/O or JSON parsing.
+ */
+class MappedDB : public DB
+{
+public:
+	/**
+	 * @param nc Controller
+	 * @param myId Controller identity
+	 * @param path Base path of database (the store is controller.mdb in this directory)
+	 */
+	MappedDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path);
+	virtual ~MappedDB();
+
+	virtual bool waitForReady();
+	virtual bool isReady();
+	virtual void save(nlohmann::json *orig,nlohmann::json &record);
+	virtual void eraseNetwork(const uint64_t networkId);
+	virtual void eraseMember(const uint64_t networkId,const uint64_t memberId);
+	virtual void nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress);
+
+protected:
+	bool _open();
+	void _load();
+	bool _commit(const char op,const nlohmann::json &record);
+	bool _writeSuperblock(const int fd,const uint64_t generation,const uint64_t end);
+	bool _compact();
+
+	std::string _dbPath;
+	std::string _tracePath;
+	TraceLog _traceLog; // remote traces, kept apart from networks and members
+
+	int _fd;
+	uint64_t _generation;
+	uint64_t _end; // committed end of the record log
+	uint64_t _compactedSize;
+	std::mutex _l; // held across commit and apply so the store and memory change in the same order
+};
+
+} // namespace ZeroTier
+
+#endif
+
+#endif // !__WINDOWS__
@@ -0,0 +1,89 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryDB.hpp"
+
+namespace ZeroTier
+{
+
+MemoryDB::MemoryDB(EmbeddedNetworkController *const nc,const Identity &myId) :
+	DB(nc,myId,"")
+{
+}
+
+MemoryDB::~MemoryDB()
+{
+}
+
+bool MemoryDB::waitForReady() { return true; }
+bool MemoryDB::isReady() { return true; }
+
+void MemoryDB::save(nlohmann::json *orig,nlohmann::json &record)
+{
+	try {
+		if (orig) {
+			if (*orig != record) {
+				record["revision"] = OSUtils::jsonInt(record["revision"],0ULL) + 1;
+			}
+		} else {
+			record["revision"] = 1;
+		}
+
+		const std::string objtype = record["objtype"];
+		if (objtype == "network") {
+			const uint64_t nwid = OSUtils::jsonIntHex(record["id"],0ULL);
+			if (nwid) {
+				std::lock_guard<std::mutex> l(_l);
+				nlohmann::json old;
+				get(nwid,old);
+				if ((!old.is_object())||(old != record))
+					_networkChanged(old,record,true);
+			}
+		} else if (objtype == "member") {
+			const uint64_t id = OSUtils::jsonIntHex(record["id"],0ULL);
+			const uint64_t nwid = OSUtils::jsonIntHex(record["nwid"],0ULL);
+			if ((id)&&(nwid)) {
+				std::lock_guard<std::mutex> l(_l);
+				nlohmann::json network,old;
+				get(nwid,network,id,old);
+				if ((!old.is_object())||(old != record))
+					_memberChanged(old,record,true);
+			}
+		}
+		// traces are dropped, since there's nowhere to keep them
+	} catch ( ... ) {} // drop invalid records missing fields
+}
+
+void MemoryDB::eraseNetwork(const uint64_t networkId)
+{
+	std::lock_guard<std::mutex> l(_l);
+	nlohmann::json network,nullJson;
+	get(networkId,network);
+	_networkChanged(network,nullJson,true);
+}
+
+void MemoryDB::eraseMember(const uint64_t networkId,const uint64_t memberId)
+{
+}
+
+void MemoryDB::nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress)
+{
+	// Nothing to do here, as with FileDB this comes from the peer list
+}
+
+} // namespace ZeroTier
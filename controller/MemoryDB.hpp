@@ -0,0 +1,59 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_CONTROLLER_MEMORYDB_HPP
+#define ZT_CONTROLLER_MEMORYDB_HPP
+
+#include "DB.hpp"
+
+#include <mutex>
+
+namespace ZeroTier
+{
+
+/**
+ * A controller database that exists only in memory
+ *
+ * Nothing is ever written anywhere, so everything is gone when the
+ * controller exits. This is for tests and simulations that run a real
+ * controller without wanting its state on disk.
+ */
+class MemoryDB : public DB
+{
+public:
+	/**
+	 * @param nc Controller
+	 * @param myId Controller identity
+	 */
+	MemoryDB(EmbeddedNetworkController *const nc,const Identity &myId);
+	virtual ~MemoryDB();
+
+	virtual bool waitForReady();
+	virtual bool isReady();
+	virtual void save(nlohmann::json *orig,nlohmann::json &record);
+	virtual void eraseNetwork(const uint64_t networkId);
+	virtual void eraseMember(const uint64_t networkId,const uint64_t memberId);
+	virtual void nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress);
+
+protected:
+	std::mutex _l; // held across compare and apply so concurrent saves of one record apply in order
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -32,6 +32,7 @@
 
 #include <chrono>
 #include <algorithm>
+#include <map>
 #include <stdexcept>
 
 #include "../ext/librethinkdbxx/build/include/rethinkdb.h"
@@ -58,8 +59,16 @@ static const char *_timestr()
 	return ts;
 }
 
-RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path) :
+RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path,const std::string &instanceId) :
 	DB(nc,myId,path),
+	_instanceId(instanceId),
+	_memberStatusDbWatcherConnection((void *)0),
+	_commitQueue(ZT_CONTROLLER_RETHINKDB_COMMIT_QUEUE_MAX),
+	_commitBatches(0),
+	_commitRecords(0),
+	_commitCoalesced(0),
+	_commitLatency(0),
+	_commitTraceCounter(0),
 	_ready(2), // two tables need to be synchronized before we're ready, so this is ready when it reaches 0
 	_run(1),
 	_waitNoticePrinted(false)
@@ -164,87 +173,98 @@ RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,co
 		_commitThread[t] = std::thread([this]() {
 			try {
 				std::unique_ptr<R::Connection> rdb;
-				nlohmann::json *config = (nlohmann::json *)0;
-				while ((this->_commitQueue.get(config))&&(_run == 1)) {
-					if (!config)
+				std::vector< std::pair<std::string,nlohmann::json> > batch;
+				while ((this->_commitQueue.get(batch,ZT_CONTROLLER_RETHINKDB_COMMIT_BATCH_MAX,ZT_CONTROLLER_RETHINKDB_COMMIT_WINDOW))&&(_run == 1)) {
+					if (batch.empty())
 						continue;
-					nlohmann::json record;
-					const char *table = (const char *)0;
-					std::string deleteId;
-					try {
-						const std::string objtype = (*config)["objtype"];
-						if (objtype == "member") {
-							const std::string nwid = (*config)["nwid"];
-							const std::string id = (*config)["id"];
-							record["id"] = nwid + "-" + id;
-							record["controllerId"] = this->_myAddressStr;
-							record["networkId"] = nwid;
-							record["nodeId"] = id;
-							record["config"] = *config;
-							table = "Member";
-						} else if (objtype == "network") {
-							const std::string id = (*config)["id"];
-							record["id"] = id;
-							record["controllerId"] = this->_myAddressStr;
- 							record["config"] = *config;
-							table = "Network";
-						} else if (objtype == "trace") {
-							record = *config;
-							table = "RemoteTrace";
-						} else if (objtype == "_delete_network") {
-							deleteId = (*config)["id"];
-							table = "Network";
-						} else if (objtype == "_delete_member") {
-							deleteId = (*config)["nwid"];
-							deleteId.push_back('-');
-							const std::string tmp = (*config)["id"];
-							deleteId.append(tmp);
-							table = "Member";
+					const int64_t start = OSUtils::now();
+
+					// Upserts are grouped into one insert per table, deletes go one at a time
+					std::map< std::string,R::Array > upserts;
+					std::vector< std::pair<const char *,std::string> > deletes;
+					for(auto b=batch.begin();b!=batch.end();++b) {
+						nlohmann::json *const config = &(b->second);
+						nlohmann::json record;
+						const char *table = (const char *)0;
+						std::string deleteId;
+						try {
+							const std::string objtype = (*config)["objtype"];
+							if (objtype == "member") {
+								const std::string nwid = (*config)["nwid"];
+								const std::string id = (*config)["id"];
+								record["id"] = nwid + "-" + id;
+								record["controllerId"] = this->_myAddressStr;
+								record["networkId"] = nwid;
+								record["nodeId"] = id;
+								record["config"] = *config;
+								table = "Member";
+							} else if (objtype == "network") {
+								const std::string id = (*config)["id"];
+								record["id"] = id;
+								record["controllerId"] = this->_myAddressStr;
+								record["config"] = *config;
+								table = "Network";
+							} else if (objtype == "trace") {
+								record = *config;
+								table = "RemoteTrace";
+							} else if (objtype == "_delete_network") {
+								deleteId = (*config)["id"];
+								table = "Network";
+							} else if (objtype == "_delete_member") {
+								deleteId = (*config)["nwid"];
+								deleteId.push_back('-');
+								const std::string tmp = (*config)["id"];
+								deleteId.append(tmp);
+								table = "Member";
+							}
+						} catch (std::exception &e) {
+							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update record creation): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.what());
+							table = (const char *)0;
+						} catch (R::Error &e) {
+							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update record creation): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.message.c_str());
+							table = (const char *)0;
+						} catch ( ... ) {
+							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update record creation): unknown exception" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt());
+							table = (const char *)0;
 						}
-					} catch (std::exception &e) {
-						fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update record creation): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.what());
-						table = (const char *)0;
-					} catch (R::Error &e) {
-						fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update record creation): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.message.c_str());
-						table = (const char *)0;
-					} catch ( ... ) {
-						fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update record creation): unknown exception" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt());
-						table = (const char *)0;
+						if (!table)
+							continue;
+						if (deleteId.length() > 0)
+							deletes.push_back(std::pair<const char *,std::string>(table,deleteId));
+						else upserts[table].push_back(R::Datum::from_json(OSUtils::jsonDump(record,-1)));
 					}
-					delete config;
-					if (!table)
-						continue;
-					const std::string jdump(OSUtils::jsonDump(record,-1));
 
 					while (_run == 1) {
 						try {
 							if (!rdb)
 								rdb = R::connect(this->_host,this->_port,this->_auth);
 							if (rdb) {
-								if (deleteId.length() > 0) {
-									//printf("DELETE: %s" ZT_EOL_S,deleteId.c_str());
-									R::db(this->_db).table(table).get(deleteId).delete_().run(*rdb);
-								} else {
-									//printf("UPSERT: %s" ZT_EOL_S,record.dump().c_str());
-									R::db(this->_db).table(table).insert(R::Datum::from_json(jdump),R::optargs("conflict","update","return_changes",false)).run(*rdb);
-								}
+								for(auto u=upserts.begin();u!=upserts.end();++u)
+									R::db(this->_db).table(u->first).insert(u->second,R::optargs("conflict","update","return_changes",false)).run(*rdb);
+								for(auto d=deletes.begin();d!=deletes.end();++d)
+									R::db(this->_db).table(d->first).get(d->second).delete_().run(*rdb);
 								break;
 							} else {
 								fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): connect failed (will retry)" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt());
 								rdb.reset();
 							}
 						} catch (std::exception &e) {
-							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): %s [%s]" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.what(),jdump.c_str());
+							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): %s [batch of %u]" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.what(),(unsigned int)batch.size());
 							rdb.reset();
 						} catch (R::Error &e) {
-							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): %s [%s]" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.message.c_str(),jdump.c_str());
+							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): %s [batch of %u]" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.message.c_str(),(unsigned int)batch.size());
 							rdb.reset();
 						} catch ( ... ) {
-							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): unknown exception [%s]" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),jdump.c_str());
+							fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update): unknown exception [batch of %u]" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),(unsigned int)batch.size());
 							rdb.reset();
 						}
 						std::this_thread::sleep_for(std::chrono::milliseconds(250));
 					}
+
+					this->_commitQueue.done(batch);
+					++_commitBatches;
+					_commitRecords += (uint64_t)batch.size();
+					_commitLatency += (uint64_t)std::max((int64_t)0,OSUtils::now() - start);
 				}
 			} catch (std::exception &e) {
 				fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (insert/update outer loop): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.what());
@@ -256,6 +276,41 @@ RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,co
 		});
 	}
 
+	if (_instanceId.length() > 0) {
+		_memberStatusDbWatcher = std::thread([this]() {
+			try {
+				while (_run == 1) {
+					try {
+						std::unique_ptr<R::Connection> rdb(R::connect(this->_host,this->_port,this->_auth));
+						if (rdb) {
+							_memberStatusDbWatcherConnection = (void *)rdb.get();
+							auto cur = R::db(this->_db).table("MemberStatus",R::optargs("read_mode","outdated")).filter(R::row["controllerId"] == this->_myAddressStr).changes(R::optargs("squash",0.05)).run(*rdb);
+							while (cur.has_next()) {
+								if (_run != 1) break;
+								json tmp(json::parse(cur.next().as_json()));
+								try {
+									json &nv = tmp["new_val"];
+									if ((nv.is_object())&&(OSUtils::jsonString(nv["instanceId"],"") != this->_instanceId)) {
+										const std::string id(OSUtils::jsonString(nv["id"],""));
+										if (id.length() == 27) // 16 digit network ID - 10 digit member address
+											_controller->onMemberServedElsewhere(Utils::hexStrToU64(id.substr(0,16).c_str()),Utils::hexStrToU64(id.substr(17).c_str()),(int64_t)OSUtils::jsonInt(nv["ts"],0ULL));
+									}
+								} catch ( ... ) {} // ignore bad records
+							}
+						}
+					} catch (std::exception &e) {
+						fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (member status change stream): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.what());
+					} catch (R::Error &e) {
+						fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (member status change stream): %s" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt(),e.message.c_str());
+					} catch ( ... ) {
+						fprintf(stderr,"[%s] ERROR: %.10llx controller RethinkDB (member status change stream): unknown exception" ZT_EOL_S,_timestr(),(unsigned long long)_myAddress.toInt());
+					}
+					std::this_thread::sleep_for(std::chrono::milliseconds(250));
+				}
+			} catch ( ... ) {}
+		});
+	}
+
 	_onlineNotificationThread = std::thread([this]() {
 		int64_t lastUpdatedNetworkStatus = 0;
 		std::unordered_map< std::pair<uint64_t,uint64_t>,int64_t,_PairHasher > lastOnlineCumulative;
@@ -286,6 +341,10 @@ RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,co
 							tmpobj["id"] = tmp;
 							tmpobj["ts"] = i->second.first;
 							tmpobj["phy"] = i->second.second.toIpString(tmp2);
+							if (_instanceId.length() > 0) {
+								tmpobj["controllerId"] = this->_myAddressStr;
+								tmpobj["instanceId"] = this->_instanceId;
+							}
 							batch.emplace_back(tmpobj);
 							if (batch.size() >= 1024) {
 								R::db(this->_db).table("MemberStatus",R::optargs("read_mode","outdated")).insert(batch,R::optargs("conflict","update")).run(*rdb);
@@ -379,7 +438,14 @@ RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,co
 						}
 					}
 				}
-				controllerRecord["id"] = this->_myAddressStr.c_str();
+				if (this->_instanceId.length() > 0) {
+					// One record per instance, so each can be watched for liveness
+					controllerRecord["id"] = (this->_myAddressStr + "-" + this->_instanceId).c_str();
+					controllerRecord["controllerId"] = this->_myAddressStr.c_str();
+					controllerRecord["instanceId"] = this->_instanceId.c_str();
+				} else {
+					controllerRecord["id"] = this->_myAddressStr.c_str();
+				}
 				controllerRecord["publicIdentity"] = publicId;
 				//controllerRecord["secretIdentity"] = secretId;
 				if (hostname[0])
@@ -390,11 +456,27 @@ RethinkDB::RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,co
 				controllerRecord["vBuild"] = ZEROTIER_ONE_VERSION_BUILD;
 			}
 
+			uint64_t lastBatches = 0,lastRecords = 0,lastLatency = 0;
 			while (_run == 1) {
 				try {
 					if (!rdb)
 						rdb = R::connect(this->_host,this->_port,this->_auth);
 					if (rdb) {
+						// Commit pipeline metrics, batch size and latency are averages since the last heartbeat
+						const uint64_t batches = _commitBatches,records = _commitRecords,latency = _commitLatency;
+						const uint64_t db = batches - lastBatches;
+						controllerRecord["commitQueueDepth"] = (uint64_t)_commitQueue.size();
+						controllerRecord["commitBatchSize"] = (db) ? ((double)(records - lastRecords) / (double)db) : 0.0;
+						controllerRecord["commitLatency"] = (db) ? ((double)(latency - lastLatency) / (double)db) : 0.0;
+						controllerRecord["commitCoalesced"] = (uint64_t)_commitCoalesced;
+						{
+							std::lock_guard<std::mutex> l(_lastOnline_l);
+							controllerRecord["onlineQueueDepth"] = (uint64_t)_lastOnline.size();
+						}
+						lastBatches = batches;
+						lastRecords = records;
+						lastLatency = latency;
+
 						controllerRecord["lastAlive"] = OSUtils::now();
 						//printf("HEARTBEAT: %s" ZT_EOL_S,tmp);
 						R::db(this->_db).table("Controller",R::optargs("read_mode","outdated")).insert(controllerRecord,R::optargs("conflict","update")).run(*rdb);
@@ -419,8 +501,12 @@ RethinkDB::~RethinkDB()
 		((R::Connection *)_membersDbWatcherConnection)->close();
 	if (_networksDbWatcherConnection)
 		((R::Connection *)_networksDbWatcherConnection)->close();
+	if (_memberStatusDbWatcherConnection)
+		((R::Connection *)_memberStatusDbWatcherConnection)->close();
 	_membersDbWatcher.join();
 	_networksDbWatcher.join();
+	if (_memberStatusDbWatcher.joinable())
+		_memberStatusDbWatcher.join();
 	_heartbeatThread.join();
 	_onlineNotificationThread.join();
 }
@@ -451,11 +537,11 @@ void RethinkDB::save(nlohmann::json *orig,nlohmann::json &record)
 	if (orig) {
 		if (*orig != record) {
 			record["revision"] = OSUtils::jsonInt(record["revision"],0ULL) + 1;
-			_commitQueue.post(new nlohmann::json(record));
+			_commit(record);
 		}
 	} else {
 		record["revision"] = 1;
-		_commitQueue.post(new nlohmann::json(record));
+		_commit(record);
 	}
 }
 
@@ -464,23 +550,49 @@ void RethinkDB::eraseNetwork(const uint64_t networkId)
 	char tmp2[24];
 	waitForReady();
 	Utils::hex(networkId,tmp2);
-	json *tmp = new json();
-	(*tmp)["id"] = tmp2;
-	(*tmp)["objtype"] = "_delete_network"; // pseudo-type, tells thread to delete network
-	_commitQueue.post(tmp);
+	json tmp;
+	tmp["id"] = tmp2;
+	tmp["objtype"] = "_delete_network"; // pseudo-type, tells thread to delete network
+	_commit(tmp);
 }
 
 void RethinkDB::eraseMember(const uint64_t networkId,const uint64_t memberId)
 {
 	char tmp2[24];
-	json *tmp = new json();
+	json tmp;
 	waitForReady();
 	Utils::hex(networkId,tmp2);
-	(*tmp)["nwid"] = tmp2;
+	tmp["nwid"] = tmp2;
 	Utils::hex10(memberId,tmp2);
-	(*tmp)["id"] = tmp2;
-	(*tmp)["objtype"] = "_delete_member"; // pseudo-type, tells thread to delete network
-	_commitQueue.post(tmp);
+	tmp["id"] = tmp2;
+	tmp["objtype"] = "_delete_member"; // pseudo-type, tells thread to delete network
+	_commit(tmp);
+}
+
+void RethinkDB::_commit(const nlohmann::json &record)
+{
+	// Deletes share a key with the record they delete so whichever came last wins
+	std::string key;
+	try {
+		const std::string objtype(record.value("objtype",std::string()));
+		if ((objtype == "member")||(objtype == "_delete_member")) {
+			key = "Member:";
+			key.append(record.value("nwid",std::string()));
+			key.push_back('-');
+			key.append(record.value("id",std::string()));
+		} else if ((objtype == "network")||(objtype == "_delete_network")) {
+			key = "Network:";
+			key.append(record.value("id",std::string()));
+		}
+	} catch ( ... ) {}
+	if (key.empty()) {
+		// Traces and anything unexpected never coalesce
+		char tmp[32];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"_:%llu",(unsigned long long)_commitTraceCounter++);
+		key = tmp;
+	}
+	if (_commitQueue.post(key,record))
+		++_commitCoalesced;
 }
 
 void RethinkDB::nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress)
@@ -492,6 +604,14 @@ void RethinkDB::nodeIsOnline(const uint64_t networkId,const uint64_t memberId,co
 		i.second = physicalAddress;
 }
 
+void RethinkDB::commitStats(CommitStats &cs)
+{
+	cs.commits = _commitBatches;
+	cs.records = _commitRecords;
+	cs.microseconds = _commitLatency * 1000ULL; // kept in ms for the heartbeat
+	cs.backlog = (uint64_t)_commitQueue.size();
+}
+
 } // namespace ZeroTier
 
 #endif // ZT_CONTROLLER_USE_RETHINKDB
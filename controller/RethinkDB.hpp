@@ -23,8 +23,19 @@
 
 #include "DB.hpp"
 
+#include "../osdep/CoalescingQueue.hpp"
+
 #define ZT_CONTROLLER_RETHINKDB_COMMIT_THREADS 4
 
+// Maximum records written by one insert query
+#define ZT_CONTROLLER_RETHINKDB_COMMIT_BATCH_MAX 256
+
+// Time in ms commit threads wait for updates to coalesce unless a full batch is ready
+#define ZT_CONTROLLER_RETHINKDB_COMMIT_WINDOW 50
+
+// Saves block once this many records are waiting to be committed
+#define ZT_CONTROLLER_RETHINKDB_COMMIT_QUEUE_MAX 65536
+
 namespace ZeroTier
 {
 
@@ -37,7 +48,10 @@ namespace ZeroTier
 class RethinkDB : public DB
 {
 public:
-	RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path);
+	/**
+	 * @param instanceId Instance ID if several controllers share this identity and database, otherwise empty
+	 */
+	RethinkDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path,const std::string &instanceId);
 	virtual ~RethinkDB();
 
 	virtual bool waitForReady();
@@ -46,6 +60,7 @@ public:
 	virtual void eraseNetwork(const uint64_t networkId);
 	virtual void eraseMember(const uint64_t networkId,const uint64_t memberId);
 	virtual void nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress);
+	virtual void commitStats(CommitStats &cs);
 
 protected:
 	struct _PairHasher
@@ -57,14 +72,24 @@ protected:
 	std::string _db;
 	std::string _auth;
 	int _port;
+	const std::string _instanceId;
 
 	void *_networksDbWatcherConnection;
 	void *_membersDbWatcherConnection;
 	std::thread _networksDbWatcher;
 	std::thread _membersDbWatcher;
 
-	BlockingQueue< nlohmann::json * > _commitQueue;
+	// Member status written by other instances sharing this controller's identity
+	void *_memberStatusDbWatcherConnection;
+	std::thread _memberStatusDbWatcher;
+
+	void _commit(const nlohmann::json &record);
+
+	// Keyed by table and record ID so later updates to a record replace earlier ones still waiting
+	CoalescingQueue< std::string,nlohmann::json > _commitQueue;
 	std::thread _commitThread[ZT_CONTROLLER_RETHINKDB_COMMIT_THREADS];
+	std::atomic<uint64_t> _commitBatches,_commitRecords,_commitCoalesced,_commitLatency; // latency is total ms over all batches
+	std::atomic<uint64_t> _commitTraceCounter;
 
 	std::unordered_map< std::pair<uint64_t,uint64_t>,std::pair<int64_t,InetAddress>,_PairHasher > _lastOnline;
 	mutable std::mutex _lastOnline_l;
@@ -0,0 +1,252 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "TraceLog.hpp"
+
+#include "../node/Constants.hpp"
+#include "../node/Utils.hpp"
+#include "../node/Packet.hpp"
+#include "../osdep/OSUtils.hpp"
+
+#define ZT_TRACELOG_BLOCK_HEADER_SIZE 8
+#define ZT_TRACELOG_SUFFIX ".ztlog"
+
+namespace ZeroTier
+{
+
+static inline void _tlPut32(uint8_t *p,const uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static inline uint32_t _tlGet32(const uint8_t *p)
+{
+	return (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+// Segment names in time order with their start times
+static void _tlSegments(const std::string &path,std::vector< std::pair<int64_t,std::string> > &segments)
+{
+	const std::vector<std::string> files(OSUtils::listDirectory(path.c_str()));
+	for(std::vector<std::string>::const_iterator f(files.begin());f!=files.end();++f) {
+		if ((f->length() == (16 + strlen(ZT_TRACELOG_SUFFIX)))&&(f->substr(16) == ZT_TRACELOG_SUFFIX))
+			segments.push_back(std::pair<int64_t,std::string>((int64_t)Utils::hexStrToU64(f->substr(0,16).c_str()),*f));
+	}
+	std::sort(segments.begin(),segments.end());
+}
+
+TraceLog::TraceLog(const std::string &path,const uint64_t maxBytes,const int64_t maxAge) :
+	_path(path),
+	_maxBytes(maxBytes),
+	_maxAge(maxAge),
+	_pendingSince(0),
+	_dropped(0),
+	_segment((FILE *)0),
+	_segmentStart(0),
+	_segmentSize(0),
+	_run(true)
+{
+	_thread = std::thread([this]() { _main(); });
+}
+
+TraceLog::~TraceLog()
+{
+	{
+		std::lock_guard<std::mutex> l(_l);
+		_run = false;
+	}
+	_c.notify_all();
+	_thread.join();
+	if (_segment)
+		fclose(_segment);
+}
+
+void TraceLog::append(const nlohmann::json &record)
+{
+	const std::string line(OSUtils::jsonDump(record,-1));
+	std::lock_guard<std::mutex> l(_l);
+	if ((_pending.length() + line.length()) >= ZT_CONTROLLER_TRACELOG_MAX_PENDING) {
+		++_dropped;
+		return;
+	}
+	if (_pending.empty())
+		_pendingSince = OSUtils::now();
+	_pending.append(line);
+	_pending.push_back('\n');
+	if (_pending.length() >= ZT_CONTROLLER_TRACELOG_BLOCK_SIZE)
+		_c.notify_one();
+}
+
+uint64_t TraceLog::dropped()
+{
+	std::lock_guard<std::mutex> l(_l);
+	return _dropped;
+}
+
+bool TraceLog::read(const char *path,std::vector<nlohmann::json> &records)
+{
+	FILE *f = fopen(path,"rb");
+	if (!f)
+		return false;
+
+	bool ok = true;
+	std::vector<char> stored,raw;
+	uint8_t h[ZT_TRACELOG_BLOCK_HEADER_SIZE];
+	for(;;) {
+		const std::size_t n = fread(h,1,sizeof(h),f);
+		if (n == 0)
+			break;
+		const uint32_t storedLen = _tlGet32(h);
+		const uint32_t rawLen = _tlGet32(h + 4);
+		if ((n != sizeof(h))||(!storedLen)||(storedLen > rawLen)||(rawLen > ZT_CONTROLLER_TRACELOG_MAX_PENDING)) {
+			ok = false;
+			break;
+		}
+		stored.resize(storedLen);
+		if (fread(stored.data(),1,storedLen,f) != storedLen) {
+			ok = false;
+			break;
+		}
+		if (storedLen < rawLen) {
+			raw.resize(rawLen);
+			if (Packet::uncompressBlock(stored.data(),(int)storedLen,raw.data(),(int)rawLen) != (int)rawLen) {
+				ok = false;
+				break;
+			}
+		} else {
+			raw.swap(stored);
+		}
+
+		const char *p = raw.data();
+		const char *const eof = p + rawLen;
+		while (p < eof) {
+			const char *e = (const char *)memchr(p,'\n',(std::size_t)(eof - p));
+			if (!e)
+				e = eof;
+			if (e > p) {
+				try {
+					records.push_back(OSUtils::jsonParse(std::string(p,(std::size_t)(e - p))));
+				} catch ( ... ) {
+					ok = false;
+				}
+			}
+			p = e + 1;
+		}
+	}
+
+	fclose(f);
+	return ok;
+}
+
+void TraceLog::_main()
+{
+	std::string block;
+	std::unique_lock<std::mutex> l(_l);
+	for(;;) {
+		while ((_run)&&((_pending.empty())||((_pending.length() < ZT_CONTROLLER_TRACELOG_BLOCK_SIZE)&&((OSUtils::now() - _pendingSince) < ZT_CONTROLLER_TRACELOG_FLUSH_INTERVAL))))
+			_c.wait_for(l,std::chrono::milliseconds((_pending.empty()) ? ZT_CONTROLLER_TRACELOG_FLUSH_INTERVAL : 100));
+		if (_pending.empty()) {
+			if (!_run)
+				break;
+			continue;
+		}
+
+		block.clear();
+		block.swap(_pending);
+		l.unlock();
+		_write(block,OSUtils::now());
+		l.lock();
+	}
+}
+
+void TraceLog::_write(const std::string &block,const int64_t now)
+{
+	if ((_segment)&&(((now - _segmentStart) >= ZT_CONTROLLER_TRACELOG_SEGMENT_PERIOD)||(_segmentSize >= ZT_CONTROLLER_TRACELOG_SEGMENT_SIZE))) {
+		fclose(_segment);
+		_segment = (FILE *)0;
+	}
+	if (!_segment) {
+		char fn[64];
+		OSUtils::ztsnprintf(fn,sizeof(fn),"%.16llx" ZT_TRACELOG_SUFFIX,(unsigned long long)now);
+		const std::string sp(_path + ZT_PATH_SEPARATOR_S + fn);
+		OSUtils::mkdir(_path.c_str());
+		_segment = fopen(sp.c_str(),"ab");
+		if (!_segment) {
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,sp.c_str());
+			return;
+		}
+		_segmentStart = now;
+		_segmentSize = 0;
+		_expire(now);
+	}
+
+	const int rawLen = (int)block.length();
+	const int maxStored = rawLen + (rawLen / 255) + 16;
+	std::vector<char> buf((std::size_t)(ZT_TRACELOG_BLOCK_HEADER_SIZE + maxStored));
+	int storedLen = Packet::compressBlock(block.data(),rawLen,buf.data() + ZT_TRACELOG_BLOCK_HEADER_SIZE,maxStored);
+	if ((storedLen <= 0)||(storedLen >= rawLen)) {
+		memcpy(buf.data() + ZT_TRACELOG_BLOCK_HEADER_SIZE,block.data(),(std::size_t)rawLen);
+		storedLen = rawLen;
+	}
+	_tlPut32(reinterpret_cast<uint8_t *>(buf.data()),(uint32_t)storedLen);
+	_tlPut32(reinterpret_cast<uint8_t *>(buf.data()) + 4,(uint32_t)rawLen);
+
+	const std::size_t len = (std::size_t)(ZT_TRACELOG_BLOCK_HEADER_SIZE + storedLen);
+	if ((fwrite(buf.data(),1,len,_segment) != len)||(fflush(_segment) != 0)) {
+		// Leave a damaged segment behind rather than append after a partial block
+		fclose(_segment);
+		_segment = (FILE *)0;
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_path.c_str());
+		return;
+	}
+	_segmentSize += (uint64_t)len;
+}
+
+void TraceLog::_expire(const int64_t now)
+{
+	std::vector< std::pair<int64_t,std::string> > segments;
+	_tlSegments(_path,segments);
+	if (segments.size() < 2)
+		return;
+
+	std::vector<uint64_t> sizes;
+	uint64_t total = 0;
+	for(std::vector< std::pair<int64_t,std::string> >::const_iterator s(segments.begin());s!=segments.end();++s) {
+		const int64_t sz = OSUtils::getFileSize((_path + ZT_PATH_SEPARATOR_S + s->second).c_str());
+		sizes.push_back((sz > 0) ? (uint64_t)sz : 0);
+		total += sizes.back();
+	}
+
+	// A segment's last event is older than the next segment's start, and the newest segment is never deleted
+	for(unsigned long i=0;i<(segments.size() - 1);++i) {
+		if ((total <= _maxBytes)&&((now - segments[i + 1].first) <= _maxAge))
+			break;
+		OSUtils::rm((_path + ZT_PATH_SEPARATOR_S + segments[i].second).c_str());
+		total -= sizes[i];
+	}
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,124 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_CONTROLLER_TRACELOG_HPP
+#define ZT_CONTROLLER_TRACELOG_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "../ext/json/json.hpp"
+
+// Buffered records are written once they reach this many bytes or have waited this many ms
+#define ZT_CONTROLLER_TRACELOG_BLOCK_SIZE 262144
+#define ZT_CONTROLLER_TRACELOG_FLUSH_INTERVAL 1000
+
+// Records arriving while this many bytes are waiting to be written are dropped
+#define ZT_CONTROLLER_TRACELOG_MAX_PENDING 16777216
+
+// A new segment is started after this many ms or once the current one is this big
+#define ZT_CONTROLLER_TRACELOG_SEGMENT_PERIOD 3600000
+#define ZT_CONTROLLER_TRACELOG_SEGMENT_SIZE 67108864
+
+// Default retention, oldest segments are deleted beyond either limit
+#define ZT_CONTROLLER_TRACELOG_DEFAULT_MAX_BYTES 1073741824ULL
+#define ZT_CONTROLLER_TRACELOG_DEFAULT_MAX_AGE 604800000LL
+
+namespace ZeroTier
+{
+
+/**
+ * Append-only log of remote trace events
+ *
+ * Events are kept as one JSON object per line, buffered in memory and
+ * written by a thread of its own as LZ4 compressed blocks, so ingesting a
+ * busy network's traces never waits on the disk and costs one write per
+ * block instead of a file per event. Each block is a 4-byte stored length
+ * and a 4-byte original length (both big-endian) followed by the data,
+ * which is stored as is if it didn't compress. Segments are named after
+ * the time in ms they were started, as 16 hex digits plus ".ztlog", so
+ * they sort by time, and the oldest are deleted once the log exceeds its
+ * size or age limit. Records are dropped rather than queued without limit
+ * if the disk can't keep up.
+ */
+class TraceLog
+{
+public:
+	/**
+	 * @param path Directory for segments (created on first write)
+	 * @param maxBytes Total size of segments to keep
+	 * @param maxAge Maximum age in ms of the newest event in a segment that's kept
+	 */
+	TraceLog(const std::string &path,const uint64_t maxBytes = ZT_CONTROLLER_TRACELOG_DEFAULT_MAX_BYTES,const int64_t maxAge = ZT_CONTROLLER_TRACELOG_DEFAULT_MAX_AGE);
+
+	/**
+	 * Writes anything still buffered
+	 */
+	~TraceLog();
+
+	/**
+	 * @param record Trace event
+	 */
+	void append(const nlohmann::json &record);
+
+	/**
+	 * @return Records dropped because too much was waiting to be written
+	 */
+	uint64_t dropped();
+
+	/**
+	 * Read a segment
+	 *
+	 * @param path Segment file
+	 * @param records Result parameter, events are appended
+	 * @return False if the segment could not be opened or ends in a damaged or incomplete block
+	 */
+	static bool read(const char *path,std::vector<nlohmann::json> &records);
+
+private:
+	void _main();
+	void _write(const std::string &block,const int64_t now);
+	void _expire(const int64_t now);
+
+	const std::string _path;
+	const uint64_t _maxBytes;
+	const int64_t _maxAge;
+
+	std::string _pending;
+	int64_t _pendingSince;
+	uint64_t _dropped;
+
+	FILE *_segment;
+	int64_t _segmentStart;
+	uint64_t _segmentSize;
+
+	bool _run;
+	std::mutex _l;
+	std::condition_variable _c;
+	std::thread _thread;
+};
+
+} // namespace ZeroTier
+
+#endif
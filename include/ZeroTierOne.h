@@ -122,6 +122,19 @@ extern "C" {
  */
 #define ZT_MAX_PHYSMTU (ZT_MAX_PHYSPAYLOAD + ZT_MAX_HEADROOM)
 
+/**
+ * Size of a frame buffer, which is the largest packet the core handles
+ */
+#define ZT_FRAME_BUFFER_SIZE (7 * ZT_DEFAULT_PHYSMTU)
+
+/**
+ * Bytes in front of the frame in a new frame buffer
+ *
+ * This is exactly the header of a packet carrying a unicast frame, so the
+ * core can build that packet around the frame where it lies.
+ */
+#define ZT_FRAME_BUFFER_HEADROOM 38
+
 /**
  * Maximum size of a remote trace message's serialized Dictionary
  */
@@ -202,6 +215,11 @@ extern "C" {
  */
 #define ZT_PATH_LINK_QUALITY_MAX 0xff
 
+/**
+ * Flag OR'd into the TTL of a wire packet that must be sent with the IP don't fragment bit (callbacks version 3+)
+ */
+#define ZT_WIRE_PACKET_DONT_FRAGMENT 0x10000
+
 /**
  * Packet characteristics flag: packet direction, 1 if inbound 0 if outbound
  */
@@ -590,6 +608,39 @@ typedef struct
 	unsigned int length;
 } ZT_UserMessage;
 
+/**
+ * How this node's NAT, if any, maps its UDP sockets to external ports
+ *
+ * This is worked out from the external addresses that peers report seeing.
+ */
+enum ZT_NatType
+{
+	/**
+	 * Not known yet (no global IPv4 address reported by an upstream)
+	 */
+	ZT_NAT_TYPE_UNKNOWN = 0,
+
+	/**
+	 * Each socket has one external address and port (no NAT or a "cone" NAT)
+	 */
+	ZT_NAT_TYPE_CONE = 1,
+
+	/**
+	 * Symmetric NAT that keeps the same external port on all its IPs
+	 */
+	ZT_NAT_TYPE_PORT_PRESERVING = 2,
+
+	/**
+	 * Symmetric NAT that hands out external ports in sequence
+	 */
+	ZT_NAT_TYPE_SEQUENTIAL = 3,
+
+	/**
+	 * Symmetric NAT with no pattern to its external ports
+	 */
+	ZT_NAT_TYPE_RANDOM = 4
+};
+
 /**
  * Current node status
  */
@@ -618,262 +669,1307 @@ typedef struct
 	 * True if some kind of connectivity appears available
 	 */
 	int online;
+
+	/**
+	 * Type of NAT this node appears to be behind
+	 */
+	enum ZT_NatType natType;
 } ZT_NodeStatus;
 
 /**
- * Virtual network status codes
+ * Statistics for the slab allocator behind one type of object
  */
-enum ZT_VirtualNetworkStatus
+typedef struct
 {
 	/**
-	 * Waiting for network configuration (also means revision == 0)
+	 * Objects currently allocated
 	 */
-	ZT_NETWORK_STATUS_REQUESTING_CONFIGURATION = 0,
+	uint64_t objects;
 
 	/**
-	 * Configuration received and we are authorized
+	 * Objects the slabs currently held could hold
 	 */
-	ZT_NETWORK_STATUS_OK = 1,
+	uint64_t capacity;
 
 	/**
-	 * Netconf master told us 'nope'
+	 * Bytes currently held in slabs
 	 */
-	ZT_NETWORK_STATUS_ACCESS_DENIED = 2,
+	uint64_t bytes;
 
 	/**
-	 * Netconf master exists, but this virtual network does not
+	 * Slabs given back to the system since startup
 	 */
-	ZT_NETWORK_STATUS_NOT_FOUND = 3,
+	uint64_t slabsReleased;
+} ZT_ObjectPoolStats;
 
+/**
+ * Huge pages used for large core tables and pools (see ZT_Node_setHugePages)
+ */
+enum ZT_HugePageMode
+{
 	/**
-	 * Initialization of network failed or other internal error
+	 * Use malloc() for everything (default)
 	 */
-	ZT_NETWORK_STATUS_PORT_ERROR = 4,
+	ZT_HUGE_PAGES_OFF = 0,
 
 	/**
-	 * ZeroTier core version too old
+	 * Ask for transparent huge pages with madvise()
 	 */
-	ZT_NETWORK_STATUS_CLIENT_TOO_OLD = 5
+	ZT_HUGE_PAGES_TRANSPARENT = 1,
+
+	/**
+	 * Use explicit huge pages reserved in vm.nr_hugepages, then transparent ones once those run out
+	 */
+	ZT_HUGE_PAGES_EXPLICIT = 2
 };
 
 /**
- * Virtual network type codes
+ * Statistics for huge page backed allocations
  */
-enum ZT_VirtualNetworkType
+typedef struct
 {
 	/**
-	 * Private networks are authorized via certificates of membership
+	 * Current mode
 	 */
-	ZT_NETWORK_TYPE_PRIVATE = 0,
+	enum ZT_HugePageMode mode;
 
 	/**
-	 * Public networks have no access control -- they'll always be AUTHORIZED
+	 * Bytes mapped in explicit huge pages
 	 */
-	ZT_NETWORK_TYPE_PUBLIC = 1
-};
+	uint64_t explicitBytes;
+
+	/**
+	 * Bytes mapped with transparent huge pages requested (the kernel may not back all of them with huge pages)
+	 */
+	uint64_t transparentBytes;
+
+	/**
+	 * Bytes of the above currently allocated, the rest being kept for reuse
+	 */
+	uint64_t allocatedBytes;
+
+	/**
+	 * Allocations that used malloc() because no huge page region could be mapped
+	 */
+	uint64_t fallbacks;
+} ZT_HugePageStats;
 
 /**
- * The type of a virtual network rules table entry
+ * Approximate memory held by a node's major tables and queues
  *
- * These must be from 0 to 63 since the most significant two bits of each
- * rule type are NOT (MSB) and AND/OR.
- *
- * Each rule is composed of zero or more MATCHes followed by an ACTION.
- * An ACTION with no MATCHes is always taken.
+ * Byte counts include the table entries themselves as well as the objects
+ * they point to, but not allocator overhead. Counts for networks are totals
+ * across all joined networks (see ZT_Node_networkMemoryUsage for one).
  */
-enum ZT_VirtualNetworkRuleType
+typedef struct
 {
-	// 0 to 15 reserved for actions
-
 	/**
-	 * Drop frame
+	 * Number of peers currently known
 	 */
-	ZT_NETWORK_RULE_ACTION_DROP = 0,
+	uint64_t peers;
 
 	/**
-	 * Accept and pass frame
+	 * Number of physical paths currently known (shared between peers)
 	 */
-	ZT_NETWORK_RULE_ACTION_ACCEPT = 1,
+	uint64_t paths;
 
 	/**
-	 * Forward a copy of this frame to an observer (by ZT address)
+	 * Total bytes used by peers and the peer table
 	 */
-	ZT_NETWORK_RULE_ACTION_TEE = 2,
+	uint64_t peerBytes;
 
 	/**
-	 * Exactly like TEE but mandates ACKs from observer
+	 * Total bytes used by paths and the path table
 	 */
-	ZT_NETWORK_RULE_ACTION_WATCH = 3,
+	uint64_t pathBytes;
 
 	/**
-	 * Drop and redirect this frame to another node (by ZT address)
+	 * Average bytes per peer, or 0 if there are none
 	 */
-	ZT_NETWORK_RULE_ACTION_REDIRECT = 4,
+	unsigned int bytesPerPeer;
 
 	/**
-	 * Stop evaluating rule set (drops unless there are capabilities, etc.)
+	 * Average bytes per path, or 0 if there are none
 	 */
-	ZT_NETWORK_RULE_ACTION_BREAK = 5,
+	unsigned int bytesPerPath;
 
 	/**
-	 * Maximum ID for an ACTION, anything higher is a MATCH
+	 * Peers dropped from memory to stay under the limit (see ZT_Node_setMemoryLimits)
 	 */
-	ZT_NETWORK_RULE_ACTION__MAX_ID = 15,
+	uint64_t peersEvicted;
 
-	// 16 to 63 reserved for match criteria
+	/**
+	 * Idle peers held as compact cold records (see ZT_Node_setColdPeerTimeout)
+	 */
+	uint64_t coldPeers;
 
-	ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS = 24,
-	ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS = 25,
-	ZT_NETWORK_RULE_MATCH_VLAN_ID = 26,
-	ZT_NETWORK_RULE_MATCH_VLAN_PCP = 27,
-	ZT_NETWORK_RULE_MATCH_VLAN_DEI = 28,
-	ZT_NETWORK_RULE_MATCH_MAC_SOURCE = 29,
-	ZT_NETWORK_RULE_MATCH_MAC_DEST = 30,
-	ZT_NETWORK_RULE_MATCH_IPV4_SOURCE = 31,
-	ZT_NETWORK_RULE_MATCH_IPV4_DEST = 32,
-	ZT_NETWORK_RULE_MATCH_IPV6_SOURCE = 33,
-	ZT_NETWORK_RULE_MATCH_IPV6_DEST = 34,
-	ZT_NETWORK_RULE_MATCH_IP_TOS = 35,
-	ZT_NETWORK_RULE_MATCH_IP_PROTOCOL = 36,
-	ZT_NETWORK_RULE_MATCH_ETHERTYPE = 37,
-	ZT_NETWORK_RULE_MATCH_ICMP = 38,
-	ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE = 39,
-	ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE = 40,
-	ZT_NETWORK_RULE_MATCH_CHARACTERISTICS = 41,
-	ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE = 42,
-	ZT_NETWORK_RULE_MATCH_RANDOM = 43,
-	ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE = 44,
-	ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND = 45,
-	ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR = 46,
-	ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR = 47,
-	ZT_NETWORK_RULE_MATCH_TAGS_EQUAL = 48,
-	ZT_NETWORK_RULE_MATCH_TAG_SENDER = 49,
-	ZT_NETWORK_RULE_MATCH_TAG_RECEIVER = 50,
-	ZT_NETWORK_RULE_MATCH_INTEGER_RANGE = 51,
+	/**
+	 * Total bytes used by cold records and their tables
+	 */
+	uint64_t coldPeerBytes;
 
 	/**
-	 * Maximum ID allowed for a MATCH entry in the rules table
+	 * Peers rebuilt from cold records since startup
 	 */
-	ZT_NETWORK_RULE_MATCH__MAX_ID = 63
-};
+	uint64_t peersPromoted;
 
-/**
- * Network flow rule
- *
- * Rules are stored in a table in which one or more match entries is followed
- * by an action. If more than one match precedes an action, the rule is
- * the AND of all matches. An action with no match is always taken since it
- * matches anything. If nothing matches, the default action is DROP.
- *
- * This is designed to be a more memory-efficient way of storing rules than
- * a wide table, yet still fast and simple to access in code.
- */
-typedef struct
-{
 	/**
-	 * Type and flags
-	 *
-	 * Bits are: NOTTTTTT
-	 *
-	 * N - If true, sense of match is inverted (no effect on actions)
-	 * O - If true, result is ORed with previous instead of ANDed (no effect on actions)
-	 * T - Rule or action type
-	 *
-	 * AND with 0x3f to get type, 0x80 to get NOT bit, and 0x40 to get OR bit.
+	 * Allocator behind peers (shared by all nodes in this process)
 	 */
-	uint8_t t;
+	ZT_ObjectPoolStats peerPool;
 
 	/**
-	 * Union containing the value of this rule -- which field is used depends on 't'
+	 * Allocator behind paths (shared by all nodes in this process)
 	 */
-	union {
-		/**
-		 * IPv6 address in big-endian / network byte order and netmask bits
-		 */
-		struct {
-			uint8_t ip[16];
-			uint8_t mask;
-		} ipv6;
+	ZT_ObjectPoolStats pathPool;
 
-		/**
-		 * IPv4 address in big-endian / network byte order
-		 */
-		struct {
-			uint32_t ip;
-			uint8_t mask;
-		} ipv4;
+	/**
+	 * Packets waiting in the RX queue for fragments or WHOIS replies
+	 */
+	uint64_t rxQueueEntries;
 
-		/**
-		 * Integer range match in packet payload
-		 *
-		 * This allows matching of ranges of integers up to 64 bits wide where
-		 * the range is +/- INT32_MAX. It's packed this way so it fits in 16
-		 * bytes and doesn't enlarge the overall size of this union.
-		 */
-		struct {
-			uint64_t start; // integer range start
-			uint32_t end; // end of integer range (relative to start, inclusive, 0 for equality w/start)
-			uint16_t idx; // index in packet of integer
-			uint8_t format; // bits in integer (range 1-64, ((format&63)+1)) and endianness (MSB 1 for little, 0 for big)
-		} intRange;
+	/**
+	 * Bytes held by RX queue entries allocated so far (entries are never freed)
+	 */
+	uint64_t rxQueueBytes;
 
-		/**
-		 * Packet characteristic flags being matched
-		 */
-		uint64_t characteristics;
+	/**
+	 * Packets waiting in the TX queue for WHOIS replies
+	 */
+	uint64_t txQueueEntries;
 
-		/**
-		 * IP port range -- start-end inclusive -- host byte order
-		 */
-		uint16_t port[2];
+	/**
+	 * Bytes held by the TX queue (fixed size)
+	 */
+	uint64_t txQueueBytes;
 
-		/**
-		 * 40-bit ZeroTier address (in least significant bits, host byte order)
-		 */
-		uint64_t zt;
+	/**
+	 * Multicast groups with known members or pending sends
+	 */
+	uint64_t multicastGroups;
 
-		/**
-		 * 0 = never, UINT32_MAX = always
-		 */
-		uint32_t randomProbability;
+	/**
+	 * Members of all multicast groups
+	 */
+	uint64_t multicastMembers;
 
-		/**
-		 * 48-bit Ethernet MAC address in big-endian order
-		 */
-		uint8_t mac[6];
+	/**
+	 * Total bytes used by multicast groups, members and pending sends
+	 */
+	uint64_t multicastBytes;
 
-		/**
-		 * VLAN ID in host byte order
-		 */
-		uint16_t vlanId;
+	/**
+	 * Multicast members forgotten to stay under the limit (see ZT_Node_setMemoryLimits)
+	 */
+	uint64_t multicastMembersEvicted;
 
-		/**
-		 * VLAN PCP (least significant 3 bits)
-		 */
-		uint8_t vlanPcp;
+	/**
+	 * Networks joined
+	 */
+	uint64_t networks;
 
-		/**
-		 * VLAN DEI (single bit / boolean)
-		 */
-		uint8_t vlanDei;
+	/**
+	 * Members in all networks' membership tables
+	 */
+	uint64_t members;
 
-		/**
-		 * Ethernet type in host byte order
-		 */
-		uint16_t etherType;
+	/**
+	 * Total bytes used by membership tables and their credentials
+	 */
+	uint64_t memberBytes;
 
-		/**
-		 * IP protocol
-		 */
-		uint8_t ipProtocol;
+	/**
+	 * Routes to MACs behind remote bridges in all networks
+	 */
+	uint64_t bridgeRoutes;
 
-		/**
-		 * IP type of service a.k.a. DSCP field
-		 */
-		struct {
-			uint8_t mask;
-			uint8_t value[2];
-		} ipTos;
+	/**
+	 * Total bytes used by bridge route tables
+	 */
+	uint64_t bridgeRouteBytes;
+
+	/**
+	 * Total bytes used by networks, including memberships and bridge routes
+	 */
+	uint64_t networkBytes;
+
+	/**
+	 * Huge pages behind tables and pools (shared by all nodes in this process)
+	 */
+	ZT_HugePageStats hugePages;
+} ZT_MemoryUsage;
+
+/**
+ * Approximate memory held by one network
+ */
+typedef struct
+{
+	/**
+	 * 64-bit network ID
+	 */
+	uint64_t nwid;
+
+	/**
+	 * Members in this network's membership table
+	 */
+	uint64_t members;
+
+	/**
+	 * Bytes used by the membership table and members' credentials
+	 */
+	uint64_t memberBytes;
+
+	/**
+	 * Flows in the flow verdict cache
+	 */
+	uint64_t flows;
+
+	/**
+	 * Bytes used by the flow verdict cache and compiled capabilities
+	 */
+	uint64_t flowBytes;
+
+	/**
+	 * Routes to MACs behind remote bridges
+	 */
+	uint64_t bridgeRoutes;
+
+	/**
+	 * Bytes used by the bridge route table
+	 */
+	uint64_t bridgeRouteBytes;
+
+	/**
+	 * Multicast groups we belong to or have seen behind us
+	 */
+	uint64_t multicastGroups;
+
+	/**
+	 * Total bytes used by this network, including all of the above
+	 */
+	uint64_t bytes;
+} ZT_NetworkMemoryUsage;
+
+/**
+ * Number of verb slots in per-verb packet counters (verbs are 5 bits)
+ */
+#define ZT_METRICS_VERB_COUNT 32
+
+/**
+ * Maximum number of networks with their own traffic counters
+ *
+ * Traffic on networks beyond this many is added to an entry with network ID 0.
+ */
+#define ZT_METRICS_MAX_NETWORKS 64
+
+/**
+ * Number of buckets in per-verb decode latency histograms
+ *
+ * Bucket 0 counts packets handled in under 1 microsecond and bucket N for
+ * N > 0 those that took at least 2^(N-1) and under 2^N microseconds. The
+ * last bucket also counts everything slower.
+ */
+#define ZT_METRICS_LATENCY_BUCKETS 16
+
+/**
+ * Reasons counted in ZT_Metrics drops[]
+ */
+enum ZT_MetricsDropReason
+{
+	/**
+	 * Packet failed MAC check or came from an untrusted path claiming to be trusted
+	 */
+	ZT_METRICS_DROP_MAC_FAILED = 0,
+
+	/**
+	 * Packet was malformed or could not be decompressed
+	 */
+	ZT_METRICS_DROP_INVALID = 1,
+
+	/**
+	 * HELLO was refused (bad identity, address collision, rate limit, etc.)
+	 */
+	ZT_METRICS_DROP_HELLO = 2,
+
+	/**
+	 * Packet referenced a network the sender is not a member of
+	 */
+	ZT_METRICS_DROP_NETWORK_ACCESS_DENIED = 3,
+
+	/**
+	 * Incoming frame refused by bridging or multicast settings
+	 */
+	ZT_METRICS_DROP_FRAME_IN = 4,
+
+	/**
+	 * Outgoing frame refused by rules, bridging or multicast settings
+	 */
+	ZT_METRICS_DROP_FRAME_OUT = 5,
+
+	/**
+	 * Packet or fragment for another node exceeded the relay hop limit
+	 */
+	ZT_METRICS_DROP_RELAY_HOPS = 6,
+
+	/**
+	 * Incomplete fragmented packet evicted from or timed out of the reassembly queue
+	 */
+	ZT_METRICS_DROP_RX_QUEUE = 7,
+
+	/**
+	 * Outgoing frame dropped by the egress scheduler because its queue was full or it waited too long
+	 */
+	ZT_METRICS_DROP_EGRESS_QUEUE = 8,
+
+	/**
+	 * Outgoing frame or relayed packet over a network or member rate limit by more than it may be held
+	 */
+	ZT_METRICS_DROP_RATE_LIMIT = 9,
+
+	/**
+	 * Work for an unknown peer shed because it was over the admission budget (see ZT_Node_setAdmissionBudget())
+	 */
+	ZT_METRICS_DROP_OVERLOAD = 10
+};
+
+/**
+ * Number of ZT_MetricsDropReason values
+ */
+#define ZT_METRICS_DROP_REASON_COUNT 11
+
+/**
+ * Traffic counters for one network
+ */
+typedef struct
+{
+	/**
+	 * Network ID or 0 for the overflow entry
+	 */
+	uint64_t networkId;
+
+	/**
+	 * Frames delivered to the local tap and their payload bytes
+	 */
+	uint64_t framesIn,bytesIn;
+
+	/**
+	 * Frames received from the local tap and their payload bytes
+	 */
+	uint64_t framesOut,bytesOut;
+} ZT_NetworkMetrics;
+
+/**
+ * Counters and gauges for monitoring
+ *
+ * Counters are kept per thread and summed when this is filled, so they
+ * only ever increase while the process runs. They are shared by every
+ * node in the same process. Gauges describe the node that was queried.
+ */
+typedef struct
+{
+	/**
+	 * Authenticated packets received and their sizes, indexed by verb
+	 */
+	uint64_t packetsIn[ZT_METRICS_VERB_COUNT];
+	uint64_t bytesIn[ZT_METRICS_VERB_COUNT];
+
+	/**
+	 * Packets encrypted for sending and their sizes, indexed by verb
+	 */
+	uint64_t packetsOut[ZT_METRICS_VERB_COUNT];
+	uint64_t bytesOut[ZT_METRICS_VERB_COUNT];
+
+	/**
+	 * Drops indexed by ZT_MetricsDropReason
+	 */
+	uint64_t drops[ZT_METRICS_DROP_REASON_COUNT];
+
+	/**
+	 * Rule evaluations by result (filter cache hits included)
+	 */
+	uint64_t filterInAccepted,filterInDropped;
+	uint64_t filterOutAccepted,filterOutDropped;
+
+	/**
+	 * Packets and fragments relayed for other nodes and their sizes
+	 */
+	uint64_t relayedPackets,relayedBytes;
+
+	/**
+	 * Multicast frames sent and total recipients they were sent to
+	 */
+	uint64_t multicastFrames,multicastRecipients;
+
+	/**
+	 * FEC parity fragments sent and packets rebuilt from received parity
+	 */
+	uint64_t fecParitySent,fecRecovered;
+
+	/**
+	 * Work for unknown peers shed under overload, indexed by class: 0 for
+	 * packets awaiting WHOIS, 1 for HELLOs needing key agreement and 2 for
+	 * HELLOs also needing identity validation
+	 */
+	uint64_t admissionShed[3];
+
+	/**
+	 * Microseconds of admitted work for unknown peers charged to the admission budget
+	 */
+	uint64_t admissionMicroseconds;
+
+	/**
+	 * Estimated nanoseconds spent encrypting and decrypting packets (sampled)
+	 */
+	uint64_t cryptoEncryptNanoseconds,cryptoDecryptNanoseconds;
+
+	/**
+	 * Time to decrypt, decompress and handle authenticated packets by verb
+	 *
+	 * decodeLatency[] holds histogram bucket counts (see ZT_METRICS_LATENCY_BUCKETS)
+	 * and decodeNanoseconds[] the total time.
+	 */
+	uint64_t decodeLatency[ZT_METRICS_VERB_COUNT][ZT_METRICS_LATENCY_BUCKETS];
+	uint64_t decodeNanoseconds[ZT_METRICS_VERB_COUNT];
+
+	/**
+	 * Gauge: fragment reassembly queue entries allocated
+	 */
+	uint64_t rxQueueSize;
+
+	/**
+	 * Gauge: peers and physical paths currently known
+	 */
+	uint64_t peers,paths;
+
+	/**
+	 * Relay best-path cache hits and misses
+	 */
+	uint64_t relayCacheHits,relayCacheMisses;
+
+	/**
+	 * Peers loaded from cache with and without a cached agreed key
+	 */
+	uint64_t peerKeyCacheHits,peerKeyCacheMisses;
+
+	/**
+	 * Identity validations skipped and done (see ZT_Node_setIdentityCacheSize)
+	 */
+	uint64_t identityCacheHits,identityCacheMisses;
+
+	/**
+	 * Per-network traffic, sorted by network ID
+	 */
+	ZT_NetworkMetrics networks[ZT_METRICS_MAX_NETWORKS + 1];
+
+	/**
+	 * Number of entries in networks[]
+	 */
+	unsigned int networkCount;
+} ZT_Metrics;
+
+/**
+ * A trace event captured in binary form (see ZT_Node_setTraceCapture())
+ *
+ * Fields that do not apply to an event are zero.
+ */
+typedef struct
+{
+	/**
+	 * Node clock time of event in milliseconds
+	 */
+	int64_t timestamp;
+
+	/**
+	 * Event type (ZT_REMOTE_TRACE_EVENT__*)
+	 */
+	unsigned int event;
+
+	/**
+	 * Packet verb
+	 */
+	unsigned int verb;
+
+	/**
+	 * Packet hop count
+	 */
+	unsigned int hops;
+
+	/**
+	 * Packet or frame length
+	 */
+	unsigned int length;
+
+	/**
+	 * Event specific value: IP scope, ethernet type, filter result, credentials requested, or credential type << 32 | credential ID
+	 */
+	uint64_t value;
+
+	/**
+	 * Network ID
+	 */
+	uint64_t networkId;
+
+	/**
+	 * Packet ID
+	 */
+	uint64_t packetId;
+
+	/**
+	 * ZeroTier address of remote peer, controller, or credential subject
+	 */
+	uint64_t address;
+
+	/**
+	 * Source and destination MAC of frame
+	 */
+	uint64_t sourceMac,destMac;
+
+	/**
+	 * Physical address of remote peer
+	 */
+	struct sockaddr_storage physicalAddress;
+
+	/**
+	 * Reason or NULL (static string, valid for the life of the process)
+	 */
+	const char *reason;
+} ZT_TraceRecord;
+
+/**
+ * Number of hold time buckets in ZT_LockProfile
+ *
+ * Bucket 0 counts holds under 128 nanoseconds and bucket N > 0 those that
+ * took at least 2^(N+6) and under 2^(N+7) nanoseconds. The last bucket also
+ * counts everything longer.
+ */
+#define ZT_LOCK_PROFILE_HOLD_BUCKETS 16
+
+/**
+ * Contention statistics for all locks sharing a name
+ *
+ * These are only collected by builds with ZT_MUTEX_PROFILING defined.
+ */
+typedef struct
+{
+	/**
+	 * Lock name, e.g. "Peer::_paths_m" (static string, valid for the life of the process)
+	 */
+	const char *name;
+
+	/**
+	 * Times locked
+	 */
+	uint64_t acquisitions;
+
+	/**
+	 * Times locked after waiting for another holder
+	 */
+	uint64_t contended;
+
+	/**
+	 * Total time spent waiting in contended acquisitions
+	 */
+	uint64_t waitNanoseconds;
+
+	/**
+	 * Total time held
+	 */
+	uint64_t holdNanoseconds;
+
+	/**
+	 * Hold time histogram (see ZT_LOCK_PROFILE_HOLD_BUCKETS)
+	 */
+	uint64_t hold[ZT_LOCK_PROFILE_HOLD_BUCKETS];
+} ZT_LockProfile;
+
+/**
+ * Counters for one network or member rate limit
+ */
+typedef struct
+{
+	/**
+	 * Network ID for a network's limit, or 0 for a member's
+	 */
+	uint64_t networkId;
+
+	/**
+	 * ZeroTier address for a member's limit, or 0 for a network's
+	 */
+	uint64_t address;
+
+	/**
+	 * Rate in bytes per second
+	 */
+	uint64_t rate;
+
+	/**
+	 * Packets and bytes sent at once because they were within the rate
+	 */
+	uint64_t packetsPassed,bytesPassed;
+
+	/**
+	 * Packets and bytes held back to pace them to the rate
+	 */
+	uint64_t packetsDelayed,bytesDelayed;
+
+	/**
+	 * Packets and bytes dropped because they would have been held too long
+	 */
+	uint64_t packetsDropped,bytesDropped;
+} ZT_RateLimitStats;
+
+/**
+ * What a ZT_TopTalker entry counts traffic by
+ */
+enum ZT_TopTalkerType
+{
+	/**
+	 * Network member frames were sent to or received from
+	 */
+	ZT_TOP_TALKER_MEMBER = 0,
+
+	/**
+	 * IPv4 or IPv6 flow (addresses, protocol and ports)
+	 */
+	ZT_TOP_TALKER_FLOW = 1,
+
+	/**
+	 * Ethernet frame type
+	 */
+	ZT_TOP_TALKER_ETHERTYPE = 2,
+
+	/**
+	 * Destination of packets this node relayed
+	 */
+	ZT_TOP_TALKER_RELAY = 3
+};
+
+/**
+ * One of the heaviest sources of traffic seen recently
+ *
+ * Counts are estimates from a sample of frames and packets. Bytes is an
+ * upper bound on the sampled traffic and bytes - bytesError a lower bound.
+ */
+typedef struct
+{
+	/**
+	 * Network ID, or 0 for relay destinations
+	 */
+	uint64_t networkId;
+
+	/**
+	 * What this entry counts traffic by
+	 */
+	enum ZT_TopTalkerType type;
+
+	/**
+	 * ZeroTier address for members and relay destinations, Ethernet type for Ethernet types, 0 for flows
+	 */
+	uint64_t key;
+
+	/**
+	 * Source and destination IP and port of a flow (port 0 if none)
+	 */
+	struct sockaddr_storage source,destination;
+
+	/**
+	 * IP protocol of a flow
+	 */
+	unsigned int protocol;
+
+	/**
+	 * Start of the period counted (ms since epoch)
+	 */
+	int64_t since;
+
+	/**
+	 * Estimated frames or packets
+	 */
+	uint64_t frames;
+
+	/**
+	 * Estimated bytes
+	 */
+	uint64_t bytes;
+
+	/**
+	 * Most that bytes could be overestimated by
+	 */
+	uint64_t bytesError;
+} ZT_TopTalker;
+
+/**
+ * Counters for one set of rules (MATCH entries and the ACTION ending them)
+ */
+typedef struct
+{
+	/**
+	 * Index of the set's first rule in its rule list
+	 */
+	unsigned int first;
+
+	/**
+	 * Index of the set's ACTION in its rule list
+	 */
+	unsigned int action;
+
+	/**
+	 * Times all of the set's entries matched and its ACTION was taken
+	 */
+	uint64_t hits;
+
+	/**
+	 * Position of this set in an order that gives the same results for less evaluation
+	 */
+	unsigned int suggestedPosition;
+} ZT_RuleSetCounters;
+
+/**
+ * Counters for a network's rules or one capability's rules
+ */
+typedef struct
+{
+	/**
+	 * Network ID
+	 */
+	uint64_t networkId;
+
+	/**
+	 * If nonzero these are a capability's rules
+	 */
+	int capability;
+
+	/**
+	 * Capability ID if capability is nonzero
+	 */
+	uint32_t capabilityId;
+
+	/**
+	 * Frames these rules were evaluated for
+	 */
+	uint64_t evaluations;
+
+	/**
+	 * MATCH entries evaluated for all of those frames
+	 */
+	uint64_t entriesEvaluated;
+
+	/**
+	 * Number of sets, in the order they appear in the rule list
+	 */
+	unsigned int setCount;
+
+	/**
+	 * Sets that frames can reach (sets that can never match are left out)
+	 */
+	ZT_RuleSetCounters *sets;
+} ZT_RuleListCounters;
+
+/**
+ * List of rule counters returned by ZT_Node_ruleCounters()
+ */
+typedef struct
+{
+	unsigned long listCount;
+	ZT_RuleListCounters *lists;
+} ZT_RuleCountersList;
+
+/**
+ * A sampled flow through a network's rules, as taken by ZT_Node_flowRecords()
+ */
+typedef struct
+{
+	/**
+	 * Network ID
+	 */
+	uint64_t networkId;
+
+	/**
+	 * ZeroTier addresses of the members frames were from and to
+	 */
+	uint64_t source,destination;
+
+	/**
+	 * Source and destination IP and port (family 0 if not IP, port 0 if none)
+	 */
+	struct sockaddr_storage sourceIp,destinationIp;
+
+	/**
+	 * Ethernet frame type
+	 */
+	unsigned int etherType;
+
+	/**
+	 * IP protocol or 0 if not IP
+	 */
+	unsigned int protocol;
+
+	/**
+	 * 1 if frames came from our tap, 0 if they arrived from a member
+	 */
+	int outbound;
+
+	/**
+	 * 1 if rules let frames through, 0 if they dropped them
+	 */
+	int accepted;
+
+	/**
+	 * Times of the first and last sampled frames (ms since epoch)
+	 */
+	int64_t start,end;
+
+	/**
+	 * Sampled frames and their payload bytes
+	 */
+	uint64_t packets,bytes;
+
+	/**
+	 * One in this many frames was sampled
+	 */
+	unsigned int sampleRate;
+} ZT_FlowRecord;
+
+/**
+ * Frames captured with ZT_Node_setFrameCapture()
+ */
+typedef struct
+{
+	/**
+	 * Nonzero if capture is on
+	 */
+	int capturing;
+
+	/**
+	 * Network being captured or 0 for all
+	 */
+	uint64_t networkId;
+
+	/**
+	 * Frames the ring holds
+	 */
+	unsigned int maxFrames;
+
+	/**
+	 * Maximum bytes kept of each frame including its Ethernet header
+	 */
+	unsigned int snapLength;
+
+	/**
+	 * Frames in data
+	 */
+	unsigned int frames;
+
+	/**
+	 * Frames lost since capture started because the ring was full
+	 */
+	uint64_t overwritten;
+
+	/**
+	 * Size of data in bytes
+	 */
+	unsigned long size;
+
+	/**
+	 * Captured frames as a pcapng section, oldest first
+	 */
+	const void *data;
+} ZT_FrameCapture;
+
+/**
+ * Bulk snapshot of a node's peers, multicast groups and member credentials
+ */
+typedef struct
+{
+	/**
+	 * Time snapshot was taken
+	 */
+	int64_t timestamp;
+
+	/**
+	 * Peers held in full
+	 */
+	unsigned long peers;
+
+	/**
+	 * Peers held as cold records (see ZT_Node_setColdPeerTimeout)
+	 */
+	unsigned long coldPeers;
+
+	/**
+	 * Members of all multicast groups
+	 */
+	unsigned long multicastMembers;
+
+	/**
+	 * Certificates, tags, capabilities and certificates of ownership of members of our networks
+	 */
+	unsigned long credentials;
+
+	/**
+	 * Size of data in bytes
+	 */
+	unsigned long size;
+
+	/**
+	 * Snapshot to hand back to ZT_Node_restoreSnapshot as is
+	 */
+	const void *data;
+} ZT_StateSnapshot;
+
+/**
+ * Maximum number of members in a root cluster
+ */
+#define ZT_CLUSTER_MAX_MEMBERS 128
+
+/**
+ * Maximum number of ZeroTier UDP endpoints a cluster member can advertise
+ */
+#define ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES 16
+
+/**
+ * Maximum size of a message between cluster members
+ *
+ * This is small enough to go in one UDP datagram on any sane backplane.
+ */
+#define ZT_CLUSTER_MAX_MESSAGE_LENGTH (1500 - 48)
+
+/**
+ * Status of one member of a root cluster
+ */
+typedef struct
+{
+	/**
+	 * Member ID
+	 */
+	unsigned int id;
+
+	/**
+	 * Milliseconds since we last heard from this member (0 for ourselves)
+	 */
+	unsigned int msSinceLastHeartbeat;
+
+	/**
+	 * Nonzero if this member has been heard from recently enough to take peers
+	 */
+	int alive;
+
+	/**
+	 * Location of this member (all zero if not known)
+	 */
+	int x,y,z;
+
+	/**
+	 * Active peers homed on this member
+	 */
+	uint64_t peers;
+
+	/**
+	 * Peers this member has redirected to others since it started
+	 */
+	uint64_t redirected;
+
+	/**
+	 * Number of ZeroTier UDP endpoints in zeroTierPhysicalEndpoints
+	 */
+	unsigned int numZeroTierPhysicalEndpoints;
+
+	/**
+	 * ZeroTier UDP endpoints peers can be redirected to at this member
+	 */
+	struct sockaddr_storage zeroTierPhysicalEndpoints[ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES];
+} ZT_ClusterMemberStatus;
+
+/**
+ * Status of a root cluster from the point of view of one member
+ */
+typedef struct
+{
+	/**
+	 * ID of this member
+	 */
+	unsigned int myId;
+
+	/**
+	 * Number of members in members[] including ourselves
+	 */
+	unsigned int clusterSize;
+
+	/**
+	 * Remote peers known to be homed on other members
+	 */
+	uint64_t remotePeers;
+
+	/**
+	 * Packets and fragments relayed to other members
+	 */
+	uint64_t relayed;
+
+	/**
+	 * Relays dropped because no member had the destination in time
+	 */
+	uint64_t relayDropped;
+
+	/**
+	 * Members, this one first
+	 */
+	ZT_ClusterMemberStatus members[ZT_CLUSTER_MAX_MEMBERS];
+} ZT_ClusterStatus;
+
+/**
+ * Virtual network status codes
+ */
+enum ZT_VirtualNetworkStatus
+{
+	/**
+	 * Waiting for network configuration (also means revision == 0)
+	 */
+	ZT_NETWORK_STATUS_REQUESTING_CONFIGURATION = 0,
+
+	/**
+	 * Configuration received and we are authorized
+	 */
+	ZT_NETWORK_STATUS_OK = 1,
+
+	/**
+	 * Netconf master told us 'nope'
+	 */
+	ZT_NETWORK_STATUS_ACCESS_DENIED = 2,
+
+	/**
+	 * Netconf master exists, but this virtual network does not
+	 */
+	ZT_NETWORK_STATUS_NOT_FOUND = 3,
+
+	/**
+	 * Initialization of network failed or other internal error
+	 */
+	ZT_NETWORK_STATUS_PORT_ERROR = 4,
+
+	/**
+	 * ZeroTier core version too old
+	 */
+	ZT_NETWORK_STATUS_CLIENT_TOO_OLD = 5
+};
+
+/**
+ * Virtual network type codes
+ */
+enum ZT_VirtualNetworkType
+{
+	/**
+	 * Private networks are authorized via certificates of membership
+	 */
+	ZT_NETWORK_TYPE_PRIVATE = 0,
+
+	/**
+	 * Public networks have no access control -- they'll always be AUTHORIZED
+	 */
+	ZT_NETWORK_TYPE_PUBLIC = 1
+};
+
+/**
+ * The type of a virtual network rules table entry
+ *
+ * These must be from 0 to 63 since the most significant two bits of each
+ * rule type are NOT (MSB) and AND/OR.
+ *
+ * Each rule is composed of zero or more MATCHes followed by an ACTION.
+ * An ACTION with no MATCHes is always taken.
+ */
+enum ZT_VirtualNetworkRuleType
+{
+	// 0 to 15 reserved for actions
+
+	/**
+	 * Drop frame
+	 */
+	ZT_NETWORK_RULE_ACTION_DROP = 0,
+
+	/**
+	 * Accept and pass frame
+	 */
+	ZT_NETWORK_RULE_ACTION_ACCEPT = 1,
+
+	/**
+	 * Forward a copy of this frame to an observer (by ZT address)
+	 */
+	ZT_NETWORK_RULE_ACTION_TEE = 2,
+
+	/**
+	 * Exactly like TEE but mandates ACKs from observer
+	 */
+	ZT_NETWORK_RULE_ACTION_WATCH = 3,
+
+	/**
+	 * Drop and redirect this frame to another node (by ZT address)
+	 */
+	ZT_NETWORK_RULE_ACTION_REDIRECT = 4,
+
+	/**
+	 * Stop evaluating rule set (drops unless there are capabilities, etc.)
+	 */
+	ZT_NETWORK_RULE_ACTION_BREAK = 5,
+
+	/**
+	 * Maximum ID for an ACTION, anything higher is a MATCH
+	 */
+	ZT_NETWORK_RULE_ACTION__MAX_ID = 15,
+
+	// 16 to 63 reserved for match criteria
+
+	ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS = 24,
+	ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS = 25,
+	ZT_NETWORK_RULE_MATCH_VLAN_ID = 26,
+	ZT_NETWORK_RULE_MATCH_VLAN_PCP = 27,
+	ZT_NETWORK_RULE_MATCH_VLAN_DEI = 28,
+	ZT_NETWORK_RULE_MATCH_MAC_SOURCE = 29,
+	ZT_NETWORK_RULE_MATCH_MAC_DEST = 30,
+	ZT_NETWORK_RULE_MATCH_IPV4_SOURCE = 31,
+	ZT_NETWORK_RULE_MATCH_IPV4_DEST = 32,
+	ZT_NETWORK_RULE_MATCH_IPV6_SOURCE = 33,
+	ZT_NETWORK_RULE_MATCH_IPV6_DEST = 34,
+	ZT_NETWORK_RULE_MATCH_IP_TOS = 35,
+	ZT_NETWORK_RULE_MATCH_IP_PROTOCOL = 36,
+	ZT_NETWORK_RULE_MATCH_ETHERTYPE = 37,
+	ZT_NETWORK_RULE_MATCH_ICMP = 38,
+	ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE = 39,
+	ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE = 40,
+	ZT_NETWORK_RULE_MATCH_CHARACTERISTICS = 41,
+	ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE = 42,
+	ZT_NETWORK_RULE_MATCH_RANDOM = 43,
+	ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE = 44,
+	ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND = 45,
+	ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR = 46,
+	ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR = 47,
+	ZT_NETWORK_RULE_MATCH_TAGS_EQUAL = 48,
+	ZT_NETWORK_RULE_MATCH_TAG_SENDER = 49,
+	ZT_NETWORK_RULE_MATCH_TAG_RECEIVER = 50,
+	ZT_NETWORK_RULE_MATCH_INTEGER_RANGE = 51,
+
+	/**
+	 * Maximum ID allowed for a MATCH entry in the rules table
+	 */
+	ZT_NETWORK_RULE_MATCH__MAX_ID = 63
+};
+
+/**
+ * Network flow rule
+ *
+ * Rules are stored in a table in which one or more match entries is followed
+ * by an action. If more than one match precedes an action, the rule is
+ * the AND of all matches. An action with no match is always taken since it
+ * matches anything. If nothing matches, the default action is DROP.
+ *
+ * This is designed to be a more memory-efficient way of storing rules than
+ * a wide table, yet still fast and simple to access in code.
+ */
+typedef struct
+{
+	/**
+	 * Type and flags
+	 *
+	 * Bits are: NOTTTTTT
+	 *
+	 * N - If true, sense of match is inverted (no effect on actions)
+	 * O - If true, result is ORed with previous instead of ANDed (no effect on actions)
+	 * T - Rule or action type
+	 *
+	 * AND with 0x3f to get type, 0x80 to get NOT bit, and 0x40 to get OR bit.
+	 */
+	uint8_t t;
+
+	/**
+	 * Union containing the value of this rule -- which field is used depends on 't'
+	 */
+	union {
+		/**
+		 * IPv6 address in big-endian / network byte order and netmask bits
+		 */
+		struct {
+			uint8_t ip[16];
+			uint8_t mask;
+		} ipv6;
+
+		/**
+		 * IPv4 address in big-endian / network byte order
+		 */
+		struct {
+			uint32_t ip;
+			uint8_t mask;
+		} ipv4;
+
+		/**
+		 * Integer range match in packet payload
+		 *
+		 * This allows matching of ranges of integers up to 64 bits wide where
+		 * the range is +/- INT32_MAX. It's packed this way so it fits in 16
+		 * bytes and doesn't enlarge the overall size of this union.
+		 */
+		struct {
+			uint64_t start; // integer range start
+			uint32_t end; // end of integer range (relative to start, inclusive, 0 for equality w/start)
+			uint16_t idx; // index in packet of integer
+			uint8_t format; // bits in integer (range 1-64, ((format&63)+1)) and endianness (MSB 1 for little, 0 for big)
+		} intRange;
+
+		/**
+		 * Packet characteristic flags being matched
+		 */
+		uint64_t characteristics;
+
+		/**
+		 * IP port range -- start-end inclusive -- host byte order
+		 */
+		uint16_t port[2];
+
+		/**
+		 * 40-bit ZeroTier address (in least significant bits, host byte order)
+		 */
+		uint64_t zt;
+
+		/**
+		 * 0 = never, UINT32_MAX = always
+		 */
+		uint32_t randomProbability;
+
+		/**
+		 * 48-bit Ethernet MAC address in big-endian order
+		 */
+		uint8_t mac[6];
+
+		/**
+		 * VLAN ID in host byte order
+		 */
+		uint16_t vlanId;
+
+		/**
+		 * VLAN PCP (least significant 3 bits)
+		 */
+		uint8_t vlanPcp;
+
+		/**
+		 * VLAN DEI (single bit / boolean)
+		 */
+		uint8_t vlanDei;
+
+		/**
+		 * Ethernet type in host byte order
+		 */
+		uint16_t etherType;
+
+		/**
+		 * IP protocol
+		 */
+		uint8_t ipProtocol;
+
+		/**
+		 * IP type of service a.k.a. DSCP field
+		 */
+		struct {
+			uint8_t mask;
+			uint8_t value[2];
+		} ipTos;
 
 		/**
 		 * Ethernet packet size in host byte order (start-end, inclusive)
@@ -976,6 +2072,31 @@ enum ZT_VirtualNetworkConfigOperation
 	ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY = 4
 };
 
+/**
+ * Managed IP addresses changed (see ZT_VirtualNetworkConfig changes)
+ */
+#define ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ADDRESSES 0x0001
+
+/**
+ * Managed routes changed
+ */
+#define ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ROUTES 0x0002
+
+/**
+ * MTU changed
+ */
+#define ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_MTU 0x0004
+
+/**
+ * Anything else about the port changed: MAC, name, status, type, bridging or broadcast
+ */
+#define ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_PORT 0x0008
+
+/**
+ * Everything should be (re)applied
+ */
+#define ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ALL 0xffff
+
 /**
  * What trust hierarchy role does this peer have?
  */
@@ -1134,6 +2255,29 @@ typedef struct
 	 * Routes (excluding those implied by assigned addresses and their masks)
 	 */
 	ZT_VirtualNetworkRoute routes[ZT_MAX_NETWORK_ROUTES];
+
+	/**
+	 * Frames whose filter result came from the per-flow cache
+	 */
+	uint64_t filterCacheHits;
+
+	/**
+	 * Frames looked up in the per-flow cache and filtered by evaluating rules
+	 *
+	 * Frames aren't looked up at all when rules are too simple to be worth
+	 * caching, so neither count moves in that case.
+	 */
+	uint64_t filterCacheMisses;
+
+	/**
+	 * What differs from the config last handed to the config callback (ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_*)
+	 *
+	 * On CONFIG_UPDATE this lets the port touch the OS only for what actually
+	 * changed. It is zero when only credentials or other things the port
+	 * doesn't see changed, e.g. when a controller reissues a COM. On every
+	 * other operation and in query results it is ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ALL.
+	 */
+	unsigned int changes;
 } ZT_VirtualNetworkConfig;
 
 /**
@@ -1160,6 +2304,31 @@ typedef struct {
 	int mtu;
 } ZT_PhysicalPathConfiguration;
 
+/**
+ * How traffic to a peer is spread across its direct physical paths
+ */
+enum ZT_MultipathMode
+{
+	/**
+	 * Send everything over the single best path (default)
+	 */
+	ZT_MULTIPATH_NONE = 0,
+
+	/**
+	 * Hash each flow onto one alive path, weighted by path latency
+	 *
+	 * Packets of one TCP/UDP flow stay on one path and so stay in order.
+	 */
+	ZT_MULTIPATH_FLOW_HASH = 1,
+
+	/**
+	 * Stripe individual packets across all alive paths, weighted by latency
+	 *
+	 * This gives the most aggregate bandwidth but can reorder packets.
+	 */
+	ZT_MULTIPATH_BALANCE = 2
+};
+
 /**
  * Physical network path to a peer
  */
@@ -1194,6 +2363,61 @@ typedef struct
 	 * Is path preferred?
 	 */
 	int preferred;
+
+	/**
+	 * Measured latency in milliseconds or -1 if unknown
+	 */
+	int latency;
+
+	/**
+	 * Mean variation of round trip times in milliseconds or -1 if unknown
+	 */
+	int jitter;
+
+	/**
+	 * Recent fraction of probes lost in parts per thousand (0-1000) or -1 if unknown
+	 */
+	int packetLoss;
+
+	/**
+	 * Recent average receive rate over this path in bytes/second
+	 */
+	uint64_t throughputIn;
+
+	/**
+	 * Recent average send rate over this path in bytes/second
+	 */
+	uint64_t throughputOut;
+
+	/**
+	 * Datagrams received over this path, including fragments
+	 */
+	uint64_t packetsIn;
+
+	/**
+	 * Bytes received over this path
+	 */
+	uint64_t bytesIn;
+
+	/**
+	 * Packet fragments (not counting heads) received over this path
+	 */
+	uint64_t fragmentsIn;
+
+	/**
+	 * Datagrams sent over this path, including fragments
+	 */
+	uint64_t packetsOut;
+
+	/**
+	 * Bytes sent over this path
+	 */
+	uint64_t bytesOut;
+
+	/**
+	 * Packet fragments (not counting heads) sent over this path
+	 */
+	uint64_t fragmentsOut;
 } ZT_PeerPhysicalPath;
 
 /**
@@ -1231,6 +2455,36 @@ typedef struct
 	 */
 	enum ZT_PeerRole role;
 
+	/**
+	 * Authenticated packets received from this peer
+	 */
+	uint64_t packetsIn;
+
+	/**
+	 * Bytes of authenticated packets received from this peer, before decompression
+	 */
+	uint64_t bytesIn;
+
+	/**
+	 * Packets from this peer that arrived via a relay rather than directly
+	 */
+	uint64_t relayedPacketsIn;
+
+	/**
+	 * Packets sent to this peer
+	 */
+	uint64_t packetsOut;
+
+	/**
+	 * Bytes sent to this peer
+	 */
+	uint64_t bytesOut;
+
+	/**
+	 * Packets sent to this peer via a relay because no direct path was available
+	 */
+	uint64_t relayedPacketsOut;
+
 	/**
 	 * Number of paths (size of paths[])
 	 */
@@ -1313,7 +2567,16 @@ enum ZT_StateObjectType
 	 * Canonical path: <HOME>/networks.d/<NETWORKID>.conf (16-digit hex ID)
 	 * Persistence: required if network memberships should persist
 	 */
-	ZT_STATE_OBJECT_NETWORK_CONFIG = 6
+	ZT_STATE_OBJECT_NETWORK_CONFIG = 6,
+
+	/**
+	 * Last good direct paths of recently active peers, contacted right away at startup
+	 *
+	 * Object ID: 0
+	 * Canonical path: <HOME>/warm.paths
+	 * Persistence: optional, can be cleared at any time
+	 */
+	ZT_STATE_OBJECT_WARM_PATHS = 7
 };
 
 /**
@@ -1445,19 +2708,183 @@ typedef int (*ZT_StateGetFunction)(
  * value if possible. If this is not possible it is acceptable to ignore
  * this value and send anyway with normal or default TTL.
  *
- * The function must return zero on success and may return any error code
- * on failure. Note that success does not (of course) guarantee packet
- * delivery. It only means that the packet appears to have been sent.
+ * Hosts whose callbacks struct is version 3 or newer may also be passed
+ * ZT_WIRE_PACKET_DONT_FRAGMENT OR'd into TTL. Such a packet must be sent
+ * with the IP don't fragment bit set, and if it can't be sent that way
+ * (e.g. it's too big for the interface) the function must fail rather
+ * than send it fragmented. These are path MTU probes.
+ *
+ * The function must return zero on success and may return any error code
+ * on failure. Note that success does not (of course) guarantee packet
+ * delivery. It only means that the packet appears to have been sent.
+ */
+typedef int (*ZT_WirePacketSendFunction)(
+	ZT_Node *,                        /* Node */
+	void *,                           /* User ptr */
+	void *,                           /* Thread ptr */
+	int64_t,                          /* Local socket */
+	const struct sockaddr_storage *,  /* Remote address */
+	const void *,                     /* Packet data */
+	unsigned int,                     /* Packet length */
+	unsigned int);                    /* TTL or 0 to use default */
+
+/**
+ * A datagram to or from the physical wire, used by batched I/O functions
+ */
+typedef struct
+{
+	/**
+	 * Local socket (see ZT_WirePacketSendFunction)
+	 */
+	int64_t localSocket;
+
+	/**
+	 * Remote address (origin for received packets, destination for sent packets)
+	 */
+	struct sockaddr_storage address;
+
+	/**
+	 * Packet data
+	 */
+	const void *data;
+
+	/**
+	 * Packet length in bytes
+	 */
+	unsigned int length;
+
+	/**
+	 * IP TTL or 0 to use default, possibly with ZT_WIRE_PACKET_DONT_FRAGMENT (ignored for received packets)
+	 */
+	unsigned int ttl;
+
+	/**
+	 * IP traffic class: DSCP in the upper six bits and ECN in the lower two
+	 *
+	 * For sent packets this is the IPv4 TOS or IPv6 traffic class of the frame
+	 * being carried, or 0 for control traffic and non-IP frames. The host may
+	 * set it on the datagram or ignore it. For received packets this is what
+	 * the datagram arrived with or 0 if unknown, and a CE (congestion
+	 * experienced) mark is copied into ECN-capable IP frames inside.
+	 */
+	unsigned int tos;
+} ZT_WirePacket;
+
+/**
+ * A frame from a virtual network port (tap), used by batched I/O functions
+ */
+typedef struct
+{
+	/**
+	 * Source MAC address (least significant 48 bits)
+	 */
+	uint64_t sourceMac;
+
+	/**
+	 * Destination MAC address (least significant 48 bits)
+	 */
+	uint64_t destMac;
+
+	/**
+	 * 16-bit Ethernet frame type
+	 */
+	unsigned int etherType;
+
+	/**
+	 * 10-bit VLAN ID or 0 if none
+	 */
+	unsigned int vlanId;
+
+	/**
+	 * Frame payload data
+	 */
+	const void *data;
+
+	/**
+	 * Frame payload length
+	 */
+	unsigned int length;
+} ZT_VirtualNetworkFrame;
+
+/**
+ * A buffer passed back and forth between the core and external code
+ *
+ * Buffers let frames and packets move between a user-space network stack
+ * and the wire without being copied. They come from ZT_Node_getFrameBuffer()
+ * and belong to whoever was last given one, who must either pass it on or
+ * return it with ZT_Node_freeFrameBuffer(). The owner may use all of the
+ * memory from data - headroom to data + length + tailroom, and may move
+ * data within it as long as headroom + length + tailroom stays equal to
+ * ZT_FRAME_BUFFER_SIZE.
+ */
+typedef struct
+{
+	/**
+	 * Frame or packet data
+	 */
+	void *data;
+
+	/**
+	 * Length of data in bytes
+	 */
+	unsigned int length;
+
+	/**
+	 * Bytes of buffer before data
+	 */
+	unsigned int headroom;
+
+	/**
+	 * Bytes of buffer after data + length
+	 */
+	unsigned int tailroom;
+} ZT_FrameBuffer;
+
+/**
+ * Function to hand a received frame to a virtual network port in its buffer
+ *
+ * Parameters are the same as for ZT_VirtualNetworkFrameFunction except that
+ * the frame is in a buffer that now belongs to the callee. The buffer's
+ * headroom holds what is left of the packet the frame came in and may be
+ * overwritten, e.g. with headers for a user-space network stack.
+ */
+typedef void (*ZT_VirtualNetworkFrameBufferFunction)(
+	ZT_Node *,                             /* Node */
+	void *,                                /* User ptr */
+	void *,                                /* Thread ptr */
+	uint64_t,                              /* Network ID */
+	void **,                               /* Modifiable network user PTR */
+	uint64_t,                              /* Source MAC */
+	uint64_t,                              /* Destination MAC */
+	unsigned int,                          /* Ethernet type */
+	unsigned int,                          /* VLAN ID (0 for none) */
+	ZT_FrameBuffer *);                     /* Frame in a buffer */
+
+/**
+ * Function to send a batch of packets over the physical wire
+ *
+ * Parameters:
+ *  (1) Node
+ *  (2) User pointer
+ *  (3) Thread pointer
+ *  (4) Array of packets to send
+ *  (5) Number of packets in array
+ *
+ * If this is supplied the core collects datagrams sent during one call to
+ * ZT_Node_processWirePackets(), ZT_Node_processWirePacket(),
+ * ZT_Node_processVirtualNetworkFrame(), or ZT_Node_processBackgroundTasks()
+ * and passes them here together, for example to be sent with sendmmsg().
+ * Packet data is only valid until this function returns. Each packet has
+ * the same semantics as a call to ZT_WirePacketSendFunction, and since the
+ * send is deferred the core assumes it succeeded. The return value is
+ * currently ignored. Only packets sent this way carry a traffic class.
  */
-typedef int (*ZT_WirePacketSendFunction)(
+typedef int (*ZT_WirePacketBatchSendFunction)(
 	ZT_Node *,                        /* Node */
 	void *,                           /* User ptr */
 	void *,                           /* Thread ptr */
-	int64_t,                          /* Local socket */
-	const struct sockaddr_storage *,  /* Remote address */
-	const void *,                     /* Packet data */
-	unsigned int,                     /* Packet length */
-	unsigned int);                    /* TTL or 0 to use default */
+	const ZT_WirePacket *,            /* Packets */
+	unsigned int);                    /* Number of packets */
 
 /**
  * Function to check whether a path should be used for ZeroTier traffic
@@ -1521,7 +2948,7 @@ typedef int (*ZT_PathLookupFunction)(
 struct ZT_Node_Callbacks
 {
 	/**
-	 * Struct version -- must currently be 0
+	 * Struct version -- 0 to 3 (1 adds wirePacketBatchSendFunction, 2 adds virtualNetworkFrameBufferFunction, 3 means sends honor ZT_WIRE_PACKET_DONT_FRAGMENT)
 	 */
 	long version;
 
@@ -1564,6 +2991,23 @@ struct ZT_Node_Callbacks
 	 * OPTIONAL: Function to get hints to physical paths to ZeroTier addresses
 	 */
 	ZT_PathLookupFunction pathLookupFunction;
+
+	/**
+	 * OPTIONAL: Function to send batches of packets (version 1 and newer)
+	 *
+	 * If present this is used instead of wirePacketSendFunction while the
+	 * node is processing a call, and wirePacketSendFunction is used otherwise.
+	 */
+	ZT_WirePacketBatchSendFunction wirePacketBatchSendFunction;
+
+	/**
+	 * OPTIONAL: Function to hand over received frames in their buffers (version 2 and newer)
+	 *
+	 * If present, unicast frames in packets given to the core with
+	 * ZT_Node_processWirePacketBuffer() are handed over here in the same
+	 * buffer. Other frames still go to virtualNetworkFrameFunction.
+	 */
+	ZT_VirtualNetworkFrameBufferFunction virtualNetworkFrameBufferFunction;
 };
 
 /**
@@ -1616,6 +3060,29 @@ ZT_SDK_API enum ZT_ResultCode ZT_Node_processWirePacket(
 	unsigned int packetLength,
 	volatile int64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Process several packets received from the physical wire
+ *
+ * This is equivalent to calling ZT_Node_processWirePacket() for each packet
+ * but lets the caller use batched receive calls like recvmmsg(), and with a
+ * batch send function all replies are sent together after the last packet.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param packets Received packets (ttl is ignored, tos is 0 if unknown)
+ * @param packetCount Number of packets
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processWirePackets(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	const ZT_WirePacket *packets,
+	unsigned int packetCount,
+	volatile int64_t *nextBackgroundTaskDeadline);
+
 /**
  * Process a frame from a virtual network port (tap)
  *
@@ -1646,134 +3113,484 @@ ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	volatile int64_t *nextBackgroundTaskDeadline);
 
 /**
- * Perform periodic background operations
+ * Process several frames from the same virtual network port (tap)
+ *
+ * This is equivalent to calling ZT_Node_processVirtualNetworkFrame() for
+ * each frame, but the network is looked up once and with a batch send
+ * function all resulting packets are sent together after the last frame.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param nwid ZeroTier 64-bit virtual network ID
+ * @param frames Frames read from the port
+ * @param frameCount Number of frames
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrames(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile int64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Get an empty frame buffer
+ *
+ * The buffer's data starts ZT_FRAME_BUFFER_HEADROOM bytes in, which is
+ * where a frame to pass to ZT_Node_processVirtualNetworkFrameBuffer()
+ * should be written. To receive a packet from the wire into it instead,
+ * read it in at data - headroom and set data, length, headroom and
+ * tailroom to match.
+ *
+ * @param node Node instance
+ * @return Buffer or NULL if out of memory
+ */
+ZT_SDK_API ZT_FrameBuffer *ZT_Node_getFrameBuffer(ZT_Node *node);
+
+/**
+ * Return a frame buffer
+ *
+ * @param node Node instance
+ * @param fb Buffer from ZT_Node_getFrameBuffer() or a ZT_VirtualNetworkFrameBufferFunction (NULL is ignored)
+ */
+ZT_SDK_API void ZT_Node_freeFrameBuffer(ZT_Node *node,ZT_FrameBuffer *fb);
+
+/**
+ * Process a packet received from the physical wire into a frame buffer
+ *
+ * This is ZT_Node_processWirePacket() for a packet in a frame buffer. The
+ * packet is decrypted where it lies and, if a virtualNetworkFrameBufferFunction
+ * was supplied, a frame it carries is handed over in the same buffer. The
+ * buffer belongs to the core once this is called, whatever it returns.
+ * Packets that do not start at the beginning of the buffer are copied.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param localSocket Local socket (you can use 0 if only one local socket is bound and ignore this)
+ * @param remoteAddress Origin of packet
+ * @param fb Buffer holding packet
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processWirePacketBuffer(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	int64_t localSocket,
+	const struct sockaddr_storage *remoteAddress,
+	ZT_FrameBuffer *fb,
+	volatile int64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Process a frame from a virtual network port (tap) in a frame buffer
+ *
+ * This is ZT_Node_processVirtualNetworkFrame() for a frame in a frame
+ * buffer. If the frame still has ZT_FRAME_BUFFER_HEADROOM bytes in front of
+ * it and goes to a single peer, its packet is built and encrypted around it
+ * where it lies. The buffer belongs to the core once this is called,
+ * whatever it returns.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param nwid ZeroTier 64-bit virtual network ID
+ * @param sourceMac Source MAC address (least significant 48 bits)
+ * @param destMac Destination MAC address (least significant 48 bits)
+ * @param etherType 16-bit Ethernet frame type
+ * @param vlanId 10-bit VLAN ID or 0 if none
+ * @param fb Buffer holding frame payload
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrameBuffer(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	uint64_t sourceMac,
+	uint64_t destMac,
+	unsigned int etherType,
+	unsigned int vlanId,
+	ZT_FrameBuffer *fb,
+	volatile int64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Perform periodic background operations
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline);
+
+/**
+ * Join a network
+ *
+ * This may generate calls to the port config callback before it returns,
+ * or these may be deffered if a netconf is not available yet.
+ *
+ * If we are already a member of the network, nothing is done and OK is
+ * returned.
+ *
+ * @param node Node instance
+ * @param nwid 64-bit ZeroTier network ID
+ * @param uptr An arbitrary pointer to associate with this network (default: NULL)
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_join(ZT_Node *node,uint64_t nwid,void *uptr,void *tptr);
+
+/**
+ * Leave a network
+ *
+ * If a port has been configured for this network this will generate a call
+ * to the port config callback with a NULL second parameter to indicate that
+ * the port is now deleted.
+ *
+ * The uptr parameter is optional and is NULL by default. If it is not NULL,
+ * the pointer it points to is set to this network's uptr on success.
+ *
+ * @param node Node instance
+ * @param nwid 64-bit network ID
+ * @param uptr Target pointer is set to uptr (if not NULL)
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_leave(ZT_Node *node,uint64_t nwid,void **uptr,void *tptr);
+
+/**
+ * Subscribe to an Ethernet multicast group
+ *
+ * ADI stands for additional distinguishing information. This defaults to zero
+ * and is rarely used. Right now its only use is to enable IPv4 ARP to scale,
+ * and this must be done.
+ *
+ * For IPv4 ARP, the implementation must subscribe to 0xffffffffffff (the
+ * broadcast address) but with an ADI equal to each IPv4 address in host
+ * byte order. This converts ARP from a non-scalable broadcast protocol to
+ * a scalable multicast protocol with perfect address specificity.
+ *
+ * If this is not done, ARP will not work reliably.
+ *
+ * Multiple calls to subscribe to the same multicast address will have no
+ * effect. It is perfectly safe to do this.
+ *
+ * This does not generate an update call to networkConfigCallback().
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param nwid 64-bit network ID
+ * @param multicastGroup Ethernet multicast or broadcast MAC (least significant 48 bits)
+ * @param multicastAdi Multicast ADI (least significant 32 bits only, use 0 if not needed)
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_multicastSubscribe(ZT_Node *node,void *tptr,uint64_t nwid,uint64_t multicastGroup,unsigned long multicastAdi);
+
+/**
+ * Unsubscribe from an Ethernet multicast group (or all groups)
+ *
+ * If multicastGroup is zero (0), this will unsubscribe from all groups. If
+ * you are not subscribed to a group this has no effect.
+ *
+ * This does not generate an update call to networkConfigCallback().
+ *
+ * @param node Node instance
+ * @param nwid 64-bit network ID
+ * @param multicastGroup Ethernet multicast or broadcast MAC (least significant 48 bits)
+ * @param multicastAdi Multicast ADI (least significant 32 bits only, use 0 if not needed)
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_multicastUnsubscribe(ZT_Node *node,uint64_t nwid,uint64_t multicastGroup,unsigned long multicastAdi);
+
+/**
+ * Add or update a moon
+ *
+ * Moons are persisted in the data store in moons.d/, so this can persist
+ * across invocations if the contents of moon.d are scanned and orbit is
+ * called for each on startup.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param moonWorldId Moon's world ID
+ * @param moonSeed If non-zero, the ZeroTier address of any member of the moon to query for moon definition
+ * @param len Length of moonWorld in bytes
+ * @return Error if moon was invalid or failed to be added
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_orbit(ZT_Node *node,void *tptr,uint64_t moonWorldId,uint64_t moonSeed);
+
+/**
+ * Remove a moon (does nothing if not present)
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param moonWorldId World ID of moon to remove
+ * @return Error if anything bad happened
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_deorbit(ZT_Node *node,void *tptr,uint64_t moonWorldId);
+
+/**
+ * Get this node's 40-bit ZeroTier address
+ *
+ * @param node Node instance
+ * @return ZeroTier address (least significant 40 bits of 64-bit int)
+ */
+ZT_SDK_API uint64_t ZT_Node_address(ZT_Node *node);
+
+/**
+ * Get the status of this node
+ *
+ * @param node Node instance
+ * @param status Buffer to fill with current node status
+ */
+ZT_SDK_API void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status);
+
+/**
+ * Get approximate memory used by this node's tables and queues
+ *
+ * This walks the peer, multicast and membership tables, so it is meant
+ * for occasional monitoring rather than for calling on every packet.
+ *
+ * @param node Node instance
+ * @param mu Buffer to fill with memory usage
+ */
+ZT_SDK_API void ZT_Node_memoryUsage(ZT_Node *node,ZT_MemoryUsage *mu);
+
+/**
+ * Set whether large tables and pools are allocated from huge pages (Linux only)
+ *
+ * This covers hash table slot arrays and multicast member arrays of 64KiB
+ * or more and the slabs behind peers, paths and RX queue entries, which on
+ * busy roots are large and randomly accessed enough that TLB misses show.
+ * It applies to everything allocated after the call by every node in this
+ * process. Where huge pages can't be had, malloc() is used instead.
+ *
+ * @param node Node instance
+ * @param mode Huge pages to use
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setHugePages(ZT_Node *node,enum ZT_HugePageMode mode);
+
+/**
+ * Get approximate memory used by one network
+ *
+ * @param node Node instance
+ * @param nwid 64-bit network ID
+ * @param mu Buffer to fill with memory usage
+ * @return 1 if the network was found and mu filled, 0 if not
+ */
+ZT_SDK_API int ZT_Node_networkMemoryUsage(ZT_Node *node,uint64_t nwid,ZT_NetworkMemoryUsage *mu);
+
+/**
+ * Get traffic counters and gauges for monitoring
+ *
+ * Counters are cheap to maintain and this is cheap enough to call from a
+ * metrics scrape, but it does walk the peer table.
+ *
+ * @param node Node instance
+ * @param m Buffer to fill with metrics
+ */
+ZT_SDK_API void ZT_Node_metrics(ZT_Node *node,ZT_Metrics *m);
+
+/**
+ * Set binary capture of trace events
+ *
+ * Captured events are kept in per-thread ring buffers until they are read
+ * with ZT_Node_readTrace(). This is independent of remote trace targets and
+ * cheap enough to enable briefly on a busy node. Capture is shared by every
+ * node in the same process.
  *
  * @param node Node instance
- * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
- * @param now Current clock in milliseconds
- * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
- * @return OK (0) or error code if a fatal error condition has occurred
+ * @param event Event type (ZT_REMOTE_TRACE_EVENT__*) or 0 for all events
+ * @param sampleRate Capture one in this many events, or 0 to stop capturing
+ * @param maxPerSecond Maximum events captured per second on each thread, or 0 for no limit
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline);
+ZT_SDK_API void ZT_Node_setTraceCapture(ZT_Node *node,unsigned int event,unsigned int sampleRate,unsigned int maxPerSecond);
 
 /**
- * Join a network
+ * Read and remove captured trace events, oldest first
  *
- * This may generate calls to the port config callback before it returns,
- * or these may be deffered if a netconf is not available yet.
+ * @param node Node instance
+ * @param records Buffer to fill
+ * @param maxRecords Size of buffer in records
+ * @param dropped If non-NULL set to total events lost because a ring buffer was full
+ * @return Number of records read
+ */
+ZT_SDK_API unsigned long ZT_Node_readTrace(ZT_Node *node,ZT_TraceRecord *records,unsigned long maxRecords,uint64_t *dropped);
+
+/**
+ * Get lock contention statistics
  *
- * If we are already a member of the network, nothing is done and OK is
- * returned.
+ * Statistics are process-wide and only collected if the core was built
+ * with ZT_MUTEX_PROFILING defined (make ZT_MUTEX_PROFILING=1). Otherwise
+ * this always returns 0.
  *
  * @param node Node instance
- * @param nwid 64-bit ZeroTier network ID
- * @param uptr An arbitrary pointer to associate with this network (default: NULL)
- * @return OK (0) or error code if a fatal error condition has occurred
+ * @param profiles Buffer to fill
+ * @param maxProfiles Size of buffer
+ * @return Number of profiles filled
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_join(ZT_Node *node,uint64_t nwid,void *uptr,void *tptr);
+ZT_SDK_API unsigned int ZT_Node_lockProfiles(ZT_Node *node,ZT_LockProfile *profiles,unsigned int maxProfiles);
 
 /**
- * Leave a network
+ * Get counters for network and member rate limits
  *
- * If a port has been configured for this network this will generate a call
- * to the port config callback with a NULL second parameter to indicate that
- * the port is now deleted.
+ * @param node Node instance
+ * @param stats Buffer to fill
+ * @param maxStats Size of buffer
+ * @return Number of entries filled
+ */
+ZT_SDK_API unsigned int ZT_Node_rateLimitStats(ZT_Node *node,ZT_RateLimitStats *stats,unsigned int maxStats);
+
+/**
+ * Get the heaviest members, flows, Ethernet types and relay destinations
  *
- * The uptr parameter is optional and is NULL by default. If it is not NULL,
- * the pointer it points to is set to this network's uptr on success.
+ * Each network keeps its members, flows and Ethernet types, and the node
+ * keeps its relay destinations. Each list is sorted by bytes, heaviest
+ * first, and covers the last ten to twenty seconds.
  *
  * @param node Node instance
- * @param nwid 64-bit network ID
- * @param uptr Target pointer is set to uptr (if not NULL)
- * @return OK (0) or error code if a fatal error condition has occurred
+ * @param nwid Network ID, or 0 for every network and relay destinations
+ * @param talkers Buffer to fill
+ * @param maxTalkers Size of buffer
+ * @return Number of entries filled
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_leave(ZT_Node *node,uint64_t nwid,void **uptr,void *tptr);
+ZT_SDK_API unsigned int ZT_Node_topTalkers(ZT_Node *node,uint64_t nwid,ZT_TopTalker *talkers,unsigned int maxTalkers);
 
 /**
- * Subscribe to an Ethernet multicast group
- *
- * ADI stands for additional distinguishing information. This defaults to zero
- * and is rarely used. Right now its only use is to enable IPv4 ARP to scale,
- * and this must be done.
+ * Get how often each rule set matches and how much evaluating rules costs
  *
- * For IPv4 ARP, the implementation must subscribe to 0xffffffffffff (the
- * broadcast address) but with an ADI equal to each IPv4 address in host
- * byte order. This converts ARP from a non-scalable broadcast protocol to
- * a scalable multicast protocol with perfect address specificity.
+ * Counts cover frames whose rules were evaluated. Frames whose result came
+ * from the flow cache cost no evaluation and are not counted, and neither
+ * are frames on networks with a remote trace target since those evaluate
+ * every rule. Counts start over when a rule list changes. Suggested
+ * positions only ever reorder sets that can't both match a frame or that
+ * end in the same DROP, ACCEPT or BREAK, so using them is always safe.
  *
- * If this is not done, ARP will not work reliably.
+ * The list must be freed with ZT_Node_freeQueryResult().
  *
- * Multiple calls to subscribe to the same multicast address will have no
- * effect. It is perfectly safe to do this.
+ * @param node Node instance
+ * @param nwid Network ID, or 0 for every network
+ * @return List of network rules and each capability's rules, or NULL on failure
+ */
+ZT_SDK_API ZT_RuleCountersList *ZT_Node_ruleCounters(ZT_Node *node,uint64_t nwid);
+
+/**
+ * Turn sampling of flows through network rules on or off
  *
- * This does not generate an update call to networkConfigCallback().
+ * Frames are sampled after filtering in both directions, including frames
+ * rules drop. The rate applies to every node in this process and sampling
+ * is off until this is called.
  *
  * @param node Node instance
- * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
- * @param nwid 64-bit network ID
- * @param multicastGroup Ethernet multicast or broadcast MAC (least significant 48 bits)
- * @param multicastAdi Multicast ADI (least significant 32 bits only, use 0 if not needed)
- * @return OK (0) or error code if a fatal error condition has occurred
+ * @param sampleRate Count one in this many frames on each thread, or 0 to turn off
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_multicastSubscribe(ZT_Node *node,void *tptr,uint64_t nwid,uint64_t multicastGroup,unsigned long multicastAdi);
+ZT_SDK_API void ZT_Node_setFlowSampling(ZT_Node *node,unsigned int sampleRate);
 
 /**
- * Unsubscribe from an Ethernet multicast group (or all groups)
+ * Take records of flows that have ended or been active for a while
  *
- * If multicastGroup is zero (0), this will unsubscribe from all groups. If
- * you are not subscribed to a group this has no effect.
+ * A flow ends after 15 seconds without a sampled frame. Flows still going
+ * after 60 seconds are reported and their counts start over. Each record is
+ * returned once, and records that don't fit are kept for the next call.
  *
- * This does not generate an update call to networkConfigCallback().
+ * @param node Node instance
+ * @param records Buffer to fill
+ * @param maxRecords Size of buffer
+ * @return Number of records filled
+ */
+ZT_SDK_API unsigned int ZT_Node_flowRecords(ZT_Node *node,ZT_FlowRecord *records,unsigned int maxRecords);
+
+/**
+ * Get rules a tap may use to drop frames from the host before they reach the core
+ *
+ * These are a subset of a network's rules, made so that any frame they
+ * DROP would also be dropped by the core, with sets ending in DROP or
+ * ACCEPT. Frames they ACCEPT or don't match must still be passed to
+ * ZT_Node_processVirtualNetworkFrame(). Frames dropped early are not seen
+ * by traces, metrics, captures or flow sampling. No rules are returned for
+ * networks with a remote trace target. Rules past maxRules are left out,
+ * which only means fewer frames are dropped early.
  *
  * @param node Node instance
- * @param nwid 64-bit network ID
- * @param multicastGroup Ethernet multicast or broadcast MAC (least significant 48 bits)
- * @param multicastAdi Multicast ADI (least significant 32 bits only, use 0 if not needed)
- * @return OK (0) or error code if a fatal error condition has occurred
+ * @param nwid Network ID
+ * @param rules Buffer to fill
+ * @param maxRules Size of buffer
+ * @return Number of rules filled, 0 if nothing should be dropped early
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_multicastUnsubscribe(ZT_Node *node,uint64_t nwid,uint64_t multicastGroup,unsigned long multicastAdi);
+ZT_SDK_API unsigned int ZT_Node_tapFilter(ZT_Node *node,uint64_t nwid,ZT_VirtualNetworkRule *rules,unsigned int maxRules);
 
 /**
- * Add or update a moon
+ * Start or stop capture of virtual network frames
  *
- * Moons are persisted in the data store in moons.d/, so this can persist
- * across invocations if the contents of moon.d are scanned and orbit is
- * called for each on startup.
+ * Frames sent and received are recorded where they enter the core, before
+ * rules are applied, into a ring that keeps the most recent maxFrames. Each
+ * is tagged with whether it was accepted, the remote peer and the physical
+ * path. Restarting capture discards what was captured. Capture is shared by
+ * every node in the same process and costs almost nothing while off.
  *
  * @param node Node instance
- * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
- * @param moonWorldId Moon's world ID
- * @param moonSeed If non-zero, the ZeroTier address of any member of the moon to query for moon definition
- * @param len Length of moonWorld in bytes
- * @return Error if moon was invalid or failed to be added
+ * @param nwid Network to capture or 0 for all networks
+ * @param maxFrames Frames to keep, or 0 to stop capturing and free memory
+ * @param snapLength Bytes of each frame to keep including its Ethernet header, or 0 for the default
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_orbit(ZT_Node *node,void *tptr,uint64_t moonWorldId,uint64_t moonSeed);
+ZT_SDK_API void ZT_Node_setFrameCapture(ZT_Node *node,uint64_t nwid,unsigned int maxFrames,unsigned int snapLength);
 
 /**
- * Remove a moon (does nothing if not present)
+ * Get captured frames as pcapng
+ *
+ * The pointer returned here must be freed with freeQueryResult()
+ * when you are done with it.
  *
  * @param node Node instance
- * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
- * @param moonWorldId World ID of moon to remove
- * @return Error if anything bad happened
+ * @param clear If nonzero remove returned frames from the ring
+ * @return Captured frames or NULL on failure
  */
-ZT_SDK_API enum ZT_ResultCode ZT_Node_deorbit(ZT_Node *node,void *tptr,uint64_t moonWorldId);
+ZT_SDK_API ZT_FrameCapture *ZT_Node_readFrameCapture(ZT_Node *node,int clear);
 
 /**
- * Get this node's 40-bit ZeroTier address
+ * Take a snapshot of this node's soft state for a fast restart
+ *
+ * A restarted node normally rebuilds its peers, multicast groups and the
+ * credentials of members of its networks packet by packet, which on a root
+ * or busy gateway takes minutes. The snapshot holds all of these: peers
+ * with their identities, paths and (if the peer cache is sealed) agreed
+ * keys, multicast group members with when they were last heard from, and
+ * the credentials members have sent us. It is only meaningful to the node
+ * that took it and holds sealed secrets, so keep it as private as the
+ * identity.
+ *
+ * The pointer returned here must be freed with freeQueryResult()
+ * when you are done with it.
  *
  * @param node Node instance
- * @return ZeroTier address (least significant 40 bits of 64-bit int)
+ * @return Snapshot or NULL on failure
  */
-ZT_SDK_API uint64_t ZT_Node_address(ZT_Node *node);
+ZT_SDK_API ZT_StateSnapshot *ZT_Node_snapshot(ZT_Node *node);
 
 /**
- * Get the status of this node
+ * Restore a snapshot taken by ZT_Node_snapshot
+ *
+ * Call this once after the node is created and networks are joined, so
+ * credentials have networks to go to. The snapshot is read in place and
+ * can be restored straight from a mapped file. Peers come back with their
+ * keys and are sent a HELLO at each saved path, and multicast members and
+ * credentials come back as they were. Credential signatures are checked
+ * again. Anything already known or expired by now is skipped.
  *
  * @param node Node instance
- * @param status Buffer to fill with current node status
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param data Snapshot data
+ * @param len Length of snapshot data
+ * @param restored If non-NULL, filled with counts of what was restored
+ * @return OK, OK_IGNORED if the snapshot is too old to be useful, or BAD_PARAMETER if it isn't a snapshot of this node
  */
-ZT_SDK_API void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status);
+ZT_SDK_API enum ZT_ResultCode ZT_Node_restoreSnapshot(ZT_Node *node,void *tptr,int64_t now,const void *data,unsigned long len,ZT_StateSnapshot *restored);
 
 /**
  * Get a list of known peer nodes
@@ -1888,6 +3705,388 @@ ZT_SDK_API void ZT_Node_setNetconfMaster(ZT_Node *node,void *networkConfigMaster
  */
 ZT_SDK_API enum ZT_ResultCode ZT_Node_setPhysicalPathConfiguration(ZT_Node *node,const struct sockaddr_storage *pathNetwork,const ZT_PhysicalPathConfiguration *pathConfig);
 
+/**
+ * Set how traffic to a peer is spread across its direct paths
+ *
+ * Paths that stop receiving heartbeats are dropped from the bond right
+ * away, without waiting for them to expire.
+ *
+ * @param node Node instance
+ * @param ztAddress ZeroTier address of peer or 0 to set the default for all peers without their own setting
+ * @param mode Multipath mode
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setMultipathMode(ZT_Node *node,uint64_t ztAddress,enum ZT_MultipathMode mode);
+
+/**
+ * Set the latency to assume for an upstream until it has been measured
+ *
+ * Relayed traffic goes to the upstream (root or moon) with the lowest
+ * measured latency, and upstreams are probed until they have been measured.
+ * Until then hints decide, so an application with a rough idea of where it
+ * is (e.g. from GeoIP) can prefer the nearest upstream from the start.
+ *
+ * @param node Node instance
+ * @param ztAddress ZeroTier address of upstream or 0 to clear all hints
+ * @param latency Latency in milliseconds or 0 to clear this upstream's hint
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setUpstreamLatencyHint(ZT_Node *node,uint64_t ztAddress,unsigned int latency);
+
+/**
+ * Limit the rate of traffic to and through a member
+ *
+ * Frames this node sends to the member and packets it relays from or to
+ * it are paced to this rate. Anything that would have to wait more than
+ * a fraction of a second is dropped. Network-wide limits are set by the
+ * network's controller.
+ *
+ * @param node Node instance
+ * @param ztAddress ZeroTier address of member or 0 to clear all member limits
+ * @param bytesPerSecond Rate or 0 to remove this member's limit
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setMemberRateLimit(ZT_Node *node,uint64_t ztAddress,uint64_t bytesPerSecond);
+
+/**
+ * Set the uplink rate for the egress scheduler
+ *
+ * When the uplink is saturated by frames, keepalives and network config
+ * traffic get delayed or lost along with them and peers declare paths dead.
+ * With a rate set, everything sent is counted against it and control
+ * packets always go out at once, while frames wait in bounded queues:
+ * latency-sensitive ones (by the DSCP of the IP packet inside) first, then
+ * the rest round-robin across networks. Set the rate a little under the
+ * real uplink rate so the queue forms here rather than in the modem.
+ *
+ * @param node Node instance
+ * @param bytesPerSecond Uplink rate or 0 to disable (default)
+ * @param interactiveDscp Bit N set if DSCP N is latency-sensitive, or 0 for EF, VOICE-ADMIT and CS5 to CS7
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setEgressRate(ZT_Node *node,uint64_t bytesPerSecond,uint64_t interactiveDscp);
+
+/**
+ * Enable or disable fast failover of direct paths
+ *
+ * While frames are being sent to a peer, the path they use is probed with
+ * an ECHO every probeInterval milliseconds in which nothing came back over
+ * it. After maxMissedProbes unanswered probes in a row the path is declared
+ * down, and traffic moves to the next best path or to relaying through an
+ * upstream until the path is heard from again. Probes are only sent for peers
+ * with recent traffic, so idle peers cost nothing. The other side must
+ * answer ECHO faster than once per second, which versions with this
+ * feature do.
+ *
+ * @param node Node instance
+ * @param probeInterval Probe interval in milliseconds (at least 100) or 0 to disable (default)
+ * @param maxMissedProbes Unanswered probes before a path is declared down (default: 3)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setFastFailover(ZT_Node *node,unsigned int probeInterval,unsigned int maxMissedProbes);
+
+/**
+ * Enable or disable adaptive keepalives for idle peers
+ *
+ * Normally every direct path gets a heartbeat every 14 seconds and a HELLO
+ * every minute. In adaptive mode, once no frames have gone either way for a
+ * minute, each path is kept alive with only a HELLO. The gap between HELLOs
+ * grows while replies show that the NAT binding lasted, and settles just
+ * under the longest gap it lasts, to at most about two minutes. Full cadence
+ * resumes as soon as frames flow again. Peers in a multipath mode always
+ * use full cadence.
+ *
+ * @param node Node instance
+ * @param enabled Nonzero to enable, zero to disable (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setAdaptiveKeepalive(ZT_Node *node,int enabled);
+
+/**
+ * Enable or disable forward error correction on lossy paths
+ *
+ * A packet bigger than a path's MTU is sent as several fragments and is
+ * lost if any one of them is. When this is enabled and HELLO/ECHO probes
+ * over a path show 1% loss or more, packets fragmented over that path are
+ * cut into equal slices and followed by an XOR parity fragment, and the
+ * receiver rebuilds any one lost slice from the rest. This costs one extra
+ * fragment per fragmented packet and stops once loss falls under 0.2%.
+ * Receivers that don't support it ignore parity fragments.
+ *
+ * @param node Node instance
+ * @param enabled Nonzero to enable, zero to disable (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setForwardErrorCorrection(ZT_Node *node,int enabled);
+
+/**
+ * Enable or disable aggregation of small frames
+ *
+ * When enabled, unicast frames of up to 512 bytes in one call to
+ * ZT_Node_processVirtualNetworkFrames() that go to the same peer on the
+ * same network are packed into as few packets as possible, each small
+ * enough to need no fragmenting. This saves a packet header, MAC and
+ * UDP/IP header per frame and cuts packets per second on both ends and on
+ * relays. Frames to a peer stay in order. Only peers of protocol version
+ * 10 or newer and peers not in a multipath mode are sent aggregated
+ * packets, and single-frame calls are never delayed.
+ *
+ * @param node Node instance
+ * @param enabled Nonzero to enable, zero to disable (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setFrameAggregation(ZT_Node *node,int enabled);
+
+/**
+ * Offer to relay traffic for peers on our networks
+ *
+ * Every 30 seconds, peers that share a network with this node and have a
+ * direct path to it are told its capacity and how much it is relaying.
+ * Those peers then send traffic for destinations on a network shared with
+ * this node, to which they have no direct path, through the least loaded,
+ * lowest latency peer that offered. They use roots and moons if no such
+ * peer is available or if nothing comes back through it. Setting the
+ * capacity back to zero withdraws the offer. This node relays only between
+ * peers it sent offers to that share a network, and drops such traffic
+ * over the offered capacity.
+ *
+ * @param node Node instance
+ * @param bytesPerSecond Relay capacity in bytes per second or 0 to not offer to relay (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setRelayCapacity(ZT_Node *node,uint64_t bytesPerSecond);
+
+/**
+ * Enable or disable pacing of frames to each path's estimated rate
+ *
+ * A burst of frames from the host, such as a TCP window handed over as one
+ * large segment, normally goes out as back to back datagrams, and shallow
+ * buffers in consumer routers and LTE links drop its tail. Once HELLO and
+ * ECHO probes over a path start to be lost while traffic is flowing, that
+ * path gets a rate estimate that starts at twice the rate it was carrying,
+ * shrinks when more probes are lost and grows while traffic keeps using it
+ * without loss. With pacing enabled, bulk frames over such a path are
+ * spread out to that rate, after a burst of 2ms worth. Frames are held for
+ * at most 100ms, and frames that would have to wait longer are dropped.
+ * Control packets and frames the egress scheduler treats as interactive
+ * are never paced.
+ *
+ * @param node Node instance
+ * @param enabled Nonzero to enable, zero to disable (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setPathPacing(ZT_Node *node,int enabled);
+
+/**
+ * Limit the peers and multicast group members held in memory
+ *
+ * Past the peer limit the least recently heard from peers, other than
+ * roots and moons, are written to the peer cache and dropped from memory,
+ * and are loaded from it again if they come back. The peer table is split
+ * into 64 shards and the limit applies to each, so it is rounded up to a
+ * multiple of 64. Past the multicast limit a new member of a group takes
+ * the place of that group's least recently heard from member. Defaults
+ * are no limits, or 4096 peers and 16384 members for builds with
+ * ZT_SMALL_FOOTPRINT defined. Together with the fixed size queues of that
+ * build, these bound the node's memory use (see the memory budget in
+ * README.md); ZT_Node_memoryUsage reports how much is in use and how much
+ * has been evicted.
+ *
+ * @param node Node instance
+ * @param maxPeers Maximum peers in memory or 0 for no limit
+ * @param maxMulticastMembers Maximum members of all multicast groups or 0 for no limit
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setMemoryLimits(ZT_Node *node,unsigned long maxPeers,unsigned long maxMulticastMembers);
+
+/**
+ * Limit how many MACs behind remote bridges each network remembers
+ *
+ * Each network learns which bridge a MAC is behind from the frames it
+ * sends, like an Ethernet switch. Past the overall limit the least recently
+ * seen MAC is forgotten, and past the per bridge limit the least recently
+ * seen MAC behind that bridge is, so one bridge can't push out the others'
+ * routes. Frames to a forgotten MAC go to all active bridges until it is
+ * seen again. Defaults are 262144 and 65536, or 16384 and 4096 for builds
+ * with ZT_SMALL_FOOTPRINT defined. Lowering them evicts routes at once.
+ *
+ * @param node Node instance
+ * @param maxRoutes Maximum routes in each network or 0 to learn none
+ * @param maxPerBridge Maximum routes behind any one bridge in each network or 0 to learn none
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setBridgeRouteLimits(ZT_Node *node,unsigned long maxRoutes,unsigned long maxPerBridge);
+
+/**
+ * Demote peers not heard from in a while to compact cold records
+ *
+ * Peers are normally held in full until ZT_PEER_ACTIVITY_TIMEOUT after they
+ * were last heard from, which on a root means memory grows with every peer
+ * seen in the last several minutes. With a timeout set, peers idle that
+ * long are written to the peer cache and replaced in memory by a record of
+ * a couple of hundred bytes holding their identity, last path and sealed
+ * agreed key. A packet from or to such a peer rebuilds it from the record
+ * without key agreement or a storage read. Demoted peers aren't listed by
+ * ZT_Node_peers. Roots and moons are never demoted. ZT_Node_memoryUsage
+ * reports cold records and promotions.
+ *
+ * @param node Node instance
+ * @param idleMs Idle time in milliseconds after which peers are demoted (at least 120000) or 0 to never demote (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setColdPeerTimeout(ZT_Node *node,int64_t idleMs);
+
+/**
+ * Set a CPU time budget for work done for unknown peers
+ *
+ * A HELLO from a peer this node doesn't know needs a key agreement and
+ * usually an identity validation, and other packets from unknown peers
+ * are queued while their senders are looked up. A root flooded with these,
+ * e.g. by mass reconnects after an outage, spends its time on them instead
+ * of on known peers. With a budget set this work is timed, and once it runs
+ * over budget it is shed, identity validation first, then key agreement,
+ * then WHOIS lookups. One source IPv4 /24 or IPv6 /48 gets at most an
+ * eighth of the budget. Traffic from known peers and relaying are never
+ * shed. Shed packets are counted as ZT_METRICS_DROP_OVERLOAD.
+ *
+ * @param node Node instance
+ * @param cpuMicrosecondsPerSecond CPU time per second for unknown peers, or 0 for no limit (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setAdmissionBudget(ZT_Node *node,uint64_t cpuMicrosecondsPerSecond);
+
+/**
+ * Set how many validated identities to remember
+ *
+ * Validating a new peer's identity runs a memory-hard hash. Identities
+ * that passed are remembered by address and key so a peer seen again, e.g.
+ * after it was dropped from memory, isn't validated twice. Each entry costs
+ * about 100 bytes. Defaults to 65536, or 4096 for builds with
+ * ZT_SMALL_FOOTPRINT defined. Hits and misses are in ZT_Metrics.
+ *
+ * @param node Node instance
+ * @param identities Maximum identities to remember or 0 to validate every time
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setIdentityCacheSize(ZT_Node *node,unsigned long identities);
+
+/**
+ * Set how many worker threads check HELLOs from new peers
+ *
+ * A HELLO from a peer this node doesn't know needs a key agreement and
+ * usually an identity validation, which take milliseconds. Done on the
+ * thread that received the HELLO they hold up every packet behind it. With
+ * worker threads this is done by the workers, and the thread that received
+ * the HELLO moves on. The HELLO is finished by the next thread to call into
+ * the node, so callbacks still only happen on threads that call into the
+ * node. While workers are busy, calls that take nextBackgroundTaskDeadline
+ * set it no more than 5ms out so results aren't left waiting.
+ *
+ * @param node Node instance
+ * @param threads Number of threads up to 64, or 0 to do this work inline (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setCryptoWorkers(ZT_Node *node,unsigned int threads);
+
+/**
+ * Pin crypto worker threads to CPUs
+ *
+ * Workers are pinned one to each CPU in turn, and running workers are
+ * restarted to move them. This is only done on Linux and Windows.
+ *
+ * @param node Node instance
+ * @param cpus CPU numbers as the OS counts them
+ * @param cpuCount Number of CPUs in cpus[], or 0 to leave workers unpinned (default)
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_setCryptoWorkerCpus(ZT_Node *node,const unsigned int *cpus,unsigned int cpuCount);
+
+/**
+ * Make this node a member of a root cluster
+ *
+ * All members of a cluster run the same root identity and each is one of
+ * the stable endpoints in the world that defines it. Members tell each
+ * other which peers they have over a private backplane, relay traffic for
+ * peers homed on other members, and redirect peers to the closest member
+ * or, without location information, to the least loaded one.
+ *
+ * Messages to other members are sent with sendFunction(arg,memberId,data,len)
+ * and must reach that member's ZT_Node_clusterHandleIncomingMessage(). They
+ * are encrypted and authenticated with keys derived from the secret key of
+ * the root identity, so the backplane needs no security of its own, but it
+ * should be a private network since every member is flooded with them.
+ *
+ * If addressToLocationFunction is non-NULL it is called as
+ * addressToLocationFunction(arg,addr,&x,&y,&z) and must return nonzero and
+ * fill x,y,z with a location (e.g. from GeoIP) in the same coordinate space
+ * as the x,y,z of each member, or return zero if it's not known.
+ *
+ * This must be called once, before packets are processed, and can't be undone.
+ *
+ * @param node Node instance
+ * @param myId ID of this member (0 to ZT_CLUSTER_MAX_MEMBERS-1)
+ * @param zeroTierPhysicalEndpoints ZeroTier UDP endpoints of this member
+ * @param numZeroTierPhysicalEndpoints Number of endpoints (at most ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES)
+ * @param x X location of this member
+ * @param y Y location of this member
+ * @param z Z location of this member
+ * @param sendFunction Function to send a message to another member
+ * @param sendFunctionArg First argument to sendFunction
+ * @param addressToLocationFunction Function to locate peers or NULL to balance by load only
+ * @param addressToLocationFunctionArg First argument to addressToLocationFunction
+ * @return OK or error code
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_clusterInit(
+	ZT_Node *node,
+	unsigned int myId,
+	const struct sockaddr_storage *zeroTierPhysicalEndpoints,
+	unsigned int numZeroTierPhysicalEndpoints,
+	int x,
+	int y,
+	int z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg);
+
+/**
+ * Add a member to this node's cluster
+ *
+ * @param node Node instance
+ * @param memberId ID of member (0 to ZT_CLUSTER_MAX_MEMBERS-1)
+ * @return OK or error if clustering is not initialized or the ID is invalid
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_clusterAddMember(ZT_Node *node,unsigned int memberId);
+
+/**
+ * Remove a member from this node's cluster
+ *
+ * @param node Node instance
+ * @param memberId ID of member to remove
+ */
+ZT_SDK_API void ZT_Node_clusterRemoveMember(ZT_Node *node,unsigned int memberId);
+
+/**
+ * Handle a message from another member of this node's cluster
+ *
+ * Messages that don't authenticate or aren't from a known member are ignored.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param msg Message data
+ * @param len Length of message (at most ZT_CLUSTER_MAX_MESSAGE_LENGTH)
+ */
+ZT_SDK_API void ZT_Node_clusterHandleIncomingMessage(ZT_Node *node,void *tptr,const void *msg,unsigned int len);
+
+/**
+ * Get the status of this node's cluster
+ *
+ * @param node Node instance
+ * @param cs Buffer to fill with cluster status
+ * @return 1 if this node is a cluster member and cs was filled, 0 if not
+ */
+ZT_SDK_API int ZT_Node_clusterStatus(ZT_Node *node,ZT_ClusterStatus *cs);
+
 /**
  * Get ZeroTier One version
  *
@@ -21,6 +21,10 @@ LOCAL_SRC_FILES := \
 	$(ZT1)/node/Capability.cpp \
 	$(ZT1)/node/CertificateOfMembership.cpp \
 	$(ZT1)/node/CertificateOfOwnership.cpp \
+	$(ZT1)/node/Cluster.cpp \
+	$(ZT1)/node/CryptoWorkers.cpp \
+	$(ZT1)/node/Egress.cpp \
+	$(ZT1)/node/HugePages.cpp \
 	$(ZT1)/node/Identity.cpp \
 	$(ZT1)/node/IncomingPacket.cpp \
 	$(ZT1)/node/InetAddress.cpp \
@@ -38,10 +42,12 @@ LOCAL_SRC_FILES := \
 	$(ZT1)/node/Salsa20.cpp \
 	$(ZT1)/node/SelfAwareness.cpp \
 	$(ZT1)/node/SHA512.cpp \
+	$(ZT1)/node/Shaper.cpp \
 	$(ZT1)/node/Switch.cpp \
 	$(ZT1)/node/Tag.cpp \
 	$(ZT1)/node/Topology.cpp \
 	$(ZT1)/node/Trace.cpp \
+	$(ZT1)/node/Traversal.cpp \
 	$(ZT1)/node/Utils.cpp \
 	$(ZT1)/osdep/OSUtils.cpp \
 	$(ZT1)/osdep/PortMapper.cpp
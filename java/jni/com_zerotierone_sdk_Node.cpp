@@ -38,6 +38,24 @@
 #include <string>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Size of each thread's direct buffer for frames and packets handed to Java
+#define ZT_JNI_BUFFER_SIZE 16384
+
+// Packets handed to PacketBufferSender start here, after the destination address
+#define ZT_JNI_PACKET_OFFSET 16
+
+// Size of each thread's direct buffers for batches of frames and packets handed to Java
+#define ZT_JNI_BATCH_BUFFER_SIZE 65536
+
+// Batch record headers; see PacketBatchSender and VirtualNetworkFrameBatchListener
+#define ZT_JNI_PACKET_HEADER_SIZE 32
+#define ZT_JNI_FRAME_HEADER_SIZE 40
+
+// Maximum packets or frames passed to the core per batched call
+#define ZT_JNI_MAX_BATCH 64
 
 // global static JNI Lookup Object
 JniLookup lookup;
@@ -61,6 +79,15 @@ namespace {
             , pathChecker(NULL)
             , callbacks(NULL)
             , portMapper(NULL)
+            , frameMethod(NULL)
+            , frameBufferMethod(NULL)
+            , frameBatchMethod(NULL)
+            , sendMethod(NULL)
+            , sendBufferMethod(NULL)
+            , sendBatchMethod(NULL)
+            , putMethod(NULL)
+            , deleteMethod(NULL)
+            , getMethod(NULL)
         {
             callbacks = (ZT_Node_Callbacks*)malloc(sizeof(ZT_Node_Callbacks));
             memset(callbacks, 0, sizeof(ZT_Node_Callbacks));
@@ -103,8 +130,221 @@ namespace {
         ZT_Node_Callbacks *callbacks;
 
         ZeroTier::PortMapper *portMapper;
+
+        // Looked up once by cacheMethods() since these are called per packet or state object
+        jmethodID frameMethod;
+        jmethodID frameBufferMethod; // NULL unless frameListener is a VirtualNetworkFrameBufferListener
+        jmethodID frameBatchMethod; // NULL unless frameListener is a VirtualNetworkFrameBatchListener
+        jmethodID sendMethod;
+        jmethodID sendBufferMethod; // NULL unless packetSender is a PacketBufferSender
+        jmethodID sendBatchMethod; // NULL unless packetSender is a PacketBatchSender
+        jmethodID putMethod;
+        jmethodID deleteMethod;
+        jmethodID getMethod;
+    };
+
+    /*
+     * Per-thread JNI state
+     *
+     * Core threads that call back into Java aren't started by the JVM, so
+     * they're attached the first time they need an env and detached when
+     * they exit. Each thread also gets direct ByteBuffers that frames and
+     * packets are copied into on their way to Java, so no Java object is
+     * allocated per packet: one for single frames and packets and one each
+     * for batches of frames and packets.
+     *
+     * Frames for a VirtualNetworkFrameBatchListener are collected in the
+     * frame batch while the core runs and handed over by flushThreadFrameBatch()
+     * before the call into the core returns to Java.
+     */
+    struct DirectBuffer
+    {
+        jobject buffer; // global ref to a direct ByteBuffer over data
+        void *data;
+    };
+
+    struct ThreadState
+    {
+        JavaVM *jvm;
+        JNIEnv *env;
+        bool attached;
+        DirectBuffer single;
+        DirectBuffer frames;
+        DirectBuffer packets;
+        JniRef *frameBatchRef; // node whose frames are in the frame batch
+        unsigned int frameBatchCount;
+        unsigned int frameBatchBytes;
+        bool inFrameBatch; // set while Java is reading the frame batch
+        bool inPacketBatch; // set while Java is reading the packet batch
     };
 
+    pthread_key_t threadStateKey;
+    pthread_once_t threadStateKeyOnce = PTHREAD_ONCE_INIT;
+
+    void destroyThreadState(void *p)
+    {
+        ThreadState *ts = (ThreadState*)p;
+        // Without an env the buffers can't be released, so they're left alone
+        JNIEnv *env = NULL;
+        if(ts->jvm->GetEnv((void**)&env, JNI_VERSION_1_6) == JNI_OK)
+        {
+            DirectBuffer *const buffers[3] = { &ts->single, &ts->frames, &ts->packets };
+            for(int i = 0; i < 3; ++i)
+            {
+                if(buffers[i]->buffer)
+                {
+                    env->DeleteGlobalRef(buffers[i]->buffer);
+                    free(buffers[i]->data);
+                }
+            }
+        }
+        if(ts->attached)
+            ts->jvm->DetachCurrentThread();
+        delete ts;
+    }
+
+    void createThreadStateKey()
+    {
+        pthread_key_create(&threadStateKey, &destroyThreadState);
+    }
+
+    ThreadState *getThreadState(JavaVM *jvm)
+    {
+        pthread_once(&threadStateKeyOnce, &createThreadStateKey);
+        ThreadState *ts = (ThreadState*)pthread_getspecific(threadStateKey);
+        if(ts == NULL)
+        {
+            ts = new ThreadState();
+            memset(ts, 0, sizeof(ThreadState));
+            ts->jvm = jvm;
+            if(jvm->GetEnv((void**)&ts->env, JNI_VERSION_1_6) == JNI_EDETACHED)
+            {
+#ifdef __ANDROID__
+                if(jvm->AttachCurrentThreadAsDaemon(&ts->env, NULL) == JNI_OK)
+#else
+                if(jvm->AttachCurrentThreadAsDaemon((void**)&ts->env, NULL) == JNI_OK)
+#endif
+                    ts->attached = true;
+                else ts->env = NULL;
+            }
+            pthread_setspecific(threadStateKey, ts);
+        }
+        return ts;
+    }
+
+    JNIEnv *getEnv(JavaVM *jvm)
+    {
+        return getThreadState(jvm)->env;
+    }
+
+    // Returns one of the thread's direct buffers, creating it on first use, or NULL on failure
+    jobject getDirectBuffer(ThreadState *ts, DirectBuffer &db, unsigned int size)
+    {
+        if((db.buffer == NULL)&&(ts->env != NULL))
+        {
+            void *data = malloc(size);
+            if(data == NULL)
+                return NULL;
+            jobject b = ts->env->NewDirectByteBuffer(data, size);
+            if(ts->env->ExceptionCheck() || b == NULL)
+            {
+                ts->env->ExceptionClear();
+                free(data);
+                return NULL;
+            }
+            db.buffer = ts->env->NewGlobalRef(b);
+            ts->env->DeleteLocalRef(b);
+            db.data = data;
+        }
+        return db.buffer;
+    }
+
+    // Size of a batch record, padded so the next record is 8-byte aligned
+    inline unsigned int batchRecordSize(unsigned int headerSize, unsigned int length)
+    {
+        return headerSize + ((length + 7) & ~7U);
+    }
+
+    // Hands the calling thread's collected frames to Java
+    void flushFrameBatch(ThreadState *ts)
+    {
+        if((ts == NULL)||(ts->frameBatchCount == 0))
+            return;
+        JniRef *ref = ts->frameBatchRef;
+        const jint count = (jint)ts->frameBatchCount;
+        ts->frameBatchCount = 0;
+        ts->frameBatchBytes = 0;
+        ts->frameBatchRef = NULL;
+        ts->inFrameBatch = true;
+        ts->env->CallVoidMethod(ref->frameListener, ref->frameBatchMethod, ts->frames.buffer, count);
+        ts->inFrameBatch = false;
+    }
+
+    // Called by natives after the core returns, so collected frames reach Java before they do
+    void flushThreadFrameBatch()
+    {
+        pthread_once(&threadStateKeyOnce, &createThreadStateKey);
+        flushFrameBatch((ThreadState*)pthread_getspecific(threadStateKey));
+    }
+
+    // Looks up a method, clearing the exception if it isn't there
+    jmethodID findOptionalMethod(JNIEnv *env, jobject obj, const char *ifaceName, const char *name, const char *sig)
+    {
+        jclass iface = env->FindClass(ifaceName);
+        if(env->ExceptionCheck() || iface == NULL)
+        {
+            env->ExceptionClear();
+            return NULL;
+        }
+        jmethodID mid = NULL;
+        if(env->IsInstanceOf(obj, iface))
+        {
+            mid = env->GetMethodID(iface, name, sig);
+            if(env->ExceptionCheck())
+            {
+                env->ExceptionClear();
+                mid = NULL;
+            }
+        }
+        env->DeleteLocalRef(iface);
+        return mid;
+    }
+
+    void cacheMethods(JNIEnv *env, JniRef *ref)
+    {
+        jclass cls = env->GetObjectClass(ref->frameListener);
+        ref->frameMethod = lookup.findMethod(cls, "onVirtualNetworkFrame", "(JJJJJ[B)V");
+        env->DeleteLocalRef(cls);
+        ref->frameBufferMethod = findOptionalMethod(env, ref->frameListener,
+            "com/zerotier/sdk/VirtualNetworkFrameBufferListener",
+            "onVirtualNetworkFrameBuffer", "(JJJJJLjava/nio/ByteBuffer;I)V");
+        ref->frameBatchMethod = findOptionalMethod(env, ref->frameListener,
+            "com/zerotier/sdk/VirtualNetworkFrameBatchListener",
+            "onVirtualNetworkFrames", "(Ljava/nio/ByteBuffer;I)V");
+
+        cls = env->GetObjectClass(ref->packetSender);
+        ref->sendMethod = lookup.findMethod(cls, "onSendPacketRequested", "(JLjava/net/InetSocketAddress;[BI)I");
+        env->DeleteLocalRef(cls);
+        ref->sendBufferMethod = findOptionalMethod(env, ref->packetSender,
+            "com/zerotier/sdk/PacketBufferSender",
+            "onSendPacketBuffer", "(JLjava/nio/ByteBuffer;IIII)I");
+        ref->sendBatchMethod = findOptionalMethod(env, ref->packetSender,
+            "com/zerotier/sdk/PacketBatchSender",
+            "onSendPackets", "(Ljava/nio/ByteBuffer;I)V");
+
+        cls = env->GetObjectClass(ref->dataStorePutListener);
+        ref->putMethod = lookup.findMethod(cls, "onDataStorePut", "(Ljava/lang/String;[BZ)I");
+        ref->deleteMethod = lookup.findMethod(cls, "onDelete", "(Ljava/lang/String;)I");
+        env->DeleteLocalRef(cls);
+
+        cls = env->GetObjectClass(ref->dataStoreGetListener);
+        ref->getMethod = lookup.findMethod(cls, "onDataStoreGet", "(Ljava/lang/String;[B)J");
+        env->DeleteLocalRef(cls);
+
+        if(env->ExceptionCheck())
+            env->ExceptionClear();
+    }
+
 
     int VirtualNetworkConfigFunctionCallback(
         ZT_Node *node,
@@ -117,8 +357,7 @@ namespace {
     {
         LOGV("VritualNetworkConfigFunctionCallback");
         JniRef *ref = (JniRef*)userData;
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        JNIEnv *env = getEnv(ref->jvm);
 
         if (ref->configListener == NULL) {
             LOGE("configListener is NULL");
@@ -180,25 +419,50 @@ namespace {
 #endif
         JniRef *ref = (JniRef*)userData;
         assert(ref->node == node);
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        ThreadState *ts = getThreadState(ref->jvm);
+        JNIEnv *env = ts->env;
 
-        if (ref->frameListener == NULL) {
+        if (env == NULL || ref->frameListener == NULL) {
             LOGE("frameListener is NULL");
             return;
         }
 
-        jclass frameListenerClass = env->GetObjectClass(ref->frameListener);
-        if(env->ExceptionCheck() || frameListenerClass == NULL)
+        const unsigned int recordSize = batchRecordSize(ZT_JNI_FRAME_HEADER_SIZE, frameLength);
+        if (ref->frameBatchMethod != NULL && !ts->inFrameBatch && recordSize <= ZT_JNI_BATCH_BUFFER_SIZE && getDirectBuffer(ts, ts->frames, ZT_JNI_BATCH_BUFFER_SIZE) != NULL)
         {
-            LOGE("Couldn't find class for VirtualNetworkFrameListener instance");
+            if ((ts->frameBatchRef != NULL && ts->frameBatchRef != ref) || (ts->frameBatchBytes + recordSize) > ZT_JNI_BATCH_BUFFER_SIZE)
+                flushFrameBatch(ts);
+
+            uint8_t *const r = (uint8_t*)ts->frames.data + ts->frameBatchBytes;
+            const int64_t n = (int64_t)nwid, s = (int64_t)sourceMac, d = (int64_t)destMac;
+            const int32_t et = (int32_t)etherType, vl = (int32_t)vlanid, len = (int32_t)frameLength;
+            memcpy(r, &n, 8);
+            memcpy(r + 8, &s, 8);
+            memcpy(r + 16, &d, 8);
+            memcpy(r + 24, &et, 4);
+            memcpy(r + 28, &vl, 4);
+            memcpy(r + 32, &len, 4);
+            memset(r + 36, 0, 4);
+            memcpy(r + ZT_JNI_FRAME_HEADER_SIZE, frameData, frameLength);
+
+            ts->frameBatchRef = ref;
+            ++ts->frameBatchCount;
+            ts->frameBatchBytes += recordSize;
             return;
         }
 
-        jmethodID frameListenerCallbackMethod = lookup.findMethod(
-            frameListenerClass,
-            "onVirtualNetworkFrame", "(JJJJJ[B)V");
-        if(env->ExceptionCheck() || frameListenerCallbackMethod == NULL)
+        if (ref->frameBufferMethod != NULL && frameLength <= ZT_JNI_BUFFER_SIZE)
+        {
+            jobject buffer = getDirectBuffer(ts, ts->single, ZT_JNI_BUFFER_SIZE);
+            if (buffer != NULL)
+            {
+                memcpy(ts->single.data, frameData, frameLength);
+                env->CallVoidMethod(ref->frameListener, ref->frameBufferMethod, (jlong)nwid, (jlong)sourceMac, (jlong)destMac, (jlong)etherType, (jlong)vlanid, buffer, (jint)frameLength);
+                return;
+            }
+        }
+
+        if (ref->frameMethod == NULL)
         {
             LOGE("Couldn't find onVirtualNetworkFrame() method");
             return;
@@ -210,18 +474,10 @@ namespace {
             LOGE("Couldn't create frame data array");
             return;
         }
+        env->SetByteArrayRegion(dataArray, 0, frameLength, (const jbyte*)frameData);
 
-        void *data = env->GetPrimitiveArrayCritical(dataArray, NULL);
-        memcpy(data, frameData, frameLength);
-        env->ReleasePrimitiveArrayCritical(dataArray, data, 0);
-
-        if(env->ExceptionCheck())
-        {
-            LOGE("Error setting frame data to array");
-            return;
-        }
-
-        env->CallVoidMethod(ref->frameListener, frameListenerCallbackMethod, (jlong)nwid, (jlong)sourceMac, (jlong)destMac, (jlong)etherType, (jlong)vlanid, dataArray);
+        env->CallVoidMethod(ref->frameListener, ref->frameMethod, (jlong)nwid, (jlong)sourceMac, (jlong)destMac, (jlong)etherType, (jlong)vlanid, dataArray);
+        env->DeleteLocalRef(dataArray);
     }
 
 
@@ -236,8 +492,7 @@ namespace {
             LOGE("Nodes not equal. ref->node %p, node %p. Event: %d", ref->node, node, event);
             return;
         }
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void **) &env, JNI_VERSION_1_6);
+        JNIEnv *env = getEnv(ref->jvm);
 
         if (ref->eventListener == NULL) {
             LOGE("eventListener is NULL");
@@ -352,41 +607,26 @@ namespace {
         }
 
         JniRef *ref = (JniRef*)userData;
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        JNIEnv *env = getEnv(ref->jvm);
 
-        if (ref->dataStorePutListener == NULL) {
+        if (env == NULL || ref->dataStorePutListener == NULL) {
             LOGE("dataStorePutListener is NULL");
             return;
         }
 
-        jclass dataStorePutClass = env->GetObjectClass(ref->dataStorePutListener);
-        if (dataStorePutClass == NULL)
+        if (ref->putMethod == NULL || ref->deleteMethod == NULL)
         {
-            LOGE("Couldn't find class for DataStorePutListener instance");
+            LOGE("Couldn't find onDataStorePut or onDelete method");
             return;
         }
 
-        jmethodID dataStorePutCallbackMethod = lookup.findMethod(
-                dataStorePutClass,
-                "onDataStorePut",
-                "(Ljava/lang/String;[BZ)I");
-        if(dataStorePutCallbackMethod == NULL)
-        {
-            LOGE("Couldn't find onDataStorePut method");
-            return;
-        }
-
-        jmethodID deleteMethod = lookup.findMethod(dataStorePutClass,
-                                                   "onDelete", "(Ljava/lang/String;)I");
-        if(deleteMethod == NULL)
+        jstring nameStr = env->NewStringUTF(p);
+        if (nameStr == NULL)
         {
-            LOGE("Couldn't find onDelete method");
+            LOGE("Error creating name string object");
             return;
         }
 
-        jstring nameStr = env->NewStringUTF(p);
-
         if (bufferLength >= 0) {
             LOGD("JNI: Write file: %s", p);
             // set operation
@@ -394,18 +634,21 @@ namespace {
             if(env->ExceptionCheck() || bufferObj == NULL)
             {
                 LOGE("Error creating byte array buffer!");
+                env->DeleteLocalRef(nameStr);
                 return;
             }
 
             env->SetByteArrayRegion(bufferObj, 0, bufferLength, (jbyte*)buffer);
 
             env->CallIntMethod(ref->dataStorePutListener,
-                               dataStorePutCallbackMethod,
+                               ref->putMethod,
                                nameStr, bufferObj, secure);
+            env->DeleteLocalRef(bufferObj);
         } else {
             LOGD("JNI: Delete file: %s", p);
-            env->CallIntMethod(ref->dataStorePutListener, deleteMethod, nameStr);
+            env->CallIntMethod(ref->dataStorePutListener, ref->deleteMethod, nameStr);
         }
+        env->DeleteLocalRef(nameStr);
     }
 
     int StateGetFunction(
@@ -445,26 +688,14 @@ namespace {
         }
 
         JniRef *ref = (JniRef*)userData;
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        JNIEnv *env = getEnv(ref->jvm);
 
-        if (ref->dataStoreGetListener == NULL) {
+        if (env == NULL || ref->dataStoreGetListener == NULL) {
             LOGE("dataStoreGetListener is NULL");
             return -2;
         }
 
-        jclass dataStoreGetClass = env->GetObjectClass(ref->dataStoreGetListener);
-        if(dataStoreGetClass == NULL)
-        {
-            LOGE("Couldn't find class for DataStoreGetListener instance");
-            return -2;
-        }
-
-        jmethodID dataStoreGetCallbackMethod = lookup.findMethod(
-                dataStoreGetClass,
-                "onDataStoreGet",
-                "(Ljava/lang/String;[B)J");
-        if(dataStoreGetCallbackMethod == NULL)
+        if(ref->getMethod == NULL)
         {
             LOGE("Couldn't find onDataStoreGet method");
             return -2;
@@ -481,6 +712,7 @@ namespace {
         if(bufferObj == NULL)
         {
             LOGE("Error creating byte[] buffer of size: %u", bufferLength);
+            env->DeleteLocalRef(nameStr);
             return -2;
         }
 
@@ -488,19 +720,19 @@ namespace {
 
         int retval = (int)env->CallLongMethod(
                 ref->dataStoreGetListener,
-                dataStoreGetCallbackMethod,
+                ref->getMethod,
                 nameStr,
                 bufferObj);
 
         LOGV("onDataStoreGet returned %d", retval);
 
+        if(retval > (int)bufferLength)
+            retval = (int)bufferLength;
         if(retval > 0)
-        {
-            void *data = env->GetPrimitiveArrayCritical(bufferObj, NULL);
-            memcpy(buffer, data, retval);
-            env->ReleasePrimitiveArrayCritical(bufferObj, data, 0);
-        }
+            env->GetByteArrayRegion(bufferObj, 0, retval, (jbyte*)buffer);
 
+        env->DeleteLocalRef(bufferObj);
+        env->DeleteLocalRef(nameStr);
         return retval;
     }
 
@@ -517,24 +749,45 @@ namespace {
         JniRef *ref = (JniRef*)userData;
         assert(ref->node == node);
 
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        ThreadState *ts = getThreadState(ref->jvm);
+        JNIEnv *env = ts->env;
 
-        if (ref->packetSender == NULL) {
+        if (env == NULL || ref->packetSender == NULL) {
             LOGE("packetSender is NULL");
             return -1;
         }
 
-        jclass packetSenderClass = env->GetObjectClass(ref->packetSender);
-        if(packetSenderClass == NULL)
+        if (ref->sendBufferMethod != NULL && bufferSize <= (ZT_JNI_BUFFER_SIZE - ZT_JNI_PACKET_OFFSET))
         {
-            LOGE("Couldn't find class for PacketSender instance");
-            return -1;
+            jobject directBuffer = getDirectBuffer(ts, ts->single, ZT_JNI_BUFFER_SIZE);
+            if (directBuffer != NULL)
+            {
+                uint8_t *const d = (uint8_t*)ts->single.data;
+                jint addressLength, port;
+                if (remoteAddress->ss_family == AF_INET6)
+                {
+                    const sockaddr_in6 *const sin6 = (const sockaddr_in6*)remoteAddress;
+                    memcpy(d, &sin6->sin6_addr, 16);
+                    addressLength = 16;
+                    port = (jint)ntohs(sin6->sin6_port);
+                }
+                else if (remoteAddress->ss_family == AF_INET)
+                {
+                    const sockaddr_in *const sin = (const sockaddr_in*)remoteAddress;
+                    memcpy(d, &sin->sin_addr, 4);
+                    addressLength = 4;
+                    port = (jint)ntohs(sin->sin_port);
+                }
+                else
+                {
+                    return -1;
+                }
+                memcpy(d + ZT_JNI_PACKET_OFFSET, buffer, bufferSize);
+                return env->CallIntMethod(ref->packetSender, ref->sendBufferMethod, (jlong)localSocket, directBuffer, addressLength, port, (jint)bufferSize, (jint)ttl);
+            }
         }
 
-        jmethodID packetSenderCallbackMethod = lookup.findMethod(packetSenderClass,
-            "onSendPacketRequested", "(JLjava/net/InetSocketAddress;[BI)I");
-        if(packetSenderCallbackMethod == NULL)
+        if(ref->sendMethod == NULL)
         {
             LOGE("Couldn't find onSendPacketRequested method");
             return -2;
@@ -542,13 +795,95 @@ namespace {
 
         jobject remoteAddressObj = newInetSocketAddress(env, *remoteAddress);
         jbyteArray bufferObj = env->NewByteArray(bufferSize);
+        if(env->ExceptionCheck() || remoteAddressObj == NULL || bufferObj == NULL)
+        {
+            LOGE("Error creating packet objects");
+            return -1;
+        }
         env->SetByteArrayRegion(bufferObj, 0, bufferSize, (jbyte*)buffer);
-        int retval = env->CallIntMethod(ref->packetSender, packetSenderCallbackMethod, localSocket, remoteAddressObj, bufferObj);
+        int retval = env->CallIntMethod(ref->packetSender, ref->sendMethod, (jlong)localSocket, remoteAddressObj, bufferObj, (jint)ttl);
+        env->DeleteLocalRef(bufferObj);
+        env->DeleteLocalRef(remoteAddressObj);
 
         LOGV("JNI Packet Sender returned: %d", retval);
         return retval;
     }
 
+    int WirePacketBatchSendFunction(ZT_Node *node,
+        void *userData,
+        void *threadData,
+        const ZT_WirePacket *packets,
+        unsigned int count)
+    {
+        LOGV("WirePacketBatchSendFunction(%p, %u)", packets, count);
+        JniRef *ref = (JniRef*)userData;
+        assert(ref->node == node);
+
+        ThreadState *ts = getThreadState(ref->jvm);
+        JNIEnv *env = ts->env;
+
+        if (env == NULL || ref->sendBatchMethod == NULL || ts->inPacketBatch || getDirectBuffer(ts, ts->packets, ZT_JNI_BATCH_BUFFER_SIZE) == NULL)
+        {
+            for(unsigned int i = 0; i < count; ++i)
+                WirePacketSendFunction(node, userData, threadData, packets[i].localSocket, &packets[i].address, packets[i].data, packets[i].length, packets[i].ttl);
+            return 0;
+        }
+
+        ts->inPacketBatch = true;
+        uint8_t *const base = (uint8_t*)ts->packets.data;
+        jint n = 0;
+        unsigned int bytes = 0;
+        for(unsigned int i = 0; i < count; ++i)
+        {
+            const ZT_WirePacket &p = packets[i];
+            const unsigned int recordSize = batchRecordSize(ZT_JNI_PACKET_HEADER_SIZE, p.length);
+            if (recordSize > ZT_JNI_BATCH_BUFFER_SIZE || (p.address.ss_family != AF_INET && p.address.ss_family != AF_INET6))
+            {
+                WirePacketSendFunction(node, userData, threadData, p.localSocket, &p.address, p.data, p.length, p.ttl);
+                continue;
+            }
+            if ((bytes + recordSize) > ZT_JNI_BATCH_BUFFER_SIZE)
+            {
+                env->CallVoidMethod(ref->packetSender, ref->sendBatchMethod, ts->packets.buffer, n);
+                n = 0;
+                bytes = 0;
+            }
+
+            uint8_t *const r = base + bytes;
+            memset(r, 0, ZT_JNI_PACKET_HEADER_SIZE);
+            const int64_t sock = p.localSocket;
+            const int32_t len = (int32_t)p.length;
+            uint16_t port;
+            if (p.address.ss_family == AF_INET6)
+            {
+                const sockaddr_in6 *const sin6 = (const sockaddr_in6*)&p.address;
+                memcpy(r + 16, &sin6->sin6_addr, 16);
+                r[14] = 16;
+                port = ntohs(sin6->sin6_port);
+            }
+            else
+            {
+                const sockaddr_in *const sin = (const sockaddr_in*)&p.address;
+                memcpy(r + 16, &sin->sin_addr, 4);
+                r[14] = 4;
+                port = ntohs(sin->sin_port);
+            }
+            memcpy(r, &sock, 8);
+            memcpy(r + 8, &len, 4);
+            memcpy(r + 12, &port, 2);
+            r[15] = (uint8_t)((p.ttl > 255) ? 255 : p.ttl);
+            memcpy(r + ZT_JNI_PACKET_HEADER_SIZE, p.data, p.length);
+
+            ++n;
+            bytes += recordSize;
+        }
+        if (n > 0)
+            env->CallVoidMethod(ref->packetSender, ref->sendBatchMethod, ts->packets.buffer, n);
+        ts->inPacketBatch = false;
+
+        return 0;
+    }
+
     int PathCheckFunction(ZT_Node *node,
         void *userPtr,
         void *threadPtr,
@@ -563,8 +898,7 @@ namespace {
             return true;
         }
 
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        JNIEnv *env = getEnv(ref->jvm);
 
         jclass pathCheckerClass = env->GetObjectClass(ref->pathChecker);
         if(pathCheckerClass == NULL)
@@ -606,8 +940,7 @@ namespace {
             return false;
         }
 
-        JNIEnv *env = NULL;
-        ref->jvm->GetEnv((void**)&env, JNI_VERSION_1_6);
+        JNIEnv *env = getEnv(ref->jvm);
 
         jclass pathCheckerClass = env->GetObjectClass(ref->pathChecker);
         if(pathCheckerClass == NULL)
@@ -850,6 +1183,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_node_1init(
         ref->pathChecker = env->NewGlobalRef(tmp);
     }
 
+    cacheMethods(env, ref);
+
     ref->callbacks->stateGetFunction = &StateGetFunction;
     ref->callbacks->statePutFunction = &StatePutFunction;
     ref->callbacks->wirePacketSendFunction = &WirePacketSendFunction;
@@ -858,6 +1193,8 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_node_1init(
     ref->callbacks->eventCallback = &EventCallback;
     ref->callbacks->pathCheckFunction = &PathCheckFunction;
     ref->callbacks->pathLookupFunction = &PathLookupFunction;
+    ref->callbacks->wirePacketBatchSendFunction = &WirePacketBatchSendFunction;
+    ref->callbacks->version = 1;
 
     ZT_ResultCode rc = ZT_Node_new(
         &node,
@@ -987,6 +1324,7 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrame(
         (const void*)localData,
         frameLength,
         &nextBackgroundTaskDeadline);
+    flushThreadFrameBatch();
 
     jlong *outDeadline = (jlong*)env->GetPrimitiveArrayCritical(out_nextBackgroundTaskDeadline, NULL);
     outDeadline[0] = (jlong)nextBackgroundTaskDeadline;
@@ -1142,6 +1480,7 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacket(
         localData,
         packetLength,
         &nextBackgroundTaskDeadline);
+    flushThreadFrameBatch();
     if(rc != ZT_RESULT_OK)
     {
         LOGE("ZT_Node_processWirePacket returned: %d", rc);
@@ -1156,6 +1495,338 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacket(
     return createResultObject(env, rc);
 }
 
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrameBuffer
+ * Signature: (JJJJJIILjava/nio/ByteBuffer;II[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrameBuffer(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jlong in_nwid,
+    jlong in_sourceMac,
+    jlong in_destMac,
+    jint in_etherType,
+    jint in_vlanId,
+    jobject in_frameBuffer,
+    jint in_offset,
+    jint in_length,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    ZT_Node *node = findNode((int64_t)id);
+    if(node == NULL)
+    {
+        // cannot find valid node.  We should  never get here.
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    // The frame is read where it is, with no copy and nothing allocated
+    const uint8_t *frameData = (const uint8_t*)env->GetDirectBufferAddress(in_frameBuffer);
+    const jlong capacity = env->GetDirectBufferCapacity(in_frameBuffer);
+    if((frameData == NULL)||(in_offset < 0)||(in_length < 0)||(((jlong)in_offset + (jlong)in_length) > capacity)||(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1))
+    {
+        LOGE("Invalid frame buffer");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    int64_t nextBackgroundTaskDeadline = 0;
+
+    ZT_ResultCode rc = ZT_Node_processVirtualNetworkFrame(
+        node,
+        NULL,
+        (int64_t)in_now,
+        (uint64_t)in_nwid,
+        (uint64_t)in_sourceMac,
+        (uint64_t)in_destMac,
+        (unsigned int)in_etherType,
+        (unsigned int)in_vlanId,
+        (const void*)(frameData + in_offset),
+        (unsigned int)in_length,
+        &nextBackgroundTaskDeadline);
+    flushThreadFrameBatch();
+
+    const jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
+
+    return (jint)rc;
+}
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePacketBuffer
+ * Signature: (JJJ[BILjava/nio/ByteBuffer;II[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processWirePacketBuffer(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jlong in_localSocket,
+    jbyteArray in_remoteAddress,
+    jint in_remotePort,
+    jobject in_packetBuffer,
+    jint in_offset,
+    jint in_length,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    ZT_Node *node = findNode((int64_t)id);
+    if(node == NULL)
+    {
+        // cannot find valid node.  We should  never get here.
+        LOGE("Couldn't find a valid node!");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    const uint8_t *packetData = (const uint8_t*)env->GetDirectBufferAddress(in_packetBuffer);
+    const jlong capacity = env->GetDirectBufferCapacity(in_packetBuffer);
+    if((packetData == NULL)||(in_offset < 0)||(in_length <= 0)||(((jlong)in_offset + (jlong)in_length) > capacity)||(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1))
+    {
+        LOGE("Invalid packet buffer");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    sockaddr_storage remoteAddress = {};
+    const jsize addrSize = env->GetArrayLength(in_remoteAddress);
+    if(addrSize == 16)
+    {
+        sockaddr_in6 *const ipv6 = (sockaddr_in6*)&remoteAddress;
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons((uint16_t)in_remotePort);
+        env->GetByteArrayRegion(in_remoteAddress, 0, 16, (jbyte*)ipv6->sin6_addr.s6_addr);
+    }
+    else if(addrSize == 4)
+    {
+        sockaddr_in *const ipv4 = (sockaddr_in*)&remoteAddress;
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons((uint16_t)in_remotePort);
+        env->GetByteArrayRegion(in_remoteAddress, 0, 4, (jbyte*)&ipv4->sin_addr);
+    }
+    else
+    {
+        LOGE("Unknown IP version");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    int64_t nextBackgroundTaskDeadline = 0;
+
+    ZT_ResultCode rc = ZT_Node_processWirePacket(
+        node,
+        NULL,
+        (int64_t)in_now,
+        (int64_t)in_localSocket,
+        &remoteAddress,
+        (const void*)(packetData + in_offset),
+        (unsigned int)in_length,
+        &nextBackgroundTaskDeadline);
+    flushThreadFrameBatch();
+    if(rc != ZT_RESULT_OK)
+    {
+        LOGE("ZT_Node_processWirePacket returned: %d", rc);
+    }
+
+    const jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
+
+    return (jint)rc;
+}
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePackets
+ * Signature: (JJLjava/nio/ByteBuffer;I[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processWirePackets(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jobject in_packets,
+    jint in_count,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    ZT_Node *node = findNode((int64_t)id);
+    if(node == NULL)
+    {
+        // cannot find valid node.  We should  never get here.
+        LOGE("Couldn't find a valid node!");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    const uint8_t *data = (const uint8_t*)env->GetDirectBufferAddress(in_packets);
+    const jlong capacity = env->GetDirectBufferCapacity(in_packets);
+    if((data == NULL)||(in_count < 0)||(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1))
+    {
+        LOGE("Invalid packet batch");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    // Records are parsed into chunks of ZT_JNI_MAX_BATCH and passed to the core in place
+    ZT_WirePacket packets[ZT_JNI_MAX_BATCH];
+    int64_t nextBackgroundTaskDeadline = 0;
+    ZT_ResultCode rc = ZT_RESULT_OK;
+    jlong pos = 0;
+    jint remaining = in_count;
+    while((remaining > 0)&&(rc == ZT_RESULT_OK))
+    {
+        unsigned int n = 0;
+        while((n < ZT_JNI_MAX_BATCH)&&(remaining > 0))
+        {
+            if((pos + ZT_JNI_PACKET_HEADER_SIZE) > capacity)
+            {
+                remaining = 0;
+                break;
+            }
+            const uint8_t *const r = data + pos;
+            int64_t sock;
+            int32_t len;
+            uint16_t port;
+            memcpy(&sock, r, 8);
+            memcpy(&len, r + 8, 4);
+            memcpy(&port, r + 12, 2);
+            if((len <= 0)||((pos + ZT_JNI_PACKET_HEADER_SIZE + (jlong)len) > capacity))
+            {
+                remaining = 0;
+                break;
+            }
+
+            ZT_WirePacket &p = packets[n];
+            memset(&p.address, 0, sizeof(p.address));
+            if(r[14] == 16)
+            {
+                sockaddr_in6 *const ipv6 = (sockaddr_in6*)&p.address;
+                ipv6->sin6_family = AF_INET6;
+                ipv6->sin6_port = htons(port);
+                memcpy(ipv6->sin6_addr.s6_addr, r + 16, 16);
+            }
+            else if(r[14] == 4)
+            {
+                sockaddr_in *const ipv4 = (sockaddr_in*)&p.address;
+                ipv4->sin_family = AF_INET;
+                ipv4->sin_port = htons(port);
+                memcpy(&ipv4->sin_addr, r + 16, 4);
+            }
+            p.localSocket = sock;
+            p.data = r + ZT_JNI_PACKET_HEADER_SIZE;
+            p.length = (unsigned int)len;
+            p.ttl = 0;
+            p.tos = 0;
+
+            pos += batchRecordSize(ZT_JNI_PACKET_HEADER_SIZE, (unsigned int)len);
+            --remaining;
+            if(p.address.ss_family != 0)
+                ++n;
+        }
+        if(n == 0)
+            continue;
+
+        rc = ZT_Node_processWirePackets(
+            node,
+            NULL,
+            (int64_t)in_now,
+            packets,
+            n,
+            &nextBackgroundTaskDeadline);
+        if(rc != ZT_RESULT_OK)
+        {
+            LOGE("ZT_Node_processWirePackets returned: %d", rc);
+        }
+    }
+    flushThreadFrameBatch();
+
+    const jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
+
+    return (jint)rc;
+}
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrames
+ * Signature: (JJJLjava/nio/ByteBuffer;I[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrames(
+    JNIEnv *env, jobject obj,
+    jlong id,
+    jlong in_now,
+    jlong in_nwid,
+    jobject in_frames,
+    jint in_count,
+    jlongArray out_nextBackgroundTaskDeadline)
+{
+    ZT_Node *node = findNode((int64_t)id);
+    if(node == NULL)
+    {
+        // cannot find valid node.  We should  never get here.
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    const uint8_t *data = (const uint8_t*)env->GetDirectBufferAddress(in_frames);
+    const jlong capacity = env->GetDirectBufferCapacity(in_frames);
+    if((data == NULL)||(in_count < 0)||(env->GetArrayLength(out_nextBackgroundTaskDeadline) < 1))
+    {
+        LOGE("Invalid frame batch");
+        return (jint)ZT_RESULT_FATAL_ERROR_INTERNAL;
+    }
+
+    ZT_VirtualNetworkFrame frames[ZT_JNI_MAX_BATCH];
+    int64_t nextBackgroundTaskDeadline = 0;
+    ZT_ResultCode rc = ZT_RESULT_OK;
+    jlong pos = 0;
+    jint remaining = in_count;
+    while((remaining > 0)&&(rc == ZT_RESULT_OK))
+    {
+        unsigned int n = 0;
+        while((n < ZT_JNI_MAX_BATCH)&&(remaining > 0))
+        {
+            if((pos + ZT_JNI_FRAME_HEADER_SIZE) > capacity)
+            {
+                remaining = 0;
+                break;
+            }
+            const uint8_t *const r = data + pos;
+            int64_t sourceMac, destMac;
+            int32_t etherType, vlanId, len;
+            memcpy(&sourceMac, r + 8, 8);
+            memcpy(&destMac, r + 16, 8);
+            memcpy(&etherType, r + 24, 4);
+            memcpy(&vlanId, r + 28, 4);
+            memcpy(&len, r + 32, 4);
+            if((len < 0)||((pos + ZT_JNI_FRAME_HEADER_SIZE + (jlong)len) > capacity))
+            {
+                remaining = 0;
+                break;
+            }
+
+            ZT_VirtualNetworkFrame &f = frames[n++];
+            f.sourceMac = (uint64_t)sourceMac;
+            f.destMac = (uint64_t)destMac;
+            f.etherType = (unsigned int)etherType;
+            f.vlanId = (unsigned int)vlanId;
+            f.data = r + ZT_JNI_FRAME_HEADER_SIZE;
+            f.length = (unsigned int)len;
+
+            pos += batchRecordSize(ZT_JNI_FRAME_HEADER_SIZE, (unsigned int)len);
+            --remaining;
+        }
+        if(n == 0)
+            continue;
+
+        rc = ZT_Node_processVirtualNetworkFrames(
+            node,
+            NULL,
+            (int64_t)in_now,
+            (uint64_t)in_nwid,
+            frames,
+            n,
+            &nextBackgroundTaskDeadline);
+    }
+    flushThreadFrameBatch();
+
+    const jlong outDeadline = (jlong)nextBackgroundTaskDeadline;
+    env->SetLongArrayRegion(out_nextBackgroundTaskDeadline, 0, 1, &outDeadline);
+
+    return (jint)rc;
+}
+
 /*
  * Class:     com_zerotier_sdk_Node
  * Method:    processBackgroundTasks
@@ -1185,6 +1856,7 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processBackgroundTasks(
     int64_t nextBackgroundTaskDeadline = 0;
 
     ZT_ResultCode rc = ZT_Node_processBackgroundTasks(node, NULL, now, &nextBackgroundTaskDeadline);
+    flushThreadFrameBatch();
 
     jlong *outDeadline = (jlong*)env->GetPrimitiveArrayCritical(out_nextBackgroundTaskDeadline, NULL);
     outDeadline[0] = (jlong)nextBackgroundTaskDeadline;
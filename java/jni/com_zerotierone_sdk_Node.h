@@ -39,6 +39,38 @@ JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrame
 JNIEXPORT jobject JNICALL Java_com_zerotier_sdk_Node_processWirePacket
   (JNIEnv *, jobject, jlong, jlong, jlong, jobject, jbyteArray, jlongArray);
 
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrameBuffer
+ * Signature: (JJJJJIILjava/nio/ByteBuffer;II[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrameBuffer
+  (JNIEnv *, jobject, jlong, jlong, jlong, jlong, jlong, jint, jint, jobject, jint, jint, jlongArray);
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePacketBuffer
+ * Signature: (JJJ[BILjava/nio/ByteBuffer;II[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processWirePacketBuffer
+  (JNIEnv *, jobject, jlong, jlong, jlong, jbyteArray, jint, jobject, jint, jint, jlongArray);
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processWirePackets
+ * Signature: (JJLjava/nio/ByteBuffer;I[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processWirePackets
+  (JNIEnv *, jobject, jlong, jlong, jobject, jint, jlongArray);
+
+/*
+ * Class:     com_zerotier_sdk_Node
+ * Method:    processVirtualNetworkFrames
+ * Signature: (JJJLjava/nio/ByteBuffer;I[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sdk_Node_processVirtualNetworkFrames
+  (JNIEnv *, jobject, jlong, jlong, jlong, jobject, jint, jlongArray);
+
 /*
  * Class:     com_zerotier_sdk_Node
  * Method:    processBackgroundTasks
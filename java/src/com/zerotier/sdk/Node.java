@@ -28,6 +28,7 @@
 package com.zerotier.sdk;
 
 import java.net.InetSocketAddress;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 import java.io.IOException;
 
@@ -182,6 +183,127 @@ public class Node {
             nextBackgroundTaskDeadline);
     }
 
+    /**
+     * Process a frame from a virtual network port held in a direct buffer
+     *
+     * <p>The frame is read in place, so nothing is copied or allocated. The
+     * buffer's position and limit are ignored.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param nwid ZeroTier 64-bit virtual network ID
+     * @param sourceMac Source MAC address (least significant 48 bits)
+     * @param destMac Destination MAC address (least significant 48 bits)
+     * @param etherType 16-bit Ethernet frame type
+     * @param vlanId 10-bit VLAN ID or 0 if none
+     * @param frameData Direct buffer holding frame payload data
+     * @param offset Offset of payload in buffer
+     * @param length Length of payload
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processVirtualNetworkFrame(
+        long now,
+        long nwid,
+        long sourceMac,
+        long destMac,
+        int etherType,
+        int vlanId,
+        ByteBuffer frameData,
+        int offset,
+        int length,
+        long[] nextBackgroundTaskDeadline) {
+        return resultCode(processVirtualNetworkFrameBuffer(
+            nodeId, now, nwid, sourceMac, destMac, etherType, vlanId,
+            frameData, offset, length, nextBackgroundTaskDeadline));
+    }
+
+    /**
+     * Process a packet received from the physical wire held in a direct buffer
+     *
+     * <p>The packet is read in place, so nothing is copied or allocated. The
+     * buffer's position and limit are ignored.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param localSocket Local socket packet arrived on or -1 if not specified
+     * @param remoteAddress Origin IP address (4 bytes for IPv4 or 16 for IPv6)
+     * @param remotePort Origin UDP port
+     * @param packetData Direct buffer holding packet data
+     * @param offset Offset of packet in buffer
+     * @param length Length of packet
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processWirePacket(
+        long now,
+        long localSocket,
+        byte[] remoteAddress,
+        int remotePort,
+        ByteBuffer packetData,
+        int offset,
+        int length,
+        long[] nextBackgroundTaskDeadline) {
+        return resultCode(processWirePacketBuffer(
+            nodeId, now, localSocket, remoteAddress, remotePort,
+            packetData, offset, length, nextBackgroundTaskDeadline));
+    }
+
+    /**
+     * Process several packets received from the physical wire
+     *
+     * <p>The packets are read in place from a direct buffer laid out as
+     * described in {@link PacketBatchSender}, so the whole batch costs one
+     * call into the node. The buffer's position and limit are ignored.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param packets Direct buffer holding packet records starting at position 0
+     * @param count Number of packets
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processWirePackets(
+        long now,
+        ByteBuffer packets,
+        int count,
+        long[] nextBackgroundTaskDeadline) {
+        return resultCode(processWirePackets(
+            nodeId, now, packets, count, nextBackgroundTaskDeadline));
+    }
+
+    /**
+     * Process several frames from the same virtual network port
+     *
+     * <p>The frames are read in place from a direct buffer laid out as
+     * described in {@link VirtualNetworkFrameBatchListener}, so the whole
+     * batch costs one call into the node. The network ID in each record is
+     * ignored. The buffer's position and limit are ignored.</p>
+     *
+     * @param now Current clock in milliseconds
+     * @param nwid ZeroTier 64-bit virtual network ID
+     * @param frames Direct buffer holding frame records starting at position 0
+     * @param count Number of frames
+     * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+     * @return OK (0) or error code if a fatal error condition has occurred
+     */
+    public ResultCode processVirtualNetworkFrames(
+        long now,
+        long nwid,
+        ByteBuffer frames,
+        int count,
+        long[] nextBackgroundTaskDeadline) {
+        return resultCode(processVirtualNetworkFrames(
+            nodeId, now, nwid, frames, count, nextBackgroundTaskDeadline));
+    }
+
+    private static ResultCode resultCode(int rc) {
+        switch(rc) {
+            case 0: return ResultCode.RESULT_OK;
+            case 1: return ResultCode.RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+            case 2: return ResultCode.RESULT_FATAL_ERROR_DATA_STORE_FAILED;
+            case 1000: return ResultCode.RESULT_ERROR_NETWORK_NOT_FOUND;
+            default: return ResultCode.RESULT_FATAL_ERROR_INTERNAL;
+        }
+    }
+
     /**
      * Perform periodic background operations
      *
@@ -431,6 +553,45 @@ public class Node {
         byte[] packetData,
         long[] nextBackgroundTaskDeadline);
 
+    private native int processVirtualNetworkFrameBuffer(
+        long nodeId,
+        long now,
+        long nwid,
+        long sourceMac,
+        long destMac,
+        int etherType,
+        int vlanId,
+        ByteBuffer frameData,
+        int offset,
+        int length,
+        long[] nextBackgroundTaskDeadline);
+
+    private native int processWirePacketBuffer(
+        long nodeId,
+        long now,
+        long localSocket,
+        byte[] remoteAddress,
+        int remotePort,
+        ByteBuffer packetData,
+        int offset,
+        int length,
+        long[] nextBackgroundTaskDeadline);
+
+    private native int processWirePackets(
+        long nodeId,
+        long now,
+        ByteBuffer packets,
+        int count,
+        long[] nextBackgroundTaskDeadline);
+
+    private native int processVirtualNetworkFrames(
+        long nodeId,
+        long now,
+        long nwid,
+        ByteBuffer frames,
+        int count,
+        long[] nextBackgroundTaskDeadline);
+
     private native ResultCode processBackgroundTasks(
         long nodeId,
         long now,
@@ -0,0 +1,72 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ */
+
+package com.zerotier.sdk;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Packet sender that receives many packets per call
+ *
+ * <p>If the sender given to {@link Node} implements this, packets the node
+ * sends while processing one call are passed to {@link #onSendPackets}
+ * together, so one transition into Java carries the whole batch. Packets
+ * too large for the batch buffer still go through
+ * {@link PacketSender#onSendPacketRequested}.</p>
+ *
+ * <p>A batch is a sequence of records in native byte order (read it with
+ * {@code buffer.order(ByteOrder.nativeOrder())}). Each record is a
+ * {@link #PACKET_HEADER_SIZE} byte header followed by the packet, and the
+ * next record starts at the next multiple of 8 bytes. The same layout is
+ * used for batches passed to
+ * {@link Node#processWirePackets(long, ByteBuffer, int, long[])}.</p>
+ */
+public interface PacketBatchSender extends PacketSender {
+    /**
+     * Size of the header before each packet in a batch
+     */
+    public static final int PACKET_HEADER_SIZE = 32;
+
+    /**
+     * Offset of local socket in header (long, -1 if not specified)
+     */
+    public static final int PACKET_LOCAL_SOCKET = 0;
+
+    /**
+     * Offset of packet length in header (int)
+     */
+    public static final int PACKET_LENGTH = 8;
+
+    /**
+     * Offset of remote UDP port in header (unsigned short)
+     */
+    public static final int PACKET_PORT = 12;
+
+    /**
+     * Offset of remote address length in header (byte, 4 for IPv4 or 16 for IPv6)
+     */
+    public static final int PACKET_ADDRESS_LENGTH = 14;
+
+    /**
+     * Offset of IP TTL in header (unsigned byte, 0 for default; ignored for received packets)
+     */
+    public static final int PACKET_TTL = 15;
+
+    /**
+     * Offset of remote IP address in header (16 bytes, IPv4 addresses use the first 4)
+     */
+    public static final int PACKET_ADDRESS = 16;
+
+    /**
+     * Function to send a batch of ZeroTier packets out over the wire
+     *
+     * <p>The buffer belongs to the calling thread and is reused for the next
+     * batch, so it must be consumed before returning.</p>
+     *
+     * @param packets direct buffer holding packet records starting at position 0
+     * @param count number of packets
+     */
+    public void onSendPackets(ByteBuffer packets, int count);
+}
@@ -0,0 +1,47 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ */
+
+package com.zerotier.sdk;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Packet sender that receives packets in a reused direct buffer
+ *
+ * <p>If the sender given to {@link Node} implements this, packets are sent
+ * through {@link #onSendPacketBuffer} and no Java objects are allocated per
+ * packet. {@link PacketSender#onSendPacketRequested} is still called for
+ * packets too large for the buffer.</p>
+ */
+public interface PacketBufferSender extends PacketSender {
+    /**
+     * Offset of packet data in the buffer passed to {@link #onSendPacketBuffer}
+     */
+    public static final int PACKET_OFFSET = 16;
+
+    /**
+     * Function to send a ZeroTier packet out over the wire
+     *
+     * <p>The buffer holds the destination IP address (4 bytes for IPv4 or
+     * 16 for IPv6) starting at position 0 and the packet starting at
+     * {@link #PACKET_OFFSET}. It belongs to the calling thread and is reused
+     * for the next packet, so it must be consumed before returning.</p>
+     *
+     * @param localSocket socket file descriptor to send from.  Set to -1 if not specified.
+     * @param buffer direct buffer holding address and packet
+     * @param addressLength length of address (4 or 16)
+     * @param port destination UDP port
+     * @param length packet length in bytes
+     * @param ttl IP TTL to send with or 0 for default
+     * @return 0 on success, any error code on failure.
+     */
+    public int onSendPacketBuffer(
+            long localSocket,
+            ByteBuffer buffer,
+            int addressLength,
+            int port,
+            int length,
+            int ttl);
+}
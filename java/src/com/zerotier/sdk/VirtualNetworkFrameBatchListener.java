@@ -0,0 +1,73 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ */
+
+package com.zerotier.sdk;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Frame listener that receives many frames per call
+ *
+ * <p>If the frame listener given to {@link Node} implements this, frames
+ * produced while the node processes one call are collected and passed to
+ * {@link #onVirtualNetworkFrames} together just before that call returns,
+ * or sooner if the batch buffer fills. Frames too large for the batch
+ * buffer still go through
+ * {@link VirtualNetworkFrameListener#onVirtualNetworkFrame}.</p>
+ *
+ * <p>A batch is a sequence of records in native byte order (read it with
+ * {@code buffer.order(ByteOrder.nativeOrder())}). Each record is a
+ * {@link #FRAME_HEADER_SIZE} byte header followed by the frame, and the
+ * next record starts at the next multiple of 8 bytes. The same layout is
+ * used for batches passed to
+ * {@link Node#processVirtualNetworkFrames(long, long, ByteBuffer, int, long[])}.</p>
+ */
+public interface VirtualNetworkFrameBatchListener extends VirtualNetworkFrameListener {
+    /**
+     * Size of the header before each frame in a batch
+     */
+    public static final int FRAME_HEADER_SIZE = 40;
+
+    /**
+     * Offset of network ID in header (long)
+     */
+    public static final int FRAME_NWID = 0;
+
+    /**
+     * Offset of source MAC in header (long)
+     */
+    public static final int FRAME_SOURCE_MAC = 8;
+
+    /**
+     * Offset of destination MAC in header (long)
+     */
+    public static final int FRAME_DEST_MAC = 16;
+
+    /**
+     * Offset of ethernet frame type in header (int)
+     */
+    public static final int FRAME_ETHER_TYPE = 24;
+
+    /**
+     * Offset of VLAN ID in header (int)
+     */
+    public static final int FRAME_VLAN_ID = 28;
+
+    /**
+     * Offset of frame length in header (int)
+     */
+    public static final int FRAME_LENGTH = 32;
+
+    /**
+     * Function to send a batch of frames out to virtual network ports
+     *
+     * <p>The buffer belongs to the calling thread and is reused for the next
+     * batch, so its contents must be copied or consumed before returning.</p>
+     *
+     * @param frames direct buffer holding frame records starting at position 0
+     * @param count number of frames
+     */
+    public void onVirtualNetworkFrames(ByteBuffer frames, int count);
+}
@@ -0,0 +1,41 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ */
+
+package com.zerotier.sdk;
+
+import java.nio.ByteBuffer;
+
+/**
+ * Frame listener that receives frames in a reused direct buffer
+ *
+ * <p>If the frame listener given to {@link Node} implements this, frames are
+ * delivered through {@link #onVirtualNetworkFrameBuffer} and no Java objects
+ * are allocated per frame. {@link VirtualNetworkFrameListener#onVirtualNetworkFrame}
+ * is still called for frames too large for the buffer.</p>
+ */
+public interface VirtualNetworkFrameBufferListener extends VirtualNetworkFrameListener {
+    /**
+     * Function to send a frame out to a virtual network port
+     *
+     * <p>The buffer belongs to the calling thread and is reused for the next
+     * frame, so its contents must be copied or consumed before returning.</p>
+     *
+     * @param nwid ZeroTier One network ID
+     * @param srcMac source MAC address
+     * @param destMac destination MAC address
+     * @param etherType
+     * @param vlanId
+     * @param frameData direct buffer holding the frame at positions 0 through length - 1
+     * @param length frame length in bytes
+     */
+    public void onVirtualNetworkFrameBuffer(
+                long nwid,
+                long srcMac,
+                long destMac,
+                long etherType,
+                long vlanId,
+                ByteBuffer frameData,
+                int length);
+}
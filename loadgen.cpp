@@ -0,0 +1,850 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+/*
+ * Load generator for network controllers.
+ *
+ * Runs an EmbeddedNetworkController in process and has it serve a private
+ * network to many impersonated members, measuring how fast it answers
+ * network config requests and pushes configs. Requests are handed to the
+ * controller directly, or with -W as encrypted NETWORK_CONFIG_REQUEST
+ * packets through the controller's own Node, which adds decryption and the
+ * encoding and encryption of replies. Requests go out at up to a target
+ * rate, and each phase reports answers per second, p50 and p99 latency, the
+ * database write rate and memory use.
+ *
+ * Scenarios:
+ *   steady     Authorized members that have been configured before request
+ *              at the target rate for -d seconds (the default), or without
+ *              one as often as the controller allows them to
+ *   storm      Every member requests at once after a controller restart,
+ *              which with -D memory: is replaced by a controller that has
+ *              not seen the members before
+ *   authorize  Unauthorized members that have been denied are all
+ *              authorized through the API, then all request again (the
+ *              controller only pushes to members it has authorized before)
+ *   rules      Configured members all get a new rule set of -R rules,
+ *              timed until each gets its push
+ *
+ * Member addresses are random and members share one key pair, since the
+ * controller never derives an address from a key. With -W the identities
+ * are added to the Node's validation cache before each member's HELLO, so
+ * setup is not held up by identity checks and their rate limits.
+ *
+ * Usage: zerotier-loadgen [<options>] [steady|storm|authorize|rules]
+ *
+ *   -n <members>    Members (default 1000)
+ *   -r <requests/s> Target request rate, 0 for as fast as possible (default 0)
+ *   -d <seconds>    Length of the steady scenario (default 10)
+ *   -R <rules>      Rules in the rules scenario's new rule set (default 512)
+ *   -p <pushes/s>   Controller push rate, 0 for its default (default 0)
+ *   -D <path>       Controller database path (default memory:)
+ *   -t <seconds>    Longest to wait for answers at the end of a phase (default 60)
+ *   -W              Send requests as packets through the controller's Node
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef __WINDOWS__
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "include/ZeroTierOne.h"
+
+#include "node/Constants.hpp"
+#include "node/Utils.hpp"
+#include "node/Identity.hpp"
+#include "node/InetAddress.hpp"
+#include "node/Packet.hpp"
+#include "node/Dictionary.hpp"
+#include "node/C25519.hpp"
+#include "node/Node.hpp"
+#include "node/NetworkConfig.hpp"
+#include "node/NetworkController.hpp"
+
+#include "controller/EmbeddedNetworkController.hpp"
+
+#include "osdep/OSUtils.hpp"
+
+#include "ext/json/json.hpp"
+
+#include "version.h"
+
+#define ZT_LOADGEN_MAX_MEMBERS 1000000
+
+// Members never request more often than this, since the controller ignores requests less than a second apart
+#define ZT_LOADGEN_MIN_REQUEST_INTERVAL_MS 1100
+
+// Each member has its own /64 under this prefix with its index in the next 32 bits, so HELLO rate limits don't interfere
+#define ZT_LOADGEN_IPV6_PREFIX_0 0xfd
+#define ZT_LOADGEN_IPV6_PREFIX_1 0x4c
+#define ZT_LOADGEN_PORT 9993
+
+using namespace ZeroTier;
+
+enum LoadScenario
+{
+	LOAD_STEADY = 0,
+	LOAD_STORM = 1,
+	LOAD_AUTHORIZE = 2,
+	LOAD_RULES = 3
+};
+
+static const char *const loadScenarioNames[4] = { "steady","storm","authorize","rules" };
+
+static unsigned int loadMembers = 1000;
+static unsigned int loadRate = 0;
+static int64_t loadDurationMs = 10000;
+static unsigned int loadRules = 512;
+static unsigned int loadPushRate = 0;
+static const char *loadDbPath = "memory:";
+static int64_t loadWaitMs = 60000;
+static bool loadWire = false;
+static LoadScenario loadScenario = LOAD_STEADY;
+
+static inline uint64_t nowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct LoadMember
+{
+	LoadMember() : pending(0),sentNs(0),pushWaitNs(0),lastSentNs(0),helloId(0),partialId(0),partialFragments(0) {}
+
+	Identity id;
+	InetAddress phy;
+
+	std::atomic<uint64_t> pending; // ID of unanswered request, or 0
+	std::atomic<uint64_t> sentNs; // when it was sent
+	std::atomic<uint64_t> pushWaitNs; // when a change that should push a config to this member was made, or 0
+	uint64_t lastSentNs; // touched only by the main thread
+	std::atomic<uint64_t> helloId; // last HELLO the controller's Node sent this member
+
+	// Fragmented reply being reassembled, guarded by the test's wire lock
+	std::string partial;
+	uint64_t partialId;
+	unsigned int partialFragments;
+};
+
+struct LoadTest
+{
+	LoadTest() :
+		members((LoadMember *)0),
+		count(0),
+		nwid(0),
+		node((ZT_Node *)0),
+		controller((EmbeddedNetworkController *)0),
+		answered(0),
+		configs(0),
+		errors(0),
+		lastAnswerNs(0) {}
+
+	LoadMember *members;
+	unsigned int count;
+	std::unordered_map<uint64_t,unsigned int> byAddress;
+	Identity controllerId;
+	std::string controllerSecret; // identity.secret served by stateGet
+	uint64_t nwid;
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH]; // shared by every member and the controller
+	Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData;
+	ZT_Node *node;
+	EmbeddedNetworkController *controller;
+
+	// Counts for the current phase, updated from the controller's threads
+	std::atomic<uint64_t> answered; // requests answered and expected pushes received
+	std::atomic<uint64_t> configs;
+	std::atomic<uint64_t> errors;
+	std::atomic<uint64_t> lastAnswerNs;
+	std::mutex latencyLock;
+	std::vector<uint64_t> latencyNs;
+
+	std::mutex wireLock;
+};
+
+struct LoadPhase
+{
+	LoadPhase(const char *n) : name(n),startNs(0),sendEndNs(0),sent(0),throttled(0),skippedPending(0),changesBefore(0) {}
+	const char *name;
+	uint64_t startNs;
+	uint64_t sendEndNs;
+	uint64_t sent; // requests sent, or pushes expected
+	uint64_t throttled; // times sending waited for a member to be allowed to request again
+	uint64_t skippedPending; // turns skipped because the member's last request was not yet answered
+	uint64_t changesBefore;
+};
+
+static void loadRecord(LoadTest &lt,const uint64_t now,const uint64_t latencyNs,const bool ok)
+{
+	if (ok)
+		++lt.configs;
+	else ++lt.errors;
+	lt.lastAnswerNs.store(now);
+	{
+		std::lock_guard<std::mutex> l(lt.latencyLock);
+		lt.latencyNs.push_back(latencyNs);
+	}
+	++lt.answered;
+}
+
+// Records an answer to a member's outstanding request (inRePacketId != 0) or a push
+static void loadAnswer(LoadTest &lt,const unsigned int m,const uint64_t inRePacketId,const bool ok)
+{
+	const uint64_t now = nowNs();
+	LoadMember &lm = lt.members[m];
+	uint64_t since;
+	if (inRePacketId) {
+		uint64_t expected = inRePacketId;
+		if (!lm.pending.compare_exchange_strong(expected,0)) // a later chunk, or a request we stopped waiting for
+			return;
+		since = lm.sentNs.load();
+	} else {
+		if (!ok)
+			return;
+		since = lm.pushWaitNs.exchange(0);
+		if (!since) // a push nothing in this phase asked for
+			return;
+	}
+	loadRecord(lt,now,now - since,ok);
+}
+
+// Takes the controller's replies and pushes directly when requests are handed to it in process
+class LoadSender : public NetworkController::Sender
+{
+public:
+	LoadSender(LoadTest &lt) : _lt(lt) {}
+
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig,const uint64_t *have)
+	{
+		std::unordered_map<uint64_t,unsigned int>::const_iterator m(_lt.byAddress.find(destination.toInt()));
+		if (m != _lt.byAddress.end())
+			loadAnswer(_lt,m->second,requestPacketId,true);
+	}
+
+	virtual void ncSendRevocation(const Address &destination,const Revocation &rev) {}
+
+	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode)
+	{
+		std::unordered_map<uint64_t,unsigned int>::const_iterator m(_lt.byAddress.find(destination.toInt()));
+		if (m != _lt.byAddress.end())
+			loadAnswer(_lt,m->second,requestPacketId,false);
+	}
+
+private:
+	LoadTest &_lt;
+};
+
+static int loadStateGet(ZT_Node *,void *uptr,void *,enum ZT_StateObjectType type,const uint64_t [2],void *data,unsigned int maxlen)
+{
+	const LoadTest *const lt = reinterpret_cast<const LoadTest *>(uptr);
+	if ((type != ZT_STATE_OBJECT_IDENTITY_SECRET)||(lt->controllerSecret.length() > maxlen))
+		return -1;
+	memcpy(data,lt->controllerSecret.data(),lt->controllerSecret.length());
+	return (int)lt->controllerSecret.length();
+}
+static void loadStatePut(ZT_Node *,void *,void *,enum ZT_StateObjectType,const uint64_t [2],const void *,int) {}
+static void loadFrame(ZT_Node *,void *,void *,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *,unsigned int) {}
+static int loadNetworkConfig(ZT_Node *,void *,void *,uint64_t,void **,enum ZT_VirtualNetworkConfigOperation,const ZT_VirtualNetworkConfig *) { return 0; }
+static void loadEvent(ZT_Node *,void *,void *,enum ZT_Event,const void *) {}
+
+// Decodes what the controller's Node sends to members, reassembling fragmented replies
+static int loadWireSend(ZT_Node *,void *uptr,void *,int64_t,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int)
+{
+	LoadTest &lt = *reinterpret_cast<LoadTest *>(uptr);
+	const InetAddress &to = *reinterpret_cast<const InetAddress *>(addr);
+	if (to.ss_family != AF_INET6)
+		return 0;
+	const uint8_t *const ip = reinterpret_cast<const uint8_t *>(to.rawIpData());
+	if ((ip[0] != ZT_LOADGEN_IPV6_PREFIX_0)||(ip[1] != ZT_LOADGEN_IPV6_PREFIX_1))
+		return 0;
+	const unsigned int m = ((unsigned int)ip[4] << 24) | ((unsigned int)ip[5] << 16) | ((unsigned int)ip[6] << 8) | (unsigned int)ip[7];
+	if (m >= lt.count)
+		return 0;
+	LoadMember &lm = lt.members[m];
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(data);
+
+	Packet p;
+	try {
+		if ((len >= ZT_PROTO_MIN_FRAGMENT_LENGTH)&&(d[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR)) {
+			const Packet::Fragment f(data,len);
+			std::lock_guard<std::mutex> l(lt.wireLock);
+			if ((lm.partialId != f.packetId())||(f.fragmentNumber() != lm.partialFragments))
+				return 0;
+			lm.partial.append(reinterpret_cast<const char *>(f.field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,f.payloadLength())),f.payloadLength());
+			if (++lm.partialFragments < f.totalFragments())
+				return 0;
+			p.copyFrom(lm.partial.data(),(unsigned int)lm.partial.length());
+			lm.partial.clear();
+			lm.partialId = 0;
+		} else if (len >= ZT_PROTO_MIN_PACKET_LENGTH) {
+			if ((d[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
+				std::lock_guard<std::mutex> l(lt.wireLock);
+				lm.partial.assign(reinterpret_cast<const char *>(data),len);
+				lm.partialId = Utils::ntoh(*reinterpret_cast<const uint64_t *>(data));
+				lm.partialFragments = 1;
+				return 0;
+			}
+			p.copyFrom(data,len);
+		} else return 0;
+
+		if ((!p.dearmor(lt.key))||(!p.uncompress()))
+			return 0;
+		switch(p.verb()) {
+			case Packet::VERB_OK:
+				if ((p.size() > ZT_PROTO_VERB_OK_IDX_PAYLOAD)&&((Packet::Verb)p[ZT_PROTO_VERB_OK_IDX_IN_RE_VERB] == Packet::VERB_NETWORK_CONFIG_REQUEST))
+					loadAnswer(lt,m,p.at<uint64_t>(ZT_PROTO_VERB_OK_IDX_IN_RE_PACKET_ID),true);
+				break;
+			case Packet::VERB_ERROR:
+				if ((p.size() > ZT_PROTO_VERB_ERROR_IDX_ERROR_CODE)&&((Packet::Verb)p[ZT_PROTO_VERB_ERROR_IDX_IN_RE_VERB] == Packet::VERB_NETWORK_CONFIG_REQUEST))
+					loadAnswer(lt,m,p.at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_IN_RE_PACKET_ID),false);
+				break;
+			case Packet::VERB_NETWORK_CONFIG:
+				loadAnswer(lt,m,0,true);
+				break;
+			case Packet::VERB_HELLO:
+				lm.helloId.store(p.packetId());
+				break;
+			default:
+				break;
+		}
+	} catch ( ... ) {}
+	return 0;
+}
+
+static uint64_t loadMaxRssKb()
+{
+#ifdef __WINDOWS__
+	return 0;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF,&ru) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (uint64_t)ru.ru_maxrss / 1024; // bytes on macOS
+#else
+	return (uint64_t)ru.ru_maxrss;
+#endif
+#endif
+}
+
+static inline uint64_t loadRandom(uint64_t &s)
+{
+	// xorshift64*
+	s ^= s >> 12;
+	s ^= s << 25;
+	s ^= s >> 27;
+	return s * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t loadDbChanges(LoadTest &lt)
+{
+	std::vector<std::string> path;
+	std::map<std::string,std::string> args,headers;
+	std::string body,responseBody,responseContentType;
+	lt.controller->handleControlPlaneHttpGET(path,args,headers,body,responseBody,responseContentType);
+	try {
+		nlohmann::json status(OSUtils::jsonParse(responseBody));
+		return OSUtils::jsonInt(status["databaseChanges"],0ULL);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+static unsigned int loadPost(LoadTest &lt,const uint64_t memberId,const std::string &body)
+{
+	char tmp[24];
+	std::vector<std::string> path;
+	path.push_back("network");
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)lt.nwid);
+	path.push_back(tmp);
+	if (memberId) {
+		path.push_back("member");
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)memberId);
+		path.push_back(tmp);
+	}
+	std::map<std::string,std::string> args,headers;
+	std::string responseBody,responseContentType;
+	return lt.controller->handleControlPlaneHttpPOST(path,args,headers,body,responseBody,responseContentType);
+}
+
+static void loadStartController(LoadTest &lt,LoadSender &sender)
+{
+	lt.controller = new EmbeddedNetworkController(reinterpret_cast<Node *>(lt.node),loadDbPath);
+	if (loadWire)
+		ZT_Node_setNetconfMaster(lt.node,(void *)lt.controller);
+	else lt.controller->init(lt.controllerId,&sender);
+	if (loadPushRate)
+		lt.controller->setPushRate(loadPushRate);
+}
+
+static void loadStopController(LoadTest &lt)
+{
+	if (loadWire)
+		ZT_Node_setNetconfMaster(lt.node,(void *)0);
+	delete lt.controller;
+	lt.controller = (EmbeddedNetworkController *)0;
+}
+
+// Sleeps until the n-th event of a phase is due at a rate (per second, 0 for no limit)
+static inline void loadPace(const uint64_t startNs,const uint64_t n,const unsigned int rate)
+{
+	if (!rate)
+		return;
+	const uint64_t due = startNs + (n * 1000000000ULL) / (uint64_t)rate;
+	const uint64_t now = nowNs();
+	if (due > now)
+		std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+}
+
+static void loadRequest(LoadTest &lt,const unsigned int m,const uint64_t now)
+{
+	LoadMember &lm = lt.members[m];
+	lm.lastSentNs = now;
+	if (loadWire) {
+		Packet outp(lt.controllerId.address(),lm.id.address(),Packet::VERB_NETWORK_CONFIG_REQUEST);
+		outp.append((uint64_t)lt.nwid);
+		const unsigned int mdSize = lt.metaData.sizeBytes();
+		outp.append((uint16_t)mdSize);
+		outp.append((const void *)lt.metaData.data(),mdSize);
+		outp.append((unsigned char)0,16);
+		outp.compress();
+		outp.armor(lt.key,true);
+		lm.sentNs.store(nowNs());
+		lm.pending.store(outp.packetId());
+		volatile int64_t nextDeadline = 0;
+		ZT_Node_processWirePacket(lt.node,(void *)0,OSUtils::now(),1,reinterpret_cast<const struct sockaddr_storage *>(&(lm.phy)),outp.data(),outp.size(),&nextDeadline);
+	} else {
+		const uint64_t packetId = ((uint64_t)m << 24) ^ now ^ 1ULL;
+		lm.sentNs.store(nowNs());
+		lm.pending.store(packetId);
+		lt.controller->request(lt.nwid,lm.phy,packetId,lm.id,lt.metaData);
+	}
+}
+
+// Introduces a member to the controller's Node as it would before its first request, and
+// answers the Node's HELLO back so it learns the member's path
+static void loadHello(LoadTest &lt,const unsigned int m)
+{
+	LoadMember &lm = lt.members[m];
+	reinterpret_cast<Node *>(lt.node)->identityValidationCache().add(lm.id);
+	lm.helloId.store(0);
+	const int64_t now = OSUtils::now();
+	Packet hello(lt.controllerId.address(),lm.id.address(),Packet::VERB_HELLO);
+	hello.append((unsigned char)ZT_PROTO_VERSION);
+	hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+	hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+	hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+	hello.append((uint64_t)now);
+	lm.id.serialize(hello,false);
+	hello.armor(lt.key,false);
+	volatile int64_t nextDeadline = 0;
+	ZT_Node_processWirePacket(lt.node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&(lm.phy)),hello.data(),hello.size(),&nextDeadline);
+
+	const uint64_t helloId = lm.helloId.load();
+	if (helloId) {
+		Packet ok(lt.controllerId.address(),lm.id.address(),Packet::VERB_OK);
+		ok.append((unsigned char)Packet::VERB_HELLO);
+		ok.append(helloId);
+		ok.append((uint64_t)now);
+		ok.append((unsigned char)ZT_PROTO_VERSION);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok.armor(lt.key,true);
+		ZT_Node_processWirePacket(lt.node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&(lm.phy)),ok.data(),ok.size(),&nextDeadline);
+	}
+}
+
+static void loadBegin(LoadTest &lt,LoadPhase &ph)
+{
+	lt.answered.store(0);
+	lt.configs.store(0);
+	lt.errors.store(0);
+	{
+		std::lock_guard<std::mutex> l(lt.latencyLock);
+		lt.latencyNs.clear();
+	}
+	ph.changesBefore = loadDbChanges(lt);
+	ph.startNs = nowNs();
+	lt.lastAnswerNs.store(ph.startNs);
+}
+
+// Waits until everything sent in a phase has been answered, or until we give up
+static void loadWait(LoadTest &lt,LoadPhase &ph)
+{
+	if (!ph.sendEndNs)
+		ph.sendEndNs = nowNs();
+	const uint64_t giveUp = nowNs() + ((uint64_t)loadWaitMs * 1000000ULL);
+	while ((lt.answered.load() < ph.sent)&&(nowNs() < giveUp))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	for(unsigned int m=0;m<lt.count;++m) { // stop waiting for anything still outstanding
+		lt.members[m].pending.store(0);
+		lt.members[m].pushWaitNs.store(0);
+	}
+}
+
+// One request from each member, as fast as the target rate allows
+static void loadRequestAll(LoadTest &lt,LoadPhase &ph)
+{
+	// Members go in the same order every time, so once the first may request again the rest soon can
+	const uint64_t firstAllowed = lt.members[0].lastSentNs + ((uint64_t)ZT_LOADGEN_MIN_REQUEST_INTERVAL_MS * 1000000ULL);
+	if ((lt.members[0].lastSentNs)&&(firstAllowed > nowNs()))
+		std::this_thread::sleep_for(std::chrono::nanoseconds(firstAllowed - nowNs()));
+
+	loadBegin(lt,ph);
+	for(unsigned int m=0;m<lt.count;++m) {
+		loadPace(ph.startNs,m,loadRate);
+		const uint64_t now = nowNs();
+		const uint64_t allowed = lt.members[m].lastSentNs + ((uint64_t)ZT_LOADGEN_MIN_REQUEST_INTERVAL_MS * 1000000ULL);
+		if ((lt.members[m].lastSentNs)&&(allowed > now)) {
+			++ph.throttled;
+			std::this_thread::sleep_for(std::chrono::nanoseconds(allowed - now));
+		}
+		loadRequest(lt,m,nowNs());
+		++ph.sent;
+	}
+	ph.sendEndNs = nowNs();
+	loadWait(lt,ph);
+}
+
+static void loadSteady(LoadTest &lt,LoadPhase &ph)
+{
+	// Without a target rate members request as often as the controller allows, evenly spread
+	const unsigned int rate = (loadRate) ? loadRate : std::max(1U,(unsigned int)(((uint64_t)lt.count * 1000ULL) / ZT_LOADGEN_MIN_REQUEST_INTERVAL_MS));
+
+	loadBegin(lt,ph);
+	const uint64_t endNs = ph.startNs + ((uint64_t)loadDurationMs * 1000000ULL);
+	unsigned int m = 0;
+	for(uint64_t n=0;;++n) {
+		loadPace(ph.startNs,n,rate);
+		uint64_t now = nowNs();
+		if (now >= endNs)
+			break;
+
+		// Members take turns, so if this one may not request yet none of the others may either
+		LoadMember &lm = lt.members[m];
+		const uint64_t allowed = lm.lastSentNs + ((uint64_t)ZT_LOADGEN_MIN_REQUEST_INTERVAL_MS * 1000000ULL);
+		if (allowed > now) {
+			++ph.throttled;
+			if (allowed >= endNs)
+				break;
+			std::this_thread::sleep_for(std::chrono::nanoseconds(allowed - now));
+			now = nowNs();
+		}
+
+		if (lm.pending.load()) {
+			lm.lastSentNs = now; // its turn is used up waiting
+			++ph.skippedPending;
+		} else {
+			loadRequest(lt,m,now);
+			++ph.sent;
+		}
+		if (++m >= lt.count)
+			m = 0;
+	}
+	ph.sendEndNs = nowNs();
+	loadWait(lt,ph);
+}
+
+static void loadAuthorize(LoadTest &lt,LoadPhase &ph)
+{
+	loadBegin(lt,ph);
+	for(unsigned int m=0;m<lt.count;++m) {
+		loadPace(ph.startNs,m,loadRate);
+		const uint64_t start = nowNs();
+		const bool ok = (loadPost(lt,lt.members[m].id.address().toInt(),"{\"authorized\":true}") == 200);
+		const uint64_t now = nowNs();
+		loadRecord(lt,now,now - start,ok);
+		++ph.sent;
+	}
+	ph.sendEndNs = nowNs();
+}
+
+static void loadRulesPush(LoadTest &lt,LoadPhase &ph)
+{
+	nlohmann::json rules = nlohmann::json::array();
+	for(unsigned int r=1;r<loadRules;r+=2) {
+		nlohmann::json match,action;
+		match["type"] = "MATCH_IP_DEST_PORT_RANGE";
+		match["start"] = 1000 + (r / 2);
+		match["end"] = 1000 + (r / 2);
+		rules.push_back(match);
+		action["type"] = "ACTION_ACCEPT";
+		rules.push_back(action);
+	}
+	nlohmann::json last;
+	last["type"] = "ACTION_DROP";
+	rules.push_back(last);
+	nlohmann::json network;
+	network["rules"] = rules;
+	const std::string body(OSUtils::jsonDump(network,-1));
+
+	loadBegin(lt,ph);
+	for(unsigned int m=0;m<lt.count;++m)
+		lt.members[m].pushWaitNs.store(ph.startNs);
+	if (loadPost(lt,0,body) == 200)
+		ph.sent = lt.count;
+	ph.sendEndNs = nowNs();
+	loadWait(lt,ph);
+}
+
+static void loadPrintPhase(LoadTest &lt,const LoadPhase &ph,const bool last)
+{
+	std::vector<uint64_t> lat;
+	{
+		std::lock_guard<std::mutex> l(lt.latencyLock);
+		lat.swap(lt.latencyNs);
+	}
+	std::sort(lat.begin(),lat.end());
+	const uint64_t answered = lt.answered.load();
+	const uint64_t endNs = std::max(ph.sendEndNs,lt.lastAnswerNs.load());
+	const double seconds = (double)(endNs - ph.startNs) / 1000000000.0;
+	const uint64_t changes = loadDbChanges(lt) - ph.changesBefore;
+	printf("    {\"name\":\"%s\",\"sent\":%llu,\"answered\":%llu,\"configs\":%llu,\"errors\":%llu,\"unanswered\":%llu,\"throttled\":%llu,\"skippedPending\":%llu,\"durationMs\":%.1f,\"answersPerSecond\":%.1f,\"p50LatencyMs\":%.3f,\"p99LatencyMs\":%.3f,\"maxLatencyMs\":%.3f,\"databaseChanges\":%llu,\"databaseChangesPerSecond\":%.1f,\"maxRssKb\":%llu}%s\n",
+		ph.name,
+		(unsigned long long)ph.sent,(unsigned long long)answered,(unsigned long long)lt.configs.load(),(unsigned long long)lt.errors.load(),
+		(unsigned long long)((ph.sent > answered) ? (ph.sent - answered) : 0),
+		(unsigned long long)ph.throttled,(unsigned long long)ph.skippedPending,
+		seconds * 1000.0,
+		(seconds > 0.0) ? ((double)answered / seconds) : 0.0,
+		(lat.empty()) ? 0.0 : ((double)lat[lat.size() / 2] / 1000000.0),
+		(lat.empty()) ? 0.0 : ((double)lat[std::min(lat.size() - 1,(lat.size() * 99) / 100)] / 1000000.0),
+		(lat.empty()) ? 0.0 : ((double)lat.back() / 1000000.0),
+		(unsigned long long)changes,
+		(seconds > 0.0) ? ((double)changes / seconds) : 0.0,
+		(unsigned long long)loadMaxRssKb(),
+		(last) ? "" : ",");
+	fflush(stdout);
+}
+
+int main(int argc,char **argv)
+{
+	for(int i=1;i<argc;++i) {
+		if ((!strcmp(argv[i],"-n"))&&((i + 1) < argc)) {
+			loadMembers = (unsigned int)std::min(ZT_LOADGEN_MAX_MEMBERS,std::max(1,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-r"))&&((i + 1) < argc)) {
+			loadRate = (unsigned int)std::max(0,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-d"))&&((i + 1) < argc)) {
+			loadDurationMs = (int64_t)std::max(1,atoi(argv[++i])) * 1000;
+		} else if ((!strcmp(argv[i],"-R"))&&((i + 1) < argc)) {
+			loadRules = (unsigned int)std::min(ZT_MAX_NETWORK_RULES,std::max(1,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-p"))&&((i + 1) < argc)) {
+			loadPushRate = (unsigned int)std::max(0,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-D"))&&((i + 1) < argc)) {
+			loadDbPath = argv[++i];
+		} else if ((!strcmp(argv[i],"-t"))&&((i + 1) < argc)) {
+			loadWaitMs = (int64_t)std::max(1,atoi(argv[++i])) * 1000;
+		} else if (!strcmp(argv[i],"-W")) {
+			loadWire = true;
+		} else if ((argv[i][0] != '-')&&(!strcmp(argv[i],"steady"))) {
+			loadScenario = LOAD_STEADY;
+		} else if ((argv[i][0] != '-')&&(!strcmp(argv[i],"storm"))) {
+			loadScenario = LOAD_STORM;
+		} else if ((argv[i][0] != '-')&&(!strcmp(argv[i],"authorize"))) {
+			loadScenario = LOAD_AUTHORIZE;
+		} else if ((argv[i][0] != '-')&&(!strcmp(argv[i],"rules"))) {
+			loadScenario = LOAD_RULES;
+		} else {
+			fprintf(stderr,"Usage: %s [-n <members>] [-r <requests/s>] [-d <seconds>] [-R <rules>] [-p <pushes/s>] [-D <database path>] [-t <seconds>] [-W] [steady|storm|authorize|rules]" ZT_EOL_S,argv[0]);
+			return 1;
+		}
+	}
+
+	LoadTest *const ltp = new LoadTest();
+	LoadTest &lt = *ltp;
+	LoadSender sender(lt);
+	const uint64_t setupStart = nowNs();
+
+	lt.controllerId.generate();
+	{
+		char tmp[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+		lt.controllerSecret = lt.controllerId.toString(true,tmp);
+	}
+	lt.nwid = (lt.controllerId.address().toInt() << 24) | 0x000001ULL;
+
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,(uint64_t)ZT_NETWORKCONFIG_VERSION);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_VENDOR,(uint64_t)ZT_VENDOR_ZEROTIER);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_PROTOCOL_VERSION,(uint64_t)ZT_PROTO_VERSION);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MAJOR_VERSION,(uint64_t)ZEROTIER_ONE_VERSION_MAJOR);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_MINOR_VERSION,(uint64_t)ZEROTIER_ONE_VERSION_MINOR);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_NODE_REVISION,(uint64_t)ZEROTIER_ONE_VERSION_REVISION);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_RULES,(uint64_t)ZT_MAX_NETWORK_RULES);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_CAPABILITIES,(uint64_t)ZT_MAX_NETWORK_CAPABILITIES);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_CAPABILITY_RULES,(uint64_t)ZT_MAX_CAPABILITY_RULES);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_TAGS,(uint64_t)ZT_MAX_NETWORK_TAGS);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)0);
+	lt.metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+
+	// Members with random addresses and one shared key pair
+	{
+		const C25519::Pair kp(C25519::generate());
+		char pubHex[(ZT_C25519_PUBLIC_KEY_LEN * 2) + 1];
+		Utils::hex(kp.pub.data,ZT_C25519_PUBLIC_KEY_LEN,pubHex);
+		char tmp[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx:0:%s",(unsigned long long)lt.controllerId.address().toInt(),pubHex);
+		const Identity pubId(tmp);
+		lt.controllerId.agree(pubId,lt.key,ZT_PEER_SECRET_KEY_LENGTH);
+
+		uint64_t rng = 0x9e3779b97f4a7c15ULL;
+		lt.count = loadMembers;
+		lt.members = new LoadMember[lt.count];
+		for(unsigned int m=0;m<lt.count;) {
+			const Address a(loadRandom(rng) & 0xffffffffffULL);
+			if ((a.isReserved())||(a == lt.controllerId.address())||(lt.byAddress.count(a.toInt())))
+				continue;
+			LoadMember &lm = lt.members[m];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx:0:%s",(unsigned long long)a.toInt(),pubHex);
+			lm.id.fromString(tmp);
+			uint8_t ip[16];
+			memset(ip,0,sizeof(ip));
+			ip[0] = ZT_LOADGEN_IPV6_PREFIX_0;
+			ip[1] = ZT_LOADGEN_IPV6_PREFIX_1;
+			ip[4] = (uint8_t)(m >> 24);
+			ip[5] = (uint8_t)(m >> 16);
+			ip[6] = (uint8_t)(m >> 8);
+			ip[7] = (uint8_t)m;
+			ip[15] = 1;
+			lm.phy.set(ip,16,ZT_LOADGEN_PORT);
+			lt.byAddress[a.toInt()] = m++;
+		}
+	}
+
+	ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.stateGetFunction = loadStateGet;
+	cb.statePutFunction = loadStatePut;
+	cb.wirePacketSendFunction = loadWireSend;
+	cb.virtualNetworkFrameFunction = loadFrame;
+	cb.virtualNetworkConfigFunction = loadNetworkConfig;
+	cb.eventCallback = loadEvent;
+	if (ZT_Node_new(&(lt.node),(void *)&lt,(void *)0,&cb,OSUtils::now()) != ZT_RESULT_OK) {
+		fprintf(stderr,"FATAL: unable to create controller node" ZT_EOL_S);
+		return 1;
+	}
+	loadStartController(lt,sender);
+
+	{
+		nlohmann::json network;
+		network["name"] = "loadgen";
+		network["private"] = true;
+		network["v4AssignMode"]["zt"] = true;
+		nlohmann::json pool,route;
+		pool["ipRangeStart"] = "10.0.0.1";
+		pool["ipRangeEnd"] = "10.255.255.254";
+		network["ipAssignmentPools"].push_back(pool);
+		route["target"] = "10.0.0.0/8";
+		network["routes"].push_back(route);
+		if (loadPost(lt,0,OSUtils::jsonDump(network,-1)) != 200) {
+			fprintf(stderr,"FATAL: unable to create network %.16llx" ZT_EOL_S,(unsigned long long)lt.nwid);
+			return 1;
+		}
+	}
+	if (loadScenario != LOAD_AUTHORIZE) {
+		for(unsigned int m=0;m<lt.count;++m) {
+			if (loadPost(lt,lt.members[m].id.address().toInt(),"{\"authorized\":true}") != 200) {
+				fprintf(stderr,"FATAL: unable to authorize member %u" ZT_EOL_S,m);
+				return 1;
+			}
+		}
+	}
+	if (loadWire) {
+		for(unsigned int m=0;m<lt.count;++m)
+			loadHello(lt,m);
+	}
+	const uint64_t setupNs = nowNs() - setupStart;
+
+	printf("{\n  \"version\":\"%d.%d.%d\",\n",ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION);
+	printf("  \"scenario\":\"%s\",\n  \"members\":%u,\n  \"wire\":%s,\n  \"database\":\"%s\",\n  \"targetRate\":%u,\n  \"setupMs\":%llu,\n  \"setupMaxRssKb\":%llu,\n  \"phases\":[\n",
+		loadScenarioNames[loadScenario],lt.count,(loadWire) ? "true" : "false",loadDbPath,loadRate,(unsigned long long)(setupNs / 1000000ULL),(unsigned long long)loadMaxRssKb());
+	fflush(stdout);
+
+	bool complete = true;
+	switch(loadScenario) {
+		case LOAD_STEADY: {
+			LoadPhase warmup("warmup"),steady("steady");
+			loadRequestAll(lt,warmup);
+			loadPrintPhase(lt,warmup,false);
+			loadSteady(lt,steady);
+			complete = (lt.answered.load() >= steady.sent);
+			loadPrintPhase(lt,steady,true);
+		}	break;
+		case LOAD_STORM: {
+			LoadPhase storm("storm");
+			if (strcmp(loadDbPath,"memory:") != 0) {
+				LoadPhase warmup("warmup");
+				loadRequestAll(lt,warmup);
+				loadPrintPhase(lt,warmup,false);
+				loadStopController(lt);
+				loadStartController(lt,sender);
+			}
+			loadRequestAll(lt,storm);
+			complete = (lt.answered.load() >= storm.sent);
+			loadPrintPhase(lt,storm,true);
+		}	break;
+		case LOAD_AUTHORIZE: {
+			LoadPhase denied("denied"),authorize("authorize"),rejoin("rejoin");
+			loadRequestAll(lt,denied);
+			loadPrintPhase(lt,denied,false);
+			loadAuthorize(lt,authorize);
+			loadPrintPhase(lt,authorize,false);
+			loadRequestAll(lt,rejoin);
+			complete = (lt.configs.load() >= rejoin.sent);
+			loadPrintPhase(lt,rejoin,true);
+		}	break;
+		case LOAD_RULES: {
+			LoadPhase warmup("warmup"),push("rules");
+			loadRequestAll(lt,warmup);
+			loadPrintPhase(lt,warmup,false);
+			loadRulesPush(lt,push);
+			complete = (lt.answered.load() >= push.sent);
+			loadPrintPhase(lt,push,true);
+		}	break;
+	}
+	printf("  ]\n}\n");
+	fflush(stdout);
+
+	loadStopController(lt);
+	ZT_Node_delete(lt.node);
+	delete [] lt.members;
+	delete ltp;
+
+	return (complete) ? 0 : 2;
+}
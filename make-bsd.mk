@@ -31,6 +31,16 @@ ifeq ($(ZT_TRACE),1)
 	DEFS+=-DZT_TRACE
 endif
 
+# Collect lock contention statistics (see node/Mutex.hpp and /metrics)
+ifeq ($(ZT_MUTEX_PROFILING),1)
+	DEFS+=-DZT_MUTEX_PROFILING
+endif
+
+# Smaller queues and capped tables for devices with little RAM (see node/Constants.hpp)
+ifeq ($(ZT_SMALL_FOOTPRINT),1)
+	DEFS+=-DZT_SMALL_FOOTPRINT
+endif
+
 # Determine system build architecture from compiler target
 CC_MACH=$(shell $(CC) -dumpmachine | cut -d '-' -f 1)
 ZT_ARCHITECTURE=999
@@ -155,8 +165,28 @@ selftest:	$(CORE_OBJS) $(ONE_OBJS) selftest.o
 
 zerotier-selftest: selftest
 
+benchmark:	$(CORE_OBJS) $(ONE_OBJS) benchmark.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-benchmark benchmark.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-benchmark: benchmark
+
+simulator:	$(CORE_OBJS) $(ONE_OBJS) simulator.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-simulator simulator.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-simulator: simulator
+
+loadgen:	$(CORE_OBJS) $(ONE_OBJS) loadgen.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-loadgen loadgen.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-loadgen: loadgen
+
+tcp-proxy:	$(CORE_OBJS) $(ONE_OBJS) tcp-proxy/tcp-proxy.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-tcp-proxy tcp-proxy/tcp-proxy.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-tcp-proxy: tcp-proxy
+
 clean:
-	rm -rf *.a *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o build-* zerotier-one zerotier-idtool zerotier-selftest zerotier-cli $(ONE_OBJS) $(CORE_OBJS)
+	rm -rf *.a *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o build-* zerotier-one zerotier-idtool zerotier-selftest zerotier-benchmark zerotier-simulator zerotier-loadgen zerotier-tcp-proxy tcp-proxy/*.o zerotier-cli $(ONE_OBJS) $(CORE_OBJS)
 
 debug:	FORCE
 	gmake -j 4 ZT_DEBUG=1
@@ -50,6 +50,21 @@ ifeq ($(ZT_RULES_ENGINE_DEBUGGING),1)
 	override DEFS+=-DZT_RULES_ENGINE_DEBUGGING
 endif
 
+# Collect lock contention statistics (see node/Mutex.hpp and /metrics)
+ifeq ($(ZT_MUTEX_PROFILING),1)
+	override DEFS+=-DZT_MUTEX_PROFILING
+endif
+
+# Smaller queues and capped tables for devices with little RAM (see node/Constants.hpp)
+ifeq ($(ZT_SMALL_FOOTPRINT),1)
+	override DEFS+=-DZT_SMALL_FOOTPRINT
+endif
+
+# USDT probes are compiled in when <sys/sdt.h> is installed (see node/Probes.hpp); ZT_USDT=0 leaves them out
+ifeq ($(ZT_USDT),0)
+	override DEFS+=-DZT_NO_USDT
+endif
+
 # Build with address sanitization library for advanced debugging (clang)
 ifeq ($(ZT_SANITIZE),1)
 	SANFLAGS+=-fsanitize=address -DASAN_OPTIONS=symbolize=1
@@ -284,13 +299,33 @@ selftest:	$(CORE_OBJS) $(ONE_OBJS) selftest.o
 
 zerotier-selftest: selftest
 
+benchmark:	$(CORE_OBJS) $(ONE_OBJS) benchmark.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-benchmark benchmark.o $(CORE_OBJS) $(ONE_OBJS) $(LDLIBS)
+
+zerotier-benchmark: benchmark
+
+simulator:	$(CORE_OBJS) $(ONE_OBJS) simulator.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-simulator simulator.o $(CORE_OBJS) $(ONE_OBJS) $(LDLIBS)
+
+zerotier-simulator: simulator
+
+loadgen:	$(CORE_OBJS) $(ONE_OBJS) loadgen.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-loadgen loadgen.o $(CORE_OBJS) $(ONE_OBJS) $(LDLIBS)
+
+zerotier-loadgen: loadgen
+
+tcp-proxy:	$(CORE_OBJS) $(ONE_OBJS) tcp-proxy/tcp-proxy.o
+	$(CXX) $(CXXFLAGS) $(LDFLAGS) -o zerotier-tcp-proxy tcp-proxy/tcp-proxy.o $(CORE_OBJS) $(ONE_OBJS) $(LDLIBS)
+
+zerotier-tcp-proxy: tcp-proxy
+
 manpages:	FORCE
 	cd doc ; ./build.sh
 
 doc:	manpages
 
 clean: FORCE
-	rm -rf *.a *.so *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o ext/miniupnpc/*.o ext/libnatpmp/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-cli zerotier-selftest build-* ZeroTierOneInstaller-* *.deb *.rpm .depend debian/files debian/zerotier-one*.debhelper debian/zerotier-one.substvars debian/*.log debian/zerotier-one doc/node_modules ext/misc/*.o debian/.debhelper debian/debhelper-build-stamp
+	rm -rf *.a *.so *.o node/*.o controller/*.o osdep/*.o service/*.o ext/http-parser/*.o ext/miniupnpc/*.o ext/libnatpmp/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-cli zerotier-selftest zerotier-benchmark zerotier-simulator zerotier-loadgen zerotier-tcp-proxy tcp-proxy/*.o build-* ZeroTierOneInstaller-* *.deb *.rpm .depend debian/files debian/zerotier-one*.debhelper debian/zerotier-one.substvars debian/*.log debian/zerotier-one doc/node_modules ext/misc/*.o debian/.debhelper debian/debhelper-build-stamp
 
 distclean:	clean
 
@@ -63,6 +63,16 @@ ifeq ($(ZT_TRACE),1)
 	DEFS+=-DZT_TRACE
 endif
 
+# Collect lock contention statistics (see node/Mutex.hpp and /metrics)
+ifeq ($(ZT_MUTEX_PROFILING),1)
+	DEFS+=-DZT_MUTEX_PROFILING
+endif
+
+# Smaller queues and capped tables for devices with little RAM (see node/Constants.hpp)
+ifeq ($(ZT_SMALL_FOOTPRINT),1)
+	DEFS+=-DZT_SMALL_FOOTPRINT
+endif
+
 CXXFLAGS=$(CFLAGS) -std=c++11 -stdlib=libc++ 
 
 all: one macui
@@ -103,6 +113,26 @@ selftest: $(CORE_OBJS) $(ONE_OBJS) selftest.o
 
 zerotier-selftest: selftest
 
+benchmark:	$(CORE_OBJS) $(ONE_OBJS) benchmark.o
+	$(CXX) $(CXXFLAGS) -o zerotier-benchmark benchmark.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-benchmark: benchmark
+
+simulator:	$(CORE_OBJS) $(ONE_OBJS) simulator.o
+	$(CXX) $(CXXFLAGS) -o zerotier-simulator simulator.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-simulator: simulator
+
+loadgen:	$(CORE_OBJS) $(ONE_OBJS) loadgen.o
+	$(CXX) $(CXXFLAGS) -o zerotier-loadgen loadgen.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-loadgen: loadgen
+
+tcp-proxy:	$(CORE_OBJS) $(ONE_OBJS) tcp-proxy/tcp-proxy.o
+	$(CXX) $(CXXFLAGS) -o zerotier-tcp-proxy tcp-proxy/tcp-proxy.o $(CORE_OBJS) $(ONE_OBJS) $(LIBS)
+
+zerotier-tcp-proxy: tcp-proxy
+
 # Requires Packages: http://s.sudre.free.fr/Software/Packages/about.html
 mac-dist-pkg: FORCE
 	packagesbuild "ext/installfiles/mac/ZeroTier One.pkgproj"
@@ -120,17 +150,10 @@ official: FORCE
 	make ZT_OFFICIAL_RELEASE=1 mac-dist-pkg
 
 clean:
-	rm -rf *.dSYM build-* *.a *.pkg *.dmg *.o node/*.o controller/*.o service/*.o osdep/*.o ext/http-parser/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-selftest zerotier-cli zerotier doc/node_modules macui/build zt1_update_$(ZT_BUILD_PLATFORM)_$(ZT_BUILD_ARCHITECTURE)_*
+	rm -rf *.dSYM build-* *.a *.pkg *.dmg *.o node/*.o controller/*.o service/*.o osdep/*.o ext/http-parser/*.o $(CORE_OBJS) $(ONE_OBJS) zerotier-one zerotier-idtool zerotier-selftest zerotier-benchmark zerotier-simulator zerotier-loadgen zerotier-tcp-proxy tcp-proxy/*.o zerotier-cli zerotier doc/node_modules macui/build zt1_update_$(ZT_BUILD_PLATFORM)_$(ZT_BUILD_ARCHITECTURE)_*
 
 distclean:	clean
 
 realclean:	clean
 
-# For those building from source -- installs signed binary tap driver in system ZT home
-install-mac-tap: FORCE
-	mkdir -p /Library/Application\ Support/ZeroTier/One
-	rm -rf /Library/Application\ Support/ZeroTier/One/tap.kext
-	cp -R ext/bin/tap-mac/tap.kext /Library/Application\ Support/ZeroTier/One
-	chown -R root:wheel /Library/Application\ Support/ZeroTier/One/tap.kext
-
 FORCE:
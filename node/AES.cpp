@@ -0,0 +1,572 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "AES.hpp"
+
+// AES-NI kernel, compiled with per-function target attributes and only used if the CPU reports support
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ >= 5))
+#define ZT_AES_AESNI 1
+#include <immintrin.h>
+#include <cpuid.h>
+#define ZT_AES_TARGET __attribute__((target("aes,pclmul,sse4.1,ssse3")))
+#endif
+
+namespace ZeroTier {
+
+namespace {
+
+/************************************************************************** */
+
+/* Portable kernel: byte oriented AES and bit serial GHASH, straight from
+ * FIPS-197 and NIST SP 800-38D. */
+
+static inline uint8_t _xtime(const uint8_t x) { return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b)); }
+static inline uint8_t _rotl8(const uint8_t x,const unsigned int s) { return (uint8_t)((x << s) | (x >> (8 - s))); }
+
+// S-box computed at startup from its definition rather than typed in
+struct _AESSbox
+{
+	_AESSbox()
+	{
+		uint8_t p = 1,q = 1;
+		do {
+			p = p ^ (uint8_t)(p << 1) ^ (uint8_t)((p & 0x80) ? 0x1b : 0); // p * 3
+			q ^= (uint8_t)(q << 1); // q / 3
+			q ^= (uint8_t)(q << 2);
+			q ^= (uint8_t)(q << 4);
+			if (q & 0x80)
+				q ^= 0x09;
+			s[p] = (uint8_t)(q ^ _rotl8(q,1) ^ _rotl8(q,2) ^ _rotl8(q,3) ^ _rotl8(q,4) ^ 0x63);
+		} while (p != 1);
+		s[0] = 0x63;
+	}
+	uint8_t s[256];
+};
+static const _AESSbox _AES_SBOX;
+
+static void _expandPortable(const uint8_t *key,uint8_t *rk)
+{
+	const uint8_t *const sb = _AES_SBOX.s;
+	memcpy(rk,key,32);
+	uint8_t rcon = 1;
+	for(unsigned int i=32;i<240;i+=4) {
+		uint8_t t[4] = { rk[i - 4],rk[i - 3],rk[i - 2],rk[i - 1] };
+		if ((i % 32) == 0) {
+			const uint8_t u = t[0];
+			t[0] = sb[t[1]] ^ rcon;
+			t[1] = sb[t[2]];
+			t[2] = sb[t[3]];
+			t[3] = sb[u];
+			rcon = _xtime(rcon);
+		} else if ((i % 32) == 16) {
+			for(unsigned int j=0;j<4;++j)
+				t[j] = sb[t[j]];
+		}
+		for(unsigned int j=0;j<4;++j)
+			rk[i + j] = rk[i - 32 + j] ^ t[j];
+	}
+}
+
+static void _encryptPortable(const uint8_t *rk,const uint8_t *in,uint8_t *out)
+{
+	const uint8_t *const sb = _AES_SBOX.s;
+	uint8_t s[16],t[16];
+	for(unsigned int i=0;i<16;++i)
+		s[i] = in[i] ^ rk[i];
+	for(unsigned int r=1;r<=14;++r) {
+		// SubBytes and ShiftRows (state is column major, row i%4 is rotated left by i%4)
+		for(unsigned int i=0;i<16;++i)
+			t[i] = sb[s[(i + ((i & 3) * 4)) & 15]];
+		if (r < 14) {
+			for(unsigned int c=0;c<16;c+=4) {
+				const uint8_t a0 = t[c],a1 = t[c + 1],a2 = t[c + 2],a3 = t[c + 3];
+				const uint8_t x = a0 ^ a1 ^ a2 ^ a3;
+				s[c] = a0 ^ x ^ _xtime(a0 ^ a1);
+				s[c + 1] = a1 ^ x ^ _xtime(a1 ^ a2);
+				s[c + 2] = a2 ^ x ^ _xtime(a2 ^ a3);
+				s[c + 3] = a3 ^ x ^ _xtime(a3 ^ a0);
+			}
+		} else {
+			memcpy(s,t,16);
+		}
+		for(unsigned int i=0;i<16;++i)
+			s[i] ^= rk[(r * 16) + i];
+	}
+	memcpy(out,s,16);
+}
+
+static inline uint64_t _load64BE(const uint8_t *p)
+{
+	return (((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7]);
+}
+
+static inline void _store64BE(uint8_t *p,const uint64_t v)
+{
+	for(unsigned int i=0;i<8;++i)
+		p[i] = (uint8_t)(v >> (56 - (i * 8)));
+}
+
+// x = x * h in GF(2^128) with GCM's reflected bit order
+static void _gmulPortable(uint8_t *x,const uint8_t *h)
+{
+	uint64_t zh = 0,zl = 0;
+	uint64_t vh = _load64BE(h),vl = _load64BE(h + 8);
+	for(unsigned int i=0;i<128;++i) {
+		const uint64_t m = (uint64_t)0 - (uint64_t)((x[i >> 3] >> (7 - (i & 7))) & 1);
+		zh ^= vh & m;
+		zl ^= vl & m;
+		const uint64_t r = (uint64_t)0 - (vl & 1);
+		vl = (vl >> 1) | (vh << 63);
+		vh = (vh >> 1) ^ (0xe100000000000000ULL & r);
+	}
+	_store64BE(x,zh);
+	_store64BE(x + 8,zl);
+}
+
+static void _ctrPortable(const uint8_t *rk,uint8_t *counter,const uint8_t *in,uint8_t *out,unsigned int len)
+{
+	uint8_t ks[16];
+	uint32_t c = ((uint32_t)counter[12] << 24) | ((uint32_t)counter[13] << 16) | ((uint32_t)counter[14] << 8) | (uint32_t)counter[15];
+	while (len) {
+		_encryptPortable(rk,counter,ks);
+		++c;
+		counter[12] = (uint8_t)(c >> 24);
+		counter[13] = (uint8_t)(c >> 16);
+		counter[14] = (uint8_t)(c >> 8);
+		counter[15] = (uint8_t)c;
+		const unsigned int n = (len < 16) ? len : 16;
+		for(unsigned int i=0;i<n;++i)
+			out[i] = in[i] ^ ks[i];
+		in += n;
+		out += n;
+		len -= n;
+	}
+}
+
+/************************************************************************** */
+
+#ifdef ZT_AES_AESNI
+
+/* AES-NI kernel. GHASH works on byte-reflected blocks as in Intel's "Carry-
+ * Less Multiplication and Its Usage for Computing the GCM Mode" white paper,
+ * with the product of four blocks and four powers of H summed before one
+ * shared reduction. */
+
+ZT_AES_TARGET static inline __m128i _bswap128(const __m128i x)
+{
+	return _mm_shuffle_epi8(x,_mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15));
+}
+
+// 256-bit carry-less product without reduction
+ZT_AES_TARGET static inline void _clmul(const __m128i a,const __m128i b,__m128i &lo,__m128i &hi)
+{
+	const __m128i t0 = _mm_clmulepi64_si128(a,b,0x00);
+	const __m128i t1 = _mm_xor_si128(_mm_clmulepi64_si128(a,b,0x10),_mm_clmulepi64_si128(a,b,0x01));
+	const __m128i t2 = _mm_clmulepi64_si128(a,b,0x11);
+	lo = _mm_xor_si128(t0,_mm_slli_si128(t1,8));
+	hi = _mm_xor_si128(t2,_mm_srli_si128(t1,8));
+}
+
+// Shift a 256-bit product left by one to account for the reflected bit order and reduce it
+ZT_AES_TARGET static inline __m128i _reduce(__m128i lo,__m128i hi)
+{
+	__m128i t7 = _mm_srli_epi32(lo,31);
+	__m128i t8 = _mm_srli_epi32(hi,31);
+	lo = _mm_slli_epi32(lo,1);
+	hi = _mm_slli_epi32(hi,1);
+	__m128i t9 = _mm_srli_si128(t7,12);
+	t8 = _mm_slli_si128(t8,4);
+	t7 = _mm_slli_si128(t7,4);
+	lo = _mm_or_si128(lo,t7);
+	hi = _mm_or_si128(_mm_or_si128(hi,t8),t9);
+
+	t7 = _mm_slli_epi32(lo,31);
+	t8 = _mm_slli_epi32(lo,30);
+	t9 = _mm_slli_epi32(lo,25);
+	t7 = _mm_xor_si128(_mm_xor_si128(t7,t8),t9);
+	t8 = _mm_srli_si128(t7,4);
+	t7 = _mm_slli_si128(t7,12);
+	lo = _mm_xor_si128(lo,t7);
+
+	__m128i t2 = _mm_srli_epi32(lo,1);
+	t2 = _mm_xor_si128(t2,_mm_srli_epi32(lo,2));
+	t2 = _mm_xor_si128(t2,_mm_srli_epi32(lo,7));
+	t2 = _mm_xor_si128(t2,t8);
+	lo = _mm_xor_si128(lo,t2);
+	return _mm_xor_si128(hi,lo);
+}
+
+ZT_AES_TARGET static inline __m128i _gfmul(const __m128i a,const __m128i b)
+{
+	__m128i lo,hi;
+	_clmul(a,b,lo,hi);
+	return _reduce(lo,hi);
+}
+
+ZT_AES_TARGET static inline __m128i _expandA(__m128i k,__m128i t)
+{
+	t = _mm_shuffle_epi32(t,0xff);
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	return _mm_xor_si128(k,t);
+}
+
+ZT_AES_TARGET static inline __m128i _expandB(__m128i k,__m128i t)
+{
+	t = _mm_shuffle_epi32(t,0xaa);
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	k = _mm_xor_si128(k,_mm_slli_si128(k,4));
+	return _mm_xor_si128(k,t);
+}
+
+ZT_AES_TARGET static void _expandAesni(const uint8_t *key,uint8_t *rk)
+{
+	__m128i k[15];
+	k[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+	k[1] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key + 16));
+	k[2] = _expandA(k[0],_mm_aeskeygenassist_si128(k[1],0x01));
+	k[3] = _expandB(k[1],_mm_aeskeygenassist_si128(k[2],0x00));
+	k[4] = _expandA(k[2],_mm_aeskeygenassist_si128(k[3],0x02));
+	k[5] = _expandB(k[3],_mm_aeskeygenassist_si128(k[4],0x00));
+	k[6] = _expandA(k[4],_mm_aeskeygenassist_si128(k[5],0x04));
+	k[7] = _expandB(k[5],_mm_aeskeygenassist_si128(k[6],0x00));
+	k[8] = _expandA(k[6],_mm_aeskeygenassist_si128(k[7],0x08));
+	k[9] = _expandB(k[7],_mm_aeskeygenassist_si128(k[8],0x00));
+	k[10] = _expandA(k[8],_mm_aeskeygenassist_si128(k[9],0x10));
+	k[11] = _expandB(k[9],_mm_aeskeygenassist_si128(k[10],0x00));
+	k[12] = _expandA(k[10],_mm_aeskeygenassist_si128(k[11],0x20));
+	k[13] = _expandB(k[11],_mm_aeskeygenassist_si128(k[12],0x00));
+	k[14] = _expandA(k[12],_mm_aeskeygenassist_si128(k[13],0x40));
+	for(unsigned int i=0;i<15;++i)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(rk + (i * 16)),k[i]);
+}
+
+ZT_AES_TARGET static void _encryptAesni(const uint8_t *rk,const uint8_t *in,uint8_t *out)
+{
+	__m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)),_mm_loadu_si128(reinterpret_cast<const __m128i *>(rk)));
+	for(unsigned int r=1;r<14;++r)
+		b = _mm_aesenc_si128(b,_mm_loadu_si128(reinterpret_cast<const __m128i *>(rk + (r * 16))));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),_mm_aesenclast_si128(b,_mm_loadu_si128(reinterpret_cast<const __m128i *>(rk + 224))));
+}
+
+#define ZT_AES_ROUND8(f,k) \
+	b0 = f(b0,k); b1 = f(b1,k); b2 = f(b2,k); b3 = f(b3,k); \
+	b4 = f(b4,k); b5 = f(b5,k); b6 = f(b6,k); b7 = f(b7,k);
+#define ZT_AES_XOR_STORE(i,b) _mm_storeu_si128(reinterpret_cast<__m128i *>(out + ((i) * 16)),_mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + ((i) * 16))),b))
+
+ZT_AES_TARGET static void _ctrAesni(const uint8_t *rk,uint8_t *counter,const uint8_t *in,uint8_t *out,unsigned int len)
+{
+	// Swapping the last four bytes puts the big-endian counter in a native 32-bit lane
+	const __m128i swap = _mm_set_epi8(12,13,14,15,11,10,9,8,7,6,5,4,3,2,1,0);
+	const __m128i one = _mm_set_epi32(1,0,0,0);
+	__m128i c = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(counter)),swap);
+
+	__m128i k[15];
+	for(unsigned int i=0;i<15;++i)
+		k[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk + (i * 16)));
+
+	while (len >= 128) {
+		__m128i b0 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b1 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b2 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b3 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b4 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b5 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b6 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		__m128i b7 = _mm_shuffle_epi8(c,swap); c = _mm_add_epi32(c,one);
+		ZT_AES_ROUND8(_mm_xor_si128,k[0]);
+		for(unsigned int r=1;r<14;++r) {
+			ZT_AES_ROUND8(_mm_aesenc_si128,k[r]);
+		}
+		ZT_AES_ROUND8(_mm_aesenclast_si128,k[14]);
+		ZT_AES_XOR_STORE(0,b0); ZT_AES_XOR_STORE(1,b1); ZT_AES_XOR_STORE(2,b2); ZT_AES_XOR_STORE(3,b3);
+		ZT_AES_XOR_STORE(4,b4); ZT_AES_XOR_STORE(5,b5); ZT_AES_XOR_STORE(6,b6); ZT_AES_XOR_STORE(7,b7);
+		in += 128;
+		out += 128;
+		len -= 128;
+	}
+
+	while (len) {
+		__m128i b = _mm_xor_si128(_mm_shuffle_epi8(c,swap),k[0]);
+		c = _mm_add_epi32(c,one);
+		for(unsigned int r=1;r<14;++r)
+			b = _mm_aesenc_si128(b,k[r]);
+		b = _mm_aesenclast_si128(b,k[14]);
+		if (len >= 16) {
+			ZT_AES_XOR_STORE(0,b);
+			in += 16;
+			out += 16;
+			len -= 16;
+		} else {
+			uint8_t ks[16];
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(ks),b);
+			for(unsigned int i=0;i<len;++i)
+				out[i] = in[i] ^ ks[i];
+			break;
+		}
+	}
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(counter),_mm_shuffle_epi8(c,swap));
+}
+
+ZT_AES_TARGET static void _ghashInitAesni(const uint8_t *h,uint8_t *y,uint8_t (*hp)[16])
+{
+	const __m128i h1 = _bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(h)));
+	const __m128i h2 = _gfmul(h1,h1);
+	const __m128i h3 = _gfmul(h2,h1);
+	const __m128i h4 = _gfmul(h3,h1);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(hp[0]),h1);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(hp[1]),h2);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(hp[2]),h3);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(hp[3]),h4);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(y),_mm_setzero_si128());
+}
+
+ZT_AES_TARGET static void _ghashUpdateAesni(uint8_t *ys,const uint8_t (*hp)[16],const uint8_t *d,unsigned int len)
+{
+	const __m128i h1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hp[0]));
+	__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ys));
+
+	if (len >= 64) {
+		const __m128i h2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hp[1]));
+		const __m128i h3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hp[2]));
+		const __m128i h4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hp[3]));
+		do {
+			// (((y + x0)h + x1)h + x2)h + x3)h == (y + x0)h^4 + x1h^3 + x2h^2 + x3h
+			__m128i lo,hi,l,h;
+			_clmul(_mm_xor_si128(y,_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(d)))),h4,lo,hi);
+			_clmul(_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(d + 16))),h3,l,h);
+			lo = _mm_xor_si128(lo,l); hi = _mm_xor_si128(hi,h);
+			_clmul(_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(d + 32))),h2,l,h);
+			lo = _mm_xor_si128(lo,l); hi = _mm_xor_si128(hi,h);
+			_clmul(_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(d + 48))),h1,l,h);
+			lo = _mm_xor_si128(lo,l); hi = _mm_xor_si128(hi,h);
+			y = _reduce(lo,hi);
+			d += 64;
+			len -= 64;
+		} while (len >= 64);
+	}
+
+	while (len >= 16) {
+		y = _gfmul(_mm_xor_si128(y,_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(d)))),h1);
+		d += 16;
+		len -= 16;
+	}
+	if (len) {
+		uint8_t last[16];
+		memset(last,0,sizeof(last));
+		memcpy(last,d,len);
+		y = _gfmul(_mm_xor_si128(y,_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(last)))),h1);
+	}
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(ys),y);
+}
+
+ZT_AES_TARGET static void _ghashFinishAesni(const uint8_t *ys,uint8_t *out)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(out),_bswap128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ys))));
+}
+
+#endif // ZT_AES_AESNI
+
+/************************************************************************** */
+
+static AES::Kernel _aesBestKernel()
+{
+	return (AES::kernelSupported(AES::KERNEL_AESNI)) ? AES::KERNEL_AESNI : AES::KERNEL_DEFAULT;
+}
+
+} // anonymous namespace
+
+AES::Kernel AES::_kernel = _aesBestKernel();
+
+bool AES::kernelSupported(const Kernel k)
+{
+	switch(k) {
+		case KERNEL_DEFAULT:
+			return true;
+#ifdef ZT_AES_AESNI
+		case KERNEL_AESNI: {
+			// AES-NI, PCLMULQDQ, SSSE3 and SSE4.1
+			unsigned int a = 0,b = 0,c = 0,d = 0;
+			if (!__get_cpuid(1,&a,&b,&c,&d))
+				return false;
+			return ((c & (1U << 25))&&(c & (1U << 1))&&(c & (1U << 9))&&(c & (1U << 19)));
+		}
+#endif
+		default:
+			return false;
+	}
+}
+
+bool AES::setKernel(const Kernel k)
+{
+	if (!kernelSupported(k))
+		return false;
+	_kernel = k;
+	return true;
+}
+
+const char *AES::kernelName(const Kernel k)
+{
+	switch(k) {
+		case KERNEL_DEFAULT: return "c";
+		case KERNEL_AESNI: return "aesni";
+	}
+	return "unknown";
+}
+
+void AES::init(const void *key)
+{
+#ifdef ZT_AES_AESNI
+	if (_kernel == KERNEL_AESNI) {
+		_expandAesni(reinterpret_cast<const uint8_t *>(key),_k);
+		return;
+	}
+#endif
+	_expandPortable(reinterpret_cast<const uint8_t *>(key),_k);
+}
+
+void AES::encrypt(const void *in,void *out) const
+{
+#ifdef ZT_AES_AESNI
+	if (_kernel == KERNEL_AESNI) {
+		_encryptAesni(_k,reinterpret_cast<const uint8_t *>(in),reinterpret_cast<uint8_t *>(out));
+		return;
+	}
+#endif
+	_encryptPortable(_k,reinterpret_cast<const uint8_t *>(in),reinterpret_cast<uint8_t *>(out));
+}
+
+void AES::ctr(uint8_t counter[16],const void *in,void *out,unsigned int len) const
+{
+#ifdef ZT_AES_AESNI
+	if (_kernel == KERNEL_AESNI) {
+		_ctrAesni(_k,counter,reinterpret_cast<const uint8_t *>(in),reinterpret_cast<uint8_t *>(out),len);
+		return;
+	}
+#endif
+	_ctrPortable(_k,counter,reinterpret_cast<const uint8_t *>(in),reinterpret_cast<uint8_t *>(out),len);
+}
+
+void AES::gcmEncrypt(const void *iv,const void *aad,unsigned int aadLen,const void *in,void *out,unsigned int len,void *tag) const
+{
+	uint8_t h[16],j0[16],cb[16],s[16];
+	memset(h,0,16);
+	encrypt(h,h);
+	memcpy(j0,iv,12);
+	j0[12] = 0; j0[13] = 0; j0[14] = 0; j0[15] = 1;
+	memcpy(cb,j0,16);
+	cb[15] = 2;
+
+	ctr(cb,in,out,len);
+	GHASH g(h);
+	g.update(aad,aadLen);
+	g.update(out,len);
+	g.finish(aadLen,len,s);
+
+	encrypt(j0,j0);
+	for(unsigned int i=0;i<16;++i)
+		reinterpret_cast<uint8_t *>(tag)[i] = s[i] ^ j0[i];
+}
+
+bool AES::gcmDecrypt(const void *iv,const void *aad,unsigned int aadLen,const void *in,void *out,unsigned int len,const void *tag,unsigned int tagLen) const
+{
+	uint8_t h[16],j0[16],cb[16],s[16];
+	if ((tagLen < 4)||(tagLen > 16))
+		return false;
+	memset(h,0,16);
+	encrypt(h,h);
+	memcpy(j0,iv,12);
+	j0[12] = 0; j0[13] = 0; j0[14] = 0; j0[15] = 1;
+	memcpy(cb,j0,16);
+	cb[15] = 2;
+
+	GHASH g(h);
+	g.update(aad,aadLen);
+	g.update(in,len);
+	g.finish(aadLen,len,s);
+	ctr(cb,in,out,len);
+
+	encrypt(j0,j0);
+	for(unsigned int i=0;i<16;++i)
+		s[i] ^= j0[i];
+	return Utils::secureEq(s,tag,tagLen);
+}
+
+AES::GHASH::GHASH(const void *h)
+{
+#ifdef ZT_AES_AESNI
+	if (_kernel == KERNEL_AESNI) {
+		_ghashInitAesni(reinterpret_cast<const uint8_t *>(h),_y,_h);
+		return;
+	}
+#endif
+	memcpy(_h[0],h,16);
+	memset(_y,0,16);
+}
+
+void AES::GHASH::update(const void *data,unsigned int len)
+{
+	const uint8_t *d = reinterpret_cast<const uint8_t *>(data);
+#ifdef ZT_AES_AESNI
+	if (_kernel == KERNEL_AESNI) {
+		_ghashUpdateAesni(_y,_h,d,len);
+		return;
+	}
+#endif
+	while (len) {
+		const unsigned int n = (len < 16) ? len : 16;
+		for(unsigned int i=0;i<n;++i)
+			_y[i] ^= d[i];
+		_gmulPortable(_y,_h[0]);
+		d += n;
+		len -= n;
+	}
+}
+
+void AES::GHASH::finish(const uint64_t aadLen,const uint64_t len,void *out)
+{
+	uint8_t lb[16];
+	_store64BE(lb,aadLen * 8);
+	_store64BE(lb + 8,len * 8);
+	update(lb,16);
+#ifdef ZT_AES_AESNI
+	if (_kernel == KERNEL_AESNI) {
+		_ghashFinishAesni(_y,reinterpret_cast<uint8_t *>(out));
+		return;
+	}
+#endif
+	memcpy(out,_y,16);
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,205 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_AES_HPP
+#define ZT_AES_HPP
+
+#include <stdint.h>
+
+#include "Constants.hpp"
+#include "Utils.hpp"
+
+#define ZT_AES_KEY_SIZE 32
+#define ZT_AES_BLOCK_SIZE 16
+
+namespace ZeroTier {
+
+/**
+ * AES-256 block cipher with the CTR mode and GHASH pieces of GCM
+ *
+ * These are the building blocks of the AES-256-GCM cipher suite in Packet
+ * plus a plain AES-256-GCM for checking them against published vectors.
+ * The portable kernel is slow and not constant time, so the cipher suite
+ * is only offered to peers when a hardware kernel is in use.
+ */
+class AES
+{
+public:
+	/**
+	 * AES and GHASH kernels
+	 *
+	 * The hardware kernel, if supported, is selected at startup. It runs
+	 * eight counter blocks through the AES rounds at once and folds four
+	 * blocks into GHASH per reduction.
+	 */
+	enum Kernel
+	{
+		KERNEL_DEFAULT = 0, // portable C
+		KERNEL_AESNI = 1    // x86 AES-NI and PCLMULQDQ
+	};
+
+	/**
+	 * @param k Kernel
+	 * @return True if this build and CPU can run this kernel
+	 */
+	static bool kernelSupported(const Kernel k);
+
+	/**
+	 * Override the kernel in use (for testing and benchmarking, not thread safe)
+	 *
+	 * @param k Kernel to use
+	 * @return False if kernel is not supported (selection is unchanged)
+	 */
+	static bool setKernel(const Kernel k);
+
+	/**
+	 * @return Kernel currently in use
+	 */
+	static inline Kernel kernel() { return _kernel; }
+
+	/**
+	 * @param k Kernel
+	 * @return Short human-readable name of kernel
+	 */
+	static const char *kernelName(const Kernel k);
+
+	/**
+	 * @return True if AES is hardware accelerated and should be offered to peers
+	 */
+	static inline bool accelerated() { return (_kernel != KERNEL_DEFAULT); }
+
+	AES() {}
+
+	/**
+	 * @param key 256-bit key
+	 */
+	AES(const void *key) { init(key); }
+
+	~AES() { Utils::burn(_k,sizeof(_k)); }
+
+	/**
+	 * @param key 256-bit key
+	 */
+	void init(const void *key);
+
+	/**
+	 * Encrypt a single block
+	 *
+	 * @param in 16-byte input
+	 * @param out 16-byte output (may be the same as in)
+	 */
+	void encrypt(const void *in,void *out) const;
+
+	/**
+	 * Encrypt or decrypt in counter mode
+	 *
+	 * The last four bytes of the counter block are a big-endian counter
+	 * that is incremented for each block and wraps without carrying, as in
+	 * GCM. The counter block is updated so a message can be processed in
+	 * pieces, but every piece except the last must be a multiple of 16 bytes.
+	 *
+	 * @param counter 16-byte counter block, updated on return
+	 * @param in Input
+	 * @param out Output (may be the same as in)
+	 * @param len Length in bytes
+	 */
+	void ctr(uint8_t counter[16],const void *in,void *out,unsigned int len) const;
+
+	/**
+	 * Standard AES-256-GCM encryption with a 96-bit IV and 128-bit tag
+	 *
+	 * @param iv 12-byte IV
+	 * @param aad Additional authenticated data
+	 * @param aadLen Length of additional authenticated data
+	 * @param in Plaintext
+	 * @param out Ciphertext (may be the same as in)
+	 * @param len Length of plaintext
+	 * @param tag 16-byte buffer to receive tag
+	 */
+	void gcmEncrypt(const void *iv,const void *aad,unsigned int aadLen,const void *in,void *out,unsigned int len,void *tag) const;
+
+	/**
+	 * Standard AES-256-GCM decryption with a 96-bit IV
+	 *
+	 * @param iv 12-byte IV
+	 * @param aad Additional authenticated data
+	 * @param aadLen Length of additional authenticated data
+	 * @param in Ciphertext
+	 * @param out Plaintext (may be the same as in, garbage if tag is invalid)
+	 * @param len Length of ciphertext
+	 * @param tag Tag to check
+	 * @param tagLen Length of tag (4 to 16 bytes, a prefix of the full tag)
+	 * @return True if tag is valid
+	 */
+	bool gcmDecrypt(const void *iv,const void *aad,unsigned int aadLen,const void *in,void *out,unsigned int len,const void *tag,unsigned int tagLen) const;
+
+	/**
+	 * GHASH universal hash from GCM
+	 *
+	 * Data is hashed as GCM does, with additional data and ciphertext
+	 * each zero padded to a multiple of 16 bytes. Every update() except the
+	 * last for each of them must be a multiple of 16 bytes.
+	 */
+	class GHASH
+	{
+	public:
+		/**
+		 * @param h 16-byte hash key
+		 */
+		GHASH(const void *h);
+
+		~GHASH() { Utils::burn(this,sizeof(GHASH)); }
+
+		/**
+		 * @param data Data to hash
+		 * @param len Length in bytes
+		 */
+		void update(const void *data,unsigned int len);
+
+		/**
+		 * Hash the lengths block and get the result
+		 *
+		 * @param aadLen Total bytes of additional data hashed
+		 * @param len Total bytes of ciphertext hashed
+		 * @param out 16-byte buffer to receive hash
+		 */
+		void finish(const uint64_t aadLen,const uint64_t len,void *out);
+
+	private:
+		// Hash state and powers of the key H^1..H^4, in the byte order of the kernel in use
+		uint8_t _y[16];
+		uint8_t _h[4][16];
+	};
+
+private:
+	static Kernel _kernel;
+
+	uint8_t _k[240]; // 15 round keys
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_ADMISSION_HPP
+#define ZT_ADMISSION_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "../include/ZeroTierOne.h"
+
+#include "Constants.hpp"
+#include "InetAddress.hpp"
+#include "Mutex.hpp"
+#include "Metrics.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Paces expensive work done for unknown peers to a CPU time budget
+ *
+ * Packets from peers we know cost a MAC check plus whatever their verb
+ * does and are never held up here, and neither is relaying. Packets from
+ * peers we don't know cost more: a HELLO needs a key agreement and usually
+ * an identity validation, and anything else is queued while its sender is
+ * looked up. After an outage every peer of a root says HELLO at once, and
+ * a flood of made-up identities costs its sender nothing.
+ *
+ * Admitted work is charged the time it actually took. Like Shaper's limits
+ * the budget is tracked as a theoretical arrival time (GCRA), once for the
+ * node and once for each source prefix (see InetAddress::rateGateHash()),
+ * which gets 1/ZT_ADMISSION_SOURCE_SHARE of the budget. More expensive
+ * classes may run less far ahead, so as a backlog builds identity
+ * validation is shed first, then key agreement, then WHOIS.
+ */
+class Admission
+{
+public:
+	enum Class
+	{
+		CLASS_WHOIS = 0,    // packet from an unknown peer, queued while its sender is looked up
+		CLASS_AGREE = 1,    // HELLO needing a key agreement
+		CLASS_VALIDATE = 2  // HELLO needing identity validation and a key agreement
+	};
+
+	/**
+	 * Measures admitted work and charges it to the budget when it goes out of scope
+	 */
+	class Charge
+	{
+	public:
+		Charge(Admission &a,const InetAddress &from,const int64_t now) :
+			_a(a),
+			_from(from),
+			_now(now),
+			_start(std::chrono::steady_clock::now()) {}
+
+		~Charge()
+		{
+			if (_a.active())
+				_a.charge(_from,(uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count(),_now);
+		}
+
+	private:
+		Admission &_a;
+		const InetAddress &_from;
+		const int64_t _now;
+		const std::chrono::steady_clock::time_point _start;
+	};
+
+	Admission() :
+		_budget(0),
+		_tat(0),
+		_lock("Admission::_lock")
+	{
+		memset(_sourceTat,0,sizeof(_sourceTat));
+	}
+
+	/**
+	 * @param cpuMicrosecondsPerSecond CPU time per second unknown peers may use or 0 for no limit
+	 */
+	inline void setBudget(const uint64_t cpuMicrosecondsPerSecond)
+	{
+		Mutex::Lock _l(_lock);
+		_budget = cpuMicrosecondsPerSecond;
+		_tat = 0;
+		memset(_sourceTat,0,sizeof(_sourceTat));
+	}
+
+	/**
+	 * @return True if a budget is set
+	 */
+	inline bool active() const { return (_budget != 0); }
+
+	/**
+	 * Decide whether to do a piece of work for an unknown peer
+	 *
+	 * Work that is shed is counted as an overload drop.
+	 *
+	 * @param c Class of work
+	 * @param from Physical source address
+	 * @param now Current time
+	 * @return True to go ahead, false to drop the packet
+	 */
+	inline bool admit(const Class c,const InetAddress &from,const int64_t now)
+	{
+		if (!_budget)
+			return true;
+		const int64_t t = now * 1000;
+		const int64_t ahead = ((int64_t)ZT_ADMISSION_BACKLOG * 1000 * (3 - (int64_t)c)) / 3;
+		const unsigned long h = from.rateGateHash();
+		{
+			Mutex::Lock _l(_lock);
+			if (((_tat - t) <= ahead)&&((_sourceTat[h] - t) <= ahead))
+				return true;
+		}
+		Metrics::drop(ZT_METRICS_DROP_OVERLOAD);
+		Metrics::add(Metrics::ADMISSION_SHED + (unsigned int)c,1);
+		return false;
+	}
+
+	/**
+	 * Charge admitted work to the budget
+	 *
+	 * @param from Physical source address
+	 * @param cpuMicroseconds Time the work took
+	 * @param now Current time
+	 */
+	inline void charge(const InetAddress &from,const uint64_t cpuMicroseconds,const int64_t now)
+	{
+		const uint64_t b = _budget;
+		if (!b)
+			return;
+		Metrics::add(Metrics::ADMISSION_MICROSECONDS,cpuMicroseconds);
+		const int64_t t = now * 1000;
+		const int64_t cost = (int64_t)((cpuMicroseconds * 1000000ULL) / b);
+		const unsigned long h = from.rateGateHash();
+		Mutex::Lock _l(_lock);
+		_tat = std::max(_tat,t) + cost;
+		_sourceTat[h] = std::max(_sourceTat[h],t) + (cost * ZT_ADMISSION_SOURCE_SHARE);
+	}
+
+private:
+	volatile uint64_t _budget;
+	int64_t _tat; // microseconds
+	int64_t _sourceTat[16384]; // indexed by InetAddress::rateGateHash()
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
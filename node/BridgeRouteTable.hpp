@@ -0,0 +1,210 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BRIDGEROUTETABLE_HPP
+#define ZT_BRIDGEROUTETABLE_HPP
+
+#include <stdint.h>
+
+#include <list>
+#include <vector>
+
+#include "Constants.hpp"
+#include "Address.hpp"
+#include "MAC.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+
+namespace ZeroTier {
+
+/**
+ * MAC learning table for devices behind remote bridges
+ *
+ * This works like the table of an Ethernet switch. Each MAC maps to the
+ * bridge it was last seen behind, and routes are aged out when frames from
+ * them stop. The table is bounded both overall and per bridge, with the
+ * least recently seen MAC evicted first in each case. Learning, lookup and
+ * eviction are all constant time.
+ */
+class BridgeRouteTable
+{
+public:
+	/**
+	 * @param capacity Maximum number of routes (default: ZT_MAX_BRIDGE_ROUTES)
+	 * @param perBridge Maximum number of routes behind any one bridge (default: ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE)
+	 */
+	BridgeRouteTable(const unsigned long capacity = ZT_MAX_BRIDGE_ROUTES,const unsigned long perBridge = ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE) :
+		_routes(64),
+		_bridges(8),
+		_capacity(capacity),
+		_perBridge(perBridge),
+		_lock("BridgeRouteTable::_lock")
+	{
+	}
+
+	/**
+	 * Change the limits, evicting least recently seen routes over them
+	 *
+	 * @param capacity Maximum number of routes
+	 * @param perBridge Maximum number of routes behind any one bridge
+	 */
+	inline void setLimits(const unsigned long capacity,const unsigned long perBridge)
+	{
+		Mutex::Lock _l(_lock);
+		_capacity = capacity;
+		_perBridge = perBridge;
+		while (_routes.size() > capacity)
+			_erase(_lru.back());
+		std::vector<MAC> over;
+		Hashtable< Address,std::list<MAC> >::Iterator i(_bridges);
+		Address *b = (Address *)0;
+		std::list<MAC> *bl = (std::list<MAC> *)0;
+		while (i.next(b,bl)) {
+			std::list<MAC>::reverse_iterator m(bl->rbegin());
+			for(unsigned long n=(unsigned long)bl->size();n>perBridge;--n)
+				over.push_back(*(m++));
+		}
+		for(std::vector<MAC>::const_iterator m(over.begin());m!=over.end();++m)
+			_erase(*m);
+	}
+
+	/**
+	 * @param mac MAC address
+	 * @return Bridge this MAC was last seen behind or NULL address if not known
+	 */
+	inline Address get(const MAC &mac) const
+	{
+		Mutex::Lock _l(_lock);
+		const _Route *const r = _routes.get(mac);
+		return ((r) ? r->bridge : Address());
+	}
+
+	/**
+	 * Learn or refresh a route from a frame that came from a bridged MAC
+	 *
+	 * @param mac Source MAC of frame
+	 * @param bridge Bridge it came from
+	 * @param now Current time
+	 */
+	inline void learn(const MAC &mac,const Address &bridge,const int64_t now)
+	{
+		Mutex::Lock _l(_lock);
+		if ((!_capacity)||(!_perBridge))
+			return;
+
+		_Route *r = _routes.get(mac);
+		if ((r)&&(r->bridge == bridge)) {
+			r->lastSeen = now;
+			_lru.splice(_lru.begin(),_lru,r->lruPosition);
+			std::list<MAC> &bl = *(_bridges.get(bridge));
+			bl.splice(bl.begin(),bl,r->bridgePosition);
+			return;
+		}
+		if (r) // MAC moved to another bridge
+			_erase(mac);
+
+		std::list<MAC> *bl = _bridges.get(bridge);
+		if ((bl)&&(bl->size() >= _perBridge))
+			_erase(bl->back());
+		while (_routes.size() >= _capacity)
+			_erase(_lru.back());
+		bl = &(_bridges[bridge]); // after evictions, which can erase this bridge's list
+
+		_lru.push_front(mac);
+		bl->push_front(mac);
+		r = &(_routes[mac]);
+		r->bridge = bridge;
+		r->lastSeen = now;
+		r->lruPosition = _lru.begin();
+		r->bridgePosition = bl->begin();
+	}
+
+	/**
+	 * Forget routes that haven't been refreshed in ZT_BRIDGE_ROUTE_EXPIRE
+	 *
+	 * @param now Current time
+	 */
+	inline void clean(const int64_t now)
+	{
+		Mutex::Lock _l(_lock);
+		while ((!_lru.empty())&&((now - _routes.get(_lru.back())->lastSeen) > ZT_BRIDGE_ROUTE_EXPIRE))
+			_erase(_lru.back());
+	}
+
+	/**
+	 * @return Number of routes in table
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _routes.size();
+	}
+
+	/**
+	 * @return Approximate bytes used by the table and its lists
+	 */
+	inline unsigned long memoryUsage() const
+	{
+		Mutex::Lock _l(_lock);
+		// Each route is on two lists, each node of which holds a MAC and two links
+		return (_routes.memoryUsage() + _bridges.memoryUsage() + (_routes.size() * 2 * (sizeof(MAC) + (2 * sizeof(void *)))));
+	}
+
+private:
+	struct _Route
+	{
+		Address bridge;
+		int64_t lastSeen;
+		std::list<MAC>::iterator lruPosition;
+		std::list<MAC>::iterator bridgePosition;
+	};
+
+	inline void _erase(const MAC mac) // by value since it's usually a reference into a list this erases from
+	{
+		_Route *const r = _routes.get(mac);
+		if (!r)
+			return;
+		std::list<MAC> *const bl = _bridges.get(r->bridge);
+		if (bl) {
+			bl->erase(r->bridgePosition);
+			if (bl->empty())
+				_bridges.erase(r->bridge);
+		}
+		_lru.erase(r->lruPosition);
+		_routes.erase(mac);
+	}
+
+	Hashtable< MAC,_Route > _routes;
+	Hashtable< Address,std::list<MAC> > _bridges; // each bridge's MACs, most recently seen first
+	std::list<MAC> _lru; // all MACs, most recently seen first
+	unsigned long _capacity;
+	unsigned long _perBridge;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -99,6 +99,12 @@ public:
 		_l = l;
 	}
 
+	// Explicit copy so that only the used part of the buffer is copied
+	Buffer(const Buffer &b)
+	{
+		ZT_FAST_MEMCPY(_b,b._b,_l = b._l);
+	}
+
 	template<unsigned int C2>
 	Buffer(const Buffer<C2> &b)
 	{
@@ -110,16 +116,19 @@ public:
 		copyFrom(b,l);
 	}
 
+	inline Buffer &operator=(const Buffer &b)
+	{
+		if (this != &b)
+			ZT_FAST_MEMCPY(_b,b._b,_l = b._l);
+		return *this;
+	}
+
 	template<unsigned int C2>
 	inline Buffer &operator=(const Buffer<C2> &b)
 	{
 		if (unlikely(b._l > C))
 			throw ZT_EXCEPTION_OUT_OF_BOUNDS;
-		if (C2 == C) {
-			ZT_FAST_MEMCPY(this,&b,sizeof(Buffer<C>));
-		} else {
-			ZT_FAST_MEMCPY(_b,b._b,_l = b._l);
-		}
+		ZT_FAST_MEMCPY(_b,b._b,_l = b._l);
 		return *this;
 	}
 
@@ -434,6 +443,105 @@ public:
 	 */
 	inline unsigned int capacity() const { return C; }
 
+	/**
+	 * Appends a run of fields with one capacity check for all of them
+	 *
+	 * The constructor reserves n bytes at the end of the buffer, throwing if
+	 * they don't fit, and put() then fills them in without further checks.
+	 * The puts must add up to exactly n bytes. Budgets should be sums of
+	 * sizeof() and *_LENGTH constants so they fold to a constant and are easy
+	 * to check against the fields written.
+	 */
+	class Writer
+	{
+	public:
+		/**
+		 * @param b Buffer to append to
+		 * @param n Total length of the fields that will be written
+		 * @throws std::out_of_range Fields would extend beyond capacity
+		 */
+		Writer(Buffer &b,const unsigned int n) : _p(b.appendField(n)) {}
+
+		/**
+		 * @param v Integer to write in big-endian byte order
+		 * @tparam T Integer type (e.g. uint16_t, int64_t)
+		 */
+		template<typename T>
+		inline void put(const T v)
+		{
+			Buffer::_store(_p,v);
+			_p += sizeof(T);
+		}
+
+		/**
+		 * @param d Bytes to write
+		 * @param l Number of bytes
+		 */
+		inline void put(const void *d,const unsigned int l)
+		{
+			ZT_FAST_MEMCPY(_p,d,l);
+			_p += l;
+		}
+
+		/**
+		 * @param l Length of field
+		 * @return Pointer to the next l bytes for the caller to fill in (e.g. with Address::copyTo())
+		 */
+		inline void *field(const unsigned int l)
+		{
+			char *const f = _p;
+			_p += l;
+			return f;
+		}
+
+	private:
+		char *_p;
+	};
+
+	/**
+	 * Reads a run of fields with one bounds check for all of them
+	 *
+	 * The constructor checks that n bytes starting at i are within the data
+	 * in the buffer and get() then reads them in order with no further checks.
+	 */
+	class Reader
+	{
+	public:
+		/**
+		 * @param b Buffer to read from
+		 * @param i Index of first field
+		 * @param n Total length of the fields that will be read
+		 * @throws std::out_of_range Fields extend beyond data size
+		 */
+		Reader(const Buffer &b,const unsigned int i,const unsigned int n) : _p(reinterpret_cast<const char *>(b.field(i,n))) {}
+
+		/**
+		 * @return Next big-endian integer
+		 * @tparam T Integer type (e.g. uint16_t, int64_t)
+		 */
+		template<typename T>
+		inline T get()
+		{
+			const T v = Buffer::_load<T>(_p);
+			_p += sizeof(T);
+			return v;
+		}
+
+		/**
+		 * @param l Length of field
+		 * @return Pointer to the next l bytes
+		 */
+		inline const void *field(const unsigned int l)
+		{
+			const char *const f = _p;
+			_p += l;
+			return f;
+		}
+
+	private:
+		const char *_p;
+	};
+
 	template<unsigned int C2>
 	inline bool operator==(const Buffer<C2> &b) const
 	{
@@ -466,6 +574,36 @@ public:
 	}
 
 private:
+	template<typename T>
+	static inline void _store(char *const b,const T v)
+	{
+#ifdef ZT_NO_TYPE_PUNNING
+		uint8_t *p = reinterpret_cast<uint8_t *>(b);
+		for(unsigned int x=1;x<=sizeof(T);++x)
+			*(p++) = (uint8_t)(v >> (8 * (sizeof(T) - x)));
+#else
+		T *const ZT_VAR_MAY_ALIAS p = reinterpret_cast<T *>(b);
+		*p = Utils::hton(v);
+#endif
+	}
+
+	template<typename T>
+	static inline T _load(const char *const b)
+	{
+#ifdef ZT_NO_TYPE_PUNNING
+		T v = 0;
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(b);
+		for(unsigned int x=0;x<sizeof(T);++x) {
+			v <<= 8;
+			v |= (T)*(p++);
+		}
+		return v;
+#else
+		const T *const ZT_VAR_MAY_ALIAS p = reinterpret_cast<const T *>(b);
+		return Utils::ntoh(*p);
+#endif
+	}
+
 	char ZT_VAR_MAY_ALIAS _b[C];
 	unsigned int _l;
 };
@@ -11,6 +11,8 @@ Derived from public domain code by D. J. Bernstein.
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "Constants.hpp"
 #include "C25519.hpp"
 #include "SHA512.hpp"
@@ -287,10 +289,6 @@ int crypto_scalarmult(unsigned char *q,const unsigned char *n,const unsigned cha
 }
 
 static const unsigned char base[32] = {9};
-int crypto_scalarmult_base(unsigned char *q,const unsigned char *n)
-{
-	return crypto_scalarmult(q,n,base);
-}
 
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -1961,6 +1959,84 @@ void ge25519_double_scalarmult_vartime(ge25519_p3 *r, const ge25519_p3 *p1, cons
 	}
 }
 
+/* signed sliding window digits of s, each zero or odd in [-15,15] */
+void sc25519_slide(signed char r[256], const sc25519 *s)
+{
+	int i,b,k;
+	for(i=0;i<256;++i)
+		r[i] = 1 & (s->v[i >> 3] >> (i & 7));
+	for(i=0;i<256;++i) {
+		if (r[i]) {
+			for(b=1;(b<=6)&&((i+b)<256);++b) {
+				if (r[i+b]) {
+					if ((r[i] + (r[i+b] << b)) <= 15) {
+						r[i] += r[i+b] << b;
+						r[i+b] = 0;
+					} else if ((r[i] - (r[i+b] << b)) >= -15) {
+						r[i] -= r[i+b] << b;
+						for(k=i+b;k<256;++k) {
+							if (!r[k]) {
+								r[k] = 1;
+								break;
+							}
+							r[k] = 0;
+						}
+					} else break;
+				}
+			}
+		}
+	}
+}
+
+#define ZT_C25519_BATCH_CHUNK 8
+#define ZT_C25519_MSM_MAX (ZT_C25519_BATCH_CHUNK * 2)
+
+/* computes [s[0]]p[0] + ... + [s[n-1]]p[n-1] with shared doublings, n <= ZT_C25519_MSM_MAX */
+void ge25519_multi_scalarmult_vartime(ge25519_p3 *r, const ge25519_p3 *p, const sc25519 *s, unsigned int n)
+{
+	ge25519_p1p1 tp1p1;
+	ge25519_p3 pre[ZT_C25519_MSM_MAX][8]; /* odd multiples 1p,3p,...,15p */
+	ge25519_p3 p2, np;
+	signed char slide[ZT_C25519_MSM_MAX][256];
+	unsigned int j,k;
+	int i,top = -1;
+
+	for(j=0;j<n;++j) {
+		sc25519_slide(slide[j],&s[j]);
+		for(i=255;i>top;--i) {
+			if (slide[j][i]) {
+				top = i;
+				break;
+			}
+		}
+		pre[j][0] = p[j];
+		dbl_p1p1(&tp1p1,(const ge25519_p2 *)&p[j]); p1p1_to_p3(&p2,&tp1p1);
+		for(k=1;k<8;++k) {
+			add_p1p1(&tp1p1,&pre[j][k-1],&p2);
+			p1p1_to_p3(&pre[j][k],&tp1p1);
+		}
+	}
+
+	setneutral(r);
+	for(i=top;i>=0;--i) {
+		dbl_p1p1(&tp1p1,(const ge25519_p2 *)r);
+		p1p1_to_p3(r,&tp1p1);
+		for(j=0;j<n;++j) {
+			const int d = slide[j][i];
+			if (d > 0) {
+				add_p1p1(&tp1p1,r,&pre[j][d >> 1]);
+				p1p1_to_p3(r,&tp1p1);
+			} else if (d < 0) {
+				np = pre[j][(-d) >> 1];
+				fe25519_neg(&np.x,&np.x);
+				fe25519_neg(&np.t,&np.t);
+				add_p1p1(&tp1p1,r,&np);
+				p1p1_to_p3(r,&tp1p1);
+			}
+		}
+	}
+}
+
 void ge25519_scalarmult_base(ge25519_p3 *r, const sc25519 *s)
 {
 	signed char b[85];
@@ -1990,23 +2066,395 @@ void get_hram(unsigned char *hram, const unsigned char *sm, const unsigned char
 	ZeroTier::SHA512::hash(hram,playground,(unsigned int)smlen);
 }
 
+/*
+ * Checks n <= ZT_C25519_BATCH_CHUNK signatures with the randomized batch
+ * equation [sum z_i*S_i]B + sum [z_i*H_i](-A_i) + sum [z_i](-R_i) == 0,
+ * with secret random 128-bit z_i. R is decoded here rather than compared to
+ * a re-encoding as verify() does, so non-canonical R encodings are refused
+ * up front. Like verify() this does not multiply by the cofactor; the two can
+ * only disagree on signatures their own signer deliberately built with
+ * small-order components, and forging remains as hard as for verify().
+ */
+bool ed25519_verify_batch_chunk(const ZeroTier::C25519::Public *their,const void *const *msg,const unsigned int *len,const ZeroTier::C25519::Signature *signature,unsigned int n)
+{
+	ge25519_p3 p[ZT_C25519_MSM_MAX], r, bs;
+	ge25519_p1p1 tp1p1;
+	sc25519 s[ZT_C25519_MSM_MAX], sb, t;
+	fe25519 zero;
+	unsigned char hram[crypto_hash_sha512_BYTES];
+	unsigned char m[96];
+	unsigned char digest[64];
+	unsigned char enc[32];
+	unsigned char z[32];
+	unsigned int i;
+
+	fe25519_setzero(&zero);
+	memset(z,0,sizeof(z));
+	sc25519_from32bytes(&sb,z);
+
+	for(i=0;i<n;++i) {
+		const unsigned char *const sig = signature[i].data;
+
+		ZeroTier::SHA512::hash(digest,msg[i],len[i]);
+		if (!ZeroTier::Utils::secureEq(sig + 64,digest,32))
+			return false;
+
+		if (ge25519_unpackneg_vartime(&p[i*2],their[i].data + 32))
+			return false;
+		if (ge25519_unpackneg_vartime(&p[(i*2)+1],sig))
+			return false;
+		fe25519_pack(enc,&p[(i*2)+1].y);
+		if ((memcmp(enc,sig,31) != 0)||(enc[31] != (sig[31] & 0x7f)))
+			return false;
+		if ((sig[31] & 0x80)&&(fe25519_iseq_vartime(&p[(i*2)+1].x,&zero)))
+			return false;
+
+		ZeroTier::Utils::getSecureRandom(z,16);
+		sc25519_from32bytes(&s[(i*2)+1],z);
+
+		get_hram(hram,sig,their[i].data + 32,m,96);
+		sc25519_from64bytes(&t,hram);
+		sc25519_mul(&s[i*2],&t,&s[(i*2)+1]);
+
+		sc25519_from32bytes(&t,sig + 32);
+		sc25519_mul(&t,&t,&s[(i*2)+1]);
+		sc25519_add(&sb,&sb,&t);
+	}
+
+	ge25519_multi_scalarmult_vartime(&r,p,s,n * 2);
+	ge25519_scalarmult_base(&bs,&sb);
+	add_p1p1(&tp1p1,&r,&bs);
+	p1p1_to_p2((ge25519_p2 *)&r,&tp1p1);
+
+	return ((fe25519_iseq_vartime(&r.x,&zero))&&(fe25519_iseq_vartime(&r.y,&r.z)));
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+#if defined(__SIZEOF_INT128__)
+#define ZT_C25519_64BIT_LIMBS 1
+
+// X25519 with five 51-bit limbs and 128-bit products, after curve25519-donna-c64.
+// Inputs are taken as 256-bit integers mod p like the reference code above.
+
+typedef unsigned __int128 x64_u128;
+typedef uint64_t x64_fe[5];
+
+#define X64_MASK51 0x7ffffffffffffULL
+
+static inline uint64_t x64_load64(const unsigned char *s)
+{
+	uint64_t w = 0;
+	for(int i=7;i>=0;--i)
+		w = (w << 8) | (uint64_t)s[i];
+	return w;
+}
+
+static inline void x64_store64(unsigned char *s,uint64_t w)
+{
+	for(int i=0;i<8;++i) {
+		s[i] = (unsigned char)w;
+		w >>= 8;
+	}
+}
+
+static inline void x64_unpack(x64_fe r,const unsigned char *s)
+{
+	const uint64_t w0 = x64_load64(s),w1 = x64_load64(s + 8),w2 = x64_load64(s + 16),w3 = x64_load64(s + 24);
+	r[0] = (w0 & X64_MASK51) + (19 * (w3 >> 63)); // bit 255 is 2^255 == 19 mod p
+	r[1] = ((w0 >> 51) | (w1 << 13)) & X64_MASK51;
+	r[2] = ((w1 >> 38) | (w2 << 26)) & X64_MASK51;
+	r[3] = ((w2 >> 25) | (w3 << 39)) & X64_MASK51;
+	r[4] = (w3 >> 12) & X64_MASK51;
+}
+
+static inline void x64_carry(x64_fe r)
+{
+	uint64_t c;
+	c = r[0] >> 51; r[0] &= X64_MASK51; r[1] += c;
+	c = r[1] >> 51; r[1] &= X64_MASK51; r[2] += c;
+	c = r[2] >> 51; r[2] &= X64_MASK51; r[3] += c;
+	c = r[3] >> 51; r[3] &= X64_MASK51; r[4] += c;
+	c = r[4] >> 51; r[4] &= X64_MASK51; r[0] += 19 * c;
+}
+
+static inline void x64_pack(unsigned char *s,const x64_fe a)
+{
+	x64_fe r;
+	for(int i=0;i<5;++i)
+		r[i] = a[i];
+	x64_carry(r);
+	x64_carry(r);
+
+	// r is now below 2^255 + 19, so subtracting p once if r >= p makes it canonical
+	uint64_t q = (r[0] + 19) >> 51;
+	q = (r[1] + q) >> 51;
+	q = (r[2] + q) >> 51;
+	q = (r[3] + q) >> 51;
+	q = (r[4] + q) >> 51;
+	r[0] += 19 * q;
+	uint64_t c;
+	c = r[0] >> 51; r[0] &= X64_MASK51; r[1] += c;
+	c = r[1] >> 51; r[1] &= X64_MASK51; r[2] += c;
+	c = r[2] >> 51; r[2] &= X64_MASK51; r[3] += c;
+	c = r[3] >> 51; r[3] &= X64_MASK51; r[4] += c;
+	r[4] &= X64_MASK51;
+
+	x64_store64(s,r[0] | (r[1] << 51));
+	x64_store64(s + 8,(r[1] >> 13) | (r[2] << 38));
+	x64_store64(s + 16,(r[2] >> 26) | (r[3] << 25));
+	x64_store64(s + 24,(r[3] >> 39) | (r[4] << 12));
+}
+
+static inline void x64_add(x64_fe r,const x64_fe a,const x64_fe b)
+{
+	for(int i=0;i<5;++i)
+		r[i] = a[i] + b[i];
+}
+
+// a - b with 4p added so limbs stay positive; b must be the output of a multiplication
+static inline void x64_sub(x64_fe r,const x64_fe a,const x64_fe b)
+{
+	r[0] = (a[0] + 0x1fffffffffffb4ULL) - b[0];
+	r[1] = (a[1] + 0x1ffffffffffffcULL) - b[1];
+	r[2] = (a[2] + 0x1ffffffffffffcULL) - b[2];
+	r[3] = (a[3] + 0x1ffffffffffffcULL) - b[3];
+	r[4] = (a[4] + 0x1ffffffffffffcULL) - b[4];
+}
+
+static inline void x64_reduce(x64_fe r,x64_u128 t0,x64_u128 t1,x64_u128 t2,x64_u128 t3,x64_u128 t4)
+{
+	uint64_t c;
+	r[0] = (uint64_t)t0 & X64_MASK51; c = (uint64_t)(t0 >> 51);
+	t1 += c; r[1] = (uint64_t)t1 & X64_MASK51; c = (uint64_t)(t1 >> 51);
+	t2 += c; r[2] = (uint64_t)t2 & X64_MASK51; c = (uint64_t)(t2 >> 51);
+	t3 += c; r[3] = (uint64_t)t3 & X64_MASK51; c = (uint64_t)(t3 >> 51);
+	t4 += c; r[4] = (uint64_t)t4 & X64_MASK51; c = (uint64_t)(t4 >> 51);
+	r[0] += 19 * c;
+	c = r[0] >> 51; r[0] &= X64_MASK51; r[1] += c;
+}
+
+static inline void x64_mul(x64_fe r,const x64_fe a,const x64_fe b)
+{
+	const uint64_t b1_19 = b[1] * 19,b2_19 = b[2] * 19,b3_19 = b[3] * 19,b4_19 = b[4] * 19;
+	x64_reduce(r,
+		(x64_u128)a[0] * b[0] + (x64_u128)a[1] * b4_19 + (x64_u128)a[2] * b3_19 + (x64_u128)a[3] * b2_19 + (x64_u128)a[4] * b1_19,
+		(x64_u128)a[0] * b[1] + (x64_u128)a[1] * b[0] + (x64_u128)a[2] * b4_19 + (x64_u128)a[3] * b3_19 + (x64_u128)a[4] * b2_19,
+		(x64_u128)a[0] * b[2] + (x64_u128)a[1] * b[1] + (x64_u128)a[2] * b[0] + (x64_u128)a[3] * b4_19 + (x64_u128)a[4] * b3_19,
+		(x64_u128)a[0] * b[3] + (x64_u128)a[1] * b[2] + (x64_u128)a[2] * b[1] + (x64_u128)a[3] * b[0] + (x64_u128)a[4] * b4_19,
+		(x64_u128)a[0] * b[4] + (x64_u128)a[1] * b[3] + (x64_u128)a[2] * b[2] + (x64_u128)a[3] * b[1] + (x64_u128)a[4] * b[0]);
+}
+
+static inline void x64_sq(x64_fe r,const x64_fe a)
+{
+	const uint64_t a0_2 = a[0] * 2,a1_2 = a[1] * 2,a2_2 = a[2] * 2,a3_19 = a[3] * 19,a4_19 = a[4] * 19;
+	x64_reduce(r,
+		(x64_u128)a[0] * a[0] + (x64_u128)a1_2 * a4_19 + (x64_u128)a2_2 * a3_19,
+		(x64_u128)a0_2 * a[1] + (x64_u128)a2_2 * a4_19 + (x64_u128)a[3] * a3_19,
+		(x64_u128)a0_2 * a[2] + (x64_u128)a[1] * a[1] + (x64_u128)(a[3] * 2) * a4_19,
+		(x64_u128)a0_2 * a[3] + (x64_u128)a1_2 * a[2] + (x64_u128)a[4] * a4_19,
+		(x64_u128)a0_2 * a[4] + (x64_u128)a1_2 * a[3] + (x64_u128)a[2] * a[2]);
+}
+
+static inline void x64_sqn(x64_fe r,const x64_fe a,int n)
+{
+	x64_sq(r,a);
+	while (--n > 0)
+		x64_sq(r,r);
+}
+
+static inline void x64_mul_small(x64_fe r,const x64_fe a,const uint64_t k)
+{
+	x64_reduce(r,(x64_u128)a[0] * k,(x64_u128)a[1] * k,(x64_u128)a[2] * k,(x64_u128)a[3] * k,(x64_u128)a[4] * k);
+}
+
+static inline void x64_cswap(x64_fe a,x64_fe b,const uint64_t swap)
+{
+	const uint64_t m = 0ULL - swap;
+	for(int i=0;i<5;++i) {
+		const uint64_t x = m & (a[i] ^ b[i]);
+		a[i] ^= x;
+		b[i] ^= x;
+	}
+}
+
+// r = z^(p-2) = z^(2^255 - 21)
+static void x64_invert(x64_fe r,const x64_fe z)
+{
+	x64_fe z2,z9,z11,z2_5_0,z2_10_0,z2_20_0,z2_50_0,z2_100_0,t;
+	x64_sq(z2,z);
+	x64_sqn(t,z2,2);
+	x64_mul(z9,t,z);
+	x64_mul(z11,z9,z2);
+	x64_sq(t,z11);
+	x64_mul(z2_5_0,t,z9);
+	x64_sqn(t,z2_5_0,5);
+	x64_mul(z2_10_0,t,z2_5_0);
+	x64_sqn(t,z2_10_0,10);
+	x64_mul(z2_20_0,t,z2_10_0);
+	x64_sqn(t,z2_20_0,20);
+	x64_mul(t,t,z2_20_0);
+	x64_sqn(t,t,10);
+	x64_mul(z2_50_0,t,z2_10_0);
+	x64_sqn(t,z2_50_0,50);
+	x64_mul(z2_100_0,t,z2_50_0);
+	x64_sqn(t,z2_100_0,100);
+	x64_mul(t,t,z2_100_0);
+	x64_sqn(t,t,50);
+	x64_mul(t,t,z2_50_0);
+	x64_sqn(t,t,5);
+	x64_mul(r,t,z11);
+}
+
+static void x64_scalarmult(unsigned char *q,const unsigned char *n,const unsigned char *p)
+{
+	unsigned char e[32];
+	for(int i=0;i<32;++i)
+		e[i] = n[i];
+	e[0] &= 248;
+	e[31] &= 127;
+	e[31] |= 64;
+
+	x64_fe x1,x2,z2,x3,z3,a,aa,b,bb,c,d,da,cb,t;
+	x64_unpack(x1,p);
+	x64_carry(x1);
+	for(int i=0;i<5;++i) {
+		x2[i] = 0;
+		z2[i] = 0;
+		x3[i] = x1[i];
+		z3[i] = 0;
+	}
+	x2[0] = 1;
+	z3[0] = 1;
+
+	// Montgomery ladder (RFC 7748 section 5)
+	uint64_t swap = 0;
+	for(int pos=254;pos>=0;--pos) {
+		const uint64_t bit = (e[pos >> 3] >> (pos & 7)) & 1;
+		swap ^= bit;
+		x64_cswap(x2,x3,swap);
+		x64_cswap(z2,z3,swap);
+		swap = bit;
+
+		x64_add(a,x2,z2);
+		x64_sq(aa,a);
+		x64_sub(b,x2,z2);
+		x64_sq(bb,b);
+		x64_add(c,x3,z3);
+		x64_sub(d,x3,z3);
+		x64_mul(da,d,a);
+		x64_mul(cb,c,b);
+		x64_add(t,da,cb);
+		x64_sq(x3,t);
+		x64_sub(t,da,cb);
+		x64_sq(t,t);
+		x64_mul(z3,x1,t);
+		x64_mul(x2,aa,bb);
+		x64_sub(t,aa,bb); // E
+		x64_mul_small(c,t,121665);
+		x64_add(c,c,aa);
+		x64_mul(z2,t,c);
+	}
+	x64_cswap(x2,x3,swap);
+	x64_cswap(z2,z3,swap);
+
+	x64_invert(z2,z2);
+	x64_mul(x2,x2,z2);
+	x64_pack(q,x2);
+}
+
+#endif // __SIZEOF_INT128__
+
 } // anonymous namespace
 
 #ifdef ZT_USE_FAST_X64_ED25519
-extern "C" void ed25519_amd64_asm_sign(const unsigned char *sk,const unsigned char *pk,const unsigned char *m,const unsigned int mlen,unsigned char *sig);
+extern "C" {
+void ed25519_amd64_asm_sign(const unsigned char *sk,const unsigned char *pk,const unsigned char *m,const unsigned int mlen,unsigned char *sig);
+
+// Scalar and group arithmetic from ext/ed25519-amd64-asm (see its fe25519.h, sc25519.h and ge25519.h)
+typedef struct { unsigned long long v[4]; } zt_amd64_fe25519;
+typedef struct { unsigned long long v[4]; } zt_amd64_sc25519;
+typedef struct { zt_amd64_fe25519 x,y,z,t; } zt_amd64_ge25519;
+void crypto_sign_ed25519_amd64_64_sc25519_from32bytes(zt_amd64_sc25519 *r,const unsigned char x[32]);
+void crypto_sign_ed25519_amd64_64_sc25519_from64bytes(zt_amd64_sc25519 *r,const unsigned char x[64]);
+int crypto_sign_ed25519_amd64_64_unpackneg_vartime(zt_amd64_ge25519 *r,const unsigned char p[32]);
+void crypto_sign_ed25519_amd64_64_pack(unsigned char r[32],const zt_amd64_ge25519 *p);
+void crypto_sign_ed25519_amd64_64_double_scalarmult_vartime(zt_amd64_ge25519 *r,const zt_amd64_ge25519 *p1,const zt_amd64_sc25519 *s1,const zt_amd64_sc25519 *s2);
+void crypto_sign_ed25519_amd64_64_scalarmult_base(zt_amd64_ge25519 *r,const zt_amd64_sc25519 *s);
+}
 #endif
 
 namespace ZeroTier {
 
+static C25519::Backend _c25519BestBackend()
+{
+	for(int b=(int)C25519::BACKEND_AMD64;b>(int)C25519::BACKEND_REF;--b) {
+		if (C25519::backendSupported((C25519::Backend)b))
+			return (C25519::Backend)b;
+	}
+	return C25519::BACKEND_REF;
+}
+
+C25519::Backend C25519::_backend = _c25519BestBackend();
+
+static inline void _c25519ScalarMult(const C25519::Backend b,unsigned char *q,const unsigned char *n,const unsigned char *p)
+{
+#ifdef ZT_C25519_64BIT_LIMBS
+	// Faster than a ladder over the assembly field arithmetic, which pays a call per operation
+	if (b != C25519::BACKEND_REF) {
+		x64_scalarmult(q,n,p);
+		return;
+	}
+#endif
+	crypto_scalarmult(q,n,p);
+}
+
+bool C25519::backendSupported(const Backend b)
+{
+	switch(b) {
+		case BACKEND_REF:
+			return true;
+#ifdef ZT_C25519_64BIT_LIMBS
+		case BACKEND_64:
+			return true;
+#endif
+#ifdef ZT_USE_FAST_X64_ED25519
+		case BACKEND_AMD64:
+			return true; // baseline x86-64 instructions only
+#endif
+		default:
+			return false;
+	}
+}
+
+bool C25519::setBackend(const Backend b)
+{
+	if (!backendSupported(b))
+		return false;
+	_backend = b;
+	return true;
+}
+
+const char *C25519::backendName(const Backend b)
+{
+	switch(b) {
+		case BACKEND_REF: return "ref";
+		case BACKEND_64: return "64bit-limbs";
+		case BACKEND_AMD64: return "amd64-asm";
+	}
+	return "unknown";
+}
+
 void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void *keybuf,unsigned int keylen)
 {
 	unsigned char rawkey[32];
 	unsigned char digest[64];
 
-	crypto_scalarmult(rawkey,mine.data,their.data);
+	_c25519ScalarMult(_backend,rawkey,mine.data,their.data);
 	SHA512::hash(digest,rawkey,32);
 	for(unsigned int i=0,k=0;i<keylen;) {
 		if (k == 64) {
@@ -2020,8 +2468,12 @@ void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void
 void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPublic,const void *msg,unsigned int len,void *signature)
 {
 #ifdef ZT_USE_FAST_X64_ED25519
-	ed25519_amd64_asm_sign(myPrivate.data + 32,myPublic.data + 32,(const unsigned char *)msg,len,(unsigned char *)signature);
-#else
+	if (_backend == BACKEND_AMD64) {
+		ed25519_amd64_asm_sign(myPrivate.data + 32,myPublic.data + 32,(const unsigned char *)msg,len,(unsigned char *)signature);
+		return;
+	}
+#endif
+
 	sc25519 sck, scs, scsk;
 	ge25519 ger;
 	unsigned char r[32];
@@ -2066,7 +2518,6 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 	sc25519_to32bytes(s,&scs); /* cat s */
 	for(unsigned int i=0;i<32;i++)
 		sig[32 + i] = s[i];
-#endif
 }
 
 bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len,const void *signature)
@@ -2084,6 +2535,21 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
 	if (!Utils::secureEq(sig + 64,digest,32))
 		return false;
 
+#ifdef ZT_USE_FAST_X64_ED25519
+	if (_backend == BACKEND_AMD64) {
+		zt_amd64_ge25519 a,r;
+		zt_amd64_sc25519 h,s;
+		if (crypto_sign_ed25519_amd64_64_unpackneg_vartime(&a,their.data + 32))
+			return false;
+		get_hram(hram,sig,their.data + 32,m,96);
+		crypto_sign_ed25519_amd64_64_sc25519_from64bytes(&h,hram);
+		crypto_sign_ed25519_amd64_64_sc25519_from32bytes(&s,sig + 32);
+		crypto_sign_ed25519_amd64_64_double_scalarmult_vartime(&r,&a,&h,&s);
+		crypto_sign_ed25519_amd64_64_pack(t2,&r);
+		return Utils::secureEq(sig,t2,32);
+	}
+#endif
+
 	if (ge25519_unpackneg_vartime(&get1,their.data + 32))
 		return false;
 
@@ -2099,11 +2565,33 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
 	return Utils::secureEq(sig,t2,32);
 }
 
+bool C25519::verifyBatch(const C25519::Public *their,const void *const *msg,const unsigned int *len,const C25519::Signature *signature,unsigned int count,bool *valid)
+{
+	bool all = true;
+	for(unsigned int i=0;i<count;i+=ZT_C25519_BATCH_CHUNK) {
+		const unsigned int n = std::min(count - i,(unsigned int)ZT_C25519_BATCH_CHUNK);
+		if ((n > 1)&&(ed25519_verify_batch_chunk(their + i,msg + i,len + i,signature + i,n))) {
+			if (valid) {
+				for(unsigned int j=0;j<n;++j)
+					valid[i + j] = true;
+			}
+		} else {
+			for(unsigned int j=0;j<n;++j) {
+				const bool v = verify(their[i + j],msg[i + j],len[i + j],signature[i + j].data);
+				if (valid)
+					valid[i + j] = v;
+				all &= v;
+			}
+		}
+	}
+	return all;
+}
+
 void C25519::_calcPubDH(C25519::Pair &kp)
 {
 	// First 32 bytes of pub and priv are the keys for ECDH key
 	// agreement. This generates the public portion from the private.
-	crypto_scalarmult_base(kp.pub.data,kp.priv.data);
+	_c25519ScalarMult(_backend,kp.pub.data,kp.priv.data,base);
 }
 
 void C25519::_calcPubED(C25519::Pair &kp)
@@ -2118,6 +2606,16 @@ void C25519::_calcPubED(C25519::Pair &kp)
 	extsk[0] &= 248;
 	extsk[31] &= 127;
 	extsk[31] |= 64;
+#ifdef ZT_USE_FAST_X64_ED25519
+	if (_backend == BACKEND_AMD64) {
+		zt_amd64_sc25519 s;
+		zt_amd64_ge25519 a;
+		crypto_sign_ed25519_amd64_64_sc25519_from32bytes(&s,extsk);
+		crypto_sign_ed25519_amd64_64_scalarmult_base(&a,&s);
+		crypto_sign_ed25519_amd64_64_pack(kp.pub.data + 32,&a);
+		return;
+	}
+#endif
 	sc25519_from32bytes(&scsk,extsk);
 	ge25519_scalarmult_base(&gepk,&scsk);
 	ge25519_pack(kp.pub.data + 32,&gepk);
@@ -46,6 +46,52 @@ public:
 	struct Signature { uint8_t data[ZT_C25519_SIGNATURE_LEN]; };
 	struct Pair { Public pub; Private priv; };
 
+	/**
+	 * Curve25519 and Ed25519 arithmetic backends, in increasing order of preference
+	 *
+	 * The best backend this build and CPU support is selected at startup.
+	 * All backends produce identical keys, agreements and signatures.
+	 */
+	enum Backend
+	{
+		BACKEND_REF = 0,   // portable 8 and 32-bit limb reference code
+		BACKEND_64 = 1,    // 51-bit limbs with 128-bit products for X25519, reference Ed25519
+		BACKEND_AMD64 = 2  // 51-bit limb X25519, x86-64 assembly Ed25519
+	};
+
+	/**
+	 * @param b Backend
+	 * @return True if this build and CPU can run this backend
+	 */
+	static bool backendSupported(const Backend b);
+
+	/**
+	 * Override the backend used for agreement, signing and verification
+	 *
+	 * This is intended for testing and benchmarking and is not thread safe
+	 * with respect to concurrent use.
+	 *
+	 * @param b Backend to use
+	 * @return False if backend is not supported (selection is unchanged)
+	 */
+	static bool setBackend(const Backend b);
+
+	/**
+	 * @return Backend currently in use
+	 */
+	static inline Backend backend() { return _backend; }
+
+	/**
+	 * @return True if verifyBatch() is cheaper than verify() on each signature with the current backend
+	 */
+	static inline bool batchVerifySupported() { return (_backend != BACKEND_AMD64); }
+
+	/**
+	 * @param b Backend
+	 * @return Short human-readable name of backend
+	 */
+	static const char *backendName(const Backend b);
+
 	/**
 	 * Generate a C25519 elliptic curve key pair
 	 */
@@ -169,7 +215,31 @@ public:
 		return verify(their,msg,len,signature.data);
 	}
 
+	/**
+	 * Verify a batch of message signatures at once
+	 *
+	 * Signatures are checked together with one randomized multi-scalar
+	 * multiplication, which costs a fraction of verifying each in turn. If
+	 * the combined check fails each signature is verified individually so
+	 * that valid[] says exactly which ones are bad.
+	 *
+	 * The multi-scalar multiplication only exists in reference C, so on the
+	 * amd64-asm backend this is slower than calling verify() on each. Check
+	 * batchVerifySupported() first.
+	 *
+	 * @param their Public keys to verify against
+	 * @param msg Messages to verify signature integrity against
+	 * @param len Lengths of messages in bytes
+	 * @param signature 96-byte signatures
+	 * @param count Number of signatures
+	 * @param valid If non-NULL, filled with the result for each signature
+	 * @return True if all signatures are valid
+	 */
+	static bool verifyBatch(const Public *their,const void *const *msg,const unsigned int *len,const Signature *signature,unsigned int count,bool *valid);
+
 private:
+	static Backend _backend;
+
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
 	static void _calcPubDH(Pair &kp);
@@ -74,7 +74,7 @@ public:
 
 	Capability()
 	{
-		memset(this,0,sizeof(Capability));
+		memset((void *)this,0,sizeof(Capability));
 	}
 
 	/**
@@ -87,7 +87,7 @@ public:
 	 */
 	Capability(uint32_t id,uint64_t nwid,int64_t ts,unsigned int mccl,const ZT_VirtualNetworkRule *rules,unsigned int ruleCount)
 	{
-		memset(this,0,sizeof(Capability));
+		memset((void *)this,0,sizeof(Capability));
 		_nwid = nwid;
 		_ts = ts;
 		_id = id;
@@ -423,7 +423,7 @@ public:
 	template<unsigned int C>
 	inline unsigned int deserialize(const Buffer<C> &b,unsigned int startAt = 0)
 	{
-		memset(this,0,sizeof(Capability));
+		memset((void *)this,0,sizeof(Capability));
 
 		unsigned int p = startAt;
 
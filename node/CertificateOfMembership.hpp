@@ -114,12 +114,12 @@ public:
 	 */
 	CertificateOfMembership()
 	{
-		memset(this,0,sizeof(CertificateOfMembership));
+		memset((void *)this,0,sizeof(CertificateOfMembership));
 	}
 
 	CertificateOfMembership(const CertificateOfMembership &c)
 	{
-		ZT_FAST_MEMCPY(this,&c,sizeof(CertificateOfMembership));
+		ZT_FAST_MEMCPY((void *)this,(const void *)&c,sizeof(CertificateOfMembership));
 	}
 
 	/**
@@ -147,7 +147,7 @@ public:
 
 	inline CertificateOfMembership &operator=(const CertificateOfMembership &c)
 	{
-		ZT_FAST_MEMCPY(this,&c,sizeof(CertificateOfMembership));
+		ZT_FAST_MEMCPY((void *)this,(const void *)&c,sizeof(CertificateOfMembership));
 		return *this;
 	}
 
@@ -267,9 +267,10 @@ public:
 	 *
 	 * @param RR Runtime environment for looking up peers
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param signatureVerified If true the signature itself already passed a batch check
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or credential
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,const bool signatureVerified = false) const;
 
 	/**
 	 * @return True if signed
@@ -281,6 +282,26 @@ public:
 	 */
 	inline const Address &signedBy() const { return _signedBy; }
 
+	/**
+	 * @return Signature (only meaningful if signed)
+	 */
+	inline const C25519::Signature &signature() const { return _signature; }
+
+	/**
+	 * Append the qualifiers covered by this certificate's signature
+	 *
+	 * @param b Buffer to append to
+	 */
+	template<unsigned int C>
+	inline void serializeForSign(Buffer<C> &b) const
+	{
+		for(unsigned int i=0;i<_qualifierCount;++i) {
+			b.append(_qualifiers[i].id);
+			b.append(_qualifiers[i].value);
+			b.append(_qualifiers[i].maxDelta);
+		}
+	}
+
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b) const
 	{
@@ -69,7 +69,7 @@ public:
 
 	CertificateOfOwnership()
 	{
-		memset(this,0,sizeof(CertificateOfOwnership));
+		memset((void *)this,0,sizeof(CertificateOfOwnership));
 	}
 
 	CertificateOfOwnership(const uint64_t nwid,const int64_t ts,const Address &issuedTo,const uint32_t id) :
@@ -82,6 +82,7 @@ public:
 	{
 		memset(_thingTypes,0,sizeof(_thingTypes));
 		memset(_thingValues,0,sizeof(_thingValues));
+		memset(_signature.data,0,sizeof(_signature.data));
 	}
 
 	inline uint64_t networkId() const { return _networkId; }
@@ -93,6 +94,8 @@ public:
 	inline const uint8_t *thingValue(const unsigned int i) const { return _thingValues[i]; }
 
 	inline const Address &issuedTo() const { return _issuedTo; }
+	inline const Address &signedBy() const { return _signedBy; }
+	inline const C25519::Signature &signature() const { return _signature; }
 
 	inline bool owns(const InetAddress &ip) const
 	{
@@ -151,9 +154,10 @@ public:
 	/**
 	 * @param RR Runtime environment to allow identity lookup for signedBy
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param signatureVerified If true the signature itself already passed a batch check
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,const bool signatureVerified = false) const;
 
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
@@ -188,7 +192,7 @@ public:
 	{
 		unsigned int p = startAt;
 
-		memset(this,0,sizeof(CertificateOfOwnership));
+		memset((void *)this,0,sizeof(CertificateOfOwnership));
 
 		_networkId = b.template at<uint64_t>(p); p += 8;
 		_ts = b.template at<uint64_t>(p); p += 8;
@@ -0,0 +1,844 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "../version.h"
+
+#include "Cluster.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "MulticastGroup.hpp"
+#include "Salsa20.hpp"
+#include "Poly1305.hpp"
+#include "Identity.hpp"
+#include "Topology.hpp"
+#include "Packet.hpp"
+#include "Switch.hpp"
+#include "Node.hpp"
+#include "Peer.hpp"
+#include "Path.hpp"
+#include "Multicaster.hpp"
+
+namespace ZeroTier {
+
+static inline double _dist3d(int x1,int y1,int z1,int x2,int y2,int z2)
+{
+	double dx = ((double)x2 - (double)x1);
+	double dy = ((double)y2 - (double)y1);
+	double dz = ((double)z2 - (double)z1);
+	return sqrt((dx * dx) + (dy * dy) + (dz * dz));
+}
+
+// Appends the body of a VERB_RENDEZVOUS telling its recipient to contact 'with' at 'at'
+template<unsigned int C>
+static inline void _appendRendezvous(Buffer<C> &b,const Address &with,const InetAddress &at)
+{
+	b.append((uint8_t)0);
+	with.appendTo(b);
+	b.append((uint16_t)at.port());
+	if (at.ss_family == AF_INET6) {
+		b.append((uint8_t)16);
+		b.append(at.rawIpData(),16);
+	} else {
+		b.append((uint8_t)4);
+		b.append(at.rawIpData(),4);
+	}
+}
+
+// Derives the key for messages to a member from the master secret and its ID
+static inline void _memberKey(const uint16_t *masterSecret,uint16_t memberId,unsigned char *key)
+{
+	uint16_t stmp[ZT_SHA512_DIGEST_LEN / sizeof(uint16_t)];
+	memcpy(stmp,masterSecret,sizeof(stmp));
+	stmp[0] ^= Utils::hton(memberId);
+	SHA512::hash(stmp,stmp,sizeof(stmp));
+	SHA512::hash(stmp,stmp,sizeof(stmp));
+	memcpy(key,stmp,ZT_PEER_SECRET_KEY_LENGTH);
+	Utils::burn(stmp,sizeof(stmp));
+}
+
+// Starts a new message to a member: <[16] iv><[8] MAC><[2] from><[2] to>
+static inline void _resetQueue(Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> &q,uint16_t fromMemberId,uint16_t toMemberId)
+{
+	q.clear();
+	char iv[16];
+	Utils::getSecureRandom(iv,16);
+	q.append(iv,16);
+	q.addSize(8); // room for MAC
+	q.append((uint16_t)fromMemberId);
+	q.append((uint16_t)toMemberId);
+}
+
+Cluster::Cluster(
+	const RuntimeEnvironment *renv,
+	uint16_t id,
+	const std::vector<InetAddress> &zeroTierPhysicalEndpoints,
+	int32_t x,
+	int32_t y,
+	int32_t z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg) :
+	RR(renv),
+	_sendFunction(sendFunction),
+	_sendFunctionArg(sendFunctionArg),
+	_addressToLocationFunction(addressToLocationFunction),
+	_addressToLocationFunctionArg(addressToLocationFunctionArg),
+	_x(x),
+	_y(y),
+	_z(z),
+	_id(id),
+	_zeroTierPhysicalEndpoints(zeroTierPhysicalEndpoints),
+	_members(new _Member[ZT_CLUSTER_MAX_MEMBERS]),
+	_localPeers(0),
+	_redirected(0),
+	_lastFlushed(0),
+	_lastCountedPeers(0),
+	_members_m("Cluster::_members_m"),
+	_queued(0),
+	_relayed(0),
+	_relayDropped(0),
+	_lastCleanedRemotePeers(0),
+	_remotePeers_m("Cluster::_remotePeers_m")
+{
+	// Generate master secret by hashing the secret from our Identity key pair
+	RR->identity.sha512PrivateKey(_masterSecret);
+
+	// Our inbound message key is the master secret XORed with our ID and hashed twice
+	_memberKey(_masterSecret,id,_key);
+}
+
+Cluster::~Cluster()
+{
+	Utils::burn(_masterSecret,sizeof(_masterSecret));
+	Utils::burn(_key,sizeof(_key));
+	delete [] _members;
+}
+
+void Cluster::handleIncomingStateMessage(void *tPtr,const void *msg,unsigned int len)
+{
+	Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> dmsg;
+	{
+		// FORMAT: <[16] iv><[8] MAC><... data>
+		if ((len < 24)||(len > ZT_CLUSTER_MAX_MESSAGE_LENGTH))
+			return;
+
+		// 16-byte IV: first 8 bytes XORed with key, last 8 bytes used as Salsa20 64-bit IV
+		char keytmp[32];
+		memcpy(keytmp,_key,32);
+		for(int i=0;i<8;++i)
+			keytmp[i] ^= reinterpret_cast<const char *>(msg)[i];
+		Salsa20 s20(keytmp,reinterpret_cast<const char *>(msg) + 8);
+		Utils::burn(keytmp,sizeof(keytmp));
+
+		// One-time-use Poly1305 key from first 32 bytes of Salsa20 keystream (as per DJB/NaCl "standard")
+		char polykey[ZT_POLY1305_KEY_LEN];
+		memset(polykey,0,sizeof(polykey));
+		s20.crypt12(polykey,polykey,sizeof(polykey));
+
+		// Compute 16-byte MAC
+		char mac[ZT_POLY1305_MAC_LEN];
+		Poly1305::compute(mac,reinterpret_cast<const char *>(msg) + 24,len - 24,polykey);
+
+		// Check first 8 bytes of MAC against 64-bit MAC in stream
+		if (!Utils::secureEq(mac,reinterpret_cast<const char *>(msg) + 16,8))
+			return;
+
+		// Decrypt!
+		dmsg.setSize(len - 24);
+		s20.crypt12(reinterpret_cast<const char *>(msg) + 24,const_cast<void *>(dmsg.data()),dmsg.size());
+	}
+
+	if (dmsg.size() < 4)
+		return;
+	const uint16_t fromMemberId = dmsg.at<uint16_t>(0);
+	unsigned int ptr = 2;
+	if ((fromMemberId == _id)||(fromMemberId >= ZT_CLUSTER_MAX_MEMBERS)) // sanity check: we don't talk to ourselves
+		return;
+	const uint16_t toMemberId = dmsg.at<uint16_t>(ptr);
+	ptr += 2;
+	if (toMemberId != _id) // sanity check: message not for us?
+		return;
+
+	{	// make sure sender is actually considered a member
+		Mutex::Lock _l(_members_m);
+		if (std::find(_memberIds.begin(),_memberIds.end(),fromMemberId) == _memberIds.end())
+			return;
+	}
+
+	const int64_t now = RR->node->now();
+
+	try {
+		while (ptr < dmsg.size()) {
+			const unsigned int mlen = dmsg.at<uint16_t>(ptr); ptr += 2;
+			const unsigned int nextPtr = ptr + mlen;
+			if (nextPtr > dmsg.size())
+				break;
+
+			try {
+				switch((StateMessageType)dmsg[ptr++]) {
+					default:
+						break;
+
+					case CLUSTER_MESSAGE_ALIVE: {
+						ptr += 7; // skip version stuff, not used yet
+						const int32_t x = dmsg.at<int32_t>(ptr); ptr += 4;
+						const int32_t y = dmsg.at<int32_t>(ptr); ptr += 4;
+						const int32_t z = dmsg.at<int32_t>(ptr); ptr += 4;
+						ptr += 8; // skip local clock, not used
+						const uint64_t peers = dmsg.at<uint64_t>(ptr); ptr += 8;
+						const uint64_t redirected = dmsg.at<uint64_t>(ptr); ptr += 8;
+						ptr += 8; // skip flags, unused
+						std::vector<InetAddress> endpoints;
+						const unsigned int physicalAddressCount = dmsg[ptr++];
+						for(unsigned int i=0;i<physicalAddressCount;++i) {
+							InetAddress ep;
+							ptr += ep.deserialize(dmsg,ptr);
+							if ((ep)&&(endpoints.size() < ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES))
+								endpoints.push_back(ep);
+						}
+
+						Mutex::Lock _l(_members_m);
+						_Member &m = _members[fromMemberId];
+						m.x = x;
+						m.y = y;
+						m.z = z;
+						m.peers = peers;
+						m.redirected = redirected;
+						m.zeroTierPhysicalEndpoints.swap(endpoints);
+						m.lastReceivedAliveAnnouncement = now;
+					}	break;
+
+					case CLUSTER_MESSAGE_HAVE_PEER: {
+						const Address zeroTierAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+						std::vector<_QueuedRelay> q;
+						{
+							Mutex::Lock _l(_remotePeers_m);
+							_RemotePeer &rp = _remotePeers[zeroTierAddress];
+							rp.lastHavePeerReceived = now;
+							rp.memberId = fromMemberId;
+							std::vector<_QueuedRelay> *const qp = _queue.get(zeroTierAddress);
+							if (qp) {
+								q.swap(*qp);
+								_queue.erase(zeroTierAddress);
+								_queued -= (unsigned long)q.size();
+							}
+						}
+						for(std::vector<_QueuedRelay>::const_iterator qr(q.begin());qr!=q.end();++qr)
+							_forward(tPtr,fromMemberId,qr->localSocket,qr->fromAddr,qr->fromPeerAddress,zeroTierAddress,qr->data.data(),(unsigned int)qr->data.length(),qr->unite,now);
+					}	break;
+
+					case CLUSTER_MESSAGE_WANT_PEER: {
+						const Address zeroTierAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+						const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(zeroTierAddress));
+						if ((peer)&&(peer->getBestPath(now,false))) {
+							char tmp[ZT_ADDRESS_LENGTH];
+							zeroTierAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
+							Mutex::Lock _l(_members_m);
+							_send(fromMemberId,CLUSTER_MESSAGE_HAVE_PEER,tmp,ZT_ADDRESS_LENGTH);
+							_flush(fromMemberId);
+						}
+					}	break;
+
+					case CLUSTER_MESSAGE_REMOTE_PACKET: {
+						const unsigned int plen = dmsg.at<uint16_t>(ptr); ptr += 2;
+						if (plen >= ZT_PROTO_MIN_PACKET_LENGTH) {
+							Packet remotep(dmsg.field(ptr,plen),plen); ptr += plen;
+							switch(remotep.verb()) {
+								case Packet::VERB_WHOIS:            _doREMOTE_WHOIS(tPtr,fromMemberId,remotep); break;
+								case Packet::VERB_MULTICAST_GATHER: _doREMOTE_MULTICAST_GATHER(tPtr,fromMemberId,remotep); break;
+								default: break; // ignore things we don't care about across cluster
+							}
+						}
+					}	break;
+
+					case CLUSTER_MESSAGE_PROXY_UNITE:
+						_doPROXY_UNITE(tPtr,fromMemberId,dmsg,ptr);
+						break;
+
+					case CLUSTER_MESSAGE_PROXY_SEND: {
+						const Address rcpt(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+						const Packet::Verb verb = (Packet::Verb)dmsg[ptr++];
+						const unsigned int plen = dmsg.at<uint16_t>(ptr); ptr += 2;
+						Packet outp(rcpt,RR->identity.address(),verb);
+						outp.append(dmsg.field(ptr,plen),plen); ptr += plen;
+						RR->sw->send(tPtr,outp,true);
+					}	break;
+				}
+			} catch ( ... ) {} // drop invalids
+
+			ptr = nextPtr;
+		}
+	} catch ( ... ) {} // drop invalids
+}
+
+void Cluster::peerHello(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const int64_t now)
+{
+	if (RR->topology->isUpstream(peer->identity()))
+		return;
+	if (_redirect(tPtr,peer,path,now))
+		return;
+	if (peer->rateGateClusterAnnounce(now)) {
+		char tmp[ZT_ADDRESS_LENGTH];
+		peer->address().copyTo(tmp,ZT_ADDRESS_LENGTH);
+		Mutex::Lock _l(_members_m);
+		_broadcast(CLUSTER_MESSAGE_HAVE_PEER,tmp,ZT_ADDRESS_LENGTH,false);
+	}
+}
+
+bool Cluster::relay(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite,const int64_t now)
+{
+	if ((len > ZT_PROTO_MAX_PACKET_LENGTH)||(isClusterPeerFrontplane(fromAddr)))
+		return false;
+
+	int memberId = -1;
+	bool sendWantPeer = false;
+	{
+		Mutex::Lock _l(_remotePeers_m);
+		_RemotePeer &rp = _remotePeers[toPeerAddress];
+		const int64_t age = now - rp.lastHavePeerReceived;
+		if ((rp.lastHavePeerReceived)&&(age < ZT_PEER_ACTIVITY_TIMEOUT))
+			memberId = (int)rp.memberId;
+
+		// Poll everyone with WANT_PEER if the age of our most recent entry is
+		// approaching expiration (or has expired, or does not exist).
+		if (((!rp.lastHavePeerReceived)||(age >= (ZT_PEER_ACTIVITY_TIMEOUT / 3)))&&((now - rp.lastSentWantPeer) >= ZT_CLUSTER_WANT_PEER_EVERY)) {
+			rp.lastSentWantPeer = now;
+			sendWantPeer = true;
+		}
+
+		// If there isn't a good place to send via, queue this until someone answers
+		if (memberId < 0) {
+			if (_queued >= ZT_CLUSTER_MAX_QUEUE_GLOBAL) {
+				++_relayDropped;
+			} else {
+				std::vector<_QueuedRelay> &q = _queue[toPeerAddress];
+				if (q.size() >= ZT_CLUSTER_MAX_QUEUE_PER_DESTINATION) {
+					q.erase(q.begin());
+					++_relayDropped;
+				} else {
+					++_queued;
+				}
+				q.push_back(_QueuedRelay());
+				_QueuedRelay &qr = q.back();
+				qr.timestamp = now;
+				qr.localSocket = localSocket;
+				qr.fromAddr = fromAddr;
+				qr.fromPeerAddress = fromPeerAddress;
+				qr.unite = unite;
+				qr.data.assign(reinterpret_cast<const char *>(data),len);
+			}
+		}
+	}
+
+	if (sendWantPeer) {
+		char tmp[ZT_ADDRESS_LENGTH];
+		toPeerAddress.copyTo(tmp,ZT_ADDRESS_LENGTH);
+		Mutex::Lock _l(_members_m);
+		_broadcast(CLUSTER_MESSAGE_WANT_PEER,tmp,ZT_ADDRESS_LENGTH,true);
+	}
+
+	if (memberId < 0)
+		return true; // queued
+	return _forward(tPtr,(uint16_t)memberId,localSocket,fromAddr,fromPeerAddress,toPeerAddress,data,len,unite,now);
+}
+
+void Cluster::sendDistributedQuery(const Packet &pkt)
+{
+	if ((pkt.size() + 2) > (ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2 + 3))) // sanity check
+		return;
+	Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> buf;
+	buf.append((uint16_t)pkt.size());
+	buf.append(pkt.data(),pkt.size());
+	Mutex::Lock _l(_members_m);
+	_broadcast(CLUSTER_MESSAGE_REMOTE_PACKET,buf.data(),buf.size(),true);
+}
+
+void Cluster::doPeriodicTasks(void *tPtr,const int64_t now)
+{
+	if ((now - _lastCountedPeers) >= ZT_CLUSTER_PEER_COUNT_PERIOD) {
+		_lastCountedPeers = now;
+		const uint64_t n = (uint64_t)RR->topology->countActive(now);
+		Mutex::Lock _l(_members_m);
+		_localPeers = n;
+	}
+
+	if ((now - _lastFlushed) >= ZT_CLUSTER_FLUSH_PERIOD) {
+		_lastFlushed = now;
+
+		Mutex::Lock _l(_members_m);
+		for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+			_Member &m = _members[*mid];
+			if ((now - m.lastAnnouncedAliveTo) >= ZT_CLUSTER_ALIVE_PERIOD) {
+				m.lastAnnouncedAliveTo = now;
+
+				Buffer<2048> alive;
+				alive.append((uint16_t)ZEROTIER_ONE_VERSION_MAJOR);
+				alive.append((uint16_t)ZEROTIER_ONE_VERSION_MINOR);
+				alive.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+				alive.append((uint8_t)ZT_PROTO_VERSION);
+				if (_addressToLocationFunction) {
+					alive.append((int32_t)_x);
+					alive.append((int32_t)_y);
+					alive.append((int32_t)_z);
+				} else {
+					alive.append((int32_t)0);
+					alive.append((int32_t)0);
+					alive.append((int32_t)0);
+				}
+				alive.append((uint64_t)now);
+				alive.append((uint64_t)_localPeers);
+				alive.append((uint64_t)_redirected);
+				alive.append((uint64_t)0); // unused/reserved flags
+				alive.append((uint8_t)_zeroTierPhysicalEndpoints.size());
+				for(std::vector<InetAddress>::const_iterator pe(_zeroTierPhysicalEndpoints.begin());pe!=_zeroTierPhysicalEndpoints.end();++pe)
+					pe->serialize(alive);
+				_send(*mid,CLUSTER_MESSAGE_ALIVE,alive.data(),alive.size());
+			}
+
+			_flush(*mid);
+		}
+	}
+
+	if ((now - _lastCleanedRemotePeers) >= ZT_CLUSTER_QUEUE_EXPIRATION) {
+		_lastCleanedRemotePeers = now;
+
+		Mutex::Lock _l(_remotePeers_m);
+
+		{
+			Hashtable< Address,_RemotePeer >::Iterator i(_remotePeers);
+			Address *a = (Address *)0;
+			_RemotePeer *rp = (_RemotePeer *)0;
+			while (i.next(a,rp)) {
+				if ( ((now - rp->lastHavePeerReceived) >= ZT_PEER_ACTIVITY_TIMEOUT) && ((now - rp->lastSentWantPeer) >= ZT_CLUSTER_QUEUE_EXPIRATION) )
+					_remotePeers.erase(*a);
+			}
+		}
+
+		{
+			Hashtable< Address,std::vector<_QueuedRelay> >::Iterator i(_queue);
+			Address *a = (Address *)0;
+			std::vector<_QueuedRelay> *q = (std::vector<_QueuedRelay> *)0;
+			while (i.next(a,q)) {
+				std::vector<_QueuedRelay>::iterator qr(q->begin());
+				while ((qr != q->end())&&((now - qr->timestamp) >= ZT_CLUSTER_QUEUE_EXPIRATION))
+					++qr;
+				const unsigned long expired = (unsigned long)(qr - q->begin());
+				if (expired) {
+					_queued -= expired;
+					_relayDropped += expired;
+					if (qr == q->end())
+						_queue.erase(*a);
+					else q->erase(q->begin(),qr);
+				}
+			}
+		}
+	}
+}
+
+bool Cluster::addMember(uint16_t memberId)
+{
+	if ((memberId >= ZT_CLUSTER_MAX_MEMBERS)||(memberId == _id))
+		return false;
+
+	Mutex::Lock _l(_members_m);
+
+	if (std::find(_memberIds.begin(),_memberIds.end(),memberId) != _memberIds.end())
+		return true;
+	_memberIds.push_back(memberId);
+	std::sort(_memberIds.begin(),_memberIds.end());
+
+	_Member &m = _members[memberId];
+	m.clear();
+	_memberKey(_masterSecret,memberId,m.key);
+	_resetQueue(m.q,_id,memberId);
+
+	return true;
+}
+
+void Cluster::removeMember(uint16_t memberId)
+{
+	Mutex::Lock _l(_members_m);
+	std::vector<uint16_t>::iterator mid(std::find(_memberIds.begin(),_memberIds.end(),memberId));
+	if (mid != _memberIds.end())
+		_memberIds.erase(mid);
+}
+
+bool Cluster::isClusterPeerFrontplane(const InetAddress &ip) const
+{
+	Mutex::Lock _l(_members_m);
+	return _isFrontplane(ip);
+}
+
+void Cluster::status(ZT_ClusterStatus &status) const
+{
+	const int64_t now = RR->node->now();
+	memset(&status,0,sizeof(ZT_ClusterStatus));
+
+	status.myId = _id;
+
+	{
+		Mutex::Lock _l(_remotePeers_m);
+		status.remotePeers = _remotePeers.size();
+		status.relayed = _relayed;
+		status.relayDropped = _relayDropped;
+	}
+
+	Mutex::Lock _l(_members_m);
+
+	{
+		ZT_ClusterMemberStatus *const s = &(status.members[status.clusterSize++]);
+		s->id = _id;
+		s->alive = 1;
+		s->x = _x;
+		s->y = _y;
+		s->z = _z;
+		s->peers = _localPeers;
+		s->redirected = _redirected;
+		for(std::vector<InetAddress>::const_iterator ep(_zeroTierPhysicalEndpoints.begin());ep!=_zeroTierPhysicalEndpoints.end();++ep) {
+			if (s->numZeroTierPhysicalEndpoints >= ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES) // sanity check
+				break;
+			memcpy(&(s->zeroTierPhysicalEndpoints[s->numZeroTierPhysicalEndpoints++]),&(*ep),sizeof(struct sockaddr_storage));
+		}
+	}
+
+	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+		if (status.clusterSize >= ZT_CLUSTER_MAX_MEMBERS) // sanity check
+			break;
+
+		const _Member &m = _members[*mid];
+		ZT_ClusterMemberStatus *const s = &(status.members[status.clusterSize++]);
+		s->id = *mid;
+		s->msSinceLastHeartbeat = (unsigned int)std::min((int64_t)(~((unsigned int)0)),(now - m.lastReceivedAliveAnnouncement));
+		s->alive = (s->msSinceLastHeartbeat < ZT_CLUSTER_TIMEOUT) ? 1 : 0;
+		s->x = m.x;
+		s->y = m.y;
+		s->z = m.z;
+		s->peers = m.peers;
+		s->redirected = m.redirected;
+		for(std::vector<InetAddress>::const_iterator ep(m.zeroTierPhysicalEndpoints.begin());ep!=m.zeroTierPhysicalEndpoints.end();++ep) {
+			if (s->numZeroTierPhysicalEndpoints >= ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES) // sanity check
+				break;
+			memcpy(&(s->zeroTierPhysicalEndpoints[s->numZeroTierPhysicalEndpoints++]),&(*ep),sizeof(struct sockaddr_storage));
+		}
+	}
+}
+
+void Cluster::_send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len)
+{
+	if ((len + 3) > (ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2))) // sanity check
+		return;
+	_Member &m = _members[memberId];
+	if ((m.q.size() + len + 3) > ZT_CLUSTER_MAX_MESSAGE_LENGTH)
+		_flush(memberId);
+	m.q.append((uint16_t)(len + 1));
+	m.q.append((uint8_t)type);
+	m.q.append(msg,len);
+}
+
+void Cluster::_flush(uint16_t memberId)
+{
+	_Member &m = _members[memberId];
+	if (m.q.size() > (24 + 2 + 2)) { // 16-byte IV + 8-byte MAC + 2 byte from-member-ID + 2 byte to-member-ID
+		// Create key from member's key and IV
+		char keytmp[32];
+		memcpy(keytmp,m.key,32);
+		for(int i=0;i<8;++i)
+			keytmp[i] ^= m.q[i];
+		Salsa20 s20(keytmp,m.q.field(8,8));
+		Utils::burn(keytmp,sizeof(keytmp));
+
+		// One-time-use Poly1305 key from first 32 bytes of Salsa20 keystream (as per DJB/NaCl "standard")
+		char polykey[ZT_POLY1305_KEY_LEN];
+		memset(polykey,0,sizeof(polykey));
+		s20.crypt12(polykey,polykey,sizeof(polykey));
+
+		// Encrypt m.q in place
+		s20.crypt12(reinterpret_cast<const char *>(m.q.data()) + 24,const_cast<char *>(reinterpret_cast<const char *>(m.q.data())) + 24,m.q.size() - 24);
+
+		// Add MAC for authentication (encrypt-then-MAC)
+		char mac[ZT_POLY1305_MAC_LEN];
+		Poly1305::compute(mac,reinterpret_cast<const char *>(m.q.data()) + 24,m.q.size() - 24,polykey);
+		memcpy(m.q.field(16,8),mac,8);
+
+		// Send!
+		_sendFunction(_sendFunctionArg,memberId,m.q.data(),m.q.size());
+
+		// Prepare for more
+		_resetQueue(m.q,_id,memberId);
+	}
+}
+
+void Cluster::_broadcast(StateMessageType type,const void *msg,unsigned int len,bool flush)
+{
+	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+		_send(*mid,type,msg,len);
+		if (flush)
+			_flush(*mid);
+	}
+}
+
+bool Cluster::_isFrontplane(const InetAddress &ip) const
+{
+	for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+		const std::vector<InetAddress> &eps = _members[*mid].zeroTierPhysicalEndpoints;
+		for(std::vector<InetAddress>::const_iterator i2(eps.begin());i2!=eps.end();++i2) {
+			if (ip.ipsEqual(*i2))
+				return true;
+		}
+	}
+	return false;
+}
+
+bool Cluster::_forward(void *tPtr,uint16_t memberId,const int64_t localSocket,const InetAddress &fromAddr,const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite,const int64_t now)
+{
+	// Prefer an endpoint in the family the packet came in on so it can go out
+	// the same socket, otherwise let the service pick one.
+	InetAddress to;
+	int64_t sock = -1;
+	{
+		Mutex::Lock _l(_members_m);
+		const std::vector<InetAddress> &eps = _members[memberId].zeroTierPhysicalEndpoints;
+		for(std::vector<InetAddress>::const_iterator ep(eps.begin());ep!=eps.end();++ep) {
+			if (ep->ss_family == fromAddr.ss_family) {
+				to = *ep;
+				sock = localSocket;
+				break;
+			}
+		}
+		if ((!to)&&(!eps.empty()))
+			to = eps.front();
+
+		if ((to)&&(unite)&&(fromPeerAddress)) {
+			const SharedPtr<Peer> fromPeer(RR->topology->getPeerNoCache(fromPeerAddress));
+			const SharedPtr<Path> fp((fromPeer) ? fromPeer->getBestPath(now,false) : SharedPtr<Path>());
+			if (fp) {
+				Buffer<128> buf;
+				toPeerAddress.appendTo(buf);
+				fromPeerAddress.appendTo(buf);
+				buf.append((uint8_t)1);
+				fp->address().serialize(buf);
+				_send(memberId,CLUSTER_MESSAGE_PROXY_UNITE,buf.data(),buf.size());
+				_flush(memberId);
+			}
+		}
+	}
+
+	if ((to)&&(RR->node->putPacket(tPtr,sock,to,data,len))) {
+		Mutex::Lock _l(_remotePeers_m);
+		++_relayed;
+		return true;
+	}
+	return false;
+}
+
+bool Cluster::_redirect(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const int64_t now)
+{
+	const InetAddress &peerPhysicalAddress = path->address();
+	InetAddress redirectTo;
+	{
+		Mutex::Lock _l(_members_m);
+
+		int best = -1;
+		if (_addressToLocationFunction) {
+			// Pick the member closest to this peer if it can be located
+			int px = 0,py = 0,pz = 0;
+			if (_addressToLocationFunction(_addressToLocationFunctionArg,reinterpret_cast<const struct sockaddr_storage *>(&peerPhysicalAddress),&px,&py,&pz) == 0)
+				return false;
+			double bestDistance = _dist3d(_x,_y,_z,px,py,pz);
+			for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+				const _Member &m = _members[*mid];
+				if ( ((now - m.lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT) && ((m.x != 0)||(m.y != 0)||(m.z != 0)) ) {
+					const double mdist = _dist3d(m.x,m.y,m.z,px,py,pz);
+					if (mdist < bestDistance) {
+						bestDistance = mdist;
+						best = (int)*mid;
+					}
+				}
+			}
+		} else {
+			// Otherwise pick the least loaded member, but only if it's lighter than us by
+			// enough that peers don't bounce back and forth between members of equal load
+			const uint64_t margin = std::max((uint64_t)ZT_CLUSTER_REDIRECT_MIN_MARGIN,_localPeers / ZT_CLUSTER_REDIRECT_MARGIN_DIVISOR);
+			uint64_t bestPeers = _localPeers;
+			for(std::vector<uint16_t>::const_iterator mid(_memberIds.begin());mid!=_memberIds.end();++mid) {
+				const _Member &m = _members[*mid];
+				if ( ((now - m.lastReceivedAliveAnnouncement) < ZT_CLUSTER_TIMEOUT) && ((m.peers + margin) < bestPeers) ) {
+					bestPeers = m.peers + margin;
+					best = (int)*mid;
+				}
+			}
+		}
+		if (best < 0)
+			return false;
+
+		// Redirect only if that member has a ZeroTier endpoint in the same family
+		_Member &m = _members[best];
+		for(std::vector<InetAddress>::const_iterator a(m.zeroTierPhysicalEndpoints.begin());a!=m.zeroTierPhysicalEndpoints.end();++a) {
+			if (a->ss_family == peerPhysicalAddress.ss_family) {
+				redirectTo = *a;
+				break;
+			}
+		}
+		if (!redirectTo)
+			return false;
+
+		// Count the move now so we don't send everyone to the same member before its next ALIVE
+		++m.peers;
+		if (_localPeers)
+			--_localPeers;
+		++_redirected;
+	}
+
+	Packet outp(peer->address(),RR->identity.address(),Packet::VERB_PUSH_DIRECT_PATHS);
+	outp.append((uint16_t)1); // count == 1
+	outp.append((uint8_t)ZT_PUSH_DIRECT_PATHS_FLAG_CLUSTER_REDIRECT);
+	outp.append((uint16_t)0); // no extensions
+	if (redirectTo.ss_family == AF_INET) {
+		outp.append((uint8_t)4);
+		outp.append((uint8_t)6);
+		outp.append(redirectTo.rawIpData(),4);
+	} else {
+		outp.append((uint8_t)6);
+		outp.append((uint8_t)18);
+		outp.append(redirectTo.rawIpData(),16);
+	}
+	outp.append((uint16_t)redirectTo.port());
+	outp.armor(peer->key(),true);
+	path->send(RR,tPtr,outp.data(),outp.size(),now);
+
+	return true;
+}
+
+void Cluster::_doREMOTE_WHOIS(void *tPtr,uint16_t fromMemberId,const Packet &remotep)
+{
+	Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> routp;
+	remotep.source().appendTo(routp);
+	routp.append((uint8_t)Packet::VERB_OK);
+	routp.addSize(2); // space for length
+	routp.append((uint8_t)Packet::VERB_WHOIS);
+	routp.append(remotep.packetId());
+
+	// Leave room for framing and stop at what fits in one message
+	unsigned int count = 0;
+	unsigned int ptr = ZT_PACKET_IDX_PAYLOAD;
+	while ((ptr + ZT_ADDRESS_LENGTH) <= remotep.size()) {
+		const Identity queried(RR->topology->getIdentity(tPtr,Address(remotep.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH)));
+		ptr += ZT_ADDRESS_LENGTH;
+		if (queried) {
+			if ((routp.size() + ZT_IDENTITY_PUBLIC_SERIALIZED_LENGTH) > (ZT_CLUSTER_MAX_MESSAGE_LENGTH - (24 + 2 + 2 + 3)))
+				break;
+			queried.serialize(routp);
+			++count;
+		}
+	}
+
+	if (count) {
+		routp.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(routp.size() - ZT_ADDRESS_LENGTH - 3));
+		Mutex::Lock _l(_members_m);
+		_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,routp.data(),routp.size());
+		_flush(fromMemberId);
+	}
+}
+
+void Cluster::_doREMOTE_MULTICAST_GATHER(void *tPtr,uint16_t fromMemberId,const Packet &remotep)
+{
+	const uint64_t nwid = remotep.at<uint64_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_NETWORK_ID);
+	const MulticastGroup mg(MAC(remotep.field(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_MAC,6),6),remotep.at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_ADI));
+	unsigned int gatherLimit = remotep.at<uint32_t>(ZT_PROTO_VERB_MULTICAST_GATHER_IDX_GATHER_LIMIT);
+	const Address remotePeerAddress(remotep.source());
+
+	if (gatherLimit) {
+		Buffer<ZT_PROTO_MAX_PACKET_LENGTH> routp;
+		remotePeerAddress.appendTo(routp);
+		routp.append((uint8_t)Packet::VERB_OK);
+		routp.addSize(2); // space for length
+		routp.append((uint8_t)Packet::VERB_MULTICAST_GATHER);
+		routp.append(remotep.packetId());
+		routp.append(nwid);
+		mg.mac().appendTo(routp);
+		routp.append((uint32_t)mg.adi());
+
+		if (gatherLimit > ((ZT_CLUSTER_MAX_MESSAGE_LENGTH - 80) / 5))
+			gatherLimit = ((ZT_CLUSTER_MAX_MESSAGE_LENGTH - 80) / 5);
+		if (RR->mc->gather(remotePeerAddress,nwid,mg,routp,gatherLimit)) {
+			routp.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(routp.size() - ZT_ADDRESS_LENGTH - 3));
+			Mutex::Lock _l(_members_m);
+			_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,routp.data(),routp.size());
+			_flush(fromMemberId);
+		}
+	}
+}
+
+void Cluster::_doPROXY_UNITE(void *tPtr,uint16_t fromMemberId,const Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> &dmsg,unsigned int ptr)
+{
+	const Address localPeerAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+	const Address remotePeerAddress(dmsg.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+	const unsigned int numRemotePeerPaths = dmsg[ptr++];
+
+	const int64_t now = RR->node->now();
+	const SharedPtr<Peer> localPeer(RR->topology->getPeerNoCache(localPeerAddress));
+	const SharedPtr<Path> lp((localPeer) ? localPeer->getBestPath(now,false) : SharedPtr<Path>());
+	if (!lp)
+		return;
+
+	// Introduce using the remote peer's first path in the family of our peer's best path
+	InetAddress remoteAt;
+	for(unsigned int i=0;i<numRemotePeerPaths;++i) {
+		InetAddress a;
+		ptr += a.deserialize(dmsg,ptr);
+		if ((!remoteAt)&&(a.ss_family == lp->address().ss_family))
+			remoteAt = a;
+	}
+	if (!remoteAt)
+		return;
+
+	Packet rendezvousForLocal(localPeerAddress,RR->identity.address(),Packet::VERB_RENDEZVOUS);
+	_appendRendezvous(rendezvousForLocal,remotePeerAddress,remoteAt);
+
+	Buffer<128> rendezvousForRemote;
+	remotePeerAddress.appendTo(rendezvousForRemote);
+	rendezvousForRemote.append((uint8_t)Packet::VERB_RENDEZVOUS);
+	rendezvousForRemote.addSize(2); // space for actual packet payload length
+	_appendRendezvous(rendezvousForRemote,localPeerAddress,lp->address());
+	rendezvousForRemote.setAt<uint16_t>(ZT_ADDRESS_LENGTH + 1,(uint16_t)(rendezvousForRemote.size() - (ZT_ADDRESS_LENGTH + 3)));
+
+	{
+		Mutex::Lock _l(_members_m);
+		_send(fromMemberId,CLUSTER_MESSAGE_PROXY_SEND,rendezvousForRemote.data(),rendezvousForRemote.size());
+		_flush(fromMemberId);
+	}
+	RR->sw->send(tPtr,rendezvousForLocal,true);
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,430 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_CLUSTER_HPP
+#define ZT_CLUSTER_HPP
+
+#include <vector>
+#include <string>
+
+#include "Constants.hpp"
+#include "../include/ZeroTierOne.h"
+#include "Address.hpp"
+#include "InetAddress.hpp"
+#include "SHA512.hpp"
+#include "Utils.hpp"
+#include "Buffer.hpp"
+#include "Mutex.hpp"
+#include "SharedPtr.hpp"
+#include "Hashtable.hpp"
+#include "Packet.hpp"
+
+/**
+ * Timeout for cluster members being considered "alive"
+ *
+ * A cluster member is considered dead and will no longer have peers
+ * redirected to it if we have not heard a heartbeat in this long.
+ */
+#define ZT_CLUSTER_TIMEOUT 5000
+
+/**
+ * How often to send ALIVE to each member
+ */
+#define ZT_CLUSTER_ALIVE_PERIOD ((ZT_CLUSTER_TIMEOUT / 2) - 1000)
+
+/**
+ * Maximum time a batched message waits before it's sent to a member
+ */
+#define ZT_CLUSTER_FLUSH_PERIOD 100
+
+/**
+ * How often to count our own active peers for ALIVE
+ *
+ * Counting walks the whole peer table, so in between the count is only
+ * adjusted for peers we redirect.
+ */
+#define ZT_CLUSTER_PEER_COUNT_PERIOD 10000
+
+/**
+ * We won't send WANT_PEER to other members more than every (ms) per peer
+ */
+#define ZT_CLUSTER_WANT_PEER_EVERY 1000
+
+/**
+ * Maximum number of packets queued for one destination while waiting for HAVE_PEER
+ */
+#define ZT_CLUSTER_MAX_QUEUE_PER_DESTINATION 16
+
+/**
+ * Maximum number of packets queued for all destinations
+ */
+#define ZT_CLUSTER_MAX_QUEUE_GLOBAL 8192
+
+/**
+ * Expiration time for queued packets
+ */
+#define ZT_CLUSTER_QUEUE_EXPIRATION 3000
+
+/**
+ * Minimum difference in active peers before a peer is redirected by load
+ */
+#define ZT_CLUSTER_REDIRECT_MIN_MARGIN 32
+
+/**
+ * Peers are redirected by load if another member has this fraction fewer (1/n)
+ */
+#define ZT_CLUSTER_REDIRECT_MARGIN_DIVISOR 16
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+class Peer;
+class Path;
+
+/**
+ * Root cluster state sharing, peer redirection and relaying
+ *
+ * A cluster is a set of root servers that all run the same identity and
+ * are all listed as stable endpoints of that identity in its world. Every
+ * peer talks to one member at a time, its home. Members tell each other
+ * over a private backplane which peers they're home to, and a member that
+ * gets a packet for a peer homed elsewhere forwards it unchanged to that
+ * member's ZeroTier endpoint, which relays it on. Since members share an
+ * identity a peer can be moved to another member with a PUSH_DIRECT_PATHS
+ * carrying the cluster redirect flag, which is how new peers are sent to
+ * the closest member (if peers can be located) or the least loaded one.
+ *
+ * Queries whose answers depend on what peers are homed where (WHOIS and
+ * MULTICAST_GATHER) are also sent to the other members, which answer the
+ * peer through the member that got the query.
+ */
+class Cluster
+{
+public:
+	/**
+	 * State message types
+	 */
+	enum StateMessageType
+	{
+		CLUSTER_MESSAGE_NOP = 0,
+
+		/**
+		 * This cluster member is alive:
+		 *   <[2] version major>
+		 *   <[2] version minor>
+		 *   <[2] version revision>
+		 *   <[1] protocol version>
+		 *   <[4] X location (signed 32-bit)>
+		 *   <[4] Y location (signed 32-bit)>
+		 *   <[4] Z location (signed 32-bit)>
+		 *   <[8] local clock at this member>
+		 *   <[8] number of active peers>
+		 *   <[8] number of peers redirected to other members>
+		 *   <[8] flags (currently unused, must be zero)>
+		 *   <[1] number of preferred ZeroTier endpoints>
+		 *   <[...] InetAddress(es) of preferred ZeroTier endpoint(s)>
+		 *
+		 * Cluster members constantly broadcast an alive heartbeat and will only
+		 * receive peer redirects if they've done so within the timeout.
+		 */
+		CLUSTER_MESSAGE_ALIVE = 1,
+
+		/**
+		 * Cluster member has this peer:
+		 *   <[5] ZeroTier address of peer>
+		 *
+		 * This is pushed periodically for peers that say HELLO to us directly
+		 * and sent in response to WANT_PEER.
+		 */
+		CLUSTER_MESSAGE_HAVE_PEER = 2,
+
+		/**
+		 * Cluster member wants this peer:
+		 *   <[5] ZeroTier address of peer>
+		 *
+		 * Members that have a direct link to this peer will respond with
+		 * HAVE_PEER.
+		 */
+		CLUSTER_MESSAGE_WANT_PEER = 3,
+
+		/**
+		 * A remote packet that we should also possibly respond to:
+		 *   <[2] 16-bit length of remote packet>
+		 *   <[...] remote packet payload>
+		 *
+		 * Members send WHOIS and MULTICAST_GATHER packets they've received
+		 * (already decrypted and authenticated) to the others, which answer
+		 * with PROXY_SEND to the member the peer is talking to.
+		 */
+		CLUSTER_MESSAGE_REMOTE_PACKET = 4,
+
+		/**
+		 * Request that VERB_RENDEZVOUS be sent to a peer that we have:
+		 *   <[5] ZeroTier address of peer on recipient's side>
+		 *   <[5] ZeroTier address of peer on sender's side>
+		 *   <[1] 8-bit number of sender's peer's active path addresses>
+		 *   <[...] series of serialized InetAddresses of sender's peer's paths>
+		 *
+		 * This requests that we perform NAT-t introduction between a peer that
+		 * we have and one on the sender's side. The sender furnishes contact
+		 * info for its peer, and we send VERB_RENDEZVOUS to both sides: to ours
+		 * directly and with PROXY_SEND to theirs.
+		 */
+		CLUSTER_MESSAGE_PROXY_UNITE = 5,
+
+		/**
+		 * Request that a cluster member send a packet to a locally-known peer:
+		 *   <[5] ZeroTier address of recipient>
+		 *   <[1] packet verb>
+		 *   <[2] length of packet payload>
+		 *   <[...] packet payload>
+		 *
+		 * The recipient composes a packet from our shared identity, so unlike
+		 * relaying this is how a member answers a peer it isn't home to.
+		 */
+		CLUSTER_MESSAGE_PROXY_SEND = 6
+
+		// 7 was NETWORK_CONFIG in older versions and is not used
+	};
+
+	/**
+	 * @param renv Runtime environment
+	 * @param id ID of this member
+	 * @param zeroTierPhysicalEndpoints ZeroTier UDP endpoints of this member
+	 * @param x X location
+	 * @param y Y location
+	 * @param z Z location
+	 * @param sendFunction Function to send a message to another member
+	 * @param sendFunctionArg First argument to sendFunction
+	 * @param addressToLocationFunction Function to locate peers or NULL if none
+	 * @param addressToLocationFunctionArg First argument to addressToLocationFunction
+	 */
+	Cluster(
+		const RuntimeEnvironment *renv,
+		uint16_t id,
+		const std::vector<InetAddress> &zeroTierPhysicalEndpoints,
+		int32_t x,
+		int32_t y,
+		int32_t z,
+		void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+		void *sendFunctionArg,
+		int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+		void *addressToLocationFunctionArg);
+
+	~Cluster();
+
+	/**
+	 * @return This cluster member's ID
+	 */
+	inline uint16_t id() const { return _id; }
+
+	/**
+	 * Handle an incoming intra-cluster message
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param msg Message data
+	 * @param len Message length (max: ZT_CLUSTER_MAX_MESSAGE_LENGTH)
+	 */
+	void handleIncomingStateMessage(void *tPtr,const void *msg,unsigned int len);
+
+	/**
+	 * Called when a peer says HELLO to us directly
+	 *
+	 * This redirects the peer if another member is a better home for it and
+	 * otherwise announces that we have it (at most every ZT_CLUSTER_HAVE_PEER_PERIOD).
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param peer Peer
+	 * @param path Path HELLO arrived on
+	 * @param now Current time
+	 */
+	void peerHello(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const int64_t now);
+
+	/**
+	 * Relay a packet or fragment through the member the destination is homed on
+	 *
+	 * If no member is known to have the destination, WANT_PEER is sent and the
+	 * packet is queued until one answers. Packets that came from another
+	 * member are never relayed again.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param localSocket Local socket packet arrived on
+	 * @param fromAddr Physical address packet came from
+	 * @param fromPeerAddress Source peer address (if known, should be NULL for fragments)
+	 * @param toPeerAddress Destination peer address
+	 * @param data Packet or packet fragment data
+	 * @param len Length of packet or fragment
+	 * @param unite If true, also ask the destination's member to introduce the two peers
+	 * @param now Current time
+	 * @return True if packet was relayed or queued
+	 */
+	bool relay(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite,const int64_t now);
+
+	/**
+	 * Send a query packet to other cluster members
+	 *
+	 * This is used for WHOIS and MULTICAST_GATHER. Replies (if any) will be
+	 * sent back to the peer via PROXY_SEND across the cluster.
+	 *
+	 * @param pkt Packet to distribute (decrypted)
+	 */
+	void sendDistributedQuery(const Packet &pkt);
+
+	/**
+	 * Call at least every ZT_CLUSTER_FLUSH_PERIOD milliseconds
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void doPeriodicTasks(void *tPtr,const int64_t now);
+
+	/**
+	 * Add a member ID to this cluster
+	 *
+	 * @param memberId Member ID
+	 * @return False if memberId is invalid
+	 */
+	bool addMember(uint16_t memberId);
+
+	/**
+	 * Remove a member ID from this cluster
+	 *
+	 * @param memberId Member ID to remove
+	 */
+	void removeMember(uint16_t memberId);
+
+	/**
+	 * @param ip Address to check
+	 * @return True if this is the IP of a cluster frontplane (excluding ours)
+	 */
+	bool isClusterPeerFrontplane(const InetAddress &ip) const;
+
+	/**
+	 * Fill out ZT_ClusterStatus structure (from core API)
+	 *
+	 * @param status Reference to structure to hold result (anything there is replaced)
+	 */
+	void status(ZT_ClusterStatus &status) const;
+
+private:
+	struct _Member
+	{
+		unsigned char key[ZT_PEER_SECRET_KEY_LENGTH];
+
+		int64_t lastReceivedAliveAnnouncement;
+		int64_t lastAnnouncedAliveTo;
+
+		uint64_t peers;
+		uint64_t redirected;
+		int32_t x,y,z;
+
+		std::vector<InetAddress> zeroTierPhysicalEndpoints;
+
+		Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> q;
+
+		inline void clear()
+		{
+			lastReceivedAliveAnnouncement = 0;
+			lastAnnouncedAliveTo = 0;
+			peers = 0;
+			redirected = 0;
+			x = 0;
+			y = 0;
+			z = 0;
+			zeroTierPhysicalEndpoints.clear();
+			q.clear();
+		}
+
+		_Member() { this->clear(); }
+		~_Member() { Utils::burn(key,sizeof(key)); }
+	};
+
+	struct _RemotePeer
+	{
+		_RemotePeer() : lastHavePeerReceived(0),lastSentWantPeer(0),memberId(0) {}
+		int64_t lastHavePeerReceived;
+		int64_t lastSentWantPeer;
+		uint16_t memberId;
+	};
+
+	struct _QueuedRelay
+	{
+		int64_t timestamp;
+		int64_t localSocket;
+		InetAddress fromAddr;
+		Address fromPeerAddress;
+		bool unite;
+		std::string data;
+	};
+
+	// These assume _members_m is locked
+	void _send(uint16_t memberId,StateMessageType type,const void *msg,unsigned int len);
+	void _flush(uint16_t memberId);
+	void _broadcast(StateMessageType type,const void *msg,unsigned int len,bool flush);
+	bool _isFrontplane(const InetAddress &ip) const;
+
+	bool _forward(void *tPtr,uint16_t memberId,const int64_t localSocket,const InetAddress &fromAddr,const Address &fromPeerAddress,const Address &toPeerAddress,const void *data,unsigned int len,bool unite,const int64_t now);
+	bool _redirect(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const int64_t now);
+
+	void _doREMOTE_WHOIS(void *tPtr,uint16_t fromMemberId,const Packet &remotep);
+	void _doREMOTE_MULTICAST_GATHER(void *tPtr,uint16_t fromMemberId,const Packet &remotep);
+	void _doPROXY_UNITE(void *tPtr,uint16_t fromMemberId,const Buffer<ZT_CLUSTER_MAX_MESSAGE_LENGTH> &dmsg,unsigned int ptr);
+
+	// These are initialized in the constructor and remain immutable ------------
+	uint16_t _masterSecret[ZT_SHA512_DIGEST_LEN / sizeof(uint16_t)];
+	unsigned char _key[ZT_PEER_SECRET_KEY_LENGTH];
+	const RuntimeEnvironment *RR;
+	void (*_sendFunction)(void *,unsigned int,const void *,unsigned int);
+	void *_sendFunctionArg;
+	int (*_addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *);
+	void *_addressToLocationFunctionArg;
+	const int32_t _x;
+	const int32_t _y;
+	const int32_t _z;
+	const uint16_t _id;
+	const std::vector<InetAddress> _zeroTierPhysicalEndpoints;
+	// end immutable fields -----------------------------------------------------
+
+	_Member *const _members;
+	std::vector<uint16_t> _memberIds;
+	uint64_t _localPeers; // estimate of our active peers, see ZT_CLUSTER_PEER_COUNT_PERIOD
+	uint64_t _redirected;
+	int64_t _lastFlushed;
+	int64_t _lastCountedPeers;
+	Mutex _members_m;
+
+	Hashtable< Address,_RemotePeer > _remotePeers;
+	Hashtable< Address,std::vector<_QueuedRelay> > _queue;
+	unsigned long _queued;
+	uint64_t _relayed;
+	uint64_t _relayDropped;
+	int64_t _lastCleanedRemotePeers;
+	Mutex _remotePeers_m;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,628 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_COMPILEDRULES_HPP
+#define ZT_COMPILEDRULES_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "../include/ZeroTierOne.h"
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "SharedPtr.hpp"
+#include "AtomicCounter.hpp"
+#include "Utils.hpp"
+
+/**
+ * Words in the largest possible candidate bitmap (one bit per rule set)
+ */
+#define ZT_COMPILEDRULES_MAX_WORDS ((ZT_MAX_NETWORK_RULES + 63) / 64)
+
+namespace ZeroTier {
+
+/**
+ * A rule list indexed so that a frame only visits the rule sets it might match
+ *
+ * Rules are evaluated as sets, each a run of MATCH entries ended by an ACTION.
+ * A set made only of AND'ed entries can't match unless each of its
+ * non-inverted entries does, so each such set is indexed by the most
+ * selective of those it has: a ZeroTier source or destination address, a
+ * destination or source port range, an IP protocol, or an ethertype. Looking
+ * these up for a frame gives a bitmap of candidate sets in rule order, and
+ * sets left out can't match so skipping them can't change the result.
+ *
+ * Sets that must always be visited are those with OR'ed entries and those
+ * with a TEE, WATCH, or REDIRECT to ourselves, since those set the inbound
+ * super-accept flag even when they do not match. Sets with unknown actions
+ * and sets that can't be reached after an unconditional DROP, ACCEPT, or
+ * BREAK are left out entirely, as are sets that can never match such as
+ * ones requiring two different ethertypes.
+ *
+ * The rules themselves are still evaluated by the filter with these sets
+ * only telling it where to jump, so semantics are exactly the same.
+ *
+ * Each compile also gets a fresh set of Counters, which copies share. The
+ * filter counts how often each set's ACTION is taken and how many MATCH
+ * entries it evaluates, and suggestOrder() uses these to find an order
+ * that would evaluate fewer entries for the same traffic.
+ */
+class CompiledRules
+{
+public:
+	/**
+	 * Evaluation and hit counters for a compiled rule list
+	 */
+	class Counters
+	{
+		friend class SharedPtr<Counters>;
+
+	public:
+		Counters(const unsigned int sets) :
+			_hits(new std::atomic<uint64_t>[(sets) ? sets : 1])
+		{
+			_evaluations.store(0,std::memory_order_relaxed);
+			_entries.store(0,std::memory_order_relaxed);
+			for(unsigned int s=0;s<sets;++s)
+				_hits[s].store(0,std::memory_order_relaxed);
+		}
+
+		~Counters() { delete [] _hits; }
+
+		/**
+		 * @param s Set whose ACTION was taken
+		 */
+		inline void hit(const unsigned int s) { _hits[s].fetch_add(1,std::memory_order_relaxed); }
+
+		/**
+		 * @param entries MATCH entries evaluated for one frame
+		 */
+		inline void evaluated(const unsigned int entries)
+		{
+			_evaluations.fetch_add(1,std::memory_order_relaxed);
+			_entries.fetch_add(entries,std::memory_order_relaxed);
+		}
+
+		/**
+		 * @param s Set index
+		 * @return Number of times set's ACTION was taken
+		 */
+		inline uint64_t hits(const unsigned int s) const { return _hits[s].load(std::memory_order_relaxed); }
+
+		/**
+		 * @return Frames the rule list was evaluated for
+		 */
+		inline uint64_t evaluations() const { return _evaluations.load(std::memory_order_relaxed); }
+
+		/**
+		 * @return MATCH entries evaluated over all those frames
+		 */
+		inline uint64_t entries() const { return _entries.load(std::memory_order_relaxed); }
+
+	private:
+		Counters(const Counters &) : _hits((std::atomic<uint64_t> *)0) {}
+		const Counters &operator=(const Counters &) { return *this; }
+
+		std::atomic<uint64_t> *const _hits;
+		std::atomic<uint64_t> _evaluations;
+		std::atomic<uint64_t> _entries;
+		AtomicCounter __refCount;
+	};
+
+	/**
+	 * Values of a frame that sets may be indexed by
+	 */
+	struct Frame
+	{
+		uint64_t ztSource;
+		uint64_t ztDest;
+		unsigned int etherType;
+		int ipProtocol; // -1 if not IP or unparseable
+		int sourcePort; // -1 if none or one that port range rules can't match
+		int destPort; // -1 if none or one that port range rules can't match
+	};
+
+	CompiledRules() :
+		_keys(8),
+		_words(0),
+		_usesKeys(false),
+		_usesIp(false),
+		_cacheable(true) {}
+
+	/**
+	 * Compile a rule list, replacing anything compiled before
+	 *
+	 * @param self Our own ZeroTier address
+	 * @param rules Rules (can't be NULL if ruleCount is nonzero)
+	 * @param ruleCount Number of rules
+	 */
+	inline void compile(const uint64_t self,const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount)
+	{
+		_source.assign(rules,rules + ruleCount);
+		_start.clear();
+		_end.clear();
+		_bits.clear();
+		_keys.clear();
+		_setKeys.clear();
+		for(unsigned int i=0;i<2;++i) {
+			_portEdges[i].clear();
+			_portMaps[i].clear();
+		}
+		_usesKeys = false;
+		_usesIp = false;
+		_cacheable = true;
+
+		// Find sets and the condition each is indexed by, if any
+		std::vector<uint64_t> keyOf; // type in the top 8 bits and value below, or 0 for always
+		std::vector< std::pair<unsigned int,unsigned int> > portOf[2]; // port ranges of port-indexed sets
+		std::vector<unsigned int> portSet[2];
+		unsigned int start = 0;
+		for(unsigned int rn=0;rn<ruleCount;++rn) {
+			const unsigned int rt = (unsigned int)(rules[rn].t & 0x3f);
+			if (rt > (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+				switch((ZT_VirtualNetworkRuleType)rt) {
+					case ZT_NETWORK_RULE_MATCH_IP_TOS:
+					case ZT_NETWORK_RULE_MATCH_ICMP:
+					case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS:
+					case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+					case ZT_NETWORK_RULE_MATCH_RANDOM:
+					case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE:
+						_cacheable = false;
+						break;
+					default:
+						break;
+				}
+				continue;
+			}
+
+			const unsigned int first = start;
+			start = rn + 1;
+
+			bool toSelf = false;
+			switch(rt) {
+				case ZT_NETWORK_RULE_ACTION_DROP:
+				case ZT_NETWORK_RULE_ACTION_ACCEPT:
+				case ZT_NETWORK_RULE_ACTION_BREAK:
+					break;
+				case ZT_NETWORK_RULE_ACTION_TEE:
+				case ZT_NETWORK_RULE_ACTION_WATCH:
+				case ZT_NETWORK_RULE_ACTION_REDIRECT:
+					toSelf = (rules[rn].v.fwd.address == self);
+					break;
+				default:
+					continue; // unknown actions do nothing whether or not they match
+			}
+
+			uint64_t key = 0;
+			int best = -1;
+			bool impossible = false;
+			int etherType = -1;
+			unsigned int portRange[2] = { 0,0 };
+			if (!toSelf) {
+				for(unsigned int i=first;i<rn;++i) {
+					if ((rules[i].t & 0x40)) {
+						key = 0;
+						best = -1;
+						impossible = false;
+						break;
+					}
+					if ((rules[i].t & 0x80))
+						continue;
+					int rank = -1;
+					uint64_t k = 0;
+					switch((ZT_VirtualNetworkRuleType)(rules[i].t & 0x3f)) {
+						case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+							rank = 6;
+							k = (uint64_t)rules[i].v.zt & 0xffffffffffULL;
+							if (k != rules[i].v.zt) impossible = true;
+							break;
+						case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+							rank = 5;
+							k = (uint64_t)rules[i].v.zt & 0xffffffffffULL;
+							if (k != rules[i].v.zt) impossible = true;
+							break;
+						case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+						case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+							rank = ((rules[i].t & 0x3f) == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 4 : 3;
+							if (rules[i].v.port[0] > rules[i].v.port[1]) impossible = true;
+							break;
+						case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+							rank = 2;
+							k = rules[i].v.ipProtocol;
+							break;
+						case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+							rank = 1;
+							k = rules[i].v.etherType;
+							if ((etherType >= 0)&&(etherType != (int)rules[i].v.etherType)) impossible = true;
+							etherType = (int)rules[i].v.etherType;
+							break;
+						default:
+							break;
+					}
+					if (rank > best) {
+						best = rank;
+						key = ((uint64_t)rank << 56) | k;
+						if ((rank == 3)||(rank == 4)) {
+							portRange[0] = rules[i].v.port[0];
+							portRange[1] = rules[i].v.port[1];
+						}
+					}
+				}
+			}
+
+			if (!impossible) {
+				const unsigned int s = (unsigned int)_start.size();
+				_start.push_back(first);
+				_end.push_back(rn);
+				if ((best == 3)||(best == 4)) {
+					const unsigned int d = (best == 4) ? 0 : 1;
+					portOf[d].push_back(std::pair<unsigned int,unsigned int>(portRange[0],portRange[1]));
+					portSet[d].push_back(s);
+					keyOf.push_back(0xffffffffffffffffULL);
+					_setKeys.push_back(((uint64_t)best << 56) | ((uint64_t)portRange[0] << 16) | (uint64_t)portRange[1]);
+				} else {
+					keyOf.push_back((best > 0) ? key : 0);
+					_setKeys.push_back((best > 0) ? key : 0);
+				}
+			}
+
+			// Nothing after a DROP, ACCEPT, or BREAK that always matches is ever reached
+			if ((first == rn)&&((rt == ZT_NETWORK_RULE_ACTION_DROP)||(rt == ZT_NETWORK_RULE_ACTION_ACCEPT)||(rt == ZT_NETWORK_RULE_ACTION_BREAK)))
+				break;
+		}
+
+		// Build bitmaps, with the one for sets that are always visited first
+		_words = ((unsigned int)_start.size() + 63) / 64;
+		_bits.resize(_words,0);
+		for(unsigned int s=0;s<(unsigned int)keyOf.size();++s) {
+			if (!keyOf[s]) {
+				_bits[s / 64] |= 1ULL << (s % 64);
+			} else if (keyOf[s] != 0xffffffffffffffffULL) {
+				unsigned int *const m = _keys.get(keyOf[s]);
+				unsigned int mi;
+				if (m) {
+					mi = *m;
+				} else {
+					mi = _newMap();
+					_keys.set(keyOf[s],mi);
+				}
+				_bits[(mi * _words) + (s / 64)] |= 1ULL << (s % 64);
+				_usesKeys = true;
+				if ((keyOf[s] >> 56) == 2)
+					_usesIp = true;
+			}
+		}
+
+		// Port range sets become a sorted list of edges, each starting an
+		// interval with a bitmap of the sets whose ranges cover all of it.
+		for(unsigned int d=0;d<2;++d) {
+			if (portOf[d].empty())
+				continue;
+			_usesIp = true;
+			std::vector<unsigned int> &e = _portEdges[d];
+			for(unsigned long i=0;i<portOf[d].size();++i) {
+				e.push_back(portOf[d][i].first);
+				e.push_back(portOf[d][i].second + 1);
+			}
+			std::sort(e.begin(),e.end());
+			e.erase(std::unique(e.begin(),e.end()),e.end());
+			_portMaps[d].resize(e.size(),0);
+			for(unsigned long j=0;j<e.size();++j) {
+				unsigned int mi = 0;
+				for(unsigned long i=0;i<portOf[d].size();++i) {
+					if ((portOf[d][i].first <= e[j])&&(portOf[d][i].second >= e[j])) {
+						if (!mi)
+							mi = _newMap();
+						const unsigned int s = portSet[d][i];
+						_bits[(mi * _words) + (s / 64)] |= 1ULL << (s % 64);
+					}
+				}
+				_portMaps[d][j] = mi;
+			}
+		}
+
+		_counters.set(new Counters((unsigned int)_start.size()));
+	}
+
+	/**
+	 * @param rules Rules
+	 * @param ruleCount Number of rules
+	 * @return True if this was compiled from exactly these rules
+	 */
+	inline bool compiledFrom(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount) const
+	{
+		if (_source.size() != (unsigned long)ruleCount)
+			return false;
+		return ((!ruleCount)||(memcmp(&(_source[0]),rules,sizeof(ZT_VirtualNetworkRule) * ruleCount) == 0));
+	}
+
+	/**
+	 * @return True if candidates() needs the IP protocol and port fields of a frame
+	 */
+	inline bool usesIp() const { return _usesIp; }
+
+	/**
+	 * Check whether results can be cached per flow
+	 *
+	 * This is true if no rule looks at anything but addresses, ethertype,
+	 * VLAN ID, IP protocol, ports, and tags, so that frames of one flow
+	 * between the same members always get the same result.
+	 *
+	 * @return True if results depend only on a frame's flow and credentials
+	 */
+	inline bool cacheable() const { return _cacheable; }
+
+	/**
+	 * @return Number of rule sets that can be visited
+	 */
+	inline unsigned int setCount() const { return (unsigned int)_start.size(); }
+
+	/**
+	 * @param s Set index
+	 * @return Index of the set's first rule
+	 */
+	inline unsigned int setStart(const unsigned int s) const { return _start[s]; }
+
+	/**
+	 * @param s Set index
+	 * @return Index of the set's ACTION
+	 */
+	inline unsigned int setEnd(const unsigned int s) const { return _end[s]; }
+
+	/**
+	 * @return Counters shared by copies of this compile, or NULL if nothing was compiled
+	 */
+	inline Counters *counters() const { return _counters.ptr(); }
+
+	/**
+	 * Check whether two sets could trade places without changing any result
+	 *
+	 * This is true if both end in DROP, ACCEPT, or BREAK and either the
+	 * actions are the same, so whichever matches first does the same thing,
+	 * or no frame could match both because they are indexed by different
+	 * values of the same field or by port ranges that do not overlap.
+	 *
+	 * @param a Set index
+	 * @param b Set index
+	 * @return True if the sets can be swapped when adjacent
+	 */
+	inline bool swappable(const unsigned int a,const unsigned int b) const
+	{
+		const unsigned int ta = (unsigned int)(_source[_end[a]].t & 0x3f);
+		const unsigned int tb = (unsigned int)(_source[_end[b]].t & 0x3f);
+		if ((!_terminal(ta))||(!_terminal(tb)))
+			return false;
+		if (ta == tb)
+			return true;
+		const uint64_t ka = _setKeys[a],kb = _setKeys[b];
+		if ((!ka)||(!kb)||((ka >> 56) != (kb >> 56)))
+			return false;
+		if (((ka >> 56) == 3)||((ka >> 56) == 4))
+			return ((((ka >> 16) & 0xffff) > (kb & 0xffff))||(((kb >> 16) & 0xffff) > (ka & 0xffff)));
+		return (ka != kb);
+	}
+
+	/**
+	 * Suggest an order of sets that evaluates fewer entries for the traffic counted
+	 *
+	 * Adjacent sets are swapped while swappable() allows it and the later one
+	 * has been hit more often per entry it takes to evaluate, so the result
+	 * gives the same verdict for every frame. Sets not visitable are left
+	 * where they are in the original list.
+	 *
+	 * @param order Filled with set indices in suggested order
+	 */
+	inline void suggestOrder(std::vector<unsigned int> &order) const
+	{
+		const unsigned int n = (unsigned int)_start.size();
+		order.resize(n);
+		for(unsigned int s=0;s<n;++s)
+			order[s] = s;
+		if (!_counters)
+			return;
+		for(bool swapped=true;swapped;) {
+			swapped = false;
+			for(unsigned int i=1;i<n;++i) {
+				const unsigned int a = order[i - 1],b = order[i];
+				if (((_counters->hits(b) * (uint64_t)(_end[a] - _start[a] + 1)) > (_counters->hits(a) * (uint64_t)(_end[b] - _start[b] + 1)))&&(swappable(a,b))) {
+					order[i - 1] = b;
+					order[i] = a;
+					swapped = true;
+				}
+			}
+		}
+	}
+
+	/**
+	 * Get rules that only drop outbound frames that these rules would drop
+	 *
+	 * Sets are kept if their matches only look at the frame's own bytes:
+	 * MACs, ethertype, IP addresses, IP protocol, and ports. Other sets are
+	 * left out if they could only drop, and otherwise end the result with
+	 * an unconditional ACCEPT since they might let a frame through. TEE and
+	 * WATCH are left out since their copies are only sent for frames that
+	 * are accepted anyway. In the result every set ends in DROP or ACCEPT,
+	 * and only DROP is final: frames it accepts or that match nothing still
+	 * have to go through the full rules. Any leading part of it is safe to
+	 * use on its own.
+	 *
+	 * @param rules Rules
+	 * @param ruleCount Number of rules
+	 * @param dropAtEnd If true frames that match nothing or a BREAK are dropped (no capabilities)
+	 * @param out Filled with rules, or left empty if they would never drop anything
+	 */
+	static inline void dropSubset(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount,const bool dropAtEnd,std::vector<ZT_VirtualNetworkRule> &out)
+	{
+		out.clear();
+		ZT_VirtualNetworkRule action;
+		memset(&action,0,sizeof(action));
+		bool drops = false,open = true;
+		unsigned int start = 0;
+		for(unsigned int rn=0;(rn<ruleCount)&&(open);++rn) {
+			const unsigned int t = rules[rn].t & 0x3f;
+			if (t > (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID)
+				continue;
+			bool stateless = true;
+			for(unsigned int i=start;i<rn;++i)
+				stateless &= _stateless(rules[i]);
+			if ((t == ZT_NETWORK_RULE_ACTION_DROP)||((t == ZT_NETWORK_RULE_ACTION_BREAK)&&(dropAtEnd))) {
+				if (stateless) {
+					out.insert(out.end(),rules + start,rules + rn);
+					action.t = ZT_NETWORK_RULE_ACTION_DROP;
+					out.push_back(action);
+					drops = true;
+					open = (rn > start);
+				}
+			} else if ((t == ZT_NETWORK_RULE_ACTION_ACCEPT)||(t == ZT_NETWORK_RULE_ACTION_BREAK)||(t == ZT_NETWORK_RULE_ACTION_REDIRECT)) {
+				if (stateless)
+					out.insert(out.end(),rules + start,rules + rn);
+				action.t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+				out.push_back(action);
+				open = ((stateless)&&(rn > start));
+			}
+			start = rn + 1;
+		}
+		if ((open)&&(dropAtEnd)) {
+			action.t = ZT_NETWORK_RULE_ACTION_DROP;
+			out.push_back(action);
+			drops = true;
+		}
+		if (!drops)
+			out.clear();
+	}
+
+	/**
+	 * Get the sets a frame might match
+	 *
+	 * @param f Frame values (IP fields may be left unset if usesIp() is false)
+	 * @param bits Bitmap to fill, must have room for ZT_COMPILEDRULES_MAX_WORDS words
+	 */
+	inline void candidates(const Frame &f,uint64_t *const bits) const
+	{
+		for(unsigned int w=0;w<_words;++w)
+			bits[w] = _bits[w];
+		if (_usesKeys) {
+			_or(bits,(6ULL << 56) | f.ztSource);
+			_or(bits,(5ULL << 56) | f.ztDest);
+			if (f.ipProtocol >= 0)
+				_or(bits,(2ULL << 56) | (uint64_t)f.ipProtocol);
+			_or(bits,(1ULL << 56) | (uint64_t)f.etherType);
+		}
+		const int port[2] = { f.destPort,f.sourcePort };
+		for(unsigned int d=0;d<2;++d) {
+			if ((port[d] >= 0)&&(!_portEdges[d].empty())) {
+				const std::vector<unsigned int>::const_iterator e(std::upper_bound(_portEdges[d].begin(),_portEdges[d].end(),(unsigned int)port[d]));
+				if (e != _portEdges[d].begin()) {
+					const unsigned int mi = _portMaps[d][(unsigned long)((e - _portEdges[d].begin()) - 1)];
+					if (mi) {
+						const uint64_t *const m = &(_bits[mi * _words]);
+						for(unsigned int w=0;w<_words;++w)
+							bits[w] |= m[w];
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * @param bits Bitmap from candidates()
+	 * @param s Set to start looking at
+	 * @return Index of first candidate set at or after s or setCount() if none
+	 */
+	inline unsigned int nextCandidate(const uint64_t *const bits,unsigned int s) const
+	{
+		const unsigned int n = (unsigned int)_start.size();
+		while (s < n) {
+			const uint64_t w = bits[s / 64] >> (s % 64);
+			if (w)
+				return s + (unsigned int)Utils::countBits((uint64_t)((w & (0ULL - w)) - 1));
+			s = (s + 64) & ~63U;
+		}
+		return n;
+	}
+
+private:
+	static inline bool _terminal(const unsigned int t) { return ((t == ZT_NETWORK_RULE_ACTION_DROP)||(t == ZT_NETWORK_RULE_ACTION_ACCEPT)||(t == ZT_NETWORK_RULE_ACTION_BREAK)); }
+
+	static inline bool _stateless(const ZT_VirtualNetworkRule &r)
+	{
+		switch(r.t & 0x3f) {
+			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+				return true;
+			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+				return (r.v.ipv4.mask <= 32);
+			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+				return (r.v.ipv6.mask <= 128);
+		}
+		return false;
+	}
+
+	inline unsigned int _newMap()
+	{
+		const unsigned int mi = (unsigned int)(_bits.size() / _words);
+		_bits.resize(_bits.size() + _words,0);
+		return mi;
+	}
+
+	inline void _or(uint64_t *const bits,const uint64_t key) const
+	{
+		const unsigned int *const mi = _keys.get(key);
+		if (mi) {
+			const uint64_t *const m = &(_bits[*mi * _words]);
+			for(unsigned int w=0;w<_words;++w)
+				bits[w] |= m[w];
+		}
+	}
+
+	std::vector<ZT_VirtualNetworkRule> _source; // copy of rules compiled, to check that they are the same
+	std::vector<unsigned int> _start; // first rule of each set
+	std::vector<unsigned int> _end; // ACTION of each set
+	std::vector<uint64_t> _setKeys; // type << 56 and value, or port range (low << 16) | high, or 0 if set is always visited
+	std::vector<uint64_t> _bits; // bitmaps of _words words each, the first being sets always visited
+	Hashtable< uint64_t,unsigned int > _keys; // (type << 56) | value -> bitmap index
+	std::vector<unsigned int> _portEdges[2]; // destination, source
+	std::vector<unsigned int> _portMaps[2]; // bitmap for interval starting at each edge or 0 for none
+	unsigned int _words;
+	bool _usesKeys;
+	bool _usesIp;
+	bool _cacheable;
+	SharedPtr<Counters> _counters;
+};
+
+} // namespace ZeroTier
+
+#endif
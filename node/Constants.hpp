@@ -186,12 +186,72 @@
 #define ZT_MAX_PACKET_FRAGMENTS 7
 
 /**
- * Size of RX queue
+ * Small footprint profile for routers and other devices with little RAM
  *
- * This is about 2mb, and can be decreased for small devices. A queue smaller
- * than about 4 is probably going to cause a lot of lost packets.
+ * Define ZT_SMALL_FOOTPRINT (make ZT_SMALL_FOOTPRINT=1) to lower the
+ * defaults below for every preallocated queue and every table that grows
+ * with the number of peers, so that memory use has a small, known upper
+ * bound (see the memory budget in README.md). Each one can still be set
+ * on its own, and the peer and multicast limits can also be set at run
+ * time with ZT_Node_setMemoryLimits().
+ */
+#ifdef ZT_SMALL_FOOTPRINT
+#ifndef ZT_RX_QUEUE_SIZE
+#define ZT_RX_QUEUE_SIZE 16
+#endif
+#ifndef ZT_RX_QUEUE_MAX_SIZE
+#define ZT_RX_QUEUE_MAX_SIZE 16
+#endif
+#ifndef ZT_TX_QUEUE_SIZE
+#define ZT_TX_QUEUE_SIZE 16
+#endif
+#ifndef ZT_TX_QUEUE_MAX_BYTES
+#define ZT_TX_QUEUE_MAX_BYTES 65536
+#endif
+#ifndef ZT_RELAY_CACHE_SIZE
+#define ZT_RELAY_CACHE_SIZE 128
+#endif
+#ifndef ZT_CRYPTO_WORKERS_MAX_QUEUE
+#define ZT_CRYPTO_WORKERS_MAX_QUEUE 64
+#endif
+#ifndef ZT_IDENTITY_VALIDATION_CACHE_SIZE
+#define ZT_IDENTITY_VALIDATION_CACHE_SIZE 4096
+#endif
+#ifndef ZT_MAX_PEERS
+#define ZT_MAX_PEERS 4096
+#endif
+#ifndef ZT_MAX_MULTICAST_MEMBERS
+#define ZT_MAX_MULTICAST_MEMBERS 16384
+#endif
+#ifndef ZT_MAX_BRIDGE_ROUTES
+#define ZT_MAX_BRIDGE_ROUTES 16384
+#endif
+#ifndef ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE
+#define ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE 4096
+#endif
+#endif
+
+/**
+ * Initial size of RX queue
+ *
+ * This many entries are allocated up front. A queue smaller than about 4 is
+ * probably going to cause a lot of lost packets.
  */
+#ifndef ZT_RX_QUEUE_SIZE
 #define ZT_RX_QUEUE_SIZE 64
+#endif
+
+/**
+ * Maximum size of RX queue
+ *
+ * The queue grows toward this only when every entry is busy with a packet
+ * that is still being reassembled or waiting on WHOIS, which in practice
+ * only happens on busy roots and relays. Each entry is about 80k, so this
+ * can be set equal to ZT_RX_QUEUE_SIZE on small devices to disable growth.
+ */
+#ifndef ZT_RX_QUEUE_MAX_SIZE
+#define ZT_RX_QUEUE_MAX_SIZE 256
+#endif
 
 /**
  * Size of TX queue
@@ -199,7 +259,84 @@
  * This is about 2mb, and can be decreased for small devices. A queue smaller
  * than about 4 is probably going to cause a lot of lost packets.
  */
+#ifndef ZT_TX_QUEUE_SIZE
 #define ZT_TX_QUEUE_SIZE 64
+#endif
+
+/**
+ * Maximum total bytes of packets in TX queue
+ *
+ * Most queued packets are small, so this is well under what the entries
+ * themselves could hold. Oldest packets are dropped to stay under it.
+ */
+#ifndef ZT_TX_QUEUE_MAX_BYTES
+#define ZT_TX_QUEUE_MAX_BYTES 262144
+#endif
+
+/**
+ * Maximum packets collected for one call to the batch wire send callback
+ */
+#define ZT_WIRE_BATCH_MAX_PACKETS 64
+
+/**
+ * Maximum bytes collected for one call to the batch wire send callback
+ */
+#define ZT_WIRE_BATCH_MAX_BYTES 65536
+
+/**
+ * Maximum bytes of frames the egress scheduler queues for each network
+ */
+#define ZT_EGRESS_MAX_QUEUE_BYTES 262144
+
+/**
+ * Maximum bytes of latency-sensitive frames the egress scheduler queues
+ */
+#define ZT_EGRESS_MAX_INTERACTIVE_QUEUE_BYTES 65536
+
+/**
+ * Frames that waited longer than this (ms) in the egress scheduler are dropped instead of sent
+ */
+#define ZT_EGRESS_MAX_QUEUE_DELAY 200
+
+/**
+ * Egress token bucket depth in ms of the configured rate
+ */
+#define ZT_EGRESS_BURST_PERIOD 10
+
+/**
+ * Minimum egress token bucket depth in bytes
+ */
+#define ZT_EGRESS_MIN_BURST 16384
+
+/**
+ * Longest hosts should wait between calls to processBackgroundTasks() while the egress scheduler is enabled
+ */
+#define ZT_EGRESS_SERVICE_PERIOD 5
+
+/**
+ * Traffic a network or member rate limit lets through unpaced, in ms of its rate
+ */
+#define ZT_SHAPER_BURST_PERIOD 10
+
+/**
+ * Minimum traffic in bytes a rate limit lets through unpaced
+ */
+#define ZT_SHAPER_MIN_BURST 8192
+
+/**
+ * Packets that would have to be held longer than this (ms) to meet a rate limit are dropped
+ */
+#define ZT_SHAPER_MAX_DELAY 100
+
+/**
+ * Maximum bytes held by rate limits at once
+ */
+#define ZT_SHAPER_MAX_HELD_BYTES 8388608
+
+/**
+ * Longest hosts should wait between calls to processBackgroundTasks() while any rate limit is set
+ */
+#define ZT_SHAPER_SERVICE_PERIOD 5
 
 /**
  * Length of secret key in bytes -- 256-bit -- do not change
@@ -221,6 +358,52 @@
  */
 #define ZT_WHOIS_RETRY_DELAY 500
 
+/**
+ * Number of independently locked shards in Topology's peer table
+ */
+#define ZT_TOPOLOGY_PEER_SHARDS 64
+
+/**
+ * Shortest idle time after which peers may be demoted to cold records
+ *
+ * Peers with a path to us send something at least every ZT_PEER_PING_PERIOD,
+ * so this is two of those (see Topology::setColdPeerTimeout).
+ */
+#define ZT_PEER_COLD_TIMEOUT_MIN (ZT_PEER_PING_PERIOD * 2)
+
+/**
+ * With a peer limit set, cold records kept per peer allowed in memory
+ */
+#define ZT_PEER_COLD_PER_HOT 8
+
+/**
+ * Default maximum number of peers held in memory, or 0 for no limit
+ *
+ * Past this the least recently heard from peers are dropped, to be loaded
+ * again from the peer cache if they come back (see Topology::setMaxPeers).
+ */
+#ifndef ZT_MAX_PEERS
+#define ZT_MAX_PEERS 0
+#endif
+
+/**
+ * Maximum number of recently active peers whose direct paths are saved for contacting at startup
+ */
+#define ZT_TOPOLOGY_MAX_WARM_PATHS 1024
+
+/**
+ * Window in ms over which WHOIS requests are coalesced into one packet
+ *
+ * The first request after a quiet period is sent at once, and any made
+ * within this window after it are held and sent together when it ends.
+ */
+#define ZT_WHOIS_COALESCE_WINDOW 20
+
+/**
+ * Maximum number of addresses in one WHOIS request
+ */
+#define ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST 128
+
 /**
  * Transmit queue entry timeout
  */
@@ -243,16 +426,49 @@
  */
 #define ZT_RELAY_MAX_HOPS 3
 
+/**
+ * Size of relay destination to best path cache (must be a power of two)
+ */
+#ifndef ZT_RELAY_CACHE_SIZE
+#define ZT_RELAY_CACHE_SIZE 1024
+#endif
+
+/**
+ * How long a relay cache entry is used before the destination's best path is looked up again
+ *
+ * This bounds how long relayed traffic keeps going to a path that has just
+ * stopped being the peer's best one.
+ */
+#define ZT_RELAY_CACHE_TTL 1000
+
 /**
  * Expire time for multicast 'likes' and indirect multicast memberships in ms
  */
 #define ZT_MULTICAST_LIKE_EXPIRE 600000
 
+/**
+ * Default maximum multicast group members remembered, or 0 for no limit
+ *
+ * This counts members of all groups together (see Multicaster::setMaxMembers).
+ */
+#ifndef ZT_MAX_MULTICAST_MEMBERS
+#define ZT_MAX_MULTICAST_MEMBERS 0
+#endif
+
 /**
  * Period for multicast LIKE announcements
  */
 #define ZT_MULTICAST_ANNOUNCE_PERIOD 120000
 
+/**
+ * Period for re-announcing all multicast LIKEs to upstreams and other always-contact peers
+ *
+ * New subscriptions are announced right away, so this only refreshes what
+ * these peers already know. It's a third of the LIKE expiration so that one
+ * lost refresh does not expire anything.
+ */
+#define ZT_MULTICAST_ANNOUNCE_UPSTREAM_PERIOD (ZT_MULTICAST_LIKE_EXPIRE / 3)
+
 /**
  * Delay between explicit MULTICAST_GATHER requests for a given multicast channel
  */
@@ -270,6 +486,19 @@
  */
 #define ZT_MULTICAST_TRANSMIT_TIMEOUT 5000
 
+/**
+ * How long a group's gather results are reused to answer further gathers
+ *
+ * Removing one of the members returned invalidates them sooner. Members
+ * who join in the meantime are returned once this expires.
+ */
+#define ZT_MULTICAST_GATHER_CACHE_TTL 1000
+
+/**
+ * Group size above which a multicast replicator splits delivery among all live replicators
+ */
+#define ZT_MULTICAST_REPLICATION_SPLIT_THRESHOLD 1024
+
 /**
  * Delay between checks of peer pings, etc., and also related housekeeping tasks
  */
@@ -280,11 +509,93 @@
  */
 #define ZT_PATH_HEARTBEAT_PERIOD 14000
 
+/**
+ * Largest UDP payload path MTU discovery will try (9000 byte jumbo frames less IPv4 and UDP headers)
+ */
+#define ZT_PATH_MTU_PROBE_MAX 8972
+
+/**
+ * Path MTU discovery stops when known-good and known-bad sizes are this close
+ */
+#define ZT_PATH_MTU_PROBE_GRANULARITY 32
+
+/**
+ * An unanswered path MTU probe is considered lost after this long
+ */
+#define ZT_PATH_MTU_PROBE_TIMEOUT 4000
+
+/**
+ * Number of lost probes after which a probe size is considered too big
+ */
+#define ZT_PATH_MTU_PROBE_TRIES 3
+
+/**
+ * How often to repeat path MTU discovery on a path
+ */
+#define ZT_PATH_MTU_PROBE_INTERVAL 600000
+
+/**
+ * Maximum number of unanswered HELLO/ECHO probes tracked per path for loss and jitter
+ */
+#define ZT_PATH_QOS_MAX_PROBES 8
+
+/**
+ * A probe that has not been answered in this long counts as lost
+ */
+#define ZT_PATH_QOS_PROBE_TIMEOUT 4000
+
+/**
+ * Forward error correction starts on a path once probe loss reaches this (ppm)
+ */
+#define ZT_PATH_FEC_LOSS_ON 10000
+
+/**
+ * Forward error correction stops on a path once probe loss falls under this (ppm)
+ */
+#define ZT_PATH_FEC_LOSS_OFF 2000
+
+/**
+ * Probes that must have been answered or lost before loss can start FEC
+ */
+#define ZT_PATH_FEC_MIN_SAMPLES 8
+
+/**
+ * Lowest rate in bytes/second frames over a lossy path are paced to
+ */
+#define ZT_PATH_PACING_MIN_RATE 125000
+
+/**
+ * Traffic a paced path lets through unpaced, in ms of its pacing rate
+ */
+#define ZT_PATH_PACING_BURST_PERIOD 2
+
+/**
+ * Minimum traffic in bytes a paced path lets through unpaced (about three full size packets)
+ */
+#define ZT_PATH_PACING_MIN_BURST 4500
+
 /**
  * Do not accept HELLOs over a given path more often than this
  */
 #define ZT_PATH_HELLO_RATE_LIMIT 1000
 
+/**
+ * Frames up to this size are held for VERB_MULTI_FRAME packets while aggregating
+ */
+#define ZT_AGGREGATE_MAX_FRAME 512
+
+/**
+ * Most bytes of frames and their 4-byte length/ethertype headers in one VERB_MULTI_FRAME
+ *
+ * With the 28-byte packet header and 8-byte network ID this fits unfragmented in ZT_MIN_PHYSMTU.
+ */
+#define ZT_AGGREGATE_MAX_BYTES (ZT_MIN_PHYSMTU - 36)
+
+/**
+ * Most peers and networks frames can be held for at once on one thread
+ */
+#define ZT_AGGREGATE_MAX_PEERS 16
+
 /**
  * Delay between full-fledge pings of directly connected peers
  */
@@ -295,6 +606,43 @@
  */
 #define ZT_PEER_PATH_EXPIRATION ((ZT_PEER_PING_PERIOD * 4) + 3000)
 
+/**
+ * Longest keepalive interval for idle peers in adaptive keepalive mode
+ *
+ * This is half of ZT_PEER_PATH_EXPIRATION so the other side keeps the path
+ * even if one keepalive is lost.
+ */
+#define ZT_PATH_KEEPALIVE_MAX (ZT_PEER_PATH_EXPIRATION / 2)
+
+/**
+ * How much an idle keepalive interval grows each time the NAT binding outlasts it
+ */
+#define ZT_PATH_KEEPALIVE_STEP 10000
+
+/**
+ * Peers are idle for adaptive keepalive when no frames went either way in this long
+ */
+#define ZT_PEER_KEEPALIVE_IDLE_TIMEOUT ZT_PEER_PING_PERIOD
+
+/**
+ * Maximum time a peer's cached best path is used before it is chosen again
+ *
+ * The cache is also dropped whenever a path is learned, removed, fails or
+ * has its latency updated. This bounds how long other changes such as a
+ * dead path coming back can go unnoticed.
+ */
+#define ZT_PEER_BEST_PATH_CACHE_TTL 1000
+
+/**
+ * How often to HELLO each path of a peer in a multipath mode to measure its latency
+ */
+#define ZT_MULTIPATH_HEARTBEAT_PERIOD 5000
+
+/**
+ * Paths of a multipath peer are taken out of the bond if nothing is received over them in this long
+ */
+#define ZT_MULTIPATH_PATH_TIMEOUT ((ZT_MULTIPATH_HEARTBEAT_PERIOD * 2) + 1000)
+
 /**
  * How often to retry expired paths that we're still remembering
  */
@@ -305,6 +653,41 @@
  */
 #define ZT_PEER_ACTIVITY_TIMEOUT 500000
 
+/**
+ * Minimum advantage in relay score (about ms of latency) for another upstream to replace the current one
+ */
+#define ZT_UPSTREAM_SWITCH_MIN_MARGIN 10
+
+/**
+ * Another upstream must also beat the current one's relay score by this fraction of it (1/N)
+ */
+#define ZT_UPSTREAM_SWITCH_MARGIN_DIVISOR 8
+
+/**
+ * Interval between VERB_RELAY_OFFERs from a peer offering relay capacity
+ */
+#define ZT_RELAY_OFFER_INTERVAL 30000
+
+/**
+ * Relay offers older than this are ignored (a few missed offers)
+ */
+#define ZT_RELAY_OFFER_TIMEOUT 95000
+
+/**
+ * Relays reporting load over this percentage of their capacity are not chosen
+ */
+#define ZT_RELAY_MAX_LOAD_PERCENT 90
+
+/**
+ * Maximum number of peers remembered as relay candidates
+ */
+#define ZT_MAX_RELAY_CANDIDATES 32
+
+/**
+ * A relay is dropped if nothing comes back from a destination sent to through it for this long
+ */
+#define ZT_RELAY_REPLY_TIMEOUT 30000
+
 /**
  * General rate limit timeout for multiple packet types (HELLO, etc.)
  */
@@ -323,6 +706,28 @@
  */
 #define ZT_NETWORK_AUTOCONF_DELAY 60000
 
+/**
+ * Maximum number of flows per network whose filter results are cached
+ */
+#define ZT_NETWORK_FLOW_CACHE_SIZE 2048
+
+/**
+ * Cached filter results for flows not seen in this long are dropped
+ */
+#define ZT_NETWORK_FLOW_CACHE_TTL 60000
+
+/**
+ * Minimum number of rules (including capabilities) for filter results to be cached
+ *
+ * Below this, evaluating the rules is about as cheap as a cache lookup.
+ */
+#define ZT_NETWORK_FLOW_CACHE_MIN_RULES 16
+
+/**
+ * Number of independently locked shards in each network's membership table
+ */
+#define ZT_NETWORK_MEMBERSHIP_SHARDS 8
+
 /**
  * Minimum interval between attempts by relays to unite peers
  *
@@ -338,15 +743,34 @@
 #define ZT_TRY_MEMORIZED_PATH_INTERVAL 30000
 
 /**
- * Sanity limit on maximum bridge routes
+ * Default maximum number of remote bridge routes remembered per network
+ *
+ * When this is reached the least recently seen MAC is forgotten. Frames to
+ * a MAC that isn't known just go to all active bridges (see below) until it
+ * is learned again. Note that this does not limit the size of ZT virtual
+ * LANs, only bridge routing. Both limits can be changed at runtime with
+ * ZT_Node_setBridgeRouteLimits.
+ */
+#ifndef ZT_MAX_BRIDGE_ROUTES
+#define ZT_MAX_BRIDGE_ROUTES 262144
+#endif
+
+/**
+ * Default maximum number of routes behind any one remote bridge
+ *
+ * Past this a bridge's own least recently seen MACs make room for its new
+ * ones, so a single bridge can't push everyone else's routes out.
+ */
+#ifndef ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE
+#define ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE 65536
+#endif
+
+/**
+ * Bridge routes not refreshed by a frame in this long are forgotten
  *
- * If the number of bridge routes exceeds this, we cull routes from the
- * bridges with the most MACs behind them until it doesn't. This is a
- * sanity limit to prevent memory-filling DOS attacks, nothing more. No
- * physical LAN has anywhere even close to this many nodes. Note that this
- * does not limit the size of ZT virtual LANs, only bridge routing.
+ * This is the usual MAC aging time of Ethernet switches.
  */
-#define ZT_MAX_BRIDGE_ROUTES 67108864
+#define ZT_BRIDGE_ROUTE_EXPIRE 300000
 
 /**
  * If there is no known route, spam to up to this many active bridges
@@ -377,6 +801,33 @@
  */
 #define ZT_PUSH_DIRECT_PATHS_MAX_PER_SCOPE_AND_FAMILY 8
 
+/**
+ * Delay between stages of probes to candidate endpoints for a peer
+ *
+ * LAN and IPv6 candidates are probed first, then global IPv4, then ports
+ * predicted for symmetric NATs, each stage this much later than the last
+ * (like Happy Eyeballs, RFC 8305).
+ */
+#define ZT_TRAVERSAL_STAGE_DELAY 100
+
+/**
+ * Number of times each candidate endpoint is probed
+ *
+ * The first probes often reach the other side's NAT before its own probes
+ * have opened it, so they are repeated until a path is found.
+ */
+#define ZT_TRAVERSAL_PROBE_TRIES 3
+
+/**
+ * Delay between repeated probes to the same candidate endpoint
+ */
+#define ZT_TRAVERSAL_RETRY_DELAY 250
+
+/**
+ * Maximum number of candidate endpoints waiting to be probed
+ */
+#define ZT_TRAVERSAL_MAX_PENDING 1024
+
 /**
  * Time horizon for VERB_NETWORK_CREDENTIALS cutoff
  */
@@ -387,16 +838,63 @@
  */
 #define ZT_PEER_CREDEITIALS_CUTOFF_LIMIT 15
 
+/**
+ * Consecutive frames to a peer that failed to compress before we back off
+ */
+#define ZT_PEER_COMPRESSION_FAILURE_THRESHOLD 16
+
+/**
+ * Frames sent uncompressed after the first back-off (doubles per failed re-probe)
+ */
+#define ZT_PEER_COMPRESSION_BACKOFF_MIN 64
+
+/**
+ * Maximum number of frames sent uncompressed between compression re-probes
+ */
+#define ZT_PEER_COMPRESSION_BACKOFF_MAX 4096
+
 /**
  * WHOIS rate limit (we allow these to be pretty fast)
  */
 #define ZT_PEER_WHOIS_RATE_LIMIT 100
 
+/**
+ * How often a peer that keeps saying HELLO to a root cluster member is announced to other members
+ *
+ * This must be well under ZT_PEER_ACTIVITY_TIMEOUT / 3 or members will
+ * send WANT_PEER for peers they already know the home of.
+ */
+#define ZT_CLUSTER_HAVE_PEER_PERIOD (ZT_PEER_ACTIVITY_TIMEOUT / 4)
+
 /**
  * General rate limit for other kinds of rate-limited packets (HELLO, credential request, etc.) both inbound and outbound
  */
 #define ZT_PEER_GENERAL_RATE_LIMIT 1000
 
+/**
+ * Inbound ECHO rate limit, fast enough to answer fast failover probes
+ *
+ * An OK(ECHO) reply is the request's payload plus the 9 byte in-re verb and
+ * packet ID, and only goes back over the path an authenticated request came
+ * in on, so this allows at most 9 bytes of amplification per request.
+ */
+#define ZT_PEER_ECHO_RATE_LIMIT 50
+
+/**
+ * Minimum fast failover probe interval in ms (must stay above ZT_PEER_ECHO_RATE_LIMIT)
+ */
+#define ZT_FAST_FAILOVER_MIN_INTERVAL 100
+
+/**
+ * Default number of consecutive unanswered fast failover probes before a path is declared down
+ */
+#define ZT_FAST_FAILOVER_DEFAULT_MISSED_PROBES 3
+
+/**
+ * Peers stop being watched for fast failover when no frame has been sent to them in this long
+ */
+#define ZT_FAST_FAILOVER_ACTIVE_TIMEOUT 2000
+
 /**
  * Don't do expensive identity validation more often than this
  *
@@ -417,6 +915,46 @@
 #endif
 #endif
 
+/**
+ * Milliseconds of admission budget unknown peers may run ahead by before WHOIS work is shed
+ *
+ * Key agreement is shed at two thirds of this and identity validation at
+ * one third, so the most expensive work goes first as a backlog builds.
+ */
+#define ZT_ADMISSION_BACKLOG 1000
+
+/**
+ * One source prefix (see InetAddress::rateGateHash()) gets this fraction of the admission budget
+ */
+#define ZT_ADMISSION_SOURCE_SHARE 8
+
+/**
+ * Maximum worker threads for HELLOs from new peers (see CryptoWorkers)
+ */
+#define ZT_CRYPTO_WORKERS_MAX_THREADS 64
+
+/**
+ * Maximum HELLOs from new peers waiting for a worker before more are dropped
+ */
+#ifndef ZT_CRYPTO_WORKERS_MAX_QUEUE
+#define ZT_CRYPTO_WORKERS_MAX_QUEUE 4096
+#endif
+
+/**
+ * How often in ms to check for finished HELLOs when nothing else calls into the node
+ */
+#define ZT_CRYPTO_WORKERS_POLL_INTERVAL 5
+
+/**
+ * Number of identities remembered as having passed local validation
+ *
+ * Identities in this cache skip the memory-hard hash check and the rate
+ * limit above. Each entry costs roughly 100 bytes.
+ */
+#ifndef ZT_IDENTITY_VALIDATION_CACHE_SIZE
+#define ZT_IDENTITY_VALIDATION_CACHE_SIZE 65536
+#endif
+
 /**
  * How long is a path or peer considered to have a trust relationship with us (for e.g. relay policy) since last trusted established packet?
  */
@@ -436,6 +974,15 @@
 #define ZT_UDP_DESIRED_BUF_SIZE 131072
 #endif
 
+/**
+ * Default size UDP socket buffers may grow to when the kernel drops datagrams on them
+ */
+#if (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__) || defined(__AMD64) || defined(__AMD64__))
+#define ZT_UDP_MAX_BUF_SIZE 8388608
+#else
+#define ZT_UDP_MAX_BUF_SIZE 1048576
+#endif
+
 /**
  * Desired / recommended min stack size for threads (used on some platforms to reset thread stack size)
  */
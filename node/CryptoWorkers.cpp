@@ -0,0 +1,162 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "CryptoWorkers.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Node.hpp"
+#include "Topology.hpp"
+#include "Metrics.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+CryptoWorkers::CryptoWorkers(const RuntimeEnvironment *renv) :
+	RR(renv),
+	_threads_m("CryptoWorkers::_threads_m"),
+	_running(0),
+	_stop(false),
+	_outstanding(0),
+	_doneCount(0)
+{
+}
+
+CryptoWorkers::~CryptoWorkers()
+{
+	setThreads(0,std::vector<unsigned int>());
+	for(std::vector< _Job * >::iterator j(_done.begin());j!=_done.end();++j)
+		delete *j;
+}
+
+void CryptoWorkers::setThreads(unsigned int threads,const std::vector<unsigned int> &cpus)
+{
+	threads = std::min(threads,(unsigned int)ZT_CRYPTO_WORKERS_MAX_THREADS);
+	Mutex::Lock _tl(_threads_m);
+	if ((threads == (unsigned int)_threads.size())&&((!threads)||(cpus == _cpus)))
+		return;
+	_cpus = cpus;
+
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_stop = true;
+		_running = 0;
+	}
+	_wake.notify_all();
+	for(std::vector< std::thread >::iterator t(_threads.begin());t!=_threads.end();++t)
+		t->join();
+	_threads.clear();
+
+	std::lock_guard<std::mutex> l(_lock);
+	_stop = false;
+	_running = threads;
+	for(unsigned int t=0;t<threads;++t)
+		_threads.push_back(std::thread(&CryptoWorkers::_threadMain,this,(_cpus.empty()) ? -1 : (int)_cpus[t % _cpus.size()]));
+}
+
+bool CryptoWorkers::submit(const IncomingPacket &packet,const Identity &id,const bool knownValid,const int64_t now)
+{
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		if (!_running)
+			return false;
+		if ((_queue.size() >= ZT_CRYPTO_WORKERS_MAX_QUEUE)||(_inFlight.contains(id.address()))) {
+			Metrics::drop(ZT_METRICS_DROP_OVERLOAD);
+			return true;
+		}
+		_Job *const j = new _Job();
+		j->packet = packet;
+		j->id = id;
+		j->now = now;
+		j->knownValid = knownValid;
+		j->authentic = false;
+		j->valid = false;
+		_queue.push_back(j);
+		_inFlight.set(id.address(),true);
+		++_outstanding;
+	}
+	_wake.notify_one();
+	return true;
+}
+
+void CryptoWorkers::drain(void *tPtr)
+{
+	if (!_doneCount.load())
+		return;
+	std::vector< _Job * > done;
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		done.swap(_done);
+		_doneCount = 0;
+		for(std::vector< _Job * >::const_iterator j(done.begin());j!=done.end();++j)
+			_inFlight.erase((*j)->id.address());
+	}
+	for(std::vector< _Job * >::iterator j(done.begin());j!=done.end();++j) {
+		try {
+			(*j)->packet.finishHELLO(RR,tPtr,(*j)->id,(*j)->key,(*j)->authentic,(*j)->valid,(*j)->knownValid);
+		} catch ( ... ) {}
+		delete *j;
+		--_outstanding;
+	}
+}
+
+void CryptoWorkers::_threadMain(int cpu)
+{
+	if (cpu >= 0)
+		Utils::pinThread((unsigned int)cpu);
+	for(;;) {
+		_Job *j;
+		{
+			std::unique_lock<std::mutex> l(_lock);
+			while ((_queue.empty())&&(!_stop))
+				_wake.wait(l);
+			if (_queue.empty())
+				return;
+			j = _queue.front();
+			_queue.pop_front();
+		}
+
+		// Same order as IncomingPacket::_doHELLO(): the MAC check is cheaper than validation so it goes first
+		const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+		if (RR->identity.agree(j->id,j->key,ZT_PEER_SECRET_KEY_LENGTH)) {
+			j->authentic = j->packet.dearmor(j->key);
+			j->valid = ((j->authentic)&&((j->knownValid)||(j->id.locallyValidate())));
+		}
+		RR->node->admission().charge(j->packet.path()->address(),(uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(),j->now);
+
+		{
+			std::lock_guard<std::mutex> l(_lock);
+			_done.push_back(j);
+			++_doneCount;
+		}
+	}
+}
+
+} // namespace ZeroTier
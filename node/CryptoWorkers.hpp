@@ -0,0 +1,156 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_CRYPTOWORKERS_HPP
+#define ZT_CRYPTOWORKERS_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Constants.hpp"
+#include "Address.hpp"
+#include "Identity.hpp"
+#include "IncomingPacket.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Worker threads for key agreement and identity validation of new peers
+ *
+ * A HELLO from a peer we don't know needs a key agreement and, unless its
+ * identity is in the validation cache, a memory-hard identity check. Done
+ * inline these hold up every packet behind them for milliseconds each, so
+ * a reconnect storm stalls traffic for peers we already know.
+ *
+ * With threads running, such a HELLO is copied into a job and the thread
+ * that received it moves on. A worker does the agreement, the MAC check and
+ * the validation, which touch nothing but the job. Finished jobs are picked
+ * up by the next thread to call into the node, which adds the peer and
+ * decodes the HELLO again, now from a known peer. This is the same way
+ * packets waiting on WHOIS are resumed. Workers never call back into the
+ * host, so callbacks still only happen on threads the host calls in on.
+ */
+class CryptoWorkers
+{
+public:
+	/**
+	 * @param renv Runtime environment
+	 */
+	CryptoWorkers(const RuntimeEnvironment *renv);
+	~CryptoWorkers();
+
+	/**
+	 * Start or stop worker threads
+	 *
+	 * Stopping lets the workers finish jobs already queued. Workers are
+	 * restarted if the number of threads or their CPUs change.
+	 *
+	 * @param threads Number of threads or 0 to do this work inline
+	 * @param cpus CPUs to pin workers to, one each in turn, or empty to leave them unpinned
+	 */
+	void setThreads(unsigned int threads,const std::vector<unsigned int> &cpus);
+
+	/**
+	 * @return Number of worker threads running
+	 */
+	inline unsigned int threads()
+	{
+		Mutex::Lock _tl(_threads_m);
+		return (unsigned int)_threads.size();
+	}
+
+	/**
+	 * Hand a HELLO from a new peer to the workers
+	 *
+	 * A HELLO from an address that already has a job is dropped, as is one
+	 * that finds the queue full. The peer will say HELLO again.
+	 *
+	 * @param packet HELLO packet, not yet authenticated
+	 * @param id Identity it carries
+	 * @param knownValid If true the identity is in the validation cache and only needs agreement
+	 * @param now Current time
+	 * @return False if no workers are running and the caller should do this itself
+	 */
+	bool submit(const IncomingPacket &packet,const Identity &id,bool knownValid,int64_t now);
+
+	/**
+	 * Finish HELLOs whose jobs are done
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 */
+	void drain(void *tPtr);
+
+	/**
+	 * @return True if any jobs are queued, running or waiting for drain()
+	 */
+	inline bool pending() const { return (_outstanding.load() != 0); }
+
+private:
+	struct _Job
+	{
+		IncomingPacket packet;
+		Identity id;
+		int64_t now;
+		bool knownValid;
+		bool authentic;
+		bool valid;
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+	};
+
+	void _threadMain(int cpu);
+
+	const RuntimeEnvironment *const RR;
+
+	std::vector< std::thread > _threads;
+	std::vector< unsigned int > _cpus;
+	Mutex _threads_m;
+
+	std::deque< _Job * > _queue;
+	std::vector< _Job * > _done;
+	Hashtable< Address,bool > _inFlight;
+	unsigned int _running;
+	bool _stop;
+	std::mutex _lock;
+	std::condition_variable _wake;
+
+	std::atomic<unsigned int> _outstanding;
+	std::atomic<unsigned int> _doneCount;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -33,6 +33,10 @@
 #include "Address.hpp"
 
 #include <stdint.h>
+#include <string.h>
+
+// Keys an Index locates, lookups of any later keys fall back to a linear search
+#define ZT_DICTIONARY_INDEX_MAX_ENTRIES 64
 
 namespace ZeroTier {
 
@@ -48,7 +52,8 @@ namespace ZeroTier {
  * contains these characters it may not be retrievable. This is not checked.
  *
  * Lookup is via linear search and will be slow with a lot of keys. It's
- * designed for small things.
+ * designed for small things. Use an Index to get many keys from a large
+ * dictionary.
  *
  * There is code to test and fuzz this in selftest.cpp. Fuzzing a blob of
  * pointer tricks like this is important after any modifications.
@@ -151,8 +156,6 @@ public:
 		const char *p = _d;
 		const char *const eof = p + C;
 		const char *k;
-		bool esc;
-		int j;
 
 		if (!destlen) // sanity check
 			return -1;
@@ -169,41 +172,9 @@ public:
 				}
 			}
 
-			if ((!*k)&&(*p == '=')) {
-				j = 0;
-				esc = false;
-				++p;
-				while ((*p != 0)&&(*p != 13)&&(*p != 10)) {
-					if (esc) {
-						esc = false;
-						switch(*p) {
-							case 'r': dest[j++] = 13; break;
-							case 'n': dest[j++] = 10; break;
-							case '0': dest[j++] = (char)0; break;
-							case 'e': dest[j++] = '='; break;
-							default: dest[j++] = *p; break;
-						}
-						if (j == (int)destlen) {
-							dest[j-1] = (char)0;
-							return j-1;
-						}
-					} else if (*p == '\\') {
-						esc = true;
-					} else {
-						dest[j++] = *p;
-						if (j == (int)destlen) {
-							dest[j-1] = (char)0;
-							return j-1;
-						}
-					}
-					if (++p == eof) {
-						dest[0] = (char)0;
-						return -1;
-					}
-				}
-				dest[j] = (char)0;
-				return j;
-			} else {
+			if ((!*k)&&(*p == '='))
+				return _unescape(p + 1,eof,dest,destlen);
+			else {
 				while ((*p)&&(*p != 13)&&(*p != 10)) {
 					if (++p == eof) {
 						dest[0] = (char)0;
@@ -448,7 +419,261 @@ public:
 	inline const char *data() const { return _d; }
 	inline char *unsafeData() { return _d; }
 
+	/**
+	 * Locations of a dictionary's keys, found in one pass
+	 *
+	 * Dictionary::get() scans from the start for every key, so decoding a lot
+	 * of keys from a large dictionary like a network config costs keys times
+	 * size. An Index finds all keys once and then unescapes values on demand
+	 * directly from the dictionary into the caller's buffer. It refers to the
+	 * dictionary or text it was built from, which must not be changed or
+	 * destroyed while the index is in use. Results are the same as
+	 * Dictionary::get().
+	 */
+	class Index
+	{
+	public:
+		Index(const Dictionary &d) :
+			_d(d._d),
+			_size(C),
+			_count(0),
+			_rest(C)
+		{
+			_build();
+		}
+
+		/**
+		 * Index dictionary text held somewhere other than a Dictionary
+		 *
+		 * @param s Dictionary text
+		 * @param size Size of s in bytes including its terminating 0 (like a Dictionary's capacity)
+		 */
+		Index(const char *s,const unsigned int size) :
+			_d(s),
+			_size(size),
+			_count(0),
+			_rest(size)
+		{
+			_build();
+		}
+
+		/**
+		 * Get an entry (see Dictionary::get())
+		 *
+		 * @param key Key to look up
+		 * @param dest Destination buffer
+		 * @param destlen Size of destination buffer
+		 * @return -1 if not found, or actual number of bytes stored in dest[] minus trailing 0
+		 */
+		inline int get(const char *key,char *dest,unsigned int destlen) const
+		{
+			if (!destlen) // sanity check
+				return -1;
+			const int v = _find(key);
+			if (v >= 0)
+				return _unescape(_d + v,_d + _size,dest,destlen);
+			dest[0] = (char)0;
+			return -1;
+		}
+
+		/**
+		 * Get an entry's value as it is stored, without unescaping it
+		 *
+		 * @param key Key to look up
+		 * @param value Set to the start of the value if found
+		 * @return -1 if not found, or length of the stored value, which is never less than its unescaped length
+		 */
+		inline int getEscaped(const char *key,const char *&value) const
+		{
+			const int v = _find(key);
+			if (v < 0)
+				return -1;
+			value = _d + v;
+			unsigned int i = (unsigned int)v;
+			while ((i < _size)&&(_d[i])&&(_d[i] != 13)&&(_d[i] != 10))
+				++i;
+			return (int)(i - (unsigned int)v);
+		}
+
+		/**
+		 * Get the contents of a key into a buffer
+		 *
+		 * @param key Key to get
+		 * @param dest Destination buffer
+		 * @return True if key was found (if false, dest will be empty)
+		 * @tparam BC Buffer capacity (usually inferred)
+		 */
+		template<unsigned int BC>
+		inline bool get(const char *key,Buffer<BC> &dest) const
+		{
+			const int r = this->get(key,const_cast<char *>(reinterpret_cast<const char *>(dest.data())),BC);
+			if (r >= 0) {
+				dest.setSize((unsigned int)r);
+				return true;
+			} else {
+				dest.clear();
+				return false;
+			}
+		}
+
+		/**
+		 * @param key Key to look up
+		 * @param dfl Default value if not found in dictionary
+		 * @return Boolean value of key or 'dfl' if not found
+		 */
+		inline bool getB(const char *key,bool dfl = false) const
+		{
+			char tmp[4];
+			if (this->get(key,tmp,sizeof(tmp)) >= 0)
+				return ((*tmp == '1')||(*tmp == 't')||(*tmp == 'T'));
+			return dfl;
+		}
+
+		/**
+		 * @param key Key to look up
+		 * @param dfl Default value or 0 if unspecified
+		 * @return Decoded hex UInt value or 'dfl' if not found
+		 */
+		inline uint64_t getUI(const char *key,uint64_t dfl = 0) const
+		{
+			char tmp[128];
+			if (this->get(key,tmp,sizeof(tmp)) >= 1)
+				return Utils::hexStrToU64(tmp);
+			return dfl;
+		}
+
+		/**
+		 * @param key Key to look up
+		 * @param dfl Default value or 0 if unspecified
+		 * @return Decoded hex int value or 'dfl' if not found
+		 */
+		inline int64_t getI(const char *key,int64_t dfl = 0) const
+		{
+			char tmp[128];
+			if (this->get(key,tmp,sizeof(tmp)) >= 1)
+				return Utils::hexStrTo64(tmp);
+			return dfl;
+		}
+
+		/**
+		 * @param key Key to check
+		 * @return True if key is present
+		 */
+		inline bool contains(const char *key) const
+		{
+			char tmp[2];
+			return (this->get(key,tmp,2) >= 0);
+		}
+
+		/**
+		 * @return Number of keys indexed
+		 */
+		inline unsigned int size() const { return _count; }
+
+	private:
+		struct _Entry
+		{
+			unsigned int key;
+			unsigned int keyLen;
+			unsigned int value;
+		};
+
+		inline void _build()
+		{
+			unsigned int i = 0;
+			while ((i < _size)&&(_d[i])) {
+				const unsigned int k = i;
+				while ((i < _size)&&(_d[i])&&(_d[i] != 13)&&(_d[i] != 10)&&(_d[i] != '='))
+					++i;
+				if ((i < _size)&&(_d[i] == '=')) {
+					if (_count == ZT_DICTIONARY_INDEX_MAX_ENTRIES) {
+						_rest = k;
+						return;
+					}
+					_e[_count].key = k;
+					_e[_count].keyLen = i - k;
+					_e[_count].value = i + 1;
+					++_count;
+				}
+				while ((i < _size)&&(_d[i])&&(_d[i] != 13)&&(_d[i] != 10))
+					++i;
+				if ((i < _size)&&(_d[i]))
+					++i;
+			}
+			_rest = _size;
+		}
+
+		// Position of key's value, or -1 if not found
+		inline int _find(const char *key) const
+		{
+			const unsigned int kl = (unsigned int)strlen(key);
+			for(unsigned int i=0;i<_count;++i) {
+				if ((_e[i].keyLen == kl)&&(!memcmp(_d + _e[i].key,key,kl)))
+					return (int)_e[i].value;
+			}
+
+			// Keys past what fits in the index are looked for the slow way
+			unsigned int i = _rest;
+			while ((i < _size)&&(_d[i])) {
+				const unsigned int k = i;
+				while ((i < _size)&&(_d[i])&&(_d[i] != 13)&&(_d[i] != 10)&&(_d[i] != '='))
+					++i;
+				if ((i < _size)&&(_d[i] == '=')&&((i - k) == kl)&&(!memcmp(_d + k,key,kl)))
+					return (int)(i + 1);
+				while ((i < _size)&&(_d[i])&&(_d[i] != 13)&&(_d[i] != 10))
+					++i;
+				if ((i < _size)&&(_d[i]))
+					++i;
+			}
+			return -1;
+		}
+
+		const char *const _d;
+		const unsigned int _size;
+		unsigned int _count;
+		unsigned int _rest; // where keys that didn't fit in the index start, or _size if there are none
+		_Entry _e[ZT_DICTIONARY_INDEX_MAX_ENTRIES];
+	};
+
 private:
+	// Unescape a value from p up to CR, LF or 0, returning its length or -1 if eof comes first
+	static inline int _unescape(const char *p,const char *const eof,char *dest,const unsigned int destlen)
+	{
+		int j = 0;
+		bool esc = false;
+		while (p != eof) {
+			if ((*p == 0)||(*p == 13)||(*p == 10)) {
+				dest[j] = (char)0;
+				return j;
+			}
+			if (esc) {
+				esc = false;
+				switch(*p) {
+					case 'r': dest[j++] = 13; break;
+					case 'n': dest[j++] = 10; break;
+					case '0': dest[j++] = (char)0; break;
+					case 'e': dest[j++] = '='; break;
+					default: dest[j++] = *p; break;
+				}
+				if (j == (int)destlen) {
+					dest[j-1] = (char)0;
+					return j-1;
+				}
+			} else if (*p == '\\') {
+				esc = true;
+			} else {
+				dest[j++] = *p;
+				if (j == (int)destlen) {
+					dest[j-1] = (char)0;
+					return j-1;
+				}
+			}
+			++p;
+		}
+		dest[0] = (char)0;
+		return -1;
+	}
+
 	char _d[C];
 };
 
@@ -0,0 +1,258 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "Egress.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Node.hpp"
+#include "Metrics.hpp"
+
+// EF, VOICE-ADMIT, CS5, CS6 and CS7
+#define ZT_EGRESS_DEFAULT_INTERACTIVE_DSCP ((1ULL << 46) | (1ULL << 44) | (1ULL << 40) | (1ULL << 48) | (1ULL << 56))
+
+namespace ZeroTier {
+
+Egress::Egress(const RuntimeEnvironment *renv) :
+	RR(renv),
+	_rate(0),
+	_interactiveDscp(ZT_EGRESS_DEFAULT_INTERACTIVE_DSCP),
+	_tokens(0),
+	_depth(0),
+	_lastRefill(0),
+	_lastServed(0),
+	_queuedBytes(0),
+	_lock("Egress::_lock")
+{
+}
+
+Egress::~Egress()
+{
+	_clear();
+}
+
+void Egress::setRate(uint64_t bytesPerSecond,uint64_t interactiveDscp)
+{
+	Mutex::Lock _l(_lock);
+	_interactiveDscp = (interactiveDscp) ? interactiveDscp : ZT_EGRESS_DEFAULT_INTERACTIVE_DSCP;
+	_depth = std::max((int64_t)((bytesPerSecond * ZT_EGRESS_BURST_PERIOD) / 1000),(int64_t)ZT_EGRESS_MIN_BURST);
+	_tokens.store(_depth);
+	_lastRefill = RR->node->now();
+	_rate = bytesPerSecond;
+	if (!bytesPerSecond)
+		_clear();
+}
+
+Egress::Class Egress::classify(unsigned int etherType,const void *data,unsigned int len) const
+{
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(data);
+	unsigned int dscp;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		dscp = (unsigned int)(d[1] >> 2);
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		dscp = ((unsigned int)(d[0] & 0x0f) << 2) | (unsigned int)(d[1] >> 6);
+	} else {
+		return BULK;
+	}
+	return (((_interactiveDscp >> dscp) & 1ULL) != 0) ? INTERACTIVE : BULK;
+}
+
+unsigned int Egress::trafficClass(unsigned int etherType,const void *data,unsigned int len)
+{
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(data);
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)&&((d[0] >> 4) == 4))
+		return (unsigned int)d[1];
+	if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)&&((d[0] >> 4) == 6))
+		return ((unsigned int)(d[0] & 0x0f) << 4) | (unsigned int)(d[1] >> 4);
+	return 0;
+}
+
+bool Egress::markCongestion(unsigned int etherType,void *data,unsigned int len)
+{
+	uint8_t *const d = reinterpret_cast<uint8_t *>(data);
+	const unsigned int ecn = trafficClass(etherType,data,len) & 3;
+	if ((ecn == 0)||(ecn == 3)) // Not-ECT, or already CE
+		return false;
+	if (etherType == ZT_ETHERTYPE_IPV4) {
+		// Incremental checksum update (RFC 1624) for the word holding the TOS
+		const unsigned int before = ((unsigned int)d[0] << 8) | (unsigned int)d[1];
+		d[1] |= 3;
+		const unsigned int after = ((unsigned int)d[0] << 8) | (unsigned int)d[1];
+		uint32_t sum = (uint32_t)(~(((unsigned int)d[10] << 8) | (unsigned int)d[11]) & 0xffff) + (uint32_t)(~before & 0xffff) + (uint32_t)after;
+		sum = (sum & 0xffff) + (sum >> 16);
+		sum = (sum & 0xffff) + (sum >> 16);
+		d[10] = (uint8_t)((~sum >> 8) & 0xff);
+		d[11] = (uint8_t)(~sum & 0xff);
+	} else {
+		d[1] |= 0x30;
+	}
+	return true;
+}
+
+bool Egress::send(void *tPtr,const SharedPtr<Path> &path,Class c,uint64_t nwid,void *data,unsigned int len,unsigned int mtu,int64_t now,unsigned int tos)
+{
+	bool direct;
+	{
+		Mutex::Lock _l(_lock);
+		_refill(now);
+
+		// If nothing is waiting and the uplink has room the frame skips the queue
+		direct = ((!_queuedBytes)&&(_tokens.load(std::memory_order_relaxed) >= (int64_t)len));
+		if (!direct) {
+			_Queue &q = (c == INTERACTIVE) ? _interactive : _bulk[nwid];
+			if ((q.bytes + len) > (unsigned long)((c == INTERACTIVE) ? ZT_EGRESS_MAX_INTERACTIVE_QUEUE_BYTES : ZT_EGRESS_MAX_QUEUE_BYTES)) {
+				Metrics::drop(ZT_METRICS_DROP_EGRESS_QUEUE);
+				return false;
+			}
+
+			void *const fm = ::malloc(sizeof(_Frame) + len);
+			if (!fm)
+				return false;
+			_Frame *const f = new (fm) _Frame();
+			f->path = path;
+			f->queued = now;
+			f->len = len;
+			f->mtu = mtu;
+			f->tos = tos;
+			memcpy(f->data,data,len);
+			q.frames.push_back(f);
+			q.bytes += len;
+			_queuedBytes += len;
+		}
+	}
+
+	if (direct)
+		path->sendFragmented(RR,tPtr,reinterpret_cast<uint8_t *>(data),len,mtu,now,tos);
+	else service(tPtr,now);
+	return true;
+}
+
+unsigned long Egress::service(void *tPtr,int64_t now)
+{
+	_Frame *batch[ZT_WIRE_BATCH_MAX_PACKETS];
+	for(;;) {
+		unsigned int n = 0;
+		unsigned long wait = ZT_PING_CHECK_INVERVAL;
+		{
+			Mutex::Lock _l(_lock);
+			if (!_queuedBytes)
+				return wait;
+			_refill(now);
+			int64_t tokens = _tokens.load(std::memory_order_relaxed);
+
+			while (n < ZT_WIRE_BATCH_MAX_PACKETS) {
+				// Latency-sensitive frames go first, then each network's in turn
+				_Queue *q;
+				std::map< uint64_t,_Queue >::iterator b(_bulk.end());
+				if (!_interactive.frames.empty()) {
+					q = &_interactive;
+				} else if (!_bulk.empty()) {
+					b = _bulk.upper_bound(_lastServed);
+					if (b == _bulk.end())
+						b = _bulk.begin();
+					q = &(b->second);
+				} else {
+					break;
+				}
+
+				_Frame *const f = q->frames.front();
+				const bool stale = ((now - f->queued) > ZT_EGRESS_MAX_QUEUE_DELAY);
+				if ((!stale)&&(tokens < (int64_t)f->len)) {
+					const uint64_t rate = _rate;
+					wait = (rate) ? (unsigned long)std::max((uint64_t)1,(uint64_t)((((uint64_t)((int64_t)f->len - tokens)) * 1000ULL) / rate)) : ZT_PING_CHECK_INVERVAL;
+					break;
+				}
+
+				q->frames.pop_front();
+				q->bytes -= f->len;
+				_queuedBytes -= f->len;
+				if (b != _bulk.end()) {
+					_lastServed = b->first;
+					if (b->second.frames.empty())
+						_bulk.erase(b);
+				}
+
+				if (stale) {
+					// A frame this late is more likely to confuse TCP than help it
+					Metrics::drop(ZT_METRICS_DROP_EGRESS_QUEUE);
+					f->~_Frame();
+					::free(f);
+				} else {
+					tokens -= (int64_t)f->len;
+					batch[n++] = f;
+				}
+			}
+		}
+
+		for(unsigned int i=0;i<n;++i) {
+			batch[i]->path->sendFragmented(RR,tPtr,batch[i]->data,batch[i]->len,batch[i]->mtu,now,batch[i]->tos);
+			batch[i]->~_Frame();
+			::free(batch[i]);
+		}
+
+		if (n < ZT_WIRE_BATCH_MAX_PACKETS)
+			return wait;
+	}
+}
+
+void Egress::_refill(int64_t now)
+{
+	if (now <= _lastRefill) {
+		if (now < _lastRefill) // clock went backwards
+			_lastRefill = now;
+		return;
+	}
+	const int64_t add = (int64_t)((_rate * (uint64_t)(now - _lastRefill)) / 1000ULL);
+	if (add > 0) {
+		_lastRefill = now;
+		if ((_tokens.fetch_add(add,std::memory_order_relaxed) + add) > _depth)
+			_tokens.store(_depth,std::memory_order_relaxed);
+	}
+}
+
+void Egress::_clear()
+{
+	for(std::deque<_Frame *>::iterator f(_interactive.frames.begin());f!=_interactive.frames.end();++f) {
+		(*f)->~_Frame();
+		::free(*f);
+	}
+	_interactive.frames.clear();
+	_interactive.bytes = 0;
+	for(std::map< uint64_t,_Queue >::iterator q(_bulk.begin());q!=_bulk.end();++q) {
+		for(std::deque<_Frame *>::iterator f(q->second.frames.begin());f!=q->second.frames.end();++f) {
+			(*f)->~_Frame();
+			::free(*f);
+		}
+	}
+	_bulk.clear();
+	_queuedBytes = 0;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,190 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_EGRESS_HPP
+#define ZT_EGRESS_HPP
+
+#include <stdint.h>
+
+#include <map>
+#include <deque>
+#include <atomic>
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "SharedPtr.hpp"
+#include "Path.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Egress scheduler that keeps frames from crowding out control traffic
+ *
+ * This is off until it is given the rate of the uplink. Then everything the
+ * node sends is counted against a token bucket filled at that rate. Control
+ * packets (HELLO, OK, WHOIS, network config, ECHO, etc.) always go out right
+ * away, so when the uplink is full it's frames that wait: latency-sensitive
+ * ones (chosen by DSCP) first, then the rest round-robin from one queue per
+ * network so a busy network can't starve the others. Queues are bounded in
+ * bytes and in delay, and frames that don't fit are dropped, which is what
+ * TCP inside them expects of a congested link.
+ *
+ * The rate should be a little under the real uplink rate so that the queue
+ * forms here rather than in a modem where everything shares it.
+ */
+class Egress
+{
+public:
+	enum Class
+	{
+		CONTROL = 0,     // never queued
+		INTERACTIVE = 1, // queued ahead of bulk frames
+		BULK = 2
+	};
+
+	Egress(const RuntimeEnvironment *renv);
+	~Egress();
+
+	/**
+	 * Set the uplink rate and which DSCP values mark latency-sensitive frames
+	 *
+	 * @param bytesPerSecond Rate or 0 to disable and drop anything queued
+	 * @param interactiveDscp Bit N set if DSCP N is latency-sensitive, or 0 for EF, VOICE-ADMIT and CS5 to CS7
+	 */
+	void setRate(uint64_t bytesPerSecond,uint64_t interactiveDscp);
+
+	/**
+	 * @return True if a rate is set
+	 */
+	inline bool enabled() const { return (_rate != 0); }
+
+	/**
+	 * Classify an outgoing frame by the DSCP of the IP packet inside it
+	 *
+	 * @return INTERACTIVE or BULK
+	 */
+	Class classify(unsigned int etherType,const void *data,unsigned int len) const;
+
+	/**
+	 * Get the IPv4 TOS or IPv6 traffic class of a frame
+	 *
+	 * @return DSCP in the upper six bits and ECN in the lower two, or 0 if not IP
+	 */
+	static unsigned int trafficClass(unsigned int etherType,const void *data,unsigned int len);
+
+	/**
+	 * Mark an IP frame that arrived in a CE marked datagram as congested too
+	 *
+	 * Frames that aren't ECN capable are left alone, since their endpoints
+	 * wouldn't understand the mark. The IPv4 header checksum is updated.
+	 *
+	 * @return True if the frame was changed
+	 */
+	static bool markCongestion(unsigned int etherType,void *data,unsigned int len);
+
+	/**
+	 * Count bytes going out on the wire against the token bucket
+	 *
+	 * This is called by Node::putPacket() for everything.
+	 */
+	inline void charge(unsigned int bytes)
+	{
+		if (_rate)
+			_tokens.fetch_sub((int64_t)bytes,std::memory_order_relaxed);
+	}
+
+	/**
+	 * Send an armored frame packet now if the uplink has room, otherwise queue it
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param path Path to send via
+	 * @param c Class (INTERACTIVE or BULK)
+	 * @param nwid Network ID of frame
+	 * @param data Armored packet (overwritten if sent now and fragmented)
+	 * @param len Length of packet
+	 * @param mtu Fragment size for this path
+	 * @param now Current time
+	 * @param tos IP traffic class of the frame inside
+	 * @return False if the frame was dropped because its queue was full
+	 */
+	bool send(void *tPtr,const SharedPtr<Path> &path,Class c,uint64_t nwid,void *data,unsigned int len,unsigned int mtu,int64_t now,unsigned int tos);
+
+	/**
+	 * Send queued frames that the uplink has room for
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return Milliseconds until this should be called again, or ZT_PING_CHECK_INVERVAL if nothing is queued
+	 */
+	unsigned long service(void *tPtr,int64_t now);
+
+	/**
+	 * @return Bytes currently queued
+	 */
+	inline unsigned long queuedBytes() const { return _queuedBytes; }
+
+private:
+	struct _Frame
+	{
+		SharedPtr<Path> path;
+		int64_t queued;
+		unsigned int len;
+		unsigned int mtu;
+		unsigned int tos;
+		uint8_t data[1]; // actually len bytes
+	};
+	struct _Queue
+	{
+		_Queue() : bytes(0) {}
+		std::deque<_Frame *> frames;
+		unsigned long bytes;
+	};
+
+	void _refill(int64_t now);
+	void _clear();
+
+	const RuntimeEnvironment *const RR;
+
+	volatile uint64_t _rate; // bytes per second, 0 if disabled
+	volatile uint64_t _interactiveDscp;
+	std::atomic<int64_t> _tokens;
+	int64_t _depth;
+	int64_t _lastRefill;
+
+	// Latency-sensitive frames, then bulk frames by network ID served
+	// round-robin starting after _lastServed
+	_Queue _interactive;
+	std::map< uint64_t,_Queue > _bulk;
+	uint64_t _lastServed;
+	volatile unsigned long _queuedBytes;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_EPOCH_HPP
+#define ZT_EPOCH_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+
+namespace ZeroTier {
+
+/**
+ * Epoch based reclamation for structures that are read without locks
+ *
+ * Writers never modify such a structure in place. They publish a new copy
+ * through an atomic pointer, call retire() to get an epoch for the old
+ * copy, and free it once safe() says every read that might still be using
+ * it has finished. Readers hold a Guard for as long as they use anything
+ * they loaded from the structure. Entering and leaving a guard only writes
+ * the calling thread's own slot, so readers never share a cache line with
+ * each other, and a writer never waits on them.
+ */
+class Epoch
+{
+private:
+	struct _Slot;
+
+public:
+	/**
+	 * Read side critical section (may be nested, must not move between threads)
+	 */
+	class Guard
+	{
+	public:
+		Guard() :
+			_s(_local())
+		{
+			if (!_s.depth++) {
+				_s.active.store(_registry().epoch.load(std::memory_order_acquire),std::memory_order_relaxed);
+				// Pairs with the fence in safe(): either the writer sees this slot
+				// active or this thread sees whatever was published before retire()
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+
+		~Guard()
+		{
+			if (!--_s.depth)
+				_s.active.store(0,std::memory_order_release);
+		}
+
+	private:
+		Guard(const Guard &) : _s(_local()) {}
+		const Guard &operator=(const Guard &) { return *this; }
+
+		_Slot &_s;
+	};
+
+	/**
+	 * Begin retirement of structures unpublished before this call
+	 *
+	 * @return Epoch to pass to safe()
+	 */
+	static inline uint64_t retire() { return _registry().epoch.fetch_add(1,std::memory_order_seq_cst); }
+
+	/**
+	 * @param e Epoch returned by retire()
+	 * @return True if no guard that was entered at or before this epoch is still held
+	 */
+	static inline bool safe(const uint64_t e)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		_Registry &r = _registry();
+		Mutex::Lock _l(r.lock);
+		for(std::vector<_Slot *>::const_iterator s(r.slots.begin());s!=r.slots.end();++s) {
+			const uint64_t a = (*s)->active.load(std::memory_order_acquire);
+			if ((a)&&(a <= e))
+				return false;
+		}
+		return true;
+	}
+
+private:
+	struct _Slot
+	{
+		_Slot() :
+			depth(0)
+		{
+			active.store(0,std::memory_order_relaxed);
+			_Registry &r = _registry();
+			Mutex::Lock _l(r.lock);
+			r.slots.push_back(this);
+		}
+
+		~_Slot()
+		{
+			_Registry &r = _registry();
+			Mutex::Lock _l(r.lock);
+			for(std::vector<_Slot *>::iterator s(r.slots.begin());s!=r.slots.end();++s) {
+				if (*s == this) {
+					r.slots.erase(s);
+					break;
+				}
+			}
+		}
+
+		std::atomic<uint64_t> active; // epoch when outermost guard was entered or 0 if none is held
+		unsigned int depth;
+	};
+
+	struct _Registry
+	{
+		_Registry() { epoch.store(1,std::memory_order_relaxed); }
+		std::atomic<uint64_t> epoch;
+		Mutex lock;
+		std::vector<_Slot *> slots;
+	};
+
+	static inline _Registry &_registry()
+	{
+		// Never destroyed, since thread-local slots may outlive static destructors
+		static _Registry *const r = new _Registry();
+		return *r;
+	}
+
+	static inline _Slot &_local()
+	{
+		static thread_local _Slot s;
+		return s;
+	}
+};
+
+} // namespace ZeroTier
+
+#endif
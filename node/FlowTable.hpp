@@ -0,0 +1,273 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_FLOWTABLE_HPP
+#define ZT_FLOWTABLE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "../include/ZeroTierOne.h"
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "Address.hpp"
+#include "InetAddress.hpp"
+#include "Hashtable.hpp"
+
+// Most flows a network tracks at once, sampled frames of new flows are dropped beyond this
+#define ZT_FLOWTABLE_MAX_FLOWS 4096
+
+// A flow with no sampled frames for this long (ms) is ended and exported
+#define ZT_FLOWTABLE_IDLE_TIMEOUT 15000
+
+// A flow still going after this long (ms) is exported and its counts start over
+#define ZT_FLOWTABLE_ACTIVE_TIMEOUT 60000
+
+namespace ZeroTier {
+
+/**
+ * Sampled flows through a network's rules for export as flow records
+ *
+ * Flows are counted after filtering in either direction, so frames the
+ * rules dropped are seen as well as those delivered. A flow is its members,
+ * direction, Ethernet type, IP addresses, protocol and ports, and verdict.
+ * One in sampleRate() frames is counted on each thread, decided before
+ * anything is parsed or locked, and sampling is off (rate 0) until an
+ * exporter turns it on. Records of ended flows are taken with expire().
+ */
+class FlowTable
+{
+public:
+	FlowTable() :
+		_flows(64),
+		_lock("FlowTable")
+	{
+	}
+
+	/**
+	 * @param rate Count one in this many frames per thread, or 0 to count none
+	 */
+	static inline void setSampleRate(const unsigned int rate) { _rate().store(rate,std::memory_order_relaxed); }
+
+	/**
+	 * @return Current sample rate or 0 if off
+	 */
+	static inline unsigned int sampleRate() { return _rate().load(std::memory_order_relaxed); }
+
+	/**
+	 * @return True if the caller should count this frame (cheap, per thread)
+	 */
+	static inline bool sample()
+	{
+		const unsigned int r = _rate().load(std::memory_order_relaxed);
+		if (!r)
+			return false;
+		static thread_local unsigned int n = 0;
+		if (++n < r)
+			return false;
+		n = 0;
+		return true;
+	}
+
+	/**
+	 * Count a sampled frame
+	 *
+	 * @param now Current time
+	 * @param outbound True if frame came from our tap, false if it arrived from a member
+	 * @param ztSource Member frame is from
+	 * @param ztDest Member frame is to
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload
+	 * @param len Frame payload length
+	 * @param accepted True if rules let the frame through
+	 */
+	inline void frame(const int64_t now,const bool outbound,const Address &ztSource,const Address &ztDest,const unsigned int etherType,const void *data,const unsigned int len,const bool accepted)
+	{
+		_Key k;
+		k.set(outbound,ztSource,ztDest,etherType,reinterpret_cast<const uint8_t *>(data),len,accepted);
+		Mutex::Lock _l(_lock);
+		_Flow *f = _flows.get(k);
+		if (!f) {
+			if (_flows.size() >= ZT_FLOWTABLE_MAX_FLOWS)
+				return;
+			f = &(_flows[k]);
+			f->start = now;
+			f->packets = 0;
+			f->bytes = 0;
+		}
+		f->end = now;
+		++f->packets;
+		f->bytes += len;
+	}
+
+	/**
+	 * Take records of flows that have ended or been active for too long
+	 *
+	 * Records that don't fit are left for the next call.
+	 *
+	 * @param nwid Network ID to put in records
+	 * @param now Current time
+	 * @param records Buffer to fill
+	 * @param maxRecords Size of buffer
+	 * @return Number of records filled
+	 */
+	inline unsigned int expire(const uint64_t nwid,const int64_t now,ZT_FlowRecord *records,const unsigned int maxRecords)
+	{
+		const unsigned int rate = sampleRate();
+		unsigned int n = 0;
+		Mutex::Lock _l(_lock);
+		Hashtable<_Key,_Flow>::Iterator i(_flows);
+		_Key *k = (_Key *)0;
+		_Flow *f = (_Flow *)0;
+		while ((n < maxRecords)&&(i.next(k,f))) {
+			const bool idle = ((now - f->end) >= ZT_FLOWTABLE_IDLE_TIMEOUT);
+			if ((idle)||((now - f->start) >= ZT_FLOWTABLE_ACTIVE_TIMEOUT)) {
+				k->get(nwid,records[n]);
+				records[n].start = f->start;
+				records[n].end = f->end;
+				records[n].packets = f->packets;
+				records[n].bytes = f->bytes;
+				records[n].sampleRate = (rate) ? rate : 1;
+				++n;
+				if (idle) {
+					_flows.erase(*k);
+				} else {
+					f->start = now;
+					f->packets = 0;
+					f->bytes = 0;
+				}
+			}
+		}
+		return n;
+	}
+
+	/**
+	 * @return Number of flows being tracked
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _flows.size();
+	}
+
+private:
+	static inline std::atomic<unsigned int> &_rate()
+	{
+		static std::atomic<unsigned int> r(0);
+		return r;
+	}
+
+	// Compared as raw bytes, so it's zeroed before anything is set
+	struct _Key
+	{
+		inline void set(const bool outbound,const Address &zs,const Address &zd,const unsigned int et,const uint8_t *d,const unsigned int len,const bool accepted)
+		{
+			memset(this,0,sizeof(_Key));
+			ztSource = zs.toInt();
+			ztDest = zd.toInt();
+			etherType = (uint16_t)et;
+			flags = (uint8_t)((outbound ? 0x01 : 0) | (accepted ? 0x02 : 0));
+			unsigned int l4 = 0;
+			if ((et == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+				ipLen = 4;
+				memcpy(ipSource,d + 12,4);
+				memcpy(ipDest,d + 16,4);
+				protocol = d[9];
+				if ((((unsigned int)(d[6] & 0x1f) << 8) | (unsigned int)d[7]) == 0) // only the first fragment has ports
+					l4 = (unsigned int)(d[0] & 0xf) * 4;
+			} else if ((et == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+				ipLen = 16;
+				memcpy(ipSource,d + 8,16);
+				memcpy(ipDest,d + 24,16);
+				protocol = d[6];
+				l4 = 40;
+			}
+			if ((l4)&&((protocol == 6)||(protocol == 17)||(protocol == 132))&&((l4 + 4) <= len)) {
+				sourcePort = (uint16_t)(((unsigned int)d[l4] << 8) | (unsigned int)d[l4 + 1]);
+				destPort = (uint16_t)(((unsigned int)d[l4 + 2] << 8) | (unsigned int)d[l4 + 3]);
+			}
+		}
+
+		inline void get(const uint64_t nwid,ZT_FlowRecord &r) const
+		{
+			memset(&r,0,sizeof(ZT_FlowRecord));
+			r.networkId = nwid;
+			r.source = ztSource;
+			r.destination = ztDest;
+			r.etherType = etherType;
+			if (ipLen) {
+				reinterpret_cast<InetAddress *>(&(r.sourceIp))->set(ipSource,ipLen,sourcePort);
+				reinterpret_cast<InetAddress *>(&(r.destinationIp))->set(ipDest,ipLen,destPort);
+			}
+			r.protocol = protocol;
+			r.outbound = ((flags & 0x01) != 0) ? 1 : 0;
+			r.accepted = ((flags & 0x02) != 0) ? 1 : 0;
+		}
+
+		inline unsigned long hashCode() const
+		{
+			uint64_t h = 0xcbf29ce484222325ULL;
+			const uint8_t *const b = reinterpret_cast<const uint8_t *>(this);
+			for(unsigned int i=0;i<sizeof(_Key);++i)
+				h = (h ^ (uint64_t)b[i]) * 0x100000001b3ULL;
+			return (unsigned long)h;
+		}
+
+		inline bool operator==(const _Key &k) const { return (memcmp(this,&k,sizeof(_Key)) == 0); }
+		inline bool operator!=(const _Key &k) const { return (memcmp(this,&k,sizeof(_Key)) != 0); }
+
+		uint64_t ztSource;
+		uint64_t ztDest;
+		uint8_t ipSource[16];
+		uint8_t ipDest[16];
+		uint16_t sourcePort;
+		uint16_t destPort;
+		uint16_t etherType;
+		uint8_t protocol;
+		uint8_t ipLen;
+		uint8_t flags; // 0x01 outbound, 0x02 accepted
+		uint8_t pad[7];
+	};
+
+	struct _Flow
+	{
+		int64_t start;
+		int64_t end;
+		uint64_t packets;
+		uint64_t bytes;
+	};
+
+	Hashtable<_Key,_Flow> _flows;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
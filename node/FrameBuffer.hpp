@@ -0,0 +1,162 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_FRAMEBUFFER_HPP
+#define ZT_FRAMEBUFFER_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "MAC.hpp"
+#include "Packet.hpp"
+#include "IncomingPacket.hpp"
+#include "ObjectPool.hpp"
+
+#include "../include/ZeroTierOne.h"
+
+#if ZT_FRAME_BUFFER_SIZE != ZT_PROTO_MAX_PACKET_LENGTH
+#error ZT_FRAME_BUFFER_SIZE must equal ZT_PROTO_MAX_PACKET_LENGTH
+#endif
+#if ZT_FRAME_BUFFER_HEADROOM != ZT_PROTO_VERB_FRAME_IDX_PAYLOAD
+#error ZT_FRAME_BUFFER_HEADROOM must equal ZT_PROTO_VERB_FRAME_IDX_PAYLOAD
+#endif
+
+namespace ZeroTier {
+
+/**
+ * A ZT_FrameBuffer and the packet whose storage it exposes
+ *
+ * External code sees the public struct this derives from, which describes
+ * a range of the packet's buffer. Frames sent from one are written right
+ * behind the room for a VERB_FRAME header, so the packet can be built and
+ * encrypted around them. Packets received into one are decoded in place,
+ * and a frame in one can then be held and handed back to external code in
+ * the same buffer once decoding is done and nothing else refers to it.
+ */
+class FrameBuffer : public ZT_FrameBuffer
+{
+public:
+	FrameBuffer() :
+		packet(),
+		_held(false)
+	{
+		_set(ZT_FRAME_BUFFER_HEADROOM,0);
+	}
+
+	static inline void *operator new(std::size_t size) { return ObjectPool<FrameBuffer>::allocate(size); }
+	static inline void operator delete(void *p,std::size_t size) { ObjectPool<FrameBuffer>::release(p,size); }
+
+	/**
+	 * @param fb Buffer given to external code
+	 * @return Buffer it was allocated as
+	 */
+	static inline FrameBuffer *from(ZT_FrameBuffer *fb) { return static_cast<FrameBuffer *>(fb); }
+
+	/**
+	 * @return True if external code left data, length, headroom and tailroom describing the same range of this buffer
+	 */
+	inline bool valid() const
+	{
+		return ( (headroom <= ZT_FRAME_BUFFER_SIZE) && (length <= (ZT_FRAME_BUFFER_SIZE - headroom)) && (tailroom == (ZT_FRAME_BUFFER_SIZE - headroom - length)) && (data == (void *)(_start() + headroom)) );
+	}
+
+	/**
+	 * Move data to the start of the buffer, which costs a copy unless it's already there
+	 */
+	inline void toStart()
+	{
+		if (headroom) {
+			memmove(_start(),data,length);
+			_set(0,length);
+		}
+	}
+
+	/**
+	 * Hold a frame in this buffer to be lent to external code after decoding
+	 *
+	 * @param nwid Network ID
+	 * @param nuptr Network's user pointer
+	 * @param from Source MAC
+	 * @param to Destination MAC
+	 * @param etherType Ethernet frame type
+	 * @param frame Frame data, which must be within this buffer's packet
+	 * @param len Frame length
+	 */
+	inline void hold(const uint64_t nwid,void **nuptr,const MAC &from,const MAC &to,const unsigned int etherType,const void *frame,const unsigned int len)
+	{
+		_held = true;
+		_nwid = nwid;
+		_nuptr = nuptr;
+		_from = from;
+		_to = to;
+		_etherType = etherType;
+		_frameOffset = (unsigned int)(reinterpret_cast<const uint8_t *>(frame) - _start());
+		_frameLength = len;
+	}
+
+	/**
+	 * Point data at the held frame before handing this buffer over
+	 */
+	inline void lend() { _set(_frameOffset,_frameLength); }
+
+	inline bool held() const { return _held; }
+	inline uint64_t heldNetworkId() const { return _nwid; }
+	inline void **heldNetworkUserPtr() const { return _nuptr; }
+	inline const MAC &heldFrom() const { return _from; }
+	inline const MAC &heldTo() const { return _to; }
+	inline unsigned int heldEtherType() const { return _etherType; }
+
+	/**
+	 * Packet whose buffer this is
+	 */
+	IncomingPacket packet;
+
+private:
+	inline uint8_t *_start() const { return reinterpret_cast<uint8_t *>(const_cast<IncomingPacket &>(packet).unsafeData()); }
+
+	inline void _set(const unsigned int h,const unsigned int l)
+	{
+		data = _start() + h;
+		length = l;
+		headroom = h;
+		tailroom = ZT_FRAME_BUFFER_SIZE - (h + l);
+	}
+
+	bool _held;
+	uint64_t _nwid;
+	void **_nuptr;
+	MAC _from;
+	MAC _to;
+	unsigned int _etherType;
+	unsigned int _frameOffset;
+	unsigned int _frameLength;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,431 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_FRAMECAPTURE_HPP
+#define ZT_FRAMECAPTURE_HPP
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "MAC.hpp"
+#include "InetAddress.hpp"
+#include "Path.hpp"
+#include "Utils.hpp"
+
+#include "../version.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Default and maximum number of frames kept
+#define ZT_FRAME_CAPTURE_DEFAULT_FRAMES 4096
+#define ZT_FRAME_CAPTURE_MAX_FRAMES 65536
+
+// Default bytes of each frame kept, counting the reconstructed Ethernet header
+#define ZT_FRAME_CAPTURE_DEFAULT_SNAPLEN 256
+
+// Maximum bytes of each frame kept (full header, VLAN tag and MTU)
+#define ZT_FRAME_CAPTURE_MAX_SNAPLEN (ZT_MAX_MTU + 18)
+
+// Limit on memory used for frame data, which caps frames * snapLength
+#define ZT_FRAME_CAPTURE_MAX_BYTES 67108864
+
+namespace ZeroTier {
+
+/**
+ * Ring of recent virtual network frames and what the core decided about them
+ *
+ * Frames are recorded where they enter the core, before rules are applied,
+ * along with the verdict, the remote peer and for received frames the
+ * physical path. This sees frames that never reach the tap, unlike a
+ * capture on the tap itself. When the ring is full the oldest frame is
+ * overwritten. pcapng() writes the ring in a form Wireshark and tcpdump
+ * can read, with one interface per network and the metadata in comments.
+ *
+ * Capture is process-wide and off until configure() is called. While off,
+ * Frame costs one relaxed atomic load and allocates nothing.
+ */
+class FrameCapture
+{
+public:
+	enum Verdict
+	{
+		VERDICT_ACCEPT = 0,
+		VERDICT_DROP_FILTER = 1, // dropped by network rules
+		VERDICT_DROP = 2         // dropped for any other reason
+	};
+
+	/**
+	 * A frame being handled, recorded when this goes out of scope
+	 *
+	 * The frame's data must remain valid until then.
+	 */
+	class Frame
+	{
+	public:
+		Frame(const int64_t now,const uint64_t nwid,const bool outbound,const MAC &from,const MAC &to,const unsigned int etherType,const unsigned int vlanId,const void *data,const unsigned int len) :
+			_active(FrameCapture::capturing(nwid))
+		{
+			if (_active) {
+				_now = now;
+				_nwid = nwid;
+				_from = from.toInt();
+				_to = to.toInt();
+				_data = data;
+				_len = len;
+				_etherType = (uint16_t)etherType;
+				_vlanId = (uint16_t)vlanId;
+				_outbound = outbound;
+				_peer = 0;
+				_path = (const Path *)0;
+				_verdict = VERDICT_ACCEPT;
+				_reason = (const char *)0;
+			}
+		}
+
+		~Frame()
+		{
+			if (_active)
+				FrameCapture::_record(*this);
+		}
+
+		/**
+		 * @param a ZeroTier address of the peer this frame came from or is going to
+		 */
+		inline void peer(const uint64_t a) { if (_active) _peer = a; }
+
+		/**
+		 * @param p Physical path this frame arrived on (must remain valid until this is destroyed)
+		 */
+		inline void path(const Path *p) { if (_active) _path = p; }
+
+		/**
+		 * @param v Verdict
+		 * @param reason Reason for a drop (static string) or NULL
+		 */
+		inline void verdict(const Verdict v,const char *reason) { if (_active) { _verdict = v; _reason = reason; } }
+
+	private:
+		friend class FrameCapture;
+
+		Frame(const Frame &) : _active(false) {}
+		inline Frame &operator=(const Frame &) { return *this; }
+
+		const bool _active;
+		bool _outbound;
+		uint16_t _etherType;
+		uint16_t _vlanId;
+		int64_t _now;
+		uint64_t _nwid;
+		uint64_t _from;
+		uint64_t _to;
+		uint64_t _peer;
+		const void *_data;
+		unsigned int _len;
+		const Path *_path;
+		Verdict _verdict;
+		const char *_reason;
+	};
+
+	/**
+	 * @param nwid Network ID
+	 * @return True if frames on this network are being captured
+	 */
+	static inline bool capturing(const uint64_t nwid)
+	{
+		if (!_state().enabled.load(std::memory_order_relaxed))
+			return false;
+		const uint64_t f = _state().nwid.load(std::memory_order_relaxed);
+		return ((!f)||(f == nwid));
+	}
+
+	/**
+	 * Start, restart or stop capture, discarding anything already captured
+	 *
+	 * @param nwid Network to capture or 0 for all networks
+	 * @param maxFrames Frames to keep (0 stops capture and frees memory)
+	 * @param snapLength Maximum bytes of each frame to keep including its Ethernet header
+	 */
+	static inline void configure(const uint64_t nwid,unsigned int maxFrames,unsigned int snapLength)
+	{
+		_State &s = _state();
+		Mutex::Lock _l(s.lock);
+		s.enabled.store(false,std::memory_order_relaxed);
+		delete [] s.slots;
+		delete [] s.data;
+		s.slots = (_Slot *)0;
+		s.data = (uint8_t *)0;
+		s.next = 0;
+		s.count = 0;
+		s.overwritten = 0;
+		if (!maxFrames)
+			return;
+		if (!snapLength)
+			snapLength = ZT_FRAME_CAPTURE_DEFAULT_SNAPLEN;
+		snapLength = std::max(14U,std::min(snapLength,(unsigned int)ZT_FRAME_CAPTURE_MAX_SNAPLEN));
+		maxFrames = std::min(std::min(maxFrames,(unsigned int)ZT_FRAME_CAPTURE_MAX_FRAMES),(unsigned int)(ZT_FRAME_CAPTURE_MAX_BYTES / snapLength));
+		s.slots = new _Slot[maxFrames];
+		s.data = new uint8_t[(unsigned long)maxFrames * (unsigned long)snapLength];
+		s.maxFrames = maxFrames;
+		s.snapLength = snapLength;
+		s.nwid.store(nwid,std::memory_order_relaxed);
+		s.enabled.store(true,std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get capture status
+	 *
+	 * @param nwid Set to network being captured or 0 for all
+	 * @param maxFrames Set to ring size in frames or 0 if not capturing
+	 * @param snapLength Set to maximum bytes kept per frame
+	 * @param frames Set to frames currently in ring
+	 * @param overwritten Set to frames lost because the ring was full
+	 * @return True if capturing
+	 */
+	static inline bool status(uint64_t &nwid,unsigned int &maxFrames,unsigned int &snapLength,unsigned int &frames,uint64_t &overwritten)
+	{
+		_State &s = _state();
+		Mutex::Lock _l(s.lock);
+		const bool on = s.enabled.load(std::memory_order_relaxed);
+		nwid = (on) ? s.nwid.load(std::memory_order_relaxed) : 0;
+		maxFrames = (on) ? s.maxFrames : 0;
+		snapLength = (on) ? s.snapLength : 0;
+		frames = s.count;
+		overwritten = s.overwritten;
+		return on;
+	}
+
+	/**
+	 * Append captured frames to a buffer as a pcapng section, oldest first
+	 *
+	 * @param out Buffer to append to
+	 * @param clear If true remove frames from the ring after writing them
+	 * @return Number of frames written
+	 */
+	static inline unsigned int pcapng(std::string &out,const bool clear)
+	{
+		_State &s = _state();
+		Mutex::Lock _l(s.lock);
+
+		// Section header block with the application name
+		const unsigned int shbStart = _blockStart(out,0x0a0d0d0a);
+		_u32(out,0x1a2b3c4d);
+		_u16(out,1);
+		_u16(out,0);
+		_u32(out,0xffffffff); // section length unknown (-1)
+		_u32(out,0xffffffff);
+		char appName[64];
+		snprintf(appName,sizeof(appName),"ZeroTier One %d.%d.%d",ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION);
+		_option(out,4,appName,(unsigned int)strlen(appName)); // shb_userappl
+		_option(out,0,(const void *)0,0);
+		_blockEnd(out,shbStart);
+
+		if (!s.slots)
+			return 0;
+
+		std::vector<uint64_t> interfaces;
+		const unsigned int first = (s.next + s.maxFrames - s.count) % s.maxFrames;
+		for(unsigned int k=0;k<s.count;++k) {
+			const unsigned int i = (first + k) % s.maxFrames;
+			const _Slot &f = s.slots[i];
+
+			// Interface description block for each network the first time it appears
+			uint32_t ifIndex = 0;
+			while ((ifIndex < interfaces.size())&&(interfaces[ifIndex] != f.nwid))
+				++ifIndex;
+			if (ifIndex == interfaces.size()) {
+				interfaces.push_back(f.nwid);
+				const unsigned int idbStart = _blockStart(out,0x00000001);
+				_u16(out,1); // LINKTYPE_ETHERNET
+				_u16(out,0);
+				_u32(out,s.snapLength);
+				char ifName[17];
+				_option(out,2,Utils::hex(f.nwid,ifName),16); // if_name
+				const uint8_t tsresol = 3; // milliseconds
+				_option(out,9,&tsresol,1); // if_tsresol
+				_option(out,0,(const void *)0,0);
+				_blockEnd(out,idbStart);
+			}
+
+			// Enhanced packet block with direction and a comment with the metadata
+			const unsigned int epbStart = _blockStart(out,0x00000006);
+			_u32(out,ifIndex);
+			_u32(out,(uint32_t)((uint64_t)f.timestamp >> 32));
+			_u32(out,(uint32_t)((uint64_t)f.timestamp & 0xffffffffULL));
+			_u32(out,f.capturedLength);
+			_u32(out,f.originalLength);
+			out.append(reinterpret_cast<const char *>(s.data + ((unsigned long)i * (unsigned long)s.snapLength)),f.capturedLength);
+			_pad(out);
+			const uint32_t flags = (f.outbound) ? 2 : 1;
+			_option(out,2,&flags,4); // epb_flags
+			static const char *const verdictNames[3] = { "accept","drop-filter","drop" };
+			char tmp[64];
+			std::string comment("verdict=");
+			comment.append(verdictNames[f.verdict]);
+			if (f.peer)
+				comment.append(" peer=").append(Utils::hex10(f.peer,tmp));
+			if (f.path.ss_family)
+				comment.append(" path=").append(f.path.toString(tmp));
+			if (f.reason)
+				comment.append(" reason=\"").append(f.reason).append("\"");
+			_option(out,1,comment.data(),(unsigned int)comment.length()); // opt_comment
+			_option(out,0,(const void *)0,0);
+			_blockEnd(out,epbStart);
+		}
+
+		const unsigned int n = s.count;
+		if (clear)
+			s.count = 0;
+		return n;
+	}
+
+private:
+	struct _Slot
+	{
+		int64_t timestamp;
+		uint64_t nwid;
+		uint64_t peer;
+		InetAddress path;
+		const char *reason;
+		uint32_t originalLength;
+		uint32_t capturedLength;
+		bool outbound;
+		Verdict verdict;
+	};
+
+	struct _State
+	{
+		_State() :
+			enabled(false),
+			nwid(0),
+			slots((_Slot *)0),
+			data((uint8_t *)0),
+			maxFrames(0),
+			snapLength(0),
+			next(0),
+			count(0),
+			overwritten(0) {}
+		std::atomic<bool> enabled;
+		std::atomic<uint64_t> nwid;
+		Mutex lock; // guards everything below
+		_Slot *slots;
+		uint8_t *data; // maxFrames * snapLength
+		unsigned int maxFrames;
+		unsigned int snapLength;
+		unsigned int next; // slot the next frame goes in
+		unsigned int count; // frames in ring, ending just before next
+		uint64_t overwritten;
+	};
+
+	static inline _State &_state()
+	{
+		// Never destroyed, since frames may be handled during static destruction
+		static _State *const s = new _State();
+		return *s;
+	}
+
+	static inline void _record(const Frame &fr)
+	{
+		_State &s = _state();
+		Mutex::Lock _l(s.lock);
+		if ((!s.slots)||(!capturing(fr._nwid)))
+			return;
+
+		const unsigned int i = s.next;
+		s.next = (s.next + 1) % s.maxFrames;
+		if (s.count == s.maxFrames)
+			++s.overwritten;
+		else ++s.count;
+
+		_Slot &f = s.slots[i];
+		f.timestamp = fr._now;
+		f.nwid = fr._nwid;
+		f.peer = fr._peer;
+		if (fr._path)
+			f.path = fr._path->address();
+		else f.path.zero();
+		f.reason = fr._reason;
+		f.outbound = fr._outbound;
+		f.verdict = fr._verdict;
+
+		// Rebuild the Ethernet header the tap would have seen, with an 802.1Q tag if there is a VLAN ID
+		uint8_t *const d = s.data + ((unsigned long)i * (unsigned long)s.snapLength);
+		uint8_t h[18];
+		MAC(fr._to).copyTo(h,6);
+		MAC(fr._from).copyTo(h + 6,6);
+		unsigned int hl = 12;
+		if (fr._vlanId) {
+			h[hl++] = 0x81;
+			h[hl++] = 0x00;
+			h[hl++] = (uint8_t)(fr._vlanId >> 8);
+			h[hl++] = (uint8_t)fr._vlanId;
+		}
+		h[hl++] = (uint8_t)(fr._etherType >> 8);
+		h[hl++] = (uint8_t)fr._etherType;
+		const unsigned int cl = std::min(hl,s.snapLength);
+		memcpy(d,h,cl);
+		const unsigned int dl = std::min(fr._len,s.snapLength - cl);
+		memcpy(d + cl,fr._data,dl);
+		f.originalLength = hl + fr._len;
+		f.capturedLength = cl + dl;
+	}
+
+	// pcapng is written in host byte order, which readers detect from the section header
+	static inline void _u16(std::string &out,const uint16_t v) { out.append(reinterpret_cast<const char *>(&v),2); }
+	static inline void _u32(std::string &out,const uint32_t v) { out.append(reinterpret_cast<const char *>(&v),4); }
+	static inline void _pad(std::string &out) { while ((out.size() & 3) != 0) out.push_back((char)0); }
+	static inline unsigned int _blockStart(std::string &out,const uint32_t type)
+	{
+		const unsigned int start = (unsigned int)out.size();
+		_u32(out,type);
+		_u32(out,0); // length, set by _blockEnd()
+		return start;
+	}
+	static inline void _blockEnd(std::string &out,const unsigned int start)
+	{
+		const uint32_t len = (uint32_t)(out.size() - start) + 4;
+		memcpy(&(out[start + 4]),&len,4);
+		_u32(out,len);
+	}
+	static inline void _option(std::string &out,const uint16_t code,const void *data,const unsigned int len)
+	{
+		_u16(out,code);
+		_u16(out,(uint16_t)len);
+		if (len) {
+			out.append(reinterpret_cast<const char *>(data),len);
+			_pad(out);
+		}
+	}
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -24,24 +24,62 @@
  * of your own application.
  */
 
+
 #ifndef ZT_HASHTABLE_HPP
 #define ZT_HASHTABLE_HPP
 
 #include "Constants.hpp"
+#include "HugePages.hpp"
 
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <new>
 #include <stdexcept>
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <type_traits>
+
+/**
+ * Entries (key plus value) larger than this are kept in their own heap
+ * allocation instead of in the table's slot array
+ *
+ * This keeps empty slots cheap for tables of large objects like Membership
+ * and also means references to their values survive growth of the table.
+ */
+#define ZT_HASHTABLE_MAX_INLINE_ENTRY 64
+
+/**
+ * Slots of the previous slot array moved per insert while a table grows
+ *
+ * Tables larger than a few times this are rehashed incrementally so that no
+ * single insert has to move every entry while its caller holds a lock.
+ */
+#define ZT_HASHTABLE_REHASH_STEP 64
 
 namespace ZeroTier {
 
 /**
  * A minimal hash table implementation for the ZeroTier core
+ *
+ * This is an open-addressing table with linear probing over a power of two
+ * number of slots. A separate array of one control byte per slot holds
+ * seven bits of each entry's hash, so probing mostly touches just that
+ * array and keys are compared only on a likely match. Erased slots become
+ * tombstones until the next rehash, so erasing never moves other entries.
+ *
+ * Small entries are stored directly in the slot array and are moved when
+ * set() or operator[] grows the table, so don't hold references to values
+ * across inserts into the same table.
+ *
+ * Growing a large table allocates the new slot array and then moves just
+ * ZT_HASHTABLE_REHASH_STEP old slots per insert, so for a while entries are
+ * spread over both arrays and lookups that miss in the new one also probe
+ * the old one. Only inserts move entries, so erasing while iterating stays
+ * safe. Large slot arrays can come from huge pages (see HugePages).
  */
 template<typename K,typename V>
 class Hashtable
@@ -51,13 +89,39 @@ private:
 	{
 		_Bucket(const K &k,const V &v) : k(k),v(v) {}
 		_Bucket(const K &k) : k(k),v() {}
-		_Bucket(const _Bucket &b) : k(b.k),v(b.v) {}
-		inline _Bucket &operator=(const _Bucket &b) { k = b.k; v = b.v; return *this; }
 		K k;
 		V v;
-		_Bucket *next; // must be set manually for each _Bucket
 	};
 
+	template<typename B,bool INLINE>
+	struct _SlotImpl;
+	template<typename B>
+	struct _SlotImpl<B,true>
+	{
+		typename std::aligned_storage<sizeof(B),std::alignment_of<B>::value>::type s;
+		inline B *b() { return reinterpret_cast<B *>(&s); }
+		inline const B *b() const { return reinterpret_cast<const B *>(&s); }
+		inline void init(const K &k) { new (&s) B(k); }
+		inline void init(const K &k,const V &v) { new (&s) B(k,v); }
+		inline void initFrom(_SlotImpl &o) { new (&s) B(std::move(*o.b())); o.b()->~B(); }
+		inline void destroy() { b()->~B(); }
+	};
+	template<typename B>
+	struct _SlotImpl<B,false>
+	{
+		B *p;
+		inline B *b() { return p; }
+		inline const B *b() const { return p; }
+		inline void init(const K &k) { p = new B(k); }
+		inline void init(const K &k,const V &v) { p = new B(k,v); }
+		inline void initFrom(_SlotImpl &o) { p = o.p; }
+		inline void destroy() { delete p; }
+	};
+	typedef _SlotImpl< _Bucket,(sizeof(_Bucket) <= ZT_HASHTABLE_MAX_INLINE_ENTRY) > _Slot;
+
+	// Control byte values: empty, erased, or 0x80 plus seven bits of hash
+	enum { _EMPTY = 0x00,_ERASED = 0x01,_FULL = 0x80 };
+
 public:
 	/**
 	 * A simple forward iterator (different from STL)
@@ -75,7 +139,7 @@ public:
 		Iterator(Hashtable &ht) :
 			_idx(0),
 			_ht(&ht),
-			_b(ht._t[0])
+			_old(false)
 		{
 		}
 
@@ -87,77 +151,75 @@ public:
 		inline bool next(K *&kptr,V *&vptr)
 		{
 			for(;;) {
-				if (_b) {
-					kptr = &(_b->k);
-					vptr = &(_b->v);
-					_b = _b->next;
-					return true;
+				const unsigned long bc = (_old) ? _ht->_obc : _ht->_bc;
+				const uint8_t *const ctl = (_old) ? _ht->_octl : _ht->_ctl;
+				while (_idx < bc) {
+					const unsigned long i = _idx++;
+					if ((ctl[i] & _FULL) != 0) {
+						_Bucket *const b = ((_old) ? _ht->_oslots : _ht->_slots)[i].b();
+						kptr = &(b->k);
+						vptr = &(b->v);
+						return true;
+					}
 				}
-				++_idx;
-				if (_idx >= _ht->_bc)
+				if ((_old)||(!_ht->_oslots))
 					return false;
-				_b = _ht->_t[_idx];
+				_old = true;
+				_idx = 0;
 			}
 		}
 
 	private:
 		unsigned long _idx;
 		Hashtable *_ht;
-		_Bucket *_b;
+		bool _old;
 	};
-	//friend class Hashtable<K,V>::Iterator;
 
 	/**
-	 * @param bc Initial capacity in buckets (default: 64, must be nonzero)
+	 * @param bc Initial capacity in slots (default: 64, rounded up to a power of two)
 	 */
 	Hashtable(unsigned long bc = 64) :
-		_t(reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * bc))),
-		_bc(bc),
-		_s(0)
+		_slots((_Slot *)0),
+		_ctl((uint8_t *)0),
+		_bc(_roundCapacity(bc)),
+		_s(0),
+		_used(0),
+		_oslots((_Slot *)0),
+		_octl((uint8_t *)0),
+		_obc(0),
+		_oidx(0)
 	{
-		if (!_t)
+		if (!_alloc(_bc,_slots,_ctl))
 			throw ZT_EXCEPTION_OUT_OF_MEMORY;
-		for(unsigned long i=0;i<bc;++i)
-			_t[i] = (_Bucket *)0;
 	}
 
 	Hashtable(const Hashtable<K,V> &ht) :
-		_t(reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * ht._bc))),
-		_bc(ht._bc),
-		_s(ht._s)
+		_slots((_Slot *)0),
+		_ctl((uint8_t *)0),
+		_bc(_roundCapacity((ht._s * 2) + 1)),
+		_s(0),
+		_used(0),
+		_oslots((_Slot *)0),
+		_octl((uint8_t *)0),
+		_obc(0),
+		_oidx(0)
 	{
-		if (!_t)
+		if (!_alloc(_bc,_slots,_ctl))
 			throw ZT_EXCEPTION_OUT_OF_MEMORY;
-		for(unsigned long i=0;i<_bc;++i)
-			_t[i] = (_Bucket *)0;
-		for(unsigned long i=0;i<_bc;++i) {
-			const _Bucket *b = ht._t[i];
-			while (b) {
-				_Bucket *nb = new _Bucket(*b);
-				nb->next = _t[i];
-				_t[i] = nb;
-				b = b->next;
-			}
-		}
+		ht._each([this](const _Bucket *b) { this->set(b->k,b->v); });
 	}
 
 	~Hashtable()
 	{
 		this->clear();
-		::free(_t);
+		HugePages::release(_slots,(sizeof(_Slot) + 1) * _bc);
 	}
 
 	inline Hashtable &operator=(const Hashtable<K,V> &ht)
 	{
-		this->clear();
-		if (ht._s) {
-			for(unsigned long i=0;i<ht._bc;++i) {
-				const _Bucket *b = ht._t[i];
-				while (b) {
-					this->set(b->k,b->v);
-					b = b->next;
-				}
-			}
+		if (&ht != this) {
+			this->clear();
+			ht._each([this](const _Bucket *b) { this->set(b->k,b->v); });
 		}
 		return *this;
 	}
@@ -167,18 +229,16 @@ public:
 	 */
 	inline void clear()
 	{
-		if (_s) {
+		if (_used) {
 			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					_Bucket *const nb = b->next;
-					delete b;
-					b = nb;
-				}
-				_t[i] = (_Bucket *)0;
+				if ((_ctl[i] & _FULL) != 0)
+					_slots[i].destroy();
 			}
+			memset(_ctl,_EMPTY,_bc);
 			_s = 0;
+			_used = 0;
 		}
+		_dropOld();
 	}
 
 	/**
@@ -189,13 +249,7 @@ public:
 		typename std::vector<K> k;
 		if (_s) {
 			k.reserve(_s);
-			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					k.push_back(b->k);
-					b = b->next;
-				}
-			}
+			_each([&k](const _Bucket *b) { k.push_back(b->k); });
 		}
 		return k;
 	}
@@ -209,15 +263,8 @@ public:
 	template<typename C>
 	inline void appendKeys(C &v) const
 	{
-		if (_s) {
-			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					v.push_back(b->k);
-					b = b->next;
-				}
-			}
-		}
+		if (_s)
+			_each([&v](const _Bucket *b) { v.push_back(b->k); });
 	}
 
 	/**
@@ -228,13 +275,7 @@ public:
 		typename std::vector< std::pair<K,V> > k;
 		if (_s) {
 			k.reserve(_s);
-			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					k.push_back(std::pair<K,V>(b->k,b->v));
-					b = b->next;
-				}
-			}
+			_each([&k](const _Bucket *b) { k.push_back(std::pair<K,V>(b->k,b->v)); });
 		}
 		return k;
 	}
@@ -245,13 +286,8 @@ public:
 	 */
 	inline V *get(const K &k)
 	{
-		_Bucket *b = _t[_hc(k) % _bc];
-		while (b) {
-			if (b->k == k)
-				return &(b->v);
-			b = b->next;
-		}
-		return (V *)0;
+		_Bucket *const b = _findAny(k,_hc(k));
+		return (b) ? &(b->v) : (V *)0;
 	}
 	inline const V *get(const K &k) const { return const_cast<Hashtable *>(this)->get(k); }
 
@@ -262,13 +298,10 @@ public:
 	 */
 	inline bool get(const K &k,V &v) const
 	{
-		_Bucket *b = _t[_hc(k) % _bc];
-		while (b) {
-			if (b->k == k) {
-				v = b->v;
-				return true;
-			}
-			b = b->next;
+		const _Bucket *const b = const_cast<Hashtable *>(this)->_findAny(k,_hc(k));
+		if (b) {
+			v = b->v;
+			return true;
 		}
 		return false;
 	}
@@ -277,16 +310,7 @@ public:
 	 * @param k Key to check
 	 * @return True if key is present
 	 */
-	inline bool contains(const K &k) const
-	{
-		_Bucket *b = _t[_hc(k) % _bc];
-		while (b) {
-			if (b->k == k)
-				return true;
-			b = b->next;
-		}
-		return false;
-	}
+	inline bool contains(const K &k) const { return (const_cast<Hashtable *>(this)->_findAny(k,_hc(k)) != (_Bucket *)0); }
 
 	/**
 	 * @param k Key
@@ -294,20 +318,28 @@ public:
 	 */
 	inline bool erase(const K &k)
 	{
-		const unsigned long bidx = _hc(k) % _bc;
-		_Bucket *lastb = (_Bucket *)0;
-		_Bucket *b = _t[bidx];
-		while (b) {
-			if (b->k == k) {
-				if (lastb)
-					lastb->next = b->next;
-				else _t[bidx] = b->next;
-				delete b;
+		const uint64_t h = _hc(k);
+		unsigned long i = _find(_slots,_ctl,_bc,k,h);
+		if (i != _bc) {
+			_slots[i].destroy();
+			// A slot followed by an empty one ends no probe sequence, so it can be emptied outright
+			if (_ctl[(i + 1) & (_bc - 1)] == _EMPTY) {
+				_ctl[i] = _EMPTY;
+				--_used;
+			} else {
+				_ctl[i] = _ERASED;
+			}
+			--_s;
+			return true;
+		}
+		if (_oslots) {
+			i = _find(_oslots,_octl,_obc,k,h);
+			if (i != _obc) {
+				_oslots[i].destroy();
+				_octl[i] = _ERASED;
 				--_s;
 				return true;
 			}
-			lastb = b;
-			b = b->next;
 		}
 		return false;
 	}
@@ -319,28 +351,15 @@ public:
 	 */
 	inline V &set(const K &k,const V &v)
 	{
-		const unsigned long h = _hc(k);
-		unsigned long bidx = h % _bc;
-
-		_Bucket *b = _t[bidx];
-		while (b) {
-			if (b->k == k) {
-				b->v = v;
-				return b->v;
-			}
-			b = b->next;
-		}
-
-		if (_s >= _bc) {
-			_grow();
-			bidx = h % _bc;
+		const uint64_t h = _hc(k);
+		_Bucket *const b = _findAny(k,h);
+		if (b) {
+			b->v = v;
+			return b->v;
 		}
-
-		b = new _Bucket(k,v);
-		b->next = _t[bidx];
-		_t[bidx] = b;
-		++_s;
-		return b->v;
+		const unsigned long i = _insertSlot(h);
+		_slots[i].init(k,v);
+		return _slots[i].b()->v;
 	}
 
 	/**
@@ -349,26 +368,13 @@ public:
 	 */
 	inline V &operator[](const K &k)
 	{
-		const unsigned long h = _hc(k);
-		unsigned long bidx = h % _bc;
-
-		_Bucket *b = _t[bidx];
-		while (b) {
-			if (b->k == k)
-				return b->v;
-			b = b->next;
-		}
-
-		if (_s >= _bc) {
-			_grow();
-			bidx = h % _bc;
-		}
-
-		b = new _Bucket(k);
-		b->next = _t[bidx];
-		_t[bidx] = b;
-		++_s;
-		return b->v;
+		const uint64_t h = _hc(k);
+		_Bucket *const b = _findAny(k,h);
+		if (b)
+			return b->v;
+		const unsigned long i = _insertSlot(h);
+		_slots[i].init(k);
+		return _slots[i].b()->v;
 	}
 
 	/**
@@ -376,6 +382,11 @@ public:
 	 */
 	inline unsigned long size() const { return _s; }
 
+	/**
+	 * @return Bytes used by the slot and control arrays and entries, not counting anything keys or values point to
+	 */
+	inline unsigned long memoryUsage() const { return (unsigned long)(((sizeof(_Slot) + 1) * (_bc + _obc)) + ((sizeof(_Slot) < sizeof(_Bucket)) ? (sizeof(_Bucket) * _s) : 0)); }
+
 	/**
 	 * @return True if table is empty
 	 */
@@ -383,49 +394,182 @@ public:
 
 private:
 	template<typename O>
-	static inline unsigned long _hc(const O &obj)
+	static inline uint64_t _hc(const O &obj)
 	{
-		return (unsigned long)obj.hashCode();
+		return _mix((uint64_t)obj.hashCode());
 	}
-	static inline unsigned long _hc(const uint64_t i)
+	static inline uint64_t _hc(const uint64_t i) { return _mix(i); }
+	static inline uint64_t _hc(const uint32_t i) { return _mix((uint64_t)i); }
+	static inline uint64_t _hc(const uint16_t i) { return _mix((uint64_t)i); }
+
+	// Many hashCode()s are just a raw address or a sum of words, so spread every bit
+	// of them over the whole word (this is the MurmurHash3 64-bit finalizer).
+	static inline uint64_t _mix(uint64_t h)
 	{
-		return (unsigned long)(i ^ (i >> 32)); // good for network IDs and addresses
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
 	}
-	static inline unsigned long _hc(const uint32_t i)
+
+	static inline uint8_t _tag(const uint64_t h) { return (uint8_t)(_FULL | (uint8_t)(h >> 57)); }
+
+	static inline unsigned long _roundCapacity(const unsigned long bc)
 	{
-		return ((unsigned long)i * (unsigned long)0x9e3779b1);
+		unsigned long c = 8;
+		while (c < bc)
+			c <<= 1;
+		return c;
 	}
-	static inline unsigned long _hc(const uint16_t i)
+
+	static inline bool _alloc(const unsigned long bc,_Slot *&slots,uint8_t *&ctl)
 	{
-		return ((unsigned long)i * (unsigned long)0x9e3779b1);
+		// One block: slots first so they keep malloc()'s alignment, then control bytes
+		slots = reinterpret_cast<_Slot *>(HugePages::allocate((sizeof(_Slot) + 1) * bc));
+		if (!slots)
+			return false;
+		ctl = reinterpret_cast<uint8_t *>(slots + bc);
+		memset(ctl,_EMPTY,bc);
+		return true;
 	}
 
-	inline void _grow()
+	// Calls f(const _Bucket *) for every entry in both slot arrays
+	template<typename F>
+	inline void _each(F f) const
 	{
-		const unsigned long nc = _bc * 2;
-		_Bucket **nt = reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * nc));
-		if (nt) {
-			for(unsigned long i=0;i<nc;++i)
-				nt[i] = (_Bucket *)0;
-			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					_Bucket *const nb = b->next;
-					const unsigned long nidx = _hc(b->k) % nc;
-					b->next = nt[nidx];
-					nt[nidx] = b;
-					b = nb;
-				}
+		for(unsigned long i=0;i<_bc;++i) {
+			if ((_ctl[i] & _FULL) != 0)
+				f(_slots[i].b());
+		}
+		for(unsigned long i=0;i<_obc;++i) {
+			if ((_octl[i] & _FULL) != 0)
+				f(_oslots[i].b());
+		}
+	}
+
+	// Returns slot index of key or bc if not present
+	static inline unsigned long _find(const _Slot *slots,const uint8_t *ctl,const unsigned long bc,const K &k,const uint64_t h)
+	{
+		const unsigned long mask = bc - 1;
+		const uint8_t tag = _tag(h);
+		unsigned long i = (unsigned long)h & mask;
+		for(;;) {
+			const uint8_t c = ctl[i];
+			if (c == tag) {
+				if (slots[i].b()->k == k)
+					return i;
+			} else if (c == _EMPTY) {
+				return bc;
+			}
+			i = (i + 1) & mask;
+		}
+	}
+
+	inline _Bucket *_findAny(const K &k,const uint64_t h)
+	{
+		unsigned long i = _find(_slots,_ctl,_bc,k,h);
+		if (i != _bc)
+			return _slots[i].b();
+		if (_oslots) {
+			i = _find(_oslots,_octl,_obc,k,h);
+			if (i != _obc)
+				return _oslots[i].b();
+		}
+		return (_Bucket *)0;
+	}
+
+	// Places an entry being moved or added into the current slot array, returns its index
+	inline unsigned long _place(const uint64_t h)
+	{
+		const unsigned long mask = _bc - 1;
+		unsigned long i = (unsigned long)h & mask;
+		while ((_ctl[i] & _FULL) != 0)
+			i = (i + 1) & mask;
+		if (_ctl[i] == _EMPTY)
+			++_used;
+		_ctl[i] = _tag(h);
+		return i;
+	}
+
+	// Claims and returns a slot for a new entry known not to be in the table yet
+	inline unsigned long _insertSlot(const uint64_t h)
+	{
+		if (_oslots)
+			_migrate(ZT_HASHTABLE_REHASH_STEP);
+		if (((_used + 1) * 4) > (_bc * 3)) { // keep at most 3/4 of slots in use, counting tombstones
+			if (_oslots)
+				_migrate(_obc); // only if inserts outran the move, which the step size makes very unlikely
+			_rehash((((_s + 1) * 2) > _bc) ? (_bc * 2) : _bc);
+		}
+		++_s;
+		return _place(h);
+	}
+
+	// Moves up to n slots of the previous slot array into the current one
+	inline void _migrate(unsigned long n)
+	{
+		while ((n)&&(_oidx < _obc)) {
+			const unsigned long i = _oidx++;
+			if ((_octl[i] & _FULL) != 0) {
+				const unsigned long j = _place(_hc(_oslots[i].b()->k));
+				_slots[j].initFrom(_oslots[i]);
+				_octl[i] = _ERASED; // keeps probe sequences through here intact for entries not yet moved
+			}
+			--n;
+		}
+		if (_oidx >= _obc)
+			_dropOld();
+	}
+
+	inline void _dropOld()
+	{
+		if (_oslots) {
+			for(unsigned long i=_oidx;i<_obc;++i) {
+				if ((_octl[i] & _FULL) != 0)
+					_oslots[i].destroy();
 			}
-			::free(_t);
-			_t = nt;
-			_bc = nc;
+			HugePages::release(_oslots,(sizeof(_Slot) + 1) * _obc);
+			_oslots = (_Slot *)0;
+			_octl = (uint8_t *)0;
+			_obc = 0;
+			_oidx = 0;
 		}
 	}
 
-	_Bucket **_t;
+	inline void _rehash(const unsigned long nc)
+	{
+		_Slot *ns;
+		uint8_t *nctl;
+		if (!_alloc(nc,ns,nctl)) {
+			if ((_used + 1) < _bc)
+				return; // still room, try again on a later insert
+			throw ZT_EXCEPTION_OUT_OF_MEMORY;
+		}
+		_oslots = _slots;
+		_octl = _ctl;
+		_obc = _bc;
+		_oidx = 0;
+		_slots = ns;
+		_ctl = nctl;
+		_bc = nc;
+		_used = 0;
+		// Small tables are cheap enough to move all at once
+		_migrate((_obc <= (ZT_HASHTABLE_REHASH_STEP * 4)) ? _obc : ZT_HASHTABLE_REHASH_STEP);
+	}
+
+	_Slot *_slots;
+	uint8_t *_ctl;
 	unsigned long _bc;
 	unsigned long _s;
+	unsigned long _used; // live entries plus tombstones in the current slot array
+
+	// Previous slot array while growing, entries below _oidx have been moved
+	_Slot *_oslots;
+	uint8_t *_octl;
+	unsigned long _obc;
+	unsigned long _oidx;
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,260 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+#include "Constants.hpp"
+
+#ifdef __LINUX__
+#include <sys/mman.h>
+#endif
+
+#include "HugePages.hpp"
+#include "Mutex.hpp"
+
+// Chunk sizes carved from shared regions: 2^16 (the minimum allocation) up to half a huge page
+#define ZT_HUGE_PAGE_MIN_CHUNK_SHIFT 16
+#define ZT_HUGE_PAGE_CHUNK_CLASSES 5
+
+namespace ZeroTier {
+
+volatile enum ZT_HugePageMode HugePages::_mode = ZT_HUGE_PAGES_OFF;
+volatile bool HugePages::_mapped = false;
+
+namespace {
+
+struct _Region
+{
+	std::size_t size;
+	bool explicitPages; // MAP_HUGETLB, otherwise madvise(MADV_HUGEPAGE)
+	int chunkClass; // class of the chunks this is carved into, or -1 if it's one allocation
+};
+
+struct _FreeChunk
+{
+	_FreeChunk *next;
+};
+
+struct _State
+{
+	_State() :
+		explicitBytes(0),
+		transparentBytes(0),
+		allocatedBytes(0),
+		fallbacks(0),
+		lock("HugePages::lock")
+	{
+		for(int c=0;c<ZT_HUGE_PAGE_CHUNK_CLASSES;++c) {
+			freeChunks[c] = (_FreeChunk *)0;
+			carve[c] = (uint8_t *)0;
+			carveLeft[c] = 0;
+		}
+	}
+
+	std::map<uintptr_t,_Region> regions; // by base address
+	_FreeChunk *freeChunks[ZT_HUGE_PAGE_CHUNK_CLASSES];
+	uint8_t *carve[ZT_HUGE_PAGE_CHUNK_CLASSES]; // region chunks of each class are being carved from
+	std::size_t carveLeft[ZT_HUGE_PAGE_CHUNK_CLASSES];
+	uint64_t explicitBytes;
+	uint64_t transparentBytes;
+	uint64_t allocatedBytes;
+	uint64_t fallbacks;
+	Mutex lock;
+};
+
+// Never destroyed, since tables in static objects may be released during exit
+static _State &_state()
+{
+	static _State *const s = new _State();
+	return *s;
+}
+
+// Maps a region of whole huge pages, or returns NULL
+static void *_mapRegion(const std::size_t size,const enum ZT_HugePageMode mode,bool &explicitPages)
+{
+#ifdef __LINUX__
+#ifdef MAP_HUGETLB
+	if (mode == ZT_HUGE_PAGES_EXPLICIT) {
+		void *const p = ::mmap((void *)0,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if (p != MAP_FAILED) {
+			explicitPages = true;
+			return p;
+		}
+	}
+#endif
+#ifdef MADV_HUGEPAGE
+	// Map a huge page extra and trim it so the region starts on a huge page boundary
+	uint8_t *const m = reinterpret_cast<uint8_t *>(::mmap((void *)0,size + ZT_HUGE_PAGE_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0));
+	if ((void *)m == MAP_FAILED)
+		return (void *)0;
+	uint8_t *const p = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(m) + (ZT_HUGE_PAGE_SIZE - 1)) & ~((uintptr_t)ZT_HUGE_PAGE_SIZE - 1));
+	if (p > m)
+		::munmap(m,(std::size_t)(p - m));
+	if ((p + size) < (m + size + ZT_HUGE_PAGE_SIZE))
+		::munmap(p + size,(std::size_t)((m + size + ZT_HUGE_PAGE_SIZE) - (p + size)));
+	::madvise(p,size,MADV_HUGEPAGE);
+	explicitPages = false;
+	return p;
+#else
+	return (void *)0;
+#endif
+#else
+	return (void *)0;
+#endif
+}
+
+static void _unmapRegion(void *p,const std::size_t size)
+{
+#ifdef __LINUX__
+	::munmap(p,size);
+#endif
+}
+
+} // anonymous namespace
+
+void HugePages::setMode(enum ZT_HugePageMode mode)
+{
+	_mode = mode;
+}
+
+enum ZT_HugePageMode HugePages::mode()
+{
+	return _mode;
+}
+
+void HugePages::stats(ZT_HugePageStats &st)
+{
+	_State &s = _state();
+	Mutex::Lock _l(s.lock);
+	st.mode = _mode;
+	st.explicitBytes = s.explicitBytes;
+	st.transparentBytes = s.transparentBytes;
+	st.allocatedBytes = s.allocatedBytes;
+	st.fallbacks = s.fallbacks;
+}
+
+void *HugePages::_allocate(std::size_t size)
+{
+	_State &s = _state();
+	const enum ZT_HugePageMode mode = _mode;
+
+	int c = 0;
+	std::size_t chunk = (std::size_t)1 << ZT_HUGE_PAGE_MIN_CHUNK_SHIFT;
+	while (chunk < size) {
+		chunk <<= 1;
+		++c;
+	}
+
+	Mutex::Lock _l(s.lock);
+	if (c >= ZT_HUGE_PAGE_CHUNK_CLASSES) {
+		// A huge page or more gets a region of its own
+		const std::size_t rsize = (size + (ZT_HUGE_PAGE_SIZE - 1)) & ~((std::size_t)ZT_HUGE_PAGE_SIZE - 1);
+		bool explicitPages = false;
+		void *const p = _mapRegion(rsize,mode,explicitPages);
+		if (!p) {
+			++s.fallbacks;
+			return ::malloc(size);
+		}
+		_Region &r = s.regions[reinterpret_cast<uintptr_t>(p)];
+		r.size = rsize;
+		r.explicitPages = explicitPages;
+		r.chunkClass = -1;
+		if (explicitPages)
+			s.explicitBytes += rsize;
+		else s.transparentBytes += rsize;
+		s.allocatedBytes += rsize;
+		_mapped = true;
+		return p;
+	}
+
+	_FreeChunk *const f = s.freeChunks[c];
+	if (f) {
+		s.freeChunks[c] = f->next;
+		s.allocatedBytes += chunk;
+		return f;
+	}
+
+	if (s.carveLeft[c] < chunk) {
+		bool explicitPages = false;
+		void *const p = _mapRegion(ZT_HUGE_PAGE_SIZE,mode,explicitPages);
+		if (!p) {
+			++s.fallbacks;
+			return ::malloc(size);
+		}
+		_Region &r = s.regions[reinterpret_cast<uintptr_t>(p)];
+		r.size = ZT_HUGE_PAGE_SIZE;
+		r.explicitPages = explicitPages;
+		r.chunkClass = c;
+		if (explicitPages)
+			s.explicitBytes += ZT_HUGE_PAGE_SIZE;
+		else s.transparentBytes += ZT_HUGE_PAGE_SIZE;
+		s.carve[c] = reinterpret_cast<uint8_t *>(p);
+		s.carveLeft[c] = ZT_HUGE_PAGE_SIZE;
+		_mapped = true;
+	}
+	void *const p = s.carve[c];
+	s.carve[c] += chunk;
+	s.carveLeft[c] -= chunk;
+	s.allocatedBytes += chunk;
+	return p;
+}
+
+void HugePages::_release(void *p,std::size_t size)
+{
+	if (!p)
+		return;
+	_State &s = _state();
+	Mutex::Lock _l(s.lock);
+
+	std::map<uintptr_t,_Region>::iterator r(s.regions.upper_bound(reinterpret_cast<uintptr_t>(p)));
+	if (r != s.regions.begin()) {
+		--r;
+		if (reinterpret_cast<uintptr_t>(p) < (r->first + r->second.size)) {
+			if (r->second.chunkClass < 0) {
+				if (r->second.explicitPages)
+					s.explicitBytes -= r->second.size;
+				else s.transparentBytes -= r->second.size;
+				s.allocatedBytes -= r->second.size;
+				_unmapRegion(p,r->second.size);
+				s.regions.erase(r);
+			} else {
+				_FreeChunk *const f = reinterpret_cast<_FreeChunk *>(p);
+				f->next = s.freeChunks[r->second.chunkClass];
+				s.freeChunks[r->second.chunkClass] = f;
+				s.allocatedBytes -= (std::size_t)1 << (ZT_HUGE_PAGE_MIN_CHUNK_SHIFT + r->second.chunkClass);
+			}
+			return;
+		}
+	}
+
+	::free(p); // fell back to malloc() or was allocated while huge pages were off
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,148 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_HUGEPAGES_HPP
+#define ZT_HUGEPAGES_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <new>
+
+#include "Constants.hpp"
+
+#include "../include/ZeroTierOne.h"
+
+/**
+ * Huge page size assumed for regions (x86-64 and arm64 with 4K base pages)
+ */
+#define ZT_HUGE_PAGE_SIZE 2097152
+
+/**
+ * Smallest allocation taken from huge pages, smaller ones always use malloc()
+ */
+#define ZT_HUGE_PAGE_MIN_ALLOCATION 65536
+
+namespace ZeroTier {
+
+/**
+ * Huge page backed memory for the core's large tables and pools
+ *
+ * Big randomly accessed tables like the peer and path hash tables, the
+ * slabs behind peers, paths and RX queue entries, and the member arrays of
+ * large multicast groups take a TLB miss on almost every lookup with 4K
+ * pages. With huge pages enabled, allocations of ZT_HUGE_PAGE_MIN_ALLOCATION
+ * bytes or more come from regions of whole huge pages: explicit ones
+ * (MAP_HUGETLB, from the pool reserved in vm.nr_hugepages) or transparent
+ * ones (madvise(MADV_HUGEPAGE)). Explicit mode falls back to transparent
+ * pages when the reserved pool runs out, and either falls back to malloc()
+ * if no region can be mapped. Only Linux is supported; elsewhere this is
+ * always malloc().
+ *
+ * Allocations of a huge page or more get regions of their own that are
+ * unmapped when released. Smaller ones are rounded up to a power of two
+ * and carved from regions shared with others of that size, which are kept
+ * for reuse once mapped. Memory is released by address, so changing the
+ * mode at runtime only affects later allocations.
+ */
+class HugePages
+{
+public:
+	/**
+	 * @param mode Huge pages to use for allocations after this
+	 */
+	static void setMode(enum ZT_HugePageMode mode);
+
+	/**
+	 * @return Current mode
+	 */
+	static enum ZT_HugePageMode mode();
+
+	/**
+	 * @param size Bytes to allocate
+	 * @return Memory aligned at least as malloc()'s, or NULL on failure
+	 */
+	static inline void *allocate(const std::size_t size)
+	{
+		if ((size < ZT_HUGE_PAGE_MIN_ALLOCATION)||(_mode == ZT_HUGE_PAGES_OFF))
+			return ::malloc(size);
+		return _allocate(size);
+	}
+
+	/**
+	 * @param p Memory from allocate() or NULL
+	 * @param size Size it was allocated with
+	 */
+	static inline void release(void *p,const std::size_t size)
+	{
+		if ((size < ZT_HUGE_PAGE_MIN_ALLOCATION)||(!_mapped))
+			::free(p);
+		else _release(p,size);
+	}
+
+	/**
+	 * @param st Structure to fill with process-wide huge page statistics
+	 */
+	static void stats(ZT_HugePageStats &st);
+
+private:
+	static void *_allocate(std::size_t size);
+	static void _release(void *p,std::size_t size);
+
+	static volatile enum ZT_HugePageMode _mode;
+	static volatile bool _mapped; // true once any region has been mapped
+};
+
+/**
+ * STL allocator for containers that can grow large, e.g. std::vector<T,HugePageAllocator<T> >
+ */
+template<typename T>
+struct HugePageAllocator
+{
+	typedef T value_type;
+
+	HugePageAllocator() {}
+	template<typename U>
+	HugePageAllocator(const HugePageAllocator<U> &) {}
+
+	inline T *allocate(const std::size_t n)
+	{
+		T *const p = reinterpret_cast<T *>(HugePages::allocate(n * sizeof(T)));
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+	inline void deallocate(T *p,const std::size_t n) { HugePages::release(p,n * sizeof(T)); }
+
+	template<typename U>
+	inline bool operator==(const HugePageAllocator<U> &) const { return true; }
+	template<typename U>
+	inline bool operator!=(const HugePageAllocator<U> &) const { return false; }
+};
+
+} // namespace ZeroTier
+
+#endif
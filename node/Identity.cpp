@@ -29,8 +29,13 @@
 #include <string.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include "Constants.hpp"
 #include "Identity.hpp"
+#include "Mutex.hpp"
 #include "SHA512.hpp"
 #include "Salsa20.hpp"
 #include "Utils.hpp"
@@ -79,38 +84,93 @@ static inline void _computeMemoryHardHash(const void *publicKey,unsigned int pub
 	}
 }
 
-// Hashcash generation halting condition -- halt when first byte is less than
-// threshold value.
-struct _Identity_generate_cond
+// Shared state for a multi-threaded identity search
+struct _Identity_generate_state
+{
+	_Identity_generate_state() : found(false) {}
+	std::atomic_bool found;
+	Mutex lock;
+	C25519::Pair kp;
+	Address address;
+};
+
+// Halting condition for one search worker -- halt on a hashcash hit or when
+// another worker has already produced an identity.
+struct _Identity_generate_worker_cond
 {
-	_Identity_generate_cond() {}
-	_Identity_generate_cond(unsigned char *sb,char *gm) : digest(sb),genmem(gm) {}
+	_Identity_generate_worker_cond() {}
+	_Identity_generate_worker_cond(unsigned char *sb,char *gm,_Identity_generate_state *st,uint64_t *c) : digest(sb),genmem(gm),state(st),candidates(c) {}
 	inline bool operator()(const C25519::Pair &kp) const
 	{
+		if (state->found)
+			return true;
+		++*candidates;
 		_computeMemoryHardHash(kp.pub.data,ZT_C25519_PUBLIC_KEY_LEN,digest,genmem);
 		return (digest[0] < ZT_IDENTITY_GEN_HASHCASH_FIRST_BYTE_LESS_THAN);
 	}
 	unsigned char *digest;
 	char *genmem;
+	_Identity_generate_state *state;
+	uint64_t *candidates;
 };
 
-void Identity::generate()
+// Search worker: each runs with its own genmem until any worker succeeds
+static void _Identity_generate_worker(_Identity_generate_state *state,uint64_t *candidates)
 {
 	unsigned char digest[64];
 	char *genmem = new char[ZT_IDENTITY_GEN_MEMORY];
 
-	C25519::Pair kp;
-	do {
-		kp = C25519::generateSatisfying(_Identity_generate_cond(digest,genmem));
-		_address.setTo(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
-	} while (_address.isReserved());
+	while (!state->found) {
+		const C25519::Pair kp(C25519::generateSatisfying(_Identity_generate_worker_cond(digest,genmem,state,candidates)));
+		if ((state->found)||(digest[0] >= ZT_IDENTITY_GEN_HASHCASH_FIRST_BYTE_LESS_THAN))
+			break;
+		const Address a(digest + 59,ZT_ADDRESS_LENGTH); // last 5 bytes are address
+		if (a.isReserved())
+			continue;
+		Mutex::Lock _l(state->lock);
+		if (!state->found) {
+			state->kp = kp;
+			state->address = a;
+			state->found = true;
+		}
+	}
 
-	_publicKey = kp.pub;
+	delete [] genmem;
+}
+
+void Identity::generate(unsigned int threads,uint64_t *candidates)
+{
+	if (!threads) {
+		threads = std::thread::hardware_concurrency();
+		if (!threads)
+			threads = 1;
+	}
+
+	_Identity_generate_state state;
+	std::vector<uint64_t> counts(threads,0);
+	std::vector<std::thread> workers;
+	for(unsigned int t=1;t<threads;++t) {
+		try {
+			workers.push_back(std::thread(_Identity_generate_worker,&state,&(counts[t])));
+		} catch ( ... ) {
+			break; // run with however many workers we could start
+		}
+	}
+	_Identity_generate_worker(&state,&(counts[0]));
+	for(std::vector<std::thread>::iterator w(workers.begin());w!=workers.end();++w)
+		w->join();
+
+	_address = state.address;
+	_publicKey = state.kp.pub;
 	if (!_privateKey)
 		_privateKey = new C25519::Private();
-	*_privateKey = kp.priv;
+	*_privateKey = state.kp.priv;
 
-	delete [] genmem;
+	if (candidates) {
+		*candidates = 0;
+		for(std::vector<uint64_t>::const_iterator c(counts.begin());c!=counts.end();++c)
+			*candidates += *c;
+	}
 }
 
 bool Identity::locallyValidate() const
@@ -39,6 +39,9 @@
 
 #define ZT_IDENTITY_STRING_BUFFER_LENGTH 384
 
+// Length of an identity serialized without its private key
+#define ZT_IDENTITY_PUBLIC_SERIALIZED_LENGTH (ZT_ADDRESS_LENGTH + 1 + ZT_C25519_PUBLIC_KEY_LEN + 1)
+
 namespace ZeroTier {
 
 /**
@@ -106,9 +109,15 @@ public:
 	/**
 	 * Generate a new identity (address, key pair)
 	 *
-	 * This is a time consuming operation.
+	 * This is a time consuming operation. Candidate key pairs are searched
+	 * in parallel by the requested number of threads (the calling thread
+	 * is one of them), each with its own hashcash scratch memory. All
+	 * threads stop as soon as any of them finds a valid identity.
+	 *
+	 * @param threads Number of search threads or 0 for one per core (default: 1)
+	 * @param candidates If non-NULL, set to total number of candidates tried
 	 */
-	void generate();
+	void generate(unsigned int threads = 1,uint64_t *candidates = (uint64_t *)0);
 
 	/**
 	 * Check the validity of this identity's pairing of key to address
@@ -0,0 +1,215 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_IDENTITYVALIDATIONCACHE_HPP
+#define ZT_IDENTITYVALIDATIONCACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <list>
+
+#include "Constants.hpp"
+#include "Identity.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+#include "SHA512.hpp"
+
+#define ZT_IDENTITY_VALIDATION_CACHE_SHARDS 16
+
+namespace ZeroTier {
+
+/**
+ * Bounded LRU cache of identities that have passed locallyValidate()
+ *
+ * Entries are keyed by address and hold a digest of the public key, so an
+ * identity with the same address but a different key is not a hit. It is
+ * split into shards by address, each with its own lock and LRU list.
+ */
+class IdentityValidationCache
+{
+public:
+	/**
+	 * @param capacity Maximum number of identities to remember (default: ZT_IDENTITY_VALIDATION_CACHE_SIZE)
+	 */
+	IdentityValidationCache(const unsigned long capacity = ZT_IDENTITY_VALIDATION_CACHE_SIZE)
+	{
+		setCapacity(capacity);
+	}
+
+	/**
+	 * Change the number of identities remembered
+	 *
+	 * Shards over the new capacity forget their least recently used entries.
+	 *
+	 * @param capacity Maximum number of identities to remember or 0 to cache nothing
+	 */
+	inline void setCapacity(const unsigned long capacity)
+	{
+		const unsigned long shardCapacity = (capacity + (ZT_IDENTITY_VALIDATION_CACHE_SHARDS - 1)) / ZT_IDENTITY_VALIDATION_CACHE_SHARDS;
+		for(unsigned int i=0;i<ZT_IDENTITY_VALIDATION_CACHE_SHARDS;++i) {
+			_Shard &s = _shards[i];
+			Mutex::Lock _l(s.lock);
+			s.capacity = shardCapacity;
+			while (s.entries.size() > shardCapacity) {
+				s.entries.erase(s.lru.back());
+				s.lru.pop_back();
+			}
+		}
+	}
+
+	/**
+	 * Validate an identity, skipping the memory-hard hash if it passed before
+	 *
+	 * @param id Identity to validate
+	 * @return True if identity is valid
+	 */
+	inline bool locallyValidate(const Identity &id)
+	{
+		if (check(id))
+			return true;
+		if (!id.locallyValidate())
+			return false;
+		add(id);
+		return true;
+	}
+
+	/**
+	 * Check whether an identity is known to have passed validation
+	 *
+	 * This counts as a hit or a miss.
+	 *
+	 * @param id Identity to look up
+	 * @return True if this exact identity is in the cache
+	 */
+	inline bool check(const Identity &id)
+	{
+		_Digest d;
+		_digest(id,d);
+		const uint64_t a = id.address().toInt();
+		_Shard &s = _shards[(unsigned long)(a % ZT_IDENTITY_VALIDATION_CACHE_SHARDS)];
+		Mutex::Lock _l(s.lock);
+		_Entry *const e = s.entries.get(a);
+		if ((e)&&(memcmp(e->digest.b,d.b,sizeof(d.b)) == 0)) {
+			s.lru.splice(s.lru.begin(),s.lru,e->lruPosition);
+			++s.hits;
+			return true;
+		}
+		++s.misses;
+		return false;
+	}
+
+	/**
+	 * Remember an identity that has passed validation
+	 *
+	 * @param id Identity that passed locallyValidate()
+	 */
+	inline void add(const Identity &id)
+	{
+		const uint64_t a = id.address().toInt();
+		_Shard &s = _shards[(unsigned long)(a % ZT_IDENTITY_VALIDATION_CACHE_SHARDS)];
+		Mutex::Lock _l(s.lock);
+		if (!s.capacity)
+			return;
+		_Entry *e = s.entries.get(a);
+		if (e) {
+			s.lru.splice(s.lru.begin(),s.lru,e->lruPosition);
+		} else {
+			while (s.entries.size() >= s.capacity) {
+				s.entries.erase(s.lru.back());
+				s.lru.pop_back();
+			}
+			s.lru.push_front(a);
+			e = &(s.entries[a]);
+			e->lruPosition = s.lru.begin();
+		}
+		_digest(id,e->digest);
+	}
+
+	/**
+	 * Get cache hit and miss counts
+	 *
+	 * @param hits Set to number of check() calls that found the identity
+	 * @param misses Set to number of check() calls that did not
+	 */
+	inline void stats(uint64_t &hits,uint64_t &misses) const
+	{
+		hits = 0;
+		misses = 0;
+		for(unsigned int i=0;i<ZT_IDENTITY_VALIDATION_CACHE_SHARDS;++i) {
+			Mutex::Lock _l(_shards[i].lock);
+			hits += _shards[i].hits;
+			misses += _shards[i].misses;
+		}
+	}
+
+	/**
+	 * @return Number of identities currently cached
+	 */
+	inline unsigned long size() const
+	{
+		unsigned long n = 0;
+		for(unsigned int i=0;i<ZT_IDENTITY_VALIDATION_CACHE_SHARDS;++i) {
+			Mutex::Lock _l(_shards[i].lock);
+			n += _shards[i].entries.size();
+		}
+		return n;
+	}
+
+private:
+	struct _Digest { uint8_t b[16]; };
+
+	struct _Entry
+	{
+		_Digest digest;
+		std::list<uint64_t>::iterator lruPosition;
+	};
+
+	struct _Shard
+	{
+		_Shard() : entries(32),capacity(0),hits(0),misses(0),lock("IdentityValidationCache::_shards") {}
+		Hashtable< uint64_t,_Entry > entries;
+		std::list<uint64_t> lru; // most recently used first
+		unsigned long capacity;
+		uint64_t hits;
+		uint64_t misses;
+		Mutex lock;
+	};
+
+	static inline void _digest(const Identity &id,_Digest &d)
+	{
+		uint8_t h[64];
+		SHA512::hash(h,id.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+		ZT_FAST_MEMCPY(d.b,h,sizeof(d.b));
+	}
+
+	_Shard _shards[ZT_IDENTITY_VALIDATION_CACHE_SHARDS];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -48,12 +48,21 @@
 #include "Tag.hpp"
 #include "Revocation.hpp"
 #include "Trace.hpp"
+#include "Cluster.hpp"
+#include "Metrics.hpp"
+#include "FrameCapture.hpp"
+#include "FrameBuffer.hpp"
+#include "CryptoWorkers.hpp"
+#include "Traversal.hpp"
+#include "Probes.hpp"
 
 namespace ZeroTier {
 
 bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 {
 	const Address sourceAddress(source());
+	Metrics::DecodeTimer decodeTimer;
+	ZT_PROBE2(decode__start,packetId(),sourceAddress.toInt());
 
 	try {
 		// Check for trusted paths or unencrypted HELLOs (HELLO is the only packet sent in the clear)
@@ -72,24 +81,30 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 			}
 		} else if ((c == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(verb() == Packet::VERB_HELLO)) {
 			// Only HELLO is allowed in the clear, but will still have a MAC
+			Metrics::packetIn(Packet::VERB_HELLO,size());
+			decodeTimer.verb(Packet::VERB_HELLO);
 			return _doHELLO(RR,tPtr,false);
 		}
 
 		const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,sourceAddress));
 		if (peer) {
 			if (!trusted) {
-				if (!dearmor(peer->key())) {
+				if (!dearmor(peer->key(),peer->aes())) {
 					RR->t->incomingPacketMessageAuthenticationFailure(tPtr,_path,packetId(),sourceAddress,hops(),"invalid MAC");
 					return true;
 				}
 			}
 
+			peer->countReceived(size(),hops());
+
 			if (!uncompress()) {
 				RR->t->incomingPacketInvalid(tPtr,_path,packetId(),sourceAddress,hops(),Packet::VERB_NOP,"LZ4 decompression failed");
 				return true;
 			}
 
 			const Packet::Verb v = verb();
+			Metrics::packetIn((unsigned int)v,size());
+			decodeTimer.verb((unsigned int)v);
 			switch(v) {
 				//case Packet::VERB_NOP:
 				default: // ignore unknown verbs, but if they pass auth check they are "received"
@@ -112,9 +127,15 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 				case Packet::VERB_PUSH_DIRECT_PATHS:          return _doPUSH_DIRECT_PATHS(RR,tPtr,peer);
 				case Packet::VERB_USER_MESSAGE:               return _doUSER_MESSAGE(RR,tPtr,peer);
 				case Packet::VERB_REMOTE_TRACE:               return _doREMOTE_TRACE(RR,tPtr,peer);
+				case Packet::VERB_MULTI_FRAME:                return _doMULTI_FRAME(RR,tPtr,peer);
+				case Packet::VERB_RELAY_OFFER:                return _doRELAY_OFFER(RR,tPtr,peer);
 			}
 		} else {
-			RR->sw->requestWhois(tPtr,RR->node->now(),sourceAddress);
+			const int64_t now = RR->node->now();
+			if (!RR->node->admission().admit(Admission::CLASS_WHOIS,_path->address(),now))
+				return true;
+			Admission::Charge charge(RR->node->admission(),_path->address(),now);
+			RR->sw->requestWhois(tPtr,now,sourceAddress);
 			return false;
 		}
 	} catch ( ... ) {
@@ -123,6 +144,25 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 	}
 }
 
+void IncomingPacket::finishHELLO(const RuntimeEnvironment *RR,void *tPtr,const Identity &id,const uint8_t *key,const bool authentic,const bool valid,const bool knownValid)
+{
+	if (!authentic) {
+		RR->t->incomingPacketMessageAuthenticationFailure(tPtr,_path,packetId(),id.address(),hops(),"invalid MAC");
+		return;
+	}
+	if (!valid) {
+		RR->t->incomingPacketDroppedHELLO(tPtr,_path,packetId(),id.address(),"invalid identity");
+		return;
+	}
+	if (!knownValid)
+		RR->node->identityValidationCache().add(id);
+
+	// If another HELLO got this peer learned first, decoding again takes the same path as if it had been known all along
+	if (!RR->topology->getPeer(tPtr,id.address()))
+		RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id,key)));
+	tryDecode(RR,tPtr);
+}
+
 bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const Packet::Verb inReVerb = (Packet::Verb)(*this)[ZT_PROTO_VERB_ERROR_IDX_IN_RE_VERB];
@@ -230,8 +270,11 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 				// Identity is different from the one we already have -- address collision
 
 				// Check rate limits
+				if (!RR->node->admission().admit(Admission::CLASS_AGREE,_path->address(),now))
+					return true;
 				if (!RR->node->rateGateIdentityVerification(now,_path->address()))
 					return true;
+				Admission::Charge charge(RR->node->admission(),_path->address(),now);
 
 				uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
 				if (RR->identity.agree(id,key,ZT_PEER_SECRET_KEY_LENGTH)) {
@@ -271,12 +314,22 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 			return true;
 		}
 
+		// Identities that already passed validation don't need the expensive check or its rate limit
+		const bool knownValid = RR->node->identityValidationCache().check(id);
+
 		// Check rate limits
-		if (!RR->node->rateGateIdentityVerification(now,_path->address())) {
+		if (!RR->node->admission().admit((knownValid) ? Admission::CLASS_AGREE : Admission::CLASS_VALIDATE,_path->address(),now))
+			return true;
+		if ((!knownValid)&&(!RR->node->rateGateIdentityVerification(now,_path->address()))) {
 			RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"rate limit exceeded");
 			return true;
 		}
 
+		// Leave key agreement and validation to worker threads if there are any, see finishHELLO()
+		if ((RR->cryptoWorkers)&&(RR->cryptoWorkers->submit(*this,id,knownValid,now)))
+			return true;
+		Admission::Charge charge(RR->node->admission(),_path->address(),now);
+
 		// Check packet integrity and MAC (this is faster than locallyValidate() so do it first to filter out total crap)
 		SharedPtr<Peer> newPeer(new Peer(RR,RR->identity,id));
 		if (!dearmor(newPeer->key())) {
@@ -285,9 +338,12 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 		}
 
 		// Check that identity's address is valid as per the derivation function
-		if (!id.locallyValidate()) {
-			RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"invalid identity");
-			return true;
+		if (!knownValid) {
+			if (!id.locallyValidate()) {
+				RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"invalid identity");
+				return true;
+			}
+			RR->node->identityValidationCache().add(id);
 		}
 
 		peer = RR->topology->addPeer(tPtr,newPeer);
@@ -314,6 +370,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 	}
 
 	std::vector< std::pair<uint64_t,uint64_t> > moonIdsAndTimestamps;
+	unsigned int helloFlags = 0;
 	if (ptr < size()) {
 		// Remainder of packet, if present, is encrypted
 		cryptField(peer->key(),ptr,size() - ptr);
@@ -327,19 +384,26 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 				ptr += 16;
 			}
 		}
+
+		// Flags follow moons in newer versions
+		if (ptr < size())
+			helloFlags = (*this)[ptr];
 	}
 
 	// Send OK(HELLO) with an echo of the packet's timestamp and some of the same
 	// information about us: version, sent-to address, etc.
 
 	Packet outp(id.address(),RR->identity.address(),Packet::VERB_OK);
-	outp.append((unsigned char)Packet::VERB_HELLO);
-	outp.append((uint64_t)pid);
-	outp.append((uint64_t)timestamp);
-	outp.append((unsigned char)ZT_PROTO_VERSION);
-	outp.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
-	outp.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
-	outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+	{
+		Packet::Writer w(outp,1 + 8 + 8 + 1 + 1 + 1 + 2);
+		w.put((unsigned char)Packet::VERB_HELLO);
+		w.put((uint64_t)pid);
+		w.put((uint64_t)timestamp);
+		w.put((unsigned char)ZT_PROTO_VERSION);
+		w.put((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		w.put((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		w.put((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+	}
 
 	if (protoVersion >= 5) {
 		_path->address().serialize(outp);
@@ -374,29 +438,22 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 
 	const unsigned int worldUpdateSizeAt = outp.size();
 	outp.addSize(2); // make room for 16-bit size field
-	if ((planetWorldId)&&(RR->topology->planetWorldTimestamp() > planetWorldTimestamp)&&(planetWorldId == RR->topology->planetWorldId())) {
-		RR->topology->planet().serialize(outp,false);
-	}
-	if (moonIdsAndTimestamps.size() > 0) {
-		std::vector<World> moons(RR->topology->moons());
-		for(std::vector<World>::const_iterator m(moons.begin());m!=moons.end();++m) {
-			for(std::vector< std::pair<uint64_t,uint64_t> >::const_iterator i(moonIdsAndTimestamps.begin());i!=moonIdsAndTimestamps.end();++i) {
-				if (i->first == m->id()) {
-					if (m->timestamp() > i->second)
-						m->serialize(outp,false);
-					break;
-				}
-			}
-		}
-	}
+	RR->topology->appendWorldUpdates(outp,planetWorldId,planetWorldTimestamp,moonIdsAndTimestamps);
 	outp.setAt<uint16_t>(worldUpdateSizeAt,(uint16_t)(outp.size() - (worldUpdateSizeAt + 2)));
+	outp.append((uint8_t)(AES::accelerated() ? ZT_PROTO_HELLO_FLAG_AES256_GCM : 0));
 
+	if (protoVersion >= 11)
+		outp.compress(true);
 	outp.armor(peer->key(),true);
 	_path->send(RR,tPtr,outp.data(),outp.size(),now);
 
 	peer->setRemoteVersion(protoVersion,vMajor,vMinor,vRevision); // important for this to go first so received() knows the version
+	peer->setRemoteHelloFlags(helloFlags);
 	peer->received(tPtr,_path,hops(),pid,Packet::VERB_HELLO,0,Packet::VERB_NOP,false,0);
 
+	if ((RR->cluster)&&(hops() == 0))
+		RR->cluster->peerHello(tPtr,peer,_path,now);
+
 	return true;
 }
 
@@ -445,10 +502,18 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 				}
 			}
 
-			if (!hops())
+			// Flags follow world updates in newer versions
+			const unsigned int helloFlags = (ptr < size()) ? (unsigned int)(*this)[ptr] : 0;
+
+			if (!hops()) {
 				_path->updateLatency((unsigned int)latency);
+				_path->probeReplied(inRePacketId,RR->node->now());
+				_path->helloReplied(inRePacketId,externalSurfaceAddress);
+				peer->invalidateBestPath();
+			}
 
 			peer->setRemoteVersion(vProto,vMajor,vMinor,vRevision);
+			peer->setRemoteHelloFlags(helloFlags);
 
 			if ((externalSurfaceAddress)&&(hops() == 0))
 				RR->sa->iam(tPtr,peer->address(),_path->localSocket(),_path->address(),externalSurfaceAddress,RR->topology->isUpstream(peer->identity()),RR->node->now());
@@ -456,8 +521,13 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 
 		case Packet::VERB_WHOIS:
 			if (RR->topology->isUpstream(peer->identity())) {
-				const Identity id(*this,ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY);
-				RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id))));
+				// A reply to a WHOIS for many addresses can carry many identities
+				unsigned int ptr = ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY;
+				while (ptr < size()) {
+					Identity id;
+					ptr += id.deserialize(*this,ptr);
+					RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id))));
+				}
 			}
 			break;
 
@@ -504,6 +574,13 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 			}
 		}	break;
 
+		case Packet::VERB_ECHO:
+			if ((!_path->mtuProbeReplied(inRePacketId))&&(!hops())) {
+				if (_path->probeReplied(inRePacketId,RR->node->now()))
+					peer->invalidateBestPath();
+			}
+			break;
+
 		default: break;
 	}
 
@@ -517,11 +594,14 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 	if ((!RR->topology->amUpstream())&&(!peer->rateGateInboundWhoisRequest(RR->node->now())))
 		return true;
 
+	// Answer with as many identities per OK as fit in one packet on this path,
+	// sending more OKs if a request for many addresses needs them
 	Packet outp(peer->address(),RR->identity.address(),Packet::VERB_OK);
 	outp.append((unsigned char)Packet::VERB_WHOIS);
 	outp.append(packetId());
 
 	unsigned int count = 0;
+	bool unknown = false;
 	unsigned int ptr = ZT_PACKET_IDX_PAYLOAD;
 	while ((ptr + ZT_ADDRESS_LENGTH) <= size()) {
 		const Address addr(field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
@@ -529,14 +609,27 @@ bool IncomingPacket::_doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const Shar
 
 		const Identity id(RR->topology->getIdentity(tPtr,addr));
 		if (id) {
+			if ((count)&&((outp.size() + ZT_IDENTITY_PUBLIC_SERIALIZED_LENGTH) > _path->mtu())) {
+				outp.armor(peer->key(),true);
+				_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
+				outp.reset(peer->address(),RR->identity.address(),Packet::VERB_OK);
+				outp.append((unsigned char)Packet::VERB_WHOIS);
+				outp.append(packetId());
+				count = 0;
+			}
 			id.serialize(outp,false);
 			++count;
 		} else {
 			// Request unknown WHOIS from upstream from us (if we have one)
 			RR->sw->requestWhois(tPtr,RR->node->now(),addr);
+			unknown = true;
 		}
 	}
 
+	// Other cluster members answer for identities they know through us
+	if ((unknown)&&(RR->cluster))
+		RR->cluster->sendDistributedQuery(*this);
+
 	if (count > 0) {
 		outp.armor(peer->key(),true);
 		_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
@@ -560,7 +653,7 @@ bool IncomingPacket::_doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const
 				if (RR->node->shouldUsePathForZeroTierTraffic(tPtr,with,_path->localSocket(),atAddr)) {
 					const uint64_t junk = RR->node->prng();
 					RR->node->putPacket(tPtr,_path->localSocket(),atAddr,&junk,4,2); // send low-TTL junk packet to 'open' local NAT(s) and stateful firewalls
-					rendezvousWith->attemptToContactAt(tPtr,_path->localSocket(),atAddr,RR->node->now(),false);
+					RR->traversal->probe(tPtr,rendezvousWith,_path->localSocket(),atAddr,false,RR->node->now());
 				}
 			}
 		}
@@ -574,7 +667,8 @@ bool IncomingPacket::_doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const
 bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID);
-	const SharedPtr<Network> network(RR->node->network(nwid));
+	const Epoch::Guard eg;
+	const SharedPtr<Network> &network = RR->node->network(eg,nwid);
 	bool trustEstablished = false;
 	if (network) {
 		if (network->gate(tPtr,peer)) {
@@ -584,10 +678,27 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 				const MAC sourceMac(peer->address(),nwid);
 				const unsigned int frameLen = size() - ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
 				const uint8_t *const frameData = reinterpret_cast<const uint8_t *>(data()) + ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
-				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0)
-					RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
+				if (_congested)
+					Egress::markCongestion(etherType,const_cast<uint8_t *>(frameData),frameLen);
+				FrameCapture::Frame captured(RR->node->now(),nwid,false,sourceMac,network->mac(),etherType,0,frameData,frameLen);
+				captured.peer(peer->address().toInt());
+				captured.path(_path.ptr());
+				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0) {
+					if (TopTalkers::sample())
+						network->topTalkers().frame(RR->node->now(),peer->address(),etherType,frameData,frameLen);
+					if ((_frameBuffer)&&(RR->node->lendsFrames()))
+						_frameBuffer->hold(nwid,network->userPtr(),sourceMac,network->mac(),etherType,frameData,frameLen);
+					else RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
+				} else captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0);
 			}
 		} else {
+			if ((FrameCapture::capturing(nwid))&&(size() > ZT_PROTO_VERB_FRAME_IDX_PAYLOAD)) {
+				const unsigned int frameLen = size() - ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
+				FrameCapture::Frame captured(RR->node->now(),nwid,false,MAC(peer->address(),nwid),network->mac(),at<uint16_t>(ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE),0,reinterpret_cast<const uint8_t *>(data()) + ZT_PROTO_VERB_FRAME_IDX_PAYLOAD,frameLen);
+				captured.peer(peer->address().toInt());
+				captured.path(_path.ptr());
+				captured.verdict(FrameCapture::VERDICT_DROP,"access denied");
+			}
 			_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
 			RR->t->incomingNetworkAccessDenied(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_FRAME,true);
 		}
@@ -603,7 +714,8 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID);
-	const SharedPtr<Network> network(RR->node->network(nwid));
+	const Epoch::Guard eg;
+	const SharedPtr<Network> &network = RR->node->network(eg,nwid);
 	if (network) {
 		const unsigned int flags = (*this)[ZT_PROTO_VERB_EXT_FRAME_IDX_FLAGS];
 
@@ -616,6 +728,13 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 		}
 
 		if (!network->gate(tPtr,peer)) {
+			if ((FrameCapture::capturing(nwid))&&(size() > (comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD))) {
+				const unsigned int frameLen = size() - (comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD);
+				FrameCapture::Frame captured(RR->node->now(),nwid,false,MAC(field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_FROM,ZT_PROTO_VERB_EXT_FRAME_LEN_FROM),ZT_PROTO_VERB_EXT_FRAME_LEN_FROM),MAC(field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_TO,ZT_PROTO_VERB_EXT_FRAME_LEN_TO),ZT_PROTO_VERB_EXT_FRAME_LEN_TO),at<uint16_t>(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_ETHERTYPE),0,field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD,frameLen),frameLen);
+				captured.peer(peer->address().toInt());
+				captured.path(_path.ptr());
+				captured.verdict(FrameCapture::VERDICT_DROP,"access denied");
+			}
 			RR->t->incomingNetworkAccessDenied(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,true);
 			_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
 			peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,false,nwid);
@@ -628,19 +747,29 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 			const MAC from(field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_FROM,ZT_PROTO_VERB_EXT_FRAME_LEN_FROM),ZT_PROTO_VERB_EXT_FRAME_LEN_FROM);
 			const unsigned int frameLen = size() - (comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD);
 			const uint8_t *const frameData = (const uint8_t *)field(comLen + ZT_PROTO_VERB_EXT_FRAME_IDX_PAYLOAD,frameLen);
+			if (_congested)
+				Egress::markCongestion(etherType,const_cast<uint8_t *>(frameData),frameLen);
+			FrameCapture::Frame captured(RR->node->now(),nwid,false,from,to,etherType,0,frameData,frameLen);
+			captured.peer(peer->address().toInt());
+			captured.path(_path.ptr());
 
 			if ((!from)||(from == network->mac())) {
+				captured.verdict(FrameCapture::VERDICT_DROP,"invalid source MAC");
 				peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 				return true;
 			}
 
 			switch (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to,frameData,frameLen,etherType,0)) {
+				case 0:
+					captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0);
+					break;
 				case 1:
 					if (from != MAC(peer->address(),nwid)) {
 						if (network->config().permitsBridging(peer->address())) {
 							network->learnBridgeRoute(from,peer->address());
 						} else {
 							RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,from,to,"bridging not allowed (remote)");
+							captured.verdict(FrameCapture::VERDICT_DROP,"bridging not allowed (remote)");
 							peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 							return true;
 						}
@@ -648,17 +777,21 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 						if (to.isMulticast()) {
 							if (network->config().multicastLimit == 0) {
 								RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,from,to,"multicast disabled");
+								captured.verdict(FrameCapture::VERDICT_DROP,"multicast disabled");
 								peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 								return true;
 							}
 						} else if (!network->config().permitsBridging(RR->identity.address())) {
 							RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,from,to,"bridging not allowed (local)");
+							captured.verdict(FrameCapture::VERDICT_DROP,"bridging not allowed (local)");
 							peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 							return true;
 						}
 					}
 					// fall through -- 2 means accept regardless of bridging checks or other restrictions
 				case 2:
+					if (TopTalkers::sample())
+						network->topTalkers().frame(RR->node->now(),peer->address(),etherType,frameData,frameLen);
 					RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to,etherType,0,(const void *)frameData,frameLen);
 					break;
 			}
@@ -666,9 +799,10 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 
 		if ((flags & 0x10) != 0) { // ACK requested
 			Packet outp(peer->address(),RR->identity.address(),Packet::VERB_OK);
-			outp.append((uint8_t)Packet::VERB_EXT_FRAME);
-			outp.append((uint64_t)packetId());
-			outp.append((uint64_t)nwid);
+			Packet::Writer w(outp,1 + 8 + 8);
+			w.put((uint8_t)Packet::VERB_EXT_FRAME);
+			w.put((uint64_t)packetId());
+			w.put((uint64_t)nwid);
 			outp.armor(peer->key(),true);
 			_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 		}
@@ -681,17 +815,63 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 	return true;
 }
 
+bool IncomingPacket::_doMULTI_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID);
+	const Epoch::Guard eg;
+	const SharedPtr<Network> &network = RR->node->network(eg,nwid);
+	bool trustEstablished = false;
+	if (network) {
+		if (network->gate(tPtr,peer)) {
+			trustEstablished = true;
+			const MAC sourceMac(peer->address(),nwid);
+			unsigned int ptr = ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES;
+			while ((ptr + 4) < size()) {
+				const unsigned int frameLen = at<uint16_t>(ptr);
+				const unsigned int etherType = at<uint16_t>(ptr + 2);
+				ptr += 4;
+				if ((!frameLen)||((ptr + frameLen) > size()))
+					break;
+				const uint8_t *const frameData = reinterpret_cast<const uint8_t *>(data()) + ptr;
+				if (_congested)
+					Egress::markCongestion(etherType,const_cast<uint8_t *>(frameData),frameLen);
+				ptr += frameLen;
+				FrameCapture::Frame captured(RR->node->now(),nwid,false,sourceMac,network->mac(),etherType,0,frameData,frameLen);
+				captured.peer(peer->address().toInt());
+				captured.path(_path.ptr());
+				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0) {
+					if (TopTalkers::sample())
+						network->topTalkers().frame(RR->node->now(),peer->address(),etherType,frameData,frameLen);
+					RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
+				} else captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0);
+			}
+		} else {
+			_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
+			RR->t->incomingNetworkAccessDenied(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_MULTI_FRAME,true);
+		}
+	} else {
+		_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
+	}
+
+	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTI_FRAME,0,Packet::VERB_NOP,trustEstablished,nwid);
+
+	return true;
+}
+
 bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	if (!peer->rateGateEchoRequest(RR->node->now()))
 		return true;
 
+	// The reply adds the in-re verb and packet ID, so a payload too big to
+	// echo back in a maximum size packet is cut short
 	const uint64_t pid = packetId();
+	const unsigned int echoLen = std::min((size() > ZT_PACKET_IDX_PAYLOAD) ? (size() - ZT_PACKET_IDX_PAYLOAD) : 0U,(unsigned int)(ZT_PROTO_MAX_PACKET_LENGTH - (ZT_PACKET_IDX_PAYLOAD + 1 + 8)));
 	Packet outp(peer->address(),RR->identity.address(),Packet::VERB_OK);
-	outp.append((unsigned char)Packet::VERB_ECHO);
-	outp.append((uint64_t)pid);
-	if (size() > ZT_PACKET_IDX_PAYLOAD)
-		outp.append(reinterpret_cast<const unsigned char *>(data()) + ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD);
+	Packet::Writer w(outp,1 + 8 + echoLen);
+	w.put((unsigned char)Packet::VERB_ECHO);
+	w.put((uint64_t)pid);
+	w.put(reinterpret_cast<const unsigned char *>(data()) + ZT_PACKET_IDX_PAYLOAD,echoLen);
 	outp.armor(peer->key(),true);
 	_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 
@@ -756,112 +936,134 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	Revocation revocation;
 	CertificateOfOwnership coo;
 	bool trustEstablished = false;
+	bool complete = false;
 	SharedPtr<Network> network;
 
-	unsigned int p = ZT_PACKET_IDX_PAYLOAD;
-	while ((p < size())&&((*this)[p] != 0)) {
-		p += com.deserialize(*this,p);
-		if (com) {
-			network = RR->node->network(com.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr,com)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
-				}
-			} else RR->mc->addCredential(tPtr,com,false);
-		}
-	}
-	++p; // skip trailing 0 after COMs if present
-
-	if (p < size()) { // older ZeroTier versions do not send capabilities, tags, or revocations
-		const unsigned int numCapabilities = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numCapabilities;++i) {
-			p += cap.deserialize(*this,p);
-			if ((!network)||(network->id() != cap.networkId()))
-				network = RR->node->network(cap.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr,cap)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+	// Credentials are added in up to two passes. The first queues the signatures
+	// of all new credentials in batch, which are then checked together, and the
+	// second adds them using the results. See Membership::CredentialBatch.
+	Membership::CredentialBatch batch;
+	for(;;) {
+		network.zero();
+		unsigned int p = ZT_PACKET_IDX_PAYLOAD;
+		do {
+			while ((p < size())&&((*this)[p] != 0)) {
+				p += com.deserialize(*this,p);
+				if (com) {
+					network = RR->node->network(com.networkId());
+					if (network) {
+						switch (network->addCredential(tPtr,com,&batch)) {
+							case Membership::ADD_REJECTED:
+							case Membership::ADD_DEFERRED_FOR_BATCH:
+								break;
+							case Membership::ADD_ACCEPTED_NEW:
+							case Membership::ADD_ACCEPTED_REDUNDANT:
+								trustEstablished = true;
+								break;
+							case Membership::ADD_DEFERRED_FOR_WHOIS:
+								return false;
+						}
+					} else if (!batch.checked()) {
+						RR->mc->addCredential(tPtr,com,false);
+					}
 				}
 			}
-		}
-
-		if (p >= size()) return true;
-
-		const unsigned int numTags = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numTags;++i) {
-			p += tag.deserialize(*this,p);
-			if ((!network)||(network->id() != tag.networkId()))
-				network = RR->node->network(tag.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr,tag)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+			++p; // skip trailing 0 after COMs if present
+
+			if (p < size()) { // older ZeroTier versions do not send capabilities, tags, or revocations
+				const unsigned int numCapabilities = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numCapabilities;++i) {
+					p += cap.deserialize(*this,p);
+					if ((!network)||(network->id() != cap.networkId()))
+						network = RR->node->network(cap.networkId());
+					if (network) {
+						switch (network->addCredential(tPtr,cap)) {
+							case Membership::ADD_REJECTED:
+							case Membership::ADD_DEFERRED_FOR_BATCH:
+								break;
+							case Membership::ADD_ACCEPTED_NEW:
+							case Membership::ADD_ACCEPTED_REDUNDANT:
+								trustEstablished = true;
+								break;
+							case Membership::ADD_DEFERRED_FOR_WHOIS:
+								return false;
+						}
+					}
 				}
-			}
-		}
-
-		if (p >= size()) return true;
 
-		const unsigned int numRevocations = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numRevocations;++i) {
-			p += revocation.deserialize(*this,p);
-			if ((!network)||(network->id() != revocation.networkId()))
-				network = RR->node->network(revocation.networkId());
-			if (network) {
-				switch(network->addCredential(tPtr,peer->address(),revocation)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+				if (p >= size()) break;
+
+				const unsigned int numTags = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numTags;++i) {
+					p += tag.deserialize(*this,p);
+					if ((!network)||(network->id() != tag.networkId()))
+						network = RR->node->network(tag.networkId());
+					if (network) {
+						switch (network->addCredential(tPtr,tag,&batch)) {
+							case Membership::ADD_REJECTED:
+							case Membership::ADD_DEFERRED_FOR_BATCH:
+								break;
+							case Membership::ADD_ACCEPTED_NEW:
+							case Membership::ADD_ACCEPTED_REDUNDANT:
+								trustEstablished = true;
+								break;
+							case Membership::ADD_DEFERRED_FOR_WHOIS:
+								return false;
+						}
+					}
 				}
-			}
-		}
 
-		if (p >= size()) return true;
+				if (p >= size()) break;
+
+				const unsigned int numRevocations = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numRevocations;++i) {
+					p += revocation.deserialize(*this,p);
+					if ((!network)||(network->id() != revocation.networkId()))
+						network = RR->node->network(revocation.networkId());
+					if (network) {
+						switch(network->addCredential(tPtr,peer->address(),revocation,&batch)) {
+							case Membership::ADD_REJECTED:
+							case Membership::ADD_DEFERRED_FOR_BATCH:
+								break;
+							case Membership::ADD_ACCEPTED_NEW:
+							case Membership::ADD_ACCEPTED_REDUNDANT:
+								trustEstablished = true;
+								break;
+							case Membership::ADD_DEFERRED_FOR_WHOIS:
+								return false;
+						}
+					}
+				}
 
-		const unsigned int numCoos = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numCoos;++i) {
-			p += coo.deserialize(*this,p);
-			if ((!network)||(network->id() != coo.networkId()))
-				network = RR->node->network(coo.networkId());
-			if (network) {
-				switch(network->addCredential(tPtr,coo)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+				if (p >= size()) break;
+
+				const unsigned int numCoos = at<uint16_t>(p); p += 2;
+				for(unsigned int i=0;i<numCoos;++i) {
+					p += coo.deserialize(*this,p);
+					if ((!network)||(network->id() != coo.networkId()))
+						network = RR->node->network(coo.networkId());
+					if (network) {
+						switch(network->addCredential(tPtr,coo,&batch)) {
+							case Membership::ADD_REJECTED:
+							case Membership::ADD_DEFERRED_FOR_BATCH:
+								break;
+							case Membership::ADD_ACCEPTED_NEW:
+							case Membership::ADD_ACCEPTED_REDUNDANT:
+								trustEstablished = true;
+								break;
+							case Membership::ADD_DEFERRED_FOR_WHOIS:
+								return false;
+						}
+					}
 				}
 			}
-		}
+			complete = true;
+		} while (false);
+		if (!batch.verify())
+			break;
 	}
+	if (!complete)
+		return true;
 
 	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_NETWORK_CREDENTIALS,0,Packet::VERB_NOP,trustEstablished,(network) ? network->id() : 0);
 
@@ -941,16 +1143,23 @@ bool IncomingPacket::_doMULTICAST_GATHER(const RuntimeEnvironment *RR,void *tPtr
 		_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
 	if ( ( trustEstablished || RR->mc->cacheAuthorized(peer->address(),nwid,RR->node->now()) ) && (gatherLimit > 0) ) {
 		Packet outp(peer->address(),RR->identity.address(),Packet::VERB_OK);
-		outp.append((unsigned char)Packet::VERB_MULTICAST_GATHER);
-		outp.append(packetId());
-		outp.append(nwid);
-		mg.mac().appendTo(outp);
-		outp.append((uint32_t)mg.adi());
+		{
+			Packet::Writer w(outp,1 + 8 + 8 + 6 + 4);
+			w.put((unsigned char)Packet::VERB_MULTICAST_GATHER);
+			w.put(packetId());
+			w.put(nwid);
+			mg.mac().copyTo(w.field(6),6);
+			w.put((uint32_t)mg.adi());
+		}
 		const unsigned int gatheredLocally = RR->mc->gather(peer->address(),nwid,mg,outp,gatherLimit);
 		if (gatheredLocally > 0) {
 			outp.armor(peer->key(),true);
 			_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
 		}
+
+		// Members subscribed through other cluster members are gathered by them
+		if (RR->cluster)
+			RR->cluster->sendDistributedQuery(*this);
 	}
 
 	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_GATHER,0,Packet::VERB_NOP,trustEstablished,nwid);
@@ -963,7 +1172,8 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_MULTICAST_FRAME_IDX_NETWORK_ID);
 	const unsigned int flags = (*this)[ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS];
 
-	const SharedPtr<Network> network(RR->node->network(nwid));
+	const Epoch::Guard eg;
+	const SharedPtr<Network> &network = RR->node->network(eg,nwid);
 	if (network) {
 		// Offset -- size of optional fields added to position of later fields
 		unsigned int offset = 0;
@@ -997,8 +1207,17 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 			from.fromAddress(peer->address(),nwid);
 		}
 
-		const MulticastGroup to(MAC(field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_MAC,6),6),at<uint32_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_ADI));
-		const unsigned int etherType = at<uint16_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE);
+		unsigned int replicationShare = 0,replicationShares = 0;
+		if ((flags & 0x10) != 0) {
+			replicationShare = at<uint16_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_REPLICATION_SHARE);
+			replicationShares = at<uint16_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_REPLICATION_SHARE + 2);
+			offset += 4;
+		}
+
+		Packet::Reader r(*this,offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_MAC,6 + 4 + 2);
+		const MAC toMac(r.field(6),6);
+		const MulticastGroup to(toMac,r.get<uint32_t>());
+		const unsigned int etherType = r.get<uint16_t>();
 		const unsigned int frameLen = size() - (offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME);
 
 		if (network->config().multicastLimit == 0) {
@@ -1021,13 +1240,21 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 
 			const uint8_t *const frameData = (const uint8_t *)field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME,frameLen);
 
-			if ((flags & 0x08)&&(network->config().isMulticastReplicator(RR->identity.address())))
-				RR->mc->send(tPtr,RR->node->now(),network,peer->address(),to,from,etherType,frameData,frameLen);
+			// Frames relayed by a designated replicator keep the original sender's MAC
+			const bool fromReplicator = network->config().isMulticastReplicator(peer->address());
+
+			if (network->config().isMulticastReplicator(RR->identity.address())) {
+				if ((flags & 0x08) != 0) {
+					RR->mc->replicate(tPtr,RR->node->now(),network,peer->address(),to,from,etherType,frameData,frameLen,0,0);
+				} else if (((flags & 0x10) != 0)&&(fromReplicator)&&(replicationShare < replicationShares)) {
+					RR->mc->replicate(tPtr,RR->node->now(),network,from.toAddress(nwid),to,from,etherType,frameData,frameLen,replicationShare,replicationShares);
+				}
+			}
 
 			if (from != MAC(peer->address(),nwid)) {
 				if (network->config().permitsBridging(peer->address())) {
 					network->learnBridgeRoute(from,peer->address());
-				} else {
+				} else if (!fromReplicator) {
 					RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_MULTICAST_FRAME,from,to.mac(),"bridging not allowed (remote)");
 					peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_MULTICAST_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 					return true;
@@ -1040,12 +1267,15 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 
 		if (gatherLimit) {
 			Packet outp(source(),RR->identity.address(),Packet::VERB_OK);
-			outp.append((unsigned char)Packet::VERB_MULTICAST_FRAME);
-			outp.append(packetId());
-			outp.append(nwid);
-			to.mac().appendTo(outp);
-			outp.append((uint32_t)to.adi());
-			outp.append((unsigned char)0x02); // flag 0x02 = contains gather results
+			{
+				Packet::Writer w(outp,1 + 8 + 8 + 6 + 4 + 1);
+				w.put((unsigned char)Packet::VERB_MULTICAST_FRAME);
+				w.put(packetId());
+				w.put(nwid);
+				to.mac().copyTo(w.field(6),6);
+				w.put((uint32_t)to.adi());
+				w.put((unsigned char)0x02); // flag 0x02 = contains gather results
+			}
 			if (RR->mc->gather(peer->address(),nwid,to,outp,gatherLimit)) {
 				outp.armor(peer->key(),true);
 				_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
@@ -1098,7 +1328,7 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 					if ((flags & ZT_PUSH_DIRECT_PATHS_FLAG_CLUSTER_REDIRECT) != 0) {
 						peer->clusterRedirect(tPtr,_path,a,now);
 					} else if (++countPerScope[(int)a.ipScope()][0] <= ZT_PUSH_DIRECT_PATHS_MAX_PER_SCOPE_AND_FAMILY) {
-						peer->attemptToContactAt(tPtr,InetAddress(),a,now,false);
+						RR->traversal->probe(tPtr,peer,-1,a,((flags & ZT_PUSH_DIRECT_PATHS_FLAG_PREDICTED) != 0),now);
 					}
 				}
 			}	break;
@@ -1112,7 +1342,7 @@ bool IncomingPacket::_doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPt
 					if ((flags & ZT_PUSH_DIRECT_PATHS_FLAG_CLUSTER_REDIRECT) != 0) {
 						peer->clusterRedirect(tPtr,_path,a,now);
 					} else if (++countPerScope[(int)a.ipScope()][1] <= ZT_PUSH_DIRECT_PATHS_MAX_PER_SCOPE_AND_FAMILY) {
-						peer->attemptToContactAt(tPtr,InetAddress(),a,now,false);
+						RR->traversal->probe(tPtr,peer,-1,a,((flags & ZT_PUSH_DIRECT_PATHS_FLAG_PREDICTED) != 0),now);
 					}
 				}
 			}	break;
@@ -1165,6 +1395,22 @@ bool IncomingPacket::_doREMOTE_TRACE(const RuntimeEnvironment *RR,void *tPtr,con
 	return true;
 }
 
+bool IncomingPacket::_doRELAY_OFFER(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	const int64_t now = RR->node->now();
+
+	// Traffic for others will be sent through this peer, so only take offers it
+	// made directly and only if it's on one of our networks.
+	if ((!hops())&&(size() >= (ZT_PROTO_VERB_RELAY_OFFER_IDX_LOAD + 8))&&(peer->trustEstablished(now))&&(!RR->topology->amUpstream())) {
+		peer->relayOffered(now,at<uint64_t>(ZT_PROTO_VERB_RELAY_OFFER_IDX_CAPACITY),at<uint64_t>(ZT_PROTO_VERB_RELAY_OFFER_IDX_LOAD));
+		RR->topology->relayOffered(peer->address());
+	}
+
+	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_RELAY_OFFER,0,Packet::VERB_NOP,false,0);
+
+	return true;
+}
+
 void IncomingPacket::_sendErrorNeedCredentials(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const uint64_t nwid)
 {
 	const int64_t now = RR->node->now();
@@ -49,12 +49,16 @@
  *
  * A return value of true indicates that the packet is done. tryDecode must
  * never be called again after that.
+ *
+ * A HELLO from a new peer may instead be handed to CryptoWorkers, which
+ * calls finishHELLO() once key agreement and identity validation are done.
  */
 
 namespace ZeroTier {
 
 class RuntimeEnvironment;
 class Network;
+class FrameBuffer;
 
 /**
  * Subclass of packet that handles the decoding of it
@@ -64,10 +68,32 @@ class IncomingPacket : public Packet
 public:
 	IncomingPacket() :
 		Packet(),
-		_receiveTime(0)
+		_receiveTime(0),
+		_frameBuffer((FrameBuffer *)0),
+		_congested(false)
+	{
+	}
+
+	// Copies are never in a FrameBuffer even if the original was
+	IncomingPacket(const IncomingPacket &p) :
+		Packet(p),
+		_receiveTime(p._receiveTime),
+		_path(p._path),
+		_frameBuffer((FrameBuffer *)0),
+		_congested(p._congested)
 	{
 	}
 
+	inline IncomingPacket &operator=(const IncomingPacket &p)
+	{
+		Packet::operator=(p);
+		_receiveTime = p._receiveTime;
+		_path = p._path;
+		_frameBuffer = (FrameBuffer *)0;
+		_congested = p._congested;
+		return *this;
+	}
+
 	/**
 	 * Create a new packet-in-decode
 	 *
@@ -80,7 +106,9 @@ public:
 	IncomingPacket(const void *data,unsigned int len,const SharedPtr<Path> &path,int64_t now) :
 		Packet(data,len),
 		_receiveTime(now),
-		_path(path)
+		_path(path),
+		_frameBuffer((FrameBuffer *)0),
+		_congested(false)
 	{
 	}
 
@@ -98,6 +126,26 @@ public:
 		copyFrom(data,len);
 		_receiveTime = now;
 		_path = path;
+		_frameBuffer = (FrameBuffer *)0;
+		_congested = false;
+	}
+
+	/**
+	 * Init packet-in-decode that was received directly into this packet's FrameBuffer
+	 *
+	 * @param len Packet length
+	 * @param path Path over which packet arrived
+	 * @param now Current time
+	 * @param fb FrameBuffer that contains this packet
+	 * @throws std::out_of_range Range error processing packet
+	 */
+	inline void initInPlace(unsigned int len,const SharedPtr<Path> &path,int64_t now,FrameBuffer *fb)
+	{
+		setSize(len);
+		_receiveTime = now;
+		_path = path;
+		_frameBuffer = fb;
+		_congested = false;
 	}
 
 	/**
@@ -115,11 +163,36 @@ public:
 	 */
 	bool tryDecode(const RuntimeEnvironment *RR,void *tPtr);
 
+	/**
+	 * Finish a HELLO from a new peer after CryptoWorkers has checked it
+	 *
+	 * If it checked out the peer is learned and the HELLO decoded again.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param id Identity the HELLO carries
+	 * @param key Key agreed with this identity
+	 * @param authentic True if the HELLO's MAC checked out with this key
+	 * @param valid True if the identity is valid
+	 * @param knownValid True if the identity was already in the validation cache
+	 */
+	void finishHELLO(const RuntimeEnvironment *RR,void *tPtr,const Identity &id,const uint8_t *key,bool authentic,bool valid,bool knownValid);
+
 	/**
 	 * @return Time of packet receipt / start of decode
 	 */
 	inline uint64_t receiveTime() const { return _receiveTime; }
 
+	/**
+	 * @return Path over which packet arrived
+	 */
+	inline const SharedPtr<Path> &path() const { return _path; }
+
+	/**
+	 * Note that this packet or a fragment of it arrived with ECN CE set, to be copied into its frames
+	 */
+	inline void congestionExperienced() { _congested = true; }
+
 private:
 	// These are called internally to handle packet contents once it has
 	// been authenticated, decrypted, decompressed, and classified.
@@ -130,6 +203,7 @@ private:
 	bool _doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doFRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doMULTI_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doECHO(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doMULTICAST_LIKE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
@@ -140,11 +214,14 @@ private:
 	bool _doPUSH_DIRECT_PATHS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doUSER_MESSAGE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doREMOTE_TRACE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doRELAY_OFFER(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 
 	void _sendErrorNeedCredentials(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer,const uint64_t nwid);
 
 	uint64_t _receiveTime;
 	SharedPtr<Path> _path;
+	FrameBuffer *_frameBuffer; // buffer this packet is in if a frame may be handed over in it
+	bool _congested; // arrived CE marked, see congestionExperienced()
 };
 
 } // namespace ZeroTier
@@ -35,97 +35,218 @@
 #include "Node.hpp"
 #include "Trace.hpp"
 
-#define ZT_CREDENTIAL_PUSH_EVERY (ZT_NETWORK_AUTOCONF_DELAY / 3)
-
 namespace ZeroTier {
 
 Membership::Membership() :
 	_lastUpdatedMulticast(0),
-	_lastPushedCom(0),
 	_comRevocationThreshold(0),
-	_revocations(4),
+	_credentialRevision(0),
+	_allowedFor(-1),
+	_allowed(false),
+	_cleanAt(0),
 	_remoteTags(4),
 	_remoteCaps(4),
 	_remoteCoos(4)
 {
-	resetPushState();
+	memset(&_localCredLastPushed,0,sizeof(_localCredLastPushed));
 }
 
-void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf,int localCapabilityIndex,const bool force)
+Membership::CredentialTemplate::CredentialTemplate(const NetworkConfig &nconf) :
+	_caps(nconf.capabilityCount),
+	_tags(nconf.tagCount),
+	_coos(nconf.certificateOfOwnershipCount)
 {
-	bool sendCom = ( (nconf.com) && ( ((now - _lastPushedCom) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) );
+	// A credential that doesn't fit in a packet is left empty and never pushed
+	Buffer<ZT_PROTO_MAX_PACKET_LENGTH> tmp;
+	try {
+		if (nconf.com) {
+			nconf.com.serialize(tmp);
+			_com.assign((const char *)tmp.data(),tmp.size());
+		}
+	} catch ( ... ) {}
+	for(unsigned int c=0;c<nconf.capabilityCount;++c) {
+		try {
+			tmp.clear();
+			nconf.capabilities[c].serialize(tmp);
+			_caps[c].assign((const char *)tmp.data(),tmp.size());
+		} catch ( ... ) {}
+	}
+	for(unsigned int t=0;t<nconf.tagCount;++t) {
+		try {
+			tmp.clear();
+			nconf.tags[t].serialize(tmp);
+			_tags[t].assign((const char *)tmp.data(),tmp.size());
+		} catch ( ... ) {}
+	}
+	for(unsigned int c=0;c<nconf.certificateOfOwnershipCount;++c) {
+		try {
+			tmp.clear();
+			nconf.certificatesOfOwnership[c].serialize(tmp);
+			_coos[c].assign((const char *)tmp.data(),tmp.size());
+		} catch ( ... ) {}
+	}
+}
 
-	const Capability *sendCap;
-	if (localCapabilityIndex >= 0) {
-		sendCap = &(nconf.capabilities[localCapabilityIndex]);
-		if ( ((now - _localCredLastPushed.cap[localCapabilityIndex]) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) )
-			_localCredLastPushed.cap[localCapabilityIndex] = now;
-		else sendCap = (const Capability *)0;
-	} else sendCap = (const Capability *)0;
+void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf,const CredentialTemplate &creds,int localCapabilityIndex,const bool force,PushBatch *batch)
+{
+	PushBatch::_Pending p;
 
-	const Tag *sendTags[ZT_MAX_NETWORK_TAGS];
-	unsigned int sendTagCount = 0;
-	for(unsigned int t=0;t<nconf.tagCount;++t) {
-		if ( ((now - _localCredLastPushed.tag[t]) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) {
-			_localCredLastPushed.tag[t] = now;
-			sendTags[sendTagCount++] = &(nconf.tags[t]);
-		}
+	if ( (nconf.com) && (_pushNeeded(_localCredLastPushed.com,_localCredLastPushed.comTimestamp,nconf.com.timestamp(),now,force)) )
+		p.add(0,creds._com);
+
+	if ( (localCapabilityIndex >= 0) && ((unsigned int)localCapabilityIndex < (unsigned int)creds._caps.size()) && (_pushNeeded(_localCredLastPushed.cap[localCapabilityIndex],_localCredLastPushed.capTimestamp[localCapabilityIndex],nconf.capabilities[localCapabilityIndex].timestamp(),now,force)) )
+		p.add(1,creds._caps[localCapabilityIndex]);
+
+	for(unsigned int t=0;t<(unsigned int)creds._tags.size();++t) {
+		if (_pushNeeded(_localCredLastPushed.tag[t],_localCredLastPushed.tagTimestamp[t],nconf.tags[t].timestamp(),now,force))
+			p.add(2,creds._tags[t]);
 	}
 
-	const CertificateOfOwnership *sendCoos[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
-	unsigned int sendCooCount = 0;
-	for(unsigned int c=0;c<nconf.certificateOfOwnershipCount;++c) {
-		if ( ((now - _localCredLastPushed.coo[c]) >= ZT_CREDENTIAL_PUSH_EVERY) || (force) ) {
-			_localCredLastPushed.coo[c] = now;
-			sendCoos[sendCooCount++] = &(nconf.certificatesOfOwnership[c]);
-		}
+	for(unsigned int c=0;c<(unsigned int)creds._coos.size();++c) {
+		if (_pushNeeded(_localCredLastPushed.coo[c],_localCredLastPushed.cooTimestamp[c],nconf.certificatesOfOwnership[c].timestamp(),now,force))
+			p.add(3,creds._coos[c]);
 	}
 
-	unsigned int tagPtr = 0;
-	unsigned int cooPtr = 0;
-	while ((tagPtr < sendTagCount)||(cooPtr < sendCooCount)||(sendCom)||(sendCap)) {
-		Packet outp(peerAddress,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
+	if (p.empty())
+		return;
 
-		if (sendCom) {
-			sendCom = false;
-			nconf.com.serialize(outp);
-			_lastPushedCom = now;
-		}
-		outp.append((uint8_t)0x00);
-
-		if (sendCap) {
-			outp.append((uint16_t)1);
-			sendCap->serialize(outp);
-			sendCap = (const Capability *)0;
-		} else outp.append((uint16_t)0);
-
-		const unsigned int tagCountAt = outp.size();
-		outp.addSize(2);
-		unsigned int thisPacketTagCount = 0;
-		while ((tagPtr < sendTagCount)&&((outp.size() + sizeof(Tag) + 16) < ZT_PROTO_MAX_PACKET_LENGTH)) {
-			sendTags[tagPtr++]->serialize(outp);
-			++thisPacketTagCount;
-		}
-		outp.setAt(tagCountAt,(uint16_t)thisPacketTagCount);
+	if (batch) {
+		PushBatch::_Pending *&bp = batch->_pending[peerAddress];
+		if (!bp)
+			bp = new PushBatch::_Pending();
+		bp->add(p);
+	} else {
+		PushBatch::_send(RR,tPtr,peerAddress,p);
+	}
+}
 
-		// No revocations, these propagate differently
-		outp.append((uint16_t)0);
+Membership::PushBatch::~PushBatch()
+{
+	Address *a = (Address *)0;
+	_Pending **p = (_Pending **)0;
+	Hashtable<Address,_Pending *>::Iterator i(_pending);
+	while (i.next(a,p))
+		delete *p;
+}
 
-		const unsigned int cooCountAt = outp.size();
-		outp.addSize(2);
-		unsigned int thisPacketCooCount = 0;
-		while ((cooPtr < sendCooCount)&&((outp.size() + sizeof(CertificateOfOwnership) + 16) < ZT_PROTO_MAX_PACKET_LENGTH)) {
-			sendCoos[cooPtr++]->serialize(outp);
-			++thisPacketCooCount;
+void Membership::PushBatch::send(const RuntimeEnvironment *RR,void *tPtr)
+{
+	Address *a = (Address *)0;
+	_Pending **p = (_Pending **)0;
+	Hashtable<Address,_Pending *>::Iterator i(_pending);
+	while (i.next(a,p)) {
+		_Pending *const pending = *p;
+		const Address peer(*a);
+		_pending.erase(peer);
+		_send(RR,tPtr,peer,*pending);
+		delete pending;
+	}
+}
+
+void Membership::PushBatch::_send(const RuntimeEnvironment *RR,void *tPtr,const Address &peer,const _Pending &p)
+{
+	unsigned int next[4] = { 0,0,0,0 }; // next credential of each type
+	unsigned int nextAt[4] = { 0,0,0,0 }; // and where it starts in p.data[]
+	while ((next[0] < p.sizes[0].size())||(next[1] < p.sizes[1].size())||(next[2] < p.sizes[2].size())||(next[3] < p.sizes[3].size())) {
+		Packet outp(peer,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
+
+		// Always take at least one credential per packet so this can't stall
+		bool empty = true;
+
+		for(unsigned int t=0;t<4;++t) {
+			if (t == 3)
+				outp.append((uint16_t)0); // no revocations, these propagate differently
+			const unsigned int countAt = outp.size();
+			if (t > 0)
+				outp.addSize(2); // COMs have no count, they end with a zero byte instead
+			unsigned int count = 0;
+			while ((next[t] < p.sizes[t].size())&&((empty)||((outp.size() + p.sizes[t][next[t]] + 16) < ZT_PROTO_MAX_PACKET_LENGTH))) {
+				const unsigned int len = p.sizes[t][next[t]++];
+				outp.append(p.data[t].data() + nextAt[t],len);
+				nextAt[t] += len;
+				++count;
+				empty = false;
+			}
+			if (t > 0)
+				outp.setAt(countAt,(uint16_t)count);
+			else outp.append((uint8_t)0x00);
 		}
-		outp.setAt(cooCountAt,(uint16_t)thisPacketCooCount);
 
-		outp.compress();
 		RR->sw->send(tPtr,outp,true);
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com)
+bool Membership::CredentialBatch::queue(const RuntimeEnvironment *RR,void *tPtr,const Address &signer,const void *data,unsigned int len,const C25519::Signature &sig)
+{
+	if ((_checked)||(_count >= ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX)||((_dataSize + len) > ZT_MEMBERSHIP_CREDENTIAL_BATCH_DATA)||(!C25519::batchVerifySupported()))
+		return false;
+	const Identity id(RR->topology->getIdentity(tPtr,signer));
+	if (!id)
+		return false;
+	_signer[_count] = signer;
+	_key[_count] = id.publicKey();
+	_sig[_count] = sig;
+	_data[_count] = _buf + _dataSize;
+	_len[_count] = len;
+	ZT_FAST_MEMCPY(_buf + _dataSize,data,len);
+	_dataSize += len;
+	++_count;
+	return true;
+}
+
+bool Membership::CredentialBatch::verify()
+{
+	if (_checked)
+		return false;
+	_checked = true;
+	if (!_count)
+		return false;
+	C25519::verifyBatch(_key,_data,_len,_sig,_count,_valid);
+	return true;
+}
+
+bool Membership::CredentialBatch::verified(const Address &signer,const void *data,unsigned int len,const C25519::Signature &sig) const
+{
+	for(unsigned int i=0;i<_count;++i) {
+		if ((_signer[i] == signer)&&(_len[i] == len)&&(memcmp(_sig[i].data,sig.data,ZT_C25519_SIGNATURE_LEN) == 0)&&(memcmp(_data[i],data,len) == 0))
+			return ((_checked)&&(_valid[i]));
+	}
+	return false;
+}
+
+// Get the signed portion, signer, and signature of batchable credentials
+template<unsigned int C>
+static inline const C25519::Signature &_signedData(const CertificateOfMembership &com,Buffer<C> &b,Address &signer) { com.serializeForSign(b); signer = com.signedBy(); return com.signature(); }
+template<unsigned int C>
+static inline const C25519::Signature &_signedData(const Tag &tag,Buffer<C> &b,Address &signer) { tag.serialize(b,true); signer = tag.signedBy(); return tag.signature(); }
+template<unsigned int C>
+static inline const C25519::Signature &_signedData(const CertificateOfOwnership &coo,Buffer<C> &b,Address &signer) { coo.serialize(b,true); signer = coo.signedBy(); return coo.signature(); }
+template<unsigned int C>
+static inline const C25519::Signature &_signedData(const Revocation &rev,Buffer<C> &b,Address &signer) { rev.serialize(b,true); signer = rev.signer(); return rev.signature(); }
+
+// Run a credential's signature through a batch: -1 if queued, 1 if the batch found it valid, 0 to verify normally
+template<typename CRED>
+static int _batchSignature(Membership::CredentialBatch *batch,const RuntimeEnvironment *RR,void *tPtr,const CRED &cred)
+{
+	if (!batch)
+		return 0;
+	try {
+		Buffer<(sizeof(CRED) * 2)> tmp;
+		Address signer;
+		const C25519::Signature &sig = _signedData(cred,tmp,signer);
+		if (batch->checked())
+			return (batch->verified(signer,tmp.data(),tmp.size(),sig) ? 1 : 0);
+		return (batch->queue(RR,tPtr,signer,tmp.data(),tmp.size(),sig) ? -1 : 0);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+static inline int _batchSignature(Membership::CredentialBatch *batch,const RuntimeEnvironment *RR,void *tPtr,const Capability &cap) { return 0; }
+template<typename CRED>
+static inline int _verifyCred(const CRED &cred,const RuntimeEnvironment *RR,void *tPtr,const bool signatureVerified) { return cred.verify(RR,tPtr,signatureVerified); }
+static inline int _verifyCred(const Capability &cap,const RuntimeEnvironment *RR,void *tPtr,const bool signatureVerified) { return cap.verify(RR,tPtr); }
+
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com,CredentialBatch *batch)
 {
 	const int64_t newts = com.timestamp();
 	if (newts <= _comRevocationThreshold) {
@@ -141,12 +262,17 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 	if ((newts == oldts)&&(_com == com))
 		return ADD_ACCEPTED_REDUNDANT;
 
-	switch(com.verify(RR,tPtr)) {
+	const int bs = _batchSignature(batch,RR,tPtr,com);
+	if (bs < 0)
+		return ADD_DEFERRED_FOR_BATCH;
+
+	switch(com.verify(RR,tPtr,(bs > 0))) {
 		default:
 			RR->t->credentialRejected(tPtr,com,"invalid");
 			return ADD_REJECTED;
 		case 0:
 			_com = com;
+			_allowedFor = -1;
 			return ADD_ACCEPTED_NEW;
 		case 1:
 			return ADD_DEFERRED_FOR_WHOIS;
@@ -155,7 +281,7 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 
 // Template out addCredential() for many cred types to avoid copypasta
 template<typename C>
-static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const Hashtable<uint64_t,int64_t> &revocations,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred)
+static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const int64_t *const rt,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred,Membership::CredentialBatch *batch)
 {
 	C *rc = remoteCreds.get(cred.id());
 	if (rc) {
@@ -167,13 +293,16 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 			return Membership::ADD_ACCEPTED_REDUNDANT;
 	}
 
-	const int64_t *const rt = revocations.get(Membership::credentialKey(C::credentialType(),cred.id()));
 	if ((rt)&&(*rt >= cred.timestamp())) {
 		RR->t->credentialRejected(tPtr,cred,"revoked");
 		return Membership::ADD_REJECTED;
 	}
 
-	switch(cred.verify(RR,tPtr)) {
+	const int bs = _batchSignature(batch,RR,tPtr,cred);
+	if (bs < 0)
+		return Membership::ADD_DEFERRED_FOR_BATCH;
+
+	switch(_verifyCred(cred,RR,tPtr,(bs > 0))) {
 		default:
 			RR->t->credentialRejected(tPtr,cred,"invalid");
 			return Membership::ADD_REJECTED;
@@ -187,14 +316,32 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag) { return _addCredImpl<Tag>(_remoteTags,_revocations,RR,tPtr,nconf,tag); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap) { return _addCredImpl<Capability>(_remoteCaps,_revocations,RR,tPtr,nconf,cap); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocations,RR,tPtr,nconf,coo); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag,CredentialBatch *batch)
+{
+	const AddCredentialResult r = _addCredImpl<Tag>(_remoteTags,_revocationThreshold(credentialKey(Credential::CREDENTIAL_TYPE_TAG,tag.id())),RR,tPtr,nconf,tag,batch);
+	if (r == ADD_ACCEPTED_NEW)
+		++_credentialRevision;
+	return r;
+}
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap)
 {
-	int64_t *rt;
-	switch(rev.verify(RR,tPtr)) {
+	const AddCredentialResult r = _addCredImpl<Capability>(_remoteCaps,_revocationThreshold(credentialKey(Credential::CREDENTIAL_TYPE_CAPABILITY,cap.id())),RR,tPtr,nconf,cap,(CredentialBatch *)0);
+	if (r == ADD_ACCEPTED_NEW)
+		++_credentialRevision;
+	return r;
+}
+
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo,CredentialBatch *batch) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocationThreshold(credentialKey(Credential::CREDENTIAL_TYPE_COO,coo.id())),RR,tPtr,nconf,coo,batch); }
+
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev,CredentialBatch *batch)
+{
+	const int bs = _batchSignature(batch,RR,tPtr,rev);
+	if (bs < 0)
+		return ADD_DEFERRED_FOR_BATCH;
+
+	std::vector<_Revocation>::iterator rt;
+	switch(rev.verify(RR,tPtr,(bs > 0))) {
 		default:
 			RR->t->credentialRejected(tPtr,rev,"invalid");
 			return ADD_REJECTED;
@@ -204,19 +351,37 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 				case Credential::CREDENTIAL_TYPE_COM:
 					if (rev.threshold() > _comRevocationThreshold) {
 						_comRevocationThreshold = rev.threshold();
+						_allowedFor = -1;
 						return ADD_ACCEPTED_NEW;
 					}
 					return ADD_ACCEPTED_REDUNDANT;
 				case Credential::CREDENTIAL_TYPE_CAPABILITY:
 				case Credential::CREDENTIAL_TYPE_TAG:
-				case Credential::CREDENTIAL_TYPE_COO:
-					rt = &(_revocations[credentialKey(ct,rev.credentialId())]);
-					if (*rt < rev.threshold()) {
-						*rt = rev.threshold();
+				case Credential::CREDENTIAL_TYPE_COO: {
+					const uint64_t key = credentialKey(ct,rev.credentialId());
+					rt = std::lower_bound(_revocations.begin(),_revocations.end(),key);
+					if ((rt == _revocations.end())||(rt->key != key)) {
+						rt = _revocations.insert(rt,_Revocation());
+						rt->key = key;
+						rt->threshold = 0;
+					}
+					if (rt->threshold < rev.threshold()) {
+						rt->threshold = rev.threshold();
 						_comRevocationThreshold = rev.threshold();
+						_allowedFor = -1;
+						++_credentialRevision;
+
+						// What this revokes can never be valid again, so it needn't wait for clean()
+						if (ct == Credential::CREDENTIAL_TYPE_TAG)
+							_eraseRevoked(_remoteTags,rev);
+						else if (ct == Credential::CREDENTIAL_TYPE_CAPABILITY)
+							_eraseRevoked(_remoteCaps,rev);
+						else _eraseRevoked(_remoteCoos,rev);
+
 						return ADD_ACCEPTED_NEW;
 					}
 					return ADD_ACCEPTED_REDUNDANT;
+				}
 				default:
 					RR->t->credentialRejected(tPtr,rev,"invalid");
 					return ADD_REJECTED;
@@ -227,11 +392,67 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 	}
 }
 
-void Membership::clean(const int64_t now,const NetworkConfig &nconf)
+void Membership::saveCredentials(StateSnapshot &ss,Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &tmp) const
+{
+	try {
+		if (_com) {
+			tmp.clear();
+			_com.serialize(tmp);
+			ss.add(StateSnapshot::RECORD_COM,tmp);
+		}
+		Hashtable< uint32_t,Tag > &tags = const_cast<Membership *>(this)->_remoteTags;
+		Hashtable< uint32_t,Tag >::Iterator ti(tags);
+		uint32_t *k = (uint32_t *)0;
+		Tag *t = (Tag *)0;
+		while (ti.next(k,t)) {
+			tmp.clear();
+			t->serialize(tmp);
+			ss.add(StateSnapshot::RECORD_TAG,tmp);
+		}
+		Hashtable< uint32_t,Capability > &caps = const_cast<Membership *>(this)->_remoteCaps;
+		Hashtable< uint32_t,Capability >::Iterator ci(caps);
+		Capability *c = (Capability *)0;
+		while (ci.next(k,c)) {
+			tmp.clear();
+			c->serialize(tmp);
+			ss.add(StateSnapshot::RECORD_CAPABILITY,tmp);
+		}
+		Hashtable< uint32_t,CertificateOfOwnership > &coos = const_cast<Membership *>(this)->_remoteCoos;
+		Hashtable< uint32_t,CertificateOfOwnership >::Iterator oi(coos);
+		CertificateOfOwnership *o = (CertificateOfOwnership *)0;
+		while (oi.next(k,o)) {
+			tmp.clear();
+			o->serialize(tmp);
+			ss.add(StateSnapshot::RECORD_COO,tmp);
+		}
+	} catch ( ... ) {} // a credential too big to save is just sent again
+}
+
+int64_t Membership::clean(const NetworkConfig &nconf)
 {
-	_cleanCredImpl<Tag>(nconf,_remoteTags);
-	_cleanCredImpl<Capability>(nconf,_remoteCaps);
-	_cleanCredImpl<CertificateOfOwnership>(nconf,_remoteCoos);
+	int64_t next = 0;
+	_cleanCredImpl<Tag>(nconf,_remoteTags,next);
+	_cleanCredImpl<Capability>(nconf,_remoteCaps,next);
+	_cleanCredImpl<CertificateOfOwnership>(nconf,_remoteCoos,next);
+
+	// Anything at or below a threshold that has fallen out of the time window
+	// fails the timestamp check anyway. The window is taken to be at least as
+	// wide as any controller makes it, in case a later config widens it.
+	const int64_t window = std::max(nconf.credentialTimeMaxDelta,(int64_t)ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA);
+	std::vector<_Revocation>::iterator w(_revocations.begin());
+	for(std::vector<_Revocation>::const_iterator r(_revocations.begin());r!=_revocations.end();++r) {
+		const int64_t e = r->threshold + window + 1;
+		if (e > nconf.timestamp) {
+			*(w++) = *r;
+			if ((!next)||(e < next))
+				next = e;
+		}
+	}
+	_revocations.erase(w,_revocations.end());
+	if (_revocations.capacity() > (_revocations.size() * 2))
+		std::vector<_Revocation>(_revocations).swap(_revocations);
+
+	return next;
 }
 
 } // namespace ZeroTier
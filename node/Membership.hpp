@@ -29,6 +29,10 @@
 
 #include <stdint.h>
 
+#include <vector>
+#include <string>
+#include <algorithm>
+
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
 #include "Credential.hpp"
@@ -38,9 +42,17 @@
 #include "Tag.hpp"
 #include "Revocation.hpp"
 #include "NetworkConfig.hpp"
+#include "StateSnapshot.hpp"
 
 #define ZT_MEMBERSHIP_CRED_ID_UNUSED 0xffffffffffffffffULL
 
+// Maximum number of signatures and total signed bytes in one credential batch
+#define ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX 32
+#define ZT_MEMBERSHIP_CREDENTIAL_BATCH_DATA 8192
+
+// How often local credentials a member should already hold are pushed again anyway
+#define ZT_CREDENTIAL_REFRESH_EVERY (ZT_NETWORK_AUTOCONF_DELAY * 5)
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -61,7 +73,151 @@ public:
 		ADD_REJECTED,
 		ADD_ACCEPTED_NEW,
 		ADD_ACCEPTED_REDUNDANT,
-		ADD_DEFERRED_FOR_WHOIS
+		ADD_DEFERRED_FOR_WHOIS,
+		ADD_DEFERRED_FOR_BATCH
+	};
+
+	/**
+	 * Signatures of credentials received together, checked in one batch
+	 *
+	 * Credentials are added twice. On the first pass addCredential() queues
+	 * the signature of each new credential here instead of checking it and
+	 * returns ADD_DEFERRED_FOR_BATCH. Then verify() checks them all at once
+	 * with C25519::verifyBatch(), and on the second pass addCredential()
+	 * takes each result from here instead of checking it again. Anything not
+	 * queued (unknown signer, batch full, capabilities, or a C25519 backend
+	 * without batch support) is verified normally.
+	 */
+	class CredentialBatch
+	{
+	public:
+		CredentialBatch() : _count(0),_dataSize(0),_checked(false) {}
+
+		/**
+		 * Queue a credential's signature (first pass)
+		 *
+		 * @param RR Runtime environment
+		 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+		 * @param signer Address of signer
+		 * @param data Signed data
+		 * @param len Length of signed data
+		 * @param sig Signature
+		 * @return True if queued, false if the credential should just be verified normally
+		 */
+		bool queue(const RuntimeEnvironment *RR,void *tPtr,const Address &signer,const void *data,unsigned int len,const C25519::Signature &sig);
+
+		/**
+		 * Check all queued signatures
+		 *
+		 * @return True if anything was queued and a second pass is needed
+		 */
+		bool verify();
+
+		/**
+		 * @return True if verify() has been called
+		 */
+		inline bool checked() const { return _checked; }
+
+		/**
+		 * Look up the result for a credential's signature (second pass)
+		 *
+		 * @param signer Address of signer
+		 * @param data Signed data
+		 * @param len Length of signed data
+		 * @param sig Signature
+		 * @return True if this exact signature was queued and found valid
+		 */
+		bool verified(const Address &signer,const void *data,unsigned int len,const C25519::Signature &sig) const;
+
+	private:
+		unsigned int _count;
+		unsigned int _dataSize;
+		bool _checked;
+		Address _signer[ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX];
+		C25519::Public _key[ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX];
+		C25519::Signature _sig[ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX];
+		const void *_data[ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX];
+		unsigned int _len[ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX];
+		bool _valid[ZT_MEMBERSHIP_CREDENTIAL_BATCH_MAX];
+		uint8_t _buf[ZT_MEMBERSHIP_CREDENTIAL_BATCH_DATA];
+	};
+
+	/**
+	 * Our own credentials on a network, serialized once per network config
+	 *
+	 * Pushes copy these bytes into VERB_NETWORK_CREDENTIALS instead of copying
+	 * and serializing each credential again for every member. A template is
+	 * never changed, so a new config gets a new one.
+	 */
+	class CredentialTemplate
+	{
+	public:
+		CredentialTemplate() {}
+		explicit CredentialTemplate(const NetworkConfig &nconf);
+
+		/**
+		 * @return Serialized COM or empty string if none
+		 */
+		inline const std::string &com() const { return _com; }
+
+	private:
+		friend class Membership;
+
+		std::string _com;
+		std::vector<std::string> _caps,_tags,_coos; // same indexes as in the config
+	};
+
+	/**
+	 * Local credentials for several networks collected into shared packets
+	 *
+	 * Every credential carries its own network ID, so the periodic pushes to
+	 * a peer that is a member of more than one of our networks can go out in
+	 * one VERB_NETWORK_CREDENTIALS packet instead of one per network.
+	 *
+	 * This isn't thread safe and is meant to live on the stack for one pass.
+	 */
+	class PushBatch
+	{
+	public:
+		PushBatch() : _pending(8) {}
+		~PushBatch();
+
+		/**
+		 * Send everything collected so far
+		 *
+		 * @param RR Runtime environment
+		 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+		 */
+		void send(const RuntimeEnvironment *RR,void *tPtr);
+
+	private:
+		friend class Membership;
+
+		// Serialized COMs, capabilities, tags and certificates of ownership, in that order
+		struct _Pending
+		{
+			inline void add(const unsigned int type,const std::string &c)
+			{
+				if (!c.empty()) {
+					data[type].append(c);
+					sizes[type].push_back((unsigned int)c.size());
+				}
+			}
+			inline void add(const _Pending &p)
+			{
+				for(unsigned int t=0;t<4;++t) {
+					data[t].append(p.data[t]);
+					sizes[t].insert(sizes[t].end(),p.sizes[t].begin(),p.sizes[t].end());
+				}
+			}
+			inline bool empty() const { return ((sizes[0].empty())&&(sizes[1].empty())&&(sizes[2].empty())&&(sizes[3].empty())); }
+			std::string data[4];
+			std::vector<unsigned int> sizes[4];
+		};
+
+		static void _send(const RuntimeEnvironment *RR,void *tPtr,const Address &peer,const _Pending &p);
+
+		Hashtable<Address,_Pending *> _pending;
 	};
 
 	Membership();
@@ -69,18 +225,21 @@ public:
 	/**
 	 * Send COM and other credentials to this peer if needed
 	 *
-	 * This checks last pushed times for our COM and for other credentials and
-	 * sends VERB_NETWORK_CREDENTIALS if the recipient might need them.
+	 * This sends VERB_NETWORK_CREDENTIALS with whichever of our COM and other
+	 * credentials are new or changed since they were last pushed to this
+	 * peer, or are due for an occasional refresh.
 	 *
 	 * @param RR Runtime environment
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param now Current time
 	 * @param peerAddress Address of member peer (the one that this Membership describes)
 	 * @param nconf My network config
+	 * @param creds Template made from nconf
 	 * @param localCapabilityIndex Index of local capability to include (in nconf.capabilities[]) or -1 if none
-	 * @param force If true, send objects regardless of last push time
+	 * @param force If true, send objects regardless of what was last pushed and when
+	 * @param batch If non-NULL, collect credentials here instead of sending them
 	 */
-	void pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf,int localCapabilityIndex,const bool force);
+	void pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf,const CredentialTemplate &creds,int localCapabilityIndex,const bool force,PushBatch *batch = (PushBatch *)0);
 
 	/**
 	 * Check whether we should push MULTICAST_LIKEs to this peer, and update last sent time if true
@@ -106,8 +265,12 @@ public:
 	inline bool isAllowedOnNetwork(const NetworkConfig &nconf) const
 	{
 		if (nconf.isPublic()) return true;
-		if (_com.timestamp() <= _comRevocationThreshold) return false;
-		return nconf.com.agreesWith(_com);
+		const int64_t ours = nconf.com.timestamp();
+		if (_allowedFor != ours) {
+			_allowed = ((_com.timestamp() > _comRevocationThreshold)&&(nconf.com.agreesWith(_com)));
+			_allowedFor = ours;
+		}
+		return _allowed;
 	}
 
 	inline bool recentlyAssociated(const int64_t now) const
@@ -149,15 +312,32 @@ public:
 		return (((t)&&(_isCredentialTimestampValid(nconf,*t))) ? t : (Tag *)0);
 	}
 
+	/**
+	 * @return Counter bumped whenever a new tag, capability, or revocation is accepted
+	 */
+	inline uint32_t credentialRevision() const { return _credentialRevision; }
+
+	/**
+	 * @return Bytes of heap memory held by this member's credential tables beyond sizeof(Membership)
+	 */
+	inline unsigned long heapBytes() const { return ((unsigned long)(_revocations.capacity() * sizeof(_Revocation)) + _remoteTags.memoryUsage() + _remoteCaps.memoryUsage() + _remoteCoos.memoryUsage()); }
+
+	/**
+	 * @return Revocation thresholds held for this member's tags, capabilities and certificates of ownership
+	 */
+	inline unsigned long revocationCount() const { return (unsigned long)_revocations.size(); }
+
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
+	 *
+	 * If a batch is given the signature check goes through it (see CredentialBatch).
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com,CredentialBatch *batch = (CredentialBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag,CredentialBatch *batch = (CredentialBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
@@ -167,31 +347,44 @@ public:
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo,CredentialBatch *batch = (CredentialBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev,CredentialBatch *batch = (CredentialBatch *)0);
 
 	/**
-	 * Clean internal databases of stale entries
+	 * Add this member's COM, tags, capabilities and certificates of ownership to a state snapshot
 	 *
-	 * @param now Current time
-	 * @param nconf Current network configuration
+	 * @param ss Snapshot to add to
+	 * @param tmp Scratch buffer
 	 */
-	void clean(const int64_t now,const NetworkConfig &nconf);
+	void saveCredentials(StateSnapshot &ss,Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &tmp) const;
 
 	/**
-	 * Reset last pushed time for local credentials
+	 * Drop credentials that are no longer valid and revocations that no longer matter
 	 *
-	 * This is done when we update our network configuration and our credentials have changed
+	 * Credentials are valid while their timestamps are within the network's
+	 * credential time window of our config's timestamp, and a revocation
+	 * only matters while something it revokes could still be within it. The
+	 * return value says when by our config's clock this has work to do
+	 * again, so callers can schedule it instead of sweeping every member.
+	 *
+	 * @param nconf Current network configuration
+	 * @return Config timestamp at which something held here next stops mattering, or 0 if nothing is held
 	 */
-	inline void resetPushState()
-	{
-		_lastPushedCom = 0;
-		memset(&_localCredLastPushed,0,sizeof(_localCredLastPushed));
-	}
+	int64_t clean(const NetworkConfig &nconf);
+
+	/**
+	 * @return Time for which a call to clean() is scheduled by our network, or 0 if none
+	 */
+	inline int64_t cleanAt() const { return _cleanAt; }
+
+	/**
+	 * @param t Time for which a call to clean() has been scheduled, or 0 once it has been made
+	 */
+	inline void setCleanAt(const int64_t t) { _cleanAt = t; }
 
 	/**
 	 * Generates a key for the internal use in indexing credentials by type and credential ID
@@ -199,54 +392,106 @@ public:
 	static uint64_t credentialKey(const Credential::Type &t,const uint32_t i) { return (((uint64_t)t << 32) | (uint64_t)i); }
 
 private:
+	// A credential needs pushing if forced, if it is not what was last pushed
+	// in its slot, or if it has not been refreshed in a while in case the
+	// member has lost it. Controllers stamp credentials when they issue them,
+	// so a new timestamp in a slot means a new or changed credential.
+	static inline bool _pushNeeded(int64_t &lastPushed,int64_t &lastTimestamp,const int64_t timestamp,const int64_t now,const bool force)
+	{
+		if ((force)||(timestamp != lastTimestamp)||((now - lastPushed) >= ZT_CREDENTIAL_REFRESH_EVERY)) {
+			lastPushed = now;
+			lastTimestamp = timestamp;
+			return true;
+		}
+		return false;
+	}
+
+	// Revocation threshold for a credential, kept sorted by key in _revocations
+	struct _Revocation
+	{
+		uint64_t key; // credentialKey()
+		int64_t threshold;
+		inline bool operator<(const uint64_t k) const { return (key < k); }
+	};
+
+	inline const int64_t *_revocationThreshold(const uint64_t key) const
+	{
+		std::vector<_Revocation>::const_iterator r(std::lower_bound(_revocations.begin(),_revocations.end(),key));
+		return (((r != _revocations.end())&&(r->key == key)) ? &(r->threshold) : (const int64_t *)0);
+	}
+
 	template<typename C>
 	inline bool _isCredentialTimestampValid(const NetworkConfig &nconf,const C &remoteCredential) const
 	{
 		const int64_t ts = remoteCredential.timestamp();
 		if (((ts >= nconf.timestamp) ? (ts - nconf.timestamp) : (nconf.timestamp - ts)) <= nconf.credentialTimeMaxDelta) {
-			const int64_t *threshold = _revocations.get(credentialKey(C::credentialType(),remoteCredential.id()));
+			const int64_t *threshold = _revocationThreshold(credentialKey(C::credentialType(),remoteCredential.id()));
 			return ((!threshold)||(ts > *threshold));
 		}
 		return false;
 	}
 
 	template<typename C>
-	void _cleanCredImpl(const NetworkConfig &nconf,Hashtable<uint32_t,C> &remoteCreds)
+	void _cleanCredImpl(const NetworkConfig &nconf,Hashtable<uint32_t,C> &remoteCreds,int64_t &next)
 	{
 		uint32_t *k = (uint32_t *)0;
 		C *v = (C *)0;
 		typename Hashtable<uint32_t,C>::Iterator i(remoteCreds);
 		while (i.next(k,v)) {
-			if (!_isCredentialTimestampValid(nconf,*v))
+			// Credentials newer than our config are kept, since they become valid once we get a newer one
+			const int64_t e = v->timestamp() + nconf.credentialTimeMaxDelta + 1;
+			const int64_t *const threshold = _revocationThreshold(credentialKey(C::credentialType(),*k));
+			if ((e <= nconf.timestamp)||((threshold)&&(v->timestamp() <= *threshold)))
 				remoteCreds.erase(*k);
+			else if ((!next)||(e < next))
+				next = e;
 		}
 	}
 
+	template<typename C>
+	inline void _eraseRevoked(Hashtable<uint32_t,C> &remoteCreds,const Revocation &rev)
+	{
+		const C *const c = remoteCreds.get(rev.credentialId());
+		if ((c)&&(c->timestamp() <= rev.threshold()))
+			remoteCreds.erase(rev.credentialId());
+	}
+
 	// Last time we pushed MULTICAST_LIKE(s)
 	int64_t _lastUpdatedMulticast;
 
-	// Last time we pushed our COM to this peer
-	int64_t _lastPushedCom;
-
 	// Revocation threshold for COM or 0 if none
 	int64_t _comRevocationThreshold;
 
+	// Bumped when credentials that rules can match on change
+	uint32_t _credentialRevision;
+
 	// Remote member's latest network COM
 	CertificateOfMembership _com;
 
-	// Revocations by credentialKey()
-	Hashtable< uint64_t,int64_t > _revocations;
+	// Result of isAllowedOnNetwork() and the timestamp of our COM it was
+	// worked out against, or -1 since this member's COM or its revocation
+	// threshold last changed
+	mutable int64_t _allowedFor;
+	mutable bool _allowed;
+
+	// Time our network will next call clean() or 0 if not scheduled
+	int64_t _cleanAt;
+
+	// Revocation thresholds for tags, capabilities and COOs
+	std::vector<_Revocation> _revocations;
 
 	// Remote credentials that we have received from this member (and that are valid)
 	Hashtable< uint32_t,Tag > _remoteTags;
 	Hashtable< uint32_t,Capability > _remoteCaps;
 	Hashtable< uint32_t,CertificateOfOwnership > _remoteCoos;
 
-	// Time we last pushed our local credentials to this member
+	// Our local credentials as last pushed to this member: when, and the
+	// timestamp of what was sent (see _pushNeeded())
 	struct {
-		uint64_t tag[ZT_MAX_NETWORK_TAGS];
-		uint64_t cap[ZT_MAX_NETWORK_CAPABILITIES];
-		uint64_t coo[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
+		int64_t com,comTimestamp;
+		int64_t tag[ZT_MAX_NETWORK_TAGS],tagTimestamp[ZT_MAX_NETWORK_TAGS];
+		int64_t cap[ZT_MAX_NETWORK_CAPABILITIES],capTimestamp[ZT_MAX_NETWORK_CAPABILITIES];
+		int64_t coo[ZT_MAX_CERTIFICATES_OF_OWNERSHIP],cooTimestamp[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
 	} _localCredLastPushed;
 
 public:
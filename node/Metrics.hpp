@@ -0,0 +1,413 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_METRICS_HPP
+#define ZT_METRICS_HPP
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "Probes.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <vector>
+
+// Crypto time is measured for one in this many packets per thread and scaled up (must be a power of two)
+#define ZT_METRICS_CRYPTO_SAMPLE_RATE 64
+
+namespace ZeroTier {
+
+/**
+ * Process-wide counters for monitoring
+ *
+ * Each thread counts into its own block, which only that thread writes, so
+ * an increment is a plain add with no locked instruction or shared cache
+ * line. snapshot() sums every block under a lock that the hot paths never
+ * take. A block that belongs to an exiting thread is added to a retired
+ * total so counters never go backwards.
+ */
+class Metrics
+{
+public:
+	enum Counter
+	{
+		PACKETS_IN = 0,
+		BYTES_IN = PACKETS_IN + ZT_METRICS_VERB_COUNT,
+		PACKETS_OUT = BYTES_IN + ZT_METRICS_VERB_COUNT,
+		BYTES_OUT = PACKETS_OUT + ZT_METRICS_VERB_COUNT,
+		DROPS = BYTES_OUT + ZT_METRICS_VERB_COUNT,
+		FILTER_IN_ACCEPTED = DROPS + ZT_METRICS_DROP_REASON_COUNT,
+		FILTER_IN_DROPPED,
+		FILTER_OUT_ACCEPTED,
+		FILTER_OUT_DROPPED,
+		RELAYED_PACKETS,
+		RELAYED_BYTES,
+		MULTICAST_FRAMES,
+		MULTICAST_RECIPIENTS,
+		FEC_PARITY_SENT,
+		FEC_RECOVERED,
+		ADMISSION_SHED,
+		ADMISSION_MICROSECONDS = ADMISSION_SHED + 3,
+		CRYPTO_ENCRYPT_NANOSECONDS,
+		CRYPTO_DECRYPT_NANOSECONDS,
+		DECODE_LATENCY,
+		DECODE_NANOSECONDS = DECODE_LATENCY + (ZT_METRICS_VERB_COUNT * ZT_METRICS_LATENCY_BUCKETS),
+		COUNTER_COUNT = DECODE_NANOSECONDS + ZT_METRICS_VERB_COUNT
+	};
+
+	/**
+	 * Add to a counter
+	 *
+	 * @param c Counter
+	 * @param n Amount to add
+	 */
+	static inline void add(const unsigned int c,const uint64_t n) { _add(_local().c[c],n); }
+
+	/**
+	 * Count an authenticated incoming packet
+	 *
+	 * @param verb Verb (only the low 5 bits are used)
+	 * @param len Packet size
+	 */
+	static inline void packetIn(const unsigned int verb,const unsigned int len)
+	{
+		_Block &b = _local();
+		_add(b.c[PACKETS_IN + (verb & 0x1f)],1);
+		_add(b.c[BYTES_IN + (verb & 0x1f)],len);
+	}
+
+	/**
+	 * Count an outgoing packet
+	 *
+	 * @param verb Verb (only the low 5 bits are used)
+	 * @param len Packet size
+	 */
+	static inline void packetOut(const unsigned int verb,const unsigned int len)
+	{
+		_Block &b = _local();
+		_add(b.c[PACKETS_OUT + (verb & 0x1f)],1);
+		_add(b.c[BYTES_OUT + (verb & 0x1f)],len);
+	}
+
+	/**
+	 * @param reason Drop reason (ZT_MetricsDropReason)
+	 */
+	static inline void drop(const ZT_MetricsDropReason reason) { _add(_local().c[DROPS + (unsigned int)reason],1); }
+
+	/**
+	 * Count a rule evaluation and pass its result through
+	 *
+	 * @param nwid Network ID
+	 * @param outbound True for outgoing filter, false for incoming
+	 * @param accept Filter result (accepted if greater than zero)
+	 * @return accept
+	 */
+	static inline int filterResult(const uint64_t nwid,const bool outbound,const int accept)
+	{
+		_add(_local().c[(outbound ? FILTER_OUT_ACCEPTED : FILTER_IN_ACCEPTED) + ((accept > 0) ? 0 : 1)],1);
+		ZT_PROBE3(filter__verdict,nwid,(unsigned int)outbound,accept);
+		return accept;
+	}
+	static inline bool filterResult(const uint64_t nwid,const bool outbound,const bool accept) { return (filterResult(nwid,outbound,accept ? 1 : 0) > 0); }
+
+	/**
+	 * Count a frame to or from a network's tap
+	 *
+	 * @param nwid Network ID
+	 * @param outbound True for frames from the tap, false for frames delivered to it
+	 * @param len Frame payload length
+	 */
+	static inline void networkFrame(const uint64_t nwid,const bool outbound,const unsigned int len)
+	{
+		_NetworkSlot &s = _network(_local(),nwid);
+		_add(s.v[outbound ? 2 : 0],1);
+		_add(s.v[outbound ? 3 : 1],len);
+	}
+
+	/**
+	 * Times the enclosing scope for one in ZT_METRICS_CRYPTO_SAMPLE_RATE uses on each thread
+	 */
+	class CryptoTimer
+	{
+	public:
+		/**
+		 * @param c Counter to add estimated nanoseconds to
+		 */
+		CryptoTimer(const unsigned int c) :
+			_c(c),
+			_sampled(((++_local().cryptoSample) & (ZT_METRICS_CRYPTO_SAMPLE_RATE - 1)) == 0)
+		{
+			if (_sampled)
+				_start = std::chrono::steady_clock::now();
+		}
+
+		~CryptoTimer()
+		{
+			if (_sampled)
+				add(_c,(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count() * ZT_METRICS_CRYPTO_SAMPLE_RATE);
+		}
+
+	private:
+		const unsigned int _c;
+		const bool _sampled;
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	/**
+	 * Records how long the enclosing scope took to decode a packet once its verb is known
+	 *
+	 * Packets whose verb is never set (e.g. failed authentication) are not recorded.
+	 */
+	class DecodeTimer
+	{
+	public:
+		DecodeTimer() :
+			_verb(-1),
+			_start(std::chrono::steady_clock::now()) {}
+
+		~DecodeTimer()
+		{
+			if (_verb < 0)
+				return;
+			const uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+			const uint64_t us = ns / 1000;
+			unsigned int b = 0;
+			while ((b < (ZT_METRICS_LATENCY_BUCKETS - 1))&&(us >= (1ULL << b)))
+				++b;
+			_Block &bl = _local();
+			_add(bl.c[DECODE_LATENCY + ((unsigned int)_verb * ZT_METRICS_LATENCY_BUCKETS) + b],1);
+			_add(bl.c[DECODE_NANOSECONDS + (unsigned int)_verb],ns);
+			ZT_PROBE2(decode__done,_verb,ns);
+		}
+
+		/**
+		 * @param v Verb of packet being decoded (only the low 5 bits are used)
+		 */
+		inline void verb(const unsigned int v) { _verb = (int)(v & 0x1f); }
+
+	private:
+		int _verb;
+		const std::chrono::steady_clock::time_point _start;
+	};
+
+	/**
+	 * Sum counters from all threads
+	 *
+	 * This fills only the counters in ZT_Metrics. Gauges and anything else
+	 * that belongs to a particular node are left alone.
+	 *
+	 * @param m Metrics structure to fill
+	 */
+	static inline void snapshot(ZT_Metrics *m)
+	{
+		uint64_t c[COUNTER_COUNT];
+		memset(c,0,sizeof(c));
+		std::map< uint64_t,ZT_NetworkMetrics > nets;
+		{
+			_Registry &r = _registry();
+			Mutex::Lock _l(r.lock);
+			_sum(*r.retired,c,nets);
+			for(std::vector<_Block *>::const_iterator b(r.blocks.begin());b!=r.blocks.end();++b)
+				_sum(**b,c,nets);
+		}
+
+		for(unsigned int i=0;i<ZT_METRICS_VERB_COUNT;++i) {
+			m->packetsIn[i] = c[PACKETS_IN + i];
+			m->bytesIn[i] = c[BYTES_IN + i];
+			m->packetsOut[i] = c[PACKETS_OUT + i];
+			m->bytesOut[i] = c[BYTES_OUT + i];
+		}
+		for(unsigned int i=0;i<ZT_METRICS_DROP_REASON_COUNT;++i)
+			m->drops[i] = c[DROPS + i];
+		m->filterInAccepted = c[FILTER_IN_ACCEPTED];
+		m->filterInDropped = c[FILTER_IN_DROPPED];
+		m->filterOutAccepted = c[FILTER_OUT_ACCEPTED];
+		m->filterOutDropped = c[FILTER_OUT_DROPPED];
+		m->relayedPackets = c[RELAYED_PACKETS];
+		m->relayedBytes = c[RELAYED_BYTES];
+		m->multicastFrames = c[MULTICAST_FRAMES];
+		m->multicastRecipients = c[MULTICAST_RECIPIENTS];
+		m->fecParitySent = c[FEC_PARITY_SENT];
+		m->fecRecovered = c[FEC_RECOVERED];
+		for(unsigned int i=0;i<3;++i)
+			m->admissionShed[i] = c[ADMISSION_SHED + i];
+		m->admissionMicroseconds = c[ADMISSION_MICROSECONDS];
+		m->cryptoEncryptNanoseconds = c[CRYPTO_ENCRYPT_NANOSECONDS];
+		m->cryptoDecryptNanoseconds = c[CRYPTO_DECRYPT_NANOSECONDS];
+		for(unsigned int i=0;i<ZT_METRICS_VERB_COUNT;++i) {
+			for(unsigned int b=0;b<ZT_METRICS_LATENCY_BUCKETS;++b)
+				m->decodeLatency[i][b] = c[DECODE_LATENCY + (i * ZT_METRICS_LATENCY_BUCKETS) + b];
+			m->decodeNanoseconds[i] = c[DECODE_NANOSECONDS + i];
+		}
+
+		// Different threads can have seen different networks, so the merged set
+		// is capped again with anything past the cap going to the 0 entry
+		ZT_NetworkMetrics other;
+		memset(&other,0,sizeof(other));
+		m->networkCount = 0;
+		for(std::map< uint64_t,ZT_NetworkMetrics >::const_iterator n(nets.begin());n!=nets.end();++n) {
+			if ((n->first)&&(m->networkCount < ZT_METRICS_MAX_NETWORKS)) {
+				m->networks[m->networkCount++] = n->second;
+			} else {
+				other.framesIn += n->second.framesIn;
+				other.bytesIn += n->second.bytesIn;
+				other.framesOut += n->second.framesOut;
+				other.bytesOut += n->second.bytesOut;
+			}
+		}
+		if ((other.framesIn)||(other.framesOut))
+			m->networks[m->networkCount++] = other;
+	}
+
+private:
+	struct _NetworkSlot
+	{
+		std::atomic<uint64_t> nwid;
+		std::atomic<uint64_t> v[4]; // frames in, bytes in, frames out, bytes out
+	};
+
+	struct _Block
+	{
+		_Block(const bool reg);
+		~_Block();
+
+		std::atomic<uint64_t> c[COUNTER_COUNT];
+		_NetworkSlot n[ZT_METRICS_MAX_NETWORKS + 1]; // open addressed by network ID, last is overflow
+		unsigned int cryptoSample;
+		const bool registered;
+	};
+
+	struct _Registry
+	{
+		_Registry() : retired(new _Block(false)) {}
+		Mutex lock;
+		std::vector<_Block *> blocks;
+		_Block *const retired;
+	};
+
+	// Only the owning thread writes a block (or the registry lock holder for
+	// the retired one), so a relaxed load and store is enough
+	static inline void _add(std::atomic<uint64_t> &v,const uint64_t n) { v.store(v.load(std::memory_order_relaxed) + n,std::memory_order_relaxed); }
+
+	static inline _Registry &_registry()
+	{
+		// Never destroyed, since thread-local blocks may outlive static destructors
+		static _Registry *const r = new _Registry();
+		return *r;
+	}
+
+	static inline _Block &_local()
+	{
+		static thread_local _Block b(true);
+		return b;
+	}
+
+	static inline _NetworkSlot &_network(_Block &b,const uint64_t nwid)
+	{
+		if (nwid) {
+			unsigned int i = (unsigned int)((nwid ^ (nwid >> 32)) % ZT_METRICS_MAX_NETWORKS);
+			for(unsigned int k=0;k<ZT_METRICS_MAX_NETWORKS;++k) {
+				_NetworkSlot &s = b.n[i];
+				const uint64_t id = s.nwid.load(std::memory_order_relaxed);
+				if (id == nwid)
+					return s;
+				if (!id) {
+					s.nwid.store(nwid,std::memory_order_relaxed);
+					return s;
+				}
+				i = (i + 1) % ZT_METRICS_MAX_NETWORKS;
+			}
+		}
+		return b.n[ZT_METRICS_MAX_NETWORKS];
+	}
+
+	static inline void _sum(const _Block &b,uint64_t *c,std::map< uint64_t,ZT_NetworkMetrics > &nets)
+	{
+		for(unsigned int i=0;i<COUNTER_COUNT;++i)
+			c[i] += b.c[i].load(std::memory_order_relaxed);
+		for(unsigned int i=0;i<=ZT_METRICS_MAX_NETWORKS;++i) {
+			const uint64_t id = (i < ZT_METRICS_MAX_NETWORKS) ? b.n[i].nwid.load(std::memory_order_relaxed) : 0;
+			if ((!id)&&(i < ZT_METRICS_MAX_NETWORKS))
+				continue;
+			const uint64_t fi = b.n[i].v[0].load(std::memory_order_relaxed),fo = b.n[i].v[2].load(std::memory_order_relaxed);
+			if ((!fi)&&(!fo))
+				continue;
+			ZT_NetworkMetrics &nm = nets[id];
+			nm.networkId = id;
+			nm.framesIn += fi;
+			nm.bytesIn += b.n[i].v[1].load(std::memory_order_relaxed);
+			nm.framesOut += fo;
+			nm.bytesOut += b.n[i].v[3].load(std::memory_order_relaxed);
+		}
+	}
+};
+
+inline Metrics::_Block::_Block(const bool reg) :
+	cryptoSample(0),
+	registered(reg)
+{
+	for(unsigned int i=0;i<COUNTER_COUNT;++i)
+		c[i].store(0,std::memory_order_relaxed);
+	for(unsigned int i=0;i<=ZT_METRICS_MAX_NETWORKS;++i) {
+		n[i].nwid.store(0,std::memory_order_relaxed);
+		for(unsigned int j=0;j<4;++j)
+			n[i].v[j].store(0,std::memory_order_relaxed);
+	}
+	if (registered) {
+		_Registry &r = _registry();
+		Mutex::Lock _l(r.lock);
+		r.blocks.push_back(this);
+	}
+}
+
+inline Metrics::_Block::~_Block()
+{
+	if (!registered)
+		return;
+	_Registry &r = _registry();
+	Mutex::Lock _l(r.lock);
+	for(unsigned int i=0;i<COUNTER_COUNT;++i)
+		_add(r.retired->c[i],c[i].load(std::memory_order_relaxed));
+	for(unsigned int i=0;i<=ZT_METRICS_MAX_NETWORKS;++i) {
+		_NetworkSlot &s = _network(*r.retired,(i < ZT_METRICS_MAX_NETWORKS) ? n[i].nwid.load(std::memory_order_relaxed) : 0);
+		for(unsigned int j=0;j<4;++j)
+			_add(s.v[j],n[i].v[j].load(std::memory_order_relaxed));
+	}
+	for(std::vector<_Block *>::iterator b(r.blocks.begin());b!=r.blocks.end();++b) {
+		if (*b == this) {
+			r.blocks.erase(b);
+			break;
+		}
+	}
+}
+
+} // namespace ZeroTier
+
+#endif
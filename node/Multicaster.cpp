@@ -37,13 +37,21 @@
 #include "CertificateOfMembership.hpp"
 #include "Node.hpp"
 #include "Network.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
 Multicaster::Multicaster(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_groups(256),
-	_gatherAuth(256)
+	_expiry(ZT_CORE_TIMER_TASK_GRANULARITY,renv->node->now()),
+	_checkGroups(16),
+	_groups_m("Multicaster::_groups_m"),
+	_memberCount(0),
+	_maxMembers(ZT_MAX_MULTICAST_MEMBERS),
+	_membersEvicted(0),
+	_gatherAuth(256),
+	_gatherAuth_m("Multicaster::_gatherAuth_m")
 {
 }
 
@@ -66,22 +74,21 @@ void Multicaster::addMultiple(void *tPtr,int64_t now,uint64_t nwid,const Multica
 void Multicaster::remove(uint64_t nwid,const MulticastGroup &mg,const Address &member)
 {
 	Mutex::Lock _l(_groups_m);
-	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	const Multicaster::Key k(nwid,mg);
+	MulticastGroupStatus *s = _groups.get(k);
 	if (s) {
-		for(std::vector<MulticastGroupMember>::iterator m(s->members.begin());m!=s->members.end();++m) {
-			if (m->address == member) {
-				s->members.erase(m);
-				break;
-			}
+		const unsigned long *const i = s->memberIndex.get(member);
+		if (i) {
+			_removeMember(*s,*i);
+			if ((s->members.empty())&&(s->txQueue.empty()))
+				_groups.erase(k);
 		}
 	}
 }
 
-unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const
+unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit)
 {
-	unsigned char *p;
-	unsigned int added = 0,i,k,rptr,totalKnown = 0;
-	uint64_t a,picked[(ZT_PROTO_MAX_PACKET_LENGTH / 5) + 2];
+	unsigned int added = 0,totalKnown = 0;
 
 	if (!limit)
 		return 0;
@@ -104,36 +111,32 @@ unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const
 
 	Mutex::Lock _l(_groups_m);
 
-	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
 	if ((s)&&(!s->members.empty())) {
 		totalKnown += (unsigned int)s->members.size();
 
 		// Members are returned in random order so that repeated gather queries
-		// will return different subsets of a large multicast group.
-		k = 0;
-		while ((added < limit)&&(k < s->members.size())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_PROTO_MAX_PACKET_LENGTH)) {
-			rptr = (unsigned int)RR->node->prng();
-
-restart_member_scan:
-			a = s->members[rptr % (unsigned int)s->members.size()].address.toInt();
-			for(i=0;i<k;++i) {
-				if (picked[i] == a) {
-					++rptr;
-					goto restart_member_scan;
-				}
-			}
-			picked[k++] = a;
-
-			if (queryingPeer.toInt() != a) { // do not return the peer that is making the request as a result
-				p = (unsigned char *)appendTo.appendField(ZT_ADDRESS_LENGTH);
-				*(p++) = (unsigned char)((a >> 32) & 0xff);
-				*(p++) = (unsigned char)((a >> 24) & 0xff);
-				*(p++) = (unsigned char)((a >> 16) & 0xff);
-				*(p++) = (unsigned char)((a >> 8) & 0xff);
-				*p = (unsigned char)(a & 0xff);
+		// will return different subsets of a large multicast group. A recent
+		// pick is reused as is, since roots get the same gather from many peers.
+		const int64_t now = RR->node->now();
+		const unsigned long want = std::min((unsigned long)limit + 1,(unsigned long)s->members.size()); // one spare in case the querying peer was picked
+		const bool cached = (((now - s->gatherCacheTime) < ZT_MULTICAST_GATHER_CACHE_TTL)&&(s->gatherCached >= want));
+		const unsigned long n = (cached) ? s->gatherCached : (unsigned long)s->members.size();
+		unsigned long k = 0;
+		while ((added < limit)&&(k < n)&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_PROTO_MAX_PACKET_LENGTH)) {
+			const Address &a = (cached) ? s->members[k].address : _pickMember(*s,k);
+			++k;
+			if (a != queryingPeer) { // do not return the peer that is making the request as a result
+				a.appendTo(appendTo);
 				++added;
 			}
 		}
+		if (!cached) {
+			if (k < n)
+				_pickMember(*s,k++);
+			s->gatherCached = k;
+			s->gatherCacheTime = now;
+		}
 	}
 
 	appendTo.setAt(totalAt,(uint32_t)totalKnown);
@@ -149,7 +152,7 @@ std::vector<Address> Multicaster::getMembers(uint64_t nwid,const MulticastGroup
 	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
 	if (!s)
 		return ls;
-	for(std::vector<MulticastGroupMember>::const_reverse_iterator m(s->members.rbegin());m!=s->members.rend();++m) {
+	for(std::vector< MulticastGroupMember,HugePageAllocator<MulticastGroupMember> >::const_reverse_iterator m(s->members.rbegin());m!=s->members.rend();++m) {
 		ls.push_back(m->address);
 		if (ls.size() >= limit)
 			break;
@@ -168,13 +171,12 @@ void Multicaster::send(
 	const void *data,
 	unsigned int len)
 {
-	unsigned long idxbuf[4096];
-	unsigned long *indexes = idxbuf;
+	Metrics::add(Metrics::MULTICAST_FRAMES,1);
 
 	// If we're in hub-and-spoke designated multicast replication mode, see if we
 	// have a multicast replicator active. If so, pick the best and send it
-	// there. If we are a multicast replicator or if none are alive, fall back
-	// to sender replication. Note that bridges do not do this since this would
+	// there. If we are a multicast replicator we send to the whole group
+	// ourselves, and if none are alive we fall back to sender replication. Note that bridges do not do this since this would
 	// break bridge route learning. This is sort of an edge case limitation of
 	// the current protocol and could be fixed, but fixing it would add more
 	// complexity than the fix is probably worth. Bridges are generally high
@@ -200,41 +202,33 @@ void Multicaster::send(
 				}
 				if (bestMulticastReplicator) {
 					Packet outp(bestMulticastReplicator->address(),RR->identity.address(),Packet::VERB_MULTICAST_FRAME);
-					outp.append((uint64_t)network->id());
-					outp.append((uint8_t)0x0c); // includes source MAC | please replicate
-					((src) ? src : MAC(RR->identity.address(),network->id())).appendTo(outp);
-					mg.mac().appendTo(outp);
-					outp.append((uint32_t)mg.adi());
-					outp.append((uint16_t)etherType);
-					outp.append(data,len);
+					Packet::Writer w(outp,8 + 1 + 6 + 6 + 4 + 2 + len);
+					w.put((uint64_t)network->id());
+					w.put((uint8_t)0x0c); // includes source MAC | please replicate
+					((src) ? src : MAC(RR->identity.address(),network->id())).copyTo(w.field(6),6);
+					mg.mac().copyTo(w.field(6),6);
+					w.put((uint32_t)mg.adi());
+					w.put((uint16_t)etherType);
+					w.put(data,len);
 					if (!network->config().disableCompression()) outp.compress();
 					outp.armor(bestMulticastReplicator->key(),true);
+					Metrics::add(Metrics::MULTICAST_RECIPIENTS,1);
 					bestMulticastReplicatorPath->send(RR,tPtr,outp.data(),outp.size(),now);
 					return;
 				}
+			} else {
+				replicate(tPtr,now,network,origin,mg,(src) ? src : MAC(RR->identity.address(),network->id()),etherType,data,len,0,0);
+				return;
 			}
 		}
 	}
 
 	try {
 		Mutex::Lock _l(_groups_m);
-		MulticastGroupStatus &gs = _groups[Multicaster::Key(network->id(),mg)];
-
-		if (!gs.members.empty()) {
-			// Allocate a memory buffer if group is monstrous
-			if (gs.members.size() > (sizeof(idxbuf) / sizeof(unsigned long)))
-				indexes = new unsigned long[gs.members.size()];
-
-			// Generate a random permutation of member indexes
-			for(unsigned long i=0;i<gs.members.size();++i)
-				indexes[i] = i;
-			for(unsigned long i=(unsigned long)gs.members.size()-1;i>0;--i) {
-				unsigned long j = (unsigned long)RR->node->prng() % (i + 1);
-				unsigned long tmp = indexes[j];
-				indexes[j] = indexes[i];
-				indexes[i] = tmp;
-			}
-		}
+		const Multicaster::Key gk(network->id(),mg);
+		MulticastGroupStatus &gs = _groups[gk];
+		if (gs.members.empty())
+			_checkGroups.set(gk,true);
 
 		Address activeBridges[ZT_MAX_NETWORK_SPECIALISTS];
 		const unsigned int activeBridgeCount = network->config().activeBridges(activeBridges);
@@ -267,9 +261,10 @@ void Multicaster::send(
 				}
 			}
 
+			// Members are picked at random as they are needed, so this costs O(limit) however big the group is
 			unsigned long idx = 0;
 			while ((count < limit)&&(idx < gs.members.size())) {
-				const Address ma(gs.members[indexes[idx++]].address);
+				const Address ma(_pickMember(gs,idx++));
 				if ((std::find(activeBridges,activeBridges + activeBridgeCount,ma) == (activeBridges + activeBridgeCount))&&(ma != origin)) {
 					out.sendOnly(RR,tPtr,ma); // optimization: don't use dedup log if it's a one-pass send
 					++count;
@@ -321,11 +316,12 @@ void Multicaster::send(
 				for(unsigned int k=0;k<numExplicitGatherPeers;++k) {
 					const CertificateOfMembership *com = (network) ? ((network->config().com) ? &(network->config().com) : (const CertificateOfMembership *)0) : (const CertificateOfMembership *)0;
 					Packet outp(explicitGatherPeers[k],RR->identity.address(),Packet::VERB_MULTICAST_GATHER);
-					outp.append(network->id());
-					outp.append((uint8_t)((com) ? 0x01 : 0x00));
-					mg.mac().appendTo(outp);
-					outp.append((uint32_t)mg.adi());
-					outp.append((uint32_t)gatherLimit);
+					Packet::Writer w(outp,8 + 1 + 6 + 4 + 4);
+					w.put(network->id());
+					w.put((uint8_t)((com) ? 0x01 : 0x00));
+					mg.mac().copyTo(w.field(6),6);
+					w.put((uint32_t)mg.adi());
+					w.put((uint32_t)gatherLimit);
 					if (com)
 						com->serialize(outp);
 					RR->node->expectReplyTo(outp.packetId());
@@ -335,6 +331,7 @@ void Multicaster::send(
 
 			gs.txQueue.push_back(OutboundMulticast());
 			OutboundMulticast &out = gs.txQueue.back();
+			_checkGroups.set(gk,true);
 
 			out.init(
 				RR,
@@ -364,56 +361,173 @@ void Multicaster::send(
 
 			unsigned long idx = 0;
 			while ((count < limit)&&(idx < gs.members.size())) {
-				Address ma(gs.members[indexes[idx++]].address);
+				const Address ma(_pickMember(gs,idx++));
 				if (std::find(activeBridges,activeBridges + activeBridgeCount,ma) == (activeBridges + activeBridgeCount)) {
 					out.sendAndLog(RR,tPtr,ma);
 					++count;
 				}
 			}
 		}
-	} catch ( ... ) {} // this is a sanity check to catch any failures and make sure indexes[] still gets deleted
-
-	// Free allocated memory buffer if any
-	if (indexes != idxbuf)
-		delete [] indexes;
+	} catch ( ... ) {} // this is a sanity check to catch any failures
 }
 
-void Multicaster::clean(int64_t now)
+void Multicaster::replicate(
+	void *tPtr,
+	int64_t now,
+	const SharedPtr<Network> &network,
+	const Address &origin,
+	const MulticastGroup &mg,
+	const MAC &src,
+	unsigned int etherType,
+	const void *data,
+	unsigned int len,
+	unsigned int share,
+	unsigned int shares)
 {
-	{
-		Mutex::Lock _l(_groups_m);
-		Multicaster::Key *k = (Multicaster::Key *)0;
-		MulticastGroupStatus *s = (MulticastGroupStatus *)0;
-		Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator mm(_groups);
-		while (mm.next(k,s)) {
-			for(std::list<OutboundMulticast>::iterator tx(s->txQueue.begin());tx!=s->txQueue.end();) {
-				if ((tx->expired(now))||(tx->atLimit()))
-					s->txQueue.erase(tx++);
-				else ++tx;
-			}
+	try {
+		const Multicaster::Key gk(network->id(),mg);
+		std::vector<Address> recipients;
 
-			unsigned long count = 0;
+		if (!shares) {
+			shares = 1;
+			share = 0;
+
+			unsigned long groupSize = 0;
 			{
-				std::vector<MulticastGroupMember>::iterator reader(s->members.begin());
-				std::vector<MulticastGroupMember>::iterator writer(reader);
-				while (reader != s->members.end()) {
-					if ((now - reader->timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
-						*writer = *reader;
-						++writer;
-						++count;
+				Mutex::Lock _l(_groups_m);
+				const MulticastGroupStatus *const s = _groups.get(gk);
+				if (s)
+					groupSize = (unsigned long)s->members.size();
+			}
+
+			if (groupSize > ZT_MULTICAST_REPLICATION_SPLIT_THRESHOLD) {
+				// Live replicators other than us get shares 1..n, we keep share 0
+				Address replicators[ZT_MAX_NETWORK_SPECIALISTS];
+				unsigned int replicatorCount = 0;
+				Address mr[ZT_MAX_NETWORK_SPECIALISTS];
+				const unsigned int mrc = network->config().multicastReplicators(mr);
+				for(unsigned int i=0;i<mrc;++i) {
+					if ((mr[i] != RR->identity.address())&&(mr[i] != origin)) {
+						const SharedPtr<Peer> p(RR->topology->getPeerNoCache(mr[i]));
+						if ((p)&&(p->isAlive(now)))
+							replicators[replicatorCount++] = mr[i];
 					}
-					++reader;
+				}
+
+				if (replicatorCount) {
+					shares = replicatorCount + 1;
+					for(unsigned int i=0;i<replicatorCount;++i) {
+						Packet outp(replicators[i],RR->identity.address(),Packet::VERB_MULTICAST_FRAME);
+						Packet::Writer w(outp,8 + 1 + 6 + 2 + 2 + 6 + 4 + 2 + len);
+						w.put((uint64_t)network->id());
+						w.put((uint8_t)0x14); // includes source MAC | replicate share
+						src.copyTo(w.field(6),6);
+						w.put((uint16_t)(i + 1));
+						w.put((uint16_t)shares);
+						mg.mac().copyTo(w.field(6),6);
+						w.put((uint32_t)mg.adi());
+						w.put((uint16_t)etherType);
+						w.put(data,len);
+						if (!network->config().disableCompression()) outp.compress();
+						RR->sw->send(tPtr,outp,true);
+					}
+				}
+			}
+		}
+
+		// Active bridges get everything, so whoever has share 0 sends to them
+		Address activeBridges[ZT_MAX_NETWORK_SPECIALISTS];
+		const unsigned int activeBridgeCount = network->config().activeBridges(activeBridges);
+		if (share == 0) {
+			for(unsigned int i=0;i<activeBridgeCount;++i)
+				recipients.push_back(activeBridges[i]);
+		}
+
+		{
+			Mutex::Lock _l(_groups_m);
+			const MulticastGroupStatus *const s = _groups.get(gk);
+			if (s) {
+				recipients.reserve(recipients.size() + ((shares > 1) ? (s->members.size() / shares) + 16 : s->members.size()));
+				for(std::vector< MulticastGroupMember,HugePageAllocator<MulticastGroupMember> >::const_iterator m(s->members.begin());m!=s->members.end();++m) {
+					if ((shares > 1)&&((unsigned int)(m->address.toInt() % (uint64_t)shares) != share))
+						continue;
+					if (std::find(activeBridges,activeBridges + activeBridgeCount,m->address) != (activeBridges + activeBridgeCount))
+						continue;
+					// Replicators that got a share packet already deliver the frame locally
+					if ((shares > 1)&&(network->config().isMulticastReplicator(m->address)))
+						continue;
+					recipients.push_back(m->address);
 				}
 			}
+		}
 
-			if (count) {
-				s->members.resize(count);
-			} else if (s->txQueue.empty()) {
-				_groups.erase(*k);
+		OutboundMulticast out;
+		out.init(
+			RR,
+			now,
+			network->id(),
+			network->config().disableCompression(),
+			0,
+			0,
+			src,
+			mg,
+			etherType,
+			data,
+			len);
+
+		for(std::vector<Address>::const_iterator a(recipients.begin());a!=recipients.end();++a) {
+			if ((*a != origin)&&(*a != RR->identity.address()))
+				out.sendOnly(RR,tPtr,*a); // recipients are distinct, so no sent log is needed
+		}
+	} catch ( ... ) {} // this is a sanity check to catch any failures
+}
+
+void Multicaster::clean(int64_t now)
+{
+	{
+		Mutex::Lock _l(_groups_m);
+
+		std::vector<_Expiry> due;
+		_expiry.expire(now,due);
+		for(std::vector<_Expiry>::const_iterator e(due.begin());e!=due.end();++e) {
+			MulticastGroupStatus *const s = _groups.get(e->key);
+			if (!s)
+				continue;
+			const unsigned long *const i = s->memberIndex.get(e->member);
+			if (!i)
+				continue;
+			const unsigned long mi = *i;
+			MulticastGroupMember &m = s->members[mi];
+			if (m.expires != e->deadline)
+				continue; // left and joined again since, so a newer entry exists
+			if ((now - m.timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
+				m.expires = m.timestamp + ZT_MULTICAST_LIKE_EXPIRE;
+				_expiry.add(m.expires,_Expiry(e->key,e->member,m.expires));
 			} else {
-				s->members.clear();
+				_removeMember(*s,mi);
+				if ((s->members.empty())&&(s->txQueue.empty()))
+					_groups.erase(e->key);
 			}
 		}
+
+		Multicaster::Key *k = (Multicaster::Key *)0;
+		bool *pending = (bool *)0;
+		Hashtable<Multicaster::Key,bool>::Iterator t(_checkGroups);
+		while (t.next(k,pending)) {
+			MulticastGroupStatus *const s = _groups.get(*k);
+			if (s) {
+				for(std::list<OutboundMulticast>::iterator tx(s->txQueue.begin());tx!=s->txQueue.end();) {
+					if ((tx->expired(now))||(tx->atLimit()))
+						s->txQueue.erase(tx++);
+					else ++tx;
+				}
+				if (!s->txQueue.empty())
+					continue;
+				if (s->members.empty())
+					_groups.erase(*k);
+			}
+			_checkGroups.erase(*k);
+		}
 	}
 
 	{
@@ -428,6 +542,77 @@ void Multicaster::clean(int64_t now)
 	}
 }
 
+void Multicaster::memoryUsage(ZT_MemoryUsage *mu) const
+{
+	Mutex::Lock _l(_groups_m);
+	Hashtable<Multicaster::Key,MulticastGroupStatus> &groups = const_cast<Multicaster *>(this)->_groups;
+	uint64_t members = 0,bytes = groups.memoryUsage() + _checkGroups.memoryUsage() + (_expiry.size() * sizeof(_Expiry));
+	Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator i(groups);
+	Multicaster::Key *k = (Multicaster::Key *)0;
+	MulticastGroupStatus *s = (MulticastGroupStatus *)0;
+	while (i.next(k,s)) {
+		members += s->members.size();
+		bytes += (s->members.capacity() * sizeof(MulticastGroupMember)) + s->memberIndex.memoryUsage() + (s->txQueue.size() * (sizeof(OutboundMulticast) + (2 * sizeof(void *))));
+	}
+	mu->multicastGroups = groups.size();
+	mu->multicastMembers = members;
+	mu->multicastBytes = bytes;
+	mu->multicastMembersEvicted = _membersEvicted;
+}
+
+void Multicaster::saveState(StateSnapshot &ss)
+{
+	Buffer<8 + 6 + 4 + 2 + (ZT_STATE_SNAPSHOT_MULTICAST_MEMBERS_PER_RECORD * (ZT_ADDRESS_LENGTH + 8))> *const b = new Buffer<8 + 6 + 4 + 2 + (ZT_STATE_SNAPSHOT_MULTICAST_MEMBERS_PER_RECORD * (ZT_ADDRESS_LENGTH + 8))>();
+	Mutex::Lock _l(_groups_m);
+	Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator i(_groups);
+	Multicaster::Key *k = (Multicaster::Key *)0;
+	MulticastGroupStatus *s = (MulticastGroupStatus *)0;
+	while (i.next(k,s)) {
+		const unsigned long n = (unsigned long)s->members.size();
+		for(unsigned long m=0;m<n;) {
+			const unsigned int cnt = (unsigned int)std::min(n - m,(unsigned long)ZT_STATE_SNAPSHOT_MULTICAST_MEMBERS_PER_RECORD);
+			b->clear();
+			b->append(k->nwid);
+			k->mg.mac().appendTo(*b);
+			b->append((uint32_t)k->mg.adi());
+			b->append((uint16_t)cnt);
+			for(unsigned int c=0;c<cnt;++c,++m) {
+				s->members[m].address.appendTo(*b);
+				b->append((uint64_t)s->members[m].timestamp);
+			}
+			ss.add(StateSnapshot::RECORD_MULTICAST_MEMBERS,*b,cnt);
+		}
+	}
+	delete b;
+}
+
+unsigned int Multicaster::restoreState(void *tPtr,int64_t now,StateSnapshot::RecordType t,const Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &b)
+{
+	if (t != StateSnapshot::RECORD_MULTICAST_MEMBERS)
+		return 0;
+	unsigned int restored = 0;
+	try {
+		const uint64_t nwid = b.at<uint64_t>(0);
+		const MulticastGroup mg(MAC(b.field(8,6),6),b.at<uint32_t>(14));
+		const unsigned int cnt = b.at<uint16_t>(18);
+		unsigned int p = 20;
+		Mutex::Lock _l(_groups_m);
+		MulticastGroupStatus &gs = _groups[Multicaster::Key(nwid,mg)];
+		for(unsigned int c=0;c<cnt;++c) {
+			const Address a(b.field(p,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); p += ZT_ADDRESS_LENGTH;
+			const int64_t ts = std::min((int64_t)b.at<uint64_t>(p),now); p += 8;
+			if ((!a)||(gs.memberIndex.contains(a))||((ts + ZT_MULTICAST_LIKE_EXPIRE) <= now))
+				continue;
+			_add(tPtr,ts,nwid,mg,gs,a);
+			if (gs.memberIndex.contains(a))
+				++restored;
+		}
+		if (gs.members.empty())
+			_checkGroups.set(Multicaster::Key(nwid,mg),true);
+	} catch ( ... ) {} // truncated or invalid record
+	return restored;
+}
+
 void Multicaster::addCredential(void *tPtr,const CertificateOfMembership &com,bool alreadyValidated)
 {
 	if ((alreadyValidated)||(com.verify(RR,tPtr) == 0)) {
@@ -441,17 +626,50 @@ void Multicaster::_add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup
 	// assumes _groups_m is locked
 
 	// Do not add self -- even if someone else returns it
-	if (member == RR->identity.address())
+	if (member == RR->identity.address()) {
+		if (gs.members.empty())
+			_checkGroups.set(Multicaster::Key(nwid,mg),true); // our caller may have just created this group
 		return;
+	}
 
-	for(std::vector<MulticastGroupMember>::iterator m(gs.members.begin());m!=gs.members.end();++m) {
-		if (m->address == member) {
-			m->timestamp = now;
+	const unsigned long *const i = gs.memberIndex.get(member);
+	if (i) {
+		gs.members[*i].timestamp = now;
+		return;
+	}
+
+	const unsigned long limit = _maxMembers;
+	if ((limit)&&(_memberCount >= limit)) {
+		// Make room by forgetting whoever in this group was heard from least recently
+		if (gs.members.empty()) {
+			_checkGroups.set(Multicaster::Key(nwid,mg),true);
 			return;
 		}
+		unsigned long lru = 0;
+		for(unsigned long k=1;k<(unsigned long)gs.members.size();++k) {
+			if (gs.members[k].timestamp < gs.members[lru].timestamp)
+				lru = k;
+		}
+		_removeMember(gs,lru);
+		++_membersEvicted;
+
+		// Evicted members leave stale expiration checks behind, so don't let those pile up
+		if (_expiry.size() > (limit * 2)) {
+			_expiry.clear();
+			Hashtable<Multicaster::Key,MulticastGroupStatus>::Iterator g(_groups);
+			Multicaster::Key *k = (Multicaster::Key *)0;
+			MulticastGroupStatus *s = (MulticastGroupStatus *)0;
+			while (g.next(k,s)) {
+				for(std::vector< MulticastGroupMember,HugePageAllocator<MulticastGroupMember> >::const_iterator m(s->members.begin());m!=s->members.end();++m)
+					_expiry.add(m->expires,_Expiry(*k,m->address,m->expires));
+			}
+		}
 	}
 
+	gs.memberIndex.set(member,(unsigned long)gs.members.size());
 	gs.members.push_back(MulticastGroupMember(member,now));
+	++_memberCount;
+	_expiry.add(gs.members.back().expires,_Expiry(Multicaster::Key(nwid,mg),member,gs.members.back().expires));
 
 	for(std::list<OutboundMulticast>::iterator tx(gs.txQueue.begin());tx!=gs.txQueue.end();) {
 		if (tx->atLimit())
@@ -465,4 +683,34 @@ void Multicaster::_add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup
 	}
 }
 
+void Multicaster::_removeMember(MulticastGroupStatus &gs,const unsigned long i)
+{
+	// Move the last member into the hole so members stays dense
+	const Address gone(gs.members[i].address);
+	const unsigned long last = (unsigned long)gs.members.size() - 1;
+	if (i != last) {
+		gs.members[i] = gs.members[last];
+		gs.memberIndex.set(gs.members[i].address,i);
+	}
+	gs.members.pop_back();
+	gs.memberIndex.erase(gone);
+	--_memberCount;
+	if (i < gs.gatherCached)
+		gs.gatherCached = 0;
+}
+
+const Address &Multicaster::_pickMember(MulticastGroupStatus &gs,const unsigned long i)
+{
+	// One step of a Fisher-Yates shuffle: members [0,i) were picked already,
+	// so swap a random one of the rest into position i
+	const unsigned long n = (unsigned long)gs.members.size();
+	const unsigned long j = i + (unsigned long)(RR->node->prng() % (uint64_t)(n - i));
+	if (j != i) {
+		std::swap(gs.members[i],gs.members[j]);
+		gs.memberIndex.set(gs.members[i].address,i);
+		gs.memberIndex.set(gs.members[j].address,j);
+	}
+	return gs.members[i].address;
+}
+
 } // namespace ZeroTier
@@ -36,6 +36,8 @@
 
 #include "Constants.hpp"
 #include "Hashtable.hpp"
+#include "HugePages.hpp"
+#include "TimerWheel.hpp"
 #include "Address.hpp"
 #include "MAC.hpp"
 #include "MulticastGroup.hpp"
@@ -43,6 +45,7 @@
 #include "Utils.hpp"
 #include "Mutex.hpp"
 #include "SharedPtr.hpp"
+#include "StateSnapshot.hpp"
 
 namespace ZeroTier {
 
@@ -53,6 +56,14 @@ class Network;
 
 /**
  * Database of known multicast peers within a network
+ *
+ * Each group keeps its members in a vector with an index by address, so
+ * adding, refreshing and removing a member is O(1) and a random subset of
+ * any size k is picked in O(k) with a partial shuffle. Members that stop
+ * sending LIKEs are expired from a timer wheel rather than by scanning every
+ * group, so clean() only does work for members and queues that are due.
+ * The random pick made by gather() is left at the front of the member list
+ * and reused for further gathers for ZT_MULTICAST_GATHER_CACHE_TTL.
  */
 class Multicaster
 {
@@ -116,7 +127,7 @@ public:
 	 * @return Number of addresses appended
 	 * @throws std::out_of_range Buffer overflow writing to packet
 	 */
-	unsigned int gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const;
+	unsigned int gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit);
 
 	/**
 	 * Get subscribers to a multicast group
@@ -151,13 +162,101 @@ public:
 		unsigned int len);
 
 	/**
-	 * Clean up and resort database
+	 * Replicate a multicast to every known member of a group (designated replicators only)
+	 *
+	 * Unlike send() this is not bounded by the network's multicast limit.
+	 * Members are copied out under lock and sent to afterwards, so the lock
+	 * is not held while thousands of packets are armored. When called while
+	 * handling a wire packet these sends are coalesced by the node's wire
+	 * batch. If shares is zero and the group is larger than
+	 * ZT_MULTICAST_REPLICATION_SPLIT_THRESHOLD, the members are split among
+	 * this and all other live replicators and each gets a copy to deliver to
+	 * its share.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @param network Network
+	 * @param origin Original sender (to not return to sender) or NULL if none
+	 * @param mg Multicast group
+	 * @param src Source Ethernet MAC address
+	 * @param etherType Ethernet frame type
+	 * @param data Packet data
+	 * @param len Length of packet data
+	 * @param share Share of members to deliver to if shares is nonzero
+	 * @param shares Number of shares the group was split into or 0 if this replicator should decide
+	 */
+	void replicate(
+		void *tPtr,
+		int64_t now,
+		const SharedPtr<Network> &network,
+		const Address &origin,
+		const MulticastGroup &mg,
+		const MAC &src,
+		unsigned int etherType,
+		const void *data,
+		unsigned int len,
+		unsigned int share,
+		unsigned int shares);
+
+	/**
+	 * Expire members and outbound multicasts that are due
 	 *
-	 * @param RR Runtime environment
 	 * @param now Current time
 	 */
 	void clean(int64_t now);
 
+	/**
+	 * Limit the number of members remembered in all groups together
+	 *
+	 * Past this a new member takes the place of the least recently heard
+	 * from member of its group, or is ignored if its group has no members
+	 * yet. Lowering the limit doesn't forget anyone at once; members expire
+	 * as usual until the total is under it.
+	 *
+	 * @param maxMembers Maximum number of members or 0 for no limit
+	 */
+	inline void setMaxMembers(const unsigned long maxMembers)
+	{
+		Mutex::Lock _l(_groups_m);
+		_maxMembers = maxMembers;
+	}
+
+	/**
+	 * @return Members forgotten to stay under the limit set by setMaxMembers()
+	 */
+	inline uint64_t membersEvicted() const
+	{
+		Mutex::Lock _l(_groups_m);
+		return _membersEvicted;
+	}
+
+	/**
+	 * @param mu Structure whose multicast fields are filled with approximate memory usage
+	 */
+	void memoryUsage(ZT_MemoryUsage *mu) const;
+
+	/**
+	 * Add the members of all groups to a state snapshot
+	 *
+	 * @param ss Snapshot to add to
+	 */
+	void saveState(StateSnapshot &ss);
+
+	/**
+	 * Restore group members from a state snapshot record
+	 *
+	 * Members keep the time they were last heard from, so they expire when
+	 * they would have if there had been no restart. Members already known or
+	 * already expired are skipped.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @param t Record type (other types are ignored)
+	 * @param b Record payload
+	 * @return Number of members restored
+	 */
+	unsigned int restoreState(void *tPtr,int64_t now,StateSnapshot::RecordType t,const Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &b);
+
 	/**
 	 * Add an authorization credential
 	 *
@@ -201,27 +300,50 @@ private:
 	struct MulticastGroupMember
 	{
 		MulticastGroupMember() {}
-		MulticastGroupMember(const Address &a,uint64_t ts) : address(a),timestamp(ts) {}
+		MulticastGroupMember(const Address &a,int64_t ts) : address(a),timestamp(ts),expires(ts + ZT_MULTICAST_LIKE_EXPIRE) {}
 
 		Address address;
-		uint64_t timestamp; // time of last notification
+		int64_t timestamp; // time of last notification
+		int64_t expires; // deadline of this member's entry in _expiry
 	};
 
 	struct MulticastGroupStatus
 	{
-		MulticastGroupStatus() : lastExplicitGather(0) {}
+		MulticastGroupStatus() : lastExplicitGather(0),gatherCacheTime(0),gatherCached(0),memberIndex(8) {}
 
 		uint64_t lastExplicitGather;
+		int64_t gatherCacheTime; // time members [0,gatherCached) were picked at random by gather()
+		unsigned long gatherCached;
 		std::list<OutboundMulticast> txQueue; // pending outbound multicasts
-		std::vector<MulticastGroupMember> members; // members of this group
+		std::vector< MulticastGroupMember,HugePageAllocator<MulticastGroupMember> > members; // members of this group in no particular order
+		Hashtable<Address,unsigned long> memberIndex; // position of each member in members
+	};
+
+	// A member's expiration check, stale if the member's expires no longer matches
+	struct _Expiry
+	{
+		_Expiry() : key(),member(),deadline(0) {}
+		_Expiry(const Key &k,const Address &m,const int64_t d) : key(k),member(m),deadline(d) {}
+
+		Key key;
+		Address member;
+		int64_t deadline;
 	};
 
+	// These must be called with _groups_m locked
 	void _add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member);
+	void _removeMember(MulticastGroupStatus &gs,const unsigned long i);
+	const Address &_pickMember(MulticastGroupStatus &gs,const unsigned long i);
 
 	const RuntimeEnvironment *const RR;
 
 	Hashtable<Multicaster::Key,MulticastGroupStatus> _groups;
+	TimerWheel<_Expiry> _expiry;
+	Hashtable<Multicaster::Key,bool> _checkGroups; // groups clean() should check for expired multicasts or for being empty
 	Mutex _groups_m;
+	unsigned long _memberCount; // members in all groups
+	unsigned long _maxMembers; // 0 for no limit
+	uint64_t _membersEvicted;
 
 	struct _GatherAuthKey
 	{
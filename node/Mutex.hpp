@@ -29,38 +29,207 @@
 
 #include "Constants.hpp"
 
+#ifdef ZT_MUTEX_PROFILING
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+// Distinct lock names that are profiled separately, the last slot counts all others
+#define ZT_MUTEX_PROFILE_MAX_NAMES 128
+
+namespace ZeroTier {
+
+/**
+ * Contention statistics shared by all mutexes with the same name
+ *
+ * This is only compiled in with ZT_MUTEX_PROFILING. Slots are claimed on
+ * first use of a name and never released, so Mutex can keep a pointer to
+ * its profile and record into it without a lookup. Counters are shared by
+ * all threads, which adds some cache traffic of its own to busy locks.
+ */
+class MutexProfile
+{
+public:
+	/**
+	 * @param name Lock name (must remain valid for the life of the process, normally a literal)
+	 * @return Profile for this name
+	 */
+	static inline MutexProfile *get(const char *name)
+	{
+		MutexProfile *const p = _all();
+		for(unsigned int i=0;i<(ZT_MUTEX_PROFILE_MAX_NAMES - 1);++i) {
+			const char *n = p[i]._name.load(std::memory_order_acquire);
+			if ((!n)&&(p[i]._name.compare_exchange_strong(n,name,std::memory_order_acq_rel)))
+				return &(p[i]);
+			if ((n == name)||(!strcmp(n,name))) // n is now set even if another thread claimed the slot first
+				return &(p[i]);
+		}
+		const char *n = (const char *)0;
+		p[ZT_MUTEX_PROFILE_MAX_NAMES - 1]._name.compare_exchange_strong(n,"(other)",std::memory_order_acq_rel);
+		return &(p[ZT_MUTEX_PROFILE_MAX_NAMES - 1]);
+	}
+
+	/**
+	 * @return Monotonic time in nanoseconds
+	 */
+	static inline uint64_t now() { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+	/**
+	 * Record an acquisition
+	 *
+	 * @param waitStart Time waiting began or 0 if the lock was free
+	 * @return Time of acquisition, to be passed to released()
+	 */
+	inline uint64_t acquired(const uint64_t waitStart)
+	{
+		const uint64_t t = now();
+		_acquisitions.fetch_add(1,std::memory_order_relaxed);
+		if (waitStart) {
+			_contended.fetch_add(1,std::memory_order_relaxed);
+			_waitNs.fetch_add(t - waitStart,std::memory_order_relaxed);
+		}
+		return t;
+	}
+
+	/**
+	 * Record a release
+	 *
+	 * @param acquiredAt Value returned by acquired()
+	 */
+	inline void released(const uint64_t acquiredAt)
+	{
+		const uint64_t ns = now() - acquiredAt;
+		_holdNs.fetch_add(ns,std::memory_order_relaxed);
+		unsigned int b = 0;
+		for(uint64_t x=(ns >> 7);((x)&&(b < (ZT_LOCK_PROFILE_HOLD_BUCKETS - 1)));x>>=1)
+			++b;
+		_hold[b].fetch_add(1,std::memory_order_relaxed);
+	}
+
+	/**
+	 * Copy statistics for all names that have been used
+	 *
+	 * @param out Buffer to fill
+	 * @param max Size of buffer
+	 * @return Number of profiles filled
+	 */
+	static inline unsigned int snapshot(ZT_LockProfile *out,const unsigned int max)
+	{
+		MutexProfile *const p = _all();
+		unsigned int n = 0;
+		for(unsigned int i=0;((i<ZT_MUTEX_PROFILE_MAX_NAMES)&&(n<max));++i) {
+			const char *const name = p[i]._name.load(std::memory_order_acquire);
+			if (!name)
+				continue;
+			ZT_LockProfile &o = out[n++];
+			o.name = name;
+			o.acquisitions = p[i]._acquisitions.load(std::memory_order_relaxed);
+			o.contended = p[i]._contended.load(std::memory_order_relaxed);
+			o.waitNanoseconds = p[i]._waitNs.load(std::memory_order_relaxed);
+			o.holdNanoseconds = p[i]._holdNs.load(std::memory_order_relaxed);
+			for(unsigned int b=0;b<ZT_LOCK_PROFILE_HOLD_BUCKETS;++b)
+				o.hold[b] = p[i]._hold[b].load(std::memory_order_relaxed);
+		}
+		return n;
+	}
+
+private:
+	// Zero initialized and trivially destructible, so usable by mutexes in other static objects
+	static inline MutexProfile *_all()
+	{
+		static MutexProfile p[ZT_MUTEX_PROFILE_MAX_NAMES];
+		return p;
+	}
+
+	std::atomic<const char *> _name;
+	std::atomic<uint64_t> _acquisitions;
+	std::atomic<uint64_t> _contended;
+	std::atomic<uint64_t> _waitNs;
+	std::atomic<uint64_t> _holdNs;
+	std::atomic<uint64_t> _hold[ZT_LOCK_PROFILE_HOLD_BUCKETS];
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_MUTEX_PROFILING
+
 #ifdef __UNIX_LIKE__
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 
 namespace ZeroTier {
 
 #if defined(__GNUC__) && (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__) || defined(__AMD64) || defined(__AMD64__) || defined(_M_X64))
 
-// Inline ticket lock on x64 systems with GCC and CLANG (Mac, Linux) -- this is really fast as long as locking durations are very short
+// Spins before a waiting thread yields the CPU, so that a holder that was
+// preempted (more runnable threads than cores) can run and release the lock
+#define ZT_MUTEX_SPINS_BEFORE_YIELD 1024
+
+// Inline spin lock on x64 systems with GCC and CLANG (Mac, Linux) -- this is really fast as long as locking durations are very short
+//
+// This used to be a ticket lock, but a strict FIFO hand-off stalls every waiter
+// whenever the thread holding the next ticket isn't running, which with more
+// threads calling into the core than there are cores happened constantly.
 class Mutex
 {
 public:
 	Mutex() :
-		nextTicket(0),
-		nowServing(0)
+		_l(0)
 	{
+#ifdef ZT_MUTEX_PROFILING
+		_profile = MutexProfile::get("(unnamed)");
+#endif
+	}
+
+	/**
+	 * @param name Name under which this lock is profiled in ZT_MUTEX_PROFILING builds (must be a literal)
+	 */
+	Mutex(const char *name) :
+		_l(0)
+	{
+#ifdef ZT_MUTEX_PROFILING
+		_profile = MutexProfile::get(name);
+#endif
 	}
 
 	inline void lock() const
 	{
-		const uint16_t myTicket = __sync_fetch_and_add(&(const_cast<Mutex *>(this)->nextTicket),1); 
-		while (nowServing != myTicket) {
-			__asm__ __volatile__("rep;nop"::);
-			__asm__ __volatile__("":::"memory");
-		}   
+		volatile int *const l = &(const_cast<Mutex *>(this)->_l);
+#ifdef ZT_MUTEX_PROFILING
+		uint64_t waitStart = 0;
+#endif
+		while (__sync_lock_test_and_set(l,1)) {
+#ifdef ZT_MUTEX_PROFILING
+			if (!waitStart)
+				waitStart = MutexProfile::now();
+#endif
+			unsigned int spins = 0;
+			while (*l) {
+				if (++spins >= ZT_MUTEX_SPINS_BEFORE_YIELD) {
+					sched_yield();
+					spins = 0;
+				} else {
+					__asm__ __volatile__("rep;nop"::);
+				}
+			}
+		}
+#ifdef ZT_MUTEX_PROFILING
+		const_cast<Mutex *>(this)->_acquired = _profile->acquired(waitStart);
+#endif
 	}
 
 	inline void unlock() const
 	{
-		++(const_cast<Mutex *>(this)->nowServing);
+#ifdef ZT_MUTEX_PROFILING
+		_profile->released(_acquired);
+#endif
+		__sync_lock_release(&(const_cast<Mutex *>(this)->_l));
 	}
 
 	/**
@@ -94,8 +263,11 @@ private:
 	Mutex(const Mutex &) {}
 	const Mutex &operator=(const Mutex &) { return *this; }
 
-	uint16_t nextTicket;
-	uint16_t nowServing;
+	volatile int _l;
+#ifdef ZT_MUTEX_PROFILING
+	MutexProfile *_profile;
+	uint64_t _acquired;
+#endif
 };
 
 #else
@@ -107,6 +279,20 @@ public:
 	Mutex()
 	{
 		pthread_mutex_init(&_mh,(const pthread_mutexattr_t *)0);
+#ifdef ZT_MUTEX_PROFILING
+		_profile = MutexProfile::get("(unnamed)");
+#endif
+	}
+
+	/**
+	 * @param name Name under which this lock is profiled in ZT_MUTEX_PROFILING builds (must be a literal)
+	 */
+	Mutex(const char *name)
+	{
+		pthread_mutex_init(&_mh,(const pthread_mutexattr_t *)0);
+#ifdef ZT_MUTEX_PROFILING
+		_profile = MutexProfile::get(name);
+#endif
 	}
 
 	~Mutex()
@@ -116,11 +302,23 @@ public:
 
 	inline void lock() const
 	{
+#ifdef ZT_MUTEX_PROFILING
+		uint64_t waitStart = 0;
+		if (pthread_mutex_trylock(&((const_cast <Mutex *> (this))->_mh)) != 0) {
+			waitStart = MutexProfile::now();
+			pthread_mutex_lock(&((const_cast <Mutex *> (this))->_mh));
+		}
+		const_cast<Mutex *>(this)->_acquired = _profile->acquired(waitStart);
+#else
 		pthread_mutex_lock(&((const_cast <Mutex *> (this))->_mh));
+#endif
 	}
 
 	inline void unlock() const
 	{
+#ifdef ZT_MUTEX_PROFILING
+		_profile->released(_acquired);
+#endif
 		pthread_mutex_unlock(&((const_cast <Mutex *> (this))->_mh));
 	}
 
@@ -153,6 +351,10 @@ private:
 	const Mutex &operator=(const Mutex &) { return *this; }
 
 	pthread_mutex_t _mh;
+#ifdef ZT_MUTEX_PROFILING
+	MutexProfile *_profile;
+	uint64_t _acquired;
+#endif
 };
 
 #endif
@@ -175,6 +377,22 @@ public:
 	Mutex()
 	{
 		InitializeCriticalSection(&_cs);
+#ifdef ZT_MUTEX_PROFILING
+		_profile = MutexProfile::get("(unnamed)");
+		_depth = 0;
+#endif
+	}
+
+	/**
+	 * @param name Name under which this lock is profiled in ZT_MUTEX_PROFILING builds (must be a literal)
+	 */
+	Mutex(const char *name)
+	{
+		InitializeCriticalSection(&_cs);
+#ifdef ZT_MUTEX_PROFILING
+		_profile = MutexProfile::get(name);
+		_depth = 0;
+#endif
 	}
 
 	~Mutex()
@@ -184,11 +402,25 @@ public:
 
 	inline void lock()
 	{
+#ifdef ZT_MUTEX_PROFILING
+		uint64_t waitStart = 0;
+		if (!TryEnterCriticalSection(&_cs)) {
+			waitStart = MutexProfile::now();
+			EnterCriticalSection(&_cs);
+		}
+		if (++_depth == 1) // critical sections are recursive, time only the outermost hold
+			_acquired = _profile->acquired(waitStart);
+#else
 		EnterCriticalSection(&_cs);
+#endif
 	}
 
 	inline void unlock()
 	{
+#ifdef ZT_MUTEX_PROFILING
+		if (--_depth == 0)
+			_profile->released(_acquired);
+#endif
 		LeaveCriticalSection(&_cs);
 	}
 
@@ -231,6 +463,11 @@ private:
 	const Mutex &operator=(const Mutex &) { return *this; }
 
 	CRITICAL_SECTION _cs;
+#ifdef ZT_MUTEX_PROFILING
+	MutexProfile *_profile;
+	uint64_t _acquired;
+	unsigned int _depth;
+#endif
 };
 
 } // namespace ZeroTier
@@ -43,6 +43,8 @@
 #include "Node.hpp"
 #include "Peer.hpp"
 #include "Trace.hpp"
+#include "Metrics.hpp"
+#include "Shaper.hpp"
 
 #include <set>
 
@@ -79,6 +81,45 @@ static bool _ipv6GetPayload(const uint8_t *frameData,unsigned int frameLen,unsig
 	return false; // overflow == invalid
 }
 
+// Fills in the IP protocol and ports of a frame exactly as the matching rules see them
+static void _ruleFrameIp(const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType,CompiledRules::Frame &f)
+{
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+		f.ipProtocol = (int)frameData[9];
+		switch(frameData[9]) {
+			case 0x06: // TCP
+			case 0x11: // UDP
+			case 0x84: // SCTP
+			case 0x88: // UDPLite
+				if (frameLen > (headerLen + 4)) {
+					f.sourcePort = ((int)frameData[headerLen] << 8) | (int)frameData[headerLen + 1];
+					f.destPort = ((int)frameData[headerLen + 2] << 8) | (int)frameData[headerLen + 3];
+				}
+				break;
+		}
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		unsigned int pos = 0,proto = 0;
+		if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+			f.ipProtocol = (int)(proto & 0xff);
+			switch(proto) {
+				case 0x06: // TCP
+				case 0x11: // UDP
+				case 0x84: // SCTP
+				case 0x88: // UDPLite
+					if (frameLen > (pos + 4)) {
+						// Port zero never matches port ranges for IPv6
+						const int sp = ((int)frameData[pos] << 8) | (int)frameData[pos + 1];
+						const int dp = ((int)frameData[pos + 2] << 8) | (int)frameData[pos + 3];
+						f.sourcePort = (sp > 0) ? sp : -1;
+						f.destPort = (dp > 0) ? dp : -1;
+					}
+					break;
+			}
+		}
+	}
+}
+
 enum _doZtFilterResult
 {
 	DOZTFILTER_NO_MATCH,
@@ -88,6 +129,19 @@ enum _doZtFilterResult
 	DOZTFILTER_SUPER_ACCEPT
 };
 
+// Counts the MATCH entries one evaluation of a compiled rule list looks at, however it returns
+struct _RuleEvaluation
+{
+	_RuleEvaluation(CompiledRules::Counters *const c) : counters(c),entries(0) {}
+	~_RuleEvaluation()
+	{
+		if (counters)
+			counters->evaluated(entries);
+	}
+	CompiledRules::Counters *const counters;
+	unsigned int entries;
+};
+
 static _doZtFilterResult _doZtFilter(
 	const RuntimeEnvironment *RR,
 	Trace::RuleResultLog &rrl,
@@ -106,7 +160,8 @@ static _doZtFilterResult _doZtFilter(
 	const unsigned int ruleCount,
 	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
 	unsigned int &ccLength, // MUTABLE -- set to length of packet payload to TEE
-	bool &ccWatch) // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+	bool &ccWatch, // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+	const CompiledRules *compiled) // compiled form of rules, or NULL to evaluate and log every rule
 {
 	// Set to true if we are a TEE/REDIRECT/WATCH target
 	bool superAccept = false;
@@ -117,12 +172,41 @@ static _doZtFilterResult _doZtFilter(
 
 	rrl.clear();
 
+	_RuleEvaluation ev((compiled) ? compiled->counters() : (CompiledRules::Counters *)0);
+
+	uint64_t candidates[ZT_COMPILEDRULES_MAX_WORDS];
+	unsigned int nextSet = 0,nextSetStart = 0;
+	if (compiled) {
+		CompiledRules::Frame f;
+		f.ztSource = ztSource.toInt();
+		f.ztDest = ztDest.toInt();
+		f.etherType = etherType;
+		f.ipProtocol = -1;
+		f.sourcePort = -1;
+		f.destPort = -1;
+		if (compiled->usesIp())
+			_ruleFrameIp(frameData,frameLen,etherType,f);
+		compiled->candidates(f,candidates);
+	}
+
 	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		if ((compiled)&&(rn == nextSetStart)) {
+			// Jump to the next set that might match, since those in between can't
+			// and not matching has no effect for them.
+			nextSet = compiled->nextCandidate(candidates,nextSet);
+			if (nextSet >= compiled->setCount())
+				break;
+			rn = compiled->setStart(nextSet);
+			nextSetStart = compiled->setEnd(nextSet++) + 1;
+		}
+
 		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f);
 
 		// First check if this is an ACTION
 		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
 			if (thisSetMatches) {
+				if (ev.counters)
+					ev.counters->hit(nextSet - 1); // counters only exist when compiled, so this is the set being evaluated
 				switch(rt) {
 					case ZT_NETWORK_RULE_ACTION_DROP:
 						return DOZTFILTER_DROP;
@@ -533,6 +617,7 @@ static _doZtFilterResult _doZtFilter(
 		}
 
 		rrl.log(rn,thisRuleMatches,thisSetMatches);
+		++ev.entries;
 
 		if ((rules[rn].t & 0x40))
 			thisSetMatches |= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
@@ -542,10 +627,75 @@ static _doZtFilterResult _doZtFilter(
 	return DOZTFILTER_NO_MATCH;
 }
 
+// What an OS port would have to do to go from one external config to another (ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_*)
+static unsigned int _configChanges(const ZT_VirtualNetworkConfig &o,const ZT_VirtualNetworkConfig &n)
+{
+	unsigned int c = 0;
+	if (o.assignedAddressCount != n.assignedAddressCount) {
+		c |= ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ADDRESSES;
+	} else {
+		for(unsigned int i=0;i<n.assignedAddressCount;++i) {
+			if (*reinterpret_cast<const InetAddress *>(&(o.assignedAddresses[i])) != *reinterpret_cast<const InetAddress *>(&(n.assignedAddresses[i]))) {
+				c |= ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ADDRESSES;
+				break;
+			}
+		}
+	}
+	if (o.routeCount != n.routeCount) {
+		c |= ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ROUTES;
+	} else {
+		for(unsigned int i=0;i<n.routeCount;++i) {
+			if ( (*reinterpret_cast<const InetAddress *>(&(o.routes[i].target)) != *reinterpret_cast<const InetAddress *>(&(n.routes[i].target))) ||
+			     (*reinterpret_cast<const InetAddress *>(&(o.routes[i].via)) != *reinterpret_cast<const InetAddress *>(&(n.routes[i].via))) ||
+			     (o.routes[i].flags != n.routes[i].flags) ||
+			     (o.routes[i].metric != n.routes[i].metric) ) {
+				c |= ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ROUTES;
+				break;
+			}
+		}
+	}
+	if (o.mtu != n.mtu)
+		c |= ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_MTU;
+	if ((o.mac != n.mac)||(strcmp(o.name,n.name) != 0)||(o.status != n.status)||(o.type != n.type)||(o.bridge != n.bridge)||(o.broadcastEnabled != n.broadcastEnabled)||(o.dhcp != n.dhcp))
+		c |= ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_PORT;
+	return c;
+}
+
 } // anonymous namespace
 
 const ZeroTier::MulticastGroup Network::BROADCAST(ZeroTier::MAC(0xffffffffffffULL),0);
 
+void Network::_FlowKey::set(const bool inbound,const Address &zs,const Address &zd,const MAC &ms,const MAC &md,const uint8_t *frameData,const unsigned int frameLen,const unsigned int et,const unsigned int vl)
+{
+	memset(this,0,sizeof(_FlowKey));
+	ztSource = zs.toInt();
+	ztDest = zd.toInt();
+	macSource = ms.toInt();
+	macDest = md.toInt();
+	etherType = et;
+	vlanId = vl;
+	flags = (inbound) ? 0x01 : 0x00;
+
+	// These mirror the conditions under which rules look at each field
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		memcpy(ipSource,frameData + 12,4);
+		memcpy(ipDest,frameData + 16,4);
+		flags |= 0x02;
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+		memcpy(ipSource,frameData + 8,16);
+		memcpy(ipDest,frameData + 24,16);
+		flags |= 0x04;
+	}
+	CompiledRules::Frame f;
+	f.ipProtocol = -1;
+	f.sourcePort = -1;
+	f.destPort = -1;
+	_ruleFrameIp(frameData,frameLen,etherType,f);
+	ipProtocol = f.ipProtocol;
+	sourcePort = f.sourcePort;
+	destPort = f.destPort;
+}
+
 Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *uptr,const NetworkConfig *nconf) :
 	RR(renv),
 	_uPtr(uptr),
@@ -553,13 +703,26 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 	_lastAnnouncedMulticastGroupsUpstream(0),
 	_mac(renv->identity.address(),nwid),
 	_portInitialized(false),
+	_groupsLock("Network::_groupsLock"),
 	_lastConfigUpdate(0),
+	_snapshot(new _Snapshot()),
+	_snapshotLock("Network::_snapshotLock"),
+	_flowCacheHits(0),
+	_flowCacheMisses(0),
+	_deltaFailed(false),
 	_destroyed(false),
 	_netconfFailure(NETCONF_FAILURE_NONE),
-	_portError(0)
+	_portError(0),
+	_ipOwnersLock("Network::_ipOwnersLock"),
+	_capabilityRules(8),
+	_capabilityRulesLock("Network::_capabilityRulesLock"),
+	_credentialExpiry(ZT_CORE_TIMER_TASK_GRANULARITY,renv->node->now()),
+	_credentialExpiry_m("Network::_credentialExpiry_m"),
+	_lock("Network::_lock")
 {
 	for(int i=0;i<ZT_NETWORK_MAX_INCOMING_UPDATES;++i)
 		_incomingConfigChunks[i].ts = 0;
+	_remoteBridgeRoutes.setLimits(renv->node->maxBridgeRoutes(),renv->node->maxBridgeRoutesPerBridge());
 
 	if (nconf) {
 		this->setConfiguration(tPtr,*nconf,false);
@@ -573,7 +736,7 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 		try {
 			int n = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_NETWORK_CONFIG,tmp,dict->unsafeData(),ZT_NETWORKCONFIG_DICT_CAPACITY - 1);
 			if (n > 1) {
-				NetworkConfig *nconf = new NetworkConfig();
+				NetworkConfig *nconf = new NetworkConfig(true);
 				try {
 					if (nconf->fromDictionary(*dict)) {
 						this->setConfiguration(tPtr,*nconf,false);
@@ -600,6 +763,8 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 
 Network::~Network()
 {
+	RR->shaper->setNetworkRate(_id,0);
+
 	ZT_VirtualNetworkConfig ctmp;
 	_externalConfig(&ctmp);
 
@@ -622,83 +787,157 @@ bool Network::filterOutgoingPacket(
 	const unsigned int frameLen,
 	const unsigned int etherType,
 	const unsigned int vlanId)
+{
+	const bool accept = _filterOutgoingPacket(tPtr,noTee,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId);
+	if (FlowTable::sample())
+		_flowTable.frame(RR->node->now(),true,ztSource,ztDest,etherType,frameData,frameLen,accept);
+	return accept;
+}
+
+int Network::filterIncomingPacket(
+	void *tPtr,
+	const SharedPtr<Peer> &sourcePeer,
+	const Address &ztDest,
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId)
+{
+	const int accept = _filterIncomingPacket(tPtr,sourcePeer,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId);
+	if (FlowTable::sample())
+		_flowTable.frame(RR->node->now(),false,sourcePeer->address(),ztDest,etherType,frameData,frameLen,(accept != 0));
+	return accept;
+}
+
+bool Network::_filterOutgoingPacket(
+	void *tPtr,
+	const bool noTee,
+	const Address &ztSource,
+	const Address &ztDest,
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId)
 {
 	const int64_t now = RR->node->now();
 	Address ztFinalDest(ztDest);
 	int localCapabilityIndex = -1;
 	int accept = 0;
 	Trace::RuleResultLog rrl,crrl;
-	Address cc;
-	unsigned int ccLength = 0;
-	bool ccWatch = false;
-
-	Mutex::Lock _l(_lock);
+	Address cc,capCc;
+	unsigned int ccLength = 0,capCcLength = 0;
+	bool ccWatch = false,capCcWatch = false;
 
-	Membership *const membership = (ztDest) ? _memberships.get(ztDest) : (Membership *)0;
+	const SharedPtr<_Snapshot> s(_currentSnapshot());
+	const NetworkConfig &nconf = s->config;
+	const CompiledRules *const compiledRules = (nconf.remoteTraceTarget) ? (const CompiledRules *)0 : &(s->rules); // tracing needs every rule's result
 
-	switch(_doZtFilter(RR,rrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch)) {
+	{
+		_MembershipShard &ms = _shard(ztDest);
+		Mutex::Lock _l(ms.lock);
+
+		Membership *const membership = (ztDest) ? ms.members.get(ztDest) : (Membership *)0;
+
+		// A flow that got a result with no side actions before gets it again without evaluating anything
+		_FlowKey flow;
+		const uint32_t credentialRevision = (membership) ? membership->credentialRevision() : 0;
+		bool cacheable = false;
+		if ((compiledRules)&&(s->flowCache)) {
+			flow.set(false,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId);
+			_FlowVerdict *const fv = ms.flows.get(flow);
+			if ((fv)&&(fv->generation == s->generation)&&(fv->credentialRevision == credentialRevision)) {
+				++_flowCacheHits;
+				fv->lastUsed = now;
+				if ((fv->accept)&&(membership))
+					membership->pushCredentials(RR,tPtr,now,ztDest,nconf,s->credentials,fv->localCapabilityIndex,false);
+				return Metrics::filterResult(_id,true,(fv->accept != 0));
+			}
+			++_flowCacheMisses;
+			cacheable = compiledRules->cacheable();
+		}
 
-		case DOZTFILTER_NO_MATCH: {
-			for(unsigned int c=0;c<_config.capabilityCount;++c) {
-				ztFinalDest = ztDest; // sanity check, shouldn't be possible if there was no match
-				Address cc2;
-				unsigned int ccLength2 = 0;
-				bool ccWatch2 = false;
-				switch (_doZtFilter(RR,crrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.capabilities[c].rules(),_config.capabilities[c].ruleCount(),cc2,ccLength2,ccWatch2)) {
-					case DOZTFILTER_NO_MATCH:
-					case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
-						break;
+		switch(_doZtFilter(RR,rrl,nconf,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf.rules,nconf.ruleCount,cc,ccLength,ccWatch,compiledRules)) {
+
+			case DOZTFILTER_NO_MATCH: {
+				for(unsigned int c=0;c<nconf.capabilityCount;++c) {
+					ztFinalDest = ztDest; // sanity check, shouldn't be possible if there was no match
+					Address cc2;
+					unsigned int ccLength2 = 0;
+					bool ccWatch2 = false;
+					const CompiledRules *const capRules = (compiledRules) ? &(s->capabilities[c]) : (const CompiledRules *)0;
+					cacheable &= ((capRules)&&(capRules->cacheable()));
+					switch (_doZtFilter(RR,crrl,nconf,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf.capabilities[c].rules(),nconf.capabilities[c].ruleCount(),cc2,ccLength2,ccWatch2,capRules)) {
+						case DOZTFILTER_NO_MATCH:
+						case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
+							break;
 
-					case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-					case DOZTFILTER_ACCEPT:
-					case DOZTFILTER_SUPER_ACCEPT: // no difference in behavior on outbound side in capabilities
-						localCapabilityIndex = (int)c;
-						accept = 1;
-
-						if ((!noTee)&&(cc2)) {
-							Membership &m2 = _membership(cc2);
-							m2.pushCredentials(RR,tPtr,now,cc2,_config,localCapabilityIndex,false);
-
-							Packet outp(cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
-							outp.append(_id);
-							outp.append((uint8_t)(ccWatch2 ? 0x16 : 0x02));
-							macDest.appendTo(outp);
-							macSource.appendTo(outp);
-							outp.append((uint16_t)etherType);
-							outp.append(frameData,ccLength2);
-							outp.compress();
-							RR->sw->send(tPtr,outp,true);
-						}
+						case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+						case DOZTFILTER_ACCEPT:
+						case DOZTFILTER_SUPER_ACCEPT: // no difference in behavior on outbound side in capabilities
+							localCapabilityIndex = (int)c;
+							accept = 1;
+
+							if (cc2) {
+								cacheable = false;
+								capCc = cc2;
+								capCcLength = ccLength2;
+								capCcWatch = ccWatch2;
+							}
 
+							break;
+					}
+					if (accept)
 						break;
 				}
-				if (accept)
-					break;
-			}
-		}	break;
+			}	break;
 
-		case DOZTFILTER_DROP:
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
-			return false;
+			case DOZTFILTER_DROP:
+				if (nconf.remoteTraceTarget)
+					RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+				if ((cacheable)&&(!cc))
+					ms.cacheFlow(flow,s->generation,credentialRevision,0,-1,now);
+				return Metrics::filterResult(_id,true,false);
+
+			case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+			case DOZTFILTER_ACCEPT:
+				accept = 1;
+				break;
 
-		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-		case DOZTFILTER_ACCEPT:
-			accept = 1;
-			break;
+			case DOZTFILTER_SUPER_ACCEPT:
+				accept = 2;
+				break;
+		}
+
+		if ((cacheable)&&(!cc)&&(ztFinalDest == ztDest))
+			ms.cacheFlow(flow,s->generation,credentialRevision,accept,localCapabilityIndex,now);
 
-		case DOZTFILTER_SUPER_ACCEPT:
-			accept = 2;
-			break;
+		if ((accept)&&(membership))
+			membership->pushCredentials(RR,tPtr,now,ztDest,nconf,s->credentials,localCapabilityIndex,false);
 	}
 
-	if (accept) {
-		if (membership)
-			membership->pushCredentials(RR,tPtr,now,ztDest,_config,localCapabilityIndex,false);
+	// Other members are each in some shard of their own, so these go out with none held
+
+	if ((!noTee)&&(capCc)) {
+		_pushCredentialsTo(tPtr,*s,capCc,localCapabilityIndex,now);
+
+		Packet outp(capCc,RR->identity.address(),Packet::VERB_EXT_FRAME);
+		outp.append(_id);
+		outp.append((uint8_t)(capCcWatch ? 0x16 : 0x02));
+		macDest.appendTo(outp);
+		macSource.appendTo(outp);
+		outp.append((uint16_t)etherType);
+		outp.append(frameData,capCcLength);
+		outp.compress();
+		RR->sw->send(tPtr,outp,true);
+	}
 
+	if (accept) {
 		if ((!noTee)&&(cc)) {
-			Membership &m2 = _membership(cc);
-			m2.pushCredentials(RR,tPtr,now,cc,_config,localCapabilityIndex,false);
+			_pushCredentialsTo(tPtr,*s,cc,localCapabilityIndex,now);
 
 			Packet outp(cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(_id);
@@ -712,8 +951,7 @@ bool Network::filterOutgoingPacket(
 		}
 
 		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
-			Membership &m2 = _membership(ztFinalDest);
-			m2.pushCredentials(RR,tPtr,now,ztFinalDest,_config,localCapabilityIndex,false);
+			_pushCredentialsTo(tPtr,*s,ztFinalDest,localCapabilityIndex,now);
 
 			Packet outp(ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(_id);
@@ -725,22 +963,22 @@ bool Network::filterOutgoingPacket(
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
-			return false; // DROP locally, since we redirected
+			if (nconf.remoteTraceTarget)
+				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(nconf.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+			return Metrics::filterResult(_id,true,false); // DROP locally, since we redirected
 		} else {
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,1);
-			return true;
+			if (nconf.remoteTraceTarget)
+				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(nconf.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,1);
+			return Metrics::filterResult(_id,true,true);
 		}
 	} else {
-		if (_config.remoteTraceTarget)
-			RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
-		return false;
+		if (nconf.remoteTraceTarget)
+			RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(nconf.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+		return Metrics::filterResult(_id,true,false);
 	}
 }
 
-int Network::filterIncomingPacket(
+int Network::_filterIncomingPacket(
 	void *tPtr,
 	const SharedPtr<Peer> &sourcePeer,
 	const Address &ztDest,
@@ -751,76 +989,117 @@ int Network::filterIncomingPacket(
 	const unsigned int etherType,
 	const unsigned int vlanId)
 {
+	const int64_t now = RR->node->now();
 	Address ztFinalDest(ztDest);
 	Trace::RuleResultLog rrl,crrl;
 	int accept = 0;
-	Address cc;
-	unsigned int ccLength = 0;
-	bool ccWatch = false;
+	Address cc,capCc;
+	unsigned int ccLength = 0,capCcLength = 0;
+	bool ccWatch = false,capCcWatch = false;
 	const Capability *c = (Capability *)0;
 
-	Mutex::Lock _l(_lock);
+	const SharedPtr<_Snapshot> s(_currentSnapshot());
+	const NetworkConfig &nconf = s->config;
+	const CompiledRules *const compiledRules = (nconf.remoteTraceTarget) ? (const CompiledRules *)0 : &(s->rules); // tracing needs every rule's result
 
-	Membership &membership = _membership(sourcePeer->address());
+	{
+		_MembershipShard &ms = _shard(sourcePeer->address());
+		Mutex::Lock _l(ms.lock);
+
+		Membership &membership = ms.members[sourcePeer->address()];
+
+		_FlowKey flow;
+		bool cacheable = false;
+		if ((compiledRules)&&(s->flowCache)) {
+			flow.set(true,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId);
+			_FlowVerdict *const fv = ms.flows.get(flow);
+			if ((fv)&&(fv->generation == s->generation)&&(fv->credentialRevision == membership.credentialRevision())) {
+				++_flowCacheHits;
+				fv->lastUsed = now;
+				return Metrics::filterResult(_id,false,fv->accept);
+			}
+			++_flowCacheMisses;
+			cacheable = compiledRules->cacheable();
+		}
 
-	switch (_doZtFilter(RR,rrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch)) {
+		switch (_doZtFilter(RR,rrl,nconf,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf.rules,nconf.ruleCount,cc,ccLength,ccWatch,compiledRules)) {
+
+			case DOZTFILTER_NO_MATCH: {
+				Membership::CapabilityIterator mci(membership,nconf);
+				while ((c = mci.next())) {
+					ztFinalDest = ztDest; // sanity check, should be unmodified if there was no match
+					Address cc2;
+					unsigned int ccLength2 = 0;
+					bool ccWatch2 = false;
+					const CompiledRules *const capRules = (compiledRules) ? ms.compiledCapability(*this,*c) : (const CompiledRules *)0;
+					cacheable &= ((capRules)&&(capRules->cacheable()));
+					switch(_doZtFilter(RR,crrl,nconf,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,c->rules(),c->ruleCount(),cc2,ccLength2,ccWatch2,capRules)) {
+						case DOZTFILTER_NO_MATCH:
+						case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
+							break;
+						case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztDest will have been changed in _doZtFilter()
+						case DOZTFILTER_ACCEPT:
+							accept = 1; // ACCEPT
+							break;
+						case DOZTFILTER_SUPER_ACCEPT:
+							accept = 2; // super-ACCEPT
+							break;
+					}
 
-		case DOZTFILTER_NO_MATCH: {
-			Membership::CapabilityIterator mci(membership,_config);
-			while ((c = mci.next())) {
-				ztFinalDest = ztDest; // sanity check, should be unmodified if there was no match
-				Address cc2;
-				unsigned int ccLength2 = 0;
-				bool ccWatch2 = false;
-				switch(_doZtFilter(RR,crrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,c->rules(),c->ruleCount(),cc2,ccLength2,ccWatch2)) {
-					case DOZTFILTER_NO_MATCH:
-					case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
-						break;
-					case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztDest will have been changed in _doZtFilter()
-					case DOZTFILTER_ACCEPT:
-						accept = 1; // ACCEPT
-						break;
-					case DOZTFILTER_SUPER_ACCEPT:
-						accept = 2; // super-ACCEPT
+					if (accept) {
+						if (cc2) {
+							cacheable = false;
+							capCc = cc2;
+							capCcLength = ccLength2;
+							capCcWatch = ccWatch2;
+						}
 						break;
-				}
-
-				if (accept) {
-					if (cc2) {
-						_membership(cc2).pushCredentials(RR,tPtr,RR->node->now(),cc2,_config,-1,false);
-
-						Packet outp(cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
-						outp.append(_id);
-						outp.append((uint8_t)(ccWatch2 ? 0x1c : 0x08));
-						macDest.appendTo(outp);
-						macSource.appendTo(outp);
-						outp.append((uint16_t)etherType);
-						outp.append(frameData,ccLength2);
-						outp.compress();
-						RR->sw->send(tPtr,outp,true);
 					}
-					break;
 				}
-			}
-		}	break;
-
-		case DOZTFILTER_DROP:
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
-			return 0; // DROP
-
-		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-		case DOZTFILTER_ACCEPT:
-			accept = 1; // ACCEPT
-			break;
-		case DOZTFILTER_SUPER_ACCEPT:
-			accept = 2; // super-ACCEPT
-			break;
+			}	break;
+
+			case DOZTFILTER_DROP:
+				if (nconf.remoteTraceTarget)
+					RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
+				if ((cacheable)&&(!cc))
+					ms.cacheFlow(flow,s->generation,membership.credentialRevision(),0,-1,now);
+				return Metrics::filterResult(_id,false,0); // DROP
+
+			case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+			case DOZTFILTER_ACCEPT:
+				accept = 1; // ACCEPT
+				break;
+			case DOZTFILTER_SUPER_ACCEPT:
+				accept = 2; // super-ACCEPT
+				break;
+		}
+
+		if ((cacheable)&&(!cc)&&(ztFinalDest == ztDest))
+			ms.cacheFlow(flow,s->generation,membership.credentialRevision(),accept,-1,now);
+
+		// The matching capability belongs to the membership, so it's traced while this is still locked
+		if (nconf.remoteTraceTarget)
+			RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,((accept)&&(ztDest != ztFinalDest)&&(ztFinalDest)) ? 0 : accept);
 	}
 
+	// Other members are each in some shard of their own, so these go out with none held
 	if (accept) {
+		if (capCc) {
+			_pushCredentialsTo(tPtr,*s,capCc,-1,now);
+
+			Packet outp(capCc,RR->identity.address(),Packet::VERB_EXT_FRAME);
+			outp.append(_id);
+			outp.append((uint8_t)(capCcWatch ? 0x1c : 0x08));
+			macDest.appendTo(outp);
+			macSource.appendTo(outp);
+			outp.append((uint16_t)etherType);
+			outp.append(frameData,capCcLength);
+			outp.compress();
+			RR->sw->send(tPtr,outp,true);
+		}
+
 		if (cc) {
-			_membership(cc).pushCredentials(RR,tPtr,RR->node->now(),cc,_config,-1,false);
+			_pushCredentialsTo(tPtr,*s,cc,-1,now);
 
 			Packet outp(cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(_id);
@@ -834,7 +1113,7 @@ int Network::filterIncomingPacket(
 		}
 
 		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
-			_membership(ztFinalDest).pushCredentials(RR,tPtr,RR->node->now(),ztFinalDest,_config,-1,false);
+			_pushCredentialsTo(tPtr,*s,ztFinalDest,-1,now);
 
 			Packet outp(ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(_id);
@@ -846,20 +1125,16 @@ int Network::filterIncomingPacket(
 			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
-			return 0; // DROP locally, since we redirected
+			return Metrics::filterResult(_id,false,0); // DROP locally, since we redirected
 		}
 	}
 
-	if (_config.remoteTraceTarget)
-		RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,accept);
-	return accept;
+	return Metrics::filterResult(_id,false,accept);
 }
 
 bool Network::subscribedToMulticastGroup(const MulticastGroup &mg,bool includeBridgedGroups) const
 {
-	Mutex::Lock _l(_lock);
+	Mutex::Lock _l(_groupsLock);
 	if (std::binary_search(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg))
 		return true;
 	else if (includeBridgedGroups)
@@ -869,16 +1144,19 @@ bool Network::subscribedToMulticastGroup(const MulticastGroup &mg,bool includeBr
 
 void Network::multicastSubscribe(void *tPtr,const MulticastGroup &mg)
 {
-	Mutex::Lock _l(_lock);
-	if (!std::binary_search(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg)) {
+	{
+		Mutex::Lock _l(_groupsLock);
+		if (std::binary_search(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg))
+			return;
 		_myMulticastGroups.insert(std::upper_bound(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg),mg);
-		_sendUpdatesToMembers(tPtr,&mg);
 	}
+	Mutex::Lock _l(_lock);
+	_sendUpdatesToMembers(tPtr,&mg);
 }
 
 void Network::multicastUnsubscribe(const MulticastGroup &mg)
 {
-	Mutex::Lock _l(_lock);
+	Mutex::Lock _l(_groupsLock);
 	std::vector<MulticastGroup>::iterator i(std::lower_bound(_myMulticastGroups.begin(),_myMulticastGroups.end(),mg));
 	if ( (i != _myMulticastGroups.end()) && (*i == mg) )
 		_myMulticastGroups.erase(i);
@@ -897,6 +1175,7 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 
 	NetworkConfig *nc = (NetworkConfig *)0;
 	uint64_t configUpdateId;
+	bool rerequest = false;
 	{
 		Mutex::Lock _l(_lock);
 
@@ -944,14 +1223,17 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 
 			// New properly verified chunks can be flooded "virally" through the network
 			if (fastPropagate) {
-				Address *a = (Address *)0;
-				Membership *m = (Membership *)0;
-				Hashtable<Address,Membership>::Iterator i(_memberships);
-				while (i.next(a,m)) {
-					if ((*a != source)&&(*a != controller())) {
-						Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CONFIG);
-						outp.append(reinterpret_cast<const uint8_t *>(chunk.data()) + start,chunk.size() - start);
-						RR->sw->send(tPtr,outp,true);
+				for(unsigned int s=0;s<ZT_NETWORK_MEMBERSHIP_SHARDS;++s) {
+					Mutex::Lock _l2(_shards[s].lock);
+					Address *a = (Address *)0;
+					Membership *m = (Membership *)0;
+					Hashtable<Address,Membership>::Iterator i(_shards[s].members);
+					while (i.next(a,m)) {
+						if ((*a != source)&&(*a != controller())) {
+							Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CONFIG);
+							outp.append(reinterpret_cast<const uint8_t *>(chunk.data()) + start,chunk.size() - start);
+							RR->sw->send(tPtr,outp,true);
+						}
 					}
 				}
 			}
@@ -980,20 +1262,27 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 			c->updateId = configUpdateId;
 			c->haveChunks = 0;
 			c->haveBytes = 0;
+			c->data.clear();
 		}
 		if (c->haveChunks >= ZT_NETWORK_MAX_UPDATE_CHUNKS)
 			return false;
 		c->haveChunkIds[c->haveChunks++] = chunkId;
 
-		ZT_FAST_MEMCPY(c->data.unsafeData() + chunkIndex,chunkData,chunkLen);
+		// Only as much is held as the update is long, and only while it's being assembled
+		if (c->data.capacity() < totalLength)
+			c->data.reserve(totalLength);
+		if (c->data.size() < (chunkIndex + chunkLen))
+			c->data.resize(chunkIndex + chunkLen);
+		ZT_FAST_MEMCPY(&(c->data[chunkIndex]),chunkData,chunkLen);
 		c->haveBytes += chunkLen;
 
 		if (c->haveBytes == totalLength) {
-			c->data.unsafeData()[c->haveBytes] = (char)0; // ensure null terminated
+			c->data.resize(c->haveBytes);
 
-			nc = new NetworkConfig();
+			// Decoded straight from the assembled text into arrays sized to fit it
+			nc = new NetworkConfig(true);
 			try {
-				if (!nc->fromDictionary(c->data)) {
+				if (!nc->fromDictionary(c->data.c_str(),(unsigned int)c->data.length() + 1,_config)) {
 					delete nc;
 					nc = (NetworkConfig *)0;
 				}
@@ -1001,9 +1290,20 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 				delete nc;
 				nc = (NetworkConfig *)0;
 			}
+
+			// If it left out blobs we no longer have, ask again for all of it
+			if ((!nc)&&(!_deltaFailed)&&(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index(c->data.c_str(),(unsigned int)c->data.length() + 1).contains(ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP))) {
+				_deltaFailed = true;
+				rerequest = true;
+			}
+
+			std::string().swap(c->data);
 		}
 	}
 
+	if (rerequest)
+		this->requestConfiguration(tPtr);
+
 	if (nc) {
 		this->setConfiguration(tPtr,*nc,true);
 		delete nc;
@@ -1027,12 +1327,41 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 		if (_config == nconf)
 			return 1; // OK config, but duplicate of what we already have
 
-		ZT_VirtualNetworkConfig ctmp;
+		ZT_VirtualNetworkConfig ctmp,otmp;
 		bool oldPortInitialized;
 		{	// do things that require lock here, but unlock before calling callbacks
 			Mutex::Lock _l(_lock);
 
+			_externalConfig(&otmp);
 			_config = nconf;
+			RR->shaper->setNetworkRate(_id,nconf.rateLimit);
+
+			// Filters still holding the old snapshot finish with it, and results they
+			// cache under its generation are never used once the new one is out.
+			// Rules that haven't changed keep their compiled form and with it their counters.
+			_Snapshot *const ns = new _Snapshot();
+			ns->config = nconf;
+			{
+				const SharedPtr<_Snapshot> old(_currentSnapshot());
+				if ((old->rules.counters())&&(old->rules.compiledFrom(nconf.rules,nconf.ruleCount)))
+					ns->rules = old->rules;
+				else ns->rules.compile(RR->identity.address().toInt(),nconf.rules,nconf.ruleCount);
+			}
+			unsigned int totalRules = nconf.ruleCount;
+			ns->capabilities.resize(nconf.capabilityCount);
+			for(unsigned int c=0;c<nconf.capabilityCount;++c) {
+				_compileCapability(nconf.capabilities[c],ns->capabilities[c]);
+				totalRules += nconf.capabilities[c].ruleCount();
+			}
+			ns->credentials = Membership::CredentialTemplate(nconf);
+			ns->flowCache = (totalRules >= ZT_NETWORK_FLOW_CACHE_MIN_RULES);
+			{
+				SharedPtr<_Snapshot> old(ns);
+				Mutex::Lock _l2(_snapshotLock);
+				ns->generation = _snapshot->generation + 1;
+				_snapshot.swap(old);
+			}
+
 			_lastConfigUpdate = RR->node->now();
 			_netconfFailure = NETCONF_FAILURE_NONE;
 
@@ -1040,12 +1369,13 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 			_portInitialized = true;
 
 			_externalConfig(&ctmp);
+			if (oldPortInitialized)
+				ctmp.changes = _configChanges(otmp,ctmp);
 
-			Address *a = (Address *)0;
-			Membership *m = (Membership *)0;
-			Hashtable<Address,Membership>::Iterator i(_memberships);
-			while (i.next(a,m))
-				m->resetPushState();
+			for(unsigned int s=0;s<ZT_NETWORK_MEMBERSHIP_SHARDS;++s) {
+				Mutex::Lock _l2(_shards[s].lock);
+				_shards[s].flows.clear();
+			}
 		}
 
 		_portError = RR->node->configureVirtualNetworkPort(tPtr,_id,&_uPtr,(oldPortInitialized) ? ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE : ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP,&ctmp);
@@ -1218,6 +1548,15 @@ void Network::requestConfiguration(void *tPtr)
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_TAGS,(uint64_t)ZT_MAX_NETWORK_TAGS);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)0);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+	if ((_config)&&(!_deltaFailed)) {
+		// Lets the controller leave out blobs such as rules that haven't changed
+		uint64_t h[ZT_NETWORKCONFIG_DELTA_BLOBS];
+		_config.blobHashes(h);
+		Buffer<ZT_NETWORKCONFIG_DELTA_BLOBS * 8> hb;
+		for(unsigned int b=0;b<ZT_NETWORKCONFIG_DELTA_BLOBS;++b)
+			hb.append(h[b]);
+		rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_DELTA_HASHES,hb);
+	}
 
 	RR->t->networkConfigRequestSent(tPtr,*this,ctrl);
 
@@ -1241,7 +1580,6 @@ void Network::requestConfiguration(void *tPtr)
 	} else {
 		outp.append((unsigned char)0,16);
 	}
-	outp.compress();
 	RR->node->expectReplyTo(outp.packetId());
 	RR->sw->send(tPtr,outp,true);
 }
@@ -1249,16 +1587,19 @@ void Network::requestConfiguration(void *tPtr)
 bool Network::gate(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const int64_t now = RR->node->now();
-	Mutex::Lock _l(_lock);
+	const SharedPtr<_Snapshot> s(_currentSnapshot());
+	const NetworkConfig &nconf = s->config;
+	_MembershipShard &ms = _shard(peer->address());
+	Mutex::Lock _l(ms.lock);
 	try {
-		if (_config) {
-			Membership *m = _memberships.get(peer->address());
-			if ( (_config.isPublic()) || ((m)&&(m->isAllowedOnNetwork(_config))) ) {
+		if (nconf) {
+			Membership *m = ms.members.get(peer->address());
+			if ( (nconf.isPublic()) || ((m)&&(m->isAllowedOnNetwork(nconf))) ) {
 				if (!m)
-					m = &(_membership(peer->address()));
+					m = &(ms.members[peer->address()]);
 				if (m->multicastLikeGate(now)) {
-					m->pushCredentials(RR,tPtr,now,peer->address(),_config,-1,false);
-					_announceMulticastGroupsTo(tPtr,peer->address(),_allMulticastGroups());
+					m->pushCredentials(RR,tPtr,now,peer->address(),nconf,s->credentials,-1,false);
+					_announceMulticastGroupsTo(tPtr,peer->address(),_serializeLikes(_allMulticastGroups(nconf)));
 				}
 				return true;
 			}
@@ -1269,8 +1610,9 @@ bool Network::gate(void *tPtr,const SharedPtr<Peer> &peer)
 
 bool Network::recentlyAssociatedWith(const Address &addr)
 {
-	Mutex::Lock _l(_lock);
-	const Membership *m = _memberships.get(addr);
+	_MembershipShard &ms = _shard(addr);
+	Mutex::Lock _l(ms.lock);
+	const Membership *m = ms.members.get(addr);
 	return ((m)&&(m->recentlyAssociated(RR->node->now())));
 }
 
@@ -1282,7 +1624,10 @@ void Network::clean()
 	if (_destroyed)
 		return;
 
+	_remoteBridgeRoutes.clean(now);
+
 	{
+		Mutex::Lock _l2(_groupsLock);
 		Hashtable< MulticastGroup,uint64_t >::Iterator i(_multicastGroupsBehindMe);
 		MulticastGroup *mg = (MulticastGroup *)0;
 		uint64_t *ts = (uint64_t *)0;
@@ -1292,103 +1637,271 @@ void Network::clean()
 		}
 	}
 
+	// Only members with a credential or revocation that has stopped mattering are cleaned
+	std::vector<_CredentialExpiry> due;
 	{
-		Address *a = (Address *)0;
-		Membership *m = (Membership *)0;
-		Hashtable<Address,Membership>::Iterator i(_memberships);
-		while (i.next(a,m)) {
-			if (!RR->topology->getPeerNoCache(*a))
-				_memberships.erase(*a);
-			else m->clean(now,_config);
+		Mutex::Lock _l2(_credentialExpiry_m);
+		_credentialExpiry.expire(now,due);
+	}
+	for(std::vector<_CredentialExpiry>::const_iterator e(due.begin());e!=due.end();++e) {
+		_MembershipShard &ms = _shard(e->member);
+		Mutex::Lock _l2(ms.lock);
+		Membership *const m = ms.members.get(e->member);
+		if ((m)&&(m->cleanAt() == e->deadline)) {
+			m->setCleanAt(0);
+			_scheduleClean(e->member,*m,_config);
 		}
 	}
-}
 
-void Network::learnBridgeRoute(const MAC &mac,const Address &addr)
-{
-	Mutex::Lock _l(_lock);
-	_remoteBridgeRoutes[mac] = addr;
+	for(unsigned int s=0;s<ZT_NETWORK_MEMBERSHIP_SHARDS;++s) {
+		_MembershipShard &ms = _shards[s];
+		Mutex::Lock _l2(ms.lock);
 
-	// Anti-DOS circuit breaker to prevent nodes from spamming us with absurd numbers of bridge routes
-	while (_remoteBridgeRoutes.size() > ZT_MAX_BRIDGE_ROUTES) {
-		Hashtable< Address,unsigned long > counts;
-		Address maxAddr;
-		unsigned long maxCount = 0;
-
-		MAC *m = (MAC *)0;
-		Address *a = (Address *)0;
-
-		// Find the address responsible for the most entries
 		{
-			Hashtable<MAC,Address>::Iterator i(_remoteBridgeRoutes);
-			while (i.next(m,a)) {
-				const unsigned long c = ++counts[*a];
-				if (c > maxCount) {
-					maxCount = c;
-					maxAddr = *a;
+			Address *a = (Address *)0;
+			Membership *m = (Membership *)0;
+			Hashtable<Address,Membership>::Iterator i(ms.members);
+			while (i.next(a,m)) {
+				if (!RR->topology->getPeerNoCache(*a)) {
+					ms.members.erase(*a);
+					ms.flows.clear(); // a new membership's credential revisions would start over
 				}
 			}
 		}
 
-		// Kill this address from our table, since it's most likely spamming us
 		{
-			Hashtable<MAC,Address>::Iterator i(_remoteBridgeRoutes);
-			while (i.next(m,a)) {
-				if (*a == maxAddr)
-					_remoteBridgeRoutes.erase(*m);
+			Hashtable< _FlowKey,_FlowVerdict >::Iterator i(ms.flows);
+			_FlowKey *k = (_FlowKey *)0;
+			_FlowVerdict *v = (_FlowVerdict *)0;
+			while (i.next(k,v)) {
+				if ((now - v->lastUsed) > ZT_NETWORK_FLOW_CACHE_TTL)
+					ms.flows.erase(*k);
 			}
 		}
 	}
 }
 
+void Network::_scheduleClean(const Address &a,Membership &m,const NetworkConfig &nconf)
+{
+	// assumes a membership shard lock is locked
+	const int64_t next = m.clean(nconf);
+	if (next) {
+		// Deadlines are in config time, which advances about as fast as our own clock
+		const int64_t at = RR->node->now() + std::max((int64_t)ZT_CORE_TIMER_TASK_GRANULARITY,next - nconf.timestamp);
+		if ((!m.cleanAt())||(at < m.cleanAt())) {
+			m.setCleanAt(at);
+			Mutex::Lock _l(_credentialExpiry_m);
+			_credentialExpiry.add(at,_CredentialExpiry(a,at));
+		}
+	}
+}
+
+void Network::memoryUsage(ZT_NetworkMemoryUsage *mu)
+{
+	memset(mu,0,sizeof(ZT_NetworkMemoryUsage));
+	mu->nwid = _id;
+
+	for(unsigned int s=0;s<ZT_NETWORK_MEMBERSHIP_SHARDS;++s) {
+		_MembershipShard &ms = _shards[s];
+		Mutex::Lock _l(ms.lock);
+		mu->members += ms.members.size();
+		mu->memberBytes += ms.members.memoryUsage();
+		Address *a = (Address *)0;
+		Membership *m = (Membership *)0;
+		Hashtable<Address,Membership>::Iterator i(ms.members);
+		while (i.next(a,m))
+			mu->memberBytes += m->heapBytes();
+		mu->flows += ms.flows.size();
+		mu->flowBytes += ms.flows.memoryUsage() + ms.capabilities.memoryUsage();
+	}
+
+	mu->bridgeRoutes = _remoteBridgeRoutes.size();
+	mu->bridgeRouteBytes = _remoteBridgeRoutes.memoryUsage();
+
+	uint64_t groupBytes;
+	{
+		Mutex::Lock _l(_groupsLock);
+		mu->multicastGroups = _myMulticastGroups.size() + _multicastGroupsBehindMe.size();
+		groupBytes = (_myMulticastGroups.capacity() * sizeof(MulticastGroup)) + _multicastGroupsBehindMe.memoryUsage();
+	}
+	{
+		Mutex::Lock _l(_ipOwnersLock);
+		groupBytes += _ipOwners.memoryUsage();
+	}
+
+	mu->bytes = sizeof(Network) + mu->memberBytes + mu->flowBytes + mu->bridgeRouteBytes + groupBytes;
+}
+
+void Network::saveCredentials(StateSnapshot &ss)
+{
+	Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> *const tmp = new Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE>();
+	for(unsigned int s=0;s<ZT_NETWORK_MEMBERSHIP_SHARDS;++s) {
+		_MembershipShard &ms = _shards[s];
+		Mutex::Lock _l(ms.lock);
+		Address *a = (Address *)0;
+		Membership *m = (Membership *)0;
+		Hashtable<Address,Membership>::Iterator i(ms.members);
+		while (i.next(a,m))
+			m->saveCredentials(ss,*tmp);
+	}
+	delete tmp;
+}
+
+void Network::ruleCounters(std::vector< std::pair<int64_t,CompiledRules> > &lists) const
+{
+	lists.clear();
+	lists.push_back(std::pair<int64_t,CompiledRules>(-1,_currentSnapshot()->rules));
+
+	std::vector<uint32_t> ids;
+	{
+		Mutex::Lock _l(_capabilityRulesLock);
+		ids = _capabilityRules.keys();
+		std::sort(ids.begin(),ids.end());
+		for(std::vector<uint32_t>::const_iterator id(ids.begin());id!=ids.end();++id)
+			lists.push_back(std::pair<int64_t,CompiledRules>((int64_t)*id,*(_capabilityRules.get(*id))));
+	}
+}
+
+void Network::tapFilter(std::vector<ZT_VirtualNetworkRule> &rules) const
+{
+	rules.clear();
+	const SharedPtr<_Snapshot> s(_currentSnapshot());
+	const NetworkConfig &nconf = s->config;
+	if ((!nconf)||(nconf.remoteTraceTarget))
+		return;
+
+	std::vector<ZT_VirtualNetworkRule> drops;
+	CompiledRules::dropSubset(nconf.rules,nconf.ruleCount,(nconf.capabilityCount == 0),drops);
+	if (drops.empty())
+		return;
+
+	ZT_VirtualNetworkRule r;
+	memset(&r,0,sizeof(r));
+	r.t = 0x80 | ZT_NETWORK_RULE_MATCH_MAC_SOURCE; // bridged
+	_mac.copyTo(r.v.mac,6);
+	rules.push_back(r);
+	r.t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+	rules.push_back(r);
+	r.t = ZT_NETWORK_RULE_MATCH_MAC_DEST; // reinjected
+	_mac.copyTo(r.v.mac,6);
+	rules.push_back(r);
+	r.t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+	rules.push_back(r);
+	if (nconf.arpEmulation()) {
+		r.t = ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+		r.v.etherType = ZT_ETHERTYPE_ARP;
+		rules.push_back(r);
+		r.t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		rules.push_back(r);
+	}
+	if ((nconf.ndpEmulation())||(nconf.ndpProxy())) {
+		r.t = ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+		r.v.etherType = ZT_ETHERTYPE_IPV6;
+		rules.push_back(r);
+		r.t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+		r.v.ipProtocol = 0x3a; // ICMPv6
+		rules.push_back(r);
+		r.t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		rules.push_back(r);
+	}
+	rules.insert(rules.end(),drops.begin(),drops.end());
+}
+
+void Network::learnBridgeRoute(const MAC &mac,const Address &addr)
+{
+	_remoteBridgeRoutes.learn(mac,addr,RR->node->now());
+}
+
+Address Network::ipOwner(const InetAddress &ip)
+{
+	const InetAddress k(ip.ipOnly());
+	const PackedInetAddress pk(k);
+	Address owner;
+	{
+		Mutex::Lock _l(_ipOwnersLock);
+		const Address *const o = _ipOwners.get(pk);
+		if (!o)
+			return Address();
+		owner = *o;
+	}
+	{
+		const SharedPtr<_Snapshot> s(_currentSnapshot());
+		_MembershipShard &ms = _shard(owner);
+		Mutex::Lock _l(ms.lock);
+		const Membership *const m = ms.members.get(owner);
+		if ((m)&&(m->hasCertificateOfOwnershipFor(s->config,k)))
+			return owner;
+	}
+	Mutex::Lock _l(_ipOwnersLock);
+	const Address *const o = _ipOwners.get(pk);
+	if ((o)&&(*o == owner)) // unless a certificate for someone else came in meanwhile
+		_ipOwners.erase(pk);
+	return Address();
+}
+
 void Network::learnBridgedMulticastGroup(void *tPtr,const MulticastGroup &mg,int64_t now)
 {
+	{
+		Mutex::Lock _l(_groupsLock);
+		const unsigned long tmp = (unsigned long)_multicastGroupsBehindMe.size();
+		_multicastGroupsBehindMe.set(mg,now);
+		if (tmp == _multicastGroupsBehindMe.size())
+			return;
+	}
 	Mutex::Lock _l(_lock);
-	const unsigned long tmp = (unsigned long)_multicastGroupsBehindMe.size();
-	_multicastGroupsBehindMe.set(mg,now);
-	if (tmp != _multicastGroupsBehindMe.size())
-		_sendUpdatesToMembers(tPtr,&mg);
+	_sendUpdatesToMembers(tPtr,&mg);
 }
 
-Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfMembership &com)
+Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfMembership &com,Membership::CredentialBatch *batch)
 {
 	if (com.networkId() != _id)
 		return Membership::ADD_REJECTED;
 	const Address a(com.issuedTo());
-	Mutex::Lock _l(_lock);
-	Membership &m = _membership(a);
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,com);
+	const SharedPtr<_Snapshot> s(_currentSnapshot());
+	_MembershipShard &ms = _shard(a);
+	Mutex::Lock _l(ms.lock);
+	Membership &m = ms.members[a];
+	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,s->config,com,batch);
 	if ((result == Membership::ADD_ACCEPTED_NEW)||(result == Membership::ADD_ACCEPTED_REDUNDANT)) {
-		m.pushCredentials(RR,tPtr,RR->node->now(),a,_config,-1,false);
+		m.pushCredentials(RR,tPtr,RR->node->now(),a,s->config,s->credentials,-1,false);
 		RR->mc->addCredential(tPtr,com,true);
 	}
 	return result;
 }
 
-Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev)
+Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev,Membership::CredentialBatch *batch)
 {
 	if (rev.networkId() != _id)
 		return Membership::ADD_REJECTED;
 
-	Mutex::Lock _l(_lock);
-	Membership &m = _membership(rev.target());
-
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,rev);
+	Membership::AddCredentialResult result;
+	{
+		const SharedPtr<_Snapshot> s(_currentSnapshot());
+		_MembershipShard &ms = _shard(rev.target());
+		Mutex::Lock _l(ms.lock);
+		Membership &m = ms.members[rev.target()];
+		result = m.addCredential(RR,tPtr,s->config,rev,batch);
+		if (result == Membership::ADD_ACCEPTED_NEW)
+			_scheduleClean(rev.target(),m,s->config);
+	}
 
 	if ((result == Membership::ADD_ACCEPTED_NEW)&&(rev.fastPropagate())) {
-		Address *a = (Address *)0;
-		Membership *m = (Membership *)0;
-		Hashtable<Address,Membership>::Iterator i(_memberships);
-		while (i.next(a,m)) {
-			if ((*a != sentFrom)&&(*a != rev.signer())) {
-				Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-				outp.append((uint8_t)0x00); // no COM
-				outp.append((uint16_t)0); // no capabilities
-				outp.append((uint16_t)0); // no tags
-				outp.append((uint16_t)1); // one revocation!
-				rev.serialize(outp);
-				outp.append((uint16_t)0); // no certificates of ownership
-				RR->sw->send(tPtr,outp,true);
+		for(unsigned int s=0;s<ZT_NETWORK_MEMBERSHIP_SHARDS;++s) {
+			Mutex::Lock _l(_shards[s].lock);
+			Address *a = (Address *)0;
+			Membership *m = (Membership *)0;
+			Hashtable<Address,Membership>::Iterator i(_shards[s].members);
+			while (i.next(a,m)) {
+				if ((*a != sentFrom)&&(*a != rev.signer())) {
+					Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
+					outp.append((uint8_t)0x00); // no COM
+					outp.append((uint16_t)0); // no capabilities
+					outp.append((uint16_t)0); // no tags
+					outp.append((uint16_t)1); // one revocation!
+					rev.serialize(outp);
+					outp.append((uint16_t)0); // no certificates of ownership
+					RR->sw->send(tPtr,outp,true);
+				}
 			}
 		}
 	}
@@ -1436,6 +1949,9 @@ void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 	ec->broadcastEnabled = (_config) ? (_config.enableBroadcast() ? 1 : 0) : 0;
 	ec->portError = _portError;
 	ec->netconfRevision = (_config) ? (unsigned long)_config.revision : 0;
+	ec->filterCacheHits = _flowCacheHits;
+	ec->filterCacheMisses = _flowCacheMisses;
+	ec->changes = ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ALL;
 
 	ec->assignedAddressCount = 0;
 	for(unsigned int i=0;i<ZT_MAX_ZT_ASSIGNED_ADDRESSES;++i) {
@@ -1458,19 +1974,23 @@ void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 	}
 }
 
-void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup)
+void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup,LikeBatch *likes,Membership::PushBatch *pushes)
 {
 	// Assumes _lock is locked
 	const int64_t now = RR->node->now();
 
+	const SharedPtr<_Snapshot> s(_currentSnapshot()); // same config as _config while _lock is held
+
+	// Every peer gets the same LIKEs, so they're serialized once for all of them
 	std::vector<MulticastGroup> groups;
 	if (newMulticastGroup)
 		groups.push_back(*newMulticastGroup);
-	else groups = _allMulticastGroups();
+	else groups = _allMulticastGroups(_config);
+	const std::string likesFor(_serializeLikes(groups));
 
 	std::vector<Address> alwaysAnnounceTo;
 
-	if ((newMulticastGroup)||((now - _lastAnnouncedMulticastGroupsUpstream) >= ZT_MULTICAST_ANNOUNCE_PERIOD)) {
+	if ((newMulticastGroup)||((now - _lastAnnouncedMulticastGroupsUpstream) >= ZT_MULTICAST_ANNOUNCE_UPSTREAM_PERIOD)) {
 		if (!newMulticastGroup)
 			_lastAnnouncedMulticastGroupsUpstream = now;
 
@@ -1486,9 +2006,15 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 
 		for(std::vector<Address>::const_iterator a(alwaysAnnounceTo.begin());a!=alwaysAnnounceTo.end();++a) {
 		 // push COM to non-members so they can do multicast request auth
-			if ( (_config.com) && (!_memberships.contains(*a)) && (*a != RR->identity.address()) ) {
+			bool isMember;
+			{
+				_MembershipShard &ms = _shard(*a);
+				Mutex::Lock _l(ms.lock);
+				isMember = ms.members.contains(*a);
+			}
+			if ( (!s->credentials.com().empty()) && (!isMember) && (*a != RR->identity.address()) ) {
 				Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-				_config.com.serialize(outp);
+				outp.append(s->credentials.com().data(),(unsigned int)s->credentials.com().size());
 				outp.append((uint8_t)0x00);
 				outp.append((uint16_t)0); // no capabilities
 				outp.append((uint16_t)0); // no tags
@@ -1496,64 +2022,138 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 				outp.append((uint16_t)0); // no certificates of ownership
 				RR->sw->send(tPtr,outp,true);
 			}
-			_announceMulticastGroupsTo(tPtr,*a,groups);
+			_announceMulticastGroupsTo(tPtr,*a,likesFor,likes);
 		}
 	}
 
-	{
+	for(unsigned int sh=0;sh<ZT_NETWORK_MEMBERSHIP_SHARDS;++sh) {
+		Mutex::Lock _l(_shards[sh].lock);
 		Address *a = (Address *)0;
 		Membership *m = (Membership *)0;
-		Hashtable<Address,Membership>::Iterator i(_memberships);
+		Hashtable<Address,Membership>::Iterator i(_shards[sh].members);
 		while (i.next(a,m)) {
-			m->pushCredentials(RR,tPtr,now,*a,_config,-1,false);
+			m->pushCredentials(RR,tPtr,now,*a,_config,s->credentials,-1,false,pushes);
 			if ( ( m->multicastLikeGate(now) || (newMulticastGroup) ) && (m->isAllowedOnNetwork(_config)) && (!std::binary_search(alwaysAnnounceTo.begin(),alwaysAnnounceTo.end(),*a)) )
-				_announceMulticastGroupsTo(tPtr,*a,groups);
+				_announceMulticastGroupsTo(tPtr,*a,likesFor);
 		}
 	}
 }
 
-void Network::_announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups)
+// Appends as many of the LIKE entries in likes as fit in outp and returns their length
+static inline unsigned int _appendLikes(Packet &outp,const char *likes,const unsigned int len)
+{
+	unsigned int n = 0;
+	for(unsigned int size=outp.size();(n < len)&&((size + 24) < ZT_PROTO_MAX_PACKET_LENGTH);size+=ZT_NETWORK_LIKE_SIZE)
+		n += ZT_NETWORK_LIKE_SIZE;
+	outp.append(likes,n);
+	return n;
+}
+
+void Network::_announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::string &likes,LikeBatch *batch)
 {
 	// Assumes _lock is locked
-	Packet outp(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+	if (batch) {
+		batch->append(RR,tPtr,peer,likes);
+		return;
+	}
 
-	for(std::vector<MulticastGroup>::const_iterator mg(allMulticastGroups.begin());mg!=allMulticastGroups.end();++mg) {
+	Packet outp(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+	for(unsigned int i=0;i<(unsigned int)likes.size();) {
 		if ((outp.size() + 24) >= ZT_PROTO_MAX_PACKET_LENGTH) {
-			outp.compress();
 			RR->sw->send(tPtr,outp,true);
 			outp.reset(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
 		}
-
-		// network ID, MAC, ADI
-		outp.append((uint64_t)_id);
-		mg->mac().appendTo(outp);
-		outp.append((uint32_t)mg->adi());
+		i += _appendLikes(outp,likes.data() + i,(unsigned int)likes.size() - i);
 	}
 
-	if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH) {
-		outp.compress();
+	if (outp.size() > ZT_PROTO_MIN_PACKET_LENGTH)
 		RR->sw->send(tPtr,outp,true);
+}
+
+Network::LikeBatch::~LikeBatch()
+{
+	Address *a = (Address *)0;
+	Packet **p = (Packet **)0;
+	Hashtable<Address,Packet *>::Iterator i(_packets);
+	while (i.next(a,p))
+		delete *p;
+}
+
+void Network::LikeBatch::append(const RuntimeEnvironment *RR,void *tPtr,const Address &peer,const std::string &likes)
+{
+	Packet *&outp = _packets[peer];
+	if (!outp)
+		outp = new Packet(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+	for(unsigned int i=0;i<(unsigned int)likes.size();) {
+		if ((outp->size() + 24) >= ZT_PROTO_MAX_PACKET_LENGTH) {
+			RR->sw->send(tPtr,*outp,true);
+			outp->reset(peer,RR->identity.address(),Packet::VERB_MULTICAST_LIKE);
+		}
+		i += _appendLikes(*outp,likes.data() + i,(unsigned int)likes.size() - i);
 	}
 }
 
-std::vector<MulticastGroup> Network::_allMulticastGroups() const
+void Network::LikeBatch::send(const RuntimeEnvironment *RR,void *tPtr)
+{
+	Address *a = (Address *)0;
+	Packet **p = (Packet **)0;
+	Hashtable<Address,Packet *>::Iterator i(_packets);
+	while (i.next(a,p)) {
+		Packet *const outp = *p;
+		_packets.erase(*a);
+		if (outp->size() > ZT_PROTO_MIN_PACKET_LENGTH)
+			RR->sw->send(tPtr,*outp,true);
+		delete outp;
+	}
+}
+
+std::vector<MulticastGroup> Network::_allMulticastGroups(const NetworkConfig &nconf) const
 {
-	// Assumes _lock is locked
 	std::vector<MulticastGroup> mgs;
-	mgs.reserve(_myMulticastGroups.size() + _multicastGroupsBehindMe.size() + 1);
-	mgs.insert(mgs.end(),_myMulticastGroups.begin(),_myMulticastGroups.end());
-	_multicastGroupsBehindMe.appendKeys(mgs);
-	if ((_config)&&(_config.enableBroadcast()))
+	{
+		Mutex::Lock _l(_groupsLock);
+		mgs.reserve(_myMulticastGroups.size() + _multicastGroupsBehindMe.size() + 1);
+		mgs.insert(mgs.end(),_myMulticastGroups.begin(),_myMulticastGroups.end());
+		_multicastGroupsBehindMe.appendKeys(mgs);
+	}
+	if ((nconf)&&(nconf.enableBroadcast()))
 		mgs.push_back(Network::BROADCAST);
 	std::sort(mgs.begin(),mgs.end());
 	mgs.erase(std::unique(mgs.begin(),mgs.end()),mgs.end());
 	return mgs;
 }
 
-Membership &Network::_membership(const Address &a)
+std::string Network::_serializeLikes(const std::vector<MulticastGroup> &groups) const
 {
-	// assumes _lock is locked
-	return _memberships[a];
+	std::string likes;
+	likes.reserve(groups.size() * ZT_NETWORK_LIKE_SIZE);
+	for(std::vector<MulticastGroup>::const_iterator mg(groups.begin());mg!=groups.end();++mg) {
+		// network ID, MAC, ADI
+		uint8_t e[ZT_NETWORK_LIKE_SIZE];
+		const uint64_t nwid = Utils::hton((uint64_t)_id);
+		const uint32_t adi = Utils::hton((uint32_t)mg->adi());
+		ZT_FAST_MEMCPY(e,&nwid,8);
+		mg->mac().copyTo(e + 8,6);
+		ZT_FAST_MEMCPY(e + 14,&adi,4);
+		likes.append((const char *)e,sizeof(e));
+	}
+	return likes;
+}
+
+void Network::_compileCapability(const Capability &cap,CompiledRules &cr)
+{
+	Mutex::Lock _l(_capabilityRulesLock);
+	CompiledRules &c = _capabilityRules[cap.id()];
+	if ((!c.counters())||(!c.compiledFrom(cap.rules(),cap.ruleCount())))
+		c.compile(RR->identity.address().toInt(),cap.rules(),cap.ruleCount());
+	cr = c;
+}
+
+void Network::_pushCredentialsTo(void *tPtr,const _Snapshot &s,const Address &to,const int localCapabilityIndex,const int64_t now)
+{
+	_MembershipShard &ms = _shard(to);
+	Mutex::Lock _l(ms.lock);
+	ms.members[to].pushCredentials(RR,tPtr,now,to,s.config,s.credentials,localCapabilityIndex,false);
 }
 
 } // namespace ZeroTier
@@ -28,6 +28,7 @@
 #define ZT_NETWORK_HPP
 
 #include <stdint.h>
+#include <string.h>
 
 #include "../include/ZeroTierOne.h"
 
@@ -36,6 +37,7 @@
 #include <vector>
 #include <algorithm>
 #include <stdexcept>
+#include <atomic>
 
 #include "Constants.hpp"
 #include "Hashtable.hpp"
@@ -50,10 +52,19 @@
 #include "Membership.hpp"
 #include "NetworkConfig.hpp"
 #include "CertificateOfMembership.hpp"
+#include "CompiledRules.hpp"
+#include "BridgeRouteTable.hpp"
+#include "PackedInetAddress.hpp"
+#include "TopTalkers.hpp"
+#include "FlowTable.hpp"
+#include "TimerWheel.hpp"
 
 #define ZT_NETWORK_MAX_INCOMING_UPDATES 3
 #define ZT_NETWORK_MAX_UPDATE_CHUNKS ((ZT_NETWORKCONFIG_DICT_CAPACITY / 1024) + 1)
 
+// Network ID, MAC and ADI of one group in MULTICAST_LIKE
+#define ZT_NETWORK_LIKE_SIZE 18
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -110,6 +121,9 @@ public:
 	 * such as TEE may be taken, and credentials may be pushed, so this is not
 	 * side-effect-free. It's basically step one in sending something over VL2.
 	 *
+	 * Results for flows that only hit rules with no side actions are cached,
+	 * see _FlowKey.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param noTee If true, do not TEE anything anywhere (for two-pass filtering as done with multicast and bridging)
 	 * @param ztSource Source ZeroTier address
@@ -265,15 +279,75 @@ public:
 	 */
 	void clean();
 
+	/**
+	 * @param maxRoutes Maximum routes to MACs behind remote bridges
+	 * @param maxPerBridge Maximum routes behind any one bridge
+	 */
+	inline void setBridgeRouteLimits(const unsigned long maxRoutes,const unsigned long maxPerBridge) { _remoteBridgeRoutes.setLimits(maxRoutes,maxPerBridge); }
+
+	/**
+	 * @param mu Structure to fill with approximate memory used by this network
+	 */
+	void memoryUsage(ZT_NetworkMemoryUsage *mu);
+
+	/**
+	 * Add the credentials of all members to a state snapshot
+	 *
+	 * They are restored by adding them again with addCredential(), so their
+	 * signatures are checked again but no member has to send them again.
+	 *
+	 * @param ss Snapshot to add to
+	 */
+	void saveCredentials(StateSnapshot &ss);
+
+	/**
+	 * MULTICAST_LIKE entries for several networks collected into shared packets
+	 *
+	 * Each LIKE entry carries its own network ID, so the periodic announcements
+	 * to upstreams and other always-contact peers can go out together for all
+	 * networks instead of in at least one packet per network and peer.
+	 *
+	 * This isn't thread safe and is meant to live on the stack for one pass.
+	 */
+	class LikeBatch
+	{
+	public:
+		LikeBatch() : _packets(8) {}
+		~LikeBatch();
+
+		/**
+		 * Add LIKEs, sending this peer's packet whenever it fills up
+		 *
+		 * @param RR Runtime environment
+		 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+		 * @param peer Peer to announce to
+		 * @param likes Serialized LIKE entries (see Network::_serializeLikes())
+		 */
+		void append(const RuntimeEnvironment *RR,void *tPtr,const Address &peer,const std::string &likes);
+
+		/**
+		 * Send everything collected so far
+		 *
+		 * @param RR Runtime environment
+		 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+		 */
+		void send(const RuntimeEnvironment *RR,void *tPtr);
+
+	private:
+		Hashtable<Address,Packet *> _packets;
+	};
+
 	/**
 	 * Push state to members such as multicast group memberships and latest COM (if needed)
 	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param likes If non-NULL, collect LIKEs for upstreams and always-contact peers here instead of sending them
+	 * @param pushes If non-NULL, collect credential pushes to members here instead of sending them
 	 */
-	inline void sendUpdatesToMembers(void *tPtr)
+	inline void sendUpdatesToMembers(void *tPtr,LikeBatch *likes = (LikeBatch *)0,Membership::PushBatch *pushes = (Membership::PushBatch *)0)
 	{
 		Mutex::Lock _l(_lock);
-		_sendUpdatesToMembers(tPtr,(const MulticastGroup *)0);
+		_sendUpdatesToMembers(tPtr,(const MulticastGroup *)0,likes,pushes);
 	}
 
 	/**
@@ -282,15 +356,10 @@ public:
 	 * @param mac MAC address
 	 * @return ZeroTier address of bridge to this MAC
 	 */
-	inline Address findBridgeTo(const MAC &mac) const
-	{
-		Mutex::Lock _l(_lock);
-		const Address *const br = _remoteBridgeRoutes.get(mac);
-		return ((br) ? *br : Address());
-	}
+	inline Address findBridgeTo(const MAC &mac) const { return _remoteBridgeRoutes.get(mac); }
 
 	/**
-	 * Set a bridge route
+	 * Learn or refresh a bridge route from a frame sent by a bridged MAC
 	 *
 	 * @param mac MAC address of destination
 	 * @param addr Bridge this MAC is reachable behind
@@ -308,8 +377,10 @@ public:
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
+	 *
+	 * If a batch is given the signature check goes through it (see Membership::CredentialBatch).
 	 */
-	Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfMembership &com);
+	Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfMembership &com,Membership::CredentialBatch *batch = (Membership::CredentialBatch *)0);
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
@@ -318,37 +389,76 @@ public:
 	{
 		if (cap.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(cap.issuedTo()).addCredential(RR,tPtr,_config,cap);
+		const SharedPtr<_Snapshot> s(_currentSnapshot());
+		_MembershipShard &ms = _shard(cap.issuedTo());
+		Mutex::Lock _l(ms.lock);
+		Membership &m = ms.members[cap.issuedTo()];
+		const Membership::AddCredentialResult r = m.addCredential(RR,tPtr,s->config,cap);
+		if (r == Membership::ADD_ACCEPTED_NEW)
+			_scheduleClean(cap.issuedTo(),m,s->config);
+		return r;
 	}
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const Tag &tag)
+	inline Membership::AddCredentialResult addCredential(void *tPtr,const Tag &tag,Membership::CredentialBatch *batch = (Membership::CredentialBatch *)0)
 	{
 		if (tag.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(tag.issuedTo()).addCredential(RR,tPtr,_config,tag);
+		const SharedPtr<_Snapshot> s(_currentSnapshot());
+		_MembershipShard &ms = _shard(tag.issuedTo());
+		Mutex::Lock _l(ms.lock);
+		Membership &m = ms.members[tag.issuedTo()];
+		const Membership::AddCredentialResult r = m.addCredential(RR,tPtr,s->config,tag,batch);
+		if (r == Membership::ADD_ACCEPTED_NEW)
+			_scheduleClean(tag.issuedTo(),m,s->config);
+		return r;
 	}
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	Membership::AddCredentialResult addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev);
+	Membership::AddCredentialResult addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev,Membership::CredentialBatch *batch = (Membership::CredentialBatch *)0);
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo)
+	inline Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo,Membership::CredentialBatch *batch = (Membership::CredentialBatch *)0)
 	{
 		if (coo.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(coo.issuedTo()).addCredential(RR,tPtr,_config,coo);
+		const SharedPtr<_Snapshot> s(_currentSnapshot());
+		_MembershipShard &ms = _shard(coo.issuedTo());
+		Mutex::Lock _l(ms.lock);
+		Membership &m = ms.members[coo.issuedTo()];
+		const Membership::AddCredentialResult r = m.addCredential(RR,tPtr,s->config,coo,batch);
+		if (r == Membership::ADD_ACCEPTED_NEW)
+			_scheduleClean(coo.issuedTo(),m,s->config);
+		if ((r == Membership::ADD_ACCEPTED_NEW)||(r == Membership::ADD_ACCEPTED_REDUNDANT)) {
+			Mutex::Lock _l2(_ipOwnersLock);
+			for(unsigned int i=0;i<coo.thingCount();++i) {
+				if (coo.thingType(i) == CertificateOfOwnership::THING_IPV4_ADDRESS)
+					_ipOwners.set(PackedInetAddress(InetAddress(coo.thingValue(i),4,0)),coo.issuedTo());
+				else if (coo.thingType(i) == CertificateOfOwnership::THING_IPV6_ADDRESS)
+					_ipOwners.set(PackedInetAddress(InetAddress(coo.thingValue(i),16,0)),coo.issuedTo());
+			}
+		}
+		return r;
 	}
 
+	/**
+	 * Find the member holding a valid certificate of ownership for an IP address
+	 *
+	 * This is what ARP emulation and the NDP proxy answer from. Only members
+	 * whose certificates we have seen are known, and a stale entry is dropped
+	 * as soon as the certificate behind it no longer checks out.
+	 *
+	 * @param ip IPv4 or IPv6 address (port is ignored)
+	 * @return Owning member's address or NULL address if not known
+	 */
+	Address ipOwner(const InetAddress &ip);
+
 	/**
 	 * Force push credentials (COM, etc.) to a peer now
 	 *
@@ -358,8 +468,10 @@ public:
 	 */
 	inline void pushCredentialsNow(void *tPtr,const Address &to,const int64_t now)
 	{
-		Mutex::Lock _l(_lock);
-		_membership(to).pushCredentials(RR,tPtr,now,to,_config,-1,true);
+		const SharedPtr<_Snapshot> s(_currentSnapshot());
+		_MembershipShard &ms = _shard(to);
+		Mutex::Lock _l(ms.lock);
+		ms.members[to].pushCredentials(RR,tPtr,now,to,s->config,s->credentials,-1,true);
 	}
 
 	/**
@@ -386,14 +498,158 @@ public:
 	 */
 	inline void **userPtr() { return &_uPtr; }
 
+	/**
+	 * @return Heaviest members, flows and Ethernet types in this network's frames
+	 */
+	inline TopTalkers &topTalkers() { return _topTalkers; }
+
+	/**
+	 * @return Sampled flows through this network's rules
+	 */
+	inline FlowTable &flowTable() { return _flowTable; }
+
+	/**
+	 * Get this network's rules and every capability's rules compiled so far with their counters
+	 *
+	 * Capabilities are compiled once per ID and version of their rules, whether
+	 * they are ours or were sent to us, so counts for one are shared by both
+	 * directions and by every member that has it.
+	 *
+	 * @param lists Filled with (-1, network rules) then (capability ID, its rules)
+	 */
+	void ruleCounters(std::vector< std::pair<int64_t,CompiledRules> > &lists) const;
+
+	/**
+	 * Get rules a tap may use to drop frames from the host before they reach us
+	 *
+	 * This is CompiledRules::dropSubset() of our rules, after sets that
+	 * accept frames we act on before filtering: those bridged in from
+	 * other MACs, those sent to our own MAC, and ARP and ICMPv6 if they are
+	 * emulated. It's empty without a config and with a remote trace target,
+	 * since traces must see every frame the rules drop.
+	 *
+	 * @param rules Filled with rules, or left empty if nothing should be dropped early
+	 */
+	void tapFilter(std::vector<ZT_VirtualNetworkRule> &rules) const;
+
 private:
 	ZT_VirtualNetworkStatus _status() const;
 	void _externalConfig(ZT_VirtualNetworkConfig *ec) const; // assumes _lock is locked
 	bool _gate(const SharedPtr<Peer> &peer);
-	void _sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup);
-	void _announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups);
-	std::vector<MulticastGroup> _allMulticastGroups() const;
-	Membership &_membership(const Address &a);
+	void _sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup,LikeBatch *likes = (LikeBatch *)0,Membership::PushBatch *pushes = (Membership::PushBatch *)0);
+	void _announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::string &likes,LikeBatch *batch = (LikeBatch *)0);
+	std::vector<MulticastGroup> _allMulticastGroups(const NetworkConfig &nconf) const;
+	std::string _serializeLikes(const std::vector<MulticastGroup> &groups) const;
+	void _scheduleClean(const Address &a,Membership &m,const NetworkConfig &nconf); // assumes a membership shard lock is locked
+	struct _Snapshot;
+	void _pushCredentialsTo(void *tPtr,const _Snapshot &s,const Address &to,const int localCapabilityIndex,const int64_t now);
+	bool _filterOutgoingPacket(void *tPtr,const bool noTee,const Address &ztSource,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId);
+	int _filterIncomingPacket(void *tPtr,const SharedPtr<Peer> &sourcePeer,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId);
+	void _compileCapability(const Capability &cap,CompiledRules &cr);
+
+	// Everything about a frame that cacheable rules (see CompiledRules::cacheable()) can
+	// match on, and a member's credentials as of when a result was cached for it.
+	struct _FlowKey
+	{
+		_FlowKey() {}
+		void set(const bool inbound,const Address &ztSource,const Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId);
+		inline unsigned long hashCode() const
+		{
+			uint64_t w[sizeof(_FlowKey) / 8];
+			memcpy(w,this,sizeof(w));
+			uint64_t h = 0;
+			for(unsigned int i=0;i<(sizeof(_FlowKey) / 8);++i)
+				h += w[i] * (0x9e3779b97f4a7c15ULL + (uint64_t)(i << 1));
+			return (unsigned long)h;
+		}
+		inline bool operator==(const _FlowKey &k) const { return (memcmp(this,&k,sizeof(_FlowKey)) == 0); }
+		inline bool operator!=(const _FlowKey &k) const { return (memcmp(this,&k,sizeof(_FlowKey)) != 0); }
+
+		uint64_t ztSource;
+		uint64_t ztDest;
+		uint64_t macSource;
+		uint64_t macDest;
+		uint8_t ipSource[16];
+		uint8_t ipDest[16];
+		uint32_t etherType;
+		uint32_t vlanId;
+		int32_t ipProtocol;
+		int32_t sourcePort;
+		int32_t destPort;
+		uint32_t flags; // 0x01 inbound, 0x02 IPv4 addresses set, 0x04 IPv6 addresses set
+	};
+	struct _FlowVerdict
+	{
+		int64_t lastUsed;
+		uint64_t generation; // _Snapshot::generation it was computed under
+		uint32_t credentialRevision;
+		int accept; // as returned by filterIncomingPacket()
+		int localCapabilityIndex;
+	};
+
+	// Everything frame filtering needs from a config. These are never changed once
+	// published, so a filter holding a reference can read one without any lock.
+	struct _Snapshot
+	{
+		_Snapshot() : generation(0),flowCache(false) {}
+		NetworkConfig config;
+		CompiledRules rules; // config.rules
+		std::vector<CompiledRules> capabilities; // config.capabilities[], sized to capabilityCount
+		Membership::CredentialTemplate credentials; // our credentials in config, serialized
+		uint64_t generation;
+		bool flowCache;
+		AtomicCounter __refCount;
+	};
+	inline SharedPtr<_Snapshot> _currentSnapshot() const
+	{
+		Mutex::Lock _l(_snapshotLock);
+		return _snapshot;
+	}
+
+	// A member whose credentials or revocations need cleaning at a deadline,
+	// stale if the member's cleanAt() has changed since
+	struct _CredentialExpiry
+	{
+		_CredentialExpiry() : member(),deadline(0) {}
+		_CredentialExpiry(const Address &m,const int64_t d) : member(m),deadline(d) {}
+		Address member;
+		int64_t deadline;
+	};
+
+	// Members are spread over shards by address, each with its own lock. A shard also
+	// keeps the filter results cached for flows to or from its members and compiled
+	// rules for the capabilities they have sent us.
+	struct _MembershipShard
+	{
+		_MembershipShard() : members(16),capabilities(8),flows(32),lock("Network::_shards") {}
+		inline const CompiledRules *compiledCapability(Network &nw,const Capability &cap) // assumes lock is locked
+		{
+			CompiledRules &cr = capabilities[cap.id()];
+			if (!cr.compiledFrom(cap.rules(),cap.ruleCount()))
+				nw._compileCapability(cap,cr);
+			return &cr;
+		}
+		inline void cacheFlow(const _FlowKey &k,const uint64_t generation,const uint32_t credentialRevision,const int accept,const int localCapabilityIndex,const int64_t now) // assumes lock is locked
+		{
+			_FlowVerdict *fv = flows.get(k);
+			if (!fv) {
+				if (flows.size() >= (ZT_NETWORK_FLOW_CACHE_SIZE / ZT_NETWORK_MEMBERSHIP_SHARDS))
+					return; // full, new flows wait until clean() drops idle ones
+				fv = &(flows[k]);
+			}
+			fv->lastUsed = now;
+			fv->generation = generation;
+			fv->credentialRevision = credentialRevision;
+			fv->accept = accept;
+			fv->localCapabilityIndex = localCapabilityIndex;
+		}
+		Hashtable<Address,Membership> members;
+		Hashtable<uint32_t,CompiledRules> capabilities; // capability ID -> rules last seen for it
+		Hashtable<_FlowKey,_FlowVerdict> flows;
+		Mutex lock;
+	};
+	// As in Topology::_peerShard(), the high address bits alone are enough to pick one
+	inline _MembershipShard &_shard(const Address &a) { return _shards[(unsigned long)(a.toInt() >> 32) % ZT_NETWORK_MEMBERSHIP_SHARDS]; }
 
 	const RuntimeEnvironment *const RR;
 	void *_uPtr;
@@ -404,22 +660,31 @@ private:
 
 	std::vector< MulticastGroup > _myMulticastGroups; // multicast groups that we belong to (according to tap)
 	Hashtable< MulticastGroup,uint64_t > _multicastGroupsBehindMe; // multicast groups that seem to be behind us and when we last saw them (if we are a bridge)
-	Hashtable< MAC,Address > _remoteBridgeRoutes; // remote addresses where given MACs are reachable (for tracking devices behind remote bridges)
+	Mutex _groupsLock;
+
+	BridgeRouteTable _remoteBridgeRoutes; // remote addresses where given MACs are reachable (for tracking devices behind remote bridges)
 
 	NetworkConfig _config;
 	uint64_t _lastConfigUpdate;
 
+	SharedPtr<_Snapshot> _snapshot; // published copy of _config for the frame path
+	Mutex _snapshotLock;
+
+	std::atomic<uint64_t> _flowCacheHits;
+	std::atomic<uint64_t> _flowCacheMisses;
+
 	struct _IncomingConfigChunk
 	{
-		_IncomingConfigChunk() { memset(this,0,sizeof(_IncomingConfigChunk)); }
+		_IncomingConfigChunk() : ts(0),updateId(0),haveChunks(0),haveBytes(0) {}
 		uint64_t ts;
 		uint64_t updateId;
 		uint64_t haveChunkIds[ZT_NETWORK_MAX_UPDATE_CHUNKS];
 		unsigned long haveChunks;
 		unsigned long haveBytes;
-		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> data;
+		std::string data; // grows to the update's length as chunks arrive, freed once it's complete
 	};
 	_IncomingConfigChunk _incomingConfigChunks[ZT_NETWORK_MAX_INCOMING_UPDATES];
+	bool _deltaFailed; // a config leaving out blobs couldn't be completed, so stop offering blob hashes
 
 	bool _destroyed;
 
@@ -431,8 +696,23 @@ private:
 	} _netconfFailure;
 	int _portError; // return value from port config callback
 
-	Hashtable<Address,Membership> _memberships;
+	_MembershipShard _shards[ZT_NETWORK_MEMBERSHIP_SHARDS];
+
+	Hashtable<PackedInetAddress,Address> _ipOwners; // last member seen with a certificate of ownership for each IP (port 0)
+	Mutex _ipOwnersLock;
+
+	Hashtable<uint32_t,CompiledRules> _capabilityRules; // capability ID -> rules last seen for it, whose counters shards and snapshots share
+	Mutex _capabilityRulesLock;
+
+	TopTalkers _topTalkers;
+	FlowTable _flowTable;
+
+	TimerWheel<_CredentialExpiry> _credentialExpiry; // when clean() should next look at members' credentials
+	Mutex _credentialExpiry_m;
 
+	// Locks are taken in this order: _lock, then one membership shard's lock, then any
+	// of the others, which nothing else is ever acquired under. Filtering frames never
+	// takes _lock, which guards _config and the rest of the control plane state.
 	Mutex _lock;
 
 	AtomicCounter __refCount;
@@ -27,14 +27,259 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <new>
+#include <string>
 
 #include "NetworkConfig.hpp"
+#include "SHA512.hpp"
+
+// Fewest serialized bytes each kind of array entry can be read from (see their deserialize() methods)
+#define ZT_NETWORKCONFIG_MIN_INETADDRESS_SIZE 1
+#define ZT_NETWORKCONFIG_MIN_ROUTE_SIZE ((ZT_NETWORKCONFIG_MIN_INETADDRESS_SIZE * 2) + 4)
+#define ZT_NETWORKCONFIG_MIN_RULE_SIZE 2
+#define ZT_NETWORKCONFIG_MIN_CAPABILITY_SIZE (8 + 8 + 4 + 2 + 1 + ZT_ADDRESS_LENGTH + 2)
+#define ZT_NETWORKCONFIG_MIN_TAG_SIZE (8 + 8 + 4 + 4 + ZT_ADDRESS_LENGTH + ZT_ADDRESS_LENGTH + 1 + 2 + 2)
+#define ZT_NETWORKCONFIG_MIN_COO_SIZE (8 + 8 + 8 + 4 + 2 + ZT_ADDRESS_LENGTH + ZT_ADDRESS_LENGTH + 1 + 2 + 2)
 
 namespace ZeroTier {
 
-bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy) const
+// Blob index in ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP and in request meta-data hashes
+static const char *const _deltaBlobKeys[ZT_NETWORKCONFIG_DELTA_BLOBS] = {
+	ZT_NETWORKCONFIG_DICT_KEY_COM,
+	ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,
+	ZT_NETWORKCONFIG_DICT_KEY_TAGS,
+	ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,
+	ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,
+	ZT_NETWORKCONFIG_DICT_KEY_ROUTES,
+	ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,
+	ZT_NETWORKCONFIG_DICT_KEY_RULES
+};
+
+static uint64_t _blobHash(const void *data,const unsigned int len)
+{
+	uint8_t h[64];
+	SHA512::hash(h,data,len);
+	uint64_t v = 0;
+	for(unsigned int i=0;i<8;++i)
+		v = (v << 8) | (uint64_t)h[i];
+	return v;
+}
+
+// Add a blob unless the recipient already has it, in which case it's listed in keep
+static bool _addBlob(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const unsigned int b,const Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &v,const uint64_t *have,Buffer<(ZT_NETWORKCONFIG_DELTA_BLOBS * 9) + 1> &keep)
+{
+	if ((have)&&(have[b])&&(v.size() >= ZT_NETWORKCONFIG_DELTA_MIN_BLOB_SIZE)) {
+		const uint64_t h = _blobHash(v.data(),v.size());
+		if (h == have[b]) {
+			keep.append((uint8_t)b);
+			keep.append(h);
+			return true;
+		}
+	}
+	return d.add(_deltaBlobKeys[b],v);
+}
+
+// Most entries a blob could hold if each takes at least min bytes, from its size before unescaping
+static inline unsigned int _mostEntries(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index &di,const char *key,const unsigned int min,const unsigned int max)
+{
+	const char *v = (const char *)0;
+	const int n = di.getEscaped(key,v);
+	return (n > 0) ? std::min(((unsigned int)n + min - 1) / min,max) : 0;
+}
+
+NetworkConfig::NetworkConfig() :
+	_arena((char *)0),
+	_arenaSize(0),
+	_compact(false)
+{
+	_clear();
+	_allocate(ZT_MAX_NETWORK_SPECIALISTS,ZT_MAX_NETWORK_ROUTES,ZT_MAX_ZT_ASSIGNED_ADDRESSES,ZT_MAX_NETWORK_RULES,ZT_MAX_NETWORK_CAPABILITIES,ZT_MAX_NETWORK_TAGS,ZT_MAX_CERTIFICATES_OF_OWNERSHIP);
+}
+
+NetworkConfig::NetworkConfig(const bool compact) :
+	_arena((char *)0),
+	_arenaSize(0),
+	_compact(compact)
+{
+	_clear();
+	if (compact)
+		_allocate(0,0,0,0,0,0,0);
+	else _allocate(ZT_MAX_NETWORK_SPECIALISTS,ZT_MAX_NETWORK_ROUTES,ZT_MAX_ZT_ASSIGNED_ADDRESSES,ZT_MAX_NETWORK_RULES,ZT_MAX_NETWORK_CAPABILITIES,ZT_MAX_NETWORK_TAGS,ZT_MAX_CERTIFICATES_OF_OWNERSHIP);
+}
+
+NetworkConfig::NetworkConfig(const NetworkConfig &nc) :
+	_arena((char *)0),
+	_arenaSize(0),
+	_compact(true)
+{
+	_copy(nc);
+}
+
+NetworkConfig &NetworkConfig::operator=(const NetworkConfig &nc)
+{
+	if (&nc != this) {
+		_copy(nc);
+		_compact = true;
+	}
+	return *this;
+}
+
+void NetworkConfig::compact()
+{
+	if (!_compact) {
+		char *const old = _arena;
+		_arena = (char *)0; // kept until copied out of, and still in use if allocation fails
+		try {
+			_copy(*this);
+		} catch ( ... ) {
+			_arena = old;
+			throw;
+		}
+		free(old);
+		_compact = true;
+	}
+}
+
+bool NetworkConfig::operator==(const NetworkConfig &nc) const
+{
+	return ( (networkId == nc.networkId) &&
+	         (timestamp == nc.timestamp) &&
+	         (credentialTimeMaxDelta == nc.credentialTimeMaxDelta) &&
+	         (revision == nc.revision) &&
+	         (issuedTo == nc.issuedTo) &&
+	         (remoteTraceTarget == nc.remoteTraceTarget) &&
+	         (flags == nc.flags) &&
+	         (remoteTraceLevel == nc.remoteTraceLevel) &&
+	         (mtu == nc.mtu) &&
+	         (rateLimit == nc.rateLimit) &&
+	         (multicastLimit == nc.multicastLimit) &&
+	         (specialistCount == nc.specialistCount) &&
+	         (routeCount == nc.routeCount) &&
+	         (staticIpCount == nc.staticIpCount) &&
+	         (ruleCount == nc.ruleCount) &&
+	         (capabilityCount == nc.capabilityCount) &&
+	         (tagCount == nc.tagCount) &&
+	         (certificateOfOwnershipCount == nc.certificateOfOwnershipCount) &&
+	         (memcmp(specialists,nc.specialists,sizeof(uint64_t) * specialistCount) == 0) &&
+	         (memcmp(routes,nc.routes,sizeof(ZT_VirtualNetworkRoute) * routeCount) == 0) &&
+	         (memcmp(staticIps,nc.staticIps,sizeof(InetAddress) * staticIpCount) == 0) &&
+	         (memcmp(rules,nc.rules,sizeof(ZT_VirtualNetworkRule) * ruleCount) == 0) &&
+	         (memcmp(capabilities,nc.capabilities,sizeof(Capability) * capabilityCount) == 0) &&
+	         (memcmp(tags,nc.tags,sizeof(Tag) * tagCount) == 0) &&
+	         (memcmp(certificatesOfOwnership,nc.certificatesOfOwnership,sizeof(CertificateOfOwnership) * certificateOfOwnershipCount) == 0) &&
+	         (type == nc.type) &&
+	         (memcmp(name,nc.name,sizeof(name)) == 0) &&
+	         (memcmp(&com,&(nc.com),sizeof(CertificateOfMembership)) == 0) );
+}
+
+void NetworkConfig::_clear()
+{
+	networkId = 0;
+	timestamp = 0;
+	credentialTimeMaxDelta = 0;
+	revision = 0;
+	issuedTo.zero();
+	remoteTraceTarget.zero();
+	flags = 0;
+	remoteTraceLevel = Trace::LEVEL_NORMAL;
+	mtu = 0;
+	rateLimit = 0;
+	multicastLimit = 0;
+	specialistCount = 0;
+	routeCount = 0;
+	staticIpCount = 0;
+	ruleCount = 0;
+	capabilityCount = 0;
+	tagCount = 0;
+	certificateOfOwnershipCount = 0;
+	type = ZT_NETWORK_TYPE_PRIVATE;
+	memset(name,0,sizeof(name));
+	com = CertificateOfMembership();
+}
+
+// Arrays in the arena each start on a 16-byte boundary
+static inline unsigned long _arenaAlign(const unsigned long n) { return ((n + 15UL) & ~15UL); }
+
+void NetworkConfig::_allocate(unsigned int ns,unsigned int nr,unsigned int nip,unsigned int nrl,unsigned int nc,unsigned int nt,unsigned int ncoo)
+{
+	unsigned long o[8];
+	o[0] = 0;
+	o[1] = o[0] + _arenaAlign(sizeof(uint64_t) * ns);
+	o[2] = o[1] + _arenaAlign(sizeof(ZT_VirtualNetworkRoute) * nr);
+	o[3] = o[2] + _arenaAlign(sizeof(InetAddress) * nip);
+	o[4] = o[3] + _arenaAlign(sizeof(ZT_VirtualNetworkRule) * nrl);
+	o[5] = o[4] + _arenaAlign(sizeof(Capability) * nc);
+	o[6] = o[5] + _arenaAlign(sizeof(Tag) * nt);
+	o[7] = o[6] + _arenaAlign(sizeof(CertificateOfOwnership) * ncoo);
+
+	char *const a = (char *)malloc((o[7]) ? o[7] : 16);
+	if (!a)
+		throw std::bad_alloc();
+	memset(a,0,o[7]);
+
+	free(_arena);
+	_arena = a;
+	_arenaSize = o[7];
+	specialists = reinterpret_cast<uint64_t *>(a + o[0]);
+	routes = reinterpret_cast<ZT_VirtualNetworkRoute *>(a + o[1]);
+	staticIps = reinterpret_cast<InetAddress *>(a + o[2]);
+	rules = reinterpret_cast<ZT_VirtualNetworkRule *>(a + o[3]);
+	capabilities = reinterpret_cast<Capability *>(a + o[4]);
+	tags = reinterpret_cast<Tag *>(a + o[5]);
+	certificatesOfOwnership = reinterpret_cast<CertificateOfOwnership *>(a + o[6]);
+}
+
+void NetworkConfig::_copy(const NetworkConfig &nc)
+{
+	// nc may be this (see compact()), so its arrays are located before reallocating
+	const uint64_t *const sp = nc.specialists;
+	const ZT_VirtualNetworkRoute *const rt = nc.routes;
+	const InetAddress *const ip = nc.staticIps;
+	const ZT_VirtualNetworkRule *const rl = nc.rules;
+	const Capability *const cp = nc.capabilities;
+	const Tag *const tg = nc.tags;
+	const CertificateOfOwnership *const coo = nc.certificatesOfOwnership;
+
+	_allocate(nc.specialistCount,nc.routeCount,nc.staticIpCount,nc.ruleCount,nc.capabilityCount,nc.tagCount,nc.certificateOfOwnershipCount);
+
+	networkId = nc.networkId;
+	timestamp = nc.timestamp;
+	credentialTimeMaxDelta = nc.credentialTimeMaxDelta;
+	revision = nc.revision;
+	issuedTo = nc.issuedTo;
+	remoteTraceTarget = nc.remoteTraceTarget;
+	flags = nc.flags;
+	remoteTraceLevel = nc.remoteTraceLevel;
+	mtu = nc.mtu;
+	rateLimit = nc.rateLimit;
+	multicastLimit = nc.multicastLimit;
+	specialistCount = nc.specialistCount;
+	routeCount = nc.routeCount;
+	staticIpCount = nc.staticIpCount;
+	ruleCount = nc.ruleCount;
+	capabilityCount = nc.capabilityCount;
+	tagCount = nc.tagCount;
+	certificateOfOwnershipCount = nc.certificateOfOwnershipCount;
+	ZT_FAST_MEMCPY(specialists,sp,sizeof(uint64_t) * specialistCount);
+	ZT_FAST_MEMCPY(routes,rt,sizeof(ZT_VirtualNetworkRoute) * routeCount);
+	ZT_FAST_MEMCPY(rules,rl,sizeof(ZT_VirtualNetworkRule) * ruleCount);
+	// InetAddress and the credentials are plain data with no pointers or
+	// owned resources, so copying their bytes is what their copy operators
+	// do anyway, and the arena is zeroed raw memory with nothing constructed
+	// in it. The casts just tell the compiler this is deliberate.
+	ZT_FAST_MEMCPY((void *)staticIps,(const void *)ip,sizeof(InetAddress) * staticIpCount);
+	ZT_FAST_MEMCPY((void *)capabilities,(const void *)cp,sizeof(Capability) * capabilityCount);
+	ZT_FAST_MEMCPY((void *)tags,(const void *)tg,sizeof(Tag) * tagCount);
+	ZT_FAST_MEMCPY((void *)certificatesOfOwnership,(const void *)coo,sizeof(CertificateOfOwnership) * certificateOfOwnershipCount);
+	type = nc.type;
+	ZT_FAST_MEMCPY(name,nc.name,sizeof(name));
+	com = nc.com;
+}
+
+bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy,const uint64_t *have) const
 {
 	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	Buffer<(ZT_NETWORKCONFIG_DELTA_BLOBS * 9) + 1> keep;
 	char tmp2[128];
 
 	try {
@@ -55,6 +300,9 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 		if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)this->type)) return false;
 		if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name)) return false;
 		if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_MTU,(uint64_t)this->mtu)) return false;
+		if (this->rateLimit) {
+			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_RATE_LIMIT,this->rateLimit)) return false;
+		}
 
 #ifdef ZT_SUPPORT_OLD_STYLE_NETCONF
 		if (includeLegacy) {
@@ -132,35 +380,35 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 		if (this->com) {
 			tmp->clear();
 			this->com.serialize(*tmp);
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp)) return false;
+			if (!_addBlob(d,0,*tmp,have,keep)) return false;
 		}
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->capabilityCount;++i)
 			this->capabilities[i].serialize(*tmp);
 		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) return false;
+			if (!_addBlob(d,1,*tmp,have,keep)) return false;
 		}
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->tagCount;++i)
 			this->tags[i].serialize(*tmp);
 		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) return false;
+			if (!_addBlob(d,2,*tmp,have,keep)) return false;
 		}
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->certificateOfOwnershipCount;++i)
 			this->certificatesOfOwnership[i].serialize(*tmp);
 		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) return false;
+			if (!_addBlob(d,3,*tmp,have,keep)) return false;
 		}
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->specialistCount;++i)
 			tmp->append((uint64_t)this->specialists[i]);
 		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) return false;
+			if (!_addBlob(d,4,*tmp,have,keep)) return false;
 		}
 
 		tmp->clear();
@@ -171,24 +419,28 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 			tmp->append((uint16_t)this->routes[i].metric);
 		}
 		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) return false;
+			if (!_addBlob(d,5,*tmp,have,keep)) return false;
 		}
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->staticIpCount;++i)
 			this->staticIps[i].serialize(*tmp);
 		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) return false;
+			if (!_addBlob(d,6,*tmp,have,keep)) return false;
 		}
 
 		if (this->ruleCount) {
 			tmp->clear();
 			Capability::serializeRules(*tmp,rules,ruleCount);
 			if (tmp->size()) {
-				if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) return false;
+				if (!_addBlob(d,7,*tmp,have,keep)) return false;
 			}
 		}
 
+		if (keep.size()) {
+			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP,keep)) return false;
+		}
+
 		delete tmp;
 	} catch ( ... ) {
 		delete tmp;
@@ -199,48 +451,68 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 }
 
 bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d)
+{
+	return this->fromDictionary(d.data(),ZT_NETWORKCONFIG_DICT_CAPACITY);
+}
+
+bool NetworkConfig::fromDictionary(const char *d,const unsigned int size)
 {
 	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index di(d,size); // one pass over d instead of one per key
 
 	try {
-		memset(this,0,sizeof(NetworkConfig));
+		_clear();
+
+		// Old style configs get room for everything, new ones only for the most
+		// entries their blobs could hold so they're never much bigger than the dictionary
+		const bool old = (di.getUI(ZT_NETWORKCONFIG_DICT_KEY_VERSION,0) < 6);
+		const unsigned int maxSpecialists = (old) ? ZT_MAX_NETWORK_SPECIALISTS : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,8,ZT_MAX_NETWORK_SPECIALISTS);
+		const unsigned int maxRoutes = (old) ? ZT_MAX_NETWORK_ROUTES : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_ROUTES,ZT_NETWORKCONFIG_MIN_ROUTE_SIZE,ZT_MAX_NETWORK_ROUTES);
+		const unsigned int maxStaticIps = (old) ? ZT_MAX_ZT_ASSIGNED_ADDRESSES : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,ZT_NETWORKCONFIG_MIN_INETADDRESS_SIZE,ZT_MAX_ZT_ASSIGNED_ADDRESSES);
+		const unsigned int maxRules = (old) ? ZT_MAX_NETWORK_RULES : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_RULES,ZT_NETWORKCONFIG_MIN_RULE_SIZE,ZT_MAX_NETWORK_RULES);
+		const unsigned int maxCapabilities = (old) ? ZT_MAX_NETWORK_CAPABILITIES : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,ZT_NETWORKCONFIG_MIN_CAPABILITY_SIZE,ZT_MAX_NETWORK_CAPABILITIES);
+		const unsigned int maxTags = (old) ? ZT_MAX_NETWORK_TAGS : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_TAGS,ZT_NETWORKCONFIG_MIN_TAG_SIZE,ZT_MAX_NETWORK_TAGS);
+		const unsigned int maxCoos = (old) ? ZT_MAX_CERTIFICATES_OF_OWNERSHIP : _mostEntries(di,ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,ZT_NETWORKCONFIG_MIN_COO_SIZE,ZT_MAX_CERTIFICATES_OF_OWNERSHIP);
+		_allocate(maxSpecialists,maxRoutes,maxStaticIps,maxRules,maxCapabilities,maxTags,maxCoos);
+		_compact = !old;
 
 		// Fields that are always present, new or old
-		this->networkId = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,0);
+		this->networkId = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_NETWORK_ID,0);
 		if (!this->networkId) {
 			delete tmp;
 			return false;
 		}
-		this->timestamp = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,0);
-		this->credentialTimeMaxDelta = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA,0);
-		this->revision = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REVISION,0);
-		this->issuedTo = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,0);
+		this->timestamp = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP,0);
+		this->credentialTimeMaxDelta = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA,0);
+		this->revision = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_REVISION,0);
+		this->issuedTo = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,0);
 		if (!this->issuedTo) {
 			delete tmp;
 			return false;
 		}
-		this->remoteTraceTarget = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_TARGET);
-		this->remoteTraceLevel = (Trace::Level)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_LEVEL);
-		this->multicastLimit = (unsigned int)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
-		d.get(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name,sizeof(this->name));
+		this->remoteTraceTarget = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_TARGET);
+		this->remoteTraceLevel = (Trace::Level)di.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_LEVEL);
+		this->multicastLimit = (unsigned int)di.getUI(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
+		di.get(ZT_NETWORKCONFIG_DICT_KEY_NAME,this->name,sizeof(this->name));
 
-		this->mtu = (unsigned int)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MTU,ZT_DEFAULT_MTU);
+		this->mtu = (unsigned int)di.getUI(ZT_NETWORKCONFIG_DICT_KEY_MTU,ZT_DEFAULT_MTU);
 		if (this->mtu < 1280)
 			this->mtu = 1280; // minimum MTU allowed by IPv6 standard and others
 		else if (this->mtu > ZT_MAX_MTU)
 			this->mtu = ZT_MAX_MTU;
+		this->rateLimit = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_RATE_LIMIT,0);
 
-		if (d.getUI(ZT_NETWORKCONFIG_DICT_KEY_VERSION,0) < 6) {
+		if (di.getUI(ZT_NETWORKCONFIG_DICT_KEY_VERSION,0) < 6) {
 	#ifdef ZT_SUPPORT_OLD_STYLE_NETCONF
 			char tmp2[1024];
 
 			// Decode legacy fields if version is old
-			if (d.getB(ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST_OLD))
+			if (di.getB(ZT_NETWORKCONFIG_DICT_KEY_ENABLE_BROADCAST_OLD))
 				this->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
 			this->flags |= ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION; // always enable for old-style netconf
-			this->type = (d.getB(ZT_NETWORKCONFIG_DICT_KEY_PRIVATE_OLD,true)) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
+			this->type = (di.getB(ZT_NETWORKCONFIG_DICT_KEY_PRIVATE_OLD,true)) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_IPV4_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					if (this->staticIpCount >= ZT_MAX_ZT_ASSIGNED_ADDRESSES) break;
@@ -249,7 +521,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 						this->staticIps[this->staticIpCount++] = ip;
 				}
 			}
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_IPV6_STATIC_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					if (this->staticIpCount >= ZT_MAX_ZT_ASSIGNED_ADDRESSES) break;
@@ -259,11 +531,11 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATE_OF_MEMBERSHIP_OLD,tmp2,sizeof(tmp2)) > 0) {
 				this->com.fromString(tmp2);
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_ALLOWED_ETHERNET_TYPES_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					unsigned int et = Utils::hexStrToUInt(f) & 0xffff;
@@ -280,7 +552,7 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				this->ruleCount = 1;
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES_OLD,tmp2,sizeof(tmp2)) > 0) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_ACTIVE_BRIDGES_OLD,tmp2,sizeof(tmp2)) > 0) {
 				char *saveptr = (char *)0;
 				for(char *f=Utils::stok(tmp2,",",&saveptr);(f);f=Utils::stok((char *)0,",",&saveptr)) {
 					this->addSpecialist(Address(Utils::hexStrToU64(f)),ZT_NETWORKCONFIG_SPECIALIST_TYPE_ACTIVE_BRIDGE);
@@ -292,16 +564,16 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 	#endif // ZT_SUPPORT_OLD_STYLE_NETCONF
 		} else {
 			// Otherwise we can use the new fields
-			this->flags = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_FLAGS,0);
-			this->type = (ZT_VirtualNetworkType)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)ZT_NETWORK_TYPE_PRIVATE);
+			this->flags = di.getUI(ZT_NETWORKCONFIG_DICT_KEY_FLAGS,0);
+			this->type = (ZT_VirtualNetworkType)di.getUI(ZT_NETWORKCONFIG_DICT_KEY_TYPE,(uint64_t)ZT_NETWORK_TYPE_PRIVATE);
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp))
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp))
 				this->com.deserialize(*tmp,0);
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) {
 				try {
 					unsigned int p = 0;
-					while (p < tmp->size()) {
+					while ((p < tmp->size())&&(this->capabilityCount < maxCapabilities)) {
 						Capability cap;
 						p += cap.deserialize(*tmp,p);
 						this->capabilities[this->capabilityCount++] = cap;
@@ -310,10 +582,10 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				std::sort(&(this->capabilities[0]),&(this->capabilities[this->capabilityCount]));
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) {
 				try {
 					unsigned int p = 0;
-					while (p < tmp->size()) {
+					while ((p < tmp->size())&&(this->tagCount < maxTags)) {
 						Tag tag;
 						p += tag.deserialize(*tmp,p);
 						this->tags[this->tagCount++] = tag;
@@ -322,10 +594,10 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				std::sort(&(this->tags[0]),&(this->tags[this->tagCount]));
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) {
 				unsigned int p = 0;
 				while (p < tmp->size()) {
-					if (certificateOfOwnershipCount < ZT_MAX_CERTIFICATES_OF_OWNERSHIP)
+					if (certificateOfOwnershipCount < maxCoos)
 						p += certificatesOfOwnership[certificateOfOwnershipCount++].deserialize(*tmp,p);
 					else {
 						CertificateOfOwnership foo;
@@ -334,18 +606,18 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) {
 				unsigned int p = 0;
 				while ((p + 8) <= tmp->size()) {
-					if (specialistCount < ZT_MAX_NETWORK_SPECIALISTS)
+					if (specialistCount < maxSpecialists)
 						this->specialists[this->specialistCount++] = tmp->at<uint64_t>(p);
 					p += 8;
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) {
 				unsigned int p = 0;
-				while ((p < tmp->size())&&(routeCount < ZT_MAX_NETWORK_ROUTES)) {
+				while ((p < tmp->size())&&(routeCount < maxRoutes)) {
 					p += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].target))->deserialize(*tmp,p);
 					p += reinterpret_cast<InetAddress *>(&(this->routes[this->routeCount].via))->deserialize(*tmp,p);
 					this->routes[this->routeCount].flags = tmp->at<uint16_t>(p); p += 2;
@@ -354,17 +626,17 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) {
 				unsigned int p = 0;
-				while ((p < tmp->size())&&(staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES)) {
+				while ((p < tmp->size())&&(staticIpCount < maxStaticIps)) {
 					p += this->staticIps[this->staticIpCount++].deserialize(*tmp,p);
 				}
 			}
 
-			if (d.get(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) {
+			if (di.get(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) {
 				this->ruleCount = 0;
 				unsigned int p = 0;
-				Capability::deserializeRules(*tmp,p,this->rules,this->ruleCount,ZT_MAX_NETWORK_RULES);
+				Capability::deserializeRules(*tmp,p,this->rules,this->ruleCount,maxRules);
 			}
 		}
 
@@ -380,4 +652,92 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 	}
 }
 
+bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const NetworkConfig &base)
+{
+	return this->fromDictionary(d.data(),ZT_NETWORKCONFIG_DICT_CAPACITY,base);
+}
+
+bool NetworkConfig::fromDictionary(const char *d,const unsigned int size,const NetworkConfig &base)
+{
+	Buffer<(ZT_NETWORKCONFIG_DELTA_BLOBS * 9) + 1> keep;
+	{
+		const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index di(d,size);
+		if (!di.get(ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP,keep))
+			return this->fromDictionary(d,size);
+	}
+
+	// Put the blobs that were left out back from our current config, making sure they're the ones meant.
+	// They're copied as they're stored in its dictionary, so nothing needs escaping again.
+	unsigned int len = 0;
+	while ((len < size)&&(d[len]))
+		++len;
+	std::string full(d,len);
+	Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *bd = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	bool ok = false;
+	try {
+		if (base.toDictionary(*bd,false)) {
+			const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index bi(*bd);
+			ok = true;
+			for(unsigned int p=0;((ok)&&((p + 9) <= keep.size()));p+=9) {
+				const unsigned int b = keep[p];
+				const char *v = (const char *)0;
+				int vl = -1;
+				ok = ( (b < ZT_NETWORKCONFIG_DELTA_BLOBS) &&
+				       (bi.get(_deltaBlobKeys[b],*tmp)) &&
+				       (_blobHash(tmp->data(),tmp->size()) == keep.at<uint64_t>(p + 1)) &&
+				       ((vl = bi.getEscaped(_deltaBlobKeys[b],v)) >= 0) );
+				if (ok) {
+					if (!full.empty())
+						full.push_back((char)10);
+					full.append(_deltaBlobKeys[b]);
+					full.push_back('=');
+					full.append(v,(unsigned int)vl);
+				}
+			}
+			if ((ok)&&(full.length() >= ZT_NETWORKCONFIG_DICT_CAPACITY)) // same limit as adding them to a Dictionary
+				ok = false;
+			delete tmp;
+			tmp = (Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *)0;
+			delete bd;
+			bd = (Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *)0;
+			if (ok)
+				ok = this->fromDictionary(full.c_str(),(unsigned int)full.length() + 1);
+		}
+	} catch ( ... ) {
+		ok = false;
+	}
+	delete tmp;
+	delete bd;
+	return ok;
+}
+
+void NetworkConfig::blobHashes(uint64_t h[ZT_NETWORKCONFIG_DELTA_BLOBS]) const
+{
+	memset(h,0,sizeof(uint64_t) * ZT_NETWORKCONFIG_DELTA_BLOBS);
+	Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+	try {
+		if (this->toDictionary(*d,false)) {
+			const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index di(*d);
+			for(unsigned int b=0;b<ZT_NETWORKCONFIG_DELTA_BLOBS;++b) {
+				if (di.get(_deltaBlobKeys[b],*tmp))
+					h[b] = _blobHash(tmp->data(),tmp->size());
+			}
+		}
+	} catch ( ... ) {}
+	delete tmp;
+	delete d;
+}
+
+bool NetworkConfig::blobHashes(const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &md,uint64_t h[ZT_NETWORKCONFIG_DELTA_BLOBS])
+{
+	Buffer<(ZT_NETWORKCONFIG_DELTA_BLOBS * 8) + 1> tmp;
+	if ((!md.get(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_DELTA_HASHES,tmp))||(tmp.size() != (ZT_NETWORKCONFIG_DELTA_BLOBS * 8)))
+		return false;
+	for(unsigned int b=0;b<ZT_NETWORKCONFIG_DELTA_BLOBS;++b)
+		h[b] = tmp.at<uint64_t>(b * 8);
+	return true;
+}
+
 } // namespace ZeroTier
@@ -88,6 +88,16 @@
  */
 #define ZT_NETWORKCONFIG_FLAG_DISABLE_COMPRESSION 0x0000000000000010ULL
 
+/**
+ * Flag: answer IPv4 ARP queries locally for IPs members have certificates of ownership for
+ */
+#define ZT_NETWORKCONFIG_FLAG_ENABLE_ARP_EMULATION 0x0000000000000020ULL
+
+/**
+ * Flag: answer IPv6 neighbor solicitations locally for IPs members have certificates of ownership for
+ */
+#define ZT_NETWORKCONFIG_FLAG_ENABLE_NDP_PROXY 0x0000000000000040ULL
+
 /**
  * Device can bridge to other Ethernet networks and gets unknown recipient multicasts
  */
@@ -114,6 +124,12 @@ namespace ZeroTier {
 // Network config version
 #define ZT_NETWORKCONFIG_VERSION 7
 
+// Binary blobs a config can leave out when the recipient says it already has them
+#define ZT_NETWORKCONFIG_DELTA_BLOBS 8
+
+// Blobs smaller than this are always sent since leaving them out saves little
+#define ZT_NETWORKCONFIG_DELTA_MIN_BLOB_SIZE 64
+
 // Fields for meta-data sent with network config requests
 
 // Network config version
@@ -142,6 +158,8 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_AUTH "a"
 // Network configuration meta-data flags
 #define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS "f"
+// Hashes of the blobs in this node's current config (see NetworkConfig::blobHashes())
+#define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_DELTA_HASHES "dh"
 
 // These dictionary keys are short so they don't take up much room.
 // By convention we use upper case for binary blobs, but it doesn't really matter.
@@ -170,6 +188,8 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_DICT_KEY_NAME "n"
 // network MTU
 #define ZT_NETWORKCONFIG_DICT_KEY_MTU "mtu"
+// rate limit for each member's frames in bytes per second
+#define ZT_NETWORKCONFIG_DICT_KEY_RATE_LIMIT "rate"
 // credential time max delta in ms
 #define ZT_NETWORKCONFIG_DICT_KEY_CREDENTIAL_TIME_MAX_DELTA "ctmd"
 // binary serialized certificate of membership
@@ -188,6 +208,8 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_DICT_KEY_TAGS "TAG"
 // tags (binary blobs)
 #define ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP "COO"
+// blobs left out since the recipient has them: <[1] blob index><[8] hash>[...] (binary)
+#define ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP "DK"
 
 // Legacy fields -- these are obsoleted but are included when older clients query
 
@@ -215,24 +237,47 @@ namespace ZeroTier {
 /**
  * Network configuration received from network controller nodes
  *
- * This is a memcpy()'able structure and is safe (in a crash sense) to modify
- * without locks.
+ * The variable length arrays (specialists, routes, rules, etc.) live in one
+ * heap block owned by this object. A default constructed config has room for
+ * the maximum number of each so it can be filled in by a controller.
+ * fromDictionary() sizes them to what the dictionary could hold. Copies, and
+ * configs on which compact() has been called, are sized to what they contain
+ * and can be modified in place but not added to.
  */
 class NetworkConfig
 {
 public:
-	NetworkConfig() { memset(this,0,sizeof(NetworkConfig)); }
-	NetworkConfig(const NetworkConfig &nc) { ZT_FAST_MEMCPY(this,&nc,sizeof(NetworkConfig)); }
-	inline NetworkConfig &operator=(const NetworkConfig &nc) { ZT_FAST_MEMCPY(this,&nc,sizeof(NetworkConfig)); return *this; }
+	NetworkConfig();
+
+	/**
+	 * @param compact If true, start with no room in any array (for configs that will only be read with fromDictionary())
+	 */
+	explicit NetworkConfig(const bool compact);
+
+	NetworkConfig(const NetworkConfig &nc);
+	~NetworkConfig() { free(_arena); }
+	NetworkConfig &operator=(const NetworkConfig &nc);
+
+	/**
+	 * Shrink array storage to fit current contents
+	 *
+	 * Nothing may be added to this config afterwards except via fromDictionary().
+	 */
+	void compact();
 
 	/**
 	 * Write this network config to a dictionary for transport
 	 *
+	 * If the recipient's blob hashes are given, blobs it already has are left
+	 * out and listed in ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP instead. Such a
+	 * dictionary must be read with fromDictionary(d,base).
+	 *
 	 * @param d Dictionary
 	 * @param includeLegacy If true, include legacy fields for old node versions
+	 * @param have Recipient's blob hashes from blobHashes() or NULL to send everything
 	 * @return True if dictionary was successfully created, false if e.g. overflow
 	 */
-	bool toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy) const;
+	bool toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy,const uint64_t *have = (const uint64_t *)0) const;
 
 	/**
 	 * Read this network config from a dictionary
@@ -242,6 +287,50 @@ public:
 	 */
 	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d);
 
+	/**
+	 * Read this network config from dictionary text held outside a Dictionary
+	 *
+	 * @param d Dictionary text
+	 * @param size Size of d in bytes including its terminating 0
+	 * @return True if dictionary was valid and network config successfully initialized
+	 */
+	bool fromDictionary(const char *d,const unsigned int size);
+
+	/**
+	 * Read this network config from a dictionary that may leave out blobs the recipient has
+	 *
+	 * @param d Dictionary
+	 * @param base Recipient's current config, which must not be this one
+	 * @return True if dictionary was valid and any blobs it left out were found in base
+	 */
+	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const NetworkConfig &base);
+
+	/**
+	 * Read this network config from dictionary text that may leave out blobs the recipient has
+	 *
+	 * @param d Dictionary text
+	 * @param size Size of d in bytes including its terminating 0
+	 * @param base Recipient's current config, which must not be this one
+	 * @return True if dictionary was valid and any blobs it left out were found in base
+	 */
+	bool fromDictionary(const char *d,const unsigned int size,const NetworkConfig &base);
+
+	/**
+	 * Get hashes of this config's binary blobs, which are sent with config requests
+	 *
+	 * @param h Array of ZT_NETWORKCONFIG_DELTA_BLOBS hashes to fill, 0 for blobs not present
+	 */
+	void blobHashes(uint64_t h[ZT_NETWORKCONFIG_DELTA_BLOBS]) const;
+
+	/**
+	 * Get blob hashes from config request meta-data
+	 *
+	 * @param md Meta-data
+	 * @param h Array of ZT_NETWORKCONFIG_DELTA_BLOBS hashes to fill
+	 * @return False if meta-data doesn't contain blob hashes
+	 */
+	static bool blobHashes(const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &md,uint64_t h[ZT_NETWORKCONFIG_DELTA_BLOBS]);
+
 	/**
 	 * @return True if broadcast (ff:ff:ff:ff:ff:ff) address should work on this network
 	 */
@@ -252,6 +341,16 @@ public:
 	 */
 	inline bool ndpEmulation() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION) != 0); }
 
+	/**
+	 * @return True if IPv4 ARP queries for members' certified IPs should be answered locally
+	 */
+	inline bool arpEmulation() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_ENABLE_ARP_EMULATION) != 0); }
+
+	/**
+	 * @return True if IPv6 neighbor solicitations for members' certified IPs should be answered locally
+	 */
+	inline bool ndpProxy() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_ENABLE_NDP_PROXY) != 0); }
+
 	/**
 	 * @return True if frames should not be compressed
 	 */
@@ -381,7 +480,7 @@ public:
 	}
 
 	inline operator bool() const { return (networkId != 0); }
-	inline bool operator==(const NetworkConfig &nc) const { return (memcmp(this,&nc,sizeof(NetworkConfig)) == 0); }
+	bool operator==(const NetworkConfig &nc) const;
 	inline bool operator!=(const NetworkConfig &nc) const { return (!(*this == nc)); }
 
 	/**
@@ -403,7 +502,7 @@ public:
 				return true;
 			}
 		}
-		if (specialistCount < ZT_MAX_NETWORK_SPECIALISTS) {
+		if ((!_compact)&&(specialistCount < ZT_MAX_NETWORK_SPECIALISTS)) {
 			specialists[specialistCount++] = f | aint;
 			return true;
 		}
@@ -473,6 +572,11 @@ public:
 	 */
 	unsigned int mtu;
 
+	/**
+	 * Rate limit in bytes per second for frames each member sends on this network, or 0 for none
+	 */
+	uint64_t rateLimit;
+
 	/**
 	 * Maximum number of recipients per multicast (not including active bridges)
 	 */
@@ -519,37 +623,37 @@ public:
 	 * For each entry the least significant 40 bits are the device's ZeroTier
 	 * address and the most significant 24 bits are flags indicating its role.
 	 */
-	uint64_t specialists[ZT_MAX_NETWORK_SPECIALISTS];
+	uint64_t *specialists;
 
 	/**
 	 * Statically defined "pushed" routes (including default gateways)
 	 */
-	ZT_VirtualNetworkRoute routes[ZT_MAX_NETWORK_ROUTES];
+	ZT_VirtualNetworkRoute *routes;
 
 	/**
 	 * Static IP assignments
 	 */
-	InetAddress staticIps[ZT_MAX_ZT_ASSIGNED_ADDRESSES];
+	InetAddress *staticIps;
 
 	/**
 	 * Base network rules
 	 */
-	ZT_VirtualNetworkRule rules[ZT_MAX_NETWORK_RULES];
+	ZT_VirtualNetworkRule *rules;
 
 	/**
 	 * Capabilities for this node on this network, in ascending order of capability ID
 	 */
-	Capability capabilities[ZT_MAX_NETWORK_CAPABILITIES];
+	Capability *capabilities;
 
 	/**
 	 * Tags for this node on this network, in ascending order of tag ID
 	 */
-	Tag tags[ZT_MAX_NETWORK_TAGS];
+	Tag *tags;
 
 	/**
 	 * Certificates of ownership for this network member
 	 */
-	CertificateOfOwnership certificatesOfOwnership[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
+	CertificateOfOwnership *certificatesOfOwnership;
 
 	/**
 	 * Network type (currently just public or private)
@@ -565,6 +669,15 @@ public:
 	 * Certficiate of membership (for private networks)
 	 */
 	CertificateOfMembership com;
+
+private:
+	void _clear();
+	void _allocate(unsigned int ns,unsigned int nr,unsigned int nip,unsigned int nrl,unsigned int nc,unsigned int nt,unsigned int ncoo);
+	void _copy(const NetworkConfig &nc);
+
+	char *_arena; // one block holding all of the above arrays
+	unsigned long _arenaSize;
+	bool _compact; // arrays are sized to their counts instead of to the maximums
 };
 
 } // namespace ZeroTier
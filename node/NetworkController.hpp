@@ -68,8 +68,9 @@ public:
 		 * @param destination Destination peer Address
 		 * @param nc Network configuration to send
 		 * @param sendLegacyFormatConfig If true, send an old-format network config
+		 * @param have Recipient's blob hashes from its request meta-data, or NULL to send the whole config
 		 */
-		virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig) = 0;
+		virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig,const uint64_t *have) = 0;
 
 		/**
 		 * Send revocation to a node
@@ -29,6 +29,9 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
 
 #include "../version.h"
 
@@ -47,9 +50,75 @@
 #include "SelfAwareness.hpp"
 #include "Network.hpp"
 #include "Trace.hpp"
+#include "Cluster.hpp"
+#include "Shaper.hpp"
+#include "Traversal.hpp"
+#include "CryptoWorkers.hpp"
+#include "TraceRing.hpp"
+#include "FrameCapture.hpp"
+#include "FrameBuffer.hpp"
+#include "FlowTable.hpp"
+#include "ObjectPool.hpp"
+#include "HugePages.hpp"
+#include "Probes.hpp"
+#include "StateSnapshot.hpp"
 
 namespace ZeroTier {
 
+// Packets collected on one thread during a call into a node, see Node::WireBatchScope
+struct _WireBatch
+{
+	_WireBatch() : node((Node *)0),tPtr((void *)0),count(0),bytes(0) {}
+	Node *node; // node whose call is being batched or NULL if none
+	void *tPtr;
+	unsigned int count;
+	unsigned int bytes;
+	ZT_WirePacket packets[ZT_WIRE_BATCH_MAX_PACKETS];
+	uint8_t data[ZT_WIRE_BATCH_MAX_BYTES];
+};
+
+// Allocated the first time a thread batches and kept for the life of the thread
+static thread_local std::unique_ptr<_WireBatch> _wireBatch;
+
+class Node::WireBatchScope
+{
+public:
+	WireBatchScope(Node *const n,void *const tPtr) :
+		_b((_WireBatch *)0)
+	{
+		if (n->_cb.wirePacketBatchSendFunction) {
+			if (!_wireBatch)
+				_wireBatch.reset(new _WireBatch());
+			if (!_wireBatch->node) { // nested calls join the outermost batch
+				_b = _wireBatch.get();
+				_b->node = n;
+				_b->tPtr = tPtr;
+			}
+		}
+	}
+
+	~WireBatchScope()
+	{
+		if (_b) {
+			flush(*_b);
+			_b->node = (Node *)0;
+		}
+	}
+
+	static inline void flush(_WireBatch &b)
+	{
+		if (b.count) {
+			const unsigned int count = b.count;
+			b.count = 0; // batch callback may call back into the node
+			b.bytes = 0;
+			b.node->_cb.wirePacketBatchSendFunction(reinterpret_cast<ZT_Node *>(b.node),b.node->_uPtr,b.tPtr,b.packets,count);
+		}
+	}
+
+private:
+	_WireBatch *_b;
+};
+
 /****************************************************************************/
 /* Public Node interface (C++, exposed via CAPI bindings)                   */
 /****************************************************************************/
@@ -59,14 +128,38 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 	RR(&_RR),
 	_uPtr(uptr),
 	_networks(8),
+	_networkTable(new _NetworkTable()),
+	_networks_m("Node::_networks_m"),
+	_directPaths_m("Node::_directPaths_m"),
+	_multipathDefault(ZT_MULTIPATH_NONE),
+	_multipathModes_m("Node::_multipathModes_m"),
+	_fastFailoverInterval(0),
+	_fastFailoverMissedProbes(ZT_FAST_FAILOVER_DEFAULT_MISSED_PROBES),
+	_lastFastFailoverCheck(0),
+	_fastFailoverPeers_m("Node::_fastFailoverPeers_m"),
+	_adaptiveKeepalive(false),
+	_forwardErrorCorrection(false),
+	_pathPacing(false),
+	_frameAggregation(false),
+	_maxBridgeRoutes(ZT_MAX_BRIDGE_ROUTES),
+	_maxBridgeRoutesPerBridge(ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE),
+	_relayCapacity(0),
+	_relayedBytesAtLastOffer(0),
+	_lastRelayOffer(0),
+	_relayOffered(false),
+	_cryptoWorkers_m("Node::_cryptoWorkers_m"),
+	_pingWheel(ZT_CORE_TIMER_TASK_GRANULARITY,now),
+	_pingWheel_m("Node::_pingWheel_m"),
+	_backgroundTasksLock("Node::_backgroundTasksLock"),
 	_now(now),
 	_lastPingCheck(0),
 	_lastHousekeepingRun(0),
 	_lastMemoizedTraceSettings(0)
 {
-	if (callbacks->version != 0)
+	if ((callbacks->version < 0)||(callbacks->version > 3))
 		throw ZT_EXCEPTION_INVALID_ARGUMENT;
-	ZT_FAST_MEMCPY(&_cb,callbacks,sizeof(ZT_Node_Callbacks));
+	memset(&_cb,0,sizeof(ZT_Node_Callbacks));
+	ZT_FAST_MEMCPY(&_cb,callbacks,(callbacks->version >= 2) ? sizeof(ZT_Node_Callbacks) : ((callbacks->version == 1) ? offsetof(ZT_Node_Callbacks,virtualNetworkFrameBufferFunction) : offsetof(ZT_Node_Callbacks,wirePacketBatchSendFunction)));
 
 	// Initialize non-cryptographic PRNG from a good random source
 	Utils::getSecureRandom((void *)_prngState,sizeof(_prngState));
@@ -92,7 +185,7 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 	}
 
 	if (n <= 0) {
-		RR->identity.generate();
+		RR->identity.generate(0);
 		RR->identity.toString(false,RR->publicIdentityStr);
 		RR->identity.toString(true,RR->secretIdentityStr);
 		idtmp[0] = RR->identity.address().toInt(); idtmp[1] = 0;
@@ -114,8 +207,10 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 		const unsigned long mcs = sizeof(Multicaster) + (((sizeof(Multicaster) & 0xf) != 0) ? (16 - (sizeof(Multicaster) & 0xf)) : 0);
 		const unsigned long topologys = sizeof(Topology) + (((sizeof(Topology) & 0xf) != 0) ? (16 - (sizeof(Topology) & 0xf)) : 0);
 		const unsigned long sas = sizeof(SelfAwareness) + (((sizeof(SelfAwareness) & 0xf) != 0) ? (16 - (sizeof(SelfAwareness) & 0xf)) : 0);
+		const unsigned long shapers = sizeof(Shaper) + (((sizeof(Shaper) & 0xf) != 0) ? (16 - (sizeof(Shaper) & 0xf)) : 0);
+		const unsigned long traversals = sizeof(Traversal) + (((sizeof(Traversal) & 0xf) != 0) ? (16 - (sizeof(Traversal) & 0xf)) : 0);
 
-		m = reinterpret_cast<char *>(::malloc(16 + ts + sws + mcs + topologys + sas));
+		m = reinterpret_cast<char *>(::malloc(16 + ts + sws + mcs + topologys + sas + shapers + traversals));
 		if (!m)
 			throw std::bad_alloc();
 		RR->rtmem = m;
@@ -130,7 +225,13 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 		RR->topology = new (m) Topology(RR,tptr);
 		m += topologys;
 		RR->sa = new (m) SelfAwareness(RR);
+		m += sas;
+		RR->shaper = new (m) Shaper(RR,now);
+		m += shapers;
+		RR->traversal = new (m) Traversal(RR);
 	} catch ( ... ) {
+		if (RR->traversal) RR->traversal->~Traversal();
+		if (RR->shaper) RR->shaper->~Shaper();
 		if (RR->sa) RR->sa->~SelfAwareness();
 		if (RR->topology) RR->topology->~Topology();
 		if (RR->mc) RR->mc->~Multicaster();
@@ -148,7 +249,16 @@ Node::~Node()
 	{
 		Mutex::Lock _l(_networks_m);
 		_networks.clear(); // destroy all networks before shutdown
+		delete _networkTable.exchange(new _NetworkTable());
+		for(std::vector< std::pair< uint64_t,const _NetworkTable * > >::const_iterator t(_retiredNetworkTables.begin());t!=_retiredNetworkTables.end();++t)
+			delete t->second;
+		_retiredNetworkTables.clear();
 	}
+	delete RR->cryptoWorkers;
+	delete RR->cluster;
+	delete RR->egress;
+	if (RR->traversal) RR->traversal->~Traversal();
+	if (RR->shaper) RR->shaper->~Shaper();
 	if (RR->sa) RR->sa->~SelfAwareness();
 	if (RR->topology) RR->topology->~Topology();
 	if (RR->mc) RR->mc->~Multicaster();
@@ -167,7 +277,31 @@ ZT_ResultCode Node::processWirePacket(
 	volatile int64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
+	WireBatchScope wb(this,tptr);
+	ZT_PROBE1(receive__start,packetLength);
 	RR->sw->onRemotePacket(tptr,localSocket,*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
+	ZT_PROBE1(receive__done,packetLength);
+	_drainCryptoWorkers(tptr,now,nextBackgroundTaskDeadline);
+	_wakeForTraversal(nextBackgroundTaskDeadline);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::processWirePackets(
+	void *tptr,
+	int64_t now,
+	const ZT_WirePacket *packets,
+	unsigned int packetCount,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	WireBatchScope wb(this,tptr);
+	for(unsigned int i=0;i<packetCount;++i) {
+		ZT_PROBE1(receive__start,packets[i].length);
+		RR->sw->onRemotePacket(tptr,packets[i].localSocket,*(reinterpret_cast<const InetAddress *>(&(packets[i].address))),packets[i].data,packets[i].length,(FrameBuffer *)0,packets[i].tos);
+		ZT_PROBE1(receive__done,packets[i].length);
+	}
+	_drainCryptoWorkers(tptr,now,nextBackgroundTaskDeadline);
+	_wakeForTraversal(nextBackgroundTaskDeadline);
 	return ZT_RESULT_OK;
 }
 
@@ -184,84 +318,200 @@ ZT_ResultCode Node::processVirtualNetworkFrame(
 	volatile int64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
-	SharedPtr<Network> nw(this->network(nwid));
+	WireBatchScope wb(this,tptr);
+	const Epoch::Guard eg;
+	const SharedPtr<Network> &nw = this->network(eg,nwid);
 	if (nw) {
 		RR->sw->onLocalEthernet(tptr,nw,MAC(sourceMac),MAC(destMac),etherType,vlanId,frameData,frameLength);
 		return ZT_RESULT_OK;
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
 
-// Closure used to ping upstream and active/online peers
-class _PingPeersThatNeedPing
+ZT_ResultCode Node::processVirtualNetworkFrames(
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	WireBatchScope wb(this,tptr);
+	const Epoch::Guard eg;
+	const SharedPtr<Network> &nw = this->network(eg,nwid);
+	if (nw) {
+		const bool aggregate = ((_frameAggregation)&&(frameCount > 1)&&(RR->sw->beginAggregation()));
+		for(unsigned int i=0;i<frameCount;++i)
+			RR->sw->onLocalEthernet(tptr,nw,MAC(frames[i].sourceMac),MAC(frames[i].destMac),frames[i].etherType,frames[i].vlanId,frames[i].data,frames[i].length);
+		if (aggregate)
+			RR->sw->flushAggregated(tptr);
+		return ZT_RESULT_OK;
+	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
+}
+
+ZT_ResultCode Node::processWirePacketBuffer(
+	void *tptr,
+	int64_t now,
+	int64_t localSocket,
+	const struct sockaddr_storage *remoteAddress,
+	ZT_FrameBuffer *fb,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	FrameBuffer *b = FrameBuffer::from(fb);
+	if (!b->valid()) {
+		delete b;
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	}
+
+	_now = now;
+	WireBatchScope wb(this,tptr);
+	ZT_PROBE1(receive__start,b->length);
+	b->toStart(); // packets are decoded at the start of the buffer
+	{
+		const Epoch::Guard eg; // keeps the network of a held frame until it is handed over
+		RR->sw->onRemotePacket(tptr,localSocket,*(reinterpret_cast<const InetAddress *>(remoteAddress)),b->data,b->length,b);
+		ZT_PROBE1(receive__done,b->length);
+		if (b->held()) {
+			b->lend();
+			Metrics::networkFrame(b->heldNetworkId(),false,b->length);
+			ZT_PROBE3(tap__put,b->heldNetworkId(),b->heldEtherType(),b->length);
+			FrameBuffer *const lent = b;
+			b = (FrameBuffer *)0;
+			_cb.virtualNetworkFrameBufferFunction(
+				reinterpret_cast<ZT_Node *>(this),
+				_uPtr,
+				tptr,
+				lent->heldNetworkId(),
+				lent->heldNetworkUserPtr(),
+				lent->heldFrom().toInt(),
+				lent->heldTo().toInt(),
+				lent->heldEtherType(),
+				0,
+				lent);
+		}
+	}
+	delete b;
+	_drainCryptoWorkers(tptr,now,nextBackgroundTaskDeadline);
+	_wakeForTraversal(nextBackgroundTaskDeadline);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::processVirtualNetworkFrameBuffer(
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	uint64_t sourceMac,
+	uint64_t destMac,
+	unsigned int etherType,
+	unsigned int vlanId,
+	ZT_FrameBuffer *fb,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	FrameBuffer *const b = FrameBuffer::from(fb);
+	if (!b->valid()) {
+		delete b;
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	}
+
+	_now = now;
+	ZT_ResultCode r = ZT_RESULT_OK;
+	{
+		WireBatchScope wb(this,tptr);
+		const Epoch::Guard eg;
+		const SharedPtr<Network> &nw = this->network(eg,nwid);
+		if (nw) {
+			try {
+				RR->sw->onLocalEthernet(tptr,nw,MAC(sourceMac),MAC(destMac),etherType,vlanId,b->data,b->length,b);
+			} catch ( ... ) {
+				delete b;
+				throw;
+			}
+		} else r = ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
+	}
+	delete b;
+	return r;
+}
+
+// Ping an upstream or other peer we should always stay in contact with, using
+// its stable endpoints or our best upstream for any address family not reached
+// Sends a VERB_RELAY_OFFER to each peer on one of our networks that we have a direct path to
+class _SendRelayOffer
 {
 public:
-	_PingPeersThatNeedPing(const RuntimeEnvironment *renv,void *tPtr,Hashtable< Address,std::vector<InetAddress> > &alwaysContact,int64_t now) :
+	_SendRelayOffer(const RuntimeEnvironment *renv,void *tPtr,int64_t now,uint64_t capacity,uint64_t load) :
 		RR(renv),
 		_tPtr(tPtr),
-		_alwaysContact(alwaysContact),
 		_now(now),
-		_bestCurrentUpstream(RR->topology->getUpstreamPeer())
-	{
-	}
+		_capacity(capacity),
+		_load(load) {}
 
 	inline void operator()(Topology &t,const SharedPtr<Peer> &p)
 	{
-		const std::vector<InetAddress> *const alwaysContactEndpoints = _alwaysContact.get(p->address());
-		if (alwaysContactEndpoints) {
-			const unsigned int sent = p->doPingAndKeepalive(_tPtr,_now);
-			bool contacted = (sent != 0);
-
-			if ((sent & 0x1) == 0) { // bit 0x1 == IPv4 sent
-				for(unsigned long k=0,ptr=(unsigned long)RR->node->prng();k<(unsigned long)alwaysContactEndpoints->size();++k) {
-					const InetAddress &addr = (*alwaysContactEndpoints)[ptr++ % alwaysContactEndpoints->size()];
-					if (addr.ss_family == AF_INET) {
-						p->sendHELLO(_tPtr,-1,addr,_now);
-						contacted = true;
-						break;
-					}
-				}
-			}
+		if ((!p->trustEstablished(_now))||(!p->getBestPath(_now,false))||(t.isUpstream(p->identity())))
+			return;
+		Packet outp(p->address(),RR->identity.address(),Packet::VERB_RELAY_OFFER);
+		outp.append(_capacity);
+		outp.append(_load);
+		RR->sw->send(_tPtr,outp,true);
+		if (_capacity)
+			p->relayOfferSent(_now);
+	}
 
-			if ((sent & 0x2) == 0) { // bit 0x2 == IPv6 sent
-				for(unsigned long k=0,ptr=(unsigned long)RR->node->prng();k<(unsigned long)alwaysContactEndpoints->size();++k) {
-					const InetAddress &addr = (*alwaysContactEndpoints)[ptr++ % alwaysContactEndpoints->size()];
-					if (addr.ss_family == AF_INET6) {
-						p->sendHELLO(_tPtr,-1,addr,_now);
-						contacted = true;
-						break;
-					}
-				}
-			}
+private:
+	const RuntimeEnvironment *RR;
+	void *_tPtr;
+	int64_t _now;
+	uint64_t _capacity;
+	uint64_t _load;
+};
 
-			if ((!contacted)&&(_bestCurrentUpstream)) {
-				const SharedPtr<Path> up(_bestCurrentUpstream->getBestPath(_now,true));
-				if (up)
-					p->sendHELLO(_tPtr,up->localSocket(),up->address(),_now);
+static void _contactAlways(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &p,const std::vector<InetAddress> &alwaysContactEndpoints,const SharedPtr<Peer> &bestCurrentUpstream,const int64_t now)
+{
+	const unsigned int sent = p->doPingAndKeepalive(tPtr,now);
+	bool contacted = (sent != 0);
+
+	if ((sent & 0x1) == 0) { // bit 0x1 == IPv4 sent
+		for(unsigned long k=0,ptr=(unsigned long)RR->node->prng();k<(unsigned long)alwaysContactEndpoints.size();++k) {
+			const InetAddress &addr = alwaysContactEndpoints[ptr++ % alwaysContactEndpoints.size()];
+			if (addr.ss_family == AF_INET) {
+				p->sendHELLO(tPtr,-1,addr,now);
+				contacted = true;
+				break;
 			}
+		}
+	}
 
-			_alwaysContact.erase(p->address()); // after this we'll WHOIS all upstreams that remain
-		} else if (p->isActive(_now)) {
-			p->doPingAndKeepalive(_tPtr,_now);
+	if ((sent & 0x2) == 0) { // bit 0x2 == IPv6 sent
+		for(unsigned long k=0,ptr=(unsigned long)RR->node->prng();k<(unsigned long)alwaysContactEndpoints.size();++k) {
+			const InetAddress &addr = alwaysContactEndpoints[ptr++ % alwaysContactEndpoints.size()];
+			if (addr.ss_family == AF_INET6) {
+				p->sendHELLO(tPtr,-1,addr,now);
+				contacted = true;
+				break;
+			}
 		}
 	}
 
-private:
-	const RuntimeEnvironment *RR;
-	void *_tPtr;
-	Hashtable< Address,std::vector<InetAddress> > &_alwaysContact;
-	const int64_t _now;
-	const SharedPtr<Peer> _bestCurrentUpstream;
-};
+	if ((!contacted)&&(bestCurrentUpstream)) {
+		const SharedPtr<Path> up(bestCurrentUpstream->getBestPath(now,true));
+		if (up)
+			p->sendHELLO(tPtr,up->localSocket(),up->address(),now);
+	}
+}
 
 ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
 	Mutex::Lock bl(_backgroundTasksLock);
+	WireBatchScope wb(this,tptr);
 
 	unsigned long timeUntilNextPingCheck = ZT_PING_CHECK_INVERVAL;
 	const int64_t timeSinceLastPingCheck = now - _lastPingCheck;
 	if (timeSinceLastPingCheck >= ZT_PING_CHECK_INVERVAL) {
 		try {
+			// The first check after startup comes once sockets are up, so contact peers we had direct paths to before
+			if (!_lastPingCheck)
+				RR->topology->warmStart(tptr,now);
 			_lastPingCheck = now;
 
 			// Get designated VL1 upstreams
@@ -295,25 +545,64 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 				}
 			}
 
-			// Ping active peers, upstreams, and others that we should always contact
-			_PingPeersThatNeedPing pfunc(RR,tptr,alwaysContact,now);
-			RR->topology->eachPeer<_PingPeersThatNeedPing &>(pfunc);
-
-			// Run WHOIS to create Peer for alwaysContact addresses that could not be contacted
+			// Ping upstreams and others that we should always contact, and WHOIS any we don't know yet
 			{
+				RR->topology->rankUpstreams(tptr,now);
+				const SharedPtr<Peer> bestCurrentUpstream(RR->topology->getUpstreamPeer());
 				Hashtable< Address,std::vector<InetAddress> >::Iterator i(alwaysContact);
-				Address *upstreamAddress = (Address *)0;
-				std::vector<InetAddress> *upstreamStableEndpoints = (std::vector<InetAddress> *)0;
-				while (i.next(upstreamAddress,upstreamStableEndpoints))
-					RR->sw->requestWhois(tptr,now,*upstreamAddress);
+				Address *contactAddress = (Address *)0;
+				std::vector<InetAddress> *contactStableEndpoints = (std::vector<InetAddress> *)0;
+				while (i.next(contactAddress,contactStableEndpoints)) {
+					const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*contactAddress));
+					if (p)
+						_contactAlways(RR,tptr,p,*contactStableEndpoints,bestCurrentUpstream,now);
+					else RR->sw->requestWhois(tptr,now,*contactAddress);
+				}
+			}
+
+			// Ping other active peers that are due and reschedule them, dropping any that went quiet
+			{
+				std::vector<Address> due;
+				{
+					Mutex::Lock _l(_pingWheel_m);
+					_pingWheel.expire(now,due);
+				}
+				std::vector< std::pair<int64_t,Address> > next;
+				next.reserve(due.size());
+				for(std::vector<Address>::const_iterator a(due.begin());a!=due.end();++a) {
+					const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*a));
+					if (!p)
+						continue;
+					if (!p->isActive(now)) {
+						p->pingUnscheduled();
+						continue;
+					}
+					if (!alwaysContact.contains(*a))
+						p->doPingAndKeepalive(tptr,now);
+					next.push_back(std::pair<int64_t,Address>(p->nextPingTime(now),*a));
+				}
+				Mutex::Lock _l(_pingWheel_m);
+				for(std::vector< std::pair<int64_t,Address> >::const_iterator n(next.begin());n!=next.end();++n)
+					_pingWheel.add(n->first,n->second);
 			}
 
-			// Refresh network config or broadcast network updates to members as needed
+			// Drop lapsed relay offers from peers and offer our own relay capacity
+			RR->topology->rankRelays(now);
+			if ((now - _lastRelayOffer) >= ZT_RELAY_OFFER_INTERVAL)
+				_sendRelayOffers(tptr,now);
+
+			// Refresh network config or broadcast network updates to members as needed,
+			// with LIKEs for upstreams and credentials for members of more than one
+			// network sharing packets
+			Network::LikeBatch likes;
+			Membership::PushBatch pushes;
 			for(std::vector< std::pair< SharedPtr<Network>,bool > >::const_iterator n(networkConfigNeeded.begin());n!=networkConfigNeeded.end();++n) {
 				if (n->second)
 					n->first->requestConfiguration(tptr);
-				n->first->sendUpdatesToMembers(tptr);
+				n->first->sendUpdatesToMembers(tptr,&likes,&pushes);
 			}
+			pushes.send(RR,tptr);
+			likes.send(RR,tptr);
 
 			// Update online status, post status change as event
 			const bool oldOnline = _online;
@@ -338,6 +627,78 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 			RR->topology->doPeriodicTasks(tptr,now);
 			RR->sa->clean(now);
 			RR->mc->clean(now);
+			{
+				Mutex::Lock _l(_networks_m);
+				_reclaimNetworkTables();
+			}
+			const std::vector< SharedPtr<Network> > networks(allNetworks());
+			for(std::vector< SharedPtr<Network> >::const_iterator n(networks.begin());n!=networks.end();++n)
+				(*n)->clean();
+		} catch ( ... ) {
+			return ZT_RESULT_FATAL_ERROR_INTERNAL;
+		}
+	}
+
+	// Send frames the egress scheduler has been holding if the uplink has room now
+	unsigned long egressWait = ZT_PING_CHECK_INVERVAL;
+	if ((RR->egress)&&(RR->egress->enabled())) {
+		try {
+			egressWait = std::min(RR->egress->service(tptr,now),(unsigned long)ZT_EGRESS_SERVICE_PERIOD);
+		} catch ( ... ) {
+			return ZT_RESULT_FATAL_ERROR_INTERNAL;
+		}
+	}
+
+	// Send packets held back by rate limits that are due
+	unsigned long shaperWait = ZT_PING_CHECK_INVERVAL;
+	try {
+		shaperWait = RR->shaper->service(tptr,now);
+		if (RR->shaper->active())
+			shaperWait = std::min(shaperWait,(unsigned long)ZT_SHAPER_SERVICE_PERIOD);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+
+	// Send staged probes to candidate endpoints that are due
+	unsigned long traversalWait = ZT_PING_CHECK_INVERVAL;
+	try {
+		traversalWait = RR->traversal->service(tptr,now);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+
+	if (RR->cluster) {
+		try {
+			RR->cluster->doPeriodicTasks(tptr,now);
+		} catch ( ... ) {
+			return ZT_RESULT_FATAL_ERROR_INTERNAL;
+		}
+	}
+
+	const unsigned int ffInterval = _fastFailoverInterval;
+	bool ffWatching = false;
+	if (ffInterval) {
+		try {
+			std::vector< SharedPtr<Peer> > watched;
+			{
+				Mutex::Lock _l(_fastFailoverPeers_m);
+				if ((now - _lastFastFailoverCheck) >= (int64_t)ffInterval) {
+					_lastFastFailoverCheck = now;
+					Hashtable< Address,SharedPtr<Peer> >::Iterator i(_fastFailoverPeers);
+					Address *a = (Address *)0;
+					SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+					while (i.next(a,p))
+						watched.push_back(*p);
+				}
+				ffWatching = (_fastFailoverPeers.size() > 0);
+			}
+			for(std::vector< SharedPtr<Peer> >::iterator p(watched.begin());p!=watched.end();++p) {
+				if (!(*p)->doFastFailover(tptr,now,ffInterval,_fastFailoverMissedProbes)) {
+					Mutex::Lock _l(_fastFailoverPeers_m);
+					_fastFailoverPeers.erase((*p)->address());
+					(*p)->fastFailoverUnwatched();
+				}
+			}
 		} catch ( ... ) {
 			return ZT_RESULT_FATAL_ERROR_INTERNAL;
 		}
@@ -345,6 +706,19 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 
 	try {
 		*nextBackgroundTaskDeadline = now + (int64_t)std::max(std::min(timeUntilNextPingCheck,RR->sw->doTimerTasks(tptr,now)),(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY);
+		if ((ffWatching)&&((*nextBackgroundTaskDeadline - now) > (int64_t)ffInterval)) // come back in time for the next fast failover probe
+			*nextBackgroundTaskDeadline = now + (int64_t)ffInterval;
+		if ((RR->sw->whoisPending())&&((*nextBackgroundTaskDeadline - now) > ZT_WHOIS_COALESCE_WINDOW)) // come back sooner to send coalesced WHOIS requests
+			*nextBackgroundTaskDeadline = now + ZT_WHOIS_COALESCE_WINDOW;
+		if ((RR->cluster)&&((*nextBackgroundTaskDeadline - now) > ZT_CLUSTER_FLUSH_PERIOD)) // come back in time to flush messages to other cluster members
+			*nextBackgroundTaskDeadline = now + ZT_CLUSTER_FLUSH_PERIOD;
+		if ((*nextBackgroundTaskDeadline - now) > (int64_t)egressWait) // come back in time to send frames the egress scheduler is holding
+			*nextBackgroundTaskDeadline = now + (int64_t)egressWait;
+		if ((*nextBackgroundTaskDeadline - now) > (int64_t)shaperWait) // come back in time to send packets rate limits are holding
+			*nextBackgroundTaskDeadline = now + (int64_t)shaperWait;
+		if ((*nextBackgroundTaskDeadline - now) > (int64_t)traversalWait) // come back in time for the next stage of probes to candidate endpoints
+			*nextBackgroundTaskDeadline = now + (int64_t)traversalWait;
+		_drainCryptoWorkers(tptr,now,nextBackgroundTaskDeadline);
 	} catch ( ... ) {
 		return ZT_RESULT_FATAL_ERROR_INTERNAL;
 	}
@@ -352,12 +726,76 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 	return ZT_RESULT_OK;
 }
 
+void Node::_drainCryptoWorkers(void *tptr,const int64_t now,volatile int64_t *nextBackgroundTaskDeadline)
+{
+	CryptoWorkers *const cw = RR->cryptoWorkers;
+	if ((cw)&&(cw->pending())) {
+		cw->drain(tptr);
+		if ((nextBackgroundTaskDeadline)&&(cw->pending())&&((*nextBackgroundTaskDeadline - now) > ZT_CRYPTO_WORKERS_POLL_INTERVAL))
+			*nextBackgroundTaskDeadline = now + ZT_CRYPTO_WORKERS_POLL_INTERVAL;
+	}
+}
+
+void Node::_wakeForTraversal(volatile int64_t *nextBackgroundTaskDeadline)
+{
+	const int64_t due = RR->traversal->nextDue();
+	if ((nextBackgroundTaskDeadline)&&(due < *nextBackgroundTaskDeadline))
+		*nextBackgroundTaskDeadline = due;
+}
+
+const SharedPtr<Network> Node::_noNetwork;
+
+void Node::_publishNetworks()
+{
+	_NetworkTable *const t = new _NetworkTable();
+	t->reserve(_networks.size());
+	Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(_networks);
+	uint64_t *k = (uint64_t *)0;
+	SharedPtr<Network> *v = (SharedPtr<Network> *)0;
+	while (i.next(k,v))
+		t->push_back(std::pair< uint64_t,SharedPtr<Network> >(*k,*v));
+	std::sort(t->begin(),t->end(),_NetworkIdLess());
+
+	const _NetworkTable *const old = _networkTable.exchange(t,std::memory_order_acq_rel);
+	_retiredNetworkTables.push_back(std::pair< uint64_t,const _NetworkTable * >(Epoch::retire(),old));
+	_reclaimNetworkTables();
+}
+
+void Node::_reclaimNetworkTables()
+{
+	// A left network is destroyed here if this was the last reference to it
+	std::vector< std::pair< uint64_t,const _NetworkTable * > >::iterator t(_retiredNetworkTables.begin());
+	while ((t != _retiredNetworkTables.end())&&(Epoch::safe(t->first))) {
+		delete t->second;
+		++t;
+	}
+	_retiredNetworkTables.erase(_retiredNetworkTables.begin(),t);
+}
+
+void Node::_sendRelayOffers(void *tPtr,const int64_t now)
+{
+	const uint64_t relayedBytes = RR->sw->relayedBytes();
+	const uint64_t load = (_lastRelayOffer) ? (((relayedBytes - _relayedBytesAtLastOffer) * 1000ULL) / (uint64_t)(now - _lastRelayOffer)) : 0;
+	_relayedBytesAtLastOffer = relayedBytes;
+	_lastRelayOffer = now;
+
+	// A capacity of zero is sent once after we stop offering so peers stop using us right away
+	const uint64_t capacity = _relayCapacity;
+	if ((!capacity)&&(!_relayOffered))
+		return;
+	_relayOffered = (capacity != 0);
+	_SendRelayOffer so(RR,tPtr,now,capacity,load);
+	RR->topology->eachPeer<_SendRelayOffer &>(so);
+}
+
 ZT_ResultCode Node::join(uint64_t nwid,void *uptr,void *tptr)
 {
 	Mutex::Lock _l(_networks_m);
 	SharedPtr<Network> &nw = _networks[nwid];
-	if (!nw)
+	if (!nw) {
 		nw = SharedPtr<Network>(new Network(RR,tptr,nwid,uptr,(const NetworkConfig *)0));
+		_publishNetworks();
+	}
 	return ZT_RESULT_OK;
 }
 
@@ -383,6 +821,7 @@ ZT_ResultCode Node::leave(uint64_t nwid,void **uptr,void *tptr)
 	{
 		Mutex::Lock _l(_networks_m);
 		_networks.erase(nwid);
+		_publishNetworks();
 	}
 
 	uint64_t tmp[2];
@@ -433,6 +872,309 @@ void Node::status(ZT_NodeStatus *status) const
 	status->publicIdentity = RR->publicIdentityStr;
 	status->secretIdentity = RR->secretIdentityStr;
 	status->online = _online ? 1 : 0;
+	status->natType = RR->sa->natType();
+}
+
+void Node::memoryUsage(ZT_MemoryUsage *mu) const
+{
+	memset(mu,0,sizeof(ZT_MemoryUsage));
+	RR->topology->memoryUsage(mu);
+	mu->bytesPerPeer = (mu->peers) ? (unsigned int)(mu->peerBytes / mu->peers) : 0;
+	mu->bytesPerPath = (mu->paths) ? (unsigned int)(mu->pathBytes / mu->paths) : 0;
+	ObjectPool<Peer>::stats(mu->peerPool);
+	ObjectPool<Path>::stats(mu->pathPool);
+	HugePages::stats(mu->hugePages);
+	RR->sw->memoryUsage(mu);
+	RR->mc->memoryUsage(mu);
+
+	const std::vector< SharedPtr<Network> > nws(allNetworks());
+	for(std::vector< SharedPtr<Network> >::const_iterator n(nws.begin());n!=nws.end();++n) {
+		ZT_NetworkMemoryUsage nmu;
+		(*n)->memoryUsage(&nmu);
+		++mu->networks;
+		mu->members += nmu.members;
+		mu->memberBytes += nmu.memberBytes;
+		mu->bridgeRoutes += nmu.bridgeRoutes;
+		mu->bridgeRouteBytes += nmu.bridgeRouteBytes;
+		mu->networkBytes += nmu.bytes;
+	}
+}
+
+bool Node::networkMemoryUsage(uint64_t nwid,ZT_NetworkMemoryUsage *mu) const
+{
+	const SharedPtr<Network> nw(network(nwid));
+	if (!nw)
+		return false;
+	nw->memoryUsage(mu);
+	return true;
+}
+
+void Node::metrics(ZT_Metrics *m) const
+{
+	memset(m,0,sizeof(ZT_Metrics));
+	Metrics::snapshot(m);
+
+	unsigned int rxqs = 0;
+	uint64_t evicted = 0,expired = 0,relayed = 0;
+	RR->sw->rxQueueStats(rxqs,evicted,expired);
+	m->rxQueueSize = rxqs;
+	RR->sw->relayStats(relayed,m->relayCacheHits,m->relayCacheMisses);
+	RR->topology->peerKeyCacheStats(m->peerKeyCacheHits,m->peerKeyCacheMisses);
+	_identityValidationCache.stats(m->identityCacheHits,m->identityCacheMisses);
+
+	ZT_MemoryUsage mu;
+	memset(&mu,0,sizeof(mu));
+	RR->topology->memoryUsage(&mu);
+	m->peers = mu.peers;
+	m->paths = mu.paths;
+}
+
+void Node::setTraceCapture(unsigned int event,unsigned int sampleRate,unsigned int maxPerSecond)
+{
+	TraceRing::configure(event,sampleRate,maxPerSecond);
+}
+
+unsigned long Node::readTrace(ZT_TraceRecord *records,unsigned long maxRecords,uint64_t *dropped)
+{
+	return TraceRing::read(records,maxRecords,dropped);
+}
+
+unsigned int Node::lockProfiles(ZT_LockProfile *profiles,unsigned int maxProfiles) const
+{
+#ifdef ZT_MUTEX_PROFILING
+	return MutexProfile::snapshot(profiles,maxProfiles);
+#else
+	return 0;
+#endif
+}
+
+unsigned int Node::rateLimitStats(ZT_RateLimitStats *stats,unsigned int maxStats) const
+{
+	return RR->shaper->stats(stats,maxStats);
+}
+
+unsigned int Node::topTalkers(uint64_t nwid,ZT_TopTalker *talkers,unsigned int maxTalkers)
+{
+	if (nwid) {
+		const SharedPtr<Network> nw(network(nwid));
+		return (nw) ? nw->topTalkers().get(nwid,false,_now,talkers,maxTalkers) : 0;
+	}
+	unsigned int n = RR->sw->topRelays().get(0,true,_now,talkers,maxTalkers);
+	const std::vector< SharedPtr<Network> > nws(allNetworks());
+	for(std::vector< SharedPtr<Network> >::const_iterator nw(nws.begin());nw!=nws.end();++nw)
+		n += (*nw)->topTalkers().get((*nw)->id(),false,_now,talkers + n,maxTalkers - n);
+	return n;
+}
+
+ZT_RuleCountersList *Node::ruleCounters(uint64_t nwid) const
+{
+	std::vector< SharedPtr<Network> > nws;
+	if (nwid) {
+		const SharedPtr<Network> nw(network(nwid));
+		if (nw)
+			nws.push_back(nw);
+	} else {
+		nws = allNetworks();
+	}
+
+	std::vector< std::pair< uint64_t,std::pair<int64_t,CompiledRules> > > lists;
+	unsigned long sets = 0;
+	for(std::vector< SharedPtr<Network> >::const_iterator nw(nws.begin());nw!=nws.end();++nw) {
+		std::vector< std::pair<int64_t,CompiledRules> > l;
+		(*nw)->ruleCounters(l);
+		for(std::vector< std::pair<int64_t,CompiledRules> >::const_iterator i(l.begin());i!=l.end();++i) {
+			lists.push_back(std::pair< uint64_t,std::pair<int64_t,CompiledRules> >((*nw)->id(),*i));
+			sets += i->second.setCount();
+		}
+	}
+
+	char *buf = (char *)::malloc(sizeof(ZT_RuleCountersList) + (sizeof(ZT_RuleListCounters) * lists.size()) + (sizeof(ZT_RuleSetCounters) * sets));
+	if (!buf)
+		return (ZT_RuleCountersList *)0;
+	ZT_RuleCountersList *rl = (ZT_RuleCountersList *)buf;
+	rl->lists = (ZT_RuleListCounters *)(buf + sizeof(ZT_RuleCountersList));
+	rl->listCount = (unsigned long)lists.size();
+	ZT_RuleSetCounters *sc = (ZT_RuleSetCounters *)(buf + sizeof(ZT_RuleCountersList) + (sizeof(ZT_RuleListCounters) * lists.size()));
+
+	std::vector<unsigned int> order;
+	for(unsigned long i=0;i<(unsigned long)lists.size();++i) {
+		const CompiledRules &cr = lists[i].second.second;
+		const CompiledRules::Counters *const c = cr.counters();
+		ZT_RuleListCounters &l = rl->lists[i];
+		l.networkId = lists[i].first;
+		l.capability = (lists[i].second.first >= 0) ? 1 : 0;
+		l.capabilityId = (lists[i].second.first >= 0) ? (uint32_t)lists[i].second.first : 0;
+		l.evaluations = (c) ? c->evaluations() : 0;
+		l.entriesEvaluated = (c) ? c->entries() : 0;
+		l.setCount = cr.setCount();
+		l.sets = sc;
+		cr.suggestOrder(order);
+		for(unsigned int s=0;s<l.setCount;++s) {
+			sc[s].first = cr.setStart(s);
+			sc[s].action = cr.setEnd(s);
+			sc[s].hits = (c) ? c->hits(s) : 0;
+			sc[order[s]].suggestedPosition = s;
+		}
+		sc += l.setCount;
+	}
+
+	return rl;
+}
+
+void Node::setFlowSampling(unsigned int sampleRate)
+{
+	FlowTable::setSampleRate(sampleRate);
+}
+
+unsigned int Node::flowRecords(ZT_FlowRecord *records,unsigned int maxRecords)
+{
+	unsigned int n = 0;
+	const std::vector< SharedPtr<Network> > nws(allNetworks());
+	for(std::vector< SharedPtr<Network> >::const_iterator nw(nws.begin());(nw!=nws.end())&&(n<maxRecords);++nw)
+		n += (*nw)->flowTable().expire((*nw)->id(),_now,records + n,maxRecords - n);
+	return n;
+}
+
+unsigned int Node::tapFilter(uint64_t nwid,ZT_VirtualNetworkRule *rules,unsigned int maxRules) const
+{
+	const SharedPtr<Network> nw(network(nwid));
+	if (!nw)
+		return 0;
+	std::vector<ZT_VirtualNetworkRule> r;
+	nw->tapFilter(r);
+	const unsigned int n = std::min((unsigned int)r.size(),maxRules);
+	if (n)
+		ZT_FAST_MEMCPY(rules,r.data(),sizeof(ZT_VirtualNetworkRule) * n);
+	return n;
+}
+
+void Node::setFrameCapture(uint64_t nwid,unsigned int maxFrames,unsigned int snapLength)
+{
+	FrameCapture::configure(nwid,maxFrames,snapLength);
+}
+
+ZT_FrameCapture *Node::readFrameCapture(bool clear)
+{
+	std::string pcap;
+	ZT_FrameCapture fc;
+	memset(&fc,0,sizeof(fc));
+	fc.capturing = (FrameCapture::status(fc.networkId,fc.maxFrames,fc.snapLength,fc.frames,fc.overwritten)) ? 1 : 0;
+	fc.frames = FrameCapture::pcapng(pcap,clear);
+	fc.size = (unsigned long)pcap.length();
+
+	char *buf = (char *)::malloc(sizeof(ZT_FrameCapture) + pcap.length());
+	if (!buf)
+		return (ZT_FrameCapture *)0;
+	fc.data = buf + sizeof(ZT_FrameCapture);
+	ZT_FAST_MEMCPY(buf,&fc,sizeof(ZT_FrameCapture));
+	ZT_FAST_MEMCPY(buf + sizeof(ZT_FrameCapture),pcap.data(),pcap.length());
+	return (ZT_FrameCapture *)buf;
+}
+
+ZT_StateSnapshot *Node::snapshot() const
+{
+	StateSnapshot ss(RR->identity.address(),_now);
+	RR->topology->saveState(ss);
+	RR->mc->saveState(ss);
+	const std::vector< SharedPtr<Network> > nws(allNetworks());
+	for(std::vector< SharedPtr<Network> >::const_iterator n(nws.begin());n!=nws.end();++n)
+		(*n)->saveCredentials(ss);
+
+	ZT_StateSnapshot sn;
+	memset(&sn,0,sizeof(sn));
+	sn.timestamp = _now;
+	sn.peers = ss.items(StateSnapshot::RECORD_PEER);
+	sn.coldPeers = ss.items(StateSnapshot::RECORD_COLD_PEER);
+	sn.multicastMembers = ss.items(StateSnapshot::RECORD_MULTICAST_MEMBERS);
+	sn.credentials = ss.items(StateSnapshot::RECORD_COM) + ss.items(StateSnapshot::RECORD_CAPABILITY) + ss.items(StateSnapshot::RECORD_TAG) + ss.items(StateSnapshot::RECORD_COO);
+	sn.size = (unsigned long)ss.data().length();
+
+	char *buf = (char *)::malloc(sizeof(ZT_StateSnapshot) + ss.data().length());
+	if (!buf)
+		return (ZT_StateSnapshot *)0;
+	sn.data = buf + sizeof(ZT_StateSnapshot);
+	ZT_FAST_MEMCPY(buf,&sn,sizeof(ZT_StateSnapshot));
+	ZT_FAST_MEMCPY(buf + sizeof(ZT_StateSnapshot),ss.data().data(),ss.data().length());
+	return (ZT_StateSnapshot *)buf;
+}
+
+ZT_ResultCode Node::restoreSnapshot(void *tptr,int64_t now,const void *data,unsigned long len,ZT_StateSnapshot *restored)
+{
+	ZT_StateSnapshot sn;
+	memset(&sn,0,sizeof(sn));
+	if (restored)
+		*restored = sn;
+
+	StateSnapshot::Reader r(data,len,RR->identity.address());
+	if (!r.valid())
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	sn.timestamp = r.timestamp();
+	sn.size = len;
+	sn.data = data;
+	if ((now - r.timestamp()) >= ZT_PEER_ACTIVITY_TIMEOUT) {
+		if (restored)
+			*restored = sn;
+		return ZT_RESULT_OK_IGNORED;
+	}
+
+	// Records are in the order they were saved, so peers (including any
+	// controllers that signed credentials) are back before credentials
+	Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> *const b = new Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE>();
+	StateSnapshot::RecordType t;
+	CertificateOfMembership com;
+	Capability cap;
+	Tag tag;
+	CertificateOfOwnership coo;
+	while (r.next(t,*b)) {
+		try {
+			Membership::AddCredentialResult cr = Membership::ADD_REJECTED;
+			SharedPtr<Network> nw;
+			switch(t) {
+				case StateSnapshot::RECORD_PEER:
+					if (RR->topology->restoreState(tptr,now,t,*b))
+						++sn.peers;
+					break;
+				case StateSnapshot::RECORD_COLD_PEER:
+					if (RR->topology->restoreState(tptr,now,t,*b))
+						++sn.coldPeers;
+					break;
+				case StateSnapshot::RECORD_MULTICAST_MEMBERS:
+					sn.multicastMembers += RR->mc->restoreState(tptr,now,t,*b);
+					break;
+				case StateSnapshot::RECORD_COM:
+					com.deserialize(*b);
+					nw = network(com.networkId());
+					if (nw)
+						cr = nw->addCredential(tptr,com);
+					break;
+				case StateSnapshot::RECORD_CAPABILITY:
+					cap.deserialize(*b);
+					nw = network(cap.networkId());
+					if (nw)
+						cr = nw->addCredential(tptr,cap);
+					break;
+				case StateSnapshot::RECORD_TAG:
+					tag.deserialize(*b);
+					nw = network(tag.networkId());
+					if (nw)
+						cr = nw->addCredential(tptr,tag);
+					break;
+				case StateSnapshot::RECORD_COO:
+					coo.deserialize(*b);
+					nw = network(coo.networkId());
+					if (nw)
+						cr = nw->addCredential(tptr,coo);
+					break;
+			}
+			if ((cr == Membership::ADD_ACCEPTED_NEW)||(cr == Membership::ADD_ACCEPTED_REDUNDANT))
+				++sn.credentials;
+		} catch ( ... ) {} // skip invalid records
+	}
+	delete b;
+
+	if (restored)
+		*restored = sn;
+	return ZT_RESULT_OK;
 }
 
 ZT_PeerList *Node::peers() const
@@ -463,17 +1205,25 @@ ZT_PeerList *Node::peers() const
 		if (p->latency >= 0xffff)
 			p->latency = -1;
 		p->role = RR->topology->role(pi->second->identity().address());
+		pi->second->traffic(p->packetsIn,p->bytesIn,p->relayedPacketsIn,p->packetsOut,p->bytesOut,p->relayedPacketsOut);
 
 		std::vector< SharedPtr<Path> > paths(pi->second->paths(_now));
 		SharedPtr<Path> bestp(pi->second->getBestPath(_now,false));
 		p->pathCount = 0;
 		for(std::vector< SharedPtr<Path> >::iterator path(paths.begin());path!=paths.end();++path) {
-			ZT_FAST_MEMCPY(&(p->paths[p->pathCount].address),&((*path)->address()),sizeof(struct sockaddr_storage));
+			const InetAddress pa((*path)->address());
+			ZT_FAST_MEMCPY(&(p->paths[p->pathCount].address),&pa,sizeof(struct sockaddr_storage));
 			p->paths[p->pathCount].lastSend = (*path)->lastOut();
 			p->paths[p->pathCount].lastReceive = (*path)->lastIn();
-			p->paths[p->pathCount].trustedPathId = RR->topology->getOutboundPathTrust((*path)->address());
+			p->paths[p->pathCount].trustedPathId = RR->topology->getOutboundPathTrust(pa);
 			p->paths[p->pathCount].expired = 0;
 			p->paths[p->pathCount].preferred = ((*path) == bestp) ? 1 : 0;
+			p->paths[p->pathCount].latency = ((*path)->latency() < 0xffff) ? (int)(*path)->latency() : -1;
+			p->paths[p->pathCount].jitter = ((*path)->qosSamples()) ? (int)(*path)->jitter() : -1;
+			p->paths[p->pathCount].packetLoss = ((*path)->qosSamples()) ? (int)((*path)->loss() / 1000) : -1;
+			p->paths[p->pathCount].throughputIn = (*path)->throughputIn();
+			p->paths[p->pathCount].throughputOut = (*path)->throughputOut();
+			(*path)->traffic(p->paths[p->pathCount].packetsIn,p->paths[p->pathCount].bytesIn,p->paths[p->pathCount].fragmentsIn,p->paths[p->pathCount].packetsOut,p->paths[p->pathCount].bytesOut,p->paths[p->pathCount].fragmentsOut);
 			++p->pathCount;
 		}
 	}
@@ -563,6 +1313,25 @@ void Node::setNetconfMaster(void *networkControllerInstance)
 /* Node methods used only within node/                                      */
 /****************************************************************************/
 
+bool Node::_batchPacket(const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl,unsigned int tos)
+{
+	_WireBatch *const b = _wireBatch.get();
+	if ((!b)||(b->node != this)||(len > ZT_WIRE_BATCH_MAX_BYTES))
+		return false;
+	if ((b->count >= ZT_WIRE_BATCH_MAX_PACKETS)||((b->bytes + len) > ZT_WIRE_BATCH_MAX_BYTES))
+		WireBatchScope::flush(*b);
+	ZT_WirePacket &p = b->packets[b->count++];
+	p.localSocket = localSocket;
+	ZT_FAST_MEMCPY(&(p.address),&addr,sizeof(struct sockaddr_storage));
+	ZT_FAST_MEMCPY(b->data + b->bytes,data,len);
+	p.data = b->data + b->bytes;
+	p.length = len;
+	p.ttl = ttl;
+	p.tos = tos;
+	b->bytes += len;
+	return true;
+}
+
 bool Node::shouldUsePathForZeroTierTraffic(void *tPtr,const Address &ztaddr,const int64_t localSocket,const InetAddress &remoteAddress)
 {
 	if (!Path::isAddressValidForPath(remoteAddress))
@@ -589,6 +1358,11 @@ bool Node::shouldUsePathForZeroTierTraffic(void *tPtr,const Address &ztaddr,cons
 	return ( (_cb.pathCheckFunction) ? (_cb.pathCheckFunction(reinterpret_cast<ZT_Node *>(this),_uPtr,tPtr,ztaddr.toInt(),localSocket,reinterpret_cast<const struct sockaddr_storage *>(&remoteAddress)) != 0) : true);
 }
 
+void Node::relayStats(uint64_t &relayed,uint64_t &cacheHits,uint64_t &cacheMisses) const
+{
+	RR->sw->relayStats(relayed,cacheHits,cacheMisses);
+}
+
 uint64_t Node::prng()
 {
 	// https://en.wikipedia.org/wiki/Xorshift#xorshift.2B
@@ -607,17 +1381,238 @@ ZT_ResultCode Node::setPhysicalPathConfiguration(const struct sockaddr_storage *
 	return ZT_RESULT_OK;
 }
 
-World Node::planet() const
+ZT_ResultCode Node::setMultipathMode(const uint64_t ztAddress,const ZT_MultipathMode mode)
 {
-	return RR->topology->planet();
-}
+	if (((int)mode < (int)ZT_MULTIPATH_NONE)||((int)mode > (int)ZT_MULTIPATH_BALANCE))
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	{
+		Mutex::Lock _l(_multipathModes_m);
+		if (ztAddress) {
+			_multipathModes[Address(ztAddress)] = (int)mode;
+		} else {
+			_multipathDefault = (int)mode;
+		}
+	}
+	// Look each mode up again rather than holding our lock under the peer table's
+	std::vector< std::pair< Address,SharedPtr<Peer> > > peers(RR->topology->allPeers());
+	for(std::vector< std::pair< Address,SharedPtr<Peer> > >::iterator p(peers.begin());p!=peers.end();++p)
+		p->second->setMultipathMode(multipathMode(p->first));
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setUpstreamLatencyHint(const uint64_t ztAddress,const unsigned int latency)
+{
+	RR->topology->setUpstreamLatencyHint(Address(ztAddress),latency);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setMemberRateLimit(const uint64_t ztAddress,const uint64_t bytesPerSecond)
+{
+	RR->shaper->setMemberRate(Address(ztAddress),bytesPerSecond);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setEgressRate(const uint64_t bytesPerSecond,const uint64_t interactiveDscp)
+{
+	if (!RR->egress) {
+		if (!bytesPerSecond)
+			return ZT_RESULT_OK;
+		RR->egress = new Egress(RR); // kept once created since other threads may be using it
+	}
+	RR->egress->setRate(bytesPerSecond,interactiveDscp);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setFastFailover(const unsigned int probeInterval,const unsigned int maxMissedProbes)
+{
+	if (((probeInterval)&&(probeInterval < ZT_FAST_FAILOVER_MIN_INTERVAL))||(!maxMissedProbes))
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	_fastFailoverMissedProbes = maxMissedProbes;
+	_fastFailoverInterval = probeInterval;
+	if (!probeInterval) {
+		Mutex::Lock _l(_fastFailoverPeers_m);
+		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_fastFailoverPeers);
+		Address *a = (Address *)0;
+		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		while (i.next(a,p))
+			(*p)->fastFailoverUnwatched();
+		_fastFailoverPeers.clear();
+	}
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setAdaptiveKeepalive(const bool enabled)
+{
+	_adaptiveKeepalive = enabled;
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setForwardErrorCorrection(const bool enabled)
+{
+	_forwardErrorCorrection = enabled;
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setFrameAggregation(const bool enabled)
+{
+	_frameAggregation = enabled;
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setRelayCapacity(const uint64_t bytesPerSecond)
+{
+	_relayCapacity = bytesPerSecond;
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setPathPacing(const bool enabled)
+{
+	_pathPacing = enabled;
+	RR->shaper->setPathPacing(enabled);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setMemoryLimits(const unsigned long maxPeers,const unsigned long maxMulticastMembers)
+{
+	RR->topology->setMaxPeers(maxPeers);
+	RR->mc->setMaxMembers(maxMulticastMembers);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setBridgeRouteLimits(const unsigned long maxRoutes,const unsigned long maxPerBridge)
+{
+	// Under _networks_m so a network being joined gets either these limits or this update
+	Mutex::Lock _l(_networks_m);
+	_maxBridgeRoutes = maxRoutes;
+	_maxBridgeRoutesPerBridge = maxPerBridge;
+	Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(_networks);
+	uint64_t *k = (uint64_t *)0;
+	SharedPtr<Network> *v = (SharedPtr<Network> *)0;
+	while (i.next(k,v))
+		(*v)->setBridgeRouteLimits(maxRoutes,maxPerBridge);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setColdPeerTimeout(const int64_t idleMs)
+{
+	RR->topology->setColdPeerTimeout(idleMs);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setAdmissionBudget(const uint64_t cpuMicrosecondsPerSecond)
+{
+	_admission.setBudget(cpuMicrosecondsPerSecond);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setIdentityCacheSize(const unsigned long identities)
+{
+	_identityValidationCache.setCapacity(identities);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setCryptoWorkers(const unsigned int threads)
+{
+	if (threads > ZT_CRYPTO_WORKERS_MAX_THREADS)
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	Mutex::Lock _l(_cryptoWorkers_m);
+	if (!RR->cryptoWorkers) {
+		if (!threads)
+			return ZT_RESULT_OK;
+		RR->cryptoWorkers = new CryptoWorkers(RR); // kept once created since other threads may be using it
+	}
+	RR->cryptoWorkers->setThreads(threads,_cryptoWorkerCpus);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setCryptoWorkerCpus(const unsigned int *cpus,const unsigned int cpuCount)
+{
+	Mutex::Lock _l(_cryptoWorkers_m);
+	_cryptoWorkerCpus.assign(cpus,cpus + cpuCount);
+	if (RR->cryptoWorkers)
+		RR->cryptoWorkers->setThreads(RR->cryptoWorkers->threads(),_cryptoWorkerCpus);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::setHugePages(enum ZT_HugePageMode mode)
+{
+	if ((mode != ZT_HUGE_PAGES_OFF)&&(mode != ZT_HUGE_PAGES_TRANSPARENT)&&(mode != ZT_HUGE_PAGES_EXPLICIT))
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	HugePages::setMode(mode);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::clusterInit(
+	unsigned int myId,
+	const std::vector<InetAddress> &zeroTierPhysicalEndpoints,
+	int32_t x,
+	int32_t y,
+	int32_t z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg)
+{
+	if ((RR->cluster)||(myId >= ZT_CLUSTER_MAX_MEMBERS)||(!sendFunction)||(zeroTierPhysicalEndpoints.size() > ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES))
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	RR->cluster = new Cluster(RR,(uint16_t)myId,zeroTierPhysicalEndpoints,x,y,z,sendFunction,sendFunctionArg,addressToLocationFunction,addressToLocationFunctionArg);
+	return ZT_RESULT_OK;
+}
+
+ZT_ResultCode Node::clusterAddMember(unsigned int memberId)
+{
+	if ((!RR->cluster)||(memberId >= ZT_CLUSTER_MAX_MEMBERS))
+		return ZT_RESULT_ERROR_BAD_PARAMETER;
+	return ((RR->cluster->addMember((uint16_t)memberId)) ? ZT_RESULT_OK : ZT_RESULT_ERROR_BAD_PARAMETER);
+}
+
+void Node::clusterRemoveMember(unsigned int memberId)
+{
+	if ((RR->cluster)&&(memberId < ZT_CLUSTER_MAX_MEMBERS))
+		RR->cluster->removeMember((uint16_t)memberId);
+}
+
+void Node::clusterHandleIncomingMessage(void *tPtr,const void *msg,unsigned int len)
+{
+	if (RR->cluster)
+		RR->cluster->handleIncomingStateMessage(tPtr,msg,len);
+}
+
+bool Node::clusterStatus(ZT_ClusterStatus *cs) const
+{
+	if (!RR->cluster)
+		return false;
+	RR->cluster->status(*cs);
+	return true;
+}
+
+void Node::frameSent(const SharedPtr<Peer> &peer,const int64_t now)
+{
+	peer->frameSent(now);
+	if ((_fastFailoverInterval)&&(peer->fastFailoverWatched())) {
+		Mutex::Lock _l(_fastFailoverPeers_m);
+		_fastFailoverPeers.set(peer->address(),peer);
+	}
+}
+
+int Node::multipathMode(const Address &ztAddress) const
+{
+	Mutex::Lock _l(_multipathModes_m);
+	const int *const m = _multipathModes.get(ztAddress);
+	return (m) ? *m : _multipathDefault;
+}
+
+World Node::planet() const
+{
+	return RR->topology->planet();
+}
 
 std::vector<World> Node::moons() const
 {
 	return RR->topology->moons();
 }
 
-void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig)
+void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig,const uint64_t *have)
 {
 	if (destination == RR->identity.address()) {
 		SharedPtr<Network> n(network(nwid));
@@ -626,7 +1621,7 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 	} else {
 		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 		try {
-			if (nc.toDictionary(*dconf,sendLegacyFormatConfig)) {
+			if (nc.toDictionary(*dconf,sendLegacyFormatConfig,(sendLegacyFormatConfig) ? (const uint64_t *)0 : have)) {
 				uint64_t configUpdateId = prng();
 				if (!configUpdateId) ++configUpdateId;
 
@@ -655,7 +1650,6 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 					outp.append((uint16_t)ZT_C25519_SIGNATURE_LEN);
 					outp.append(sig.data,ZT_C25519_SIGNATURE_LEN);
 
-					outp.compress();
 					RR->sw->send((void *)0,outp,true);
 					chunkIndex += chunkLen;
 				}
@@ -770,6 +1764,23 @@ enum ZT_ResultCode ZT_Node_processWirePacket(
 	}
 }
 
+enum ZT_ResultCode ZT_Node_processWirePackets(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	const ZT_WirePacket *packets,
+	unsigned int packetCount,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processWirePackets(tptr,now,packets,packetCount,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_OK; // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	ZT_Node *node,
 	void *tptr,
@@ -792,6 +1803,78 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	}
 }
 
+enum ZT_ResultCode ZT_Node_processVirtualNetworkFrames(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	const ZT_VirtualNetworkFrame *frames,
+	unsigned int frameCount,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processVirtualNetworkFrames(tptr,now,nwid,frames,frameCount,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+ZT_FrameBuffer *ZT_Node_getFrameBuffer(ZT_Node *node)
+{
+	try {
+		return new ZeroTier::FrameBuffer();
+	} catch ( ... ) {
+		return (ZT_FrameBuffer *)0;
+	}
+}
+
+void ZT_Node_freeFrameBuffer(ZT_Node *node,ZT_FrameBuffer *fb)
+{
+	if (fb)
+		delete ZeroTier::FrameBuffer::from(fb);
+}
+
+enum ZT_ResultCode ZT_Node_processWirePacketBuffer(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	int64_t localSocket,
+	const struct sockaddr_storage *remoteAddress,
+	ZT_FrameBuffer *fb,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processWirePacketBuffer(tptr,now,localSocket,remoteAddress,fb,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_OK; // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
+enum ZT_ResultCode ZT_Node_processVirtualNetworkFrameBuffer(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	uint64_t sourceMac,
+	uint64_t destMac,
+	unsigned int etherType,
+	unsigned int vlanId,
+	ZT_FrameBuffer *fb,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processVirtualNetworkFrameBuffer(tptr,now,nwid,sourceMac,destMac,etherType,vlanId,fb,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline)
 {
 	try {
@@ -877,6 +1960,142 @@ void ZT_Node_status(ZT_Node *node,ZT_NodeStatus *status)
 	} catch ( ... ) {}
 }
 
+void ZT_Node_memoryUsage(ZT_Node *node,ZT_MemoryUsage *mu)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->memoryUsage(mu);
+	} catch ( ... ) {}
+}
+
+int ZT_Node_networkMemoryUsage(ZT_Node *node,uint64_t nwid,ZT_NetworkMemoryUsage *mu)
+{
+	try {
+		return (reinterpret_cast<ZeroTier::Node *>(node)->networkMemoryUsage(nwid,mu) ? 1 : 0);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+void ZT_Node_metrics(ZT_Node *node,ZT_Metrics *m)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->metrics(m);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_setTraceCapture(ZT_Node *node,unsigned int event,unsigned int sampleRate,unsigned int maxPerSecond)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setTraceCapture(event,sampleRate,maxPerSecond);
+	} catch ( ... ) {}
+}
+
+unsigned long ZT_Node_readTrace(ZT_Node *node,ZT_TraceRecord *records,unsigned long maxRecords,uint64_t *dropped)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->readTrace(records,maxRecords,dropped);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+unsigned int ZT_Node_lockProfiles(ZT_Node *node,ZT_LockProfile *profiles,unsigned int maxProfiles)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->lockProfiles(profiles,maxProfiles);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+unsigned int ZT_Node_rateLimitStats(ZT_Node *node,ZT_RateLimitStats *stats,unsigned int maxStats)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->rateLimitStats(stats,maxStats);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+unsigned int ZT_Node_topTalkers(ZT_Node *node,uint64_t nwid,ZT_TopTalker *talkers,unsigned int maxTalkers)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->topTalkers(nwid,talkers,maxTalkers);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+ZT_RuleCountersList *ZT_Node_ruleCounters(ZT_Node *node,uint64_t nwid)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->ruleCounters(nwid);
+	} catch ( ... ) {
+		return (ZT_RuleCountersList *)0;
+	}
+}
+
+void ZT_Node_setFlowSampling(ZT_Node *node,unsigned int sampleRate)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setFlowSampling(sampleRate);
+	} catch ( ... ) {}
+}
+
+unsigned int ZT_Node_flowRecords(ZT_Node *node,ZT_FlowRecord *records,unsigned int maxRecords)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->flowRecords(records,maxRecords);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+unsigned int ZT_Node_tapFilter(ZT_Node *node,uint64_t nwid,ZT_VirtualNetworkRule *rules,unsigned int maxRules)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->tapFilter(nwid,rules,maxRules);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
+void ZT_Node_setFrameCapture(ZT_Node *node,uint64_t nwid,unsigned int maxFrames,unsigned int snapLength)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->setFrameCapture(nwid,maxFrames,snapLength);
+	} catch ( ... ) {}
+}
+
+ZT_FrameCapture *ZT_Node_readFrameCapture(ZT_Node *node,int clear)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->readFrameCapture(clear != 0);
+	} catch ( ... ) {
+		return (ZT_FrameCapture *)0;
+	}
+}
+
+ZT_StateSnapshot *ZT_Node_snapshot(ZT_Node *node)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->snapshot();
+	} catch ( ... ) {
+		return (ZT_StateSnapshot *)0;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_restoreSnapshot(ZT_Node *node,void *tptr,int64_t now,const void *data,unsigned long len,ZT_StateSnapshot *restored)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->restoreSnapshot(tptr,now,data,len,restored);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
 ZT_PeerList *ZT_Node_peers(ZT_Node *node)
 {
 	try {
@@ -952,6 +2171,225 @@ enum ZT_ResultCode ZT_Node_setPhysicalPathConfiguration(ZT_Node *node,const stru
 	}
 }
 
+enum ZT_ResultCode ZT_Node_setMultipathMode(ZT_Node *node,uint64_t ztAddress,enum ZT_MultipathMode mode)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setMultipathMode(ztAddress,mode);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setUpstreamLatencyHint(ZT_Node *node,uint64_t ztAddress,unsigned int latency)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setUpstreamLatencyHint(ztAddress,latency);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setMemberRateLimit(ZT_Node *node,uint64_t ztAddress,uint64_t bytesPerSecond)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setMemberRateLimit(ztAddress,bytesPerSecond);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setEgressRate(ZT_Node *node,uint64_t bytesPerSecond,uint64_t interactiveDscp)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setEgressRate(bytesPerSecond,interactiveDscp);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setFastFailover(ZT_Node *node,unsigned int probeInterval,unsigned int maxMissedProbes)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setFastFailover(probeInterval,maxMissedProbes);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setAdaptiveKeepalive(ZT_Node *node,int enabled)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setAdaptiveKeepalive(enabled != 0);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setForwardErrorCorrection(ZT_Node *node,int enabled)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setForwardErrorCorrection(enabled != 0);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setFrameAggregation(ZT_Node *node,int enabled)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setFrameAggregation(enabled != 0);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setRelayCapacity(ZT_Node *node,uint64_t bytesPerSecond)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setRelayCapacity(bytesPerSecond);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setPathPacing(ZT_Node *node,int enabled)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setPathPacing(enabled != 0);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setMemoryLimits(ZT_Node *node,unsigned long maxPeers,unsigned long maxMulticastMembers)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setMemoryLimits(maxPeers,maxMulticastMembers);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setColdPeerTimeout(ZT_Node *node,int64_t idleMs)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setColdPeerTimeout(idleMs);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setBridgeRouteLimits(ZT_Node *node,unsigned long maxRoutes,unsigned long maxPerBridge)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setBridgeRouteLimits(maxRoutes,maxPerBridge);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setAdmissionBudget(ZT_Node *node,uint64_t cpuMicrosecondsPerSecond)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setAdmissionBudget(cpuMicrosecondsPerSecond);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setIdentityCacheSize(ZT_Node *node,unsigned long identities)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setIdentityCacheSize(identities);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setCryptoWorkers(ZT_Node *node,unsigned int threads)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setCryptoWorkers(threads);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setCryptoWorkerCpus(ZT_Node *node,const unsigned int *cpus,unsigned int cpuCount)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setCryptoWorkerCpus(cpus,cpuCount);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_setHugePages(ZT_Node *node,enum ZT_HugePageMode mode)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->setHugePages(mode);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_clusterInit(
+	ZT_Node *node,
+	unsigned int myId,
+	const struct sockaddr_storage *zeroTierPhysicalEndpoints,
+	unsigned int numZeroTierPhysicalEndpoints,
+	int x,
+	int y,
+	int z,
+	void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+	void *sendFunctionArg,
+	int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+	void *addressToLocationFunctionArg)
+{
+	try {
+		std::vector<ZeroTier::InetAddress> eps;
+		for(unsigned int i=0;i<numZeroTierPhysicalEndpoints;++i)
+			eps.push_back(ZeroTier::InetAddress(zeroTierPhysicalEndpoints[i]));
+		return reinterpret_cast<ZeroTier::Node *>(node)->clusterInit(myId,eps,x,y,z,sendFunction,sendFunctionArg,addressToLocationFunction,addressToLocationFunctionArg);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+enum ZT_ResultCode ZT_Node_clusterAddMember(ZT_Node *node,unsigned int memberId)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->clusterAddMember(memberId);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
+void ZT_Node_clusterRemoveMember(ZT_Node *node,unsigned int memberId)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->clusterRemoveMember(memberId);
+	} catch ( ... ) {}
+}
+
+void ZT_Node_clusterHandleIncomingMessage(ZT_Node *node,void *tptr,const void *msg,unsigned int len)
+{
+	try {
+		reinterpret_cast<ZeroTier::Node *>(node)->clusterHandleIncomingMessage(tptr,msg,len);
+	} catch ( ... ) {}
+}
+
+int ZT_Node_clusterStatus(ZT_Node *node,ZT_ClusterStatus *cs)
+{
+	try {
+		return (reinterpret_cast<ZeroTier::Node *>(node)->clusterStatus(cs) ? 1 : 0);
+	} catch ( ... ) {
+		return 0;
+	}
+}
+
 void ZT_version(int *major,int *minor,int *revision)
 {
 	if (major) *major = ZEROTIER_ONE_VERSION_MAJOR;
@@ -31,6 +31,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <vector>
 
@@ -41,12 +43,19 @@
 #include "RuntimeEnvironment.hpp"
 #include "InetAddress.hpp"
 #include "Mutex.hpp"
+#include "Epoch.hpp"
 #include "MAC.hpp"
 #include "Network.hpp"
 #include "Path.hpp"
 #include "Salsa20.hpp"
 #include "NetworkController.hpp"
 #include "Hashtable.hpp"
+#include "TimerWheel.hpp"
+#include "IdentityValidationCache.hpp"
+#include "Admission.hpp"
+#include "Metrics.hpp"
+#include "Probes.hpp"
+#include "Egress.hpp"
 
 // Bit mask for "expecting reply" hash
 #define ZT_EXPECTING_REPLIES_BUCKET_MASK1 255
@@ -55,6 +64,7 @@
 namespace ZeroTier {
 
 class World;
+class Peer;
 
 /**
  * Implementation of Node object as defined in CAPI
@@ -83,6 +93,12 @@ public:
 		const void *packetData,
 		unsigned int packetLength,
 		volatile int64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processWirePackets(
+		void *tptr,
+		int64_t now,
+		const ZT_WirePacket *packets,
+		unsigned int packetCount,
+		volatile int64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processVirtualNetworkFrame(
 		void *tptr,
 		int64_t now,
@@ -94,6 +110,30 @@ public:
 		const void *frameData,
 		unsigned int frameLength,
 		volatile int64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processVirtualNetworkFrames(
+		void *tptr,
+		int64_t now,
+		uint64_t nwid,
+		const ZT_VirtualNetworkFrame *frames,
+		unsigned int frameCount,
+		volatile int64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processWirePacketBuffer(
+		void *tptr,
+		int64_t now,
+		int64_t localSocket,
+		const struct sockaddr_storage *remoteAddress,
+		ZT_FrameBuffer *fb,
+		volatile int64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processVirtualNetworkFrameBuffer(
+		void *tptr,
+		int64_t now,
+		uint64_t nwid,
+		uint64_t sourceMac,
+		uint64_t destMac,
+		unsigned int etherType,
+		unsigned int vlanId,
+		ZT_FrameBuffer *fb,
+		volatile int64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processBackgroundTasks(void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode join(uint64_t nwid,void *uptr,void *tptr);
 	ZT_ResultCode leave(uint64_t nwid,void **uptr,void *tptr);
@@ -103,6 +143,22 @@ public:
 	ZT_ResultCode deorbit(void *tptr,uint64_t moonWorldId);
 	uint64_t address() const;
 	void status(ZT_NodeStatus *status) const;
+	void memoryUsage(ZT_MemoryUsage *mu) const;
+	bool networkMemoryUsage(uint64_t nwid,ZT_NetworkMemoryUsage *mu) const;
+	void metrics(ZT_Metrics *m) const;
+	void setTraceCapture(unsigned int event,unsigned int sampleRate,unsigned int maxPerSecond);
+	unsigned long readTrace(ZT_TraceRecord *records,unsigned long maxRecords,uint64_t *dropped);
+	unsigned int lockProfiles(ZT_LockProfile *profiles,unsigned int maxProfiles) const;
+	unsigned int rateLimitStats(ZT_RateLimitStats *stats,unsigned int maxStats) const;
+	unsigned int topTalkers(uint64_t nwid,ZT_TopTalker *talkers,unsigned int maxTalkers);
+	ZT_RuleCountersList *ruleCounters(uint64_t nwid) const;
+	void setFlowSampling(unsigned int sampleRate);
+	unsigned int flowRecords(ZT_FlowRecord *records,unsigned int maxRecords);
+	unsigned int tapFilter(uint64_t nwid,ZT_VirtualNetworkRule *rules,unsigned int maxRules) const;
+	void setFrameCapture(uint64_t nwid,unsigned int maxFrames,unsigned int snapLength);
+	ZT_FrameCapture *readFrameCapture(bool clear);
+	ZT_StateSnapshot *snapshot() const;
+	ZT_ResultCode restoreSnapshot(void *tptr,int64_t now,const void *data,unsigned long len,ZT_StateSnapshot *restored);
 	ZT_PeerList *peers() const;
 	ZT_VirtualNetworkConfig *networkConfig(uint64_t nwid) const;
 	ZT_VirtualNetworkList *networks() const;
@@ -116,8 +172,13 @@ public:
 
 	inline int64_t now() const { return _now; }
 
-	inline bool putPacket(void *tPtr,const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl = 0)
+	inline bool putPacket(void *tPtr,const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl = 0,unsigned int tos = 0)
 	{
+		if (RR->egress)
+			RR->egress->charge(len);
+		// Don't fragment sends can fail and the caller needs to know, so they aren't batched
+		if ((_cb.wirePacketBatchSendFunction)&&((ttl & ZT_WIRE_PACKET_DONT_FRAGMENT) == 0)&&(_batchPacket(localSocket,addr,data,len,ttl,tos)))
+			return true;
 		return (_cb.wirePacketSendFunction(
 			reinterpret_cast<ZT_Node *>(this),
 			_uPtr,
@@ -129,8 +190,20 @@ public:
 			ttl) == 0);
 	}
 
+	/**
+	 * @return True if the host sends packets with ZT_WIRE_PACKET_DONT_FRAGMENT without fragmenting them
+	 */
+	inline bool sendsDontFragment() const { return (_cb.version >= 3); }
+
+	/**
+	 * @return True if frames received into a FrameBuffer can be handed over in it
+	 */
+	inline bool lendsFrames() const { return (_cb.virtualNetworkFrameBufferFunction != 0); }
+
 	inline void putFrame(void *tPtr,uint64_t nwid,void **nuptr,const MAC &source,const MAC &dest,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
+		Metrics::networkFrame(nwid,false,len);
+		ZT_PROBE3(tap__put,nwid,etherType,len);
 		_cb.virtualNetworkFrameFunction(
 			reinterpret_cast<ZT_Node *>(this),
 			_uPtr,
@@ -147,31 +220,72 @@ public:
 
 	inline SharedPtr<Network> network(uint64_t nwid) const
 	{
-		Mutex::Lock _l(_networks_m);
-		const SharedPtr<Network> *n = _networks.get(nwid);
-		if (n)
-			return *n;
-		return SharedPtr<Network>();
+		const Epoch::Guard g;
+		return network(g,nwid);
+	}
+
+	/**
+	 * Look up a network without taking a lock or a reference
+	 *
+	 * The result refers to an entry in the current network table and must
+	 * not be used once the guard is destroyed. Copy it to keep it longer.
+	 *
+	 * @param g Guard held by the caller
+	 * @param nwid Network ID
+	 * @return Network or a NULL pointer if not a member
+	 */
+	inline const SharedPtr<Network> &network(const Epoch::Guard &g,const uint64_t nwid) const
+	{
+		const _NetworkTable &t = *(_networkTable.load(std::memory_order_acquire));
+		const _NetworkTable::const_iterator n(std::lower_bound(t.begin(),t.end(),std::pair< uint64_t,SharedPtr<Network> >(nwid,SharedPtr<Network>()),_NetworkIdLess()));
+		return (((n != t.end())&&(n->first == nwid)) ? n->second : _noNetwork);
 	}
 
 	inline bool belongsToNetwork(uint64_t nwid) const
 	{
-		Mutex::Lock _l(_networks_m);
-		return _networks.contains(nwid);
+		const Epoch::Guard g;
+		return (network(g,nwid) != _noNetwork);
 	}
 
 	inline std::vector< SharedPtr<Network> > allNetworks() const
 	{
 		std::vector< SharedPtr<Network> > nw;
-		Mutex::Lock _l(_networks_m);
-		Hashtable< uint64_t,SharedPtr<Network> >::Iterator i(*const_cast< Hashtable< uint64_t,SharedPtr<Network> > * >(&_networks));
-		uint64_t *k = (uint64_t *)0;
-		SharedPtr<Network> *v = (SharedPtr<Network> *)0;
-		while (i.next(k,v))
-			nw.push_back(*v);
+		const Epoch::Guard g;
+		const _NetworkTable &t = *(_networkTable.load(std::memory_order_acquire));
+		nw.reserve(t.size());
+		for(_NetworkTable::const_iterator n(t.begin());n!=t.end();++n)
+			nw.push_back(n->second);
 		return nw;
 	}
 
+	/**
+	 * Check whether two peers have both recently associated with one of our networks
+	 *
+	 * @param a First peer address
+	 * @param b Second peer address
+	 * @param nwid Network to check or 0 for any
+	 * @return True if both are members of the same network as far as we know
+	 */
+	inline bool sharedNetwork(const Address &a,const Address &b,const uint64_t nwid = 0) const
+	{
+		const Epoch::Guard g;
+		if (nwid) {
+			const SharedPtr<Network> &nw = network(g,nwid);
+			return ((nw)&&(nw->recentlyAssociatedWith(a))&&(nw->recentlyAssociatedWith(b)));
+		}
+		const _NetworkTable &t = *(_networkTable.load(std::memory_order_acquire));
+		for(_NetworkTable::const_iterator n(t.begin());n!=t.end();++n) {
+			if ((n->second->recentlyAssociatedWith(a))&&(n->second->recentlyAssociatedWith(b)))
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @return Relay capacity we offer to peers in bytes per second or 0 if none, see setRelayCapacity()
+	 */
+	inline uint64_t relayCapacity() const { return _relayCapacity; }
+
 	inline std::vector<InetAddress> directPaths() const
 	{
 		Mutex::Lock _l(_directPaths_m);
@@ -193,6 +307,94 @@ public:
 
 	uint64_t prng();
 	ZT_ResultCode setPhysicalPathConfiguration(const struct sockaddr_storage *pathNetwork,const ZT_PhysicalPathConfiguration *pathConfig);
+	ZT_ResultCode setMultipathMode(const uint64_t ztAddress,const ZT_MultipathMode mode);
+	ZT_ResultCode setUpstreamLatencyHint(const uint64_t ztAddress,const unsigned int latency);
+	ZT_ResultCode setMemberRateLimit(const uint64_t ztAddress,const uint64_t bytesPerSecond);
+	ZT_ResultCode setEgressRate(const uint64_t bytesPerSecond,const uint64_t interactiveDscp);
+	ZT_ResultCode setFastFailover(const unsigned int probeInterval,const unsigned int maxMissedProbes);
+	ZT_ResultCode setAdaptiveKeepalive(const bool enabled);
+	ZT_ResultCode setForwardErrorCorrection(const bool enabled);
+	ZT_ResultCode setFrameAggregation(const bool enabled);
+	ZT_ResultCode setRelayCapacity(const uint64_t bytesPerSecond);
+	ZT_ResultCode setPathPacing(const bool enabled);
+	ZT_ResultCode setMemoryLimits(const unsigned long maxPeers,const unsigned long maxMulticastMembers);
+	ZT_ResultCode setBridgeRouteLimits(const unsigned long maxRoutes,const unsigned long maxPerBridge);
+	ZT_ResultCode setColdPeerTimeout(const int64_t idleMs);
+	ZT_ResultCode setAdmissionBudget(const uint64_t cpuMicrosecondsPerSecond);
+	ZT_ResultCode setIdentityCacheSize(const unsigned long identities);
+	ZT_ResultCode setCryptoWorkers(const unsigned int threads);
+	ZT_ResultCode setCryptoWorkerCpus(const unsigned int *cpus,const unsigned int cpuCount);
+	ZT_ResultCode setHugePages(enum ZT_HugePageMode mode);
+
+	ZT_ResultCode clusterInit(
+		unsigned int myId,
+		const std::vector<InetAddress> &zeroTierPhysicalEndpoints,
+		int32_t x,
+		int32_t y,
+		int32_t z,
+		void (*sendFunction)(void *,unsigned int,const void *,unsigned int),
+		void *sendFunctionArg,
+		int (*addressToLocationFunction)(void *,const struct sockaddr_storage *,int *,int *,int *),
+		void *addressToLocationFunctionArg);
+	ZT_ResultCode clusterAddMember(unsigned int memberId);
+	void clusterRemoveMember(unsigned int memberId);
+	void clusterHandleIncomingMessage(void *tPtr,const void *msg,unsigned int len);
+	bool clusterStatus(ZT_ClusterStatus *cs) const;
+
+	/**
+	 * @return True if idle peers' keepalives follow each path's learned NAT binding timeout
+	 */
+	inline bool adaptiveKeepalive() const { return _adaptiveKeepalive; }
+
+	/**
+	 * @return True if fragmented packets sent over lossy paths get FEC parity, see Path::sendFragmented()
+	 */
+	inline bool forwardErrorCorrection() const { return _forwardErrorCorrection; }
+
+	/**
+	 * @return True if bulk frames are paced to each path's estimated rate, see Shaper
+	 */
+	inline bool pathPacing() const { return _pathPacing; }
+
+	/**
+	 * @return Maximum routes to MACs behind remote bridges in each network, see setBridgeRouteLimits()
+	 */
+	inline unsigned long maxBridgeRoutes() const { return _maxBridgeRoutes; }
+
+	/**
+	 * @return Maximum routes behind any one remote bridge in each network
+	 */
+	inline unsigned long maxBridgeRoutesPerBridge() const { return _maxBridgeRoutesPerBridge; }
+
+	/**
+	 * Note that a frame was sent to a peer, watching it for fast failover if that's enabled
+	 *
+	 * @param peer Peer frame was sent to
+	 * @param now Current time
+	 */
+	void frameSent(const SharedPtr<Peer> &peer,const int64_t now);
+
+	/**
+	 * Put a peer on the ping schedule
+	 *
+	 * Peers are pinged at their next ping check at or after the deadline and
+	 * then rescheduled for as long as they stay active, so background tasks
+	 * only visit peers with something due instead of every known peer.
+	 *
+	 * @param ztAddress Peer address
+	 * @param deadline Time at which peer should next be checked
+	 */
+	inline void schedulePing(const Address &ztAddress,const int64_t deadline)
+	{
+		Mutex::Lock _l(_pingWheel_m);
+		_pingWheel.add(deadline,ztAddress);
+	}
+
+	/**
+	 * @param ztAddress Peer address
+	 * @return Multipath mode (ZT_MultipathMode) configured for this peer or the default
+	 */
+	int multipathMode(const Address &ztAddress) const;
 
 	World planet() const;
 	std::vector<World> moons() const;
@@ -253,7 +455,26 @@ public:
 		return false;
 	}
 
-	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig);
+	/**
+	 * @return Cache of identities that have already passed local validation
+	 */
+	inline IdentityValidationCache &identityValidationCache() { return _identityValidationCache; }
+
+	/**
+	 * @return Budget for expensive work done for unknown peers
+	 */
+	inline Admission &admission() { return _admission; }
+
+	/**
+	 * Get relay statistics (see Switch::relayStats())
+	 *
+	 * @param relayed Packets and fragments relayed directly to their destination
+	 * @param cacheHits Relayed packets sent to a cached best path
+	 * @param cacheMisses Relay attempts that had to look up the peer
+	 */
+	void relayStats(uint64_t &relayed,uint64_t &cacheHits,uint64_t &cacheMisses) const;
+
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig,const uint64_t *have);
 	virtual void ncSendRevocation(const Address &destination,const Revocation &rev);
 	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode);
 
@@ -261,6 +482,19 @@ public:
 	inline Trace::Level remoteTraceLevel() const { return _remoteTraceLevel; }
 
 private:
+	// While one of these exists on a thread, packets this node sends with
+	// putPacket() on that thread are collected for the batch send callback
+	class WireBatchScope;
+	friend class WireBatchScope;
+
+	// Finish HELLOs CryptoWorkers is done with and come back soon if it's busy with more
+	void _drainCryptoWorkers(void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline);
+
+	// Come back in time for probes Traversal has scheduled while handling packets
+	void _wakeForTraversal(volatile int64_t *nextBackgroundTaskDeadline);
+
+	bool _batchPacket(const int64_t localSocket,const InetAddress &addr,const void *data,unsigned int len,unsigned int ttl,unsigned int tos);
+
 	RuntimeEnvironment _RR;
 	RuntimeEnvironment *RR;
 	void *_uPtr; // _uptr (lower case) is reserved in Visual Studio :P
@@ -272,13 +506,61 @@ private:
 
 	// Time of last identity verification indexed by InetAddress.rateGateHash() -- used in IncomingPacket::_doHELLO() via rateGateIdentityVerification()
 	int64_t _lastIdentityVerification[16384];
-
+	IdentityValidationCache _identityValidationCache;
+	Admission _admission;
+
+	// Networks by ID, changed with _networks_m locked. Frame paths read an
+	// immutable sorted copy published through _networkTable instead, so
+	// they take no lock and touch no reference counts. Replaced copies are
+	// freed once no Epoch::Guard that might be reading them is still held.
+	typedef std::vector< std::pair< uint64_t,SharedPtr<Network> > > _NetworkTable;
+	struct _NetworkIdLess { inline bool operator()(const std::pair< uint64_t,SharedPtr<Network> > &a,const std::pair< uint64_t,SharedPtr<Network> > &b) const { return (a.first < b.first); } };
+	void _publishNetworks();
+	void _reclaimNetworkTables();
+	void _sendRelayOffers(void *tPtr,const int64_t now);
 	Hashtable< uint64_t,SharedPtr<Network> > _networks;
+	std::atomic<const _NetworkTable *> _networkTable;
+	std::vector< std::pair< uint64_t,const _NetworkTable * > > _retiredNetworkTables;
 	Mutex _networks_m;
+	static const SharedPtr<Network> _noNetwork;
 
 	std::vector<InetAddress> _directPaths;
 	Mutex _directPaths_m;
 
+	int _multipathDefault;
+	Hashtable< Address,int > _multipathModes;
+	Mutex _multipathModes_m;
+
+	// Peers with recent traffic being probed for fast failover, see Peer::doFastFailover()
+	volatile unsigned int _fastFailoverInterval; // 0 if disabled
+	volatile unsigned int _fastFailoverMissedProbes;
+	int64_t _lastFastFailoverCheck;
+	Hashtable< Address,SharedPtr<Peer> > _fastFailoverPeers;
+	Mutex _fastFailoverPeers_m;
+
+	volatile bool _adaptiveKeepalive;
+	volatile bool _forwardErrorCorrection;
+	volatile bool _pathPacing;
+	volatile bool _frameAggregation;
+
+	// Bridge route table limits for each network, set with _networks_m held
+	volatile unsigned long _maxBridgeRoutes;
+	volatile unsigned long _maxBridgeRoutesPerBridge;
+
+	// Relay capacity offered to peers with VERB_RELAY_OFFER, see _sendRelayOffers()
+	volatile uint64_t _relayCapacity; // bytes/second, 0 if not offered
+	uint64_t _relayedBytesAtLastOffer;
+	int64_t _lastRelayOffer;
+	bool _relayOffered; // true if peers may still hold an offer from us
+
+	// CPUs crypto workers are pinned to, see setCryptoWorkerCpus()
+	std::vector<unsigned int> _cryptoWorkerCpus;
+	Mutex _cryptoWorkers_m;
+
+	// Active peers by the time of their next ping check, see schedulePing()
+	TimerWheel<Address> _pingWheel;
+	Mutex _pingWheel_m;
+
 	Mutex _backgroundTasksLock;
 
 	Address _remoteTraceTarget;
@@ -0,0 +1,212 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_OBJECTPOOL_HPP
+#define ZT_OBJECTPOOL_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "HugePages.hpp"
+
+#include "../include/ZeroTierOne.h"
+
+/**
+ * Bytes per slab (large enough that most allocators map it directly)
+ */
+#define ZT_OBJECT_POOL_SLAB_SIZE 262144
+
+namespace ZeroTier {
+
+/**
+ * Slab allocator for one type of long-lived, frequently churned object
+ *
+ * Objects of a type come from slabs holding only that type, so churn
+ * doesn't scatter them among everything else on the heap and a slab
+ * whose objects are all gone goes back to the system in one piece. One
+ * empty slab is kept so a type hovering at a slab boundary doesn't
+ * allocate and free a slab over and over. Slabs are carved as they are
+ * used, so a slab's untouched pages are never faulted in. With huge pages
+ * on (see HugePages) slabs are carved from huge pages instead, and slabs
+ * given back are kept there for reuse.
+ *
+ * A class uses this by declaring operator new and sized operator delete
+ * that call allocate() and release(). Allocations of a different size
+ * (subclasses) fall through to malloc(). Build with ZT_NO_OBJECT_POOLS
+ * to use malloc() for everything, e.g. under memory checkers.
+ *
+ * @tparam T Type of object
+ */
+template<typename T>
+class ObjectPool
+{
+public:
+	static inline void *allocate(const std::size_t size)
+	{
+#ifndef ZT_NO_OBJECT_POOLS
+		if (size == sizeof(T)) {
+			Mutex::Lock _l(_s.lock);
+			_Slab *s = _s.partial;
+			if (!s) {
+				if (_s.spare) {
+					s = _s.spare;
+					_s.spare = (_Slab *)0;
+				} else {
+					s = reinterpret_cast<_Slab *>(HugePages::allocate(ZT_OBJECT_POOL_SLAB_SIZE));
+					if (!s)
+						throw std::bad_alloc();
+					s->free = (_Slot *)0;
+					s->used = 0;
+					s->carved = 0;
+					++_s.slabs;
+				}
+				_link(s);
+			}
+
+			_Slot *o = s->free;
+			if (o) {
+				s->free = o->next;
+			} else {
+				o = reinterpret_cast<_Slot *>(reinterpret_cast<uint8_t *>(s) + _SLAB_HEADER + (s->carved++ * _STRIDE));
+			}
+			o->slab = s;
+			if (++s->used == _PER_SLAB)
+				_unlink(s);
+			++_s.objects;
+			return reinterpret_cast<uint8_t *>(o) + _SLOT_HEADER;
+		}
+#endif
+		void *const p = malloc(size);
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	static inline void release(void *p,const std::size_t size)
+	{
+		if (!p)
+			return;
+#ifndef ZT_NO_OBJECT_POOLS
+		if (size == sizeof(T)) {
+			_Slot *const o = reinterpret_cast<_Slot *>(reinterpret_cast<uint8_t *>(p) - _SLOT_HEADER);
+			_Slab *const s = o->slab;
+			Mutex::Lock _l(_s.lock);
+			o->next = s->free;
+			s->free = o;
+			if (s->used-- == _PER_SLAB)
+				_link(s);
+			--_s.objects;
+			if (!s->used) {
+				_unlink(s);
+				if (_s.spare) {
+					HugePages::release(s,ZT_OBJECT_POOL_SLAB_SIZE);
+					--_s.slabs;
+					++_s.slabsReleased;
+				} else {
+					_s.spare = s;
+				}
+			}
+			return;
+		}
+#endif
+		free(p);
+	}
+
+	/**
+	 * @param st Structure to fill with this pool's statistics
+	 */
+	static inline void stats(ZT_ObjectPoolStats &st)
+	{
+		Mutex::Lock _l(_s.lock);
+		st.objects = _s.objects;
+		st.capacity = _s.slabs * _PER_SLAB;
+		st.bytes = _s.slabs * ZT_OBJECT_POOL_SLAB_SIZE;
+		st.slabsReleased = _s.slabsReleased;
+	}
+
+private:
+	struct _Slab;
+	struct _Slot
+	{
+		_Slab *slab; // owner, valid while allocated
+		_Slot *next; // free list, overlaps the object
+	};
+	struct _Slab
+	{
+		_Slab *prev,*next; // list of slabs with room, if this has room
+		_Slot *free;
+		unsigned long used;
+		unsigned long carved; // slots past this have never been used
+	};
+
+	// Objects are 16-byte aligned and preceded by their slab pointer
+	static const unsigned long _SLOT_HEADER = 16;
+	static const unsigned long _SLAB_HEADER = (sizeof(_Slab) + 15) & ~((unsigned long)15);
+	static const unsigned long _STRIDE = _SLOT_HEADER + ((sizeof(T) + 15) & ~((unsigned long)15));
+	static const unsigned long _PER_SLAB = (ZT_OBJECT_POOL_SLAB_SIZE - _SLAB_HEADER) / _STRIDE;
+
+	static inline void _link(_Slab *s)
+	{
+		s->prev = (_Slab *)0;
+		s->next = _s.partial;
+		if (_s.partial)
+			_s.partial->prev = s;
+		_s.partial = s;
+	}
+
+	static inline void _unlink(_Slab *s)
+	{
+		if (s->prev)
+			s->prev->next = s->next;
+		else _s.partial = s->next;
+		if (s->next)
+			s->next->prev = s->prev;
+	}
+
+	struct _State
+	{
+		_State() : partial((_Slab *)0),spare((_Slab *)0),objects(0),slabs(0),slabsReleased(0) {}
+		_Slab *partial;
+		_Slab *spare;
+		uint64_t objects;
+		uint64_t slabs;
+		uint64_t slabsReleased;
+		Mutex lock;
+	};
+	static _State _s;
+};
+
+template<typename T>
+typename ObjectPool<T>::_State ObjectPool<T>::_s;
+
+} // namespace ZeroTier
+
+#endif
@@ -32,6 +32,7 @@
 #include "Node.hpp"
 #include "Peer.hpp"
 #include "Topology.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
@@ -67,14 +68,17 @@ void OutboundMulticast::init(
 
 	_packet.setSource(RR->identity.address());
 	_packet.setVerb(Packet::VERB_MULTICAST_FRAME);
-	_packet.append((uint64_t)nwid);
-	_packet.append(flags);
-	if (gatherLimit) _packet.append((uint32_t)gatherLimit);
-	if (src) src.appendTo(_packet);
-	dest.mac().appendTo(_packet);
-	_packet.append((uint32_t)dest.adi());
-	_packet.append((uint16_t)etherType);
-	_packet.append(payload,_frameLen);
+	{
+		Packet::Writer w(_packet,8 + 1 + ((gatherLimit) ? 4 : 0) + ((src) ? 6 : 0) + 6 + 4 + 2 + _frameLen);
+		w.put((uint64_t)nwid);
+		w.put(flags);
+		if (gatherLimit) w.put((uint32_t)gatherLimit);
+		if (src) src.copyTo(w.field(6),6);
+		dest.mac().copyTo(w.field(6),6);
+		w.put((uint32_t)dest.adi());
+		w.put((uint16_t)etherType);
+		w.put(payload,_frameLen);
+	}
 	if (!disableCompression)
 		_packet.compress();
 
@@ -86,12 +90,16 @@ void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,void *tPtr,const A
 	const SharedPtr<Network> nw(RR->node->network(_nwid));
 	const Address toAddr2(toAddr);
 	if ((nw)&&(nw->filterOutgoingPacket(tPtr,true,RR->identity.address(),toAddr2,_macSrc,_macDest,_frameData,_frameLen,_etherType,0))) {
-		_packet.newInitializationVector();
-		_packet.setDestination(toAddr2);
-		RR->node->expectReplyTo(_packet.packetId());
-
-		Packet tmp(_packet); // make a copy of packet so as not to garble the original -- GitHub issue #461
-		RR->sw->send(tPtr,tmp,true);
+		// Only the header is copied for each recipient. The payload was laid
+		// out and compressed once by init() and is encrypted straight out of
+		// _packet as a tail, which also leaves the original ungarbled (GitHub
+		// issue #461).
+		Packet tmp(_packet.data(),ZT_PACKET_IDX_PAYLOAD);
+		tmp.newInitializationVector();
+		tmp.setDestination(toAddr2);
+		RR->node->expectReplyTo(tmp.packetId());
+		Metrics::add(Metrics::MULTICAST_RECIPIENTS,1);
+		RR->sw->send(tPtr,tmp,true,_packet.field(ZT_PACKET_IDX_PAYLOAD,_packet.size() - ZT_PACKET_IDX_PAYLOAD),_packet.size() - ZT_PACKET_IDX_PAYLOAD,0,Egress::BULK,_nwid);
 	}
 }
 
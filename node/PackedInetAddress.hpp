@@ -0,0 +1,131 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_PACKEDINETADDRESS_HPP
+#define ZT_PACKEDINETADDRESS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "InetAddress.hpp"
+
+namespace ZeroTier {
+
+/**
+ * An IPv4 or IPv6 address and port packed into 24 bytes
+ *
+ * InetAddress is a sockaddr_storage, which is 128 bytes. This holds just
+ * the parts of one that identify an endpoint so that hash tables keyed by
+ * physical address hash and compare a fraction of the memory. Convert back
+ * with toInetAddress() where an address is handed to the OS. Anything that
+ * isn't IPv4 or IPv6 packs to the same nil value.
+ */
+class PackedInetAddress
+{
+public:
+	PackedInetAddress() { memset(this,0,sizeof(PackedInetAddress)); }
+
+	PackedInetAddress(const InetAddress &a)
+	{
+		memset(this,0,sizeof(PackedInetAddress));
+		switch(a.ss_family) {
+			case AF_INET:
+				_a[1] = (uint64_t)reinterpret_cast<const struct sockaddr_in *>(&a)->sin_addr.s_addr;
+				_port = reinterpret_cast<const struct sockaddr_in *>(&a)->sin_port;
+				_family = 4;
+				break;
+			case AF_INET6:
+				ZT_FAST_MEMCPY(_a,reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_addr.s6_addr,16);
+				_scope = (uint32_t)reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_scope_id;
+				_port = reinterpret_cast<const struct sockaddr_in6 *>(&a)->sin6_port;
+				_family = 6;
+				break;
+		}
+	}
+
+	/**
+	 * @return Address as an InetAddress (nil if this is nil)
+	 */
+	inline InetAddress toInetAddress() const
+	{
+		InetAddress r;
+		if (_family == 4) {
+			r.ss_family = AF_INET;
+			reinterpret_cast<struct sockaddr_in *>(&r)->sin_addr.s_addr = (uint32_t)_a[1];
+			reinterpret_cast<struct sockaddr_in *>(&r)->sin_port = _port;
+		} else if (_family == 6) {
+			r.ss_family = AF_INET6;
+			ZT_FAST_MEMCPY(reinterpret_cast<struct sockaddr_in6 *>(&r)->sin6_addr.s6_addr,_a,16);
+			reinterpret_cast<struct sockaddr_in6 *>(&r)->sin6_scope_id = _scope;
+			reinterpret_cast<struct sockaddr_in6 *>(&r)->sin6_port = _port;
+		}
+		return r;
+	}
+
+	/**
+	 * @return 4 for IPv4, 6 for IPv6, 0 if nil
+	 */
+	inline unsigned int ipVersion() const { return (unsigned int)_family; }
+
+	/**
+	 * @return Port in host byte order
+	 */
+	inline unsigned int port() const { return (unsigned int)Utils::ntoh(_port); }
+
+	inline unsigned long hashCode() const
+	{
+		const uint64_t t = ((uint64_t)_scope << 32) | ((uint64_t)_port << 8) | (uint64_t)_family;
+		return (unsigned long)((_a[0] * 0x9e3779b97f4a7c15ULL) ^ (_a[1] * 0xc2b2ae3d27d4eb4fULL) ^ t);
+	}
+
+	inline operator bool() const { return (_family != 0); }
+
+	inline bool operator==(const PackedInetAddress &a) const { return ((_a[0] == a._a[0])&&(_a[1] == a._a[1])&&(_scope == a._scope)&&(_port == a._port)&&(_family == a._family)); }
+	inline bool operator!=(const PackedInetAddress &a) const { return (!(*this == a)); }
+	inline bool operator<(const PackedInetAddress &a) const
+	{
+		if (_family != a._family) return (_family < a._family);
+		if (_a[0] != a._a[0]) return (_a[0] < a._a[0]);
+		if (_a[1] != a._a[1]) return (_a[1] < a._a[1]);
+		if (_port != a._port) return (_port < a._port);
+		return (_scope < a._scope);
+	}
+	inline bool operator>(const PackedInetAddress &a) const { return (a < *this); }
+	inline bool operator<=(const PackedInetAddress &a) const { return !(a < *this); }
+	inline bool operator>=(const PackedInetAddress &a) const { return !(*this < a); }
+
+private:
+	uint64_t _a[2]; // IPv6 address, or IPv4 address in the low 32 bits of _a[1], as raw network byte order bytes
+	uint32_t _scope; // IPv6 scope ID
+	uint16_t _port; // network byte order
+	uint8_t _family; // 4, 6, or 0 for nil
+	uint8_t _reserved;
+};
+
+} // namespace ZeroTier
+
+#endif
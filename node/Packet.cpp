@@ -30,7 +30,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include "Packet.hpp"
+#include "Metrics.hpp"
+#include "Probes.hpp"
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
 #include "../ext/x64-salsa2012-asm/salsa2012.h"
@@ -79,6 +83,19 @@ static const _FastCryptoChecker _ZT_FAST_CRYPTO_CHECK;
 #define ZT_FAST_SINGLE_PASS_SALSA2012(b,l,n,k) {}
 #endif
 
+// The runtime-selected multi-block kernels in Salsa20 beat the external ASM
+// and work in place, so only fall back to the ASM if none are available.
+#define ZT_USE_FAST_CRYPTO() ((Salsa20::kernel() == Salsa20::KERNEL_DEFAULT)&&(ZT_HAS_FAST_CRYPTO()))
+
+// Slice size for fused cipher+MAC passes in armor() and dearmor() (multiple of 64)
+#define ZT_PACKET_ARMOR_SLICE_SIZE 1024
+
+// Length of the slice starting at i, with any short tail merged into the last slice
+#define ZT_PACKET_ARMOR_SLICE(i,len) ((((len) - (i)) < (ZT_PACKET_ARMOR_SLICE_SIZE * 2)) ? ((len) - (i)) : ZT_PACKET_ARMOR_SLICE_SIZE)
+
+// Destination and source addresses, hashed as additional data by the AES-256-GCM cipher suite
+#define ZT_PACKET_AES_AAD_SIZE 10
+
 /************************************************************************** */
 
 /* LZ4 is shipped encapsulated into Packet in an anonymous namespace.
@@ -882,92 +899,338 @@ static inline int LZ4_decompress_safe(const char* source, char* dest, int compre
 	return LZ4_decompress_generic(source, dest, compressedSize, maxDecompressedSize, endOnInputSize, full, 0, noDict, (BYTE*)dest, NULL, 0);
 }
 
+/* Hashes positions of a prefix of at most 64KB that compressed input will directly follow */
+static inline void LZ4_loadPrefix(LZ4_stream_t* LZ4_stream, const char* prefix, int prefixSize)
+{
+	LZ4_stream_t_internal* const ctx = &LZ4_stream->internal_donotuse;
+	const BYTE* p = (const BYTE*)prefix;
+	const BYTE* const pEnd = p + prefixSize;
+	LZ4_resetStream(LZ4_stream);
+	while (p <= pEnd - sizeof(reg_t)) {
+	    LZ4_putPosition(p, ctx->hashTable, byU32, (const BYTE*)prefix);
+	    p += 3;
+	}
+	ctx->currentOffset = (U32)prefixSize;
+	ctx->dictSize = (U32)prefixSize;
+}
+
+/* Compresses input that directly follows the prefix loaded into the stream, so matches may reach back into it */
+static inline int LZ4_compress_withPrefix(LZ4_stream_t* LZ4_stream, const char* source, char* dest, int inputSize, int maxOutputSize, int acceleration)
+{
+	return LZ4_compress_generic(&LZ4_stream->internal_donotuse, source, dest, inputSize, maxOutputSize, limitedOutput, byU32, withPrefix64k, noDictIssue, acceleration);
+}
+
+/* Decompresses to dest, which directly follows a prefix beginning at prefixStart that matches may reach back into */
+static inline int LZ4_decompress_safe_withPrefix(const char* source, char* dest, int compressedSize, int maxDecompressedSize, const char* prefixStart)
+{
+	return LZ4_decompress_generic(source, dest, compressedSize, maxDecompressedSize, endOnInputSize, full, 0, noDict, (const BYTE*)prefixStart, NULL, 0);
+}
+
 } // anonymous namespace
 
 /************************************************************************** */
 /************************************************************************** */
 
+// Preset dictionary version 1 for control payloads (ZT_PROTO_VERB_FLAG_DICTIONARY), made of the
+// byte strings most common across samples of NETWORK_CONFIG, NETWORK_CONFIG_REQUEST,
+// NETWORK_CREDENTIALS, MULTICAST_LIKE and OK(HELLO) payloads, the most common last. This is
+// part of the protocol: a change is a new version, and old versions must still be decoded.
+static const uint8_t _compressionDictionary1[1148] = {
+	0x0a,0x53,0x3d,0x5c,0x30,0x5c,0x30,0x02,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,
+	0x5c,0x30,0x5c,0x30,0x06,0xfd,0x5c,0x30,0x58,0x0a,0x52,0x3d,0xa5,0x02,0x08,0x5c,
+	0x30,0xe5,0x02,0x08,0x06,0xe5,0x02,0x86,0xdd,0x5c,0x30,0x5c,0x30,0x01,0x5c,0x30,
+	0x00,0x5c,0x30,0x5c,0x30,0x03,0xe8,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,
+	0x30,0x5c,0x30,0x01,0x5c,0x30,0x00,0x5c,0x30,0x58,0x5c,0x30,0x5c,0x30,0x5c,0x30,
+	0x5c,0x30,0x5c,0x30,0x0a,0x49,0x3d,0x04,0x5c,0x6e,0x93,0x0b,0x01,0x02,0x00,0x0c,
+	0x06,0x20,0x01,0x0d,0xb8,0x5c,0x30,0x5c,0x30,0x18,0x5c,0x30,0x5c,0x30,0x5c,0x30,
+	0x5c,0x30,0x5c,0x30,0x04,0x5c,0x6e,0x00,0x00,0x00,0x00,0x00,0x00,0x27,0x09,0x00,
+	0x00,0x01,0x76,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x37,0x0a,0x76,0x65,0x6e,0x64,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x31,0x0a,0x70,0x76,0x3d,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x62,0x0a,0x6d,
+	0x61,0x6a,0x76,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x31,0x0a,0x6d,0x69,0x6e,0x76,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x32,0x0a,0x72,0x65,0x76,0x76,0x3d,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x63,
+	0x0a,0x6d,0x72,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x34,0x30,0x30,0x0a,0x6d,0x63,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x38,0x30,0x0a,0x6d,0x63,0x72,0x3d,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x34,0x30,0x0a,0x6d,0x74,
+	0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x38,
+	0x30,0x0a,0x66,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x0a,0x72,0x65,0x76,0x72,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x31,0x0a,0x64,0x68,0x3d,0x39,0x7c,
+	0x39,0x56,0xb8,0xf8,0x09,0x1e,0x00,0x00,0x00,0x00,0x00,0x00,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0x5c,0x30,0x5c,0x30,0x10,0x04,0x5c,0x6e,0x93,0x5c,0x30,0x00,
+	0x00,0x03,0xe8,0x00,0x03,0x24,0x01,0x06,0x28,0x04,0x00,0x16,0x00,0x16,0x01,0x00,
+	0x01,0x33,0x33,0x00,0x00,0x00,0xfb,0x00,0x00,0x00,0x00,0x01,0x00,0x5e,0x00,0x00,
+	0xfb,0x00,0x00,0x00,0x00,0x01,0x00,0x5e,0x00,0x00,0x01,0x00,0x00,0x00,0x00,0x00,
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x02,0x00,
+	0x00,0x00,0x01,0x00,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,
+	0xa1,0x5c,0x30,0x5c,0x30,0x18,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,
+	0x0a,0x49,0x3d,0x04,0x5c,0x6e,0x93,0x5c,0x30,0x5c,0x30,0x03,0xe8,0x5c,0x30,0x03,
+	0x24,0x01,0x06,0x28,0x04,0x5c,0x30,0x16,0x5c,0x30,0x16,0x01,0x5c,0x30,0x01,0x76,
+	0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x37,0x0a,0x6e,0x77,0x69,0x64,0x3d,0x0a,0x63,0x74,0x6d,0x64,0x3d,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x36,0x64,0x64,0x64,0x30,0x30,0x0a,0x72,0x3d,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x5c,0x30,0x18,
+	0x0a,0x52,0x3d,0xa5,0x02,0x08,0x5c,0x30,0xe5,0x02,0x08,0x06,0xe5,0x02,0x86,0xdd,
+	0x5c,0x30,0x5c,0x30,0x01,0x5c,0x30,0x00,0x0a,0x74,0x73,0x3d,0x30,0x30,0x30,0x30,
+	0x30,0x31,0x61,0x31,0x33,0x33,0x33,0x00,0x00,0x00,0x01,0x00,0x00,0x00,0x00,0x5c,
+	0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,
+	0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x02,0x5c,0x30,
+	0x5c,0x30,0x5c,0x30,0x00,0x00,0x00,0x00,0x00,0x6d,0xdd,0x00,0x00,0x00,0x00,0x00,
+	0x00,0x00,0x00,0x01,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x6d,0xdd,
+	0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,
+	0x01,0x0a,0x74,0x74,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x0a,
+	0x74,0x6c,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x0a,0x66,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x32,0x0a,0x6d,0x6c,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x32,0x30,0x0a,0x74,0x3d,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x0a,0x6e,0x3d,
+	0x0a,0x6d,0x74,0x75,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x61,0x66,0x30,0x0a,0x43,0x3d,0x01,0x5c,0x30,0x03,0x5c,0x30,0x5c,0x30,
+	0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,0x5c,0x30,
+	0x01,0xa1,0x00,0xf8,0x76,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x37,0x0a,0x76,0x65,0x6e,0x64,0x3d,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x31,0x0a,0x70,0x76,0x3d,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x62,
+	0x0a,0x6d,0x61,0x6a,0x76,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x31,0x0a,0x6d,0x69,0x6e,0x76,0x3d,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x32,0x0a,0x72,0x65,0x76,
+	0x76,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x63,0x0a,0x6d,0x72,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x34,0x30,0x30,0x0a,0x6d,0x63,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x38,0x30,0x0a,0x6d,0x63,0x72,0x3d,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x34,0x30,0x0a,
+	0x6d,0x74,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x38,0x30,0x0a,0x66,0x3d,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x0a,0x72,0x65,0x76,0x72,0x3d,0x30,0x30,0x30,0x30,
+	0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x30,0x31,0x00,0x00,0x00,0x00,
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00
+};
+
+// LZ4 state with the dictionary's positions hashed, copied for each compression instead of being cleared
+static const LZ4_stream_t &_compressionDictionaryStream()
+{
+	static LZ4_stream_t *const s = []() {
+		LZ4_stream_t *const ls = new LZ4_stream_t;
+		LZ4_loadPrefix(ls,(const char *)_compressionDictionary1,(int)sizeof(_compressionDictionary1));
+		return ls;
+	}();
+	return *s;
+}
+
+// Initial counter block for the AES-256-GCM cipher suite (see Packet.hpp)
+static inline void _aesGcmCounter(const uint8_t *data,const unsigned int size,uint8_t cb[16])
+{
+	ZT_FAST_MEMCPY(cb,data + ZT_PACKET_IDX_IV,8);
+	cb[8] = data[ZT_PACKET_IDX_FLAGS] & 0xf8; // mask hops
+	cb[9] = (uint8_t)size;
+	cb[10] = (uint8_t)(size >> 8);
+	cb[11] = 0;
+	cb[12] = 0;
+	cb[13] = 0;
+	cb[14] = 0;
+	cb[15] = 0;
+}
+
 const unsigned char Packet::ZERO_KEY[32] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
 
-void Packet::armor(const void *key,bool encryptPayload)
+void Packet::armor(const void *key,bool encryptPayload,const void *tail,unsigned int tailLen)
 {
 	uint8_t mangledKey[32];
 	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
+	ZT_PROBE1(armor__start,size() + tailLen);
+
+	// Any tail is appended by the cipher pass, which reads it from caller
+	// memory. First the part of the payload already in the buffer is padded
+	// out to a 64-byte boundary from the tail so that every cipher call on
+	// the remainder is block aligned.
+	const uint8_t *src = reinterpret_cast<const uint8_t *>(tail);
+	if (tailLen) {
+		const unsigned int headLen = size();
+		setSize(headLen + tailLen);
+		unsigned int pad = (64 - ((headLen - ZT_PACKET_IDX_VERB) & 63)) & 63;
+		if (pad > tailLen)
+			pad = tailLen;
+		ZT_FAST_MEMCPY(data + headLen,src,pad);
+		src += pad;
+		tailLen -= pad;
+	}
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+	const unsigned int inPlaceLen = payloadLen - tailLen; // payload bytes [inPlaceLen,payloadLen) come from src
+
+	Metrics::packetOut(payload[0],size());
+	Metrics::CryptoTimer _ct(Metrics::CRYPTO_ENCRYPT_NANOSECONDS);
 
 	// Set flag now, since it affects key mangle function
 	setCipher(encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
 
 	_salsa20MangleKey((const unsigned char *)key,mangledKey);
 
-	if (ZT_HAS_FAST_CRYPTO()) {
-		const unsigned int encryptLen = (encryptPayload) ? (size() - ZT_PACKET_IDX_VERB) : 0;
+	uint64_t mac[2];
+	if (ZT_USE_FAST_CRYPTO()) {
+		// The single-pass ASM can't resume mid-stream, so its whole keystream
+		// is generated up front and slicing the XOR and MAC passes gains
+		// nothing. The tail is copied in first so it gets the same wide XOR.
+		const unsigned int encryptLen = (encryptPayload) ? payloadLen : 0;
 		uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
 		ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,encryptLen + 64,(data + ZT_PACKET_IDX_IV),mangledKey);
-		Salsa20::memxor(data + ZT_PACKET_IDX_VERB,reinterpret_cast<const uint8_t *>(keyStream + 8),encryptLen);
-		uint64_t mac[2];
-		Poly1305::compute(mac,data + ZT_PACKET_IDX_VERB,size() - ZT_PACKET_IDX_VERB,keyStream);
-#ifdef ZT_NO_TYPE_PUNNING
-		memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
-#else
-		(*reinterpret_cast<uint64_t *>(data + ZT_PACKET_IDX_MAC)) = mac[0];
-#endif
+		Poly1305 p1305(keyStream);
+		if (tailLen)
+			ZT_FAST_MEMCPY(payload + inPlaceLen,src,tailLen);
+		if (encryptPayload)
+			Salsa20::memxor(payload,reinterpret_cast<const uint8_t *>(keyStream + 8),payloadLen);
+		p1305.update(payload,payloadLen);
+		p1305.finish(mac);
 	} else {
+		// Encrypt-then-MAC is done one slice at a time so that each slice of
+		// ciphertext is still in L1 cache when it is fed to Poly1305.
 		Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
 		uint64_t macKey[4];
 		s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
-		uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
-		const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
-		if (encryptPayload)
-			s20.crypt12(payload,payload,payloadLen);
-		uint64_t mac[2];
-		Poly1305::compute(mac,payload,payloadLen,macKey);
-		ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_MAC,mac,8);
+		Poly1305 p1305(macKey);
+		if (encryptPayload) {
+			for(unsigned int i=0,n=0;i<payloadLen;i+=n) {
+				n = ZT_PACKET_ARMOR_SLICE(i,payloadLen);
+				const unsigned int e = i + n;
+				// The tail part of the slice is copied in and the whole slice then
+				// encrypted in place, since splitting a call to a multi-block kernel
+				// at the tail boundary would leave a remainder to its one-block path
+				const unsigned int t = std::max(i,inPlaceLen);
+				if (e > t)
+					ZT_FAST_MEMCPY(payload + t,src + (t - inPlaceLen),e - t);
+				s20.crypt12(payload + i,payload + i,n);
+				p1305.update(payload + i,n);
+			}
+		} else {
+			if (tailLen)
+				ZT_FAST_MEMCPY(payload + inPlaceLen,src,tailLen);
+			p1305.update(payload,payloadLen);
+		}
+		p1305.finish(mac);
+	}
+	ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_MAC,mac,8);
+	ZT_PROBE1(armor__done,size());
+}
+
+void Packet::armor(const AES &aes,const void *tail,unsigned int tailLen)
+{
+	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
+	ZT_PROBE1(armor__start,size() + tailLen);
+
+	const uint8_t *const src = reinterpret_cast<const uint8_t *>(tail);
+	const unsigned int inPlaceLen = size() - ZT_PACKET_IDX_VERB;
+	if (tailLen)
+		setSize(size() + tailLen);
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+
+	Metrics::packetOut(payload[0],size());
+	Metrics::CryptoTimer _ct(Metrics::CRYPTO_ENCRYPT_NANOSECONDS);
+
+	// Set flag now, since it is part of the counter block
+	setCipher(ZT_PROTO_CIPHER_SUITE__C25519_AES256_GCM);
+
+	uint8_t cb[16],hm[32];
+	_aesGcmCounter(data,size(),cb);
+	memset(hm,0,sizeof(hm));
+	aes.ctr(cb,hm,hm,sizeof(hm));
+	AES::GHASH g(hm);
+	g.update(data + ZT_PACKET_IDX_DEST,ZT_PACKET_AES_AAD_SIZE);
+	for(unsigned int i=0,n=0;i<payloadLen;i+=n) {
+		n = ZT_PACKET_ARMOR_SLICE(i,payloadLen);
+		const unsigned int e = i + n;
+		const unsigned int t = std::max(i,inPlaceLen);
+		if (e > t)
+			ZT_FAST_MEMCPY(payload + t,src + (t - inPlaceLen),e - t);
+		aes.ctr(cb,payload + i,payload + i,n);
+		g.update(payload + i,n);
 	}
+	uint8_t tag[16];
+	g.finish(ZT_PACKET_AES_AAD_SIZE,payloadLen,tag);
+	for(unsigned int i=0;i<8;++i)
+		data[ZT_PACKET_IDX_MAC + i] = tag[i] ^ hm[16 + i];
+	ZT_PROBE1(armor__done,size());
 }
 
-bool Packet::dearmor(const void *key)
+bool Packet::dearmor(const void *key,const AES *aes)
 {
 	uint8_t mangledKey[32];
 	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
 	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
 	unsigned char *const payload = data + ZT_PACKET_IDX_VERB;
 	const unsigned int cs = cipher();
+	ZT_PROBE1(dearmor__start,size());
 
 	if ((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)||(cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)) {
+		Metrics::CryptoTimer _ct(Metrics::CRYPTO_DECRYPT_NANOSECONDS);
 		_salsa20MangleKey((const unsigned char *)key,mangledKey);
-		if (ZT_HAS_FAST_CRYPTO()) {
+
+		// The payload is MACed and then decrypted. If the MAC turns out to be
+		// invalid the payload is left decrypted with a bogus key, but callers
+		// always discard packets that fail here.
+		uint64_t mac[2];
+		if (ZT_USE_FAST_CRYPTO()) {
+			// As in armor() the whole keystream comes first, so there are no slices
 			uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
 			ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012) ? (payloadLen + 64) : 64),(data + ZT_PACKET_IDX_IV),mangledKey);
-			uint64_t mac[2];
-			Poly1305::compute(mac,payload,payloadLen,keyStream);
-#ifdef ZT_NO_TYPE_PUNNING
-			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8))
-				return false;
-#else
-			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) // also secure, constant time
-				return false;
-#endif
+			Poly1305 p1305(keyStream);
+			p1305.update(payload,payloadLen);
+			p1305.finish(mac);
 			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-				Salsa20::memxor(data + ZT_PACKET_IDX_VERB,reinterpret_cast<const uint8_t *>(keyStream + 8),payloadLen);
+				Salsa20::memxor(payload,reinterpret_cast<const uint8_t *>(keyStream + 8),payloadLen);
 		} else {
+			// Each slice is MACed and then decrypted while it is still in L1
 			Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
 			uint64_t macKey[4];
 			s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
-			uint64_t mac[2];
-			Poly1305::compute(mac,payload,payloadLen,macKey);
+			Poly1305 p1305(macKey);
+			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012) {
+				for(unsigned int i=0,n=0;i<payloadLen;i+=n) {
+					n = ZT_PACKET_ARMOR_SLICE(i,payloadLen);
+					p1305.update(payload + i,n);
+					s20.crypt12(payload + i,payload + i,n);
+				}
+			} else {
+				p1305.update(payload,payloadLen);
+			}
+			p1305.finish(mac);
+		}
+
 #ifdef ZT_NO_TYPE_PUNNING
-			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8))
-				return false;
+		const bool ok = Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8);
 #else
-			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) // also secure, constant time
-				return false;
+		const bool ok = ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) == mac[0]); // also secure, constant time
 #endif
-			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-				s20.crypt12(payload,payload,payloadLen);
+		ZT_PROBE2(dearmor__done,payloadLen + ZT_PACKET_IDX_VERB,(unsigned int)ok);
+		return ok;
+	} else if ((cs == ZT_PROTO_CIPHER_SUITE__C25519_AES256_GCM)&&(aes)) {
+		Metrics::CryptoTimer _ct(Metrics::CRYPTO_DECRYPT_NANOSECONDS);
+
+		uint8_t cb[16],hm[32];
+		_aesGcmCounter(data,size(),cb);
+		memset(hm,0,sizeof(hm));
+		aes->ctr(cb,hm,hm,sizeof(hm));
+		AES::GHASH g(hm);
+		g.update(data + ZT_PACKET_IDX_DEST,ZT_PACKET_AES_AAD_SIZE);
+		for(unsigned int i=0,n=0;i<payloadLen;i+=n) {
+			n = ZT_PACKET_ARMOR_SLICE(i,payloadLen);
+			g.update(payload + i,n);
+			aes->ctr(cb,payload + i,payload + i,n);
 		}
-
-		return true;
+		uint8_t tag[16];
+		g.finish(ZT_PACKET_AES_AAD_SIZE,payloadLen,tag);
+		for(unsigned int i=0;i<8;++i)
+			tag[i] ^= hm[16 + i];
+
+		const bool ok = Utils::secureEq(tag,data + ZT_PACKET_IDX_MAC,8);
+		ZT_PROBE2(dearmor__done,payloadLen + ZT_PACKET_IDX_VERB,(unsigned int)ok);
+		return ok;
 	} else {
+		ZT_PROBE2(dearmor__done,size(),0U);
 		return false; // unrecognized cipher suite
 	}
 }
@@ -982,12 +1245,30 @@ void Packet::cryptField(const void *key,unsigned int start,unsigned int len)
 	s20.crypt12(data + start,data + start,len);
 }
 
-bool Packet::compress()
+bool Packet::compress(const bool dictionary)
 {
 	char *const data = reinterpret_cast<char *>(unsafeData());
 	char buf[ZT_PROTO_MAX_PACKET_LENGTH * 2];
 
-	if ((!compressed())&&(size() > (ZT_PACKET_IDX_PAYLOAD + 64))) { // don't bother compressing tiny packets
+	if (dictionary) {
+		// Matches against the dictionary make even small control payloads worth a try
+		if ((!compressed())&&(size() > (ZT_PACKET_IDX_PAYLOAD + 16))) {
+			const int pl = (int)(size() - ZT_PACKET_IDX_PAYLOAD);
+			char in[sizeof(_compressionDictionary1) + ZT_PROTO_MAX_PACKET_LENGTH]; // input must directly follow the dictionary
+			ZT_FAST_MEMCPY(in,_compressionDictionary1,sizeof(_compressionDictionary1));
+			ZT_FAST_MEMCPY(in + sizeof(_compressionDictionary1),data + ZT_PACKET_IDX_PAYLOAD,pl);
+			LZ4_stream_t s;
+			ZT_FAST_MEMCPY(&s,&_compressionDictionaryStream(),sizeof(s));
+			buf[0] = (char)ZT_PROTO_COMPRESSION_DICTIONARY_VERSION;
+			const int cl = LZ4_compress_withPrefix(&s,in + sizeof(_compressionDictionary1),buf + 1,pl,(ZT_PROTO_MAX_PACKET_LENGTH * 2) - 1,1) + 1;
+			if ((cl > 1)&&(cl < pl)) {
+				data[ZT_PACKET_IDX_VERB] |= (char)(ZT_PROTO_VERB_FLAG_COMPRESSED | ZT_PROTO_VERB_FLAG_DICTIONARY);
+				setSize((unsigned int)cl + ZT_PACKET_IDX_PAYLOAD);
+				ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_PAYLOAD,buf,cl);
+				return true;
+			}
+		}
+	} else if ((!compressed())&&(size() > (ZT_PACKET_IDX_PAYLOAD + 64))) { // don't bother compressing tiny packets
 		int pl = (int)(size() - ZT_PACKET_IDX_PAYLOAD);
 		int cl = LZ4_compress_fast(data + ZT_PACKET_IDX_PAYLOAD,buf,pl,ZT_PROTO_MAX_PACKET_LENGTH * 2,2);
 		if ((cl > 0)&&(cl < pl)) {
@@ -997,7 +1278,8 @@ bool Packet::compress()
 			return true;
 		}
 	}
-	data[ZT_PACKET_IDX_VERB] &= (char)(~ZT_PROTO_VERB_FLAG_COMPRESSED);
+	if (!compressed())
+		data[ZT_PACKET_IDX_VERB] &= (char)(~(ZT_PROTO_VERB_FLAG_COMPRESSED | ZT_PROTO_VERB_FLAG_DICTIONARY));
 
 	return false;
 }
@@ -1005,23 +1287,44 @@ bool Packet::compress()
 bool Packet::uncompress()
 {
 	char *const data = reinterpret_cast<char *>(unsafeData());
-	char buf[ZT_PROTO_MAX_PACKET_LENGTH];
+	char buf[sizeof(_compressionDictionary1) + ZT_PROTO_MAX_PACKET_LENGTH];
+	char *out = buf;
 
 	if ((compressed())&&(size() >= ZT_PROTO_MIN_PACKET_LENGTH)) {
 		if (size() > ZT_PACKET_IDX_PAYLOAD) {
 			unsigned int compLen = size() - ZT_PACKET_IDX_PAYLOAD;
-			int ucl = LZ4_decompress_safe((const char *)data + ZT_PACKET_IDX_PAYLOAD,buf,compLen,sizeof(buf));
+			int ucl;
+			if ((data[ZT_PACKET_IDX_VERB] & ZT_PROTO_VERB_FLAG_DICTIONARY) != 0) {
+				if (data[ZT_PACKET_IDX_PAYLOAD] != (char)ZT_PROTO_COMPRESSION_DICTIONARY_VERSION) // only dictionary version so far
+					return false;
+				// Output directly follows the dictionary so matches may reach back into it
+				ZT_FAST_MEMCPY(buf,_compressionDictionary1,sizeof(_compressionDictionary1));
+				out = buf + sizeof(_compressionDictionary1);
+				ucl = LZ4_decompress_safe_withPrefix((const char *)data + ZT_PACKET_IDX_PAYLOAD + 1,out,compLen - 1,ZT_PROTO_MAX_PACKET_LENGTH,buf);
+			} else {
+				ucl = LZ4_decompress_safe((const char *)data + ZT_PACKET_IDX_PAYLOAD,buf,compLen,ZT_PROTO_MAX_PACKET_LENGTH);
+			}
 			if ((ucl > 0)&&(ucl <= (int)(capacity() - ZT_PACKET_IDX_PAYLOAD))) {
 				setSize((unsigned int)ucl + ZT_PACKET_IDX_PAYLOAD);
-				ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_PAYLOAD,buf,ucl);
+				ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_PAYLOAD,out,ucl);
 			} else {
 				return false;
 			}
 		}
-		data[ZT_PACKET_IDX_VERB] &= (char)(~ZT_PROTO_VERB_FLAG_COMPRESSED);
+		data[ZT_PACKET_IDX_VERB] &= (char)(~(ZT_PROTO_VERB_FLAG_COMPRESSED | ZT_PROTO_VERB_FLAG_DICTIONARY));
 	}
 
 	return true;
 }
 
+int Packet::compressBlock(const void *in,int inLen,void *out,int outMax)
+{
+	return LZ4_compress_fast((const char *)in,(char *)out,inLen,outMax,1);
+}
+
+int Packet::uncompressBlock(const void *in,int inLen,void *out,int outMax)
+{
+	return LZ4_decompress_safe((const char *)in,(char *)out,inLen,outMax);
+}
+
 } // namespace ZeroTier
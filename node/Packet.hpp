@@ -40,6 +40,7 @@
 #include "Poly1305.hpp"
 #include "Salsa20.hpp"
 #include "Utils.hpp"
+#include "AES.hpp"
 #include "Buffer.hpp"
 
 /**
@@ -67,9 +68,14 @@
  *   + Multipart network configurations for large network configs
  *   + Tags and Capabilities
  *   + Inline push of CertificateOfMembership deprecated
- * 9 - 1.2.0 ... CURRENT
+ * 9 - 1.2.0 ... 1.2.12
+ * 10 - 1.2.12 ... 1.2.12
+ *   + VERB_MULTI_FRAME for several small frames in one packet
+ *   + VERB_RELAY_OFFER for peer-assisted relaying (ignored by older peers)
+ * 11 - 1.2.12 ... CURRENT
+ *   + Control payloads compressed against a preset dictionary
  */
-#define ZT_PROTO_VERSION 9
+#define ZT_PROTO_VERSION 11
 
 /**
  * Minimum supported protocol version
@@ -119,6 +125,25 @@
  */
 #define ZT_PROTO_CIPHER_SUITE__NO_CRYPTO_TRUSTED_PATH 2
 
+/**
+ * Cipher suite: Curve25519/AES-256-GCM
+ *
+ * This encrypts the payload with AES-256 in counter mode and authenticates
+ * it with GHASH, as in GCM, using a key derived from the Curve25519 agreed
+ * key with SHA-512. The initial counter block is the packet IV followed by
+ * the flags byte with its hop count masked off, the packet size as a 16-bit
+ * little-endian value, and zero. Its first two blocks of key stream are the
+ * GHASH key and the mask for the tag and the payload is encrypted with the
+ * rest. Using a GHASH key of its own for every packet, like Poly1305 in the
+ * Salsa20/12 suite, means a random packet ID that repeats can't reveal a
+ * key that would let MACs be forged for other packets. The source and
+ * destination addresses are hashed as additional data and the tag is cut
+ * to 64 bits to fit the MAC field.
+ *
+ * This is only used for peers that advertise it in HELLO or OK(HELLO).
+ */
+#define ZT_PROTO_CIPHER_SUITE__C25519_AES256_GCM 3
+
 /**
  * DEPRECATED payload encrypted flag, may be re-used in the future.
  *
@@ -139,6 +164,20 @@
  */
 #define ZT_PROTO_VERB_FLAG_COMPRESSED 0x80
 
+/**
+ * Verb flag indicating payload is compressed against a preset dictionary
+ *
+ * This is only set along with ZT_PROTO_VERB_FLAG_COMPRESSED. The compressed
+ * payload is then preceded by one byte giving the dictionary's version. It
+ * is only sent to peers of protocol version 11 or newer.
+ */
+#define ZT_PROTO_VERB_FLAG_DICTIONARY 0x40
+
+/**
+ * Version of preset dictionary used to compress control payloads
+ */
+#define ZT_PROTO_COMPRESSION_DICTIONARY_VERSION 1
+
 /**
  * Rounds used for Salsa20 encryption in ZT
  *
@@ -212,6 +251,11 @@
  */
 #define ZT_PUSH_DIRECT_PATHS_FLAG_CLUSTER_REDIRECT 0x02
 
+/**
+ * PUSH_DIRECT_PATHS flag: predicted port (symmetric NAT), try after others
+ */
+#define ZT_PUSH_DIRECT_PATHS_FLAG_PREDICTED 0x04
+
 // Field indexes in packet header
 #define ZT_PACKET_IDX_IV 0
 #define ZT_PACKET_IDX_DEST 8
@@ -283,6 +327,12 @@
 #define ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE (ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID + 8)
 #define ZT_PROTO_VERB_FRAME_IDX_PAYLOAD (ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE + 2)
 
+#define ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID (ZT_PACKET_IDX_PAYLOAD)
+#define ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES (ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID + 8)
+
+#define ZT_PROTO_VERB_RELAY_OFFER_IDX_CAPACITY (ZT_PACKET_IDX_PAYLOAD)
+#define ZT_PROTO_VERB_RELAY_OFFER_IDX_LOAD (ZT_PROTO_VERB_RELAY_OFFER_IDX_CAPACITY + 8)
+
 #define ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID (ZT_PACKET_IDX_PAYLOAD)
 #define ZT_PROTO_VERB_EXT_FRAME_LEN_NETWORK_ID 8
 #define ZT_PROTO_VERB_EXT_FRAME_IDX_FLAGS (ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID + ZT_PROTO_VERB_EXT_FRAME_LEN_NETWORK_ID)
@@ -313,11 +363,15 @@
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_COM (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS + 1)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_GATHER_LIMIT (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS + 1)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_SOURCE_MAC (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS + 1)
+#define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_REPLICATION_SHARE (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS + 1)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_MAC (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FLAGS + 1)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_ADI (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_MAC + 6)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_DEST_ADI + 4)
 #define ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME (ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE + 2)
 
+// HELLO and OK(HELLO) flag: sender can receive the AES-256-GCM cipher suite
+#define ZT_PROTO_HELLO_FLAG_AES256_GCM 0x01
+
 #define ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP (ZT_PROTO_VERB_OK_IDX_PAYLOAD)
 #define ZT_PROTO_VERB_HELLO__OK__IDX_PROTOCOL_VERSION (ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP + 8)
 #define ZT_PROTO_VERB_HELLO__OK__IDX_MAJOR_VERSION (ZT_PROTO_VERB_HELLO__OK__IDX_PROTOCOL_VERSION + 1)
@@ -457,14 +511,39 @@ public:
 				throw ZT_EXCEPTION_OUT_OF_BOUNDS;
 			setSize(fragLen + ZT_PROTO_MIN_FRAGMENT_LENGTH);
 
-			// NOTE: this copies both the IV/packet ID and the destination address.
-			memcpy(field(ZT_PACKET_FRAGMENT_IDX_PACKET_ID,13),p.field(ZT_PACKET_IDX_IV,13),13);
+			writeHeader(reinterpret_cast<uint8_t *>(unsafeData()),p,fragNo,fragTotal);
+			memcpy(field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,fragLen),p.field(fragStart,fragLen),fragLen);
+		}
+
+		/**
+		 * Write a fragment header for a packet to arbitrary memory
+		 *
+		 * This is used to send fragments as in-place slices of an armored
+		 * packet by writing the header just before each slice.
+		 *
+		 * @param h Buffer of at least ZT_PROTO_MIN_FRAGMENT_LENGTH bytes (may be within p)
+		 * @param p Original assembled packet
+		 * @param fragNo Which fragment (>= 1, since 0 is Packet with end chopped off)
+		 * @param fragTotal Total number of fragments (including 0)
+		 */
+		static inline void writeHeader(uint8_t *h,const Packet &p,unsigned int fragNo,unsigned int fragTotal) { writeHeader(h,reinterpret_cast<const uint8_t *>(p.data()),fragNo,fragTotal); }
 
-			(*this)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] = ZT_PACKET_FRAGMENT_INDICATOR;
-			(*this)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] = (char)(((fragTotal & 0xf) << 4) | (fragNo & 0xf));
-			(*this)[ZT_PACKET_FRAGMENT_IDX_HOPS] = 0;
+		/**
+		 * Write a fragment header for a packet given as raw (armored) bytes
+		 *
+		 * @param h Start of fragment header (ZT_PROTO_MIN_FRAGMENT_LENGTH bytes)
+		 * @param p Start of packet
+		 * @param fragNo Fragment number (1 for the first fragment after the head)
+		 * @param fragTotal Total number of fragments including the head
+		 */
+		static inline void writeHeader(uint8_t *h,const uint8_t *p,unsigned int fragNo,unsigned int fragTotal)
+		{
+			// NOTE: this copies both the IV/packet ID and the destination address.
+			memmove(h + ZT_PACKET_FRAGMENT_IDX_PACKET_ID,p + ZT_PACKET_IDX_IV,13);
 
-			memcpy(field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,fragLen),p.field(fragStart,fragLen),fragLen);
+			h[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] = ZT_PACKET_FRAGMENT_INDICATOR;
+			h[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] = (uint8_t)(((fragTotal & 0xf) << 4) | (fragNo & 0xf));
+			h[ZT_PACKET_FRAGMENT_IDX_HOPS] = 0;
 		}
 
 		/**
@@ -519,6 +598,75 @@ public:
 		{
 			return field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,size() - ZT_PACKET_FRAGMENT_IDX_PAYLOAD);
 		}
+
+		/**
+		 * @return True if this is an FEC parity fragment (see writeParity())
+		 */
+		inline bool isParity() const { return ((*this)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] & 0xf) == 0; }
+
+		/**
+		 * Write an FEC parity fragment for a packet sent as equal-sized slices
+		 *
+		 * The head and every fragment payload but the last must be exactly
+		 * unit bytes. The parity fragment has fragment number 0, which nodes
+		 * without FEC support discard as invalid. Its payload is the packet's
+		 * length followed by the XOR of all slices zero-padded to unit bytes,
+		 * so any one missing slice can be rebuilt with parityRecover().
+		 *
+		 * @param h Buffer of at least ZT_PROTO_MIN_FRAGMENT_LENGTH + 2 + unit bytes
+		 * @param p Start of packet
+		 * @param len Length of packet
+		 * @param unit Slice size
+		 * @param fragTotal Total number of fragments including the head
+		 * @return Size of parity fragment
+		 */
+		static inline unsigned int writeParity(uint8_t *h,const uint8_t *p,unsigned int len,unsigned int unit,unsigned int fragTotal)
+		{
+			writeHeader(h,p,0,fragTotal);
+			uint8_t *const x = h + ZT_PACKET_FRAGMENT_IDX_PAYLOAD;
+			x[0] = (uint8_t)(len >> 8);
+			x[1] = (uint8_t)len;
+			memset(x + 2,0,unit);
+			for(unsigned int s=0;s<len;s+=unit) {
+				const unsigned int n = std::min(unit,len - s);
+				for(unsigned int i=0;i<n;++i)
+					x[2 + i] ^= p[s + i];
+			}
+			return ZT_PACKET_FRAGMENT_IDX_PAYLOAD + 2 + unit;
+		}
+
+		/**
+		 * Rebuild the one missing slice of a packet from this parity fragment
+		 *
+		 * @param slices Head and fragment payloads in order (entry for missing slice is ignored)
+		 * @param sliceLengths Lengths of slices
+		 * @param fragTotal Number of slices
+		 * @param missing Index of missing slice, 0 for the head
+		 * @param out Buffer of at least ZT_PROTO_MAX_PACKET_LENGTH bytes to receive missing slice
+		 * @return Length of rebuilt slice or 0 if the parity does not match these slices
+		 */
+		inline unsigned int parityRecover(const uint8_t *const *slices,const unsigned int *sliceLengths,unsigned int fragTotal,unsigned int missing,uint8_t *out) const
+		{
+			if ((!isParity())||(totalFragments() != fragTotal)||(fragTotal < 2)||(missing >= fragTotal)||(size() <= (ZT_PACKET_FRAGMENT_IDX_PAYLOAD + 2)))
+				return 0;
+			const uint8_t *const x = payload();
+			const unsigned int len = ((unsigned int)x[0] << 8) | (unsigned int)x[1];
+			const unsigned int unit = payloadLength() - 2;
+			if ((len <= (unit * (fragTotal - 1)))||(len > (unit * fragTotal)))
+				return 0;
+			const unsigned int lastLen = len - (unit * (fragTotal - 1));
+			memcpy(out,x + 2,unit);
+			for(unsigned int f=0;f<fragTotal;++f) {
+				if (f != missing) {
+					const unsigned int n = (f == (fragTotal - 1)) ? lastLen : unit;
+					if (sliceLengths[f] != n)
+						return 0;
+					for(unsigned int i=0;i<n;++i)
+						out[i] ^= slices[f][i];
+				}
+			}
+			return (missing == (fragTotal - 1)) ? lastLen : unit;
+		}
 	};
 
 	/**
@@ -548,6 +696,7 @@ public:
 		 *   [<[8] 64-bit world ID of moon>]
 		 *   [<[8] 64-bit timestamp of moon>]
 		 *   [... additional moon type/ID/timestamp tuples ...]
+		 *   [<[1] 8-bit flags (see ZT_PROTO_HELLO_FLAG_*)>]
 		 *
 		 * HELLO is sent in the clear as it is how peers share their identity
 		 * public keys. A few additional fields are sent in the clear too, but
@@ -569,6 +718,10 @@ public:
 		 *   <[...] physical destination address of packet>
 		 *   <[2] 16-bit length of world update(s) or 0 if none>
 		 *   [[...] updates to planets and/or moons]
+		 *   [<[1] 8-bit flags (see ZT_PROTO_HELLO_FLAG_*)>]
+		 *
+		 * Flags are absent when sent by older versions, which is the same as
+		 * all flags being zero.
 		 *
 		 * With the exception of the timestamp, the other fields pertain to the
 		 * respondent who is sending OK and are not echoes.
@@ -754,6 +907,11 @@ public:
 		 * Respones to this are always whole configs intended for the recipient.
 		 * For patches and other updates a NETWORK_CONFIG is sent instead.
 		 *
+		 * If the meta-data includes hashes of the blobs in the config the
+		 * requester has now, the config sent in reply or in later pushes may
+		 * leave out those that haven't changed and list them instead (see
+		 * ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP).
+		 *
 		 * It would be valid and correct as of 1.2.0 to use NETWORK_CONFIG always,
 		 * but OK(NTEWORK_CONFIG_REQUEST) should be sent for compatibility.
 		 *
@@ -862,6 +1020,8 @@ public:
 		 *   <[1] flags>
 		 *  [<[4] 32-bit implicit gather limit>]
 		 *  [<[6] source MAC>]
+		 *  [<[2] 16-bit replication share index>]
+		 *  [<[2] 16-bit replication share count>]
 		 *   <[6] destination MAC (multicast address)>
 		 *   <[4] 32-bit multicast ADI (multicast address extension)>
 		 *   <[2] 16-bit ethertype>
@@ -872,6 +1032,13 @@ public:
 		 *   0x02 - Implicit gather limit field is present
 		 *   0x04 - Source MAC is specified -- otherwise it's computed from sender
 		 *   0x08 - Please replicate (sent to multicast replicators)
+		 *   0x10 - Replicate to one share of the group (replicator to replicator)
+		 *
+		 * A replicator that gets a frame for a very large group may split the
+		 * group's members into shares, keep share 0 for itself, and send each
+		 * other live replicator a copy with flag 0x10 naming its share. A member
+		 * belongs to share (address % count). Frames with flag 0x10 are only
+		 * accepted from designated replicators and are never split again.
 		 *
 		 * OK and ERROR responses are optional. OK may be generated if there are
 		 * implicit gather results or if the recipient wants to send its own
@@ -914,6 +1081,7 @@ public:
 		 * Path record flags:
 		 *   0x01 - Forget this path if currently known (not implemented yet)
 		 *   0x02 - Cluster redirect -- use this in preference to others
+		 *   0x04 - Predicted port for a symmetric NAT -- try after others
 		 *
 		 * The receiver may, upon receiving a push, attempt to establish a
 		 * direct link to one or more of the indicated addresses. It is the
@@ -961,7 +1129,44 @@ public:
 		 * node on startup. This is helpful in identifying traces from different
 		 * members of a cluster.
 		 */
-		VERB_REMOTE_TRACE = 0x15
+		VERB_REMOTE_TRACE = 0x15,
+
+		/**
+		 * Several small Ethernet frames on the same network:
+		 *   <[8] 64-bit network ID>
+		 *   <[2] 16-bit length of frame>
+		 *   <[2] 16-bit ethertype>
+		 *   <[...] ethernet payload>
+		 *  [... additional length/ethertype/payload tuples ...]
+		 *
+		 * Each frame is handled as if it had been sent in its own VERB_FRAME,
+		 * so source and destination MACs are those of the sender and recipient.
+		 * This is only sent to peers of protocol version 10 or newer, and only
+		 * when frame aggregation is enabled (see Switch::beginAggregation()).
+		 *
+		 * ERROR may be generated if a membership certificate is needed for a
+		 * closed network. Payload will be network ID.
+		 */
+		VERB_MULTI_FRAME = 0x16,
+
+		/**
+		 * Offer to relay for the recipient:
+		 *   <[8] 64-bit relay capacity in bytes per second>
+		 *   <[8] 64-bit bytes per second currently being relayed>
+		 *
+		 * Peers with relay capacity configured send this every 30 seconds to
+		 * peers they share a network with and have a direct path to. A peer
+		 * with no direct path to a destination on a network it shares with a
+		 * relay sends via the least loaded, lowest latency relay that offered.
+		 * It falls back to roots or moons if there is none or if nothing comes
+		 * back from the destination through it. A capacity of zero withdraws
+		 * the offer. Offers are only accepted directly (zero hops) from peers
+		 * with whom trust is established. The relay only relays between peers
+		 * it sent offers to that share a network, up to its capacity.
+		 *
+		 * No OK or ERROR is generated.
+		 */
+		VERB_RELAY_OFFER = 0x17
 	};
 
 	/**
@@ -1217,6 +1422,25 @@ public:
 	 */
 	inline Verb verb() const { return (Verb)((*this)[ZT_PACKET_IDX_VERB] & 0x1f); }
 
+	/**
+	 * @param v Verb
+	 * @return True if verb carries control plane data worth compressing against the preset dictionary
+	 */
+	static inline bool controlVerb(const Verb v)
+	{
+		switch(v) {
+			case VERB_ERROR:
+			case VERB_OK:
+			case VERB_MULTICAST_LIKE:
+			case VERB_NETWORK_CREDENTIALS:
+			case VERB_NETWORK_CONFIG_REQUEST:
+			case VERB_NETWORK_CONFIG:
+				return true;
+			default:
+				return false;
+		}
+	}
+
 	/**
 	 * @return Length of packet payload
 	 */
@@ -1230,10 +1454,29 @@ public:
 	/**
 	 * Armor packet for transport
 	 *
+	 * If a tail is supplied it is appended to the packet as part of armoring,
+	 * encrypting straight from the caller's memory into this buffer. This
+	 * saves a separate copy of e.g. an Ethernet frame into the packet.
+	 *
 	 * @param key 32-byte key
 	 * @param encryptPayload If true, encrypt packet payload, else just MAC
+	 * @param tail Additional payload to append or NULL if none (default: NULL)
+	 * @param tailLen Length of tail in bytes (default: 0)
+	 * @throws std::out_of_range Packet plus tail would exceed capacity
 	 */
-	void armor(const void *key,bool encryptPayload);
+	void armor(const void *key,bool encryptPayload,const void *tail = (const void *)0,unsigned int tailLen = 0);
+
+	/**
+	 * Armor packet for transport using the AES-256-GCM cipher suite
+	 *
+	 * The payload is always encrypted. The tail works as above.
+	 *
+	 * @param aes Cipher initialized with the peer's AES key
+	 * @param tail Additional payload to append or NULL if none (default: NULL)
+	 * @param tailLen Length of tail in bytes (default: 0)
+	 * @throws std::out_of_range Packet plus tail would exceed capacity
+	 */
+	void armor(const AES &aes,const void *tail = (const void *)0,unsigned int tailLen = 0);
 
 	/**
 	 * Verify and (if encrypted) decrypt packet
@@ -1243,9 +1486,10 @@ public:
 	 * address and MAC field match a trusted path.
 	 *
 	 * @param key 32-byte key
+	 * @param aes Cipher for the AES-256-GCM suite or NULL to reject packets using it
 	 * @return False if packet is invalid or failed MAC authenticity check
 	 */
-	bool dearmor(const void *key);
+	bool dearmor(const void *key,const AES *aes = (const AES *)0);
 
 	/**
 	 * Encrypt/decrypt a separately armored portion of a packet
@@ -1270,9 +1514,14 @@ public:
 	 * results in a size reduction. If no size reduction occurs, compression
 	 * is not done and the flag is left cleared.
 	 *
+	 * Compressing against the preset dictionary lets small control payloads
+	 * such as network configs and credentials reuse strings they all share,
+	 * but the recipient must be of protocol version 11 or newer.
+	 *
+	 * @param dictionary If true, compress against the preset dictionary
 	 * @return True if compression occurred
 	 */
-	bool compress();
+	bool compress(const bool dictionary = false);
 
 	/**
 	 * Attempt to decompress payload if it is compressed (must be unencrypted)
@@ -1284,6 +1533,28 @@ public:
 	 */
 	bool uncompress();
 
+	/**
+	 * Compress an arbitrary block with the LZ4 used for payloads
+	 *
+	 * @param in Data to compress
+	 * @param inLen Length of data
+	 * @param out Buffer for compressed data
+	 * @param outMax Size of buffer
+	 * @return Compressed length, or 0 if it didn't fit in outMax
+	 */
+	static int compressBlock(const void *in,int inLen,void *out,int outMax);
+
+	/**
+	 * Decompress a block from compressBlock()
+	 *
+	 * @param in Compressed data
+	 * @param inLen Length of compressed data
+	 * @param out Buffer for decompressed data
+	 * @param outMax Size of buffer
+	 * @return Decompressed length, or a negative value if data is invalid or doesn't fit
+	 */
+	static int uncompressBlock(const void *in,int inLen,void *out,int outMax);
+
 private:
 	static const unsigned char ZERO_KEY[32];
 
@@ -27,16 +27,264 @@
 #include "Path.hpp"
 #include "RuntimeEnvironment.hpp"
 #include "Node.hpp"
+#include "Packet.hpp"
+#include "Metrics.hpp"
 
 namespace ZeroTier {
 
-bool Path::send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now)
+bool Path::send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now,unsigned int tos,unsigned int ttl)
 {
-	if (RR->node->putPacket(tPtr,_localSocket,_addr,data,len)) {
+	if (RR->node->putPacket(tPtr,_localSocket,address(),data,len,ttl,tos)) {
 		_lastOut = now;
+		_bytesOut.fetch_add(len,std::memory_order_relaxed);
+		_packetsOut.fetch_add(1,std::memory_order_relaxed);
 		return true;
 	}
 	return false;
 }
 
+bool Path::sendFragmented(const RuntimeEnvironment *RR,void *tPtr,uint8_t *data,unsigned int len,unsigned int mtu,int64_t now,unsigned int tos)
+{
+	if ((len > mtu)&&(_fec)&&(RR->node->forwardErrorCorrection())) {
+		// Slices are cut so that the parity fragment is no bigger than the others
+		const unsigned int unit = mtu - (ZT_PROTO_MIN_FRAGMENT_LENGTH + 2);
+		const unsigned int totalFragments = (len + unit - 1) / unit;
+		if (totalFragments <= ZT_MAX_PACKET_FRAGMENTS) {
+			uint8_t parity[ZT_PROTO_MAX_PACKET_LENGTH]; // mtu < len, so this holds a full fragment
+			const unsigned int parityLen = Packet::Fragment::writeParity(parity,data,len,unit,totalFragments);
+			if (!send(RR,tPtr,data,unit,now,tos))
+				return false;
+			for(unsigned int fno=1;fno<totalFragments;++fno) {
+				const unsigned int fragStart = fno * unit;
+				uint8_t *const frag = data + (fragStart - ZT_PROTO_MIN_FRAGMENT_LENGTH);
+				Packet::Fragment::writeHeader(frag,data,fno,totalFragments);
+				if (send(RR,tPtr,frag,std::min(unit,len - fragStart) + ZT_PROTO_MIN_FRAGMENT_LENGTH,now,tos))
+					fragmentSent();
+			}
+			if (send(RR,tPtr,parity,parityLen,now,tos)) {
+				fragmentSent();
+				Metrics::add(Metrics::FEC_PARITY_SENT,1);
+			}
+			return true;
+		}
+	}
+
+	unsigned int chunkSize = std::min(len,mtu);
+	if (!send(RR,tPtr,data,chunkSize,now,tos))
+		return false;
+	if (chunkSize < len) {
+		unsigned int fragStart = chunkSize;
+		unsigned int remaining = len - chunkSize;
+		unsigned int fragsRemaining = (remaining / (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+		if ((fragsRemaining * (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
+			++fragsRemaining;
+		const unsigned int totalFragments = fragsRemaining + 1;
+
+		for(unsigned int fno=1;fno<totalFragments;++fno) {
+			chunkSize = std::min(remaining,(unsigned int)(mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
+			uint8_t *const frag = data + (fragStart - ZT_PROTO_MIN_FRAGMENT_LENGTH);
+			Packet::Fragment::writeHeader(frag,data,fno,totalFragments);
+			if (send(RR,tPtr,frag,chunkSize + ZT_PROTO_MIN_FRAGMENT_LENGTH,now,tos))
+				fragmentSent();
+			fragStart += chunkSize;
+			remaining -= chunkSize;
+		}
+	}
+	return true;
+}
+
+unsigned int Path::nextMtuProbe(const int64_t now,const unsigned int maxSize)
+{
+	Mutex::Lock _l(_mtu_m);
+
+	if (_mtuProbeSize) {
+		if ((now - _mtuProbeSent) < ZT_PATH_MTU_PROBE_TIMEOUT)
+			return 0;
+		if (++_mtuProbeTries < ZT_PATH_MTU_PROBE_TRIES)
+			return _mtuProbeSize;
+		_mtuBad = _mtuProbeSize;
+		_mtuProbeSize = 0;
+	} else if (!_mtuBad) {
+		if (now < _mtuNextSearch)
+			return 0;
+		_mtuGood = 0;
+		_mtuBad = std::max(std::min(maxSize,(unsigned int)ZT_PATH_MTU_PROBE_MAX),(unsigned int)ZT_DEFAULT_PHYSMTU) + 1;
+		_mtuProbeTries = 0;
+		return (_mtuProbeSize = ZT_DEFAULT_PHYSMTU);
+	}
+
+	const unsigned int lo = (_mtuGood) ? _mtuGood : ZT_MIN_PHYSMTU;
+	if ((_mtuBad - lo) <= ZT_PATH_MTU_PROBE_GRANULARITY) {
+		if ((!_mtuGood)&&(_mtuBad > ZT_MIN_PHYSMTU)) {
+			// Nothing answered yet, so make sure the floor itself works
+			_mtuProbeTries = 0;
+			return (_mtuProbeSize = ZT_MIN_PHYSMTU);
+		}
+		// If nothing at all was answered the path is probably just down, so go
+		// back to the default rather than keep a stale or too-small value.
+		_mtu = (_mtuGood) ? _mtuGood : ZT_DEFAULT_PHYSMTU;
+		_mtuBad = 0;
+		_mtuNextSearch = now + ZT_PATH_MTU_PROBE_INTERVAL;
+		return 0;
+	}
+	_mtuProbeTries = 0;
+	return (_mtuProbeSize = lo + ((_mtuBad - lo) / 2));
+}
+
+void Path::mtuProbeFailed()
+{
+	Mutex::Lock _l(_mtu_m);
+	if (_mtuProbeSize) {
+		_mtuBad = _mtuProbeSize;
+		_mtuProbeSize = 0;
+	}
+}
+
+bool Path::mtuProbeReplied(const uint64_t inRePacketId)
+{
+	Mutex::Lock _l(_mtu_m);
+	// Compare only the most significant bits, see Node::expectingReplyTo()
+	if ((!_mtuProbeSize)||((_mtuProbeId >> 32) != (inRePacketId >> 32)))
+		return false;
+	_mtuGood = _mtuProbeSize;
+	if (_mtuGood > _mtu)
+		_mtu = _mtuGood;
+	_mtuProbeSize = 0;
+	return true;
+}
+
+void Path::probeSent(const uint64_t packetId,const int64_t now)
+{
+	Mutex::Lock _l(_qos_m);
+	_expireProbes(now);
+	unsigned int slot = 0;
+	for(unsigned int i=0;i<ZT_PATH_QOS_MAX_PROBES;++i) {
+		if (!_probeSent[i]) {
+			slot = i;
+			break;
+		}
+		if (_probeSent[i] < _probeSent[slot])
+			slot = i;
+	}
+	if (_probeSent[slot]) // all slots busy, so the oldest is given up on
+		_qosSample(true,0);
+	_probeId[slot] = (uint32_t)(packetId >> 32);
+	_probeSent[slot] = now;
+}
+
+bool Path::probeReplied(const uint64_t inRePacketId,const int64_t now)
+{
+	Mutex::Lock _l(_qos_m);
+	const uint32_t id = (uint32_t)(inRePacketId >> 32);
+	for(unsigned int i=0;i<ZT_PATH_QOS_MAX_PROBES;++i) {
+		if ((_probeSent[i])&&(_probeId[i] == id)) {
+			_qosSample(false,now - _probeSent[i]);
+			_probeSent[i] = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Path::keepaliveSent(const uint64_t packetId,const int64_t idle,const int64_t now)
+{
+	Mutex::Lock _l(_qos_m);
+	// Gaps shorter than the normal heartbeat period tell us nothing new
+	if ((_keepaliveSent)||(idle < ZT_PATH_HEARTBEAT_PERIOD))
+		return;
+	_keepaliveGap = (unsigned int)std::min(idle,(int64_t)0x7fffffff);
+	_keepaliveProbeId = (uint32_t)(packetId >> 32);
+	_keepaliveSent = now;
+}
+
+void Path::helloReplied(const uint64_t inRePacketId,const InetAddress &surface)
+{
+	Mutex::Lock _l(_qos_m);
+	const uint64_t h = (surface) ? ((uint64_t)surface.hashCode() | 1ULL) : 0ULL;
+	if ((_keepaliveSent)&&(_keepaliveProbeId == (uint32_t)(inRePacketId >> 32)))
+		_keepaliveResult((!h)||(!_surfaceHash)||(h == _surfaceHash));
+	if (h)
+		_surfaceHash = h;
+}
+
+void Path::updateQoS(const int64_t now)
+{
+	Mutex::Lock _l(_qos_m);
+	_expireProbes(now);
+
+	const uint64_t bi = _bytesIn.load(std::memory_order_relaxed);
+	const uint64_t bo = _bytesOut.load(std::memory_order_relaxed);
+	const int64_t dt = now - _throughputSampled;
+	if ((_throughputSampled)&&(dt > 0)) {
+		const uint64_t ri = ((bi - _throughputBytesIn) * 1000ULL) / (uint64_t)dt;
+		const uint64_t ro = ((bo - _throughputBytesOut) * 1000ULL) / (uint64_t)dt;
+		_throughputIn = (_throughputIn + ri) / 2;
+		_throughputOut = (_throughputOut + ro) / 2;
+
+		// Loss while traffic flows means bursts are overrunning a buffer somewhere along the path
+		const uint64_t pr = _paceRate;
+		if ((_paceLost)&&(_lossPpm >= ZT_PATH_FEC_LOSS_ON)) {
+			if (pr)
+				_paceRate = std::max((uint64_t)ZT_PATH_PACING_MIN_RATE,(pr * 3) / 4);
+			else if (ro >= ZT_PATH_PACING_MIN_RATE)
+				_paceRate = ro * 2;
+		} else if ((pr)&&(!_paceLost)&&((ro * 2) >= pr)) {
+			_paceRate = pr + (pr / 4);
+		}
+	}
+	_paceLost = 0;
+	_throughputBytesIn = bi;
+	_throughputBytesOut = bo;
+	_throughputSampled = now;
+}
+
+void Path::_expireProbes(const int64_t now)
+{
+	for(unsigned int i=0;i<ZT_PATH_QOS_MAX_PROBES;++i) {
+		if ((_probeSent[i])&&((now - _probeSent[i]) >= ZT_PATH_QOS_PROBE_TIMEOUT)) {
+			_qosSample(true,0);
+			_probeSent[i] = 0;
+		}
+	}
+	if ((_keepaliveSent)&&((now - _keepaliveSent) >= ZT_PATH_QOS_PROBE_TIMEOUT))
+		_keepaliveResult(false);
+}
+
+void Path::_keepaliveResult(const bool survived)
+{
+	if (survived) {
+		const unsigned int cap = (_keepaliveBad) ? std::max((unsigned int)ZT_PATH_HEARTBEAT_PERIOD,_keepaliveBad - ZT_PATH_KEEPALIVE_STEP) : (unsigned int)ZT_PATH_KEEPALIVE_MAX;
+		_keepalive = std::max((unsigned int)_keepalive,std::min(cap,_keepaliveGap + ZT_PATH_KEEPALIVE_STEP));
+	} else {
+		_keepaliveBad = (_keepaliveBad) ? std::min(_keepaliveBad,_keepaliveGap) : _keepaliveGap;
+		_keepalive = std::max((unsigned int)ZT_PATH_HEARTBEAT_PERIOD,_keepaliveBad - ZT_PATH_KEEPALIVE_STEP);
+	}
+	_keepaliveSent = 0;
+}
+
+void Path::_qosSample(const bool lost,const int64_t rtt)
+{
+	// Exponentially weighted with a gain of 1/8 for loss and 1/16 for jitter (as in RFC 3550)
+	const int64_t l = (int64_t)_lossPpm;
+	_lossPpm = (unsigned int)(l + ((((lost) ? 1000000LL : 0LL) - l) / 8));
+	if (lost)
+		++_paceLost;
+	if (!lost) {
+		if (_lastRtt >= 0) {
+			// Kept times 16 so the average can still move by less than 1ms
+			const int64_t d = (rtt > _lastRtt) ? (rtt - _lastRtt) : (_lastRtt - rtt);
+			const int64_t j = (int64_t)_jitter16;
+			_jitter16 = (unsigned int)std::max((int64_t)0,j + d - ((j + 8) >> 4));
+		}
+		_lastRtt = rtt;
+	}
+	++_qosSamples;
+	if (_qosSamples >= ZT_PATH_FEC_MIN_SAMPLES) {
+		if (_lossPpm >= ZT_PATH_FEC_LOSS_ON)
+			_fec = true;
+		else if (_lossPpm < ZT_PATH_FEC_LOSS_OFF)
+			_fec = false;
+	}
+}
+
 } // namespace ZeroTier
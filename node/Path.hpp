@@ -33,12 +33,16 @@
 
 #include <stdexcept>
 #include <algorithm>
+#include <atomic>
 
 #include "Constants.hpp"
 #include "InetAddress.hpp"
+#include "PackedInetAddress.hpp"
 #include "SharedPtr.hpp"
 #include "AtomicCounter.hpp"
 #include "Utils.hpp"
+#include "Mutex.hpp"
+#include "ObjectPool.hpp"
 
 /**
  * Maximum return value of preferenceRank()
@@ -65,58 +69,144 @@ public:
 	public:
 		HashKey() {}
 
-		HashKey(const int64_t l,const InetAddress &r)
-		{
-			if (r.ss_family == AF_INET) {
-				_k[0] = (uint64_t)reinterpret_cast<const struct sockaddr_in *>(&r)->sin_addr.s_addr;
-				_k[1] = (uint64_t)reinterpret_cast<const struct sockaddr_in *>(&r)->sin_port;
-				_k[2] = (uint64_t)l;
-			} else if (r.ss_family == AF_INET6) {
-				ZT_FAST_MEMCPY(_k,reinterpret_cast<const struct sockaddr_in6 *>(&r)->sin6_addr.s6_addr,16);
-				_k[2] = ((uint64_t)reinterpret_cast<const struct sockaddr_in6 *>(&r)->sin6_port << 32) ^ (uint64_t)l;
-			} else {
-				ZT_FAST_MEMCPY(_k,&r,std::min(sizeof(_k),sizeof(InetAddress)));
-				_k[2] += (uint64_t)l;
-			}
-		}
+		HashKey(const int64_t l,const InetAddress &r) : _r(r),_l(l) {}
 
-		inline unsigned long hashCode() const { return (unsigned long)(_k[0] + _k[1] + _k[2]); }
+		inline unsigned long hashCode() const { return (_r.hashCode() ^ (unsigned long)((uint64_t)_l * 0xff51afd7ed558ccdULL)); }
 
-		inline bool operator==(const HashKey &k) const { return ( (_k[0] == k._k[0]) && (_k[1] == k._k[1]) && (_k[2] == k._k[2]) ); }
+		inline bool operator==(const HashKey &k) const { return ((_l == k._l)&&(_r == k._r)); }
 		inline bool operator!=(const HashKey &k) const { return (!(*this == k)); }
 
 	private:
-		uint64_t _k[3];
+		PackedInetAddress _r;
+		int64_t _l;
 	};
 
+	// Paths come from their own slabs, see ObjectPool
+	static inline void *operator new(std::size_t size) { return ObjectPool<Path>::allocate(size); }
+	static inline void operator delete(void *p,std::size_t size) { ObjectPool<Path>::release(p,size); }
+
 	Path() :
 		_lastOut(0),
 		_lastIn(0),
 		_lastTrustEstablishedPacketReceived(0),
+		_failedAt(-1),
 		_localSocket(-1),
 		_latency(0xffff),
-		_addr(),
-		_ipScope(InetAddress::IP_SCOPE_NONE)
+		_ipScope(InetAddress::IP_SCOPE_NONE),
+		_mtu(ZT_DEFAULT_PHYSMTU),
+		_mtuGood(0),
+		_mtuBad(0),
+		_mtuProbeSize(0),
+		_mtuProbeTries(0),
+		_mtuProbeId(0),
+		_mtuProbeSent(0),
+		_mtuNextSearch(0),
+		_mtu_m("Path::_mtu_m"),
+		_bytesIn(0),
+		_bytesOut(0),
+		_packetsIn(0),
+		_packetsOut(0),
+		_fragmentsIn(0),
+		_fragmentsOut(0),
+		_jitter16(0),
+		_lossPpm(0),
+		_lastRtt(-1),
+		_qosSamples(0),
+		_fec(false),
+		_keepalive(ZT_PATH_HEARTBEAT_PERIOD),
+		_keepaliveBad(0),
+		_keepaliveGap(0),
+		_keepaliveProbeId(0),
+		_keepaliveSent(0),
+		_surfaceHash(0),
+		_throughputIn(0),
+		_throughputOut(0),
+		_throughputBytesIn(0),
+		_throughputBytesOut(0),
+		_throughputSampled(0),
+		_paceRate(0),
+		_paceLost(0),
+		_qos_m("Path::_qos_m")
 	{
+		memset(&_addr,0,sizeof(_addr));
+		memset(_probeId,0,sizeof(_probeId));
+		memset(_probeSent,0,sizeof(_probeSent));
 	}
 
 	Path(const int64_t localSocket,const InetAddress &addr) :
 		_lastOut(0),
 		_lastIn(0),
 		_lastTrustEstablishedPacketReceived(0),
+		_failedAt(-1),
 		_localSocket(localSocket),
 		_latency(0xffff),
-		_addr(addr),
-		_ipScope(addr.ipScope())
+		_ipScope(addr.ipScope()),
+		_mtu(ZT_DEFAULT_PHYSMTU),
+		_mtuGood(0),
+		_mtuBad(0),
+		_mtuProbeSize(0),
+		_mtuProbeTries(0),
+		_mtuProbeId(0),
+		_mtuProbeSent(0),
+		_mtuNextSearch(0),
+		_mtu_m("Path::_mtu_m"),
+		_bytesIn(0),
+		_bytesOut(0),
+		_packetsIn(0),
+		_packetsOut(0),
+		_fragmentsIn(0),
+		_fragmentsOut(0),
+		_jitter16(0),
+		_lossPpm(0),
+		_lastRtt(-1),
+		_qosSamples(0),
+		_fec(false),
+		_keepalive(ZT_PATH_HEARTBEAT_PERIOD),
+		_keepaliveBad(0),
+		_keepaliveGap(0),
+		_keepaliveProbeId(0),
+		_keepaliveSent(0),
+		_surfaceHash(0),
+		_throughputIn(0),
+		_throughputOut(0),
+		_throughputBytesIn(0),
+		_throughputBytesOut(0),
+		_throughputSampled(0),
+		_paceRate(0),
+		_paceLost(0),
+		_qos_m("Path::_qos_m")
 	{
+		memset(&_addr,0,sizeof(_addr));
+		if (addr.ss_family == AF_INET)
+			ZT_FAST_MEMCPY(&(_addr.in4),&addr,sizeof(struct sockaddr_in));
+		else if (addr.ss_family == AF_INET6)
+			ZT_FAST_MEMCPY(&(_addr.in6),&addr,sizeof(struct sockaddr_in6));
+		memset(_probeId,0,sizeof(_probeId));
+		memset(_probeSent,0,sizeof(_probeSent));
 	}
 
 	/**
 	 * Called when a packet is received from this remote path, regardless of content
 	 *
 	 * @param t Time of receive
+	 * @param len Length of packet in bytes
 	 */
-	inline void received(const uint64_t t) { _lastIn = t; }
+	inline void received(const uint64_t t,const unsigned int len)
+	{
+		_lastIn = t;
+		_bytesIn.fetch_add(len,std::memory_order_relaxed);
+		_packetsIn.fetch_add(1,std::memory_order_relaxed);
+	}
+
+	/**
+	 * Count a received packet fragment (other than a head), in addition to received()
+	 */
+	inline void fragmentReceived() { _fragmentsIn.fetch_add(1,std::memory_order_relaxed); }
+
+	/**
+	 * Count a sent packet fragment (other than a head), in addition to send()
+	 */
+	inline void fragmentSent() { _fragmentsOut.fetch_add(1,std::memory_order_relaxed); }
 
 	/**
 	 * Set time last trusted packet was received (done in Peer::received())
@@ -131,9 +221,32 @@ public:
 	 * @param data Packet data
 	 * @param len Packet length
 	 * @param now Current time
+	 * @param tos IP traffic class of a frame inside, or 0 for the default (default: 0)
 	 * @return True if transport reported success
 	 */
-	bool send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now);
+	bool send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now,unsigned int tos = 0,unsigned int ttl = 0);
+
+	/**
+	 * Send an armored packet via this path, fragmenting it if it's bigger than mtu
+	 *
+	 * Each fragment is sent as a slice of the packet with its header written
+	 * over the end of the previous slice, so the packet's contents are
+	 * destroyed.
+	 *
+	 * While fec() is true and the node has forward error correction enabled,
+	 * fragmented packets are cut into equal slices and followed by a parity
+	 * fragment from which the receiver can rebuild any one lost slice.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param data Armored packet, overwritten if fragmented
+	 * @param len Packet length
+	 * @param mtu Maximum size of each datagram
+	 * @param now Current time
+	 * @param tos IP traffic class of a frame inside, set on every fragment (default: 0)
+	 * @return True if transport reported success for the head
+	 */
+	bool sendFragmented(const RuntimeEnvironment *RR,void *tPtr,uint8_t *data,unsigned int len,unsigned int mtu,int64_t now,unsigned int tos = 0);
 
 	/**
 	 * Manually update last sent time
@@ -163,7 +276,19 @@ public:
 	/**
 	 * @return Physical address
 	 */
-	inline const InetAddress &address() const { return _addr; }
+	inline InetAddress address() const
+	{
+		if (_addr.in4.sin_family == AF_INET6)
+			return InetAddress(_addr.in6);
+		else if (_addr.in4.sin_family == AF_INET)
+			return InetAddress(_addr.in4);
+		return InetAddress();
+	}
+
+	/**
+	 * @return Address family of this path's physical address
+	 */
+	inline int addressFamily() const { return (int)_addr.in4.sin_family; }
 
 	/**
 	 * @return IP scope -- faster shortcut for address().ipScope()
@@ -182,7 +307,7 @@ public:
 	{
 		// This causes us to rank paths in order of IP scope rank (see InetAdddress.hpp) but
 		// within each IP scope class to prefer IPv6 over IPv4.
-		return ( ((unsigned int)_ipScope << 1) | (unsigned int)(_addr.ss_family == AF_INET6) );
+		return ( ((unsigned int)_ipScope << 1) | (unsigned int)(_addr.in4.sin_family == AF_INET6) );
 	}
 
 	/**
@@ -230,20 +355,115 @@ public:
 	 */
 	inline unsigned int latency() const { return _latency; }
 
+	/**
+	 * @return Jitter (mean variation of probe round trips) in milliseconds
+	 */
+	inline unsigned int jitter() const { return (_jitter16 >> 4); }
+
+	/**
+	 * @return Fraction of HELLO/ECHO probes lost in parts per million, recent probes weighted most
+	 */
+	inline unsigned int loss() const { return _lossPpm; }
+
+	/**
+	 * @return Number of probes answered or lost so far, i.e. whether jitter() and loss() mean anything yet
+	 */
+	inline unsigned int qosSamples() const { return _qosSamples; }
+
+	/**
+	 * @return True if probe loss on this path is high enough for sendFragmented() to add FEC parity
+	 */
+	inline bool fec() const { return _fec; }
+
+	/**
+	 * @return Average receive rate in bytes/second as of the last updateThroughput()
+	 */
+	inline uint64_t throughputIn() const { return _throughputIn; }
+
+	/**
+	 * @return Average send rate in bytes/second as of the last updateThroughput()
+	 */
+	inline uint64_t throughputOut() const { return _throughputOut; }
+
+	/**
+	 * Estimated rate this path can carry, for pacing frames sent over it
+	 *
+	 * This is zero until probes are lost while traffic is flowing. It then
+	 * starts at twice the average send rate at that time, drops by a quarter
+	 * whenever more probes are lost, and grows by a quarter whenever traffic
+	 * uses at least half of it without loss.
+	 *
+	 * @return Rate in bytes/second or 0 if frames over this path don't need pacing
+	 */
+	inline uint64_t paceRate() const { return _paceRate; }
+
+	/**
+	 * Get traffic counters since this path was created
+	 *
+	 * Counters are updated with relaxed atomics and so may be read slightly
+	 * out of step with one another. Packets include fragments.
+	 *
+	 * @param packetsIn Set to datagrams received
+	 * @param bytesIn Set to bytes received
+	 * @param fragmentsIn Set to fragments received
+	 * @param packetsOut Set to datagrams sent
+	 * @param bytesOut Set to bytes sent
+	 * @param fragmentsOut Set to fragments sent
+	 */
+	inline void traffic(uint64_t &packetsIn,uint64_t &bytesIn,uint64_t &fragmentsIn,uint64_t &packetsOut,uint64_t &bytesOut,uint64_t &fragmentsOut) const
+	{
+		packetsIn = _packetsIn.load(std::memory_order_relaxed);
+		bytesIn = _bytesIn.load(std::memory_order_relaxed);
+		fragmentsIn = _fragmentsIn.load(std::memory_order_relaxed);
+		packetsOut = _packetsOut.load(std::memory_order_relaxed);
+		bytesOut = _bytesOut.load(std::memory_order_relaxed);
+		fragmentsOut = _fragmentsOut.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Latency penalized for jitter and loss, or 0xffff if latency is unknown
+	 *
+	 * Jitter counts twice since it delays a typical packet by about that much
+	 * more than the average, and every 1% loss adds a tenth of
+	 * (latency + 100ms) to account for retransmits at the transport layer.
+	 *
+	 * @return Effective latency in milliseconds
+	 */
+	inline unsigned int effectiveLatency() const
+	{
+		const unsigned int l = _latency;
+		if (l >= 0xffff)
+			return 0xffff;
+		const uint64_t e = (uint64_t)l + ((uint64_t)(_jitter16 >> 4) * 2) + ((((uint64_t)l + 100) * (uint64_t)_lossPpm) / 100000);
+		return (unsigned int)std::min(e,(uint64_t)0xfffe);
+	}
+
 	/**
 	 * @return Path quality -- lower is better
 	 */
 	inline long quality(const int64_t now) const
 	{
-		const int l = (long)_latency;
+		const int l = (long)effectiveLatency();
 		const int age = (long)std::min((now - _lastIn),(int64_t)(ZT_PATH_HEARTBEAT_PERIOD * 10)); // set an upper sanity limit to avoid overflow
-		return (((age < (ZT_PATH_HEARTBEAT_PERIOD + 5000)) ? l : (l + 0xffff + age)) * (long)((ZT_INETADDRESS_MAX_SCOPE - _ipScope) + 1));
+		return (((alive(now)) ? l : (l + 0xffff + age)) * (long)((ZT_INETADDRESS_MAX_SCOPE - _ipScope) + 1));
 	}
 
 	/**
-	 * @return True if this path is alive (receiving heartbeats)
+	 * @return True if this path is alive (receiving heartbeats and not declared down by fast failover)
+	 */
+	inline bool alive(const int64_t now) const { return (((now - _lastIn) < (ZT_PATH_HEARTBEAT_PERIOD + 5000))&&(!failed())); }
+
+	/**
+	 * Declare this path down until anything is received over it again
+	 *
+	 * @param now Current time
 	 */
-	inline bool alive(const int64_t now) const { return ((now - _lastIn) < (ZT_PATH_HEARTBEAT_PERIOD + 5000)); }
+	inline void fail(const int64_t now) { _failedAt = now; }
+
+	/**
+	 * @return True if fail() was called and nothing has been received since
+	 */
+	inline bool failed() const { return (_lastIn <= _failedAt); }
 
 	/**
 	 * @return True if this path needs a heartbeat
@@ -255,6 +475,127 @@ public:
 	 */
 	inline int64_t lastOut() const { return _lastOut; }
 
+	/**
+	 * @return UDP payload size to use on this path (discovered, or ZT_DEFAULT_PHYSMTU)
+	 */
+	inline unsigned int mtu() const { return _mtu; }
+
+	/**
+	 * Get the size of the next path MTU probe if one is due
+	 *
+	 * Discovery is a binary search between the largest size known to make it
+	 * through in one datagram and the smallest size known not to, starting at
+	 * ZT_DEFAULT_PHYSMTU. Sizes are only declared too big after several lost
+	 * probes so that ordinary packet loss doesn't shrink the MTU.
+	 *
+	 * Probes must be sent with the don't fragment bit set, or an oversized
+	 * probe fragmented by the sender's IP stack would still be answered. If
+	 * the host can't do that, maxSize should be ZT_DEFAULT_PHYSMTU so the
+	 * search can only lower the MTU.
+	 *
+	 * @param now Current time
+	 * @param maxSize Largest size to try, at most ZT_PATH_MTU_PROBE_MAX
+	 * @return Probe UDP payload size or 0 if no probe should be sent now
+	 */
+	unsigned int nextMtuProbe(const int64_t now,const unsigned int maxSize);
+
+	/**
+	 * @param now Current time
+	 * @return Time after which nextMtuProbe() may have a probe to send (now if a search is under way)
+	 */
+	inline int64_t nextMtuProbeTime(const int64_t now)
+	{
+		Mutex::Lock _l(_mtu_m);
+		if (_mtuProbeSize)
+			return _mtuProbeSent + ZT_PATH_MTU_PROBE_TIMEOUT;
+		return (_mtuBad) ? now : _mtuNextSearch;
+	}
+
+	/**
+	 * Record that a probe returned by nextMtuProbe() was sent
+	 *
+	 * @param packetId Packet ID of probe (after armor)
+	 * @param now Current time
+	 */
+	inline void mtuProbeSent(const uint64_t packetId,const int64_t now)
+	{
+		Mutex::Lock _l(_mtu_m);
+		_mtuProbeId = packetId;
+		_mtuProbeSent = now;
+	}
+
+	/**
+	 * Record that a probe returned by nextMtuProbe() could not be sent
+	 *
+	 * This happens when it's too big to leave the host without being
+	 * fragmented, so its size is declared too big at once.
+	 */
+	void mtuProbeFailed();
+
+	/**
+	 * Check a reply against the outstanding probe and raise the MTU if it matches
+	 *
+	 * @param inRePacketId Packet ID of ECHO being replied to
+	 * @return True if this was a reply to this path's outstanding probe
+	 */
+	bool mtuProbeReplied(const uint64_t inRePacketId);
+
+	/**
+	 * Record that a HELLO or ECHO that the other side should answer was sent
+	 *
+	 * Probes that go unanswered for ZT_PATH_QOS_PROBE_TIMEOUT count as lost.
+	 *
+	 * @param packetId Packet ID of probe
+	 * @param now Current time
+	 */
+	void probeSent(const uint64_t packetId,const int64_t now);
+
+	/**
+	 * Check an OK against this path's outstanding probes and update jitter and loss if it matches
+	 *
+	 * @param inRePacketId Packet ID of HELLO or ECHO being replied to
+	 * @param now Current time
+	 * @return True if this answered an outstanding probe
+	 */
+	bool probeReplied(const uint64_t inRePacketId,const int64_t now);
+
+	/**
+	 * @return Keepalive interval to use while the peer is idle in adaptive keepalive mode
+	 */
+	inline unsigned int keepaliveInterval() const { return _keepalive; }
+
+	/**
+	 * Record that an idle keepalive HELLO was sent in adaptive keepalive mode
+	 *
+	 * If the reply reports the same external address as the last one did, the
+	 * NAT binding outlasted the idle gap and the interval grows to that gap
+	 * plus ZT_PATH_KEEPALIVE_STEP, up to ZT_PATH_KEEPALIVE_MAX. If there is no
+	 * reply or the address changed, the binding was lost. The interval then
+	 * drops to one step under that gap and never grows past it again.
+	 *
+	 * @param packetId Packet ID of HELLO
+	 * @param idle Time since anything was last sent over this path before the HELLO
+	 * @param now Current time
+	 */
+	void keepaliveSent(const uint64_t packetId,const int64_t idle,const int64_t now);
+
+	/**
+	 * Note the external address reported in an OK(HELLO) received over this path
+	 *
+	 * @param inRePacketId Packet ID of HELLO being replied to
+	 * @param surface Our external address as seen by the other side, or a nil address if not reported
+	 */
+	void helloReplied(const uint64_t inRePacketId,const InetAddress &surface);
+
+	/**
+	 * Count probes that have timed out, sample send and receive rates and update the pacing rate
+	 *
+	 * This is called about every ZT_PING_CHECK_INVERVAL for paths of active peers.
+	 *
+	 * @param now Current time
+	 */
+	void updateQoS(const int64_t now);
+
 	/**
 	 * @return Last time we received anything
 	 */
@@ -266,13 +607,64 @@ public:
 	inline int64_t lastTrustEstablishedPacketReceived() const { return _lastTrustEstablishedPacketReceived; }
 
 private:
+	void _expireProbes(const int64_t now);
+	void _keepaliveResult(const bool survived);
+	void _qosSample(const bool lost,const int64_t rtt);
+
 	volatile int64_t _lastOut;
 	volatile int64_t _lastIn;
 	volatile int64_t _lastTrustEstablishedPacketReceived;
+	volatile int64_t _failedAt;
 	int64_t _localSocket;
 	volatile unsigned int _latency;
-	InetAddress _addr;
+	// A path is only ever IPv4 or IPv6, so this is much smaller than a whole
+	// sockaddr_storage; address() expands it to an InetAddress when needed.
+	union {
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+	} _addr;
 	InetAddress::IpScope _ipScope; // memoize this since it's a computed value checked often
+
+	// Path MTU discovery state, all but _mtu guarded by _mtu_m
+	volatile unsigned int _mtu;
+	unsigned int _mtuGood; // largest size answered during this search, 0 if none
+	unsigned int _mtuBad; // search upper bound (exclusive), 0 if not searching
+	unsigned int _mtuProbeSize; // size of outstanding probe, 0 if none
+	unsigned int _mtuProbeTries;
+	uint64_t _mtuProbeId;
+	int64_t _mtuProbeSent;
+	int64_t _mtuNextSearch;
+	Mutex _mtu_m;
+
+	// In-band QoS measurements, probe state and rate sampling guarded by _qos_m
+	std::atomic<uint64_t> _bytesIn;
+	std::atomic<uint64_t> _bytesOut;
+	std::atomic<uint64_t> _packetsIn;
+	std::atomic<uint64_t> _packetsOut;
+	std::atomic<uint64_t> _fragmentsIn;
+	std::atomic<uint64_t> _fragmentsOut;
+	volatile unsigned int _jitter16;
+	volatile unsigned int _lossPpm;
+	int64_t _lastRtt;
+	volatile unsigned int _qosSamples;
+	volatile bool _fec; // true while loss is high enough for FEC, see ZT_PATH_FEC_LOSS_ON
+	volatile unsigned int _keepalive; // idle keepalive interval learned so far
+	unsigned int _keepaliveBad; // shortest idle gap the NAT binding didn't survive, 0 if none yet
+	unsigned int _keepaliveGap; // idle gap before the outstanding keepalive
+	uint32_t _keepaliveProbeId;
+	int64_t _keepaliveSent; // 0 if no keepalive outstanding
+	uint64_t _surfaceHash; // external address last reported over this path, 0 if none
+	volatile uint64_t _throughputIn;
+	volatile uint64_t _throughputOut;
+	uint64_t _throughputBytesIn;
+	uint64_t _throughputBytesOut;
+	int64_t _throughputSampled;
+	volatile uint64_t _paceRate; // see paceRate()
+	unsigned int _paceLost; // probes lost since last updateQoS()
+	uint32_t _probeId[ZT_PATH_QOS_MAX_PROBES]; // most significant bits of packet ID, see Node::expectingReplyTo()
+	int64_t _probeSent[ZT_PATH_QOS_MAX_PROBES]; // 0 if slot is empty (kept apart from IDs to avoid padding)
+	Mutex _qos_m;
+
 	AtomicCounter __refCount;
 };
 
@@ -24,6 +24,8 @@
  * of your own application.
  */
 
+#include <math.h>
+
 #include "../version.h"
 
 #include "Constants.hpp"
@@ -35,34 +37,109 @@
 #include "Packet.hpp"
 #include "Trace.hpp"
 #include "InetAddress.hpp"
+#include "Salsa20.hpp"
+#include "Poly1305.hpp"
+#include "SHA512.hpp"
+#include "Probes.hpp"
 
 namespace ZeroTier {
 
-Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity) :
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity,const uint8_t *key) :
 	RR(renv),
 	_lastReceive(0),
 	_lastNontrivialReceive(0),
 	_lastTriedMemorizedPath(0),
+	_lastLearnedPath(0),
 	_lastDirectPathPushSent(0),
 	_lastDirectPathPushReceive(0),
 	_lastCredentialRequestSent(0),
 	_lastWhoisRequestReceived(0),
 	_lastEchoRequestReceived(0),
+	_lastClusterAnnounce(0),
 	_lastComRequestReceived(0),
 	_lastComRequestSent(0),
 	_lastCredentialsReceived(0),
 	_lastTrustEstablishedPacketReceived(0),
 	_lastSentFullHello(0),
+	_lastMultipathHeartbeat(0),
+	_lastRelayOffer(0),
+	_relayCapacity(0),
+	_relayLoad(0),
+	_relayFailed(0),
+	_lastRelayOfferSent(0),
+	_relaySendsSince(0),
+	_lastSentViaRelay(0),
 	_vProto(0),
 	_vMajor(0),
 	_vMinor(0),
 	_vRevision(0),
+	_remoteHelloFlags(0),
+	_aesReady(false),
+	_paths_m("Peer::_paths_m"),
 	_id(peerIdentity),
 	_directPathPushCutoffCount(0),
-	_credentialsCutoffCount(0)
+	_credentialsCutoffCount(0),
+	_frames((_FrameState *)0),
+	_lastFrameSent(0),
+	_ffActive(false),
+	_pingScheduled(false),
+	_multipathMode((renv->node) ? renv->node->multipathMode(peerIdentity.address()) : (int)ZT_MULTIPATH_NONE),
+	_multipathCounter(0),
+	_packetsIn(0),
+	_bytesIn(0),
+	_relayedIn(0),
+	_packetsOut(0),
+	_bytesOut(0),
+	_relayedOut(0),
+	_bestPathSeq(0),
+	_bestPath((Path *)0),
+	_bestPathExpires(0)
 {
-	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
+	if (key) {
+		ZT_FAST_MEMCPY(_key,key,ZT_PEER_SECRET_KEY_LENGTH);
+	} else if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH)) {
 		throw ZT_EXCEPTION_INVALID_ARGUMENT;
+	}
+
+	// AES keys are only set up if the AES-256-GCM cipher suite will be offered
+	if (AES::accelerated()) {
+		uint8_t aesKey[64];
+		SHA512::hash(aesKey,_key,ZT_PEER_SECRET_KEY_LENGTH);
+		_aes.init(aesKey);
+		_aesReady = true;
+		Utils::burn(aesKey,sizeof(aesKey));
+	}
+}
+
+bool Peer::attemptFrameCompression(Packet &outp)
+{
+	const unsigned int uncompressedSize = outp.size();
+	if (uncompressedSize <= (ZT_PACKET_IDX_PAYLOAD + 64))
+		return outp.compress(); // too small to be attempted, so not counted
+
+	_FrameState *const f = _frameState();
+	f->compressAttempts.fetch_add(1,std::memory_order_relaxed);
+	if (outp.compress()) {
+		f->compressSuccesses.fetch_add(1,std::memory_order_relaxed);
+		f->compressBytesSaved.fetch_add(uncompressedSize - outp.size(),std::memory_order_relaxed);
+		f->compressFailures.store(0,std::memory_order_relaxed);
+		f->compressBackoff.store(0,std::memory_order_relaxed);
+		return true;
+	}
+
+	// Only the sender that crosses the threshold arms the back-off, so
+	// concurrent failures can't double it more than once per round.
+	unsigned int failures = f->compressFailures.fetch_add(1,std::memory_order_relaxed) + 1;
+	while (failures >= ZT_PEER_COMPRESSION_FAILURE_THRESHOLD) {
+		if (f->compressFailures.compare_exchange_weak(failures,ZT_PEER_COMPRESSION_FAILURE_THRESHOLD - 1,std::memory_order_relaxed)) { // a single failed re-probe backs off again
+			const unsigned int backoff = f->compressBackoff.load(std::memory_order_relaxed);
+			const unsigned int next = (backoff) ? std::min(backoff * 2,(unsigned int)ZT_PEER_COMPRESSION_BACKOFF_MAX) : ZT_PEER_COMPRESSION_BACKOFF_MIN;
+			f->compressBackoff.store(next,std::memory_order_relaxed);
+			f->compressSkip.store(next,std::memory_order_relaxed);
+			break;
+		}
+	}
+	return false;
 }
 
 void Peer::received(
@@ -82,10 +159,14 @@ void Peer::received(
 	switch (verb) {
 		case Packet::VERB_FRAME:
 		case Packet::VERB_EXT_FRAME:
+		case Packet::VERB_MULTI_FRAME:
 		case Packet::VERB_NETWORK_CONFIG_REQUEST:
 		case Packet::VERB_NETWORK_CONFIG:
 		case Packet::VERB_MULTICAST_FRAME:
 			_lastNontrivialReceive = now;
+			// Active peers get pinged, so put this one on the ping schedule if it isn't yet
+			if ((!_pingScheduled.load(std::memory_order_relaxed))&&(!_pingScheduled.exchange(true)))
+				RR->node->schedulePing(_id.address(),now);
 			break;
 		default: break;
 	}
@@ -104,6 +185,8 @@ void Peer::received(
 			for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
 				if (_paths[i].p) {
 					if (_paths[i].p == path) {
+						if ((now - _paths[i].lr) >= ZT_PEER_PATH_EXPIRATION)
+							_invalidateBestPath(); // expired path is usable again
 						_paths[i].lr = now;
 						havePath = true;
 						break;
@@ -121,7 +204,7 @@ void Peer::received(
 			bool redundant = false;
 			for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
 				if (_paths[i].p) {
-					if ( (_paths[i].p->alive(now)) && ( ((_paths[i].p->localSocket() == path->localSocket())&&(_paths[i].p->address().ss_family == path->address().ss_family)) || (_paths[i].p->address().ipsEqual2(path->address())) ) )  {
+					if ( (_paths[i].p->alive(now)) && ( ((_paths[i].p->localSocket() == path->localSocket())&&(_paths[i].p->addressFamily() == path->addressFamily())) || (_paths[i].p->address().ipsEqual2(path->address())) ) )  {
 						redundant = true;
 						break;
 					}
@@ -147,9 +230,12 @@ void Peer::received(
 				if (replacePath != ZT_MAX_PEER_NETWORK_PATHS) {
 					if (verb == Packet::VERB_OK) {
 						RR->t->peerLearnedNewPath(tPtr,networkId,*this,path,packetId);
+						_lastLearnedPath = now;
 						_paths[replacePath].lr = now;
 						_paths[replacePath].p = path;
 						_paths[replacePath].priority = 1;
+						_invalidateBestPath();
+						ZT_PROBE2(peer__path__learned,_id.address().toInt(),replacePath);
 					} else {
 						attemptToContact = true;
 					}
@@ -177,11 +263,21 @@ void Peer::received(
 			for(std::vector<InetAddress>::const_iterator i(dps.begin());i!=dps.end();++i)
 				pathsToPush.push_back(*i);
 
-			// Do symmetric NAT prediction if we are communicating indirectly.
+			// Add our external addresses as upstreams see them, which may be several
+			// if we are multi-homed or behind a symmetric NAT.
+			std::vector<InetAddress> reflexive(RR->sa->getReflexiveAddresses());
+			for(std::vector<InetAddress>::const_iterator i(reflexive.begin());i!=reflexive.end();++i) {
+				if (std::find(pathsToPush.begin(),pathsToPush.end(),*i) == pathsToPush.end())
+					pathsToPush.push_back(*i);
+			}
+
+			// Do symmetric NAT prediction if we are communicating indirectly. These
+			// are flagged so the other side tries them after everything else.
+			const std::vector<InetAddress>::size_type predictedFrom = pathsToPush.size();
 			if (hops > 0) {
-				std::vector<InetAddress> sym(RR->sa->getSymmetricNatPredictions());
+				std::vector<InetAddress> sym(RR->sa->getSymmetricNatPredictions()); // most likely first
 				for(unsigned long i=0,added=0;i<sym.size();++i) {
-					InetAddress tmp(sym[(unsigned long)RR->node->prng() % sym.size()]);
+					const InetAddress &tmp = sym[i];
 					if (std::find(pathsToPush.begin(),pathsToPush.end(),tmp) == pathsToPush.end()) {
 						pathsToPush.push_back(tmp);
 						if (++added >= ZT_PUSH_DIRECT_PATHS_MAX_PER_SCOPE_AND_FAMILY)
@@ -210,7 +306,7 @@ void Peer::received(
 								continue;
 						}
 
-						outp.append((uint8_t)0); // no flags
+						outp.append((uint8_t)(((std::vector<InetAddress>::size_type)(p - pathsToPush.begin()) >= predictedFrom) ? ZT_PUSH_DIRECT_PATHS_FLAG_PREDICTED : 0));
 						outp.append((uint16_t)0); // no extensions
 						outp.append(addressType);
 						outp.append((uint8_t)((addressType == 4) ? 6 : 18));
@@ -234,13 +330,35 @@ void Peer::received(
 
 SharedPtr<Path> Peer::getBestPath(int64_t now,bool includeExpired) const
 {
+	const Epoch::Guard g;
+	Path *const p = getBestPath(g,now,includeExpired);
+	SharedPtr<Path> r;
+	if (p)
+		r.set(p);
+	return r;
+}
+
+Path *Peer::getBestPath(const Epoch::Guard &g,int64_t now,bool includeExpired) const
+{
+	if (!includeExpired) {
+		// Lock-free read of the cached choice, see _cacheBestPath()
+		const uint32_t seq = _bestPathSeq.load(std::memory_order_acquire);
+		if ((seq & 1) == 0) {
+			Path *const p = _bestPath;
+			const int64_t expires = _bestPathExpires;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if ((_bestPathSeq.load(std::memory_order_relaxed) == seq)&&(now < expires))
+				return p;
+		}
+	}
+
 	Mutex::Lock _l(_paths_m);
 
 	unsigned int bestPath = ZT_MAX_PEER_NETWORK_PATHS;
 	long bestPathQuality = 2147483647;
 	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
 		if (_paths[i].p) {
-			if ((includeExpired)||((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION)) {
+			if ((includeExpired)||(((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION)&&(!_paths[i].p->failed()))) {
 				const long q = _paths[i].p->quality(now) / _paths[i].priority;
 				if (q <= bestPathQuality) {
 					bestPathQuality = q;
@@ -250,9 +368,128 @@ SharedPtr<Path> Peer::getBestPath(int64_t now,bool includeExpired) const
 		} else break;
 	}
 
+	if (!includeExpired)
+		_cacheBestPath(now,bestPath);
 	if (bestPath != ZT_MAX_PEER_NETWORK_PATHS)
-		return _paths[bestPath].p;
-	return SharedPtr<Path>();
+		return _paths[bestPath].p.ptr();
+	return (Path *)0;
+}
+
+bool Peer::_keepaliveAdaptive(const int64_t now) const
+{
+	return ((RR->node)&&(RR->node->adaptiveKeepalive())&&(_multipathMode == ZT_MULTIPATH_NONE)&&((now - std::max(_lastNontrivialReceive,(int64_t)_lastFrameSent)) >= ZT_PEER_KEEPALIVE_IDLE_TIMEOUT));
+}
+
+void Peer::_cacheBestPath(const int64_t now,const unsigned int bestPath) const
+{
+	// The choice can only change on its own when a path stops being alive or
+	// expires, so the cache ends at the first of those or after the TTL.
+	int64_t expires = now + ZT_PEER_BEST_PATH_CACHE_TTL;
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		if (_paths[i].p) {
+			const int64_t pathExpires = _paths[i].lr + ZT_PEER_PATH_EXPIRATION;
+			if ((pathExpires > now)&&(pathExpires < expires))
+				expires = pathExpires;
+			const int64_t deadAt = _paths[i].p->lastIn() + (ZT_PATH_HEARTBEAT_PERIOD + 5000);
+			if ((deadAt > now)&&(deadAt < expires))
+				expires = deadAt;
+		} else break;
+	}
+
+	Path *const p = (bestPath != ZT_MAX_PEER_NETWORK_PATHS) ? _paths[bestPath].p.ptr() : (Path *)0;
+	const uint32_t seq = _bestPathSeq.load(std::memory_order_relaxed);
+	_bestPathSeq.store(seq + 1,std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_bestPath = p;
+	_bestPathExpires = expires;
+	_bestPathSeq.store(seq + 2,std::memory_order_release);
+}
+
+SharedPtr<Path> Peer::getMultipathPath(int64_t now,uint64_t flowId)
+{
+	const int mode = _multipathMode;
+	if ((mode == ZT_MULTIPATH_NONE)||((mode == ZT_MULTIPATH_FLOW_HASH)&&(!flowId)))
+		return getBestPath(now,false);
+
+	{
+		Mutex::Lock _l(_paths_m);
+
+		const uint64_t key = (mode == ZT_MULTIPATH_BALANCE) ? ++_multipathCounter : flowId;
+
+		// Weighted rendezvous hashing: each path scores -w/ln(u) for a uniform u
+		// derived from the key and the path, so a path's share of keys follows its
+		// weight and keys only move when their path goes away. Paths are keyed by
+		// local socket and address so two uplinks to the same remote are distinct.
+		unsigned int best = ZT_MAX_PEER_NETWORK_PATHS;
+		double bestScore = 0.0;
+		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+			if (_paths[i].p) {
+				const Path &p = *(_paths[i].p);
+				if (((now - p.lastIn()) < ZT_MULTIPATH_PATH_TIMEOUT)&&(!p.failed())) {
+					uint64_t h = key ^ ((uint64_t)p.address().hashCode() * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)p.localSocket();
+					h ^= h >> 33;
+					h *= 0xff51afd7ed558ccdULL;
+					h ^= h >> 33;
+					h *= 0xc4ceb9fe1a85ec53ULL;
+					h ^= h >> 33;
+					const double u = ((double)(h >> 11) + 0.5) / 9007199254740992.0; // (0,1)
+					const double w = 1.0 / (double)(std::min(p.effectiveLatency(),1000U) + 10U);
+					const double score = -w / log(u);
+					if (score > bestScore) {
+						bestScore = score;
+						best = i;
+					}
+				}
+			} else break;
+		}
+
+		if (best != ZT_MAX_PEER_NETWORK_PATHS)
+			return _paths[best].p;
+	}
+
+	return getBestPath(now,false);
+}
+
+bool Peer::doFastFailover(void *tPtr,const int64_t now,const unsigned int interval,const unsigned int maxMissedProbes)
+{
+	_FrameState *const f = _frameState();
+	if ((now - _lastFrameSent) >= ZT_FAST_FAILOVER_ACTIVE_TIMEOUT) {
+		f->ffPath.zero();
+		f->ffLastProbe = 0;
+		f->ffMissed = 0;
+		return false;
+	}
+
+	const SharedPtr<Path> p(getBestPath(now,false));
+	if (p != f->ffPath) {
+		f->ffPath = p;
+		f->ffLastProbe = 0;
+		f->ffMissed = 0;
+	}
+	if (!p)
+		return true; // relaying, nothing to watch
+
+	// Anything at all coming back answers the last probe, so a path that is
+	// carrying traffic in both directions is never probed.
+	if (f->ffLastProbe) {
+		if (p->lastIn() >= f->ffLastProbe)
+			f->ffMissed = 0;
+		else ++f->ffMissed;
+		f->ffLastProbe = 0;
+	}
+
+	if (f->ffMissed >= maxMissedProbes) {
+		// The next send picks the next best path or goes via upstream
+		p->fail(now);
+		invalidateBestPath();
+		f->ffPath.zero();
+		f->ffMissed = 0;
+	} else if ((now - p->lastIn()) >= (int64_t)interval) {
+		attemptToContactAt(tPtr,p->localSocket(),p->address(),now,false);
+		f->ffLastProbe = now;
+	}
+
+	return true;
 }
 
 void Peer::introduce(void *const tPtr,const int64_t now,const SharedPtr<Peer> &other) const
@@ -282,7 +519,7 @@ void Peer::introduce(void *const tPtr,const int64_t now,const SharedPtr<Peer> &o
 		if (_paths[i].p) {
 			const long q = _paths[i].p->quality(now) / _paths[i].priority;
 			const unsigned int s = (unsigned int)_paths[i].p->ipScope();
-			switch(_paths[i].p->address().ss_family) {
+			switch(_paths[i].p->addressFamily()) {
 				case AF_INET:
 					if (q <= myBestV4QualityByScope[s]) {
 						myBestV4QualityByScope[s] = q;
@@ -305,7 +542,7 @@ void Peer::introduce(void *const tPtr,const int64_t now,const SharedPtr<Peer> &o
 		if (other->_paths[i].p) {
 			const long q = other->_paths[i].p->quality(now) / other->_paths[i].priority;
 			const unsigned int s = (unsigned int)other->_paths[i].p->ipScope();
-			switch(other->_paths[i].p->address().ss_family) {
+			switch(other->_paths[i].p->addressFamily()) {
 				case AF_INET:
 					if (q <= theirBestV4QualityByScope[s]) {
 						theirBestV4QualityByScope[s] = q;
@@ -347,7 +584,7 @@ void Peer::introduce(void *const tPtr,const int64_t now,const SharedPtr<Peer> &o
 				outp.append((uint8_t)0);
 				other->_id.address().appendTo(outp);
 				outp.append((uint16_t)other->_paths[theirs].p->address().port());
-				if (other->_paths[theirs].p->address().ss_family == AF_INET6) {
+				if (other->_paths[theirs].p->addressFamily() == AF_INET6) {
 					outp.append((uint8_t)16);
 					outp.append(other->_paths[theirs].p->address().rawIpData(),16);
 				} else {
@@ -361,7 +598,7 @@ void Peer::introduce(void *const tPtr,const int64_t now,const SharedPtr<Peer> &o
 				outp.append((uint8_t)0);
 				_id.address().appendTo(outp);
 				outp.append((uint16_t)_paths[mine].p->address().port());
-				if (_paths[mine].p->address().ss_family == AF_INET6) {
+				if (_paths[mine].p->addressFamily() == AF_INET6) {
 					outp.append((uint8_t)16);
 					outp.append(_paths[mine].p->address().rawIpData(),16);
 				} else {
@@ -376,7 +613,7 @@ void Peer::introduce(void *const tPtr,const int64_t now,const SharedPtr<Peer> &o
 	}
 }
 
-void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now)
+uint64_t Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now)
 {
 	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_HELLO);
 
@@ -388,28 +625,13 @@ void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atA
 	RR->identity.serialize(outp,false);
 	atAddress.serialize(outp);
 
-	outp.append((uint64_t)RR->topology->planetWorldId());
-	outp.append((uint64_t)RR->topology->planetWorldTimestamp());
-
-	const unsigned int startCryptedPortionAt = outp.size();
-
-	std::vector<World> moons(RR->topology->moons());
-	std::vector<uint64_t> moonsWanted(RR->topology->moonsWanted());
-	outp.append((uint16_t)(moons.size() + moonsWanted.size()));
-	for(std::vector<World>::const_iterator m(moons.begin());m!=moons.end();++m) {
-		outp.append((uint8_t)m->type());
-		outp.append((uint64_t)m->id());
-		outp.append((uint64_t)m->timestamp());
-	}
-	for(std::vector<uint64_t>::const_iterator m(moonsWanted.begin());m!=moonsWanted.end();++m) {
-		outp.append((uint8_t)World::TYPE_MOON);
-		outp.append(*m);
-		outp.append((uint64_t)0);
-	}
+	const unsigned int startCryptedPortionAt = RR->topology->appendHelloWorlds(outp);
+	outp.append((uint8_t)(AES::accelerated() ? ZT_PROTO_HELLO_FLAG_AES256_GCM : 0));
 
 	outp.cryptField(_key,startCryptedPortionAt,outp.size() - startCryptedPortionAt);
 
-	RR->node->expectReplyTo(outp.packetId());
+	const uint64_t packetId = outp.packetId();
+	RR->node->expectReplyTo(packetId);
 
 	if (atAddress) {
 		outp.armor(_key,false); // false == don't encrypt full payload, but add MAC
@@ -417,17 +639,21 @@ void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atA
 	} else {
 		RR->sw->send(tPtr,outp,false); // false == don't encrypt full payload, but add MAC
 	}
+
+	return packetId;
 }
 
-void Peer::attemptToContactAt(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now,bool sendFullHello)
+uint64_t Peer::attemptToContactAt(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now,bool sendFullHello)
 {
 	if ( (!sendFullHello) && (_vProto >= 5) && (!((_vMajor == 1)&&(_vMinor == 1)&&(_vRevision == 0))) ) {
 		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
-		RR->node->expectReplyTo(outp.packetId());
+		const uint64_t packetId = outp.packetId();
+		RR->node->expectReplyTo(packetId);
 		outp.armor(_key,true);
 		RR->node->putPacket(tPtr,localSocket,atAddress,outp.data(),outp.size());
+		return packetId;
 	} else {
-		sendHELLO(tPtr,localSocket,atAddress,now);
+		return sendHELLO(tPtr,localSocket,atAddress,now);
 	}
 }
 
@@ -447,9 +673,21 @@ unsigned int Peer::doPingAndKeepalive(void *tPtr,int64_t now)
 
 	Mutex::Lock _l(_paths_m);
 
-	const bool sendFullHello = ((now - _lastSentFullHello) >= ZT_PEER_PING_PERIOD);
+	// Idle peers in adaptive keepalive mode send each path a HELLO on its own
+	// learned schedule instead of heartbeats and a periodic HELLO to all paths
+	const bool adaptive = _keepaliveAdaptive(now);
+	const bool sendFullHello = ((!adaptive)&&((now - _lastSentFullHello) >= ZT_PEER_PING_PERIOD));
 	_lastSentFullHello = now;
 
+	// Bonded paths get a HELLO every ZT_MULTIPATH_HEARTBEAT_PERIOD since OK(HELLO)
+	// is what measures latency and a dead path must drop out of the bond quickly.
+	// ECHO can't be used here since replies to it are rate limited per peer.
+	bool multipathHeartbeat = false;
+	if ((_multipathMode != ZT_MULTIPATH_NONE)&&((now - _lastMultipathHeartbeat) >= ZT_MULTIPATH_HEARTBEAT_PERIOD)) {
+		_lastMultipathHeartbeat = now;
+		multipathHeartbeat = true;
+	}
+
 	// Right now we only keep pinging links that have the maximum priority. The
 	// priority is used to track cluster redirections, meaning that when a cluster
 	// redirects us its redirect target links override all other links and we
@@ -461,22 +699,67 @@ unsigned int Peer::doPingAndKeepalive(void *tPtr,int64_t now)
 		else break;
 	}
 
+	// Paths carrying frames are probed too while paths are paced, since lost probes are what sets a path's pace
+	const bool paceProbe = ((RR->node)&&(RR->node->pathPacing())&&((now - _lastFrameSent) < ZT_PEER_PING_PERIOD));
+
+	bool echoSent = false;
 	unsigned int j = 0;
 	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
 		if (_paths[i].p) {
 			// Clean expired and reduced priority paths
 			if ( ((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION) && (_paths[i].priority == maxPriority) ) {
-				if ((sendFullHello)||(_paths[i].p->needsHeartbeat(now))) {
-					attemptToContactAt(tPtr,_paths[i].p->localSocket(),_paths[i].p->address(),now,sendFullHello);
+				const int64_t idle = now - _paths[i].p->lastOut();
+				if ((sendFullHello)||(multipathHeartbeat)||(paceProbe)||(idle >= ((adaptive) ? (int64_t)_paths[i].p->keepaliveInterval() : (int64_t)ZT_PATH_HEARTBEAT_PERIOD))) {
+					const bool hello = ((sendFullHello)||(multipathHeartbeat)||(adaptive));
+					const uint64_t probeId = attemptToContactAt(tPtr,_paths[i].p->localSocket(),_paths[i].p->address(),now,hello);
+					// Replies to ECHO are rate limited per peer, so only the first is sure to be answered
+					if ((hello)||(!echoSent))
+						_paths[i].p->probeSent(probeId,now);
+					if (adaptive)
+						_paths[i].p->keepaliveSent(probeId,idle,now);
+					echoSent |= !hello;
 					_paths[i].p->sent(now);
-					sent |= (_paths[i].p->address().ss_family == AF_INET) ? 0x1 : 0x2;
+					sent |= (_paths[i].p->addressFamily() == AF_INET) ? 0x1 : 0x2;
+				} else if (adaptive) {
+					sent |= (_paths[i].p->addressFamily() == AF_INET) ? 0x1 : 0x2;
 				}
+				_paths[i].p->updateQoS(now);
 				if (i != j)
 					_paths[j] = _paths[i];
 				++j;
 			}
 		} else break;
 	}
+
+	// Probe path MTU on at most one path per check, and never alongside a
+	// heartbeat since the other side rate limits its replies to ECHO.
+	if ((!echoSent)&&(_vProto >= 5)) {
+		for(unsigned int i=0;i<j;++i) {
+			const SharedPtr<Path> &p = _paths[i].p;
+			if (!p->alive(now))
+				continue;
+			unsigned int configuredMtu = 0;
+			uint64_t trustedPathId = 0;
+			RR->topology->getOutboundPathInfo(p->address(),configuredMtu,trustedPathId);
+			if ((configuredMtu)||(trustedPathId)||(p->localSocket() == -1))
+				continue;
+			// Without don't fragment an oversized probe is fragmented and answered, so only search downward
+			const bool df = RR->node->sendsDontFragment();
+			const unsigned int probeSize = p->nextMtuProbe(now,(df) ? ZT_PATH_MTU_PROBE_MAX : ZT_DEFAULT_PHYSMTU);
+			if (probeSize) {
+				Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+				outp.append((unsigned char)0,probeSize - ZT_PACKET_IDX_PAYLOAD);
+				RR->node->expectReplyTo(outp.packetId());
+				outp.armor(_key,true);
+				p->mtuProbeSent(outp.packetId(),now);
+				if (!p->send(RR,tPtr,outp.data(),outp.size(),now,0,(df) ? ZT_WIRE_PACKET_DONT_FRAGMENT : 0))
+					p->mtuProbeFailed();
+				break;
+			}
+		}
+	}
+
+	_invalidateBestPath(); // paths were dropped and probe losses counted
 	while(j < ZT_MAX_PEER_NETWORK_PATHS) {
 		_paths[j].lr = 0;
 		_paths[j].p.zero();
@@ -487,6 +770,27 @@ unsigned int Peer::doPingAndKeepalive(void *tPtr,int64_t now)
 	return sent;
 }
 
+int64_t Peer::nextPingTime(const int64_t now)
+{
+	const bool adaptive = _keepaliveAdaptive(now);
+	Mutex::Lock _l(_paths_m);
+	int64_t t = (adaptive) ? (now + ZT_PATH_KEEPALIVE_MAX) : (_lastSentFullHello + ZT_PEER_PING_PERIOD);
+	if (_multipathMode != ZT_MULTIPATH_NONE)
+		t = std::min(t,_lastMultipathHeartbeat + ZT_MULTIPATH_HEARTBEAT_PERIOD);
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		if (!_paths[i].p) break;
+		t = std::min(t,_paths[i].p->lastOut() + ((adaptive) ? (int64_t)_paths[i].p->keepaliveInterval() : (int64_t)ZT_PATH_HEARTBEAT_PERIOD));
+		if ((_vProto >= 5)&&(_paths[i].p->alive(now))) {
+			unsigned int configuredMtu = 0;
+			uint64_t trustedPathId = 0;
+			RR->topology->getOutboundPathInfo(_paths[i].p->address(),configuredMtu,trustedPathId);
+			if ((!configuredMtu)&&(!trustedPathId))
+				t = std::min(t,_paths[i].p->nextMtuProbeTime(now));
+		}
+	}
+	return t;
+}
+
 void Peer::clusterRedirect(void *tPtr,const SharedPtr<Path> &originatingPath,const InetAddress &remoteAddress,const int64_t now)
 {
 	SharedPtr<Path> np(RR->topology->getPath(originatingPath->localSocket(),remoteAddress));
@@ -525,6 +829,7 @@ void Peer::clusterRedirect(void *tPtr,const SharedPtr<Path> &originatingPath,con
 			_paths[j].lr = now;
 			_paths[j].p = np;
 			_paths[j].priority = newPriority;
+			ZT_PROBE2(peer__path__redirected,_id.address().toInt(),newPriority);
 			++j;
 			while (j < ZT_MAX_PEER_NETWORK_PATHS) {
 				_paths[j].lr = 0;
@@ -533,6 +838,7 @@ void Peer::clusterRedirect(void *tPtr,const SharedPtr<Path> &originatingPath,con
 				++j;
 			}
 		}
+		_invalidateBestPath();
 	}
 }
 
@@ -541,13 +847,54 @@ void Peer::resetWithinScope(void *tPtr,InetAddress::IpScope scope,int inetAddres
 	Mutex::Lock _l(_paths_m);
 	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
 		if (_paths[i].p) {
-			if ((_paths[i].p->address().ss_family == inetAddressFamily)&&(_paths[i].p->ipScope() == scope)) {
+			if ((_paths[i].p->addressFamily() == inetAddressFamily)&&(_paths[i].p->ipScope() == scope)) {
 				attemptToContactAt(tPtr,_paths[i].p->localSocket(),_paths[i].p->address(),now,false);
 				_paths[i].p->sent(now);
 				_paths[i].lr = 0; // path will not be used unless it speaks again
 			}
 		} else break;
 	}
+	_invalidateBestPath();
+}
+
+// The sealing key is bound to this peer's identity so an entry can't be
+// moved to another peer, and the cache key itself to our own identity.
+static void _peerKeySealingKey(const uint8_t *cacheKey,const Identity &id,const uint8_t *nonce,uint8_t polyKey[32],Salsa20 &s20)
+{
+	uint8_t k[64];
+	uint8_t tmp[32 + ZT_C25519_PUBLIC_KEY_LEN];
+	ZT_FAST_MEMCPY(tmp,cacheKey,32);
+	ZT_FAST_MEMCPY(tmp + 32,id.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+	SHA512::hash(k,tmp,sizeof(tmp));
+	s20.init(k,nonce);
+	memset(polyKey,0,32);
+	s20.crypt12(polyKey,polyKey,32);
+	Utils::burn(k,sizeof(k));
+}
+
+void Peer::_sealKey(const uint8_t *cacheKey,const Identity &id,const uint8_t *key,uint8_t *sealed)
+{
+	Salsa20 s20;
+	uint8_t polyKey[32],mac[16];
+	Utils::getSecureRandom(sealed,8);
+	_peerKeySealingKey(cacheKey,id,sealed,polyKey,s20);
+	s20.crypt12(key,sealed + 8,ZT_PEER_SECRET_KEY_LENGTH);
+	Poly1305::compute(mac,sealed + 8,ZT_PEER_SECRET_KEY_LENGTH,polyKey);
+	ZT_FAST_MEMCPY(sealed + 8 + ZT_PEER_SECRET_KEY_LENGTH,mac,16);
+	Utils::burn(polyKey,sizeof(polyKey));
+}
+
+bool Peer::_unsealKey(const uint8_t *cacheKey,const Identity &id,const uint8_t *sealed,uint8_t *key)
+{
+	Salsa20 s20;
+	uint8_t polyKey[32],mac[16];
+	_peerKeySealingKey(cacheKey,id,sealed,polyKey,s20);
+	Poly1305::compute(mac,sealed + 8,ZT_PEER_SECRET_KEY_LENGTH,polyKey);
+	Utils::burn(polyKey,sizeof(polyKey));
+	if (!Utils::secureEq(mac,sealed + 8 + ZT_PEER_SECRET_KEY_LENGTH,16))
+		return false;
+	s20.crypt12(sealed + 8,key,ZT_PEER_SECRET_KEY_LENGTH);
+	return true;
 }
 
 } // namespace ZeroTier
@@ -35,6 +35,7 @@
 #include <utility>
 #include <vector>
 #include <stdexcept>
+#include <atomic>
 
 #include "../include/ZeroTierOne.h"
 
@@ -45,13 +46,23 @@
 #include "Identity.hpp"
 #include "InetAddress.hpp"
 #include "Packet.hpp"
+#include "AES.hpp"
 #include "SharedPtr.hpp"
 #include "AtomicCounter.hpp"
 #include "Hashtable.hpp"
 #include "Mutex.hpp"
+#include "ObjectPool.hpp"
+#include "Epoch.hpp"
 
 #define ZT_PEER_MAX_SERIALIZED_STATE_SIZE (sizeof(Peer) + 32 + (sizeof(Path) * 2))
 
+// Agreed key sealed in local peer cache: 8-byte nonce, encrypted key, 16-byte MAC
+#define ZT_PEER_CACHED_KEY_TYPE_SEALED 1
+#define ZT_PEER_CACHED_KEY_SEALED_SIZE (8 + ZT_PEER_SECRET_KEY_LENGTH + 16)
+
+// Largest cache entry with one path: version, identity, versions, path count, path, key type, sealed key
+#define ZT_PEER_COLD_RECORD_SIZE (1 + (ZT_ADDRESS_LENGTH + 1 + ZT_C25519_PUBLIC_KEY_LEN + 1) + 8 + 2 + 19 + 1 + ZT_PEER_CACHED_KEY_SEALED_SIZE)
+
 namespace ZeroTier {
 
 /**
@@ -65,7 +76,11 @@ private:
 	Peer() {} // disabled to prevent bugs -- should not be constructed uninitialized
 
 public:
-	~Peer() { Utils::burn(_key,sizeof(_key)); }
+	~Peer()
+	{
+		Utils::burn(_key,sizeof(_key));
+		delete _frames.load();
+	}
 
 	/**
 	 * Construct a new peer
@@ -73,9 +88,14 @@ public:
 	 * @param renv Runtime environment
 	 * @param myIdentity Identity of THIS node (for key agreement)
 	 * @param peerIdentity Identity of peer
+	 * @param key Previously agreed key with this peer or NULL to perform key agreement
 	 * @throws std::runtime_error Key agreement with peer's identity failed
 	 */
-	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity);
+	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity,const uint8_t *key = (const uint8_t *)0);
+
+	// Peers come from their own slabs, see ObjectPool
+	static inline void *operator new(std::size_t size) { return ObjectPool<Peer>::allocate(size); }
+	static inline void operator delete(void *p,std::size_t size) { ObjectPool<Peer>::release(p,size); }
 
 	/**
 	 * @return This peer's ZT address (short for identity().address())
@@ -145,7 +165,8 @@ public:
 	 */
 	inline bool sendDirect(void *tPtr,const void *data,unsigned int len,int64_t now,bool force)
 	{
-		SharedPtr<Path> bp(getBestPath(now,force));
+		const Epoch::Guard g;
+		Path *const bp = getBestPath(g,now,force);
 		if (bp)
 			return bp->send(RR,tPtr,data,len,now);
 		return false;
@@ -154,12 +175,96 @@ public:
 	/**
 	 * Get the best current direct path
 	 *
+	 * Unless includeExpired is true the choice is cached, so most calls are a
+	 * lock-free read that doesn't look at the paths at all.
+	 *
 	 * @param now Current time
 	 * @param includeExpired If true, include even expired paths
 	 * @return Best current path or NULL if none
 	 */
 	SharedPtr<Path> getBestPath(int64_t now,bool includeExpired) const;
 
+	/**
+	 * Get the best current direct path without taking a reference to it
+	 *
+	 * Paths all come from Topology, which retires them through Epoch, so the
+	 * result stays valid until the guard is released. Use the SharedPtr
+	 * version if the path is kept or handed to anything that might keep it.
+	 *
+	 * @param g Read side critical section that must outlive any use of the result
+	 * @param now Current time
+	 * @param includeExpired If true, include even expired paths
+	 * @return Best current path or NULL if none
+	 */
+	Path *getBestPath(const Epoch::Guard &g,int64_t now,bool includeExpired) const;
+
+	/**
+	 * Drop the cached best path, e.g. after a path's latency or state changed
+	 */
+	inline void invalidateBestPath()
+	{
+		Mutex::Lock _l(_paths_m);
+		_invalidateBestPath();
+	}
+
+	/**
+	 * Get the path to send a packet over according to this peer's multipath mode
+	 *
+	 * In flow hash mode packets with the same non-zero flow ID always pick the
+	 * same path while it stays alive. In balance mode every call may pick a
+	 * different one. Either way paths are weighted by latency. This falls back
+	 * to getBestPath() if multipath is off or no path is currently alive.
+	 *
+	 * @param now Current time
+	 * @param flowId Flow ID or 0 if packet isn't part of a flow
+	 * @return Path or NULL if none
+	 */
+	SharedPtr<Path> getMultipathPath(int64_t now,uint64_t flowId);
+
+	/**
+	 * Note that a frame was sent to this peer
+	 *
+	 * @param now Current time
+	 */
+	inline void frameSent(const int64_t now) { _lastFrameSent = now; }
+
+	/**
+	 * @return True if this peer wasn't being watched for fast failover and now should be
+	 */
+	inline bool fastFailoverWatched() { return ((!_ffActive.load(std::memory_order_relaxed))&&(!_ffActive.exchange(true))); }
+
+	/**
+	 * Note that this peer was taken off the fast failover watch list
+	 */
+	inline void fastFailoverUnwatched() { _ffActive.store(false); }
+
+	/**
+	 * Probe the path traffic to this peer is using and fail it over if it stops answering
+	 *
+	 * This is called every fast failover interval for peers that frameSent()
+	 * added to the watch list. A probe is only sent if nothing was received over
+	 * the path in the last interval, and after maxMissedProbes unanswered probes
+	 * in a row the path is declared down so the next best path or a relay takes
+	 * over until it answers again.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @param interval Probe interval in milliseconds
+	 * @param maxMissedProbes Unanswered probes before the path is declared down
+	 * @return False if no traffic was sent recently and the peer can stop being watched
+	 */
+	bool doFastFailover(void *tPtr,const int64_t now,const unsigned int interval,const unsigned int maxMissedProbes);
+
+	/**
+	 * @param mode New multipath mode (ZT_MultipathMode)
+	 */
+	inline void setMultipathMode(const int mode) { _multipathMode = mode; }
+
+	/**
+	 * @return Multipath mode (ZT_MultipathMode)
+	 */
+	inline int multipathMode() const { return _multipathMode; }
+
 	/**
 	 * Send VERB_RENDEZVOUS to this and another peer via the best common IP scope and path
 	 */
@@ -174,8 +279,9 @@ public:
 	 * @param localSocket Local source socket
 	 * @param atAddress Destination address
 	 * @param now Current time
+	 * @return Packet ID of HELLO
 	 */
-	void sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now);
+	uint64_t sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now);
 
 	/**
 	 * Send ECHO (or HELLO for older peers) to this peer at the given address
@@ -187,8 +293,9 @@ public:
 	 * @param atAddress Destination address
 	 * @param now Current time
 	 * @param sendFullHello If true, always send a full HELLO instead of just an ECHO
+	 * @return Packet ID of HELLO or ECHO
 	 */
-	void attemptToContactAt(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now,bool sendFullHello);
+	uint64_t attemptToContactAt(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now,bool sendFullHello);
 
 	/**
 	 * Try a memorized or statically defined path if any are known
@@ -208,10 +315,21 @@ public:
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param now Current time
 	 * @param inetAddressFamily Keep this address family alive, or -1 for any
-	 * @return 0 if nothing sent or bit mask: bit 0x1 if IPv4 sent, bit 0x2 if IPv6 sent (0x3 means both sent)
+	 * @return 0 if nothing sent or bit mask: bit 0x1 if IPv4 sent, bit 0x2 if IPv6 sent (0x3 means both sent), in adaptive keepalive mode also set for paths kept alive on their own schedule
 	 */
 	unsigned int doPingAndKeepalive(void *tPtr,int64_t now);
 
+	/**
+	 * @param now Current time
+	 * @return Earliest time at which doPingAndKeepalive() will have something to send
+	 */
+	int64_t nextPingTime(const int64_t now);
+
+	/**
+	 * Note that this peer was dropped from Node's ping schedule after going quiet
+	 */
+	inline void pingUnscheduled() { _pingScheduled.store(false); }
+
 	/**
 	 * Process a cluster redirect sent by this peer
 	 *
@@ -257,6 +375,25 @@ public:
 	 */
 	inline int64_t lastReceive() const { return _lastReceive; }
 
+	/**
+	 * Carry over when this peer was last heard from by a previous process
+	 *
+	 * This is only for peers restored from a state snapshot, which would
+	 * otherwise look long dead until they are heard from again.
+	 *
+	 * @param t Time peer was last heard from
+	 */
+	inline void restoreLastReceive(const int64_t t)
+	{
+		if (t > _lastReceive)
+			_lastReceive = t;
+	}
+
+	/**
+	 * @return Time a new direct path to this peer was last confirmed, or 0 if never
+	 */
+	inline int64_t lastLearnedPath() const { return _lastLearnedPath; }
+
 	/**
 	 * @return True if we've heard from this peer in less than ZT_PEER_ACTIVITY_TIMEOUT
 	 */
@@ -272,7 +409,8 @@ public:
 	 */
 	inline unsigned int latency(const int64_t now) const
 	{
-		SharedPtr<Path> bp(getBestPath(now,false));
+		const Epoch::Guard g;
+		Path *const bp = getBestPath(g,now,false);
 		if (bp)
 			return bp->latency();
 		return 0xffff;
@@ -300,6 +438,97 @@ public:
 		return (l * (((unsigned int)tsr / (ZT_PEER_PING_PERIOD + 1000)) + 1));
 	}
 
+	/**
+	 * Record a VERB_RELAY_OFFER from this peer
+	 *
+	 * @param now Current time
+	 * @param capacity Relay capacity in bytes per second or 0 if withdrawn
+	 * @param load Bytes per second this peer is currently relaying
+	 */
+	inline void relayOffered(const int64_t now,const uint64_t capacity,const uint64_t load)
+	{
+		_relayCapacity = capacity;
+		_relayLoad = load;
+		_lastRelayOffer = now;
+	}
+
+	/**
+	 * Score this peer as a relay to peers we have no direct path to
+	 *
+	 * This is relayQuality() scaled up by how much of the peer's offered
+	 * capacity is in use, so load spreads over relays of similar latency.
+	 *
+	 * @return Score, lower is better, or max unsigned int if this peer has no usable relay offer
+	 */
+	inline unsigned int relayOfferScore(const int64_t now) const
+	{
+		const uint64_t capacity = _relayCapacity;
+		const uint64_t load = _relayLoad;
+		if (((now - _lastRelayOffer) >= ZT_RELAY_OFFER_TIMEOUT)||(capacity < 100)||((_relayFailed)&&((now - _relayFailed) < ZT_RELAY_OFFER_TIMEOUT)))
+			return (~(unsigned int)0);
+		const uint64_t percent = load / (capacity / 100);
+		if (percent >= ZT_RELAY_MAX_LOAD_PERCENT)
+			return (~(unsigned int)0);
+		const uint64_t q = relayQuality(now);
+		if (q == (uint64_t)(~(unsigned int)0))
+			return (~(unsigned int)0);
+		return (unsigned int)std::min((uint64_t)((q * 100) / (100 - percent)),(uint64_t)((~(unsigned int)0) - 1));
+	}
+
+	/**
+	 * Stop using this peer as a relay after something sent through it went unanswered
+	 *
+	 * Its offers are ignored for ZT_RELAY_OFFER_TIMEOUT.
+	 *
+	 * @param now Current time
+	 */
+	inline void relayFailed(const int64_t now) { _relayFailed = now; }
+
+	/**
+	 * Note a packet sent to this peer through a peer that offered to relay
+	 *
+	 * @param now Current time
+	 */
+	inline void sentViaRelay(const int64_t now)
+	{
+		// A new run of relayed sends starts after a reply or a pause in sending
+		if ((!_relaySendsSince)||(_lastReceive >= _relaySendsSince)||((now - _lastSentViaRelay) >= ZT_RELAY_REPLY_TIMEOUT))
+			_relaySendsSince = now;
+		_lastSentViaRelay = now;
+	}
+
+	/**
+	 * Check whether packets to this peer are disappearing into a relay
+	 *
+	 * This is true once if we've kept sending through a relay for
+	 * ZT_RELAY_REPLY_TIMEOUT and nothing at all has come back from this peer.
+	 *
+	 * @param now Current time
+	 * @return True if the relay should be dropped in favor of an upstream
+	 */
+	inline bool relayWentSilent(const int64_t now)
+	{
+		const int64_t since = _relaySendsSince;
+		if ((since)&&(_lastReceive < since)&&((now - since) >= ZT_RELAY_REPLY_TIMEOUT)&&((now - _lastSentViaRelay) < ZT_RELAY_REPLY_TIMEOUT)) {
+			_relaySendsSince = 0;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Note that we sent this peer a VERB_RELAY_OFFER
+	 *
+	 * @param now Current time
+	 */
+	inline void relayOfferSent(const int64_t now) { _lastRelayOfferSent = now; }
+
+	/**
+	 * @param now Current time
+	 * @return True if this peer holds a current relay offer from us, so we'll relay for and to it
+	 */
+	inline bool holdsRelayOffer(const int64_t now) const { return ((_lastRelayOfferSent)&&((now - _lastRelayOfferSent) < ZT_RELAY_OFFER_TIMEOUT)); }
+
 	/**
 	 * @return 256-bit secret symmetric encryption key
 	 */
@@ -328,6 +557,150 @@ public:
 
 	inline bool remoteVersionKnown() const { return ((_vMajor > 0)||(_vMinor > 0)||(_vRevision > 0)); }
 
+	/**
+	 * @param flags Flags from this peer's last HELLO or OK(HELLO) (ZT_PROTO_HELLO_FLAG_*)
+	 */
+	inline void setRemoteHelloFlags(const unsigned int flags) { _remoteHelloFlags = (uint8_t)flags; }
+
+	/**
+	 * @return Cipher for the AES-256-GCM suite or NULL if it isn't offered
+	 */
+	inline const AES *aes() const { return (_aesReady) ? &_aes : (const AES *)0; }
+
+	/**
+	 * @return True if both sides support the AES-256-GCM cipher suite and it should be used to send
+	 */
+	inline bool aesGcm() const { return (((_remoteHelloFlags & ZT_PROTO_HELLO_FLAG_AES256_GCM) != 0)&&(_aesReady)); }
+
+	/**
+	 * Compress a frame to this peer unless recent frames have not benefited
+	 *
+	 * Most traffic is already encrypted end to end and does not compress.
+	 * After ZT_PEER_COMPRESSION_FAILURE_THRESHOLD consecutive failures we
+	 * send frames uncompressed for a while and then re-probe, doubling the
+	 * back-off for each failed probe up to ZT_PEER_COMPRESSION_BACKOFF_MAX.
+	 * Any successful compression resets this.
+	 *
+	 * @param outp Packet to compress if worthwhile
+	 * @return True if packet was compressed
+	 */
+	inline bool compressFrame(Packet &outp)
+	{
+		if (compressionBackedOff())
+			return false;
+		return attemptFrameCompression(outp);
+	}
+
+	/**
+	 * Check and count down compression back-off for the next frame
+	 *
+	 * @return True if the next frame should not be compressed
+	 */
+	inline bool compressionBackedOff()
+	{
+		_FrameState *const f = _frames.load(std::memory_order_acquire);
+		if (!f)
+			return false;
+		unsigned int skip = f->compressSkip.load(std::memory_order_relaxed);
+		while (skip) {
+			if (f->compressSkip.compare_exchange_weak(skip,skip - 1,std::memory_order_relaxed)) {
+				f->compressSkipped.fetch_add(1,std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Compress a frame regardless of back-off and record the result
+	 *
+	 * @param outp Packet to compress
+	 * @return True if packet was compressed
+	 */
+	bool attemptFrameCompression(Packet &outp);
+
+	/**
+	 * Get adaptive frame compression counters for this peer
+	 *
+	 * These are updated atomically but read independently, so a snapshot
+	 * taken while frames are being sent may be slightly inconsistent.
+	 *
+	 * @param attempts Set to number of frames LZ4 was run on
+	 * @param successes Set to number of frames that came out smaller
+	 * @param skipped Set to number of frames not attempted due to back-off
+	 * @param bytesSaved Set to total bytes saved by compression
+	 */
+	inline void compressionStats(uint64_t &attempts,uint64_t &successes,uint64_t &skipped,uint64_t &bytesSaved) const
+	{
+		const _FrameState *const f = _frames.load(std::memory_order_acquire);
+		if (f) {
+			attempts = f->compressAttempts.load(std::memory_order_relaxed);
+			successes = f->compressSuccesses.load(std::memory_order_relaxed);
+			skipped = f->compressSkipped.load(std::memory_order_relaxed);
+			bytesSaved = f->compressBytesSaved.load(std::memory_order_relaxed);
+		} else {
+			attempts = 0;
+			successes = 0;
+			skipped = 0;
+			bytesSaved = 0;
+		}
+	}
+
+	/**
+	 * Count an authenticated packet received from this peer
+	 *
+	 * @param len Packet length before decompression
+	 * @param hops Hops the packet took, nonzero if it came via a relay
+	 */
+	inline void countReceived(const unsigned int len,const unsigned int hops)
+	{
+		_packetsIn.fetch_add(1,std::memory_order_relaxed);
+		_bytesIn.fetch_add(len,std::memory_order_relaxed);
+		if (hops)
+			_relayedIn.fetch_add(1,std::memory_order_relaxed);
+	}
+
+	/**
+	 * Count a packet sent to this peer through Switch
+	 *
+	 * @param len Packet length including any fragments
+	 * @param relayed True if sent via an upstream relay rather than a direct path
+	 */
+	inline void countSent(const unsigned int len,const bool relayed)
+	{
+		_packetsOut.fetch_add(1,std::memory_order_relaxed);
+		_bytesOut.fetch_add(len,std::memory_order_relaxed);
+		if (relayed)
+			_relayedOut.fetch_add(1,std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get traffic counters for this peer
+	 *
+	 * These are updated with relaxed atomics and are therefore approximate.
+	 *
+	 * @param packetsIn Set to authenticated packets received
+	 * @param bytesIn Set to bytes of authenticated packets received
+	 * @param relayedIn Set to packets received via a relay
+	 * @param packetsOut Set to packets sent
+	 * @param bytesOut Set to bytes sent
+	 * @param relayedOut Set to packets sent via a relay
+	 */
+	inline void traffic(uint64_t &packetsIn,uint64_t &bytesIn,uint64_t &relayedIn,uint64_t &packetsOut,uint64_t &bytesOut,uint64_t &relayedOut) const
+	{
+		packetsIn = _packetsIn.load(std::memory_order_relaxed);
+		bytesIn = _bytesIn.load(std::memory_order_relaxed);
+		relayedIn = _relayedIn.load(std::memory_order_relaxed);
+		packetsOut = _packetsOut.load(std::memory_order_relaxed);
+		bytesOut = _bytesOut.load(std::memory_order_relaxed);
+		relayedOut = _relayedOut.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * @return Bytes of heap memory held by this peer beyond sizeof(Peer), not counting shared paths
+	 */
+	inline unsigned long heapBytes() const { return (_frames.load(std::memory_order_relaxed)) ? (unsigned long)sizeof(_FrameState) : 0; }
+
 	/**
 	 * @return True if peer has received a trust established packet (e.g. common network membership) in the past ZT_TRUST_EXPIRATION ms
 	 */
@@ -381,12 +754,24 @@ public:
 		return false;
 	}
 
+	/**
+	 * Rate limit gate for announcing this peer to other root cluster members
+	 */
+	inline bool rateGateClusterAnnounce(const int64_t now)
+	{
+		if ((now - _lastClusterAnnounce) >= ZT_CLUSTER_HAVE_PEER_PERIOD) {
+			_lastClusterAnnounce = now;
+			return true;
+		}
+		return false;
+	}
+
 	/**
 	 * Rate limit gate for inbound ECHO requests
 	 */
 	inline bool rateGateEchoRequest(const int64_t now)
 	{
-		if ((now - _lastEchoRequestReceived) >= ZT_PEER_GENERAL_RATE_LIMIT) {
+		if ((now - _lastEchoRequestReceived) >= ZT_PEER_ECHO_RATE_LIMIT) {
 			_lastEchoRequestReceived = now;
 			return true;
 		}
@@ -421,9 +806,15 @@ public:
 	 * Serialize a peer for storage in local cache
 	 *
 	 * This does not serialize everything, just non-ephemeral information.
+	 * If a cache key is supplied the agreed key is appended sealed with it
+	 * so that deserializeFromCache() can skip key agreement.
+	 *
+	 * @param b Buffer to append to
+	 * @param cacheKey 32-byte key for sealing agreed key or NULL to omit it
+	 * @param maxPaths Most paths to include, the most recently heard from first if this leaves any out
 	 */
 	template<unsigned int C>
-	inline void serializeForCache(Buffer<C> &b) const
+	inline void serializeForCache(Buffer<C> &b,const uint8_t *cacheKey = (const uint8_t *)0,const unsigned int maxPaths = ZT_MAX_PEER_NETWORK_PATHS) const
 	{
 		b.append((uint8_t)1);
 
@@ -442,14 +833,48 @@ public:
 					++pc;
 				else break;
 			}
-			b.append((uint16_t)pc);
-			for(unsigned int i=0;i<pc;++i)
-				_paths[i].p->address().serialize(b);
+			if (pc > maxPaths) {
+				bool used[ZT_MAX_PEER_NETWORK_PATHS];
+				memset(used,0,sizeof(used));
+				b.append((uint16_t)maxPaths);
+				for(unsigned int k=0;k<maxPaths;++k) {
+					unsigned int latest = 0;
+					while (used[latest])
+						++latest;
+					for(unsigned int i=latest+1;i<pc;++i) {
+						if ((!used[i])&&(_paths[i].p->lastIn() > _paths[latest].p->lastIn()))
+							latest = i;
+					}
+					used[latest] = true;
+					_paths[latest].p->address().serialize(b);
+				}
+			} else {
+				b.append((uint16_t)pc);
+				for(unsigned int i=0;i<pc;++i)
+					_paths[i].p->address().serialize(b);
+			}
+		}
+
+		// Older versions stop reading after paths, so the sealed key follows them
+		if (cacheKey) {
+			b.append((uint8_t)ZT_PEER_CACHED_KEY_TYPE_SEALED);
+			_sealKey(cacheKey,_id,_key,reinterpret_cast<uint8_t *>(b.appendField(ZT_PEER_CACHED_KEY_SEALED_SIZE)));
 		}
 	}
 
+	/**
+	 * Create a peer from its serialized local cache entry
+	 *
+	 * @param now Current time
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param b Buffer containing entry
+	 * @param renv Runtime environment
+	 * @param cacheKey 32-byte key the agreed key was sealed with or NULL to always agree
+	 * @param cachedKeyUsed If non-NULL, set to true if a sealed agreed key was used
+	 * @return Peer or NULL on error
+	 */
 	template<unsigned int C>
-	inline static SharedPtr<Peer> deserializeFromCache(int64_t now,void *tPtr,Buffer<C> &b,const RuntimeEnvironment *renv)
+	inline static SharedPtr<Peer> deserializeFromCache(int64_t now,void *tPtr,Buffer<C> &b,const RuntimeEnvironment *renv,const uint8_t *cacheKey = (const uint8_t *)0,bool *cachedKeyUsed = (bool *)0)
 	{
 		try {
 			unsigned int ptr = 0;
@@ -461,28 +886,49 @@ public:
 			if (!id)
 				return SharedPtr<Peer>();
 
-			SharedPtr<Peer> p(new Peer(renv,renv->identity,id));
-
-			p->_vProto = b.template at<uint16_t>(ptr); ptr += 2;
-			p->_vMajor = b.template at<uint16_t>(ptr); ptr += 2;
-			p->_vMinor = b.template at<uint16_t>(ptr); ptr += 2;
-			p->_vRevision = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vProto = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vMajor = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vMinor = b.template at<uint16_t>(ptr); ptr += 2;
+			const unsigned int vRevision = b.template at<uint16_t>(ptr); ptr += 2;
 
 			// When we deserialize from the cache we don't actually restore paths. We
 			// just try them and then re-learn them if they happen to still be up.
 			// Paths are fairly ephemeral in the real world in most cases.
-			const unsigned int tryPathCount = b.template at<uint16_t>(ptr); ptr += 2;
+			InetAddress tryPaths[ZT_MAX_PEER_NETWORK_PATHS];
+			unsigned int tryPathCount = b.template at<uint16_t>(ptr); ptr += 2;
+			bool pathsOk = (tryPathCount <= ZT_MAX_PEER_NETWORK_PATHS);
+			if (!pathsOk)
+				tryPathCount = ZT_MAX_PEER_NETWORK_PATHS;
 			for(unsigned int i=0;i<tryPathCount;++i) {
-				InetAddress inaddr;
 				try {
-					ptr += inaddr.deserialize(b,ptr);
-					if (inaddr)
-						p->attemptToContactAt(tPtr,-1,inaddr,now,true);
+					ptr += tryPaths[i].deserialize(b,ptr);
 				} catch ( ... ) {
+					tryPathCount = i;
+					pathsOk = false;
 					break;
 				}
 			}
 
+			uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+			bool haveKey = false;
+			if ((cacheKey)&&(pathsOk)&&((ptr + 1 + ZT_PEER_CACHED_KEY_SEALED_SIZE) <= b.size())&&(b[ptr] == ZT_PEER_CACHED_KEY_TYPE_SEALED))
+				haveKey = _unsealKey(cacheKey,id,reinterpret_cast<const uint8_t *>(b.field(ptr + 1,ZT_PEER_CACHED_KEY_SEALED_SIZE)),key);
+			if (cachedKeyUsed)
+				*cachedKeyUsed = haveKey;
+
+			SharedPtr<Peer> p(new Peer(renv,renv->identity,id,(haveKey) ? key : (const uint8_t *)0));
+			Utils::burn(key,sizeof(key));
+
+			p->_vProto = (uint16_t)vProto;
+			p->_vMajor = (uint16_t)vMajor;
+			p->_vMinor = (uint16_t)vMinor;
+			p->_vRevision = (uint16_t)vRevision;
+
+			for(unsigned int i=0;i<tryPathCount;++i) {
+				if (tryPaths[i])
+					p->attemptToContactAt(tPtr,-1,tryPaths[i],now,true);
+			}
+
 			return p;
 		} catch ( ... ) {
 			return SharedPtr<Peer>();
@@ -490,6 +936,23 @@ public:
 	}
 
 private:
+	// True if keepalives should follow each path's learned interval, see Node::setAdaptiveKeepalive()
+	bool _keepaliveAdaptive(const int64_t now) const;
+
+	// These must be called with _paths_m locked
+	void _cacheBestPath(const int64_t now,const unsigned int bestPath) const;
+	inline void _invalidateBestPath() const
+	{
+		const uint32_t seq = _bestPathSeq.load(std::memory_order_relaxed);
+		_bestPathSeq.store(seq + 1,std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bestPathExpires = 0;
+		_bestPathSeq.store(seq + 2,std::memory_order_release);
+	}
+
+	static void _sealKey(const uint8_t *cacheKey,const Identity &id,const uint8_t *key,uint8_t *sealed);
+	static bool _unsealKey(const uint8_t *cacheKey,const Identity &id,const uint8_t *sealed,uint8_t *key);
+
 	struct _PeerPath
 	{
 		_PeerPath() : lr(0),p(),priority(1) {}
@@ -499,27 +962,40 @@ private:
 	};
 
 	uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
+	AES _aes; // keyed with the first 256 bits of SHA512(_key)
 
 	const RuntimeEnvironment *RR;
 
 	int64_t _lastReceive; // direct or indirect
 	int64_t _lastNontrivialReceive; // frames, things like netconf, etc.
 	int64_t _lastTriedMemorizedPath;
+	int64_t _lastLearnedPath;
 	int64_t _lastDirectPathPushSent;
 	int64_t _lastDirectPathPushReceive;
 	int64_t _lastCredentialRequestSent;
 	int64_t _lastWhoisRequestReceived;
 	int64_t _lastEchoRequestReceived;
+	int64_t _lastClusterAnnounce;
 	int64_t _lastComRequestReceived;
 	int64_t _lastComRequestSent;
 	int64_t _lastCredentialsReceived;
 	int64_t _lastTrustEstablishedPacketReceived;
 	int64_t _lastSentFullHello;
+	int64_t _lastMultipathHeartbeat;
+	volatile int64_t _lastRelayOffer;
+	volatile uint64_t _relayCapacity; // from VERB_RELAY_OFFER, see relayOfferScore()
+	volatile uint64_t _relayLoad;
+	volatile int64_t _relayFailed; // last time relayFailed() was called
+	volatile int64_t _lastRelayOfferSent;
+	volatile int64_t _relaySendsSince; // start of the current run of sends to this peer via a relay, see relayWentSilent()
+	volatile int64_t _lastSentViaRelay;
 
 	uint16_t _vProto;
 	uint16_t _vMajor;
 	uint16_t _vMinor;
 	uint16_t _vRevision;
+	uint8_t _remoteHelloFlags;
+	bool _aesReady;
 
 	_PeerPath _paths[ZT_MAX_PEER_NETWORK_PATHS];
 	Mutex _paths_m;
@@ -529,6 +1005,72 @@ private:
 	unsigned int _directPathPushCutoffCount;
 	unsigned int _credentialsCutoffCount;
 
+	// State only needed once frames are sent, which most peers of a busy root
+	// never carry, so it is allocated on first use (see _frameState()).
+	struct _FrameState
+	{
+		_FrameState() :
+			compressFailures(0),
+			compressBackoff(0),
+			compressSkip(0),
+			compressAttempts(0),
+			compressSuccesses(0),
+			compressSkipped(0),
+			compressBytesSaved(0),
+			ffPath(),
+			ffLastProbe(0),
+			ffMissed(0) {}
+
+		std::atomic<unsigned int> compressFailures; // consecutive frames that did not compress
+		std::atomic<unsigned int> compressBackoff; // current back-off or 0 if none
+		std::atomic<unsigned int> compressSkip; // frames left to send before re-probing
+		std::atomic<uint64_t> compressAttempts;
+		std::atomic<uint64_t> compressSuccesses;
+		std::atomic<uint64_t> compressSkipped;
+		std::atomic<uint64_t> compressBytesSaved;
+
+		// Fast failover state, only touched by the background task thread
+		SharedPtr<Path> ffPath;
+		int64_t ffLastProbe;
+		unsigned int ffMissed;
+	};
+	inline _FrameState *_frameState()
+	{
+		_FrameState *f = _frames.load(std::memory_order_acquire);
+		if (!f) {
+			_FrameState *const nf = new _FrameState();
+			if (_frames.compare_exchange_strong(f,nf,std::memory_order_acq_rel))
+				f = nf;
+			else delete nf; // f is now the one another thread installed
+		}
+		return f;
+	}
+	std::atomic<_FrameState *> _frames;
+
+	// _ffActive is true while on Node's watch list and is cleared under that list's lock
+	volatile int64_t _lastFrameSent;
+	std::atomic<bool> _ffActive;
+
+	// True while this peer is in Node's ping timer wheel, see Node::schedulePing()
+	std::atomic<bool> _pingScheduled;
+
+	volatile int _multipathMode;
+	uint64_t _multipathCounter; // packets striped in balance mode, guarded by _paths_m
+
+	// Traffic counters, see traffic()
+	std::atomic<uint64_t> _packetsIn;
+	std::atomic<uint64_t> _bytesIn;
+	std::atomic<uint64_t> _relayedIn;
+	std::atomic<uint64_t> _packetsOut;
+	std::atomic<uint64_t> _bytesOut;
+	std::atomic<uint64_t> _relayedOut;
+
+	// Best path cache, a seqlock written with _paths_m locked and read without it.
+	// Readers hold an Epoch::Guard, which keeps the cached path from being freed.
+	mutable std::atomic<uint32_t> _bestPathSeq;
+	mutable Path *volatile _bestPath;
+	mutable volatile int64_t _bestPathExpires;
+
 	AtomicCounter __refCount;
 };
 
@@ -16,6 +16,18 @@ Public domain.
 #pragma warning(disable: 4146)
 #endif
 
+// Four-way vector kernel: AVX2 (selected at runtime) or aarch64 NEON
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__amd64__)) && (defined(__clang__) || (__GNUC__ >= 5))
+#define ZT_POLY1305_X4 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) && defined(__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define ZT_POLY1305_X4 1
+#include <arm_neon.h>
+#endif
+
+// Vectorized code is only used for runs of at least this many bytes
+#define ZT_POLY1305_X4_MIN_BYTES 256
+
 namespace ZeroTier {
 
 #if 0
@@ -131,9 +143,18 @@ namespace {
 
 typedef struct poly1305_context {
   size_t aligner;
-  unsigned char opaque[136];
+  unsigned char opaque[ZT_POLY1305_STATE_SIZE];
 } poly1305_context;
 
+#ifdef ZT_POLY1305_X4
+/* precomputed 26-bit limbs of r^4, and of r^4..r^1 per lane for the final multiply */
+typedef struct poly1305_x4_t {
+  uint32_t r4[5];
+  uint32_t rf[5][4];
+  unsigned char ready;
+} poly1305_x4_t;
+#endif
+
 #if (defined(_MSC_VER) || defined(__GNUC__)) && (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__) || defined(__AMD64) || defined(__AMD64__) || defined(_M_X64))
 
 //////////////////////////////////////////////////////////////////////////////
@@ -180,6 +201,9 @@ typedef struct poly1305_state_internal_t {
   size_t leftover;
   unsigned char buffer[poly1305_block_size];
   unsigned char final;
+#ifdef ZT_POLY1305_X4
+  poly1305_x4_t x4;
+#endif
 } poly1305_state_internal_t;
 
 #if defined(ZT_NO_TYPE_PUNNING) || (__BYTE_ORDER != __LITTLE_ENDIAN)
@@ -239,6 +263,9 @@ poly1305_init(poly1305_context *ctx, const unsigned char key[32]) {
 
   st->leftover = 0;
   st->final = 0;
+#ifdef ZT_POLY1305_X4
+  st->x4.ready = 0;
+#endif
 }
 
 static inline void
@@ -293,6 +320,27 @@ poly1305_blocks(poly1305_state_internal_t *st, const unsigned char *m, size_t by
   st->h[2] = h2;
 }
 
+#ifdef ZT_POLY1305_X4
+/* convert 44/44/42-bit limbs to 26-bit limbs for the vector code and back */
+static inline void poly1305_get26(const unsigned long long x[3],uint64_t l[5])
+{
+  l[0] = x[0] & 0x3ffffff;
+  l[1] = (x[0] >> 26) + ((x[1] & 0xff) << 18);
+  l[2] = (x[1] >> 8) & 0x3ffffff;
+  l[3] = (x[1] >> 34) + ((x[2] & 0xffff) << 10);
+  l[4] = x[2] >> 16;
+}
+static inline void poly1305_set26(unsigned long long x[3],const uint64_t l[5])
+{
+  unsigned long long c;
+  x[0] = l[0] + (l[1] << 26);                 c = x[0] >> 44; x[0] &= 0xfffffffffff;
+  x[1] = c + (l[2] << 8) + (l[3] << 34);      c = x[1] >> 44; x[1] &= 0xfffffffffff;
+  x[2] = c + (l[4] << 16);                    c = x[2] >> 42; x[2] &= 0x3ffffffffff;
+  x[0] += c * 5;                              c = x[0] >> 44; x[0] &= 0xfffffffffff;
+  x[1] += c;
+}
+#endif
+
 static inline void
 poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
   poly1305_state_internal_t *st = (poly1305_state_internal_t *)ctx;
@@ -381,6 +429,9 @@ typedef struct poly1305_state_internal_t {
   size_t leftover;
   unsigned char buffer[poly1305_block_size];
   unsigned char final;
+#ifdef ZT_POLY1305_X4
+  poly1305_x4_t x4;
+#endif
 } poly1305_state_internal_t;
 
 /* interpret four 8 bit unsigned integers as a 32 bit unsigned integer in little endian */
@@ -428,6 +479,9 @@ poly1305_init(poly1305_context *ctx, const unsigned char key[32]) {
 
   st->leftover = 0;
   st->final = 0;
+#ifdef ZT_POLY1305_X4
+  st->x4.ready = 0;
+#endif
 }
 
 static inline void
@@ -491,6 +545,20 @@ poly1305_blocks(poly1305_state_internal_t *st, const unsigned char *m, size_t by
   st->h[4] = h4;
 }
 
+#ifdef ZT_POLY1305_X4
+/* this implementation already uses 26-bit limbs */
+static inline void poly1305_get26(const unsigned long x[5],uint64_t l[5])
+{
+  for(int i=0;i<5;++i)
+    l[i] = (uint64_t)x[i];
+}
+static inline void poly1305_set26(unsigned long x[5],const uint64_t l[5])
+{
+  for(int i=0;i<5;++i)
+    x[i] = (unsigned long)l[i];
+}
+#endif
+
 static inline void
 poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
   poly1305_state_internal_t *st = (poly1305_state_internal_t *)ctx;
@@ -582,6 +650,179 @@ poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
 
 #endif // MSC/GCC or not
 
+//////////////////////////////////////////////////////////////////////////////
+// Four-way vectorized block function
+//
+// Four consecutive blocks are processed in parallel, one per 64-bit vector
+// lane, using 26-bit limbs. Each lane is multiplied by r^4 per iteration
+// and on the last iteration by r^4, r^3, r^2 or r^1 depending on its
+// position, after which the lanes are summed back into the scalar state.
+// The same code is used for AVX2 and aarch64 NEON through the P4_* ops.
+
+#ifdef ZT_POLY1305_X4
+
+#define P4_M26 0x3ffffffULL
+
+// Scalar h = (h * r) mod p (partially reduced) with 26-bit limbs, used to compute powers of r
+static inline void poly1305_mul26(uint64_t h[5],const uint64_t r[5])
+{
+  const uint64_t s1 = r[1] * 5,s2 = r[2] * 5,s3 = r[3] * 5,s4 = r[4] * 5;
+  uint64_t d0 = (h[0] * r[0]) + (h[1] * s4) + (h[2] * s3) + (h[3] * s2) + (h[4] * s1);
+  uint64_t d1 = (h[0] * r[1]) + (h[1] * r[0]) + (h[2] * s4) + (h[3] * s3) + (h[4] * s2);
+  uint64_t d2 = (h[0] * r[2]) + (h[1] * r[1]) + (h[2] * r[0]) + (h[3] * s4) + (h[4] * s3);
+  uint64_t d3 = (h[0] * r[3]) + (h[1] * r[2]) + (h[2] * r[1]) + (h[3] * r[0]) + (h[4] * s4);
+  uint64_t d4 = (h[0] * r[4]) + (h[1] * r[3]) + (h[2] * r[2]) + (h[3] * r[1]) + (h[4] * r[0]);
+  uint64_t c;
+  c = d0 >> 26; h[0] = d0 & P4_M26; d1 += c;
+  c = d1 >> 26; h[1] = d1 & P4_M26; d2 += c;
+  c = d2 >> 26; h[2] = d2 & P4_M26; d3 += c;
+  c = d3 >> 26; h[3] = d3 & P4_M26; d4 += c;
+  c = d4 >> 26; h[4] = d4 & P4_M26; h[0] += c * 5;
+  c = h[0] >> 26; h[0] &= P4_M26; h[1] += c;
+}
+
+#if defined(__aarch64__)
+
+typedef struct { uint64x2_t a,b; } p4v;
+static inline p4v p4v_make(const uint64x2_t a,const uint64x2_t b) { p4v v; v.a = a; v.b = b; return v; }
+static inline p4v p4v_set4(const uint64_t l0,const uint64_t l1,const uint64_t l2,const uint64_t l3) { const uint64_t lo[2] = { l0,l1 },hi[2] = { l2,l3 }; return p4v_make(vld1q_u64(lo),vld1q_u64(hi)); }
+static inline void p4v_store(uint64_t out[4],const p4v v) { vst1q_u64(out,v.a); vst1q_u64(out + 2,v.b); }
+#define P4_SET1(x) p4v_make(vdupq_n_u64((uint64_t)(x)),vdupq_n_u64((uint64_t)(x)))
+#define P4_SET4(l0,l1,l2,l3) p4v_set4((l0),(l1),(l2),(l3))
+#define P4_STORE(o,v) p4v_store((o),(v))
+#define P4_ADD(x,y) p4v_make(vaddq_u64((x).a,(y).a),vaddq_u64((x).b,(y).b))
+#define P4_AND(x,y) p4v_make(vandq_u64((x).a,(y).a),vandq_u64((x).b,(y).b))
+#define P4_OR(x,y) p4v_make(vorrq_u64((x).a,(y).a),vorrq_u64((x).b,(y).b))
+#define P4_SHR(x,n) p4v_make(vshrq_n_u64((x).a,(n)),vshrq_n_u64((x).b,(n)))
+#define P4_SHL(x,n) p4v_make(vshlq_n_u64((x).a,(n)),vshlq_n_u64((x).b,(n)))
+#define P4_MUL(x,y) p4v_make(vmull_u32(vmovn_u64((x).a),vmovn_u64((y).a)),vmull_u32(vmovn_u64((x).b),vmovn_u64((y).b)))
+#define P4_LOAD(m,lo,hi) { const uint64x2x2_t _p4l01 = vld2q_u64(reinterpret_cast<const uint64_t *>(m)); const uint64x2x2_t _p4l23 = vld2q_u64(reinterpret_cast<const uint64_t *>(m) + 4); lo = p4v_make(_p4l01.val[0],_p4l23.val[0]); hi = p4v_make(_p4l01.val[1],_p4l23.val[1]); }
+#define ZT_POLY1305_X4_TARGET
+
+#else // AVX2
+
+typedef __m256i p4v;
+#define P4_SET1(x) _mm256_set1_epi64x((long long)(x))
+#define P4_SET4(l0,l1,l2,l3) _mm256_set_epi64x((long long)(l3),(long long)(l2),(long long)(l1),(long long)(l0))
+#define P4_STORE(o,v) _mm256_storeu_si256(reinterpret_cast<__m256i *>(o),(v))
+#define P4_ADD(x,y) _mm256_add_epi64((x),(y))
+#define P4_AND(x,y) _mm256_and_si256((x),(y))
+#define P4_OR(x,y) _mm256_or_si256((x),(y))
+#define P4_SHR(x,n) _mm256_srli_epi64((x),(n))
+#define P4_SHL(x,n) _mm256_slli_epi64((x),(n))
+#define P4_MUL(x,y) _mm256_mul_epu32((x),(y))
+#define P4_LOAD(m,lo,hi) { const __m256i _p4l01 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m)); const __m256i _p4l23 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m) + 1); lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(_p4l01,_p4l23),0xd8); hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(_p4l01,_p4l23),0xd8); }
+#define ZT_POLY1305_X4_TARGET __attribute__((target("avx2")))
+
+#endif
+
+// Powers of r needed by the vector path, computed once per message
+static inline void poly1305_x4_prepare(poly1305_x4_t *x4,const uint64_t r[5])
+{
+  uint64_t p[4][5]; // r^1..r^4
+  for(int i=0;i<5;++i)
+    p[0][i] = p[1][i] = r[i];
+  poly1305_mul26(p[1],r);
+  for(int i=0;i<5;++i)
+    p[2][i] = p[1][i];
+  poly1305_mul26(p[2],r);
+  for(int i=0;i<5;++i)
+    p[3][i] = p[2][i];
+  poly1305_mul26(p[3],r);
+  for(int i=0;i<5;++i) {
+    x4->r4[i] = (uint32_t)p[3][i];
+    for(int l=0;l<4;++l)
+      x4->rf[i][l] = (uint32_t)p[3 - l][i];
+  }
+  x4->ready = 1;
+}
+
+// h = (h + m) * r4 over all blocks, with the last group multiplied by rf
+#define P4_MULMOD(R0,R1,R2,R3,R4,S1,S2,S3,S4) { \
+  const p4v d0 = P4_ADD(P4_ADD(P4_ADD(P4_ADD(P4_MUL(h0,R0),P4_MUL(h1,S4)),P4_MUL(h2,S3)),P4_MUL(h3,S2)),P4_MUL(h4,S1)); \
+  p4v d1 = P4_ADD(P4_ADD(P4_ADD(P4_ADD(P4_MUL(h0,R1),P4_MUL(h1,R0)),P4_MUL(h2,S4)),P4_MUL(h3,S3)),P4_MUL(h4,S2)); \
+  p4v d2 = P4_ADD(P4_ADD(P4_ADD(P4_ADD(P4_MUL(h0,R2),P4_MUL(h1,R1)),P4_MUL(h2,R0)),P4_MUL(h3,S4)),P4_MUL(h4,S3)); \
+  p4v d3 = P4_ADD(P4_ADD(P4_ADD(P4_ADD(P4_MUL(h0,R3),P4_MUL(h1,R2)),P4_MUL(h2,R1)),P4_MUL(h3,R0)),P4_MUL(h4,S4)); \
+  p4v d4 = P4_ADD(P4_ADD(P4_ADD(P4_ADD(P4_MUL(h0,R4),P4_MUL(h1,R3)),P4_MUL(h2,R2)),P4_MUL(h3,R1)),P4_MUL(h4,R0)); \
+  p4v c; \
+  c = P4_SHR(d0,26); h0 = P4_AND(d0,m26); d1 = P4_ADD(d1,c); \
+  c = P4_SHR(d1,26); h1 = P4_AND(d1,m26); d2 = P4_ADD(d2,c); \
+  c = P4_SHR(d2,26); h2 = P4_AND(d2,m26); d3 = P4_ADD(d3,c); \
+  c = P4_SHR(d3,26); h3 = P4_AND(d3,m26); d4 = P4_ADD(d4,c); \
+  c = P4_SHR(d4,26); h4 = P4_AND(d4,m26); h0 = P4_ADD(h0,P4_ADD(c,P4_SHL(c,2))); \
+  c = P4_SHR(h0,26); h0 = P4_AND(h0,m26); h1 = P4_ADD(h1,c); }
+
+static ZT_POLY1305_X4_TARGET void poly1305_blocks_x4(uint64_t h[5],const poly1305_x4_t *x4,const unsigned char *m,size_t groups)
+{
+  const p4v m26 = P4_SET1(P4_M26);
+  const p4v hibit = P4_SET1(1ULL << 24);
+  const p4v r0 = P4_SET1(x4->r4[0]),r1 = P4_SET1(x4->r4[1]),r2 = P4_SET1(x4->r4[2]),r3 = P4_SET1(x4->r4[3]),r4 = P4_SET1(x4->r4[4]);
+  const p4v s1 = P4_SET1(x4->r4[1] * 5),s2 = P4_SET1(x4->r4[2] * 5),s3 = P4_SET1(x4->r4[3] * 5),s4 = P4_SET1(x4->r4[4] * 5);
+
+  p4v h0 = P4_SET4(h[0],0,0,0),h1 = P4_SET4(h[1],0,0,0),h2 = P4_SET4(h[2],0,0,0),h3 = P4_SET4(h[3],0,0,0),h4 = P4_SET4(h[4],0,0,0);
+
+  for(;;) {
+    p4v lo,hi;
+    P4_LOAD(m,lo,hi);
+    h0 = P4_ADD(h0,P4_AND(lo,m26));
+    h1 = P4_ADD(h1,P4_AND(P4_SHR(lo,26),m26));
+    h2 = P4_ADD(h2,P4_AND(P4_OR(P4_SHR(lo,52),P4_SHL(hi,12)),m26));
+    h3 = P4_ADD(h3,P4_AND(P4_SHR(hi,14),m26));
+    h4 = P4_ADD(h4,P4_OR(P4_SHR(hi,40),hibit));
+    m += 64;
+
+    if (--groups == 0)
+      break;
+
+    P4_MULMOD(r0,r1,r2,r3,r4,s1,s2,s3,s4);
+  }
+
+  {
+    const p4v f0 = P4_SET4(x4->rf[0][0],x4->rf[0][1],x4->rf[0][2],x4->rf[0][3]);
+    const p4v f1 = P4_SET4(x4->rf[1][0],x4->rf[1][1],x4->rf[1][2],x4->rf[1][3]);
+    const p4v f2 = P4_SET4(x4->rf[2][0],x4->rf[2][1],x4->rf[2][2],x4->rf[2][3]);
+    const p4v f3 = P4_SET4(x4->rf[3][0],x4->rf[3][1],x4->rf[3][2],x4->rf[3][3]);
+    const p4v f4 = P4_SET4(x4->rf[4][0],x4->rf[4][1],x4->rf[4][2],x4->rf[4][3]);
+    const p4v g1 = P4_ADD(f1,P4_SHL(f1,2)),g2 = P4_ADD(f2,P4_SHL(f2,2)),g3 = P4_ADD(f3,P4_SHL(f3,2)),g4 = P4_ADD(f4,P4_SHL(f4,2));
+    P4_MULMOD(f0,f1,f2,f3,f4,g1,g2,g3,g4);
+  }
+
+  uint64_t l[5][4];
+  P4_STORE(l[0],h0);
+  P4_STORE(l[1],h1);
+  P4_STORE(l[2],h2);
+  P4_STORE(l[3],h3);
+  P4_STORE(l[4],h4);
+  for(int i=0;i<5;++i)
+    h[i] = l[i][0] + l[i][1] + l[i][2] + l[i][3];
+
+  uint64_t c;
+  c = h[0] >> 26; h[0] &= P4_M26; h[1] += c;
+  c = h[1] >> 26; h[1] &= P4_M26; h[2] += c;
+  c = h[2] >> 26; h[2] &= P4_M26; h[3] += c;
+  c = h[3] >> 26; h[3] &= P4_M26; h[4] += c;
+  c = h[4] >> 26; h[4] &= P4_M26; h[0] += c * 5;
+  c = h[0] >> 26; h[0] &= P4_M26; h[1] += c;
+}
+
+// Runs the vector path over bytes (a multiple of 64) and converts to and from the scalar state
+static inline void poly1305_blocks_x4_state(poly1305_state_internal_t *st,const unsigned char *m,size_t bytes)
+{
+  uint64_t h[5];
+  if (!st->x4.ready) {
+    uint64_t r[5];
+    poly1305_get26(st->r,r);
+    poly1305_x4_prepare(&(st->x4),r);
+  }
+  poly1305_get26(st->h,h);
+  poly1305_blocks_x4(h,&(st->x4),m,bytes / 64);
+  poly1305_set26(st->h,h);
+}
+
+#endif // ZT_POLY1305_X4
+
+//////////////////////////////////////////////////////////////////////////////
+
 static inline void
 poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
   poly1305_state_internal_t *st = (poly1305_state_internal_t *)ctx;
@@ -604,6 +845,14 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
   }
 
   /* process full blocks */
+#ifdef ZT_POLY1305_X4
+  if ((bytes >= ZT_POLY1305_X4_MIN_BYTES)&&(Poly1305::kernel() != Poly1305::KERNEL_DEFAULT)) {
+    size_t want = (bytes & ~((size_t)63));
+    poly1305_blocks_x4_state(st, m, want);
+    m += want;
+    bytes -= want;
+  }
+#endif
   if (bytes >= poly1305_block_size) {
     size_t want = (bytes & ~(poly1305_block_size - 1));
     poly1305_blocks(st, m, want);
@@ -619,8 +868,74 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
   }
 }
 
+static_assert(sizeof(poly1305_state_internal_t) <= sizeof(poly1305_context),"ZT_POLY1305_STATE_SIZE too small");
+
 } // anonymous namespace
 
+static Poly1305::Kernel _p1305BestKernel()
+{
+  for(int k=(int)Poly1305::KERNEL_NEON_X4;k>(int)Poly1305::KERNEL_DEFAULT;--k) {
+    if (Poly1305::kernelSupported((Poly1305::Kernel)k))
+      return (Poly1305::Kernel)k;
+  }
+  return Poly1305::KERNEL_DEFAULT;
+}
+
+Poly1305::Kernel Poly1305::_kernel = _p1305BestKernel();
+
+bool Poly1305::kernelSupported(const Kernel k)
+{
+  switch(k) {
+    case KERNEL_DEFAULT:
+      return true;
+#ifdef ZT_POLY1305_X4
+#ifdef __aarch64__
+    case KERNEL_NEON_X4:
+      return true;
+#else
+    case KERNEL_AVX2_X4:
+      __builtin_cpu_init();
+      return (__builtin_cpu_supports("avx2") != 0);
+#endif
+#endif
+    default:
+      return false;
+  }
+}
+
+bool Poly1305::setKernel(const Kernel k)
+{
+  if (!kernelSupported(k))
+    return false;
+  _kernel = k;
+  return true;
+}
+
+const char *Poly1305::kernelName(const Kernel k)
+{
+  switch(k) {
+    case KERNEL_DEFAULT: return "scalar";
+    case KERNEL_AVX2_X4: return "avx2-x4";
+    case KERNEL_NEON_X4: return "neon-x4";
+  }
+  return "unknown";
+}
+
+void Poly1305::init(const void *key)
+{
+  poly1305_init(reinterpret_cast<poly1305_context *>(&_ctx),reinterpret_cast<const unsigned char *>(key));
+}
+
+void Poly1305::update(const void *data,unsigned int len)
+{
+  poly1305_update(reinterpret_cast<poly1305_context *>(&_ctx),reinterpret_cast<const unsigned char *>(data),(size_t)len);
+}
+
+void Poly1305::finish(void *auth)
+{
+  poly1305_finish(reinterpret_cast<poly1305_context *>(&_ctx),reinterpret_cast<unsigned char *>(auth));
+}
+
 void Poly1305::compute(void *auth,const void *data,unsigned int len,const void *key)
 {
   poly1305_context ctx;
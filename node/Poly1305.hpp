@@ -27,11 +27,16 @@
 #ifndef ZT_POLY1305_HPP
 #define ZT_POLY1305_HPP
 
+#include <stddef.h>
+
 namespace ZeroTier {
 
 #define ZT_POLY1305_KEY_LEN 32
 #define ZT_POLY1305_MAC_LEN 16
 
+// Size of opaque incremental state (must be large enough for any implementation)
+#define ZT_POLY1305_STATE_SIZE 248
+
 /**
  * Poly1305 one-time authentication code
  *
@@ -46,6 +51,74 @@ namespace ZeroTier {
 class Poly1305
 {
 public:
+	/**
+	 * Poly1305 block kernels
+	 *
+	 * A four-way vector kernel is selected at startup if available and is
+	 * used for runs of 256 or more bytes. Shorter messages such as most
+	 * control packets always use the scalar code.
+	 */
+	enum Kernel
+	{
+		KERNEL_DEFAULT = 0, // scalar (donna)
+		KERNEL_AVX2_X4 = 1, // four blocks per iteration, x64 AVX2
+		KERNEL_NEON_X4 = 2  // four blocks per iteration, aarch64 NEON
+	};
+
+	/**
+	 * @param k Kernel
+	 * @return True if this build and CPU can run this kernel
+	 */
+	static bool kernelSupported(const Kernel k);
+
+	/**
+	 * Override the kernel in use (for testing and benchmarking, not thread safe)
+	 *
+	 * @param k Kernel to use
+	 * @return False if kernel is not supported (selection is unchanged)
+	 */
+	static bool setKernel(const Kernel k);
+
+	/**
+	 * @return Kernel currently in use
+	 */
+	static inline Kernel kernel() { return _kernel; }
+
+	/**
+	 * @param k Kernel
+	 * @return Short human-readable name of kernel
+	 */
+	static const char *kernelName(const Kernel k);
+
+	Poly1305() {}
+
+	/**
+	 * @param key 32-byte one-time use key (must not be reused)
+	 */
+	Poly1305(const void *key) { init(key); }
+
+	/**
+	 * Begin computing a MAC incrementally
+	 *
+	 * @param key 32-byte one-time use key (must not be reused)
+	 */
+	void init(const void *key);
+
+	/**
+	 * Add data to a MAC being computed incrementally
+	 *
+	 * @param data Data to authenticate
+	 * @param len Length of data in bytes
+	 */
+	void update(const void *data,unsigned int len);
+
+	/**
+	 * Finish an incremental MAC and clear internal state
+	 *
+	 * @param auth Buffer to receive code -- MUST be 16 bytes in length
+	 */
+	void finish(void *auth);
+
 	/**
 	 * Compute a one-time authentication code
 	 *
@@ -55,6 +128,15 @@ public:
 	 * @param key 32-byte one-time use key to authenticate data (must not be reused)
 	 */
 	static void compute(void *auth,const void *data,unsigned int len,const void *key);
+
+private:
+	static Kernel _kernel;
+
+	// Opaque state for whichever implementation is compiled in
+	struct {
+		size_t aligner;
+		unsigned char opaque[ZT_POLY1305_STATE_SIZE];
+	} _ctx;
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,190 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_PREFIXTRIE_HPP
+#define ZT_PREFIXTRIE_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "InetAddress.hpp"
+
+// Null node or value index
+#define ZT_PREFIXTRIE_NONE 0xffffffff
+
+namespace ZeroTier {
+
+/**
+ * Binary trie of IPv4 and IPv6 network prefixes for longest prefix matching
+ *
+ * Networks are InetAddress objects with the prefix length in the port
+ * field, as used for routes and local.conf path settings. Lookups walk
+ * one node per bit of the longest matching prefix, so they cost the same
+ * however many prefixes there are. Tries are meant to be built when
+ * configuration changes and then only read, and are not locked.
+ *
+ * @tparam V Value type
+ */
+template<typename V>
+class PrefixTrie
+{
+public:
+	PrefixTrie() { clear(); }
+
+	/**
+	 * Add a network, replacing the value of any identical prefix
+	 *
+	 * Prefix lengths beyond the address length are treated as host routes.
+	 *
+	 * @param net Network address with prefix length in port field
+	 * @param value Value for addresses within this network
+	 */
+	inline void add(const InetAddress &net,const V &value)
+	{
+		unsigned int bits;
+		const uint8_t *k;
+		uint32_t n = _root(net,true,bits,k);
+		if (n == ZT_PREFIXTRIE_NONE)
+			return;
+		for(unsigned int i=0;i<bits;++i) {
+			const unsigned int b = (k[i >> 3] >> (7 - (i & 7))) & 1;
+			if (_nodes[n].child[b] == ZT_PREFIXTRIE_NONE) {
+				_nodes[n].child[b] = (uint32_t)_nodes.size();
+				_nodes.push_back(_Node());
+			}
+			n = _nodes[n].child[b];
+		}
+		if (_nodes[n].value == ZT_PREFIXTRIE_NONE) {
+			_nodes[n].value = (uint32_t)_values.size();
+			_values.push_back(_Value(value));
+		} else {
+			_values[_nodes[n].value].v = value;
+		}
+	}
+
+	/**
+	 * @param addr IP address
+	 * @return Value of the longest prefix containing this address or NULL if none
+	 */
+	inline const V *get(const InetAddress &addr) const
+	{
+		const V *v = (const V *)0;
+		unsigned int bits;
+		const uint8_t *k;
+		uint32_t n = _root(addr,false,bits,k);
+		for(unsigned int i=0;n!=ZT_PREFIXTRIE_NONE;++i) {
+			if (_nodes[n].value != ZT_PREFIXTRIE_NONE)
+				v = &(_values[_nodes[n].value].v);
+			if (i >= bits)
+				break;
+			n = _nodes[n].child[(k[i >> 3] >> (7 - (i & 7))) & 1];
+		}
+		return v;
+	}
+
+	/**
+	 * Visit the values of every prefix containing an address, shortest first
+	 *
+	 * @param addr IP address
+	 * @param f Function or function object taking (const V &) and returning true to stop
+	 * @return True if f stopped the walk
+	 */
+	template<typename F>
+	inline bool eachMatch(const InetAddress &addr,F f) const
+	{
+		unsigned int bits;
+		const uint8_t *k;
+		uint32_t n = _root(addr,false,bits,k);
+		for(unsigned int i=0;n!=ZT_PREFIXTRIE_NONE;++i) {
+			if ((_nodes[n].value != ZT_PREFIXTRIE_NONE)&&(f(_values[_nodes[n].value].v)))
+				return true;
+			if (i >= bits)
+				break;
+			n = _nodes[n].child[(k[i >> 3] >> (7 - (i & 7))) & 1];
+		}
+		return false;
+	}
+
+	/**
+	 * @param addr IP address
+	 * @return True if any prefix contains this address
+	 */
+	inline bool contains(const InetAddress &addr) const { return (get(addr) != (const V *)0); }
+
+	/**
+	 * @return Number of distinct prefixes
+	 */
+	inline unsigned long size() const { return (unsigned long)_values.size(); }
+
+	inline bool empty() const { return _values.empty(); }
+
+	inline void clear()
+	{
+		_nodes.clear();
+		_nodes.resize(2); // IPv4 and IPv6 roots
+		_values.clear();
+	}
+
+private:
+	// Returns the root for an address's family and its key bytes and bit count, or ZT_PREFIXTRIE_NONE
+	static inline uint32_t _root(const InetAddress &a,const bool prefix,unsigned int &bits,const uint8_t *&k)
+	{
+		bits = (prefix) ? a.netmaskBits() : 128;
+		k = reinterpret_cast<const uint8_t *>(a.rawIpData());
+		switch(a.ss_family) {
+			case AF_INET:
+				if (bits > 32) bits = 32;
+				return 0;
+			case AF_INET6:
+				if (bits > 128) bits = 128;
+				return 1;
+		}
+		return ZT_PREFIXTRIE_NONE;
+	}
+
+	struct _Node
+	{
+		_Node() : value(ZT_PREFIXTRIE_NONE) { child[0] = ZT_PREFIXTRIE_NONE; child[1] = ZT_PREFIXTRIE_NONE; }
+		uint32_t child[2];
+		uint32_t value;
+	};
+
+	// Wrapped so std::vector<bool> isn't used and values can be pointed to
+	struct _Value
+	{
+		_Value(const V &value) : v(value) {}
+		V v;
+	};
+
+	std::vector<_Node> _nodes;
+	std::vector<_Value> _values;
+};
+
+} // namespace ZeroTier
+
+#endif
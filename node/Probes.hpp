@@ -0,0 +1,77 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_PROBES_HPP
+#define ZT_PROBES_HPP
+
+/*
+ * USDT (user statically defined tracing) probes for bpftrace, perf and SystemTap
+ *
+ * On Linux these are compiled in whenever <sys/sdt.h> is installed (from the
+ * systemtap-sdt-dev or systemtap-sdt-devel package) unless built with
+ * ZT_USDT=0. A probe is one nop and an ELF note, so it costs nothing until a
+ * tracer attaches, but its arguments are still computed, so only pass values
+ * that are already at hand. Elsewhere the macros expand to nothing.
+ *
+ * Probes are in provider "zerotier", e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/zerotier-one:zerotier:decode__done { @[arg0] = hist(arg1); }'
+ *
+ *   receive__start(len)                    Switch::onRemotePacket() entry
+ *   receive__done(len)                     Switch::onRemotePacket() exit
+ *   fragment__assembled(packetId,count,recovered)  All fragments of a packet are here (recovered is 1 if FEC rebuilt one)
+ *   decode__start(packetId,source)         IncomingPacket::tryDecode() entry, including retries after WHOIS
+ *   decode__done(verb,ns)                  Authenticated packet handled, with time since decode__start
+ *   armor__start(len) / armor__done(len)   Packet::armor()
+ *   dearmor__start(len) / dearmor__done(len,ok)  Packet::dearmor(), ok is 0 if the MAC was invalid
+ *   filter__verdict(nwid,outbound,result)  Network::filterOutgoingPacket() and filterIncomingPacket() results
+ *   tap__put(nwid,etherType,len)           Frame delivered to a network's virtual port
+ *   peer__path__learned(address,slot)      Peer learned a new direct path from an OK
+ *   peer__path__redirected(address,priority)  Peer path set by a cluster member redirect
+ *   controller__request__start(nwid,address,packetId)  Controller began building a network config
+ *   controller__request__done(nwid,address,packetId)   Controller finished (or refused) a request
+ */
+
+#if defined(__linux__) && !defined(ZT_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ZT_USDT 1
+#endif
+#endif
+
+#ifdef ZT_USDT
+#define ZT_PROBE0(n) DTRACE_PROBE(zerotier,n)
+#define ZT_PROBE1(n,a) DTRACE_PROBE1(zerotier,n,a)
+#define ZT_PROBE2(n,a,b) DTRACE_PROBE2(zerotier,n,a,b)
+#define ZT_PROBE3(n,a,b,c) DTRACE_PROBE3(zerotier,n,a,b,c)
+#else
+#define ZT_PROBE0(n)
+#define ZT_PROBE1(n,a)
+#define ZT_PROBE2(n,a,b)
+#define ZT_PROBE3(n,a,b,c)
+#endif
+
+#endif
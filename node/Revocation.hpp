@@ -60,7 +60,7 @@ public:
 
 	Revocation()
 	{
-		memset(this,0,sizeof(Revocation));
+		memset((void *)this,0,sizeof(Revocation));
 	}
 
 	/**
@@ -80,7 +80,10 @@ public:
 		_flags(fl),
 		_target(tgt),
 		_signedBy(),
-		_type(ct) {}
+		_type(ct)
+	{
+		memset(_signature.data,0,sizeof(_signature.data));
+	}
 
 	inline uint32_t id() const { return _id; }
 	inline uint32_t credentialId() const { return _credentialId; }
@@ -89,6 +92,7 @@ public:
 	inline const Address &target() const { return _target; }
 	inline const Address &signer() const { return _signedBy; }
 	inline Credential::Type type() const { return _type; }
+	inline const C25519::Signature &signature() const { return _signature; }
 
 	inline bool fastPropagate() const { return ((_flags & ZT_REVOCATION_FLAG_FAST_PROPAGATE) != 0); }
 
@@ -113,9 +117,10 @@ public:
 	 *
 	 * @param RR Runtime environment to provide for peer lookup, etc.
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param signatureVerified If true the signature itself already passed a batch check
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or chain
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,const bool signatureVerified = false) const;
 
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
@@ -148,7 +153,7 @@ public:
 	template<unsigned int C>
 	inline unsigned int deserialize(const Buffer<C> &b,unsigned int startAt = 0)
 	{
-		memset(this,0,sizeof(Revocation));
+		memset((void *)this,0,sizeof(Revocation));
 
 		unsigned int p = startAt;
 
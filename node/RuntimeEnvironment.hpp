@@ -43,6 +43,11 @@ class Multicaster;
 class NetworkController;
 class SelfAwareness;
 class Trace;
+class Cluster;
+class Egress;
+class Shaper;
+class Traversal;
+class CryptoWorkers;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
@@ -58,6 +63,11 @@ public:
 		,mc((Multicaster *)0)
 		,topology((Topology *)0)
 		,sa((SelfAwareness *)0)
+		,shaper((Shaper *)0)
+		,traversal((Traversal *)0)
+		,cluster((Cluster *)0)
+		,egress((Egress *)0)
+		,cryptoWorkers((CryptoWorkers *)0)
 	{
 		publicIdentityStr[0] = (char)0;
 		secretIdentityStr[0] = (char)0;
@@ -88,6 +98,17 @@ public:
 	Multicaster *mc;
 	Topology *topology;
 	SelfAwareness *sa;
+	Shaper *shaper;
+	Traversal *traversal;
+
+	// This is NULL unless this node is a member of a root cluster
+	Cluster *cluster;
+
+	// This is NULL until an egress rate is first set
+	Egress *egress;
+
+	// This is NULL until worker threads for HELLOs from new peers are first set
+	CryptoWorkers *cryptoWorkers;
 
 	// This node's identity and string representations thereof
 	Identity identity;
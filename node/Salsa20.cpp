@@ -64,8 +64,329 @@ public:
 static const _s20sseconsts _S20SSECONSTANTS;
 #endif
 
+// Multi-block kernels: these compute several consecutive 64-byte blocks in
+// parallel with one block per vector lane ("vertical" layout), then transpose
+// the result back into keystream order. SSE2 is baseline on anything that
+// defines ZT_SALSA20_SSE. AVX2 and AVX-512VL are compiled with per-function
+// target attributes and only used if the CPU reports support at startup.
+#ifdef ZT_SALSA20_SSE
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && (defined(__clang__) || (__GNUC__ >= 5))
+#define ZT_SALSA20_AVX 1
+#include <immintrin.h>
+#endif
+
+// Canonical Salsa20 state word -> slot in the SSE-reordered _state
+static const unsigned int _S20SSESLOT[16] = { 0,13,10,7,4,1,14,11,8,5,2,15,12,9,6,3 };
+
+#define ZT_S20X4_ROTL(v,c) _mm_or_si128(_mm_slli_epi32((v),(c)),_mm_srli_epi32((v),32 - (c)))
+#define ZT_S20X4_QR(a,b,c,d) \
+	b = _mm_xor_si128(b,ZT_S20X4_ROTL(_mm_add_epi32(a,d),7)); \
+	c = _mm_xor_si128(c,ZT_S20X4_ROTL(_mm_add_epi32(b,a),9)); \
+	d = _mm_xor_si128(d,ZT_S20X4_ROTL(_mm_add_epi32(c,b),13)); \
+	a = _mm_xor_si128(a,ZT_S20X4_ROTL(_mm_add_epi32(d,c),18))
+
+// Transposes a group of four state words from four lanes into four 16-byte keystream pieces
+#define ZT_S20X4_TRANSPOSE(a,b,c,d) { \
+	const __m128i t0 = _mm_unpacklo_epi32(a,b); \
+	const __m128i t1 = _mm_unpackhi_epi32(a,b); \
+	const __m128i t2 = _mm_unpacklo_epi32(c,d); \
+	const __m128i t3 = _mm_unpackhi_epi32(c,d); \
+	a = _mm_unpacklo_epi64(t0,t2); \
+	b = _mm_unpackhi_epi64(t0,t2); \
+	c = _mm_unpacklo_epi64(t1,t3); \
+	d = _mm_unpackhi_epi64(t1,t3); }
+
+#define ZT_S20X4_XOR_STORE(off,v) _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (off)),_mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + (off))),(v)))
+
+// Processes blocks/4 groups of four blocks starting at counter j[8],j[9]
+static void _salsa2012x4(const uint32_t *j,const uint8_t *in,uint8_t *out,unsigned int blocks)
+{
+	uint64_t ctr = (uint64_t)j[8] | ((uint64_t)j[9] << 32);
+	while (blocks >= 4) {
+		const __m128i j8 = _mm_set_epi32((int)(uint32_t)(ctr + 3),(int)(uint32_t)(ctr + 2),(int)(uint32_t)(ctr + 1),(int)(uint32_t)ctr);
+		const __m128i j9 = _mm_set_epi32((int)(uint32_t)((ctr + 3) >> 32),(int)(uint32_t)((ctr + 2) >> 32),(int)(uint32_t)((ctr + 1) >> 32),(int)(uint32_t)(ctr >> 32));
+		__m128i x0 = _mm_set1_epi32((int)j[0]),x1 = _mm_set1_epi32((int)j[1]),x2 = _mm_set1_epi32((int)j[2]),x3 = _mm_set1_epi32((int)j[3]);
+		__m128i x4 = _mm_set1_epi32((int)j[4]),x5 = _mm_set1_epi32((int)j[5]),x6 = _mm_set1_epi32((int)j[6]),x7 = _mm_set1_epi32((int)j[7]);
+		__m128i x8 = j8,x9 = j9,x10 = _mm_set1_epi32((int)j[10]),x11 = _mm_set1_epi32((int)j[11]);
+		__m128i x12 = _mm_set1_epi32((int)j[12]),x13 = _mm_set1_epi32((int)j[13]),x14 = _mm_set1_epi32((int)j[14]),x15 = _mm_set1_epi32((int)j[15]);
+
+		for(int r=0;r<6;++r) {
+			ZT_S20X4_QR(x0,x4,x8,x12);
+			ZT_S20X4_QR(x5,x9,x13,x1);
+			ZT_S20X4_QR(x10,x14,x2,x6);
+			ZT_S20X4_QR(x15,x3,x7,x11);
+			ZT_S20X4_QR(x0,x1,x2,x3);
+			ZT_S20X4_QR(x5,x6,x7,x4);
+			ZT_S20X4_QR(x10,x11,x8,x9);
+			ZT_S20X4_QR(x15,x12,x13,x14);
+		}
+
+		x0 = _mm_add_epi32(x0,_mm_set1_epi32((int)j[0])); x1 = _mm_add_epi32(x1,_mm_set1_epi32((int)j[1]));
+		x2 = _mm_add_epi32(x2,_mm_set1_epi32((int)j[2])); x3 = _mm_add_epi32(x3,_mm_set1_epi32((int)j[3]));
+		x4 = _mm_add_epi32(x4,_mm_set1_epi32((int)j[4])); x5 = _mm_add_epi32(x5,_mm_set1_epi32((int)j[5]));
+		x6 = _mm_add_epi32(x6,_mm_set1_epi32((int)j[6])); x7 = _mm_add_epi32(x7,_mm_set1_epi32((int)j[7]));
+		x8 = _mm_add_epi32(x8,j8); x9 = _mm_add_epi32(x9,j9);
+		x10 = _mm_add_epi32(x10,_mm_set1_epi32((int)j[10])); x11 = _mm_add_epi32(x11,_mm_set1_epi32((int)j[11]));
+		x12 = _mm_add_epi32(x12,_mm_set1_epi32((int)j[12])); x13 = _mm_add_epi32(x13,_mm_set1_epi32((int)j[13]));
+		x14 = _mm_add_epi32(x14,_mm_set1_epi32((int)j[14])); x15 = _mm_add_epi32(x15,_mm_set1_epi32((int)j[15]));
+
+		ZT_S20X4_TRANSPOSE(x0,x1,x2,x3);
+		ZT_S20X4_TRANSPOSE(x4,x5,x6,x7);
+		ZT_S20X4_TRANSPOSE(x8,x9,x10,x11);
+		ZT_S20X4_TRANSPOSE(x12,x13,x14,x15);
+		ZT_S20X4_XOR_STORE(0,x0); ZT_S20X4_XOR_STORE(16,x4); ZT_S20X4_XOR_STORE(32,x8); ZT_S20X4_XOR_STORE(48,x12);
+		ZT_S20X4_XOR_STORE(64,x1); ZT_S20X4_XOR_STORE(80,x5); ZT_S20X4_XOR_STORE(96,x9); ZT_S20X4_XOR_STORE(112,x13);
+		ZT_S20X4_XOR_STORE(128,x2); ZT_S20X4_XOR_STORE(144,x6); ZT_S20X4_XOR_STORE(160,x10); ZT_S20X4_XOR_STORE(176,x14);
+		ZT_S20X4_XOR_STORE(192,x3); ZT_S20X4_XOR_STORE(208,x7); ZT_S20X4_XOR_STORE(224,x11); ZT_S20X4_XOR_STORE(240,x15);
+
+		ctr += 4;
+		in += 256;
+		out += 256;
+		blocks -= 4;
+	}
+}
+
+#ifdef ZT_SALSA20_AVX
+
+#define ZT_S20X8_ROTL_AVX2(v,c) _mm256_or_si256(_mm256_slli_epi32((v),(c)),_mm256_srli_epi32((v),32 - (c)))
+#define ZT_S20X8_ROTL_AVX512(v,c) _mm256_rol_epi32((v),(c))
+#define ZT_S20X8_QR(R,a,b,c,d) \
+	b = _mm256_xor_si256(b,R(_mm256_add_epi32(a,d),7)); \
+	c = _mm256_xor_si256(c,R(_mm256_add_epi32(b,a),9)); \
+	d = _mm256_xor_si256(d,R(_mm256_add_epi32(c,b),13)); \
+	a = _mm256_xor_si256(a,R(_mm256_add_epi32(d,c),18))
+#define ZT_S20X8_DOUBLEROUND(R) \
+	ZT_S20X8_QR(R,x[0],x[4],x[8],x[12]); \
+	ZT_S20X8_QR(R,x[5],x[9],x[13],x[1]); \
+	ZT_S20X8_QR(R,x[10],x[14],x[2],x[6]); \
+	ZT_S20X8_QR(R,x[15],x[3],x[7],x[11]); \
+	ZT_S20X8_QR(R,x[0],x[1],x[2],x[3]); \
+	ZT_S20X8_QR(R,x[5],x[6],x[7],x[4]); \
+	ZT_S20X8_QR(R,x[10],x[11],x[8],x[9]); \
+	ZT_S20X8_QR(R,x[15],x[12],x[13],x[14])
+
+// Sets up x[] and s[] for eight blocks starting at counter ctr
+__attribute__((target("avx2"))) static inline void _salsa20x8Setup(const uint32_t *j,const uint64_t ctr,__m256i *x,__m256i *s)
+{
+	for(unsigned int k=0;k<16;++k)
+		s[k] = _mm256_set1_epi32((int)j[k]);
+	s[8] = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)ctr),_mm256_set_epi32(7,6,5,4,3,2,1,0));
+	s[9] = _mm256_set_epi32((int)(uint32_t)((ctr + 7) >> 32),(int)(uint32_t)((ctr + 6) >> 32),(int)(uint32_t)((ctr + 5) >> 32),(int)(uint32_t)((ctr + 4) >> 32),(int)(uint32_t)((ctr + 3) >> 32),(int)(uint32_t)((ctr + 2) >> 32),(int)(uint32_t)((ctr + 1) >> 32),(int)(uint32_t)(ctr >> 32));
+	for(unsigned int k=0;k<16;++k)
+		x[k] = s[k];
+}
+
+// Adds in original state, transposes, and XORs 512 bytes of keystream into out
+__attribute__((target("avx2"))) static inline void _salsa20x8Finish(__m256i *x,const __m256i *s,const uint8_t *in,uint8_t *out)
+{
+	for(unsigned int k=0;k<16;++k)
+		x[k] = _mm256_add_epi32(x[k],s[k]);
+
+	// Within each group of four words, interleave so that each 128-bit half
+	// holds words 4g..4g+3 of one block (lanes 0-3 low half, 4-7 high half).
+	for(unsigned int g=0;g<16;g+=4) {
+		const __m256i t0 = _mm256_unpacklo_epi32(x[g],x[g + 1]);
+		const __m256i t1 = _mm256_unpackhi_epi32(x[g],x[g + 1]);
+		const __m256i t2 = _mm256_unpacklo_epi32(x[g + 2],x[g + 3]);
+		const __m256i t3 = _mm256_unpackhi_epi32(x[g + 2],x[g + 3]);
+		x[g] = _mm256_unpacklo_epi64(t0,t2);
+		x[g + 1] = _mm256_unpackhi_epi64(t0,t2);
+		x[g + 2] = _mm256_unpacklo_epi64(t1,t3);
+		x[g + 3] = _mm256_unpackhi_epi64(t1,t3);
+	}
+
+	const __m256i *const i256 = reinterpret_cast<const __m256i *>(in);
+	__m256i *const o256 = reinterpret_cast<__m256i *>(out);
+	for(unsigned int b=0;b<4;++b) {
+		_mm256_storeu_si256(o256 + (b * 2),_mm256_xor_si256(_mm256_loadu_si256(i256 + (b * 2)),_mm256_permute2x128_si256(x[b],x[b + 4],0x20)));
+		_mm256_storeu_si256(o256 + (b * 2) + 1,_mm256_xor_si256(_mm256_loadu_si256(i256 + (b * 2) + 1),_mm256_permute2x128_si256(x[b + 8],x[b + 12],0x20)));
+		_mm256_storeu_si256(o256 + (b * 2) + 8,_mm256_xor_si256(_mm256_loadu_si256(i256 + (b * 2) + 8),_mm256_permute2x128_si256(x[b],x[b + 4],0x31)));
+		_mm256_storeu_si256(o256 + (b * 2) + 9,_mm256_xor_si256(_mm256_loadu_si256(i256 + (b * 2) + 9),_mm256_permute2x128_si256(x[b + 8],x[b + 12],0x31)));
+	}
+}
+
+__attribute__((target("avx2"))) static void _salsa2012x8avx2(const uint32_t *j,const uint8_t *in,uint8_t *out,unsigned int blocks)
+{
+	__m256i x[16],s[16];
+	uint64_t ctr = (uint64_t)j[8] | ((uint64_t)j[9] << 32);
+	while (blocks >= 8) {
+		_salsa20x8Setup(j,ctr,x,s);
+		for(int r=0;r<6;++r) {
+			ZT_S20X8_DOUBLEROUND(ZT_S20X8_ROTL_AVX2);
+		}
+		_salsa20x8Finish(x,s,in,out);
+		ctr += 8;
+		in += 512;
+		out += 512;
+		blocks -= 8;
+	}
+}
+
+__attribute__((target("avx2,avx512f,avx512vl"))) static void _salsa2012x8avx512(const uint32_t *j,const uint8_t *in,uint8_t *out,unsigned int blocks)
+{
+	__m256i x[16],s[16];
+	uint64_t ctr = (uint64_t)j[8] | ((uint64_t)j[9] << 32);
+	while (blocks >= 8) {
+		_salsa20x8Setup(j,ctr,x,s);
+		for(int r=0;r<6;++r) {
+			ZT_S20X8_DOUBLEROUND(ZT_S20X8_ROTL_AVX512);
+		}
+		_salsa20x8Finish(x,s,in,out);
+		ctr += 8;
+		in += 512;
+		out += 512;
+		blocks -= 8;
+	}
+}
+
+#endif // ZT_SALSA20_AVX
+#endif // ZT_SALSA20_SSE
+
+// aarch64 NEON four-block kernel. NEON is baseline on ARMv8-A, so this is
+// selected unconditionally on little-endian aarch64 builds. The layout is
+// the same as the SSE2 one above but the state is in canonical word order.
+#if (!defined(ZT_SALSA20_SSE)) && defined(__aarch64__) && defined(__ARM_NEON) && defined(__ORDER_LITTLE_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define ZT_SALSA20_NEON 1
+#include <arm_neon.h>
+
+#define ZT_S20NEON_ROTL(v,c) vsriq_n_u32(vshlq_n_u32((v),(c)),(v),32 - (c))
+#define ZT_S20NEON_QR(a,b,c,d) \
+	b = veorq_u32(b,ZT_S20NEON_ROTL(vaddq_u32(a,d),7)); \
+	c = veorq_u32(c,ZT_S20NEON_ROTL(vaddq_u32(b,a),9)); \
+	d = veorq_u32(d,ZT_S20NEON_ROTL(vaddq_u32(c,b),13)); \
+	a = veorq_u32(a,ZT_S20NEON_ROTL(vaddq_u32(d,c),18))
+
+// Transposes a group of four state words from four lanes into four 16-byte keystream pieces
+#define ZT_S20NEON_TRANSPOSE(a,b,c,d) { \
+	const uint32x4_t t0 = vtrn1q_u32(a,b); \
+	const uint32x4_t t1 = vtrn2q_u32(a,b); \
+	const uint32x4_t t2 = vtrn1q_u32(c,d); \
+	const uint32x4_t t3 = vtrn2q_u32(c,d); \
+	a = vreinterpretq_u32_u64(vtrn1q_u64(vreinterpretq_u64_u32(t0),vreinterpretq_u64_u32(t2))); \
+	b = vreinterpretq_u32_u64(vtrn1q_u64(vreinterpretq_u64_u32(t1),vreinterpretq_u64_u32(t3))); \
+	c = vreinterpretq_u32_u64(vtrn2q_u64(vreinterpretq_u64_u32(t0),vreinterpretq_u64_u32(t2))); \
+	d = vreinterpretq_u32_u64(vtrn2q_u64(vreinterpretq_u64_u32(t1),vreinterpretq_u64_u32(t3))); }
+
+#define ZT_S20NEON_XOR_STORE(off,v) vst1q_u8(out + (off),veorq_u8(vld1q_u8(in + (off)),vreinterpretq_u8_u32(v)))
+
+// Processes blocks/4 groups of four blocks starting at counter j[8],j[9]
+static void _salsa2012x4neon(const uint32_t *j,const uint8_t *in,uint8_t *out,unsigned int blocks)
+{
+	uint64_t ctr = (uint64_t)j[8] | ((uint64_t)j[9] << 32);
+	while (blocks >= 4) {
+		uint32_t c8[4],c9[4];
+		for(unsigned int l=0;l<4;++l) {
+			c8[l] = (uint32_t)(ctr + l);
+			c9[l] = (uint32_t)((ctr + l) >> 32);
+		}
+		const uint32x4_t j8 = vld1q_u32(c8);
+		const uint32x4_t j9 = vld1q_u32(c9);
+		uint32x4_t x0 = vdupq_n_u32(j[0]),x1 = vdupq_n_u32(j[1]),x2 = vdupq_n_u32(j[2]),x3 = vdupq_n_u32(j[3]);
+		uint32x4_t x4 = vdupq_n_u32(j[4]),x5 = vdupq_n_u32(j[5]),x6 = vdupq_n_u32(j[6]),x7 = vdupq_n_u32(j[7]);
+		uint32x4_t x8 = j8,x9 = j9,x10 = vdupq_n_u32(j[10]),x11 = vdupq_n_u32(j[11]);
+		uint32x4_t x12 = vdupq_n_u32(j[12]),x13 = vdupq_n_u32(j[13]),x14 = vdupq_n_u32(j[14]),x15 = vdupq_n_u32(j[15]);
+
+		for(int r=0;r<6;++r) {
+			ZT_S20NEON_QR(x0,x4,x8,x12);
+			ZT_S20NEON_QR(x5,x9,x13,x1);
+			ZT_S20NEON_QR(x10,x14,x2,x6);
+			ZT_S20NEON_QR(x15,x3,x7,x11);
+			ZT_S20NEON_QR(x0,x1,x2,x3);
+			ZT_S20NEON_QR(x5,x6,x7,x4);
+			ZT_S20NEON_QR(x10,x11,x8,x9);
+			ZT_S20NEON_QR(x15,x12,x13,x14);
+		}
+
+		x0 = vaddq_u32(x0,vdupq_n_u32(j[0])); x1 = vaddq_u32(x1,vdupq_n_u32(j[1]));
+		x2 = vaddq_u32(x2,vdupq_n_u32(j[2])); x3 = vaddq_u32(x3,vdupq_n_u32(j[3]));
+		x4 = vaddq_u32(x4,vdupq_n_u32(j[4])); x5 = vaddq_u32(x5,vdupq_n_u32(j[5]));
+		x6 = vaddq_u32(x6,vdupq_n_u32(j[6])); x7 = vaddq_u32(x7,vdupq_n_u32(j[7]));
+		x8 = vaddq_u32(x8,j8); x9 = vaddq_u32(x9,j9);
+		x10 = vaddq_u32(x10,vdupq_n_u32(j[10])); x11 = vaddq_u32(x11,vdupq_n_u32(j[11]));
+		x12 = vaddq_u32(x12,vdupq_n_u32(j[12])); x13 = vaddq_u32(x13,vdupq_n_u32(j[13]));
+		x14 = vaddq_u32(x14,vdupq_n_u32(j[14])); x15 = vaddq_u32(x15,vdupq_n_u32(j[15]));
+
+		ZT_S20NEON_TRANSPOSE(x0,x1,x2,x3);
+		ZT_S20NEON_TRANSPOSE(x4,x5,x6,x7);
+		ZT_S20NEON_TRANSPOSE(x8,x9,x10,x11);
+		ZT_S20NEON_TRANSPOSE(x12,x13,x14,x15);
+		ZT_S20NEON_XOR_STORE(0,x0); ZT_S20NEON_XOR_STORE(16,x4); ZT_S20NEON_XOR_STORE(32,x8); ZT_S20NEON_XOR_STORE(48,x12);
+		ZT_S20NEON_XOR_STORE(64,x1); ZT_S20NEON_XOR_STORE(80,x5); ZT_S20NEON_XOR_STORE(96,x9); ZT_S20NEON_XOR_STORE(112,x13);
+		ZT_S20NEON_XOR_STORE(128,x2); ZT_S20NEON_XOR_STORE(144,x6); ZT_S20NEON_XOR_STORE(160,x10); ZT_S20NEON_XOR_STORE(176,x14);
+		ZT_S20NEON_XOR_STORE(192,x3); ZT_S20NEON_XOR_STORE(208,x7); ZT_S20NEON_XOR_STORE(224,x11); ZT_S20NEON_XOR_STORE(240,x15);
+
+		ctr += 4;
+		in += 256;
+		out += 256;
+		blocks -= 4;
+	}
+}
+
+#endif // ZT_SALSA20_NEON
+
 namespace ZeroTier {
 
+static Salsa20::Kernel _s20BestKernel()
+{
+	for(int k=(int)Salsa20::KERNEL_NEON_X4;k>(int)Salsa20::KERNEL_DEFAULT;--k) {
+		if (Salsa20::kernelSupported((Salsa20::Kernel)k))
+			return (Salsa20::Kernel)k;
+	}
+	return Salsa20::KERNEL_DEFAULT;
+}
+
+Salsa20::Kernel Salsa20::_kernel = _s20BestKernel();
+
+bool Salsa20::kernelSupported(const Kernel k)
+{
+	switch(k) {
+		case KERNEL_DEFAULT:
+			return true;
+#ifdef ZT_SALSA20_SSE
+		case KERNEL_SSE2_X4:
+			return true;
+#ifdef ZT_SALSA20_AVX
+		case KERNEL_AVX2_X8:
+			__builtin_cpu_init();
+			return (__builtin_cpu_supports("avx2") != 0);
+		case KERNEL_AVX512_X8:
+			__builtin_cpu_init();
+			return ((__builtin_cpu_supports("avx2"))&&(__builtin_cpu_supports("avx512f"))&&(__builtin_cpu_supports("avx512vl")));
+#endif
+#endif
+#ifdef ZT_SALSA20_NEON
+		case KERNEL_NEON_X4:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+bool Salsa20::setKernel(const Kernel k)
+{
+	if (!kernelSupported(k))
+		return false;
+	_kernel = k;
+	return true;
+}
+
+const char *Salsa20::kernelName(const Kernel k)
+{
+	switch(k) {
+#ifdef ZT_SALSA20_SSE
+		case KERNEL_DEFAULT: return "sse";
+#else
+		case KERNEL_DEFAULT: return "c";
+#endif
+		case KERNEL_SSE2_X4: return "sse2-x4";
+		case KERNEL_AVX2_X8: return "avx2-x8";
+		case KERNEL_AVX512_X8: return "avx512vl-x8";
+		case KERNEL_NEON_X4: return "neon-x4";
+	}
+	return "unknown";
+}
+
 void Salsa20::init(const void *key,const void *iv)
 {
 #ifdef ZT_SALSA20_SSE
@@ -110,6 +431,51 @@ void Salsa20::init(const void *key,const void *iv)
 
 void Salsa20::crypt12(const void *in,void *out,unsigned int bytes)
 {
+#ifdef ZT_SALSA20_SSE
+	if ((bytes >= 256)&&(_kernel != KERNEL_DEFAULT)) {
+		uint32_t j[16];
+		for(unsigned int k=0;k<16;++k)
+			j[k] = _state.i[_S20SSESLOT[k]];
+		unsigned int blocks = 0;
+#ifdef ZT_SALSA20_AVX
+		if (_kernel >= KERNEL_AVX2_X8) {
+			blocks = (bytes / 64) & ~7U;
+			if (_kernel == KERNEL_AVX512_X8)
+				_salsa2012x8avx512(j,(const uint8_t *)in,(uint8_t *)out,blocks);
+			else _salsa2012x8avx2(j,(const uint8_t *)in,(uint8_t *)out,blocks);
+			const uint64_t ctr = ((uint64_t)j[8] | ((uint64_t)j[9] << 32)) + (uint64_t)blocks;
+			j[8] = (uint32_t)ctr;
+			j[9] = (uint32_t)(ctr >> 32);
+		}
+#endif
+		const unsigned int x4blocks = ((bytes / 64) - blocks) & ~3U;
+		_salsa2012x4(j,(const uint8_t *)in + (blocks * 64),(uint8_t *)out + (blocks * 64),x4blocks);
+		blocks += x4blocks;
+		const uint64_t ctr = ((uint64_t)j[8] | ((uint64_t)j[9] << 32)) + (uint64_t)x4blocks;
+		_state.i[8] = (uint32_t)ctr;
+		_state.i[5] = (uint32_t)(ctr >> 32);
+		bytes -= blocks * 64;
+		if (!bytes)
+			return;
+		in = reinterpret_cast<const uint8_t *>(in) + (blocks * 64);
+		out = reinterpret_cast<uint8_t *>(out) + (blocks * 64);
+	}
+#endif
+#ifdef ZT_SALSA20_NEON
+	if ((bytes >= 256)&&(_kernel == KERNEL_NEON_X4)) {
+		const unsigned int blocks = (bytes / 64) & ~3U;
+		_salsa2012x4neon(_state.i,(const uint8_t *)in,(uint8_t *)out,blocks);
+		const uint64_t ctr = ((uint64_t)_state.i[8] | ((uint64_t)_state.i[9] << 32)) + (uint64_t)blocks;
+		_state.i[8] = (uint32_t)ctr;
+		_state.i[9] = (uint32_t)(ctr >> 32);
+		bytes -= blocks * 64;
+		if (!bytes)
+			return;
+		in = reinterpret_cast<const uint8_t *>(in) + (blocks * 64);
+		out = reinterpret_cast<uint8_t *>(out) + (blocks * 64);
+	}
+#endif
+
 	uint8_t tmp[64];
 	const uint8_t *m = (const uint8_t *)in;
 	uint8_t *c = (uint8_t *)out;
@@ -31,6 +31,50 @@ namespace ZeroTier {
 class Salsa20
 {
 public:
+	/**
+	 * Salsa20/12 keystream kernels, in increasing order of preference
+	 *
+	 * The best supported kernel is selected by CPU detection at startup.
+	 * Wider kernels are only used for the bulk of long inputs; anything
+	 * shorter than their block multiple goes through the default path.
+	 */
+	enum Kernel
+	{
+		KERNEL_DEFAULT = 0,   // one 64-byte block per iteration (SSE or C)
+		KERNEL_SSE2_X4 = 1,   // four blocks per iteration
+		KERNEL_AVX2_X8 = 2,   // eight blocks per iteration
+		KERNEL_AVX512_X8 = 3, // eight blocks per iteration using AVX-512VL rotates
+		KERNEL_NEON_X4 = 4    // four blocks per iteration, aarch64 NEON
+	};
+
+	/**
+	 * @param k Kernel
+	 * @return True if this build and CPU can run this kernel
+	 */
+	static bool kernelSupported(const Kernel k);
+
+	/**
+	 * Override the kernel used by crypt12()
+	 *
+	 * This is intended for testing and benchmarking and is not thread safe
+	 * with respect to concurrent encryption.
+	 *
+	 * @param k Kernel to use
+	 * @return False if kernel is not supported (selection is unchanged)
+	 */
+	static bool setKernel(const Kernel k);
+
+	/**
+	 * @return Kernel currently used by crypt12()
+	 */
+	static inline Kernel kernel() { return _kernel; }
+
+	/**
+	 * @param k Kernel
+	 * @return Short human-readable name of kernel
+	 */
+	static const char *kernelName(const Kernel k);
+
 	Salsa20() {}
 	~Salsa20() { Utils::burn(&_state,sizeof(_state)); }
 
@@ -146,6 +190,8 @@ public:
 	void crypt20(const void *in,void *out,unsigned int bytes);
 
 private:
+	static Kernel _kernel;
+
 	union {
 #ifdef ZT_SALSA20_SSE
 		__m128i v[4];
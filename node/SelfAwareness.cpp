@@ -29,7 +29,9 @@
 #include <string.h>
 
 #include <set>
+#include <map>
 #include <vector>
+#include <algorithm>
 
 #include "Constants.hpp"
 #include "SelfAwareness.hpp"
@@ -44,6 +46,12 @@
 // Entry timeout -- make it fairly long since this is just to prevent stale buildup
 #define ZT_SELFAWARENESS_ENTRY_TIMEOUT 600000
 
+// Ports predicted past the last one seen for each IP of a sequential NAT
+#define ZT_SELFAWARENESS_PREDICTED_PORTS 4
+
+// Largest step between ports handed out in turn for a NAT to count as sequential
+#define ZT_SELFAWARENESS_SEQUENTIAL_MAX_STEP 64
+
 namespace ZeroTier {
 
 class _ResetWithinScope
@@ -66,7 +74,8 @@ private:
 
 SelfAwareness::SelfAwareness(const RuntimeEnvironment *renv) :
 	RR(renv),
-	_phy(128)
+	_phy(128),
+	_phy_m("SelfAwareness::_phy_m")
 {
 }
 
@@ -77,8 +86,9 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 	if ((scope != reporterPhysicalAddress.ipScope())||(scope == InetAddress::IP_SCOPE_NONE)||(scope == InetAddress::IP_SCOPE_LOOPBACK)||(scope == InetAddress::IP_SCOPE_MULTICAST))
 		return;
 
+	const PackedInetAddress reporterPhysicalAddressKey(reporterPhysicalAddress);
 	Mutex::Lock _l(_phy_m);
-	PhySurfaceEntry &entry = _phy[PhySurfaceKey(reporter,receivedOnLocalSocket,reporterPhysicalAddress,scope)];
+	PhySurfaceEntry &entry = _phy[PhySurfaceKey(reporter,receivedOnLocalSocket,reporterPhysicalAddressKey,scope)];
 
 	if ( (trusted) && ((now - entry.ts) < ZT_SELFAWARENESS_ENTRY_TIMEOUT) && (!entry.mySurface.ipsEqual(myPhysicalAddress)) ) {
 		// Changes to external surface reported by trusted peers causes path reset in this scope
@@ -86,6 +96,7 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 
 		entry.mySurface = myPhysicalAddress;
 		entry.ts = now;
+		entry.firstSeen = now;
 		entry.trusted = trusted;
 
 		// Erase all entries in this scope that were not reported from this remote address to prevent 'thrashing'
@@ -96,7 +107,7 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 			PhySurfaceKey *k = (PhySurfaceKey *)0;
 			PhySurfaceEntry *e = (PhySurfaceEntry *)0;
 			while (i.next(k,e)) {
-				if ((k->reporterPhysicalAddress != reporterPhysicalAddress)&&(k->scope == scope))
+				if ((k->reporterPhysicalAddress != reporterPhysicalAddressKey)&&(k->scope == scope))
 					_phy.erase(*k);
 			}
 		}
@@ -106,6 +117,8 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 		RR->topology->eachPeer<_ResetWithinScope &>(rset);
 	} else {
 		// Otherwise just update DB to use to determine external surface info
+		if ((!entry.ts)||(entry.mySurface != myPhysicalAddress))
+			entry.firstSeen = now;
 		entry.mySurface = myPhysicalAddress;
 		entry.ts = now;
 		entry.trusted = trusted;
@@ -124,13 +137,30 @@ void SelfAwareness::clean(int64_t now)
 	}
 }
 
-std::vector<InetAddress> SelfAwareness::getSymmetricNatPredictions()
+std::vector<InetAddress> SelfAwareness::getReflexiveAddresses()
+{
+	std::vector<InetAddress> r;
+	Mutex::Lock _l(_phy_m);
+	Hashtable< PhySurfaceKey,PhySurfaceEntry >::Iterator i(_phy);
+	PhySurfaceKey *k = (PhySurfaceKey *)0;
+	PhySurfaceEntry *e = (PhySurfaceEntry *)0;
+	while (i.next(k,e)) {
+		// Only what trusted peers report, see the security note below
+		if ((e->trusted)&&(e->mySurface.ipScope() == InetAddress::IP_SCOPE_GLOBAL)&&(std::find(r.begin(),r.end(),e->mySurface) == r.end()))
+			r.push_back(e->mySurface);
+	}
+	return r;
+}
+
+ZT_NatType SelfAwareness::_analyze(std::vector<InetAddress> *predictions)
 {
 	/* This is based on ideas and strategies found here:
 	 * https://tools.ietf.org/html/draft-takeda-symmetric-nat-traversal-00
 	 *
-	 * For each IP address reported by a trusted (upstream) peer, we find
-	 * the external port most recently reported by ANY peer for that IP.
+	 * For each local socket we take every external IPv4 address and port
+	 * reported by ANY peer for IPs that trusted (upstream) peers have also
+	 * reported, in the order they were first seen, and look at how ports
+	 * were handed out.
 	 *
 	 * We only do any of this for global IPv4 addresses since private IPs
 	 * and IPv6 are not going to have symmetric NAT.
@@ -147,64 +177,109 @@ std::vector<InetAddress> SelfAwareness::getSymmetricNatPredictions()
 	 * read or modify traffic, but they could gather meta-data for forensics
 	 * purpsoes or use this as a DOS attack vector. */
 
-	std::map< uint32_t,unsigned int > maxPortByIp;
-	InetAddress theOneTrueSurface;
+	// Mappings by local socket, then by external IP, as (first seen,port)
+	std::map< int64_t,std::map< uint32_t,std::vector< std::pair<uint64_t,unsigned int> > > > mappings;
 	{
 		Mutex::Lock _l(_phy_m);
 
-		// First check to see if this is a symmetric NAT and enumerate external IPs learned from trusted peers
-		bool symmetric = false;
+		std::set<uint32_t> trustedIps;
 		{
 			Hashtable< PhySurfaceKey,PhySurfaceEntry >::Iterator i(_phy);
 			PhySurfaceKey *k = (PhySurfaceKey *)0;
 			PhySurfaceEntry *e = (PhySurfaceEntry *)0;
 			while (i.next(k,e)) {
-				if ((e->trusted)&&(e->mySurface.ss_family == AF_INET)&&(e->mySurface.ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
-					if (!theOneTrueSurface)
-						theOneTrueSurface = e->mySurface;
-					else if (theOneTrueSurface != e->mySurface)
-						symmetric = true;
-					maxPortByIp[reinterpret_cast<const struct sockaddr_in *>(&(e->mySurface))->sin_addr.s_addr] = e->mySurface.port();
-				}
+				if ((e->trusted)&&(e->mySurface.ss_family == AF_INET)&&(e->mySurface.ipScope() == InetAddress::IP_SCOPE_GLOBAL))
+					trustedIps.insert(reinterpret_cast<const struct sockaddr_in *>(&(e->mySurface))->sin_addr.s_addr);
 			}
 		}
-		if (!symmetric)
-			return std::vector<InetAddress>();
+		if (trustedIps.empty())
+			return ZT_NAT_TYPE_UNKNOWN;
 
-		{	// Then find the highest issued port per IP
-			Hashtable< PhySurfaceKey,PhySurfaceEntry >::Iterator i(_phy);
-			PhySurfaceKey *k = (PhySurfaceKey *)0;
-			PhySurfaceEntry *e = (PhySurfaceEntry *)0;
-			while (i.next(k,e)) {
-				if ((e->mySurface.ss_family == AF_INET)&&(e->mySurface.ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
-					const unsigned int port = e->mySurface.port();
-					std::map< uint32_t,unsigned int >::iterator mp(maxPortByIp.find(reinterpret_cast<const struct sockaddr_in *>(&(e->mySurface))->sin_addr.s_addr));
-					if ((mp != maxPortByIp.end())&&(mp->second < port))
-						mp->second = port;
-				}
+		Hashtable< PhySurfaceKey,PhySurfaceEntry >::Iterator i(_phy);
+		PhySurfaceKey *k = (PhySurfaceKey *)0;
+		PhySurfaceEntry *e = (PhySurfaceEntry *)0;
+		while (i.next(k,e)) {
+			if ((e->mySurface.ss_family == AF_INET)&&(e->mySurface.ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
+				const uint32_t ip = reinterpret_cast<const struct sockaddr_in *>(&(e->mySurface))->sin_addr.s_addr;
+				if (trustedIps.count(ip))
+					mappings[k->receivedOnLocalSocket][ip].push_back(std::pair<uint64_t,unsigned int>(e->firstSeen,e->mySurface.port()));
 			}
 		}
 	}
 
-	std::vector<InetAddress> r;
+	ZT_NatType type = ZT_NAT_TYPE_CONE;
+	for(std::map< int64_t,std::map< uint32_t,std::vector< std::pair<uint64_t,unsigned int> > > >::iterator sock(mappings.begin());sock!=mappings.end();++sock) {
+		std::map< uint32_t,std::vector< std::pair<uint64_t,unsigned int> > > &byIp = sock->second;
 
-	// Try next port up from max for each
-	for(std::map< uint32_t,unsigned int >::iterator i(maxPortByIp.begin());i!=maxPortByIp.end();++i) {
-		unsigned int p = i->second + 1;
-		if (p > 65535) p -= 64511;
-		const InetAddress pred(&(i->first),4,p);
-		if (std::find(r.begin(),r.end(),pred) == r.end())
-			r.push_back(pred);
-	}
+		// One port per IP: a cone NAT, or if it's the same port on several IPs a port preserving one
+		unsigned int commonPort = 0;
+		bool onePortPerIp = true;
+		for(std::map< uint32_t,std::vector< std::pair<uint64_t,unsigned int> > >::iterator ip(byIp.begin());ip!=byIp.end();++ip) {
+			std::sort(ip->second.begin(),ip->second.end());
+			for(std::vector< std::pair<uint64_t,unsigned int> >::const_iterator m(ip->second.begin());m!=ip->second.end();++m) {
+				if (m->second != ip->second.front().second)
+					onePortPerIp = false;
+			}
+			if (ip == byIp.begin())
+				commonPort = ip->second.front().second;
+			else if (commonPort != ip->second.front().second)
+				commonPort = 0;
+		}
+		if (onePortPerIp) {
+			if ((byIp.size() > 1)&&(commonPort)) {
+				type = std::max(type,ZT_NAT_TYPE_PORT_PRESERVING);
+				if (predictions) {
+					for(std::map< uint32_t,std::vector< std::pair<uint64_t,unsigned int> > >::iterator ip(byIp.begin());ip!=byIp.end();++ip)
+						_predict(*predictions,ip->first,commonPort);
+				}
+			}
+			continue;
+		}
 
-	// Try a random port for each -- there are only 65535 so eventually it should work
-	for(std::map< uint32_t,unsigned int >::iterator i(maxPortByIp.begin());i!=maxPortByIp.end();++i) {
-		const InetAddress pred(&(i->first),4,1024 + ((unsigned int)RR->node->prng() % 64511));
-		if (std::find(r.begin(),r.end(),pred) == r.end())
-			r.push_back(pred);
+		// Otherwise ports rising by small steps in the order they were handed
+		// out are a sequential NAT, so the next ones are likely to be the next
+		// few steps up. Anything else is random, so try the next port up from
+		// the highest and one at random in case we get lucky.
+		for(std::map< uint32_t,std::vector< std::pair<uint64_t,unsigned int> > >::iterator ip(byIp.begin());ip!=byIp.end();++ip) {
+			const std::vector< std::pair<uint64_t,unsigned int> > &ports = ip->second;
+			if (ports.size() < 2)
+				continue;
+			int step = 0;
+			bool sequential = true;
+			unsigned int maxPort = ports.front().second;
+			for(unsigned long j=1;j<ports.size();++j) {
+				const int d = (int)ports[j].second - (int)ports[j - 1].second;
+				if ((d < 0)||(d > ZT_SELFAWARENESS_SEQUENTIAL_MAX_STEP))
+					sequential = false;
+				else if ((d > 0)&&((!step)||(d < step)))
+					step = d;
+				maxPort = std::max(maxPort,ports[j].second);
+			}
+			if ((sequential)&&(step)) {
+				type = std::max(type,ZT_NAT_TYPE_SEQUENTIAL);
+				if (predictions) {
+					for(unsigned int n=1;n<=ZT_SELFAWARENESS_PREDICTED_PORTS;++n)
+						_predict(*predictions,ip->first,ports.back().second + (n * (unsigned int)step));
+				}
+			} else {
+				type = std::max(type,ZT_NAT_TYPE_RANDOM);
+				if (predictions) {
+					_predict(*predictions,ip->first,maxPort + 1);
+					_predict(*predictions,ip->first,1024 + ((unsigned int)RR->node->prng() % 64511));
+				}
+			}
+		}
 	}
 
-	return r;
+	return type;
+}
+
+void SelfAwareness::_predict(std::vector<InetAddress> &predictions,const uint32_t ip,unsigned int port)
+{
+	if (port > 65535) port -= 64511;
+	const InetAddress pred(&ip,4,port);
+	if (std::find(predictions.begin(),predictions.end(),pred) == predictions.end())
+		predictions.push_back(pred);
 }
 
 } // namespace ZeroTier
@@ -27,8 +27,13 @@
 #ifndef ZT_SELFAWARENESS_HPP
 #define ZT_SELFAWARENESS_HPP
 
+#include <vector>
+
+#include "../include/ZeroTierOne.h"
+
 #include "Constants.hpp"
 #include "InetAddress.hpp"
+#include "PackedInetAddress.hpp"
 #include "Hashtable.hpp"
 #include "Address.hpp"
 #include "Mutex.hpp"
@@ -64,23 +69,48 @@ public:
 	 */
 	void clean(int64_t now);
 
+	/**
+	 * Get our external (server reflexive) addresses as reported by trusted peers
+	 *
+	 * @return Distinct global scope addresses, more than one if we are multi-homed or behind a symmetric NAT
+	 */
+	std::vector<InetAddress> getReflexiveAddresses();
+
+	/**
+	 * Work out how our NAT maps sockets to external ports
+	 *
+	 * Each local socket's external addresses, as reported by all peers for
+	 * IPs that trusted peers have confirmed, are put in the order they were
+	 * first seen. One address and port per IP is a cone NAT (or none), one
+	 * port on several IPs a port preserving NAT, ports rising by small steps
+	 * a sequential NAT, and anything else a random one.
+	 *
+	 * @return NAT type
+	 */
+	inline ZT_NatType natType() { return _analyze((std::vector<InetAddress> *)0); }
+
 	/**
 	 * If we appear to be behind a symmetric NAT, get predictions for possible external endpoints
 	 *
-	 * @return Symmetric NAT predictions or empty vector if none
+	 * @return Symmetric NAT predictions, most likely first, or empty vector if none
 	 */
-	std::vector<InetAddress> getSymmetricNatPredictions();
+	inline std::vector<InetAddress> getSymmetricNatPredictions()
+	{
+		std::vector<InetAddress> r;
+		_analyze(&r);
+		return r;
+	}
 
 private:
 	struct PhySurfaceKey
 	{
 		Address reporter;
 		int64_t receivedOnLocalSocket;
-		InetAddress reporterPhysicalAddress;
+		PackedInetAddress reporterPhysicalAddress;
 		InetAddress::IpScope scope;
 
 		PhySurfaceKey() : reporter(),scope(InetAddress::IP_SCOPE_NONE) {}
-		PhySurfaceKey(const Address &r,const int64_t rol,const InetAddress &ra,InetAddress::IpScope s) : reporter(r),receivedOnLocalSocket(rol),reporterPhysicalAddress(ra),scope(s) {}
+		PhySurfaceKey(const Address &r,const int64_t rol,const PackedInetAddress &ra,InetAddress::IpScope s) : reporter(r),receivedOnLocalSocket(rol),reporterPhysicalAddress(ra),scope(s) {}
 
 		inline unsigned long hashCode() const { return ((unsigned long)reporter.toInt() + (unsigned long)scope); }
 		inline bool operator==(const PhySurfaceKey &k) const { return ((reporter == k.reporter)&&(receivedOnLocalSocket == k.receivedOnLocalSocket)&&(reporterPhysicalAddress == k.reporterPhysicalAddress)&&(scope == k.scope)); }
@@ -89,12 +119,16 @@ private:
 	{
 		InetAddress mySurface;
 		uint64_t ts;
+		uint64_t firstSeen; // when mySurface was first reported
 		bool trusted;
 
-		PhySurfaceEntry() : mySurface(),ts(0),trusted(false) {}
-		PhySurfaceEntry(const InetAddress &a,const uint64_t t) : mySurface(a),ts(t),trusted(false) {}
+		PhySurfaceEntry() : mySurface(),ts(0),firstSeen(0),trusted(false) {}
+		PhySurfaceEntry(const InetAddress &a,const uint64_t t) : mySurface(a),ts(t),firstSeen(t),trusted(false) {}
 	};
 
+	ZT_NatType _analyze(std::vector<InetAddress> *predictions);
+	static void _predict(std::vector<InetAddress> &predictions,uint32_t ip,unsigned int port);
+
 	const RuntimeEnvironment *RR;
 
 	Hashtable< PhySurfaceKey,PhySurfaceEntry > _phy;
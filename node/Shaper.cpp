@@ -0,0 +1,315 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "Shaper.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Node.hpp"
+#include "Switch.hpp"
+#include "Metrics.hpp"
+
+namespace ZeroTier {
+
+Shaper::Shaper(const RuntimeEnvironment *renv,int64_t now) :
+	RR(renv),
+	_networks(8),
+	_members(8),
+	_limitCount(0),
+	_paths(8),
+	_pacing(false),
+	_lastPathPrune(now),
+	_held(1,now),
+	_heldBytes(0),
+	_lastService(now),
+	_lock("Shaper::_lock")
+{
+}
+
+Shaper::~Shaper()
+{
+	// Everything held is due within ZT_SHAPER_MAX_DELAY of the last service
+	std::vector<_Held *> held;
+	_held.expire(_lastService + ZT_SHAPER_MAX_DELAY + 1,held);
+	for(std::vector<_Held *>::iterator h(held.begin());h!=held.end();++h)
+		_free(*h);
+}
+
+void Shaper::setNetworkRate(uint64_t nwid,uint64_t bytesPerSecond)
+{
+	Mutex::Lock _l(_lock);
+	if (bytesPerSecond) {
+		_Limit &l = _networks[nwid];
+		if (l.rate != bytesPerSecond)
+			_setRate(l,bytesPerSecond);
+	} else {
+		_networks.erase(nwid);
+	}
+	_limitCount = _networks.size() + _members.size();
+}
+
+void Shaper::setMemberRate(const Address &member,uint64_t bytesPerSecond)
+{
+	Mutex::Lock _l(_lock);
+	if (!member) {
+		_members.clear();
+	} else if (bytesPerSecond) {
+		_Limit &l = _members[member];
+		if (l.rate != bytesPerSecond)
+			_setRate(l,bytesPerSecond);
+	} else {
+		_members.erase(member);
+	}
+	_limitCount = _networks.size() + _members.size();
+}
+
+void Shaper::setPathPacing(bool enabled)
+{
+	Mutex::Lock _l(_lock);
+	_pacing = enabled;
+	if (!enabled)
+		_paths.clear();
+}
+
+Shaper::Result Shaper::frame(void *tPtr,const SharedPtr<Path> &path,Egress::Class c,uint64_t nwid,const Address &destination,const void *data,unsigned int len,unsigned int mtu,int64_t now,unsigned int tos)
+{
+	Result r;
+	{
+		Mutex::Lock _l(_lock);
+		_Limit *limits[3];
+		unsigned int n = 0;
+		if ((nwid)&&((limits[n] = _networks.get(nwid))))
+			++n;
+		if ((limits[n] = _members.get(destination)))
+			++n;
+		if ((_pacing)&&(c == Egress::BULK)&&(path)) {
+			const uint64_t pr = path->paceRate();
+			if (pr) {
+				_Limit &l = _paths[(uint64_t)((uintptr_t)path.ptr())];
+				if (l.rate != pr)
+					_setPaceRate(l,pr);
+				limits[n++] = &l;
+			}
+		}
+		if (!n)
+			return SEND;
+
+		int64_t due = 0;
+		r = _check(limits,n,len,now,due);
+		if (r == HELD) {
+			_Held *const h = _hold(due,data,len);
+			if (h) {
+				h->path = path;
+				h->destination = destination;
+				h->c = c;
+				h->nwid = nwid;
+				h->mtu = mtu;
+				h->tos = tos;
+			} else {
+				r = DROP;
+			}
+		}
+	}
+	service(tPtr,now); // traffic itself releases what's due between background task runs
+	return r;
+}
+
+Shaper::Result Shaper::relay(void *tPtr,int64_t localSocket,const InetAddress &fromAddr,const Address &source,const Address &destination,const void *data,unsigned int len,int64_t now)
+{
+	Result r;
+	{
+		Mutex::Lock _l(_lock);
+		_Limit *limits[2];
+		unsigned int n = 0;
+		if ((source)&&((limits[n] = _members.get(source))))
+			++n;
+		if ((limits[n] = _members.get(destination)))
+			++n;
+		if (!n)
+			return SEND;
+
+		int64_t due = 0;
+		r = _check(limits,n,len,now,due);
+		if (r == HELD) {
+			_Held *const h = _hold(due,data,len);
+			if (h) {
+				h->fromAddr = fromAddr;
+				h->localSocket = localSocket;
+				h->source = source;
+				h->destination = destination;
+			} else {
+				r = DROP;
+			}
+		}
+	}
+	service(tPtr,now);
+	return r;
+}
+
+unsigned long Shaper::service(void *tPtr,int64_t now)
+{
+	std::vector<_Held *> due;
+	{
+		Mutex::Lock _l(_lock);
+		if (now > _lastService)
+			_lastService = now;
+		_held.expire(now,due); // also keeps the wheel's clock current while nothing is held
+
+		// Forget the pace of paths that have been idle for a while, since a
+		// path's pointer may be reused for another once it is freed
+		if ((now - _lastPathPrune) >= ZT_PING_CHECK_INVERVAL) {
+			_lastPathPrune = now;
+			Hashtable< uint64_t,_Limit >::Iterator i(_paths);
+			uint64_t *k = (uint64_t *)0;
+			_Limit *l = (_Limit *)0;
+			while (i.next(k,l)) {
+				if (l->tat < ((now - ZT_PING_CHECK_INVERVAL) * 1000))
+					_paths.erase(*k);
+			}
+		}
+		for(std::vector<_Held *>::const_iterator i(due.begin());i!=due.end();++i)
+			_heldBytes -= (*i)->len;
+	}
+
+	for(std::vector<_Held *>::iterator i(due.begin());i!=due.end();++i) {
+		_Held *const h = *i;
+		if (h->path) {
+			if ((h->c != Egress::CONTROL)&&(RR->egress)&&(RR->egress->enabled()))
+				RR->egress->send(tPtr,h->path,h->c,h->nwid,h->data,h->len,h->mtu,now,h->tos);
+			else h->path->sendFragmented(RR,tPtr,h->data,h->len,h->mtu,now,h->tos);
+		} else {
+			RR->sw->relayNow(tPtr,h->localSocket,h->fromAddr,h->source,h->destination,h->data,h->len,now);
+		}
+		_free(h);
+	}
+
+	return (_heldBytes) ? 1 : ZT_PING_CHECK_INVERVAL;
+}
+
+unsigned int Shaper::stats(ZT_RateLimitStats *stats,unsigned int maxStats) const
+{
+	Mutex::Lock _l(_lock);
+	unsigned int n = 0;
+	{
+		Hashtable< uint64_t,_Limit >::Iterator i(const_cast<Shaper *>(this)->_networks);
+		uint64_t *k = (uint64_t *)0;
+		_Limit *l = (_Limit *)0;
+		while ((n < maxStats)&&(i.next(k,l))) {
+			ZT_RateLimitStats &s = stats[n++];
+			s.networkId = *k;
+			s.address = 0;
+			s.rate = l->rate;
+			s.packetsPassed = l->packetsPassed; s.bytesPassed = l->bytesPassed;
+			s.packetsDelayed = l->packetsDelayed; s.bytesDelayed = l->bytesDelayed;
+			s.packetsDropped = l->packetsDropped; s.bytesDropped = l->bytesDropped;
+		}
+	}
+	{
+		Hashtable< Address,_Limit >::Iterator i(const_cast<Shaper *>(this)->_members);
+		Address *k = (Address *)0;
+		_Limit *l = (_Limit *)0;
+		while ((n < maxStats)&&(i.next(k,l))) {
+			ZT_RateLimitStats &s = stats[n++];
+			s.networkId = 0;
+			s.address = k->toInt();
+			s.rate = l->rate;
+			s.packetsPassed = l->packetsPassed; s.bytesPassed = l->bytesPassed;
+			s.packetsDelayed = l->packetsDelayed; s.bytesDelayed = l->bytesDelayed;
+			s.packetsDropped = l->packetsDropped; s.bytesDropped = l->bytesDropped;
+		}
+	}
+	return n;
+}
+
+Shaper::Result Shaper::_check(_Limit **limits,unsigned int count,unsigned int len,int64_t now,int64_t &due)
+{
+	// The packet may leave once every limit's theoretical arrival time is
+	// within that limit's burst, and every limit is charged for it
+	const int64_t t = now * 1000;
+	int64_t leave = t;
+	for(unsigned int i=0;i<count;++i) {
+		const int64_t earliest = std::max(limits[i]->tat,t) - limits[i]->burst;
+		if (earliest > leave)
+			leave = earliest;
+	}
+
+	if ((leave > t)&&(((leave - t) > ((int64_t)ZT_SHAPER_MAX_DELAY * 1000))||((_heldBytes + len) > ZT_SHAPER_MAX_HELD_BYTES))) {
+		for(unsigned int i=0;i<count;++i) {
+			++limits[i]->packetsDropped;
+			limits[i]->bytesDropped += len;
+		}
+		Metrics::drop(ZT_METRICS_DROP_RATE_LIMIT);
+		return DROP;
+	}
+
+	for(unsigned int i=0;i<count;++i) {
+		_Limit &l = *(limits[i]);
+		l.tat = std::max(l.tat,t) + (int64_t)(((uint64_t)len * 1000000ULL) / l.rate);
+		if (leave > t) {
+			++l.packetsDelayed;
+			l.bytesDelayed += len;
+		} else {
+			++l.packetsPassed;
+			l.bytesPassed += len;
+		}
+	}
+
+	if (leave > t) {
+		due = (leave + 999) / 1000;
+		return HELD;
+	}
+	return SEND;
+}
+
+Shaper::_Held *Shaper::_hold(int64_t due,const void *data,unsigned int len)
+{
+	// assumes _lock is locked
+	void *const hm = ::malloc(sizeof(_Held) + len);
+	if (!hm)
+		return (_Held *)0;
+	_Held *const h = new (hm) _Held();
+	h->localSocket = -1;
+	h->c = Egress::CONTROL;
+	h->nwid = 0;
+	h->len = len;
+	h->mtu = len;
+	memcpy(h->data,data,len);
+	_held.add(due,h);
+	_heldBytes += len;
+	return h;
+}
+
+void Shaper::_free(_Held *h)
+{
+	h->~_Held();
+	::free(h);
+}
+
+} // namespace ZeroTier
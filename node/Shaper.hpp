@@ -0,0 +1,221 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_SHAPER_HPP
+#define ZT_SHAPER_HPP
+
+#include <stdint.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "../include/ZeroTierOne.h"
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "SharedPtr.hpp"
+#include "Path.hpp"
+#include "Address.hpp"
+#include "InetAddress.hpp"
+#include "Hashtable.hpp"
+#include "TimerWheel.hpp"
+#include "Egress.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * Paces traffic to per-network and per-member rate limits
+ *
+ * Network limits come from network configs and cover frames this node
+ * sends on the network. Member limits are set locally and cover frames
+ * sent to the member and packets relayed from or to it. A packet covered
+ * by more than one limit has to meet all of them.
+ *
+ * Each limit keeps a theoretical arrival time (GCRA), so checking a packet
+ * is a lookup and an add. A packet that is early by less than the limit's
+ * burst goes out at once. One that is early by more is copied into a timer
+ * wheel and sent when it's due, and one that would have to wait longer than
+ * ZT_SHAPER_MAX_DELAY is dropped. Bursts are spread out instead of being
+ * cut off at the tail, which TCP handles much better.
+ *
+ * With path pacing on, bulk frames are also paced to each path's estimated
+ * rate (see Path::paceRate()) so bursts read from the tap don't overrun
+ * shallow buffers along the way. Control packets and latency-sensitive
+ * frames are never paced.
+ */
+class Shaper
+{
+public:
+	enum Result
+	{
+		SEND = 0, // within all limits, caller sends now
+		HELD = 1, // copied and will be sent when due
+		DROP = 2  // over a limit by too much
+	};
+
+	/**
+	 * @param renv Runtime environment
+	 * @param now Current time
+	 */
+	Shaper(const RuntimeEnvironment *renv,int64_t now);
+	~Shaper();
+
+	/**
+	 * @param nwid Network ID
+	 * @param bytesPerSecond Rate or 0 for none
+	 */
+	void setNetworkRate(uint64_t nwid,uint64_t bytesPerSecond);
+
+	/**
+	 * @param member Member address or nil to remove all member limits
+	 * @param bytesPerSecond Rate or 0 for none
+	 */
+	void setMemberRate(const Address &member,uint64_t bytesPerSecond);
+
+	/**
+	 * @param enabled If true, pace bulk frames to the estimated rate of the path they're sent over
+	 */
+	void setPathPacing(bool enabled);
+
+	/**
+	 * @return True if any limit is set or paths are paced (checked before anything else so unlimited traffic costs nothing)
+	 */
+	inline bool active() const { return ((_limitCount != 0)||(_pacing)); }
+
+	/**
+	 * Check an armored frame packet against its network's and destination's limits and its path's pace
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param path Path to send via
+	 * @param c Egress class for sending via the egress scheduler
+	 * @param nwid Network ID or 0 if not a frame
+	 * @param destination Destination member
+	 * @param data Armored packet
+	 * @param len Length of packet
+	 * @param mtu Fragment size for this path
+	 * @param now Current time
+	 * @param tos IP traffic class of the frame inside
+	 * @return SEND, HELD or DROP
+	 */
+	Result frame(void *tPtr,const SharedPtr<Path> &path,Egress::Class c,uint64_t nwid,const Address &destination,const void *data,unsigned int len,unsigned int mtu,int64_t now,unsigned int tos);
+
+	/**
+	 * Check a packet or fragment being relayed against its source's and destination's limits
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param localSocket Local socket it was received on
+	 * @param fromAddr Address it was received from
+	 * @param source Source member or nil for fragments
+	 * @param destination Destination member
+	 * @param data Packet or fragment with hops already incremented
+	 * @param len Length of packet or fragment
+	 * @param now Current time
+	 * @return SEND, HELD or DROP
+	 */
+	Result relay(void *tPtr,int64_t localSocket,const InetAddress &fromAddr,const Address &source,const Address &destination,const void *data,unsigned int len,int64_t now);
+
+	/**
+	 * Send held packets that are due
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return Milliseconds until this should be called again, or ZT_PING_CHECK_INVERVAL if nothing is held
+	 */
+	unsigned long service(void *tPtr,int64_t now);
+
+	/**
+	 * @param stats Buffer to fill
+	 * @param maxStats Size of buffer
+	 * @return Number of entries filled
+	 */
+	unsigned int stats(ZT_RateLimitStats *stats,unsigned int maxStats) const;
+
+	/**
+	 * @return Bytes currently held
+	 */
+	inline unsigned long heldBytes() const { return _heldBytes; }
+
+private:
+	struct _Limit
+	{
+		_Limit() : rate(0),burst(0),tat(0),packetsPassed(0),bytesPassed(0),packetsDelayed(0),bytesDelayed(0),packetsDropped(0),bytesDropped(0) {}
+		uint64_t rate; // bytes per second
+		int64_t burst; // microseconds a packet may be early and still pass
+		int64_t tat; // theoretical arrival time in microseconds
+		uint64_t packetsPassed,bytesPassed;
+		uint64_t packetsDelayed,bytesDelayed;
+		uint64_t packetsDropped,bytesDropped;
+	};
+	struct _Held
+	{
+		SharedPtr<Path> path; // NULL for relayed packets
+		InetAddress fromAddr;
+		int64_t localSocket;
+		Address source;
+		Address destination;
+		Egress::Class c;
+		uint64_t nwid;
+		unsigned int len;
+		unsigned int mtu;
+		unsigned int tos;
+		uint8_t data[1]; // actually len bytes
+	};
+
+	static inline void _setRate(_Limit &l,const uint64_t bytesPerSecond)
+	{
+		l.rate = bytesPerSecond;
+		l.burst = std::max((int64_t)ZT_SHAPER_BURST_PERIOD * 1000,(int64_t)(((uint64_t)ZT_SHAPER_MIN_BURST * 1000000ULL) / bytesPerSecond));
+	}
+
+	static inline void _setPaceRate(_Limit &l,const uint64_t bytesPerSecond)
+	{
+		l.rate = bytesPerSecond;
+		l.burst = std::max((int64_t)ZT_PATH_PACING_BURST_PERIOD * 1000,(int64_t)(((uint64_t)ZT_PATH_PACING_MIN_BURST * 1000000ULL) / bytesPerSecond));
+	}
+
+	Result _check(_Limit **limits,unsigned int count,unsigned int len,int64_t now,int64_t &due);
+	_Held *_hold(int64_t due,const void *data,unsigned int len);
+	static void _free(_Held *h);
+
+	const RuntimeEnvironment *const RR;
+
+	Hashtable< uint64_t,_Limit > _networks;
+	Hashtable< Address,_Limit > _members;
+	volatile unsigned long _limitCount;
+	Hashtable< uint64_t,_Limit > _paths; // by Path pointer while path pacing is on
+	volatile bool _pacing;
+	int64_t _lastPathPrune;
+	TimerWheel< _Held * > _held;
+	volatile unsigned long _heldBytes;
+	int64_t _lastService;
+	mutable Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
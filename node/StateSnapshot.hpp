@@ -0,0 +1,203 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_STATESNAPSHOT_HPP
+#define ZT_STATESNAPSHOT_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "Constants.hpp"
+#include "Address.hpp"
+#include "Buffer.hpp"
+#include "Packet.hpp"
+
+#define ZT_STATE_SNAPSHOT_VERSION 1
+
+// <[4] "ZTSS"><[1] version><[8] timestamp><[5] address of node that wrote it>
+#define ZT_STATE_SNAPSHOT_HEADER_SIZE (4 + 1 + 8 + ZT_ADDRESS_LENGTH)
+
+// Records hold one peer, credential or slice of a multicast group, and credentials fit in packets
+#define ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE ZT_PROTO_MAX_PACKET_LENGTH
+
+// Multicast group members per record
+#define ZT_STATE_SNAPSHOT_MULTICAST_MEMBERS_PER_RECORD 512
+
+namespace ZeroTier {
+
+/**
+ * Bulk dump of the core's soft state for fast restarts
+ *
+ * A snapshot is a header followed by records, each a type byte, a 32-bit
+ * length and a payload in the format its owner already uses on the wire or
+ * in the peer cache. Records are read one at a time straight out of the
+ * caller's memory, so a snapshot can be restored from a mapped file without
+ * reading it first. Records of unknown type or that are too big are
+ * skipped, and reading stops at the first truncated one.
+ */
+class StateSnapshot
+{
+public:
+	enum RecordType
+	{
+		RECORD_PEER = 1,                // <[8] last receive><peer cache entry>
+		RECORD_COLD_PEER = 2,           // <[8] last receive><peer cache entry with one path>
+		RECORD_MULTICAST_MEMBERS = 3,   // <[8] network ID><[6] MAC><[4] ADI><[2] count>[<[5] address><[8] last LIKE>]...
+		RECORD_COM = 4,                 // certificates and other credentials of members of our networks
+		RECORD_CAPABILITY = 5,
+		RECORD_TAG = 6,
+		RECORD_COO = 7
+	};
+	enum { RECORD_TYPE_COUNT = 8 };
+
+	/**
+	 * Begin a snapshot
+	 *
+	 * @param a Address of this node
+	 * @param timestamp Time snapshot was taken
+	 */
+	StateSnapshot(const Address &a,const int64_t timestamp)
+	{
+		memset(_items,0,sizeof(_items));
+		Buffer<ZT_STATE_SNAPSHOT_HEADER_SIZE> h;
+		h.append("ZTSS",4);
+		h.append((uint8_t)ZT_STATE_SNAPSHOT_VERSION);
+		h.append((uint64_t)timestamp);
+		a.appendTo(h);
+		_data.append((const char *)h.data(),h.size());
+	}
+
+	/**
+	 * Append a record
+	 *
+	 * @param t Record type
+	 * @param payload Record payload
+	 * @param items Number of things in this record, for counting only
+	 */
+	template<unsigned int C>
+	inline void add(const RecordType t,const Buffer<C> &payload,const unsigned long items = 1)
+	{
+		uint8_t h[5];
+		h[0] = (uint8_t)t;
+		h[1] = (uint8_t)(payload.size() >> 24);
+		h[2] = (uint8_t)(payload.size() >> 16);
+		h[3] = (uint8_t)(payload.size() >> 8);
+		h[4] = (uint8_t)payload.size();
+		_data.append((const char *)h,5);
+		_data.append((const char *)payload.data(),payload.size());
+		_items[(unsigned int)t] += items;
+	}
+
+	/**
+	 * @param t Record type
+	 * @return Things added in records of this type
+	 */
+	inline unsigned long items(const RecordType t) const { return _items[(unsigned int)t]; }
+
+	/**
+	 * @return Snapshot so far
+	 */
+	inline const std::string &data() const { return _data; }
+
+	/**
+	 * Reads records from a snapshot in place
+	 */
+	class Reader
+	{
+	public:
+		/**
+		 * @param data Snapshot
+		 * @param len Length of snapshot in bytes
+		 * @param a Address of this node (snapshots written by others are not valid)
+		 */
+		Reader(const void *data,const unsigned long len,const Address &a) :
+			_p(reinterpret_cast<const uint8_t *>(data)),
+			_eof(reinterpret_cast<const uint8_t *>(data) + len),
+			_timestamp(0)
+		{
+			if ((len >= ZT_STATE_SNAPSHOT_HEADER_SIZE)&&(!memcmp(_p,"ZTSS",4))&&(_p[4] == ZT_STATE_SNAPSHOT_VERSION)&&(Address(_p + 13,ZT_ADDRESS_LENGTH) == a)) {
+				for(unsigned int i=5;i<13;++i)
+					_timestamp = (_timestamp << 8) | (int64_t)_p[i];
+				_p += ZT_STATE_SNAPSHOT_HEADER_SIZE;
+			} else {
+				_p = _eof;
+			}
+		}
+
+		/**
+		 * @return True if the header checked out
+		 */
+		inline bool valid() const { return (_timestamp != 0); }
+
+		/**
+		 * @return Time snapshot was taken
+		 */
+		inline int64_t timestamp() const { return _timestamp; }
+
+		/**
+		 * Get the next record
+		 *
+		 * @param t Set to record type
+		 * @param payload Filled with record payload
+		 * @return False at end of snapshot or at a truncated record
+		 */
+		inline bool next(RecordType &t,Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &payload)
+		{
+			for(;;) {
+				if ((unsigned long)(_eof - _p) < 5)
+					return false;
+				const unsigned int type = _p[0];
+				const unsigned long len = ((unsigned long)_p[1] << 24) | ((unsigned long)_p[2] << 16) | ((unsigned long)_p[3] << 8) | (unsigned long)_p[4];
+				if ((unsigned long)(_eof - (_p + 5)) < len) {
+					_p = _eof;
+					return false;
+				}
+				const uint8_t *const r = _p + 5;
+				_p = r + len;
+				if ((type > 0)&&(type < RECORD_TYPE_COUNT)&&(len <= ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE)) {
+					payload.copyFrom(r,(unsigned int)len);
+					t = (RecordType)type;
+					return true;
+				}
+			}
+		}
+
+	private:
+		const uint8_t *_p;
+		const uint8_t *const _eof;
+		int64_t _timestamp;
+	};
+
+private:
+	std::string _data;
+	unsigned long _items[RECORD_TYPE_COUNT];
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -44,24 +44,95 @@
 #include "SelfAwareness.hpp"
 #include "Packet.hpp"
 #include "Trace.hpp"
+#include "Cluster.hpp"
+#include "Shaper.hpp"
+#include "Metrics.hpp"
+#include "FrameCapture.hpp"
+#include "FrameBuffer.hpp"
+#include "Probes.hpp"
 
 namespace ZeroTier {
 
+struct Switch::AggregatedFrames
+{
+	SharedPtr<Peer> peer;
+	uint64_t nwid;
+	unsigned int frames;
+	unsigned int bytes;
+	Egress::Class egressClass; // most urgent class of any frame held
+	unsigned int tos; // IP traffic class for the packet, see _aggregate()
+	bool compress;
+	uint8_t data[ZT_AGGREGATE_MAX_BYTES]; // <[2] length><[2] ethertype><[...] frame> for each frame
+};
+
+struct Switch::Aggregation
+{
+	Aggregation() : sw((Switch *)0),count(0) {}
+	Switch *sw; // switch collecting or NULL if none
+	unsigned int count;
+	AggregatedFrames peers[ZT_AGGREGATE_MAX_PEERS];
+};
+
+thread_local std::unique_ptr<Switch::Aggregation> Switch::_aggregation;
+
 Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
 	_lastCheckedQueues(0),
-	_lastUniteAttempt(8) // only really used on root servers and upstreams, and it'll grow there just fine
+	_lastWhoisSent(0),
+	_lastSentWhoisRequest_m("Switch::_lastSentWhoisRequest_m"),
+	_rxQueueFree((RXQueueEntry *)0),
+	_rxQueueEvicted(0),
+	_rxQueueExpired(0),
+	_rxQueue_m("Switch::_rxQueue_m"),
+	_txQueueOldest((TXQueueEntry *)0),
+	_txQueueNewest((TXQueueEntry *)0),
+	_txQueueFree((TXQueueEntry *)0),
+	_txQueueBytes(0),
+	_txQueue_m("Switch::_txQueue_m"),
+	_lastUniteAttempt(8), // only really used on root servers and upstreams, and it'll grow there just fine
+	_lastUniteAttempt_m("Switch::_lastUniteAttempt_m"),
+	_relayed(0),
+	_relayedBytes(0),
+	_relayCacheHits(0),
+	_relayCacheMisses(0),
+	_offeredRelaySecond(0),
+	_offeredRelayBytes(0)
 {
+	for(unsigned int i=0;i<ZT_RX_QUEUE_MAX_SIZE;++i)
+		_rxQueueIndex[i] = (RXQueueEntry *)0;
+	for(unsigned int i=0;i<ZT_RELAY_CACHE_SIZE;++i)
+		_offeredRelayPackets[i].store(0,std::memory_order_relaxed);
+	for(unsigned int i=0;i<ZT_RX_QUEUE_SIZE;++i) {
+		RXQueueEntry *const rq = new RXQueueEntry();
+		rq->next = _rxQueueFree;
+		_rxQueueFree = rq;
+		_rxQueue[i] = rq;
+		++_rxQueueSize;
+	}
+	for(unsigned int i=0;i<ZT_TX_QUEUE_SIZE;++i) {
+		_txQueue[i].newer = _txQueueFree;
+		_txQueueFree = &(_txQueue[i]);
+		_txQueueByDest[i].head = (TXQueueEntry *)0;
+		_txQueueByDest[i].tail = (TXQueueEntry *)0;
+	}
 }
 
-void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len)
+Switch::~Switch()
+{
+	const unsigned int rqs = (unsigned int)_rxQueueSize.load();
+	for(unsigned int i=0;i<rqs;++i)
+		delete _rxQueue[i];
+}
+
+void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len,FrameBuffer *fb,unsigned int tos)
 {
 	try {
 		const int64_t now = RR->node->now();
+		const bool congested = ((tos & 3) == 3); // ECN CE
 
 		const SharedPtr<Path> path(RR->topology->getPath(localSocket,fromAddr));
-		path->received(now);
+		path->received(now,len);
 
 		if (len == 13) {
 			/* LEGACY: before VERB_PUSH_DIRECT_PATHS, peers used broadcast
@@ -90,9 +161,10 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 
 				Packet::Fragment fragment(data,len);
 				const Address destination(fragment.destination());
+				path->fragmentReceived();
 
 				if (destination != RR->identity.address()) {
-					if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) )
+					if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) && (!_admitOfferedRelay(tPtr,Address(),destination,fragment.packetId(),fragment.size(),now)) )
 						return;
 
 					if (fragment.hops() < ZT_RELAY_MAX_HOPS) {
@@ -100,13 +172,10 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 
 						// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
 						// It wouldn't hurt anything, just redundant and unnecessary.
-						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
-						if ((!relayTo)||(!relayTo->sendDirect(tPtr,fragment.data(),fragment.size(),now,false))) {
-							// Don't know peer or no direct path -- so relay via someone upstream
-							relayTo = RR->topology->getUpstreamPeer();
-							if (relayTo)
-								relayTo->sendDirect(tPtr,fragment.data(),fragment.size(),now,true);
-						}
+						if ((!RR->shaper->active())||(RR->shaper->relay(tPtr,localSocket,fromAddr,Address(),destination,fragment.data(),fragment.size(),now) == Shaper::SEND))
+							relayNow(tPtr,localSocket,fromAddr,Address(),destination,fragment.data(),fragment.size(),now);
+					} else {
+						Metrics::drop(ZT_METRICS_DROP_RELAY_HOPS);
 					}
 				} else {
 					// Fragment looks like ours
@@ -114,7 +183,28 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 					const unsigned int fragmentNumber = fragment.fragmentNumber();
 					const unsigned int totalFragments = fragment.totalFragments();
 
-					if ((totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber < ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber > 0)&&(totalFragments > 1)) {
+					if ((fragmentNumber == 0)&&(totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(totalFragments > 1)) {
+						// FEC parity fragment, see Packet::Fragment::writeParity()
+
+						RXQueueEntry *const rq = _findRXQueueEntry(fragmentPacketId);
+						Mutex::Lock rql(rq->lock);
+						if ((rq->packetId != fragmentPacketId)||(!rq->timestamp)) {
+							rq->timestamp.store(now,std::memory_order_relaxed);
+							rq->packetId = fragmentPacketId;
+							rq->parity = fragment;
+							rq->haveParity = true;
+							rq->totalFragments = totalFragments;
+							rq->haveFragments = 0;
+							rq->congested = congested;
+							rq->complete.store(false,std::memory_order_relaxed);
+						} else if ((!rq->haveParity)&&(!rq->complete)) {
+							rq->parity = fragment;
+							rq->haveParity = true;
+							rq->totalFragments = totalFragments;
+							rq->congested |= congested;
+							_rxAssemble(tPtr,rq,path,now);
+						}
+					} else if ((totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber < ZT_MAX_PACKET_FRAGMENTS)&&(fragmentNumber > 0)&&(totalFragments > 1)) {
 						// Fragment appears basically sane. Its fragment number must be
 						// 1 or more, since a Packet with fragmented bit set is fragment 0.
 						// Total fragments must be more than 1, otherwise why are we
@@ -122,33 +212,25 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 
 						RXQueueEntry *const rq = _findRXQueueEntry(fragmentPacketId);
 						Mutex::Lock rql(rq->lock);
-						if (rq->packetId != fragmentPacketId) {
+						if ((rq->packetId != fragmentPacketId)||(!rq->timestamp)) {
 							// No packet found, so we received a fragment without its head.
 
-							rq->timestamp = now;
+							rq->timestamp.store(now,std::memory_order_relaxed);
 							rq->packetId = fragmentPacketId;
 							rq->frags[fragmentNumber - 1] = fragment;
 							rq->totalFragments = totalFragments; // total fragment count is known
 							rq->haveFragments = 1 << fragmentNumber; // we have only this fragment
-							rq->complete = false;
+							rq->haveParity = false;
+							rq->congested = congested;
+							rq->complete.store(false,std::memory_order_relaxed);
 						} else if (!(rq->haveFragments & (1 << fragmentNumber))) {
 							// We have other fragments and maybe the head, so add this one and check
 
 							rq->frags[fragmentNumber - 1] = fragment;
 							rq->totalFragments = totalFragments;
-
-							if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
-								// We have all fragments -- assemble and process full Packet
-
-								for(unsigned int f=1;f<totalFragments;++f)
-									rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-								if (rq->frag0.tryDecode(RR,tPtr)) {
-									rq->timestamp = 0; // packet decoded, free entry
-								} else {
-									rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-								}
-							}
+							rq->haveFragments |= (1 << fragmentNumber);
+							rq->congested |= congested;
+							_rxAssemble(tPtr,rq,path,now);
 						} // else this is a duplicate fragment, ignore
 					}
 				}
@@ -164,30 +246,17 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 					return;
 
 				if (destination != RR->identity.address()) {
-					if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) && (source != RR->identity.address()) )
-						return;
-
 					Packet packet(data,len);
 
+					if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) && (!_admitOfferedRelay(tPtr,source,destination,packet.packetId(),len,now)) )
+						return;
+
 					if (packet.hops() < ZT_RELAY_MAX_HOPS) {
 						packet.incrementHops();
-						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
-						if ((relayTo)&&(relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,false))) {
-							if ((source != RR->identity.address())&&(_shouldUnite(now,source,destination))) {
-								const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
-								if (sourcePeer)
-									relayTo->introduce(tPtr,now,sourcePeer);
-							}
-						} else {
-							relayTo = RR->topology->getUpstreamPeer();
-							if ((relayTo)&&(relayTo->address() != source)) {
-								if (relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,true)) {
-									const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
-									if (sourcePeer)
-										relayTo->introduce(tPtr,now,sourcePeer);
-								}
-							}
-						}
+						if ((!RR->shaper->active())||(RR->shaper->relay(tPtr,localSocket,fromAddr,source,destination,packet.data(),packet.size(),now) == Shaper::SEND))
+							relayNow(tPtr,localSocket,fromAddr,source,destination,packet.data(),packet.size(),now);
+					} else {
+						Metrics::drop(ZT_METRICS_DROP_RELAY_HOPS);
 					}
 				} else if ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
 					// Packet is the head of a fragmented packet series
@@ -205,47 +274,45 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 
 					RXQueueEntry *const rq = _findRXQueueEntry(packetId);
 					Mutex::Lock rql(rq->lock);
-					if (rq->packetId != packetId) {
+					if ((rq->packetId != packetId)||(!rq->timestamp)) {
 						// If we have no other fragments yet, create an entry and save the head
 
-						rq->timestamp = now;
+						rq->timestamp.store(now,std::memory_order_relaxed);
 						rq->packetId = packetId;
 						rq->frag0.init(data,len,path,now);
 						rq->totalFragments = 0;
 						rq->haveFragments = 1;
-						rq->complete = false;
+						rq->haveParity = false;
+						rq->congested = congested;
+						rq->complete.store(false,std::memory_order_relaxed);
 					} else if (!(rq->haveFragments & 1)) {
-						// If we have other fragments but no head, see if we are complete with the head
+						// If we have other fragments but no head, save the head and see if we are complete
 
-						if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
-							// We have all fragments -- assemble and process full Packet
-
-							rq->frag0.init(data,len,path,now);
-							for(unsigned int f=1;f<rq->totalFragments;++f)
-								rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-							if (rq->frag0.tryDecode(RR,tPtr)) {
-								rq->timestamp = 0; // packet decoded, free entry
-							} else {
-								rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-							}
-						} else {
-							// Still waiting on more fragments, but keep the head
-							rq->frag0.init(data,len,path,now);
-						}
+						rq->frag0.init(data,len,path,now);
+						rq->haveFragments |= 1;
+						rq->congested |= congested;
+						_rxAssemble(tPtr,rq,path,now);
 					} // else this is a duplicate head, ignore
 				} else {
-					// Packet is unfragmented, so just process it
-					IncomingPacket packet(data,len,path,now);
+					// Packet is unfragmented, so just process it (where it lies if it's in a FrameBuffer)
+					IncomingPacket stackPacket;
+					IncomingPacket &packet = (fb) ? fb->packet : stackPacket;
+					if (fb)
+						packet.initInPlace(len,path,now,fb);
+					else packet.init(data,len,path,now);
+					if (congested)
+						packet.congestionExperienced();
 					if (!packet.tryDecode(RR,tPtr)) {
-						RXQueueEntry *const rq = _nextRXQueueEntry();
+						RXQueueEntry *const rq = _findRXQueueEntry(packet.packetId());
 						Mutex::Lock rql(rq->lock);
-						rq->timestamp = now;
+						rq->timestamp.store(now,std::memory_order_relaxed);
 						rq->packetId = packet.packetId();
 						rq->frag0 = packet;
 						rq->totalFragments = 1;
 						rq->haveFragments = 1;
-						rq->complete = true;
+						rq->haveParity = false;
+						rq->congested = congested;
+						rq->complete.store(true,std::memory_order_relaxed);
 					}
 				}
 
@@ -255,16 +322,20 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 	} catch ( ... ) {} // sanity check, should be caught elsewhere
 }
 
-void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len,FrameBuffer *fb)
 {
 	if (!network->hasConfig())
 		return;
 
+	Metrics::networkFrame(network->id(),true,len);
+	FrameCapture::Frame captured(RR->node->now(),network->id(),true,from,to,etherType,vlanId,data,len);
+
 	// Check if this packet is from someone other than the tap -- i.e. bridged in
 	bool fromBridged;
 	if ((fromBridged = (from != network->mac()))) {
 		if (!network->config().permitsBridging(RR->identity.address())) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"not a bridge");
+			captured.verdict(FrameCapture::VERDICT_DROP,"not a bridge");
 			return;
 		}
 	}
@@ -284,14 +355,38 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				 * the 32-bit ADI field. In practice this uses our multicast pub/sub
 				 * system to implement a kind of extended/distributed ARP table. */
 				multicastGroup = MulticastGroup::deriveMulticastGroupForAddressResolution(InetAddress(((const unsigned char *)data) + 24,4,0));
+
+				/* If ARP emulation is enabled and a member has shown us a certificate
+				 * of ownership for the IP being queried, answer locally instead of
+				 * multicasting the query. Our own IPs are left alone so duplicate
+				 * address detection on the host still sees nothing answer. */
+				if ((network->config().arpEmulation())&&(!fromBridged)) {
+					const uint8_t *const arp = reinterpret_cast<const uint8_t *>(data);
+					const Address owner(network->ipOwner(InetAddress(arp + 24,4,0)));
+					if ((owner)&&(owner != RR->identity.address())) {
+						const MAC ownerMac(owner,network->id());
+
+						uint8_t reply[28];
+						reply[0] = 0x00; reply[1] = 0x01; reply[2] = 0x08; reply[3] = 0x00;
+						reply[4] = 0x06; reply[5] = 0x04; reply[6] = 0x00; reply[7] = 0x02;
+						ownerMac.copyTo(reply + 8,6);
+						memcpy(reply + 14,arp + 24,4);
+						memcpy(reply + 18,arp + 8,10); // requester's MAC and IP
+
+						RR->node->putFrame(tPtr,network->id(),network->userPtr(),ownerMac,from,ZT_ETHERTYPE_ARP,0,reply,28);
+						captured.verdict(FrameCapture::VERDICT_ACCEPT,"answered by ARP emulation");
+						return; // ARP emulation done, so there's no need to multicast the query
+					}
+				}
 			} else if (!network->config().enableBroadcast()) {
 				// Don't transmit broadcasts if this network doesn't want them
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"broadcast disabled");
+				captured.verdict(FrameCapture::VERDICT_DROP,"broadcast disabled");
 				return;
 			}
 		} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= (40 + 8 + 16))) {
 			// IPv6 NDP emulation for certain very special patterns of private IPv6 addresses -- if enabled
-			if ((network->config().ndpEmulation())&&(reinterpret_cast<const uint8_t *>(data)[6] == 0x3a)&&(reinterpret_cast<const uint8_t *>(data)[40] == 0x87)) { // ICMPv6 neighbor solicitation
+			if (((network->config().ndpEmulation())||(network->config().ndpProxy()))&&(reinterpret_cast<const uint8_t *>(data)[6] == 0x3a)&&(reinterpret_cast<const uint8_t *>(data)[40] == 0x87)) { // ICMPv6 neighbor solicitation
 				Address v6EmbeddedAddress;
 				const uint8_t *const pkt6 = reinterpret_cast<const uint8_t *>(data) + 40 + 8;
 				const uint8_t *my6 = (const uint8_t *)0;
@@ -303,7 +398,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 
 				// For these to work, we must have a ZT-managed address assigned in one of the
 				// above formats, and the query must match its prefix.
-				for(unsigned int sipk=0;sipk<network->config().staticIpCount;++sipk) {
+				for(unsigned int sipk=0;((network->config().ndpEmulation())&&(sipk<network->config().staticIpCount));++sipk) {
 					const InetAddress *const sip = &(network->config().staticIps[sipk]);
 					if (sip->ss_family == AF_INET6) {
 						my6 = reinterpret_cast<const uint8_t *>(reinterpret_cast<const struct sockaddr_in6 *>(&(*sip))->sin6_addr.s6_addr);
@@ -337,6 +432,25 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 					}
 				}
 
+				/* Otherwise the NDP proxy answers for any address a member has shown
+				 * us a certificate of ownership for, replying to the solicitation's
+				 * source. Solicitations from the unspecified address are duplicate
+				 * address detection and are never answered. */
+				if ((!v6EmbeddedAddress)&&(network->config().ndpProxy())&&(!fromBridged)) {
+					const uint8_t *const src6 = reinterpret_cast<const uint8_t *>(data) + 8;
+					bool unspecified = true;
+					for(int i=0;i<16;++i) {
+						if (src6[i]) {
+							unspecified = false;
+							break;
+						}
+					}
+					if (!unspecified) {
+						v6EmbeddedAddress = network->ipOwner(InetAddress(pkt6,16,0));
+						my6 = src6;
+					}
+				}
+
 				if ((v6EmbeddedAddress)&&(v6EmbeddedAddress != RR->identity.address())) {
 					const MAC peerMac(v6EmbeddedAddress,network->id());
 
@@ -367,6 +481,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 					adv[43] = checksum & 0xff;
 
 					RR->node->putFrame(tPtr,network->id(),network->userPtr(),peerMac,from,ZT_ETHERTYPE_IPV6,0,adv,72);
+					captured.verdict(FrameCapture::VERDICT_ACCEPT,"answered by NDP emulation");
 					return; // NDP emulation done. We have forged a "fake" reply, so no need to send actual NDP query.
 				} // else no NDP emulation
 			} // else no NDP emulation
@@ -375,6 +490,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 		// Check this after NDP emulation, since that has to be allowed in exactly this case
 		if (network->config().multicastLimit == 0) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"multicast disabled");
+			captured.verdict(FrameCapture::VERDICT_DROP,"multicast disabled");
 			return;
 		}
 
@@ -388,6 +504,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 		// First pass sets noTee to false, but noTee is set to true in OutboundMulticast to prevent duplicates.
 		if (!network->filterOutgoingPacket(tPtr,false,RR->identity.address(),Address(),from,to,(const uint8_t *)data,len,etherType,vlanId)) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked");
+			captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0);
 			return;
 		}
 
@@ -409,31 +526,47 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 
 		Address toZT(to.toAddress(network->id())); // since in-network MACs are derived from addresses and network IDs, we can reverse this
 		SharedPtr<Peer> toPeer(RR->topology->getPeer(tPtr,toZT));
+		captured.peer(toZT.toInt());
 
 		if (!network->filterOutgoingPacket(tPtr,false,RR->identity.address(),toZT,from,to,(const uint8_t *)data,len,etherType,vlanId)) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked");
+			captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0);
 			return;
 		}
 
+		const uint64_t flowId = ((toPeer)&&(toPeer->multipathMode() == ZT_MULTIPATH_FLOW_HASH)) ? _flowId(from,to,etherType,data,len) : 0;
+		if (toPeer)
+			RR->node->frameSent(toPeer,RR->node->now());
+		if (TopTalkers::sample())
+			network->topTalkers().frame(RR->node->now(),toZT,etherType,data,len);
+
 		if (fromBridged) {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(network->id());
-			outp.append((unsigned char)0x00);
-			to.appendTo(outp);
-			from.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			send(tPtr,outp,true);
-		} else {
-			Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
-			outp.append(network->id());
-			outp.append((uint16_t)etherType);
-			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			send(tPtr,outp,true);
+			Packet::Writer w(outp,8 + 1 + 6 + 6 + 2);
+			w.put(network->id());
+			w.put((uint8_t)0x00);
+			to.copyTo(w.field(6),6);
+			from.copyTo(w.field(6),6);
+			w.put((uint16_t)etherType);
+			_sendFrame(tPtr,outp,toPeer,!network->config().disableCompression(),network->id(),etherType,data,len,flowId);
+		} else if (!_aggregate(tPtr,toPeer,network,etherType,data,len)) {
+			if ((fb)&&(fb->headroom == ZT_PROTO_VERB_FRAME_IDX_PAYLOAD)&&(!FrameCapture::capturing(network->id()))) {
+				// The header fits exactly in front of the frame, so build and encrypt the packet where it lies
+				// (unless it's being captured, since capture records the frame after it is sent)
+				Packet &outp = fb->packet;
+				outp.reset(toZT,RR->identity.address(),Packet::VERB_FRAME);
+				Packet::Writer w(outp,8 + 2);
+				w.put(network->id());
+				w.put((uint16_t)etherType);
+				outp.setSize(ZT_PROTO_VERB_FRAME_IDX_PAYLOAD + len);
+				_sendFrame(tPtr,outp,toPeer,!network->config().disableCompression(),network->id(),etherType,data,len,flowId,true);
+			} else {
+				Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
+				Packet::Writer w(outp,8 + 2);
+				w.put(network->id());
+				w.put((uint16_t)etherType);
+				_sendFrame(tPtr,outp,toPeer,!network->config().disableCompression(),network->id(),etherType,data,len,flowId);
+			}
 		}
 
 	} else {
@@ -444,6 +577,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 		// and design as for multicast.
 		if (!network->filterOutgoingPacket(tPtr,false,RR->identity.address(),Address(),from,to,(const uint8_t *)data,len,etherType,vlanId)) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked");
+			captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0);
 			return;
 		}
 
@@ -479,18 +613,27 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			}
 		}
 
+		if (!numBridges)
+			captured.verdict(FrameCapture::VERDICT_DROP,"no bridge");
+		else captured.verdict(FrameCapture::VERDICT_DROP_FILTER,(const char *)0); // until a bridge's rules accept it
 		for(unsigned int b=0;b<numBridges;++b) {
 			if (network->filterOutgoingPacket(tPtr,true,RR->identity.address(),bridges[b],from,to,(const uint8_t *)data,len,etherType,vlanId)) {
+				captured.peer(bridges[b].toInt());
+				captured.verdict(FrameCapture::VERDICT_ACCEPT,(const char *)0);
 				Packet outp(bridges[b],RR->identity.address(),Packet::VERB_EXT_FRAME);
-				outp.append(network->id());
-				outp.append((uint8_t)0x00);
-				to.appendTo(outp);
-				from.appendTo(outp);
-				outp.append((uint16_t)etherType);
-				outp.append(data,len);
-				if (!network->config().disableCompression())
-					outp.compress();
-				send(tPtr,outp,true);
+				Packet::Writer w(outp,8 + 1 + 6 + 6 + 2);
+				w.put(network->id());
+				w.put((uint8_t)0x00);
+				to.copyTo(w.field(6),6);
+				from.copyTo(w.field(6),6);
+				w.put((uint16_t)etherType);
+				const SharedPtr<Peer> bridgePeer(RR->topology->getPeer(tPtr,bridges[b]));
+				const uint64_t flowId = ((bridgePeer)&&(bridgePeer->multipathMode() == ZT_MULTIPATH_FLOW_HASH)) ? _flowId(from,to,etherType,data,len) : 0;
+				if (bridgePeer)
+					RR->node->frameSent(bridgePeer,RR->node->now());
+				if (TopTalkers::sample())
+					network->topTalkers().frame(RR->node->now(),bridges[b],etherType,data,len);
+				_sendFrame(tPtr,outp,bridgePeer,!network->config().disableCompression(),network->id(),etherType,data,len,flowId);
 			} else {
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked (bridge replication)");
 			}
@@ -498,24 +641,50 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 	}
 }
 
-void Switch::send(void *tPtr,Packet &packet,bool encrypt)
+void Switch::send(void *tPtr,Packet &packet,bool encrypt,const void *tail,unsigned int tailLen,uint64_t flowId,Egress::Class egressClass,uint64_t nwid,unsigned int tos)
 {
 	const Address dest(packet.destination());
 	if (dest == RR->identity.address())
 		return;
-	if (!_trySend(tPtr,packet,encrypt)) {
+	if (!_trySend(tPtr,packet,encrypt,tail,tailLen,flowId,egressClass,nwid,tos)) {
+		if (tailLen)
+			packet.append(tail,tailLen);
 		{
 			Mutex::Lock _l(_txQueue_m);
-			if (_txQueue.size() >= ZT_TX_QUEUE_SIZE) {
-				_txQueue.pop_front();
-			}
-			_txQueue.push_back(TXQueueEntry(dest,RR->node->now(),packet,encrypt));
+			TXQueueEntry *const txi = _txQueueAlloc(dest,packet.size());
+			txi->creationTime = RR->node->now();
+			txi->packet = packet;
+			txi->encrypt = encrypt;
 		}
 		if (!RR->topology->getPeer(tPtr,dest))
 			requestWhois(tPtr,RR->node->now(),dest);
 	}
 }
 
+bool Switch::beginAggregation()
+{
+	if (!_aggregation)
+		_aggregation.reset(new Aggregation());
+	if (_aggregation->sw)
+		return false;
+	_aggregation->sw = this;
+	_aggregation->count = 0;
+	return true;
+}
+
+void Switch::flushAggregated(void *tPtr)
+{
+	Aggregation *const a = _aggregation.get();
+	if ((!a)||(a->sw != this))
+		return;
+	a->sw = (Switch *)0; // sending can't add more
+	for(unsigned int i=0;i<a->count;++i) {
+		_sendAggregated(tPtr,a->peers[i]);
+		a->peers[i].peer.zero();
+	}
+	a->count = 0;
+}
+
 void Switch::requestWhois(void *tPtr,const int64_t now,const Address &addr)
 {
 	if (addr == RR->identity.address())
@@ -527,14 +696,34 @@ void Switch::requestWhois(void *tPtr,const int64_t now,const Address &addr)
 		if ((now - last) < ZT_WHOIS_RETRY_DELAY)
 			return;
 		else last = now;
+		_whoisQueue.push_back(addr);
+	}
+
+	_flushWhois(tPtr,now,false);
+}
+
+void Switch::_flushWhois(void *tPtr,const int64_t now,bool force)
+{
+	std::vector<Address> addrs;
+	{
+		Mutex::Lock _l(_lastSentWhoisRequest_m);
+		if (_whoisQueue.empty())
+			return;
+		if ((!force)&&((now - _lastWhoisSent) < ZT_WHOIS_COALESCE_WINDOW)&&(_whoisQueue.size() < ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST))
+			return;
+		_lastWhoisSent = now;
+		addrs.swap(_whoisQueue);
 	}
 
 	const SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer());
 	if (upstream) {
-		Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
-		addr.appendTo(outp);
-		RR->node->expectReplyTo(outp.packetId());
-		send(tPtr,outp,true);
+		for(std::vector<Address>::const_iterator a(addrs.begin());a!=addrs.end();) {
+			Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
+			for(unsigned int n=0;((n<ZT_WHOIS_MAX_ADDRESSES_PER_REQUEST)&&(a!=addrs.end()));++n,++a)
+				a->appendTo(outp);
+			RR->node->expectReplyTo(outp.packetId());
+			send(tPtr,outp,true);
+		}
 	}
 }
 
@@ -543,36 +732,40 @@ void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
 	{
 		Mutex::Lock _l(_lastSentWhoisRequest_m);
 		_lastSentWhoisRequest.erase(peer->address());
+		std::vector<Address>::iterator q(std::find(_whoisQueue.begin(),_whoisQueue.end(),peer->address()));
+		if (q != _whoisQueue.end())
+			_whoisQueue.erase(q);
 	}
 
 	const int64_t now = RR->node->now();
-	for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
-		RXQueueEntry *const rq = &(_rxQueue[ptr]);
+	const unsigned int rqs = (unsigned int)_rxQueueSize.load();
+	for(unsigned int ptr=0;ptr<rqs;++ptr) {
+		RXQueueEntry *const rq = _rxQueue[ptr];
 		Mutex::Lock rql(rq->lock);
 		if ((rq->timestamp)&&(rq->complete)) {
-			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT))
-				rq->timestamp = 0;
+			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
+				rq->timestamp.store(0,std::memory_order_relaxed);
+				_releaseRXQueueEntry(rq,rq->packetId);
+			}
 		}
 	}
 
 	{
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (txi->dest == peer->address()) {
-				if (_trySend(tPtr,txi->packet,txi->encrypt)) {
-					_txQueue.erase(txi++);
-				} else {
-					++txi;
-				}
-			} else {
-				++txi;
-			}
+		TXQueueEntry *txi = _txQueueByDest[(unsigned long)(peer->address().toInt() % ZT_TX_QUEUE_SIZE)].head;
+		while (txi) {
+			TXQueueEntry *const next = txi->destNext;
+			if ((txi->dest == peer->address())&&(_trySend(tPtr,txi->packet,txi->encrypt)))
+				_txQueueRemove(txi);
+			txi = next;
 		}
 	}
 }
 
 unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
 {
+	_flushWhois(tPtr,now,false);
+
 	const uint64_t timeSinceLastCheck = now - _lastCheckedQueues;
 	if (timeSinceLastCheck < ZT_WHOIS_RETRY_DELAY)
 		return (unsigned long)(ZT_WHOIS_RETRY_DELAY - timeSinceLastCheck);
@@ -581,32 +774,45 @@ unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
 	std::vector<Address> needWhois;
 	{
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
+		while ((_txQueueOldest)&&((now - _txQueueOldest->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT))
+			_txQueueRemove(_txQueueOldest);
+		TXQueueEntry *txi = _txQueueOldest;
+		while (txi) {
+			TXQueueEntry *const next = txi->newer;
 			if (_trySend(tPtr,txi->packet,txi->encrypt)) {
-				_txQueue.erase(txi++);
-			} else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
-				_txQueue.erase(txi++);
-			} else {
-				if (!RR->topology->getPeer(tPtr,txi->dest))
-					needWhois.push_back(txi->dest);
-				++txi;
+				_txQueueRemove(txi);
+			} else if (!RR->topology->getPeer(tPtr,txi->dest)) {
+				needWhois.push_back(txi->dest);
 			}
+			txi = next;
 		}
 	}
 	for(std::vector<Address>::const_iterator i(needWhois.begin());i!=needWhois.end();++i)
 		requestWhois(tPtr,now,*i);
 
-	for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
-		RXQueueEntry *const rq = &(_rxQueue[ptr]);
+	const unsigned int rqs = (unsigned int)_rxQueueSize.load();
+	for(unsigned int ptr=0;ptr<rqs;++ptr) {
+		RXQueueEntry *const rq = _rxQueue[ptr];
 		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp)&&(rq->complete)) {
+		if (!rq->timestamp)
+			continue;
+		if (rq->complete) {
 			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
-				rq->timestamp = 0;
+				rq->timestamp.store(0,std::memory_order_relaxed);
+				_releaseRXQueueEntry(rq,rq->packetId);
 			} else {
 				const Address src(rq->frag0.source());
 				if (!RR->topology->getPeer(tPtr,src))
 					requestWhois(tPtr,now,src);
 			}
+		} else if ((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT) {
+			// Fragments that never completed would otherwise sit here until
+			// their entry is needed for some other packet
+			rq->timestamp.store(0,std::memory_order_relaxed);
+			_releaseRXQueueEntry(rq,rq->packetId);
+			Mutex::Lock _l(_rxQueue_m);
+			++_rxQueueExpired;
+			Metrics::drop(ZT_METRICS_DROP_RX_QUEUE);
 		}
 	}
 
@@ -646,61 +852,526 @@ bool Switch::_shouldUnite(const int64_t now,const Address &source,const Address
 	return false;
 }
 
-bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
+void Switch::relayNow(void *tPtr,int64_t localSocket,const InetAddress &fromAddr,const Address &source,const Address &destination,const void *data,unsigned int len,int64_t now)
+{
+	if (_relay(tPtr,destination,data,len,now)) {
+		if ((source)&&(_relayShouldUnite(now,source,destination))) {
+			const SharedPtr<Peer> relayTo(RR->topology->getPeer(tPtr,destination));
+			const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
+			if ((relayTo)&&(sourcePeer))
+				relayTo->introduce(tPtr,now,sourcePeer);
+		}
+	} else if ((!RR->cluster)||(!RR->cluster->relay(tPtr,localSocket,fromAddr,source,destination,data,len,((source)&&(_relayShouldUnite(now,source,destination))),now))) {
+		// Don't know peer or no direct path -- so relay via someone upstream
+		const SharedPtr<Peer> relayTo(RR->topology->getUpstreamPeer());
+		if ((relayTo)&&(relayTo->address() != source)) {
+			if ((relayTo->sendDirect(tPtr,data,len,now,true))&&(source)) {
+				const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
+				if (sourcePeer)
+					relayTo->introduce(tPtr,now,sourcePeer);
+			}
+		}
+	}
+}
+
+bool Switch::_admitOfferedRelay(void *tPtr,const Address &source,const Address &destination,const uint64_t packetId,const unsigned int len,const int64_t now)
+{
+	const uint64_t capacity = RR->node->relayCapacity();
+	if (!capacity)
+		return false;
+
+	std::atomic<uint64_t> &admitted = _offeredRelayPackets[(unsigned long)(packetId & (ZT_RELAY_CACHE_SIZE - 1))];
+	if (source) {
+		// Both ends must hold our offer, i.e. be on our networks with a direct path to us, and share a network
+		const Epoch::Guard eg;
+		Peer *const from = RR->topology->getPeer(eg,tPtr,source);
+		Peer *const to = RR->topology->getPeer(eg,tPtr,destination);
+		if ((!from)||(!to)||(!from->holdsRelayOffer(now))||(!to->holdsRelayOffer(now))||(!RR->node->sharedNetwork(source,destination)))
+			return false;
+	} else if (admitted.load(std::memory_order_relaxed) != packetId) {
+		// Fragments carry no source, so they're only let through after their head
+		return false;
+	}
+
+	// The offered capacity is enforced per second. Threads racing to start a
+	// new second can let a little more than that through.
+	const int64_t second = now / 1000;
+	if (_offeredRelaySecond.load(std::memory_order_relaxed) != second) {
+		_offeredRelaySecond.store(second,std::memory_order_relaxed);
+		_offeredRelayBytes.store(0,std::memory_order_relaxed);
+	}
+	if ((_offeredRelayBytes.fetch_add(len,std::memory_order_relaxed) + len) > capacity)
+		return false;
+
+	if (source)
+		admitted.store(packetId,std::memory_order_relaxed);
+	return true;
+}
+
+bool Switch::_relay(void *tPtr,const Address &destination,const void *data,unsigned int len,const int64_t now)
+{
+	RelayCacheEntry &e = _relayCache[(unsigned long)(destination.toInt() & (ZT_RELAY_CACHE_SIZE - 1))];
+	const Epoch::Guard eg;
+
+	const uint32_t seq = e.seq.load(std::memory_order_acquire);
+	if ((seq & 1) == 0) {
+		const uint64_t d = e.destination;
+		Path *const p = e.path.ptr();
+		const int64_t expires = e.expires;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((e.seq.load(std::memory_order_relaxed) == seq)&&(d == destination.toInt())&&(now < expires)&&(p)) {
+			if (p->send(RR,tPtr,data,len,now)) {
+				_relayCacheHits.fetch_add(1,std::memory_order_relaxed);
+				_relayed.fetch_add(1,std::memory_order_relaxed);
+				_relayedBytes.fetch_add(len,std::memory_order_relaxed);
+				Metrics::add(Metrics::RELAYED_PACKETS,1);
+				Metrics::add(Metrics::RELAYED_BYTES,len);
+				if (TopTalkers::sample())
+					_topRelays.relay(now,destination,len);
+				return true;
+			}
+		}
+	}
+	_relayCacheMisses.fetch_add(1,std::memory_order_relaxed);
+
+	Peer *const relayTo = RR->topology->getPeer(eg,tPtr,destination);
+	if (!relayTo)
+		return false;
+	Path *const bp = relayTo->getBestPath(eg,now,false);
+	if ((!bp)||(!bp->send(RR,tPtr,data,len,now)))
+		return false;
+	_relayed.fetch_add(1,std::memory_order_relaxed);
+	_relayedBytes.fetch_add(len,std::memory_order_relaxed);
+	Metrics::add(Metrics::RELAYED_PACKETS,1);
+	Metrics::add(Metrics::RELAYED_BYTES,len);
+	if (TopTalkers::sample())
+		_topRelays.relay(now,destination,len);
+
+	// If another thread is already refreshing this entry just let it
+	uint32_t s = e.seq.load(std::memory_order_relaxed);
+	if (((s & 1) == 0)&&(e.seq.compare_exchange_strong(s,s + 1,std::memory_order_acquire))) {
+		e.destination = destination.toInt();
+		e.path.set(bp);
+		e.expires = now + ZT_RELAY_CACHE_TTL;
+		e.seq.store(s + 2,std::memory_order_release);
+	}
+
+	return true;
+}
+
+void Switch::memoryUsage(ZT_MemoryUsage *mu)
+{
+	{
+		Mutex::Lock _l(_rxQueue_m);
+		const unsigned int rqs = (unsigned int)_rxQueueSize.load();
+		uint64_t inUse = 0;
+		for(unsigned int i=0;i<rqs;++i) {
+			if (_rxQueue[i]->indexed)
+				++inUse;
+		}
+		mu->rxQueueEntries = inUse;
+		mu->rxQueueBytes = (uint64_t)rqs * sizeof(RXQueueEntry);
+	}
+	{
+		Mutex::Lock _l(_txQueue_m);
+		uint64_t inUse = 0;
+		for(TXQueueEntry *txi=_txQueueOldest;txi;txi=txi->newer)
+			++inUse;
+		mu->txQueueEntries = inUse;
+		mu->txQueueBytes = sizeof(_txQueue) + sizeof(_txQueueByDest);
+	}
+}
+
+Switch::RXQueueEntry *Switch::_findRXQueueEntry(uint64_t packetId)
+{
+	Mutex::Lock _l(_rxQueue_m);
+
+	RXQueueEntry **const bucket = &(_rxQueueIndex[(unsigned long)(packetId % ZT_RX_QUEUE_MAX_SIZE)]);
+	for(RXQueueEntry *rq=*bucket;rq;rq=rq->next) {
+		if (rq->indexedId == packetId)
+			return rq;
+	}
+
+	RXQueueEntry *rq = _rxQueueFree;
+	if (rq) {
+		_rxQueueFree = rq->next;
+	} else {
+		const unsigned int rqs = (unsigned int)_rxQueueSize.load();
+		if (rqs < ZT_RX_QUEUE_MAX_SIZE) {
+			rq = new RXQueueEntry();
+			_rxQueue[rqs] = rq;
+			++_rxQueueSize;
+		} else {
+			// Every entry is busy, so take the one that has waited longest.
+			// Timestamps are atomic and read without each entry's lock, which at
+			// worst picks a slightly less old victim. Only the victim's index
+			// fields change here. A thread still assembling it under its lock
+			// finishes undisturbed, and the new packet's thread then finds a
+			// different packet ID under that lock and starts the entry over.
+			rq = _rxQueue[0];
+			int64_t oldest = rq->timestamp.load(std::memory_order_relaxed);
+			for(unsigned int i=1;i<rqs;++i) {
+				const int64_t ts = _rxQueue[i]->timestamp.load(std::memory_order_relaxed);
+				if (ts < oldest) {
+					oldest = ts;
+					rq = _rxQueue[i];
+				}
+			}
+			if (!rq->complete.load(std::memory_order_relaxed)) {
+				++_rxQueueEvicted;
+				Metrics::drop(ZT_METRICS_DROP_RX_QUEUE);
+			}
+			RXQueueEntry **p = &(_rxQueueIndex[(unsigned long)(rq->indexedId % ZT_RX_QUEUE_MAX_SIZE)]);
+			while (*p != rq)
+				p = &((*p)->next);
+			*p = rq->next;
+		}
+	}
+
+	rq->indexedId = packetId;
+	rq->indexed = true;
+	rq->next = *bucket;
+	*bucket = rq;
+	return rq;
+}
+
+void Switch::_releaseRXQueueEntry(RXQueueEntry *rq,uint64_t packetId)
+{
+	Mutex::Lock _l(_rxQueue_m);
+	if ((!rq->indexed)||(rq->indexedId != packetId))
+		return; // entry was taken for another packet in the meantime
+	RXQueueEntry **p = &(_rxQueueIndex[(unsigned long)(packetId % ZT_RX_QUEUE_MAX_SIZE)]);
+	while (*p != rq)
+		p = &((*p)->next);
+	*p = rq->next;
+	rq->indexed = false;
+	rq->next = _rxQueueFree;
+	_rxQueueFree = rq;
+}
+
+void Switch::_rxAssemble(void *tPtr,RXQueueEntry *rq,const SharedPtr<Path> &path,const int64_t now)
+{
+	const unsigned int totalFragments = rq->totalFragments;
+	if ((totalFragments <= 1)||(rq->complete))
+		return;
+	const unsigned int have = Utils::countBits(rq->haveFragments);
+	const bool recovered = (have < totalFragments);
+	if (recovered) {
+		if ((!rq->haveParity)||((have + 1) != totalFragments))
+			return;
+
+		// One slice is missing but we have FEC parity, so rebuild it
+		const uint8_t *slices[ZT_MAX_PACKET_FRAGMENTS];
+		unsigned int sliceLengths[ZT_MAX_PACKET_FRAGMENTS];
+		unsigned int missing = 0;
+		for(unsigned int f=0;f<totalFragments;++f) {
+			if (!(rq->haveFragments & (1 << f))) {
+				missing = f;
+				slices[f] = (const uint8_t *)0;
+				sliceLengths[f] = 0;
+			} else if (f) {
+				slices[f] = rq->frags[f - 1].payload();
+				sliceLengths[f] = rq->frags[f - 1].payloadLength();
+			} else {
+				slices[f] = reinterpret_cast<const uint8_t *>(rq->frag0.data());
+				sliceLengths[f] = rq->frag0.size();
+			}
+		}
+		uint8_t rebuilt[ZT_PROTO_MAX_PACKET_LENGTH];
+		const unsigned int n = rq->parity.parityRecover(slices,sliceLengths,totalFragments,missing,rebuilt);
+		if (!n)
+			return;
+		if (missing) {
+			rq->frags[missing - 1].copyFrom(rq->parity.data(),ZT_PROTO_MIN_FRAGMENT_LENGTH);
+			rq->frags[missing - 1].append(rebuilt,n);
+		} else {
+			rq->frag0.init(rebuilt,n,path,now);
+		}
+		rq->haveFragments |= (1 << missing);
+		Metrics::add(Metrics::FEC_RECOVERED,1);
+	}
+
+	// We have all fragments -- assemble and process full Packet
+	for(unsigned int f=1;f<totalFragments;++f)
+		rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
+	ZT_PROBE3(fragment__assembled,rq->packetId,totalFragments,(unsigned int)recovered);
+
+	if (rq->congested)
+		rq->frag0.congestionExperienced();
+	if (rq->frag0.tryDecode(RR,tPtr)) {
+		rq->timestamp.store(0,std::memory_order_relaxed); // packet decoded, free entry
+		_releaseRXQueueEntry(rq,rq->packetId);
+	} else {
+		rq->complete.store(true,std::memory_order_relaxed); // set complete flag but leave entry since it probably needs WHOIS or something
+	}
+}
+
+Switch::TXQueueEntry *Switch::_txQueueAlloc(const Address &dest,unsigned int bytes)
+{
+	while ((_txQueueOldest)&&((!_txQueueFree)||((_txQueueBytes + bytes) > ZT_TX_QUEUE_MAX_BYTES)))
+		_txQueueRemove(_txQueueOldest);
+
+	TXQueueEntry *const txi = _txQueueFree;
+	_txQueueFree = txi->newer;
+
+	txi->dest = dest;
+	txi->bytes = bytes;
+	txi->older = _txQueueNewest;
+	txi->newer = (TXQueueEntry *)0;
+	if (_txQueueNewest)
+		_txQueueNewest->newer = txi;
+	else _txQueueOldest = txi;
+	_txQueueNewest = txi;
+
+	TXQueueBucket &b = _txQueueByDest[(unsigned long)(dest.toInt() % ZT_TX_QUEUE_SIZE)];
+	txi->destPrev = b.tail;
+	txi->destNext = (TXQueueEntry *)0;
+	if (b.tail)
+		b.tail->destNext = txi;
+	else b.head = txi;
+	b.tail = txi;
+
+	_txQueueBytes += bytes;
+	return txi;
+}
+
+void Switch::_txQueueRemove(TXQueueEntry *txi)
+{
+	if (txi->older)
+		txi->older->newer = txi->newer;
+	else _txQueueOldest = txi->newer;
+	if (txi->newer)
+		txi->newer->older = txi->older;
+	else _txQueueNewest = txi->older;
+
+	TXQueueBucket &b = _txQueueByDest[(unsigned long)(txi->dest.toInt() % ZT_TX_QUEUE_SIZE)];
+	if (txi->destPrev)
+		txi->destPrev->destNext = txi->destNext;
+	else b.head = txi->destNext;
+	if (txi->destNext)
+		txi->destNext->destPrev = txi->destPrev;
+	else b.tail = txi->destPrev;
+
+	_txQueueBytes -= txi->bytes;
+	txi->creationTime = 0;
+	txi->packet.clear();
+	txi->newer = _txQueueFree;
+	_txQueueFree = txi;
+}
+
+void Switch::_sendFrame(void *tPtr,Packet &outp,const SharedPtr<Peer> &peer,bool compress,uint64_t nwid,unsigned int etherType,const void *data,unsigned int len,uint64_t flowId,bool inPacket)
+{
+	// Interactive frames skip path pacing as well as the egress scheduler's queues
+	const Egress::Class ec = ((RR->egress)&&((RR->egress->enabled())||(RR->node->pathPacing()))) ? RR->egress->classify(etherType,data,len) : Egress::BULK;
+	const unsigned int tos = Egress::trafficClass(etherType,data,len);
+	if (inPacket) {
+		if ((compress)&&((!peer)||(!peer->compressionBackedOff()))) {
+			if (peer)
+				peer->attemptFrameCompression(outp);
+			else outp.compress();
+		}
+		send(tPtr,outp,true,(const void *)0,0,flowId,ec,nwid,tos);
+	} else if ((compress)&&((!peer)||(!peer->compressionBackedOff()))) {
+		outp.append(data,len);
+		if (peer)
+			peer->attemptFrameCompression(outp);
+		else outp.compress();
+		send(tPtr,outp,true,(const void *)0,0,flowId,ec,nwid,tos);
+	} else {
+		send(tPtr,outp,true,data,len,flowId,ec,nwid,tos);
+	}
+}
+
+bool Switch::_aggregate(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Network> &network,unsigned int etherType,const void *data,unsigned int len)
+{
+	Aggregation *const a = _aggregation.get();
+	if ((!a)||(a->sw != this)||(!peer))
+		return false;
+
+	AggregatedFrames *af = (AggregatedFrames *)0;
+	for(unsigned int i=0;i<a->count;++i) {
+		if ((a->peers[i].peer == peer)&&(a->peers[i].nwid == network->id())) {
+			af = &(a->peers[i]);
+			break;
+		}
+	}
+
+	if ((len > ZT_AGGREGATE_MAX_FRAME)||(peer->remoteVersionProtocol() < 10)||(peer->multipathMode() != ZT_MULTIPATH_NONE)) {
+		if (af)
+			_sendAggregated(tPtr,*af); // so this frame doesn't overtake held ones
+		return false;
+	}
+
+	if (af) {
+		if ((af->bytes + 4 + len) > ZT_AGGREGATE_MAX_BYTES)
+			_sendAggregated(tPtr,*af);
+	} else {
+		if (a->count >= ZT_AGGREGATE_MAX_PEERS) {
+			for(unsigned int i=0;i<a->count;++i) {
+				_sendAggregated(tPtr,a->peers[i]);
+				a->peers[i].peer.zero();
+			}
+			a->count = 0;
+		}
+		af = &(a->peers[a->count++]);
+		af->peer = peer;
+		af->nwid = network->id();
+		af->frames = 0;
+		af->bytes = 0;
+	}
+
+	if (!af->frames) {
+		af->egressClass = Egress::BULK;
+		af->compress = !network->config().disableCompression();
+	}
+	if ((RR->egress)&&((RR->egress->enabled())||(RR->node->pathPacing())))
+		af->egressClass = std::min(af->egressClass,RR->egress->classify(etherType,data,len));
+
+	// Mixed frames go with the highest DSCP, and as ECN capable only if all of them are
+	const unsigned int tos = Egress::trafficClass(etherType,data,len);
+	if (!af->frames)
+		af->tos = tos;
+	else if (tos != af->tos)
+		af->tos = std::max(af->tos & 0xfc,tos & 0xfc) | ((((af->tos & 3) != 0)&&((tos & 3) != 0)) ? 2 : 0);
+	uint8_t *const p = af->data + af->bytes;
+	p[0] = (uint8_t)(len >> 8);
+	p[1] = (uint8_t)len;
+	p[2] = (uint8_t)(etherType >> 8);
+	p[3] = (uint8_t)etherType;
+	ZT_FAST_MEMCPY(p + 4,data,len);
+	af->bytes += 4 + len;
+	++af->frames;
+	return true;
+}
+
+void Switch::_sendAggregated(void *tPtr,AggregatedFrames &af)
+{
+	if (!af.frames)
+		return;
+	if (af.frames == 1) {
+		// A lone frame goes as an ordinary FRAME
+		Packet outp(af.peer->address(),RR->identity.address(),Packet::VERB_FRAME);
+		outp.append(af.nwid);
+		outp.append(af.data + 2,2);
+		_sendFrame(tPtr,outp,af.peer,af.compress,af.nwid,((unsigned int)af.data[2] << 8) | (unsigned int)af.data[3],af.data + 4,af.bytes - 4,0);
+	} else {
+		Packet outp(af.peer->address(),RR->identity.address(),Packet::VERB_MULTI_FRAME);
+		outp.append(af.nwid);
+		outp.append(af.data,af.bytes);
+		if ((af.compress)&&(!af.peer->compressionBackedOff()))
+			af.peer->attemptFrameCompression(outp);
+		send(tPtr,outp,true,(const void *)0,0,0,af.egressClass,af.nwid,af.tos);
+	}
+	af.frames = 0;
+	af.bytes = 0;
+}
+
+bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt,const void *tail,unsigned int tailLen,uint64_t flowId,Egress::Class egressClass,uint64_t nwid,unsigned int tos)
 {
 	SharedPtr<Path> viaPath;
+	bool relayed = false;
 	const int64_t now = RR->node->now();
 	const Address destination(packet.destination());
 
-	const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,destination));
+	const Epoch::Guard eg;
+	Peer *const peer = RR->topology->getPeer(eg,tPtr,destination);
 	if (peer) {
-		viaPath = peer->getBestPath(now,false);
+		viaPath = peer->getMultipathPath(now,flowId);
 		if (!viaPath) {
 			peer->tryMemorizedPath(tPtr,now); // periodically attempt memorized or statically defined paths, if any are known
-			const SharedPtr<Peer> relay(RR->topology->getUpstreamPeer());
-			if ( (!relay) || (!(viaPath = relay->getBestPath(now,false))) ) {
-				if (!(viaPath = peer->getBestPath(now,true)))
-					return false;
+			// Peers that offered to relay are tried first for destinations on a network
+			// they're on, leaving upstreams as a last resort and for when nothing comes
+			// back through the relay
+			SharedPtr<Peer> relay(RR->topology->getRelayPeer());
+			if ((relay)&&(relay->address() != destination)&&(RR->node->sharedNetwork(relay->address(),destination,nwid))) {
+				if (peer->relayWentSilent(now)) {
+					relay->relayFailed(now);
+				} else if ((viaPath = relay->getBestPath(now,false))) {
+					peer->sentViaRelay(now);
+				}
+			}
+			if (!viaPath) {
+				relay = RR->topology->getUpstreamPeer();
+				if (relay)
+					viaPath = relay->getBestPath(now,false);
+			}
+			if (viaPath) {
+				relayed = true;
+			} else if (!(viaPath = peer->getBestPath(now,true))) {
+				return false;
 			}
 		}
 	} else {
 		return false;
 	}
 
-	unsigned int mtu = ZT_DEFAULT_PHYSMTU;
+	unsigned int mtu = viaPath->mtu(); // overridden by local.conf physical path config, if any
 	uint64_t trustedPathId = 0;
 	RR->topology->getOutboundPathInfo(viaPath->address(),mtu,trustedPathId);
 
-	unsigned int chunkSize = std::min(packet.size(),mtu);
-	packet.setFragmented(chunkSize < packet.size());
+	// Control payloads are compressed here, where the recipient's version says whether it has the preset dictionary
+	if ((!tailLen)&&(!packet.compressed())&&(Packet::controlVerb(packet.verb())))
+		packet.compress(peer->remoteVersionProtocol() >= 11);
+
+	packet.setFragmented((packet.size() + tailLen) > mtu);
 
 	if (trustedPathId) {
+		if (tailLen)
+			packet.append(tail,tailLen);
 		packet.setTrusted(trustedPathId);
+	} else if ((encrypt)&&(peer->aesGcm())) {
+		packet.armor(*(peer->aes()),tail,tailLen);
 	} else {
-		packet.armor(peer->key(),encrypt);
-	}
-
-	if (viaPath->send(RR,tPtr,packet.data(),chunkSize,now)) {
-		if (chunkSize < packet.size()) {
-			// Too big for one packet, fragment the rest
-			unsigned int fragStart = chunkSize;
-			unsigned int remaining = packet.size() - chunkSize;
-			unsigned int fragsRemaining = (remaining / (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
-			if ((fragsRemaining * (mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH)) < remaining)
-				++fragsRemaining;
-			const unsigned int totalFragments = fragsRemaining + 1;
-
-			for(unsigned int fno=1;fno<totalFragments;++fno) {
-				chunkSize = std::min(remaining,(unsigned int)(mtu - ZT_PROTO_MIN_FRAGMENT_LENGTH));
-				Packet::Fragment frag(packet,fragStart,chunkSize,fno,totalFragments);
-				viaPath->send(RR,tPtr,frag.data(),frag.size(),now);
-				fragStart += chunkSize;
-				remaining -= chunkSize;
-			}
+		packet.armor(peer->key(),encrypt,tail,tailLen);
+	}
+
+	if (RR->shaper->active()) {
+		// Frames over a network or member rate limit are held and sent when due
+		const Shaper::Result sr = RR->shaper->frame(tPtr,viaPath,egressClass,nwid,destination,packet.data(),packet.size(),mtu,now,tos);
+		if (sr != Shaper::SEND) {
+			if (sr == Shaper::HELD)
+				peer->countSent(packet.size(),relayed);
+			return true;
 		}
 	}
 
+	if ((egressClass != Egress::CONTROL)&&(RR->egress)&&(RR->egress->enabled())) {
+		// Frames wait their turn in the egress scheduler if the uplink is full
+		if (RR->egress->send(tPtr,viaPath,egressClass,nwid,packet.unsafeData(),packet.size(),mtu,now,tos))
+			peer->countSent(packet.size(),relayed);
+	} else if (viaPath->sendFragmented(RR,tPtr,reinterpret_cast<uint8_t *>(packet.unsafeData()),packet.size(),mtu,now,tos)) {
+		peer->countSent(packet.size(),relayed);
+	}
+
 	return true;
 }
 
+uint64_t Switch::_flowId(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	// The result only has to be stable on this node, so byte order doesn't matter
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(data);
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned int proto = 0,l4 = 0,addrStart = 0,addrEnd = 0;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		addrStart = 12; addrEnd = 20;
+		proto = d[9];
+		if ((((unsigned int)(d[6] & 0x1f) << 8) | (unsigned int)d[7]) == 0) // only the first fragment has ports
+			l4 = (unsigned int)(d[0] & 0xf) * 4;
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		addrStart = 8; addrEnd = 40;
+		proto = d[6];
+		l4 = 40;
+	} else {
+		return ((from.toInt() * 0x100000001b3ULL) ^ (to.toInt() << 16) ^ (uint64_t)etherType) | 1ULL;
+	}
+	for(unsigned int i=addrStart;i<addrEnd;++i)
+		h = (h ^ (uint64_t)d[i]) * 0x100000001b3ULL;
+	h = (h ^ (uint64_t)proto) * 0x100000001b3ULL;
+	if ((l4)&&((proto == 6)||(proto == 17)||(proto == 132))&&((l4 + 4) <= len)) {
+		for(unsigned int i=l4;i<(l4 + 4);++i)
+			h = (h ^ (uint64_t)d[i]) * 0x100000001b3ULL;
+	}
+	return h | 1ULL;
+}
+
 } // namespace ZeroTier
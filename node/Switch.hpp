@@ -31,6 +31,8 @@
 #include <set>
 #include <vector>
 #include <list>
+#include <atomic>
+#include <memory>
 
 #include "Constants.hpp"
 #include "Mutex.hpp"
@@ -43,11 +45,15 @@
 #include "SharedPtr.hpp"
 #include "IncomingPacket.hpp"
 #include "Hashtable.hpp"
+#include "Egress.hpp"
+#include "ObjectPool.hpp"
+#include "TopTalkers.hpp"
 
 namespace ZeroTier {
 
 class RuntimeEnvironment;
 class Peer;
+class FrameBuffer;
 
 /**
  * Core of the distributed Ethernet switch and protocol implementation
@@ -61,6 +67,7 @@ class Switch
 {
 public:
 	Switch(const RuntimeEnvironment *renv);
+	~Switch();
 
 	/**
 	 * Called when a packet is received from the real network
@@ -70,8 +77,10 @@ public:
 	 * @param fromAddr Internet IP address of origin
 	 * @param data Packet data
 	 * @param len Packet length
+	 * @param fb FrameBuffer whose packet holds data, to decode an unfragmented packet in place (default: NULL)
+	 * @param tos IP traffic class the datagram arrived with, so a CE mark can be passed on to frames in it (default: 0)
 	 */
-	void onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len);
+	void onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len,FrameBuffer *fb = (FrameBuffer *)0,unsigned int tos = 0);
 
 	/**
 	 * Called when a packet comes from a local Ethernet tap
@@ -84,8 +93,9 @@ public:
 	 * @param vlanId VLAN ID or 0 if none
 	 * @param data Ethernet payload
 	 * @param len Frame length
+	 * @param fb FrameBuffer holding data, to build a unicast frame's packet around it in place (default: NULL)
 	 */
-	void onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+	void onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len,FrameBuffer *fb = (FrameBuffer *)0);
 
 	/**
 	 * Send a packet to a ZeroTier address (destination in packet)
@@ -99,21 +109,63 @@ public:
 	 * Needless to say, the packet's source must be this node. Otherwise it
 	 * won't be encrypted right. (This is not used for relaying.)
 	 *
+	 * A tail may be supplied to be appended to the payload. If the packet can
+	 * be sent immediately the tail is encrypted directly from its memory into
+	 * the packet during armoring, otherwise it is copied in and queued.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param packet Packet to send (buffer may be modified)
 	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 * @param tail Additional payload data or NULL if none (default: NULL)
+	 * @param tailLen Length of tail (default: 0)
+	 * @param flowId Flow ID used to pick a path if the peer is multipath, or 0 if none (default: 0)
+	 * @param egressClass Egress scheduler class, frames being the only ones that can wait (default: CONTROL)
+	 * @param nwid Network a frame is for, to share the uplink fairly between networks and apply its rate limit (default: 0)
+	 * @param tos IP traffic class of a frame, passed to the host with each datagram carrying it (default: 0)
+	 */
+	void send(void *tPtr,Packet &packet,bool encrypt,const void *tail = (const void *)0,unsigned int tailLen = 0,uint64_t flowId = 0,Egress::Class egressClass = Egress::CONTROL,uint64_t nwid = 0,unsigned int tos = 0);
+
+	/**
+	 * Start collecting small frames into VERB_MULTI_FRAME packets on this thread
+	 *
+	 * Until flushAggregated() is called, unicast frames of up to
+	 * ZT_AGGREGATE_MAX_FRAME bytes from onLocalEthernet() to peers that
+	 * understand VERB_MULTI_FRAME are held and then sent together, one packet
+	 * per peer and network. A larger frame to the same peer sends what's held
+	 * for it first, so frames to a peer stay in order.
+	 *
+	 * @return True if collecting started, false if this thread is already collecting
+	 */
+	bool beginAggregation();
+
+	/**
+	 * Send frames held since beginAggregation() and stop collecting
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 */
-	void send(void *tPtr,Packet &packet,bool encrypt);
+	void flushAggregated(void *tPtr);
 
 	/**
 	 * Request WHOIS on a given address
 	 *
+	 * Requests made in quick succession are coalesced into one WHOIS packet
+	 * carrying many addresses, see ZT_WHOIS_COALESCE_WINDOW.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param now Current time
 	 * @param addr Address to look up
 	 */
 	void requestWhois(void *tPtr,const int64_t now,const Address &addr);
 
+	/**
+	 * @return True if WHOIS requests are waiting for the coalescing window to end
+	 */
+	inline bool whoisPending() const
+	{
+		Mutex::Lock _l(_lastSentWhoisRequest_m);
+		return (!_whoisQueue.empty());
+	}
+
 	/**
 	 * Run any processes that are waiting for this peer's identity
 	 *
@@ -136,69 +188,211 @@ public:
 	 */
 	unsigned long doTimerTasks(void *tPtr,int64_t now);
 
+	/**
+	 * Get fragment reassembly queue statistics
+	 *
+	 * @param size Number of entries currently allocated
+	 * @param evicted Incomplete packets dropped because their entry was needed for another packet
+	 * @param expired Incomplete packets dropped because they timed out
+	 */
+	inline void rxQueueStats(unsigned int &size,uint64_t &evicted,uint64_t &expired)
+	{
+		Mutex::Lock _l(_rxQueue_m);
+		size = (unsigned int)_rxQueueSize.load();
+		evicted = _rxQueueEvicted;
+		expired = _rxQueueExpired;
+	}
+
+	/**
+	 * Relay a packet or fragment for another node without checking rate limits
+	 *
+	 * This sends to the destination's best direct path, the cluster member
+	 * it's homed on, or an upstream, in that order.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param localSocket Local socket it was received on
+	 * @param fromAddr Address it was received from
+	 * @param source Source address or nil for fragments (nothing is introduced if nil)
+	 * @param destination Destination address
+	 * @param data Packet or fragment with hops already incremented
+	 * @param len Length of packet or fragment
+	 * @param now Current time
+	 */
+	void relayNow(void *tPtr,int64_t localSocket,const InetAddress &fromAddr,const Address &source,const Address &destination,const void *data,unsigned int len,int64_t now);
+
+	/**
+	 * @param mu Structure whose RX and TX queue fields are filled with approximate memory usage
+	 */
+	void memoryUsage(ZT_MemoryUsage *mu);
+
+	/**
+	 * Get relay statistics
+	 *
+	 * @param relayed Packets and fragments relayed directly to their destination
+	 * @param cacheHits Relayed packets sent to a cached best path without looking up the peer
+	 * @param cacheMisses Relay attempts that had to look up the peer
+	 */
+	inline void relayStats(uint64_t &relayed,uint64_t &cacheHits,uint64_t &cacheMisses) const
+	{
+		relayed = _relayed.load(std::memory_order_relaxed);
+		cacheHits = _relayCacheHits.load(std::memory_order_relaxed);
+		cacheMisses = _relayCacheMisses.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * @return Total bytes of packets and fragments relayed directly to their destination
+	 */
+	inline uint64_t relayedBytes() const { return _relayedBytes.load(std::memory_order_relaxed); }
+
+	/**
+	 * @return Heaviest destinations of relayed packets
+	 */
+	inline TopTalkers &topRelays() { return _topRelays; }
+
 private:
 	bool _shouldUnite(const int64_t now,const Address &source,const Address &destination);
-	bool _trySend(void *tPtr,Packet &packet,bool encrypt); // packet is modified if return is true
+
+	// Sends a packet or fragment we are relaying to its destination's best direct
+	// path, returning false if there isn't one (caller falls back to upstream)
+	bool _relay(void *tPtr,const Address &destination,const void *data,unsigned int len,const int64_t now);
+
+	// True if a packet (or a fragment, with a NULL source) not addressed to us should be
+	// relayed because we offered to relay for its source and destination, see VERB_RELAY_OFFER
+	bool _admitOfferedRelay(void *tPtr,const Address &source,const Address &destination,const uint64_t packetId,const unsigned int len,const int64_t now);
+
+	// Cheap check before _shouldUnite() so relayed packets usually don't take its lock
+	inline bool _relayShouldUnite(const int64_t now,const Address &source,const Address &destination)
+	{
+		RelayUniteCheck &c = _relayUniteChecks[(unsigned long)((source.toInt() ^ destination.toInt()) & (ZT_RELAY_CACHE_SIZE - 1))];
+		if ((c.source == source.toInt())&&(c.destination == destination.toInt())&&((now - c.checked) < ZT_RELAY_CACHE_TTL))
+			return false;
+		c.source = source.toInt();
+		c.destination = destination.toInt();
+		c.checked = now;
+		return _shouldUnite(now,source,destination);
+	}
+	bool _trySend(void *tPtr,Packet &packet,bool encrypt,const void *tail = (const void *)0,unsigned int tailLen = 0,uint64_t flowId = 0,Egress::Class egressClass = Egress::CONTROL,uint64_t nwid = 0,unsigned int tos = 0); // packet is modified if return is true
+
+	// Hashes the IP addresses, protocol and ports of a frame (or its MACs and
+	// ethertype if it isn't IP) into a non-zero flow ID for multipath
+	static uint64_t _flowId(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
+
+	// Sends a frame packet with the frame itself as a tail, compressing the
+	// whole thing instead if compression is wanted and the peer isn't backed
+	// off. If inPacket is true the frame is already at the end of the packet.
+	void _sendFrame(void *tPtr,Packet &outp,const SharedPtr<Peer> &peer,bool compress,uint64_t nwid,unsigned int etherType,const void *data,unsigned int len,uint64_t flowId,bool inPacket = false);
+
+	// Frames held for one peer and network while aggregating, see beginAggregation()
+	struct AggregatedFrames;
+
+	// Frames held on one thread, allocated the first time it aggregates and
+	// kept for the life of the thread
+	struct Aggregation;
+	static thread_local std::unique_ptr<Aggregation> _aggregation;
+
+	// Holds a frame for a peer if this thread is aggregating and returns true,
+	// otherwise sends anything held for that peer and returns false
+	bool _aggregate(void *tPtr,const SharedPtr<Peer> &peer,const SharedPtr<Network> &network,unsigned int etherType,const void *data,unsigned int len);
+
+	// Sends and empties frames held for a peer
+	void _sendAggregated(void *tPtr,AggregatedFrames &af);
 
 	const RuntimeEnvironment *const RR;
 	int64_t _lastBeaconResponse;
 	volatile int64_t _lastCheckedQueues;
 
-	// Time we last sent a WHOIS request for each address
+	// Time we last sent a WHOIS request for each address, plus addresses
+	// waiting to go out in the next coalesced request and when the last went
 	Hashtable< Address,int64_t > _lastSentWhoisRequest;
+	std::vector<Address> _whoisQueue;
+	int64_t _lastWhoisSent;
 	Mutex _lastSentWhoisRequest_m;
 
+	// Sends queued WHOIS requests if the coalescing window is over or force is true
+	void _flushWhois(void *tPtr,const int64_t now,bool force);
+
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
 	struct RXQueueEntry
 	{
-		RXQueueEntry() : timestamp(0) {}
-		volatile int64_t timestamp; // 0 if entry is not in use
+		RXQueueEntry() : timestamp(0),packetId(0),haveParity(false),congested(false),complete(false),lock("Switch::RXQueueEntry::lock"),indexedId(0),next((RXQueueEntry *)0),indexed(false) {}
+
+		// Entries come from their own slabs, see ObjectPool
+		static inline void *operator new(std::size_t size) { return ObjectPool<RXQueueEntry>::allocate(size); }
+		static inline void operator delete(void *p,std::size_t size) { ObjectPool<RXQueueEntry>::release(p,size); }
+
+		std::atomic<int64_t> timestamp; // 0 if entry is not in use, atomic since evictions scan it without lock
 		volatile uint64_t packetId;
 		IncomingPacket frag0; // head of packet
 		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1]; // later fragments (if any)
 		unsigned int totalFragments; // 0 if only frag0 received, waiting for frags
 		uint32_t haveFragments; // bit mask, LSB to MSB
-		volatile bool complete; // if true, packet is complete
+		Packet::Fragment parity; // FEC parity fragment if haveParity
+		bool haveParity;
+		bool congested; // some part arrived CE marked
+		std::atomic<bool> complete; // if true, packet is complete
 		Mutex lock;
+
+		// Index state, guarded by _rxQueue_m and not by lock
+		uint64_t indexedId; // packet ID under which this entry is indexed
+		RXQueueEntry *next; // next in index bucket if indexed, otherwise next free entry
+		bool indexed;
 	};
-	RXQueueEntry _rxQueue[ZT_RX_QUEUE_SIZE];
-	AtomicCounter _rxQueuePtr;
 
-	// Returns matching or next available RX queue entry
-	inline RXQueueEntry *_findRXQueueEntry(uint64_t packetId)
-	{
-		const unsigned int current = static_cast<unsigned int>(_rxQueuePtr.load());
-		for(unsigned int k=1;k<=ZT_RX_QUEUE_SIZE;++k) {
-			RXQueueEntry *rq = &(_rxQueue[(current - k) % ZT_RX_QUEUE_SIZE]);
-			if ((rq->packetId == packetId)&&(rq->timestamp))
-				return rq;
-		}
-		++_rxQueuePtr;
-		return &(_rxQueue[static_cast<unsigned int>(current) % ZT_RX_QUEUE_SIZE]);
-	}
+	// Entries are allocated on demand up to ZT_RX_QUEUE_MAX_SIZE and are never
+	// deleted until the Switch is, so pointers to them stay valid without
+	// holding _rxQueue_m. Entries in use are chained into a hash index by packet
+	// ID; the rest are on a free list threaded through the same next pointer.
+	RXQueueEntry *_rxQueue[ZT_RX_QUEUE_MAX_SIZE];
+	AtomicCounter _rxQueueSize;
+	RXQueueEntry *_rxQueueIndex[ZT_RX_QUEUE_MAX_SIZE];
+	RXQueueEntry *_rxQueueFree;
+	uint64_t _rxQueueEvicted; // incomplete packets whose entry was reused
+	uint64_t _rxQueueExpired; // incomplete packets that timed out
+	Mutex _rxQueue_m;
 
-	// Returns current entry in rx queue ring buffer and increments ring pointer
-	inline RXQueueEntry *_nextRXQueueEntry()
-	{
-		return &(_rxQueue[static_cast<unsigned int>((++_rxQueuePtr) - 1) % ZT_RX_QUEUE_SIZE]);
-	}
+	// Returns matching or next available RX queue entry; an entry with a zero
+	// timestamp or a different packet ID must be initialized by the caller
+	RXQueueEntry *_findRXQueueEntry(uint64_t packetId);
+
+	// Removes an entry from the index (call with rq->lock held after zeroing timestamp)
+	void _releaseRXQueueEntry(RXQueueEntry *rq,uint64_t packetId);
+
+	// Assembles and decodes a packet once all its fragments are in, rebuilding
+	// one missing fragment from FEC parity if need be (call with rq->lock held)
+	void _rxAssemble(void *tPtr,RXQueueEntry *rq,const SharedPtr<Path> &path,const int64_t now);
 
 	// ZeroTier-layer TX queue entry
 	struct TXQueueEntry
 	{
-		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc) :
-			dest(d),
-			creationTime(ct),
-			packet(p),
-			encrypt(enc) {}
-
+		TXQueueEntry() : creationTime(0),older((TXQueueEntry *)0),newer((TXQueueEntry *)0),destPrev((TXQueueEntry *)0),destNext((TXQueueEntry *)0) {}
 		Address dest;
-		uint64_t creationTime;
+		int64_t creationTime; // 0 if entry is not in use
 		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
 		bool encrypt;
+		unsigned int bytes; // counted against ZT_TX_QUEUE_MAX_BYTES
+		TXQueueEntry *older,*newer; // age order if in use, or free list via newer
+		TXQueueEntry *destPrev,*destNext; // destination bucket, oldest first
+	};
+
+	// TX queue entries live in a fixed array so that queueing never allocates.
+	// Entries in use are linked oldest to newest, so expiry only touches what
+	// expires, and into a hash bucket by destination, so flushing packets for
+	// a newly learned peer doesn't scan the whole queue.
+	struct TXQueueBucket
+	{
+		TXQueueEntry *head;
+		TXQueueEntry *tail;
 	};
-	std::list< TXQueueEntry > _txQueue;
+	TXQueueEntry _txQueue[ZT_TX_QUEUE_SIZE];
+	TXQueueBucket _txQueueByDest[ZT_TX_QUEUE_SIZE];
+	TXQueueEntry *_txQueueOldest;
+	TXQueueEntry *_txQueueNewest;
+	TXQueueEntry *_txQueueFree;
+	unsigned int _txQueueBytes;
+
+	// Both of these must be called with _txQueue_m held
+	TXQueueEntry *_txQueueAlloc(const Address &dest,unsigned int bytes); // drops oldest entries if over budget
+	void _txQueueRemove(TXQueueEntry *txi);
 	Mutex _txQueue_m;
 
 	// Tracks sending of VERB_RENDEZVOUS to relaying peers
@@ -221,6 +415,47 @@ private:
 	};
 	Hashtable< _LastUniteKey,uint64_t > _lastUniteAttempt; // key is always sorted in ascending order, for set-like behavior
 	Mutex _lastUniteAttempt_m;
+
+	// Destination to best direct path cache for relaying. Each entry is guarded
+	// by a sequence number that is odd while the entry is being written, and
+	// readers discard what they copied if it changed, so relaying a packet
+	// to a cached destination takes no locks and touches no reference counts.
+	// An entry holds a reference to its path, which keeps Topology from
+	// dropping it, so a reader holding an Epoch::Guard when it checks the
+	// sequence can send through the path even if the entry is then replaced.
+	struct RelayCacheEntry
+	{
+		RelayCacheEntry() : seq(0),destination(0),expires(0) {}
+		std::atomic<uint32_t> seq;
+		uint64_t destination;
+		SharedPtr<Path> path;
+		int64_t expires;
+	};
+	RelayCacheEntry _relayCache[ZT_RELAY_CACHE_SIZE];
+
+	// Last time each source/destination pair (by hash) was checked for uniting;
+	// races here only ever cause an extra or a slightly late _shouldUnite() call
+	struct RelayUniteCheck
+	{
+		RelayUniteCheck() : source(0),destination(0),checked(0) {}
+		volatile uint64_t source;
+		volatile uint64_t destination;
+		volatile int64_t checked;
+	};
+	RelayUniteCheck _relayUniteChecks[ZT_RELAY_CACHE_SIZE];
+
+	std::atomic<uint64_t> _relayed;
+	std::atomic<uint64_t> _relayedBytes;
+	std::atomic<uint64_t> _relayCacheHits;
+	std::atomic<uint64_t> _relayCacheMisses;
+
+	// Packet IDs of heads let through by _admitOfferedRelay() so their fragments follow,
+	// and bytes it let through in the current second against the offered capacity
+	std::atomic<uint64_t> _offeredRelayPackets[ZT_RELAY_CACHE_SIZE];
+	std::atomic<int64_t> _offeredRelaySecond;
+	std::atomic<uint64_t> _offeredRelayBytes;
+
+	TopTalkers _topRelays;
 };
 
 } // namespace ZeroTier
@@ -67,7 +67,7 @@ public:
 
 	Tag()
 	{
-		memset(this,0,sizeof(Tag));
+		memset((void *)this,0,sizeof(Tag));
 	}
 
 	/**
@@ -85,6 +85,7 @@ public:
 		_issuedTo(issuedTo),
 		_signedBy()
 	{
+		memset(_signature.data,0,sizeof(_signature.data));
 	}
 
 	inline uint32_t id() const { return _id; }
@@ -93,6 +94,7 @@ public:
 	inline int64_t timestamp() const { return _ts; }
 	inline const Address &issuedTo() const { return _issuedTo; }
 	inline const Address &signedBy() const { return _signedBy; }
+	inline const C25519::Signature &signature() const { return _signature; }
 
 	/**
 	 * Sign this tag
@@ -117,9 +119,10 @@ public:
 	 *
 	 * @param RR Runtime environment to allow identity lookup for signedBy
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param signatureVerified If true the signature itself already passed a batch check
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or tag
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,const bool signatureVerified = false) const;
 
 	template<unsigned int C>
 	inline void serialize(Buffer<C> &b,const bool forSign = false) const
@@ -149,7 +152,7 @@ public:
 	{
 		unsigned int p = startAt;
 
-		memset(this,0,sizeof(Tag));
+		memset((void *)this,0,sizeof(Tag));
 
 		_networkId = b.template at<uint64_t>(p); p += 8;
 		_ts = b.template at<uint64_t>(p); p += 8;
@@ -0,0 +1,171 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_TIMERWHEEL_HPP
+#define ZT_TIMERWHEEL_HPP
+
+#include "Constants.hpp"
+
+#include <stdint.h>
+
+#include <vector>
+#include <utility>
+
+/**
+ * Bits of tick number resolved by each level of a timer wheel
+ */
+#define ZT_TIMERWHEEL_LEVEL_BITS 6
+
+/**
+ * Number of levels in a timer wheel, which can hold deadlines up to 2^24 ticks away
+ */
+#define ZT_TIMERWHEEL_LEVELS 4
+
+namespace ZeroTier {
+
+/**
+ * A hierarchical timer wheel
+ *
+ * Each entry is a value with a deadline. Level 0 has one slot per tick and
+ * each higher level has one slot per whole turn of the level below it, and
+ * when a level turns over the next slot of the level above it is spread out
+ * over the lower levels. Adding an entry is O(1) and expire() does work in
+ * proportion to the ticks that passed and the entries that came due, not to
+ * the number of entries waiting.
+ *
+ * Entries can't be removed. Owners that change their minds should check
+ * whether an entry is still wanted when it comes due and add it again if it
+ * needs a later deadline.
+ *
+ * This is not thread safe, callers should add their own locking.
+ */
+template<typename T>
+class TimerWheel
+{
+public:
+	/**
+	 * @param tick Length of one tick in milliseconds, deadlines are rounded up to this
+	 * @param now Current time
+	 */
+	TimerWheel(const int64_t tick,const int64_t now) :
+		_tick(tick),
+		_cur(now / tick),
+		_size(0)
+	{
+	}
+
+	/**
+	 * @param deadline Time at or after which this entry should be returned by expire()
+	 * @param v Value
+	 */
+	inline void add(const int64_t deadline,const T &v)
+	{
+		_add((deadline + _tick - 1) / _tick,v);
+		++_size;
+	}
+
+	/**
+	 * Remove and return all entries whose deadline is at or before now
+	 *
+	 * @param now Current time
+	 * @param out Vector, list, or other compliant container to append values to
+	 * @tparam C Type of out (generally inferred)
+	 */
+	template<typename C>
+	inline void expire(const int64_t now,C &out)
+	{
+		const int64_t t = now / _tick;
+		while (_cur < t) {
+			++_cur;
+			// Higher levels first, so entries land in lower slots that are handled after them
+			for(int l=ZT_TIMERWHEEL_LEVELS-1;l>0;--l) {
+				if ((_cur & ((1LL << (ZT_TIMERWHEEL_LEVEL_BITS * l)) - 1)) == 0) {
+					std::vector< std::pair<int64_t,T> > e;
+					e.swap(_slots[l][_slot(_cur,l)]);
+					for(typename std::vector< std::pair<int64_t,T> >::const_iterator i(e.begin());i!=e.end();++i)
+						_add(i->first,i->second);
+				}
+			}
+			std::vector< std::pair<int64_t,T> > &s = _slots[0][_slot(_cur,0)];
+			for(typename std::vector< std::pair<int64_t,T> >::const_iterator i(s.begin());i!=s.end();++i)
+				_due.push_back(*i);
+			s.clear();
+		}
+		for(typename std::vector< std::pair<int64_t,T> >::const_iterator i(_due.begin());i!=_due.end();++i)
+			out.push_back(i->second);
+		_size -= (unsigned long)_due.size();
+		_due.clear();
+	}
+
+	/**
+	 * @return Number of entries waiting
+	 */
+	inline unsigned long size() const { return _size; }
+
+	/**
+	 * Remove all entries
+	 *
+	 * Entries can't be removed one at a time, so callers that leave many
+	 * stale ones behind can clear the wheel and add back the ones they want.
+	 */
+	inline void clear()
+	{
+		for(int l=0;l<ZT_TIMERWHEEL_LEVELS;++l) {
+			for(unsigned int i=0;i<(1 << ZT_TIMERWHEEL_LEVEL_BITS);++i)
+				_slots[l][i].clear();
+		}
+		_due.clear();
+		_size = 0;
+	}
+
+private:
+	static inline unsigned int _slot(const int64_t t,const int l) { return (unsigned int)((t >> (ZT_TIMERWHEEL_LEVEL_BITS * l)) & ((1 << ZT_TIMERWHEEL_LEVEL_BITS) - 1)); }
+
+	inline void _add(int64_t t,const T &v)
+	{
+		if (t <= _cur) {
+			_due.push_back(std::pair<int64_t,T>(t,v));
+			return;
+		}
+		const int64_t max = (1LL << (ZT_TIMERWHEEL_LEVEL_BITS * ZT_TIMERWHEEL_LEVELS)) - 1;
+		if ((t - _cur) > max)
+			t = _cur + max; // comes back around early and is simply put back
+		int l = 0;
+		while ((l < (ZT_TIMERWHEEL_LEVELS - 1))&&((t >> (ZT_TIMERWHEEL_LEVEL_BITS * (l + 1))) != (_cur >> (ZT_TIMERWHEEL_LEVEL_BITS * (l + 1)))))
+			++l;
+		_slots[l][_slot(t,l)].push_back(std::pair<int64_t,T>(t,v));
+	}
+
+	const int64_t _tick;
+	int64_t _cur; // last tick handled by expire()
+	unsigned long _size;
+	std::vector< std::pair<int64_t,T> > _slots[ZT_TIMERWHEEL_LEVELS][1 << ZT_TIMERWHEEL_LEVEL_BITS];
+	std::vector< std::pair<int64_t,T> > _due;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_TOPTALKERS_HPP
+#define ZT_TOPTALKERS_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/ZeroTierOne.h"
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "Address.hpp"
+#include "InetAddress.hpp"
+
+// One in this many frames or relayed packets is counted on each thread (must be a power of two)
+#define ZT_TOPTALKERS_SAMPLE_RATE 8
+
+// Entries in each sketch, which is also how many of each kind can be reported
+#define ZT_TOPTALKERS_SIZE 32
+
+// Length of a window in ms, results cover the previous window and the current one
+#define ZT_TOPTALKERS_WINDOW 10000
+
+namespace ZeroTier {
+
+/**
+ * Heaviest members, flows, Ethernet types and relay destinations
+ *
+ * Each kind is counted by bytes in a space-saving sketch, which keeps a
+ * fixed number of entries and gives a new key the smallest entry's slot and
+ * count. A key that sent more than 1/ZT_TOPTALKERS_SIZE of the traffic is
+ * always present, and no count is too high by more than its error. Frames
+ * are sampled per thread before anything is locked, so most cost a counter
+ * increment. Sketches are kept for the current and previous window and
+ * merged when read, so results cover one to two windows.
+ */
+class TopTalkers
+{
+public:
+	TopTalkers() :
+		_windowStart(0),
+		_lock("TopTalkers")
+	{
+	}
+
+	/**
+	 * @return True if the caller should count this frame or packet (cheap, per thread)
+	 */
+	static inline bool sample()
+	{
+		static thread_local unsigned int n = 0;
+		return (((++n) & (ZT_TOPTALKERS_SAMPLE_RATE - 1)) == 0);
+	}
+
+	/**
+	 * Count a sampled frame
+	 *
+	 * @param now Current time
+	 * @param member Member it was sent to or received from
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload
+	 * @param len Frame payload length
+	 */
+	inline void frame(const int64_t now,const Address &member,const unsigned int etherType,const void *data,const unsigned int len)
+	{
+		_Flow f;
+		const bool isFlow = f.parse(etherType,reinterpret_cast<const uint8_t *>(data),len);
+		Mutex::Lock _l(_lock);
+		_rotate(now);
+		_members[0].add(member.toInt(),len);
+		_etherTypes[0].add((uint64_t)etherType,len);
+		if (isFlow)
+			_flows[0].add(f,len);
+	}
+
+	/**
+	 * Count a sampled relayed packet or fragment
+	 *
+	 * @param now Current time
+	 * @param destination Member it was relayed to
+	 * @param len Length of packet or fragment
+	 */
+	inline void relay(const int64_t now,const Address &destination,const unsigned int len)
+	{
+		Mutex::Lock _l(_lock);
+		_rotate(now);
+		_relays[0].add(destination.toInt(),len);
+	}
+
+	/**
+	 * Get the heaviest members, flows and Ethernet types, or relay destinations
+	 *
+	 * @param nwid Network ID to report frames under
+	 * @param relays If true report relay destinations, otherwise frames
+	 * @param now Current time
+	 * @param talkers Buffer to fill
+	 * @param maxTalkers Size of buffer
+	 * @return Number of entries filled
+	 */
+	inline unsigned int get(const uint64_t nwid,const bool relays,const int64_t now,ZT_TopTalker *talkers,const unsigned int maxTalkers)
+	{
+		Mutex::Lock _l(_lock);
+		_rotate(now);
+		const int64_t since = _windowStart - ZT_TOPTALKERS_WINDOW;
+		unsigned int n = 0;
+		if (relays) {
+			n += _get(_relays,nwid,ZT_TOP_TALKER_RELAY,since,talkers + n,maxTalkers - n);
+		} else {
+			n += _get(_members,nwid,ZT_TOP_TALKER_MEMBER,since,talkers + n,maxTalkers - n);
+			n += _get(_flows,nwid,ZT_TOP_TALKER_FLOW,since,talkers + n,maxTalkers - n);
+			n += _get(_etherTypes,nwid,ZT_TOP_TALKER_ETHERTYPE,since,talkers + n,maxTalkers - n);
+		}
+		return n;
+	}
+
+private:
+	// IP addresses, protocol and ports of a frame, compared by hash
+	struct _Flow
+	{
+		inline bool parse(const unsigned int etherType,const uint8_t *d,const unsigned int len)
+		{
+			unsigned int l4 = 0,addrLen;
+			memset(this,0,sizeof(_Flow));
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+				addrLen = 4;
+				memcpy(src,d + 12,4);
+				memcpy(dst,d + 16,4);
+				proto = d[9];
+				if ((((unsigned int)(d[6] & 0x1f) << 8) | (unsigned int)d[7]) == 0) // only the first fragment has ports
+					l4 = (unsigned int)(d[0] & 0xf) * 4;
+			} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+				addrLen = 16;
+				memcpy(src,d + 8,16);
+				memcpy(dst,d + 24,16);
+				proto = d[6];
+				l4 = 40;
+			} else {
+				return false;
+			}
+			ipLen = (uint8_t)addrLen;
+			if ((l4)&&((proto == 6)||(proto == 17)||(proto == 132))&&((l4 + 4) <= len)) {
+				sport = (uint16_t)(((unsigned int)d[l4] << 8) | (unsigned int)d[l4 + 1]);
+				dport = (uint16_t)(((unsigned int)d[l4 + 2] << 8) | (unsigned int)d[l4 + 3]);
+			}
+			uint64_t h = 0xcbf29ce484222325ULL;
+			for(unsigned int i=0;i<addrLen;++i)
+				h = (h ^ (uint64_t)src[i]) * 0x100000001b3ULL;
+			for(unsigned int i=0;i<addrLen;++i)
+				h = (h ^ (uint64_t)dst[i]) * 0x100000001b3ULL;
+			hash = ((h ^ ((uint64_t)proto << 32) ^ ((uint64_t)sport << 16) ^ (uint64_t)dport) * 0x100000001b3ULL) | 1ULL;
+			return true;
+		}
+		inline bool operator==(const _Flow &f) const { return (hash == f.hash); }
+		inline bool operator!=(const _Flow &f) const { return (hash != f.hash); }
+		uint64_t hash; // never 0 for a parsed flow
+		uint8_t src[16],dst[16];
+		uint16_t sport,dport;
+		uint8_t proto;
+		uint8_t ipLen;
+	};
+
+	template<typename K>
+	struct _Sketch
+	{
+		struct Entry
+		{
+			K key;
+			uint64_t frames,bytes,error;
+		};
+
+		_Sketch() { clear(); }
+
+		inline void clear()
+		{
+			memset(e,0,sizeof(e));
+			count = 0;
+		}
+
+		inline void add(const K &k,const unsigned int len)
+		{
+			const uint64_t b = (uint64_t)len * ZT_TOPTALKERS_SAMPLE_RATE;
+			for(unsigned int i=0;i<count;++i) {
+				if (e[i].key == k) {
+					e[i].frames += ZT_TOPTALKERS_SAMPLE_RATE;
+					e[i].bytes += b;
+					return;
+				}
+			}
+			if (count < ZT_TOPTALKERS_SIZE) {
+				Entry &n = e[count++];
+				n.key = k;
+				n.frames = ZT_TOPTALKERS_SAMPLE_RATE;
+				n.bytes = b;
+				n.error = 0;
+			} else {
+				Entry &m = e[minimum()];
+				m.key = k;
+				m.frames = ZT_TOPTALKERS_SAMPLE_RATE; // only counted since it took the slot
+				m.error = m.bytes;
+				m.bytes += b;
+			}
+		}
+
+		inline unsigned int minimum() const
+		{
+			unsigned int m = 0;
+			for(unsigned int i=1;i<count;++i) {
+				if (e[i].bytes < e[m].bytes)
+					m = i;
+			}
+			return m;
+		}
+
+		// Smallest count, which bounds the count of any key that isn't present
+		inline uint64_t floor() const { return (count < ZT_TOPTALKERS_SIZE) ? 0 : e[minimum()].bytes; }
+
+		inline const Entry *find(const K &k) const
+		{
+			for(unsigned int i=0;i<count;++i) {
+				if (e[i].key == k)
+					return &(e[i]);
+			}
+			return (const Entry *)0;
+		}
+
+		Entry e[ZT_TOPTALKERS_SIZE];
+		unsigned int count;
+	};
+
+	// Starts a new window when the current one is over (assumes _lock is locked)
+	inline void _rotate(const int64_t now)
+	{
+		if ((now - _windowStart) < ZT_TOPTALKERS_WINDOW)
+			return;
+		if ((now - _windowStart) < (ZT_TOPTALKERS_WINDOW * 2)) {
+			_members[1] = _members[0];
+			_flows[1] = _flows[0];
+			_etherTypes[1] = _etherTypes[0];
+			_relays[1] = _relays[0];
+			_windowStart += ZT_TOPTALKERS_WINDOW;
+		} else {
+			_members[1].clear();
+			_flows[1].clear();
+			_etherTypes[1].clear();
+			_relays[1].clear();
+			_windowStart = now;
+		}
+		_members[0].clear();
+		_flows[0].clear();
+		_etherTypes[0].clear();
+		_relays[0].clear();
+	}
+
+	static inline void _key(ZT_TopTalker &t,const uint64_t k) { t.key = k; }
+	static inline void _key(ZT_TopTalker &t,const _Flow &f)
+	{
+		reinterpret_cast<InetAddress *>(&(t.source))->set(f.src,f.ipLen,f.sport);
+		reinterpret_cast<InetAddress *>(&(t.destination))->set(f.dst,f.ipLen,f.dport);
+		t.protocol = f.proto;
+	}
+
+	// Merges the two windows' sketches as mergeable summaries do, taking the
+	// other window's floor for a key it lacks, then sorts by bytes
+	template<typename K>
+	static inline unsigned int _get(const _Sketch<K> s[2],const uint64_t nwid,const ZT_TopTalkerType type,const int64_t since,ZT_TopTalker *talkers,const unsigned int maxTalkers)
+	{
+		const uint64_t floors[2] = { s[0].floor(),s[1].floor() };
+		unsigned int n = 0;
+		for(unsigned int w=0;w<2;++w) {
+			for(unsigned int i=0;i<s[w].count;++i) {
+				const typename _Sketch<K>::Entry &a = s[w].e[i];
+				const typename _Sketch<K>::Entry *const b = s[w ^ 1].find(a.key);
+				if ((w == 1)&&(b))
+					continue; // already merged from the current window
+				ZT_TopTalker t;
+				memset(&t,0,sizeof(t));
+				t.networkId = nwid;
+				t.type = type;
+				_key(t,a.key);
+				t.since = since;
+				t.frames = a.frames + ((b) ? b->frames : 0);
+				t.bytes = a.bytes + ((b) ? b->bytes : floors[w ^ 1]);
+				t.bytesError = a.error + ((b) ? b->error : floors[w ^ 1]);
+				_insert(t,talkers,n,maxTalkers);
+			}
+		}
+		return n;
+	}
+
+	// Insertion into a list sorted by bytes, dropping the lightest when full
+	static inline void _insert(const ZT_TopTalker &t,ZT_TopTalker *talkers,unsigned int &n,const unsigned int maxTalkers)
+	{
+		unsigned int i = n;
+		while ((i > 0)&&(talkers[i - 1].bytes < t.bytes))
+			--i;
+		if (i >= maxTalkers)
+			return;
+		const unsigned int end = (n < maxTalkers) ? n : (maxTalkers - 1);
+		memmove(talkers + i + 1,talkers + i,sizeof(ZT_TopTalker) * (end - i));
+		talkers[i] = t;
+		if (n < maxTalkers)
+			++n;
+	}
+
+	int64_t _windowStart;
+	_Sketch<uint64_t> _members[2];
+	_Sketch<_Flow> _flows[2];
+	_Sketch<uint64_t> _etherTypes[2];
+	_Sketch<uint64_t> _relays[2];
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
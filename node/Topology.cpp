@@ -32,6 +32,7 @@
 #include "NetworkConfig.hpp"
 #include "Buffer.hpp"
 #include "Switch.hpp"
+#include "SHA512.hpp"
 
 namespace ZeroTier {
 
@@ -60,14 +61,48 @@ namespace ZeroTier {
  * root-bob-tok-01: Tokyo, Japan
  * root-bob-tor-01: Toronto, Canada
  */
+// Version byte, 16-bit count, then each peer's address and serialized InetAddress (at most 19 bytes)
+#define ZT_TOPOLOGY_WARM_PATHS_MAX_SIZE (3 + (ZT_TOPOLOGY_MAX_WARM_PATHS * (ZT_ADDRESS_LENGTH + 19)))
+
 #define ZT_DEFAULT_WORLD_LENGTH 634
 static const unsigned char ZT_DEFAULT_WORLD[ZT_DEFAULT_WORLD_LENGTH] = {0x01,0x00,0x00,0x00,0x00,0x08,0xea,0xc9,0x0a,0x00,0x00,0x01,0x64,0xd3,0x71,0xf0,0x58,0xb8,0xb3,0x88,0xa4,0x69,0x22,0x14,0x91,0xaa,0x9a,0xcd,0x66,0xcc,0x76,0x4c,0xde,0xfd,0x56,0x03,0x9f,0x10,0x67,0xae,0x15,0xe6,0x9c,0x6f,0xb4,0x2d,0x7b,0x55,0x33,0x0e,0x3f,0xda,0xac,0x52,0x9c,0x07,0x92,0xfd,0x73,0x40,0xa6,0xaa,0x21,0xab,0xa8,0xa4,0x89,0xfd,0xae,0xa4,0x4a,0x39,0xbf,0x2d,0x00,0x65,0x9a,0xc9,0xc8,0x18,0xeb,0xbf,0xfd,0xd5,0x32,0xf7,0x15,0x6e,0x02,0x6f,0xb9,0x01,0x0d,0xb5,0x7b,0x04,0xd8,0x3a,0xc5,0x17,0x39,0x04,0x36,0xfd,0x9d,0xc6,0x3d,0xa8,0xf3,0x8e,0x79,0xe7,0xc8,0x77,0x8d,0xcc,0x79,0xb8,0xab,0xc6,0x98,0x7c,0x9f,0x34,0x25,0x14,0xe1,0x2f,0xd7,0x97,0x11,0xec,0x34,0x4c,0x9f,0x0f,0xb4,0x85,0x0d,0x9b,0x11,0xd1,0xc2,0xce,0x00,0xc4,0x0a,0x13,0x4b,0xcb,0xc3,0xae,0x2e,0x16,0x00,0x4b,0xdc,0x90,0x5e,0x7e,0x9b,0x44,0x07,0x15,0x36,0x61,0x3c,0x64,0xaa,0xe9,0x46,0x78,0x3c,0xa7,0x18,0xc8,0xd8,0x02,0x9d,0x21,0x90,0x39,0xf3,0x00,0x01,0xf0,0x92,0x2a,0x98,0xe3,0xb3,0x4e,0xbc,0xbf,0xf3,0x33,0x26,0x9d,0xc2,0x65,0xd7,0xa0,0x20,0xaa,0xb6,0x9d,0x72,0xbe,0x4d,0x4a,0xcc,0x9c,0x8c,0x92,0x94,0x78,0x57,0x71,0x25,0x6c,0xd1,0xd9,0x42,0xa9,0x0d,0x1b,0xd1,0xd2,0xdc,0xa3,0xea,0x84,0xef,0x7d,0x85,0xaf,0xe6,0x61,0x1f,0xb4,0x3f,0xf0,0xb7,0x41,0x26,0xd9,0x0a,0x6e,0x00,0x0c,0x04,0xbc,0xa6,0x5e,0xb1,0x27,0x09,0x06,0x2a,0x03,0xb0,0xc0,0x00,0x02,0x00,0xd0,0x00,0x7d,0x00,0x01,0x00,0x00,0x00,0x00,0x27,0x09,0x04,0x9a,0x42,0xc5,0x21,0x27,0x09,0x06,0x2c,0x0f,0xf8,0x50,0x01,0x54,0x01,0x97,0x00,0x33,0xcc,0x08,0xf8,0xfa,0xcc,0x08,0x27,0x09,0x04,0x9f,0xcb,0x61,0xab,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x08,0x00,0x00,0xa1,0x00,0x54,0x60,0x01,0x00,0xfc,0xcc,0x08,0x27,0x09,0x04,0x83,0xff,0x06,0x10,0x27,0x09,0x06,0x28,0x03,0xeb,0x80,0x00,0x00,0x00,0x0e,0x00,0x02,0x60,0x01,0x00,0xfc,0xcc,0x08,0x27,0x09,0x04,0x6b,0xaa,0xc5,0x0e,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x00,0x01,0x00,0x20,0x02,0x00,0xe0,0x01,0x08,0xfe,0xcc,0x08,0x27,0x09,0x04,0x80,0xc7,0xc5,0xd9,0x27,0x09,0x06,0x24,0x00,0x61,0x80,0x00,0x00,0x00,0xd0,0x00,0xb7,0x40,0x01,0x08,0xfe,0xcc,0x08,0x27,0x09,0x88,0x41,0x40,0x8a,0x2e,0x00,0xbb,0x1d,0x31,0xf2,0xc3,0x23,0xe2,0x64,0xe9,0xe6,0x41,0x72,0xc1,0xa7,0x4f,0x77,0x89,0x95,0x55,0xed,0x10,0x75,0x1c,0xd5,0x6e,0x86,0x40,0x5c,0xde,0x11,0x8d,0x02,0xdf,0xfe,0x55,0x5d,0x46,0x2c,0xcf,0x6a,0x85,0xb5,0x63,0x1c,0x12,0x35,0x0c,0x8d,0x5d,0xc4,0x09,0xba,0x10,0xb9,0x02,0x5d,0x0f,0x44,0x5c,0xf4,0x49,0xd9,0x2b,0x1c,0x00,0x0c,0x04,0x2d,0x20,0xc6,0x82,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x64,0x00,0x81,0xc3,0x54,0x00,0x00,0xff,0xfe,0x18,0x1d,0x61,0x27,0x09,0x04,0x2e,0x65,0xa0,0xf9,0x27,0x09,0x06,0x2a,0x03,0xb0,0xc0,0x00,0x03,0x00,0xd0,0x00,0x6a,0x30,0x01,0x78,0x00,0xcd,0x08,0x27,0x09,0x04,0x6b,0xbf,0x2e,0xd2,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x68,0x00,0x83,0xa4,0x00,0x64,0xcd,0x08,0x80,0x01,0xcd,0x08,0x27,0x09,0x04,0x2d,0x20,0xf6,0xb3,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x58,0x00,0x8b,0xf8,0x54,0x00,0x00,0xff,0xfe,0x15,0xb3,0x9a,0x27,0x09,0x04,0x2d,0x20,0xf8,0x57,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x70,0x00,0x9b,0xc9,0x54,0x00,0x00,0xff,0xfe,0x15,0xc4,0xf5,0x27,0x09,0x04,0x9f,0xcb,0x02,0x9a,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x0c,0xad,0x00,0xd0,0x00,0x26,0x70,0x01,0xfe,0x15,0xc4,0xf5,0x27,0x09};
 
 Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 	RR(renv),
-	_numConfiguredPhysicalPaths(0),
-	_amUpstream(false)
+	_physicalPathConfig(new _PathConfig()),
+	_physicalPathConfig_m("Topology::_physicalPathConfig_m"),
+	_peerKeyCacheHits(0),
+	_peerKeyCacheMisses(0),
+	_maxPeersPerShard(ZT_MAX_PEERS ? ((ZT_MAX_PEERS + (ZT_TOPOLOGY_PEER_SHARDS - 1)) / ZT_TOPOLOGY_PEER_SHARDS) : 0),
+	_peersEvicted(0),
+	_coldTimeout(0),
+	_peersPromoted(0),
+	_paths_m("Topology::_paths_m"),
+	_retired_m("Topology::_retired_m"),
+	_amUpstream(false),
+	_upstreams_m("Topology::_upstreams_m"),
+	_relays_m("Topology::_relays_m")
 {
+#ifdef ZT_NO_PEER_KEY_CACHE
+	_peerKeyCacheEnabled = false;
+#else
+	// Agreed keys in the peer cache are sealed with a key derived from our own
+	// secret key, so they are useless without our identity.secret.
+	_peerKeyCacheEnabled = RR->identity.hasPrivate();
+	if (_peerKeyCacheEnabled) {
+		uint8_t tmp[ZT_C25519_PRIVATE_KEY_LEN + 16];
+		uint8_t digest[64];
+		C25519::Pair kp(RR->identity.privateKeyPair());
+		ZT_FAST_MEMCPY(tmp,kp.priv.data,ZT_C25519_PRIVATE_KEY_LEN);
+		memcpy(tmp + ZT_C25519_PRIVATE_KEY_LEN,"peer key cache\0\0",16);
+		SHA512::hash(digest,tmp,sizeof(tmp));
+		ZT_FAST_MEMCPY(_peerKeyCacheKey,digest,sizeof(_peerKeyCacheKey));
+		Utils::burn(tmp,sizeof(tmp));
+		Utils::burn(digest,sizeof(digest));
+		Utils::burn(&kp,sizeof(kp));
+	}
+#endif
+
 	uint8_t tmp[ZT_WORLD_MAX_SERIALIZED_LENGTH];
 	uint64_t idtmp[2];
 	idtmp[0] = 0; idtmp[1] = 0;
@@ -90,23 +125,37 @@ Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 
 Topology::~Topology()
 {
-	Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-	Address *a = (Address *)0;
-	SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-	while (i.next(a,p))
-		_savePeer((void *)0,*p);
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peerShards[s].peers);
+		Address *a = (Address *)0;
+		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		while (i.next(a,p))
+			_savePeer((void *)0,*p);
+	}
+	saveWarmPaths((void *)0,RR->node->now());
+	delete _physicalPathConfig.load();
+	for(std::vector<const _PathConfig *>::const_iterator pc(_oldPhysicalPathConfigs.begin());pc!=_oldPhysicalPathConfigs.end();++pc)
+		delete *pc;
 }
 
 SharedPtr<Peer> Topology::addPeer(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	SharedPtr<Peer> np;
+	bool full = false;
+	_PeerShard &s = _peerShard(peer->address());
 	{
-		Mutex::Lock _l(_peers_m);
-		SharedPtr<Peer> &hp = _peers[peer->address()];
-		if (!hp)
+		Mutex::Lock _l(s.lock);
+		SharedPtr<Peer> &hp = s.peers[peer->address()];
+		if (!hp) {
 			hp = peer;
+			s.cold.erase(peer->address());
+		}
 		np = hp;
+		const unsigned long limit = _maxPeersPerShard;
+		full = ((limit)&&(s.peers.size() > limit));
 	}
+	if (full)
+		_evictPeers(tPtr,s,peer->address());
 	return np;
 }
 
@@ -115,11 +164,32 @@ SharedPtr<Peer> Topology::getPeer(void *tPtr,const Address &zta)
 	if (zta == RR->identity.address())
 		return SharedPtr<Peer>();
 
+	_PeerShard &s = _peerShard(zta);
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
-		if (ap)
-			return *ap;
+		SharedPtr<Peer> np;
+		bool full = false;
+		{
+			Mutex::Lock _l(s.lock);
+			const SharedPtr<Peer> *const ap = s.peers.get(zta);
+			if (ap)
+				return *ap;
+			_ColdPeer *const cp = s.cold.get(zta);
+			if (cp) {
+				np = Peer::deserializeFromCache(RR->node->now(),tPtr,cp->record,RR,(_peerKeyCacheEnabled) ? _peerKeyCacheKey : (const uint8_t *)0);
+				s.cold.erase(zta);
+				if (np) {
+					s.peers.set(zta,np);
+					++_peersPromoted;
+					const unsigned long limit = _maxPeersPerShard;
+					full = ((limit)&&(s.peers.size() > limit));
+				}
+			}
+		}
+		if (np) {
+			if (full)
+				_evictPeers(tPtr,s,zta);
+			return np;
+		}
 	}
 
 	try {
@@ -128,14 +198,26 @@ SharedPtr<Peer> Topology::getPeer(void *tPtr,const Address &zta)
 		int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_PEER,idbuf,buf.unsafeData(),ZT_PEER_MAX_SERIALIZED_STATE_SIZE);
 		if (len > 0) {
 			buf.setSize(len);
-			Mutex::Lock _l(_peers_m);
-			SharedPtr<Peer> &ap = _peers[zta];
-			if (ap)
-				return ap;
-			ap = Peer::deserializeFromCache(RR->node->now(),tPtr,buf,RR);
-			if (!ap) {
-				_peers.erase(zta);
+			bool full = false;
+			{
+				Mutex::Lock _l(s.lock);
+				SharedPtr<Peer> &ap = s.peers[zta];
+				if (ap)
+					return ap;
+				bool cachedKeyUsed = false;
+				ap = Peer::deserializeFromCache(RR->node->now(),tPtr,buf,RR,(_peerKeyCacheEnabled) ? _peerKeyCacheKey : (const uint8_t *)0,&cachedKeyUsed);
+				if (!ap) {
+					s.peers.erase(zta);
+				} else if (cachedKeyUsed) {
+					++_peerKeyCacheHits;
+				} else {
+					++_peerKeyCacheMisses;
+				}
+				const unsigned long limit = _maxPeersPerShard;
+				full = ((limit)&&(s.peers.size() > limit));
 			}
+			if (full)
+				_evictPeers(tPtr,s,zta);
 			return SharedPtr<Peer>();
 		}
 	} catch ( ... ) {} // ignore invalid identities or other strage failures
@@ -148,10 +230,19 @@ Identity Topology::getIdentity(void *tPtr,const Address &zta)
 	if (zta == RR->identity.address()) {
 		return RR->identity;
 	} else {
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		Mutex::Lock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return (*ap)->identity();
+		const _ColdPeer *const cp = s.cold.get(zta);
+		if (cp) {
+			try {
+				Identity id;
+				id.deserialize(cp->record,1);
+				return id;
+			} catch ( ... ) {}
+		}
 	}
 	return Identity();
 }
@@ -159,26 +250,72 @@ Identity Topology::getIdentity(void *tPtr,const Address &zta)
 SharedPtr<Peer> Topology::getUpstreamPeer()
 {
 	const int64_t now = RR->node->now();
-	unsigned int bestq = ~((unsigned int)0);
-	const SharedPtr<Peer> *best = (const SharedPtr<Peer> *)0;
-
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
+	if (_bestUpstream) {
+		const SharedPtr<Peer> p(getPeerNoCache(_bestUpstream));
+		if ((p)&&((now - p->lastReceive()) < ZT_PEER_ACTIVITY_TIMEOUT)) {
+			const unsigned int l = p->latency(now);
+			if ((l)&&(l < 0xffff))
+				return p;
+		}
+	}
+	return _selectUpstream(now);
+}
 
-	for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
-		const SharedPtr<Peer> *p = _peers.get(*a);
-		if (p) {
-			const unsigned int q = (*p)->relayQuality(now);
-			if (q <= bestq) {
-				bestq = q;
-				best = p;
+void Topology::rankUpstreams(void *tPtr,int64_t now)
+{
+	std::vector< std::pair< SharedPtr<Peer>,SharedPtr<Path> > > probe;
+	{
+		Mutex::Lock _l1(_upstreams_m);
+		for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
+			const SharedPtr<Peer> p(getPeerNoCache(*a));
+			if (p) {
+				const unsigned int l = p->latency(now);
+				if ((!l)||(l >= 0xffff)) {
+					const SharedPtr<Path> bp(p->getBestPath(now,false));
+					if (bp)
+						probe.push_back(std::pair< SharedPtr<Peer>,SharedPtr<Path> >(p,bp));
+				}
 			}
 		}
+		_selectUpstream(now);
 	}
 
-	if (!best)
-		return SharedPtr<Peer>();
-	return *best;
+	// A path's latency is only known after an OK(HELLO), so rather than wait
+	// for the next regular ping keep saying HELLO until one comes back.
+	for(std::vector< std::pair< SharedPtr<Peer>,SharedPtr<Path> > >::const_iterator p(probe.begin());p!=probe.end();++p)
+		p->first->sendHELLO(tPtr,p->second->localSocket(),p->second->address(),now);
+}
+
+void Topology::relayOffered(const Address &ztaddr)
+{
+	Mutex::Lock _l(_relays_m);
+	if ((std::find(_relayCandidates.begin(),_relayCandidates.end(),ztaddr) == _relayCandidates.end())&&(_relayCandidates.size() < ZT_MAX_RELAY_CANDIDATES))
+		_relayCandidates.push_back(ztaddr);
+}
+
+SharedPtr<Peer> Topology::getRelayPeer()
+{
+	const int64_t now = RR->node->now();
+	Mutex::Lock _l(_relays_m);
+	if (_bestRelay) {
+		const SharedPtr<Peer> p(getPeerNoCache(_bestRelay));
+		if ((p)&&(p->relayOfferScore(now) != (~(unsigned int)0)))
+			return p;
+	}
+	return _selectRelay(now);
+}
+
+void Topology::rankRelays(int64_t now)
+{
+	Mutex::Lock _l(_relays_m);
+	for(std::vector<Address>::iterator a(_relayCandidates.begin());a!=_relayCandidates.end();) {
+		const SharedPtr<Peer> p(getPeerNoCache(*a));
+		if ((!p)||(p->relayOfferScore(now) == (~(unsigned int)0)))
+			a = _relayCandidates.erase(a);
+		else ++a;
+	}
+	_selectRelay(now);
 }
 
 bool Topology::isUpstream(const Identity &id) const
@@ -252,7 +389,6 @@ bool Topology::addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew)
 	if ((newWorld.type() != World::TYPE_PLANET)&&(newWorld.type() != World::TYPE_MOON))
 		return false;
 
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	World *existing = (World *)0;
@@ -334,14 +470,15 @@ void Topology::addMoon(void *tPtr,const uint64_t id,const Address &seed)
 
 	if (seed) {
 		Mutex::Lock _l(_upstreams_m);
-		if (std::find(_moonSeeds.begin(),_moonSeeds.end(),std::pair<uint64_t,Address>(id,seed)) == _moonSeeds.end())
+		if (std::find(_moonSeeds.begin(),_moonSeeds.end(),std::pair<uint64_t,Address>(id,seed)) == _moonSeeds.end()) {
 			_moonSeeds.push_back(std::pair<uint64_t,Address>(id,seed));
+			_serializeWorlds();
+		}
 	}
 }
 
 void Topology::removeMoon(void *tPtr,const uint64_t id)
 {
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	std::vector<World> nm;
@@ -368,35 +505,398 @@ void Topology::removeMoon(void *tPtr,const uint64_t id)
 
 void Topology::doPeriodicTasks(void *tPtr,int64_t now)
 {
+	saveWarmPaths(tPtr,now);
+
+	std::vector< SharedPtr<Peer> > deadPeers;
 	{
-		Mutex::Lock _l1(_peers_m);
 		Mutex::Lock _l2(_upstreams_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) ) {
-				_savePeer(tPtr,*p);
-				_peers.erase(*a);
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			Mutex::Lock _l1(_peerShards[s].lock);
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peerShards[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			const int64_t coldTimeout = _coldTimeout;
+			while (i.next(a,p)) {
+				if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) != _upstreamAddresses.end())
+					continue;
+				if (!(*p)->isAlive(now)) {
+					_savePeer(tPtr,*p);
+					deadPeers.push_back(*p);
+					_peerShards[s].peers.erase(*a);
+				} else if ((coldTimeout)&&((now - (*p)->lastReceive()) >= coldTimeout)) {
+					_savePeer(tPtr,*p);
+					_demote(_peerShards[s],*a,*p);
+					deadPeers.push_back(*p);
+					_peerShards[s].peers.erase(*a);
+				}
+			}
+
+			// Cold records last as long as the peers would have
+			Hashtable< Address,_ColdPeer >::Iterator c(_peerShards[s].cold);
+			_ColdPeer *cp = (_ColdPeer *)0;
+			while (c.next(a,cp)) {
+				if ((now - cp->lastReceive) >= ZT_PEER_ACTIVITY_TIMEOUT)
+					_peerShards[s].cold.erase(*a);
 			}
 		}
 	}
 
+	std::vector< SharedPtr<Path> > deadPaths;
 	{
 		Mutex::Lock _l(_paths_m);
 		Hashtable< Path::HashKey,SharedPtr<Path> >::Iterator i(_paths);
 		Path::HashKey *k = (Path::HashKey *)0;
 		SharedPtr<Path> *p = (SharedPtr<Path> *)0;
 		while (i.next(k,p)) {
-			if (p->references() <= 1)
+			if (p->references() <= 1) {
+				deadPaths.push_back(*p);
 				_paths.erase(*k);
+			}
+		}
+	}
+
+	{
+		Mutex::Lock _l(_retired_m);
+		if ((!deadPeers.empty())||(!deadPaths.empty())) {
+			const uint64_t e = Epoch::retire();
+			for(std::vector< SharedPtr<Peer> >::iterator p(deadPeers.begin());p!=deadPeers.end();++p) {
+				_retiredPeers.push_back(std::pair< uint64_t,SharedPtr<Peer> >(e,SharedPtr<Peer>()));
+				_retiredPeers.back().second.swap(*p);
+			}
+			for(std::vector< SharedPtr<Path> >::iterator p(deadPaths.begin());p!=deadPaths.end();++p) {
+				_retiredPaths.push_back(std::pair< uint64_t,SharedPtr<Path> >(e,SharedPtr<Path>()));
+				_retiredPaths.back().second.swap(*p);
+			}
+		}
+		_reclaimRetired();
+	}
+}
+
+void Topology::_evictPeers(void *tPtr,_PeerShard &s,const Address &keep)
+{
+	std::vector< SharedPtr<Peer> > evicted;
+	{
+		Mutex::Lock _l2(_upstreams_m);
+		Mutex::Lock _l1(s.lock);
+		const unsigned long limit = _maxPeersPerShard;
+		while ((limit)&&(s.peers.size() > limit)) {
+			// Least recently heard from, but never a root or moon or the peer just added
+			Address lru;
+			int64_t lruTime = 0;
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(s.peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p)) {
+				if ( (*a != keep) && ((!lru)||((*p)->lastReceive() < lruTime)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) ) {
+					lru = *a;
+					lruTime = (*p)->lastReceive();
+				}
+			}
+			if (!lru)
+				break;
+			SharedPtr<Peer> *const ep = s.peers.get(lru);
+			_savePeer(tPtr,*ep);
+			if ((*ep)->isAlive(RR->node->now()))
+				_demote(s,lru,*ep);
+			evicted.push_back(*ep);
+			s.peers.erase(lru);
+			++_peersEvicted;
+		}
+	}
+
+	if (!evicted.empty()) {
+		Mutex::Lock _l(_retired_m);
+		const uint64_t e = Epoch::retire();
+		for(std::vector< SharedPtr<Peer> >::iterator p(evicted.begin());p!=evicted.end();++p) {
+			_retiredPeers.push_back(std::pair< uint64_t,SharedPtr<Peer> >(e,SharedPtr<Peer>()));
+			_retiredPeers.back().second.swap(*p);
 		}
 	}
 }
 
+void Topology::_demote(_PeerShard &s,const Address &a,const SharedPtr<Peer> &p)
+{
+	if (!_coldTimeout)
+		return;
+	const unsigned long limit = _maxPeersPerShard;
+	if ((limit)&&(s.cold.size() >= (limit * ZT_PEER_COLD_PER_HOT)))
+		return; // it's still in the peer cache
+	try {
+		_ColdPeer &cp = s.cold[a];
+		cp.lastReceive = p->lastReceive();
+		cp.record.clear();
+		p->serializeForCache(cp.record,(_peerKeyCacheEnabled) ? _peerKeyCacheKey : (const uint8_t *)0,1);
+	} catch ( ... ) {
+		s.cold.erase(a);
+	}
+}
+
+void Topology::_reclaimRetired()
+{
+	// Retired in epoch order, so stop at the first one that isn't safe yet
+	std::vector< std::pair< uint64_t,SharedPtr<Peer> > >::iterator pe(_retiredPeers.begin());
+	while ((pe != _retiredPeers.end())&&(Epoch::safe(pe->first)))
+		++pe;
+	_retiredPeers.erase(_retiredPeers.begin(),pe);
+	std::vector< std::pair< uint64_t,SharedPtr<Path> > >::iterator pa(_retiredPaths.begin());
+	while ((pa != _retiredPaths.end())&&(Epoch::safe(pa->first)))
+		++pa;
+	_retiredPaths.erase(_retiredPaths.begin(),pa);
+}
+
+void Topology::saveWarmPaths(void *tPtr,int64_t now)
+{
+	const std::vector<Address> upstreams(upstreamAddresses());
+	std::vector< std::pair< int64_t,std::pair<Address,InetAddress> > > warm;
+	std::vector< SharedPtr<Peer> > sp;
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		_peerShards[s].snapshot(sp);
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(sp.begin());p!=sp.end();++p) {
+			if (std::find(upstreams.begin(),upstreams.end(),(*p)->address()) != upstreams.end())
+				continue;
+			const SharedPtr<Path> bp((*p)->getBestPath(now,false));
+			if (bp)
+				warm.push_back(std::pair< int64_t,std::pair<Address,InetAddress> >(-(*p)->lastReceive(),std::pair<Address,InetAddress>((*p)->address(),bp->address())));
+		}
+	}
+	std::sort(warm.begin(),warm.end()); // most recently heard from first
+	if (warm.size() > ZT_TOPOLOGY_MAX_WARM_PATHS)
+		warm.resize(ZT_TOPOLOGY_MAX_WARM_PATHS);
+
+	try {
+		Buffer<ZT_TOPOLOGY_WARM_PATHS_MAX_SIZE> *const b = new Buffer<ZT_TOPOLOGY_WARM_PATHS_MAX_SIZE>();
+		b->append((uint8_t)1);
+		b->append((uint16_t)warm.size());
+		for(std::vector< std::pair< int64_t,std::pair<Address,InetAddress> > >::const_iterator w(warm.begin());w!=warm.end();++w) {
+			w->second.first.appendTo(*b);
+			w->second.second.serialize(*b);
+		}
+		uint64_t idtmp[2]; idtmp[0] = 0; idtmp[1] = 0;
+		RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_WARM_PATHS,idtmp,b->data(),b->size());
+		delete b;
+	} catch ( ... ) {}
+}
+
+unsigned int Topology::warmStart(void *tPtr,int64_t now)
+{
+	Buffer<ZT_TOPOLOGY_WARM_PATHS_MAX_SIZE> *const b = new Buffer<ZT_TOPOLOGY_WARM_PATHS_MAX_SIZE>();
+	uint64_t idtmp[2]; idtmp[0] = 0; idtmp[1] = 0;
+	const int n = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_WARM_PATHS,idtmp,b->unsafeData(),ZT_TOPOLOGY_WARM_PATHS_MAX_SIZE);
+	unsigned int contacted = 0;
+	if (n > 3) {
+		try {
+			b->setSize((unsigned int)n);
+			if ((*b)[0] == 1) {
+				const std::vector<Address> upstreams(upstreamAddresses());
+				const unsigned int cnt = b->at<uint16_t>(1);
+				unsigned int ptr = 3;
+				for(unsigned int i=0;i<cnt;++i) {
+					const Address a(b->field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH); ptr += ZT_ADDRESS_LENGTH;
+					InetAddress at;
+					ptr += at.deserialize(*b,ptr);
+					if ((!at)||(a == RR->identity.address())||(std::find(upstreams.begin(),upstreams.end(),a) != upstreams.end()))
+						continue;
+
+					// Loading a peer from the cache also tries the paths it was cached with, but
+					// the saved path is newer if we stopped without saving peers (e.g. crashed)
+					getPeer(tPtr,a);
+					const SharedPtr<Peer> p(getPeerNoCache(a));
+					if ((p)&&(RR->node->shouldUsePathForZeroTierTraffic(tPtr,a,-1,at))) {
+						p->attemptToContactAt(tPtr,-1,at,now,true);
+						++contacted;
+					}
+				}
+			}
+		} catch ( ... ) {} // stop at truncated or invalid entries
+	}
+	delete b;
+	return contacted;
+}
+
+void Topology::saveState(StateSnapshot &ss)
+{
+	Buffer<8 + ZT_PEER_MAX_SERIALIZED_STATE_SIZE> *const b = new Buffer<8 + ZT_PEER_MAX_SERIALIZED_STATE_SIZE>();
+	std::vector< SharedPtr<Peer> > sp;
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		_peerShards[s].snapshot(sp);
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(sp.begin());p!=sp.end();++p) {
+			try {
+				b->clear();
+				b->append((uint64_t)(*p)->lastReceive());
+				(*p)->serializeForCache(*b,(_peerKeyCacheEnabled) ? _peerKeyCacheKey : (const uint8_t *)0);
+				ss.add(StateSnapshot::RECORD_PEER,*b);
+			} catch ( ... ) {}
+		}
+
+		Mutex::Lock _l(_peerShards[s].lock);
+		Hashtable< Address,_ColdPeer >::Iterator c(_peerShards[s].cold);
+		Address *a = (Address *)0;
+		_ColdPeer *cp = (_ColdPeer *)0;
+		while (c.next(a,cp)) {
+			b->clear();
+			b->append((uint64_t)cp->lastReceive);
+			b->append(cp->record.data(),cp->record.size());
+			ss.add(StateSnapshot::RECORD_COLD_PEER,*b);
+		}
+	}
+	delete b;
+}
+
+bool Topology::restoreState(void *tPtr,int64_t now,StateSnapshot::RecordType t,const Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &b)
+{
+	if ((t != StateSnapshot::RECORD_PEER)&&(t != StateSnapshot::RECORD_COLD_PEER))
+		return false;
+	try {
+		// <[8] last receive><[1] cache entry version><[5] address>...
+		const int64_t lastReceive = (int64_t)b.at<uint64_t>(0);
+		if ((now - lastReceive) >= ZT_PEER_ACTIVITY_TIMEOUT)
+			return false;
+		const Address a(b.field(9,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+		if ((!a)||(a == RR->identity.address()))
+			return false;
+		_PeerShard &s = _peerShard(a);
+
+		if ((t == StateSnapshot::RECORD_COLD_PEER)&&(_coldTimeout)) {
+			Mutex::Lock _l(s.lock);
+			const unsigned long limit = _maxPeersPerShard;
+			if ((s.peers.contains(a))||(s.cold.contains(a))||((limit)&&(s.cold.size() >= (limit * ZT_PEER_COLD_PER_HOT))))
+				return false;
+			_ColdPeer cp;
+			cp.lastReceive = lastReceive;
+			cp.record.copyFrom(b.field(8,b.size() - 8),b.size() - 8);
+			s.cold.set(a,cp);
+			return true;
+		}
+
+		{
+			Mutex::Lock _l(s.lock);
+			if (s.peers.contains(a))
+				return false;
+		}
+		Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> *const pb = new Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE>();
+		SharedPtr<Peer> p;
+		try {
+			pb->copyFrom(b.field(8,b.size() - 8),b.size() - 8);
+			p = Peer::deserializeFromCache(now,tPtr,*pb,RR,(_peerKeyCacheEnabled) ? _peerKeyCacheKey : (const uint8_t *)0);
+		} catch ( ... ) {}
+		delete pb;
+		if ((!p)||(p->address() != a))
+			return false;
+		p->restoreLastReceive(lastReceive);
+		return (addPeer(tPtr,p) == p);
+	} catch ( ... ) {} // truncated or invalid record
+	return false;
+}
+
+void Topology::memoryUsage(ZT_MemoryUsage *mu) const
+{
+	uint64_t peers = 0,peerBytes = 0,coldPeers = 0,coldPeerBytes = 0;
+	for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+		Mutex::Lock _l(_peerShards[s].lock);
+		Hashtable< Address,SharedPtr<Peer> > &pt = const_cast<Topology *>(this)->_peerShards[s].peers;
+		peers += pt.size();
+		coldPeers += _peerShards[s].cold.size();
+		coldPeerBytes += _peerShards[s].cold.memoryUsage();
+		peerBytes += pt.memoryUsage() + (pt.size() * sizeof(Peer));
+		Hashtable< Address,SharedPtr<Peer> >::Iterator i(pt);
+		Address *a = (Address *)0;
+		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		while (i.next(a,p))
+			peerBytes += (*p)->heapBytes();
+	}
+	mu->peers = peers;
+	mu->peerBytes = peerBytes;
+	mu->peersEvicted = _peersEvicted;
+	mu->coldPeers = coldPeers;
+	mu->coldPeerBytes = coldPeerBytes;
+	mu->peersPromoted = _peersPromoted;
+
+	Mutex::Lock _l(_paths_m);
+	mu->paths = _paths.size();
+	mu->pathBytes = _paths.memoryUsage() + (_paths.size() * sizeof(Path));
+}
+
+unsigned int Topology::_upstreamScore(const SharedPtr<Peer> &p,const int64_t now) const
+{
+	const uint64_t tsr = (uint64_t)(now - p->lastReceive());
+	if (tsr >= ZT_PEER_ACTIVITY_TIMEOUT)
+		return (~(unsigned int)0);
+	unsigned int l = p->latency(now);
+	if ((!l)||(l >= 0xffff)) {
+		const unsigned int *const hint = _upstreamLatencyHints.get(p->address());
+		l = (hint) ? *hint : 0xffff;
+	}
+	return (l * (((unsigned int)tsr / (ZT_PEER_PING_PERIOD + 1000)) + 1));
+}
+
+SharedPtr<Peer> Topology::_selectUpstream(const int64_t now)
+{
+	unsigned int bestq = ~((unsigned int)0);
+	unsigned int currentq = ~((unsigned int)0);
+	SharedPtr<Peer> best,current;
+
+	for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
+		const SharedPtr<Peer> p(getPeerNoCache(*a));
+		if (p) {
+			const unsigned int q = _upstreamScore(p,now);
+			if (q <= bestq) {
+				bestq = q;
+				best = p;
+			}
+			if (*a == _bestUpstream) {
+				currentq = q;
+				current = p;
+			}
+		}
+	}
+
+	// Stay with the current upstream unless another is better by a margin
+	if ((current)&&(currentq != (~(unsigned int)0))&&(best != current)) {
+		const unsigned int margin = std::max((unsigned int)ZT_UPSTREAM_SWITCH_MIN_MARGIN,currentq / ZT_UPSTREAM_SWITCH_MARGIN_DIVISOR);
+		if ((bestq + margin) >= currentq)
+			best = current;
+	}
+
+	_bestUpstream = (best) ? best->address() : Address();
+	return best;
+}
+
+SharedPtr<Peer> Topology::_selectRelay(const int64_t now)
+{
+	// assumes _relays_m is locked
+	unsigned int bestq = ~((unsigned int)0);
+	unsigned int currentq = ~((unsigned int)0);
+	SharedPtr<Peer> best,current;
+
+	for(std::vector<Address>::const_iterator a(_relayCandidates.begin());a!=_relayCandidates.end();++a) {
+		const SharedPtr<Peer> p(getPeerNoCache(*a));
+		if (p) {
+			const unsigned int q = p->relayOfferScore(now);
+			if (q < bestq) {
+				bestq = q;
+				best = p;
+			}
+			if (*a == _bestRelay) {
+				currentq = q;
+				current = p;
+			}
+		}
+	}
+
+	// Same margin as for upstreams, so traffic doesn't flap between relays as their load reports change
+	if ((current)&&(currentq != (~(unsigned int)0))&&(best != current)) {
+		const unsigned int margin = std::max((unsigned int)ZT_UPSTREAM_SWITCH_MIN_MARGIN,currentq / ZT_UPSTREAM_SWITCH_MARGIN_DIVISOR);
+		if ((bestq + margin) >= currentq)
+			best = current;
+	}
+
+	_bestRelay = (best) ? best->address() : Address();
+	return best;
+}
+
 void Topology::_memoizeUpstreams(void *tPtr)
 {
-	// assumes _upstreams_m and _peers_m are locked
+	// assumes _upstreams_m is locked
 	_upstreamAddresses.clear();
 	_amUpstream = false;
 
@@ -405,7 +905,9 @@ void Topology::_memoizeUpstreams(void *tPtr)
 			_amUpstream = true;
 		} else if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),i->identity.address()) == _upstreamAddresses.end()) {
 			_upstreamAddresses.push_back(i->identity.address());
-			SharedPtr<Peer> &hp = _peers[i->identity.address()];
+			_PeerShard &s = _peerShard(i->identity.address());
+			Mutex::Lock _l(s.lock);
+			SharedPtr<Peer> &hp = s.peers[i->identity.address()];
 			if (!hp)
 				hp = new Peer(RR,RR->identity,i->identity);
 		}
@@ -417,7 +919,9 @@ void Topology::_memoizeUpstreams(void *tPtr)
 				_amUpstream = true;
 			} else if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),i->identity.address()) == _upstreamAddresses.end()) {
 				_upstreamAddresses.push_back(i->identity.address());
-				SharedPtr<Peer> &hp = _peers[i->identity.address()];
+				_PeerShard &s = _peerShard(i->identity.address());
+				Mutex::Lock _l(s.lock);
+				SharedPtr<Peer> &hp = s.peers[i->identity.address()];
 				if (!hp)
 					hp = new Peer(RR,RR->identity,i->identity);
 			}
@@ -425,13 +929,52 @@ void Topology::_memoizeUpstreams(void *tPtr)
 	}
 
 	std::sort(_upstreamAddresses.begin(),_upstreamAddresses.end());
+
+	_serializeWorlds();
+}
+
+void Topology::_serializeWorlds()
+{
+	// assumes _upstreams_m is locked
+	Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> tmp;
+
+	tmp.append((uint64_t)_planet.id());
+	tmp.append((uint64_t)_planet.timestamp());
+	std::vector<uint64_t> wanted;
+	for(std::vector< std::pair<uint64_t,Address> >::const_iterator s(_moonSeeds.begin());s!=_moonSeeds.end();++s) {
+		if (std::find(wanted.begin(),wanted.end(),s->first) == wanted.end())
+			wanted.push_back(s->first);
+	}
+	tmp.append((uint16_t)(_moons.size() + wanted.size()));
+	for(std::vector<World>::const_iterator m(_moons.begin());m!=_moons.end();++m) {
+		tmp.append((uint8_t)m->type());
+		tmp.append((uint64_t)m->id());
+		tmp.append((uint64_t)m->timestamp());
+	}
+	for(std::vector<uint64_t>::const_iterator m(wanted.begin());m!=wanted.end();++m) {
+		tmp.append((uint8_t)World::TYPE_MOON);
+		tmp.append(*m);
+		tmp.append((uint64_t)0);
+	}
+	_helloWorlds.assign((const char *)tmp.data(),tmp.size());
+
+	tmp.clear();
+	_planet.serialize(tmp,false);
+	_planetSerialized.assign((const char *)tmp.data(),tmp.size());
+
+	_moonsSerialized.resize(_moons.size());
+	for(unsigned int m=0;m<(unsigned int)_moons.size();++m) {
+		tmp.clear();
+		_moons[m].serialize(tmp,false);
+		_moonsSerialized[m].assign((const char *)tmp.data(),tmp.size());
+	}
 }
 
 void Topology::_savePeer(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	try {
 		Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> buf;
-		peer->serializeForCache(buf);
+		peer->serializeForCache(buf,(_peerKeyCacheEnabled) ? _peerKeyCacheKey : (const uint8_t *)0);
 		uint64_t tmpid[2]; tmpid[0] = peer->address().toInt(); tmpid[1] = 0;
 		RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_PEER,tmpid,buf.data(),buf.size());
 	} catch ( ... ) {} // sanity check, discard invalid entries
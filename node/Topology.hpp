@@ -31,9 +31,12 @@
 #include <string.h>
 
 #include <vector>
+#include <map>
+#include <string>
 #include <stdexcept>
 #include <algorithm>
 #include <utility>
+#include <atomic>
 
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
@@ -44,8 +47,11 @@
 #include "Path.hpp"
 #include "Mutex.hpp"
 #include "InetAddress.hpp"
+#include "PrefixTrie.hpp"
 #include "Hashtable.hpp"
 #include "World.hpp"
+#include "Epoch.hpp"
+#include "StateSnapshot.hpp"
 
 namespace ZeroTier {
 
@@ -81,6 +87,32 @@ public:
 	 */
 	SharedPtr<Peer> getPeer(void *tPtr,const Address &zta);
 
+	/**
+	 * Get a peer from its address without taking a reference to it
+	 *
+	 * Peers dropped from memory are retired through Epoch rather than
+	 * released, so the result stays valid until the guard is released. Use
+	 * the SharedPtr version if the peer is kept or handed to anything that
+	 * might keep it.
+	 *
+	 * @param g Read side critical section that must outlive any use of the result
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param zta ZeroTier address of peer
+	 * @return Peer or NULL if not found
+	 */
+	inline Peer *getPeer(const Epoch::Guard &g,void *tPtr,const Address &zta)
+	{
+		{
+			_PeerShard &s = _peerShard(zta);
+			Mutex::Lock _l(s.lock);
+			const SharedPtr<Peer> *const ap = s.peers.get(zta);
+			if (ap)
+				return ap->ptr();
+		}
+		// Anything this returns is also held by its shard
+		return getPeer(tPtr,zta).ptr();
+	}
+
 	/**
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param zta ZeroTier address of peer
@@ -100,8 +132,9 @@ public:
 	 */
 	inline SharedPtr<Peer> getPeerNoCache(const Address &zta)
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		Mutex::Lock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return *ap;
 		return SharedPtr<Peer>();
@@ -126,10 +159,64 @@ public:
 	/**
 	 * Get the current best upstream peer
 	 *
+	 * The choice is sticky: it is only re-ranked here if it has gone quiet or
+	 * has no latency measurement yet, and otherwise by rankUpstreams().
+	 *
 	 * @return Upstream or NULL if none available
 	 */
 	SharedPtr<Peer> getUpstreamPeer();
 
+	/**
+	 * Probe upstreams whose latency isn't known yet and re-rank them
+	 *
+	 * A different upstream only replaces the current one if it is better by a
+	 * margin, so relaying doesn't flap between upstreams of similar latency.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void rankUpstreams(void *tPtr,int64_t now);
+
+	/**
+	 * Set the latency to assume for an upstream until it has been measured
+	 *
+	 * @param ztaddr Upstream address or zero to clear all hints
+	 * @param latency Latency in milliseconds or zero to clear this upstream's hint
+	 */
+	inline void setUpstreamLatencyHint(const Address &ztaddr,const unsigned int latency)
+	{
+		Mutex::Lock _l(_upstreams_m);
+		if (!ztaddr)
+			_upstreamLatencyHints.clear();
+		else if (latency)
+			_upstreamLatencyHints[ztaddr] = latency;
+		else _upstreamLatencyHints.erase(ztaddr);
+	}
+
+	/**
+	 * Remember a peer that sent us a VERB_RELAY_OFFER as a relay candidate
+	 *
+	 * @param ztaddr Address of peer (its offer is kept by Peer::relayOffered())
+	 */
+	void relayOffered(const Address &ztaddr);
+
+	/**
+	 * Get the current best peer-assisted relay
+	 *
+	 * Like getUpstreamPeer() the choice is sticky and is only re-ranked here
+	 * if its offer has lapsed or it has become too loaded.
+	 *
+	 * @return Peer that offered to relay for us or NULL if none available
+	 */
+	SharedPtr<Peer> getRelayPeer();
+
+	/**
+	 * Forget relay candidates whose offers have lapsed and re-rank the rest
+	 *
+	 * @param now Current time
+	 */
+	void rankRelays(int64_t now);
+
 	/**
 	 * @param id Identity to check
 	 * @return True if this is a root server or a network preferred relay from one of our networks
@@ -228,6 +315,51 @@ public:
 		return mw;
 	}
 
+	/**
+	 * Append what HELLO says about our worlds
+	 *
+	 * This is the planet's ID and timestamp followed by the moons we have and
+	 * want, kept pre-serialized since it only changes with our worlds.
+	 *
+	 * @param b Buffer to append to
+	 * @return Offset in b where the moon list starts (HELLO encrypts from there)
+	 */
+	template<unsigned int C>
+	inline unsigned int appendHelloWorlds(Buffer<C> &b) const
+	{
+		Mutex::Lock _l(_upstreams_m);
+		const unsigned int moonsAt = b.size() + 16;
+		b.append(_helloWorlds.data(),(unsigned int)_helloWorlds.size());
+		return moonsAt;
+	}
+
+	/**
+	 * Append our planet and moons that are newer than a peer's, for OK(HELLO)
+	 *
+	 * @param b Buffer to append to
+	 * @param planetWorldId Peer's planet ID or 0 if it didn't say
+	 * @param planetWorldTimestamp Peer's planet timestamp
+	 * @param moons IDs and timestamps of the peer's moons
+	 */
+	template<unsigned int C>
+	inline void appendWorldUpdates(Buffer<C> &b,const uint64_t planetWorldId,const uint64_t planetWorldTimestamp,const std::vector< std::pair<uint64_t,uint64_t> > &moons) const
+	{
+		Mutex::Lock _l(_upstreams_m);
+		if ((planetWorldId)&&(_planet.timestamp() > planetWorldTimestamp)&&(planetWorldId == _planet.id()))
+			b.append(_planetSerialized.data(),(unsigned int)_planetSerialized.size());
+		if (moons.empty())
+			return;
+		for(unsigned int m=0;m<(unsigned int)_moons.size();++m) {
+			for(std::vector< std::pair<uint64_t,uint64_t> >::const_iterator i(moons.begin());i!=moons.end();++i) {
+				if (i->first == _moons[m].id()) {
+					if (_moons[m].timestamp() > i->second)
+						b.append(_moonsSerialized[m].data(),(unsigned int)_moonsSerialized[m].size());
+					break;
+				}
+			}
+		}
+	}
+
 	/**
 	 * @return Current planet
 	 */
@@ -287,6 +419,56 @@ public:
 	 */
 	void doPeriodicTasks(void *tPtr,int64_t now);
 
+	/**
+	 * Save the best direct path of each of the most recently active peers
+	 *
+	 * Upstreams are left out since they are always contacted anyway.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void saveWarmPaths(void *tPtr,int64_t now);
+
+	/**
+	 * Load the peers saved by saveWarmPaths() and send each a HELLO at its saved path
+	 *
+	 * This is called once at startup after sockets are up, so peers we were
+	 * talking to directly before a restart are reached directly within about
+	 * a round trip instead of through an upstream until path discovery catches
+	 * up. Peers whose identities are no longer cached are skipped.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return Number of peers contacted
+	 */
+	unsigned int warmStart(void *tPtr,int64_t now);
+
+	/**
+	 * Add all hot and cold peers to a state snapshot
+	 *
+	 * Peers are written with all their paths and, if the peer cache seals
+	 * keys, their sealed agreed keys.
+	 *
+	 * @param ss Snapshot to add to
+	 */
+	void saveState(StateSnapshot &ss);
+
+	/**
+	 * Restore a peer from a state snapshot record
+	 *
+	 * Peers already known and peers not heard from within the activity
+	 * timeout are skipped. Hot peers come back hot with when they were last
+	 * heard from and are sent a HELLO at each saved path, since their paths
+	 * were bound to the old process's sockets. Cold peers come back cold.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @param t Record type (other types are ignored)
+	 * @param b Record payload
+	 * @return True if a peer was restored
+	 */
+	bool restoreState(void *tPtr,int64_t now,StateSnapshot::RecordType t,const Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> &b);
+
 	/**
 	 * @param now Current time
 	 * @return Number of peers with active direct paths
@@ -294,14 +476,13 @@ public:
 	inline unsigned long countActive(int64_t now) const
 	{
 		unsigned long cnt = 0;
-		Mutex::Lock _l(_peers_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			const SharedPtr<Path> pp((*p)->getBestPath(now,false));
-			if (pp)
-				++cnt;
+		std::vector< SharedPtr<Peer> > sp;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			const_cast<Topology *>(this)->_peerShards[s].snapshot(sp);
+			for(std::vector< SharedPtr<Peer> >::const_iterator p(sp.begin());p!=sp.end();++p) {
+				if ((*p)->getBestPath(now,false))
+					++cnt;
+			}
 		}
 		return cnt;
 	}
@@ -309,18 +490,22 @@ public:
 	/**
 	 * Apply a function or function object to all peers
 	 *
+	 * Peers are copied out one shard at a time and the function is called with
+	 * no lock held, so it may itself look up or add peers and lookups by other
+	 * threads only ever wait for a shard copy. Peers added or removed during
+	 * iteration may or may not be visited.
+	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
 	 */
 	template<typename F>
 	inline void eachPeer(F f)
 	{
-		Mutex::Lock _l(_peers_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			f(*this,*((const SharedPtr<Peer> *)p));
+		std::vector< SharedPtr<Peer> > sp;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			_peerShards[s].snapshot(sp);
+			for(std::vector< SharedPtr<Peer> >::const_iterator p(sp.begin());p!=sp.end();++p)
+				f(*this,*p);
 		}
 	}
 
@@ -329,15 +514,96 @@ public:
 	 */
 	inline std::vector< std::pair< Address,SharedPtr<Peer> > > allPeers() const
 	{
-		Mutex::Lock _l(_peers_m);
-		return _peers.entries();
+		std::vector< std::pair< Address,SharedPtr<Peer> > > ap;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			Mutex::Lock _l(_peerShards[s].lock);
+			std::vector< std::pair< Address,SharedPtr<Peer> > > e(_peerShards[s].peers.entries());
+			ap.insert(ap.end(),e.begin(),e.end());
+		}
+		return ap;
+	}
+
+	/**
+	 * Limit the number of peers held in memory
+	 *
+	 * Peers are split among ZT_TOPOLOGY_PEER_SHARDS shards, and the limit is
+	 * applied to each shard, so it is rounded up to a multiple of that. Past
+	 * it the least recently heard from peer in a shard, other than roots and
+	 * moons, is saved to the peer cache and dropped, to be loaded again if
+	 * it is ever needed.
+	 *
+	 * @param maxPeers Maximum number of peers or 0 for no limit
+	 */
+	inline void setMaxPeers(const unsigned long maxPeers) { _maxPeersPerShard = (maxPeers + (ZT_TOPOLOGY_PEER_SHARDS - 1)) / ZT_TOPOLOGY_PEER_SHARDS; }
+
+	/**
+	 * @return Peers dropped from memory to stay under the limit set by setMaxPeers()
+	 */
+	inline uint64_t peersEvicted() const { return _peersEvicted; }
+
+	/**
+	 * Demote peers that have been idle this long to compact cold records
+	 *
+	 * A cold record is the peer's cache entry with only its most recently
+	 * used path: identity, versions, and its agreed key sealed with our
+	 * cache key, a few hundred bytes instead of a full Peer with its paths
+	 * and state. Demoted peers are also written to the peer cache. The next
+	 * getPeer() for the address rebuilds the peer from its record without
+	 * key agreement or a storage read. Records are kept until the peer would
+	 * have been forgotten anyway, ZT_PEER_ACTIVITY_TIMEOUT after it was last
+	 * heard from. Roots and moons are never demoted.
+	 *
+	 * @param idle Idle time in ms after which peers are demoted (at least ZT_PEER_COLD_TIMEOUT_MIN) or 0 to never demote
+	 */
+	inline void setColdPeerTimeout(const int64_t idle) { _coldTimeout = (idle <= 0) ? 0 : std::max(idle,(int64_t)ZT_PEER_COLD_TIMEOUT_MIN); }
+
+	/**
+	 * @return Peers rebuilt from cold records since startup
+	 */
+	inline uint64_t peersPromoted() const { return _peersPromoted; }
+
+	/**
+	 * @return Number of peers in memory
+	 */
+	inline unsigned long peerCount() const
+	{
+		unsigned long cnt = 0;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_PEER_SHARDS;++s) {
+			Mutex::Lock _l(_peerShards[s].lock);
+			cnt += _peerShards[s].peers.size();
+		}
+		return cnt;
 	}
 
+	/**
+	 * Add up memory used by peers, paths, and the tables holding them
+	 *
+	 * @param mu Structure whose peer and path counts and byte totals are filled in
+	 */
+	void memoryUsage(ZT_MemoryUsage *mu) const;
+
 	/**
 	 * @return True if I am a root server in a planet or moon
 	 */
 	inline bool amUpstream() const { return _amUpstream; }
 
+	/**
+	 * Get statistics on peers loaded from the local peer cache
+	 *
+	 * A hit is a peer rebuilt from a cached agreed key, a miss one that needed
+	 * key agreement (e.g. written by an older version or with caching disabled).
+	 *
+	 * @param hits Set to number of cache loads that skipped key agreement
+	 * @param misses Set to number of cache loads that performed key agreement
+	 * @return Hit rate from 0.0 to 1.0 (0.0 if nothing has been loaded)
+	 */
+	inline double peerKeyCacheStats(uint64_t &hits,uint64_t &misses)
+	{
+		hits = _peerKeyCacheHits.load();
+		misses = _peerKeyCacheMisses.load();
+		return ((hits + misses) > 0) ? ((double)hits / (double)(hits + misses)) : 0.0;
+	}
+
 	/**
 	 * Get info about a path
 	 *
@@ -349,12 +615,10 @@ public:
 	 */
 	inline void getOutboundPathInfo(const InetAddress &physicalAddress,unsigned int &mtu,uint64_t &trustedPathId)
 	{
-		for(unsigned int i=0,j=_numConfiguredPhysicalPaths;i<j;++i) {
-			if (_physicalPathConfig[i].first.containsAddress(physicalAddress)) {
-				trustedPathId = _physicalPathConfig[i].second.trustedPathId;
-				mtu = _physicalPathConfig[i].second.mtu;
-				return;
-			}
+		const ZT_PhysicalPathConfiguration *const pc = _physicalPathConfig.load(std::memory_order_acquire)->trie.get(physicalAddress);
+		if (pc) {
+			trustedPathId = pc->trustedPathId;
+			mtu = pc->mtu;
 		}
 	}
 
@@ -366,11 +630,8 @@ public:
 	 */
 	inline unsigned int getOutboundPathMtu(const InetAddress &physicalAddress)
 	{
-		for(unsigned int i=0,j=_numConfiguredPhysicalPaths;i<j;++i) {
-			if (_physicalPathConfig[i].first.containsAddress(physicalAddress))
-				return _physicalPathConfig[i].second.mtu;
-		}
-		return ZT_DEFAULT_PHYSMTU;
+		const ZT_PhysicalPathConfiguration *const pc = _physicalPathConfig.load(std::memory_order_acquire)->trie.get(physicalAddress);
+		return ((pc) ? pc->mtu : ZT_DEFAULT_PHYSMTU);
 	}
 
 	/**
@@ -381,11 +642,8 @@ public:
 	 */
 	inline uint64_t getOutboundPathTrust(const InetAddress &physicalAddress)
 	{
-		for(unsigned int i=0,j=_numConfiguredPhysicalPaths;i<j;++i) {
-			if (_physicalPathConfig[i].first.containsAddress(physicalAddress))
-				return _physicalPathConfig[i].second.trustedPathId;
-		}
-		return 0;
+		const ZT_PhysicalPathConfiguration *const pc = _physicalPathConfig.load(std::memory_order_acquire)->trie.get(physicalAddress);
+		return ((pc) ? pc->trustedPathId : 0);
 	}
 
 	/**
@@ -396,11 +654,8 @@ public:
 	 */
 	inline bool shouldInboundPathBeTrusted(const InetAddress &physicalAddress,const uint64_t trustedPathId)
 	{
-		for(unsigned int i=0,j=_numConfiguredPhysicalPaths;i<j;++i) {
-			if ((_physicalPathConfig[i].second.trustedPathId == trustedPathId)&&(_physicalPathConfig[i].first.containsAddress(physicalAddress)))
-				return true;
-		}
-		return false;
+		// Any configured network containing the address may carry this ID, not just the most specific
+		return _physicalPathConfig.load(std::memory_order_acquire)->trie.eachMatch(physicalAddress,_TrustedPathIdIs(trustedPathId));
 	}
 
 	/**
@@ -408,13 +663,12 @@ public:
 	 */
 	inline void setPhysicalPathConfiguration(const struct sockaddr_storage *pathNetwork,const ZT_PhysicalPathConfiguration *pathConfig)
 	{
-		if (!pathNetwork) {
-			_numConfiguredPhysicalPaths = 0;
-		} else {
-			std::map<InetAddress,ZT_PhysicalPathConfiguration> cpaths;
-			for(unsigned int i=0,j=_numConfiguredPhysicalPaths;i<j;++i)
-				cpaths[_physicalPathConfig[i].first] = _physicalPathConfig[i].second;
+		Mutex::Lock _l(_physicalPathConfig_m);
+		const _PathConfig *const old = _physicalPathConfig.load(std::memory_order_acquire);
+		_PathConfig *const pcfg = new _PathConfig();
 
+		if (pathNetwork) {
+			pcfg->paths = old->paths;
 			if (pathConfig) {
 				ZT_PhysicalPathConfiguration pc(*pathConfig);
 
@@ -425,43 +679,120 @@ public:
 				else if (pc.mtu > ZT_MAX_PHYSMTU)
 					pc.mtu = ZT_MAX_PHYSMTU;
 
-				cpaths[*(reinterpret_cast<const InetAddress *>(pathNetwork))] = pc;
+				const InetAddress &net = *(reinterpret_cast<const InetAddress *>(pathNetwork));
+				if ((pcfg->paths.size() < ZT_MAX_CONFIGURABLE_PATHS)||(pcfg->paths.count(net)))
+					pcfg->paths[net] = pc;
 			} else {
-				cpaths.erase(*(reinterpret_cast<const InetAddress *>(pathNetwork)));
-			}
-
-			unsigned int cnt = 0;
-			for(std::map<InetAddress,ZT_PhysicalPathConfiguration>::const_iterator i(cpaths.begin());((i!=cpaths.end())&&(cnt<ZT_MAX_CONFIGURABLE_PATHS));++i) {
-				_physicalPathConfig[cnt].first = i->first;
-				_physicalPathConfig[cnt].second = i->second;
-				++cnt;
+				pcfg->paths.erase(*(reinterpret_cast<const InetAddress *>(pathNetwork)));
 			}
-			_numConfiguredPhysicalPaths = cnt;
+			for(std::map<InetAddress,ZT_PhysicalPathConfiguration>::const_iterator i(pcfg->paths.begin());i!=pcfg->paths.end();++i)
+				pcfg->trie.add(i->first,i->second);
 		}
+
+		// Lookups hold no lock, so replaced tries are kept until we're destroyed. This
+		// only happens when local.conf is loaded and there can be at most a few of them.
+		_physicalPathConfig.store(pcfg,std::memory_order_release);
+		_oldPhysicalPathConfigs.push_back(old);
 	}
 
 private:
 	Identity _getIdentity(void *tPtr,const Address &zta);
 	void _memoizeUpstreams(void *tPtr);
+	void _serializeWorlds();
 	void _savePeer(void *tPtr,const SharedPtr<Peer> &peer);
+	unsigned int _upstreamScore(const SharedPtr<Peer> &p,const int64_t now) const;
+	SharedPtr<Peer> _selectUpstream(const int64_t now);
+	SharedPtr<Peer> _selectRelay(const int64_t now);
 
 	const RuntimeEnvironment *const RR;
 
-	std::pair<InetAddress,ZT_PhysicalPathConfiguration> _physicalPathConfig[ZT_MAX_CONFIGURABLE_PATHS];
-	volatile unsigned int _numConfiguredPhysicalPaths;
-
-	Hashtable< Address,SharedPtr<Peer> > _peers;
-	Mutex _peers_m;
+	// Physical path configuration and a trie of it for longest prefix lookups
+	struct _PathConfig
+	{
+		std::map<InetAddress,ZT_PhysicalPathConfiguration> paths;
+		PrefixTrie<ZT_PhysicalPathConfiguration> trie;
+	};
+	struct _TrustedPathIdIs
+	{
+		_TrustedPathIdIs(const uint64_t i) : id(i) {}
+		inline bool operator()(const ZT_PhysicalPathConfiguration &pc) const { return (pc.trustedPathId == id); }
+		const uint64_t id;
+	};
+	std::atomic<const _PathConfig *> _physicalPathConfig;
+	std::vector<const _PathConfig *> _oldPhysicalPathConfigs;
+	Mutex _physicalPathConfig_m;
+
+	// Peers are sharded by address so threads looking up different peers don't
+	// contend and iteration only ever holds one shard's lock, and only to copy it.
+	// Lock order is _upstreams_m or _relays_m before any shard lock.
+	struct _ColdPeer
+	{
+		int64_t lastReceive;
+		Buffer<ZT_PEER_COLD_RECORD_SIZE> record; // as written by Peer::serializeForCache()
+	};
+	struct _PeerShard
+	{
+		_PeerShard() : peers(32),cold(8),lock("Topology::_peerShards") {}
+		inline void snapshot(std::vector< SharedPtr<Peer> > &sp)
+		{
+			sp.clear();
+			Mutex::Lock _l(lock);
+			sp.reserve(peers.size());
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p))
+				sp.push_back(*p);
+		}
+		Hashtable< Address,SharedPtr<Peer> > peers;
+		Hashtable< Address,_ColdPeer > cold; // demoted peers, never also in peers
+		Mutex lock;
+	};
+	// The Hashtable slots by a mix of all address bits, so the high ones alone pick a shard
+	inline _PeerShard &_peerShard(const Address &a) { return _peerShards[(unsigned long)(a.toInt() >> 32) % ZT_TOPOLOGY_PEER_SHARDS]; }
+	_PeerShard _peerShards[ZT_TOPOLOGY_PEER_SHARDS];
+
+	uint8_t _peerKeyCacheKey[32];
+	bool _peerKeyCacheEnabled;
+	std::atomic<uint64_t> _peerKeyCacheHits;
+	std::atomic<uint64_t> _peerKeyCacheMisses;
+
+	// Evicts least recently heard from peers from a shard over the limit
+	void _evictPeers(void *tPtr,_PeerShard &s,const Address &keep);
+	std::atomic<unsigned long> _maxPeersPerShard; // 0 for no limit
+	std::atomic<uint64_t> _peersEvicted;
+
+	// Keeps a cold record of a peer being dropped from s.peers if tiering is on (s.lock must be held)
+	void _demote(_PeerShard &s,const Address &a,const SharedPtr<Peer> &p);
+	std::atomic<int64_t> _coldTimeout; // 0 if peers are never demoted
+	std::atomic<uint64_t> _peersPromoted;
 
 	Hashtable< Path::HashKey,SharedPtr<Path> > _paths;
 	Mutex _paths_m;
 
+	// Peers and paths dropped from memory with the epoch they were retired
+	// in, released once no borrowed pointer to them can remain
+	void _reclaimRetired();
+	std::vector< std::pair< uint64_t,SharedPtr<Peer> > > _retiredPeers;
+	std::vector< std::pair< uint64_t,SharedPtr<Path> > > _retiredPaths;
+	Mutex _retired_m;
+
 	World _planet;
 	std::vector<World> _moons;
 	std::vector< std::pair<uint64_t,Address> > _moonSeeds;
+	std::string _helloWorlds; // see appendHelloWorlds()
+	std::string _planetSerialized;
+	std::vector<std::string> _moonsSerialized; // same order as _moons
 	std::vector<Address> _upstreamAddresses;
+	Address _bestUpstream; // sticky choice of getUpstreamPeer()
+	Hashtable< Address,unsigned int > _upstreamLatencyHints;
 	bool _amUpstream;
 	Mutex _upstreams_m; // locks worlds, upstream info, moon info, etc.
+
+	// Peers that offered to relay for us, see relayOffered()
+	std::vector<Address> _relayCandidates;
+	Address _bestRelay; // sticky choice of getRelayPeer()
+	Mutex _relays_m;
 };
 
 } // namespace ZeroTier
@@ -40,6 +40,8 @@
 #include "Tag.hpp"
 #include "Capability.hpp"
 #include "Revocation.hpp"
+#include "Metrics.hpp"
+#include "TraceRing.hpp"
 
 namespace ZeroTier {
 
@@ -58,10 +60,32 @@ static void ZT_LOCAL_TRACE(void *const tPtr,const RuntimeEnvironment *const RR,c
 #define ZT_LOCAL_TRACE(...)
 #endif
 
+// Binary capture of a credential rejection, which has the same shape for every credential type
+template<typename C>
+static inline void _captureCredentialRejected(const int64_t now,const C &c,const Address &to,const char *reason)
+{
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED,now)) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__CREDENTIAL_REJECTED,now);
+		r.networkId = c.networkId();
+		r.address = to.toInt();
+		r.value = ((uint64_t)c.credentialType() << 32) | (uint64_t)c.id();
+		r.reason = reason;
+		TraceRing::write(r);
+	}
+}
+
 void Trace::resettingPathsInScope(void *const tPtr,const Address &reporter,const InetAddress &reporterPhysicalAddress,const InetAddress &myPhysicalAddress,const InetAddress::IpScope scope)
 {
 	char tmp[128];
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__RESETTING_PATHS_IN_SCOPE,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__RESETTING_PATHS_IN_SCOPE,RR->node->now());
+		r.address = reporter.toInt();
+		r.physical(reporterPhysicalAddress);
+		r.value = (uint64_t)scope;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"RESET and revalidate paths in scope %d; new phy address %s reported by trusted peer %.10llx",(int)scope,myPhysicalAddress.toIpString(tmp),reporter.toInt());
 
 	Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
@@ -81,6 +105,16 @@ void Trace::peerConfirmingUnknownPath(void *const tPtr,const uint64_t networkId,
 	char tmp[128];
 	if (!path) return; // sanity check
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PEER_CONFIRMING_UNKNOWN_PATH,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__PEER_CONFIRMING_UNKNOWN_PATH,RR->node->now());
+		r.networkId = networkId;
+		r.packetId = packetId;
+		r.address = peer.address().toInt();
+		r.physical(path->address());
+		r.verb = (uint8_t)verb;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"trying unknown path %s to %.10llx (packet %.16llx verb %d local socket %lld network %.16llx)",path->address().toString(tmp),peer.address().toInt(),packetId,(double)verb,path->localSocket(),networkId);
 
 	std::pair<Address,Trace::Level> byn;
@@ -111,6 +145,15 @@ void Trace::peerLearnedNewPath(void *const tPtr,const uint64_t networkId,Peer &p
 	char tmp[128];
 	if (!newPath) return; // sanity check
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PEER_LEARNED_NEW_PATH,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__PEER_LEARNED_NEW_PATH,RR->node->now());
+		r.networkId = networkId;
+		r.packetId = packetId;
+		r.address = peer.address().toInt();
+		r.physical(newPath->address());
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"learned new path %s to %.10llx (packet %.16llx local socket %lld network %.16llx)",newPath->address().toString(tmp),peer.address().toInt(),packetId,newPath->localSocket(),networkId);
 
 	std::pair<Address,Trace::Level> byn;
@@ -138,6 +181,14 @@ void Trace::peerRedirected(void *const tPtr,const uint64_t networkId,Peer &peer,
 	char tmp[128];
 	if (!newPath) return; // sanity check
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PEER_REDIRECTED,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__PEER_REDIRECTED,RR->node->now());
+		r.networkId = networkId;
+		r.address = peer.address().toInt();
+		r.physical(newPath->address());
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"explicit redirect from %.10llx to path %s",peer.address().toInt(),newPath->address().toString(tmp));
 
 	std::pair<Address,Trace::Level> byn;
@@ -161,11 +212,23 @@ void Trace::peerRedirected(void *const tPtr,const uint64_t networkId,Peer &peer,
 
 void Trace::outgoingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network> &network,const MAC &sourceMac,const MAC &destMac,const unsigned int etherType,const unsigned int vlanId,const unsigned int frameLen,const char *reason)
 {
+	Metrics::drop(ZT_METRICS_DROP_FRAME_OUT);
 #ifdef ZT_TRACE
 	char tmp[128],tmp2[128];
 #endif
 	if (!network) return; // sanity check
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__OUTGOING_NETWORK_FRAME_DROPPED,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__OUTGOING_NETWORK_FRAME_DROPPED,RR->node->now());
+		r.networkId = network->id();
+		r.sourceMac = sourceMac.toInt();
+		r.destMac = destMac.toInt();
+		r.length = frameLen;
+		r.value = etherType;
+		r.reason = reason;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"%.16llx DROP frame %s -> %s etherType %.4x size %u (%s)",network->id(),sourceMac.toString(tmp),destMac.toString(tmp2),etherType,frameLen,(reason) ? reason : "unknown reason");
 
 	std::pair<Address,Trace::Level> byn;
@@ -192,9 +255,23 @@ void Trace::outgoingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network
 
 void Trace::incomingNetworkAccessDenied(void *const tPtr,const SharedPtr<Network> &network,const SharedPtr<Path> &path,const uint64_t packetId,const unsigned int packetLength,const Address &source,const Packet::Verb verb,bool credentialsRequested)
 {
+	Metrics::drop(ZT_METRICS_DROP_NETWORK_ACCESS_DENIED);
 	char tmp[128];
 	if (!network) return; // sanity check
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_ACCESS_DENIED,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_ACCESS_DENIED,RR->node->now());
+		r.networkId = network->id();
+		r.packetId = packetId;
+		r.address = source.toInt();
+		if (path)
+			r.physical(path->address());
+		r.verb = (uint8_t)verb;
+		r.length = packetLength;
+		r.value = (credentialsRequested) ? 1 : 0;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"%.16llx DENIED packet from %.10llx(%s) verb %d size %u%s",network->id(),source.toInt(),(path) ? (path->address().toString(tmp)) : "???",(int)verb,packetLength,credentialsRequested ? " (credentials requested)" : " (credentials not requested)");
 
 	std::pair<Address,Trace::Level> byn;
@@ -221,9 +298,25 @@ void Trace::incomingNetworkAccessDenied(void *const tPtr,const SharedPtr<Network
 
 void Trace::incomingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network> &network,const SharedPtr<Path> &path,const uint64_t packetId,const unsigned int packetLength,const Address &source,const Packet::Verb verb,const MAC &sourceMac,const MAC &destMac,const char *reason)
 {
+	Metrics::drop(ZT_METRICS_DROP_FRAME_IN);
 	char tmp[128];
 	if (!network) return; // sanity check
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_FRAME_DROPPED,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_FRAME_DROPPED,RR->node->now());
+		r.networkId = network->id();
+		r.packetId = packetId;
+		r.address = source.toInt();
+		if (path)
+			r.physical(path->address());
+		r.verb = (uint8_t)verb;
+		r.length = packetLength;
+		r.sourceMac = sourceMac.toInt();
+		r.destMac = destMac.toInt();
+		r.reason = reason;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"%.16llx DROPPED frame from %.10llx(%s) verb %d size %u",network->id(),source.toInt(),(path) ? (path->address().toString(tmp)) : "???",(int)verb,packetLength);
 
 	std::pair<Address,Trace::Level> byn;
@@ -254,8 +347,20 @@ void Trace::incomingNetworkFrameDropped(void *const tPtr,const SharedPtr<Network
 
 void Trace::incomingPacketMessageAuthenticationFailure(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const unsigned int hops,const char *reason)
 {
+	Metrics::drop(ZT_METRICS_DROP_MAC_FAILED);
 	char tmp[128];
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PACKET_MAC_FAILURE,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__PACKET_MAC_FAILURE,RR->node->now());
+		r.packetId = packetId;
+		r.address = source.toInt();
+		if (path)
+			r.physical(path->address());
+		r.hops = (uint8_t)hops;
+		r.reason = reason;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"MAC failed for packet %.16llx from %.10llx(%s)",packetId,source.toInt(),(path) ? path->address().toString(tmp) : "???");
 
 	if ((_globalTarget)&&((int)_globalLevel >= Trace::LEVEL_DEBUG)) {
@@ -277,8 +382,21 @@ void Trace::incomingPacketMessageAuthenticationFailure(void *const tPtr,const Sh
 
 void Trace::incomingPacketInvalid(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const unsigned int hops,const Packet::Verb verb,const char *reason)
 {
+	Metrics::drop(ZT_METRICS_DROP_INVALID);
 	char tmp[128];
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PACKET_INVALID,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__PACKET_INVALID,RR->node->now());
+		r.packetId = packetId;
+		r.address = source.toInt();
+		if (path)
+			r.physical(path->address());
+		r.verb = (uint8_t)verb;
+		r.hops = (uint8_t)hops;
+		r.reason = reason;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"INVALID packet %.16llx from %.10llx(%s) (%s)",packetId,source.toInt(),(path) ? path->address().toString(tmp) : "???",(reason) ? reason : "unknown reason");
 
 	if ((_globalTarget)&&((int)_globalLevel >= Trace::LEVEL_DEBUG)) {
@@ -301,8 +419,20 @@ void Trace::incomingPacketInvalid(void *const tPtr,const SharedPtr<Path> &path,c
 
 void Trace::incomingPacketDroppedHELLO(void *const tPtr,const SharedPtr<Path> &path,const uint64_t packetId,const Address &source,const char *reason)
 {
+	Metrics::drop(ZT_METRICS_DROP_HELLO);
 	char tmp[128];
 
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__DROPPED_HELLO,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__DROPPED_HELLO,RR->node->now());
+		r.packetId = packetId;
+		r.address = source.toInt();
+		if (path)
+			r.physical(path->address());
+		r.verb = (uint8_t)Packet::VERB_HELLO;
+		r.reason = reason;
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"DROPPED HELLO from %.10llx(%s) (%s)",source.toInt(),(path) ? path->address().toString(tmp) : "???",(reason) ? reason : "???");
 
 	if ((_globalTarget)&&((int)_globalLevel >= Trace::LEVEL_DEBUG)) {
@@ -323,6 +453,13 @@ void Trace::incomingPacketDroppedHELLO(void *const tPtr,const SharedPtr<Path> &p
 
 void Trace::networkConfigRequestSent(void *const tPtr,const Network &network,const Address &controller)
 {
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__NETWORK_CONFIG_REQUEST_SENT,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__NETWORK_CONFIG_REQUEST_SENT,RR->node->now());
+		r.networkId = network.id();
+		r.address = controller.toInt();
+		TraceRing::write(r);
+	}
+
 	ZT_LOCAL_TRACE(tPtr,RR,"requesting configuration for network %.16llx",network.id());
 	if ((_globalTarget)&&((int)_globalLevel >= Trace::LEVEL_DEBUG)) {
 		Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
@@ -351,6 +488,18 @@ void Trace::networkFilter(
 	const bool inbound,
 	const int accept)
 {
+	if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__NETWORK_FILTER_TRACE,RR->node->now())) {
+		TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__NETWORK_FILTER_TRACE,RR->node->now());
+		r.networkId = network.id();
+		r.address = ((inbound) ? ztSource : ztDest).toInt();
+		r.sourceMac = macSource.toInt();
+		r.destMac = macDest.toInt();
+		r.length = frameLen;
+		r.value = (uint64_t)((int64_t)accept);
+		r.reason = (inbound) ? "inbound" : "outbound";
+		TraceRing::write(r);
+	}
+
 	std::pair<Address,Trace::Level> byn;
 	{ Mutex::Lock l(_byNet_m); _byNet.get(network.id(),byn); }
 
@@ -385,6 +534,8 @@ void Trace::networkFilter(
 
 void Trace::credentialRejected(void *const tPtr,const CertificateOfMembership &c,const char *reason)
 {
+	_captureCredentialRejected(RR->node->now(),c,c.issuedTo(),reason);
+
 	std::pair<Address,Trace::Level> byn;
 	if (c.networkId()) { Mutex::Lock l(_byNet_m); _byNet.get(c.networkId(),byn); }
 
@@ -408,6 +559,8 @@ void Trace::credentialRejected(void *const tPtr,const CertificateOfMembership &c
 
 void Trace::credentialRejected(void *const tPtr,const CertificateOfOwnership &c,const char *reason)
 {
+	_captureCredentialRejected(RR->node->now(),c,c.issuedTo(),reason);
+
 	std::pair<Address,Trace::Level> byn;
 	if (c.networkId()) { Mutex::Lock l(_byNet_m); _byNet.get(c.networkId(),byn); }
 
@@ -431,6 +584,8 @@ void Trace::credentialRejected(void *const tPtr,const CertificateOfOwnership &c,
 
 void Trace::credentialRejected(void *const tPtr,const Capability &c,const char *reason)
 {
+	_captureCredentialRejected(RR->node->now(),c,c.issuedTo(),reason);
+
 	std::pair<Address,Trace::Level> byn;
 	if (c.networkId()) { Mutex::Lock l(_byNet_m); _byNet.get(c.networkId(),byn); }
 
@@ -454,6 +609,8 @@ void Trace::credentialRejected(void *const tPtr,const Capability &c,const char *
 
 void Trace::credentialRejected(void *const tPtr,const Tag &c,const char *reason)
 {
+	_captureCredentialRejected(RR->node->now(),c,c.issuedTo(),reason);
+
 	std::pair<Address,Trace::Level> byn;
 	if (c.networkId()) { Mutex::Lock l(_byNet_m); _byNet.get(c.networkId(),byn); }
 
@@ -478,6 +635,8 @@ void Trace::credentialRejected(void *const tPtr,const Tag &c,const char *reason)
 
 void Trace::credentialRejected(void *const tPtr,const Revocation &c,const char *reason)
 {
+	_captureCredentialRejected(RR->node->now(),c,c.target(),reason);
+
 	std::pair<Address,Trace::Level> byn;
 	if (c.networkId()) { Mutex::Lock l(_byNet_m); _byNet.get(c.networkId(),byn); }
 
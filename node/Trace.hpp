@@ -114,7 +114,8 @@ public:
 
 	Trace(const RuntimeEnvironment *renv) :
 		RR(renv),
-		_byNet(8)
+		_byNet(8),
+		_byNet_m("Trace::_byNet_m")
 	{
 	}
 
@@ -0,0 +1,332 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_TRACERING_HPP
+#define ZT_TRACERING_HPP
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "InetAddress.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Records buffered per thread between reads (must be a power of two)
+#define ZT_TRACE_RING_SIZE 1024
+
+// Slots for per-event settings, indexed by _slot(event)
+#define ZT_TRACE_RING_EVENT_SLOTS 16
+
+namespace ZeroTier {
+
+/**
+ * Low overhead capture of trace events into per-thread ring buffers
+ *
+ * Trace events are written as fixed-size binary records into a ring that
+ * belongs to the calling thread, so recording takes no lock and touches no
+ * shared cache line. read() drains all rings under a lock only readers
+ * take. Each event type has its own sample rate and per-thread limit on
+ * records per second so capture can be left on briefly on a busy node.
+ * A full ring drops new records and counts them rather than blocking.
+ *
+ * Capture is process-wide and off until configure() enables an event.
+ */
+class TraceRing
+{
+public:
+	/**
+	 * A captured event (see ZT_TraceRecord for field meanings)
+	 */
+	struct Record
+	{
+		Record() {}
+		Record(const unsigned int e,const int64_t ts)
+		{
+			memset(this,0,sizeof(Record));
+			timestamp = ts;
+			event = (uint16_t)e;
+		}
+
+		inline void physical(const InetAddress &a)
+		{
+			if (a.ss_family == AF_INET) {
+				physicalFamily = 4;
+				memcpy(physicalIp,a.rawIpData(),4);
+			} else if (a.ss_family == AF_INET6) {
+				physicalFamily = 6;
+				memcpy(physicalIp,a.rawIpData(),16);
+			} else return;
+			physicalPort = (uint16_t)a.port();
+		}
+
+		int64_t timestamp;
+		uint64_t value;
+		uint64_t networkId;
+		uint64_t packetId;
+		uint64_t address;
+		uint64_t sourceMac;
+		uint64_t destMac;
+		const char *reason; // always a string literal
+		uint32_t length;
+		uint16_t event;
+		uint16_t physicalPort;
+		uint8_t verb;
+		uint8_t hops;
+		uint8_t physicalFamily; // 0, 4 or 6
+		uint8_t physicalIp[16];
+	};
+
+	/**
+	 * Decide whether to record an event, applying its sample rate and rate limit
+	 *
+	 * @param event Event type (ZT_REMOTE_TRACE_EVENT__*)
+	 * @param now Current time in milliseconds
+	 * @return True if caller should build and write() a record
+	 */
+	static inline bool admit(const unsigned int event,const int64_t now)
+	{
+		_Settings &g = _settings();
+		if (!g.enabled.load(std::memory_order_relaxed))
+			return false;
+		const unsigned int s = _slot(event);
+		const unsigned int rate = g.sampleRate[s].load(std::memory_order_relaxed);
+		if (!rate)
+			return false;
+		_Ring &r = _local();
+		if ((++r.sampled[s] % rate) != 0)
+			return false;
+		const unsigned int maxps = g.maxPerSecond[s].load(std::memory_order_relaxed);
+		if (maxps) {
+			const int64_t sec = now / 1000;
+			if (r.second[s] != sec) {
+				r.second[s] = sec;
+				r.count[s] = 0;
+			}
+			if (++r.count[s] > maxps)
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Write a record to this thread's ring
+	 *
+	 * @param rec Record to copy
+	 */
+	static inline void write(const Record &rec)
+	{
+		_Ring &r = _local();
+		if (!r.buf)
+			r.buf = new Record[ZT_TRACE_RING_SIZE];
+		const uint64_t h = r.head.load(std::memory_order_relaxed);
+		if ((h - r.tail.load(std::memory_order_acquire)) >= ZT_TRACE_RING_SIZE) {
+			r.dropped.store(r.dropped.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+			return;
+		}
+		r.buf[h & (ZT_TRACE_RING_SIZE - 1)] = rec;
+		r.head.store(h + 1,std::memory_order_release);
+	}
+
+	/**
+	 * Set capture parameters for one or all event types
+	 *
+	 * @param event Event type or 0 for all
+	 * @param sampleRate Record one in this many events, or 0 to stop capturing
+	 * @param maxPerSecond Maximum records per second per thread, or 0 for no limit
+	 */
+	static inline void configure(const unsigned int event,const unsigned int sampleRate,const unsigned int maxPerSecond)
+	{
+		_Settings &g = _settings();
+		Mutex::Lock _l(_registry().lock);
+		for(unsigned int s=0;s<ZT_TRACE_RING_EVENT_SLOTS;++s) {
+			if ((!event)||(s == _slot(event))) {
+				g.sampleRate[s].store(sampleRate,std::memory_order_relaxed);
+				g.maxPerSecond[s].store(maxPerSecond,std::memory_order_relaxed);
+			}
+		}
+		bool any = false;
+		for(unsigned int s=0;s<ZT_TRACE_RING_EVENT_SLOTS;++s)
+			any |= (g.sampleRate[s].load(std::memory_order_relaxed) != 0);
+		g.enabled.store(any,std::memory_order_relaxed);
+	}
+
+	/**
+	 * @return True if any event type is being captured
+	 */
+	static inline bool enabled() { return _settings().enabled.load(std::memory_order_relaxed); }
+
+	/**
+	 * Drain captured records from all threads, oldest first
+	 *
+	 * @param out Buffer to fill
+	 * @param max Size of buffer in records
+	 * @param dropped If non-NULL set to total records dropped because a ring was full
+	 * @return Number of records read
+	 */
+	static inline unsigned long read(ZT_TraceRecord *out,const unsigned long max,uint64_t *dropped)
+	{
+		unsigned long n = 0;
+		uint64_t d = 0;
+		{
+			_Registry &r = _registry();
+			Mutex::Lock _l(r.lock);
+			d = r.retiredDropped;
+			for(std::vector<_Ring *>::const_iterator ri(r.rings.begin());ri!=r.rings.end();++ri) {
+				_Ring &ring = **ri;
+				d += ring.dropped.load(std::memory_order_relaxed);
+				const uint64_t h = ring.head.load(std::memory_order_acquire);
+				uint64_t t = ring.tail.load(std::memory_order_relaxed);
+				while ((t < h)&&(n < max))
+					_export(ring.buf[(t++) & (ZT_TRACE_RING_SIZE - 1)],out[n++]);
+				ring.tail.store(t,std::memory_order_release);
+			}
+		}
+		std::stable_sort(out,out + n,_olderThan);
+		if (dropped)
+			*dropped = d;
+		return n;
+	}
+
+private:
+	struct _Ring
+	{
+		_Ring() :
+			head(0),
+			tail(0),
+			dropped(0),
+			buf((Record *)0)
+		{
+			memset(sampled,0,sizeof(sampled));
+			memset(second,0,sizeof(second));
+			memset(count,0,sizeof(count));
+			_Registry &r = _registry();
+			Mutex::Lock _l(r.lock);
+			r.rings.push_back(this);
+		}
+
+		~_Ring()
+		{
+			{
+				_Registry &r = _registry();
+				Mutex::Lock _l(r.lock);
+				r.retiredDropped += dropped.load(std::memory_order_relaxed) + (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed));
+				for(std::vector<_Ring *>::iterator ri(r.rings.begin());ri!=r.rings.end();++ri) {
+					if (*ri == this) {
+						r.rings.erase(ri);
+						break;
+					}
+				}
+			}
+			delete [] buf;
+		}
+
+		std::atomic<uint64_t> head; // written only by owning thread
+		std::atomic<uint64_t> tail; // written only by readers holding the registry lock
+		std::atomic<uint64_t> dropped;
+		Record *buf; // allocated on first write
+
+		// Sampling and rate limit state, used only by the owning thread
+		unsigned int sampled[ZT_TRACE_RING_EVENT_SLOTS];
+		int64_t second[ZT_TRACE_RING_EVENT_SLOTS];
+		unsigned int count[ZT_TRACE_RING_EVENT_SLOTS];
+	};
+
+	struct _Registry
+	{
+		_Registry() : retiredDropped(0) {}
+		Mutex lock;
+		std::vector<_Ring *> rings;
+		uint64_t retiredDropped; // dropped or unread records of exited threads
+	};
+
+	struct _Settings
+	{
+		_Settings() :
+			enabled(false)
+		{
+			for(unsigned int s=0;s<ZT_TRACE_RING_EVENT_SLOTS;++s) {
+				sampleRate[s].store(0,std::memory_order_relaxed);
+				maxPerSecond[s].store(0,std::memory_order_relaxed);
+			}
+		}
+		std::atomic<bool> enabled;
+		std::atomic<unsigned int> sampleRate[ZT_TRACE_RING_EVENT_SLOTS];
+		std::atomic<unsigned int> maxPerSecond[ZT_TRACE_RING_EVENT_SLOTS];
+	};
+
+	// Event codes are 0x1000-0x1007 for peer and packet events and 0x2000-0x2007 for network events
+	static inline unsigned int _slot(const unsigned int event) { return ((((event >> 12) - 1) & 1) << 3) | (event & 7); }
+
+	static inline _Registry &_registry()
+	{
+		// Never destroyed, since thread-local rings may outlive static destructors
+		static _Registry *const r = new _Registry();
+		return *r;
+	}
+
+	static inline _Settings &_settings()
+	{
+		static _Settings s;
+		return s;
+	}
+
+	static inline _Ring &_local()
+	{
+		static thread_local _Ring r;
+		return r;
+	}
+
+	static inline bool _olderThan(const ZT_TraceRecord &a,const ZT_TraceRecord &b) { return (a.timestamp < b.timestamp); }
+
+	static inline void _export(const Record &r,ZT_TraceRecord &o)
+	{
+		memset(&o,0,sizeof(ZT_TraceRecord));
+		o.timestamp = r.timestamp;
+		o.event = r.event;
+		o.verb = r.verb;
+		o.hops = r.hops;
+		o.length = r.length;
+		o.value = r.value;
+		o.networkId = r.networkId;
+		o.packetId = r.packetId;
+		o.address = r.address;
+		o.sourceMac = r.sourceMac;
+		o.destMac = r.destMac;
+		o.reason = r.reason;
+		if (r.physicalFamily == 4)
+			*reinterpret_cast<InetAddress *>(&(o.physicalAddress)) = InetAddress(r.physicalIp,4,r.physicalPort);
+		else if (r.physicalFamily == 6)
+			*reinterpret_cast<InetAddress *>(&(o.physicalAddress)) = InetAddress(r.physicalIp,16,r.physicalPort);
+	}
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <algorithm>
+
+#include "Traversal.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Peer.hpp"
+
+#define ZT_TRAVERSAL_NOTHING_DUE 0x7fffffffffffffffLL
+
+namespace ZeroTier {
+
+Traversal::Traversal(const RuntimeEnvironment *renv) :
+	RR(renv),
+	_nextDue(ZT_TRAVERSAL_NOTHING_DUE),
+	_lock("Traversal::_lock")
+{
+}
+
+void Traversal::probe(void *tPtr,const SharedPtr<Peer> &peer,int64_t localSocket,const InetAddress &addr,bool predicted,int64_t now)
+{
+	const unsigned int s = stage(addr,predicted);
+	{
+		Mutex::Lock _l(_lock);
+		for(std::vector<_Pending>::const_iterator p(_pending.begin());p!=_pending.end();++p) {
+			if ((p->peer == peer)&&(p->addr == addr))
+				return; // already being probed
+		}
+		if (_pending.size() < ZT_TRAVERSAL_MAX_PENDING) {
+			_pending.push_back(_Pending());
+			_Pending &p = _pending.back();
+			p.peer = peer;
+			p.addr = addr;
+			p.localSocket = localSocket;
+			p.started = now;
+			p.due = (s) ? (now + (int64_t)(s * ZT_TRAVERSAL_STAGE_DELAY)) : (now + ZT_TRAVERSAL_RETRY_DELAY);
+			p.tries = (s) ? 0 : 1;
+			if (p.due < _nextDue.load(std::memory_order_relaxed))
+				_nextDue.store(p.due,std::memory_order_relaxed);
+		} else if (s) {
+			// Too much pending, so just try it once now like everything else
+			peer->attemptToContactAt(tPtr,localSocket,addr,now,false);
+			return;
+		}
+	}
+	if (!s)
+		peer->attemptToContactAt(tPtr,localSocket,addr,now,false);
+}
+
+unsigned long Traversal::service(void *tPtr,int64_t now)
+{
+	unsigned long wait = ZT_PING_CHECK_INVERVAL;
+	std::vector<_Pending> due;
+	{
+		Mutex::Lock _l(_lock);
+		for(unsigned long i=0;i<_pending.size();) {
+			_Pending &p = _pending[i];
+			// Stop once a new path has been found or this one works
+			bool done = ((p.peer->lastLearnedPath() > p.started)||(p.peer->hasActivePathTo(now,p.addr)));
+			if ((!done)&&(now >= p.due)) {
+				due.push_back(p);
+				p.due = now + ZT_TRAVERSAL_RETRY_DELAY;
+				done = (++p.tries >= ZT_TRAVERSAL_PROBE_TRIES);
+			}
+			if (done) {
+				if (i != (_pending.size() - 1))
+					p = _pending.back();
+				_pending.pop_back();
+			} else {
+				wait = std::min(wait,(unsigned long)(p.due - now));
+				++i;
+			}
+		}
+		_nextDue.store((_pending.empty()) ? ZT_TRAVERSAL_NOTHING_DUE : (now + (int64_t)wait),std::memory_order_relaxed);
+	}
+	for(std::vector<_Pending>::const_iterator p(due.begin());p!=due.end();++p)
+		p->peer->attemptToContactAt(tPtr,p->localSocket,p->addr,now,false);
+	return wait;
+}
+
+} // namespace ZeroTier
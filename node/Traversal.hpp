@@ -0,0 +1,120 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_TRAVERSAL_HPP
+#define ZT_TRAVERSAL_HPP
+
+#include <stdint.h>
+
+#include <vector>
+#include <atomic>
+
+#include "Constants.hpp"
+#include "Mutex.hpp"
+#include "SharedPtr.hpp"
+#include "InetAddress.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+class Peer;
+
+/**
+ * Probes candidate endpoints for peers in stages until a path is found
+ *
+ * Candidates come from PUSH_DIRECT_PATHS and RENDEZVOUS. Instead of trying
+ * each one once as it arrives, they are ranked and probed in stages
+ * ZT_TRAVERSAL_STAGE_DELAY apart: LAN and IPv6 candidates at once, then
+ * global IPv4, then ports predicted for symmetric NATs. Each candidate is
+ * probed ZT_TRAVERSAL_PROBE_TRIES times so that both sides' NATs get a
+ * chance to open, and as soon as a new path to the peer is confirmed its
+ * remaining probes are dropped and it keeps that path.
+ */
+class Traversal
+{
+public:
+	Traversal(const RuntimeEnvironment *renv);
+
+	/**
+	 * Probe a candidate endpoint for a peer, now or in a later stage
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param peer Peer to contact
+	 * @param localSocket Local socket to send from or -1 for any
+	 * @param addr Candidate endpoint
+	 * @param predicted True if this is a port predicted for a symmetric NAT
+	 * @param now Current time
+	 */
+	void probe(void *tPtr,const SharedPtr<Peer> &peer,int64_t localSocket,const InetAddress &addr,bool predicted,int64_t now);
+
+	/**
+	 * Send probes that are due
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return Milliseconds until this should be called again, or ZT_PING_CHECK_INVERVAL if nothing is pending
+	 */
+	unsigned long service(void *tPtr,int64_t now);
+
+	/**
+	 * @return Time service() should next be called, checked without locking after probe() may have been called
+	 */
+	inline int64_t nextDue() const { return _nextDue.load(std::memory_order_relaxed); }
+
+	/**
+	 * @param addr Candidate endpoint
+	 * @param predicted True if this is a port predicted for a symmetric NAT
+	 * @return Stage in which to first probe this candidate (0 for right away)
+	 */
+	static inline unsigned int stage(const InetAddress &addr,const bool predicted)
+	{
+		if (predicted)
+			return 2;
+		if ((addr.ss_family == AF_INET)&&(addr.ipScope() == InetAddress::IP_SCOPE_GLOBAL))
+			return 1;
+		return 0;
+	}
+
+private:
+	struct _Pending
+	{
+		SharedPtr<Peer> peer;
+		InetAddress addr;
+		int64_t localSocket;
+		int64_t started;
+		int64_t due;
+		unsigned int tries;
+	};
+
+	const RuntimeEnvironment *const RR;
+	std::vector<_Pending> _pending;
+	std::atomic<int64_t> _nextDue;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
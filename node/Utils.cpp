@@ -31,6 +31,9 @@
 #include <time.h>
 #include <sys/stat.h>
 
+#include <atomic>
+#include <memory>
+
 #include "Constants.hpp"
 
 #ifdef __UNIX_LIKE__
@@ -43,6 +46,11 @@
 #include <dirent.h>
 #endif
 
+#ifdef __LINUX__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #ifdef __WINDOWS__
 #include <wincrypt.h>
 #endif
@@ -85,90 +93,126 @@ char *Utils::decimal(unsigned long n,char s[24])
 	return s;
 }
 
-void Utils::getSecureRandom(void *buf,unsigned int bytes)
+// Each thread whitens OS entropy with its own Salsa20 instance and buffer, so
+// threads never wait on each other for random bytes. The buffer is allocated
+// the first time a thread needs it and kept for the life of the thread.
+struct _SecureRandomState
 {
-	static Mutex globalLock;
-	static Salsa20 s20;
-	static bool s20Initialized = false;
-	static uint8_t randomBuf[65536];
-	static unsigned int randomPtr = sizeof(randomBuf);
-
-	Mutex::Lock _l(globalLock);
-
-	/* Just for posterity we Salsa20 encrypt the result of whatever system
-	 * CSPRNG we use. There have been several bugs at the OS or OS distribution
-	 * level in the past that resulted in systematically weak or predictable
-	 * keys due to random seeding problems. This mitigates that by grabbing
-	 * a bit of extra entropy and further randomizing the result, and comes
-	 * at almost no cost and with no real downside if the random source is
-	 * good. */
-	if (!s20Initialized) {
-		s20Initialized = true;
-		uint64_t s20Key[4];
-		s20Key[0] = (uint64_t)time(0); // system clock
-		s20Key[1] = (uint64_t)buf; // address of buf
-		s20Key[2] = (uint64_t)s20Key; // address of s20Key[]
-		s20Key[3] = (uint64_t)&s20; // address of s20
-		s20.init(s20Key,s20Key);
-	}
+	_SecureRandomState() : ptr(sizeof(buf)) {}
+	Salsa20 s20;
+	unsigned int ptr;
+	uint8_t buf[16384];
+};
+static thread_local std::unique_ptr<_SecureRandomState> _secureRandomState;
 
 #ifdef __WINDOWS__
 
-	static HCRYPTPROV cryptProvider = NULL;
+static HCRYPTPROV _Utils_cryptProvider = NULL;
+static Mutex _Utils_cryptProviderLock;
 
-	for(unsigned int i=0;i<bytes;++i) {
-		if (randomPtr >= sizeof(randomBuf)) {
-			if (cryptProvider == NULL) {
-				if (!CryptAcquireContextA(&cryptProvider,NULL,NULL,PROV_RSA_FULL,CRYPT_VERIFYCONTEXT|CRYPT_SILENT)) {
-					fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() unable to obtain WinCrypt context!\r\n");
-					exit(1);
-				}
-			}
-			if (!CryptGenRandom(cryptProvider,(DWORD)sizeof(randomBuf),(BYTE *)randomBuf)) {
-				fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() CryptGenRandom failed!\r\n");
+static void _Utils_osRandom(uint8_t *buf,unsigned int len)
+{
+	{
+		Mutex::Lock _l(_Utils_cryptProviderLock);
+		if (_Utils_cryptProvider == NULL) {
+			if (!CryptAcquireContextA(&_Utils_cryptProvider,NULL,NULL,PROV_RSA_FULL,CRYPT_VERIFYCONTEXT|CRYPT_SILENT)) {
+				fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() unable to obtain WinCrypt context!\r\n");
 				exit(1);
 			}
-			randomPtr = 0;
-			s20.crypt12(randomBuf,randomBuf,sizeof(randomBuf));
-			s20.init(randomBuf,randomBuf);
 		}
-		((uint8_t *)buf)[i] = randomBuf[randomPtr++];
 	}
+	if (!CryptGenRandom(_Utils_cryptProvider,(DWORD)len,(BYTE *)buf)) {
+		fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() CryptGenRandom failed!\r\n");
+		exit(1);
+	}
+}
 
 #else // not __WINDOWS__
 
-	static int devURandomFd = -1;
+// Opened once and shared, since reads from it need no locking
+static std::atomic<int> _Utils_devURandomFd(-1);
+static Mutex _Utils_devURandomLock;
 
-	if (devURandomFd < 0) {
-		devURandomFd = ::open("/dev/urandom",O_RDONLY);
-		if (devURandomFd < 0) {
-			fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() unable to open /dev/urandom\n");
+static void _Utils_osRandom(uint8_t *buf,unsigned int len)
+{
+	int fd = _Utils_devURandomFd.load();
+	if (fd < 0) {
+		Mutex::Lock _l(_Utils_devURandomLock);
+		fd = _Utils_devURandomFd.load();
+		if (fd < 0) {
+			fd = ::open("/dev/urandom",O_RDONLY);
+			if (fd < 0) {
+				fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() unable to open /dev/urandom\n");
+				exit(1);
+				return;
+			}
+			_Utils_devURandomFd.store(fd);
+		}
+	}
+	while (len) {
+		const ssize_t n = ::read(fd,buf,len);
+		if (n > 0) {
+			buf += n;
+			len -= (unsigned int)n;
+		} else if ((n < 0)&&(errno != EINTR)) {
+			fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() unable to read /dev/urandom\n");
 			exit(1);
 			return;
 		}
 	}
+}
+
+#endif // __WINDOWS__ or not
+
+void Utils::getSecureRandom(void *buf,unsigned int bytes)
+{
+	_SecureRandomState *st = _secureRandomState.get();
+
+	/* Just for posterity we Salsa20 encrypt the result of whatever system
+	 * CSPRNG we use. There have been several bugs at the OS or OS distribution
+	 * level in the past that resulted in systematically weak or predictable
+	 * keys due to random seeding problems. This mitigates that by grabbing
+	 * a bit of extra entropy and further randomizing the result, and comes
+	 * at almost no cost and with no real downside if the random source is
+	 * good. */
+	if (!st) {
+		st = new _SecureRandomState();
+		_secureRandomState.reset(st);
+		uint64_t s20Key[4];
+		s20Key[0] = (uint64_t)time(0); // system clock
+		s20Key[1] = (uint64_t)buf; // address of buf
+		s20Key[2] = (uint64_t)s20Key; // address of s20Key[]
+		s20Key[3] = (uint64_t)st; // address of this thread's state
+		st->s20.init(s20Key,s20Key);
+	}
 
 	for(unsigned int i=0;i<bytes;++i) {
-		if (randomPtr >= sizeof(randomBuf)) {
-			for(;;) {
-				if ((int)::read(devURandomFd,randomBuf,sizeof(randomBuf)) != (int)sizeof(randomBuf)) {
-					::close(devURandomFd);
-					devURandomFd = ::open("/dev/urandom",O_RDONLY);
-					if (devURandomFd < 0) {
-						fprintf(stderr,"FATAL ERROR: Utils::getSecureRandom() unable to open /dev/urandom\n");
-						exit(1);
-						return;
-					}
-				} else break;
-			}
-			randomPtr = 0;
-			s20.crypt12(randomBuf,randomBuf,sizeof(randomBuf));
-			s20.init(randomBuf,randomBuf);
+		if (st->ptr >= sizeof(st->buf)) {
+			_Utils_osRandom(st->buf,sizeof(st->buf));
+			st->ptr = 0;
+			st->s20.crypt12(st->buf,st->buf,sizeof(st->buf));
+			st->s20.init(st->buf,st->buf);
 		}
-		((uint8_t *)buf)[i] = randomBuf[randomPtr++];
+		((uint8_t *)buf)[i] = st->buf[st->ptr++];
 	}
+}
 
-#endif // __WINDOWS__ or not
+bool Utils::pinThread(unsigned int cpu)
+{
+#ifdef __LINUX__
+	if (cpu >= CPU_SETSIZE)
+		return false;
+	cpu_set_t s;
+	CPU_ZERO(&s);
+	CPU_SET(cpu,&s);
+	return (pthread_setaffinity_np(pthread_self(),sizeof(s),&s) == 0);
+#elif defined(__WINDOWS__)
+	if (cpu >= (sizeof(DWORD_PTR) * 8))
+		return false;
+	return (SetThreadAffinityMask(GetCurrentThread(),((DWORD_PTR)1) << cpu) != 0);
+#else
+	return false;
+#endif
 }
 
 } // namespace ZeroTier
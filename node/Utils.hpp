@@ -264,14 +264,26 @@ public:
 	/**
 	 * Generate secure random bytes
 	 *
-	 * This will try to use whatever OS sources of entropy are available. It's
-	 * guarded by an internal mutex so it's thread-safe.
+	 * This will try to use whatever OS sources of entropy are available. Each
+	 * thread draws from its own whitened buffer, so it's thread-safe and
+	 * threads don't contend for it.
 	 *
 	 * @param buf Buffer to fill
 	 * @param bytes Number of random bytes to generate
 	 */
 	static void getSecureRandom(void *buf,unsigned int bytes);
 
+	/**
+	 * Pin the calling thread to one CPU (Linux and Windows only)
+	 *
+	 * Memory the thread allocates and first writes after this comes from
+	 * that CPU's NUMA node under the default allocation policy.
+	 *
+	 * @param cpu CPU number as the OS counts them
+	 * @return True if the thread was pinned
+	 */
+	static bool pinThread(unsigned int cpu);
+
 	/**
 	 * Tokenize a string (alias for strtok_r or strtok_s depending on platform)
 	 *
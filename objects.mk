@@ -1,8 +1,13 @@
 CORE_OBJS=\
+	node/AES.o \
 	node/C25519.o \
 	node/Capability.o \
 	node/CertificateOfMembership.o \
 	node/CertificateOfOwnership.o \
+	node/Cluster.o \
+	node/CryptoWorkers.o \
+	node/Egress.o \
+	node/HugePages.o \
 	node/Identity.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
@@ -20,17 +25,22 @@ CORE_OBJS=\
 	node/Salsa20.o \
 	node/SelfAwareness.o \
 	node/SHA512.o \
+	node/Shaper.o \
 	node/Switch.o \
 	node/Tag.o \
 	node/Topology.o \
 	node/Trace.o \
+	node/Traversal.o \
 	node/Utils.o
 
 ONE_OBJS=\
 	controller/EmbeddedNetworkController.o \
 	controller/DB.o \
 	controller/FileDB.o \
+	controller/MappedDB.o \
+	controller/MemoryDB.o \
 	controller/RethinkDB.o \
+	controller/TraceLog.o \
 	osdep/ManagedRoute.o \
 	osdep/Http.o \
 	osdep/OSUtils.o \
@@ -67,6 +67,10 @@
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <functional>
 
 #include "version.h"
 #include "include/ZeroTierOne.h"
@@ -135,6 +139,7 @@ static void cliPrintHelp(const char *pn,FILE *out)
 	fprintf(out,"  listmoons               - List moons (federated root sets)" ZT_EOL_S);
 	fprintf(out,"  orbit <world ID> <seed> - Join a moon via any member root" ZT_EOL_S);
 	fprintf(out,"  deorbit <world ID>      - Leave a moon" ZT_EOL_S);
+	fprintf(out,"  top [<count>]           - Live traffic, drops, queues and crypto load" ZT_EOL_S);
 }
 
 static std::string cliFixJsonCRs(const std::string &s)
@@ -148,6 +153,151 @@ static std::string cliFixJsonCRs(const std::string &s)
 	return r;
 }
 
+// Format a per-second rate with a k/M/G suffix for zerotier-cli top
+static std::string cliRate(double v)
+{
+	static const char *const suffixes[4] = { "","k","M","G" };
+	unsigned int s = 0;
+	while ((v >= 1000.0)&&(s < 3)) {
+		v /= 1000.0;
+		++s;
+	}
+	char tmp[64];
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),(s) ? "%.1f%s" : "%.0f%s",v,suffixes[s]);
+	return std::string(tmp);
+}
+
+// Difference in a counter between two /metrics/top samples, zero if the service restarted in between
+static uint64_t cliDelta(const nlohmann::json &cur,const nlohmann::json &prev,const char *field)
+{
+	const uint64_t c = OSUtils::jsonInt(cur[field],0ULL);
+	const uint64_t p = (prev.is_object()) ? OSUtils::jsonInt(prev[field],0ULL) : 0ULL;
+	return (c >= p) ? (c - p) : 0ULL;
+}
+
+// Index a /metrics/top array of objects by one of their fields
+static std::map<std::string,nlohmann::json> cliIndex(const nlohmann::json &a,const char *key)
+{
+	std::map<std::string,nlohmann::json> m;
+	if (a.is_array()) {
+		for(unsigned long i=0;i<a.size();++i) {
+			if (a[i].is_object())
+				m[OSUtils::jsonString(a[i][key],"")] = a[i];
+		}
+	}
+	return m;
+}
+
+// Print one zerotier-cli top screen from two samples taken secs apart
+static void cliPrintTop(nlohmann::json &cur,nlohmann::json &prev,double secs)
+{
+	printf("\x1b[H\x1b[2J");
+	printf("zerotier-cli top - %llu peers, %llu paths, %u networks (every %.1fs, ^C to quit)" ZT_EOL_S ZT_EOL_S,
+		(unsigned long long)OSUtils::jsonInt(cur["peerCount"],0ULL),
+		(unsigned long long)OSUtils::jsonInt(cur["pathCount"],0ULL),
+		(cur["networks"].is_array()) ? (unsigned int)cur["networks"].size() : 0,
+		secs);
+
+	const uint64_t bytes = cliDelta(cur,prev,"bytesIn") + cliDelta(cur,prev,"bytesOut");
+	const uint64_t relayed = cliDelta(cur,prev,"relayedBytes");
+	printf("Traffic   in %8s pkt/s %8sB/s   out %8s pkt/s %8sB/s" ZT_EOL_S,
+		cliRate((double)cliDelta(cur,prev,"packetsIn") / secs).c_str(),
+		cliRate((double)cliDelta(cur,prev,"bytesIn") / secs).c_str(),
+		cliRate((double)cliDelta(cur,prev,"packetsOut") / secs).c_str(),
+		cliRate((double)cliDelta(cur,prev,"bytesOut") / secs).c_str());
+	printf("Relayed      %8s pkt/s %8sB/s   (%.1f%% of bytes handled)" ZT_EOL_S,
+		cliRate((double)cliDelta(cur,prev,"relayedPackets") / secs).c_str(),
+		cliRate((double)relayed / secs).c_str(),
+		((bytes + relayed) > 0) ? (100.0 * (double)relayed / (double)(bytes + relayed)) : 0.0);
+	printf("Queues    rx %llu entries (%sB)   tx %sB" ZT_EOL_S,
+		(unsigned long long)OSUtils::jsonInt(cur["rxQueueEntries"],0ULL),
+		cliRate((double)OSUtils::jsonInt(cur["rxQueueBytes"],0ULL)).c_str(),
+		cliRate((double)OSUtils::jsonInt(cur["txQueueBytes"],0ULL)).c_str());
+	printf("Crypto    encrypt %.1f%%   decrypt %.1f%% of one core" ZT_EOL_S,
+		(double)cliDelta(cur,prev,"cryptoEncryptNs") / (secs * 10000000.0),
+		(double)cliDelta(cur,prev,"cryptoDecryptNs") / (secs * 10000000.0));
+
+	printf("Drops/s  ");
+	bool anyDrops = false;
+	if (cur["drops"].is_object()) {
+		for(nlohmann::json::iterator d(cur["drops"].begin());d!=cur["drops"].end();++d) {
+			const uint64_t n = cliDelta(cur["drops"],prev["drops"],d.key().c_str());
+			if (n) {
+				printf(" %s %s",d.key().c_str(),cliRate((double)n / secs).c_str());
+				anyDrops = true;
+			}
+		}
+	}
+	printf("%s" ZT_EOL_S,(anyDrops) ? "" : " none");
+
+	// Locks are only reported by ZT_MUTEX_PROFILING builds
+	std::map<std::string,nlohmann::json> pl(cliIndex(prev["locks"],"name"));
+	std::vector< std::pair<uint64_t,std::string> > contended;
+	std::map<std::string,nlohmann::json> cl(cliIndex(cur["locks"],"name"));
+	for(std::map<std::string,nlohmann::json>::iterator l(cl.begin());l!=cl.end();++l) {
+		const uint64_t n = cliDelta(l->second,pl[l->first],"contended");
+		if (n)
+			contended.push_back(std::pair<uint64_t,std::string>(n,l->first));
+	}
+	if (!contended.empty()) {
+		std::sort(contended.begin(),contended.end(),std::greater< std::pair<uint64_t,std::string> >());
+		printf(ZT_EOL_S "%-32s %12s %12s %12s" ZT_EOL_S,"lock","acquired/s","contended/s","wait ms/s");
+		for(unsigned long i=0;(i<contended.size())&&(i<5);++i) {
+			nlohmann::json &l = cl[contended[i].second];
+			printf("%-32s %12s %12s %12.2f" ZT_EOL_S,
+				contended[i].second.c_str(),
+				cliRate((double)cliDelta(l,pl[contended[i].second],"acquisitions") / secs).c_str(),
+				cliRate((double)contended[i].first / secs).c_str(),
+				(double)cliDelta(l,pl[contended[i].second],"waitNs") / (secs * 1000000.0));
+		}
+	}
+
+	std::map<std::string,nlohmann::json> pn(cliIndex(prev["networks"],"id"));
+	std::map<std::string,nlohmann::json> cn(cliIndex(cur["networks"],"id"));
+	if (!cn.empty()) {
+		printf(ZT_EOL_S "%-16s %10s %10s %10s %10s" ZT_EOL_S,"network","in fr/s","in B/s","out fr/s","out B/s");
+		for(std::map<std::string,nlohmann::json>::iterator n(cn.begin());n!=cn.end();++n) {
+			nlohmann::json &p = pn[n->first];
+			printf("%-16s %10s %10s %10s %10s" ZT_EOL_S,
+				n->first.c_str(),
+				cliRate((double)cliDelta(n->second,p,"framesIn") / secs).c_str(),
+				cliRate((double)cliDelta(n->second,p,"bytesIn") / secs).c_str(),
+				cliRate((double)cliDelta(n->second,p,"framesOut") / secs).c_str(),
+				cliRate((double)cliDelta(n->second,p,"bytesOut") / secs).c_str());
+		}
+	}
+
+	// Rank peers by bytes per second over this interval rather than by lifetime totals
+	std::map<std::string,nlohmann::json> pp(cliIndex(prev["peers"],"address"));
+	std::map<std::string,nlohmann::json> cp(cliIndex(cur["peers"],"address"));
+	std::vector< std::pair<uint64_t,std::string> > busiest;
+	for(std::map<std::string,nlohmann::json>::iterator p(cp.begin());p!=cp.end();++p) {
+		nlohmann::json &q = pp[p->first];
+		const uint64_t n = cliDelta(p->second,q,"bytesIn") + cliDelta(p->second,q,"bytesOut");
+		if (n)
+			busiest.push_back(std::pair<uint64_t,std::string>(n,p->first));
+	}
+	if (!busiest.empty()) {
+		std::sort(busiest.begin(),busiest.end(),std::greater< std::pair<uint64_t,std::string> >());
+		printf(ZT_EOL_S "%-10s %10s %10s %10s %10s %8s" ZT_EOL_S,"peer","in pkt/s","in B/s","out pkt/s","out B/s","relayed");
+		for(unsigned long i=0;(i<busiest.size())&&(i<20);++i) {
+			nlohmann::json &c = cp[busiest[i].second];
+			nlohmann::json &q = pp[busiest[i].second];
+			const uint64_t pkts = cliDelta(c,q,"packetsIn") + cliDelta(c,q,"packetsOut");
+			const uint64_t rpkts = cliDelta(c,q,"relayedPacketsIn") + cliDelta(c,q,"relayedPacketsOut");
+			printf("%-10s %10s %10s %10s %10s %7.0f%%" ZT_EOL_S,
+				busiest[i].second.c_str(),
+				cliRate((double)cliDelta(c,q,"packetsIn") / secs).c_str(),
+				cliRate((double)cliDelta(c,q,"bytesIn") / secs).c_str(),
+				cliRate((double)cliDelta(c,q,"packetsOut") / secs).c_str(),
+				cliRate((double)cliDelta(c,q,"bytesOut") / secs).c_str(),
+				(pkts) ? (100.0 * (double)rpkts / (double)pkts) : 0.0);
+		}
+	}
+
+	fflush(stdout);
+}
+
 #ifdef __WINDOWS__
 static int cli(int argc, _TCHAR* argv[])
 #else
@@ -670,6 +820,45 @@ static int cli(int argc,char **argv)
 			printf("%u %s %s" ZT_EOL_S,scode,command.c_str(),responseBody.c_str());
 			return 1;
 		}
+	} else if (command == "top") {
+		// Poll raw counters once a second and show rates; stop after <count> screens if given
+		const unsigned long screens = (arg1.length() > 0) ? Utils::strToULong(arg1.c_str()) : 0;
+		unsigned long shown = 0;
+		nlohmann::json prev;
+		for(;;) {
+			responseHeaders.clear();
+			responseBody.clear();
+			const unsigned int scode = Http::GET(1024 * 1024 * 16,60000,(const struct sockaddr *)&addr,"/metrics/top",requestHeaders,responseHeaders,responseBody);
+
+			if (scode == 0) {
+				printf("Error connecting to the ZeroTier service: %s\n\nPlease check that the service is running and that TCP port 9993 can be contacted via 127.0.0.1." ZT_EOL_S, responseBody.c_str());
+				return 1;
+			} else if (scode != 200) {
+				printf("%u %s %s" ZT_EOL_S,scode,command.c_str(),responseBody.c_str());
+				return 1;
+			}
+
+			nlohmann::json j;
+			try {
+				j = OSUtils::jsonParse(responseBody);
+			} catch ( ... ) {
+				printf("%u %s invalid JSON response" ZT_EOL_S,scode,command.c_str());
+				return 1;
+			}
+
+			if (prev.is_object()) {
+				const int64_t ms = (int64_t)OSUtils::jsonInt(j["clock"],0ULL) - (int64_t)OSUtils::jsonInt(prev["clock"],0ULL);
+				if (json) {
+					printf("%s" ZT_EOL_S,OSUtils::jsonDump(j,-1).c_str());
+					fflush(stdout);
+				} else cliPrintTop(j,prev,(ms > 0) ? ((double)ms / 1000.0) : 1.0);
+				if ((screens)&&(++shown >= screens))
+					break;
+			}
+			prev = j;
+
+			Thread::sleep(1000);
+		}
 	} else {
 		cliPrintHelp(argv[0],stderr);
 		return 0;
@@ -739,8 +928,12 @@ static int idtool(int argc,char **argv)
 		}
 
 		Identity id;
+		uint64_t candidates = 0;
+		const int64_t startTime = OSUtils::now();
 		for(;;) {
-			id.generate();
+			uint64_t c = 0;
+			id.generate(0,&c);
+			candidates += c;
 			if ((id.address().toInt() >> (40 - vanityBits)) == vanity) {
 				if (vanityBits > 0) {
 					fprintf(stderr,"vanity address: found %.10llx !\n",(unsigned long long)id.address().toInt());
@@ -751,6 +944,9 @@ static int idtool(int argc,char **argv)
 			}
 		}
 
+		const int64_t elapsed = OSUtils::now() - startTime;
+		fprintf(stderr,"generated in %.3fs (%llu candidates, %.1f candidates/sec)" ZT_EOL_S,(double)elapsed / 1000.0,(unsigned long long)candidates,(elapsed > 0) ? ((double)candidates / ((double)elapsed / 1000.0)) : 0.0);
+
 		char idtmp[1024];
 		std::string idser = id.toString(true,idtmp);
 		if (argc >= 3) {
@@ -72,6 +72,8 @@ static const ZeroTier::MulticastGroup _blindWildcardMulticastGroup(ZeroTier::MAC
 
 namespace ZeroTier {
 
+static volatile bool __tapNetmap = false;
+
 BSDEthernetTap::BSDEthernetTap(
 	const char *homePath,
 	const MAC &mac,
@@ -79,7 +81,7 @@ BSDEthernetTap::BSDEthernetTap(
 	unsigned int metric,
 	uint64_t nwid,
 	const char *friendlyName,
-	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+	void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 	void *arg) :
 	_handler(handler),
 	_arg(arg),
@@ -88,6 +90,9 @@ BSDEthernetTap::BSDEthernetTap(
 	_metric(metric),
 	_fd(0),
 	_enabled(true)
+#ifdef ZT_HAVE_NETMAP
+	,_netmap((BSDNetmap *)0)
+#endif
 {
 	static Mutex globalTapCreateLock;
 	char devpath[64],ethaddr[64],mtustr[32],metstr[32],tmpdevname[32];
@@ -192,6 +197,16 @@ BSDEthernetTap::BSDEthernetTap(
 
 	::pipe(_shutdownSignalPipe);
 
+#ifdef ZT_HAVE_NETMAP
+	if (__tapNetmap) {
+		_netmap = new BSDNetmap();
+		if ((!_netmap->open(_dev.c_str()))||(_netmap->bufferSize() < (_mtu + 14))) {
+			delete _netmap;
+			_netmap = (BSDNetmap *)0;
+		}
+	}
+#endif
+
 	_thread = Thread::start(this);
 }
 
@@ -199,6 +214,9 @@ BSDEthernetTap::~BSDEthernetTap()
 {
 	::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
 	Thread::join(_thread);
+#ifdef ZT_HAVE_NETMAP
+	delete _netmap;
+#endif
 	::close(_fd);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
@@ -322,6 +340,22 @@ void BSDEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,co
 {
 	char putBuf[ZT_MAX_MTU + 64];
 	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
+#ifdef ZT_HAVE_NETMAP
+		if (_netmap) {
+			char eth[14];
+			to.copyTo(eth,6);
+			from.copyTo(eth + 6,6);
+			*((uint16_t *)(eth + 12)) = htons((uint16_t)etherType);
+			Mutex::Lock _l(_netmapTxLock);
+			if (!_netmap->send(eth,14,data,len)) {
+				_netmap->flush(); // ring is full, so wait for the host stack to take some
+				if (!_netmap->send(eth,14,data,len))
+					return; // too big for a buffer after an MTU change
+			}
+			_netmap->flush();
+			return;
+		}
+#endif
 		to.copyTo(putBuf,6);
 		from.copyTo(putBuf + 6,6);
 		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
@@ -401,7 +435,6 @@ void BSDEthernetTap::threadMain()
 	throw()
 {
 	fd_set readfds,nullfds;
-	MAC to,from;
 	int n,nfds,r;
 	char getBuf[ZT_MAX_MTU + 64];
 
@@ -409,6 +442,13 @@ void BSDEthernetTap::threadMain()
 	// constructing itself.
 	Thread::sleep(500);
 
+#ifdef ZT_HAVE_NETMAP
+	if (_netmap) {
+		_netmapLoop();
+		return;
+	}
+#endif
+
 	FD_ZERO(&readfds);
 	FD_ZERO(&nullfds);
 	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
@@ -437,10 +477,14 @@ void BSDEthernetTap::threadMain()
 						r = _mtu + 14;
 
 					if (_enabled) {
-						to.setTo(getBuf,6);
-						from.setTo(getBuf + 6,6);
-						unsigned int etherType = ntohs(((const uint16_t *)getBuf)[6]);
-						_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(getBuf + 14),r - 14);
+						ZT_VirtualNetworkFrame f;
+						f.destMac = MAC(getBuf,6).toInt();
+						f.sourceMac = MAC(getBuf + 6,6).toInt();
+						f.etherType = ntohs(((const uint16_t *)getBuf)[6]);
+						f.vlanId = 0; // TODO: VLAN support
+						f.data = (const void *)(getBuf + 14);
+						f.length = r - 14;
+						_handler(_arg,(void *)0,_nwid,&f,1);
 					}
 
 					r = 0;
@@ -450,4 +494,59 @@ void BSDEthernetTap::threadMain()
 	}
 }
 
+void BSDEthernetTap::setNetmap(bool enabled)
+{
+	__tapNetmap = enabled;
+}
+
+void BSDEthernetTap::_netmapLoop()
+{
+#ifdef ZT_HAVE_NETMAP
+	fd_set readfds,nullfds;
+	const int nmfd = _netmap->fd();
+	ZT_VirtualNetworkFrame frames[ZT_TAP_NETMAP_BATCH];
+
+	FD_ZERO(&readfds);
+	FD_ZERO(&nullfds);
+	const int nfds = (int)std::max(_shutdownSignalPipe[0],nmfd) + 1;
+
+	for(;;) {
+		// Waiting on the netmap fd also syncs its receive ring
+		FD_SET(_shutdownSignalPipe[0],&readfds);
+		FD_SET(nmfd,&readfds);
+		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
+
+		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
+			break;
+
+		if (FD_ISSET(nmfd,&readfds)) {
+			// Frames are handed over in place and only released to the kernel once the core returns
+			for(;;) {
+				unsigned int taken = 0,count = 0,len = 0;
+				const char *buf;
+				while ((count < ZT_TAP_NETMAP_BATCH)&&((buf = _netmap->received(taken,len)))) {
+					++taken;
+					if (len <= 14)
+						continue;
+					if (len > (_mtu + 14))
+						len = _mtu + 14;
+					ZT_VirtualNetworkFrame &f = frames[count++];
+					f.destMac = MAC(buf,6).toInt();
+					f.sourceMac = MAC(buf + 6,6).toInt();
+					f.etherType = ntohs(((const uint16_t *)buf)[6]);
+					f.vlanId = 0; // TODO: VLAN support
+					f.data = (const void *)(buf + 14);
+					f.length = len - 14;
+				}
+				if (!taken)
+					break;
+				if ((count)&&(_enabled))
+					_handler(_arg,(void *)0,_nwid,frames,count);
+				_netmap->release(taken);
+			}
+		}
+	}
+#endif
+}
+
 } // namespace ZeroTier
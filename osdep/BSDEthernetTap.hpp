@@ -37,7 +37,12 @@
 #include "../node/Constants.hpp"
 #include "../node/MulticastGroup.hpp"
 #include "../node/MAC.hpp"
+#include "../node/Mutex.hpp"
 #include "Thread.hpp"
+#include "BSDNetmap.hpp"
+
+// Most frames from a netmap receive ring handed to the core together
+#define ZT_TAP_NETMAP_BATCH 64
 
 namespace ZeroTier {
 
@@ -51,7 +56,7 @@ public:
 		unsigned int metric,
 		uint64_t nwid,
 		const char *friendlyName,
-		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 		void *arg);
 
 	~BSDEthernetTap();
@@ -70,8 +75,23 @@ public:
 	void threadMain()
 		throw();
 
+	/**
+	 * Use netmap for reads and writes on taps created after this (FreeBSD only)
+	 *
+	 * The tap's host rings are bound with netmap (see BSDNetmap), so each
+	 * wakeup hands every frame the host sent to the core in one batch from
+	 * buffers shared with the kernel, and put() copies frames straight into
+	 * the transmit ring. Taps fall back to read() and write() if netmap is
+	 * unavailable or its buffers are too small for the tap's MTU.
+	 *
+	 * @param enabled If true, use netmap
+	 */
+	static void setNetmap(bool enabled);
+
 private:
-	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
+	void _netmapLoop();
+
+	void (*_handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
 	Thread _thread;
@@ -82,6 +102,10 @@ private:
 	int _fd;
 	int _shutdownSignalPipe[2];
 	volatile bool _enabled;
+#ifdef ZT_HAVE_NETMAP
+	BSDNetmap *_netmap; // NULL if reading and writing the tap device
+	Mutex _netmapTxLock;
+#endif
 };
 
 } // namespace ZeroTier
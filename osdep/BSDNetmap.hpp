@@ -0,0 +1,229 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BSDNETMAP_HPP
+#define ZT_BSDNETMAP_HPP
+
+// netmap is used through its ioctl()s and the ring macros in its user header,
+// so there is no libnetmap dependency. The headers have to be new enough for
+// the nmreq_header control API (FreeBSD 12), checked through its register
+// request.
+#if defined(__FreeBSD__) && defined(__has_include)
+#if __has_include(<net/netmap_user.h>)
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <net/netmap.h>
+#include <net/netmap_user.h>
+#ifdef NETMAP_REQ_REGISTER
+#define ZT_HAVE_NETMAP
+#endif
+#endif
+#endif
+
+#ifdef ZT_HAVE_NETMAP
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ZeroTier {
+
+/**
+ * The host stack rings of an interface opened with netmap
+ *
+ * Binding an interface's host rings diverts what the host stack transmits
+ * on it into the receive ring, and frames put in the transmit ring are
+ * handed to the host stack as if the interface received them. For a tap
+ * this replaces reading and writing its device: each poll() of fd() makes
+ * every frame waiting available at once, in buffers shared with the
+ * kernel, so nothing is copied until the frames are handled.
+ *
+ * Frames are one buffer each, so interfaces whose MTU doesn't fit a buffer
+ * shouldn't be opened (see bufferSize()). This isn't thread-safe; callers
+ * sharing the transmit ring must lock around send() and flush().
+ */
+class BSDNetmap
+{
+public:
+	BSDNetmap() :
+		_fd(-1),
+		_mem(MAP_FAILED),
+		_memSize(0),
+		_nifp((struct netmap_if *)0),
+		_rx((struct netmap_ring *)0),
+		_tx((struct netmap_ring *)0)
+	{
+	}
+
+	~BSDNetmap()
+	{
+		if (_mem != MAP_FAILED)
+			::munmap(_mem,_memSize);
+		if (_fd >= 0)
+			::close(_fd); // gives the interface's traffic back to the host stack
+	}
+
+	/**
+	 * Bind the host rings of an interface
+	 *
+	 * @param ifname Interface name
+	 * @return True on success, false if netmap is unavailable or won't bind this interface
+	 */
+	inline bool open(const char *ifname)
+	{
+		if (_fd >= 0)
+			return true;
+		_fd = ::open("/dev/netmap",O_RDWR|O_CLOEXEC);
+		if (_fd < 0)
+			return false;
+
+		struct nmreq_header h;
+		struct nmreq_register r;
+		memset(&h,0,sizeof(h));
+		memset(&r,0,sizeof(r));
+		h.nr_version = NETMAP_API;
+		h.nr_reqtype = NETMAP_REQ_REGISTER;
+		strncpy(h.nr_name,ifname,sizeof(h.nr_name) - 1);
+		h.nr_body = (uint64_t)((uintptr_t)&r);
+		r.nr_mode = NR_REG_SW;
+		if (::ioctl(_fd,NIOCCTRL,&h) != 0) {
+			::close(_fd);
+			_fd = -1;
+			return false;
+		}
+
+		_memSize = (size_t)r.nr_memsize;
+		_mem = ::mmap((void *)0,_memSize,PROT_READ|PROT_WRITE,MAP_SHARED,_fd,0);
+		if (_mem == MAP_FAILED) {
+			::close(_fd);
+			_fd = -1;
+			return false;
+		}
+
+		// The host rings come after the hardware rings
+		_nifp = NETMAP_IF(_mem,r.nr_offset);
+		_rx = NETMAP_RXRING(_nifp,r.nr_rx_rings);
+		_tx = NETMAP_TXRING(_nifp,r.nr_tx_rings);
+		return true;
+	}
+
+	/**
+	 * @return File descriptor to poll or select on for received frames, or -1 if not open
+	 */
+	inline int fd() const { return _fd; }
+
+	/**
+	 * @return Size of each frame buffer, or 0 if not open
+	 */
+	inline unsigned int bufferSize() const { return ((_rx) ? (unsigned int)_rx->nr_buf_size : 0); }
+
+	/**
+	 * Get the next frame the last poll() made available
+	 *
+	 * Frames stay valid until release() gives them back to the kernel.
+	 *
+	 * @param i Frame index, 0 for the first not yet released
+	 * @param len Set to length of frame
+	 * @return Frame or NULL if there are no more than i frames waiting
+	 */
+	inline const char *received(unsigned int i,unsigned int &len) const
+	{
+		if (i >= nm_ring_space(_rx))
+			return (const char *)0;
+		unsigned int s = _rx->cur + i;
+		if (s >= _rx->num_slots)
+			s -= _rx->num_slots;
+		const struct netmap_slot &slot = _rx->slot[s];
+		len = (slot.flags & NS_MOREFRAG) ? 0 : (unsigned int)slot.len; // frames not fitting one buffer are skipped
+		return NETMAP_BUF(_rx,slot.buf_idx);
+	}
+
+	/**
+	 * Give frames returned by received() back to the kernel
+	 *
+	 * @param count Number of frames, starting at the first not yet released
+	 */
+	inline void release(unsigned int count)
+	{
+		_rx->head = _rx->cur = _advance(_rx,count);
+	}
+
+	/**
+	 * Copy a frame into the transmit ring
+	 *
+	 * Frames are handed to the host stack by the next flush() or poll().
+	 *
+	 * @param hdr Ethernet header
+	 * @param hdrLen Length of header
+	 * @param data Payload
+	 * @param len Length of payload
+	 * @return False if the ring is full or the frame doesn't fit a buffer
+	 */
+	inline bool send(const void *hdr,unsigned int hdrLen,const void *data,unsigned int len)
+	{
+		if ((nm_ring_empty(_tx))||((hdrLen + len) > _tx->nr_buf_size))
+			return false;
+		struct netmap_slot &slot = _tx->slot[_tx->cur];
+		char *const b = NETMAP_BUF(_tx,slot.buf_idx);
+		memcpy(b,hdr,hdrLen);
+		memcpy(b + hdrLen,data,len);
+		slot.len = (uint16_t)(hdrLen + len);
+		slot.flags = 0;
+		_tx->head = _tx->cur = nm_ring_next(_tx,_tx->cur);
+		return true;
+	}
+
+	/**
+	 * Hand frames queued by send() to the host stack
+	 */
+	inline void flush()
+	{
+		::ioctl(_fd,NIOCTXSYNC,(void *)0);
+	}
+
+private:
+	static inline uint32_t _advance(const struct netmap_ring *r,const unsigned int n)
+	{
+		uint32_t i = r->cur + n;
+		return ((i >= r->num_slots) ? (i - r->num_slots) : i);
+	}
+
+	int _fd;
+	void *_mem;
+	size_t _memSize;
+	struct netmap_if *_nifp;
+	struct netmap_ring *_rx;
+	struct netmap_ring *_tx;
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_NETMAP
+
+#endif
@@ -73,6 +73,15 @@
 // Max number of bindings
 #define ZT_BINDER_MAX_BINDINGS 256
 
+// Max number of SO_REUSEPORT UDP sockets in each binding's socket group
+#define ZT_BINDER_MAX_UDP_SOCKETS_PER_BINDING 64
+
+// How long the OS's choice of source address for a destination is cached
+#define ZT_BINDER_ROUTE_CACHE_TTL 30000
+
+// Max number of destinations with a cached source address
+#define ZT_BINDER_ROUTE_CACHE_SIZE 4096
+
 namespace ZeroTier {
 
 /**
@@ -85,35 +94,70 @@ namespace ZeroTier {
  *
  * On OSes that do not support local port enumeration or where this is not
  * meaningful, this degrades to binding to wildcard.
+ *
+ * On Linux each binding's UDP endpoint can instead be a group of SO_REUSEPORT
+ * sockets, one per supplied UDP Phy<> instance, so that the kernel spreads
+ * flows across threads each polling one of them. The first socket of a group
+ * is the one used for sends that aren't tied to a particular socket.
  */
 class Binder
 {
 private:
 	struct _Binding
 	{
-		_Binding() : udpSock((PhySocket *)0),tcpListenSock((PhySocket *)0) {}
-		PhySocket *udpSock;
+		_Binding() : udpSockCount(0),tcpListenSock((PhySocket *)0) {}
+		PhySocket *udpSocks[ZT_BINDER_MAX_UDP_SOCKETS_PER_BINDING]; // socket k belongs to UDP Phy<> k if there are any, otherwise to the main one
+		unsigned int udpSockCount;
 		PhySocket *tcpListenSock;
 		InetAddress address;
 	};
 
 public:
-	Binder() : _bindingCount(0) {}
+	/**
+	 * Drops and buffer size of a bound UDP socket
+	 */
+	struct UdpSocketStats
+	{
+		InetAddress address; // bound address
+		unsigned int socket; // index of socket in its SO_REUSEPORT group
+		uint64_t drops; // datagrams dropped on a full receive buffer
+		int bufferSize; // receive and send buffer size or 0 if unknown
+	};
+
+	Binder() : _bindingCount(0),_udpBufferCeiling(ZT_UDP_MAX_BUF_SIZE) {}
+
+	/**
+	 * Set how far UDP sockets bound after this may grow their buffers when the kernel drops datagrams
+	 *
+	 * @param maxBufferSize Largest buffer size, or 0 to keep ZT_UDP_DESIRED_BUF_SIZE and only count drops
+	 */
+	inline void setUdpBufferCeiling(int maxBufferSize) { _udpBufferCeiling = maxBufferSize; }
 
 	/**
 	 * Close all bound ports, should be called on shutdown
 	 *
+	 * The caller must make sure nothing is polling the UDP Phy<> instances
+	 * during this call, and must pass the same ones that were given to refresh().
+	 *
 	 * @param phy Physical interface
+	 * @param udpPhys Physical interfaces owning UDP socket groups or NULL if none (default: NULL)
+	 * @param udpPhyCount Number of UDP physical interfaces (default: 0)
 	 */
 	template<typename PHY_HANDLER_TYPE>
-	void closeAll(Phy<PHY_HANDLER_TYPE> &phy)
+	void closeAll(Phy<PHY_HANDLER_TYPE> &phy,Phy<PHY_HANDLER_TYPE> *const *udpPhys = (Phy<PHY_HANDLER_TYPE> *const *)0,unsigned int udpPhyCount = 0)
 	{
 		Mutex::Lock _l(_lock);
+#ifndef __LINUX__
+		udpPhys = (Phy<PHY_HANDLER_TYPE> *const *)0;
+#endif
+		if (!udpPhys)
+			udpPhyCount = 0;
 		for(unsigned int b=0,c=_bindingCount;b<c;++b) {
-			phy.close(_bindings[b].udpSock,false);
+			_closeUdp(phy,udpPhys,udpPhyCount,_bindings[b]);
 			phy.close(_bindings[b].tcpListenSock,false);
 		}
 		_bindingCount = 0;
+		_routes.clear();
 	}
 
 	/**
@@ -127,17 +171,27 @@ public:
 	 * @param portCount Number of ports
 	 * @param explicitBind If present, override interface IP detection and bind to these (if possible)
 	 * @param ifChecker Interface checker function to see if an interface should be used
+	 * @param udpPhys If non-NULL, bind a group of SO_REUSEPORT UDP sockets with one in each of these instead of one UDP socket in phy (Linux only, caller must make sure nothing is polling them during this call)
+	 * @param udpPhyCount Number of UDP physical interfaces, must not change between calls (default: 0)
 	 * @tparam PHY_HANDLER_TYPE Type for Phy<> template
 	 * @tparam INTERFACE_CHECKER Type for class containing shouldBindInterface() method
 	 */
 	template<typename PHY_HANDLER_TYPE,typename INTERFACE_CHECKER>
-	void refresh(Phy<PHY_HANDLER_TYPE> &phy,unsigned int *ports,unsigned int portCount,const std::vector<InetAddress> explicitBind,INTERFACE_CHECKER &ifChecker)
+	void refresh(Phy<PHY_HANDLER_TYPE> &phy,unsigned int *ports,unsigned int portCount,const std::vector<InetAddress> explicitBind,INTERFACE_CHECKER &ifChecker,Phy<PHY_HANDLER_TYPE> *const *udpPhys = (Phy<PHY_HANDLER_TYPE> *const *)0,unsigned int udpPhyCount = 0)
 	{
 		std::map<InetAddress,std::string> localIfAddrs;
-		PhySocket *udps,*tcps;
+		PhySocket *tcps;
 		Mutex::Lock _l(_lock);
 		bool interfacesEnumerated = true;
 
+#ifndef __LINUX__
+		udpPhys = (Phy<PHY_HANDLER_TYPE> *const *)0;
+#endif
+		if (!udpPhys)
+			udpPhyCount = 0;
+		else if (udpPhyCount > ZT_BINDER_MAX_UDP_SOCKETS_PER_BINDING)
+			udpPhyCount = ZT_BINDER_MAX_UDP_SOCKETS_PER_BINDING;
+
 		if (explicitBind.empty()) {
 #ifdef __WINDOWS__
 
@@ -343,6 +397,7 @@ public:
 
 		const unsigned int oldBindingCount = _bindingCount;
 		_bindingCount = 0;
+		_routes.clear(); // routes may have changed along with interfaces
 
 		// Save bindings that are still valid, close those that are not
 		for(unsigned int b=0;b<oldBindingCount;++b) {
@@ -351,11 +406,9 @@ public:
 					_bindings[(unsigned int)_bindingCount] = _bindings[b];
 				++_bindingCount;
 			} else {
-				PhySocket *const udps = _bindings[b].udpSock;
 				PhySocket *const tcps = _bindings[b].tcpListenSock;
-				_bindings[b].udpSock = (PhySocket *)0;
 				_bindings[b].tcpListenSock = (PhySocket *)0;
-				phy.close(udps,false);
+				_closeUdp(phy,udpPhys,udpPhyCount,_bindings[b]);
 				phy.close(tcps,false);
 			}
 		}
@@ -368,31 +421,53 @@ public:
 					break;
 				++bi;
 			}
-			if (bi == _bindingCount) {
-				udps = phy.udpBind(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0,ZT_UDP_DESIRED_BUF_SIZE);
+			if ((bi == _bindingCount)&&(_bindingCount < ZT_BINDER_MAX_BINDINGS)) {
+				_Binding &nb = _bindings[_bindingCount];
+				nb.udpSockCount = 0;
+				if (udpPhyCount) {
+					// If some of the group can't be bound keep what we got, but all of
+					// them are needed for Phy<> k to own socket k so stop at the first gap
+					while (nb.udpSockCount < udpPhyCount) {
+						PhySocket *const udps = udpPhys[nb.udpSockCount]->udpBind(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0,ZT_UDP_DESIRED_BUF_SIZE,true);
+						if (!udps)
+							break;
+						udpPhys[nb.udpSockCount]->setUdpOffload(udps);
+						udpPhys[nb.udpSockCount]->setUdpTrafficClass(udps);
+						udpPhys[nb.udpSockCount]->setUdpBufferCeiling(udps,_udpBufferCeiling);
+						nb.udpSocks[nb.udpSockCount++] = udps;
+					}
+				} else {
+					PhySocket *const udps = phy.udpBind(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0,ZT_UDP_DESIRED_BUF_SIZE);
+					if (udps) {
+						phy.setUdpOffload(udps); // GRO/GSO where the kernel supports it
+						phy.setUdpTrafficClass(udps); // DSCP and ECN of received datagrams, for underlayEcn
+						phy.setUdpBufferCeiling(udps,_udpBufferCeiling); // count receive buffer overflows and grow on them
+						nb.udpSocks[nb.udpSockCount++] = udps;
+					}
+				}
 				tcps = phy.tcpListen(reinterpret_cast<const struct sockaddr *>(&(ii->first)),(void *)0);
-				if ((udps)&&(tcps)) {
+				if ((nb.udpSockCount)&&(tcps)) {
 #ifdef __LINUX__
 					// Bind Linux sockets to their device so routes tha we manage do not override physical routes (wish all platforms had this!)
 					if (ii->second.length() > 0) {
 						char tmp[256];
 						Utils::scopy(tmp,sizeof(tmp),ii->second.c_str());
-						int fd = (int)Phy<PHY_HANDLER_TYPE>::getDescriptor(udps);
-						if (fd >= 0)
-							setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,tmp,strlen(tmp));
+						int fd;
+						for(unsigned int k=0;k<nb.udpSockCount;++k) {
+							fd = (int)Phy<PHY_HANDLER_TYPE>::getDescriptor(nb.udpSocks[k]);
+							if (fd >= 0)
+								setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,tmp,strlen(tmp));
+						}
 						fd = (int)Phy<PHY_HANDLER_TYPE>::getDescriptor(tcps);
 						if (fd >= 0)
 							setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,tmp,strlen(tmp));
 					}
 #endif // __LINUX__
-					if (_bindingCount < ZT_BINDER_MAX_BINDINGS) {
-						_bindings[_bindingCount].udpSock = udps;
-						_bindings[_bindingCount].tcpListenSock = tcps;
-						_bindings[_bindingCount].address = ii->first;
-						++_bindingCount;
-					}
+					nb.tcpListenSock = tcps;
+					nb.address = ii->first;
+					++_bindingCount;
 				} else {
-					phy.close(udps,false);
+					_closeUdp(phy,udpPhys,udpPhyCount,nb);
 					phy.close(tcps,false);
 				}
 			}
@@ -412,21 +487,66 @@ public:
 	}
 
 	/**
-	 * Send from all bound UDP sockets
+	 * Send from the bound UDP socket the OS would route through, or else from all of them
+	 *
+	 * The OS is asked which source address it would use to reach the
+	 * destination and the answer is cached. If that address is bound the
+	 * packet goes out of that binding only. Otherwise, e.g. if the lookup
+	 * fails or bindings are wildcards, it goes out of every binding.
 	 */
 	template<typename PHY_HANDLER_TYPE>
 	inline bool udpSendAll(Phy<PHY_HANDLER_TYPE> &phy,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
 	{
 		bool r = false;
 		Mutex::Lock _l(_lock);
+
+		const InetAddress src(_routeSource(addr));
+		if (src) {
+			for(unsigned int b=0,c=_bindingCount;b<c;++b) {
+				if (_bindings[b].address.ipsEqual(src)) {
+					PhySocket *const udps = _bindings[b].udpSocks[0];
+					if (ttl) phy.setIp4UdpTtl(udps,ttl);
+					r = phy.udpSend(udps,(const struct sockaddr *)addr,data,len);
+					if (ttl) phy.setIp4UdpTtl(udps,255);
+					if (r)
+						return true;
+					break;
+				}
+			}
+		}
+
 		for(unsigned int b=0,c=_bindingCount;b<c;++b) {
-			if (ttl) phy.setIp4UdpTtl(_bindings[b].udpSock,ttl);
-			if (phy.udpSend(_bindings[b].udpSock,(const struct sockaddr *)addr,data,len)) r = true;
-			if (ttl) phy.setIp4UdpTtl(_bindings[b].udpSock,255);
+			PhySocket *const udps = _bindings[b].udpSocks[0]; // only one send per group
+			if (ttl) phy.setIp4UdpTtl(udps,ttl);
+			if (phy.udpSend(udps,(const struct sockaddr *)addr,data,len)) r = true;
+			if (ttl) phy.setIp4UdpTtl(udps,255);
 		}
 		return r;
 	}
 
+	/**
+	 * Get drops and buffer sizes of all bound UDP sockets
+	 *
+	 * @param stats Filled with one entry per socket
+	 * @tparam PHY_HANDLER_TYPE Type for Phy<> template
+	 */
+	template<typename PHY_HANDLER_TYPE>
+	inline void udpSocketStats(std::vector<UdpSocketStats> &stats) const
+	{
+		Mutex::Lock _l(_lock);
+		stats.clear();
+		for(unsigned int b=0,c=_bindingCount;b<c;++b) {
+			for(unsigned int k=0;k<_bindings[b].udpSockCount;++k) {
+				stats.push_back(UdpSocketStats());
+				UdpSocketStats &st = stats.back();
+				st.address = _bindings[b].address;
+				st.socket = k;
+				st.drops = Phy<PHY_HANDLER_TYPE>::udpDrops(_bindings[b].udpSocks[k]);
+				st.bufferSize = Phy<PHY_HANDLER_TYPE>::udpBufferSize(_bindings[b].udpSocks[k]);
+			}
+		}
+	}
+
 	/**
 	 * @param addr Address to check
 	 * @return True if this is a bound local interface address
@@ -444,21 +564,85 @@ public:
 	/**
 	 * Quickly check that a UDP socket is valid
 	 *
-	 * @param udpSock UDP socket to check
+	 * @param udpSock UDP socket to check (may be any member of a socket group)
 	 * @return True if socket is currently bound/allocated
 	 */
 	inline bool isUdpSocketValid(PhySocket *const udpSock)
 	{
 		for(unsigned int b=0,c=_bindingCount;b<c;++b) {
-			if (_bindings[b].udpSock == udpSock)
-				return (b < _bindingCount); // double check atomic which may have changed
+			for(unsigned int k=0,kc=_bindings[b].udpSockCount;k<kc;++k) {
+				if (_bindings[b].udpSocks[k] == udpSock)
+					return (b < _bindingCount); // double check atomic which may have changed
+			}
 		}
 		return false;
 	}
 
 private:
+	// Source address the OS would use to reach a destination or a nil address if unknown, call with _lock held
+	inline InetAddress _routeSource(const struct sockaddr_storage *addr)
+	{
+		if ((addr->ss_family != AF_INET)&&(addr->ss_family != AF_INET6))
+			return InetAddress();
+
+		InetAddress dest(addr);
+		dest.setPort(0);
+		const int64_t now = OSUtils::now();
+		std::map<InetAddress,_Route>::iterator rt(_routes.find(dest));
+		if ((rt != _routes.end())&&(now < rt->second.expires))
+			return rt->second.source;
+
+		// Connecting a UDP socket sends nothing but makes the OS pick a route and source address
+		struct sockaddr_storage me;
+		memset(&me,0,sizeof(me));
+		bool found = false;
+#ifdef __WINDOWS__
+		int mel = sizeof(me);
+		const SOCKET s = ::socket(addr->ss_family,SOCK_DGRAM,IPPROTO_UDP);
+		if (s != INVALID_SOCKET) {
+			found = ((::connect(s,(const struct sockaddr *)addr,(addr->ss_family == AF_INET) ? (int)sizeof(struct sockaddr_in) : (int)sizeof(struct sockaddr_in6)) == 0)&&(::getsockname(s,(struct sockaddr *)&me,&mel) == 0));
+			::closesocket(s);
+		}
+#else
+		socklen_t mel = sizeof(me);
+		const int s = ::socket(addr->ss_family,SOCK_DGRAM,IPPROTO_UDP);
+		if (s >= 0) {
+			found = ((::connect(s,(const struct sockaddr *)addr,(addr->ss_family == AF_INET) ? (socklen_t)sizeof(struct sockaddr_in) : (socklen_t)sizeof(struct sockaddr_in6)) == 0)&&(::getsockname(s,(struct sockaddr *)&me,&mel) == 0));
+			::close(s);
+		}
+#endif
+
+		if (_routes.size() >= ZT_BINDER_ROUTE_CACHE_SIZE)
+			_routes.clear();
+		_Route &r = _routes[dest];
+		r.source = (found) ? InetAddress(&me) : InetAddress();
+		r.expires = now + ZT_BINDER_ROUTE_CACHE_TTL;
+		return r.source;
+	}
+
+	template<typename PHY_HANDLER_TYPE>
+	static inline void _closeUdp(Phy<PHY_HANDLER_TYPE> &phy,Phy<PHY_HANDLER_TYPE> *const *udpPhys,unsigned int udpPhyCount,_Binding &b)
+	{
+		const unsigned int c = b.udpSockCount;
+		b.udpSockCount = 0;
+		for(unsigned int k=0;k<c;++k) {
+			if (udpPhyCount)
+				udpPhys[k]->close(b.udpSocks[k],false);
+			else phy.close(b.udpSocks[k],false);
+		}
+	}
+
+	struct _Route
+	{
+		_Route() : source(),expires(0) {}
+		InetAddress source; // nil if the OS could not say
+		int64_t expires;
+	};
+
 	_Binding _bindings[ZT_BINDER_MAX_BINDINGS];
 	std::atomic<unsigned int> _bindingCount;
+	std::map<InetAddress,_Route> _routes;
+	int _udpBufferCeiling;
 	Mutex _lock;
 };
 
@@ -37,7 +37,9 @@ namespace ZeroTier {
 /**
  * Simple C++11 thread-safe queue
  *
- * Do not use in node/ since we have not gone C++11 there yet.
+ * The core in node/ may use C++11 but does not include anything from
+ * osdep/, so this and the other osdep/ queues are for the service and
+ * other code outside the core.
  */
 template <class T>
 class BlockingQueue
@@ -0,0 +1,160 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_BYTERING_HPP
+#define ZT_BYTERING_HPP
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+// Smallest allocation, and the most kept after clear()
+#define ZT_BYTERING_MIN_CAPACITY 65536
+
+namespace ZeroTier {
+
+/**
+ * Growable ring of bytes for stream write queues
+ *
+ * Appending copies onto the tail and consuming just advances the head, so
+ * neither moves what's already queued the way erasing from the front of
+ * a std::string does. Capacity doubles when an append doesn't fit and is
+ * given back on clear() if it grew past ZT_BYTERING_MIN_CAPACITY. Limits
+ * on size are up to the caller.
+ *
+ * This isn't thread safe.
+ */
+class ByteRing
+{
+public:
+	ByteRing() :
+		_buf((char *)0),
+		_cap(0),
+		_head(0),
+		_size(0)
+	{
+	}
+
+	~ByteRing() { free(_buf); }
+
+	/**
+	 * @param data Bytes to append
+	 * @param len Number of bytes
+	 */
+	inline void append(const void *data,const unsigned long len)
+	{
+		if (!len)
+			return;
+		if ((_size + len) > _cap)
+			_grow(_size + len);
+		unsigned long tail = _head + _size;
+		if (tail >= _cap)
+			tail -= _cap;
+		const unsigned long first = ((_cap - tail) < len) ? (_cap - tail) : len;
+		memcpy(_buf + tail,data,first);
+		memcpy(_buf,reinterpret_cast<const char *>(data) + first,len - first);
+		_size += len;
+	}
+
+	/**
+	 * @param len Set to the number of bytes that follow in one piece (0 if empty)
+	 * @return Pointer to the oldest bytes
+	 */
+	inline const char *front(unsigned long &len) const
+	{
+		len = ((_cap - _head) < _size) ? (_cap - _head) : _size;
+		return (_buf + _head);
+	}
+
+	/**
+	 * @param n Number of bytes to drop from the front (at most size())
+	 */
+	inline void consume(unsigned long n)
+	{
+		if (n >= _size) {
+			_head = 0;
+			_size = 0;
+		} else {
+			_head += n;
+			if (_head >= _cap)
+				_head -= _cap;
+			_size -= n;
+		}
+	}
+
+	/**
+	 * Drop everything and give back memory beyond ZT_BYTERING_MIN_CAPACITY
+	 */
+	inline void clear()
+	{
+		_head = 0;
+		_size = 0;
+		if (_cap > ZT_BYTERING_MIN_CAPACITY) {
+			free(_buf);
+			_buf = (char *)0;
+			_cap = 0;
+		}
+	}
+
+	inline unsigned long size() const { return _size; }
+	inline bool empty() const { return (_size == 0); }
+	inline unsigned long capacity() const { return _cap; }
+
+private:
+	ByteRing(const ByteRing &) {}
+	const ByteRing &operator=(const ByteRing &) { return *this; }
+
+	// Reallocates with the contents moved to the start
+	inline void _grow(const unsigned long need)
+	{
+		unsigned long c = (_cap) ? _cap : ZT_BYTERING_MIN_CAPACITY;
+		while (c < need)
+			c <<= 1;
+		char *const b = (char *)malloc(c);
+		if (!b)
+			throw std::bad_alloc();
+		unsigned long first = 0;
+		if (_size) {
+			const char *const f = front(first);
+			memcpy(b,f,first);
+			memcpy(b + first,_buf,_size - first);
+		}
+		free(_buf);
+		_buf = b;
+		_cap = c;
+		_head = 0;
+	}
+
+	char *_buf;
+	unsigned long _cap;
+	unsigned long _head;
+	unsigned long _size;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_COALESCINGQUEUE_HPP
+#define ZT_COALESCINGQUEUE_HPP
+
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace ZeroTier {
+
+/**
+ * Bounded C++11 thread-safe queue that keeps only the latest value per key
+ *
+ * Values are taken in batches. A key that has been taken isn't handed out
+ * again until done() is called for it, so updates to the same key are never
+ * committed concurrently or out of order. Posting blocks while the queue is
+ * full unless it only replaces a value that's already waiting.
+ */
+template <class K,class V,class H = std::hash<K> >
+class CoalescingQueue
+{
+public:
+	CoalescingQueue(const std::size_t maxSize) : _max(maxSize),_r(true) {}
+
+	/**
+	 * @param k Key
+	 * @param v Value
+	 * @return True if this replaced a value still waiting under this key
+	 */
+	inline bool post(const K &k,const V &v)
+	{
+		std::unique_lock<std::mutex> l(_m);
+		for(;;) {
+			typename std::unordered_map<K,V,H>::iterator e(_entries.find(k));
+			if (e != _entries.end()) {
+				e->second = v;
+				return true;
+			}
+			typename std::unordered_map<K,V,H>::iterator d(_deferred.find(k));
+			if (d != _deferred.end()) {
+				d->second = v;
+				return true;
+			}
+			if (!_r)
+				return false;
+			if ((_entries.size() + _deferred.size()) < _max)
+				break;
+			_space.wait(l);
+		}
+		if (_inFlight.count(k) != 0) {
+			_deferred[k] = v;
+		} else {
+			_add(k,v);
+			_c.notify_one();
+		}
+		return false;
+	}
+
+	inline void stop()
+	{
+		std::lock_guard<std::mutex> l(_m);
+		_r = false;
+		_c.notify_all();
+		_space.notify_all();
+	}
+
+	/**
+	 * Take a batch of values, oldest first
+	 *
+	 * @param batch Result parameter, filled with key/value pairs (may be empty on return)
+	 * @param maxBatch Maximum batch size
+	 * @param windowMs Time to let more values arrive and coalesce unless a full batch is ready
+	 * @return False if queue has been stopped
+	 */
+	inline bool get(std::vector< std::pair<K,V> > &batch,const std::size_t maxBatch,const unsigned long windowMs)
+	{
+		batch.clear();
+		std::unique_lock<std::mutex> l(_m);
+		while ((_r)&&(_entries.empty()))
+			_c.wait(l);
+		if ((_r)&&(windowMs)&&(_entries.size() < maxBatch))
+			_c.wait_for(l,std::chrono::milliseconds(windowMs),[this,maxBatch]() { return ((!_r)||(_entries.size() >= maxBatch)); });
+		if (!_r)
+			return false;
+		while ((!_order.empty())&&(batch.size() < maxBatch)) {
+			typename std::unordered_map<K,V,H>::iterator e(_entries.find(_order.front()));
+			batch.push_back(std::pair<K,V>(e->first,e->second));
+			_inFlight.insert(e->first);
+			_entries.erase(e);
+			_order.pop_front();
+		}
+		_space.notify_all();
+		return true;
+	}
+
+	/**
+	 * Release keys taken with get() once their values have been handled
+	 *
+	 * @param batch Batch returned by get()
+	 */
+	inline void done(const std::vector< std::pair<K,V> > &batch)
+	{
+		std::lock_guard<std::mutex> l(_m);
+		for(typename std::vector< std::pair<K,V> >::const_iterator b(batch.begin());b!=batch.end();++b) {
+			_inFlight.erase(b->first);
+			typename std::unordered_map<K,V,H>::iterator d(_deferred.find(b->first));
+			if (d != _deferred.end()) {
+				_add(d->first,d->second);
+				_deferred.erase(d);
+				_c.notify_one();
+			}
+		}
+	}
+
+	/**
+	 * @return Number of values waiting
+	 */
+	inline std::size_t size()
+	{
+		std::lock_guard<std::mutex> l(_m);
+		return (_entries.size() + _deferred.size());
+	}
+
+private:
+	inline void _add(const K &k,const V &v)
+	{
+		_order.push_back(k);
+		_entries[k] = v;
+	}
+
+	const std::size_t _max;
+	bool _r;
+	std::list<K> _order;
+	std::unordered_map<K,V,H> _entries; // waiting and ready to be taken
+	std::unordered_map<K,V,H> _deferred; // waiting for the same key to be done
+	std::unordered_set<K,H> _inFlight;
+	std::mutex _m;
+	std::condition_variable _c;
+	std::condition_variable _space;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_FRAMERING_HPP
+#define ZT_FRAMERING_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+namespace ZeroTier {
+
+/**
+ * Bounded lock-free queue of frames copied into fixed size slots
+ *
+ * Any number of threads may push() but only one may read. Producers claim
+ * slots by advancing a shared head and publish them with a per-slot
+ * sequence number, so they never lock or wait for each other or for the
+ * reader. When the ring is full push() drops the frame and counts it.
+ *
+ * A reader with nothing left to do calls idle() and, if that returns
+ * true, sleeps until woken. push() reports when it has just published a
+ * frame to an idle reader so the caller knows to wake it.
+ */
+class FrameRing
+{
+public:
+	/**
+	 * @param slots Number of slots (rounded up to a power of two)
+	 * @param maxLength Largest frame a slot holds
+	 */
+	FrameRing(const unsigned int slots,const unsigned int maxLength) :
+		_maxLength(maxLength),
+		_head(0),
+		_idle(true),
+		_drops(0),
+		_tail(0)
+	{
+		unsigned int n = 1;
+		while (n < slots)
+			n <<= 1;
+		_mask = n - 1;
+		_seq = new std::atomic<uint64_t>[n];
+		for(unsigned int i=0;i<n;++i)
+			_seq[i].store(i,std::memory_order_relaxed);
+		_len = new unsigned int[n];
+		_data = new char[(size_t)n * (size_t)maxLength];
+	}
+
+	~FrameRing()
+	{
+		delete [] _seq;
+		delete [] _len;
+		delete [] _data;
+	}
+
+	/**
+	 * Copy a frame into the ring (any thread)
+	 *
+	 * @param hdr Header to copy in front of the frame data
+	 * @param hdrLen Length of header
+	 * @param data Frame data
+	 * @param len Length of frame data
+	 * @param wake Set to true if the reader was idle and should be woken
+	 * @return False if the frame was dropped because the ring is full or it's too big
+	 */
+	inline bool push(const void *hdr,const unsigned int hdrLen,const void *data,const unsigned int len,bool &wake)
+	{
+		wake = false;
+		if ((hdrLen + len) > _maxLength) {
+			_drops.fetch_add(1,std::memory_order_relaxed);
+			return false;
+		}
+		uint64_t pos = _head.load(std::memory_order_relaxed);
+		for(;;) {
+			const int64_t d = (int64_t)(_seq[pos & _mask].load(std::memory_order_acquire) - pos);
+			if (d == 0) {
+				if (_head.compare_exchange_weak(pos,pos + 1,std::memory_order_relaxed))
+					break;
+			} else if (d < 0) { // the reader hasn't freed this slot yet, so the ring is full
+				_drops.fetch_add(1,std::memory_order_relaxed);
+				return false;
+			} else {
+				pos = _head.load(std::memory_order_relaxed);
+			}
+		}
+		const unsigned int i = (unsigned int)(pos & _mask);
+		char *const s = _data + ((size_t)i * (size_t)_maxLength);
+		memcpy(s,hdr,hdrLen);
+		memcpy(s + hdrLen,data,len);
+		_len[i] = hdrLen + len;
+		_seq[i].store(pos + 1,std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in idle()
+		wake = ((_idle.load(std::memory_order_relaxed))&&(_idle.exchange(false)));
+		return true;
+	}
+
+	/**
+	 * Get the oldest frame (reader only)
+	 *
+	 * @param len Set to frame length (header plus data)
+	 * @return Frame, valid until pop(), or NULL if the ring is empty
+	 */
+	inline const char *front(unsigned int &len) const
+	{
+		const unsigned int i = (unsigned int)(_tail & _mask);
+		if (_seq[i].load(std::memory_order_acquire) != (_tail + 1))
+			return (const char *)0;
+		len = _len[i];
+		return _data + ((size_t)i * (size_t)_maxLength);
+	}
+
+	/**
+	 * Free the oldest frame's slot (reader only)
+	 */
+	inline void pop()
+	{
+		_seq[_tail & _mask].store(_tail + _mask + 1,std::memory_order_release);
+		++_tail;
+	}
+
+	/**
+	 * Mark the reader idle if the ring is empty (reader only)
+	 *
+	 * @return True if the reader may sleep, false if frames arrived and it should keep reading
+	 */
+	inline bool idle()
+	{
+		_idle.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		unsigned int len;
+		if (front(len)) {
+			_idle.store(false);
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @return Number of frames dropped so far
+	 */
+	inline uint64_t drops() const { return _drops.load(std::memory_order_relaxed); }
+
+private:
+	FrameRing(const FrameRing &) = delete;
+	FrameRing &operator=(const FrameRing &) = delete;
+
+	unsigned int _mask;
+	const unsigned int _maxLength;
+	std::atomic<uint64_t> *_seq;
+	unsigned int *_len;
+	char *_data;
+
+	// Shared by producers, kept away from the reader's own state
+	char _pad0[64];
+	std::atomic<uint64_t> _head;
+	std::atomic<bool> _idle;
+	std::atomic<uint64_t> _drops;
+	char _pad1[64];
+
+	uint64_t _tail;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_INTERFACEMONITOR_HPP
+#define ZT_INTERFACEMONITOR_HPP
+
+#include "../node/Constants.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <Windows.h>
+#include <netioapi.h>
+#include <iphlpapi.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <net/if.h>
+#ifdef __LINUX__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+#ifdef __BSD__
+#include <net/route.h>
+#endif
+#endif
+
+#include <atomic>
+#include <set>
+#include <string>
+
+#include "Phy.hpp"
+
+#ifdef __LINUX__
+// Multicast membership notifications, in kernels since 6.13 but not yet in all headers
+#ifndef RTNLGRP_IPV4_MCADDR
+#define RTNLGRP_IPV4_MCADDR 37
+#endif
+#ifndef RTNLGRP_IPV6_MCADDR
+#define RTNLGRP_IPV6_MCADDR 38
+#endif
+#ifndef RTM_NEWMULTICAST
+#define RTM_NEWMULTICAST 56
+#endif
+#ifndef RTM_DELMULTICAST
+#define RTM_DELMULTICAST 57
+#endif
+#endif
+
+namespace ZeroTier {
+
+/**
+ * Listens for OS notifications of interface and address changes
+ *
+ * Linux uses an rtnetlink socket subscribed to link and address groups and
+ * BSD and macOS use a routing socket. Both are added to the caller's Phy<>
+ * and whatever it reads from them must be passed to received() from the
+ * phyOnUnixData() handler. Windows registers NotifyIpInterfaceChange() and
+ * NotifyUnicastIpAddressChange() callbacks that run on a system thread.
+ *
+ * Either way changed() tells the I/O loop that it should refresh bindings
+ * now rather than waiting for the next periodic sweep.
+ *
+ * Where the OS also reports multicast group joins and leaves (Linux 6.13+
+ * and BSD), multicastChanged() names the devices whose groups or addresses
+ * changed so only their memberships need to be rescanned.
+ */
+class InterfaceMonitor
+{
+public:
+	InterfaceMonitor() :
+		_sock((PhySocket *)0),
+#ifdef __WINDOWS__
+		_ifHandle((HANDLE)0),
+		_addrHandle((HANDLE)0),
+#endif
+		_multicastMonitored(false),
+		_changed(false) {}
+
+	~InterfaceMonitor()
+	{
+#ifdef __WINDOWS__
+		if (_ifHandle)
+			CancelMibChangeNotify2(_ifHandle);
+		if (_addrHandle)
+			CancelMibChangeNotify2(_addrHandle);
+#endif
+	}
+
+	/**
+	 * Start listening, or restart if the notification socket was closed
+	 *
+	 * @param phy Physical interface whose poll loop should watch the notification socket
+	 * @return True if changes will be reported, false if only periodic refresh will notice them
+	 */
+	template<typename PHY_HANDLER_TYPE>
+	inline bool start(Phy<PHY_HANDLER_TYPE> &phy)
+	{
+#ifdef __WINDOWS__
+		if (!_ifHandle) {
+			if (NotifyIpInterfaceChange(AF_UNSPEC,&InterfaceMonitor::_ifCallback,this,FALSE,&_ifHandle) != NO_ERROR)
+				_ifHandle = (HANDLE)0;
+		}
+		if (!_addrHandle) {
+			if (NotifyUnicastIpAddressChange(AF_UNSPEC,&InterfaceMonitor::_addrCallback,this,FALSE,&_addrHandle) != NO_ERROR)
+				_addrHandle = (HANDLE)0;
+		}
+		return ((_ifHandle)||(_addrHandle));
+#else
+		if (_sock)
+			return true;
+		int fd = -1;
+#ifdef __LINUX__
+		fd = ::socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC,NETLINK_ROUTE);
+		if (fd >= 0) {
+			struct sockaddr_nl sa;
+			memset(&sa,0,sizeof(sa));
+			sa.nl_family = AF_NETLINK;
+			sa.nl_groups = RTMGRP_LINK|RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+			if (::bind(fd,reinterpret_cast<const struct sockaddr *>(&sa),sizeof(sa)) != 0) {
+				::close(fd);
+				fd = -1;
+			} else {
+				int g4 = RTNLGRP_IPV4_MCADDR,g6 = RTNLGRP_IPV6_MCADDR;
+				_multicastMonitored = ((::setsockopt(fd,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&g4,sizeof(g4)) == 0)&&(::setsockopt(fd,SOL_NETLINK,NETLINK_ADD_MEMBERSHIP,&g6,sizeof(g6)) == 0));
+			}
+		}
+#endif
+#ifdef __BSD__
+		fd = ::socket(PF_ROUTE,SOCK_RAW,AF_UNSPEC);
+#ifdef RTM_NEWMADDR
+		_multicastMonitored = (fd >= 0);
+#endif
+#endif
+		if (fd < 0)
+			return false;
+		fcntl(fd,F_SETFL,O_NONBLOCK);
+		_sock = phy.wrapSocket(fd,(void *)this);
+		if (!_sock) {
+			::close(fd);
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	/**
+	 * Check messages read from the notification socket
+	 *
+	 * @param data Data read from socket()
+	 * @param len Length of data
+	 */
+	inline void received(const void *data,unsigned long len)
+	{
+#ifdef __LINUX__
+		int l = (int)len;
+		for(const struct nlmsghdr *nh=reinterpret_cast<const struct nlmsghdr *>(data);NLMSG_OK(nh,l);nh=NLMSG_NEXT(nh,l)) {
+			switch(nh->nlmsg_type) {
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+					_changed = true;
+					// fall through, addresses determine address resolution groups
+				case RTM_NEWMULTICAST:
+				case RTM_DELMULTICAST:
+					if (nh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+						_multicastDevice(reinterpret_cast<const struct ifaddrmsg *>(NLMSG_DATA(nh))->ifa_index);
+					break;
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+					_changed = true;
+					break;
+			}
+		}
+#endif
+#ifdef __BSD__
+		for(unsigned long i=0;(i + sizeof(struct rt_msghdr)) <= len;) {
+			const struct rt_msghdr *rtm = reinterpret_cast<const struct rt_msghdr *>(reinterpret_cast<const char *>(data) + i);
+			if (rtm->rtm_msglen == 0)
+				break;
+			if (rtm->rtm_version == RTM_VERSION) {
+				switch(rtm->rtm_type) {
+					case RTM_NEWADDR:
+					case RTM_DELADDR:
+						_changed = true;
+						_multicastDevice(reinterpret_cast<const struct ifa_msghdr *>(rtm)->ifam_index);
+						break;
+#ifdef RTM_NEWMADDR
+					case RTM_NEWMADDR:
+					case RTM_DELMADDR:
+						_multicastDevice(reinterpret_cast<const struct ifma_msghdr *>(rtm)->ifmam_index);
+						break;
+#endif
+					case RTM_IFINFO:
+#ifdef RTM_IFANNOUNCE
+					case RTM_IFANNOUNCE:
+#endif
+						_changed = true;
+						break;
+				}
+			}
+			i += rtm->rtm_msglen;
+		}
+#endif
+	}
+
+	/**
+	 * Forget the notification socket after Phy<> has closed it
+	 *
+	 * Notifications may have been lost, so this counts as a change. The next
+	 * start() opens a new socket.
+	 */
+	inline void closed()
+	{
+		_sock = (PhySocket *)0;
+		_changed = true;
+	}
+
+	/**
+	 * @return Notification socket or NULL if none
+	 */
+	inline PhySocket *socket() const { return _sock; }
+
+	/**
+	 * @return True if a change has been reported since the last call
+	 */
+	inline bool changed() { return _changed.exchange(false); }
+
+	/**
+	 * @return True if multicast membership changes are reported, so periodic multicast group scans can be infrequent
+	 */
+	inline bool multicastMonitored() const { return ((_sock)&&(_multicastMonitored)); }
+
+	/**
+	 * Get devices whose multicast groups or addresses changed since the last call
+	 *
+	 * This must be called from the same thread that calls received().
+	 *
+	 * @param devices Set to fill with device names
+	 * @return True if any devices were added to the set
+	 */
+	inline bool multicastChanged(std::set<std::string> &devices)
+	{
+		if (_multicastDevices.empty())
+			return false;
+		devices.insert(_multicastDevices.begin(),_multicastDevices.end());
+		_multicastDevices.clear();
+		return true;
+	}
+
+private:
+#ifndef __WINDOWS__
+	inline void _multicastDevice(const unsigned int ifindex)
+	{
+		char name[IF_NAMESIZE + 1];
+		if (if_indextoname(ifindex,name))
+			_multicastDevices.insert(std::string(name));
+	}
+#endif
+
+#ifdef __WINDOWS__
+	static VOID NETIOAPI_API_ _ifCallback(PVOID context,PMIB_IPINTERFACE_ROW row,MIB_NOTIFICATION_TYPE type) { reinterpret_cast<InterfaceMonitor *>(context)->_changed = true; }
+	static VOID NETIOAPI_API_ _addrCallback(PVOID context,PMIB_UNICASTIPADDRESS_ROW row,MIB_NOTIFICATION_TYPE type) { reinterpret_cast<InterfaceMonitor *>(context)->_changed = true; }
+#endif
+
+	InterfaceMonitor(const InterfaceMonitor &) {}
+	inline InterfaceMonitor &operator=(const InterfaceMonitor &) { return *this; }
+
+	PhySocket *_sock;
+#ifdef __WINDOWS__
+	HANDLE _ifHandle;
+	HANDLE _addrHandle;
+#endif
+	bool _multicastMonitored;
+	std::atomic<bool> _changed;
+	std::set<std::string> _multicastDevices;
+};
+
+} // namespace ZeroTier
+
+#endif
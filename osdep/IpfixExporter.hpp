@@ -0,0 +1,385 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_IPFIXEXPORTER_HPP
+#define ZT_IPFIXEXPORTER_HPP
+
+#include "../node/Constants.hpp"
+#include "../node/InetAddress.hpp"
+#include "../include/ZeroTierOne.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __WINDOWS__
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Largest IPFIX message sent, so messages are never fragmented on common paths
+#define ZT_IPFIX_MAX_MESSAGE 1400
+
+// Frames sampled per thread if no rate is configured
+#define ZT_IPFIX_DEFAULT_SAMPLE_RATE 100
+
+// How often (ms) ended flows are taken from the node and sent
+#define ZT_IPFIX_EXPORT_INTERVAL 1000
+
+// How often (ms) templates are sent again, since a UDP collector may have missed them or restarted
+#define ZT_IPFIX_TEMPLATE_INTERVAL 60000
+
+// Template IDs for IPv4, IPv6, and other flows
+#define ZT_IPFIX_TEMPLATE_IPV4 256
+#define ZT_IPFIX_TEMPLATE_IPV6 257
+#define ZT_IPFIX_TEMPLATE_OTHER 258
+
+namespace ZeroTier {
+
+/**
+ * Sends sampled flow records from ZT_Node_flowRecords() to a collector as IPFIX over UDP
+ *
+ * Records use standard information elements (RFC 7011 and the IANA IPFIX
+ * registry): the network ID is layer2SegmentId, the verdict is
+ * forwardingStatus (forwarded or dropped), and counts are as sampled with
+ * samplingPacketInterval giving the rate. If an enterprise number is given
+ * the member addresses are also sent as its elements 1 (source) and 2
+ * (destination). A thread of its own takes records from the node once a
+ * second and sends them in messages of at most ZT_IPFIX_MAX_MESSAGE bytes.
+ */
+class IpfixExporter
+{
+public:
+	IpfixExporter() :
+		_node((ZT_Node *)0),
+		_domain(0),
+		_enterprise(0),
+		_sequence(0)
+	{
+		_run.store(false);
+	}
+
+	~IpfixExporter() { stop(); }
+
+	/**
+	 * Start sampling and exporting, replacing any export in progress
+	 *
+	 * @param node Node to take records from
+	 * @param collector IP and port of collector
+	 * @param sampleRate Count one in this many frames on each thread
+	 * @param domain Observation domain ID
+	 * @param enterprise Private enterprise number for member addresses, or 0 to leave them out
+	 * @return False if a socket could not be opened
+	 */
+	inline bool start(ZT_Node *node,const InetAddress &collector,const unsigned int sampleRate,const uint32_t domain,const uint32_t enterprise)
+	{
+		stop();
+		if ((collector.ss_family != AF_INET)&&(collector.ss_family != AF_INET6))
+			return false;
+#ifdef __WINDOWS__
+		_sock = ::socket(collector.ss_family,SOCK_DGRAM,IPPROTO_UDP);
+		if (_sock == INVALID_SOCKET)
+			return false;
+#else
+		_sock = ::socket(collector.ss_family,SOCK_DGRAM,0);
+		if (_sock < 0)
+			return false;
+#endif
+		_node = node;
+		_collector = collector;
+		_domain = domain;
+		_enterprise = enterprise;
+		_sequence = 0;
+		ZT_Node_setFlowSampling(node,(sampleRate) ? sampleRate : 1);
+		_run.store(true);
+		_thread = std::thread(&IpfixExporter::_threadMain,this);
+		return true;
+	}
+
+	/**
+	 * Stop sampling and exporting, after sending records of flows that have already ended
+	 */
+	inline void stop()
+	{
+		if (!_thread.joinable())
+			return;
+		ZT_Node_setFlowSampling(_node,0);
+		_run.store(false);
+		_thread.join();
+#ifdef __WINDOWS__
+		::closesocket(_sock);
+#else
+		::close(_sock);
+#endif
+	}
+
+	/**
+	 * @return True if exporting
+	 */
+	inline bool running() const { return _thread.joinable(); }
+
+	/**
+	 * Encode one IPFIX message
+	 *
+	 * @param buf Buffer of at least ZT_IPFIX_MAX_MESSAGE bytes
+	 * @param records Records to encode
+	 * @param count Number of records
+	 * @param templates If true begin with template set
+	 * @param exportTime Export time in seconds since epoch
+	 * @param sequence Data records sent before this message
+	 * @param domain Observation domain ID
+	 * @param enterprise Private enterprise number for member addresses, or 0 to leave them out
+	 * @param consumed Set to number of records encoded (fewer than count if message is full)
+	 * @return Message length in bytes
+	 */
+	static inline unsigned int encode(uint8_t *buf,const ZT_FlowRecord *records,const unsigned int count,const bool templates,const uint32_t exportTime,const uint32_t sequence,const uint32_t domain,const uint32_t enterprise,unsigned int &consumed)
+	{
+		unsigned int p = 16;
+
+		if (templates) {
+			const unsigned int setStart = p;
+			p += 4;
+			for(unsigned int t=ZT_IPFIX_TEMPLATE_IPV4;t<=ZT_IPFIX_TEMPLATE_OTHER;++t) {
+				_Field f[_MAX_FIELDS];
+				const unsigned int n = _fields(t,enterprise,f);
+				_u16(buf + p,t);
+				_u16(buf + p + 2,n);
+				p += 4;
+				for(unsigned int i=0;i<n;++i) {
+					_u16(buf + p,(f[i].enterprise) ? (f[i].id | 0x8000) : f[i].id);
+					_u16(buf + p + 2,f[i].len);
+					p += 4;
+					if (f[i].enterprise) {
+						_u32(buf + p,enterprise);
+						p += 4;
+					}
+				}
+			}
+			_u16(buf + setStart,2);
+			_u16(buf + setStart + 2,p - setStart);
+		}
+
+		unsigned int setStart = 0,setTemplate = 0;
+		consumed = 0;
+		while (consumed < count) {
+			const ZT_FlowRecord &r = records[consumed];
+			const unsigned int t = _template(r);
+			_Field f[_MAX_FIELDS];
+			const unsigned int n = _fields(t,enterprise,f);
+			unsigned int len = 0;
+			for(unsigned int i=0;i<n;++i)
+				len += f[i].len;
+			if ((p + len + ((t != setTemplate) ? 4 : 0)) > ZT_IPFIX_MAX_MESSAGE)
+				break;
+			if (t != setTemplate) {
+				if (setTemplate)
+					_u16(buf + setStart + 2,p - setStart);
+				setStart = p;
+				setTemplate = t;
+				_u16(buf + p,t);
+				p += 4;
+			}
+			for(unsigned int i=0;i<n;++i)
+				p += _value(buf + p,f[i],r);
+			++consumed;
+		}
+		if (setTemplate)
+			_u16(buf + setStart + 2,p - setStart);
+
+		_u16(buf,10);
+		_u16(buf + 2,p);
+		_u32(buf + 4,exportTime);
+		_u32(buf + 8,sequence);
+		_u32(buf + 12,domain);
+		return p;
+	}
+
+private:
+	enum {
+		_IE_OCTETS = 1,
+		_IE_PACKETS = 2,
+		_IE_PROTOCOL = 4,
+		_IE_SOURCE_PORT = 7,
+		_IE_SOURCE_IPV4 = 8,
+		_IE_DEST_PORT = 11,
+		_IE_DEST_IPV4 = 12,
+		_IE_SOURCE_IPV6 = 27,
+		_IE_DEST_IPV6 = 28,
+		_IE_FLOW_DIRECTION = 61,
+		_IE_FORWARDING_STATUS = 89,
+		_IE_START = 152,
+		_IE_END = 153,
+		_IE_ETHERTYPE = 256,
+		_IE_SAMPLING_INTERVAL = 305,
+		_IE_SEGMENT = 351,
+		_IE_SOURCE_MEMBER = 1, // with enterprise number
+		_IE_DEST_MEMBER = 2, // with enterprise number
+		_MAX_FIELDS = 16
+	};
+
+	struct _Field
+	{
+		uint16_t id;
+		uint16_t len;
+		bool enterprise;
+	};
+
+	static inline unsigned int _template(const ZT_FlowRecord &r)
+	{
+		switch(r.sourceIp.ss_family) {
+			case AF_INET: return ZT_IPFIX_TEMPLATE_IPV4;
+			case AF_INET6: return ZT_IPFIX_TEMPLATE_IPV6;
+		}
+		return ZT_IPFIX_TEMPLATE_OTHER;
+	}
+
+	static inline unsigned int _fields(const unsigned int t,const uint32_t enterprise,_Field *f)
+	{
+		unsigned int n = 0;
+#define ZT_IPFIX_FIELD(i,l,e) { f[n].id = (i); f[n].len = (l); f[n].enterprise = (e); ++n; }
+		ZT_IPFIX_FIELD(_IE_START,8,false);
+		ZT_IPFIX_FIELD(_IE_END,8,false);
+		ZT_IPFIX_FIELD(_IE_PACKETS,8,false);
+		ZT_IPFIX_FIELD(_IE_OCTETS,8,false);
+		ZT_IPFIX_FIELD(_IE_SEGMENT,8,false);
+		ZT_IPFIX_FIELD(_IE_ETHERTYPE,2,false);
+		ZT_IPFIX_FIELD(_IE_FLOW_DIRECTION,1,false);
+		ZT_IPFIX_FIELD(_IE_FORWARDING_STATUS,1,false);
+		ZT_IPFIX_FIELD(_IE_SAMPLING_INTERVAL,4,false);
+		if (t == ZT_IPFIX_TEMPLATE_IPV4) {
+			ZT_IPFIX_FIELD(_IE_SOURCE_IPV4,4,false);
+			ZT_IPFIX_FIELD(_IE_DEST_IPV4,4,false);
+		} else if (t == ZT_IPFIX_TEMPLATE_IPV6) {
+			ZT_IPFIX_FIELD(_IE_SOURCE_IPV6,16,false);
+			ZT_IPFIX_FIELD(_IE_DEST_IPV6,16,false);
+		}
+		if (t != ZT_IPFIX_TEMPLATE_OTHER) {
+			ZT_IPFIX_FIELD(_IE_PROTOCOL,1,false);
+			ZT_IPFIX_FIELD(_IE_SOURCE_PORT,2,false);
+			ZT_IPFIX_FIELD(_IE_DEST_PORT,2,false);
+		}
+		if (enterprise) {
+			ZT_IPFIX_FIELD(_IE_SOURCE_MEMBER,8,true);
+			ZT_IPFIX_FIELD(_IE_DEST_MEMBER,8,true);
+		}
+#undef ZT_IPFIX_FIELD
+		return n;
+	}
+
+	static inline unsigned int _value(uint8_t *p,const _Field &f,const ZT_FlowRecord &r)
+	{
+		const InetAddress &src = *reinterpret_cast<const InetAddress *>(&(r.sourceIp));
+		const InetAddress &dst = *reinterpret_cast<const InetAddress *>(&(r.destinationIp));
+		if (f.enterprise) {
+			_u64(p,(f.id == _IE_SOURCE_MEMBER) ? r.source : r.destination);
+			return 8;
+		}
+		switch(f.id) {
+			case _IE_START: _u64(p,(uint64_t)r.start); break;
+			case _IE_END: _u64(p,(uint64_t)r.end); break;
+			case _IE_PACKETS: _u64(p,r.packets); break;
+			case _IE_OCTETS: _u64(p,r.bytes); break;
+			case _IE_SEGMENT: _u64(p,r.networkId); break;
+			case _IE_ETHERTYPE: _u16(p,r.etherType); break;
+			case _IE_FLOW_DIRECTION: p[0] = (r.outbound) ? 1 : 0; break; // egress from our tap into the network, or ingress
+			case _IE_FORWARDING_STATUS: p[0] = (r.accepted) ? 64 : 128; break; // forwarded or dropped, reason unknown
+			case _IE_SAMPLING_INTERVAL: _u32(p,r.sampleRate); break;
+			case _IE_SOURCE_IPV4:
+			case _IE_SOURCE_IPV6: memcpy(p,src.rawIpData(),f.len); break;
+			case _IE_DEST_IPV4:
+			case _IE_DEST_IPV6: memcpy(p,dst.rawIpData(),f.len); break;
+			case _IE_PROTOCOL: p[0] = (uint8_t)r.protocol; break;
+			case _IE_SOURCE_PORT: _u16(p,src.port()); break;
+			case _IE_DEST_PORT: _u16(p,dst.port()); break;
+		}
+		return f.len;
+	}
+
+	static inline void _u16(uint8_t *p,const unsigned int v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+	static inline void _u32(uint8_t *p,const uint32_t v) { _u16(p,v >> 16); _u16(p + 2,v & 0xffff); }
+	static inline void _u64(uint8_t *p,const uint64_t v) { _u32(p,(uint32_t)(v >> 32)); _u32(p + 4,(uint32_t)v); }
+
+	inline void _threadMain()
+	{
+		std::vector<ZT_FlowRecord> records(256);
+		uint8_t buf[ZT_IPFIX_MAX_MESSAGE];
+		int64_t lastTemplates = 0;
+		bool running = true;
+		while (running) {
+			for(unsigned int t=0;(t<ZT_IPFIX_EXPORT_INTERVAL)&&(_run.load());t+=100)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			running = _run.load();
+
+			for(;;) {
+				const unsigned int n = ZT_Node_flowRecords(_node,records.data(),(unsigned int)records.size());
+				const int64_t now = (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+				bool templates = ((now - lastTemplates) >= ZT_IPFIX_TEMPLATE_INTERVAL);
+				unsigned int sent = 0;
+				while ((sent < n)||(templates)) {
+					unsigned int consumed = 0;
+					const unsigned int len = encode(buf,records.data() + sent,n - sent,templates,(uint32_t)(now / 1000),_sequence,_domain,_enterprise,consumed);
+					::sendto(_sock,(const char *)buf,(int)len,0,reinterpret_cast<const struct sockaddr *>(&_collector),(_collector.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+					if (templates) {
+						lastTemplates = now;
+						templates = false;
+					}
+					_sequence += consumed;
+					sent += consumed;
+				}
+				if (n < (unsigned int)records.size())
+					break;
+			}
+		}
+	}
+
+	ZT_Node *_node;
+	InetAddress _collector;
+	uint32_t _domain;
+	uint32_t _enterprise;
+	uint32_t _sequence;
+#ifdef __WINDOWS__
+	SOCKET _sock;
+#else
+	int _sock;
+#endif
+	std::atomic<bool> _run;
+	std::thread _thread;
+};
+
+} // namespace ZeroTier
+
+#endif
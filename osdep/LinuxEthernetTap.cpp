@@ -37,16 +37,38 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <net/if_arp.h>
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
 #include <linux/if_addr.h>
 #include <linux/if_ether.h>
 #include <ifaddrs.h>
 
+// Older headers lack UDP segmentation offload (Linux 6.2 and newer)
+#ifndef TUN_F_USO4
+#define TUN_F_USO4 0x20
+#endif
+#ifndef TUN_F_USO6
+#define TUN_F_USO6 0x40
+#endif
+
+// From linux/virtio_net.h, which can't be included from C++
+#define ZT_VNET_HDR_F_NEEDS_CSUM 1
+#define ZT_VNET_HDR_F_DATA_VALID 2
+#define ZT_VNET_HDR_GSO_NONE 0
+#define ZT_VNET_HDR_GSO_TCPV4 1
+#define ZT_VNET_HDR_GSO_TCPV6 4
+#define ZT_VNET_HDR_GSO_UDP_L4 5
+#define ZT_VNET_HDR_GSO_ECN 0x80
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <utility>
 #include <string>
 
@@ -55,7 +77,9 @@
 #include "../node/Mutex.hpp"
 #include "../node/Dictionary.hpp"
 #include "OSUtils.hpp"
+#include "Phy.hpp"
 #include "LinuxEthernetTap.hpp"
+#include "LinuxTapFilter.hpp"
 
 // ff:ff:ff:ff:ff:ff with no ADI
 static const ZeroTier::MulticastGroup _blindWildcardMulticastGroup(ZeroTier::MAC(0xff),0);
@@ -63,6 +87,200 @@ static const ZeroTier::MulticastGroup _blindWildcardMulticastGroup(ZeroTier::MAC
 namespace ZeroTier {
 
 static Mutex __tapCreateLock;
+static volatile bool __tapIoUring = false;
+static volatile unsigned int __tapQueues = 1;
+static volatile bool __tapOffload = false;
+static volatile unsigned int __tapOutputQueue = 0;
+static std::vector<unsigned int> __tapCpus;
+static unsigned int __tapNextCpu = 0;
+static Mutex __tapCpusLock;
+static volatile unsigned long __tapBusyPoll = 0;
+static volatile unsigned int __tapThreads = 0;
+
+// Pin the calling reader thread to the next CPU set with setCpus(), if any
+static void _pinTapThread()
+{
+	Mutex::Lock _l(__tapCpusLock);
+	if (!__tapCpus.empty())
+		Utils::pinThread(__tapCpus[__tapNextCpu++ % __tapCpus.size()]);
+}
+
+// Header in front of frames on taps with IFF_VNET_HDR (_VnetHdr, in host byte order)
+struct _VnetHdr
+{
+	uint8_t flags;
+	uint8_t gso_type;
+	uint16_t hdr_len;
+	uint16_t gso_size;
+	uint16_t csum_start;
+	uint16_t csum_offset;
+};
+
+// Taps with coalesced frames pending on this thread, see LinuxEthernetTap::PutBatch
+struct _TapPutBatch
+{
+	unsigned int depth;
+	unsigned int count;
+	LinuxEthernetTap *taps[ZT_TAP_PUT_BATCH_TAPS];
+};
+static thread_local _TapPutBatch __tapPutBatch = { 0,0,{} };
+
+static inline unsigned int _get16(const uint8_t *p) { return (((unsigned int)p[0] << 8) | (unsigned int)p[1]); }
+static inline void _put16(uint8_t *p,const unsigned int v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static inline uint32_t _get32(const uint8_t *p) { return (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]); }
+static inline void _put32(uint8_t *p,const uint32_t v) { p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v; }
+
+// Internet checksum, summed as big-endian 16-bit words
+static inline uint32_t _sum(const uint8_t *p,unsigned int len,uint32_t s)
+{
+	while (len > 1) {
+		s += _get16(p);
+		p += 2;
+		len -= 2;
+	}
+	if (len)
+		s += ((uint32_t)p[0] << 8);
+	return s;
+}
+static inline unsigned int _fold(uint32_t s)
+{
+	while (s >> 16)
+		s = (s & 0xffff) + (s >> 16);
+	return s;
+}
+
+// Sum of the TCP or UDP pseudo-header for a frame, given the offset and length of its transport header and payload
+static inline uint32_t _pseudoSum(const uint8_t *frame,const bool v6,const unsigned int proto,const unsigned int l4len)
+{
+	return (v6 ? _sum(frame + 22,32,0) : _sum(frame + 26,8,0)) + proto + l4len;
+}
+
+// Polls queues of many taps with one Phy<>. Like UDP socket group threads in
+// OneService, it holds its lock while polling and is paused to modify its Phy<>.
+class LinuxEthernetTap::_SharedThread
+{
+public:
+	_SharedThread() :
+		_phy(this,false,false),
+		_batch((_RxBatch *)0),
+		_bufs((char *)0)
+	{
+		_pausers.store(0);
+		_phy.setBusyPoll(__tapBusyPoll,false);
+		_thread = Thread::start(this);
+	}
+
+	/**
+	 * @return Next thread in the pool to give a queue to, started if need be (call with __tapCreateLock held)
+	 */
+	static inline _SharedThread &next()
+	{
+		// Never destroyed, since taps may still be using them at exit
+		static std::vector<_SharedThread *> pool;
+		static unsigned int n = 0;
+		const unsigned int i = n++ % __tapThreads;
+		while (pool.size() <= i)
+			pool.push_back(new _SharedThread());
+		return *pool[i];
+	}
+
+	/**
+	 * @param f Queue to poll, with tap and fd set
+	 * @return True if registered (f.thread and f.sock are set)
+	 */
+	inline bool add(_SharedFd &f)
+	{
+		// Phy<> closes what it wraps, so it gets a duplicate
+		const int fd = ::fcntl(f.fd,F_DUPFD_CLOEXEC,0);
+		if (fd < 0)
+			return false;
+		_pause();
+		f.thread = this;
+		f.sock = _phy.wrapSocket(fd,(void *)&f);
+		_resume();
+		if (!f.sock) {
+			::close(fd);
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Stop polling a queue, waiting for anything reading it to finish
+	 *
+	 * @param f Queue registered with add()
+	 */
+	inline void remove(_SharedFd &f)
+	{
+		_pause();
+		if (f.sock)
+			_phy.close(f.sock,false);
+		f.sock = (void *)0;
+		_resume();
+	}
+
+	void threadMain()
+		throw()
+	{
+		_pinTapThread();
+		_RxBatch b(true);
+		std::vector<char> bufs(ZT_TAP_READ_BATCH * ZT_TAP_OFFLOAD_FRAME_SIZE);
+		_batch = &b;
+		_bufs = bufs.data();
+		for(;;) {
+			if (_pausers.load()) {
+				Thread::sleep(1);
+				continue;
+			}
+			Mutex::Lock _l(_lock);
+			_phy.poll(0);
+		}
+	}
+
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+	{
+		_SharedFd &f = *reinterpret_cast<_SharedFd *>(*uptr);
+		if (&f == &(f.tap->_shared[ZT_TAP_MAX_QUEUES])) // Phy<> read the eventfd, so it's not idle anymore
+			f.tap->_drainOutput();
+		else f.tap->_readShared(*_batch,(int)Phy<_SharedThread *>::getDescriptor(sock),(char *)data,(unsigned int)len,_bufs);
+	}
+
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr)
+	{
+		reinterpret_cast<_SharedFd *>(*uptr)->sock = (void *)0; // read error, and Phy<> closed its duplicate
+	}
+
+	inline void phyOnDatagrams(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *datagrams,unsigned int count) {}
+	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success) {}
+	inline void phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from) {}
+	inline void phyOnTcpClose(PhySocket *sock,void **uptr) {}
+	inline void phyOnTcpData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnTcpWritable(PhySocket *sock,void **uptr) {}
+	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
+	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
+	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip_invoked) {}
+
+private:
+	inline void _pause()
+	{
+		++_pausers;
+		_phy.whack();
+		_lock.lock();
+	}
+
+	inline void _resume()
+	{
+		_lock.unlock();
+		--_pausers;
+	}
+
+	Phy<_SharedThread *> _phy;
+	Mutex _lock;
+	std::atomic<unsigned int> _pausers;
+	Thread _thread;
+	_RxBatch *_batch; // allocated by the thread itself once pinned
+	char *_bufs;
+};
 
 static const char _base32_chars[32] = { 'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v','w','x','y','z','2','3','4','5','6','7' };
 static void _base32_5_to_8(const uint8_t *in,char *out)
@@ -84,7 +302,7 @@ LinuxEthernetTap::LinuxEthernetTap(
 	unsigned int metric,
 	uint64_t nwid,
 	const char *friendlyName,
-	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+	void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 	void *arg) :
 	_handler(handler),
 	_arg(arg),
@@ -92,7 +310,25 @@ LinuxEthernetTap::LinuxEthernetTap(
 	_homePath(homePath),
 	_mtu(mtu),
 	_fd(0),
-	_enabled(true)
+	_queueCount(1),
+	_enabled(true),
+	_vnetHdr(__tapOffload),
+	_gro((char *)0),
+	_groLen(0),
+	_groL4(0),
+	_groHeaders(0),
+	_groMss(0),
+	_groSegments(0),
+	_groNextSeq(0),
+	_groFd(0),
+	_out((FrameRing *)0),
+	_outEvent(-1),
+	_filtered(false)
+#ifdef ZT_HAVE_IO_URING
+	,_uringTx((LinuxIoUring *)0)
+	,_uringTxBufs((char *)0)
+	,_uringTxFreeCount(0)
+#endif
 {
 	char procpath[128],nwids[32];
 	struct stat sbuf;
@@ -166,16 +402,38 @@ LinuxEthernetTap::LinuxEthernetTap(
 #endif
 	}
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
-	if (ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0) {
-		::close(_fd);
-		throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+	const short tapFlags = IFF_TAP | IFF_NO_PI | (_vnetHdr ? IFF_VNET_HDR : 0);
+	bool multiQueue = false;
+#ifdef IFF_MULTI_QUEUE
+	if (__tapQueues > 1) {
+		struct ifreq mqifr;
+		memcpy(&mqifr,&ifr,sizeof(mqifr));
+		mqifr.ifr_flags = tapFlags | IFF_MULTI_QUEUE;
+		multiQueue = (ioctl(_fd,TUNSETIFF,(void *)&mqifr) == 0);
+		if (multiQueue)
+			memcpy(&ifr,&mqifr,sizeof(ifr));
+	}
+#endif
+	if (!multiQueue) {
+		ifr.ifr_flags = tapFlags;
+		if (ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0) {
+			::close(_fd);
+			throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+		}
 	}
 
 	_dev = ifr.ifr_name;
 
 	::ioctl(_fd,TUNSETPERSIST,0); // valgrind may generate a false alarm here
 
+	if (_vnetHdr) {
+		// Without these the kernel still sends headers, just no super-frames or partial checksums
+		const unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+		if (::ioctl(_fd,TUNSETOFFLOAD,(unsigned long)(offloads | TUN_F_USO4 | TUN_F_USO6)) != 0)
+			::ioctl(_fd,TUNSETOFFLOAD,(unsigned long)offloads);
+		_gro = new char[ZT_TAP_OFFLOAD_FRAME_SIZE];
+	}
+
 	// Open an arbitrary socket to talk to netlink
 	int sock = socket(AF_INET,SOCK_DGRAM,0);
 	if (sock <= 0) {
@@ -224,8 +482,55 @@ LinuxEthernetTap::LinuxEthernetTap(
 	// Set close-on-exec so that devices cannot persist if we fork/exec for update
 	::fcntl(_fd,F_SETFD,fcntl(_fd,F_GETFD) | FD_CLOEXEC);
 
+#ifdef IFF_MULTI_QUEUE
+	// Attach more queues to the device by opening it again under the same name
+	while ((multiQueue)&&(_queueCount < __tapQueues)&&(_queueCount < ZT_TAP_MAX_QUEUES)) {
+		const int qfd = ::open("/dev/net/tun",O_RDWR|O_CLOEXEC);
+		if (qfd <= 0)
+			break;
+		struct ifreq qifr;
+		memset(&qifr,0,sizeof(qifr));
+		Utils::scopy(qifr.ifr_name,sizeof(qifr.ifr_name),_dev.c_str());
+		qifr.ifr_flags = tapFlags | IFF_MULTI_QUEUE; // flags must match or the kernel changes them for the device
+		if (ioctl(qfd,TUNSETIFF,(void *)&qifr) < 0) {
+			::close(qfd);
+			break;
+		}
+		_queues[_queueCount - 1].tap = this;
+		_queues[_queueCount - 1].fd = qfd;
+		++_queueCount;
+	}
+#endif
+
 	(void)::pipe(_shutdownSignalPipe);
 
+	if (__tapOutputQueue) {
+		_outEvent = ::eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+		if (_outEvent >= 0)
+			_out = new FrameRing(__tapOutputQueue,ZT_MAX_MTU + 14); // pages of each slot are only touched as far as frames reach
+	}
+
+#ifdef ZT_HAVE_IO_URING
+	if (__tapIoUring) {
+		_uringTx = new LinuxIoUring();
+		_uringTxBufs = (char *)::malloc(ZT_TAP_IO_URING_WRITES * (ZT_MAX_MTU + 64));
+		struct iovec iov[ZT_TAP_IO_URING_WRITES];
+		for(unsigned int i=0;i<ZT_TAP_IO_URING_WRITES;++i) {
+			iov[i].iov_base = (void *)(_uringTxBufs + (i * (ZT_MAX_MTU + 64)));
+			iov[i].iov_len = ZT_MAX_MTU + 64;
+			_uringTxFree[i] = i;
+		}
+		if ((_uringTxBufs)&&(_uringTx->init(ZT_TAP_IO_URING_WRITES))&&(_uringTx->registerBuffers(iov,ZT_TAP_IO_URING_WRITES))) {
+			_uringTxFreeCount = ZT_TAP_IO_URING_WRITES;
+		} else {
+			delete _uringTx;
+			_uringTx = (LinuxIoUring *)0;
+			::free(_uringTxBufs);
+			_uringTxBufs = (char *)0;
+		}
+	}
+#endif
+
 	/*
 	globalDeviceMap[nwids] = _dev;
 	devmapf = fopen((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),"w");
@@ -239,16 +544,59 @@ LinuxEthernetTap::LinuxEthernetTap(
 	}
 	*/
 
-	_thread = Thread::start(this);
+	for(unsigned int i=0;i<=ZT_TAP_MAX_QUEUES;++i) {
+		_shared[i].tap = this;
+		_shared[i].fd = -1;
+		_shared[i].thread = (_SharedThread *)0;
+		_shared[i].sock = (void *)0;
+	}
+	if (__tapThreads) {
+		// Reads don't block so each wakeup can take every frame that's waiting
+		for(unsigned int q=0;q<_queueCount;++q) {
+			_shared[q].fd = (q) ? _queues[q - 1].fd : _fd;
+			::fcntl(_shared[q].fd,F_SETFL,fcntl(_shared[q].fd,F_GETFL) | O_NONBLOCK);
+			_SharedThread::next().add(_shared[q]);
+		}
+		if ((_out)&&(_shared[0].sock)) {
+			// Queued frames are written by whatever reads the first queue
+			_shared[ZT_TAP_MAX_QUEUES].fd = _outEvent;
+			if (!_shared[0].thread->add(_shared[ZT_TAP_MAX_QUEUES]))
+				_shared[0].thread->remove(_shared[0]);
+		}
+	}
+
+	// Queues a shared thread didn't take get threads of their own
+	if (!_shared[0].sock)
+		_thread = Thread::start(this);
+	for(unsigned int q=1;q<_queueCount;++q) {
+		if (!_shared[q].sock)
+			_queues[q - 1].thread = Thread::start(&(_queues[q - 1]));
+	}
 }
 
 LinuxEthernetTap::~LinuxEthernetTap()
 {
-	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
+	for(unsigned int i=0;i<=ZT_TAP_MAX_QUEUES;++i) {
+		if (_shared[i].thread)
+			_shared[i].thread->remove(_shared[i]);
+	}
+	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes threads to exit
 	Thread::join(_thread);
+	for(unsigned int q=1;q<_queueCount;++q)
+		Thread::join(_queues[q - 1].thread);
 	::close(_fd);
+	for(unsigned int q=1;q<_queueCount;++q)
+		::close(_queues[q - 1].fd);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
+#ifdef ZT_HAVE_IO_URING
+	delete _uringTx; // waits for any writes still using the buffers
+	::free(_uringTxBufs);
+#endif
+	delete [] _gro;
+	delete _out;
+	if (_outEvent >= 0)
+		::close(_outEvent);
 }
 
 void LinuxEthernetTap::setEnabled(bool en)
@@ -420,14 +768,20 @@ std::vector<InetAddress> LinuxEthernetTap::ips() const
 
 void LinuxEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
 	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
-		to.copyTo(putBuf,6);
-		from.copyTo(putBuf + 6,6);
-		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14,data,len);
-		len += 14;
-		(void)::write(_fd,putBuf,len);
+		if (_out) {
+			char eth[14];
+			to.copyTo(eth,6);
+			from.copyTo(eth + 6,6);
+			*((uint16_t *)(eth + 12)) = htons((uint16_t)etherType);
+			bool wake;
+			if ((_out->push(eth,14,data,len,wake))&&(wake)) {
+				const uint64_t one = 1;
+				(void)::write(_outEvent,&one,sizeof(one));
+			}
+		} else {
+			_putNow(from,to,etherType,data,len);
+		}
 	}
 }
 
@@ -504,56 +858,601 @@ void LinuxEthernetTap::setMtu(unsigned int mtu)
 	}
 }
 
+bool LinuxEthernetTap::setFilter(const ZT_VirtualNetworkRule *rules,unsigned int ruleCount)
+{
+	if ((ruleCount == (unsigned int)_filterRules.size())&&((!ruleCount)||(memcmp(_filterRules.data(),rules,sizeof(ZT_VirtualNetworkRule) * ruleCount) == 0)))
+		return _filtered;
+	_filterRules.assign(rules,rules + ruleCount);
+	_filtered = false;
+#ifdef ZT_HAVE_TAP_FILTER
+	// A failed load leaves fd at -1, which removes any filter attached before
+	int fd = (ruleCount) ? LinuxTapFilter::load(rules,ruleCount) : -1;
+	_filtered = ((::ioctl(_fd,TUNSETFILTEREBPF,(void *)&fd) == 0)&&(fd >= 0));
+	if (fd >= 0)
+		::close(fd); // the tap holds its own reference
+#endif
+	return _filtered;
+}
+
 void LinuxEthernetTap::threadMain()
 	throw()
 {
-	fd_set readfds,nullfds;
-	MAC to,from;
-	int n,nfds,r;
-	char getBuf[ZT_MAX_MTU + 64];
+	_pinTapThread();
+	_readLoop(_fd);
+}
+
+void LinuxEthernetTap::_Queue::threadMain()
+	throw()
+{
+	_pinTapThread();
+	tap->_readLoop(fd);
+}
+
+void LinuxEthernetTap::setQueues(unsigned int queues)
+{
+	__tapQueues = std::max(1U,std::min(queues,(unsigned int)ZT_TAP_MAX_QUEUES));
+}
+
+void LinuxEthernetTap::setOffload(bool enabled)
+{
+	__tapOffload = enabled;
+}
+
+void LinuxEthernetTap::setOutputQueue(unsigned int frames)
+{
+	__tapOutputQueue = frames;
+}
+
+void LinuxEthernetTap::setCpus(const std::vector<unsigned int> &cpus)
+{
+	Mutex::Lock _l(__tapCpusLock);
+	__tapCpus = cpus;
+}
+
+void LinuxEthernetTap::setBusyPoll(unsigned long usec)
+{
+	__tapBusyPoll = usec;
+}
+
+void LinuxEthernetTap::setThreads(unsigned int threads)
+{
+	__tapThreads = std::min(threads,(unsigned int)ZT_TAP_MAX_SHARED_THREADS);
+}
+
+LinuxEthernetTap::PutBatch::PutBatch()
+{
+	++__tapPutBatch.depth;
+}
+
+LinuxEthernetTap::PutBatch::~PutBatch()
+{
+	if (!--__tapPutBatch.depth) {
+		for(unsigned int i=0;i<__tapPutBatch.count;++i) {
+			Mutex::Lock _l(__tapPutBatch.taps[i]->_groLock);
+			__tapPutBatch.taps[i]->_flushCoalesced();
+		}
+		__tapPutBatch.count = 0;
+	}
+}
+
+int LinuxEthernetTap::_putFd(const unsigned int etherType,const void *data,const unsigned int len) const
+{
+	if (_queueCount <= 1)
+		return _fd;
+
+	// Hash addresses and, for unfragmented TCP and UDP, ports so each flow stays on one queue
+	const uint8_t *const p = reinterpret_cast<const uint8_t *>(data);
+	unsigned int start,end,proto,l4;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 20)) {
+		start = 12;
+		end = 20;
+		proto = p[9];
+		l4 = ((p[6] & 0x3f) | p[7]) ? 0 : ((p[0] & 0x0f) * 4);
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 40)) {
+		start = 8;
+		end = 40;
+		proto = p[6];
+		l4 = 40;
+	} else return _fd;
+	uint32_t h = 2166136261U;
+	for(unsigned int i=start;i<end;++i)
+		h = (h ^ p[i]) * 16777619U;
+	if ((l4)&&((proto == 6)||(proto == 17))&&((l4 + 4) <= len)) {
+		for(unsigned int i=l4;i<(l4 + 4);++i)
+			h = (h ^ p[i]) * 16777619U;
+	}
+	const unsigned int q = (unsigned int)((h ^ (h >> 16)) % _queueCount);
+	return (q == 0) ? _fd : _queues[q - 1].fd;
+}
+
+void LinuxEthernetTap::_putNow(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	char putBuf[ZT_MAX_MTU + 64];
+	unsigned int hdrLen = 0;
+	if (_vnetHdr) {
+		if ((__tapPutBatch.depth)&&(_coalesce(from,to,etherType,data,len)))
+			return;
+		_VnetHdr h;
+		memset(&h,0,sizeof(h));
+		h.flags = ZT_VNET_HDR_F_DATA_VALID; // ZeroTier authenticated the frame, so don't check it again
+		memcpy(putBuf,&h,sizeof(h));
+		hdrLen = sizeof(h);
+	}
+	to.copyTo(putBuf + hdrLen,6);
+	from.copyTo(putBuf + hdrLen + 6,6);
+	*((uint16_t *)(putBuf + hdrLen + 12)) = htons((uint16_t)etherType);
+	memcpy(putBuf + hdrLen + 14,data,len);
+	_write(_putFd(etherType,data,len),putBuf,hdrLen + 14 + len);
+}
+
+void LinuxEthernetTap::_drainOutput()
+{
+	uint64_t n;
+	(void)::read(_outEvent,&n,sizeof(n));
+	do {
+		{
+			PutBatch pb; // the writes below are one batch, so TCP runs can be coalesced
+			unsigned int len;
+			const char *f;
+			while ((f = _out->front(len))) {
+				_putNow(MAC(f + 6,6),MAC(f,6),ntohs(*((const uint16_t *)(f + 12))),f + 14,len - 14);
+				_out->pop();
+			}
+		}
+#ifdef ZT_HAVE_IO_URING
+		if (_uringTx) {
+			Mutex::Lock _l(_uringTxLock);
+			_uringTx->submit(); // writes queued by _write() go to the kernel together
+		}
+#endif
+	} while (!_out->idle());
+}
+
+void LinuxEthernetTap::_write(const int fd,const void *data,const unsigned int len)
+{
+#ifdef ZT_HAVE_IO_URING
+	if (_uringTx) {
+		Mutex::Lock _l(_uringTxLock);
+		struct io_uring_cqe c;
+		while (_uringTx->cqe(c))
+			_uringTxFree[_uringTxFreeCount++] = (unsigned int)c.user_data;
+		if (len > (ZT_MAX_MTU + 64)) { // coalesced frames don't fit a buffer, so wait for queued frames to go first
+			while ((_uringTxFreeCount < ZT_TAP_IO_URING_WRITES)&&(_uringTx->submit(1) >= 0)) {
+				while (_uringTx->cqe(c))
+					_uringTxFree[_uringTxFreeCount++] = (unsigned int)c.user_data;
+			}
+		} else {
+			if (!_uringTxFreeCount) { // wait for a buffer rather than write around queued frames
+				if (_uringTx->submit(1) >= 0) {
+					while (_uringTx->cqe(c))
+						_uringTxFree[_uringTxFreeCount++] = (unsigned int)c.user_data;
+				}
+			}
+			if (_uringTxFreeCount) {
+				struct io_uring_sqe *const e = _uringTx->sqe();
+				if (e) {
+					const unsigned int slot = _uringTxFree[--_uringTxFreeCount];
+					memcpy(_uringTxBufs + (slot * (ZT_MAX_MTU + 64)),data,len);
+					e->opcode = IORING_OP_WRITE_FIXED;
+					e->fd = fd;
+					e->addr = (uint64_t)((uintptr_t)(_uringTxBufs + (slot * (ZT_MAX_MTU + 64))));
+					e->len = len;
+					e->buf_index = (uint16_t)slot;
+					e->user_data = slot;
+					if ((_out)||(_uringTx->submit() >= 0)) // queued writes are submitted by _drainOutput()
+						return;
+					_uringTxFree[_uringTxFreeCount++] = slot; // unlikely: sent below instead
+				}
+			}
+			_uringTx->submit(); // anything queued goes before the write below
+		}
+	}
+#endif
+	(void)::write(fd,data,len);
+}
+
+bool LinuxEthernetTap::_coalesce(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
+{
+	// Only plain TCP segments carrying data and nothing but ACK (and PSH to end a run) are coalesced
+	const uint8_t *const p = reinterpret_cast<const uint8_t *>(data);
+	bool v6 = false;
+	unsigned int l4 = 0,ipLen = 0,tcpLen = 0,flags = 0;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 40)&&(p[0] == 0x45)&&(p[9] == 6)&&(p[6] == 0x40)&&(!p[7])) {
+		l4 = 20;
+		ipLen = _get16(p + 2);
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 60)&&((p[0] >> 4) == 6)&&(p[6] == 6)) {
+		v6 = true;
+		l4 = 40;
+		ipLen = 40 + _get16(p + 4);
+	}
+	if (l4) {
+		tcpLen = (p[l4 + 12] >> 4) * 4;
+		flags = p[l4 + 13];
+	}
+
+	Mutex::Lock _l(_groLock);
+
+	if ((!l4)||(ipLen > len)||(tcpLen < 20)||((l4 + tcpLen) >= ipLen)||((flags & ~0x08U) != 0x10)||(p[l4 + 18])||(p[l4 + 19])) {
+		_flushCoalesced(); // anything else from the same flow must not pass it
+		return false;
+	}
+	const unsigned int payload = ipLen - (l4 + tcpLen);
+	const uint32_t seq = _get32(p + l4 + 4);
+
+	uint8_t *const g = reinterpret_cast<uint8_t *>(_gro) + sizeof(_VnetHdr);
+	if (_groLen) {
+		const uint8_t *const gl4 = g + 14 + l4;
+		if ((_groL4 == (14 + l4))&&(_groHeaders == (14 + l4 + tcpLen))&&(seq == _groNextSeq)&&(payload <= _groMss)&&((_groLen + payload) <= (ZT_TAP_OFFLOAD_FRAME_SIZE - sizeof(_VnetHdr)))&&((_groLen - 14 + payload) <= 65535)&&
+				(_get16(g + 12) == etherType)&&(from == MAC(g + 6,6))&&(to == MAC(g,6))&&
+				((v6) ? ((!memcmp(g + 14,p,4))&&(!memcmp(g + 14 + 7,p + 7,33))) : ((g[14 + 1] == p[1])&&(!memcmp(g + 14 + 8,p + 8,2))&&(!memcmp(g + 14 + 12,p + 12,8))))&&
+				(!memcmp(gl4,p + l4,4))&&(!memcmp(gl4 + 8,p + l4 + 8,5))&&(!memcmp(gl4 + 14,p + l4 + 14,2))&&(!memcmp(gl4 + 20,p + l4 + 20,tcpLen - 20))) {
+			memcpy(g + _groLen,p + l4 + tcpLen,payload);
+			_groLen += payload;
+			_groNextSeq += payload;
+			++_groSegments;
+			if ((flags & 0x08)||(payload < _groMss)) { // pushed or short segments end a run
+				g[_groL4 + 13] |= (uint8_t)flags;
+				_flushCoalesced();
+			}
+			return true;
+		}
+		_flushCoalesced();
+	}
+
+	// Start a new run if this thread can flush it later, otherwise write this one now
+	if ((flags & 0x08)||(ipLen > (ZT_TAP_OFFLOAD_FRAME_SIZE - sizeof(_VnetHdr) - 14)))
+		return false;
+	bool tracked = false;
+	for(unsigned int i=0;i<__tapPutBatch.count;++i) {
+		if (__tapPutBatch.taps[i] == this) {
+			tracked = true;
+			break;
+		}
+	}
+	if (!tracked) {
+		if (__tapPutBatch.count >= ZT_TAP_PUT_BATCH_TAPS)
+			return false;
+		__tapPutBatch.taps[__tapPutBatch.count++] = this;
+	}
+	to.copyTo(g,6);
+	from.copyTo(g + 6,6);
+	_put16(g + 12,etherType);
+	memcpy(g + 14,p,ipLen);
+	_groLen = 14 + ipLen;
+	_groL4 = 14 + l4;
+	_groHeaders = 14 + l4 + tcpLen;
+	_groMss = payload;
+	_groSegments = 1;
+	_groNextSeq = seq + payload;
+	_groFd = _putFd(etherType,data,len);
+	return true;
+}
+
+void LinuxEthernetTap::_flushCoalesced()
+{
+	if (!_groLen)
+		return;
+	_VnetHdr h;
+	memset(&h,0,sizeof(h));
+	uint8_t *const g = reinterpret_cast<uint8_t *>(_gro) + sizeof(h);
+	if (_groSegments > 1) {
+		// Send as one TSO frame with a partial checksum, like a NIC doing GRO would
+		const bool v6 = (_get16(g + 12) == ZT_ETHERTYPE_IPV6);
+		if (v6) {
+			_put16(g + 18,_groLen - 54);
+			h.gso_type = ZT_VNET_HDR_GSO_TCPV6;
+		} else {
+			_put16(g + 16,_groLen - 14);
+			_put16(g + 24,0);
+			_put16(g + 24,~_fold(_sum(g + 14,20,0)) & 0xffff);
+			h.gso_type = ZT_VNET_HDR_GSO_TCPV4;
+		}
+		h.flags = ZT_VNET_HDR_F_NEEDS_CSUM;
+		h.hdr_len = (uint16_t)_groHeaders;
+		h.gso_size = (uint16_t)_groMss;
+		h.csum_start = (uint16_t)_groL4;
+		h.csum_offset = 16;
+		_put16(g + _groL4 + 16,_fold(_pseudoSum(g,v6,6,_groLen - _groL4)));
+	} else {
+		h.flags = ZT_VNET_HDR_F_DATA_VALID;
+	}
+	memcpy(_gro,&h,sizeof(h));
+	_write(_groFd,_gro,sizeof(h) + _groLen);
+	_groLen = 0;
+}
+
+void LinuxEthernetTap::_readLoop(const int fd)
+{
+	fd_set readfds;
+	int nfds;
 
 	Thread::sleep(500);
 
+	if ((__tapIoUring)&&(_readLoopIoUring(fd)))
+		return;
+
+	// Reads don't block so each wakeup can take every frame that's waiting
+	const unsigned int bufSize = _vnetHdr ? ZT_TAP_OFFLOAD_FRAME_SIZE : (ZT_MAX_MTU + 64);
+	std::vector<char> bufs(ZT_TAP_READ_BATCH * bufSize);
+	_RxBatch b(_vnetHdr);
+	::fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+
+	// The first queue's thread also writes frames queued by put()
+	const int outEvent = ((_out)&&(fd == _fd)) ? _outEvent : -1;
+
 	FD_ZERO(&readfds);
-	FD_ZERO(&nullfds);
-	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
+	nfds = (int)std::max(std::max(_shutdownSignalPipe[0],fd),outEvent) + 1;
 
-	r = 0;
 	for(;;) {
-		FD_SET(_shutdownSignalPipe[0],&readfds);
-		FD_SET(_fd,&readfds);
-		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
+		// With busy polling, check without waiting until something is ready or the spin runs out
+		const unsigned long spin = __tapBusyPoll;
+		const std::chrono::steady_clock::time_point until(std::chrono::steady_clock::now() + std::chrono::microseconds(spin));
+		for(;;) {
+			FD_SET(_shutdownSignalPipe[0],&readfds);
+			FD_SET(fd,&readfds);
+			if (outEvent >= 0)
+				FD_SET(outEvent,&readfds);
+			struct timeval tv;
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+			if ((!spin)||(std::chrono::steady_clock::now() >= until)) {
+				select(nfds,&readfds,(fd_set *)0,(fd_set *)0,(struct timeval *)0);
+				break;
+			}
+			if (select(nfds,&readfds,(fd_set *)0,(fd_set *)0,&tv) != 0)
+				break;
+		}
 
 		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
 			break;
 
-		if (FD_ISSET(_fd,&readfds)) {
-			n = (int)::read(_fd,getBuf + r,sizeof(getBuf) - r);
-			if (n < 0) {
-				if ((errno != EINTR)&&(errno != ETIMEDOUT))
-					break;
-			} else {
-				// Some tap drivers like to send the ethernet frame and the
-				// payload in two chunks, so handle that by accumulating
-				// data until we have at least a frame.
-				r += n;
-				if (r > 14) {
-					if (r > ((int)_mtu + 14)) // sanity check for weird TAP behavior on some platforms
-						r = _mtu + 14;
-
-					if (_enabled) {
-						to.setTo(getBuf,6);
-						from.setTo(getBuf + 6,6);
-						unsigned int etherType = ntohs(((const uint16_t *)getBuf)[6]);
-						// TODO: VLAN support
-						_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(getBuf + 14),r - 14);
-					}
-
-					r = 0;
+		if ((outEvent >= 0)&&(FD_ISSET(outEvent,&readfds)))
+			_drainOutput();
+
+		if (FD_ISSET(fd,&readfds)) {
+			for(unsigned int i=0;i<ZT_TAP_READ_BATCH;++i) {
+				char *const getBuf = bufs.data() + (i * bufSize);
+				const int n = (int)::read(fd,getBuf,bufSize);
+				if (n < 0) {
+					if ((errno == EAGAIN)||(errno == EWOULDBLOCK)||(errno == EINTR))
+						break;
+					_flush(b);
+					return;
 				}
+				if (_vnetHdr)
+					_receivedOffload(b,getBuf,(unsigned int)n);
+				else if (n > 14) // the Linux tun driver always returns whole frames
+					_received(b,getBuf,(unsigned int)n);
 			}
+			_flush(b);
 		}
 	}
 }
 
+void LinuxEthernetTap::_readShared(_RxBatch &b,const int fd,char *frame,unsigned int len,char *bufs)
+{
+	// Phy<> read the first frame, and the rest of what's waiting is read here to go to the core with it
+	const unsigned int bufSize = _vnetHdr ? ZT_TAP_OFFLOAD_FRAME_SIZE : (ZT_MAX_MTU + 64);
+	for(unsigned int i=0;;) {
+		if (_vnetHdr)
+			_receivedOffload(b,frame,len);
+		else if (len > 14) // the Linux tun driver always returns whole frames
+			_received(b,frame,len);
+		if (++i >= ZT_TAP_READ_BATCH)
+			break;
+		frame = bufs + ((i - 1) * bufSize);
+		const int n = (int)::read(fd,frame,bufSize);
+		if (n <= 0)
+			break;
+		len = (unsigned int)n;
+	}
+	_flush(b);
+}
+
+void LinuxEthernetTap::_received(_RxBatch &b,const char *buf,unsigned int len)
+{
+	if (len > (_mtu + 14)) // sanity check for weird TAP behavior on some platforms
+		len = _mtu + 14;
+	if (b.count >= ZT_TAP_READ_BATCH)
+		_flush(b);
+	ZT_VirtualNetworkFrame &f = b.frames[b.count++];
+	f.destMac = MAC(buf,6).toInt();
+	f.sourceMac = MAC(buf + 6,6).toInt();
+	f.etherType = ntohs(((const uint16_t *)buf)[6]);
+	f.vlanId = 0; // TODO: VLAN support
+	f.data = (const void *)(buf + 14);
+	f.length = len - 14;
+}
+
+void LinuxEthernetTap::_receivedOffload(_RxBatch &b,char *buf,unsigned int len)
+{
+	_VnetHdr h;
+	if (len < (sizeof(h) + 14))
+		return;
+	memcpy(&h,buf,sizeof(h));
+	uint8_t *const f = reinterpret_cast<uint8_t *>(buf) + sizeof(h);
+	len -= sizeof(h);
+
+	const unsigned int gsoType = h.gso_type & ~ZT_VNET_HDR_GSO_ECN;
+	if (gsoType == ZT_VNET_HDR_GSO_NONE) {
+		// With a partial checksum the field holds the pseudo-header sum and the rest is summed here
+		if ((h.flags & ZT_VNET_HDR_F_NEEDS_CSUM)&&(((unsigned int)h.csum_start + (unsigned int)h.csum_offset + 2) <= len))
+			_put16(f + h.csum_start + h.csum_offset,~_fold(_sum(f + h.csum_start,len - h.csum_start,0)) & 0xffff);
+		_received(b,(const char *)f,len);
+		return;
+	}
+
+	// Segment super-frames against the tap MTU, doing what the kernel would have done
+	const bool tcp = ((gsoType == ZT_VNET_HDR_GSO_TCPV4)||(gsoType == ZT_VNET_HDR_GSO_TCPV6));
+	if ((!tcp)&&(gsoType != ZT_VNET_HDR_GSO_UDP_L4))
+		return;
+	const unsigned int etherType = _get16(f + 12);
+	const bool v6 = (etherType == ZT_ETHERTYPE_IPV6);
+	if ((!v6)&&(etherType != ZT_ETHERTYPE_IPV4))
+		return;
+	const unsigned int l4 = h.csum_start;
+	if ((l4 < (v6 ? 54U : 34U))||((l4 + 20) > len))
+		return;
+	const unsigned int headers = l4 + (tcp ? ((f[l4 + 12] >> 4) * 4) : 8);
+	unsigned int mss = std::min((unsigned int)h.gso_size,(_mtu + 14) - std::min(headers,_mtu + 14));
+	if ((headers > len)||(!mss))
+		return;
+
+	const unsigned int payload = len - headers;
+	const uint32_t seq = _get32(f + l4 + 4);
+	const unsigned int ipId = _get16(f + 18);
+	const unsigned int tcpFlags = f[l4 + 13];
+	for(unsigned int off=0,i=0;off<payload;off+=mss,++i) {
+		// Each segment gets the headers and its part of the payload in its own slot
+		if (b.count >= ZT_TAP_READ_BATCH)
+			_flush(b);
+		uint8_t *const s = reinterpret_cast<uint8_t *>(b.segments.data()) + (b.count * (ZT_MAX_MTU + 64));
+		const unsigned int n = std::min(mss,payload - off);
+		const unsigned int segLen = headers + n;
+		memcpy(s,f,headers);
+		memcpy(s + headers,f + headers + off,n);
+		if (v6) {
+			_put16(s + 18,segLen - 54);
+		} else {
+			_put16(s + 16,segLen - 14);
+			_put16(s + 18,(ipId + i) & 0xffff);
+			_put16(s + 24,0);
+			_put16(s + 24,~_fold(_sum(s + 14,l4 - 14,0)) & 0xffff);
+		}
+		unsigned int ck;
+		if (tcp) {
+			_put32(s + l4 + 4,seq + off);
+			unsigned int fl = tcpFlags;
+			if ((off + n) < payload)
+				fl &= ~0x09U; // FIN and PSH only on the last segment
+			if (i)
+				fl &= ~0x80U; // CWR only on the first
+			s[l4 + 13] = (uint8_t)fl;
+			ck = l4 + 16;
+		} else {
+			_put16(s + l4 + 4,segLen - l4);
+			ck = l4 + 6;
+		}
+		_put16(s + ck,0);
+		unsigned int sum = ~_fold(_sum(s + l4,segLen - l4,_pseudoSum(s,v6,tcp ? 6 : 17,segLen - l4))) & 0xffff;
+		if ((!tcp)&&(!sum))
+			sum = 0xffff;
+		_put16(s + ck,sum);
+		_received(b,(const char *)s,segLen);
+	}
+}
+
+void LinuxEthernetTap::_flush(_RxBatch &b)
+{
+	if (b.count) {
+		if (_enabled)
+			_handler(_arg,(void *)0,_nwid,b.frames,b.count);
+		b.count = 0;
+	}
+}
+
+void LinuxEthernetTap::setIoUring(bool enabled)
+{
+	__tapIoUring = enabled;
+}
+
+bool LinuxEthernetTap::_readLoopIoUring(const int fd)
+{
+#ifdef ZT_HAVE_IO_URING
+	// Buffers are allocated before the ring so the ring (and any reads still
+	// queued in it) is torn down first.
+	const unsigned int bufSize = _vnetHdr ? ZT_TAP_OFFLOAD_FRAME_SIZE : (ZT_MAX_MTU + 64);
+	std::vector<char> bufs(ZT_TAP_IO_URING_READS * bufSize);
+	LinuxIoUring ring;
+	struct iovec iov[ZT_TAP_IO_URING_READS];
+	for(unsigned int i=0;i<ZT_TAP_IO_URING_READS;++i) {
+		iov[i].iov_base = (void *)(bufs.data() + (i * bufSize));
+		iov[i].iov_len = bufSize;
+	}
+	if ((!ring.init(ZT_TAP_IO_URING_READS * 2))||(!ring.registerBuffers(iov,ZT_TAP_IO_URING_READS)))
+		return false;
+
+	// A poll on the shutdown pipe ends the loop (user data 0), each buffer
+	// has a read queued (user data is buffer index plus one), and the first
+	// queue polls for frames queued by put() (user data is one past those).
+	const bool out = ((_out)&&(fd == _fd));
+	struct io_uring_sqe *e = ring.sqe();
+	e->opcode = IORING_OP_POLL_ADD;
+	e->fd = _shutdownSignalPipe[0];
+	e->poll32_events = POLLIN;
+	e->user_data = 0;
+	if (out) {
+		e = ring.sqe();
+		e->opcode = IORING_OP_POLL_ADD;
+		e->fd = _outEvent;
+		e->poll32_events = POLLIN;
+		e->user_data = ZT_TAP_IO_URING_READS + 1;
+	}
+	for(unsigned int i=0;i<ZT_TAP_IO_URING_READS;++i) {
+		e = ring.sqe();
+		e->opcode = IORING_OP_READ_FIXED;
+		e->fd = fd;
+		e->addr = (uint64_t)((uintptr_t)iov[i].iov_base);
+		e->len = (unsigned int)iov[i].iov_len;
+		e->buf_index = (uint16_t)i;
+		e->user_data = i + 1;
+	}
+	if (ring.submit() < 0)
+		return false;
+
+	_RxBatch b(_vnetHdr);
+	unsigned int done[ZT_TAP_IO_URING_READS];
+	for(;;) {
+		if (ring.submit(1) < 0)
+			break;
+
+		// Every completed read is handed to the core before its buffer is queued again
+		unsigned int doneCount = 0;
+		struct io_uring_cqe c;
+		while ((doneCount < ZT_TAP_IO_URING_READS)&&(ring.cqe(c))) {
+			if (!c.user_data) // writes to shutdown pipe terminate thread
+				return true;
+			if (c.user_data == (ZT_TAP_IO_URING_READS + 1)) {
+				_drainOutput();
+				e = ring.sqe();
+				if (!e)
+					return true;
+				e->opcode = IORING_OP_POLL_ADD;
+				e->fd = _outEvent;
+				e->poll32_events = POLLIN;
+				e->user_data = ZT_TAP_IO_URING_READS + 1;
+				continue;
+			}
+			const unsigned int i = (unsigned int)(c.user_data - 1);
+			done[doneCount++] = i;
+			if (c.res < 0) {
+				if ((c.res != -EINTR)&&(c.res != -EAGAIN)&&(c.res != -ETIMEDOUT))
+					return true;
+			} else if (_vnetHdr) {
+				_receivedOffload(b,(char *)iov[i].iov_base,(unsigned int)c.res);
+			} else if (c.res > 14) { // the Linux tun driver always returns whole frames
+				_received(b,(const char *)iov[i].iov_base,(unsigned int)c.res);
+			}
+		}
+		_flush(b);
+
+		for(unsigned int k=0;k<doneCount;++k) {
+			const unsigned int i = done[k];
+			e = ring.sqe();
+			if (!e)
+				return true;
+			e->opcode = IORING_OP_READ_FIXED;
+			e->fd = fd;
+			e->addr = (uint64_t)((uintptr_t)iov[i].iov_base);
+			e->len = (unsigned int)iov[i].iov_len;
+			e->buf_index = (uint16_t)i;
+			e->user_data = i + 1;
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
 } // namespace ZeroTier
@@ -35,7 +35,29 @@
 #include <stdexcept>
 
 #include "../node/MulticastGroup.hpp"
+#include "../node/Mutex.hpp"
 #include "Thread.hpp"
+#include "LinuxIoUring.hpp"
+#include "FrameRing.hpp"
+
+// Most frames read per wakeup and handed to the core together
+#define ZT_TAP_READ_BATCH 16
+
+// Reads kept queued and write buffers for taps using io_uring
+#define ZT_TAP_IO_URING_READS 16
+#define ZT_TAP_IO_URING_WRITES 16
+
+// Most queues (each with its own reader thread) opened per tap with setQueues()
+#define ZT_TAP_MAX_QUEUES 16
+
+// Largest frame plus virtio-net header read from or written to a tap with setOffload()
+#define ZT_TAP_OFFLOAD_FRAME_SIZE 65600
+
+// Most taps one thread can have coalesced frames pending for in a PutBatch
+#define ZT_TAP_PUT_BATCH_TAPS 8
+
+// Most shared threads serving taps with setThreads()
+#define ZT_TAP_MAX_SHARED_THREADS 64
 
 namespace ZeroTier {
 
@@ -52,7 +74,7 @@ public:
 		unsigned int metric,
 		uint64_t nwid,
 		const char *friendlyName,
-		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 		void *arg);
 
 	~LinuxEthernetTap();
@@ -71,11 +93,172 @@ public:
 	void scanMulticastGroups(std::vector<MulticastGroup> &added,std::vector<MulticastGroup> &removed);
 	void setMtu(unsigned int mtu);
 
+	/**
+	 * Drop frames from the host in the kernel if these rules drop them (Linux only)
+	 *
+	 * Rules are from ZT_Node_tapFilter() and are compiled into an eBPF
+	 * filter on the tap (see LinuxTapFilter). Calling this again with the
+	 * same rules does nothing, and no rules removes the filter. If the
+	 * kernel won't load or attach it, every frame is read as before.
+	 *
+	 * @param rules Rules
+	 * @param ruleCount Number of rules
+	 * @return True if a filter is attached
+	 */
+	bool setFilter(const ZT_VirtualNetworkRule *rules,unsigned int ruleCount);
+
+	/**
+	 * @return Frames dropped because the output queue was full (see setOutputQueue())
+	 */
+	inline uint64_t outputDrops() const { return ((_out) ? _out->drops() : 0ULL); }
+
 	void threadMain()
 		throw();
 
+	/**
+	 * Use io_uring for reads and writes on taps created after this (Linux only)
+	 *
+	 * Taps fall back to select() and read()/write() if the kernel doesn't
+	 * support it.
+	 *
+	 * @param enabled If true, use io_uring
+	 */
+	static void setIoUring(bool enabled);
+
+	/**
+	 * Open this many queues for taps created after this (Linux only)
+	 *
+	 * With more than one queue the tap is created with IFF_MULTI_QUEUE and
+	 * each queue is read by its own thread, so frames from the host are
+	 * handled on several cores. The kernel spreads flows across queues and
+	 * put() does the same by hashing addresses and ports. Taps fall back
+	 * to fewer queues if the kernel won't open more.
+	 *
+	 * @param queues Number of queues, 1 to ZT_TAP_MAX_QUEUES (default: 1)
+	 */
+	static void setQueues(unsigned int queues);
+
+	/**
+	 * Use virtio-net headers and offloads on taps created after this (Linux only)
+	 *
+	 * Taps are created with IFF_VNET_HDR and advertise checksum offload and
+	 * TSO (and UDP segmentation if the kernel has it), so the host stack
+	 * hands over large super-frames that are segmented here against the
+	 * tap MTU instead of by the kernel. Frames written by put() are marked
+	 * checksum-valid, since they were authenticated in transit, and runs of
+	 * TCP segments put() within a PutBatch go to the kernel as one frame.
+	 *
+	 * @param enabled If true, use offloads
+	 */
+	static void setOffload(bool enabled);
+
+	/**
+	 * Queue frames from put() for taps created after this (Linux only)
+	 *
+	 * With a queue, put() copies each frame into a lock-free ring and the
+	 * tap's first reader thread writes them to the kernel in batches, so a
+	 * slow or backed-up host stack can't stall the core thread calling
+	 * put(). Frames put() while the ring is full are dropped and counted
+	 * (see outputDrops()). Without one, put() writes to the tap directly.
+	 *
+	 * @param frames Ring size in frames, or 0 to write directly (default: 0)
+	 */
+	static void setOutputQueue(unsigned int frames);
+
+	/**
+	 * Pin tap reader threads started after this to these CPUs (Linux only)
+	 *
+	 * Each reader thread, including those of every queue, takes the next CPU
+	 * in turn. Readers allocate their buffers after they are pinned, so
+	 * those come from the reader's own NUMA node.
+	 *
+	 * @param cpus CPU numbers, or empty to leave readers unpinned (default)
+	 */
+	static void setCpus(const std::vector<unsigned int> &cpus);
+
+	/**
+	 * Spin checking for frames before waiting in tap reader threads (Linux only)
+	 *
+	 * This applies to readers using select(), not io_uring.
+	 *
+	 * @param usec Microseconds to spin or 0 to wait right away (default)
+	 */
+	static void setBusyPoll(unsigned long usec);
+
+	/**
+	 * Serve taps created after this from a fixed pool of threads (Linux only)
+	 *
+	 * Instead of starting reader threads of their own, taps register each
+	 * queue (and their output queue, see setOutputQueue()) with one of these
+	 * threads, which wait on many taps at once in a Phy<> event loop. This
+	 * keeps the thread count independent of the number of networks joined.
+	 * Queues are spread across the pool in turn. Pool threads are started
+	 * as taps first need them, follow setCpus() and setBusyPoll(), and read
+	 * with epoll even if io_uring is enabled.
+	 *
+	 * @param threads Threads in pool, 1 to ZT_TAP_MAX_SHARED_THREADS, or 0 for threads per tap (default)
+	 */
+	static void setThreads(unsigned int threads);
+
+	/**
+	 * While in scope, TCP segments put() on this thread may be coalesced
+	 *
+	 * Coalesced frames are written when a frame that can't extend them is
+	 * put() or when the outermost PutBatch on the thread goes out of scope.
+	 * This only has an effect on taps using offloads.
+	 */
+	class PutBatch
+	{
+	public:
+		PutBatch();
+		~PutBatch();
+	};
+
 private:
-	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
+	// A queue after the first, read by its own thread
+	struct _Queue
+	{
+		LinuxEthernetTap *tap;
+		int fd;
+		Thread thread;
+		void threadMain() throw();
+	};
+
+	// Thread polling queues of many taps, see setThreads()
+	class _SharedThread;
+
+	// A queue or output queue event registered with a _SharedThread
+	struct _SharedFd
+	{
+		LinuxEthernetTap *tap;
+		int fd;
+		_SharedThread *thread;
+		void *sock; // PhySocket wrapping a duplicate of fd, NULL if not registered
+	};
+
+	// Frames read by one thread and not yet handed to the core
+	struct _RxBatch
+	{
+		_RxBatch(const bool offload) : count(0),segments(offload ? (ZT_TAP_READ_BATCH * (ZT_MAX_MTU + 64)) : 0) {}
+		ZT_VirtualNetworkFrame frames[ZT_TAP_READ_BATCH];
+		unsigned int count;
+		std::vector<char> segments; // segmented super-frames, one slot per frame (offload only)
+	};
+
+	void _readLoop(const int fd);
+	void _readShared(_RxBatch &b,const int fd,char *frame,unsigned int len,char *bufs);
+	bool _readLoopIoUring(const int fd);
+	int _putFd(const unsigned int etherType,const void *data,const unsigned int len) const;
+	void _putNow(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
+	void _drainOutput();
+	void _write(const int fd,const void *data,const unsigned int len);
+	void _received(_RxBatch &b,const char *buf,unsigned int len);
+	void _receivedOffload(_RxBatch &b,char *buf,unsigned int len);
+	void _flush(_RxBatch &b);
+	bool _coalesce(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len);
+	void _flushCoalesced();
+
+	void (*_handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
 	Thread _thread;
@@ -83,9 +266,33 @@ private:
 	std::string _dev;
 	std::vector<MulticastGroup> _multicastGroups;
 	unsigned int _mtu;
-	int _fd;
+	int _fd; // first queue, read by _thread or a shared thread
+	_Queue _queues[ZT_TAP_MAX_QUEUES - 1];
+	unsigned int _queueCount; // including the first
 	int _shutdownSignalPipe[2];
 	volatile bool _enabled;
+	bool _vnetHdr;
+	char *_gro; // virtio-net header and frame TCP segments are being coalesced into
+	unsigned int _groLen; // 0 if nothing is pending
+	unsigned int _groL4; // offset of TCP header in frame
+	unsigned int _groHeaders; // length of all headers in frame
+	unsigned int _groMss; // payload size of first segment
+	unsigned int _groSegments;
+	uint32_t _groNextSeq;
+	int _groFd;
+	Mutex _groLock;
+	FrameRing *_out; // frames waiting for _thread to write them, if queued
+	int _outEvent; // eventfd that wakes _thread when _out goes from idle to non-empty
+	_SharedFd _shared[ZT_TAP_MAX_QUEUES + 1]; // queues and then output queue, if served by shared threads
+	std::vector<ZT_VirtualNetworkRule> _filterRules; // last given to setFilter()
+	bool _filtered;
+#ifdef ZT_HAVE_IO_URING
+	LinuxIoUring *_uringTx;
+	char *_uringTxBufs;
+	unsigned int _uringTxFree[ZT_TAP_IO_URING_WRITES];
+	unsigned int _uringTxFreeCount;
+	Mutex _uringTxLock;
+#endif
 };
 
 } // namespace ZeroTier
@@ -0,0 +1,331 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_LINUXIOURING_HPP
+#define ZT_LINUXIOURING_HPP
+
+// io_uring is used directly through its system calls, so it's available if the
+// kernel headers are new enough for multishot recvmsg (Linux 6.0) and the
+// running kernel lets us set up a ring. There is no liburing dependency.
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+#include <sys/syscall.h>
+#if defined(__has_include) && defined(__NR_io_uring_setup)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define ZT_HAVE_IO_URING
+#endif
+#endif
+#endif
+#endif
+
+#ifdef ZT_HAVE_IO_URING
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+namespace ZeroTier {
+
+/**
+ * Minimal io_uring submission and completion rings
+ *
+ * This is just enough of io_uring for Phy<> and LinuxEthernetTap: queueing
+ * and submitting entries, reaping completions, registering fixed buffers,
+ * and one ring of provided buffers for multishot receives. It isn't
+ * thread-safe; callers sharing a ring must lock around it.
+ */
+class LinuxIoUring
+{
+public:
+	LinuxIoUring() :
+		_fd(-1),
+		_ring(MAP_FAILED),
+		_ringSize(0),
+		_sqes((struct io_uring_sqe *)MAP_FAILED),
+		_sqesSize(0),
+		_sqLocalTail(0),
+		_bufRing((struct io_uring_buf_ring *)MAP_FAILED),
+		_bufRingSize(0),
+		_bufs((char *)0),
+		_bufSize(0),
+		_bufMask(0),
+		_bufTail(0)
+	{
+	}
+
+	~LinuxIoUring()
+	{
+		if (_fd >= 0)
+			::close(_fd); // cancels anything still in flight
+		if (_bufRing != (struct io_uring_buf_ring *)MAP_FAILED)
+			::munmap((void *)_bufRing,_bufRingSize);
+		::free(_bufs);
+		if (_sqes != (struct io_uring_sqe *)MAP_FAILED)
+			::munmap((void *)_sqes,_sqesSize);
+		if (_ring != MAP_FAILED)
+			::munmap(_ring,_ringSize);
+	}
+
+	/**
+	 * Create the ring
+	 *
+	 * @param entries Submission queue size (rounded up to a power of two)
+	 * @return True on success, false if io_uring is unavailable or disabled
+	 */
+	inline bool init(unsigned int entries)
+	{
+		if (_fd >= 0)
+			return true;
+
+		struct io_uring_params p;
+		memset(&p,0,sizeof(p));
+		p.flags = IORING_SETUP_CLAMP;
+		const int fd = (int)::syscall(__NR_io_uring_setup,entries,&p);
+		if (fd < 0)
+			return false;
+		if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0) { // Linux 5.4 and newer
+			::close(fd);
+			return false;
+		}
+
+		_ringSize = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+		if ((p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe))) > _ringSize)
+			_ringSize = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+		_ring = ::mmap((void *)0,_ringSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+		if (_ring == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+		_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+		_sqes = (struct io_uring_sqe *)::mmap((void *)0,_sqesSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+		if (_sqes == (struct io_uring_sqe *)MAP_FAILED) {
+			::munmap(_ring,_ringSize);
+			_ring = MAP_FAILED;
+			::close(fd);
+			return false;
+		}
+
+		char *const r = reinterpret_cast<char *>(_ring);
+		_sqHead = reinterpret_cast<unsigned int *>(r + p.sq_off.head);
+		_sqTail = reinterpret_cast<unsigned int *>(r + p.sq_off.tail);
+		_sqArray = reinterpret_cast<unsigned int *>(r + p.sq_off.array);
+		_sqMask = *reinterpret_cast<unsigned int *>(r + p.sq_off.ring_mask);
+		_sqEntries = p.sq_entries;
+		_cqHead = reinterpret_cast<unsigned int *>(r + p.cq_off.head);
+		_cqTail = reinterpret_cast<unsigned int *>(r + p.cq_off.tail);
+		_cqes = reinterpret_cast<struct io_uring_cqe *>(r + p.cq_off.cqes);
+		_cqMask = *reinterpret_cast<unsigned int *>(r + p.cq_off.ring_mask);
+		_sqLocalTail = *_sqTail;
+
+		_fd = fd;
+		return true;
+	}
+
+	/**
+	 * @return Ring file descriptor (readable when completions are waiting) or -1 if not initialized
+	 */
+	inline int fd() const { return _fd; }
+
+	/**
+	 * Get a zeroed submission queue entry to fill in
+	 *
+	 * Entries are passed to the kernel on the next submit().
+	 *
+	 * @return Entry or NULL if the submission queue is full
+	 */
+	inline struct io_uring_sqe *sqe()
+	{
+		if ((_sqLocalTail - __atomic_load_n(_sqHead,__ATOMIC_ACQUIRE)) >= _sqEntries)
+			return (struct io_uring_sqe *)0;
+		const unsigned int idx = _sqLocalTail & _sqMask;
+		struct io_uring_sqe *const e = &(_sqes[idx]);
+		memset(e,0,sizeof(struct io_uring_sqe));
+		_sqArray[idx] = idx;
+		++_sqLocalTail;
+		return e;
+	}
+
+	/**
+	 * Submit queued entries and optionally wait for completions
+	 *
+	 * @param waitFor Number of completions to wait for (default: 0)
+	 * @return Number of entries submitted or negative errno on error
+	 */
+	inline int submit(unsigned int waitFor = 0)
+	{
+		__atomic_store_n(_sqTail,_sqLocalTail,__ATOMIC_RELEASE);
+		const unsigned int toSubmit = _sqLocalTail - __atomic_load_n(_sqHead,__ATOMIC_ACQUIRE);
+		if ((!toSubmit)&&(!waitFor))
+			return 0;
+		for(;;) {
+			const int r = (int)::syscall(__NR_io_uring_enter,_fd,toSubmit,waitFor,(waitFor) ? IORING_ENTER_GETEVENTS : 0,(void *)0,0);
+			if (r >= 0)
+				return r;
+			if (errno != EINTR)
+				return -errno;
+		}
+	}
+
+	/**
+	 * Take the next completion if there is one
+	 *
+	 * @param c Completion is copied here
+	 * @return True if there was a completion
+	 */
+	inline bool cqe(struct io_uring_cqe &c)
+	{
+		const unsigned int head = *_cqHead;
+		if (head == __atomic_load_n(_cqTail,__ATOMIC_ACQUIRE))
+			return false;
+		memcpy(&c,&(_cqes[head & _cqMask]),sizeof(struct io_uring_cqe));
+		__atomic_store_n(_cqHead,head + 1,__ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 * Register fixed buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED
+	 *
+	 * @param iov Buffers, indexed by buf_index in entries
+	 * @param count Number of buffers
+	 * @return True on success
+	 */
+	inline bool registerBuffers(const struct iovec *iov,unsigned int count)
+	{
+		return (::syscall(__NR_io_uring_register,_fd,IORING_REGISTER_BUFFERS,iov,count) == 0);
+	}
+
+	/**
+	 * Set up a ring of provided buffers for receives with IOSQE_BUFFER_SELECT
+	 *
+	 * The kernel picks a buffer for each receive and reports its ID in the
+	 * completion flags. Buffers must be handed back with recycleBuffer().
+	 * This needs Linux 5.19 or newer. Only one buffer group per ring is
+	 * supported here.
+	 *
+	 * @param bgid Buffer group ID
+	 * @param count Number of buffers, a power of two no larger than 32768
+	 * @param size Size of each buffer in bytes
+	 * @return True on success
+	 */
+	inline bool setupBufferRing(unsigned short bgid,unsigned int count,unsigned int size)
+	{
+		if ((_bufs)||(!count)||(count > 32768)||((count & (count - 1)) != 0))
+			return false;
+		_bufRingSize = count * sizeof(struct io_uring_buf);
+		_bufRing = (struct io_uring_buf_ring *)::mmap((void *)0,_bufRingSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if (_bufRing == (struct io_uring_buf_ring *)MAP_FAILED)
+			return false;
+		_bufs = (char *)::malloc((size_t)count * (size_t)size);
+		if (_bufs) {
+			struct io_uring_buf_reg reg;
+			memset(&reg,0,sizeof(reg));
+			reg.ring_addr = (uint64_t)((uintptr_t)_bufRing);
+			reg.ring_entries = count;
+			reg.bgid = bgid;
+			if (::syscall(__NR_io_uring_register,_fd,IORING_REGISTER_PBUF_RING,&reg,1) == 0) {
+				_bufSize = size;
+				_bufMask = count - 1;
+				_bufTail = 0;
+				for(unsigned int b=0;b<count;++b)
+					recycleBuffer(b);
+				return true;
+			}
+			::free(_bufs);
+			_bufs = (char *)0;
+		}
+		::munmap((void *)_bufRing,_bufRingSize);
+		_bufRing = (struct io_uring_buf_ring *)MAP_FAILED;
+		return false;
+	}
+
+	/**
+	 * @param bid Provided buffer ID
+	 * @return Pointer to buffer
+	 */
+	inline char *buffer(unsigned int bid) const { return (_bufs + ((size_t)bid * (size_t)_bufSize)); }
+
+	/**
+	 * @return Size of each provided buffer
+	 */
+	inline unsigned int bufferSize() const { return _bufSize; }
+
+	/**
+	 * Give a provided buffer back to the kernel for another receive
+	 *
+	 * @param bid Provided buffer ID
+	 */
+	inline void recycleBuffer(unsigned int bid)
+	{
+		// Index the ring directly: in C++ the header's flexible array member can be
+		// laid out after an empty placeholder struct instead of at offset zero.
+		struct io_uring_buf *const b = reinterpret_cast<struct io_uring_buf *>(_bufRing) + (_bufTail & _bufMask);
+		b->addr = (uint64_t)((uintptr_t)buffer(bid));
+		b->len = _bufSize;
+		b->bid = (uint16_t)bid;
+		++_bufTail;
+		__atomic_store_n(&(_bufRing->tail),(uint16_t)_bufTail,__ATOMIC_RELEASE);
+	}
+
+private:
+	LinuxIoUring(const LinuxIoUring &) = delete;
+	LinuxIoUring &operator=(const LinuxIoUring &) = delete;
+
+	int _fd;
+	void *_ring;
+	size_t _ringSize;
+	struct io_uring_sqe *_sqes;
+	size_t _sqesSize;
+
+	unsigned int *_sqHead;
+	unsigned int *_sqTail;
+	unsigned int *_sqArray;
+	unsigned int _sqMask;
+	unsigned int _sqEntries;
+	unsigned int _sqLocalTail; // entries queued by sqe() but not yet published to the kernel
+
+	unsigned int *_cqHead;
+	unsigned int *_cqTail;
+	struct io_uring_cqe *_cqes;
+	unsigned int _cqMask;
+
+	struct io_uring_buf_ring *_bufRing;
+	size_t _bufRingSize;
+	char *_bufs;
+	unsigned int _bufSize;
+	unsigned int _bufMask;
+	unsigned int _bufTail;
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_IO_URING
+
+#endif
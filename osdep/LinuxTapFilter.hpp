@@ -0,0 +1,417 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_LINUXTAPFILTER_HPP
+#define ZT_LINUXTAPFILTER_HPP
+
+// The program is built and loaded with the bpf() call directly, like the
+// one in LinuxXdp.hpp, and attached to a tap with TUNSETFILTEREBPF (Linux 4.16).
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+#include <sys/syscall.h>
+#if defined(__has_include) && defined(__NR_bpf)
+#if __has_include(<linux/bpf.h>) && __has_include(<linux/if_tun.h>)
+#include <linux/bpf.h>
+#include <linux/if_tun.h>
+#if defined(TUNSETFILTEREBPF) && defined(BPF_JLT)
+#define ZT_HAVE_TAP_FILTER
+#endif
+#endif
+#endif
+#endif
+
+#ifdef ZT_HAVE_TAP_FILTER
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "../include/ZeroTierOne.h"
+#include "../node/Constants.hpp"
+
+namespace ZeroTier {
+
+/**
+ * eBPF socket filter that drops frames written to a tap by the host
+ *
+ * A tap's filter runs in the kernel on each frame the host sends through
+ * it, before the frame is queued for us to read, and a frame it returns 0
+ * for is dropped there. This compiles rule lists from Network::tapFilter()
+ * into such a filter. Sets may only contain MAC, ethertype, IP address, IP
+ * protocol and port range matches and end in DROP or ACCEPT. Matches work
+ * exactly as they do in Network. A frame is passed as soon as an ACCEPT
+ * set matches, and also if it can't be evaluated the same way here, for
+ * example if its IPv6 protocol is behind extension headers or it has a
+ * VLAN tag the kernel holds outside the frame.
+ */
+class LinuxTapFilter
+{
+public:
+	/**
+	 * @param rules Rules
+	 * @param ruleCount Number of rules
+	 * @param prog Filled with program
+	 * @return False if a rule isn't supported
+	 */
+	static inline bool compile(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount,std::vector<struct bpf_insn> &prog)
+	{
+		_Asm a(prog);
+		const int pass = a.label();
+
+		a.i(BPF_ALU64|BPF_MOV|BPF_X,6,1,0,0); // r6 = ctx
+		a.i(BPF_LDX|BPF_MEM|BPF_W,7,6,offsetof(struct __sk_buff,len),0);
+		a.i(BPF_LDX|BPF_MEM|BPF_W,0,6,offsetof(struct __sk_buff,vlan_present),0);
+		a.j(BPF_JNE|BPF_K,0,0,0,pass);
+		a.j(BPF_JLT|BPF_K,7,0,14,pass);
+		a.load(12,2,pass);
+		a.i(BPF_LDX|BPF_MEM|BPF_H,0,10,_BUF,0);
+		a.i(BPF_ALU|BPF_END|BPF_TO_BE,0,0,0,16);
+		a.i(BPF_STX|BPF_MEM|BPF_DW,10,0,_ETHERTYPE,0);
+		a.i(BPF_ALU64|BPF_SUB|BPF_K,7,0,0,14); // r7 = frame length after Ethernet header
+
+		// r9 is the current set's match state and r8 each entry's result
+		a.i(BPF_ALU64|BPF_MOV|BPF_K,9,0,0,1);
+		bool empty = true;
+		for(unsigned int rn=0;rn<ruleCount;++rn) {
+			const unsigned int t = rules[rn].t & 0x3f;
+			if (t <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+				const int next = a.label();
+				if (!empty)
+					a.j(BPF_JEQ|BPF_K,9,0,0,next);
+				if (t == ZT_NETWORK_RULE_ACTION_DROP) {
+					a.i(BPF_ALU64|BPF_MOV|BPF_K,0,0,0,0);
+					a.i(BPF_JMP|BPF_EXIT,0,0,0,0);
+				} else if (t == ZT_NETWORK_RULE_ACTION_ACCEPT) {
+					a.j(BPF_JA,0,0,0,pass);
+				} else return false;
+				if (empty)
+					break; // nothing after an unconditional action is reachable
+				a.bind(next);
+				a.i(BPF_ALU64|BPF_MOV|BPF_K,9,0,0,1);
+				empty = true;
+				continue;
+			}
+
+			if (!_match(a,rules[rn],pass))
+				return false;
+			if ((rules[rn].t & 0x80) != 0)
+				a.i(BPF_ALU64|BPF_XOR|BPF_K,8,0,0,1);
+			a.i(BPF_ALU64|(((rules[rn].t & 0x40) != 0) ? BPF_OR : BPF_AND)|BPF_X,9,8,0,0);
+			empty = false;
+		}
+
+		a.bind(pass);
+		a.i(BPF_LDX|BPF_MEM|BPF_W,0,6,offsetof(struct __sk_buff,len),0); // keep all of it
+		a.i(BPF_JMP|BPF_EXIT,0,0,0,0);
+		a.finish();
+		return true;
+	}
+
+	/**
+	 * Compile and load a filter
+	 *
+	 * @param rules Rules
+	 * @param ruleCount Number of rules
+	 * @return Program file descriptor or -1 if unsupported or not permitted
+	 */
+	static inline int load(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount)
+	{
+		std::vector<struct bpf_insn> prog;
+		if (!compile(rules,ruleCount,prog))
+			return -1;
+		static const char license[] = "GPL";
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+		a.insn_cnt = (uint32_t)prog.size();
+		a.insns = (uint64_t)((uintptr_t)prog.data());
+		a.license = (uint64_t)((uintptr_t)license);
+		return _bpf(BPF_PROG_LOAD,a);
+	}
+
+	/**
+	 * Run a loaded filter on a frame (for testing)
+	 *
+	 * @param progFd Program from load()
+	 * @param frame Ethernet frame
+	 * @param len Length of frame
+	 * @return 1 if passed, 0 if dropped, -1 on error
+	 */
+	static inline int run(const int progFd,const void *frame,const unsigned int len)
+	{
+		// The kernel pulls an Ethernet header off test input before running
+		// socket filters, so the frame goes behind one it can take.
+		std::vector<uint8_t> in(14 + len,0);
+		in[12] = 0x08;
+		memcpy(in.data() + 14,frame,len);
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.test.prog_fd = (uint32_t)progFd;
+		a.test.data_in = (uint64_t)((uintptr_t)in.data());
+		a.test.data_size_in = (uint32_t)in.size();
+		a.test.repeat = 1;
+		if (_bpf(BPF_PROG_TEST_RUN,a) != 0)
+			return -1;
+		return (a.test.retval != 0) ? 1 : 0;
+	}
+
+private:
+	// Stack slots: the frame's ethertype and a buffer fields are loaded into
+	static const int16_t _ETHERTYPE = -8;
+	static const int16_t _BUF = -24;
+
+	// Instructions with jumps to labels that are fixed up once all are bound
+	class _Asm
+	{
+	public:
+		_Asm(std::vector<struct bpf_insn> &p) : _p(p) { _p.clear(); }
+
+		inline void i(uint8_t code,uint8_t dst,uint8_t src,int16_t off,int32_t imm)
+		{
+			struct bpf_insn x;
+			memset(&x,0,sizeof(x));
+			x.code = code;
+			x.dst_reg = dst;
+			x.src_reg = src;
+			x.off = off;
+			x.imm = imm;
+			_p.push_back(x);
+		}
+
+		// dst = 64-bit immediate (takes two instructions)
+		inline void imm64(uint8_t dst,uint64_t v)
+		{
+			i(BPF_LD|BPF_DW|BPF_IMM,dst,0,0,(int32_t)(uint32_t)v);
+			i(0,0,0,0,(int32_t)(uint32_t)(v >> 32));
+		}
+
+		inline int label() { _labels.push_back(-1); return (int)_labels.size() - 1; }
+		inline void bind(int l) { _labels[l] = (int)_p.size(); }
+
+		inline void j(uint8_t op,uint8_t dst,uint8_t src,int32_t imm,int l)
+		{
+			_fixups.push_back(std::pair<unsigned int,int>((unsigned int)_p.size(),l));
+			i(BPF_JMP|op,dst,src,0,imm);
+		}
+
+		// Load n bytes at offset (or at r2 if offset < 0) into the stack buffer, passing if out of bounds
+		inline void load(int offset,int n,int pass)
+		{
+			if (offset >= 0)
+				i(BPF_ALU64|BPF_MOV|BPF_K,2,0,0,offset);
+			i(BPF_ALU64|BPF_MOV|BPF_X,1,6,0,0);
+			i(BPF_ALU64|BPF_MOV|BPF_X,3,10,0,0);
+			i(BPF_ALU64|BPF_ADD|BPF_K,3,0,0,_BUF);
+			i(BPF_ALU64|BPF_MOV|BPF_K,4,0,0,n);
+			i(BPF_JMP|BPF_CALL,0,0,0,BPF_FUNC_skb_load_bytes);
+			j(BPF_JNE|BPF_K,0,0,0,pass);
+		}
+
+		inline void finish()
+		{
+			for(std::vector< std::pair<unsigned int,int> >::const_iterator f(_fixups.begin());f!=_fixups.end();++f)
+				_p[f->first].off = (int16_t)(_labels[f->second] - (int)f->first - 1);
+		}
+
+	private:
+		std::vector<struct bpf_insn> &_p;
+		std::vector<int> _labels;
+		std::vector< std::pair<unsigned int,int> > _fixups;
+	};
+
+	static inline int _bpf(int cmd,union bpf_attr &a) { return (int)::syscall(__NR_bpf,cmd,&a,sizeof(a)); }
+
+	// Frame bytes as they sit in memory, for comparing with what's loaded from the stack
+	static inline uint32_t _raw32(const uint8_t *b) { uint32_t v; memcpy(&v,b,4); return v; }
+	static inline uint16_t _raw16(const uint8_t *b) { uint16_t v; memcpy(&v,b,2); return v; }
+
+	// Jumps to fail unless the frame's ethertype is et and at least min bytes follow its header
+	static inline void _need(_Asm &a,unsigned int et,unsigned int min,int fail)
+	{
+		a.i(BPF_LDX|BPF_MEM|BPF_DW,0,10,_ETHERTYPE,0);
+		a.j(BPF_JNE|BPF_K,0,0,(int32_t)et,fail);
+		a.j(BPF_JLT|BPF_K,7,0,(int32_t)min,fail);
+	}
+
+	// Jumps to pass if r0 is an IPv6 extension header Network would walk past
+	static inline void _extensionHeader(_Asm &a,int pass)
+	{
+		static const int32_t ext[4] = { 0,43,60,135 };
+		for(unsigned int k=0;k<4;++k)
+			a.j(BPF_JEQ|BPF_K,0,0,ext[k],pass);
+	}
+
+	// Jumps to fail unless r0 is an IP protocol with ports first
+	static inline void _portProtocol(_Asm &a,int fail)
+	{
+		const int ok = a.label();
+		a.j(BPF_JEQ|BPF_K,0,0,0x06,ok); // TCP
+		a.j(BPF_JEQ|BPF_K,0,0,0x11,ok); // UDP
+		a.j(BPF_JEQ|BPF_K,0,0,0x84,ok); // SCTP
+		a.j(BPF_JNE|BPF_K,0,0,0x88,fail); // UDPLite
+		a.bind(ok);
+	}
+
+	// Sets r8 to whether a MATCH entry matches, before NOT
+	static inline bool _match(_Asm &a,const ZT_VirtualNetworkRule &r,int pass)
+	{
+		const int matched = a.label(),fail = a.label(),done = a.label();
+		switch(r.t & 0x3f) {
+			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+				a.load(((r.t & 0x3f) == ZT_NETWORK_RULE_MATCH_MAC_SOURCE) ? 6 : 0,6,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_W,0,10,_BUF,0);
+				a.imm64(1,_raw32(r.v.mac));
+				a.j(BPF_JNE|BPF_X,0,1,0,fail);
+				a.i(BPF_LDX|BPF_MEM|BPF_H,0,10,_BUF + 4,0);
+				a.j(BPF_JNE|BPF_K,0,0,_raw16(r.v.mac + 4),fail);
+				break;
+
+			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+				a.i(BPF_LDX|BPF_MEM|BPF_DW,0,10,_ETHERTYPE,0);
+				a.j(BPF_JNE|BPF_K,0,0,r.v.etherType,fail);
+				break;
+
+			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV4_DEST: {
+				if (r.v.ipv4.mask > 32)
+					return false;
+				_need(a,ZT_ETHERTYPE_IPV4,20,fail);
+				if (r.v.ipv4.mask) {
+					uint8_t ip[4],m[4];
+					memcpy(ip,&(r.v.ipv4.ip),4);
+					for(unsigned int k=0;k<4;++k) {
+						const unsigned int bits = (r.v.ipv4.mask > (k * 8)) ? (r.v.ipv4.mask - (k * 8)) : 0;
+						m[k] = (bits >= 8) ? 0xff : (uint8_t)(0xff << (8 - bits));
+						ip[k] &= m[k];
+					}
+					a.load(14 + (((r.t & 0x3f) == ZT_NETWORK_RULE_MATCH_IPV4_SOURCE) ? 12 : 16),4,pass);
+					a.i(BPF_LDX|BPF_MEM|BPF_W,0,10,_BUF,0);
+					a.imm64(1,_raw32(m));
+					a.i(BPF_ALU64|BPF_AND|BPF_X,0,1,0,0);
+					a.imm64(1,_raw32(ip));
+					a.j(BPF_JNE|BPF_X,0,1,0,fail);
+				}
+			}	break;
+
+			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV6_DEST: {
+				if (r.v.ipv6.mask > 128)
+					return false;
+				_need(a,ZT_ETHERTYPE_IPV6,40,fail);
+				a.load(14 + (((r.t & 0x3f) == ZT_NETWORK_RULE_MATCH_IPV6_SOURCE) ? 8 : 24),16,pass);
+				for(unsigned int w=0;w<4;++w) {
+					// As in InetAddress::containsAddress() only the frame's address is masked
+					uint8_t m[4];
+					for(unsigned int k=0;k<4;++k) {
+						const unsigned int bits = (r.v.ipv6.mask > ((w * 32) + (k * 8))) ? (r.v.ipv6.mask - ((w * 32) + (k * 8))) : 0;
+						m[k] = (bits >= 8) ? 0xff : (uint8_t)(0xff << (8 - bits));
+					}
+					a.i(BPF_LDX|BPF_MEM|BPF_W,0,10,_BUF + (4 * w),0);
+					a.imm64(1,_raw32(m));
+					a.i(BPF_ALU64|BPF_AND|BPF_X,0,1,0,0);
+					a.imm64(1,_raw32(r.v.ipv6.ip + (4 * w)));
+					a.j(BPF_JNE|BPF_X,0,1,0,fail);
+				}
+			}	break;
+
+			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL: {
+				const int v6 = a.label();
+				a.i(BPF_LDX|BPF_MEM|BPF_DW,0,10,_ETHERTYPE,0);
+				a.j(BPF_JNE|BPF_K,0,0,ZT_ETHERTYPE_IPV4,v6);
+				a.j(BPF_JLT|BPF_K,7,0,20,fail);
+				a.load(14 + 9,1,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_B,0,10,_BUF,0);
+				a.j(BPF_JNE|BPF_K,0,0,r.v.ipProtocol,fail);
+				a.j(BPF_JA,0,0,0,matched);
+				a.bind(v6);
+				_need(a,ZT_ETHERTYPE_IPV6,40,fail);
+				a.load(14 + 6,1,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_B,0,10,_BUF,0);
+				_extensionHeader(a,pass);
+				a.j(BPF_JNE|BPF_K,0,0,r.v.ipProtocol,fail);
+			}	break;
+
+			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE: {
+				const int dp = ((r.t & 0x3f) == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 2 : 0;
+				const int v6 = a.label(),check = a.label();
+				a.i(BPF_LDX|BPF_MEM|BPF_DW,0,10,_ETHERTYPE,0);
+				a.j(BPF_JNE|BPF_K,0,0,ZT_ETHERTYPE_IPV4,v6);
+				a.j(BPF_JLT|BPF_K,7,0,20,fail);
+				a.load(14,1,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_B,8,10,_BUF,0);
+				a.i(BPF_ALU64|BPF_AND|BPF_K,8,0,0,0x0f);
+				a.i(BPF_ALU64|BPF_LSH|BPF_K,8,0,0,2); // r8 = IPv4 header length
+				a.load(14 + 9,1,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_B,0,10,_BUF,0);
+				_portProtocol(a,fail);
+				a.i(BPF_ALU64|BPF_MOV|BPF_X,0,8,0,0);
+				a.i(BPF_ALU64|BPF_ADD|BPF_K,0,0,0,4);
+				a.j(BPF_JGE|BPF_X,0,7,0,fail);
+				a.i(BPF_ALU64|BPF_MOV|BPF_X,2,8,0,0);
+				a.i(BPF_ALU64|BPF_ADD|BPF_K,2,0,0,14 + dp);
+				a.load(-1,2,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_H,0,10,_BUF,0);
+				a.i(BPF_ALU|BPF_END|BPF_TO_BE,0,0,0,16);
+				a.j(BPF_JA,0,0,0,check);
+				a.bind(v6);
+				_need(a,ZT_ETHERTYPE_IPV6,40,fail);
+				a.load(14 + 6,1,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_B,0,10,_BUF,0);
+				_extensionHeader(a,pass);
+				_portProtocol(a,fail);
+				a.j(BPF_JLE|BPF_K,7,0,44,fail);
+				a.load(14 + 40 + dp,2,pass);
+				a.i(BPF_LDX|BPF_MEM|BPF_H,0,10,_BUF,0);
+				a.i(BPF_ALU|BPF_END|BPF_TO_BE,0,0,0,16);
+				a.j(BPF_JEQ|BPF_K,0,0,0,fail); // port 0 never matches over IPv6
+				a.bind(check);
+				a.j(BPF_JLT|BPF_K,0,0,r.v.port[0],fail);
+				a.j(BPF_JGT|BPF_K,0,0,r.v.port[1],fail);
+			}	break;
+
+			default:
+				return false;
+		}
+		a.bind(matched);
+		a.i(BPF_ALU64|BPF_MOV|BPF_K,8,0,0,1);
+		a.j(BPF_JA,0,0,0,done);
+		a.bind(fail);
+		a.i(BPF_ALU64|BPF_MOV|BPF_K,8,0,0,0);
+		a.bind(done);
+		return true;
+	}
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_TAP_FILTER
+
+#endif
@@ -0,0 +1,744 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_LINUXXDP_HPP
+#define ZT_LINUXXDP_HPP
+
+// AF_XDP and the bpf() calls to load and attach an XDP program are used
+// directly, so there is no libbpf or libxdp dependency. The headers have to
+// be new enough for XDP links (Linux 5.9, checked through a later flag).
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+#include <sys/syscall.h>
+#if defined(__has_include) && defined(__NR_bpf)
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#if defined(XDP_USE_NEED_WAKEUP) && defined(BPF_F_XDP_HAS_FRAGS)
+#define ZT_HAVE_XDP
+#endif
+#endif
+#endif
+#endif
+
+#ifdef ZT_HAVE_XDP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+
+#include <map>
+#include <mutex>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// Frames in each queue's UMEM are this big, and half of them are for receive
+#define ZT_XDP_FRAME_SIZE 2048
+#define ZT_XDP_RING_SIZE 2048
+#define ZT_XDP_FRAMES (ZT_XDP_RING_SIZE * 2)
+
+#define ZT_XDP_MAX_QUEUES 64
+#define ZT_XDP_MAX_PORTS 64
+
+// Frames taken from the receive ring per receive() call
+#define ZT_XDP_RX_BATCH 64
+
+// Remote addresses whose next hop MAC we know, direct mapped by address hash
+#define ZT_XDP_NEIGHBORS 4096
+
+namespace ZeroTier {
+
+/**
+ * AF_XDP sockets and an XDP program that steers UDP ports into them
+ *
+ * The program is attached to one interface and redirects UDP datagrams (not
+ * fragments) to any port added with addPort() into an AF_XDP socket on the
+ * receiving queue. Everything else, and anything on queues without a socket,
+ * goes to the kernel network stack as usual.
+ *
+ * Frames are read in place from each queue's UMEM. Sends are built as whole
+ * Ethernet frames, so they only go out this way to addresses something was
+ * received from on this interface: the frame that came in tells us the next
+ * hop MAC and which local address was used. send() returns false otherwise
+ * and the caller should use a normal socket.
+ *
+ * receive() and release() are for one thread (the one polling the sockets).
+ * Everything else may be called from any thread.
+ */
+class LinuxXdp
+{
+public:
+	/**
+	 * A UDP datagram found in a received frame
+	 */
+	struct Datagram
+	{
+		struct sockaddr_storage from;
+		struct sockaddr_storage to;
+		const void *data;
+		unsigned int len;
+	};
+
+	LinuxXdp() :
+		_ifindex(0),
+		_queueCount(0),
+		_progFd(-1),
+		_xsksFd(-1),
+		_portsFd(-1),
+		_linkFd(-1),
+		_ipId(0)
+	{
+		memset(_queues,0,sizeof(_queues));
+		for(unsigned int q=0;q<ZT_XDP_MAX_QUEUES;++q)
+			_queues[q].fd = -1;
+		_neighbors = new _Neighbor[ZT_XDP_NEIGHBORS];
+		memset(_neighbors,0,sizeof(_Neighbor) * ZT_XDP_NEIGHBORS);
+	}
+
+	~LinuxXdp()
+	{
+		if (_linkFd >= 0)
+			::close(_linkFd); // detaches the program
+		for(unsigned int q=0;q<_queueCount;++q)
+			_closeQueue(_queues[q]);
+		if (_progFd >= 0)
+			::close(_progFd);
+		if (_xsksFd >= 0)
+			::close(_xsksFd);
+		if (_portsFd >= 0)
+			::close(_portsFd);
+		delete [] _neighbors;
+	}
+
+	/**
+	 * Create sockets on an interface's first queues and attach the program
+	 *
+	 * The interface's RSS or flow steering should send ZeroTier traffic to
+	 * these queues. The driver's native XDP is used if it has one.
+	 *
+	 * @param ifname Interface name
+	 * @param queues Number of queues starting at queue 0
+	 * @return True on success, false if AF_XDP is unavailable or not permitted
+	 */
+	inline bool init(const char *ifname,unsigned int queues)
+	{
+		if ((_queueCount)||(!queues)||(queues > ZT_XDP_MAX_QUEUES))
+			return false;
+		_ifindex = if_nametoindex(ifname);
+		if (!_ifindex)
+			return false;
+
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.map_type = BPF_MAP_TYPE_XSKMAP;
+		a.key_size = 4;
+		a.value_size = 4;
+		a.max_entries = queues;
+		_xsksFd = _bpf(BPF_MAP_CREATE,a);
+		memset(&a,0,sizeof(a));
+		a.map_type = BPF_MAP_TYPE_HASH;
+		a.key_size = 4;
+		a.value_size = 4;
+		a.max_entries = ZT_XDP_MAX_PORTS;
+		_portsFd = _bpf(BPF_MAP_CREATE,a);
+		if ((_xsksFd < 0)||(_portsFd < 0)||(!_loadProgram()))
+			return false;
+
+		for(unsigned int q=0;q<queues;++q) {
+			if (!_openQueue(_queues[q],q))
+				return false;
+			++_queueCount;
+			uint32_t k = q,v = (uint32_t)_queues[q].fd;
+			memset(&a,0,sizeof(a));
+			a.map_fd = (uint32_t)_xsksFd;
+			a.key = (uint64_t)((uintptr_t)&k);
+			a.value = (uint64_t)((uintptr_t)&v);
+			if (_bpf(BPF_MAP_UPDATE_ELEM,a) != 0)
+				return false;
+		}
+
+		for(unsigned int mode=0;mode<2;++mode) {
+			memset(&a,0,sizeof(a));
+			a.link_create.prog_fd = (uint32_t)_progFd;
+			a.link_create.target_ifindex = _ifindex;
+			a.link_create.attach_type = BPF_XDP;
+			a.link_create.flags = (mode == 0) ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+			_linkFd = _bpf(BPF_LINK_CREATE,a);
+			if (_linkFd >= 0)
+				return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @return Number of queues with sockets
+	 */
+	inline unsigned int queues() const { return _queueCount; }
+
+	/**
+	 * @param q Queue
+	 * @return AF_XDP socket for queue (readable when frames are waiting)
+	 */
+	inline int fd(unsigned int q) const { return _queues[q].fd; }
+
+	/**
+	 * @return Index of attached interface
+	 */
+	inline unsigned int ifindex() const { return _ifindex; }
+
+	/**
+	 * Start steering a UDP port into the sockets
+	 *
+	 * Ports are reference counted since several sockets may share one.
+	 *
+	 * @param port Port in host byte order
+	 * @return True if port is now steered
+	 */
+	inline bool addPort(unsigned int port)
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		unsigned int &refs = _ports[port];
+		if (refs++)
+			return true;
+		uint32_t k = htons((uint16_t)port),v = 1;
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.map_fd = (uint32_t)_portsFd;
+		a.key = (uint64_t)((uintptr_t)&k);
+		a.value = (uint64_t)((uintptr_t)&v);
+		if (_bpf(BPF_MAP_UPDATE_ELEM,a) == 0)
+			return true;
+		_ports.erase(port);
+		return false;
+	}
+
+	/**
+	 * Hand a UDP port back to the kernel once no socket uses it
+	 *
+	 * @param port Port in host byte order
+	 */
+	inline void removePort(unsigned int port)
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		std::map<unsigned int,unsigned int>::iterator p(_ports.find(port));
+		if ((p == _ports.end())||(--(p->second) > 0))
+			return;
+		_ports.erase(p);
+		uint32_t k = htons((uint16_t)port);
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.map_fd = (uint32_t)_portsFd;
+		a.key = (uint64_t)((uintptr_t)&k);
+		_bpf(BPF_MAP_DELETE_ELEM,a);
+	}
+
+	/**
+	 * Take received frames from a queue and find their UDP datagrams
+	 *
+	 * Datagram payloads point into the UMEM and stay valid until release().
+	 * Frames that aren't UDP datagrams we can parse are skipped.
+	 *
+	 * @param q Queue
+	 * @param d Datagrams are written here
+	 * @param max Size of d, no more than ZT_XDP_RX_BATCH
+	 * @return Number of datagrams (0 doesn't mean no frames were taken, call release() anyway)
+	 */
+	inline unsigned int receive(unsigned int q,Datagram *d,unsigned int max)
+	{
+		_Queue &qu = _queues[q];
+		const uint32_t cons = *(qu.rx.consumer);
+		uint32_t avail = __atomic_load_n(qu.rx.producer,__ATOMIC_ACQUIRE) - cons;
+		if (avail > max)
+			avail = max;
+		if (avail > ZT_XDP_RX_BATCH)
+			avail = ZT_XDP_RX_BATCH;
+		unsigned int count = 0;
+		std::lock_guard<std::mutex> l(_lock); // for the neighbor table
+		for(uint32_t i=0;i<avail;++i) {
+			const struct xdp_desc &desc = reinterpret_cast<const struct xdp_desc *>(qu.rx.desc)[(cons + i) & (ZT_XDP_RING_SIZE - 1)];
+			qu.held[qu.heldCount++] = desc.addr;
+			if (_parse(reinterpret_cast<const uint8_t *>(qu.umem + desc.addr),desc.len,d[count]))
+				++count;
+		}
+		__atomic_store_n(qu.rx.consumer,cons + avail,__ATOMIC_RELEASE);
+		return count;
+	}
+
+	/**
+	 * Give frames taken by the last receive() on a queue back for more receives
+	 *
+	 * @param q Queue
+	 */
+	inline void release(unsigned int q)
+	{
+		_Queue &qu = _queues[q];
+		if (!qu.heldCount)
+			return;
+		const uint32_t prod = *(qu.fill.producer);
+		for(unsigned int i=0;i<qu.heldCount;++i)
+			reinterpret_cast<uint64_t *>(qu.fill.desc)[(prod + i) & (ZT_XDP_RING_SIZE - 1)] = qu.held[i];
+		__atomic_store_n(qu.fill.producer,prod + qu.heldCount,__ATOMIC_RELEASE);
+		qu.heldCount = 0;
+		if ((__atomic_load_n(qu.fill.flags,__ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) != 0)
+			::recvfrom(qu.fd,(void *)0,0,MSG_DONTWAIT,(struct sockaddr *)0,(socklen_t *)0);
+	}
+
+	/**
+	 * Queue a UDP datagram for sending as an Ethernet frame
+	 *
+	 * Call flush() after one or more of these to start transmission.
+	 *
+	 * @param local Local address and port (address may be a wildcard)
+	 * @param to Destination
+	 * @param ttl IP TTL or hop limit
+	 * @param data Payload
+	 * @param len Payload length
+	 * @return True if queued, false if the destination hasn't been heard from here or no frame is free
+	 */
+	inline bool send(const struct sockaddr *local,const struct sockaddr *to,const unsigned int ttl,const void *data,const unsigned int len)
+	{
+		const bool v6 = (to->sa_family == AF_INET6);
+		if (((!v6)&&(to->sa_family != AF_INET))||(local->sa_family != to->sa_family))
+			return false;
+		const unsigned int hlen = 14 + ((v6) ? 40 : 20) + 8;
+		if ((len + hlen) > ZT_XDP_FRAME_SIZE)
+			return false;
+		if ((v6)&&(reinterpret_cast<const struct sockaddr_in6 *>(to)->sin6_scope_id)&&(reinterpret_cast<const struct sockaddr_in6 *>(to)->sin6_scope_id != _ifindex))
+			return false; // link-local address on some other interface
+		const uint8_t *const dip = _ip(to);
+		const unsigned int alen = (v6) ? 16 : 4;
+
+		std::lock_guard<std::mutex> l(_lock);
+		const _Neighbor &nb = _neighbors[_hash(dip,alen)];
+		if ((nb.family != to->sa_family)||(memcmp(nb.ip,dip,alen) != 0))
+			return false;
+		const uint8_t *sip = _ip(local);
+		bool wildcard = true;
+		for(unsigned int i=0;i<alen;++i) {
+			if (sip[i]) {
+				wildcard = false;
+				break;
+			}
+		}
+		if (wildcard)
+			sip = nb.local;
+
+		_Queue &qu = _queues[0];
+		_reclaim(qu);
+		if ((!qu.txFreeCount)||((*(qu.tx.producer) - __atomic_load_n(qu.tx.consumer,__ATOMIC_ACQUIRE)) >= ZT_XDP_RING_SIZE))
+			return false;
+		const uint64_t addr = qu.txFree[--qu.txFreeCount];
+		uint8_t *const f = reinterpret_cast<uint8_t *>(qu.umem + addr);
+
+		memcpy(f,nb.mac,6);
+		memcpy(f + 6,nb.localMac,6);
+		const unsigned int hops = ((ttl == 0)||(ttl > 255)) ? 255 : ttl;
+		uint8_t *udp;
+		if (v6) {
+			_put16(f + 12,0x86dd);
+			uint8_t *const ip = f + 14;
+			ip[0] = 0x60; ip[1] = 0; ip[2] = 0; ip[3] = 0;
+			_put16(ip + 4,len + 8);
+			ip[6] = 17;
+			ip[7] = (uint8_t)hops;
+			memcpy(ip + 8,sip,16);
+			memcpy(ip + 24,dip,16);
+			udp = ip + 40;
+		} else {
+			_put16(f + 12,0x0800);
+			uint8_t *const ip = f + 14;
+			ip[0] = 0x45; ip[1] = 0;
+			_put16(ip + 2,len + 28);
+			_put16(ip + 4,(unsigned int)(++_ipId));
+			_put16(ip + 6,0);
+			ip[8] = (uint8_t)hops;
+			ip[9] = 17;
+			_put16(ip + 10,0);
+			memcpy(ip + 12,sip,4);
+			memcpy(ip + 16,dip,4);
+			_put16(ip + 10,_fold(_sum(ip,20,0)));
+			udp = ip + 20;
+		}
+		memcpy(udp,&(reinterpret_cast<const struct sockaddr_in *>(local)->sin_port),2); // same offset in sockaddr_in6
+		memcpy(udp + 2,&(reinterpret_cast<const struct sockaddr_in *>(to)->sin_port),2);
+		_put16(udp + 4,len + 8);
+		_put16(udp + 6,0);
+		memcpy(udp + 8,data,len);
+		if (v6) { // IPv6 requires UDP checksums, IPv4 sends none like SO_NO_CHECK
+			uint32_t s = _sum(sip,16,0);
+			s = _sum(dip,16,s);
+			s += (uint32_t)(len + 8) + 17;
+			uint16_t c = _fold(_sum(udp,len + 8,s));
+			_put16(udp + 6,(c) ? c : 0xffff);
+		}
+
+		const uint32_t prod = *(qu.tx.producer);
+		struct xdp_desc &desc = reinterpret_cast<struct xdp_desc *>(qu.tx.desc)[prod & (ZT_XDP_RING_SIZE - 1)];
+		desc.addr = addr;
+		desc.len = len + hlen;
+		desc.options = 0;
+		__atomic_store_n(qu.tx.producer,prod + 1,__ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 * Start transmission of frames queued by send()
+	 */
+	inline void flush()
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_Queue &qu = _queues[0];
+		if ((__atomic_load_n(qu.tx.flags,__ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) != 0)
+			::sendto(qu.fd,(const void *)0,0,MSG_DONTWAIT,(const struct sockaddr *)0,0);
+	}
+
+private:
+	LinuxXdp(const LinuxXdp &) = delete;
+	LinuxXdp &operator=(const LinuxXdp &) = delete;
+
+	struct _Ring
+	{
+		uint32_t *producer;
+		uint32_t *consumer;
+		uint32_t *flags;
+		void *desc;
+		void *map;
+		size_t mapSize;
+	};
+
+	struct _Queue
+	{
+		int fd;
+		char *umem;
+		_Ring fill,comp,rx,tx;
+		uint64_t held[ZT_XDP_RX_BATCH]; // frames from the last receive()
+		unsigned int heldCount;
+		uint64_t txFree[ZT_XDP_RING_SIZE]; // send frames not in flight
+		unsigned int txFreeCount;
+	};
+
+	struct _Neighbor
+	{
+		uint16_t family; // 0 if empty
+		uint8_t ip[16]; // remote address
+		uint8_t local[16]; // our address it sent to
+		uint8_t mac[6]; // next hop toward it
+		uint8_t localMac[6]; // our MAC it sent to
+	};
+
+	static inline int _bpf(int cmd,union bpf_attr &a) { return (int)::syscall(__NR_bpf,cmd,&a,sizeof(a)); }
+
+	static inline struct bpf_insn _insn(uint8_t code,uint8_t dst,uint8_t src,int16_t off,int32_t imm)
+	{
+		struct bpf_insn i;
+		memset(&i,0,sizeof(i));
+		i.code = code;
+		i.dst_reg = dst;
+		i.src_reg = src;
+		i.off = off;
+		i.imm = imm;
+		return i;
+	}
+
+	// Builds and loads: pass anything that isn't an unfragmented UDP datagram
+	// (IPv4 without options or IPv6 without extension headers) to a port in
+	// the ports map, redirect the rest to the socket for its receive queue.
+	inline bool _loadProgram()
+	{
+		enum { PASS = 37,V6 = 18,PORT = 24 };
+		struct bpf_insn p[39];
+		p[0] = _insn(BPF_ALU64|BPF_MOV|BPF_X,6,1,0,0);        // r6 = ctx
+		p[1] = _insn(BPF_LDX|BPF_MEM|BPF_W,2,6,0,0);          // r2 = data
+		p[2] = _insn(BPF_LDX|BPF_MEM|BPF_W,3,6,4,0);          // r3 = data_end
+		p[3] = _insn(BPF_ALU64|BPF_MOV|BPF_X,4,2,0,0);
+		p[4] = _insn(BPF_ALU64|BPF_ADD|BPF_K,4,0,0,42);
+		p[5] = _insn(BPF_JMP|BPF_JGT|BPF_X,4,3,PASS - 6,0);   // Ethernet + IPv4 + UDP
+		p[6] = _insn(BPF_LDX|BPF_MEM|BPF_H,5,2,12,0);
+		p[7] = _insn(BPF_JMP|BPF_JEQ|BPF_K,5,0,V6 - 8,htons(0x86dd));
+		p[8] = _insn(BPF_JMP|BPF_JNE|BPF_K,5,0,PASS - 9,htons(0x0800));
+		p[9] = _insn(BPF_LDX|BPF_MEM|BPF_B,5,2,14,0);
+		p[10] = _insn(BPF_JMP|BPF_JNE|BPF_K,5,0,PASS - 11,0x45);
+		p[11] = _insn(BPF_LDX|BPF_MEM|BPF_B,5,2,23,0);
+		p[12] = _insn(BPF_JMP|BPF_JNE|BPF_K,5,0,PASS - 13,17);
+		p[13] = _insn(BPF_LDX|BPF_MEM|BPF_H,5,2,20,0);
+		p[14] = _insn(BPF_ALU64|BPF_AND|BPF_K,5,0,0,htons(0x3fff));
+		p[15] = _insn(BPF_JMP|BPF_JNE|BPF_K,5,0,PASS - 16,0); // more fragments or offset
+		p[16] = _insn(BPF_LDX|BPF_MEM|BPF_H,5,2,36,0);
+		p[17] = _insn(BPF_JMP|BPF_JA,0,0,PORT - 18,0);
+		p[18] = _insn(BPF_ALU64|BPF_MOV|BPF_X,4,2,0,0);       // V6
+		p[19] = _insn(BPF_ALU64|BPF_ADD|BPF_K,4,0,0,62);
+		p[20] = _insn(BPF_JMP|BPF_JGT|BPF_X,4,3,PASS - 21,0); // Ethernet + IPv6 + UDP
+		p[21] = _insn(BPF_LDX|BPF_MEM|BPF_B,5,2,20,0);
+		p[22] = _insn(BPF_JMP|BPF_JNE|BPF_K,5,0,PASS - 23,17);
+		p[23] = _insn(BPF_LDX|BPF_MEM|BPF_H,5,2,56,0);
+		p[24] = _insn(BPF_STX|BPF_MEM|BPF_W,10,5,-4,0);       // PORT: look up destination port
+		p[25] = _insn(BPF_ALU64|BPF_MOV|BPF_X,2,10,0,0);
+		p[26] = _insn(BPF_ALU64|BPF_ADD|BPF_K,2,0,0,-4);
+		p[27] = _insn(BPF_LD|BPF_DW|BPF_IMM,1,BPF_PSEUDO_MAP_FD,0,_portsFd);
+		p[28] = _insn(0,0,0,0,0);
+		p[29] = _insn(BPF_JMP|BPF_CALL,0,0,0,BPF_FUNC_map_lookup_elem);
+		p[30] = _insn(BPF_JMP|BPF_JEQ|BPF_K,0,0,PASS - 31,0);
+		p[31] = _insn(BPF_LD|BPF_DW|BPF_IMM,1,BPF_PSEUDO_MAP_FD,0,_xsksFd);
+		p[32] = _insn(0,0,0,0,0);
+		p[33] = _insn(BPF_LDX|BPF_MEM|BPF_W,2,6,16,0);        // rx_queue_index
+		p[34] = _insn(BPF_ALU64|BPF_MOV|BPF_K,3,0,0,XDP_PASS); // if its queue has no socket
+		p[35] = _insn(BPF_JMP|BPF_CALL,0,0,0,BPF_FUNC_redirect_map);
+		p[36] = _insn(BPF_JMP|BPF_EXIT,0,0,0,0);
+		p[37] = _insn(BPF_ALU64|BPF_MOV|BPF_K,0,0,0,XDP_PASS); // PASS
+		p[38] = _insn(BPF_JMP|BPF_EXIT,0,0,0,0);
+
+		static const char license[] = "GPL";
+		union bpf_attr a;
+		memset(&a,0,sizeof(a));
+		a.prog_type = BPF_PROG_TYPE_XDP;
+		a.insn_cnt = sizeof(p) / sizeof(struct bpf_insn);
+		a.insns = (uint64_t)((uintptr_t)p);
+		a.license = (uint64_t)((uintptr_t)license);
+		_progFd = _bpf(BPF_PROG_LOAD,a);
+		return (_progFd >= 0);
+	}
+
+	static inline bool _mapRing(_Ring &r,const int fd,const struct xdp_ring_offset &off,const size_t descSize,const uint64_t pgoff)
+	{
+		r.mapSize = off.desc + (ZT_XDP_RING_SIZE * descSize);
+		r.map = ::mmap((void *)0,r.mapSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,(off_t)pgoff);
+		if (r.map == MAP_FAILED) {
+			r.map = (void *)0;
+			return false;
+		}
+		char *const m = reinterpret_cast<char *>(r.map);
+		r.producer = reinterpret_cast<uint32_t *>(m + off.producer);
+		r.consumer = reinterpret_cast<uint32_t *>(m + off.consumer);
+		r.flags = reinterpret_cast<uint32_t *>(m + off.flags);
+		r.desc = (void *)(m + off.desc);
+		return true;
+	}
+
+	inline bool _openQueue(_Queue &qu,const unsigned int q)
+	{
+		qu.fd = ::socket(AF_XDP,SOCK_RAW|SOCK_CLOEXEC,0);
+		if (qu.fd < 0)
+			return false;
+		qu.umem = (char *)::mmap((void *)0,(size_t)ZT_XDP_FRAMES * ZT_XDP_FRAME_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if (qu.umem == (char *)MAP_FAILED) {
+			qu.umem = (char *)0;
+			return false;
+		}
+
+		struct xdp_umem_reg mr;
+		memset(&mr,0,sizeof(mr));
+		mr.addr = (uint64_t)((uintptr_t)qu.umem);
+		mr.len = (uint64_t)ZT_XDP_FRAMES * ZT_XDP_FRAME_SIZE;
+		mr.chunk_size = ZT_XDP_FRAME_SIZE;
+		int n = ZT_XDP_RING_SIZE;
+		if ((::setsockopt(qu.fd,SOL_XDP,XDP_UMEM_REG,&mr,sizeof(mr)) != 0)
+		  ||(::setsockopt(qu.fd,SOL_XDP,XDP_UMEM_FILL_RING,&n,sizeof(n)) != 0)
+		  ||(::setsockopt(qu.fd,SOL_XDP,XDP_UMEM_COMPLETION_RING,&n,sizeof(n)) != 0)
+		  ||(::setsockopt(qu.fd,SOL_XDP,XDP_RX_RING,&n,sizeof(n)) != 0)
+		  ||(::setsockopt(qu.fd,SOL_XDP,XDP_TX_RING,&n,sizeof(n)) != 0))
+			return false;
+
+		struct xdp_mmap_offsets off;
+		socklen_t offlen = sizeof(off);
+		if ((::getsockopt(qu.fd,SOL_XDP,XDP_MMAP_OFFSETS,&off,&offlen) != 0)
+		  ||(!_mapRing(qu.fill,qu.fd,off.fr,sizeof(uint64_t),XDP_UMEM_PGOFF_FILL_RING))
+		  ||(!_mapRing(qu.comp,qu.fd,off.cr,sizeof(uint64_t),XDP_UMEM_PGOFF_COMPLETION_RING))
+		  ||(!_mapRing(qu.rx,qu.fd,off.rx,sizeof(struct xdp_desc),XDP_PGOFF_RX_RING))
+		  ||(!_mapRing(qu.tx,qu.fd,off.tx,sizeof(struct xdp_desc),XDP_PGOFF_TX_RING)))
+			return false;
+
+		// The first half of the frames is for receive, the second for send
+		for(unsigned int i=0;i<ZT_XDP_RING_SIZE;++i)
+			reinterpret_cast<uint64_t *>(qu.fill.desc)[i] = (uint64_t)i * ZT_XDP_FRAME_SIZE;
+		__atomic_store_n(qu.fill.producer,(uint32_t)ZT_XDP_RING_SIZE,__ATOMIC_RELEASE);
+		for(unsigned int i=0;i<ZT_XDP_RING_SIZE;++i)
+			qu.txFree[i] = (uint64_t)(ZT_XDP_RING_SIZE + i) * ZT_XDP_FRAME_SIZE;
+		qu.txFreeCount = ZT_XDP_RING_SIZE;
+
+		struct sockaddr_xdp sxdp;
+		memset(&sxdp,0,sizeof(sxdp));
+		sxdp.sxdp_family = AF_XDP;
+		sxdp.sxdp_ifindex = _ifindex;
+		sxdp.sxdp_queue_id = q;
+		sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP; // zero copy if the driver supports it, otherwise copy mode
+		return (::bind(qu.fd,(const struct sockaddr *)&sxdp,sizeof(sxdp)) == 0);
+	}
+
+	static inline void _closeQueue(_Queue &qu)
+	{
+		_Ring *const rings[4] = { &(qu.fill),&(qu.comp),&(qu.rx),&(qu.tx) };
+		for(unsigned int i=0;i<4;++i) {
+			if (rings[i]->map)
+				::munmap(rings[i]->map,rings[i]->mapSize);
+		}
+		if (qu.fd >= 0)
+			::close(qu.fd);
+		if (qu.umem)
+			::munmap((void *)qu.umem,(size_t)ZT_XDP_FRAMES * ZT_XDP_FRAME_SIZE);
+	}
+
+	// Returns sent frames to the free list (caller holds _lock)
+	static inline void _reclaim(_Queue &qu)
+	{
+		const uint32_t cons = *(qu.comp.consumer);
+		const uint32_t n = __atomic_load_n(qu.comp.producer,__ATOMIC_ACQUIRE) - cons;
+		for(uint32_t i=0;i<n;++i)
+			qu.txFree[qu.txFreeCount++] = reinterpret_cast<const uint64_t *>(qu.comp.desc)[(cons + i) & (ZT_XDP_RING_SIZE - 1)];
+		__atomic_store_n(qu.comp.consumer,cons + n,__ATOMIC_RELEASE);
+	}
+
+	// Parses a frame and learns how to get back to its sender (caller holds _lock)
+	inline bool _parse(const uint8_t *f,const unsigned int len,Datagram &d)
+	{
+		if (len < 42)
+			return false;
+		const unsigned int et = _get16(f + 12);
+		const uint8_t *udp,*sip,*dip;
+		unsigned int ulen;
+		memset(&(d.from),0,sizeof(d.from));
+		memset(&(d.to),0,sizeof(d.to));
+		if (et == 0x0800) {
+			const uint8_t *const ip = f + 14;
+			const unsigned int tlen = _get16(ip + 2);
+			if ((ip[0] != 0x45)||(ip[9] != 17)||((_get16(ip + 6) & 0x3fff) != 0)||((tlen + 14) > len))
+				return false;
+			udp = ip + 20;
+			ulen = _get16(udp + 4);
+			if ((ulen < 8)||((ulen + 20) > tlen))
+				return false;
+			sip = ip + 12;
+			dip = ip + 16;
+			struct sockaddr_in *const from = reinterpret_cast<struct sockaddr_in *>(&(d.from));
+			struct sockaddr_in *const to = reinterpret_cast<struct sockaddr_in *>(&(d.to));
+			from->sin_family = to->sin_family = AF_INET;
+			memcpy(&(from->sin_addr),sip,4);
+			memcpy(&(from->sin_port),udp,2);
+			memcpy(&(to->sin_addr),dip,4);
+			memcpy(&(to->sin_port),udp + 2,2);
+		} else if (et == 0x86dd) {
+			if (len < 62)
+				return false;
+			const uint8_t *const ip = f + 14;
+			const unsigned int plen = _get16(ip + 4);
+			if ((ip[6] != 17)||((plen + 54) > len))
+				return false;
+			udp = ip + 40;
+			ulen = _get16(udp + 4);
+			if ((ulen < 8)||(ulen > plen))
+				return false;
+			sip = ip + 8;
+			dip = ip + 24;
+			struct sockaddr_in6 *const from = reinterpret_cast<struct sockaddr_in6 *>(&(d.from));
+			struct sockaddr_in6 *const to = reinterpret_cast<struct sockaddr_in6 *>(&(d.to));
+			from->sin6_family = to->sin6_family = AF_INET6;
+			memcpy(&(from->sin6_addr),sip,16);
+			memcpy(&(from->sin6_port),udp,2);
+			memcpy(&(to->sin6_addr),dip,16);
+			memcpy(&(to->sin6_port),udp + 2,2);
+			if ((sip[0] == 0xfe)&&((sip[1] & 0xc0) == 0x80))
+				from->sin6_scope_id = to->sin6_scope_id = _ifindex;
+		} else return false;
+
+		// ZeroTier packets are authenticated, so the UDP checksum isn't checked here
+		d.data = udp + 8;
+		d.len = ulen - 8;
+
+		const unsigned int alen = (et == 0x0800) ? 4 : 16;
+		_Neighbor &nb = _neighbors[_hash(sip,alen)];
+		nb.family = d.from.ss_family;
+		memcpy(nb.ip,sip,alen);
+		memcpy(nb.local,dip,alen);
+		memcpy(nb.mac,f + 6,6);
+		memcpy(nb.localMac,f,6);
+		return true;
+	}
+
+	static inline const uint8_t *_ip(const struct sockaddr *sa)
+	{
+		if (sa->sa_family == AF_INET6)
+			return reinterpret_cast<const uint8_t *>(&(reinterpret_cast<const struct sockaddr_in6 *>(sa)->sin6_addr));
+		return reinterpret_cast<const uint8_t *>(&(reinterpret_cast<const struct sockaddr_in *>(sa)->sin_addr));
+	}
+
+	static inline unsigned int _hash(const uint8_t *ip,const unsigned int len)
+	{
+		uint32_t h = 2166136261U;
+		for(unsigned int i=0;i<len;++i)
+			h = (h ^ ip[i]) * 16777619U;
+		return (unsigned int)(h & (ZT_XDP_NEIGHBORS - 1));
+	}
+
+	static inline unsigned int _get16(const uint8_t *p) { return (((unsigned int)p[0] << 8) | (unsigned int)p[1]); }
+	static inline void _put16(uint8_t *p,const unsigned int v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+
+	// Internet checksum, summed as big-endian 16-bit words
+	static inline uint32_t _sum(const uint8_t *p,unsigned int len,uint32_t s)
+	{
+		while (len > 1) {
+			s += _get16(p);
+			p += 2;
+			len -= 2;
+		}
+		if (len)
+			s += ((uint32_t)p[0] << 8);
+		return s;
+	}
+	static inline uint16_t _fold(uint32_t s)
+	{
+		while (s >> 16)
+			s = (s & 0xffff) + (s >> 16);
+		return (uint16_t)~s;
+	}
+
+	unsigned int _ifindex;
+	unsigned int _queueCount;
+	int _progFd;
+	int _xsksFd;
+	int _portsFd;
+	int _linkFd;
+	_Queue _queues[ZT_XDP_MAX_QUEUES];
+	_Neighbor *_neighbors;
+	std::map<unsigned int,unsigned int> _ports; // port -> sockets using it
+	uint16_t _ipId;
+	std::mutex _lock; // guards neighbors, ports, and the send rings
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_XDP
+
+#endif
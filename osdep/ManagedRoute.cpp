@@ -43,28 +43,31 @@
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <net/route.h>
 #include <net/if.h>
 #ifdef __BSD__
+#include <errno.h>
 #include <net/if_dl.h>
 #include <sys/sysctl.h>
 #endif
 #include <ifaddrs.h>
 #endif
 
+#ifdef __LINUX__
+#include <errno.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
 #include <vector>
 #include <algorithm>
 #include <utility>
 
 #include "ManagedRoute.hpp"
 
-#define ZT_BSD_ROUTE_CMD "/sbin/route"
-#define ZT_LINUX_IP_COMMAND "/sbin/ip"
-#define ZT_LINUX_IP_COMMAND_2 "/usr/sbin/ip"
-
 namespace ZeroTier {
 
 namespace {
@@ -244,33 +247,91 @@ static std::vector<_RTE> _getRTEs(const InetAddress &target,bool contains)
 	return rtes;
 }
 
-static void _routeCmd(const char *op,const InetAddress &target,const InetAddress &via,const char *ifscope,const char *localInterface)
+// Addresses in routing socket messages are padded to this alignment
+#ifdef __APPLE__
+#define ZT_RTSOCK_ROUNDUP(a) (((a) > 0) ? (1 + (((a) - 1) | (sizeof(uint32_t) - 1))) : sizeof(uint32_t))
+#else
+#define ZT_RTSOCK_ROUNDUP(a) (((a) > 0) ? (1 + (((a) - 1) | (sizeof(long) - 1))) : sizeof(long))
+#endif
+
+static char *_rtsockAddr(char *p,const InetAddress &a)
 {
-	//char f1[1024],f2[1024]; printf("%s %s %s %s %s\n",op,target.toString(f1),via.toString(f2),ifscope,localInterface);
-	long p = (long)fork();
-	if (p > 0) {
-		int exitcode = -1;
-		::waitpid(p,&exitcode,0);
-	} else if (p == 0) {
-		::close(STDOUT_FILENO);
-		::close(STDERR_FILENO);
-		char ttmp[64];
-		char iptmp[64];
-		if (via) {
-			if ((ifscope)&&(ifscope[0])) {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,"-ifscope",ifscope,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),via.toIpString(iptmp),(const char *)0);
-			} else {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),via.toIpString(iptmp),(const char *)0);
-			}
-		} else if ((localInterface)&&(localInterface[0])) {
-			if ((ifscope)&&(ifscope[0])) {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,"-ifscope",ifscope,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),"-interface",localInterface,(const char *)0);
-			} else {
-				::execl(ZT_BSD_ROUTE_CMD,ZT_BSD_ROUTE_CMD,op,((target.ss_family == AF_INET6) ? "-inet6" : "-inet"),target.toString(ttmp),"-interface",localInterface,(const char *)0);
-			}
-		}
-		::_exit(-1);
+	const unsigned int len = (a.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+	const InetAddress ip(a.ipOnly());
+	memcpy(p,&ip,len);
+	reinterpret_cast<struct sockaddr *>(p)->sa_len = (unsigned char)len;
+	return p + ZT_RTSOCK_ROUNDUP(len);
+}
+
+/**
+ * Add, change or delete a route by writing to a PF_ROUTE socket
+ *
+ * RTM_ADD changes the route instead if it already exists, and RTM_DELETE of
+ * a route that isn't there is not an error.
+ *
+ * @return True on success
+ */
+static bool _routeCmd(const int op,const InetAddress &target,const InetAddress &via,const char *ifscope,const char *localInterface)
+{
+	struct {
+		struct rt_msghdr hdr;
+		char addrs[512];
+	} m;
+	memset(&m,0,sizeof(m));
+
+	const unsigned int bits = target.netmaskBits();
+	const bool host = (bits == ((target.ss_family == AF_INET6) ? 128U : 32U));
+	m.hdr.rtm_version = RTM_VERSION;
+	m.hdr.rtm_type = (unsigned char)op;
+	m.hdr.rtm_flags = RTF_UP|RTF_STATIC|((host) ? RTF_HOST : 0);
+	m.hdr.rtm_addrs = RTA_DST|RTA_GATEWAY|((host) ? 0 : RTA_NETMASK);
+	m.hdr.rtm_seq = 1;
+
+	char *p = _rtsockAddr(m.addrs,target);
+	if (via) {
+		m.hdr.rtm_flags |= RTF_GATEWAY;
+		p = _rtsockAddr(p,via);
+	} else if ((localInterface)&&(localInterface[0])) {
+		struct sockaddr_dl *sdl = reinterpret_cast<struct sockaddr_dl *>(p);
+		sdl->sdl_len = sizeof(struct sockaddr_dl);
+		sdl->sdl_family = AF_LINK;
+		sdl->sdl_index = (unsigned short)if_nametoindex(localInterface);
+		if (!sdl->sdl_index)
+			return false;
+		p += ZT_RTSOCK_ROUNDUP(sizeof(struct sockaddr_dl));
+	} else {
+		return false;
+	}
+	if (!host)
+		p = _rtsockAddr(p,target.netmask());
+
+	if ((ifscope)&&(ifscope[0])) {
+#ifdef RTF_IFSCOPE
+		m.hdr.rtm_flags |= RTF_IFSCOPE;
+		m.hdr.rtm_index = (unsigned short)if_nametoindex(ifscope);
+#else
+		return false;
+#endif
 	}
+
+	m.hdr.rtm_msglen = (unsigned short)(p - reinterpret_cast<char *>(&m));
+
+	const int fd = ::socket(PF_ROUTE,SOCK_RAW,0);
+	if (fd < 0)
+		return false;
+	::shutdown(fd,SHUT_RD); // replies aren't needed, write() returns the error
+
+	bool ok = (::write(fd,&m,m.hdr.rtm_msglen) == (ssize_t)m.hdr.rtm_msglen);
+	if ((!ok)&&(op == RTM_ADD)&&(errno == EEXIST)) {
+		m.hdr.rtm_type = RTM_CHANGE;
+		++m.hdr.rtm_seq;
+		ok = (::write(fd,&m,m.hdr.rtm_msglen) == (ssize_t)m.hdr.rtm_msglen);
+	} else if ((!ok)&&(op == RTM_DELETE)&&(errno == ESRCH)) {
+		ok = true;
+	}
+
+	::close(fd);
+	return ok;
 }
 
 #endif // __BSD__ ------------------------------------------------------------
@@ -278,26 +339,133 @@ static void _routeCmd(const char *op,const InetAddress &target,const InetAddress
 #ifdef __LINUX__ // ----------------------------------------------------------
 #define ZT_ROUTING_SUPPORT_FOUND 1
 
-static void _routeCmd(const char *op,const InetAddress &target,const InetAddress &via,const char *localInterface)
+// Route changes collected and sent to the kernel as one batch of rtnetlink messages
+class _RouteBatch
 {
-	long p = (long)fork();
-	if (p > 0) {
-		int exitcode = -1;
-		::waitpid(p,&exitcode,0);
-	} else if (p == 0) {
-		::close(STDOUT_FILENO);
-		::close(STDERR_FILENO);
-		char ipbuf[64],ipbuf2[64];
+public:
+	_RouteBatch() : _count(0),_failed(false) {}
+
+	/**
+	 * Queue a route replace (add or update) or delete
+	 *
+	 * @param del If true delete the route, otherwise create or replace it
+	 * @param target Route target
+	 * @param via Gateway or NIL to route directly to localInterface
+	 * @param localInterface Device for routes without a gateway
+	 */
+	inline void add(bool del,const InetAddress &target,const InetAddress &via,const char *localInterface)
+	{
+		const unsigned int alen = (target.ss_family == AF_INET6) ? 16 : 4;
+		const unsigned int msg = (unsigned int)_buf.size();
+		_buf.resize(msg + NLMSG_LENGTH(sizeof(struct rtmsg)));
+
+		struct nlmsghdr *nh = reinterpret_cast<struct nlmsghdr *>(_buf.data() + msg);
+		nh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+		nh->nlmsg_type = (del) ? RTM_DELROUTE : RTM_NEWROUTE;
+		nh->nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|((del) ? 0 : (NLM_F_CREATE|NLM_F_REPLACE));
+		nh->nlmsg_seq = ++_count;
+
+		// Same defaults as 'ip route replace' and 'ip route del'
+		struct rtmsg *rt = reinterpret_cast<struct rtmsg *>(NLMSG_DATA(nh));
+		rt->rtm_family = (unsigned char)target.ss_family;
+		rt->rtm_dst_len = (unsigned char)target.netmaskBits();
+		rt->rtm_table = RT_TABLE_MAIN;
+		if (del) {
+			rt->rtm_scope = RT_SCOPE_NOWHERE;
+		} else {
+			rt->rtm_protocol = RTPROT_BOOT;
+			rt->rtm_scope = ((!via)&&(target.ss_family == AF_INET)) ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE;
+			rt->rtm_type = RTN_UNICAST;
+		}
+
+		_attr(msg,RTA_DST,target.rawIpData(),alen);
 		if (via) {
-			::execl(ZT_LINUX_IP_COMMAND,ZT_LINUX_IP_COMMAND,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"via",via.toIpString(ipbuf2),(const char *)0);
-			::execl(ZT_LINUX_IP_COMMAND_2,ZT_LINUX_IP_COMMAND_2,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"via",via.toIpString(ipbuf2),(const char *)0);
+			_attr(msg,RTA_GATEWAY,via.rawIpData(),alen);
 		} else if ((localInterface)&&(localInterface[0])) {
-			::execl(ZT_LINUX_IP_COMMAND,ZT_LINUX_IP_COMMAND,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"dev",localInterface,(const char *)0);
-			::execl(ZT_LINUX_IP_COMMAND_2,ZT_LINUX_IP_COMMAND_2,(target.ss_family == AF_INET6) ? "-6" : "-4","route",op,target.toString(ipbuf),"dev",localInterface,(const char *)0);
+			const uint32_t ifindex = (uint32_t)if_nametoindex(localInterface);
+			if (!ifindex) {
+				_buf.resize(msg); // unknown device, route can't be applied
+				_failed = true;
+				return;
+			}
+			_attr(msg,RTA_OIF,&ifindex,sizeof(ifindex));
 		}
-		::_exit(-1);
 	}
-}
+
+	/**
+	 * Send all queued changes and wait for the kernel to acknowledge them
+	 *
+	 * Deleting a route that does not exist is not counted as a failure.
+	 *
+	 * @return True if every change was applied
+	 */
+	inline bool commit()
+	{
+		bool ok = !_failed;
+		if (_buf.empty())
+			return ok;
+
+		const int fd = ::socket(AF_NETLINK,SOCK_RAW|SOCK_CLOEXEC,NETLINK_ROUTE);
+		if (fd < 0)
+			return false;
+		struct timeval tv;
+		tv.tv_sec = 2;
+		tv.tv_usec = 0;
+		::setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+
+		struct sockaddr_nl kernel;
+		memset(&kernel,0,sizeof(kernel));
+		kernel.nl_family = AF_NETLINK;
+		if (::sendto(fd,_buf.data(),_buf.size(),0,reinterpret_cast<const struct sockaddr *>(&kernel),sizeof(kernel)) != (ssize_t)_buf.size()) {
+			::close(fd);
+			return false;
+		}
+
+		std::vector<bool> acked(_count + 1,false);
+		unsigned int remaining = 0;
+		for(std::vector<char>::size_type i=0;i<_buf.size();i+=NLMSG_ALIGN(reinterpret_cast<const struct nlmsghdr *>(_buf.data() + i)->nlmsg_len))
+			++remaining;
+
+		char reply[8192];
+		while (remaining) {
+			const ssize_t n = ::recv(fd,reply,sizeof(reply),0);
+			if (n <= 0) {
+				ok = false;
+				break;
+			}
+			int len = (int)n;
+			for(const struct nlmsghdr *nh=reinterpret_cast<const struct nlmsghdr *>(reply);NLMSG_OK(nh,len);nh=NLMSG_NEXT(nh,len)) {
+				if ((nh->nlmsg_type != NLMSG_ERROR)||(nh->nlmsg_seq == 0)||(nh->nlmsg_seq > _count)||(acked[nh->nlmsg_seq]))
+					continue;
+				acked[nh->nlmsg_seq] = true;
+				--remaining;
+				const int err = reinterpret_cast<const struct nlmsgerr *>(NLMSG_DATA(nh))->error;
+				if ((err != 0)&&(err != -ESRCH))
+					ok = false;
+			}
+		}
+
+		::close(fd);
+		_buf.clear();
+		return ok;
+	}
+
+private:
+	inline void _attr(unsigned int msg,unsigned short type,const void *data,unsigned int len)
+	{
+		const unsigned int at = (unsigned int)_buf.size();
+		_buf.resize(at + RTA_SPACE(len));
+		struct rtattr *rta = reinterpret_cast<struct rtattr *>(_buf.data() + at);
+		rta->rta_type = type;
+		rta->rta_len = RTA_LENGTH(len);
+		memcpy(RTA_DATA(rta),data,len);
+		reinterpret_cast<struct nlmsghdr *>(_buf.data() + msg)->nlmsg_len = (uint32_t)(_buf.size() - msg);
+	}
+
+	std::vector<char> _buf;
+	uint32_t _count;
+	bool _failed;
+};
 
 #endif // __LINUX__ ----------------------------------------------------------
 
@@ -460,46 +628,51 @@ bool ManagedRoute::sync()
 	// allow us to do that if underlying connectivity changes.
 	if ((_systemVia != newSystemVia)||(strcmp(_systemDevice,newSystemDevice) != 0)) {
 		if (_systemVia) {
-			_routeCmd("delete",leftt,_systemVia,_systemDevice,(const char *)0);
+			_routeCmd(RTM_DELETE,leftt,_systemVia,_systemDevice,(const char *)0);
 			if (rightt)
-				_routeCmd("delete",rightt,_systemVia,_systemDevice,(const char *)0);
+				_routeCmd(RTM_DELETE,rightt,_systemVia,_systemDevice,(const char *)0);
 		}
 
 		_systemVia = newSystemVia;
 		Utils::scopy(_systemDevice,sizeof(_systemDevice),newSystemDevice);
 
 		if (_systemVia) {
-			_routeCmd("add",leftt,_systemVia,_systemDevice,(const char *)0);
-			_routeCmd("change",leftt,_systemVia,_systemDevice,(const char *)0);
-			if (rightt) {
-				_routeCmd("add",rightt,_systemVia,_systemDevice,(const char *)0);
-				_routeCmd("change",rightt,_systemVia,_systemDevice,(const char *)0);
-			}
+			_routeCmd(RTM_ADD,leftt,_systemVia,_systemDevice,(const char *)0);
+			if (rightt)
+				_routeCmd(RTM_ADD,rightt,_systemVia,_systemDevice,(const char *)0);
 		}
 	}
 
 	if (!_applied.count(leftt)) {
+		if (!_routeCmd(RTM_ADD,leftt,_via,(const char *)0,(_via) ? (const char *)0 : _device))
+			return false;
 		_applied[leftt] = false; // not ifscoped
-		_routeCmd("add",leftt,_via,(const char *)0,(_via) ? (const char *)0 : _device);
-		_routeCmd("change",leftt,_via,(const char *)0,(_via) ? (const char *)0 : _device);
 	}
 	if ((rightt)&&(!_applied.count(rightt))) {
+		if (!_routeCmd(RTM_ADD,rightt,_via,(const char *)0,(_via) ? (const char *)0 : _device))
+			return false;
 		_applied[rightt] = false; // not ifscoped
-		_routeCmd("add",rightt,_via,(const char *)0,(_via) ? (const char *)0 : _device);
-		_routeCmd("change",rightt,_via,(const char *)0,(_via) ? (const char *)0 : _device);
 	}
 
 #endif // __BSD__ ------------------------------------------------------------
 
 #ifdef __LINUX__ // ----------------------------------------------------------
 
+	_RouteBatch batch;
 	if (!_applied.count(leftt)) {
 		_applied[leftt] = false; // boolean unused
-		_routeCmd("replace",leftt,_via,(_via) ? (const char *)0 : _device);
+		batch.add(false,leftt,_via,(_via) ? (const char *)0 : _device);
 	}
 	if ((rightt)&&(!_applied.count(rightt))) {
 		_applied[rightt] = false; // boolean unused
-		_routeCmd("replace",rightt,_via,(_via) ? (const char *)0 : _device);
+		batch.add(false,rightt,_via,(_via) ? (const char *)0 : _device);
+	}
+	if (!batch.commit()) {
+		// Forget what didn't apply so the next sync() tries it again
+		_applied.erase(leftt);
+		if (rightt)
+			_applied.erase(rightt);
+		return false;
 	}
 
 #endif // __LINUX__ ----------------------------------------------------------
@@ -534,25 +707,31 @@ void ManagedRoute::remove()
 	if (_systemVia) {
 		InetAddress leftt,rightt;
 		_forkTarget(_target,leftt,rightt);
-		_routeCmd("delete",leftt,_systemVia,_systemDevice,(const char *)0);
+		_routeCmd(RTM_DELETE,leftt,_systemVia,_systemDevice,(const char *)0);
 		if (rightt)
-			_routeCmd("delete",rightt,_systemVia,_systemDevice,(const char *)0);
+			_routeCmd(RTM_DELETE,rightt,_systemVia,_systemDevice,(const char *)0);
 	}
 #endif // __BSD__ ------------------------------------------------------------
 
+#ifdef __LINUX__
+	_RouteBatch batch;
+#endif
 	for(std::map<InetAddress,bool>::iterator r(_applied.begin());r!=_applied.end();++r) {
 #ifdef __BSD__ // ------------------------------------------------------------
-		_routeCmd("delete",r->first,_via,r->second ? _device : (const char *)0,(_via) ? (const char *)0 : _device);
+		_routeCmd(RTM_DELETE,r->first,_via,r->second ? _device : (const char *)0,(_via) ? (const char *)0 : _device);
 #endif // __BSD__ ------------------------------------------------------------
 
 #ifdef __LINUX__ // ----------------------------------------------------------
-		_routeCmd("del",r->first,_via,(_via) ? (const char *)0 : _device);
+		batch.add(true,r->first,_via,(_via) ? (const char *)0 : _device);
 #endif // __LINUX__ ----------------------------------------------------------
 
 #ifdef __WINDOWS__ // --------------------------------------------------------
 		_winRoute(true,interfaceLuid,interfaceIndex,r->first,_via);
 #endif // __WINDOWS__ --------------------------------------------------------
 	}
+#ifdef __LINUX__
+	batch.commit();
+#endif
 
 	_target.zero();
 	_via.zero();
@@ -77,7 +77,7 @@ NetBSDEthernetTap::NetBSDEthernetTap(
 	unsigned int metric,
 	uint64_t nwid,
 	const char *friendlyName,
-	void (*handler)(void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+	void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 	void *arg) :
 	_handler(handler),
 	_arg(arg),
@@ -431,7 +431,6 @@ void NetBSDEthernetTap::threadMain()
 	throw()
 {
 	fd_set readfds,nullfds;
-	MAC to,from;
 	int n,nfds,r;
 	char getBuf[8194];
 
@@ -467,11 +466,14 @@ void NetBSDEthernetTap::threadMain()
 						r = _mtu + 14;
 
 					if (_enabled) {
-						to.setTo(getBuf,6);
-						from.setTo(getBuf + 6,6);
-						unsigned int etherType = ntohs(((const uint16_t *)getBuf)[6]);
-						// TODO: VLAN support
-						_handler(_arg,_nwid,from,to,etherType,0,(const void *)(getBuf + 14),r - 14);
+						ZT_VirtualNetworkFrame f;
+						f.destMac = MAC(getBuf,6).toInt();
+						f.sourceMac = MAC(getBuf + 6,6).toInt();
+						f.etherType = ntohs(((const uint16_t *)getBuf)[6]);
+						f.vlanId = 0; // TODO: VLAN support
+						f.data = (const void *)(getBuf + 14);
+						f.length = r - 14;
+						_handler(_arg,(void *)0,_nwid,&f,1);
 					}
 
 					r = 0;
@@ -30,6 +30,8 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+
 #include "../node/Constants.hpp"
 #include "../node/Utils.hpp"
 
@@ -55,6 +57,9 @@
 
 #include "OSUtils.hpp"
 
+// CPU numbers at or above this are ignored by cpuList()
+#define ZT_CPU_LIST_MAX 4096
+
 namespace ZeroTier {
 
 unsigned int OSUtils::ztsnprintf(char *buf,unsigned int len,const char *fmt,...)
@@ -523,7 +528,83 @@ std::string OSUtils::jsonBinFromHex(const nlohmann::json &jv)
 	return std::string();
 }
 
+// Add CPUs from a list in the kernel's format, e.g. 0-3,8,10-11
+static void _cpuRanges(const char *s,std::vector<unsigned int> &cpus)
+{
+	while (*s) {
+		char *e = (char *)0;
+		const unsigned long first = strtoul(s,&e,10);
+		if (e == s)
+			return;
+		unsigned long last = first;
+		s = e;
+		if (*s == '-') {
+			last = strtoul(++s,&e,10);
+			if (e == s)
+				return;
+			s = e;
+		}
+		for(unsigned long c=first;(c<=last)&&(c<ZT_CPU_LIST_MAX);++c)
+			cpus.push_back((unsigned int)c);
+		while ((*s == ',')||(*s == ' ')||(*s == '\n'))
+			++s;
+	}
+}
+
+std::vector<unsigned int> OSUtils::cpuList(const char *spec)
+{
+	std::vector<unsigned int> cpus;
+	std::vector<std::string> items(split(spec,",","",""));
+	for(std::vector<std::string>::iterator i(items.begin());i!=items.end();++i) {
+		if (i->substr(0,5) == "node:") {
+#ifdef __LINUX__
+			std::string l;
+			if (readFile((std::string("/sys/devices/system/node/node") + i->substr(5) + "/cpulist").c_str(),l))
+				_cpuRanges(l.c_str(),cpus);
+#endif
+		} else if (i->substr(0,3) == "rss") {
+#ifdef __LINUX__
+			// A NIC's MSI-X vectors are listed under its PCI device, and each is
+			// serviced by the CPUs in its effective affinity
+			std::vector<std::string> ifs;
+			if (i->length() > 4)
+				ifs.push_back(i->substr(4));
+			else ifs = listDirectory("/sys/class/net",true);
+			for(std::vector<std::string>::iterator n(ifs.begin());n!=ifs.end();++n) {
+				const std::string irqDir(std::string("/sys/class/net/") + *n + "/device/msi_irqs");
+				std::vector<std::string> irqs(listDirectory(irqDir.c_str()));
+				for(std::vector<std::string>::iterator irq(irqs.begin());irq!=irqs.end();++irq) {
+					std::string l;
+					if ((readFile((std::string("/proc/irq/") + *irq + "/effective_affinity_list").c_str(),l))||(readFile((std::string("/proc/irq/") + *irq + "/smp_affinity_list").c_str(),l)))
+						_cpuRanges(l.c_str(),cpus);
+				}
+			}
+#endif
+		} else {
+			_cpuRanges(i->c_str(),cpus);
+		}
+	}
+	std::sort(cpus.begin(),cpus.end());
+	cpus.erase(std::unique(cpus.begin(),cpus.end()),cpus.end());
+	return cpus;
+}
+
+uint64_t OSUtils::anonHugePageBytes()
+{
+#ifdef __LINUX__
+	std::string s;
+	if (readFile("/proc/self/smaps_rollup",s)) {
+		const std::string::size_type i = s.find("AnonHugePages:");
+		if (i != std::string::npos)
+			return (uint64_t)strtoull(s.c_str() + i + 14,(char **)0,10) * 1024ULL;
+	}
+#endif
+	return 0;
+}
+
 // Used to convert HTTP header names to ASCII lower case
+std::atomic<int64_t> OSUtils::_coarseNow(0);
+
 const unsigned char OSUtils::TOLOWER_TABLE[256] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, ' ', '!', '"', '#', '$', '%', '&', 0x27, '(', ')', '*', '+', ',', '-', '.', '/', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ':', ';', '<', '=', '>', '?', '@', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '{', '|', '}', '~', '_', '`', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', '{', '|', '}', '~', 0x7f, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf, 0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf, 0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef, 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
 
 } // namespace ZeroTier
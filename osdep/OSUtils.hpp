@@ -36,6 +36,7 @@
 #include <stdexcept>
 #include <vector>
 #include <map>
+#include <atomic>
 
 #include "../node/Constants.hpp"
 #include "../node/InetAddress.hpp"
@@ -231,6 +232,38 @@ public:
 #endif
 	};
 
+	/**
+	 * Sample now() and make it the time returned by coarseNow()
+	 *
+	 * The service calls this once per main loop iteration and once per batch
+	 * of received packets or frames, and passes the result along as that
+	 * batch's timestamp.
+	 *
+	 * @return Current time in milliseconds since epoch
+	 */
+	static inline int64_t updateCoarseNow()
+	{
+		const int64_t t = now();
+		_coarseNow.store(t,std::memory_order_relaxed);
+		return t;
+	}
+
+	/**
+	 * Get the time last sampled by updateCoarseNow() without a system call
+	 *
+	 * This can be behind by as long as the service goes without processing
+	 * anything, so it's for timestamps that don't need to be exact (last
+	 * receive times, expiry checks) and not for anything handed to the core
+	 * along with a packet that just arrived.
+	 *
+	 * @return Recent time in milliseconds since epoch
+	 */
+	static inline int64_t coarseNow()
+	{
+		const int64_t t = _coarseNow.load(std::memory_order_relaxed);
+		return (t) ? t : updateCoarseNow();
+	}
+
 	/**
 	 * Read the full contents of a file into a string buffer
 	 *
@@ -284,6 +317,25 @@ public:
 	 */
 	static std::string platformDefaultHomePath();
 
+	/**
+	 * Parse a list of CPUs for thread placement
+	 *
+	 * Items are separated by commas and can be a CPU number, a range like
+	 * 0-3, node:N for every CPU in NUMA node N, or rss or rss:<interface>
+	 * for the CPUs that handle the receive queue interrupts of every
+	 * physical NIC or of one NIC. NUMA nodes and NIC queues are only found
+	 * on Linux.
+	 *
+	 * @param spec CPU list
+	 * @return CPU numbers in ascending order without duplicates
+	 */
+	static std::vector<unsigned int> cpuList(const char *spec);
+
+	/**
+	 * @return Bytes of this process's memory backed by transparent huge pages (AnonHugePages, Linux only, otherwise 0)
+	 */
+	static uint64_t anonHugePageBytes();
+
 	static nlohmann::json jsonParse(const std::string &buf);
 	static std::string jsonDump(const nlohmann::json &j,int indentation = 1);
 	static uint64_t jsonInt(const nlohmann::json &jv,const uint64_t dfl);
@@ -294,6 +346,7 @@ public:
 
 private:
 	static const unsigned char TOLOWER_TABLE[256];
+	static std::atomic<int64_t> _coarseNow;
 };
 
 } // namespace ZeroTier
@@ -51,6 +51,8 @@
 #include <net/if_arp.h>
 #include <net/if_dl.h>
 #include <net/if_media.h>
+#include <net/bpf.h>
+#include <net/ndrv.h>
 #include <sys/sysctl.h>
 #include <netinet6/in6_var.h>
 #include <netinet/in_var.h>
@@ -312,9 +314,31 @@ static inline bool _setIpv6Stuff(const char *ifname,bool performNUD,bool acceptR
 
 namespace ZeroTier {
 
-static long globalTapsRunning = 0;
 static Mutex globalTapCreateLock;
 
+// Runs ifconfig with arguments (NULL terminated) and returns true if it exits with 0
+static bool _ifconfig(const char *const *args)
+{
+	long cpid = (long)vfork();
+	if (cpid == 0) {
+		::execv("/sbin/ifconfig",const_cast<char *const *>(args));
+		::_exit(-1);
+	} else if (cpid > 0) {
+		int exitcode = -1;
+		::waitpid(cpid,&exitcode,0);
+		return (exitcode == 0);
+	}
+	return false;
+}
+
+static void _destroyFeth(const char *dev)
+{
+	if (if_nametoindex(dev)) {
+		const char *const args[4] = { "/sbin/ifconfig",dev,"destroy",(const char *)0 };
+		_ifconfig(args);
+	}
+}
+
 OSXEthernetTap::OSXEthernetTap(
 	const char *homePath,
 	const MAC &mac,
@@ -322,7 +346,7 @@ OSXEthernetTap::OSXEthernetTap(
 	unsigned int metric,
 	uint64_t nwid,
 	const char *friendlyName,
-	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *data,unsigned int len),
+	void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 	void *arg) :
 	_handler(handler),
 	_arg(arg),
@@ -330,33 +354,18 @@ OSXEthernetTap::OSXEthernetTap(
 	_homePath(homePath),
 	_mtu(mtu),
 	_metric(metric),
-	_fd(0),
+	_bpf(-1),
+	_ndrv(-1),
 	_enabled(true)
 {
-	char devpath[64],ethaddr[64],mtustr[32],metstr[32],nwids[32];
-	struct stat stattmp;
+	char ethaddr[64],mtustr[32],metstr[32],nwids[32],tmp[32];
 
 	OSUtils::ztsnprintf(nwids,sizeof(nwids),"%.16llx",nwid);
 
 	Mutex::Lock _gl(globalTapCreateLock);
 
-	if (::stat("/dev/zt0",&stattmp)) {
-		long kextpid = (long)vfork();
-		if (kextpid == 0) {
-			::chdir(homePath);
-			OSUtils::redirectUnixOutputs("/dev/null",(const char *)0);
-			::execl("/sbin/kextload","/sbin/kextload","-q","-repository",homePath,"tap.kext",(const char *)0);
-			::_exit(-1);
-		} else if (kextpid > 0) {
-			int exitcode = -1;
-			::waitpid(kextpid,&exitcode,0);
-		}
-		::usleep(500); // give tap device driver time to start up and try again
-		if (::stat("/dev/zt0",&stattmp))
-			throw std::runtime_error("/dev/zt# tap devices do not exist and cannot load tap.kext");
-	}
-
-	// Try to reopen the last device we had, if we had one and it's still unused.
+	// Try to reuse the number of the last device we had for this network, so
+	// the OS sees the same interface name across restarts.
 	std::map<std::string,std::string> globalDeviceMap;
 	FILE *devmapf = fopen((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),"r");
 	if (devmapf) {
@@ -375,69 +384,128 @@ OSXEthernetTap::OSXEthernetTap(
 		}
 		fclose(devmapf);
 	}
-	bool recalledDevice = false;
+	int devno = -1;
 	std::map<std::string,std::string>::const_iterator gdmEntry = globalDeviceMap.find(nwids);
-	if (gdmEntry != globalDeviceMap.end()) {
-		std::string devpath("/dev/"); devpath.append(gdmEntry->second);
-		if (stat(devpath.c_str(),&stattmp) == 0) {
-			_fd = ::open(devpath.c_str(),O_RDWR);
-			if (_fd > 0) {
-				_dev = gdmEntry->second;
-				recalledDevice = true;
-			}
+	if ((gdmEntry != globalDeviceMap.end())&&(gdmEntry->second.length() > 4)&&(gdmEntry->second.substr(0,4) == "feth")) {
+		devno = (int)Utils::strToUInt(gdmEntry->second.c_str() + 4);
+		if (devno >= ZT_OSX_FETH_PEER_OFFSET) {
+			devno = -1;
+		} else {
+			// Left over if we didn't exit cleanly, so start it over
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"feth%d",devno);
+			_destroyFeth(tmp);
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"feth%d",devno + ZT_OSX_FETH_PEER_OFFSET);
+			_destroyFeth(tmp);
 		}
 	}
-
-	// Open the first unused tap device if we didn't recall a previous one.
-	if (!recalledDevice) {
-		for(int i=0;i<64;++i) {
-			OSUtils::ztsnprintf(devpath,sizeof(devpath),"/dev/zt%d",i);
-			if (stat(devpath,&stattmp))
-				throw std::runtime_error("no more TAP devices available");
-			_fd = ::open(devpath,O_RDWR);
-			if (_fd > 0) {
-				char foo[16];
-				OSUtils::ztsnprintf(foo,sizeof(foo),"zt%d",i);
-				_dev = foo;
-				break;
-			}
+	if (devno < 0) {
+		for(int i=0;i<ZT_OSX_FETH_PEER_OFFSET;++i) {
+			const int n = (int)((nwid + (uint64_t)i) % ZT_OSX_FETH_PEER_OFFSET);
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"feth%d",n);
+			if (if_nametoindex(tmp))
+				continue;
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"feth%d",n + ZT_OSX_FETH_PEER_OFFSET);
+			if (if_nametoindex(tmp))
+				continue;
+			devno = n;
+			break;
+		}
+		if (devno < 0)
+			throw std::runtime_error("no more feth devices available");
+	}
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"feth%d",devno);
+	_dev = tmp;
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"feth%d",devno + ZT_OSX_FETH_PEER_OFFSET);
+	_peerDev = tmp;
+
+	// The OS sees _dev and we read and write its peer, which gets whatever the
+	// other one sends and sends what it gets. The peer's MTU is set as large as
+	// possible so it never drops what _dev accepts.
+	{
+		const char *const a1[4] = { "/sbin/ifconfig",_dev.c_str(),"create",(const char *)0 };
+		const char *const a2[4] = { "/sbin/ifconfig",_peerDev.c_str(),"create",(const char *)0 };
+		const char *const a3[5] = { "/sbin/ifconfig",_peerDev.c_str(),"peer",_dev.c_str(),(const char *)0 };
+		const char *const a4[6] = { "/sbin/ifconfig",_peerDev.c_str(),"mtu","16370","up",(const char *)0 };
+		if ((!_ifconfig(a1))||(!_ifconfig(a2))||(!_ifconfig(a3))||(!_ifconfig(a4))) {
+			_destroyFeth(_dev.c_str());
+			_destroyFeth(_peerDev.c_str());
+			throw std::runtime_error("unable to create feth interface pair (needs macOS 10.13 or newer)");
 		}
 	}
 
-	if (_fd <= 0)
-		throw std::runtime_error("unable to open TAP device or no more devices available");
+	// Frames the OS sends are read from the peer through BPF, which returns
+	// as many as fit in its buffer with each read().
+	for(int i=0;i<256;++i) {
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"/dev/bpf%d",i);
+		_bpf = ::open(tmp,O_RDWR);
+		if (_bpf >= 0)
+			break;
+		if (errno != EBUSY)
+			break;
+	}
+	if (_bpf < 0) {
+		_destroyFeth(_dev.c_str());
+		_destroyFeth(_peerDev.c_str());
+		throw std::runtime_error("unable to open a BPF device");
+	}
+	{
+		struct ifreq ifr;
+		u_int bufSize = ZT_OSX_TAP_BPF_BUFFER_SIZE,one = 1,zero = 0;
+		memset(&ifr,0,sizeof(ifr));
+		strncpy(ifr.ifr_name,_peerDev.c_str(),sizeof(ifr.ifr_name) - 1);
+		// The buffer size must be set before attaching, and frames we write must not come back to us
+		if ((ioctl(_bpf,BIOCSBLEN,&bufSize) != 0)||(ioctl(_bpf,BIOCSETIF,&ifr) != 0)||(ioctl(_bpf,BIOCIMMEDIATE,&one) != 0)||(ioctl(_bpf,BIOCSSEESENT,&zero) != 0)||(ioctl(_bpf,BIOCGBLEN,&bufSize) != 0)) {
+			::close(_bpf);
+			_destroyFeth(_dev.c_str());
+			_destroyFeth(_peerDev.c_str());
+			throw std::runtime_error("unable to attach BPF to feth peer interface");
+		}
+		_bpfBufferSize = (unsigned int)bufSize;
+	}
 
-	if (fcntl(_fd,F_SETFL,fcntl(_fd,F_GETFL) & ~O_NONBLOCK) == -1) {
-		::close(_fd);
-		throw std::runtime_error("unable to set flags on file descriptor for TAP device");
+	// Frames going to the OS are written to the peer through a raw NDRV socket
+	_ndrv = ::socket(AF_NDRV,SOCK_RAW,0);
+	if (_ndrv >= 0) {
+		struct sockaddr_ndrv nd;
+		memset(&nd,0,sizeof(nd));
+		nd.snd_len = sizeof(nd);
+		nd.snd_family = AF_NDRV;
+		strncpy((char *)nd.snd_name,_peerDev.c_str(),sizeof(nd.snd_name) - 1);
+		if ((::bind(_ndrv,(struct sockaddr *)&nd,sizeof(nd)) != 0)||(::connect(_ndrv,(struct sockaddr *)&nd,sizeof(nd)) != 0)) {
+			::close(_ndrv);
+			_ndrv = -1;
+		}
+	}
+	if (_ndrv < 0) {
+		::close(_bpf);
+		_destroyFeth(_dev.c_str());
+		_destroyFeth(_peerDev.c_str());
+		throw std::runtime_error("unable to open NDRV socket on feth peer interface");
 	}
 
 	// Configure MAC address and MTU, bring interface up
 	OSUtils::ztsnprintf(ethaddr,sizeof(ethaddr),"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",(int)mac[0],(int)mac[1],(int)mac[2],(int)mac[3],(int)mac[4],(int)mac[5]);
 	OSUtils::ztsnprintf(mtustr,sizeof(mtustr),"%u",_mtu);
 	OSUtils::ztsnprintf(metstr,sizeof(metstr),"%u",_metric);
-	long cpid = (long)vfork();
-	if (cpid == 0) {
-		::execl("/sbin/ifconfig","/sbin/ifconfig",_dev.c_str(),"lladdr",ethaddr,"mtu",mtustr,"metric",metstr,"up",(const char *)0);
-		::_exit(-1);
-	} else if (cpid > 0) {
-		int exitcode = -1;
-		::waitpid(cpid,&exitcode,0);
-		if (exitcode) {
-			::close(_fd);
-			throw std::runtime_error("ifconfig failure setting link-layer address and activating tap interface");
+	{
+		const char *const args[10] = { "/sbin/ifconfig",_dev.c_str(),"lladdr",ethaddr,"mtu",mtustr,"metric",metstr,"up",(const char *)0 };
+		if (!_ifconfig(args)) {
+			::close(_bpf);
+			::close(_ndrv);
+			_destroyFeth(_dev.c_str());
+			_destroyFeth(_peerDev.c_str());
+			throw std::runtime_error("ifconfig failure setting link-layer address and activating feth interface");
 		}
 	}
 
 	_setIpv6Stuff(_dev.c_str(),true,false);
 
 	// Set close-on-exec so that devices cannot persist if we fork/exec for update
-	fcntl(_fd,F_SETFD,fcntl(_fd,F_GETFD) | FD_CLOEXEC);
+	fcntl(_bpf,F_SETFD,fcntl(_bpf,F_GETFD) | FD_CLOEXEC);
+	fcntl(_ndrv,F_SETFD,fcntl(_ndrv,F_GETFD) | FD_CLOEXEC);
 
 	::pipe(_shutdownSignalPipe);
 
-	++globalTapsRunning;
-
 	globalDeviceMap[nwids] = _dev;
 	devmapf = fopen((_homePath + ZT_PATH_SEPARATOR_S + "devicemap").c_str(),"w");
 	if (devmapf) {
@@ -457,28 +525,14 @@ OSXEthernetTap::~OSXEthernetTap()
 	::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
 	Thread::join(_thread);
 
-	::close(_fd);
+	::close(_bpf);
+	::close(_ndrv);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
 
-	{
-		Mutex::Lock _gl(globalTapCreateLock);
-		if (--globalTapsRunning <= 0) {
-			globalTapsRunning = 0; // sanity check -- should not be possible
-
-			char tmp[16384];
-			sprintf(tmp,"%s/%s",_homePath.c_str(),"tap.kext");
-			long kextpid = (long)vfork();
-			if (kextpid == 0) {
-				OSUtils::redirectUnixOutputs("/dev/null",(const char *)0);
-				::execl("/sbin/kextunload","/sbin/kextunload",tmp,(const char *)0);
-				::_exit(-1);
-			} else if (kextpid > 0) {
-				int exitcode = -1;
-				::waitpid(kextpid,&exitcode,0);
-			}
-		}
-	}
+	Mutex::Lock _gl(globalTapCreateLock);
+	_destroyFeth(_dev.c_str());
+	_destroyFeth(_peerDev.c_str());
 }
 
 void OSXEthernetTap::setEnabled(bool en)
@@ -573,14 +627,18 @@ std::vector<InetAddress> OSXEthernetTap::ips() const
 
 void OSXEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
-	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
-		to.copyTo(putBuf,6);
-		from.copyTo(putBuf + 6,6);
-		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14,data,len);
-		len += 14;
-		::write(_fd,putBuf,len);
+	if ((len <= _mtu)&&(_enabled)) {
+		char hdr[14];
+		to.copyTo(hdr,6);
+		from.copyTo(hdr + 6,6);
+		const uint16_t et = htons((uint16_t)etherType);
+		memcpy(hdr + 12,&et,2);
+		struct iovec iov[2];
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = 14;
+		iov[1].iov_base = const_cast<void *>(data);
+		iov[1].iov_len = len;
+		::writev(_ndrv,iov,2);
 	}
 }
 
@@ -652,52 +710,64 @@ void OSXEthernetTap::threadMain()
 	throw()
 {
 	fd_set readfds,nullfds;
-	MAC to,from;
-	int n,nfds,r;
-	char getBuf[ZT_MAX_MTU + 64];
+	ZT_VirtualNetworkFrame frames[ZT_OSX_TAP_BATCH];
+	char *const getBuf = (char *)malloc(_bpfBufferSize);
+	if (!getBuf)
+		return;
 
 	Thread::sleep(500);
 
 	FD_ZERO(&readfds);
 	FD_ZERO(&nullfds);
-	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
+	const int nfds = (int)std::max(_shutdownSignalPipe[0],_bpf) + 1;
 
-	r = 0;
 	for(;;) {
 		FD_SET(_shutdownSignalPipe[0],&readfds);
-		FD_SET(_fd,&readfds);
+		FD_SET(_bpf,&readfds);
 		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
 
 		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
 			break;
 
-		if (FD_ISSET(_fd,&readfds)) {
-			n = (int)::read(_fd,getBuf + r,sizeof(getBuf) - r);
+		if (FD_ISSET(_bpf,&readfds)) {
+			// One read() returns every frame waiting, each behind a bpf_hdr and
+			// word aligned. They're handed up in batches straight out of getBuf.
+			const long n = (long)::read(_bpf,getBuf,_bpfBufferSize);
 			if (n < 0) {
 				if ((errno != EINTR)&&(errno != ETIMEDOUT))
 					break;
-			} else {
-				// Some tap drivers like to send the ethernet frame and the
-				// payload in two chunks, so handle that by accumulating
-				// data until we have at least a frame.
-				r += n;
-				if (r > 14) {
-					if (r > ((int)_mtu + 14)) // sanity check for weird TAP behavior on some platforms
-						r = _mtu + 14;
-
-					if (_enabled) {
-						to.setTo(getBuf,6);
-						from.setTo(getBuf + 6,6);
-						unsigned int etherType = ntohs(((const uint16_t *)getBuf)[6]);
-						// TODO: VLAN support
-						_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(getBuf + 14),r - 14);
-					}
-
-					r = 0;
+				continue;
+			}
+			unsigned int count = 0;
+			long p = 0;
+			while ((p + (long)sizeof(struct bpf_hdr)) <= n) {
+				const struct bpf_hdr *const h = reinterpret_cast<const struct bpf_hdr *>(getBuf + p);
+				const long next = p + (long)BPF_WORDALIGN(h->bh_hdrlen + h->bh_caplen);
+				if ((p + (long)h->bh_hdrlen + (long)h->bh_caplen) > n)
+					break;
+				const char *const f = getBuf + p + h->bh_hdrlen;
+				const unsigned int flen = h->bh_caplen;
+				p = next;
+				if ((flen <= 14)||(flen > (_mtu + 14))||(h->bh_caplen != h->bh_datalen)||(!_enabled))
+					continue;
+				ZT_VirtualNetworkFrame &fr = frames[count++];
+				fr.destMac = MAC(f,6).toInt();
+				fr.sourceMac = MAC(f + 6,6).toInt();
+				fr.etherType = ntohs(*reinterpret_cast<const uint16_t *>(f + 12));
+				fr.vlanId = 0; // TODO: VLAN support
+				fr.data = (const void *)(f + 14);
+				fr.length = flen - 14;
+				if (count == ZT_OSX_TAP_BATCH) {
+					_handler(_arg,(void *)0,_nwid,frames,count);
+					count = 0;
 				}
 			}
+			if (count)
+				_handler(_arg,(void *)0,_nwid,frames,count);
 		}
 	}
+
+	free(getBuf);
 }
 
 } // namespace ZeroTier
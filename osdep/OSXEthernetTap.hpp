@@ -41,10 +41,23 @@
 
 #include "Thread.hpp"
 
+// feth# is the interface the OS sees and feth# + this is its peer that we read and write
+#define ZT_OSX_FETH_PEER_OFFSET 5000
+
+// BPF buffer size requested (the kernel may cap it), i.e. the most one read() returns
+#define ZT_OSX_TAP_BPF_BUFFER_SIZE 131072
+
+// Most frames handed to the handler at once
+#define ZT_OSX_TAP_BATCH 64
+
 namespace ZeroTier {
 
 /**
- * OSX Ethernet tap using ZeroTier kernel extension zt# devices
+ * macOS Ethernet tap using feth (fake Ethernet) interface pairs
+ *
+ * feth pairs are built into macOS 10.13 and newer, so this needs no kernel
+ * extension. Each network gets feth# for the OS, and its peer is read
+ * through BPF (many frames per read) and written through an NDRV socket.
  */
 class OSXEthernetTap
 {
@@ -56,7 +69,7 @@ public:
 		unsigned int metric,
 		uint64_t nwid,
 		const char *friendlyName,
-		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 		void *arg);
 
 	~OSXEthernetTap();
@@ -76,16 +89,19 @@ public:
 		throw();
 
 private:
-	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
+	void (*_handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
 	Thread _thread;
 	std::string _homePath;
 	std::string _dev;
+	std::string _peerDev;
 	std::vector<MulticastGroup> _multicastGroups;
 	unsigned int _mtu;
 	unsigned int _metric;
-	int _fd;
+	int _bpf;
+	int _ndrv;
+	unsigned int _bpfBufferSize;
 	int _shutdownSignalPipe[2];
 	volatile bool _enabled;
 };
@@ -0,0 +1,354 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_PEERSTATEFILE_HPP
+#define ZT_PEERSTATEFILE_HPP
+
+#ifndef __WINDOWS__
+
+#include "../node/Constants.hpp"
+#include "../node/Mutex.hpp"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// File starts with this magic; a file without it (or with a different slot size) is started over
+#define ZT_PEER_STATE_FILE_MAGIC "ZTPEERS1"
+#define ZT_PEER_STATE_FILE_HEADER_SIZE 64
+
+// Each slot is a 32-byte header (address, last put time, length, checksum) followed by the record
+#define ZT_PEER_STATE_FILE_SLOT_SIZE 512
+#define ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE 32
+#define ZT_PEER_STATE_FILE_MAX_RECORD (ZT_PEER_STATE_FILE_SLOT_SIZE - ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE)
+
+// Slots in a new file; the file doubles when it fills
+#define ZT_PEER_STATE_FILE_INITIAL_SLOTS 1024
+
+namespace ZeroTier {
+
+/**
+ * Keeps cached peer state in one memory-mapped file
+ *
+ * Storing a file per peer costs an inode per peer, and at hundreds of
+ * thousands of peers directory scans for cleanup and cold start get slow.
+ * This instead keeps every peer in a fixed-size slot of one mapped file
+ * with an in-memory index from address to slot built when the file is
+ * opened, so put() and get() are a hash lookup and a memcpy. Deleted and
+ * expired slots are reused by later puts and the file grows by doubling
+ * when none are free.
+ *
+ * Slots are in native byte order since the file is only ever read back
+ * by the machine that wrote it. Each carries a checksum so a slot torn
+ * by a crash is dropped at open instead of handed to the node. Records
+ * larger than ZT_PEER_STATE_FILE_MAX_RECORD are refused so the caller
+ * can store them some other way.
+ */
+class PeerStateFile
+{
+public:
+	PeerStateFile() :
+		_fd(-1),
+		_map((uint8_t *)0),
+		_slots(0),
+		_end(0)
+	{
+	}
+
+	~PeerStateFile() { close(); }
+
+	/**
+	 * Open or create the file and index its slots
+	 *
+	 * @param path Path to file
+	 * @return True on success
+	 */
+	inline bool open(const char *path)
+	{
+		Mutex::Lock _l(_lock);
+		_close();
+
+		_fd = ::open(path,O_RDWR|O_CREAT,0600);
+		if (_fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(_fd,&st) != 0) {
+			_close();
+			return false;
+		}
+		unsigned long slots = 0;
+		if (st.st_size >= (off_t)(ZT_PEER_STATE_FILE_HEADER_SIZE + ZT_PEER_STATE_FILE_SLOT_SIZE)) {
+			char hdr[ZT_PEER_STATE_FILE_HEADER_SIZE];
+			uint32_t slotSize = 0;
+			if ((pread(_fd,hdr,sizeof(hdr),0) == (ssize_t)sizeof(hdr))&&(memcmp(hdr,ZT_PEER_STATE_FILE_MAGIC,8) == 0)) {
+				memcpy(&slotSize,hdr + 8,4);
+				if (slotSize == ZT_PEER_STATE_FILE_SLOT_SIZE)
+					slots = (unsigned long)((st.st_size - ZT_PEER_STATE_FILE_HEADER_SIZE) / ZT_PEER_STATE_FILE_SLOT_SIZE);
+			}
+		}
+		if (!slots) {
+			if (ftruncate(_fd,0) != 0) {
+				_close();
+				return false;
+			}
+			slots = ZT_PEER_STATE_FILE_INITIAL_SLOTS;
+		}
+		if (!_remap(slots)) {
+			_close();
+			return false;
+		}
+		memcpy(_map,ZT_PEER_STATE_FILE_MAGIC,8);
+		const uint32_t slotSize = ZT_PEER_STATE_FILE_SLOT_SIZE;
+		memcpy(_map + 8,&slotSize,4);
+
+		// Index what's there, clearing torn slots, and remember the end of the used region
+		for(unsigned long i=0;i<_slots;++i) {
+			uint8_t *const s = _slot(i);
+			uint64_t a;
+			memcpy(&a,s,8);
+			if (!a)
+				continue;
+			uint32_t len,sum;
+			memcpy(&len,s + 16,4);
+			memcpy(&sum,s + 20,4);
+			if ((len > ZT_PEER_STATE_FILE_MAX_RECORD)||(sum != _checksum(a,s + ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE,len))||(_index.count(a))) {
+				memset(s,0,ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE);
+				continue;
+			}
+			_index[a] = i;
+			_end = i + 1;
+		}
+		for(unsigned long i=0;i<_end;++i) {
+			uint64_t a;
+			memcpy(&a,_slot(i),8);
+			if (!a)
+				_free.push_back(i);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Write everything to disk and close the file
+	 */
+	inline void close()
+	{
+		Mutex::Lock _l(_lock);
+		_close();
+	}
+
+	/**
+	 * @return True if a file is open
+	 */
+	inline bool isOpen() const
+	{
+		Mutex::Lock _l(_lock);
+		return (_map != (uint8_t *)0);
+	}
+
+	/**
+	 * Store, replace, or delete a peer's state
+	 *
+	 * @param address Peer address
+	 * @param now Current time
+	 * @param data Record
+	 * @param len Length of record, or negative to delete it
+	 * @return False if no file is open or the record is too large (nothing is stored)
+	 */
+	inline bool put(const uint64_t address,const int64_t now,const void *data,const int len)
+	{
+		Mutex::Lock _l(_lock);
+		if ((!_map)||(!address)||(len > (int)ZT_PEER_STATE_FILE_MAX_RECORD))
+			return false;
+
+		std::unordered_map<uint64_t,unsigned long>::iterator e(_index.find(address));
+		if (len < 0) {
+			if (e != _index.end()) {
+				memset(_slot(e->second),0,ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE);
+				_free.push_back(e->second);
+				_index.erase(e);
+			}
+			return true;
+		}
+
+		unsigned long i;
+		if (e != _index.end()) {
+			i = e->second;
+		} else {
+			if (!_free.empty()) {
+				i = _free.back();
+				_free.pop_back();
+			} else {
+				if ((_end >= _slots)&&(!_remap(_slots * 2)))
+					return false;
+				i = _end++;
+			}
+			_index[address] = i;
+		}
+
+		uint8_t *const s = _slot(i);
+		const uint32_t l = (uint32_t)len,sum = _checksum(address,data,l);
+		memcpy(s + ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE,data,l);
+		memcpy(s + 8,&now,8);
+		memcpy(s + 16,&l,4);
+		memcpy(s + 20,&sum,4);
+		memcpy(s,&address,8);
+		return true;
+	}
+
+	/**
+	 * @param address Peer address
+	 * @param data Buffer to fill
+	 * @param maxlen Size of buffer
+	 * @return Bytes copied or -1 if there is no record
+	 */
+	inline int get(const uint64_t address,void *data,const unsigned int maxlen)
+	{
+		Mutex::Lock _l(_lock);
+		std::unordered_map<uint64_t,unsigned long>::const_iterator e(_index.find(address));
+		if (e == _index.end())
+			return -1;
+		const uint8_t *const s = _slot(e->second);
+		uint32_t l;
+		memcpy(&l,s + 16,4);
+		if (l > maxlen)
+			l = maxlen;
+		memcpy(data,s + ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE,l);
+		return (int)l;
+	}
+
+	/**
+	 * Free the slots of records last put before a time and start writing them out
+	 *
+	 * @param before Records put before this time are deleted
+	 * @return Number of records deleted
+	 */
+	inline unsigned long expire(const int64_t before)
+	{
+		Mutex::Lock _l(_lock);
+		unsigned long n = 0;
+		for(std::unordered_map<uint64_t,unsigned long>::iterator e(_index.begin());e!=_index.end();) {
+			uint8_t *const s = _slot(e->second);
+			int64_t ts;
+			memcpy(&ts,s + 8,8);
+			if (ts < before) {
+				memset(s,0,ZT_PEER_STATE_FILE_SLOT_HEADER_SIZE);
+				_free.push_back(e->second);
+				_index.erase(e++);
+				++n;
+			} else ++e;
+		}
+		if (_map)
+			msync(_map,_mapSize(),MS_ASYNC);
+		return n;
+	}
+
+	/**
+	 * @return Number of records stored
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return (unsigned long)_index.size();
+	}
+
+private:
+	inline unsigned long _mapSize() const { return ZT_PEER_STATE_FILE_HEADER_SIZE + (_slots * ZT_PEER_STATE_FILE_SLOT_SIZE); }
+	inline uint8_t *_slot(const unsigned long i) const { return _map + ZT_PEER_STATE_FILE_HEADER_SIZE + (i * ZT_PEER_STATE_FILE_SLOT_SIZE); }
+
+	// (Re)map the file at a given number of slots, growing it if needed
+	inline bool _remap(const unsigned long slots)
+	{
+		const unsigned long size = ZT_PEER_STATE_FILE_HEADER_SIZE + (slots * ZT_PEER_STATE_FILE_SLOT_SIZE);
+		struct stat st;
+		if ((fstat(_fd,&st) != 0)||((st.st_size < (off_t)size)&&(ftruncate(_fd,(off_t)size) != 0)))
+			return false;
+		void *const m = mmap((void *)0,size,PROT_READ|PROT_WRITE,MAP_SHARED,_fd,0);
+		if (m == MAP_FAILED)
+			return false;
+		if (_map)
+			munmap(_map,_mapSize());
+		_map = reinterpret_cast<uint8_t *>(m);
+		_slots = slots;
+		return true;
+	}
+
+	inline void _close()
+	{
+		if (_map) {
+			msync(_map,_mapSize(),MS_SYNC);
+			munmap(_map,_mapSize());
+			_map = (uint8_t *)0;
+		}
+		if (_fd >= 0) {
+			::close(_fd);
+			_fd = -1;
+		}
+		_slots = 0;
+		_end = 0;
+		_index.clear();
+		_free.clear();
+	}
+
+	// FNV-1a over the address and record
+	static inline uint32_t _checksum(const uint64_t address,const void *data,const uint32_t len)
+	{
+		uint32_t h = 0x811c9dc5;
+		for(unsigned int i=0;i<8;++i) {
+			h ^= (uint32_t)((address >> (i * 8)) & 0xff);
+			h *= 0x01000193;
+		}
+		for(uint32_t i=0;i<len;++i) {
+			h ^= (uint32_t)reinterpret_cast<const uint8_t *>(data)[i];
+			h *= 0x01000193;
+		}
+		return h;
+	}
+
+	int _fd;
+	uint8_t *_map;
+	unsigned long _slots;
+	unsigned long _end; // slots at or past this have never been used
+	std::unordered_map<uint64_t,unsigned long> _index;
+	std::vector<unsigned long> _free;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif // !__WINDOWS__
+
+#endif
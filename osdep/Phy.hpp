@@ -32,6 +32,8 @@
 #include <string.h>
 
 #include <list>
+#include <vector>
+#include <chrono>
 #include <stdexcept>
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -44,10 +46,17 @@
 #define ZT_PHY_SOCKFD_NULL (INVALID_SOCKET)
 #define ZT_PHY_SOCKFD_VALID(s) ((s) != INVALID_SOCKET)
 #define ZT_PHY_CLOSE_SOCKET(s) ::closesocket(s)
-#define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
-#define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
+// IOCP completes operations rather than reporting readiness, which doesn't fit
+// the handler interface, and WSAPoll() doesn't report failed connects on older
+// Windows versions. So Windows stays on select().
+#undef ZT_PHY_USE_EPOLL
+#undef ZT_PHY_USE_KQUEUE
+#ifndef ZT_PHY_USE_SELECT
+#define ZT_PHY_USE_SELECT
+#endif
+
 #else // not Windows
 
 #include <errno.h>
@@ -73,12 +82,125 @@
 #define ZT_PHY_SOCKFD_NULL (-1)
 #define ZT_PHY_SOCKFD_VALID(s) ((s) > -1)
 #define ZT_PHY_CLOSE_SOCKET(s) ::close(s)
-#define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
-#define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
+// Event backend: epoll on Linux, kqueue on BSD and macOS, otherwise select().
+// Define one of ZT_PHY_USE_SELECT, ZT_PHY_USE_EPOLL or ZT_PHY_USE_KQUEUE to override.
+#if !defined(ZT_PHY_USE_SELECT) && !defined(ZT_PHY_USE_EPOLL) && !defined(ZT_PHY_USE_KQUEUE)
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+#define ZT_PHY_USE_EPOLL
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#define ZT_PHY_USE_KQUEUE
+#else
+#define ZT_PHY_USE_SELECT
+#endif
+#endif
+
+#ifdef ZT_PHY_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#ifdef ZT_PHY_USE_KQUEUE
+#include <sys/event.h>
+#endif
+
 #endif // Windows or not
 
+#ifdef ZT_PHY_USE_SELECT
+#define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
+#else
+#define ZT_PHY_MAX_SOCKETS 1048576
+#endif
+#define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
+
+// Maximum events taken from epoll or kqueue per poll()
+#define ZT_PHY_MAX_EVENTS 256
+
+// Size of the buffer poll() reads into
+#define ZT_PHY_RECV_BUFFER_SIZE 131072
+
+// UDP is received with recvmmsg() and sent in batches with sendmmsg() where available
+#if defined(__linux__) || defined(linux) || defined(__LINUX__) || defined(__linux)
+#define ZT_PHY_HAVE_MMSG
+#include <linux/filter.h>
+#endif
+
+// Datagrams per recvmmsg() or sendmmsg() call
+#define ZT_PHY_UDP_BATCH_SIZE 32
+
+#ifdef ZT_PHY_HAVE_MMSG
+// UDP segmentation offload (UDP_SEGMENT and UDP_GRO) needs Linux 4.18 / 5.0 at run time
+// and is just not enabled on kernels that refuse the socket options.
+#define ZT_PHY_HAVE_UDP_OFFLOAD
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Largest datagram accepted from recvmmsg(), big enough for a full GRO receive
+#define ZT_PHY_UDP_BATCH_MAX_DATAGRAM 65536
+
+// Kernel limit on segments in one UDP_SEGMENT send, and payload bytes we put in one
+#define ZT_PHY_UDP_GSO_MAX_SEGMENTS 64
+#define ZT_PHY_UDP_GSO_MAX_BYTES 65000
+
+// Control space for a UDP_SEGMENT size and an IP_TOS or IPV6_TCLASS on send,
+// or a UDP_GRO size, the traffic class and an SO_RXQ_OVFL drop count on receive
+#define ZT_PHY_UDP_CONTROL_SIZE (CMSG_SPACE(sizeof(int)) * 3)
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+#endif
+
+#if defined(ZT_PHY_USE_EPOLL) && defined(ZT_PHY_HAVE_MMSG)
+#include "LinuxIoUring.hpp"
+#ifdef ZT_HAVE_IO_URING
+#include <mutex>
+
+// UDP can be moved onto io_uring with enableIoUring()
+#define ZT_PHY_HAVE_IO_URING
+
+// Receive ring size, provided receive buffers (each holds one datagram and its
+// address), and send slots (each holds one datagram or GSO run until sent)
+#define ZT_PHY_IO_URING_ENTRIES 256
+#define ZT_PHY_IO_URING_RX_BUFFERS 256
+#define ZT_PHY_IO_URING_RX_BUFFER_SIZE 16384
+#define ZT_PHY_IO_URING_TX_SLOTS 64
+#define ZT_PHY_IO_URING_BGID 0
+#endif
+#endif
+
+#ifdef ZT_PHY_USE_EPOLL
+#include "LinuxXdp.hpp"
+#ifdef ZT_HAVE_XDP
+// UDP ports can also be received and sent through AF_XDP with xdpAttach()
+#define ZT_PHY_HAVE_XDP
+#endif
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#include "WindowsRio.hpp"
+#ifdef ZT_HAVE_RIO
+#include <mutex>
+#include <thread>
+
+// UDP can be moved onto Registered I/O with enableRio()
+#define ZT_PHY_HAVE_RIO
+
+// Receives kept posted and send slots per socket, the size of each, and
+// completion queue entries (which caps RIO sockets at CQ_SIZE / RECEIVES)
+#define ZT_PHY_RIO_RECEIVES 64
+#define ZT_PHY_RIO_SENDS 64
+#define ZT_PHY_RIO_BUFFER_SIZE 16384
+#define ZT_PHY_RIO_CQ_SIZE 16384
+#endif
+#endif
+
 namespace ZeroTier {
 
 /**
@@ -86,6 +208,33 @@ namespace ZeroTier {
  */
 typedef void PhySocket;
 
+/**
+ * A UDP datagram in a batch passed to or from Phy<>
+ */
+struct PhyDatagram
+{
+	/**
+	 * Source address of received or destination of sent datagrams
+	 */
+	const struct sockaddr *address;
+
+	/**
+	 * Datagram payload
+	 */
+	const void *data;
+
+	/**
+	 * Payload length in bytes
+	 */
+	unsigned long len;
+
+	/**
+	 * IP traffic class (DSCP and ECN) to send with or 0 for the socket's default,
+	 * or for received datagrams what it arrived with if reported (see setUdpTrafficClass())
+	 */
+	unsigned int tos;
+};
+
 /**
  * Simple templated non-blocking sockets implementation
  *
@@ -97,7 +246,7 @@ typedef void PhySocket;
  *
  * For all platforms:
  *
- * phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
+ * phyOnDatagrams(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *datagrams,unsigned int count)
  * phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
  * phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from)
  * phyOnTcpClose(PhySocket *sock,void **uptr)
@@ -130,6 +279,18 @@ typedef void PhySocket;
  * handler, and in that case close() can be told not to call handlers to
  * prevent recursion.
  *
+ * Datagrams are delivered in batches of up to ZT_PHY_UDP_BATCH_SIZE taken
+ * from one recvmmsg() call, or one at a time on platforms without recvmmsg().
+ * Receives coalesced by UDP GRO (see setUdpOffload()) are split back into
+ * the original datagrams first. Datagrams and their addresses are only valid
+ * until the handler returns.
+ *
+ * Readiness is waited for with epoll, kqueue, or select() depending on the
+ * platform and build (see ZT_PHY_USE_*). Only select() is subject to the
+ * FD_SETSIZE limit and scans every socket on each wakeup. With busy polling
+ * (see setBusyPoll()) poll() checks for readiness without waiting for a
+ * while before it waits.
+ *
  * This isn't thread-safe with the exception of whack(), which is safe to
  * call from another thread to abort poll().
  */
@@ -138,6 +299,7 @@ class Phy
 {
 private:
 	HANDLER_PTR_TYPE _handler;
+	std::vector<unsigned int> _reusePortCpus; // CPU of each socket in an SO_REUSEPORT group, see setReusePortCpus()
 
 	enum PhySocketType
 	{
@@ -149,8 +311,23 @@ private:
 		ZT_PHY_SOCKET_UDP = 0x05,
 		ZT_PHY_SOCKET_FD = 0x06,
 		ZT_PHY_SOCKET_UNIX_IN = 0x07,
-		ZT_PHY_SOCKET_UNIX_LISTEN = 0x08
+		ZT_PHY_SOCKET_UNIX_LISTEN = 0x08,
+		ZT_PHY_SOCKET_XDP = 0x09 // AF_XDP socket for one queue, owned by _xdp
+	};
+
+#ifdef ZT_PHY_HAVE_RIO
+	// Registered buffer of a RIO socket: receive slots, then send slots, then
+	// an address slot for each of those
+	struct _RioSocket
+	{
+		RIO_RQ rq;
+		RIO_BUFFERID buf;
+		char *mem;
+		unsigned int rxPosted; // receives outstanding, so this can't be freed yet
+		unsigned int txFree[ZT_PHY_RIO_SENDS];
+		unsigned int txFreeCount;
 	};
+#endif
 
 	struct PhySocketImpl
 	{
@@ -158,15 +335,85 @@ private:
 		ZT_PHY_SOCKFD_TYPE sock;
 		void *uptr; // user-settable pointer
 		ZT_PHY_SOCKADDR_STORAGE_TYPE saddr; // remote for TCP_OUT and TCP_IN, local for TCP_LISTEN, RAW, and UDP
+		bool wantRead;
+		bool wantWrite;
+		bool udpGso; // UDP socket accepts UDP_SEGMENT sends
+		int udpBuf; // receive and send buffer size last set on a UDP socket
+		int udpBufMax; // size its buffers may grow to on drops, see setUdpBufferCeiling()
+		uint32_t udpDropMark; // last SO_RXQ_OVFL count seen (wraps)
+		uint64_t udpDrops; // datagrams the kernel dropped on a full receive buffer
+#ifdef ZT_PHY_HAVE_IO_URING
+		bool uring; // UDP socket is received through io_uring instead of epoll
+		bool uringArmed; // multishot receive outstanding, so this can't be removed from _socks yet
+		struct msghdr uringMsg; // name and control space to reserve in each receive buffer
+#endif
+#ifdef ZT_PHY_HAVE_XDP
+		unsigned int xdpQueue; // queue of an XDP socket
+		unsigned int udpTtl; // IPv4 TTL of a UDP socket, for sends that bypass it through XDP
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+		_RioSocket *rio; // UDP socket received and sent through Registered I/O
+#endif
 	};
 
 	std::list<PhySocketImpl> _socks;
+#ifdef ZT_PHY_USE_SELECT
 	fd_set _readfds;
 	fd_set _writefds;
 #if defined(_WIN32) || defined(_WIN64)
 	fd_set _exceptfds;
 #endif
 	long _nfds;
+#else
+	int _pollfd; // epoll or kqueue descriptor
+	unsigned long _closed; // closed sockets waiting to be removed from _socks
+#endif
+
+#ifdef ZT_PHY_HAVE_MMSG
+	// Ring of receive buffers for recvmmsg(), allocated on first UDP receive
+	struct _UdpRing
+	{
+		struct mmsghdr msgs[ZT_PHY_UDP_BATCH_SIZE];
+		struct iovec iov[ZT_PHY_UDP_BATCH_SIZE];
+		struct sockaddr_storage from[ZT_PHY_UDP_BATCH_SIZE];
+		PhyDatagram datagrams[ZT_PHY_UDP_BATCH_SIZE];
+		union { char buf[ZT_PHY_UDP_CONTROL_SIZE]; size_t align; } control[ZT_PHY_UDP_BATCH_SIZE]; // GRO segment size and traffic class
+		char data[ZT_PHY_UDP_BATCH_SIZE][ZT_PHY_UDP_BATCH_MAX_DATAGRAM];
+	};
+	_UdpRing *_udpRing;
+#endif
+
+#ifdef ZT_PHY_HAVE_IO_URING
+	// A send waiting for its completion
+	struct _UringTxSlot
+	{
+		struct msghdr msg;
+		struct iovec iov;
+		struct sockaddr_storage to;
+		union { char buf[ZT_PHY_UDP_CONTROL_SIZE]; size_t align; } control;
+		bool gso;
+		char data[ZT_PHY_UDP_BATCH_MAX_DATAGRAM];
+	};
+	LinuxIoUring *_uringRx; // multishot UDP receives, its fd is watched by epoll (poll() thread only)
+	LinuxIoUring *_uringTx; // UDP sends from any thread, guarded by _uringTxLock
+	std::mutex _uringTxLock;
+	_UringTxSlot *_uringTxSlots;
+	unsigned int _uringTxFree[ZT_PHY_IO_URING_TX_SLOTS];
+	unsigned int _uringTxFreeCount;
+	bool _uringTxGso;
+#endif
+
+#ifdef ZT_PHY_HAVE_XDP
+	LinuxXdp *_xdp;
+#endif
+
+#ifdef ZT_PHY_HAVE_RIO
+	WindowsRio *_rio;
+	std::mutex _rioLock; // RIO doesn't serialize calls on a queue, so this guards every request queue and the send completion queue
+	std::thread _rioNotifier; // wakes poll() when receives complete
+	volatile bool _rioRun;
+	unsigned int _rioSockets;
+#endif
 
 	ZT_PHY_SOCKFD_TYPE _whackReceiveSocket;
 	ZT_PHY_SOCKFD_TYPE _whackSendSocket;
@@ -174,6 +421,9 @@ private:
 	bool _noDelay;
 	bool _noCheck;
 
+	unsigned long _busyPoll; // microseconds poll() spins before waiting, see setBusyPoll()
+	bool _busyPollSockets;
+
 public:
 	/**
 	 * @param handler Pointer of type HANDLER_PTR_TYPE to handler
@@ -183,8 +433,10 @@ public:
 	Phy(HANDLER_PTR_TYPE handler,bool noDelay,bool noCheck) :
 		_handler(handler)
 	{
+#ifdef ZT_PHY_USE_SELECT
 		FD_ZERO(&_readfds);
 		FD_ZERO(&_writefds);
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 		FD_ZERO(&_exceptfds);
@@ -220,21 +472,103 @@ public:
 			throw std::runtime_error("unable to create pipes for select() abort");
 #endif // Windows or not
 
-		_nfds = (pipes[0] > pipes[1]) ? (long)pipes[0] : (long)pipes[1];
 		_whackReceiveSocket = pipes[0];
 		_whackSendSocket = pipes[1];
+#ifdef ZT_PHY_USE_SELECT
+		_nfds = (pipes[0] > pipes[1]) ? (long)pipes[0] : (long)pipes[1];
+#else
+		_closed = 0;
+		// The whack pipe is registered with a null pointer to tell it apart from sockets
+#ifdef ZT_PHY_USE_EPOLL
+		_pollfd = ::epoll_create1(EPOLL_CLOEXEC);
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = (void *)0;
+		if ((_pollfd < 0)||(::epoll_ctl(_pollfd,EPOLL_CTL_ADD,_whackReceiveSocket,&ev) != 0)) {
+#else
+		_pollfd = ::kqueue();
+		struct kevent ev;
+		EV_SET(&ev,_whackReceiveSocket,EVFILT_READ,EV_ADD,0,0,0);
+		if ((_pollfd < 0)||(::kevent(_pollfd,&ev,1,(struct kevent *)0,0,(const struct timespec *)0) != 0)) {
+#endif
+			if (_pollfd >= 0)
+				::close(_pollfd);
+			::close(pipes[0]);
+			::close(pipes[1]);
+			throw std::runtime_error("unable to create event queue for poll()");
+		}
+#endif
+#ifdef ZT_PHY_HAVE_MMSG
+		_udpRing = (_UdpRing *)0;
+#endif
+#ifdef ZT_PHY_HAVE_IO_URING
+		_uringRx = (LinuxIoUring *)0;
+		_uringTx = (LinuxIoUring *)0;
+		_uringTxSlots = (_UringTxSlot *)0;
+		_uringTxFreeCount = 0;
+		_uringTxGso = true;
+#endif
+#ifdef ZT_PHY_HAVE_XDP
+		_xdp = (LinuxXdp *)0;
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+		_rio = (WindowsRio *)0;
+		_rioRun = false;
+		_rioSockets = 0;
+#endif
 		_noDelay = noDelay;
 		_noCheck = noCheck;
+		_busyPoll = 0;
+		_busyPollSockets = false;
 	}
 
 	~Phy()
 	{
+#ifdef ZT_PHY_HAVE_RIO
+		if (_rio) {
+			_rioRun = false;
+			SetEvent(_rio->event());
+			_rioNotifier.join();
+		}
+#endif
 		for(typename std::list<PhySocketImpl>::const_iterator s(_socks.begin());s!=_socks.end();++s) {
 			if (s->type != ZT_PHY_SOCKET_CLOSED)
 				this->close((PhySocket *)&(*s),true);
 		}
 		ZT_PHY_CLOSE_SOCKET(_whackReceiveSocket);
 		ZT_PHY_CLOSE_SOCKET(_whackSendSocket);
+#ifndef ZT_PHY_USE_SELECT
+		::close(_pollfd);
+#endif
+#ifdef ZT_PHY_HAVE_MMSG
+		delete _udpRing;
+#endif
+#ifdef ZT_PHY_HAVE_IO_URING
+		delete _uringRx;
+		delete _uringTx;
+		delete [] _uringTxSlots;
+#endif
+#ifdef ZT_PHY_HAVE_XDP
+		delete _xdp;
+#endif
+#ifdef ZT_PHY_HAVE_RIO
+		// Closing a socket drops its request queue and anything outstanding on it
+		if (_rio) {
+			for(int k=0;k<20;++k) {
+				_rioReceive(); // takes the completions of canceled operations, nothing is delivered
+				bool waiting = false;
+				for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();++s) {
+					if ((s->rio)&&(!_rioFree(*s)))
+						waiting = true;
+				}
+				if (!waiting)
+					break;
+				Sleep(50);
+			}
+			delete _rio;
+		}
+#endif
 	}
 
 	/**
@@ -305,14 +639,12 @@ public:
 			return (PhySocket *)0;
 		}
 		PhySocketImpl &sws = _socks.back();
-		if ((long)fd > _nfds)
-			_nfds = (long)fd;
-		FD_SET(fd,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_IN; /* TODO: Type was changed to allow for CBs with new RPC model */
 		sws.sock = fd;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		// no sockaddr for this socket type, leave saddr null
+		_setInterest(sws,true,false);
 		return (PhySocket *)&sws;
 	}
 
@@ -322,17 +654,23 @@ public:
 	 * @param localAddress Local endpoint address and port
 	 * @param uptr Initial value of user pointer associated with this socket (default: NULL)
 	 * @param bufferSize Desired socket receive/send buffer size -- will set as close to this as possible (default: 0, leave alone)
+	 * @param reusePort If true, set SO_REUSEPORT so several sockets can bind the same endpoint (Linux balances flows across them) (default: false)
 	 * @return Socket or NULL on failure to bind
 	 */
-	inline PhySocket *udpBind(const struct sockaddr *localAddress,void *uptr = (void *)0,int bufferSize = 0)
+	inline PhySocket *udpBind(const struct sockaddr *localAddress,void *uptr = (void *)0,int bufferSize = 0,bool reusePort = false)
 	{
 		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
 			return (PhySocket *)0;
 
+#ifdef ZT_PHY_HAVE_RIO
+		ZT_PHY_SOCKFD_TYPE s = (_rio) ? WindowsRio::socket(localAddress->sa_family) : ::socket(localAddress->sa_family,SOCK_DGRAM,0);
+#else
 		ZT_PHY_SOCKFD_TYPE s = ::socket(localAddress->sa_family,SOCK_DGRAM,0);
+#endif
 		if (!ZT_PHY_SOCKFD_VALID(s))
 			return (PhySocket *)0;
 
+		int rcvbs = 0;
 		if (bufferSize > 0) {
 			int bs = bufferSize;
 			while (bs >= 65536) {
@@ -341,6 +679,8 @@ public:
 					break;
 				bs -= 16384;
 			}
+			if (bs >= 65536)
+				rcvbs = bs;
 			bs = bufferSize;
 			while (bs >= 65536) {
 				int tmpbs = bs;
@@ -359,6 +699,10 @@ public:
 			}
 			f = FALSE; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,(const char *)&f,sizeof(f));
 			f = TRUE; setsockopt(s,SOL_SOCKET,SO_BROADCAST,(const char *)&f,sizeof(f));
+			if (reusePort) { // no equivalent that balances across sockets
+				ZT_PHY_CLOSE_SOCKET(s);
+				return (PhySocket *)0;
+			}
 		}
 #else // not Windows
 		{
@@ -373,7 +717,44 @@ public:
 #endif
 			}
 			f = 0; setsockopt(s,SOL_SOCKET,SO_REUSEADDR,(void *)&f,sizeof(f));
+#ifdef SO_REUSEPORT
+			if (reusePort) {
+				f = 1;
+				if (setsockopt(s,SOL_SOCKET,SO_REUSEPORT,(void *)&f,sizeof(f)) != 0) {
+					ZT_PHY_CLOSE_SOCKET(s);
+					return (PhySocket *)0;
+				}
+#if defined(ZT_PHY_HAVE_MMSG) && defined(SO_ATTACH_REUSEPORT_CBPF)
+				if ((!_reusePortCpus.empty())&&(_reusePortCpus.size() <= 64)) {
+					// Return the index of the socket whose CPU this is, or one past the end
+					// so the kernel falls back to its usual flow hash
+					struct sock_filter code[2 + (64 * 2)];
+					unsigned short n = 0;
+					code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,(uint32_t)(SKF_AD_OFF + SKF_AD_CPU));
+					for(unsigned int i=0;i<(unsigned int)_reusePortCpus.size();++i) {
+						code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,_reusePortCpus[i],0,1);
+						code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,i);
+					}
+					code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,(uint32_t)_reusePortCpus.size());
+					struct sock_fprog prog;
+					prog.len = n;
+					prog.filter = code;
+					setsockopt(s,SOL_SOCKET,SO_ATTACH_REUSEPORT_CBPF,(void *)&prog,sizeof(prog));
+				}
+#endif
+			}
+#else
+			if (reusePort) {
+				ZT_PHY_CLOSE_SOCKET(s);
+				return (PhySocket *)0;
+			}
+#endif
 			f = 1; setsockopt(s,SOL_SOCKET,SO_BROADCAST,(void *)&f,sizeof(f));
+#ifdef SO_BUSY_POLL
+			if ((_busyPoll)&&(_busyPollSockets)) {
+				f = (int)_busyPoll; setsockopt(s,SOL_SOCKET,SO_BUSY_POLL,(void *)&f,sizeof(f));
+			}
+#endif
 #ifdef IP_DONTFRAG
 			f = 0; setsockopt(s,IPPROTO_IP,IP_DONTFRAG,&f,sizeof(f));
 #endif
@@ -410,18 +791,108 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UDP;
 		sws.sock = s;
 		sws.uptr = uptr;
+		sws.udpGso = false;
+		sws.udpBuf = rcvbs;
+		sws.udpBufMax = 0;
+		sws.udpDropMark = 0;
+		sws.udpDrops = 0;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+#ifdef ZT_PHY_HAVE_IO_URING
+		sws.uringArmed = false;
+		sws.uring = ((_uringRx)&&(_uringArm(sws)));
+		if (!sws.uring)
+			_setInterest(sws,true,false);
+#elif defined(ZT_PHY_HAVE_RIO)
+		sws.rio = (_rio) ? _rioAttach(sws) : (_RioSocket *)0;
+		if (!sws.rio)
+			_setInterest(sws,true,false);
+#else
+		_setInterest(sws,true,false);
+#endif
+#ifdef ZT_PHY_HAVE_XDP
+		sws.udpTtl = 64;
+		if (_xdp)
+			_xdp->addPort(_port(sws.saddr));
+#endif
 
 		return (PhySocket *)&sws;
 	}
 
+	/**
+	 * Steer SO_REUSEPORT UDP groups bound after this by receiving CPU (Linux only)
+	 *
+	 * A group's sockets are numbered in the order they were bound. With
+	 * this set, a datagram received on cpus[i] goes to socket i instead of
+	 * the socket picked by the kernel's flow hash, which is still used for
+	 * datagrams received on other CPUs. If socket i is polled by a thread
+	 * pinned to cpus[i] and cpus[] are the CPUs that service the NIC's
+	 * receive queues, each datagram is handled where it was received.
+	 *
+	 * @param cpus CPU of each socket in each group (at most 64), or empty for the flow hash (default)
+	 */
+	inline void setReusePortCpus(const std::vector<unsigned int> &cpus) { _reusePortCpus = cpus; }
+
+	/**
+	 * Spin in poll() before waiting for activity
+	 *
+	 * With this set poll() checks for activity without waiting, over and over,
+	 * for up to this long (or its timeout if that's shorter) before it waits,
+	 * so anything arriving meanwhile is handled without the latency of a
+	 * wakeup. This keeps a core busy and is best used with the polling thread
+	 * pinned to a core of its own. With sockets true, UDP sockets bound after
+	 * this also get SO_BUSY_POLL (Linux only), so a receive that empties one
+	 * polls the NIC driver for more. Raising that above net.core.busy_read
+	 * needs CAP_NET_ADMIN.
+	 *
+	 * @param usec Microseconds to spin or 0 to wait right away (default)
+	 * @param sockets If true, set SO_BUSY_POLL to usec on UDP sockets bound after this
+	 */
+	inline void setBusyPoll(unsigned long usec,bool sockets)
+	{
+		_busyPoll = usec;
+		_busyPollSockets = sockets;
+	}
+
+	/**
+	 * Enable UDP receive and segmentation offload on a UDP socket if possible
+	 *
+	 * With GRO the kernel may coalesce a burst of same-size datagrams from one
+	 * sender into a single receive, which poll() splits again before calling
+	 * the handler. With GSO udpSendBatch() sends runs of same-size datagrams
+	 * to one destination as one buffer that the kernel or NIC segments. GSO
+	 * needs UDP checksums, so SO_NO_CHECK is cleared on sockets that get it.
+	 * This does nothing on platforms or kernels without support.
+	 *
+	 * @param sock UDP socket
+	 * @return True if GRO or GSO was enabled
+	 */
+	inline bool setUdpOffload(PhySocket *sock)
+	{
+#ifdef ZT_PHY_HAVE_UDP_OFFLOAD
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		int f = 1;
+#ifdef ZT_PHY_HAVE_IO_URING
+		const bool gro = ((!sws.uring)&&(::setsockopt(sws.sock,SOL_UDP,UDP_GRO,(void *)&f,sizeof(f)) == 0)); // io_uring receive buffers only fit single datagrams
+#else
+		const bool gro = (::setsockopt(sws.sock,SOL_UDP,UDP_GRO,(void *)&f,sizeof(f)) == 0);
+#endif
+		f = 0; // a zero segment size only checks that UDP_SEGMENT is supported
+		sws.udpGso = (::setsockopt(sws.sock,SOL_UDP,UDP_SEGMENT,(void *)&f,sizeof(f)) == 0);
+#ifdef SO_NO_CHECK
+		if (sws.udpGso) {
+			f = 0; ::setsockopt(sws.sock,SOL_SOCKET,SO_NO_CHECK,(void *)&f,sizeof(f));
+		}
+#endif
+		return ((gro)||(sws.udpGso));
+#else
+		return false;
+#endif
+	}
+
 	/**
 	 * Set the IP TTL for the next outgoing packet (for IPv4 UDP sockets only)
 	 *
@@ -436,98 +907,419 @@ public:
 		return (::setsockopt(sws.sock,IPPROTO_IP,IP_TTL,(const char *)&tmp,sizeof(tmp)) == 0);
 #else
 		int tmp = ((ttl == 0)||(ttl > 255)) ? 255 : (int)ttl;
+#ifdef ZT_PHY_HAVE_XDP
+		sws.udpTtl = (unsigned int)tmp;
+#endif
 		return (::setsockopt(sws.sock,IPPROTO_IP,IP_TTL,(void *)&tmp,sizeof(tmp)) == 0);
 #endif
 	}
 
 	/**
-	 * Send a UDP packet
+	 * Send a UDP packet with the IP don't fragment bit set
+	 *
+	 * UDP sockets are opened with fragmentation allowed, so this sets don't
+	 * fragment, sends with a plain sendto() (not AF_XDP or RIO) and clears
+	 * it again. Like setIp4UdpTtl() this races with sends from other threads
+	 * on the same socket, which at worst go out once with the bit set. A
+	 * packet bigger than the interface MTU (or a cached path MTU) fails
+	 * rather than being fragmented. On Linux the kernel's path MTU cache is
+	 * neither used nor updated.
 	 *
 	 * @param sock UDP socket
 	 * @param remoteAddress Destination address (must be correct type for socket)
 	 * @param data Data to send
 	 * @param len Length of packet
-	 * @return True if packet appears to have been sent successfully
+	 * @return True if packet was sent without fragmenting it, false if it failed or don't fragment isn't supported
 	 */
-	inline bool udpSend(PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len)
+	inline bool udpSendDontFragment(PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		const bool v6 = (remoteAddress->sa_family == AF_INET6);
+		if (!_setDontFragment(sws.sock,v6,true))
+			return false;
 #if defined(_WIN32) || defined(_WIN64)
-		return ((long)::sendto(sws.sock,reinterpret_cast<const char *>(data),len,0,remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
+		const bool r = ((long)::sendto(sws.sock,reinterpret_cast<const char *>(data),len,0,remoteAddress,(v6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
 #else
-		return ((long)::sendto(sws.sock,data,len,0,remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
+		const bool r = ((long)::sendto(sws.sock,data,len,0,remoteAddress,(v6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
 #endif
+		_setDontFragment(sws.sock,v6,false);
+		return r;
 	}
 
-#ifdef __UNIX_LIKE__
 	/**
-	 * Listen for connections on a Unix domain socket
+	 * Report the IP traffic class of datagrams received on a UDP socket (Linux only)
 	 *
-	 * @param path Path to Unix domain socket
-	 * @param uptr Arbitrary pointer to associate
-	 * @return PhySocket or NULL if cannot bind
+	 * Once enabled, received datagrams carry the DSCP and ECN bits they
+	 * arrived with in their tos field. Sending with a traffic class doesn't
+	 * need this and happens wherever a datagram's tos is set, but also only
+	 * on Linux.
+	 *
+	 * @param sock UDP socket
+	 * @return True if the traffic class will be reported
 	 */
-	inline PhySocket *unixListen(const char *path,void *uptr = (void *)0)
+	inline bool setUdpTrafficClass(PhySocket *sock)
 	{
-		struct sockaddr_un sun;
-
-		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
-			return (PhySocket *)0;
+#ifdef ZT_PHY_HAVE_MMSG
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		int f = 1;
+		if (reinterpret_cast<const struct sockaddr *>(&(sws.saddr))->sa_family == AF_INET6) {
+			// Dual stack sockets also get IPv4 TOS for mapped addresses on Linux
+			const bool v4 = (::setsockopt(sws.sock,IPPROTO_IP,IP_RECVTOS,(void *)&f,sizeof(f)) == 0);
+			return ((::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_RECVTCLASS,(void *)&f,sizeof(f)) == 0)||(v4));
+		}
+		return (::setsockopt(sws.sock,IPPROTO_IP,IP_RECVTOS,(void *)&f,sizeof(f)) == 0);
+#else
+		return false;
+#endif
+	}
 
-		memset(&sun,0,sizeof(sun));
-		sun.sun_family = AF_UNIX;
-		if (strlen(path) >= sizeof(sun.sun_path))
-			return (PhySocket *)0;
-		strcpy(sun.sun_path,path);
+	/**
+	 * Count datagrams a UDP socket drops on a full receive buffer and grow its buffers when it does (Linux only)
+	 *
+	 * This turns on SO_RXQ_OVFL, so receives report how many datagrams the
+	 * kernel has dropped because the socket's receive buffer was full. Each
+	 * time that goes up, udpDrops() counts the new drops and the receive and
+	 * send buffers are doubled until they reach maxBufferSize. Growing uses
+	 * SO_RCVBUFFORCE and SO_SNDBUFFORCE if we have CAP_NET_ADMIN, otherwise
+	 * the kernel caps it at net.core.rmem_max and wmem_max.
+	 *
+	 * @param sock UDP socket
+	 * @param maxBufferSize Largest buffer size to grow to, or 0 to only count drops
+	 * @return True if drops will be counted
+	 */
+	inline bool setUdpBufferCeiling(PhySocket *sock,int maxBufferSize)
+	{
+#ifdef ZT_PHY_HAVE_MMSG
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		sws.udpBufMax = maxBufferSize;
+		int f = 1;
+		return (::setsockopt(sws.sock,SOL_SOCKET,SO_RXQ_OVFL,(void *)&f,sizeof(f)) == 0);
+#else
+		return false;
+#endif
+	}
 
-		ZT_PHY_SOCKFD_TYPE s = ::socket(PF_UNIX,SOCK_STREAM,0);
-		if (!ZT_PHY_SOCKFD_VALID(s))
-			return (PhySocket *)0;
+	/**
+	 * Get datagrams dropped on a UDP socket's full receive buffer
+	 *
+	 * This may be called from another thread than the one polling the
+	 * socket as long as the socket stays open, but may then lag a little.
+	 *
+	 * @param sock UDP socket
+	 * @return Drops counted since setUdpBufferCeiling()
+	 */
+	static inline uint64_t udpDrops(PhySocket *sock) { return reinterpret_cast<const PhySocketImpl *>(sock)->udpDrops; }
 
-		::fcntl(s,F_SETFL,O_NONBLOCK);
+	/**
+	 * @param sock UDP socket
+	 * @return Receive and send buffer size last set on this socket or 0 if never set (threads as for udpDrops())
+	 */
+	static inline int udpBufferSize(PhySocket *sock) { return reinterpret_cast<const PhySocketImpl *>(sock)->udpBuf; }
 
-		::unlink(path);
-		if (::bind(s,(struct sockaddr *)&sun,sizeof(struct sockaddr_un)) != 0) {
-			ZT_PHY_CLOSE_SOCKET(s);
-			return (PhySocket *)0;
+	/**
+	 * Send a UDP packet
+	 *
+	 * @param sock UDP socket
+	 * @param remoteAddress Destination address (must be correct type for socket)
+	 * @param data Data to send
+	 * @param len Length of packet
+	 * @param tos IP traffic class or 0 for the socket's default (default: 0, see PhyDatagram)
+	 * @return True if packet appears to have been sent successfully
+	 */
+	inline bool udpSend(PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len,unsigned int tos = 0)
+	{
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+#ifdef ZT_PHY_HAVE_MMSG
+		if (tos) {
+			struct msghdr msg;
+			struct iovec iov;
+			union { char buf[ZT_PHY_UDP_CONTROL_SIZE]; size_t align; } control;
+			memset(&msg,0,sizeof(msg));
+			msg.msg_name = const_cast<struct sockaddr *>(remoteAddress);
+			msg.msg_namelen = (remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+			iov.iov_base = const_cast<void *>(data);
+			iov.iov_len = (size_t)len;
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			_udpControl(msg,control.buf,0,tos);
+			return ((long)::sendmsg(sws.sock,&msg,0) == (long)len);
 		}
-		if (::listen(s,128) != 0) {
-			ZT_PHY_CLOSE_SOCKET(s);
-			return (PhySocket *)0;
+#endif
+#ifdef ZT_PHY_HAVE_XDP
+		if ((_xdp)&&(_xdpSend(sws,remoteAddress,data,len))) {
+			_xdp->flush();
+			return true;
 		}
-
-		try {
-			_socks.push_back(PhySocketImpl());
-		} catch ( ... ) {
-			ZT_PHY_CLOSE_SOCKET(s);
-			return (PhySocket *)0;
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#ifdef ZT_PHY_HAVE_RIO
+		if (sws.rio) {
+			PhyDatagram d;
+			d.address = remoteAddress;
+			d.data = data;
+			d.len = len;
+			d.tos = 0;
+			if (_rioSend(sws,&d,1) == 1)
+				return true;
 		}
-		PhySocketImpl &sws = _socks.back();
-
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
-		sws.type = ZT_PHY_SOCKET_UNIX_LISTEN;
-		sws.sock = s;
-		sws.uptr = uptr;
-		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
-		memcpy(&(sws.saddr),&sun,sizeof(struct sockaddr_un));
-
-		return (PhySocket *)&sws;
+#endif
+		return ((long)::sendto(sws.sock,reinterpret_cast<const char *>(data),len,0,remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
+#else
+		return ((long)::sendto(sws.sock,data,len,0,remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
+#endif
 	}
-#endif // __UNIX_LIKE__
 
 	/**
-	 * Bind a local listen socket to listen for new TCP connections
+	 * Send several UDP packets from one socket
 	 *
-	 * @param localAddress Local address and port
-	 * @param uptr Initial value of uptr for new socket (default: NULL)
-	 * @return Socket or NULL on failure to bind
+	 * Where available these go out with one sendmmsg() call per
+	 * ZT_PHY_UDP_BATCH_SIZE messages, otherwise with one sendto() each. If
+	 * GSO is enabled on the socket (see setUdpOffload()), consecutive datagrams
+	 * to the same destination that are the same size (the last may be shorter)
+	 * are sent as one message with UDP_SEGMENT. A datagram that fails to send
+	 * doesn't stop the ones after it. After enableIoUring() sends are queued
+	 * on io_uring instead and are counted as sent once queued, and after
+	 * enableRio() the same goes for Registered I/O. After xdpAttach() datagrams to addresses heard from on its interface go out
+	 * through AF_XDP. Datagrams with a tos are sent with that traffic class
+	 * on Linux, bypassing AF_XDP, and without it elsewhere.
+	 *
+	 * @param sock UDP socket
+	 * @param datagrams Datagrams with their destination addresses
+	 * @param count Number of datagrams
+	 * @return Number of datagrams that appear to have been sent successfully
 	 */
-	inline PhySocket *tcpListen(const struct sockaddr *localAddress,void *uptr = (void *)0)
+	inline unsigned int udpSendBatch(PhySocket *sock,const PhyDatagram *datagrams,unsigned int count)
 	{
-		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
-			return (PhySocket *)0;
+#ifdef ZT_PHY_HAVE_XDP
+		if (_xdp) {
+			PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+			unsigned int i = 0,sent = 0,queued = 0;
+			while (i < count) {
+				unsigned int j = i;
+				while ((j < count)&&((datagrams[j].tos)||(!_xdpSend(sws,datagrams[j].address,datagrams[j].data,datagrams[j].len))))
+					++j;
+				if (j > i) // these couldn't go through XDP
+					sent += _udpSendBatch(sock,datagrams + i,j - i);
+				if (j < count) {
+					++sent;
+					++queued;
+				}
+				i = j + 1;
+			}
+			if (queued)
+				_xdp->flush();
+			return sent;
+		}
+#endif
+		return _udpSendBatch(sock,datagrams,count);
+	}
+
+	/**
+	 * Move UDP receive and send onto io_uring (Linux only)
+	 *
+	 * UDP sockets bound after this get a multishot recvmsg into a ring of
+	 * kernel-selected buffers, and their datagrams are delivered from poll()
+	 * straight out of those buffers. udpSendBatch() queues sends as
+	 * asynchronous sendmsg operations, using GSO where enabled. Sockets that
+	 * can't be set up this way and sends that find no free slot use the usual
+	 * epoll, recvmmsg() and sendmmsg() paths.
+	 *
+	 * @return True if io_uring is in use, false if it's unsupported here
+	 */
+	inline bool enableIoUring()
+	{
+#ifdef ZT_PHY_HAVE_IO_URING
+		if (_uringRx)
+			return true;
+		LinuxIoUring *const rx = new LinuxIoUring();
+		LinuxIoUring *const tx = new LinuxIoUring();
+		if ((rx->init(ZT_PHY_IO_URING_ENTRIES))&&(rx->setupBufferRing(ZT_PHY_IO_URING_BGID,ZT_PHY_IO_URING_RX_BUFFERS,ZT_PHY_IO_URING_RX_BUFFER_SIZE))&&(tx->init(ZT_PHY_IO_URING_TX_SLOTS))) {
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = (void *)&_uringRx; // tells completions apart from sockets and the whack pipe
+			if (::epoll_ctl(_pollfd,EPOLL_CTL_ADD,rx->fd(),&ev) == 0) {
+				_uringRx = rx;
+				_uringTx = tx;
+				_uringTxSlots = new _UringTxSlot[ZT_PHY_IO_URING_TX_SLOTS];
+				for(unsigned int k=0;k<ZT_PHY_IO_URING_TX_SLOTS;++k)
+					_uringTxFree[k] = k;
+				_uringTxFreeCount = ZT_PHY_IO_URING_TX_SLOTS;
+				return true;
+			}
+		}
+		delete rx;
+		delete tx;
+#endif
+		return false;
+	}
+
+	/**
+	 * Move UDP receive and send onto Registered I/O (Windows only)
+	 *
+	 * UDP sockets bound after this keep ZT_PHY_RIO_RECEIVES receives posted
+	 * into a registered buffer of their own instead of being in select()'s
+	 * set, and poll() delivers completed receives in batches straight out of
+	 * that buffer. A thread waits on the completion queue's event and wakes
+	 * poll() with whack(), so poll() still sleeps in select(). udpSendBatch()
+	 * copies datagrams into registered send slots and submits a whole batch
+	 * with one commit. Sockets that can't be set up this way and sends that
+	 * find no free slot use select() and sendto() as usual. Needs Windows 8
+	 * or Server 2012 or newer.
+	 *
+	 * @return True if Registered I/O is in use, false if it's unsupported here
+	 */
+	inline bool enableRio()
+	{
+#ifdef ZT_PHY_HAVE_RIO
+		if (_rio)
+			return true;
+		WindowsRio *const rio = new WindowsRio();
+		if (!rio->init(ZT_PHY_RIO_CQ_SIZE)) {
+			delete rio;
+			return false;
+		}
+		_rio = rio;
+		_rioRun = true;
+		_rioNotifier = std::thread([this]() {
+			while (_rioRun) {
+				if (WaitForSingleObject(_rio->event(),INFINITE) != WAIT_OBJECT_0)
+					break;
+				if (_rioRun)
+					this->whack();
+			}
+		});
+		_rio->notify();
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * Receive and send this Phy's UDP ports through AF_XDP on an interface (Linux only)
+	 *
+	 * An XDP program on the interface steers datagrams to the ports of UDP
+	 * sockets bound here (now or later) into AF_XDP sockets on its first
+	 * queues, and poll() delivers them from there as if they came in on the
+	 * socket they were sent to. Other traffic, and traffic on other queues,
+	 * goes through the kernel. Sends to addresses that were heard from on the
+	 * interface are written straight into its transmit ring. This is meant
+	 * for hosts that do little but ZeroTier, like roots and relays, and needs
+	 * CAP_NET_ADMIN and CAP_BPF or root.
+	 *
+	 * @param ifname Interface name
+	 * @param queues Number of queues, starting at queue 0
+	 * @return True if attached, false if unsupported, not permitted, or already attached
+	 */
+	inline bool xdpAttach(const char *ifname,unsigned int queues)
+	{
+#ifdef ZT_PHY_HAVE_XDP
+		if (_xdp)
+			return false;
+		LinuxXdp *const x = new LinuxXdp();
+		if (x->init(ifname,queues)) {
+			try {
+				for(unsigned int q=0;q<x->queues();++q) {
+					_socks.push_back(PhySocketImpl());
+					PhySocketImpl &sws = _socks.back();
+					sws.type = ZT_PHY_SOCKET_XDP;
+					sws.sock = x->fd(q);
+					sws.uptr = (void *)0;
+					sws.wantRead = false;
+					sws.wantWrite = false;
+					sws.xdpQueue = q;
+					_setInterest(sws,true,false);
+				}
+			} catch ( ... ) {
+				for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
+					if (s->type == ZT_PHY_SOCKET_XDP) {
+						_unwatch(*s);
+						_socks.erase(s++);
+					} else ++s;
+				}
+				delete x;
+				return false;
+			}
+			_xdp = x;
+			for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();++s) {
+				if (s->type == ZT_PHY_SOCKET_UDP)
+					_xdp->addPort(_port(s->saddr));
+			}
+			return true;
+		}
+		delete x;
+#endif
+		return false;
+	}
+
+#ifdef __UNIX_LIKE__
+	/**
+	 * Listen for connections on a Unix domain socket
+	 *
+	 * @param path Path to Unix domain socket
+	 * @param uptr Arbitrary pointer to associate
+	 * @return PhySocket or NULL if cannot bind
+	 */
+	inline PhySocket *unixListen(const char *path,void *uptr = (void *)0)
+	{
+		struct sockaddr_un sun;
+
+		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
+			return (PhySocket *)0;
+
+		memset(&sun,0,sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(sun.sun_path))
+			return (PhySocket *)0;
+		strcpy(sun.sun_path,path);
+
+		ZT_PHY_SOCKFD_TYPE s = ::socket(PF_UNIX,SOCK_STREAM,0);
+		if (!ZT_PHY_SOCKFD_VALID(s))
+			return (PhySocket *)0;
+
+		::fcntl(s,F_SETFL,O_NONBLOCK);
+
+		::unlink(path);
+		if (::bind(s,(struct sockaddr *)&sun,sizeof(struct sockaddr_un)) != 0) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			return (PhySocket *)0;
+		}
+		if (::listen(s,128) != 0) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			return (PhySocket *)0;
+		}
+
+		try {
+			_socks.push_back(PhySocketImpl());
+		} catch ( ... ) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			return (PhySocket *)0;
+		}
+		PhySocketImpl &sws = _socks.back();
+
+		sws.type = ZT_PHY_SOCKET_UNIX_LISTEN;
+		sws.sock = s;
+		sws.uptr = uptr;
+		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
+		memcpy(&(sws.saddr),&sun,sizeof(struct sockaddr_un));
+		_setInterest(sws,true,false);
+
+		return (PhySocket *)&sws;
+	}
+#endif // __UNIX_LIKE__
+
+	/**
+	 * Bind a local listen socket to listen for new TCP connections
+	 *
+	 * @param localAddress Local address and port
+	 * @param uptr Initial value of uptr for new socket (default: NULL)
+	 * @return Socket or NULL on failure to bind
+	 */
+	inline PhySocket *tcpListen(const struct sockaddr *localAddress,void *uptr = (void *)0)
+	{
+		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
+			return (PhySocket *)0;
 
 		ZT_PHY_SOCKFD_TYPE s = ::socket(localAddress->sa_family,SOCK_STREAM,0);
 		if (!ZT_PHY_SOCKFD_VALID(s))
@@ -570,14 +1362,12 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_TCP_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		_setInterest(sws,true,false);
 
 		return (PhySocket *)&sws;
 	}
@@ -655,22 +1445,12 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		if (connected) {
-			FD_SET(s,&_readfds);
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-		} else {
-			FD_SET(s,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-			FD_SET(s,&_exceptfds);
-#endif
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_PENDING;
-		}
+		sws.type = (connected) ? ZT_PHY_SOCKET_TCP_OUT_CONNECTED : ZT_PHY_SOCKET_TCP_OUT_PENDING;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		_setInterest(sws,connected,!connected); // a pending connect is done when writable
 
 		if ((callConnectHandler)&&(connected)) {
 			try {
@@ -819,11 +1599,8 @@ public:
 	inline void setNotifyWritable(PhySocket *sock,bool notifyWritable)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
-		if (notifyWritable) {
-			FD_SET(sws.sock,&_writefds);
-		} else {
-			FD_CLR(sws.sock,&_writefds);
-		}
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_setInterest(sws,sws.wantRead,notifyWritable);
 	}
 
 	/**
@@ -839,11 +1616,8 @@ public:
 	inline void setNotifyReadable(PhySocket *sock,bool notifyReadable)
 	{
 		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
-		if (notifyReadable) {
-			FD_SET(sws.sock,&_readfds);
-		} else {
-			FD_CLR(sws.sock,&_readfds);
-		}
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_setInterest(sws,notifyReadable,sws.wantWrite);
 	}
 
 	/**
@@ -857,199 +1631,22 @@ public:
 	 */
 	inline void poll(unsigned long timeout)
 	{
-		char buf[131072];
-		struct sockaddr_storage ss;
-		struct timeval tv;
-		fd_set rfds,wfds,efds;
-
-		memcpy(&rfds,&_readfds,sizeof(rfds));
-		memcpy(&wfds,&_writefds,sizeof(wfds));
-#if defined(_WIN32) || defined(_WIN64)
-		memcpy(&efds,&_exceptfds,sizeof(efds));
-#else
-		FD_ZERO(&efds);
-#endif
-
-		tv.tv_sec = (long)(timeout / 1000);
-		tv.tv_usec = (long)((timeout % 1000) * 1000);
-		if (::select((int)_nfds + 1,&rfds,&wfds,&efds,(timeout > 0) ? &tv : (struct timeval *)0) <= 0)
-			return;
-
-		if (FD_ISSET(_whackReceiveSocket,&rfds)) {
-			char tmp[16];
-#if defined(_WIN32) || defined(_WIN64)
-			::recv(_whackReceiveSocket,tmp,16,0);
-#else
-			::read(_whackReceiveSocket,tmp,16);
-#endif
-		}
-
-		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
-			switch (s->type) {
-
-				case ZT_PHY_SOCKET_TCP_OUT_PENDING:
-#if defined(_WIN32) || defined(_WIN64)
-					if (FD_ISSET(s->sock,&efds)) {
-						this->close((PhySocket *)&(*s),true);
-					} else // ... if
-#endif
-					if (FD_ISSET(s->sock,&wfds)) {
-						socklen_t slen = sizeof(ss);
-						if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-							FD_SET(s->sock,&_readfds);
-							FD_CLR(s->sock,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-							FD_CLR(s->sock,&_exceptfds);
-#endif
-							try {
-								_handler->phyOnTcpConnect((PhySocket *)&(*s),&(s->uptr),true);
-							} catch ( ... ) {}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
-				case ZT_PHY_SOCKET_TCP_IN: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if (FD_ISSET(sock,&rfds)) {
-						long n = (long)::recv(sock,buf,sizeof(buf),0);
-						if (n <= 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							try {
-								_handler->phyOnTcpData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
-							} catch ( ... ) {}
-						}
-					}
-					if ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds))) {
-						try {
-							_handler->phyOnTcpWritable((PhySocket *)&(*s),&(s->uptr));
-						} catch ( ... ) {}
-					}
-				}	break;
-
-				case ZT_PHY_SOCKET_TCP_LISTEN:
-					if (FD_ISSET(s->sock,&rfds)) {
-						memset(&ss,0,sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							} else {
-#if defined(_WIN32) || defined(_WIN64)
-								{ BOOL f = (_noDelay ? TRUE : FALSE); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
-								{ u_long iMode=1; ioctlsocket(newSock,FIONBIO,&iMode); }
-#else
-								{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
-								fcntl(newSock,F_SETFL,O_NONBLOCK);
-#endif
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl &sws = _socks.back();
-								FD_SET(newSock,&_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_TCP_IN;
-								sws.sock = newSock;
-								sws.uptr = (void *)0;
-								memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
-								try {
-									_handler->phyOnTcpAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
-								} catch ( ... ) {}
-							}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UDP:
-					if (FD_ISSET(s->sock,&rfds)) {
-						for(int k=0;k<1024;++k) {
-							memset(&ss,0,sizeof(ss));
-							socklen_t slen = sizeof(ss);
-							long n = (long)::recvfrom(s->sock,buf,sizeof(buf),0,(struct sockaddr *)&ss,&slen);
-							if (n > 0) {
-								try {
-									_handler->phyOnDatagram((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
-								} catch ( ... ) {}
-							} else if (n < 0)
-								break;
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UNIX_IN: {
-#ifdef __UNIX_LIKE__
-					ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds))) {
-						try {
-							_handler->phyOnUnixWritable((PhySocket *)&(*s),&(s->uptr),false);
-						} catch ( ... ) {}
-					}
-					if (FD_ISSET(sock,&rfds)) {
-						long n = (long)::read(sock,buf,sizeof(buf));
-						if (n <= 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							try {
-								_handler->phyOnUnixData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
-							} catch ( ... ) {}
-						}
-					}
-#endif // __UNIX_LIKE__
-				}	break;
-
-				case ZT_PHY_SOCKET_UNIX_LISTEN:
-#ifdef __UNIX_LIKE__
-					if (FD_ISSET(s->sock,&rfds)) {
-						memset(&ss,0,sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							} else {
-								fcntl(newSock,F_SETFL,O_NONBLOCK);
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl &sws = _socks.back();
-								FD_SET(newSock,&_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_UNIX_IN;
-								sws.sock = newSock;
-								sws.uptr = (void *)0;
-								memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
-								try {
-									//_handler->phyOnUnixAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
-								} catch ( ... ) {}
-							}
-						}
-					}
-#endif // __UNIX_LIKE__
-					break;
-
-				case ZT_PHY_SOCKET_FD: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock;
-					const bool readable = ((FD_ISSET(sock,&rfds))&&(FD_ISSET(sock,&_readfds)));
-					const bool writable = ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds)));
-					if ((readable)||(writable)) {
-						try {
-							//_handler->phyOnFileDescriptorActivity((PhySocket *)&(*s),&(s->uptr),readable,writable);
-						} catch ( ... ) {}
-					}
-				}	break;
-
-				default:
-					break;
-
+		if (_busyPoll) {
+			const unsigned long spin = ((timeout > 0)&&(timeout < ((_busyPoll + 999) / 1000))) ? (timeout * 1000) : _busyPoll;
+			const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+			const std::chrono::steady_clock::time_point until(start + std::chrono::microseconds(spin));
+			do {
+				if (_wait(0))
+					return;
+			} while (std::chrono::steady_clock::now() < until);
+			if (timeout > 0) {
+				const unsigned long spun = (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+				if (spun >= timeout)
+					return;
+				timeout -= spun;
 			}
-
-			if (s->type == ZT_PHY_SOCKET_CLOSED)
-				_socks.erase(s++);
-			else ++s;
 		}
+		_wait((timeout > 0) ? (long)timeout : -1);
 	}
 
 	/**
@@ -1064,13 +1661,27 @@ public:
 		if (sws.type == ZT_PHY_SOCKET_CLOSED)
 			return;
 
-		FD_CLR(sws.sock,&_readfds);
-		FD_CLR(sws.sock,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-		FD_CLR(sws.sock,&_exceptfds);
+		_unwatch(sws);
+
+#ifdef ZT_PHY_HAVE_IO_URING
+		if (sws.uringArmed) {
+			// The receive holds its own reference to the socket, so it has to be canceled
+			struct io_uring_sqe *const e = _uringRx->sqe();
+			if (e) {
+				e->opcode = IORING_OP_ASYNC_CANCEL;
+				e->addr = (uint64_t)((uintptr_t)&sws);
+				e->user_data = 0;
+				_uringRx->submit();
+			}
+		}
+#endif
+
+#ifdef ZT_PHY_HAVE_XDP
+		if ((sws.type == ZT_PHY_SOCKET_UDP)&&(_xdp))
+			_xdp->removePort(_port(sws.saddr));
 #endif
 
-		if (sws.type != ZT_PHY_SOCKET_FD)
+		if ((sws.type != ZT_PHY_SOCKET_FD)&&(sws.type != ZT_PHY_SOCKET_XDP))
 			ZT_PHY_CLOSE_SOCKET(sws.sock);
 
 #ifdef __UNIX_LIKE__
@@ -1106,6 +1717,7 @@ public:
 		// Causes entry to be deleted from list in poll(), ignored elsewhere
 		sws.type = ZT_PHY_SOCKET_CLOSED;
 
+#ifdef ZT_PHY_USE_SELECT
 		if ((long)sws.sock >= (long)_nfds) {
 			long nfds = (long)_whackSendSocket;
 			if ((long)_whackReceiveSocket > nfds)
@@ -1116,6 +1728,1014 @@ public:
 			}
 			_nfds = nfds;
 		}
+#else
+		++_closed;
+#endif
+	}
+
+private:
+	// Sets which of readable and writable the socket is watched for
+	inline void _setInterest(PhySocketImpl &sws,const bool r,const bool w)
+	{
+#ifdef ZT_PHY_USE_SELECT
+		if (r)
+			FD_SET(sws.sock,&_readfds);
+		else FD_CLR(sws.sock,&_readfds);
+		if (w)
+			FD_SET(sws.sock,&_writefds);
+		else FD_CLR(sws.sock,&_writefds);
+#if defined(_WIN32) || defined(_WIN64)
+		if (sws.type == ZT_PHY_SOCKET_TCP_OUT_PENDING) // Windows reports a failed connect as an exception
+			FD_SET(sws.sock,&_exceptfds);
+		else FD_CLR(sws.sock,&_exceptfds);
+#endif
+		if ((long)sws.sock > _nfds)
+			_nfds = (long)sws.sock;
+#elif defined(ZT_PHY_USE_EPOLL)
+		if ((sws.wantRead != r)||(sws.wantWrite != w)) {
+			// Sockets watched for nothing are taken out entirely so errors and hangups aren't reported either, as with select()
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = ((r) ? EPOLLIN : 0) | ((w) ? EPOLLOUT : 0);
+			ev.data.ptr = (void *)&sws;
+			::epoll_ctl(_pollfd,((r)||(w)) ? (((sws.wantRead)||(sws.wantWrite)) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) : EPOLL_CTL_DEL,sws.sock,&ev);
+		}
+#else
+		struct kevent ch[2];
+		int n = 0;
+		if (sws.wantRead != r) {
+			EV_SET(&(ch[n]),sws.sock,EVFILT_READ,(r) ? EV_ADD : EV_DELETE,0,0,(void *)&sws);
+			++n;
+		}
+		if (sws.wantWrite != w) {
+			EV_SET(&(ch[n]),sws.sock,EVFILT_WRITE,(w) ? EV_ADD : EV_DELETE,0,0,(void *)&sws);
+			++n;
+		}
+		if (n > 0)
+			::kevent(_pollfd,ch,n,(struct kevent *)0,0,(const struct timespec *)0);
+#endif
+		sws.wantRead = r;
+		sws.wantWrite = w;
+	}
+
+	inline void _unwatch(PhySocketImpl &sws)
+	{
+#ifdef ZT_PHY_USE_SELECT
+		FD_CLR(sws.sock,&_readfds);
+		FD_CLR(sws.sock,&_writefds);
+#if defined(_WIN32) || defined(_WIN64)
+		FD_CLR(sws.sock,&_exceptfds);
+#endif
+		sws.wantRead = false;
+		sws.wantWrite = false;
+#else
+		_setInterest(sws,false,false);
+#endif
+	}
+
+	// Sends a batch through this socket itself (sendmmsg(), io_uring, or sendto())
+	inline unsigned int _udpSendBatch(PhySocket *sock,const PhyDatagram *datagrams,unsigned int count)
+	{
+#ifdef ZT_PHY_HAVE_MMSG
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		unsigned int i = 0,sent = 0;
+#ifdef ZT_PHY_HAVE_IO_URING
+		if (_uringTx) {
+			i = sent = _uringSend(sws,datagrams,count); // the rest go below if send slots run out
+			if (i == count)
+				return sent;
+		}
+#endif
+		struct mmsghdr msgs[ZT_PHY_UDP_BATCH_SIZE];
+		unsigned int segments[ZT_PHY_UDP_BATCH_SIZE]; // datagrams in each message
+		struct iovec iov[ZT_PHY_UDP_BATCH_SIZE * 4];
+		union { char buf[ZT_PHY_UDP_CONTROL_SIZE]; size_t align; } control[ZT_PHY_UDP_BATCH_SIZE];
+		while (i < count) {
+			unsigned int m = 0,j = i,v = 0;
+			memset(msgs,0,sizeof(msgs));
+			while ((m < ZT_PHY_UDP_BATCH_SIZE)&&(j < count)&&(v < (ZT_PHY_UDP_BATCH_SIZE * 4))) {
+				const PhyDatagram &d = datagrams[j];
+				const unsigned int maxSegs = ((ZT_PHY_UDP_BATCH_SIZE * 4) - v);
+				const unsigned int segs = _udpRun(datagrams + j,count - j,sws.udpGso,(maxSegs < ZT_PHY_UDP_GSO_MAX_SEGMENTS) ? maxSegs : ZT_PHY_UDP_GSO_MAX_SEGMENTS);
+				for(unsigned int k=0;k<segs;++k) {
+					iov[v + k].iov_base = const_cast<void *>(datagrams[j + k].data);
+					iov[v + k].iov_len = (size_t)datagrams[j + k].len;
+				}
+				msgs[m].msg_hdr.msg_name = const_cast<struct sockaddr *>(d.address);
+				msgs[m].msg_hdr.msg_namelen = (d.address->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+				msgs[m].msg_hdr.msg_iov = &(iov[v]);
+				msgs[m].msg_hdr.msg_iovlen = segs;
+				_udpControl(msgs[m].msg_hdr,control[m].buf,(segs > 1) ? (uint16_t)d.len : 0,d.tos);
+				segments[m++] = segs;
+				j += segs;
+				v += segs;
+			}
+			const int r = ::sendmmsg(sws.sock,msgs,m,0);
+			if (r > 0) {
+				for(int k=0;k<r;++k) {
+					i += segments[k];
+					sent += segments[k];
+				}
+			} else if (segments[0] > 1) {
+				// Segmentation can still fail on some routes or devices, so send these
+				// one by one and stop trying GSO on this socket if it's unsupported.
+				if (errno == EIO)
+					sws.udpGso = false;
+				for(unsigned int k=0;k<segments[0];++k) {
+					if (udpSend(sock,datagrams[i].address,datagrams[i].data,datagrams[i].len,datagrams[i].tos))
+						++sent;
+					++i;
+				}
+			} else ++i; // sendmmsg() stops at the first failed datagram, so skip it
+		}
+		return sent;
+#else
+		unsigned int i = 0,sent = 0;
+#ifdef ZT_PHY_HAVE_RIO
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		if (sws.rio) {
+			i = sent = _rioSend(sws,datagrams,count); // the rest go below if send slots run out
+			if (i == count)
+				return sent;
+		}
+#endif
+		for(;i<count;++i) {
+			if (udpSend(sock,datagrams[i].address,datagrams[i].data,datagrams[i].len,datagrams[i].tos))
+				++sent;
+		}
+		return sent;
+#endif
+	}
+
+	// Sets or clears don't fragment on a UDP socket, returning false if it can't be set
+	static inline bool _setDontFragment(const ZT_PHY_SOCKFD_TYPE s,const bool v6,const bool df)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		DWORD f = (df) ? 1 : 0;
+		if (v6)
+			return (::setsockopt(s,IPPROTO_IPV6,IPV6_DONTFRAG,(const char *)&f,sizeof(f)) == 0);
+		return (::setsockopt(s,IPPROTO_IP,IP_DONTFRAGMENT,(const char *)&f,sizeof(f)) == 0);
+#else
+		int f;
+		if (v6) {
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+			f = (df) ? IPV6_PMTUDISC_PROBE : 0;
+			return (::setsockopt(s,IPPROTO_IPV6,IPV6_MTU_DISCOVER,&f,sizeof(f)) == 0);
+#elif defined(IPV6_DONTFRAG)
+			f = (df) ? 1 : 0;
+			return (::setsockopt(s,IPPROTO_IPV6,IPV6_DONTFRAG,&f,sizeof(f)) == 0);
+#else
+			return (!df);
+#endif
+		}
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+		f = (df) ? IP_PMTUDISC_PROBE : 0;
+		return (::setsockopt(s,IPPROTO_IP,IP_MTU_DISCOVER,&f,sizeof(f)) == 0);
+#elif defined(IP_DONTFRAG)
+		f = (df) ? 1 : 0;
+		return (::setsockopt(s,IPPROTO_IP,IP_DONTFRAG,&f,sizeof(f)) == 0);
+#else
+		return (!df);
+#endif
+#endif
+	}
+
+#ifdef ZT_PHY_HAVE_MMSG
+	// Number of datagrams from the start of d that can go out as one UDP_SEGMENT send
+	static inline unsigned int _udpRun(const PhyDatagram *d,const unsigned int count,const bool gso,const unsigned int maxSegments)
+	{
+		unsigned int segs = 1;
+		if (gso) {
+			const socklen_t alen = (d[0].address->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+			unsigned long total = d[0].len;
+			while ((segs < count)&&(segs < maxSegments)) {
+				const PhyDatagram &nd = d[segs];
+				if ((nd.len > d[0].len)||(d[segs - 1].len != d[0].len)||((total + nd.len) > ZT_PHY_UDP_GSO_MAX_BYTES)||(nd.tos != d[0].tos)||(nd.address->sa_family != d[0].address->sa_family)||(memcmp(nd.address,d[0].address,alen) != 0))
+					break;
+				total += nd.len;
+				++segs;
+			}
+		}
+		return segs;
+	}
+
+	// Adds a UDP_SEGMENT size if not 0 and a traffic class if not 0 to a message, using ZT_PHY_UDP_CONTROL_SIZE bytes of control
+	static inline void _udpControl(struct msghdr &msg,char *const control,const uint16_t segmentSize,const unsigned int tos)
+	{
+		if ((!segmentSize)&&(!tos))
+			return;
+		memset(control,0,ZT_PHY_UDP_CONTROL_SIZE);
+		msg.msg_control = control;
+		msg.msg_controllen = ZT_PHY_UDP_CONTROL_SIZE;
+		struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		size_t used = 0;
+		if (segmentSize) {
+			c->cmsg_level = SOL_UDP;
+			c->cmsg_type = UDP_SEGMENT;
+			c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			memcpy(CMSG_DATA(c),&segmentSize,sizeof(segmentSize));
+			used += CMSG_SPACE(sizeof(uint16_t));
+			c = CMSG_NXTHDR(&msg,c);
+		}
+		if (tos) {
+			const int tc = (int)(tos & 0xff);
+			if (reinterpret_cast<const struct sockaddr *>(msg.msg_name)->sa_family == AF_INET6) {
+				c->cmsg_level = IPPROTO_IPV6;
+				c->cmsg_type = IPV6_TCLASS;
+			} else {
+				c->cmsg_level = IPPROTO_IP;
+				c->cmsg_type = IP_TOS;
+			}
+			c->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(c),&tc,sizeof(tc));
+			used += CMSG_SPACE(sizeof(int));
+		}
+		msg.msg_controllen = used;
+	}
+
+	// Counts drops reported with a received message and grows the socket's buffers if there were any
+	inline void _udpDropped(PhySocketImpl &sws,struct msghdr &msg)
+	{
+		for(struct cmsghdr *c=CMSG_FIRSTHDR(&msg);(c);c=CMSG_NXTHDR(&msg,c)) {
+			if ((c->cmsg_level == SOL_SOCKET)&&(c->cmsg_type == SO_RXQ_OVFL)) {
+				uint32_t mark = 0;
+				memcpy(&mark,CMSG_DATA(c),sizeof(mark));
+				const uint32_t dropped = mark - sws.udpDropMark;
+				if ((dropped)&&(dropped < 0x80000000U)) { // ignore counts older than one already seen
+					sws.udpDropMark = mark;
+					sws.udpDrops += dropped;
+					if (sws.udpBuf < sws.udpBufMax) {
+						int bs = (sws.udpBuf >= 65536) ? sws.udpBuf * 2 : 262144;
+						if ((bs > sws.udpBufMax)||(bs < sws.udpBuf))
+							bs = sws.udpBufMax;
+						for(int k=0;k<2;++k) {
+#ifdef SO_RCVBUFFORCE
+							if (::setsockopt(sws.sock,SOL_SOCKET,(k) ? SO_SNDBUFFORCE : SO_RCVBUFFORCE,(void *)&bs,sizeof(bs)) == 0)
+								continue;
+#endif
+							::setsockopt(sws.sock,SOL_SOCKET,(k) ? SO_SNDBUF : SO_RCVBUF,(void *)&bs,sizeof(bs));
+						}
+						sws.udpBuf = bs;
+					}
+				}
+				return;
+			}
+		}
+	}
+
+	// Gets the traffic class reported with a received message, or 0 if none
+	static inline unsigned int _udpTrafficClass(struct msghdr &msg)
+	{
+		for(struct cmsghdr *c=CMSG_FIRSTHDR(&msg);(c);c=CMSG_NXTHDR(&msg,c)) {
+			if (((c->cmsg_level == IPPROTO_IP)&&(c->cmsg_type == IP_TOS))||((c->cmsg_level == IPPROTO_IPV6)&&(c->cmsg_type == IPV6_TCLASS))) {
+				if (c->cmsg_len >= CMSG_LEN(sizeof(int))) {
+					int tc = 0;
+					memcpy(&tc,CMSG_DATA(c),sizeof(tc));
+					return (unsigned int)tc & 0xff;
+				}
+				return (unsigned int)*reinterpret_cast<const uint8_t *>(CMSG_DATA(c)); // IP_TOS is one byte on Linux
+			}
+		}
+		return 0;
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_RIO
+	static inline unsigned long _rioMemSize() { return ((ZT_PHY_RIO_RECEIVES + ZT_PHY_RIO_SENDS) * (ZT_PHY_RIO_BUFFER_SIZE + sizeof(SOCKADDR_INET))); }
+	static inline unsigned long _rioAddressOffset(const unsigned int slot) { return ((ZT_PHY_RIO_RECEIVES + ZT_PHY_RIO_SENDS) * ZT_PHY_RIO_BUFFER_SIZE) + (slot * sizeof(SOCKADDR_INET)); }
+
+	// Posts a receive into a slot (_rioLock must be held)
+	inline bool _rioPostReceive(_RioSocket &r,const unsigned int slot,const DWORD flags)
+	{
+		RIO_BUF d,a;
+		d.BufferId = r.buf;
+		d.Offset = slot * ZT_PHY_RIO_BUFFER_SIZE;
+		d.Length = ZT_PHY_RIO_BUFFER_SIZE;
+		a.BufferId = r.buf;
+		a.Offset = _rioAddressOffset(slot);
+		a.Length = sizeof(SOCKADDR_INET);
+		return _rio->receive(r.rq,&d,&a,flags,(void *)((uintptr_t)slot));
+	}
+
+	// Gives a bound UDP socket a request queue and registered buffer and posts its receives
+	inline _RioSocket *_rioAttach(PhySocketImpl &sws)
+	{
+		if (_rioSockets >= (ZT_PHY_RIO_CQ_SIZE / ZT_PHY_RIO_RECEIVES))
+			return (_RioSocket *)0;
+		char *const mem = (char *)VirtualAlloc(NULL,_rioMemSize(),MEM_COMMIT|MEM_RESERVE,PAGE_READWRITE);
+		if (!mem)
+			return (_RioSocket *)0;
+		_RioSocket *const r = new _RioSocket();
+		r->mem = mem;
+		r->rxPosted = 0;
+		for(unsigned int k=0;k<ZT_PHY_RIO_SENDS;++k)
+			r->txFree[k] = k;
+		r->txFreeCount = ZT_PHY_RIO_SENDS;
+
+		std::lock_guard<std::mutex> l(_rioLock);
+		r->buf = _rio->registerBuffer(mem,_rioMemSize());
+		if (r->buf != RIO_INVALID_BUFFERID) {
+			r->rq = _rio->createRequestQueue(sws.sock,ZT_PHY_RIO_RECEIVES,ZT_PHY_RIO_SENDS,(void *)&sws);
+			if (r->rq != RIO_INVALID_RQ) {
+				for(unsigned int k=0;k<ZT_PHY_RIO_RECEIVES;++k) {
+					if (_rioPostReceive(*r,k,((k + 1) < ZT_PHY_RIO_RECEIVES) ? RIO_MSG_DEFER : 0))
+						++r->rxPosted;
+				}
+				if (r->rxPosted) { // receives complete to this socket now, even if fewer than all could be posted
+					++_rioSockets;
+					return r;
+				}
+			}
+			_rio->deregisterBuffer(r->buf);
+		}
+		VirtualFree(mem,0,MEM_RELEASE);
+		delete r;
+		return (_RioSocket *)0;
+	}
+
+	// Frees a closed socket's RIO state once nothing is outstanding on it
+	inline bool _rioFree(PhySocketImpl &sws)
+	{
+		std::lock_guard<std::mutex> l(_rioLock);
+		_rioReapSends();
+		_RioSocket *const r = sws.rio;
+		if ((r->rxPosted)||(r->txFreeCount < ZT_PHY_RIO_SENDS))
+			return false;
+		_rio->deregisterBuffer(r->buf);
+		VirtualFree(r->mem,0,MEM_RELEASE);
+		delete r;
+		sws.rio = (_RioSocket *)0;
+		--_rioSockets;
+		return true;
+	}
+
+	// Returns the send slots of completed sends (_rioLock must be held)
+	inline void _rioReapSends()
+	{
+		RIORESULT res[ZT_PHY_UDP_BATCH_SIZE];
+		unsigned long n;
+		while ((n = _rio->sendResults(res,ZT_PHY_UDP_BATCH_SIZE)) > 0) {
+			for(unsigned long i=0;i<n;++i) {
+				_RioSocket &r = *(reinterpret_cast<PhySocketImpl *>((uintptr_t)res[i].SocketContext)->rio);
+				r.txFree[r.txFreeCount++] = (unsigned int)res[i].RequestContext;
+			}
+		}
+	}
+
+	// Copies datagrams into free send slots and submits them with one commit, returning how many were queued
+	inline unsigned int _rioSend(PhySocketImpl &sws,const PhyDatagram *datagrams,const unsigned int count)
+	{
+		if (sws.type != ZT_PHY_SOCKET_UDP)
+			return 0;
+		_RioSocket &r = *(sws.rio);
+		std::lock_guard<std::mutex> l(_rioLock);
+		_rioReapSends();
+		unsigned int i = 0;
+		for(;(i<count)&&(r.txFreeCount);++i) {
+			const PhyDatagram &d = datagrams[i];
+			if (d.len > ZT_PHY_RIO_BUFFER_SIZE)
+				break;
+			const unsigned int k = r.txFree[--r.txFreeCount];
+			const unsigned int slot = ZT_PHY_RIO_RECEIVES + k;
+			memcpy(r.mem + (slot * ZT_PHY_RIO_BUFFER_SIZE),d.data,d.len);
+			char *const to = r.mem + _rioAddressOffset(slot);
+			memset(to,0,sizeof(SOCKADDR_INET));
+			memcpy(to,d.address,(d.address->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+			RIO_BUF db,ab;
+			db.BufferId = r.buf;
+			db.Offset = slot * ZT_PHY_RIO_BUFFER_SIZE;
+			db.Length = (ULONG)d.len;
+			ab.BufferId = r.buf;
+			ab.Offset = _rioAddressOffset(slot);
+			ab.Length = sizeof(SOCKADDR_INET);
+			if (!_rio->send(r.rq,&db,&ab,RIO_MSG_DEFER,(void *)((uintptr_t)k))) {
+				r.txFree[r.txFreeCount++] = k;
+				break;
+			}
+		}
+		if (i)
+			_rio->send(r.rq,(RIO_BUF *)0,(RIO_BUF *)0,RIO_MSG_COMMIT_ONLY,(void *)0);
+		return i;
+	}
+
+	// Delivers completed receives in per-socket runs and posts their slots again once handlers are done with them
+	inline void _rioReceive()
+	{
+		RIORESULT res[ZT_PHY_UDP_BATCH_SIZE];
+		PhyDatagram datagrams[ZT_PHY_UDP_BATCH_SIZE];
+		struct sockaddr_storage from[ZT_PHY_UDP_BATCH_SIZE];
+		for(int k=0;k<(1024 / ZT_PHY_UDP_BATCH_SIZE);++k) {
+			unsigned long n;
+			{
+				std::lock_guard<std::mutex> l(_rioLock);
+				n = _rio->receiveResults(res,ZT_PHY_UDP_BATCH_SIZE);
+			}
+			if (!n)
+				break;
+
+			PhySocketImpl *batchSock = (PhySocketImpl *)0;
+			unsigned int count = 0;
+			for(unsigned long i=0;i<=n;++i) {
+				PhySocketImpl *const s = (i < n) ? reinterpret_cast<PhySocketImpl *>((uintptr_t)res[i].SocketContext) : (PhySocketImpl *)0;
+				if ((count)&&(s != batchSock)) {
+					try {
+						if (batchSock->type == ZT_PHY_SOCKET_UDP) // could have been closed by a handler
+							_handler->phyOnDatagrams((PhySocket *)batchSock,&(batchSock->uptr),(const struct sockaddr *)&(batchSock->saddr),datagrams,count);
+					} catch ( ... ) {}
+					count = 0;
+				}
+				// Failed receives (e.g. ICMP port unreachable reported as WSAECONNRESET) are just posted again
+				if ((s)&&(s->type == ZT_PHY_SOCKET_UDP)&&(res[i].Status == 0)&&(res[i].BytesTransferred > 0)) {
+					const unsigned int slot = (unsigned int)res[i].RequestContext;
+					const SOCKADDR_INET *const a = reinterpret_cast<const SOCKADDR_INET *>(s->rio->mem + _rioAddressOffset(slot));
+					memset(&(from[count]),0,sizeof(struct sockaddr_storage));
+					memcpy(&(from[count]),a,(a->si_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+					PhyDatagram &d = datagrams[count++];
+					d.address = (const struct sockaddr *)&(from[count - 1]);
+					d.data = s->rio->mem + (slot * ZT_PHY_RIO_BUFFER_SIZE);
+					d.len = res[i].BytesTransferred;
+					d.tos = 0;
+				}
+				batchSock = s;
+			}
+
+			std::lock_guard<std::mutex> l(_rioLock);
+			for(unsigned long i=0;i<n;++i) {
+				PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>((uintptr_t)res[i].SocketContext);
+				_RioSocket &r = *(s->rio);
+				--r.rxPosted;
+				if ((s->type == ZT_PHY_SOCKET_UDP)&&(_rioPostReceive(r,(unsigned int)res[i].RequestContext,0)))
+					++r.rxPosted;
+			}
+			if (n < ZT_PHY_UDP_BATCH_SIZE)
+				break;
+		}
+		std::lock_guard<std::mutex> l(_rioLock);
+		_rioReapSends();
+		_rio->notify();
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_XDP
+	static inline unsigned int _port(const struct sockaddr_storage &sa) { return (unsigned int)ntohs(reinterpret_cast<const struct sockaddr_in *>(&sa)->sin_port); } // same offset in sockaddr_in6
+
+	inline bool _xdpSend(PhySocketImpl &sws,const struct sockaddr *to,const void *data,const unsigned long len)
+	{
+		return ((sws.type == ZT_PHY_SOCKET_UDP)&&(len <= 0xffff)&&(_xdp->send((const struct sockaddr *)&(sws.saddr),to,(to->sa_family == AF_INET6) ? 64 : sws.udpTtl,data,(unsigned int)len)));
+	}
+
+	// Finds the UDP socket a datagram taken by XDP was sent to
+	inline PhySocketImpl *_xdpSocket(const struct sockaddr_storage &to)
+	{
+		PhySocketImpl *wildcard = (PhySocketImpl *)0;
+		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();++s) {
+			if ((s->type != ZT_PHY_SOCKET_UDP)||(s->saddr.ss_family != to.ss_family)||(_port(s->saddr) != _port(to)))
+				continue;
+			if (to.ss_family == AF_INET6) {
+				const struct in6_addr &a = reinterpret_cast<const struct sockaddr_in6 *>(&(s->saddr))->sin6_addr;
+				if (memcmp(&a,&(reinterpret_cast<const struct sockaddr_in6 *>(&to)->sin6_addr),16) == 0)
+					return &(*s);
+				if (IN6_IS_ADDR_UNSPECIFIED(&a))
+					wildcard = &(*s);
+			} else {
+				const uint32_t a = reinterpret_cast<const struct sockaddr_in *>(&(s->saddr))->sin_addr.s_addr;
+				if (a == reinterpret_cast<const struct sockaddr_in *>(&to)->sin_addr.s_addr)
+					return &(*s);
+				if (!a)
+					wildcard = &(*s);
+			}
+		}
+		return wildcard;
+	}
+
+	// Delivers datagrams from an XDP socket's queue in place, in per-socket runs
+	inline void _xdpReceive(PhySocketImpl &xs)
+	{
+		LinuxXdp::Datagram xd[ZT_XDP_RX_BATCH];
+		PhyDatagram datagrams[ZT_XDP_RX_BATCH];
+		for(int k=0;k<(1024 / ZT_XDP_RX_BATCH);++k) {
+			const unsigned int n = _xdp->receive(xs.xdpQueue,xd,ZT_XDP_RX_BATCH);
+			PhySocketImpl *batchSock = (PhySocketImpl *)0;
+			const struct sockaddr_storage *batchTo = (const struct sockaddr_storage *)0;
+			unsigned int count = 0;
+			for(unsigned int i=0;i<=n;++i) {
+				PhySocketImpl *s = batchSock;
+				if ((i < n)&&((!batchTo)||(memcmp(batchTo,&(xd[i].to),sizeof(struct sockaddr_storage)) != 0))) {
+					s = _xdpSocket(xd[i].to);
+					batchTo = &(xd[i].to);
+				}
+				if ((count)&&((i == n)||(s != batchSock))) {
+					try {
+						if (batchSock->type == ZT_PHY_SOCKET_UDP) // could have been closed by a handler
+							_handler->phyOnDatagrams((PhySocket *)batchSock,&(batchSock->uptr),(const struct sockaddr *)&(batchSock->saddr),datagrams,count);
+					} catch ( ... ) {}
+					count = 0;
+				}
+				if ((i < n)&&(s)) { // datagrams to a port no socket is left on are dropped
+					PhyDatagram &d = datagrams[count++];
+					d.address = (const struct sockaddr *)&(xd[i].from);
+					d.data = xd[i].data;
+					d.len = xd[i].len;
+					d.tos = 0;
+				}
+				batchSock = s;
+			}
+			_xdp->release(xs.xdpQueue);
+			if (n < ZT_XDP_RX_BATCH) // anything left is reported again, since epoll is level triggered
+				break;
+		}
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_IO_URING
+	// Starts a multishot receive on a UDP socket
+	inline bool _uringArm(PhySocketImpl &sws)
+	{
+		struct io_uring_sqe *const e = _uringRx->sqe();
+		if (!e)
+			return false;
+		memset(&(sws.uringMsg),0,sizeof(struct msghdr));
+		sws.uringMsg.msg_namelen = sizeof(struct sockaddr_storage);
+		sws.uringMsg.msg_controllen = CMSG_SPACE(sizeof(int)) * 2; // traffic class and drop count, if setUdpTrafficClass() and setUdpBufferCeiling() are on
+		e->opcode = IORING_OP_RECVMSG;
+		e->fd = sws.sock;
+		e->addr = (uint64_t)((uintptr_t)&(sws.uringMsg));
+		e->len = 1;
+		e->ioprio = IORING_RECV_MULTISHOT;
+		e->flags = IOSQE_BUFFER_SELECT;
+		e->buf_group = ZT_PHY_IO_URING_BGID;
+		e->user_data = (uint64_t)((uintptr_t)&sws);
+		if (_uringRx->submit() < 0)
+			return false;
+		sws.uringArmed = true;
+		return true;
+	}
+
+	// Finds the datagram in a receive buffer, laid out as io_uring_recvmsg_out, address, control, payload
+	inline bool _uringDatagram(PhySocketImpl &sws,const unsigned int bid,const unsigned int len,PhyDatagram &d)
+	{
+		char *const b = _uringRx->buffer(bid);
+		const unsigned long hdr = sizeof(struct io_uring_recvmsg_out) + sws.uringMsg.msg_namelen + sws.uringMsg.msg_controllen;
+		if (len < hdr)
+			return false;
+		const struct io_uring_recvmsg_out *const out = reinterpret_cast<const struct io_uring_recvmsg_out *>(b);
+		if (((out->flags & MSG_TRUNC) != 0)||(out->payloadlen == 0)||(out->payloadlen > (len - hdr)))
+			return false;
+		char *const from = b + sizeof(struct io_uring_recvmsg_out);
+		if (out->namelen < sizeof(struct sockaddr_storage)) // handlers may copy the whole sockaddr_storage
+			memset(from + out->namelen,0,sizeof(struct sockaddr_storage) - out->namelen);
+		d.address = reinterpret_cast<const struct sockaddr *>(from);
+		d.data = b + hdr;
+		d.len = out->payloadlen;
+		d.tos = 0;
+		if (out->controllen) {
+			struct msghdr m;
+			memset(&m,0,sizeof(m));
+			m.msg_control = from + sws.uringMsg.msg_namelen;
+			m.msg_controllen = out->controllen;
+			d.tos = _udpTrafficClass(m);
+			_udpDropped(sws,m);
+		}
+		return true;
+	}
+
+	inline void _uringDeliver(PhySocketImpl *s,const PhyDatagram *datagrams,const unsigned int *bids,unsigned int &count)
+	{
+		if (s->type == ZT_PHY_SOCKET_UDP) {
+			try {
+				_handler->phyOnDatagrams((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),datagrams,count);
+			} catch ( ... ) {}
+		}
+		for(unsigned int k=0;k<count;++k)
+			_uringRx->recycleBuffer(bids[k]);
+		count = 0;
+	}
+
+	// Delivers datagrams received through io_uring and restarts receives that ended
+	inline void _uringReceive()
+	{
+		PhyDatagram datagrams[ZT_PHY_UDP_BATCH_SIZE];
+		unsigned int bids[ZT_PHY_UDP_BATCH_SIZE];
+		PhySocketImpl *batchSock = (PhySocketImpl *)0;
+		unsigned int count = 0;
+		struct io_uring_cqe c;
+		for(unsigned int k=0;(k<1024)&&(_uringRx->cqe(c));++k) {
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>((uintptr_t)c.user_data);
+			if (!s)
+				continue; // cancel completed
+			if ((c.res >= 0)&&((c.flags & IORING_CQE_F_BUFFER) != 0)) {
+				const unsigned int bid = c.flags >> IORING_CQE_BUFFER_SHIFT;
+				if ((count)&&((s != batchSock)||(count == ZT_PHY_UDP_BATCH_SIZE)))
+					_uringDeliver(batchSock,datagrams,bids,count);
+				if ((s->type == ZT_PHY_SOCKET_UDP)&&(_uringDatagram(*s,bid,(unsigned int)c.res,datagrams[count]))) {
+					bids[count++] = bid;
+					batchSock = s;
+				} else _uringRx->recycleBuffer(bid);
+			}
+			if ((c.flags & IORING_CQE_F_MORE) == 0) {
+				// Running out of buffers ends a multishot receive, so hand back what we hold before restarting it
+				if (count)
+					_uringDeliver(batchSock,datagrams,bids,count);
+				s->uringArmed = false;
+				if (s->type == ZT_PHY_SOCKET_UDP) {
+					if (((c.res < 0)&&(c.res != -ENOBUFS))||(!_uringArm(*s))) {
+						s->uring = false; // other errors or failing to restart put this socket back on epoll
+						_setInterest(*s,true,false);
+					}
+				}
+			}
+		}
+		if (count)
+			_uringDeliver(batchSock,datagrams,bids,count);
+	}
+
+	// Queues sends on io_uring and returns how many datagrams were taken
+	inline unsigned int _uringSend(PhySocketImpl &sws,const PhyDatagram *datagrams,const unsigned int count)
+	{
+		std::lock_guard<std::mutex> l(_uringTxLock);
+		struct io_uring_cqe c;
+		while (_uringTx->cqe(c)) {
+			const unsigned int slot = (unsigned int)c.user_data;
+			if ((c.res == -EIO)&&(_uringTxSlots[slot].gso))
+				_uringTxGso = false; // see udpSendBatch()
+			_uringTxFree[_uringTxFreeCount++] = slot;
+		}
+		unsigned int i = 0;
+		while ((i < count)&&(_uringTxFreeCount)) {
+			struct io_uring_sqe *const e = _uringTx->sqe();
+			if (!e)
+				break;
+			const PhyDatagram &d = datagrams[i];
+			const unsigned int segs = _udpRun(datagrams + i,count - i,(sws.udpGso)&&(_uringTxGso),ZT_PHY_UDP_GSO_MAX_SEGMENTS);
+			const unsigned int slot = _uringTxFree[--_uringTxFreeCount];
+			_UringTxSlot &t = _uringTxSlots[slot];
+			unsigned long len = 0;
+			for(unsigned int k=0;k<segs;++k) {
+				memcpy(t.data + len,datagrams[i + k].data,datagrams[i + k].len);
+				len += datagrams[i + k].len;
+			}
+			memset(&(t.msg),0,sizeof(struct msghdr));
+			t.msg.msg_namelen = (d.address->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+			memcpy(&(t.to),d.address,t.msg.msg_namelen);
+			t.msg.msg_name = &(t.to);
+			t.iov.iov_base = t.data;
+			t.iov.iov_len = (size_t)len;
+			t.msg.msg_iov = &(t.iov);
+			t.msg.msg_iovlen = 1;
+			t.gso = (segs > 1);
+			_udpControl(t.msg,t.control.buf,(t.gso) ? (uint16_t)d.len : 0,d.tos);
+			e->opcode = IORING_OP_SENDMSG;
+			e->fd = sws.sock;
+			e->addr = (uint64_t)((uintptr_t)&(t.msg));
+			e->len = 1;
+			e->user_data = (uint64_t)slot;
+			i += segs;
+		}
+		if (i)
+			_uringTx->submit();
+		return i;
+	}
+#endif
+
+	// Wait up to timeout ms (forever if negative, not at all if 0) and handle what's ready, returning true if anything was
+	inline bool _wait(const long timeout)
+	{
+		char buf[ZT_PHY_RECV_BUFFER_SIZE];
+		struct sockaddr_storage ss;
+
+#ifdef ZT_PHY_USE_SELECT
+		struct timeval tv;
+		fd_set rfds,wfds,efds;
+
+		memcpy(&rfds,&_readfds,sizeof(rfds));
+		memcpy(&wfds,&_writefds,sizeof(wfds));
+#if defined(_WIN32) || defined(_WIN64)
+		memcpy(&efds,&_exceptfds,sizeof(efds));
+#else
+		FD_ZERO(&efds);
+#endif
+
+		tv.tv_sec = (timeout > 0) ? (long)(timeout / 1000) : 0;
+		tv.tv_usec = (timeout > 0) ? (long)((timeout % 1000) * 1000) : 0;
+		const int sn = ::select((int)_nfds + 1,&rfds,&wfds,&efds,(timeout >= 0) ? &tv : (struct timeval *)0);
+#ifdef ZT_PHY_HAVE_RIO
+		if (_rio) // receives can complete without anything in select()'s sets becoming ready
+			_rioReceive();
+#endif
+		if (sn <= 0)
+			return false;
+
+		if (FD_ISSET(_whackReceiveSocket,&rfds))
+			_drainWhack();
+
+		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
+			if (s->type != ZT_PHY_SOCKET_CLOSED) {
+				const ZT_PHY_SOCKFD_TYPE sock = s->sock;
+				_process(&(*s),FD_ISSET(sock,&rfds) != 0,FD_ISSET(sock,&wfds) != 0,FD_ISSET(sock,&efds) != 0,buf,ss);
+			}
+			if (s->type == ZT_PHY_SOCKET_CLOSED) {
+#ifdef ZT_PHY_HAVE_RIO
+				if ((s->rio)&&(!_rioFree(*s))) { // kept until its outstanding operations complete
+					++s;
+					continue;
+				}
+#endif
+				_socks.erase(s++);
+			} else ++s;
+		}
+		return true;
+#else // epoll or kqueue
+		// Closed sockets are only removed here, since until now events could still point to them
+		if (_closed) {
+			unsigned long waiting = 0;
+			for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
+				if (s->type == ZT_PHY_SOCKET_CLOSED) {
+#ifdef ZT_PHY_HAVE_IO_URING
+					if (s->uringArmed) { // kept until its canceled receive completes
+						++waiting;
+						++s;
+						continue;
+					}
+#endif
+					_socks.erase(s++);
+				} else ++s;
+			}
+			_closed = waiting;
+		}
+
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event ev[ZT_PHY_MAX_EVENTS];
+		const int n = ::epoll_wait(_pollfd,ev,ZT_PHY_MAX_EVENTS,(timeout >= 0) ? (int)timeout : -1);
+		for(int i=0;i<n;++i) {
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>(ev[i].data.ptr);
+			if (!s) {
+				_drainWhack();
+#ifdef ZT_PHY_HAVE_IO_URING
+			} else if (ev[i].data.ptr == (void *)&_uringRx) {
+				_uringReceive();
+#endif
+			} else if (s->type != ZT_PHY_SOCKET_CLOSED) {
+				// Errors and hangups are reported as readiness so the read or write fails and closes the socket, as with select()
+				const bool err = ((ev[i].events & (EPOLLERR|EPOLLHUP)) != 0);
+				_process(s,((ev[i].events & EPOLLIN) != 0)||(err),((ev[i].events & EPOLLOUT) != 0)||(err),false,buf,ss);
+			}
+		}
+		return (n > 0);
+#else
+		struct kevent ev[ZT_PHY_MAX_EVENTS];
+		struct timespec ts;
+		ts.tv_sec = (timeout > 0) ? (time_t)(timeout / 1000) : 0;
+		ts.tv_nsec = (timeout > 0) ? (long)((timeout % 1000) * 1000000) : 0;
+		const int n = ::kevent(_pollfd,(const struct kevent *)0,0,ev,ZT_PHY_MAX_EVENTS,(timeout >= 0) ? &ts : (const struct timespec *)0);
+		for(int i=0;i<n;++i) {
+			PhySocketImpl *const s = reinterpret_cast<PhySocketImpl *>(ev[i].udata);
+			if (!s) {
+				_drainWhack();
+			} else if ((s->type != ZT_PHY_SOCKET_CLOSED)&&((ev[i].flags & EV_ERROR) == 0)) {
+				_process(s,(ev[i].filter == EVFILT_READ),(ev[i].filter == EVFILT_WRITE),false,buf,ss);
+			}
+		}
+		return (n > 0);
+#endif
+#endif // select or not
+	}
+
+	inline void _drainWhack()
+	{
+		char tmp[16];
+#if defined(_WIN32) || defined(_WIN64)
+		::recv(_whackReceiveSocket,tmp,16,0);
+#else
+		(void)(::read(_whackReceiveSocket,tmp,16));
+#endif
+	}
+
+	// Handles readiness of one socket, 'except' is only used on Windows for failed connects
+	inline void _process(PhySocketImpl *const s,const bool readable,const bool writable,const bool except,char *const buf,struct sockaddr_storage &ss)
+	{
+		switch (s->type) {
+
+			case ZT_PHY_SOCKET_TCP_OUT_PENDING:
+#if defined(_WIN32) || defined(_WIN64)
+				if (except) {
+					this->close((PhySocket *)&(*s),true);
+				} else // ... if
+#endif
+				if (writable) {
+					socklen_t slen = sizeof(ss);
+					if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
+						this->close((PhySocket *)&(*s),true);
+					} else {
+						s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
+						_setInterest(*s,true,false);
+						try {
+							_handler->phyOnTcpConnect((PhySocket *)&(*s),&(s->uptr),true);
+						} catch ( ... ) {}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
+			case ZT_PHY_SOCKET_TCP_IN: {
+				if (readable) {
+					long n = (long)::recv(s->sock,buf,ZT_PHY_RECV_BUFFER_SIZE,0);
+					if (n <= 0) {
+						this->close((PhySocket *)&(*s),true);
+					} else {
+						try {
+							_handler->phyOnTcpData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
+						} catch ( ... ) {}
+					}
+				}
+				if ((writable)&&(s->wantWrite)) { // not if closed or no longer wanted after the read above
+					try {
+						_handler->phyOnTcpWritable((PhySocket *)&(*s),&(s->uptr));
+					} catch ( ... ) {}
+				}
+			}	break;
+
+			case ZT_PHY_SOCKET_TCP_LISTEN:
+				if (readable) {
+					memset(&ss,0,sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+					if (ZT_PHY_SOCKFD_VALID(newSock)) {
+						if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+							ZT_PHY_CLOSE_SOCKET(newSock);
+						} else {
+#if defined(_WIN32) || defined(_WIN64)
+							{ BOOL f = (_noDelay ? TRUE : FALSE); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							{ u_long iMode=1; ioctlsocket(newSock,FIONBIO,&iMode); }
+#else
+							{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+#endif
+							_socks.push_back(PhySocketImpl());
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_TCP_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							_setInterest(sws,true,false);
+							try {
+								_handler->phyOnTcpAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
+							} catch ( ... ) {}
+						}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UDP:
+				if (readable) {
+#ifdef ZT_PHY_HAVE_MMSG
+					if (!_udpRing) {
+						_udpRing = new _UdpRing();
+						for(unsigned int i=0;i<ZT_PHY_UDP_BATCH_SIZE;++i) {
+							_udpRing->iov[i].iov_base = _udpRing->data[i];
+							_udpRing->iov[i].iov_len = ZT_PHY_UDP_BATCH_MAX_DATAGRAM;
+						}
+					}
+					_UdpRing &r = *_udpRing;
+					for(int k=0;k<(1024 / ZT_PHY_UDP_BATCH_SIZE);++k) {
+						memset(r.msgs,0,sizeof(r.msgs));
+						memset(r.from,0,sizeof(r.from));
+						for(unsigned int i=0;i<ZT_PHY_UDP_BATCH_SIZE;++i) {
+							r.msgs[i].msg_hdr.msg_name = &(r.from[i]);
+							r.msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+							r.msgs[i].msg_hdr.msg_iov = &(r.iov[i]);
+							r.msgs[i].msg_hdr.msg_iovlen = 1;
+							r.msgs[i].msg_hdr.msg_control = r.control[i].buf;
+							r.msgs[i].msg_hdr.msg_controllen = sizeof(r.control[i].buf);
+						}
+						const int n = ::recvmmsg(s->sock,r.msgs,ZT_PHY_UDP_BATCH_SIZE,MSG_DONTWAIT,(struct timespec *)0);
+						if (n <= 0)
+							break;
+						_udpDropped(*s,r.msgs[n - 1].msg_hdr); // the count only goes up, so the last one has it all (and the handler may close s)
+						unsigned int count = 0;
+						for(int i=0;i<n;++i) {
+							const unsigned long len = (unsigned long)r.msgs[i].msg_len;
+							if ((len == 0)||((r.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0))
+								continue;
+							unsigned long seg = len;
+							for(struct cmsghdr *c=CMSG_FIRSTHDR(&(r.msgs[i].msg_hdr));(c);c=CMSG_NXTHDR(&(r.msgs[i].msg_hdr),c)) {
+								if ((c->cmsg_level == SOL_UDP)&&(c->cmsg_type == UDP_GRO)) {
+									int gs = 0;
+									memcpy(&gs,CMSG_DATA(c),sizeof(gs));
+									if (gs > 0)
+										seg = (unsigned long)gs;
+								}
+							}
+							const unsigned int tos = _udpTrafficClass(r.msgs[i].msg_hdr);
+							// A GRO receive holds datagrams of seg bytes each except maybe the last
+							for(unsigned long off=0;off<len;off+=seg) {
+								if (count == ZT_PHY_UDP_BATCH_SIZE) {
+									try {
+										_handler->phyOnDatagrams((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),r.datagrams,count);
+									} catch ( ... ) {}
+									count = 0;
+								}
+								PhyDatagram &d = r.datagrams[count++];
+								d.address = (const struct sockaddr *)&(r.from[i]);
+								d.data = r.data[i] + off;
+								d.len = ((len - off) < seg) ? (len - off) : seg;
+								d.tos = tos;
+							}
+						}
+						if (count) {
+							try {
+								_handler->phyOnDatagrams((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),r.datagrams,count);
+							} catch ( ... ) {}
+						}
+						if (n < ZT_PHY_UDP_BATCH_SIZE)
+							break;
+					}
+#else
+					for(int k=0;k<1024;++k) {
+						memset(&ss,0,sizeof(ss));
+						socklen_t slen = sizeof(ss);
+						long n = (long)::recvfrom(s->sock,buf,ZT_PHY_RECV_BUFFER_SIZE,0,(struct sockaddr *)&ss,&slen);
+						if (n > 0) {
+							PhyDatagram d;
+							d.address = (const struct sockaddr *)&ss;
+							d.data = buf;
+							d.len = (unsigned long)n;
+							d.tos = 0;
+							try {
+								_handler->phyOnDatagrams((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),&d,1);
+							} catch ( ... ) {}
+						} else if (n < 0)
+							break;
+					}
+#endif
+				}
+				break;
+
+#ifdef ZT_PHY_HAVE_XDP
+			case ZT_PHY_SOCKET_XDP:
+				if (readable)
+					_xdpReceive(*s);
+				break;
+#endif
+
+			case ZT_PHY_SOCKET_UNIX_IN: {
+#ifdef __UNIX_LIKE__
+				if ((writable)&&(s->wantWrite)) {
+					try {
+						_handler->phyOnUnixWritable((PhySocket *)&(*s),&(s->uptr),false);
+					} catch ( ... ) {}
+				}
+				if ((readable)&&(s->wantRead)) { // not if closed or no longer wanted after the write above
+					long n = (long)::read(s->sock,buf,ZT_PHY_RECV_BUFFER_SIZE);
+					if (n <= 0) {
+						this->close((PhySocket *)&(*s),true);
+					} else {
+						try {
+							_handler->phyOnUnixData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
+						} catch ( ... ) {}
+					}
+				}
+#endif // __UNIX_LIKE__
+			}	break;
+
+			case ZT_PHY_SOCKET_UNIX_LISTEN:
+#ifdef __UNIX_LIKE__
+				if (readable) {
+					memset(&ss,0,sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+					if (ZT_PHY_SOCKFD_VALID(newSock)) {
+						if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+							ZT_PHY_CLOSE_SOCKET(newSock);
+						} else {
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+							_socks.push_back(PhySocketImpl());
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_UNIX_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							_setInterest(sws,true,false);
+							try {
+								//_handler->phyOnUnixAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
+							} catch ( ... ) {}
+						}
+					}
+				}
+#endif // __UNIX_LIKE__
+				break;
+
+			case ZT_PHY_SOCKET_FD: {
+				if (((readable)&&(s->wantRead))||((writable)&&(s->wantWrite))) {
+					try {
+						//_handler->phyOnFileDescriptorActivity((PhySocket *)&(*s),&(s->uptr),readable,writable);
+					} catch ( ... ) {}
+				}
+			}	break;
+
+			default:
+				break;
+
+		}
 	}
 };
 
@@ -41,6 +41,11 @@
 #include <string.h>
 
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 
 #include "../node/Utils.hpp"
 #include "OSUtils.hpp"
@@ -79,15 +84,50 @@
 #endif
 #endif
 
+#ifdef __WINDOWS__
+#define ZT_PORTMAPPER_BAD_SOCKET INVALID_SOCKET
+#define ZT_PORTMAPPER_CLOSE_SOCKET(s) ::closesocket(s)
+#else
+#include <unistd.h>
+#define ZT_PORTMAPPER_BAD_SOCKET (-1)
+#define ZT_PORTMAPPER_CLOSE_SOCKET(s) ::close(s)
+#endif
+
+// PCP (RFC 6887) server port on the gateway, same as NAT-PMP
+#define ZT_PORTMAPPER_PCP_PORT 5351
+
+// PCP retransmits after this long, doubling each time (RFC 6887 section 8.1.1)
+#define ZT_PORTMAPPER_PCP_WAIT 250
+
+// PCP requests to send before giving up
+#define ZT_PORTMAPPER_PCP_TRIES 3
+
+// How long to wait for each NAT-PMP response
+#define ZT_PORTMAPPER_NATPMP_TIMEOUT 2000
+
+// How long to wait for UPnP devices to answer discovery
+#define ZT_PORTMAPPER_UPNP_DISCOVER_TIMEOUT 2000
+
 namespace ZeroTier {
 
 class PortMapperImpl
 {
 public:
-	PortMapperImpl(int localUdpPortToMap,const char *un) :
+	enum Mode
+	{
+		MODE_PCP = 0,
+		MODE_NATPMP = 1,
+		MODE_UPNP = 2
+	};
+
+	PortMapperImpl(int localUdpPortToMap,const char *un,void (*ch)(void *),void *ca) :
 		run(true),
+		kicked(false),
+		changed(false),
 		localPort(localUdpPortToMap),
-		uniqueName(un)
+		uniqueName(un),
+		changedHandler(ch),
+		changedArg(ca)
 	{
 	}
 
@@ -96,248 +136,357 @@ public:
 	void threadMain()
 		throw()
 	{
-		int mode = 0; // 0 == NAT-PMP, 1 == UPnP
+		int mode = MODE_PCP; // tried first, set to whatever last worked
+		unsigned long retryDelay = ZT_PORTMAPPER_RETRY_DELAY;
+		int64_t expires = 0;
 
 #ifdef ZT_PORTMAPPER_TRACE
-		fprintf(stderr,"PortMapper: started for UDP port %d" ZT_EOL_S,localPort);
+		PM_TRACE("PortMapper: started for UDP port %d" ZT_EOL_S,localPort);
 #endif
 
-		while (run) {
+		while (running()) {
+			InetAddress mapped;
+			unsigned long lease = 0;
+			for(int m=0;(m<3)&&(!lease)&&(running());++m) {
+				const int tryMode = (mode + m) % 3;
+				switch(tryMode) {
+					case MODE_PCP: lease = _pcp(mapped); break;
+					case MODE_NATPMP: lease = _natPmp(mapped); break;
+					default: lease = _upnp(mapped); break;
+				}
+				if (lease)
+					mode = tryMode;
+			}
 
-			// ---------------------------------------------------------------------
-			// NAT-PMP mode (preferred)
-			// ---------------------------------------------------------------------
-			if (mode == 0) {
-			  natpmp_t natpmp;
-			  natpmpresp_t response;
-				int r = 0;
+			const int64_t now = OSUtils::now();
+			unsigned long delay;
+			if (lease) {
+				std::vector<InetAddress> s;
+				s.push_back(mapped);
+				_setSurface(s);
+				expires = now + (int64_t)lease;
+				retryDelay = ZT_PORTMAPPER_RETRY_DELAY;
+				delay = (lease > (ZT_PORTMAPPER_RENEW_MARGIN * 2)) ? (lease - ZT_PORTMAPPER_RENEW_MARGIN) : (lease / 2);
+			} else {
+				// Keep what we had until its lease runs out in case this was a blip
+				if (now >= expires)
+					_setSurface(std::vector<InetAddress>());
+				delay = retryDelay;
+				retryDelay = std::min(retryDelay * 2,(unsigned long)ZT_PORTMAPPER_REFRESH_DELAY);
+			}
 
-				bool natPmpSuccess = false;
-				for(int tries=0;tries<60;++tries) {
-					int tryPort = (int)localPort + tries;
-					if (tryPort >= 65535)
-						tryPort = (tryPort - 65535) + 1025;
+#ifdef ZT_PORTMAPPER_TRACE
+			PM_TRACE("PortMapper: next attempt in %lu ms" ZT_EOL_S,delay);
+#endif
+			std::unique_lock<std::mutex> l(lock);
+			wake.wait_for(l,std::chrono::milliseconds(delay),[this]() { return ((!run)||(kicked)); });
+			if (kicked) {
+				// Old mappings are probably gone with the old network, so don't keep them past a failed attempt
+				kicked = false;
+				expires = 0;
+				retryDelay = ZT_PORTMAPPER_RETRY_DELAY;
+			}
+		}
 
-					memset(&natpmp,0,sizeof(natpmp));
-					memset(&response,0,sizeof(response));
+		delete this;
+	}
+
+	inline bool running()
+	{
+		std::lock_guard<std::mutex> l(lock);
+		return run;
+	}
 
-					if (initnatpmp(&natpmp,0,0) != 0) {
-						mode = 1;
-						closenatpmp(&natpmp);
+	bool run;
+	bool kicked;
+	std::mutex lock;
+	std::condition_variable wake;
+
+	std::atomic<bool> changed;
+	int localPort;
+	std::string uniqueName;
+	void (*changedHandler)(void *);
+	void *changedArg;
+
+	Mutex surface_l;
+	std::vector<InetAddress> surface;
+
+private:
+	void _setSurface(const std::vector<InetAddress> &s)
+	{
+		{
+			Mutex::Lock sl(surface_l);
+			if (surface == s)
+				return;
+			surface = s;
+		}
+		changed = true;
+		std::lock_guard<std::mutex> l(lock);
+		if ((run)&&(changedHandler))
+			changedHandler(changedArg);
+	}
+
+	// Each of these returns the mapping's lease in milliseconds, or 0 if no mapping was made
+
+	unsigned long _pcp(InetAddress &mapped)
+	{
+		natpmp_t natpmp;
+		memset(&natpmp,0,sizeof(natpmp));
+		const int gwr = initnatpmp(&natpmp,0,0);
+		const uint32_t gateway = (uint32_t)natpmp.gateway;
+		closenatpmp(&natpmp);
+		if ((gwr != 0)||(!gateway))
+			return 0;
+
+		struct sockaddr_in gw;
+		memset(&gw,0,sizeof(gw));
+		gw.sin_family = AF_INET;
+		gw.sin_addr.s_addr = gateway;
+		gw.sin_port = htons(ZT_PORTMAPPER_PCP_PORT);
+
+		// The client address in a request must be the one the gateway sees it come from
+		struct sockaddr_in me;
+		memset(&me,0,sizeof(me));
+		socklen_t mel = sizeof(me);
+		const auto s = ::socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+		if (s == ZT_PORTMAPPER_BAD_SOCKET)
+			return 0;
+		if ((::connect(s,(const struct sockaddr *)&gw,sizeof(gw)) != 0)||(::getsockname(s,(struct sockaddr *)&me,&mel) != 0)) {
+			ZT_PORTMAPPER_CLOSE_SOCKET(s);
+			return 0;
+		}
+
+		// MAP request: 24 byte header then 36 byte MAP opcode, with IPv4 addresses as ::ffff:a.b.c.d
+		uint8_t req[60];
+		memset(req,0,sizeof(req));
+		req[0] = 2; // version
+		req[1] = 1; // MAP
+		const uint32_t lifetime = Utils::hton((uint32_t)(ZT_PORTMAPPER_LEASE / 1000));
+		memcpy(req + 4,&lifetime,4);
+		req[18] = 0xff; req[19] = 0xff;
+		memcpy(req + 20,&(me.sin_addr.s_addr),4);
+		Utils::getSecureRandom(req + 24,12); // nonce
+		req[36] = IPPROTO_UDP;
+		const uint16_t port = Utils::hton((uint16_t)localPort);
+		memcpy(req + 40,&port,2);
+		memcpy(req + 42,&port,2); // suggest the same port outside
+		req[54] = 0xff; req[55] = 0xff; // any external IPv4 address
+
+		unsigned long lease = 0;
+		unsigned int wait = ZT_PORTMAPPER_PCP_WAIT;
+		for(int tries=0;tries<ZT_PORTMAPPER_PCP_TRIES;++tries) {
+			if (::send(s,(const char *)req,sizeof(req),0) != (int)sizeof(req))
+				break;
+			fd_set fds;
+			FD_ZERO(&fds);
+			FD_SET(s,&fds);
+			struct timeval tv;
+			tv.tv_sec = wait / 1000;
+			tv.tv_usec = (wait % 1000) * 1000;
+			wait *= 2;
+			if (::select((int)s + 1,&fds,(fd_set *)0,(fd_set *)0,&tv) <= 0)
+				continue;
+
+			uint8_t resp[1100];
+			const int n = (int)::recv(s,(char *)resp,sizeof(resp),0);
+			if ((n >= 4)&&(resp[0] == 0)) {
+				// NAT-PMP only gateways answer anything else with "unsupported version"
 #ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: NAT-PMP: init failed, switching to UPnP mode" ZT_EOL_S);
+				PM_TRACE("PortMapper: PCP: gateway only speaks NAT-PMP" ZT_EOL_S);
 #endif
-						break;
-					}
-
-					InetAddress publicAddress;
-					sendpublicaddressrequest(&natpmp);
-					int64_t myTimeout = OSUtils::now() + 5000;
-					do {
-						fd_set fds;
-						struct timeval timeout;
-						FD_ZERO(&fds);
-						FD_SET(natpmp.s, &fds);
-						getnatpmprequesttimeout(&natpmp, &timeout);
-						select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
-						r = readnatpmpresponseorretry(&natpmp, &response);
-						if (OSUtils::now() >= myTimeout)
-							break;
-					} while (r == NATPMP_TRYAGAIN);
-					if (r == 0) {
-						publicAddress = InetAddress((uint32_t)response.pnu.publicaddress.addr.s_addr,0);
-					} else {
+				break;
+			}
+			if ((n < 60)||(resp[0] != 2)||(resp[1] != 0x81)||(memcmp(resp + 24,req + 24,12) != 0))
+				continue;
+			if (resp[3] == 0) { // SUCCESS
+				uint32_t granted = 0;
+				memcpy(&granted,resp + 4,4);
+				uint16_t extPort = 0;
+				memcpy(&extPort,resp + 42,2);
+				mapped = InetAddress(resp + 56,4,Utils::ntoh(extPort));
+				if ((extPort)&&(mapped.ipScope() == InetAddress::IP_SCOPE_GLOBAL))
+					lease = (unsigned long)Utils::ntoh(granted) * 1000UL;
 #ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: NAT-PMP: request for external address failed, aborting..." ZT_EOL_S);
+				char paddr[128];
+				PM_TRACE("PortMapper: PCP: mapped %u to %s for %lu ms" ZT_EOL_S,(unsigned int)localPort,mapped.toString(paddr),lease);
 #endif
-						closenatpmp(&natpmp);
-						break;
-					}
-
-				  sendnewportmappingrequest(&natpmp,NATPMP_PROTOCOL_UDP,localPort,tryPort,(ZT_PORTMAPPER_REFRESH_DELAY * 2) / 1000);
-					myTimeout = OSUtils::now() + 10000;
-					do {
-				    fd_set fds;
-				    struct timeval timeout;
-				    FD_ZERO(&fds);
-				    FD_SET(natpmp.s, &fds);
-				    getnatpmprequesttimeout(&natpmp, &timeout);
-				    select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
-				    r = readnatpmpresponseorretry(&natpmp, &response);
-						if (OSUtils::now() >= myTimeout)
-							break;
-				  } while (r == NATPMP_TRYAGAIN);
-					if (r == 0) {
-						publicAddress.setPort(response.pnu.newportmapping.mappedpublicport);
+			}
 #ifdef ZT_PORTMAPPER_TRACE
-                        char paddr[128];
-                        PM_TRACE("PortMapper: NAT-PMP: mapped %u to %s" ZT_EOL_S,(unsigned int)localPort,publicAddress.toString(paddr));
+			else PM_TRACE("PortMapper: PCP: MAP failed with result %u" ZT_EOL_S,(unsigned int)resp[3]);
 #endif
-						Mutex::Lock sl(surface_l);
-						surface.clear();
-						surface.push_back(publicAddress);
-						natPmpSuccess = true;
-						closenatpmp(&natpmp);
-						break;
-					} else {
-						closenatpmp(&natpmp);
-						// continue
-					}
-				}
+			break;
+		}
+
+		ZT_PORTMAPPER_CLOSE_SOCKET(s);
+		return lease;
+	}
 
-				if (!natPmpSuccess) {
-					mode = 1;
+	static bool _natPmpResponse(natpmp_t &natpmp,natpmpresp_t &response)
+	{
+		int r;
+		const int64_t timeout = OSUtils::now() + ZT_PORTMAPPER_NATPMP_TIMEOUT;
+		do {
+			fd_set fds;
+			struct timeval tv;
+			FD_ZERO(&fds);
+			FD_SET(natpmp.s,&fds);
+			getnatpmprequesttimeout(&natpmp,&tv);
+			select(FD_SETSIZE,&fds,NULL,NULL,&tv);
+			r = readnatpmpresponseorretry(&natpmp,&response);
+		} while ((r == NATPMP_TRYAGAIN)&&(OSUtils::now() < timeout));
+		return (r == 0);
+	}
+
+	unsigned long _natPmp(InetAddress &mapped)
+	{
+		natpmp_t natpmp;
+		natpmpresp_t response;
+		memset(&natpmp,0,sizeof(natpmp));
+		memset(&response,0,sizeof(response));
+
+		unsigned long lease = 0;
+		if (initnatpmp(&natpmp,0,0) == 0) {
+			if ((sendpublicaddressrequest(&natpmp) >= 0)&&(_natPmpResponse(natpmp,response))) {
+				mapped = InetAddress((uint32_t)response.pnu.publicaddress.addr.s_addr,0);
+				// The port asked for is only a suggestion, the gateway picks another if it's taken
+				if ((sendnewportmappingrequest(&natpmp,NATPMP_PROTOCOL_UDP,localPort,localPort,ZT_PORTMAPPER_LEASE / 1000) >= 0)&&(_natPmpResponse(natpmp,response))) {
+					mapped.setPort(response.pnu.newportmapping.mappedpublicport);
+					lease = (unsigned long)response.pnu.newportmapping.lifetime * 1000UL;
 #ifdef ZT_PORTMAPPER_TRACE
-                    PM_TRACE("PortMapper: NAT-PMP: request failed, switching to UPnP mode" ZT_EOL_S);
+					char paddr[128];
+					PM_TRACE("PortMapper: NAT-PMP: mapped %u to %s for %lu ms" ZT_EOL_S,(unsigned int)localPort,mapped.toString(paddr),lease);
 #endif
 				}
 			}
-			// ---------------------------------------------------------------------
-
-			// ---------------------------------------------------------------------
-			// UPnP mode
-			// ---------------------------------------------------------------------
-			if (mode == 1) {
-				char lanaddr[4096];
-				char externalip[4096]; // no range checking? so make these buffers larger than any UDP packet a uPnP server could send us as a precaution :P
-				char inport[16];
-				char outport[16];
-				struct UPNPUrls urls;
-				struct IGDdatas data;
-
-				int upnpError = 0;
-				UPNPDev *devlist = upnpDiscoverAll(5000,(const char *)0,(const char *)0,0,0,2,&upnpError);
-				if (devlist) {
-
 #ifdef ZT_PORTMAPPER_TRACE
-					{
-						UPNPDev *dev = devlist;
-						while (dev) {
-                            PM_TRACE("PortMapper: found UPnP device at URL '%s': %s" ZT_EOL_S,dev->descURL,dev->st);
-							dev = dev->pNext;
-						}
-					}
+			if (!lease)
+				PM_TRACE("PortMapper: NAT-PMP: request failed" ZT_EOL_S);
 #endif
+		}
+		closenatpmp(&natpmp);
+		return lease;
+	}
 
-					memset(lanaddr,0,sizeof(lanaddr));
-					memset(externalip,0,sizeof(externalip));
-					memset(&urls,0,sizeof(urls));
-					memset(&data,0,sizeof(data));
-					OSUtils::ztsnprintf(inport,sizeof(inport),"%d",localPort);
+	unsigned long _upnp(InetAddress &mapped)
+	{
+		char lanaddr[4096];
+		char externalip[4096]; // no range checking? so make these buffers larger than any UDP packet a uPnP server could send us as a precaution :P
+		char inport[16];
+		char outport[16];
+		struct UPNPUrls urls;
+		struct IGDdatas data;
+
+		unsigned long lease = 0;
+		int upnpError = 0;
+		UPNPDev *devlist = upnpDiscoverAll(ZT_PORTMAPPER_UPNP_DISCOVER_TIMEOUT,(const char *)0,(const char *)0,0,0,2,&upnpError);
+		if (devlist) {
 
-					if ((UPNP_GetValidIGD(devlist,&urls,&data,lanaddr,sizeof(lanaddr)))&&(lanaddr[0])) {
-#ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: UPnP: my LAN IP address: %s" ZT_EOL_S,lanaddr);
-#endif
-						if ((UPNP_GetExternalIPAddress(urls.controlURL,data.first.servicetype,externalip) == UPNPCOMMAND_SUCCESS)&&(externalip[0])) {
 #ifdef ZT_PORTMAPPER_TRACE
-                            PM_TRACE("PortMapper: UPnP: my external IP address: %s" ZT_EOL_S,externalip);
+			{
+				UPNPDev *dev = devlist;
+				while (dev) {
+					PM_TRACE("PortMapper: found UPnP device at URL '%s': %s" ZT_EOL_S,dev->descURL,dev->st);
+					dev = dev->pNext;
+				}
+			}
 #endif
 
-							for(int tries=0;tries<60;++tries) {
-								int tryPort = (int)localPort + tries;
-								if (tryPort >= 65535)
-									tryPort = (tryPort - 65535) + 1025;
-								OSUtils::ztsnprintf(outport,sizeof(outport),"%u",tryPort);
-
-								// First check and see if this port is already mapped to the
-								// same unique name. If so, keep this mapping and don't try
-								// to map again since this can break buggy routers. But don't
-								// fail if this command fails since not all routers support it.
-								{
-									char haveIntClient[128]; // 128 == big enough for all these as per miniupnpc "documentation"
-									char haveIntPort[128];
-									char haveDesc[128];
-									char haveEnabled[128];
-									char haveLeaseDuration[128];
-									memset(haveIntClient,0,sizeof(haveIntClient));
-									memset(haveIntPort,0,sizeof(haveIntPort));
-									memset(haveDesc,0,sizeof(haveDesc));
-									memset(haveEnabled,0,sizeof(haveEnabled));
-									memset(haveLeaseDuration,0,sizeof(haveLeaseDuration));
-									if ((UPNP_GetSpecificPortMappingEntry(urls.controlURL,data.first.servicetype,outport,"UDP",(const char *)0,haveIntClient,haveIntPort,haveDesc,haveEnabled,haveLeaseDuration) == UPNPCOMMAND_SUCCESS)&&(uniqueName == haveDesc)) {
+			memset(lanaddr,0,sizeof(lanaddr));
+			memset(externalip,0,sizeof(externalip));
+			memset(&urls,0,sizeof(urls));
+			memset(&data,0,sizeof(data));
+			OSUtils::ztsnprintf(inport,sizeof(inport),"%d",localPort);
+
+			if ((UPNP_GetValidIGD(devlist,&urls,&data,lanaddr,sizeof(lanaddr)))&&(lanaddr[0])) {
 #ifdef ZT_PORTMAPPER_TRACE
-                                        PM_TRACE("PortMapper: UPnP: reusing previously reserved external port: %s" ZT_EOL_S,outport);
+				PM_TRACE("PortMapper: UPnP: my LAN IP address: %s" ZT_EOL_S,lanaddr);
 #endif
-										Mutex::Lock sl(surface_l);
-										surface.clear();
-										InetAddress tmp(externalip);
-										tmp.setPort(tryPort);
-										surface.push_back(tmp);
-										break;
-									}
-								}
-
-								// Try to map this port
-								int mapResult = 0;
-								if ((mapResult = UPNP_AddPortMapping(urls.controlURL,data.first.servicetype,outport,inport,lanaddr,uniqueName.c_str(),"UDP",(const char *)0,"0")) == UPNPCOMMAND_SUCCESS) {
+				if ((UPNP_GetExternalIPAddress(urls.controlURL,data.first.servicetype,externalip) == UPNPCOMMAND_SUCCESS)&&(externalip[0])) {
 #ifdef ZT_PORTMAPPER_TRACE
-                                    PM_TRACE("PortMapper: UPnP: reserved external port: %s" ZT_EOL_S,outport);
+					PM_TRACE("PortMapper: UPnP: my external IP address: %s" ZT_EOL_S,externalip);
 #endif
-									Mutex::Lock sl(surface_l);
-									surface.clear();
-									InetAddress tmp(externalip);
-									tmp.setPort(tryPort);
-									surface.push_back(tmp);
-									break;
-								} else {
+
+					for(int tries=0;(tries<60)&&(running());++tries) {
+						int tryPort = (int)localPort + tries;
+						if (tryPort >= 65535)
+							tryPort = (tryPort - 65535) + 1025;
+						OSUtils::ztsnprintf(outport,sizeof(outport),"%u",tryPort);
+
+						// First check and see if this port is already mapped to the
+						// same unique name. If so, keep this mapping and don't try
+						// to map again since this can break buggy routers. But don't
+						// fail if this command fails since not all routers support it.
+						{
+							char haveIntClient[128]; // 128 == big enough for all these as per miniupnpc "documentation"
+							char haveIntPort[128];
+							char haveDesc[128];
+							char haveEnabled[128];
+							char haveLeaseDuration[128];
+							memset(haveIntClient,0,sizeof(haveIntClient));
+							memset(haveIntPort,0,sizeof(haveIntPort));
+							memset(haveDesc,0,sizeof(haveDesc));
+							memset(haveEnabled,0,sizeof(haveEnabled));
+							memset(haveLeaseDuration,0,sizeof(haveLeaseDuration));
+							if ((UPNP_GetSpecificPortMappingEntry(urls.controlURL,data.first.servicetype,outport,"UDP",(const char *)0,haveIntClient,haveIntPort,haveDesc,haveEnabled,haveLeaseDuration) == UPNPCOMMAND_SUCCESS)&&(uniqueName == haveDesc)) {
 #ifdef ZT_PORTMAPPER_TRACE
-                                    PM_TRACE("PortMapper: UPnP: UPNP_AddPortMapping(%s) failed: %d" ZT_EOL_S,outport,mapResult);
+								PM_TRACE("PortMapper: UPnP: reusing previously reserved external port: %s" ZT_EOL_S,outport);
 #endif
-									Thread::sleep(1000);
-								}
+								mapped = InetAddress(externalip);
+								mapped.setPort(tryPort);
+								lease = ZT_PORTMAPPER_REFRESH_DELAY + ZT_PORTMAPPER_RENEW_MARGIN;
+								break;
 							}
+						}
 
-						} else {
-							mode = 0;
+						// Try to map this port, with no lease since some routers only support permanent ones
+						int mapResult = 0;
+						if ((mapResult = UPNP_AddPortMapping(urls.controlURL,data.first.servicetype,outport,inport,lanaddr,uniqueName.c_str(),"UDP",(const char *)0,"0")) == UPNPCOMMAND_SUCCESS) {
 #ifdef ZT_PORTMAPPER_TRACE
-                            PM_TRACE("PortMapper: UPnP: UPNP_GetExternalIPAddress failed, returning to NAT-PMP mode" ZT_EOL_S);
+							PM_TRACE("PortMapper: UPnP: reserved external port: %s" ZT_EOL_S,outport);
 #endif
+							mapped = InetAddress(externalip);
+							mapped.setPort(tryPort);
+							lease = ZT_PORTMAPPER_REFRESH_DELAY + ZT_PORTMAPPER_RENEW_MARGIN;
+							break;
 						}
-					} else {
-						mode = 0;
 #ifdef ZT_PORTMAPPER_TRACE
-                        PM_TRACE("PortMapper: UPnP: UPNP_GetValidIGD failed, returning to NAT-PMP mode" ZT_EOL_S);
+						PM_TRACE("PortMapper: UPnP: UPNP_AddPortMapping(%s) failed: %d" ZT_EOL_S,outport,mapResult);
 #endif
 					}
 
-					freeUPNPDevlist(devlist);
-
-				} else {
-					mode = 0;
+				}
 #ifdef ZT_PORTMAPPER_TRACE
-                    PM_TRACE("PortMapper: upnpDiscover failed, returning to NAT-PMP mode: %d" ZT_EOL_S,upnpError);
+				else PM_TRACE("PortMapper: UPnP: UPNP_GetExternalIPAddress failed" ZT_EOL_S);
 #endif
-				}
+				FreeUPNPUrls(&urls);
 			}
-			// ---------------------------------------------------------------------
-
 #ifdef ZT_PORTMAPPER_TRACE
-            PM_TRACE("UPNPClient: rescanning in %d ms" ZT_EOL_S,ZT_PORTMAPPER_REFRESH_DELAY);
+			else PM_TRACE("PortMapper: UPnP: UPNP_GetValidIGD failed" ZT_EOL_S);
 #endif
-			Thread::sleep(ZT_PORTMAPPER_REFRESH_DELAY);
-		}
 
-		delete this;
-	}
+			freeUPNPDevlist(devlist);
 
-	volatile bool run;
-	int localPort;
-	std::string uniqueName;
+		}
+#ifdef ZT_PORTMAPPER_TRACE
+		else PM_TRACE("PortMapper: upnpDiscover failed: %d" ZT_EOL_S,upnpError);
+#endif
 
-	Mutex surface_l;
-	std::vector<InetAddress> surface;
+		return lease;
+	}
 };
 
-PortMapper::PortMapper(int localUdpPortToMap,const char *uniqueName)
+PortMapper::PortMapper(int localUdpPortToMap,const char *uniqueName,void (*changedHandler)(void *),void *changedArg)
 {
-	_impl = new PortMapperImpl(localUdpPortToMap,uniqueName);
+	_impl = new PortMapperImpl(localUdpPortToMap,uniqueName,changedHandler,changedArg);
 	Thread::start(_impl);
 }
 
 PortMapper::~PortMapper()
 {
+	// The thread deletes _impl once it notices, which may be after a request in progress times out
+	std::lock_guard<std::mutex> l(_impl->lock);
 	_impl->run = false;
+	_impl->wake.notify_all();
 }
 
 std::vector<InetAddress> PortMapper::get() const
@@ -346,6 +495,18 @@ std::vector<InetAddress> PortMapper::get() const
 	return _impl->surface;
 }
 
+bool PortMapper::changed()
+{
+	return _impl->changed.exchange(false);
+}
+
+void PortMapper::networkChanged()
+{
+	std::lock_guard<std::mutex> l(_impl->lock);
+	_impl->kicked = true;
+	_impl->wake.notify_all();
+}
+
 } // namespace ZeroTier
 
 #endif // ZT_USE_MINIUPNPC
@@ -37,16 +37,35 @@
 #include "Thread.hpp"
 
 /**
- * How frequently should we refresh our UPNP/NAT-PnP/whatever state?
+ * Lease lifetime to request for PCP and NAT-PMP mappings
+ */
+#define ZT_PORTMAPPER_LEASE 600000
+
+/**
+ * Renew this long before a mapping's lease runs out (or at half of a lease shorter than twice this)
+ */
+#define ZT_PORTMAPPER_RENEW_MARGIN 30000
+
+/**
+ * How frequently should we re-check UPnP mappings, which we ask for without a lease?
  */
 #define ZT_PORTMAPPER_REFRESH_DELAY 300000
 
+/**
+ * First delay before trying again if no mapping could be made, doubling up to ZT_PORTMAPPER_REFRESH_DELAY
+ */
+#define ZT_PORTMAPPER_RETRY_DELAY 5000
+
 namespace ZeroTier {
 
 class PortMapperImpl;
 
 /**
- * UPnP/NAT-PnP port mapping "daemon"
+ * PCP/NAT-PMP/UPnP port mapping "daemon"
+ *
+ * Mappings are made right away, renewed just before their leases run out,
+ * and re-made immediately when told the network has changed. Tries PCP
+ * first, then NAT-PMP, then UPnP, starting with whichever last worked.
  */
 class PortMapper
 {
@@ -58,8 +77,10 @@ public:
 	 *
 	 * @param localUdpPortToMap Port we want visible to the outside world
 	 * @param name Unique name of this endpoint (based on ZeroTier address)
+	 * @param changedHandler Function called from the mapper's thread when mappings change, or NULL
+	 * @param changedArg Argument for changedHandler
 	 */
-	PortMapper(int localUdpPortToMap,const char *uniqueName);
+	PortMapper(int localUdpPortToMap,const char *uniqueName,void (*changedHandler)(void *) = (void (*)(void *))0,void *changedArg = (void *)0);
 
 	~PortMapper();
 
@@ -68,6 +89,16 @@ public:
 	 */
 	std::vector<InetAddress> get() const;
 
+	/**
+	 * @return True if mappings have changed since the last call
+	 */
+	bool changed();
+
+	/**
+	 * Re-map now, e.g. after interfaces, addresses, or the default gateway have changed
+	 */
+	void networkChanged();
+
 private:
 	PortMapperImpl *_impl;
 };
@@ -204,6 +204,26 @@ static Mutex _systemTapInitLock;
 // Only perform installation or uninstallation options one at a time
 static Mutex _systemDeviceManagementLock;
 
+// One overlapped read or write on the tap device; completions are matched back to it through ovl
+struct _TapIo
+{
+	OVERLAPPED ovl;
+	bool write;
+	char data[ZT_MAX_MTU + 32];
+};
+
+static inline bool _tapRead(HANDLE tap,_TapIo &io)
+{
+	memset(&io.ovl,0,sizeof(io.ovl));
+	return ((ReadFile(tap,io.data,sizeof(io.data),NULL,&io.ovl))||(GetLastError() == ERROR_IO_PENDING));
+}
+
+static inline bool _tapWrite(HANDLE tap,_TapIo &io,const unsigned int len)
+{
+	memset(&io.ovl,0,sizeof(io.ovl));
+	return ((WriteFile(tap,io.data,len,NULL,&io.ovl))||(GetLastError() == ERROR_IO_PENDING));
+}
+
 } // anonymous namespace
 
 std::string WindowsEthernetTap::addNewPersistentTapDevice(const char *pathToInf,std::string &deviceInstanceId)
@@ -464,7 +484,7 @@ WindowsEthernetTap::WindowsEthernetTap(
 	unsigned int metric,
 	uint64_t nwid,
 	const char *friendlyName,
-	void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+	void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 	void *arg) :
 	_handler(handler),
 	_arg(arg),
@@ -473,7 +493,8 @@ WindowsEthernetTap::WindowsEthernetTap(
 	_mtu(mtu),
 	_tap(INVALID_HANDLE_VALUE),
 	_friendlyName(friendlyName),
-	_injectSemaphore(INVALID_HANDLE_VALUE),
+	_iocp((HANDLE)0),
+	_injectPending(ZT_WINDOWS_TAP_QUEUE,ZT_MAX_MTU + 14),
 	_pathToHelpers(hp),
 	_run(true),
 	_initialized(false),
@@ -651,16 +672,20 @@ WindowsEthernetTap::WindowsEthernetTap(
 	if (friendlyName)
 		setFriendlyName(friendlyName);
 
-	_injectSemaphore = CreateSemaphore(NULL,0,1,NULL);
+	// Each opened tap handle is associated with this port, which outlives them so put() can always post to it
+	_iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE,NULL,0,1);
+	if (!_iocp)
+		throw std::runtime_error("unable to create I/O completion port for tap device");
+
 	_thread = Thread::start(this);
 }
 
 WindowsEthernetTap::~WindowsEthernetTap()
 {
 	_run = false;
-	ReleaseSemaphore(_injectSemaphore,1,NULL);
+	PostQueuedCompletionStatus(_iocp,0,0,NULL);
 	Thread::join(_thread);
-	CloseHandle(_injectSemaphore);
+	CloseHandle(_iocp);
 	setPersistentTapDeviceState(_deviceInstanceId.c_str(),false);
 }
 
@@ -794,17 +819,14 @@ void WindowsEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherTyp
 	if ((!_initialized)||(!_enabled)||(_tap == INVALID_HANDLE_VALUE)||(len > _mtu))
 		return;
 
-	Mutex::Lock _l(_injectPending_m);
-	_injectPending.emplace();
-	_injectPending.back().len = len + 14;
-	char *const d = _injectPending.back().data;
-	to.copyTo(d,6);
-	from.copyTo(d + 6,6);
-	d[12] = (char)((etherType >> 8) & 0xff);
-	d[13] = (char)(etherType & 0xff);
-	memcpy(d + 14,data,len);
-
-	ReleaseSemaphore(_injectSemaphore,1,NULL);
+	char eth[14];
+	to.copyTo(eth,6);
+	from.copyTo(eth + 6,6);
+	eth[12] = (char)((etherType >> 8) & 0xff);
+	eth[13] = (char)(etherType & 0xff);
+	bool wake;
+	if ((_injectPending.push(eth,14,data,len,wake))&&(wake))
+		PostQueuedCompletionStatus(_iocp,0,0,NULL); // a completion with no OVERLAPPED just wakes threadMain()
 }
 
 std::string WindowsEthernetTap::deviceName() const
@@ -900,10 +922,11 @@ NET_IFINDEX WindowsEthernetTap::interfaceIndex() const
 void WindowsEthernetTap::threadMain()
 	throw()
 {
-	char tapReadBuf[ZT_MAX_MTU + 32];
 	char tapPath[128];
-	HANDLE wait4[3];
-	OVERLAPPED tapOvlRead,tapOvlWrite;
+	OVERLAPPED_ENTRY done[ZT_WINDOWS_TAP_READS + ZT_WINDOWS_TAP_WRITES];
+	ZT_VirtualNetworkFrame frames[ZT_WINDOWS_TAP_READS];
+	_TapIo *reads[ZT_WINDOWS_TAP_READS];
+	_TapIo *freeWrites[ZT_WINDOWS_TAP_WRITES];
 
 	OSUtils::ztsnprintf(tapPath,sizeof(tapPath),"\\\\.\\Global\\%s.tap",_netCfgInstanceId.c_str());
 
@@ -925,6 +948,12 @@ void WindowsEthernetTap::threadMain()
 				Sleep(250);
 				continue;
 			}
+			if (CreateIoCompletionPort(_tap,_iocp,0,0) != _iocp) {
+				CloseHandle(_tap);
+				_tap = INVALID_HANDLE_VALUE;
+				Sleep(250);
+				continue;
+			}
 
 			{
 				uint32_t tmpi = 1;
@@ -1017,25 +1046,49 @@ void WindowsEthernetTap::threadMain()
 				_syncIps();
 			}
 
-			memset(&tapOvlRead,0,sizeof(tapOvlRead));
-			tapOvlRead.hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
-			memset(&tapOvlWrite,0,sizeof(tapOvlWrite));
-			tapOvlWrite.hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
-
-			wait4[0] = _injectSemaphore;
-			wait4[1] = tapOvlRead.hEvent;
-			wait4[2] = tapOvlWrite.hEvent; // only included if writeInProgress is true
+			// Keep ZT_WINDOWS_TAP_READS reads outstanding at all times and up to
+			// ZT_WINDOWS_TAP_WRITES writes, all completing to _iocp. Every wakeup
+			// takes whatever has completed, hands the frames read to the core in
+			// one batch, re-arms those reads, and fills free writes from the queue.
+			_TapIo *const io = new _TapIo[ZT_WINDOWS_TAP_READS + ZT_WINDOWS_TAP_WRITES];
+			unsigned int pending = 0;
+			unsigned int freeWriteCount = 0;
+			bool failed = false;
+			for(unsigned int i=0;i<ZT_WINDOWS_TAP_READS;++i) {
+				io[i].write = false;
+				if (_tapRead(_tap,io[i]))
+					++pending;
+				else failed = true;
+			}
+			for(unsigned int i=ZT_WINDOWS_TAP_READS;i<(ZT_WINDOWS_TAP_READS + ZT_WINDOWS_TAP_WRITES);++i) {
+				io[i].write = true;
+				freeWrites[freeWriteCount++] = &(io[i]);
+			}
 
-			ReadFile(_tap,tapReadBuf,sizeof(tapReadBuf),NULL,&tapOvlRead);
-			bool writeInProgress = false;
 			ULONGLONG timeOfLastBorkCheck = GetTickCount64();
 			_initialized = true;
 			unsigned int oldmtu = _mtu;
 
 			setFriendlyName(_friendlyName.c_str());
 
-			while (_run) {
-				DWORD waitResult = WaitForMultipleObjectsEx(writeInProgress ? 3 : 2,wait4,FALSE,2500,TRUE);
+			while ((_run)&&(!failed)) {
+				// Submit as many queued frames as there are free writes
+				unsigned int len = 0;
+				const char *f;
+				while ((freeWriteCount)&&((f = _injectPending.front(len)))) {
+					_TapIo *const w = freeWrites[--freeWriteCount];
+					memcpy(w->data,f,len);
+					_injectPending.pop();
+					if (_tapWrite(_tap,*w,len))
+						++pending;
+					else freeWrites[freeWriteCount++] = w;
+				}
+				// With writes free and nothing queued, put() posts a wakeup when frames arrive
+				if ((freeWriteCount)&&(!_injectPending.idle()))
+					continue;
+
+				ULONG count = 0;
+				const BOOL ok = GetQueuedCompletionStatusEx(_iocp,done,ZT_WINDOWS_TAP_READS + ZT_WINDOWS_TAP_WRITES,&count,2500,FALSE);
 				if (!_run) break; // will also break outer while(_run) since _run is false
 
 				// Check for changes in MTU and break to restart tap device to reconfigure in this case
@@ -1072,46 +1125,65 @@ void WindowsEthernetTap::threadMain()
 					}
 				}
 
-				if ((waitResult == WAIT_TIMEOUT)||(waitResult == WAIT_FAILED)) {
-					Sleep(250); // guard against spinning under some conditions
+				if (!ok) {
+					if (GetLastError() != WAIT_TIMEOUT)
+						Sleep(250); // guard against spinning under some conditions
 					continue;
 				}
 
-				if (HasOverlappedIoCompleted(&tapOvlRead)) {
-					DWORD bytesRead = 0;
-					if (GetOverlappedResult(_tap,&tapOvlRead,&bytesRead,FALSE)) {
-						if ((bytesRead > 14)&&(_enabled)) {
-							MAC to(tapReadBuf,6);
-							MAC from(tapReadBuf + 6,6);
-							unsigned int etherType = ((((unsigned int)tapReadBuf[12]) & 0xff) << 8) | (((unsigned int)tapReadBuf[13]) & 0xff);
-							try {
-								_handler(_arg,(void *)0,_nwid,from,to,etherType,0,tapReadBuf + 14,bytesRead - 14);
-							} catch ( ... ) {} // handlers should not throw
-						}
+				unsigned int frameCount = 0,readCount = 0;
+				for(ULONG i=0;i<count;++i) {
+					if (!done[i].lpOverlapped)
+						continue; // wakeup from put() or the destructor
+					_TapIo *const t = CONTAINING_RECORD(done[i].lpOverlapped,_TapIo,ovl);
+					--pending;
+					if (t->write) {
+						freeWrites[freeWriteCount++] = t;
+						continue;
 					}
-					ReadFile(_tap,tapReadBuf,ZT_MAX_MTU + 32,NULL,&tapOvlRead);
+					const DWORD bytesRead = done[i].dwNumberOfBytesTransferred;
+					if ((t->ovl.Internal == 0)&&(bytesRead > 14)&&(_enabled)) {
+						ZT_VirtualNetworkFrame &fr = frames[frameCount++];
+						fr.destMac = MAC(t->data,6).toInt();
+						fr.sourceMac = MAC(t->data + 6,6).toInt();
+						fr.etherType = ((((unsigned int)t->data[12]) & 0xff) << 8) | (((unsigned int)t->data[13]) & 0xff);
+						fr.vlanId = 0;
+						fr.data = t->data + 14;
+						fr.length = bytesRead - 14;
+					}
+					reads[readCount++] = t;
 				}
 
-				if (writeInProgress) {
-					if (HasOverlappedIoCompleted(&tapOvlWrite)) {
-						writeInProgress = false;
-						_injectPending_m.lock();
-						_injectPending.pop();
-					} else continue; // still writing, so skip code below and wait
-				} else _injectPending_m.lock();
-
-				if (!_injectPending.empty()) {
-					WriteFile(_tap,_injectPending.front().data,_injectPending.front().len,NULL,&tapOvlWrite);
-					writeInProgress = true;
+				if (frameCount) {
+					try {
+						_handler(_arg,(void *)0,_nwid,frames,frameCount);
+					} catch ( ... ) {} // handlers should not throw
 				}
 
-				_injectPending_m.unlock();
+				// Buffers are only re-armed after the core is done with the frames in them
+				for(unsigned int i=0;i<readCount;++i) {
+					if (_tapRead(_tap,*(reads[i])))
+						++pending;
+					else failed = true; // device went away, so reopen it
+				}
 			}
 
 			CancelIo(_tap);
 
-			CloseHandle(tapOvlRead.hEvent);
-			CloseHandle(tapOvlWrite.hEvent);
+			// Cancelled reads and writes still complete to _iocp and refer to io, so
+			// wait for them. If some never do, io is abandoned rather than freed.
+			for(unsigned int tries=0;((pending)&&(tries<20));++tries) {
+				ULONG count = 0;
+				if (GetQueuedCompletionStatusEx(_iocp,done,ZT_WINDOWS_TAP_READS + ZT_WINDOWS_TAP_WRITES,&count,250,FALSE)) {
+					for(ULONG i=0;i<count;++i) {
+						if (done[i].lpOverlapped)
+							--pending;
+					}
+				}
+			}
+			if (!pending)
+				delete [] io;
+
 			CloseHandle(_tap);
 			_tap = INVALID_HANDLE_VALUE;
 
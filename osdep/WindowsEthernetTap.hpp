@@ -33,7 +33,6 @@
 #include <ifdef.h>
 
 #include <string>
-#include <queue>
 #include <stdexcept>
 
 #include "../node/Constants.hpp"
@@ -41,6 +40,16 @@
 #include "../node/MulticastGroup.hpp"
 #include "../node/InetAddress.hpp"
 #include "../osdep/Thread.hpp"
+#include "FrameRing.hpp"
+
+// Reads kept outstanding on the tap device, each completed batch goes to the core together
+#define ZT_WINDOWS_TAP_READS 16
+
+// Writes kept outstanding on the tap device
+#define ZT_WINDOWS_TAP_WRITES 16
+
+// Frames from the core that can wait for a free write before new ones are dropped
+#define ZT_WINDOWS_TAP_QUEUE 1024
 
 namespace ZeroTier {
 
@@ -94,7 +103,7 @@ public:
 		unsigned int metric,
 		uint64_t nwid,
 		const char *friendlyName,
-		void (*handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int),
+		void (*handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int),
 		void *arg);
 
 	~WindowsEthernetTap();
@@ -126,7 +135,7 @@ private:
 	void _setRegistryIPv4Value(const char *regKey,const std::vector<std::string> &value);
 	void _syncIps();
 
-	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
+	void (*_handler)(void *,void *,uint64_t,const ZT_VirtualNetworkFrame *,unsigned int);
 	void *_arg;
 	MAC _mac;
 	uint64_t _nwid;
@@ -134,7 +143,7 @@ private:
 	Thread _thread;
 
 	volatile HANDLE _tap;
-	HANDLE _injectSemaphore;
+	HANDLE _iocp; // completion port for _tap's reads and writes and for waking threadMain()
 
 	GUID _deviceGuid;
 	NET_LUID _deviceLuid;
@@ -149,13 +158,7 @@ private:
 
 	std::vector<MulticastGroup> _multicastGroups;
 
-	struct _InjectPending
-	{
-		unsigned int len;
-		char data[ZT_MAX_MTU + 32];
-	};
-	std::queue<_InjectPending> _injectPending;
-	Mutex _injectPending_m;
+	FrameRing _injectPending; // frames from put() waiting for threadMain() to write them
 
 	std::string _pathToHelpers;
 
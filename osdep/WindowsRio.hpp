@@ -0,0 +1,242 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_WINDOWSRIO_HPP
+#define ZT_WINDOWSRIO_HPP
+
+// Registered I/O is in Winsock on Windows 8 / Server 2012 and newer. Its
+// functions are only reachable through a table fetched at runtime, so it's
+// available if the SDK headers have it and init() succeeds.
+#if defined(_WIN32) || defined(_WIN64)
+#include <WinSock2.h>
+#include <MSWSock.h>
+#include <Windows.h>
+#ifdef RIO_CORRUPT_CQ
+#define ZT_HAVE_RIO
+#endif
+#endif
+
+#ifdef ZT_HAVE_RIO
+
+#include <string.h>
+
+namespace ZeroTier {
+
+/**
+ * Minimal Registered I/O function table and completion queues
+ *
+ * This holds what Phy<> needs from RIO: the function table, one completion
+ * queue for receives that signals an event when armed with notify(), and
+ * one for sends that is only ever polled. Request queues and registered
+ * buffers belong to callers. RIO doesn't serialize calls on the same
+ * request or completion queue, so callers must.
+ */
+class WindowsRio
+{
+public:
+	WindowsRio() :
+		_rxCq(RIO_INVALID_CQ),
+		_txCq(RIO_INVALID_CQ),
+		_event((HANDLE)0)
+	{
+		memset(&_f,0,sizeof(_f));
+	}
+
+	~WindowsRio()
+	{
+		if (_rxCq != RIO_INVALID_CQ)
+			_f.RIOCloseCompletionQueue(_rxCq);
+		if (_txCq != RIO_INVALID_CQ)
+			_f.RIOCloseCompletionQueue(_txCq);
+		if (_event)
+			CloseHandle(_event);
+	}
+
+	/**
+	 * Load the function table and create completion queues
+	 *
+	 * @param cqSize Entries in each completion queue, which must cover every request queue's outstanding operations
+	 * @return True on success, false if RIO is unavailable
+	 */
+	inline bool init(unsigned long cqSize)
+	{
+		if (_event)
+			return true;
+
+		// The table can only be fetched through a socket, any RIO socket will do
+		SOCKET s = socket(AF_INET);
+		if (s == INVALID_SOCKET)
+			return false;
+		GUID id = WSAID_MULTIPLE_RIO;
+		DWORD bytes = 0;
+		RIO_EXTENSION_FUNCTION_TABLE f;
+		memset(&f,0,sizeof(f));
+		f.cbSize = sizeof(f);
+		const int r = WSAIoctl(s,SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,&id,sizeof(id),&f,sizeof(f),&bytes,NULL,NULL);
+		closesocket(s);
+		if (r != 0)
+			return false;
+
+		HANDLE e = CreateEvent(NULL,FALSE,FALSE,NULL);
+		if (!e)
+			return false;
+		RIO_NOTIFICATION_COMPLETION n;
+		memset(&n,0,sizeof(n));
+		n.Type = RIO_EVENT_COMPLETION;
+		n.Event.EventHandle = e;
+		n.Event.NotifyReset = FALSE; // auto-reset event
+		RIO_CQ rx = f.RIOCreateCompletionQueue((DWORD)cqSize,&n);
+		if (rx == RIO_INVALID_CQ) {
+			CloseHandle(e);
+			return false;
+		}
+		RIO_CQ tx = f.RIOCreateCompletionQueue((DWORD)cqSize,NULL);
+		if (tx == RIO_INVALID_CQ) {
+			f.RIOCloseCompletionQueue(rx);
+			CloseHandle(e);
+			return false;
+		}
+
+		memcpy(&_f,&f,sizeof(_f));
+		_rxCq = rx;
+		_txCq = tx;
+		_event = e;
+		return true;
+	}
+
+	/**
+	 * @param af Address family
+	 * @return New UDP socket that can be used with RIO or INVALID_SOCKET on failure
+	 */
+	static inline SOCKET socket(int af)
+	{
+		return WSASocketW(af,SOCK_DGRAM,IPPROTO_UDP,NULL,0,WSA_FLAG_OVERLAPPED|WSA_FLAG_REGISTERED_IO);
+	}
+
+	/**
+	 * Register memory for use in requests
+	 *
+	 * @param buf Memory, which must stay valid until deregistered
+	 * @param len Length in bytes
+	 * @return Buffer ID or RIO_INVALID_BUFFERID on failure
+	 */
+	inline RIO_BUFFERID registerBuffer(char *buf,unsigned long len) { return _f.RIORegisterBuffer(buf,(DWORD)len); }
+
+	inline void deregisterBuffer(RIO_BUFFERID id) { _f.RIODeregisterBuffer(id); }
+
+	/**
+	 * Create a request queue on a socket completing to this object's queues
+	 *
+	 * The queue goes away when the socket is closed.
+	 *
+	 * @param s Socket from socket()
+	 * @param receives Most receives outstanding
+	 * @param sends Most sends outstanding
+	 * @param context Reported as SocketContext in this queue's results
+	 * @return Request queue or RIO_INVALID_RQ on failure
+	 */
+	inline RIO_RQ createRequestQueue(SOCKET s,unsigned long receives,unsigned long sends,void *context)
+	{
+		return _f.RIOCreateRequestQueue(s,(ULONG)receives,1,(ULONG)sends,1,_rxCq,_txCq,context);
+	}
+
+	/**
+	 * Post a receive
+	 *
+	 * @param rq Request queue
+	 * @param data Buffer slice for the datagram
+	 * @param from Buffer slice for the source address (a SOCKADDR_INET)
+	 * @param flags 0 or RIO_MSG_DEFER to post it with the next receive that isn't deferred
+	 * @param context Reported as RequestContext in the result
+	 * @return True on success
+	 */
+	inline bool receive(RIO_RQ rq,RIO_BUF *data,RIO_BUF *from,DWORD flags,void *context)
+	{
+		return (_f.RIOReceiveEx(rq,data,1,NULL,from,NULL,NULL,flags,context) != FALSE);
+	}
+
+	/**
+	 * Post a send
+	 *
+	 * @param rq Request queue
+	 * @param data Buffer slice holding the datagram, or NULL with RIO_MSG_COMMIT_ONLY
+	 * @param to Buffer slice holding the destination (a SOCKADDR_INET), or NULL with RIO_MSG_COMMIT_ONLY
+	 * @param flags 0, RIO_MSG_DEFER to batch it with later sends, or RIO_MSG_COMMIT_ONLY to submit deferred sends
+	 * @param context Reported as RequestContext in the result
+	 * @return True on success
+	 */
+	inline bool send(RIO_RQ rq,RIO_BUF *data,RIO_BUF *to,DWORD flags,void *context)
+	{
+		return (_f.RIOSendEx(rq,data,(data) ? 1 : 0,NULL,to,NULL,NULL,flags,context) != FALSE);
+	}
+
+	/**
+	 * @param results Array to fill
+	 * @param max Size of array
+	 * @return Number of receive results taken
+	 */
+	inline unsigned long receiveResults(RIORESULT *results,unsigned long max)
+	{
+		const ULONG n = _f.RIODequeueCompletion(_rxCq,results,(ULONG)max);
+		return (n == RIO_CORRUPT_CQ) ? 0 : (unsigned long)n;
+	}
+
+	/**
+	 * @param results Array to fill
+	 * @param max Size of array
+	 * @return Number of send results taken
+	 */
+	inline unsigned long sendResults(RIORESULT *results,unsigned long max)
+	{
+		const ULONG n = _f.RIODequeueCompletion(_txCq,results,(ULONG)max);
+		return (n == RIO_CORRUPT_CQ) ? 0 : (unsigned long)n;
+	}
+
+	/**
+	 * Arm the receive queue to signal event() once when it has results
+	 */
+	inline void notify() { _f.RIONotify(_rxCq); }
+
+	/**
+	 * @return Auto-reset event signaled after notify() once receive results are waiting
+	 */
+	inline HANDLE event() const { return _event; }
+
+private:
+	WindowsRio(const WindowsRio &) = delete;
+	WindowsRio &operator=(const WindowsRio &) = delete;
+
+	RIO_EXTENSION_FUNCTION_TABLE _f;
+	RIO_CQ _rxCq;
+	RIO_CQ _txCq;
+	HANDLE _event;
+};
+
+} // namespace ZeroTier
+
+#endif // ZT_HAVE_RIO
+
+#endif
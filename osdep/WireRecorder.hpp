@@ -0,0 +1,353 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_WIRERECORDER_HPP
+#define ZT_WIRERECORDER_HPP
+
+#include "../node/Constants.hpp"
+#include "../node/InetAddress.hpp"
+#include "../node/Mutex.hpp"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// File starts with this magic, then the recording node's address and the start time (both 64-bit big-endian)
+#define ZT_WIRE_RECORDER_MAGIC "ZTWIRE01"
+#define ZT_WIRE_RECORDER_HEADER_SIZE 24
+
+// Each record is a 32-bit millisecond offset from the start time, a 16-bit length, a socket index,
+// an address family (4, 6 or 0) with its IP and 16-bit port, then the datagram
+#define ZT_WIRE_RECORDER_MAX_RECORD_HEADER 26
+
+// Socket index for datagrams that arrived over TCP (local socket -1); others are numbered in order of appearance
+#define ZT_WIRE_RECORDER_SOCKET_TCP 255
+
+// Largest datagram recorded, anything longer is truncated
+#define ZT_WIRE_RECORDER_MAX_LENGTH 65535
+
+// Write buffer size, so recording a busy node isn't a syscall per packet
+#define ZT_WIRE_RECORDER_BUFFER_SIZE 1048576
+
+namespace ZeroTier {
+
+/**
+ * Records received wire datagrams to a file for offline replay
+ *
+ * Each datagram is stored as it arrived (still encrypted) with its source
+ * address, the local socket it came in on and its arrival time. Only the
+ * local sockets' order of first appearance is kept since the values are
+ * meaningless outside the recording process. Any thread may call record(),
+ * which does nothing unless a recording is in progress.
+ *
+ * Reader reads the file back for replay into a Node with the same
+ * identity and state.
+ */
+class WireRecorder
+{
+public:
+	/**
+	 * A datagram read back by Reader
+	 */
+	struct Record
+	{
+		int64_t timestamp;
+		unsigned int socket; // index, or ZT_WIRE_RECORDER_SOCKET_TCP
+		InetAddress from;
+		unsigned int len;
+		uint8_t data[ZT_WIRE_RECORDER_MAX_LENGTH];
+	};
+
+	/**
+	 * Reads a recording in order
+	 */
+	class Reader
+	{
+	public:
+		Reader() : _f((FILE *)0),_address(0),_start(0) {}
+		~Reader() { close(); }
+
+		/**
+		 * @param path Recording to open
+		 * @return True if file was opened and has a valid header
+		 */
+		inline bool open(const char *path)
+		{
+			close();
+			_f = fopen(path,"rb");
+			if (!_f)
+				return false;
+			uint8_t h[ZT_WIRE_RECORDER_HEADER_SIZE];
+			if ((fread(h,1,sizeof(h),_f) != sizeof(h))||(memcmp(h,ZT_WIRE_RECORDER_MAGIC,8) != 0)) {
+				close();
+				return false;
+			}
+			_address = _be64(h + 8);
+			_start = (int64_t)_be64(h + 16);
+			return true;
+		}
+
+		inline void close()
+		{
+			if (_f) {
+				fclose(_f);
+				_f = (FILE *)0;
+			}
+		}
+
+		/**
+		 * @param r Record to fill
+		 * @return True if a record was read, false at end of file or if the rest is truncated
+		 */
+		inline bool next(Record &r)
+		{
+			if (!_f)
+				return false;
+			uint8_t h[ZT_WIRE_RECORDER_MAX_RECORD_HEADER];
+			if (fread(h,1,8,_f) != 8)
+				return false;
+			const unsigned int ipLen = (h[7] == 4) ? 4 : ((h[7] == 6) ? 16 : 0);
+			if (fread(h + 8,1,ipLen + 2,_f) != (ipLen + 2))
+				return false;
+			r.timestamp = _start + (int64_t)(((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | (uint32_t)h[3]);
+			r.len = ((unsigned int)h[4] << 8) | (unsigned int)h[5];
+			r.socket = h[6];
+			const unsigned int port = ((unsigned int)h[8 + ipLen] << 8) | (unsigned int)h[9 + ipLen];
+			if (ipLen)
+				r.from.set(h + 8,ipLen,port);
+			else r.from.zero();
+			return (fread(r.data,1,r.len,_f) == r.len);
+		}
+
+		/**
+		 * @return Address of the node that made the recording
+		 */
+		inline uint64_t address() const { return _address; }
+
+		/**
+		 * @return Time recording started in milliseconds since epoch
+		 */
+		inline int64_t start() const { return _start; }
+
+	private:
+		static inline uint64_t _be64(const uint8_t *p)
+		{
+			uint64_t v = 0;
+			for(unsigned int i=0;i<8;++i)
+				v = (v << 8) | (uint64_t)p[i];
+			return v;
+		}
+
+		FILE *_f;
+		uint64_t _address;
+		int64_t _start;
+	};
+
+	WireRecorder() :
+		_active(false),
+		_f((FILE *)0),
+		_buf((char *)0),
+		_start(0),
+		_maxBytes(0),
+		_bytes(0),
+		_packets(0) {}
+
+	~WireRecorder() { stop(); }
+
+	/**
+	 * Start a new recording, replacing any in progress
+	 *
+	 * @param path File to write (replaced if it exists)
+	 * @param address Address of this node, so replay can check it has the right identity
+	 * @param now Current time in milliseconds since epoch
+	 * @param maxBytes Stop after writing this much, or 0 for no limit
+	 * @return True if recording started
+	 */
+	inline bool start(const char *path,const uint64_t address,const int64_t now,const uint64_t maxBytes)
+	{
+		Mutex::Lock _l(_lock);
+		_close();
+		_f = fopen(path,"wb");
+		if (!_f)
+			return false;
+		_buf = new char[ZT_WIRE_RECORDER_BUFFER_SIZE];
+		setvbuf(_f,_buf,_IOFBF,ZT_WIRE_RECORDER_BUFFER_SIZE);
+		uint8_t h[ZT_WIRE_RECORDER_HEADER_SIZE];
+		memcpy(h,ZT_WIRE_RECORDER_MAGIC,8);
+		for(unsigned int i=0;i<8;++i) {
+			h[8 + i] = (uint8_t)(address >> (56 - (i * 8)));
+			h[16 + i] = (uint8_t)((uint64_t)now >> (56 - (i * 8)));
+		}
+		if (fwrite(h,1,sizeof(h),_f) != sizeof(h)) {
+			_close();
+			return false;
+		}
+		_path = path;
+		_start = now;
+		_maxBytes = maxBytes;
+		_bytes = sizeof(h);
+		_packets = 0;
+		_sockets.clear();
+		_active.store(true,std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	 * Stop recording and close the file
+	 */
+	inline void stop()
+	{
+		Mutex::Lock _l(_lock);
+		_close();
+	}
+
+	/**
+	 * @return True if recording
+	 */
+	inline bool active() const { return _active.load(std::memory_order_relaxed); }
+
+	/**
+	 * Record a received datagram if recording
+	 *
+	 * @param now Time datagram was received
+	 * @param localSocket Local socket it arrived on, or -1 for TCP
+	 * @param from Source address
+	 * @param data Datagram
+	 * @param len Length of datagram
+	 */
+	inline void record(const int64_t now,const int64_t localSocket,const struct sockaddr_storage *from,const void *data,unsigned int len)
+	{
+		if (!_active.load(std::memory_order_relaxed))
+			return;
+		if (len > ZT_WIRE_RECORDER_MAX_LENGTH)
+			len = ZT_WIRE_RECORDER_MAX_LENGTH;
+
+		Mutex::Lock _l(_lock);
+		if (!_f)
+			return;
+
+		uint8_t h[ZT_WIRE_RECORDER_MAX_RECORD_HEADER];
+		const uint32_t t = (now > _start) ? (uint32_t)(now - _start) : 0;
+		h[0] = (uint8_t)(t >> 24);
+		h[1] = (uint8_t)(t >> 16);
+		h[2] = (uint8_t)(t >> 8);
+		h[3] = (uint8_t)t;
+		h[4] = (uint8_t)(len >> 8);
+		h[5] = (uint8_t)len;
+		h[6] = _socketIndex(localSocket);
+		const InetAddress &a = *reinterpret_cast<const InetAddress *>(from);
+		unsigned int hl = 8;
+		if (a.ss_family == AF_INET) {
+			h[7] = 4;
+			memcpy(h + 8,a.rawIpData(),4);
+			hl += 4;
+		} else if (a.ss_family == AF_INET6) {
+			h[7] = 6;
+			memcpy(h + 8,a.rawIpData(),16);
+			hl += 16;
+		} else h[7] = 0;
+		const unsigned int port = a.port();
+		h[hl++] = (uint8_t)(port >> 8);
+		h[hl++] = (uint8_t)port;
+
+		if ((fwrite(h,1,hl,_f) != hl)||(fwrite(data,1,len,_f) != len)) {
+			_close();
+			return;
+		}
+		_bytes += hl + len;
+		++_packets;
+		if ((_maxBytes)&&(_bytes >= _maxBytes))
+			_close();
+	}
+
+	/**
+	 * Get the state of the current or last recording
+	 *
+	 * @param path Set to file path
+	 * @param start Set to start time
+	 * @param packets Set to datagrams recorded
+	 * @param bytes Set to bytes written
+	 * @param maxBytes Set to limit or 0 for none
+	 * @return True if still recording
+	 */
+	inline bool status(std::string &path,int64_t &start,uint64_t &packets,uint64_t &bytes,uint64_t &maxBytes)
+	{
+		Mutex::Lock _l(_lock);
+		path = _path;
+		start = _start;
+		packets = _packets;
+		bytes = _bytes;
+		maxBytes = _maxBytes;
+		return (_f != (FILE *)0);
+	}
+
+private:
+	inline uint8_t _socketIndex(const int64_t localSocket)
+	{
+		if (localSocket == -1)
+			return ZT_WIRE_RECORDER_SOCKET_TCP;
+		for(std::size_t i=0;i<_sockets.size();++i) {
+			if (_sockets[i] == localSocket)
+				return (uint8_t)i;
+		}
+		if (_sockets.size() < (ZT_WIRE_RECORDER_SOCKET_TCP - 1))
+			_sockets.push_back(localSocket);
+		return (uint8_t)(_sockets.size() - 1); // the last index is shared once they're used up
+	}
+
+	inline void _close()
+	{
+		_active.store(false,std::memory_order_relaxed);
+		if (_f) {
+			fclose(_f);
+			_f = (FILE *)0;
+		}
+		delete [] _buf;
+		_buf = (char *)0;
+	}
+
+	WireRecorder(const WireRecorder &) {}
+	inline WireRecorder &operator=(const WireRecorder &) { return *this; }
+
+	std::atomic<bool> _active;
+	Mutex _lock;
+	FILE *_f;
+	char *_buf;
+	std::string _path;
+	int64_t _start;
+	uint64_t _maxBytes;
+	uint64_t _bytes;
+	uint64_t _packets;
+	std::vector<int64_t> _sockets;
+};
+
+} // namespace ZeroTier
+
+#endif
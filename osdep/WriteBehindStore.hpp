@@ -0,0 +1,242 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_WRITEBEHINDSTORE_HPP
+#define ZT_WRITEBEHINDSTORE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include "OSUtils.hpp"
+
+// How long the writer waits after the first put before writing, so repeated puts to an object coalesce
+#define ZT_WRITE_BEHIND_BATCH_DELAY 250
+
+// Puts block once this many bytes are waiting to be written
+#define ZT_WRITE_BEHIND_MAX_PENDING_BYTES 16777216
+
+namespace ZeroTier {
+
+/**
+ * Writes small files on a background thread
+ *
+ * put() queues a file's new contents (or its deletion) and returns. A put
+ * to a file that is still queued replaces the queued contents, so an object
+ * saved many times in quick succession is written once. Each file is
+ * written to a temporary file and renamed into place so a crash never
+ * leaves a partly written one. Puts block while too much is queued, which
+ * only happens if storage can't keep up. get() returns queued contents so
+ * readers see puts that haven't reached disk yet.
+ */
+class WriteBehindStore
+{
+public:
+	WriteBehindStore() :
+		_pendingBytes(0),
+		_flushes(0),
+		_flushed(0),
+		_run(true)
+	{
+		_thread = std::thread(&WriteBehindStore::_threadMain,this);
+	}
+
+	~WriteBehindStore()
+	{
+		{
+			std::lock_guard<std::mutex> l(_lock);
+			_run = false;
+		}
+		_wake.notify_all();
+		_thread.join();
+	}
+
+	/**
+	 * Queue a file's new contents
+	 *
+	 * @param path File to write
+	 * @param dir Directory to create if the file can't be created, or empty for none
+	 * @param data File contents
+	 * @param len Length of contents, or negative to delete the file
+	 * @param secure If true, restrict permissions to the owner
+	 */
+	inline void put(const std::string &path,const std::string &dir,const void *data,const int len,const bool secure)
+	{
+		std::unique_lock<std::mutex> l(_lock);
+		while ((_pendingBytes >= ZT_WRITE_BEHIND_MAX_PENDING_BYTES)&&(_run))
+			_done.wait(l);
+		_File &f = _pending[path];
+		_pendingBytes -= f.data.length();
+		if (len >= 0)
+			f.data.assign(reinterpret_cast<const char *>(data),(unsigned long)len);
+		else f.data.clear();
+		_pendingBytes += f.data.length();
+		f.dir = dir;
+		f.remove = (len < 0);
+		f.secure = secure;
+		_wake.notify_one();
+	}
+
+	/**
+	 * Get a file's contents if a write of it hasn't finished yet
+	 *
+	 * @param path File to look up
+	 * @param data Buffer to fill
+	 * @param maxlen Size of buffer
+	 * @return Bytes copied, -1 if the file is being deleted, or -2 if nothing is queued (read the file)
+	 */
+	inline int get(const std::string &path,void *data,const unsigned int maxlen)
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		std::map<std::string,_File>::const_iterator f(_pending.find(path));
+		if (f == _pending.end()) {
+			f = _writing.find(path);
+			if (f == _writing.end())
+				return -2;
+		}
+		if (f->second.remove)
+			return -1;
+		const unsigned int n = (f->second.data.length() < maxlen) ? (unsigned int)f->second.data.length() : maxlen;
+		memcpy(data,f->second.data.data(),n);
+		return (int)n;
+	}
+
+	/**
+	 * Write everything queued now and wait until it's on disk
+	 */
+	inline void flush()
+	{
+		std::unique_lock<std::mutex> l(_lock);
+		const uint64_t want = ++_flushes;
+		_wake.notify_one();
+		while ((_flushed < want)&&(_run))
+			_done.wait(l);
+	}
+
+private:
+	struct _File
+	{
+		_File() : remove(false),secure(false) {}
+		std::string data;
+		std::string dir;
+		bool remove;
+		bool secure;
+	};
+
+	void _threadMain()
+	{
+		std::unique_lock<std::mutex> l(_lock);
+		for(;;) {
+			while ((_pending.empty())&&(_flushed == _flushes)&&(_run))
+				_wake.wait(l);
+
+			// Give repeated puts a moment to coalesce unless someone is waiting
+			const std::chrono::steady_clock::time_point until(std::chrono::steady_clock::now() + std::chrono::milliseconds(ZT_WRITE_BEHIND_BATCH_DELAY));
+			while ((_flushed == _flushes)&&(_pendingBytes < ZT_WRITE_BEHIND_MAX_PENDING_BYTES)&&(_run)) {
+				if (_wake.wait_until(l,until) == std::cv_status::timeout)
+					break;
+			}
+
+			const uint64_t flushes = _flushes;
+			_writing.swap(_pending);
+			_pendingBytes = 0;
+			l.unlock();
+			for(std::map<std::string,_File>::const_iterator f(_writing.begin());f!=_writing.end();++f)
+				_write(f->first,f->second);
+			l.lock();
+			_writing.clear();
+			_flushed = flushes;
+			_done.notify_all();
+
+			if ((!_run)&&(_pending.empty()))
+				break;
+		}
+	}
+
+	static void _write(const std::string &path,const _File &f)
+	{
+		if (f.remove) {
+			OSUtils::rm(path);
+			return;
+		}
+
+		// Leave the file alone if it already has these contents
+		FILE *fp = fopen(path.c_str(),"rb");
+		if (fp) {
+			char buf[65535];
+			const long l = (long)fread(buf,1,sizeof(buf),fp);
+			fclose(fp);
+			if ((l == (long)f.data.length())&&(memcmp(f.data.data(),buf,l) == 0))
+				return;
+		}
+
+		const std::string tmp(path + ".tmp");
+		fp = fopen(tmp.c_str(),"wb");
+		if ((!fp)&&(f.dir.length() > 0)) { // create subdirectory if it does not exist
+			OSUtils::mkdir(f.dir);
+			fp = fopen(tmp.c_str(),"wb");
+		}
+		if (!fp) {
+			fprintf(stderr,"WARNING: unable to write to file: %s (unable to open)" ZT_EOL_S,path.c_str());
+			return;
+		}
+		const bool ok = ((f.data.length() == 0)||(fwrite(f.data.data(),f.data.length(),1,fp) == 1));
+		fclose(fp);
+		if (!ok) {
+			fprintf(stderr,"WARNING: unable to write to file: %s (I/O error)" ZT_EOL_S,path.c_str());
+			OSUtils::rm(tmp);
+			return;
+		}
+		if (f.secure)
+			OSUtils::lockDownFile(tmp.c_str(),false);
+		if (!OSUtils::rename(tmp.c_str(),path.c_str())) {
+			fprintf(stderr,"WARNING: unable to write to file: %s (unable to rename)" ZT_EOL_S,path.c_str());
+			OSUtils::rm(tmp);
+		}
+	}
+
+	std::map<std::string,_File> _pending;
+	std::map<std::string,_File> _writing;
+	unsigned long _pendingBytes;
+	uint64_t _flushes;
+	uint64_t _flushed;
+	bool _run;
+	std::mutex _lock;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+	std::thread _thread;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -33,12 +33,21 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <thread>
+#include <atomic>
 
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
+#include "node/TimerWheel.hpp"
+#include "node/CompiledRules.hpp"
+#include "node/BridgeRouteTable.hpp"
+#include "node/PrefixTrie.hpp"
+#include "node/Epoch.hpp"
 #include "node/RuntimeEnvironment.hpp"
 #include "node/InetAddress.hpp"
+#include "node/PackedInetAddress.hpp"
 #include "node/Utils.hpp"
 #include "node/Identity.hpp"
 #include "node/Buffer.hpp"
@@ -47,18 +56,41 @@
 #include "node/MAC.hpp"
 #include "node/NetworkConfig.hpp"
 #include "node/Peer.hpp"
+#include "node/ObjectPool.hpp"
+#include "node/HugePages.hpp"
+#include "node/IdentityValidationCache.hpp"
+#include "node/Admission.hpp"
 #include "node/Dictionary.hpp"
 #include "node/SHA512.hpp"
 #include "node/C25519.hpp"
 #include "node/Poly1305.hpp"
+#include "node/AES.hpp"
 #include "node/CertificateOfMembership.hpp"
+#include "node/Membership.hpp"
 #include "node/Node.hpp"
+#include "node/Shaper.hpp"
+#include "node/SelfAwareness.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/Metrics.hpp"
+#include "node/TraceRing.hpp"
+#include "node/FrameCapture.hpp"
+#include "node/TopTalkers.hpp"
+#include "node/FlowTable.hpp"
+#include "node/StateSnapshot.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Phy.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
+#include "osdep/WireRecorder.hpp"
+#include "osdep/PeerStateFile.hpp"
+#include "osdep/ByteRing.hpp"
+#include "osdep/IpfixExporter.hpp"
+#include "osdep/LinuxTapFilter.hpp"
+
+#include "controller/TraceLog.hpp"
+
+#include "service/SoftwareUpdater.hpp"
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
 #include "ext/x64-salsa2012-asm/salsa2012.h"
@@ -94,6 +126,18 @@ static const unsigned char poly1305TV1Input[12] = { 0x48,0x65,0x6c,0x6c,0x6f,0x2
 static const unsigned char poly1305TV1Key[32] = { 0x74,0x68,0x69,0x73,0x20,0x69,0x73,0x20,0x33,0x32,0x2d,0x62,0x79,0x74,0x65,0x20,0x6b,0x65,0x79,0x20,0x66,0x6f,0x72,0x20,0x50,0x6f,0x6c,0x79,0x31,0x33,0x30,0x35 };
 static const unsigned char poly1305TV1Tag[16] = { 0xa6,0xf7,0x45,0x00,0x8f,0x81,0xc9,0x16,0xa2,0x0d,0xcc,0x74,0xee,0xf2,0xb2,0xf0 };
 
+static const unsigned char aesTV0Key[32] = { 0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f };
+static const unsigned char aesTV0In[16] = { 0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff };
+static const unsigned char aesTV0Out[16] = { 0x8e,0xa2,0xb7,0xca,0x51,0x67,0x45,0xbf,0xea,0xfc,0x49,0x90,0x4b,0x49,0x60,0x89 };
+
+// AES-256-GCM test case 16 from "The Galois/Counter Mode of Operation"
+static const unsigned char aesGcmTV0Key[32] = { 0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08,0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08 };
+static const unsigned char aesGcmTV0Iv[12] = { 0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88 };
+static const unsigned char aesGcmTV0Aad[20] = { 0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xab,0xad,0xda,0xd2 };
+static const unsigned char aesGcmTV0In[60] = { 0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,0xba,0x63,0x7b,0x39 };
+static const unsigned char aesGcmTV0Out[60] = { 0x52,0x2d,0xc1,0xf0,0x99,0x56,0x7d,0x07,0xf4,0x7f,0x37,0xa3,0x2a,0x84,0x42,0x7d,0x64,0x3a,0x8c,0xdc,0xbf,0xe5,0xc0,0xc9,0x75,0x98,0xa2,0xbd,0x25,0x55,0xd1,0xaa,0x8c,0xb0,0x8e,0x48,0x59,0x0d,0xbb,0x3d,0xa7,0xb0,0x8b,0x10,0x56,0x82,0x88,0x38,0xc5,0xf6,0x1e,0x63,0x93,0xba,0x7a,0x0a,0xbc,0xc9,0xf6,0x62 };
+static const unsigned char aesGcmTV0Tag[16] = { 0x76,0xfc,0x6e,0xce,0x0f,0x4e,0x17,0x68,0xcd,0xdf,0x88,0x53,0xbb,0x2d,0x55,0x1b };
+
 static const char *sha512TV0Input = "supercalifragilisticexpealidocious";
 static const unsigned char sha512TV0Digest[64] = { 0x18,0x2a,0x85,0x59,0x69,0xe5,0xd3,0xe6,0xcb,0xf6,0x05,0x24,0xad,0xf2,0x88,0xd1,0xbb,0xf2,0x52,0x92,0x81,0x24,0x31,0xf6,0xd2,0x52,0xf1,0xdb,0xc1,0xcb,0x44,0xdf,0x21,0x57,0x3d,0xe1,0xb0,0x6b,0x68,0x75,0x95,0x9f,0x3b,0x6f,0x87,0xb1,0x13,0x81,0xd0,0xbc,0x79,0x2c,0x43,0x3a,0x13,0x55,0x3c,0xe0,0x84,0xc2,0x92,0x55,0x31,0x1c };
 
@@ -158,6 +202,40 @@ static int testCrypto()
 		std::cout << "[crypto] getSecureRandom: " << Utils::hex(buf1,64,hexbuf) << std::endl;
 	}
 
+	std::cout << "[crypto] Testing getSecureRandom across threads... "; std::cout.flush();
+	{
+		// Each thread has its own generator, so check that no two produce the same stream
+		std::vector< std::vector<uint8_t> > out(4,std::vector<uint8_t>(40000));
+		std::vector<std::thread> threads;
+		for(unsigned int t=0;t<out.size();++t) {
+			threads.push_back(std::thread([&out,t]() {
+				for(unsigned int i=0;i<out[t].size();i+=100)
+					Utils::getSecureRandom(out[t].data() + i,100);
+			}));
+		}
+		for(unsigned int t=0;t<threads.size();++t)
+			threads[t].join();
+		unsigned long counts[256];
+		memset(counts,0,sizeof(counts));
+		for(unsigned int t=0;t<out.size();++t) {
+			for(unsigned int u=t+1;u<out.size();++u) {
+				if ((memcmp(out[t].data(),out[u].data(),32) == 0)||(memcmp(out[t].data() + 20000,out[u].data() + 20000,32) == 0)) {
+					std::cout << "FAILED! (threads produced the same bytes)" << std::endl;
+					return -1;
+				}
+			}
+			for(unsigned int i=0;i<out[t].size();++i)
+				++counts[out[t][i]];
+		}
+		for(unsigned int b=0;b<256;++b) {
+			if ((counts[b] < 400)||(counts[b] > 850)) { // expected 625
+				std::cout << "FAILED! (byte " << b << " seen " << counts[b] << " times)" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[crypto] Testing Salsa20... "; std::cout.flush();
 	for(unsigned int i=0;i<4;++i) {
 		for(unsigned int k=0;k<sizeof(buf1);++k)
@@ -192,14 +270,44 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	const Salsa20::Kernel bestS20Kernel = Salsa20::kernel();
+	for(int kn=(int)Salsa20::KERNEL_SSE2_X4;kn<=(int)Salsa20::KERNEL_NEON_X4;++kn) {
+		if (!Salsa20::kernelSupported((Salsa20::Kernel)kn))
+			continue;
+		std::cout << "[crypto] Testing Salsa20/12 " << Salsa20::kernelName((Salsa20::Kernel)kn) << " kernel... "; std::cout.flush();
+		for(unsigned int i=0;i<64;++i) {
+			const unsigned int len = (unsigned int)(rand() % sizeof(buf1));
+			const unsigned int split = (len > 0) ? (unsigned int)(rand() % len) & ~63U : 0;
+			for(unsigned int k=0;k<len;++k)
+				buf1[k] = (unsigned char)rand();
+			Salsa20::setKernel(Salsa20::KERNEL_DEFAULT);
+			s20.init(s2012TV0Key,s2012TV0Iv);
+			s20.crypt12(buf1,buf2,len);
+			Salsa20::setKernel((Salsa20::Kernel)kn);
+			s20.init(s2012TV0Key,s2012TV0Iv);
+			s20.crypt12(buf1,buf3,split);
+			s20.crypt12(buf1 + split,buf3 + split,len - split);
+			if (memcmp(buf2,buf3,len)) {
+				Salsa20::setKernel(bestS20Kernel);
+				std::cout << "FAIL (length " << len << ", split " << split << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+	Salsa20::setKernel(bestS20Kernel);
+	std::cout << "[crypto] Salsa20/12 selected kernel: " << Salsa20::kernelName(bestS20Kernel) << std::endl;
+
 #ifdef ZT_SALSA20_SSE
 	std::cout << "[crypto] Salsa20 SSE: ENABLED" << std::endl;
 #else
 	std::cout << "[crypto] Salsa20 SSE: DISABLED" << std::endl;
 #endif
 
-	std::cout << "[crypto] Benchmarking Salsa20/12... "; std::cout.flush();
-	{
+	for(int kn=(int)Salsa20::KERNEL_DEFAULT;kn<=(int)Salsa20::KERNEL_NEON_X4;++kn) {
+		if (!Salsa20::setKernel((Salsa20::Kernel)kn))
+			continue;
+		std::cout << "[crypto] Benchmarking Salsa20/12 (" << Salsa20::kernelName((Salsa20::Kernel)kn) << ")... "; std::cout.flush();
 		unsigned char *bb = (unsigned char *)::malloc(1234567);
 		for(unsigned int i=0;i<1234567;++i)
 			bb[i] = (unsigned char)i;
@@ -212,9 +320,10 @@ static int testCrypto()
 		}
 		uint64_t end = OSUtils::now();
 		SHA512::hash(buf1,bb,1234567);
-		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1024.0)) << " MiB/second (" << Utils::hex(buf1,16,hexbuf) << ')' << std::endl;
+		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1000.0)) << " MiB/second (" << Utils::hex(buf1,16,hexbuf) << ')' << std::endl;
 		::free((void *)bb);
 	}
+	Salsa20::setKernel(bestS20Kernel);
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
 	std::cout << "[crypto] Benchmarking Salsa20/12 fast x64 ASM... "; std::cout.flush();
@@ -289,8 +398,46 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
-	std::cout << "[crypto] Benchmarking Poly1305... "; std::cout.flush();
-	{
+	const Poly1305::Kernel bestP1305Kernel = Poly1305::kernel();
+	for(int kn=(int)Poly1305::KERNEL_AVX2_X4;kn<=(int)Poly1305::KERNEL_NEON_X4;++kn) {
+		if (!Poly1305::kernelSupported((Poly1305::Kernel)kn))
+			continue;
+		std::cout << "[crypto] Testing Poly1305 " << Poly1305::kernelName((Poly1305::Kernel)kn) << " kernel... "; std::cout.flush();
+		for(unsigned int i=0;i<256;++i) {
+			const unsigned int len = (unsigned int)(rand() % 4096);
+			const unsigned int split = (len > 0) ? (unsigned int)(rand() % len) : 0;
+			for(unsigned int k=0;k<len;++k)
+				buf1[k] = (unsigned char)rand();
+			for(unsigned int k=0;k<32;++k)
+				buf1[8192 + k] = (unsigned char)rand();
+			Poly1305::setKernel(Poly1305::KERNEL_DEFAULT);
+			Poly1305::compute(buf2,buf1,len,buf1 + 8192);
+			Poly1305::setKernel((Poly1305::Kernel)kn);
+			Poly1305 p1305(buf1 + 8192);
+			p1305.update(buf1,split);
+			p1305.update(buf1 + split,len - split);
+			p1305.finish(buf3);
+			if (memcmp(buf2,buf3,16)) {
+				Poly1305::setKernel(bestP1305Kernel);
+				std::cout << "FAIL (length " << len << ", split " << split << ")" << std::endl;
+				return -1;
+			}
+		}
+		Poly1305::compute(buf2,poly1305TV0Input,sizeof(poly1305TV0Input),poly1305TV0Key);
+		if (memcmp(buf2,poly1305TV0Tag,16)) {
+			Poly1305::setKernel(bestP1305Kernel);
+			std::cout << "FAIL (test vector)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+	Poly1305::setKernel(bestP1305Kernel);
+	std::cout << "[crypto] Poly1305 selected kernel: " << Poly1305::kernelName(bestP1305Kernel) << std::endl;
+
+	for(int kn=(int)Poly1305::KERNEL_DEFAULT;kn<=(int)Poly1305::KERNEL_NEON_X4;++kn) {
+		if (!Poly1305::setKernel((Poly1305::Kernel)kn))
+			continue;
+		std::cout << "[crypto] Benchmarking Poly1305 (" << Poly1305::kernelName((Poly1305::Kernel)kn) << ")... "; std::cout.flush();
 		unsigned char *bb = (unsigned char *)::malloc(1234567);
 		for(unsigned int i=0;i<1234567;++i)
 			bb[i] = (unsigned char)i;
@@ -304,6 +451,76 @@ static int testCrypto()
 		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1000.0)) << " MiB/second" << std::endl;
 		::free((void *)bb);
 	}
+	Poly1305::setKernel(bestP1305Kernel);
+
+	std::cout << "[crypto] Testing AES-256 and AES-256-GCM... "; std::cout.flush();
+	{
+		const AES::Kernel bestAesKernel = AES::kernel();
+		for(int kn=(int)AES::KERNEL_DEFAULT;kn<=(int)AES::KERNEL_AESNI;++kn) {
+			if (!AES::setKernel((AES::Kernel)kn))
+				continue;
+			AES aes(aesTV0Key);
+			aes.encrypt(aesTV0In,buf1);
+			if (memcmp(buf1,aesTV0Out,16)) {
+				AES::setKernel(bestAesKernel);
+				std::cout << "FAIL (AES-256 test vector, " << AES::kernelName((AES::Kernel)kn) << ")" << std::endl;
+				return -1;
+			}
+			AES gcm(aesGcmTV0Key);
+			gcm.gcmEncrypt(aesGcmTV0Iv,aesGcmTV0Aad,sizeof(aesGcmTV0Aad),aesGcmTV0In,buf1,sizeof(aesGcmTV0In),buf2);
+			if ((memcmp(buf1,aesGcmTV0Out,sizeof(aesGcmTV0Out)))||(memcmp(buf2,aesGcmTV0Tag,16))) {
+				AES::setKernel(bestAesKernel);
+				std::cout << "FAIL (AES-256-GCM test vector, " << AES::kernelName((AES::Kernel)kn) << ")" << std::endl;
+				return -1;
+			}
+			if (!gcm.gcmDecrypt(aesGcmTV0Iv,aesGcmTV0Aad,sizeof(aesGcmTV0Aad),aesGcmTV0Out,buf1,sizeof(aesGcmTV0Out),aesGcmTV0Tag,16)||(memcmp(buf1,aesGcmTV0In,sizeof(aesGcmTV0In)))) {
+				AES::setKernel(bestAesKernel);
+				std::cout << "FAIL (AES-256-GCM decrypt, " << AES::kernelName((AES::Kernel)kn) << ")" << std::endl;
+				return -1;
+			}
+			buf2[3] ^= 0x10;
+			if (gcm.gcmDecrypt(aesGcmTV0Iv,aesGcmTV0Aad,sizeof(aesGcmTV0Aad),aesGcmTV0Out,buf1,sizeof(aesGcmTV0Out),buf2,16)) {
+				AES::setKernel(bestAesKernel);
+				std::cout << "FAIL (AES-256-GCM bad tag accepted, " << AES::kernelName((AES::Kernel)kn) << ")" << std::endl;
+				return -1;
+			}
+		}
+
+		// Kernels must agree for any length and split, including the eight and four block paths
+		for(int kn=(int)AES::KERNEL_AESNI;kn<=(int)AES::KERNEL_AESNI;++kn) {
+			if (!AES::kernelSupported((AES::Kernel)kn))
+				continue;
+			for(unsigned int i=0;i<256;++i) {
+				const unsigned int len = (unsigned int)(rand() % 4096);
+				const unsigned int split = (len > 0) ? ((unsigned int)(rand() % len) & 0xfffffff0) : 0;
+				for(unsigned int k=0;k<len;++k)
+					buf1[k] = (unsigned char)rand();
+				for(unsigned int k=0;k<64;++k)
+					buf1[8192 + k] = (unsigned char)rand();
+				AES::setKernel(AES::KERNEL_DEFAULT);
+				AES a0(buf1 + 8192);
+				a0.gcmEncrypt(buf1 + 8224,buf1 + 8240,(unsigned int)(i % 24),buf1,buf2,len,buf2 + 8192);
+				AES::setKernel((AES::Kernel)kn);
+				AES a1(buf1 + 8192);
+				a1.gcmEncrypt(buf1 + 8224,buf1 + 8240,(unsigned int)(i % 24),buf1,buf3,len,buf3 + 8192);
+				uint8_t cb0[16],cb1[16];
+				memcpy(cb0,buf1 + 8224,16);
+				memcpy(cb1,cb0,16);
+				AES::setKernel(AES::KERNEL_DEFAULT);
+				a0.ctr(cb0,buf1,buf2 + 4096,len);
+				AES::setKernel((AES::Kernel)kn);
+				a1.ctr(cb1,buf1,buf3 + 4096,split);
+				a1.ctr(cb1,buf1 + split,buf3 + 4096 + split,len - split);
+				if ((memcmp(buf2,buf3,len))||(memcmp(buf2 + 8192,buf3 + 8192,16))||(memcmp(buf2 + 4096,buf3 + 4096,len))||(memcmp(cb0,cb1,16))) {
+					AES::setKernel(bestAesKernel);
+					std::cout << "FAIL (" << AES::kernelName((AES::Kernel)kn) << " kernel, length " << len << ", split " << split << ")" << std::endl;
+					return -1;
+				}
+			}
+		}
+		AES::setKernel(bestAesKernel);
+		std::cout << "PASS (selected kernel: " << AES::kernelName(bestAesKernel) << ")" << std::endl;
+	}
 
 	/*
 	for(unsigned int d=8;d<=10;++d) {
@@ -348,6 +565,62 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[crypto] Testing C25519 and Ed25519 backends against the reference... "; std::cout.flush();
+	{
+		const C25519::Backend bestBackend = C25519::backend();
+		for(int b=(int)C25519::BACKEND_REF + 1;b<=(int)C25519::BACKEND_AMD64;++b) {
+			if (!C25519::backendSupported((C25519::Backend)b))
+				continue;
+			std::cout << C25519::backendName((C25519::Backend)b) << ' '; std::cout.flush();
+			for(unsigned int i=0;i<64;++i) {
+				C25519::Pair kp;
+				C25519::Public pub;
+				Utils::getSecureRandom(kp.priv.data,sizeof(kp.priv.data));
+				Utils::getSecureRandom(pub.data,sizeof(pub.data));
+				if (i < 6) {
+					// Edge cases of the peer's X25519 key: 0, 1, p - 1, p, p + 1 and 2^256 - 1
+					static const uint8_t lowByte[6] = { 0x00,0x01,0xec,0xed,0xee,0xff };
+					memset(pub.data,(i >= 2) ? 0xff : 0,32);
+					pub.data[0] = lowByte[i];
+					if ((i >= 2)&&(i <= 4))
+						pub.data[31] = 0x7f;
+				}
+				uint8_t msg[100];
+				Utils::getSecureRandom(msg,sizeof(msg));
+
+				C25519::setBackend(C25519::BACKEND_REF);
+				const C25519::Pair ref(C25519::generate());
+				uint8_t refKey[64];
+				C25519::agree(kp.priv,pub,refKey,sizeof(refKey));
+				const C25519::Signature refSig(C25519::sign(ref,msg,sizeof(msg)));
+
+				C25519::setBackend((C25519::Backend)b);
+				const C25519::Pair gen(C25519::generate());
+				uint8_t key[64];
+				C25519::agree(kp.priv,pub,key,sizeof(key));
+				const C25519::Signature sig(C25519::sign(ref,msg,sizeof(msg)));
+				C25519::Signature bad(sig);
+				bad.data[i % 64] ^= 0x10;
+				bool ok = ((!memcmp(key,refKey,sizeof(key)))&&(!memcmp(sig.data,refSig.data,sizeof(sig.data)))&&(C25519::verify(ref.pub,msg,sizeof(msg),sig))&&(!C25519::verify(ref.pub,msg,sizeof(msg),bad)));
+
+				// Keys generated by this backend must work with the reference
+				C25519::setBackend(C25519::BACKEND_REF);
+				uint8_t k1[64],k2[64];
+				C25519::agree(ref,gen.pub,k1,sizeof(k1));
+				C25519::agree(gen,ref.pub,k2,sizeof(k2));
+				ok &= ((!memcmp(k1,k2,sizeof(k1)))&&(C25519::verify(gen.pub,msg,sizeof(msg),C25519::sign(gen,msg,sizeof(msg)))));
+
+				if (!ok) {
+					C25519::setBackend(bestBackend);
+					std::cout << "FAIL (" << C25519::backendName((C25519::Backend)b) << ")" << std::endl;
+					return -1;
+				}
+			}
+		}
+		C25519::setBackend(bestBackend);
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[crypto] Testing C25519 ECC key agreement... "; std::cout.flush();
 	for(unsigned int i=0;i<100;++i) {
 		memset(buf1,64,sizeof(buf1));
@@ -419,6 +692,79 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+	std::cout << "[crypto] Testing Ed25519 batch verification... "; std::cout.flush();
+	{
+		C25519::Pair bkp[4];
+		C25519::Public bpub[20];
+		C25519::Signature bsig[20];
+		unsigned char bmsg[20][64];
+		const void *bmsgp[20];
+		unsigned int blen[20];
+		bool bvalid[20];
+		for(int k=0;k<4;++k)
+			bkp[k] = C25519::generate();
+		for(unsigned int i=0;i<20;++i) {
+			Utils::getSecureRandom(bmsg[i],sizeof(bmsg[i]));
+			bmsgp[i] = bmsg[i];
+			blen[i] = 1 + (i * 3);
+			bpub[i] = bkp[i & 3].pub;
+			bsig[i] = C25519::sign(bkp[i & 3],bmsg[i],blen[i]);
+		}
+		for(unsigned int n=1;n<=20;++n) {
+			if (!C25519::verifyBatch(bpub,bmsgp,blen,bsig,n,bvalid)) {
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+		}
+		for(unsigned int k=0;k<32;++k) {
+			const unsigned int bad = (unsigned int)rand() % 20;
+			C25519::Signature sv(bsig[bad]);
+			if ((k & 3) == 0)
+				++bmsg[bad][0];
+			else bsig[bad].data[rand() % 64] ^= (unsigned char)(1 << (rand() & 7));
+			if (C25519::verifyBatch(bpub,bmsgp,blen,bsig,20,bvalid)) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
+			for(unsigned int i=0;i<20;++i) {
+				if (bvalid[i] != (i != bad)) {
+					std::cout << "FAIL (3)" << std::endl;
+					return -1;
+				}
+			}
+			if ((k & 3) == 0)
+				--bmsg[bad][0];
+			bsig[bad] = sv;
+		}
+		std::cout << "PASS" << std::endl;
+
+		// Batching must never cost more than verifying one at a time where it's used
+		std::cout << "[crypto] Benchmarking Ed25519 batch verification... "; std::cout.flush();
+		const C25519::Backend bestBackend = C25519::backend();
+		for(int b=(int)C25519::BACKEND_REF;b<=(int)C25519::BACKEND_AMD64;++b) {
+			if ((!C25519::setBackend((C25519::Backend)b))||(!C25519::batchVerifySupported()))
+				continue;
+			st = OSUtils::now();
+			for(int k=0;k<10;++k) {
+				for(unsigned int i=0;i<16;++i)
+					C25519::verify(bpub[i],bmsgp[i],blen[i],bsig[i]);
+			}
+			const int64_t individual = OSUtils::now() - st;
+			st = OSUtils::now();
+			for(int k=0;k<10;++k)
+				C25519::verifyBatch(bpub,bmsgp,blen,bsig,16,bvalid);
+			const int64_t batched = OSUtils::now() - st;
+			std::cout << C25519::backendName((C25519::Backend)b) << ' ' << ((double)individual / 160.0) << "ms individually, " << ((double)batched / 160.0) << "ms batched; "; std::cout.flush();
+			if (batched > ((individual * 3) / 2) + 2) {
+				C25519::setBackend(bestBackend);
+				std::cout << "FAIL (batch slower than individual)" << std::endl;
+				return -1;
+			}
+		}
+		C25519::setBackend(bestBackend);
+		std::cout << "PASS" << std::endl;
+	}
+
 	std::cout << "[crypto] Benchmarking Ed25519 ECC signatures... "; std::cout.flush();
 	st = OSUtils::now();
 	for(int k=0;k<1000;++k) {
@@ -478,6 +824,22 @@ static int testIdentity()
 		}
 	}
 
+	for(unsigned int k=0;k<2;++k) {
+		std::cout << "[identity] Generate identity using all cores... "; std::cout.flush();
+		uint64_t candidates = 0;
+		uint64_t genstart = OSUtils::now();
+		id.generate(0,&candidates);
+		uint64_t genend = OSUtils::now();
+		std::cout << "(took " << (genend - genstart) << "ms, " << candidates << " candidates): " << id.address().toString(buf2) << std::endl;
+		std::cout << "[identity] Locally validate identity: ";
+		if ((candidates > 0)&&(id.locallyValidate())) {
+			std::cout << "PASS" << std::endl;
+		} else {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+	}
+
 	{
 		Identity id2;
 		buf.clear();
@@ -530,6 +892,75 @@ static int testIdentity()
 		}
 	}
 
+	{
+		std::cout << "[identity] Identity validation cache: "; std::cout.flush();
+		IdentityValidationCache ivc(ZT_IDENTITY_VALIDATION_CACHE_SHARDS * 2);
+		Identity known;
+		known.fromString(KNOWN_GOOD_IDENTITY);
+		if ((ivc.check(id))||(!ivc.locallyValidate(id))||(!ivc.check(id))||(ivc.check(known))) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		// Same address with a different key must not hit
+		Identity forged;
+		buf.clear();
+		known.serialize(buf,false);
+		id.address().copyTo(buf.unsafeData(),ZT_ADDRESS_LENGTH);
+		forged.deserialize(buf);
+		if ((forged.address() != id.address())||(ivc.check(forged))||(ivc.locallyValidate(forged))) {
+			std::cout << "FAIL (2)" << std::endl;
+			return -1;
+		}
+		// Fill the cache way past capacity with fake entries
+		for(uint64_t a=1;a<=1024;++a) {
+			buf.clear();
+			known.serialize(buf,false);
+			Address(a).copyTo(buf.unsafeData(),ZT_ADDRESS_LENGTH);
+			forged.deserialize(buf);
+			ivc.add(forged);
+		}
+		uint64_t hits = 0,misses = 0;
+		ivc.stats(hits,misses);
+		if ((ivc.size() > (ZT_IDENTITY_VALIDATION_CACHE_SHARDS * 2))||(ivc.check(id))||(hits != 1)||(misses != 5)) {
+			std::cout << "FAIL (3)" << std::endl;
+			return -1;
+		}
+		// Shrinking trims each shard and zero turns caching off
+		ivc.setCapacity(ZT_IDENTITY_VALIDATION_CACHE_SHARDS);
+		if (ivc.size() > ZT_IDENTITY_VALIDATION_CACHE_SHARDS) {
+			std::cout << "FAIL (4)" << std::endl;
+			return -1;
+		}
+		ivc.setCapacity(0);
+		ivc.add(id);
+		if ((ivc.size() != 0)||(ivc.check(id))) {
+			std::cout << "FAIL (5)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[identity] Peer cache with sealed agreed key: "; std::cout.flush();
+		RuntimeEnvironment rr((Node *)0);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		uint8_t cacheKey[32],wrongKey[32];
+		Utils::getSecureRandom(cacheKey,sizeof(cacheKey));
+		Utils::getSecureRandom(wrongKey,sizeof(wrongKey));
+		const SharedPtr<Peer> p(new Peer(&rr,rr.identity,id));
+		for(int k=0;k<3;++k) {
+			Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> pbuf;
+			p->serializeForCache(pbuf,(k == 2) ? (const uint8_t *)0 : cacheKey);
+			bool cachedKeyUsed = (k != 0);
+			const SharedPtr<Peer> p2(Peer::deserializeFromCache(0,(void *)0,pbuf,&rr,(k == 1) ? wrongKey : cacheKey,&cachedKeyUsed));
+			if ((!p2)||(p2->identity() != id)||(cachedKeyUsed != (k == 0))||(memcmp(p2->key(),p->key(),ZT_PEER_SECRET_KEY_LENGTH) != 0)) {
+				std::cout << "FAIL (" << k << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
 	return 0;
 }
 
@@ -630,141 +1061,771 @@ static int testPacket()
 		return -1;
 	}
 
+	{
+		// A small network config compresses better against the preset dictionary than on its own
+		NetworkConfig *nc = new NetworkConfig();
+		nc->networkId = 0x8056c2e21c000001ULL;
+		nc->timestamp = 1000;
+		nc->revision = 7;
+		nc->issuedTo = Address(0x1122334455ULL);
+		nc->type = ZT_NETWORK_TYPE_PRIVATE;
+		nc->mtu = ZT_DEFAULT_MTU;
+		nc->multicastLimit = 32;
+		Utils::scopy(nc->name,sizeof(nc->name),"office-lan");
+		nc->staticIps[nc->staticIpCount++] = InetAddress("10.147.17.5/24");
+		*reinterpret_cast<InetAddress *>(&(nc->routes[nc->routeCount++].target)) = InetAddress("10.147.17.0/24");
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		nc->toDictionary(*d,false);
+		Packet c(Address(),Address(),Packet::VERB_NETWORK_CONFIG);
+		c.append((uint64_t)nc->networkId);
+		c.append((uint16_t)d->sizeBytes());
+		c.append(d->data(),d->sizeBytes());
+		delete d;
+		delete nc;
+		Packet plain(c),dict(c);
+		plain.compress();
+		dict.compress(true);
+		std::cout << "(dictionary: " << (dict.size() - ZT_PACKET_IDX_PAYLOAD) << ", plain: " << (plain.size() - ZT_PACKET_IDX_PAYLOAD) << ", raw: " << (c.size() - ZT_PACKET_IDX_PAYLOAD) << ") ";
+		if ((!dict.compressed())||(dict.size() >= plain.size())) {
+			std::cout << "FAIL (dictionary compression)" << std::endl;
+			return -1;
+		}
+		Packet bad(dict);
+		bad[ZT_PACKET_IDX_PAYLOAD] = (char)(ZT_PROTO_COMPRESSION_DICTIONARY_VERSION + 1);
+		if ((!dict.uncompress())||(dict != c)||(bad.uncompress())) {
+			std::cout << "FAIL (dictionary decompression)" << std::endl;
+			return -1;
+		}
+	}
+
 	a.armor(salsaKey,true);
 	if (!a.dearmor(salsaKey)) {
 		std::cout << "FAIL (encrypt-decrypt/verify)" << std::endl;
 		return -1;
 	}
 
-	std::cout << "PASS" << std::endl;
-	return 0;
-}
-
-static int testOther()
-{
-	char buf[1024];
-	char buf2[4096];
-	char buf3[1024];
-
-	std::cout << "[other] Testing hex/unhex... "; std::cout.flush();
-	Utils::getSecureRandom(buf,(unsigned int)sizeof(buf));
-	Utils::hex(buf,(unsigned int)sizeof(buf),buf2);
-	Utils::unhex(buf2,buf3,(unsigned int)sizeof(buf3));
-	if (memcmp(buf,buf3,sizeof(buf)) == 0) {
-		std::cout << "PASS" << std::endl;
-	} else {
-		std::cout << "FAIL!" << std::endl;
-		buf2[78] = 0;
-		std::cout << buf2 << std::endl;
-		Utils::hex(buf3,(unsigned int)sizeof(buf3),buf2);
-		buf2[78] = 0;
-		std::cout << buf2 << std::endl;
-		return -1;
+	// Packets armored with one Salsa20 kernel must dearmor with any other
+	const Salsa20::Kernel bestS20Kernel = Salsa20::kernel();
+	for(int kn=(int)Salsa20::KERNEL_SSE2_X4;kn<=(int)Salsa20::KERNEL_NEON_X4;++kn) {
+		if (!Salsa20::kernelSupported((Salsa20::Kernel)kn))
+			continue;
+		for(int dir=0;dir<2;++dir) {
+			Salsa20::setKernel((dir) ? (Salsa20::Kernel)kn : Salsa20::KERNEL_DEFAULT);
+			a = b;
+			a.armor(salsaKey,true);
+			Salsa20::setKernel((dir) ? Salsa20::KERNEL_DEFAULT : (Salsa20::Kernel)kn);
+			if ((!a.dearmor(salsaKey))||(a.size() != b.size())||(memcmp(a.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),a.size() - ZT_PACKET_IDX_VERB))) {
+				Salsa20::setKernel(bestS20Kernel);
+				std::cout << "FAIL (armor/dearmor across kernels)" << std::endl;
+				return -1;
+			}
+		}
 	}
-
-	std::cout << "[other] Testing InetAddress encode/decode..."; std::cout.flush();
-	std::cout << " " << InetAddress("127.0.0.1/9993").toString(buf);
-	std::cout << " " << InetAddress("feed:dead:babe:dead:beef:f00d:1234:5678/12345").toString(buf);
-	std::cout << " " << InetAddress("0/9993").toString(buf);
-	std::cout << " " << InetAddress("").toString(buf);
-	std::cout << std::endl;
-
-#if 0
-	std::cout << "[other] Benchmarking memcpy... "; std::cout.flush();
-	{
-		unsigned char *bb = (unsigned char *)::malloc(1234567);
-		unsigned char *cc = (unsigned char *)::malloc(1234567);
-		for(unsigned int i=0;i<1234567;++i)
-			bb[i] = (unsigned char)i;
-		double bytes = 0.0;
-		uint64_t start = OSUtils::now();
-		for(unsigned int i=0;i<20000;++i) {
-			++bb[i];
-			++bb[i+1];
-			memcpy(cc,bb,1234567);
-			bytes += 1234567.0;
+	Salsa20::setKernel(bestS20Kernel);
+
+	// Armoring with a tail must match armoring the same packet built in full
+	Packet big(Address(0x1111111111ULL),Address(0x2222222222ULL),Packet::VERB_FRAME);
+	for(unsigned int i=0;i<5000;++i)
+		big.append((uint8_t)rand());
+	for(int kn=(int)Salsa20::KERNEL_DEFAULT;kn<=(int)Salsa20::KERNEL_NEON_X4;++kn) {
+		if (!Salsa20::setKernel((Salsa20::Kernel)kn))
+			continue;
+		for(unsigned int split=ZT_PACKET_IDX_VERB + 1;split<big.size();split+=97) {
+			for(int enc=0;enc<2;++enc) {
+				a = big;
+				a.armor(salsaKey,enc != 0);
+				Packet c(big);
+				c.setSize(split);
+				c.armor(salsaKey,enc != 0,big.field(split,big.size() - split),big.size() - split);
+				if (a != c) {
+					Salsa20::setKernel(bestS20Kernel);
+					std::cout << "FAIL (armor with tail, split " << split << ")" << std::endl;
+					return -1;
+				}
+			}
 		}
-		if (cc[0] != bb[0])
-			abort();
-		uint64_t end = OSUtils::now();
-		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1024.0)) << " MiB/second" << std::endl;
-		::free((void *)bb);
-		::free((void *)cc);
 	}
-#endif
+	Salsa20::setKernel(bestS20Kernel);
 
-	std::cout << "[other] Benchmarking ZT_FAST_MEMCPY... "; std::cout.flush();
 	{
-		unsigned char *bb = (unsigned char *)::malloc(1234567);
-		unsigned char *cc = (unsigned char *)::malloc(1234567);
-		for(unsigned int i=0;i<1234567;++i)
-			bb[i] = (unsigned char)i;
-		double bytes = 0.0;
-		uint64_t start = OSUtils::now();
-		for(unsigned int i=0;i<20000;++i) {
-			++bb[0];
-			++bb[1234566];
-			ZT_FAST_MEMCPY(cc,bb,1234567);
-			bytes += 1234567.0;
+		Packet::Fragment f(b,100,200,1,3);
+		uint8_t fh[ZT_PROTO_MIN_FRAGMENT_LENGTH];
+		Packet::Fragment::writeHeader(fh,b,1,3);
+		if (memcmp(fh,f.data(),ZT_PROTO_MIN_FRAGMENT_LENGTH) != 0) {
+			std::cout << "FAIL (fragment header)" << std::endl;
+			return -1;
 		}
-		if (cc[0] != bb[0])
-			abort();
-		uint64_t end = OSUtils::now();
-		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1024.0)) << " MiB/second" << std::endl;
-		::free((void *)bb);
-		::free((void *)cc);
 	}
 
-#if 0
-	std::cout << "[other] Testing Hashtable... "; std::cout.flush();
+	a = b;
+	a.armor(salsaKey,true);
+	a[ZT_PACKET_IDX_PAYLOAD + 7] ^= 0x01;
+	if (a.dearmor(salsaKey)) {
+		std::cout << "FAIL (corrupt packet passed dearmor)" << std::endl;
+		return -1;
+	}
+
+	// AES-256-GCM cipher suite, with and without a tail, dearmored with each kernel
 	{
-		Hashtable<uint64_t,std::string> ht;
-		std::map<uint64_t,std::string> ref; // assume std::map works correctly :)
-		for(int x=0;x<2;++x) {
-			for(int i=0;i<77777;++i) {
-				uint64_t k = rand();
-				while ((k == 0)||(ref.count(k) > 0))
-					++k;
-				std::string v("!");
-				for(int j=0;j<(int)(k % 64);++j)
-					v.push_back("0123456789"[rand() % 10]);
-				ref[k] = v;
-				ht.set(0xffffffffffffffffULL,v);
-				std::string &vref = ht[k];
-				vref = v;
-				ht.erase(0xffffffffffffffffULL);
-			}
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (size mismatch, original)" << std::endl;
-				return -1;
-			}
-			{
-				Hashtable<uint64_t,std::string>::Iterator i(ht);
-				uint64_t *k = (uint64_t *)0;
-				std::string *v = (std::string *)0;
-				while(i.next(k,v)) {
-					if (ref.find(*k)->second != *v) {
-						std::cout << "FAILED! (data mismatch!)" << std::endl;
-						return -1;
-					}
+		const AES::Kernel bestAesKernel = AES::kernel();
+		const AES aes(salsaKey);
+		for(int kn=(int)AES::KERNEL_DEFAULT;kn<=(int)AES::KERNEL_AESNI;++kn) {
+			if (!AES::setKernel((AES::Kernel)kn))
+				continue;
+			const AES daes(salsaKey);
+			for(unsigned int split=ZT_PACKET_IDX_VERB + 1;split<big.size();split+=331) {
+				AES::setKernel(bestAesKernel);
+				a = big;
+				a.armor(aes);
+				Packet c(big);
+				c.setSize(split);
+				c.armor(aes,big.field(split,big.size() - split),big.size() - split);
+				AES::setKernel((AES::Kernel)kn);
+				if ((a != c)||(a.cipher() != ZT_PROTO_CIPHER_SUITE__C25519_AES256_GCM)) {
+					AES::setKernel(bestAesKernel);
+					std::cout << "FAIL (AES armor with tail, split " << split << ")" << std::endl;
+					return -1;
 				}
-			}
-			for(std::map<uint64_t,std::string>::const_iterator i(ref.begin());i!=ref.end();++i) {
-				if (ht[i->first] != i->second) {
-					std::cout << "FAILED! (data mismatch!)" << std::endl;
+				a.incrementHops();
+				if ((!a.dearmor(salsaKey,&daes))||(a.size() != big.size())||(memcmp(a.field(ZT_PACKET_IDX_VERB,0),big.field(ZT_PACKET_IDX_VERB,0),a.size() - ZT_PACKET_IDX_VERB))) {
+					AES::setKernel(bestAesKernel);
+					std::cout << "FAIL (AES armor/dearmor, " << AES::kernelName((AES::Kernel)kn) << ")" << std::endl;
+					return -1;
+				}
+				if (c.dearmor(salsaKey)) {
+					AES::setKernel(bestAesKernel);
+					std::cout << "FAIL (AES packet passed dearmor without AES)" << std::endl;
 					return -1;
 				}
 			}
-
-			Hashtable<uint64_t,std::string> ht2;
-			ht2 = ht;
-			Hashtable<uint64_t,std::string> ht3(ht2);
-			if (ht2.size() != ref.size()) {
-				std::cout << "FAILED! (size mismatch, assigned)" << std::endl;
-				return -1;
-			}
-			if (ht3.size() != ref.size()) {
-				std::cout << "FAILED! (size mismatch, copied)" << std::endl;
+		}
+		AES::setKernel(bestAesKernel);
+		const unsigned int corruptAt[3] = { ZT_PACKET_IDX_PAYLOAD + 7,ZT_PACKET_IDX_SOURCE + 1,ZT_PACKET_IDX_FLAGS };
+		for(unsigned int i=0;i<3;++i) {
+			a = b;
+			a.armor(aes);
+			a[corruptAt[i]] ^= 0x20;
+			if (a.dearmor(salsaKey,&aes)) {
+				std::cout << "FAIL (corrupt AES packet passed dearmor at " << corruptAt[i] << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+
+	std::cout << "PASS" << std::endl;
+
+	{
+		std::cout << "[packet] Testing per-thread metrics counters... "; std::cout.flush();
+		ZT_Metrics before,after;
+		memset(&before,0,sizeof(before));
+		Metrics::snapshot(&before);
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		a.reset(Address(),Address(),Packet::VERB_ECHO);
+		a.append((uint64_t)0);
+		const unsigned int echoLen = a.size();
+		for(unsigned int i=0;i<200;++i) {
+			Packet c(a);
+			c.armor(salsaKey,true);
+		}
+		Metrics::networkFrame(nwid,false,1000);
+		std::thread t([&salsaKey,nwid]() {
+			for(unsigned int i=0;i<100;++i) {
+				Packet tp(Address(),Address(),Packet::VERB_ECHO);
+				tp.append((uint64_t)0);
+				tp.armor(salsaKey,true);
+			}
+			Metrics::networkFrame(nwid,false,500);
+			Metrics::networkFrame(nwid,true,50);
+		});
+		t.join(); // thread's counters are retired, not lost
+		{
+			Metrics::DecodeTimer dt;
+			dt.verb(Packet::VERB_ECHO);
+		}
+		memset(&after,0,sizeof(after));
+		Metrics::snapshot(&after);
+		const ZT_NetworkMetrics *nm = (const ZT_NetworkMetrics *)0;
+		for(unsigned int i=0;i<after.networkCount;++i) {
+			if (after.networks[i].networkId == nwid)
+				nm = &(after.networks[i]);
+		}
+		if ((after.packetsOut[Packet::VERB_ECHO] - before.packetsOut[Packet::VERB_ECHO]) != 300) {
+			std::cout << "FAIL (packets out " << (after.packetsOut[Packet::VERB_ECHO] - before.packetsOut[Packet::VERB_ECHO]) << ")" << std::endl;
+			return -1;
+		}
+		if ((after.bytesOut[Packet::VERB_ECHO] - before.bytesOut[Packet::VERB_ECHO]) != (300ULL * echoLen)) {
+			std::cout << "FAIL (bytes out)" << std::endl;
+			return -1;
+		}
+		uint64_t decoded = 0;
+		for(unsigned int i=0;i<ZT_METRICS_LATENCY_BUCKETS;++i)
+			decoded += after.decodeLatency[Packet::VERB_ECHO][i] - before.decodeLatency[Packet::VERB_ECHO][i];
+		if (decoded != 1) {
+			std::cout << "FAIL (decode histogram)" << std::endl;
+			return -1;
+		}
+		if ((!nm)||(nm->framesIn != 2)||(nm->bytesIn != 1500)||(nm->framesOut != 1)||(nm->bytesOut != 50)) {
+			std::cout << "FAIL (network counters)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing trace capture ring... "; std::cout.flush();
+		const int64_t now = OSUtils::now();
+		if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PACKET_INVALID,now)) {
+			std::cout << "FAIL (enabled by default)" << std::endl;
+			return -1;
+		}
+		TraceRing::configure(ZT_REMOTE_TRACE_EVENT__PACKET_INVALID,4,10);
+		unsigned int admitted = 0;
+		for(unsigned int i=0;i<100;++i) {
+			if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__NETWORK_FILTER_TRACE,now))
+				++admitted;
+			if (TraceRing::admit(ZT_REMOTE_TRACE_EVENT__PACKET_INVALID,now)) {
+				TraceRing::Record r(ZT_REMOTE_TRACE_EVENT__PACKET_INVALID,now + i);
+				r.packetId = i;
+				r.verb = Packet::VERB_ECHO;
+				r.reason = "test";
+				r.physical(InetAddress("10.0.0.1/9993"));
+				TraceRing::write(r);
+				++admitted;
+			}
+		}
+		if (admitted != 10) { // 25 sampled, then limited to 10 in this second
+			std::cout << "FAIL (admitted " << admitted << ")" << std::endl;
+			return -1;
+		}
+		ZT_TraceRecord tr[16];
+		uint64_t dropped = 1;
+		const unsigned long n = TraceRing::read(tr,16,&dropped);
+		TraceRing::configure(0,0,0);
+		if ((n != 10)||(dropped != 0)||(tr[0].packetId != 3)||(tr[9].packetId != 39)||(tr[0].verb != Packet::VERB_ECHO)||(strcmp(tr[0].reason,"test"))||(*reinterpret_cast<const InetAddress *>(&(tr[0].physicalAddress)) != InetAddress("10.0.0.1/9993"))) {
+			std::cout << "FAIL (read " << n << ")" << std::endl;
+			return -1;
+		}
+		if ((TraceRing::enabled())||(TraceRing::read(tr,16,(uint64_t *)0) != 0)) {
+			std::cout << "FAIL (not stopped)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing frame capture ring... "; std::cout.flush();
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const MAC src(0x325a0fe01c01ULL),dst(0x325a0fe01c02ULL);
+		uint8_t payload[1000];
+		memset(payload,0x5a,sizeof(payload));
+		if (FrameCapture::capturing(nwid)) {
+			std::cout << "FAIL (enabled by default)" << std::endl;
+			return -1;
+		}
+		FrameCapture::configure(nwid,4,64);
+		for(unsigned int i=0;i<6;++i) {
+			FrameCapture::Frame fr(1000 + i,nwid,(i & 1) != 0,src,dst,ZT_ETHERTYPE_IPV4,0,payload,sizeof(payload));
+			fr.peer(0x89e92ceee5ULL);
+			if (i == 5)
+				fr.verdict(FrameCapture::VERDICT_DROP_FILTER,"test");
+		}
+		{
+			FrameCapture::Frame other(2000,nwid + 1,false,src,dst,ZT_ETHERTYPE_IPV4,0,payload,sizeof(payload));
+		}
+		uint64_t cnwid = 0,overwritten = 0;
+		unsigned int maxFrames = 0,snapLength = 0,frames = 0;
+		FrameCapture::status(cnwid,maxFrames,snapLength,frames,overwritten);
+		if ((cnwid != nwid)||(maxFrames != 4)||(snapLength != 64)||(frames != 4)||(overwritten != 2)) {
+			std::cout << "FAIL (status " << frames << "/" << overwritten << ")" << std::endl;
+			return -1;
+		}
+		std::string pcap;
+		const unsigned int n = FrameCapture::pcapng(pcap,true);
+		uint32_t magic = 0;
+		if (pcap.size() >= 4)
+			memcpy(&magic,pcap.data(),4);
+		if ((n != 4)||(magic != 0x0a0d0d0a)||(pcap.find("verdict=drop-filter") == std::string::npos)||(pcap.find("8056c2e21c000001") == std::string::npos)) {
+			std::cout << "FAIL (pcapng " << n << ")" << std::endl;
+			return -1;
+		}
+		FrameCapture::status(cnwid,maxFrames,snapLength,frames,overwritten);
+		FrameCapture::configure(0,0,0);
+		if ((frames != 0)||(FrameCapture::capturing(nwid))) {
+			std::cout << "FAIL (not cleared or stopped)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing peer and path traffic counters... "; std::cout.flush();
+		RuntimeEnvironment rr((Node *)0);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		const SharedPtr<Peer> p(new Peer(&rr,rr.identity,rr.identity));
+		Path path(0,InetAddress("10.0.0.1/9993"));
+		path.received(1000,1400);
+		path.received(1001,200);
+		path.fragmentReceived();
+		p->countReceived(1400,0);
+		p->countReceived(600,1);
+		p->countSent(3000,false);
+		p->countSent(100,true);
+		uint64_t c[6];
+		path.traffic(c[0],c[1],c[2],c[3],c[4],c[5]);
+		if ((c[0] != 2)||(c[1] != 1600)||(c[2] != 1)||(c[3] != 0)||(c[4] != 0)||(c[5] != 0)) {
+			std::cout << "FAIL (path)" << std::endl;
+			return -1;
+		}
+		p->traffic(c[0],c[1],c[2],c[3],c[4],c[5]);
+		if ((c[0] != 2)||(c[1] != 2000)||(c[2] != 1)||(c[3] != 2)||(c[4] != 3100)||(c[5] != 1)) {
+			std::cout << "FAIL (peer)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing relay fallback when nothing comes back... "; std::cout.flush();
+		RuntimeEnvironment rr((Node *)0);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		const SharedPtr<Peer> p(new Peer(&rr,rr.identity,rr.identity));
+		const int64_t start = 1000000;
+		int64_t now = start;
+		// A packet now and then with long pauses in between is never blamed on the relay
+		for(unsigned int k=0;k<3;++k) {
+			if (p->relayWentSilent(now)) {
+				std::cout << "FAIL (blamed after a pause)" << std::endl;
+				return -1;
+			}
+			p->sentViaRelay(now);
+			now += ZT_RELAY_REPLY_TIMEOUT * 2;
+		}
+		// Steady sending with no reply is, once
+		const int64_t run = now;
+		for(;now<(run + ZT_RELAY_REPLY_TIMEOUT);now+=1000) {
+			if (p->relayWentSilent(now)) {
+				std::cout << "FAIL (blamed early)" << std::endl;
+				return -1;
+			}
+			p->sentViaRelay(now);
+		}
+		if ((!p->relayWentSilent(now))||(p->relayWentSilent(now))) {
+			std::cout << "FAIL (silence not reported once)" << std::endl;
+			return -1;
+		}
+		if (p->holdsRelayOffer(now)) {
+			std::cout << "FAIL (offer never sent)" << std::endl;
+			return -1;
+		}
+		p->relayOfferSent(now);
+		if ((!p->holdsRelayOffer(now + ZT_RELAY_OFFER_TIMEOUT - 1))||(p->holdsRelayOffer(now + ZT_RELAY_OFFER_TIMEOUT))) {
+			std::cout << "FAIL (offer lifetime)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing adaptive per-peer frame compression... "; std::cout.flush();
+		RuntimeEnvironment rr((Node *)0);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		const SharedPtr<Peer> p(new Peer(&rr,rr.identity,rr.identity));
+		unsigned int compressedCount = 0;
+		for(unsigned int k=0;k<(ZT_PEER_COMPRESSION_FAILURE_THRESHOLD + ZT_PEER_COMPRESSION_BACKOFF_MIN);++k) {
+			a.reset(Address(),Address(),Packet::VERB_FRAME);
+			for(unsigned int i=0;i<1000;++i)
+				a.append((uint8_t)rand());
+			compressedCount += (p->compressFrame(a)) ? 1 : 0;
+		}
+		uint64_t attempts,successes,skipped,bytesSaved;
+		p->compressionStats(attempts,successes,skipped,bytesSaved);
+		if ((compressedCount)||(attempts != ZT_PEER_COMPRESSION_FAILURE_THRESHOLD)||(successes)||(skipped != ZT_PEER_COMPRESSION_BACKOFF_MIN)) {
+			std::cout << "FAIL (back-off)" << std::endl;
+			return -1;
+		}
+		// One more failure doubles the back-off; racing senders must consume it exactly once
+		a.reset(Address(),Address(),Packet::VERB_FRAME);
+		for(unsigned int i=0;i<1000;++i)
+			a.append((uint8_t)rand());
+		compressedCount += (p->compressFrame(a)) ? 1 : 0;
+		std::atomic<unsigned int> backedOff(0);
+		std::vector<std::thread> racers;
+		for(unsigned int t=0;t<4;++t) {
+			racers.push_back(std::thread([&p,&backedOff]() {
+				for(unsigned int k=0;k<(ZT_PEER_COMPRESSION_BACKOFF_MIN * 2);++k) {
+					if (p->compressionBackedOff())
+						++backedOff;
+				}
+			}));
+		}
+		for(std::vector<std::thread>::iterator t(racers.begin());t!=racers.end();++t)
+			t->join();
+		if ((backedOff != (ZT_PEER_COMPRESSION_BACKOFF_MIN * 2))||(p->compressionBackedOff())) {
+			std::cout << "FAIL (concurrent back-off)" << std::endl;
+			return -1;
+		}
+		for(unsigned int k=0;k<4;++k) {
+			a = b;
+			compressedCount += (p->compressFrame(a)) ? 1 : 0;
+		}
+		p->compressionStats(attempts,successes,skipped,bytesSaved);
+		if ((compressedCount != 4)||(successes != 4)||(bytesSaved != (uint64_t)((b.size() - complen) * 4))) {
+			std::cout << "FAIL (re-probe)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << attempts << " attempts, " << skipped << " skipped, " << bytesSaved << " bytes saved)" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing path MTU discovery... "; std::cout.flush();
+		// Simulated path limits, with 0 meaning a path that answers nothing. Probes over
+		// the limit are lost further along the path (mode 0), fail to leave the host with
+		// don't fragment set (mode 1), or are fragmented by a host that can't set it and
+		// answered anyway (mode 2), in which case the search must not go above the default.
+		static const unsigned int limits[4] = { 8000,1444,1420,0 };
+		for(unsigned int mode=0;mode<3;++mode) {
+			for(unsigned int li=0;li<4;++li) {
+				const SharedPtr<Path> p(new Path(-1,InetAddress("10.0.0.1/9993")));
+				const unsigned int maxSize = (mode == 2) ? ZT_DEFAULT_PHYSMTU : ZT_PATH_MTU_PROBE_MAX;
+				int64_t now = 1;
+				unsigned int probes = 0;
+				uint64_t pid = 0;
+				for(unsigned int k=0;k<1000;++k) {
+					const unsigned int ps = p->nextMtuProbe(now,maxSize);
+					if (ps) {
+						++probes;
+						pid += 0x100000000ULL;
+						p->mtuProbeSent(pid,now);
+						if (ps > maxSize) {
+							std::cout << "FAIL (probe of " << ps << " over " << maxSize << ")" << std::endl;
+							return -1;
+						}
+						if ((ps <= limits[li])||((mode == 2)&&(limits[li]))) {
+							p->mtuProbeReplied(pid);
+						} else if (mode == 1) {
+							p->mtuProbeFailed();
+							if (p->mtuProbeReplied(pid)) {
+								std::cout << "FAIL (reply to unsent " << ps << " byte probe counted)" << std::endl;
+								return -1;
+							}
+						}
+					} else if (probes) {
+						break;
+					}
+					now += ZT_PING_CHECK_INVERVAL;
+				}
+				const unsigned int want = ((limits[li])&&(mode != 2)) ? limits[li] : ZT_DEFAULT_PHYSMTU;
+				if ((p->mtu() > want)||((want - p->mtu()) > ZT_PATH_MTU_PROBE_GRANULARITY)||(p->nextMtuProbe(now,maxSize))) {
+					std::cout << "FAIL (mode " << mode << ", limit " << limits[li] << ", got " << p->mtu() << ")" << std::endl;
+					return -1;
+				}
+				std::cout << limits[li] << "->" << p->mtu() << " (" << probes << " probes) ";
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing path loss and jitter estimation... "; std::cout.flush();
+		// Same latency on both, but one path loses every fourth probe and has a varying round trip
+		const SharedPtr<Path> clean(new Path(-1,InetAddress("10.0.0.1/9993")));
+		const SharedPtr<Path> lossy(new Path(-1,InetAddress("10.0.0.2/9993")));
+		clean->updateLatency(50);
+		lossy->updateLatency(50);
+		int64_t now = 1;
+		for(uint64_t k=1;k<=64;++k) {
+			const uint64_t pid = k << 32;
+			clean->probeSent(pid,now);
+			lossy->probeSent(pid,now);
+			clean->probeReplied(pid,now + 50);
+			if ((k & 3) != 0)
+				lossy->probeReplied(pid,now + 30 + (int64_t)((k & 1) * 40));
+			now += ZT_PING_CHECK_INVERVAL;
+			clean->updateQoS(now);
+			lossy->updateQoS(now);
+		}
+		if ((clean->loss() != 0)||(clean->jitter() != 0)||(lossy->loss() < 100000)||(lossy->loss() > 400000)||(lossy->jitter() < 10)||(lossy->quality(now) <= clean->quality(now))) {
+			std::cout << "FAIL (clean " << clean->loss() << "ppm/" << clean->jitter() << "ms, lossy " << lossy->loss() << "ppm/" << lossy->jitter() << "ms)" << std::endl;
+			return -1;
+		}
+		std::cout << "lossy " << lossy->loss() << "ppm/" << lossy->jitter() << "ms PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing fast failover path state... "; std::cout.flush();
+		const SharedPtr<Path> p(new Path(-1,InetAddress("10.0.0.1/9993")));
+		p->updateLatency(20);
+		p->received(1000,64);
+		const long q = p->quality(1000);
+		p->fail(1300);
+		const bool down = ((p->failed())&&(!p->alive(1300))&&(p->quality(1300) > q));
+		p->received(1400,64);
+		if ((!down)||(p->failed())||(!p->alive(1400))||(p->quality(1400) != q)) {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing compact path addresses... "; std::cout.flush();
+		const InetAddress a4("10.1.2.3/9993"),a6("fd00:1234:5678::1/21212");
+		const Path p4(1,a4),p6(2,a6);
+		if ((p4.address() != a4)||(p6.address() != a6)||(p4.addressFamily() != AF_INET)||(p6.addressFamily() != AF_INET6)||(p4.ipScope() != a4.ipScope())||(Path().address())) {
+			std::cout << "FAIL" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << sizeof(Path) << " bytes per path)" << std::endl;
+	}
+
+	{
+		std::cout << "[packet] Testing adaptive keepalive learning... "; std::cout.flush();
+		// A NAT that keeps bindings for 60 seconds and hands out a new port after that
+		const SharedPtr<Path> p(new Path(-1,InetAddress("10.0.0.1/9993")));
+		const InetAddress s1("1.2.3.4/1000"),s2("1.2.3.4/2000");
+		int64_t now = 100000;
+		uint64_t id = 0x100000000ULL;
+		bool ok = (p->keepaliveInterval() == ZT_PATH_HEARTBEAT_PERIOD);
+		p->helloReplied(0,s1);
+		for(int i=0;i<20;++i) {
+			const int64_t idle = p->keepaliveInterval();
+			now += idle;
+			p->keepaliveSent(id,idle,now);
+			p->helloReplied(id,(idle < 60000) ? s1 : s2);
+			p->helloReplied(id,s1); // binding re-established, later replies report the old address again
+			id += 0x100000000ULL;
+		}
+		ok &= ((p->keepaliveInterval() < 60000)&&(p->keepaliveInterval() >= (60000 - (2 * ZT_PATH_KEEPALIVE_STEP))));
+		// No reply at all counts as a lost binding too
+		const unsigned int before = p->keepaliveInterval();
+		p->keepaliveSent(id,before,now);
+		p->updateQoS(now + ZT_PATH_QOS_PROBE_TIMEOUT);
+		ok &= (p->keepaliveInterval() < before);
+		if (!ok) {
+			std::cout << "FAIL (" << p->keepaliveInterval() << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (settled at " << before << "ms)" << std::endl;
+	}
+
+	static const unsigned int benchSizes[4] = { 64,512,1400,2800 };
+	for(unsigned int si=0;si<4;++si) {
+		const unsigned int plen = benchSizes[si];
+		std::cout << "[packet] Benchmarking armor with " << plen << " byte payload... "; std::cout.flush();
+
+		a.reset(Address(),Address(),Packet::VERB_FRAME);
+		for(unsigned int i=0;i<plen;++i)
+			a.append((uint8_t)i);
+		uint8_t *const pl = reinterpret_cast<uint8_t *>(a.unsafeData()) + ZT_PACKET_IDX_VERB;
+		const unsigned int pll = a.size() - ZT_PACKET_IDX_VERB;
+		const unsigned int iterations = (64 * 1048576) / plen;
+
+		// Two separate passes over the payload as armor() used to do it
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<iterations;++i) {
+			uint64_t macKey[4],mac[2];
+			memset(macKey,0,sizeof(macKey));
+			Salsa20 s20(salsaKey,a.data());
+			s20.crypt12(macKey,macKey,sizeof(macKey));
+			s20.crypt12(pl,pl,pll);
+			Poly1305::compute(mac,pl,pll,macKey);
+			pl[0] ^= (uint8_t)mac[0];
+		}
+		uint64_t end = OSUtils::now();
+		const double unfused = ((double)iterations * (double)plen / 1048576.0) / ((double)(end - start) / 1000.0);
+
+		start = OSUtils::now();
+		for(unsigned int i=0;i<iterations;++i)
+			a.armor(salsaKey,true);
+		end = OSUtils::now();
+		const double fused = ((double)iterations * (double)plen / 1048576.0) / ((double)(end - start) / 1000.0);
+
+		std::cout << "unfused " << unfused << " MiB/second, fused " << fused << " MiB/second" << std::endl;
+	}
+
+	return 0;
+}
+
+#ifdef ZT_HAVE_TAP_FILTER
+// Builds a frame from the tap: an IP packet from ip to 10.1.9.9 or fd00::2 if ip is set, with
+// a header of ihl words (IPv4) or a hop-by-hop header in front of protocol if ihl is set (IPv6)
+static unsigned int testTapFilterFrame(uint8_t *f,const bool bridged,const unsigned int etherType,const char *ip,const unsigned int protocol,const unsigned int dport,const unsigned int ihl)
+{
+	memset(f,0,128);
+	memset(f,0xff,6);
+	static const uint8_t ours[6] = { 0x32,0x11,0x22,0x33,0x44,0x55 };
+	memcpy(f + 6,ours,6);
+	if (bridged)
+		f[11] ^= 0x01;
+	f[12] = (uint8_t)(etherType >> 8);
+	f[13] = (uint8_t)etherType;
+	if (!ip)
+		return 60;
+	const InetAddress src(ip);
+	unsigned int l4;
+	if (src.ss_family == AF_INET) {
+		f[14] = 0x40 | (uint8_t)ihl;
+		f[14 + 9] = (uint8_t)protocol;
+		memcpy(f + 14 + 12,src.rawIpData(),4);
+		f[14 + 16] = 10; f[14 + 17] = 1; f[14 + 18] = 9; f[14 + 19] = 9;
+		l4 = 14 + (ihl * 4);
+	} else {
+		f[14] = 0x60;
+		memcpy(f + 14 + 8,src.rawIpData(),16);
+		f[14 + 24] = 0xfd; f[14 + 39] = 2;
+		l4 = 14 + 40;
+		if (ihl) {
+			f[14 + 6] = 0; // hop-by-hop
+			f[l4] = (uint8_t)protocol;
+			l4 += 8;
+		} else f[14 + 6] = (uint8_t)protocol;
+	}
+	f[l4] = 0x04; f[l4 + 1] = 0xd2;
+	f[l4 + 2] = (uint8_t)(dport >> 8);
+	f[l4 + 3] = (uint8_t)dport;
+	return l4 + 8;
+}
+#endif
+
+static int testOther()
+{
+	char buf[1024];
+	char buf2[4096];
+	char buf3[1024];
+
+	std::cout << "[other] Testing hex/unhex... "; std::cout.flush();
+	Utils::getSecureRandom(buf,(unsigned int)sizeof(buf));
+	Utils::hex(buf,(unsigned int)sizeof(buf),buf2);
+	Utils::unhex(buf2,buf3,(unsigned int)sizeof(buf3));
+	if (memcmp(buf,buf3,sizeof(buf)) == 0) {
+		std::cout << "PASS" << std::endl;
+	} else {
+		std::cout << "FAIL!" << std::endl;
+		buf2[78] = 0;
+		std::cout << buf2 << std::endl;
+		Utils::hex(buf3,(unsigned int)sizeof(buf3),buf2);
+		buf2[78] = 0;
+		std::cout << buf2 << std::endl;
+		return -1;
+	}
+
+	std::cout << "[other] Testing InetAddress encode/decode..."; std::cout.flush();
+	std::cout << " " << InetAddress("127.0.0.1/9993").toString(buf);
+	std::cout << " " << InetAddress("feed:dead:babe:dead:beef:f00d:1234:5678/12345").toString(buf);
+	std::cout << " " << InetAddress("0/9993").toString(buf);
+	std::cout << " " << InetAddress("").toString(buf);
+	std::cout << std::endl;
+
+	std::cout << "[other] Testing PackedInetAddress... "; std::cout.flush();
+	{
+		const InetAddress a4("10.1.2.3/9993"),a4p("10.1.2.3/9994"),a6("fd00:1234:5678::1/21212");
+		const PackedInetAddress p4(a4),p4p(a4p),p6(a6);
+		if ((sizeof(PackedInetAddress) > 24)||(p4.toInetAddress() != a4)||(p6.toInetAddress() != a6)||(p4.port() != 9993)||(p6.ipVersion() != 6)) {
+			std::cout << "FAILED (round trip)" << std::endl;
+			return -1;
+		}
+		if ((p4 == p4p)||(p4 == p6)||(!(p4 == PackedInetAddress(a4)))||(p4.hashCode() != PackedInetAddress(a4).hashCode())||(PackedInetAddress(InetAddress()))) {
+			std::cout << "FAILED (compare)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+#if 0
+	std::cout << "[other] Benchmarking memcpy... "; std::cout.flush();
+	{
+		unsigned char *bb = (unsigned char *)::malloc(1234567);
+		unsigned char *cc = (unsigned char *)::malloc(1234567);
+		for(unsigned int i=0;i<1234567;++i)
+			bb[i] = (unsigned char)i;
+		double bytes = 0.0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<20000;++i) {
+			++bb[i];
+			++bb[i+1];
+			memcpy(cc,bb,1234567);
+			bytes += 1234567.0;
+		}
+		if (cc[0] != bb[0])
+			abort();
+		uint64_t end = OSUtils::now();
+		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1024.0)) << " MiB/second" << std::endl;
+		::free((void *)bb);
+		::free((void *)cc);
+	}
+#endif
+
+	std::cout << "[other] Benchmarking ZT_FAST_MEMCPY... "; std::cout.flush();
+	{
+		unsigned char *bb = (unsigned char *)::malloc(1234567);
+		unsigned char *cc = (unsigned char *)::malloc(1234567);
+		for(unsigned int i=0;i<1234567;++i)
+			bb[i] = (unsigned char)i;
+		double bytes = 0.0;
+		uint64_t start = OSUtils::now();
+		for(unsigned int i=0;i<20000;++i) {
+			++bb[0];
+			++bb[1234566];
+			ZT_FAST_MEMCPY(cc,bb,1234567);
+			bytes += 1234567.0;
+		}
+		if (cc[0] != bb[0])
+			abort();
+		uint64_t end = OSUtils::now();
+		std::cout << ((bytes / 1048576.0) / ((long double)(end - start) / 1024.0)) << " MiB/second" << std::endl;
+		::free((void *)bb);
+		::free((void *)cc);
+	}
+
+	std::cout << "[other] Testing Hashtable... "; std::cout.flush();
+	{
+		Hashtable<uint64_t,std::string> ht;
+		std::map<uint64_t,std::string> ref; // assume std::map works correctly :)
+		for(int x=0;x<2;++x) {
+			for(int i=0;i<77777;++i) {
+				uint64_t k = rand();
+				while ((k == 0)||(ref.count(k) > 0))
+					++k;
+				std::string v("!");
+				for(int j=0;j<(int)(k % 64);++j)
+					v.push_back("0123456789"[rand() % 10]);
+				ref[k] = v;
+				ht.set(0xffffffffffffffffULL,v);
+				std::string &vref = ht[k];
+				vref = v;
+				ht.erase(0xffffffffffffffffULL);
+			}
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (size mismatch, original)" << std::endl;
+				return -1;
+			}
+			{
+				Hashtable<uint64_t,std::string>::Iterator i(ht);
+				uint64_t *k = (uint64_t *)0;
+				std::string *v = (std::string *)0;
+				while(i.next(k,v)) {
+					if (ref.find(*k)->second != *v) {
+						std::cout << "FAILED! (data mismatch!)" << std::endl;
+						return -1;
+					}
+				}
+			}
+			for(std::map<uint64_t,std::string>::const_iterator i(ref.begin());i!=ref.end();++i) {
+				if (ht[i->first] != i->second) {
+					std::cout << "FAILED! (data mismatch!)" << std::endl;
+					return -1;
+				}
+			}
+
+			Hashtable<uint64_t,std::string> ht2;
+			ht2 = ht;
+			Hashtable<uint64_t,std::string> ht3(ht2);
+			if (ht2.size() != ref.size()) {
+				std::cout << "FAILED! (size mismatch, assigned)" << std::endl;
+				return -1;
+			}
+			if (ht3.size() != ref.size()) {
+				std::cout << "FAILED! (size mismatch, copied)" << std::endl;
 				return -1;
 			}
 
@@ -844,43 +1905,1232 @@ static int testOther()
 				ht.set(k,v);
 				ref[k] = v;
 			}
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (second populate)" << std::endl;
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (second populate)" << std::endl;
+				return -1;
+			}
+			ht.clear();
+			ref.clear();
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (clear)" << std::endl;
+				return -1;
+			}
+			for(int i=0;i<10000;++i) {
+				uint64_t k = rand();
+				while ((k == 0)||(ref.count(k) > 0))
+					++k;
+				std::string v;
+				for(int j=0;j<(int)(k % 64);++j)
+					v.push_back("0123456789"[rand() % 10]);
+				ht.set(k,v);
+				ref[k] = v;
+			}
+			{
+				Hashtable<uint64_t,std::string>::Iterator i(ht);
+				uint64_t *k;
+				std::string *v;
+				while (i.next(k,v))
+					ht.erase(*k);
+			}
+			ref.clear();
+			if (ht.size() != ref.size()) {
+				std::cout << "FAILED! (clear by iterate, " << ht.size() << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	{
+		// Entries too big to be stored inline are boxed, check that path too
+		struct BigValue { uint64_t w[16]; };
+		Hashtable<uint64_t,BigValue> ht;
+		for(uint64_t k=1;k<=5000;++k) {
+			BigValue &v = ht[k];
+			v.w[0] = k;
+			v.w[15] = ~k;
+		}
+		for(uint64_t k=1;k<=5000;k+=2)
+			ht.erase(k);
+		bool ok = (ht.size() == 2500);
+		for(uint64_t k=1;k<=5000;++k) {
+			const BigValue *v = ht.get(k);
+			if ((k & 1) ? (v != (const BigValue *)0) : ((!v)||(v->w[0] != k)||(v->w[15] != ~k)))
+				ok = false;
+		}
+		if (!ok) {
+			std::cout << "FAILED! (boxed values)" << std::endl;
+			return -1;
+		}
+	}
+	{
+		// Large tables grow a step at a time, so entries must be found in both slot arrays meanwhile
+		Hashtable<uint64_t,uint64_t> ht;
+		for(uint64_t k=1;k<=50000;++k) {
+			ht[k] = ~k;
+			if ((k % 3) == 0)
+				ht.erase(k / 3);
+			const uint64_t *v = ht.get((k / 2) + 1);
+			if ((!v)||(*v != ~((k / 2) + 1))) {
+				std::cout << "FAILED! (lookup while growing)" << std::endl;
+				return -1;
+			}
+			if ((k % 4999) == 0) {
+				Hashtable<uint64_t,uint64_t>::Iterator i(ht);
+				uint64_t *ik,*iv;
+				unsigned long ic = 0;
+				while (i.next(ik,iv))
+					++ic;
+				if ((ic != ht.size())||(ht.size() != (k - (k / 3)))) {
+					std::cout << "FAILED! (iterate while growing)" << std::endl;
+					return -1;
+				}
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing TimerWheel... "; std::cout.flush();
+	{
+		// Compare against a plain list, with deadlines from just past to far beyond the wheel's range
+		TimerWheel<unsigned int> tw(500,1000000);
+		std::multimap<int64_t,unsigned int> ref;
+		int64_t now = 1000000;
+		unsigned int n = 0;
+		for(int step=0;step<20000;++step) {
+			for(int k=(rand() % 4);k>0;--k) {
+				static const int64_t ranges[4] = { 1000LL,100000LL,100000000LL,20000000000LL };
+				const int64_t d = now - 1000 + (int64_t)((((uint64_t)rand() << 31) ^ (uint64_t)rand()) % (uint64_t)ranges[rand() % 4]);
+				tw.add(d,n);
+				ref.insert(std::pair<int64_t,unsigned int>(d,n++));
+			}
+			now += ((rand() % 16) == 0) ? (int64_t)(rand() % 10000000) : (int64_t)(rand() % 3000);
+			std::vector<unsigned int> got;
+			tw.expire(now,got);
+			std::sort(got.begin(),got.end());
+			// Deadlines are rounded up to whole ticks, so anything due by the last whole tick must be out
+			std::vector<unsigned int> want;
+			while ((!ref.empty())&&(ref.begin()->first <= ((now / 500) * 500))) {
+				want.push_back(ref.begin()->second);
+				ref.erase(ref.begin());
+			}
+			std::sort(want.begin(),want.end());
+			if ((got != want)||(tw.size() != ref.size())) {
+				std::cout << "FAILED! (step " << step << ")" << std::endl;
+				return -1;
+			}
+			if ((step % 5000) == 4999) {
+				// Clearing and adding back what's still wanted must not change what comes out
+				tw.clear();
+				for(std::multimap<int64_t,unsigned int>::const_iterator i(ref.begin());i!=ref.end();++i)
+					tw.add(i->first,i->second);
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing StateSnapshot... "; std::cout.flush();
+	{
+		const Address self(0x0102030405ULL);
+		StateSnapshot ss(self,1234567890123LL);
+		for(unsigned int i=0;i<100;++i) {
+			Buffer<256> b;
+			b.append((uint32_t)i);
+			b.addSize(i);
+			ss.add((i & 1) ? StateSnapshot::RECORD_PEER : StateSnapshot::RECORD_TAG,b,i);
+		}
+		const std::string &d = ss.data();
+		if (ss.items(StateSnapshot::RECORD_PEER) != 2500) {
+			std::cout << "FAILED! (item count)" << std::endl;
+			return -1;
+		}
+		Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE> *const b = new Buffer<ZT_STATE_SNAPSHOT_MAX_RECORD_SIZE>();
+		StateSnapshot::RecordType t;
+		StateSnapshot::Reader r(d.data(),(unsigned long)d.length(),self);
+		unsigned int n = 0;
+		while (r.next(t,*b)) {
+			if ((t != ((n & 1) ? StateSnapshot::RECORD_PEER : StateSnapshot::RECORD_TAG))||(b->size() != (n + 4))||(b->at<uint32_t>(0) != n)) {
+				std::cout << "FAILED! (record " << n << ")" << std::endl;
+				return -1;
+			}
+			++n;
+		}
+		if ((n != 100)||(r.timestamp() != 1234567890123LL)) {
+			std::cout << "FAILED! (read " << n << " records)" << std::endl;
+			return -1;
+		}
+		// Another node's snapshot is refused, and a truncated one yields only its whole records
+		StateSnapshot::Reader other(d.data(),(unsigned long)d.length(),Address(0x0102030406ULL));
+		StateSnapshot::Reader cut(d.data(),(unsigned long)d.length() - 1,self);
+		n = 0;
+		while (cut.next(t,*b))
+			++n;
+		delete b;
+		if ((other.valid())||(!cut.valid())||(n != 99)) {
+			std::cout << "FAILED! (invalid or truncated snapshot)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing BridgeRouteTable... "; std::cout.flush();
+	{
+		// Compare against a plain map, where least recently seen means lowest sequence number
+		BridgeRouteTable brt(64,16);
+		std::map< uint64_t,std::pair<uint64_t,int64_t> > ref; // MAC -> bridge, last seen
+		int64_t now = 1000;
+		for(int step=0;step<50000;++step) {
+			const uint64_t mac = 1 + (uint64_t)(rand() % 200);
+			const uint64_t bridge = 0x1000000000ULL + (uint64_t)(((rand() % 4) == 0) ? (rand() % 8) : 0);
+			++now;
+			brt.learn(MAC(mac),Address(bridge),now);
+
+			std::map< uint64_t,std::pair<uint64_t,int64_t> >::iterator e(ref.find(mac));
+			if ((e != ref.end())&&(e->second.first == bridge)) {
+				e->second.second = now;
+			} else {
+				if (e != ref.end())
+					ref.erase(e);
+				unsigned long behind = 0;
+				std::map< uint64_t,std::pair<uint64_t,int64_t> >::iterator oldest(ref.end());
+				for(std::map< uint64_t,std::pair<uint64_t,int64_t> >::iterator i(ref.begin());i!=ref.end();++i) {
+					if (i->second.first == bridge) {
+						++behind;
+						if ((oldest == ref.end())||(i->second.second < oldest->second.second))
+							oldest = i;
+					}
+				}
+				if (behind >= 16)
+					ref.erase(oldest);
+				if (ref.size() >= 64) {
+					oldest = ref.begin();
+					for(std::map< uint64_t,std::pair<uint64_t,int64_t> >::iterator i(ref.begin());i!=ref.end();++i) {
+						if (i->second.second < oldest->second.second)
+							oldest = i;
+					}
+					ref.erase(oldest);
+				}
+				ref[mac] = std::pair<uint64_t,int64_t>(bridge,now);
+			}
+
+			if (brt.size() != ref.size()) {
+				std::cout << "FAILED! (size, step " << step << ")" << std::endl;
+				return -1;
+			}
+			if ((step % 97) == 0) {
+				for(uint64_t m=1;m<=200;++m) {
+					e = ref.find(m);
+					if (brt.get(MAC(m)) != Address((e == ref.end()) ? 0ULL : e->second.first)) {
+						std::cout << "FAILED! (route, step " << step << ")" << std::endl;
+						return -1;
+					}
+				}
+			}
+		}
+		brt.clean(now + ZT_BRIDGE_ROUTE_EXPIRE - 30);
+		for(std::map< uint64_t,std::pair<uint64_t,int64_t> >::iterator i(ref.begin());i!=ref.end();) {
+			if ((now + ZT_BRIDGE_ROUTE_EXPIRE - 30 - i->second.second) > ZT_BRIDGE_ROUTE_EXPIRE)
+				ref.erase(i++);
+			else ++i;
+		}
+		if ((brt.size() != ref.size())||(ref.empty())) {
+			std::cout << "FAILED! (expiry)" << std::endl;
+			return -1;
+		}
+		// Lowering the limits keeps the most recently seen routes overall, then behind each bridge
+		for(uint64_t m=201;m<=203;++m) {
+			brt.learn(MAC(m),Address(0x1000000001ULL),now + (int64_t)(m - 200));
+			ref[m] = std::pair<uint64_t,int64_t>(0x1000000001ULL,now + (int64_t)(m - 200));
+		}
+		brt.setLimits(8,2);
+		std::vector< std::pair<int64_t,uint64_t> > byAge; // last seen, MAC
+		for(std::map< uint64_t,std::pair<uint64_t,int64_t> >::iterator i(ref.begin());i!=ref.end();++i)
+			byAge.push_back(std::pair<int64_t,uint64_t>(i->second.second,i->first));
+		std::sort(byAge.rbegin(),byAge.rend());
+		std::map< uint64_t,unsigned int > perBridge;
+		unsigned long kept = 0;
+		for(unsigned int i=0;i<(unsigned int)byAge.size();++i) {
+			const uint64_t bridge = ref[byAge[i].second].first;
+			const bool keep = ((i < 8)&&(++perBridge[bridge] <= 2));
+			kept += (keep) ? 1 : 0;
+			if (brt.get(MAC(byAge[i].second)) != Address((keep) ? bridge : 0ULL)) {
+				std::cout << "FAILED! (limits)" << std::endl;
+				return -1;
+			}
+		}
+		if ((brt.size() != kept)||(brt.get(MAC(201)))) {
+			std::cout << "FAILED! (limits)" << std::endl;
+			return -1;
+		}
+		brt.clean(now + ZT_BRIDGE_ROUTE_EXPIRE + 4);
+		if (brt.size() != 0) {
+			std::cout << "FAILED! (expiry)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing PrefixTrie... "; std::cout.flush();
+	{
+		// Compare against a linear scan for the most specific containing network
+		PrefixTrie<unsigned int> pt;
+		std::vector<InetAddress> nets;
+		for(unsigned int i=0;i<200;++i) {
+			const unsigned int bits = (i < 100) ? (8 + (rand() % 25)) : (16 + (rand() % 113));
+			InetAddress net;
+			if (i < 100) {
+				const uint32_t ip = Utils::hton(((uint32_t)rand() & 0x0003ffff) | 0x0a000000); // 10.0-3.x.x so prefixes overlap
+				net.set(&ip,4,0);
+			} else {
+				uint8_t ip[16];
+				memset(ip,0,sizeof(ip));
+				ip[0] = 0xfd;
+				for(unsigned int b=1;b<16;++b)
+					ip[b] = (uint8_t)(rand() & ((b < 3) ? 0x03 : 0xff));
+				net.set(ip,16,0);
+			}
+			net.setPort(bits);
+			net = net.network(); // containsAddress() expects host bits to be zero
+			bool dup = false;
+			for(std::vector<InetAddress>::const_iterator n(nets.begin());n!=nets.end();++n)
+				dup |= (*n == net);
+			if (dup)
+				continue;
+			pt.add(net,(unsigned int)nets.size());
+			nets.push_back(net);
+		}
+		for(unsigned int k=0;k<20000;++k) {
+			InetAddress a;
+			if ((k & 1) == 0) {
+				const uint32_t ip = Utils::hton(((uint32_t)rand() & 0x0003ffff) | 0x0a000000);
+				a.set(&ip,4,0);
+			} else {
+				// Start from a known network so that long IPv6 prefixes get hit
+				uint8_t ip[16];
+				memcpy(ip,nets[100 + (rand() % (nets.size() - 100))].rawIpData(),16);
+				for(unsigned int b=(unsigned int)(rand() % 16);b<16;++b)
+					ip[b] ^= (uint8_t)(rand() & 0x01);
+				a.set(ip,16,0);
+			}
+			unsigned int best = 0xffffffff,bestBits = 0,matches = 0;
+			for(unsigned int n=0;n<(unsigned int)nets.size();++n) {
+				if (nets[n].containsAddress(a)) {
+					++matches;
+					if ((best == 0xffffffff)||(nets[n].netmaskBits() > bestBits)) {
+						best = n;
+						bestBits = nets[n].netmaskBits();
+					}
+				}
+			}
+			const unsigned int *const v = pt.get(a);
+			unsigned int visited = 0;
+			pt.eachMatch(a,[&visited](const unsigned int &) { ++visited; return false; });
+			if ((((v) ? *v : 0xffffffff) != best)||(visited != matches)) {
+				std::cout << "FAILED! (" << a.toIpString(buf) << ")" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << pt.size() << " prefixes ";
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing CompiledRules... "; std::cout.flush();
+	{
+		// Any reachable set that could match a frame must be a candidate for it
+		static const uint16_t etherTypes[3] = { ZT_ETHERTYPE_IPV4,ZT_ETHERTYPE_IPV6,ZT_ETHERTYPE_ARP };
+		static const uint8_t ipProtocols[3] = { 0x06,0x11,0x01 };
+		ZT_VirtualNetworkRule rules[64];
+		for(int step=0;step<20000;++step) {
+			const unsigned int ruleCount = 1 + (rand() % 64);
+			memset(rules,0,sizeof(rules));
+			for(unsigned int rn=0;rn<ruleCount;++rn) {
+				ZT_VirtualNetworkRule &r = rules[rn];
+				switch(rand() % 10) {
+					case 0: r.t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; r.v.etherType = etherTypes[rand() % 3]; break;
+					case 1: r.t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL; r.v.ipProtocol = ipProtocols[rand() % 3]; break;
+					case 2: r.t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE; r.v.port[0] = rand() % 40; r.v.port[1] = r.v.port[0] + (rand() % 20) - 2; break;
+					case 3: r.t = ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE; r.v.port[0] = rand() % 40; r.v.port[1] = r.v.port[0] + (rand() % 20) - 2; break;
+					case 4: r.t = ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS; r.v.zt = 1 + (rand() % 3); break;
+					case 5: r.t = ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS; r.v.zt = 1 + (rand() % 3); break;
+					case 6: r.t = ZT_NETWORK_RULE_MATCH_VLAN_ID; break;
+					default: {
+						static const uint8_t actions[6] = { ZT_NETWORK_RULE_ACTION_DROP,ZT_NETWORK_RULE_ACTION_ACCEPT,ZT_NETWORK_RULE_ACTION_TEE,ZT_NETWORK_RULE_ACTION_REDIRECT,ZT_NETWORK_RULE_ACTION_BREAK,9 };
+						r.t = actions[rand() % 6];
+						r.v.fwd.address = 1 + (rand() % 4); // 4 is us
+					}	continue;
+				}
+				if ((rand() % 5) == 0) r.t |= 0x80;
+				if ((rand() % 8) == 0) r.t |= 0x40;
+			}
+			CompiledRules cr;
+			cr.compile(4,rules,ruleCount);
+			if (!cr.compiledFrom(rules,ruleCount)) {
+				std::cout << "FAILED! (compiledFrom)" << std::endl;
+				return -1;
+			}
+
+			for(int fn=0;fn<8;++fn) {
+				CompiledRules::Frame f;
+				f.ztSource = 1 + (rand() % 3);
+				f.ztDest = 1 + (rand() % 3);
+				f.etherType = etherTypes[rand() % 3];
+				f.ipProtocol = ((rand() % 4) == 0) ? -1 : (int)ipProtocols[rand() % 3];
+				f.sourcePort = (int)(rand() % 64) - 4;
+				f.destPort = (int)(rand() % 64) - 4;
+				if (f.sourcePort < 0) f.sourcePort = -1;
+				if (f.destPort < 0) f.destPort = -1;
+				uint64_t bits[ZT_COMPILEDRULES_MAX_WORDS];
+				cr.candidates(f,bits);
+
+				unsigned int start = 0,s = 0;
+				for(unsigned int rn=0;rn<ruleCount;++rn) {
+					const unsigned int rt = rules[rn].t & 0x3f;
+					if (rt > ZT_NETWORK_RULE_ACTION__MAX_ID)
+						continue;
+					bool any = false,orred = false,possible = true;
+					for(unsigned int i=start;i<rn;++i) {
+						any = true;
+						orred |= ((rules[i].t & 0x40) != 0);
+						if ((rules[i].t & 0x80))
+							continue;
+						const ZT_VirtualNetworkRule &r = rules[i];
+						switch(r.t & 0x3f) {
+							case ZT_NETWORK_RULE_MATCH_ETHERTYPE: possible &= (r.v.etherType == f.etherType); break;
+							case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL: possible &= ((int)r.v.ipProtocol == f.ipProtocol); break;
+							case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE: possible &= ((f.destPort >= (int)r.v.port[0])&&(f.destPort <= (int)r.v.port[1])); break;
+							case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE: possible &= ((f.sourcePort >= (int)r.v.port[0])&&(f.sourcePort <= (int)r.v.port[1])); break;
+							case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS: possible &= (r.v.zt == f.ztSource); break;
+							case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS: possible &= (r.v.zt == f.ztDest); break;
+						}
+					}
+					const bool toSelf = (((rt == ZT_NETWORK_RULE_ACTION_TEE)||(rt == ZT_NETWORK_RULE_ACTION_REDIRECT))&&(rules[rn].v.fwd.address == 4));
+					if ((rt != 9)&&((orred)||(possible)||(toSelf))) {
+						while ((s < cr.setCount())&&(cr.setStart(s) < start))
+							++s;
+						if ((s >= cr.setCount())||(cr.setStart(s) != start)||(cr.setEnd(s) != rn)||(cr.nextCandidate(bits,s) != s)) {
+							std::cout << "FAILED! (step " << step << " rule " << rn << ")" << std::endl;
+							return -1;
+						}
+					}
+					start = rn + 1;
+					if ((!any)&&(rt != ZT_NETWORK_RULE_ACTION_TEE)&&(rt != ZT_NETWORK_RULE_ACTION_REDIRECT)&&(rt != 9))
+						break;
+				}
+			}
+		}
+
+		// Often hit sets should only move past sets they can trade places with
+		memset(rules,0,sizeof(rules));
+		rules[0].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[0].v.etherType = ZT_ETHERTYPE_ARP;
+		rules[1].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[2].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[2].v.etherType = ZT_ETHERTYPE_IPV4;
+		rules[3].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE; rules[3].v.port[0] = 80; rules[3].v.port[1] = 80;
+		rules[4].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		rules[5].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[5].v.etherType = ZT_ETHERTYPE_IPV6;
+		rules[6].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		rules[7].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE; rules[7].v.port[0] = 81; rules[7].v.port[1] = 90;
+		rules[8].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[9].t = ZT_NETWORK_RULE_ACTION_DROP;
+		CompiledRules cr;
+		cr.compile(4,rules,10);
+		const CompiledRules cp(cr);
+		static const unsigned int hits[5] = { 1,5,100,50,1000 };
+		for(unsigned int s=0;s<5;++s) {
+			for(unsigned int i=0;i<hits[s];++i)
+				cr.counters()->hit(s);
+		}
+		cr.counters()->evaluated(3);
+		std::vector<unsigned int> order;
+		cp.suggestOrder(order);
+		static const unsigned int expected[5] = { 2,3,0,1,4 };
+		if ((cp.counters() != cr.counters())||(cp.counters()->hits(2) != 100)||(cp.counters()->entries() != 3)||(cr.setCount() != 5)||(!cr.swappable(1,3))||(cr.swappable(1,4))||(order.size() != 5)||(memcmp(&(order[0]),expected,sizeof(expected)) != 0)) {
+			std::cout << "FAILED! (suggestOrder)" << std::endl;
+			return -1;
+		}
+		cr.compile(4,rules,10);
+		if ((cp.counters() == cr.counters())||(cr.counters()->hits(2) != 0)) {
+			std::cout << "FAILED! (counters not reset)" << std::endl;
+			return -1;
+		}
+
+		// Sets that only look at frame bytes are kept, others dropped or turned into ACCEPT
+		std::vector<ZT_VirtualNetworkRule> sub;
+		CompiledRules::dropSubset(rules,10,false,sub);
+		bool ok = ((sub.size() == 10)&&(memcmp(&(sub[0]),rules,sizeof(ZT_VirtualNetworkRule) * 10) == 0));
+		rules[7].t = ZT_NETWORK_RULE_MATCH_TAGS_EQUAL;
+		CompiledRules::dropSubset(rules,10,false,sub);
+		ok &= ((sub.size() == 8)&&(memcmp(&(sub[0]),rules,sizeof(ZT_VirtualNetworkRule) * 7) == 0)&&(sub[7].t == ZT_NETWORK_RULE_ACTION_DROP));
+		rules[5].t = ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS;
+		CompiledRules::dropSubset(rules,10,false,sub);
+		ok &= ((sub.size() == 6)&&(memcmp(&(sub[0]),rules,sizeof(ZT_VirtualNetworkRule) * 5) == 0)&&(sub[5].t == ZT_NETWORK_RULE_ACTION_ACCEPT));
+		CompiledRules::dropSubset(rules + 2,3,false,sub);
+		ok &= sub.empty();
+		CompiledRules::dropSubset(rules + 2,3,true,sub);
+		ok &= ((sub.size() == 4)&&(sub[3].t == ZT_NETWORK_RULE_ACTION_DROP));
+		rules[4].t = ZT_NETWORK_RULE_ACTION_TEE;
+		CompiledRules::dropSubset(rules + 2,3,false,sub);
+		ok &= sub.empty();
+		if (!ok) {
+			std::cout << "FAILED! (dropSubset)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing WireRecorder... "; std::cout.flush();
+	{
+		// Datagrams must read back as recorded, and recording must stop at its size limit
+		const char *const path = "zt-selftest-wire.rec";
+		const InetAddress from4("10.1.2.3/9993"),from6("fd00::1234/19993");
+		WireRecorder w;
+		if (!w.start(path,0x1234567890ULL,100000,0)) {
+			std::cout << "FAILED! (start)" << std::endl;
+			return -1;
+		}
+		uint8_t d[1500];
+		for(unsigned int i=0;i<100;++i) {
+			memset(d,(int)i,sizeof(d));
+			w.record(100000 + (int64_t)(i * 7),(i & 1) ? 42 : ((i % 5) ? 43 : -1),reinterpret_cast<const struct sockaddr_storage *>((i & 2) ? &from6 : &from4),d,i * 13);
+		}
+		w.stop();
+		w.record(200000,42,reinterpret_cast<const struct sockaddr_storage *>(&from4),d,10); // ignored once stopped
+
+		WireRecorder::Reader rd;
+		WireRecorder::Record *const rec = new WireRecorder::Record();
+		bool ok = ((rd.open(path))&&(rd.address() == 0x1234567890ULL)&&(rd.start() == 100000));
+		unsigned int n = 0;
+		while ((ok)&&(rd.next(*rec))) {
+			const unsigned int sock = (n & 1) ? 0 : ((n % 5) ? 1 : ZT_WIRE_RECORDER_SOCKET_TCP); // numbered in order of first appearance
+			ok = ((rec->timestamp == (100000 + (int64_t)(n * 7)))&&(rec->socket == sock)&&(rec->from == ((n & 2) ? from6 : from4))&&(rec->len == (n * 13)));
+			for(unsigned int k=0;((ok)&&(k<rec->len));++k)
+				ok = (rec->data[k] == (uint8_t)n);
+			++n;
+		}
+		rd.close();
+		if ((!ok)||(n != 100)) {
+			delete rec;
+			OSUtils::rm(path);
+			std::cout << "FAILED! (read back)" << std::endl;
+			return -1;
+		}
+
+		std::string ps;
+		int64_t st = 0;
+		uint64_t packets = 0,bytes = 0,maxBytes = 0;
+		w.start(path,1,0,4096);
+		for(unsigned int i=0;i<100;++i)
+			w.record(i,1,reinterpret_cast<const struct sockaddr_storage *>(&from4),d,1000);
+		const bool still = w.status(ps,st,packets,bytes,maxBytes);
+		n = 0;
+		if (rd.open(path)) {
+			while (rd.next(*rec))
+				++n;
+		}
+		rd.close();
+		delete rec;
+		OSUtils::rm(path);
+		if ((still)||(w.active())||(packets != 5)||(n != 5)||(bytes < 4096)) {
+			std::cout << "FAILED! (limit)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+#ifndef __WINDOWS__
+	std::cout << "[other] Testing PeerStateFile... "; std::cout.flush();
+	{
+		// Records must survive growth, replacement, deletion, expiry and reopening
+		const char *const path = "zt-selftest-peers.dat";
+		OSUtils::rm(path);
+		PeerStateFile psf;
+		uint8_t d[ZT_PEER_STATE_FILE_MAX_RECORD],r[ZT_PEER_STATE_FILE_MAX_RECORD];
+		bool ok = psf.open(path);
+		for(unsigned int i=1;((ok)&&(i<=3000));++i) { // grows past the initial slots twice
+			memset(d,(int)i,sizeof(d));
+			ok = psf.put(0x1000000000ULL + i,(i <= 1000) ? 100 : 200,d,(int)(i % sizeof(d)));
+		}
+		ok &= (!psf.put(1,200,d,sizeof(d) + 1)); // too large
+		ok &= psf.put(0x1000000000ULL + 5,300,d,0); // replace
+		ok &= psf.put(0x1000000000ULL + 6,300,d,-1); // delete
+		ok &= (psf.expire(150) == 998);
+		ok &= (psf.size() == 2001);
+		psf.close();
+		ok &= psf.open(path);
+		ok &= ((psf.size() == 2001)&&(psf.get(0x1000000000ULL + 5,r,sizeof(r)) == 0)&&(psf.get(0x1000000000ULL + 6,r,sizeof(r)) == -1)&&(psf.get(0x1000000000ULL + 7,r,sizeof(r)) == -1));
+		for(unsigned int i=1001;((ok)&&(i<=3000));++i) {
+			const int n = psf.get(0x1000000000ULL + i,r,sizeof(r));
+			ok = (n == (int)(i % sizeof(d)));
+			for(int k=0;((ok)&&(k<n));++k)
+				ok = (r[k] == (uint8_t)i);
+		}
+		memset(d,0xab,sizeof(d));
+		ok &= psf.put(0x2000000000ULL,400,d,100); // reuses an expired slot
+		ok &= ((psf.get(0x2000000000ULL,r,sizeof(r)) == 100)&&(r[99] == 0xab));
+		psf.close();
+		OSUtils::rm(path);
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+#endif
+
+	std::cout << "[other] Testing TraceLog... "; std::cout.flush();
+	{
+		const std::string tlPath("zt-selftest-tracelog");
+		OSUtils::rmDashRf(tlPath.c_str());
+		OSUtils::mkdir(tlPath.c_str());
+
+		// Two segments from over a week ago, where only the older one's events are all past the default retention
+		char fn[64];
+		const int64_t now = OSUtils::now();
+		OSUtils::ztsnprintf(fn,sizeof(fn),"%.16llx.ztlog",(unsigned long long)(now - ZT_CONTROLLER_TRACELOG_DEFAULT_MAX_AGE - 7200000LL));
+		const std::string expired(tlPath + ZT_PATH_SEPARATOR_S + fn);
+		OSUtils::writeFile(expired.c_str(),std::string());
+		OSUtils::ztsnprintf(fn,sizeof(fn),"%.16llx.ztlog",(unsigned long long)(now - ZT_CONTROLLER_TRACELOG_DEFAULT_MAX_AGE - 3600000LL));
+		const std::string kept(tlPath + ZT_PATH_SEPARATOR_S + fn);
+		OSUtils::writeFile(kept.c_str(),std::string());
+
+		{
+			TraceLog tl(tlPath);
+			for(unsigned long i=0;i<20000;++i) {
+				nlohmann::json r;
+				r["id"] = i;
+				r["objtype"] = "trace";
+				r["event"] = "VL1_INCOMING_PACKET_DROPPED";
+				tl.append(r);
+			}
+		}
+
+		std::vector<nlohmann::json> records;
+		uint64_t bytes = 0;
+		const std::vector<std::string> segments(OSUtils::listDirectory(tlPath.c_str()));
+		for(std::vector<std::string>::const_iterator s(segments.begin());s!=segments.end();++s) {
+			const std::string sp(tlPath + ZT_PATH_SEPARATOR_S + *s);
+			bytes += (uint64_t)OSUtils::getFileSize(sp.c_str());
+			if (!TraceLog::read(sp.c_str(),records)) {
+				std::cout << "FAILED (read " << *s << ")" << std::endl;
 				return -1;
 			}
-			ht.clear();
-			ref.clear();
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (clear)" << std::endl;
-				return -1;
+		}
+		bool ok = (records.size() == 20000);
+		for(unsigned long i=0;((ok)&&(i<records.size()));++i)
+			ok = (OSUtils::jsonInt(records[i]["id"],0ULL) == i);
+		if (!ok) {
+			std::cout << "FAILED (" << records.size() << " records read back)" << std::endl;
+			return -1;
+		}
+		if ((OSUtils::fileExists(expired.c_str()))||(!OSUtils::fileExists(kept.c_str()))) {
+			std::cout << "FAILED (retention)" << std::endl;
+			return -1;
+		}
+		std::cout << records.size() << " records in " << bytes << " bytes ";
+		OSUtils::rmDashRf(tlPath.c_str());
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing ByteRing... "; std::cout.flush();
+	{
+		// Bytes must come out in order across wraparound and growth
+		ByteRing br;
+		std::string model;
+		uint8_t in[5000];
+		unsigned int next = 0;
+		bool ok = true;
+		for(unsigned int k=0;((ok)&&(k<2000));++k) {
+			const unsigned long n = (unsigned long)(rand() % sizeof(in));
+			for(unsigned long i=0;i<n;++i)
+				in[i] = (uint8_t)(next++);
+			if ((k < 1000)||((k & 1) == 0)) { // grows, then mostly drains
+				br.append(in,n);
+				model.append((const char *)in,n);
 			}
-			for(int i=0;i<10000;++i) {
-				uint64_t k = rand();
-				while ((k == 0)||(ref.count(k) > 0))
-					++k;
-				std::string v;
-				for(int j=0;j<(int)(k % 64);++j)
-					v.push_back("0123456789"[rand() % 10]);
-				ht.set(k,v);
-				ref[k] = v;
+			unsigned long take = (unsigned long)(rand() % (sizeof(in) * 2));
+			while ((ok)&&(take)&&(!br.empty())) {
+				unsigned long len = 0;
+				const char *const f = br.front(len);
+				if (len > take)
+					len = take;
+				ok = (memcmp(f,model.data(),len) == 0);
+				br.consume(len);
+				model.erase(0,len);
+				take -= len;
 			}
+			ok &= (br.size() == (unsigned long)model.size());
+		}
+		br.clear();
+		ok &= ((br.empty())&&(br.capacity() <= ZT_BYTERING_MIN_CAPACITY));
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Epoch... "; std::cout.flush();
+	{
+		bool ok = true;
+		{
+			// A held guard (even nested) blocks reclamation of anything retired after it was entered
+			const Epoch::Guard g1;
+			const uint64_t e1 = Epoch::retire();
 			{
-				Hashtable<uint64_t,std::string>::Iterator i(ht);
-				uint64_t *k;
-				std::string *v;
-				while (i.next(k,v))
-					ht.erase(*k);
+				const Epoch::Guard g2;
+				ok &= (!Epoch::safe(Epoch::retire()));
 			}
-			ref.clear();
-			if (ht.size() != ref.size()) {
-				std::cout << "FAILED! (clear by iterate, " << ht.size() << ")" << std::endl;
+			ok &= (!Epoch::safe(e1));
+		}
+		ok &= Epoch::safe(Epoch::retire());
+
+		// Readers check a table while a writer keeps replacing it and freeing old ones
+		struct EpochTest { uint64_t canary[8]; };
+		std::atomic<const EpochTest *> cur(new EpochTest());
+		for(unsigned int i=0;i<8;++i)
+			const_cast<EpochTest *>(cur.load())->canary[i] = 0x1234567890abcdefULL;
+		std::atomic<bool> run(true),bad(false);
+		std::vector<std::thread> readers;
+		for(unsigned int t=0;t<4;++t) {
+			readers.push_back(std::thread([&cur,&run,&bad]() {
+				while (run.load()) {
+					const Epoch::Guard g;
+					const EpochTest *const e = cur.load(std::memory_order_acquire);
+					for(unsigned int i=0;i<8;++i) {
+						if (e->canary[i] != 0x1234567890abcdefULL)
+							bad = true;
+					}
+				}
+			}));
+		}
+		std::vector< std::pair<uint64_t,EpochTest *> > retired;
+		for(unsigned int k=0;k<20000;++k) {
+			EpochTest *const n = new EpochTest();
+			for(unsigned int i=0;i<8;++i)
+				n->canary[i] = 0x1234567890abcdefULL;
+			EpochTest *const old = const_cast<EpochTest *>(cur.exchange(n));
+			retired.push_back(std::pair<uint64_t,EpochTest *>(Epoch::retire(),old));
+			std::vector< std::pair<uint64_t,EpochTest *> >::iterator r(retired.begin());
+			while ((r != retired.end())&&(Epoch::safe(r->first))) {
+				memset(r->second->canary,0,sizeof(r->second->canary)); // poison in case a reader still has it
+				delete r->second;
+				++r;
+			}
+			retired.erase(retired.begin(),r);
+		}
+		run = false;
+		for(std::vector<std::thread>::iterator t(readers.begin());t!=readers.end();++t)
+			t->join();
+		ok &= ((!bad)&&(Epoch::safe(Epoch::retire())));
+		for(std::vector< std::pair<uint64_t,EpochTest *> >::iterator r(retired.begin());r!=retired.end();++r)
+			delete r->second;
+		delete cur.load();
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing TopTalkers... "; std::cout.flush();
+	{
+		// Two heavy members among hundreds of light ones, each with its own UDP flow
+		TopTalkers *const tt = new TopTalkers();
+		const int64_t now = 1000000;
+		uint64_t sent[512];
+		memset(sent,0,sizeof(sent));
+		uint8_t frame[1000];
+		memset(frame,0,sizeof(frame));
+		frame[0] = 0x45;
+		frame[9] = 17;
+		frame[12] = 10; frame[15] = 1;
+		frame[16] = 10;
+		for(unsigned int k=0;k<100000;++k) {
+			const unsigned int r = (unsigned int)rand() % 10;
+			const unsigned int m = (r < 4) ? 1 : ((r < 6) ? 2 : (3 + ((unsigned int)rand() % 500)));
+			const unsigned int len = 100 + ((unsigned int)rand() % 900);
+			frame[19] = (uint8_t)m;
+			frame[20] = (uint8_t)(m >> 8);
+			frame[21] = (uint8_t)m;
+			tt->frame(now + (k / 100),Address(m),ZT_ETHERTYPE_IPV4,frame,len);
+			sent[m] += len;
+		}
+		ZT_TopTalker t[ZT_TOPTALKERS_SIZE * 3];
+		const unsigned int n = tt->get(0x1234,false,now + 1000,t,ZT_TOPTALKERS_SIZE * 3);
+		bool ok = (n == ((ZT_TOPTALKERS_SIZE * 2) + 1)); // only one Ethernet type
+		for(unsigned int i=0;(ok)&&(i<n);++i) {
+			ok &= (t[i].networkId == 0x1234);
+			if ((t[i].type == ZT_TOP_TALKER_MEMBER)&&(t[i].key < 512)) {
+				const uint64_t actual = sent[t[i].key] * ZT_TOPTALKERS_SAMPLE_RATE;
+				ok &= ((t[i].bytes >= actual)&&((t[i].bytes - t[i].bytesError) <= actual));
+			}
+		}
+		ok &= ((t[0].type == ZT_TOP_TALKER_MEMBER)&&(t[0].key == 1)&&(t[1].key == 2));
+		ok &= ((t[ZT_TOPTALKERS_SIZE].type == ZT_TOP_TALKER_FLOW)&&(reinterpret_cast<const InetAddress *>(&(t[ZT_TOPTALKERS_SIZE].source))->port() == 1));
+		ok &= ((t[ZT_TOPTALKERS_SIZE * 2].type == ZT_TOP_TALKER_ETHERTYPE)&&(t[ZT_TOPTALKERS_SIZE * 2].key == ZT_ETHERTYPE_IPV4));
+
+		// Counts age out after two windows
+		ok &= (tt->get(0x1234,false,now + (ZT_TOPTALKERS_WINDOW * 3),t,ZT_TOPTALKERS_SIZE * 3) == 0);
+		delete tt;
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing FlowTable and IpfixExporter... "; std::cout.flush();
+	{
+		bool ok = true;
+
+		// One in sampleRate() frames is sampled, and none once sampling is off
+		FlowTable::setSampleRate(3);
+		unsigned int sampled = 0;
+		for(int i=0;i<30;++i)
+			sampled += (FlowTable::sample()) ? 1 : 0;
+		ok &= (sampled == 10);
+		FlowTable::setSampleRate(0);
+		ok &= (!FlowTable::sample());
+
+		uint8_t udp[28];
+		memset(udp,0,sizeof(udp));
+		udp[0] = 0x45; udp[9] = 17;
+		udp[12] = 10; udp[15] = 1; udp[16] = 10; udp[19] = 2;
+		udp[20] = 0x30; udp[21] = 0x39; udp[23] = 53;
+		uint8_t arp[28];
+		memset(arp,0,sizeof(arp));
+		const int64_t now = 1000000;
+		FlowTable ft;
+		for(int i=0;i<5;++i)
+			ft.frame(now,true,Address(0x1111111111ULL),Address(0x2222222222ULL),ZT_ETHERTYPE_IPV4,udp,sizeof(udp),true);
+		ft.frame(now,false,Address(0x2222222222ULL),Address(0x1111111111ULL),ZT_ETHERTYPE_IPV4,udp,sizeof(udp),false);
+		ft.frame(now,true,Address(0x1111111111ULL),Address(0x2222222222ULL),ZT_ETHERTYPE_ARP,arp,sizeof(arp),true);
+		ZT_FlowRecord r[8];
+		ok &= ((ft.size() == 3)&&(ft.expire(0x1234,now + 1000,r,8) == 0));
+
+		// Flows that stop end after the idle timeout
+		ok &= (ft.expire(0x1234,now + ZT_FLOWTABLE_IDLE_TIMEOUT,r,8) == 3);
+		ok &= (ft.size() == 0);
+		unsigned int ipv4 = 0,other = 0;
+		for(unsigned int i=0;i<3;++i) {
+			ok &= ((r[i].networkId == 0x1234)&&(r[i].start == now)&&(r[i].end == now)&&(r[i].sampleRate == 1));
+			if (r[i].etherType == ZT_ETHERTYPE_IPV4) {
+				++ipv4;
+				const InetAddress &src = *reinterpret_cast<const InetAddress *>(&(r[i].sourceIp));
+				const InetAddress &dst = *reinterpret_cast<const InetAddress *>(&(r[i].destinationIp));
+				ok &= ((src.ss_family == AF_INET)&&(src.port() == 12345)&&(dst.port() == 53)&&(r[i].protocol == 17));
+				if (r[i].accepted)
+					ok &= ((r[i].outbound == 1)&&(r[i].source == 0x1111111111ULL)&&(r[i].packets == 5)&&(r[i].bytes == 5 * sizeof(udp)));
+				else ok &= ((r[i].outbound == 0)&&(r[i].source == 0x2222222222ULL)&&(r[i].packets == 1));
+			} else {
+				++other;
+				ok &= ((r[i].sourceIp.ss_family == 0)&&(r[i].packets == 1));
+			}
+		}
+		ok &= ((ipv4 == 2)&&(other == 1));
+
+		// Flows that keep going are reported after the active timeout and start over
+		ft.frame(now,true,Address(0x1111111111ULL),Address(0x2222222222ULL),ZT_ETHERTYPE_IPV4,udp,sizeof(udp),true);
+		ft.frame(now + ZT_FLOWTABLE_ACTIVE_TIMEOUT - 1,true,Address(0x1111111111ULL),Address(0x2222222222ULL),ZT_ETHERTYPE_IPV4,udp,sizeof(udp),true);
+		ok &= ((ft.expire(0x1234,now + ZT_FLOWTABLE_ACTIVE_TIMEOUT,r,8) == 1)&&(r[0].packets == 2)&&(ft.size() == 1));
+		ok &= (ft.expire(0x1234,now + ZT_FLOWTABLE_ACTIVE_TIMEOUT + 1,r,8) == 0);
+
+		// An IPFIX message is a header, templates, then data sets that exactly cover it
+		ZT_FlowRecord many[100];
+		for(unsigned int i=0;i<100;++i)
+			many[i] = r[0];
+		uint8_t msg[ZT_IPFIX_MAX_MESSAGE];
+		unsigned int consumed = 0;
+		const unsigned int len = IpfixExporter::encode(msg,many,100,true,1234,77,5,0,consumed);
+		ok &= ((len <= ZT_IPFIX_MAX_MESSAGE)&&(consumed > 0)&&(consumed < 100));
+		ok &= ((msg[0] == 0)&&(msg[1] == 10)&&((((unsigned int)msg[2] << 8) | msg[3]) == len)&&(msg[11] == 77)&&(msg[15] == 5));
+		unsigned int p = 16,records = 0;
+		while ((ok)&&(p < len)) {
+			const unsigned int setId = ((unsigned int)msg[p] << 8) | msg[p + 1];
+			const unsigned int setLen = ((unsigned int)msg[p + 2] << 8) | msg[p + 3];
+			ok &= ((setLen >= 4)&&((p + setLen) <= len));
+			if (setId == ZT_IPFIX_TEMPLATE_IPV4)
+				records += (setLen - 4) / 61;
+			else ok &= (setId == 2);
+			p += setLen;
+		}
+		ok &= ((p == len)&&(records == consumed));
+		ok &= ((IpfixExporter::encode(msg,many,0,false,1234,77,5,0,consumed) == 16)&&(consumed == 0));
+
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+#ifdef ZT_HAVE_TAP_FILTER
+	std::cout << "[other] Testing tap filter eBPF... "; std::cout.flush();
+	{
+		ZT_VirtualNetworkRule rules[20];
+		memset(rules,0,sizeof(rules));
+		static const uint8_t ours[6] = { 0x32,0x11,0x22,0x33,0x44,0x55 };
+		rules[0].t = 0x80 | ZT_NETWORK_RULE_MATCH_MAC_SOURCE; memcpy(rules[0].v.mac,ours,6);
+		rules[1].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		rules[2].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[2].v.etherType = ZT_ETHERTYPE_ARP;
+		rules[3].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[4].t = ZT_NETWORK_RULE_MATCH_IPV4_DEST; memcpy(&(rules[4].v.ipv4.ip),InetAddress("10.1.0.0").rawIpData(),4); rules[4].v.ipv4.mask = 16;
+		rules[5].t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL; rules[5].v.ipProtocol = 17;
+		rules[6].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE; rules[6].v.port[0] = 53; rules[6].v.port[1] = 53;
+		rules[7].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		rules[8].t = ZT_NETWORK_RULE_MATCH_IPV4_SOURCE; memcpy(&(rules[8].v.ipv4.ip),InetAddress("10.0.0.0").rawIpData(),4); rules[8].v.ipv4.mask = 8;
+		rules[9].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[10].t = ZT_NETWORK_RULE_MATCH_IPV6_SOURCE; memcpy(rules[10].v.ipv6.ip,InetAddress("fd00:0:0:0:0:0:0:0").rawIpData(),16); rules[10].v.ipv6.mask = 8;
+		rules[11].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[12].t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL; rules[12].v.ipProtocol = 6;
+		rules[13].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE; rules[13].v.port[0] = 1000; rules[13].v.port[1] = 2000;
+		rules[14].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[15].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[15].v.etherType = 0x88b5;
+		rules[16].t = 0x40 | ZT_NETWORK_RULE_MATCH_ETHERTYPE; rules[16].v.etherType = 0x88b6;
+		rules[17].t = ZT_NETWORK_RULE_ACTION_DROP;
+		rules[18].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE; rules[18].v.port[0] = 7000; rules[18].v.port[1] = 7000;
+		rules[19].t = ZT_NETWORK_RULE_ACTION_DROP;
+
+		std::vector<struct bpf_insn> prog;
+		const int fd = LinuxTapFilter::load(rules,20);
+		if ((!LinuxTapFilter::compile(rules,20,prog))||(prog.empty())) {
+			std::cout << "FAILED! (compile)" << std::endl;
+			return -1;
+		} else if (fd < 0) {
+			std::cout << "not available or not permitted, skipped" << std::endl;
+		} else {
+			struct { bool bridged; unsigned int etherType; const char *ip; unsigned int protocol,dport,ihl; int pass; } const frames[13] = {
+				{ false,ZT_ETHERTYPE_ARP,(const char *)0,0,0,0,0 },
+				{ true,ZT_ETHERTYPE_ARP,(const char *)0,0,0,0,1 },
+				{ false,ZT_ETHERTYPE_IPV4,"10.2.3.4",17,53,5,1 }, // accepted before the DROP for 10/8
+				{ false,ZT_ETHERTYPE_IPV4,"10.2.3.4",17,54,5,0 },
+				{ false,ZT_ETHERTYPE_IPV4,"192.168.1.1",17,54,5,1 },
+				{ false,ZT_ETHERTYPE_IPV4,"192.168.1.1",6,7000,6,0 }, // with options
+				{ false,ZT_ETHERTYPE_IPV6,"fd12:0:0:0:0:0:0:1",17,80,0,0 },
+				{ false,ZT_ETHERTYPE_IPV6,"2001:db8:0:0:0:0:0:1",6,1500,0,0 },
+				{ false,ZT_ETHERTYPE_IPV6,"2001:db8:0:0:0:0:0:1",6,2500,0,1 },
+				{ false,ZT_ETHERTYPE_IPV6,"2001:db8:0:0:0:0:0:1",6,1500,1,1 }, // behind an extension header
+				{ false,ZT_ETHERTYPE_IPV6,"2001:db8:0:0:0:0:0:1",17,7000,0,0 },
+				{ false,0x88b6,(const char *)0,0,0,0,0 },
+				{ false,0x88b7,(const char *)0,0,0,0,1 }
+			};
+			uint8_t f[128];
+			for(unsigned int i=0;i<13;++i) {
+				const unsigned int len = testTapFilterFrame(f,frames[i].bridged,frames[i].etherType,frames[i].ip,frames[i].protocol,frames[i].dport,frames[i].ihl);
+				if (LinuxTapFilter::run(fd,f,len) != frames[i].pass) {
+					std::cout << "FAILED! (frame " << i << ")" << std::endl;
+					return -1;
+				}
+			}
+			f[12] = 0x08; f[13] = 0x00;
+			if (LinuxTapFilter::run(fd,f,24) != 1) { // too short to be IPv4 to rules, so no port
+				std::cout << "FAILED! (short frame)" << std::endl;
 				return -1;
 			}
+			::close(fd);
+			std::cout << "PASS" << std::endl;
+		}
+	}
+#endif
+
+#ifndef ZT_NO_OBJECT_POOLS
+	std::cout << "[other] Testing ObjectPool... "; std::cout.flush();
+	{
+		// Slabs must fill, be reused, and be given back (all but one spare) once empty
+		struct PoolTest { uint64_t a[37]; };
+		std::vector<void *> objs;
+		for(unsigned int i=0;i<20000;++i) {
+			objs.push_back(ObjectPool<PoolTest>::allocate(sizeof(PoolTest)));
+			memset(objs.back(),(int)i,sizeof(PoolTest));
+		}
+		ZT_ObjectPoolStats st;
+		ObjectPool<PoolTest>::stats(st);
+		bool ok = ((st.objects == 20000)&&(st.capacity >= 20000)&&((st.bytes % ZT_OBJECT_POOL_SLAB_SIZE) == 0));
+		for(unsigned int i=0;((ok)&&(i<20000));++i)
+			ok = (reinterpret_cast<const uint8_t *>(objs[i])[sizeof(PoolTest) - 1] == (uint8_t)i);
+		for(unsigned int i=0;i<20000;i+=2)
+			ObjectPool<PoolTest>::release(objs[i],sizeof(PoolTest));
+		for(unsigned int i=0;i<20000;i+=2)
+			objs[i] = ObjectPool<PoolTest>::allocate(sizeof(PoolTest));
+		ZT_ObjectPoolStats st2;
+		ObjectPool<PoolTest>::stats(st2);
+		ok &= ((st2.objects == 20000)&&(st2.capacity == st.capacity)); // freed slots are reused before new slabs
+		void *const other = ObjectPool<PoolTest>::allocate(sizeof(PoolTest) + 1); // not this pool's size
+		ObjectPool<PoolTest>::release(other,sizeof(PoolTest) + 1);
+		for(unsigned int i=0;i<20000;++i)
+			ObjectPool<PoolTest>::release(objs[i],sizeof(PoolTest));
+		ObjectPool<PoolTest>::stats(st2);
+		ok &= ((st2.objects == 0)&&(st2.bytes == ZT_OBJECT_POOL_SLAB_SIZE)&&(st2.slabsReleased == ((st.bytes / ZT_OBJECT_POOL_SLAB_SIZE) - 1)));
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
 		}
 	}
 	std::cout << "PASS" << std::endl;
 #endif
 
+	std::cout << "[other] Testing HugePages... "; std::cout.flush();
+	{
+		// Whatever the system provides, memory must be usable, accounted for, and reused
+		HugePages::setMode(ZT_HUGE_PAGES_TRANSPARENT);
+		ZT_HugePageStats st0;
+		HugePages::stats(st0);
+		const std::size_t sizes[5] = { 100,ZT_HUGE_PAGE_MIN_ALLOCATION,200000,ZT_HUGE_PAGE_SIZE,(ZT_HUGE_PAGE_SIZE * 2) + 1 };
+		void *p[5];
+		bool ok = true;
+		for(unsigned int i=0;i<5;++i) {
+			p[i] = HugePages::allocate(sizes[i]);
+			ok &= (p[i] != (void *)0);
+			if (p[i])
+				memset(p[i],(int)i,sizes[i]);
+		}
+		ZT_HugePageStats st;
+		HugePages::stats(st);
+		const bool mapped = (st.fallbacks == st0.fallbacks);
+		ok &= (st.mode == ZT_HUGE_PAGES_TRANSPARENT);
+		if (mapped) {
+			// 64KiB and 256KiB chunks plus one and three huge pages of their own
+			ok &= (st.allocatedBytes == (st0.allocatedBytes + 65536 + 262144 + (ZT_HUGE_PAGE_SIZE * 4)));
+			ok &= ((reinterpret_cast<uintptr_t>(p[3]) % ZT_HUGE_PAGE_SIZE) == 0);
+		}
+		for(unsigned int i=0;i<5;++i)
+			ok &= (reinterpret_cast<const uint8_t *>(p[i])[sizes[i] - 1] == (uint8_t)i);
+		for(unsigned int i=0;i<5;++i)
+			HugePages::release(p[i],sizes[i]);
+		void *const again = HugePages::allocate(200000);
+		HugePages::release(again,200000);
+		if (mapped)
+			ok &= (again == p[2]); // chunks are reused
+		HugePages::stats(st);
+		ok &= (st.allocatedBytes == st0.allocatedBytes);
+
+		// Tables grown while huge pages are on are freed correctly after they're turned off
+		Hashtable<uint64_t,uint64_t> *const ht = new Hashtable<uint64_t,uint64_t>();
+		for(uint64_t i=0;i<100000;++i)
+			ht->set(i,i * 3);
+		HugePages::setMode(ZT_HUGE_PAGES_OFF);
+		for(uint64_t i=100000;i<200000;++i)
+			ht->set(i,i * 3);
+		for(uint64_t i=0;i<200000;i+=997)
+			ok &= ((ht->get(i))&&(*(ht->get(i)) == (i * 3)));
+		delete ht;
+		HugePages::stats(st);
+		ok &= (st.allocatedBytes == st0.allocatedBytes);
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << (mapped ? "mapped" : "malloc() fallback") << ")" << std::endl;
+	}
+
+	std::cout << "[other] Testing Shaper... "; std::cout.flush();
+	{
+		// At 1MB/s 10ms worth passes at once, the next 100ms worth is held, and the rest is dropped
+		const int64_t now = 1000000;
+		Shaper sh((const RuntimeEnvironment *)0,now);
+		const Address member(0x0123456789ULL);
+		uint8_t pkt[1000];
+		memset(pkt,0,sizeof(pkt));
+		bool ok = (!sh.active());
+		sh.setMemberRate(member,1000000);
+		ok &= (sh.active());
+		ok &= (sh.frame((void *)0,SharedPtr<Path>(),Egress::BULK,0x1122334455667788ULL,Address(0x0987654321ULL),pkt,sizeof(pkt),1400,now,0) == Shaper::SEND);
+		unsigned int passed = 0,held = 0,dropped = 0;
+		for(unsigned int i=0;i<200;++i) {
+			switch(sh.frame((void *)0,SharedPtr<Path>(),Egress::BULK,0,member,pkt,sizeof(pkt),1400,now,0)) {
+				case Shaper::SEND: ++passed; break;
+				case Shaper::HELD: ++held; break;
+				default: ++dropped; break;
+			}
+		}
+		ok &= ((passed == 11)&&(held == 100)&&(dropped == 89)&&(sh.heldBytes() == 100000));
+		ZT_RateLimitStats st[4];
+		ok &= ((sh.stats(st,4) == 1)&&(st[0].address == member.toInt())&&(st[0].packetsPassed == 11)&&(st[0].packetsDelayed == 100)&&(st[0].bytesDropped == 89000));
+		sh.setMemberRate(Address(),0);
+		ok &= ((!sh.active())&&(sh.heldBytes() == 100000)); // held packets still go out when due
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Admission... "; std::cout.flush();
+	{
+		// 50ms of work at 100ms/second puts the node 500ms and its source prefix 4s ahead of budget
+		Admission *adm = new Admission();
+		const InetAddress a("10.1.2.3/9993"),a2("10.1.2.200/9993"),b("10.9.9.9/9993");
+		bool ok = adm->admit(Admission::CLASS_VALIDATE,a,1000000);
+		adm->setBudget(100000);
+		ok &= adm->admit(Admission::CLASS_VALIDATE,a,1000000);
+		adm->charge(a,50000,1000000);
+		ok &= ((!adm->admit(Admission::CLASS_WHOIS,a,1000000))&&(!adm->admit(Admission::CLASS_WHOIS,a2,1000000)));
+		ok &= ((!adm->admit(Admission::CLASS_VALIDATE,b,1000000))&&(adm->admit(Admission::CLASS_AGREE,b,1000000))&&(adm->admit(Admission::CLASS_WHOIS,b,1000000)));
+		ok &= ((adm->admit(Admission::CLASS_VALIDATE,b,1000200))&&(!adm->admit(Admission::CLASS_AGREE,a,1003000))&&(adm->admit(Admission::CLASS_AGREE,a,1003400)));
+		adm->setBudget(0);
+		ok &= adm->admit(Admission::CLASS_VALIDATE,a,1000000);
+		delete adm;
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing SelfAwareness NAT classification... "; std::cout.flush();
+	{
+		RuntimeEnvironment env((Node *)0);
+		const int64_t now = OSUtils::now();
+		const InetAddress root1("1.1.1.1/9993"),root2("1.1.1.2/9993"),peer("198.51.100.1/9993");
+		SelfAwareness *sa = new SelfAwareness(&env);
+		bool ok = (sa->natType() == ZT_NAT_TYPE_UNKNOWN);
+		sa->iam((void *)0,Address(0x1111111111ULL),1,root1,InetAddress("203.0.113.5/40000"),true,now + 1000);
+		sa->iam((void *)0,Address(0x2222222222ULL),1,root2,InetAddress("203.0.113.5/40000"),true,now + 1100);
+		sa->iam((void *)0,Address(0x1111111111ULL),2,root1,InetAddress("203.0.113.5/40100"),true,now + 1200);
+		ok &= ((sa->natType() == ZT_NAT_TYPE_CONE)&&(sa->getSymmetricNatPredictions().empty()));
+		delete sa;
+
+		// Same port on every external IP
+		sa = new SelfAwareness(&env);
+		sa->iam((void *)0,Address(0x1111111111ULL),1,root1,InetAddress("203.0.113.5/40000"),true,now + 1000);
+		sa->iam((void *)0,Address(0x2222222222ULL),1,root2,InetAddress("203.0.113.6/40000"),true,now + 1100);
+		std::vector<InetAddress> p(sa->getSymmetricNatPredictions());
+		ok &= ((sa->natType() == ZT_NAT_TYPE_PORT_PRESERVING)&&(p.size() == 2)&&(p[0].port() == 40000));
+		delete sa;
+
+		// Ports handed out two apart, including to an untrusted peer on an IP roots have seen
+		sa = new SelfAwareness(&env);
+		sa->iam((void *)0,Address(0x1111111111ULL),1,root1,InetAddress("203.0.113.5/40000"),true,now + 1000);
+		sa->iam((void *)0,Address(0x2222222222ULL),1,root2,InetAddress("203.0.113.5/40002"),true,now + 1100);
+		sa->iam((void *)0,Address(0x3333333333ULL),1,peer,InetAddress("203.0.113.5/40004"),false,now + 1200);
+		p = sa->getSymmetricNatPredictions();
+		ok &= ((sa->natType() == ZT_NAT_TYPE_SEQUENTIAL)&&(p.size() == 4)&&(p[0] == InetAddress("203.0.113.5/40006"))&&(p[3] == InetAddress("203.0.113.5/40012")));
+		delete sa;
+
+		sa = new SelfAwareness(&env);
+		sa->iam((void *)0,Address(0x1111111111ULL),1,root1,InetAddress("203.0.113.5/40000"),true,now + 1000);
+		sa->iam((void *)0,Address(0x2222222222ULL),1,root2,InetAddress("203.0.113.5/51234"),true,now + 1100);
+		sa->iam((void *)0,Address(0x3333333333ULL),1,peer,InetAddress("203.0.113.5/41000"),false,now + 1200);
+		ok &= (sa->natType() == ZT_NAT_TYPE_RANDOM);
+		delete sa;
+
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing software update deltas... "; std::cout.flush();
+	{
+		// A new image with bytes inserted, changed, and removed should mostly be copied from the old one
+		std::string base,target,delta,rebuilt;
+		base.resize(200000);
+		Utils::getSecureRandom(&(base[0]),(unsigned int)base.length());
+		target = base.substr(0,50000) + std::string(1000,'x') + base.substr(50000,70000);
+		target[90000] ^= 0xff;
+		target.append(base.substr(150000));
+		SoftwareUpdater::makeDelta(base,target,delta);
+		bool ok = ((delta.length() < 2000)&&(SoftwareUpdater::applyDelta(base,delta,rebuilt))&&(rebuilt == target));
+		SoftwareUpdater::makeDelta(std::string(),target,delta);
+		ok &= ((SoftwareUpdater::applyDelta(base,delta,rebuilt))&&(rebuilt == target));
+		SoftwareUpdater::makeDelta(base,target,delta);
+		ok &= (!SoftwareUpdater::applyDelta(base.substr(0,100000),delta,rebuilt)); // copies past the end of the base
+		ok &= (!SoftwareUpdater::applyDelta(base,delta.substr(0,delta.length() - 1),rebuilt));
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing FEC parity... "; std::cout.flush();
+	{
+		// Any one slice of a packet cut into equal slices can be rebuilt from the others and the parity
+		const unsigned int unit = 1400 - (ZT_PROTO_MIN_FRAGMENT_LENGTH + 2);
+		const unsigned int len = (unit * 3) + 123;
+		uint8_t pkt[(1400 - (ZT_PROTO_MIN_FRAGMENT_LENGTH + 2)) * 4];
+		Utils::getSecureRandom(pkt,len);
+		uint8_t par[1400];
+		Packet::Fragment parity(par,Packet::Fragment::writeParity(par,pkt,len,unit,4));
+		bool ok = ((parity.size() == 1400)&&(parity.isParity())&&(parity.totalFragments() == 4)&&(!memcmp(parity.field(0,8),pkt,8)));
+		for(unsigned int missing=0;missing<4;++missing) {
+			const uint8_t *slices[4];
+			unsigned int lengths[4];
+			for(unsigned int f=0;f<4;++f) {
+				slices[f] = pkt + (f * unit);
+				lengths[f] = (f == 3) ? 123 : unit;
+			}
+			uint8_t rebuilt[ZT_PROTO_MAX_PACKET_LENGTH];
+			const unsigned int n = parity.parityRecover(slices,lengths,4,missing,rebuilt);
+			ok &= ((n == lengths[missing])&&(!memcmp(rebuilt,slices[missing],n)));
+			lengths[(missing + 1) % 4] = 7;
+			ok &= (parity.parityRecover(slices,lengths,4,missing,rebuilt) == 0);
+		}
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Egress classification... "; std::cout.flush();
+	{
+		// EF (46) is latency-sensitive by default, best effort and non-IP are not
+		Egress eg((const RuntimeEnvironment *)0);
+		uint8_t ip4[20],ip6[40];
+		memset(ip4,0,sizeof(ip4));
+		memset(ip6,0,sizeof(ip6));
+		ip4[0] = 0x45;
+		ip4[1] = (uint8_t)(46 << 2);
+		ip6[0] = (uint8_t)(0x60 | (46 >> 2));
+		ip6[1] = (uint8_t)((46 & 3) << 6);
+		bool ok = ((eg.classify(ZT_ETHERTYPE_IPV4,ip4,sizeof(ip4)) == Egress::INTERACTIVE)&&(eg.classify(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6)) == Egress::INTERACTIVE));
+		ok &= (eg.classify(ZT_ETHERTYPE_IPV4,ip4,19) == Egress::BULK);
+		ok &= (eg.classify(ZT_ETHERTYPE_ARP,ip4,sizeof(ip4)) == Egress::BULK);
+		ip4[1] = 0;
+		ip6[0] = 0x60;
+		ip6[1] = 0;
+		ok &= ((eg.classify(ZT_ETHERTYPE_IPV4,ip4,sizeof(ip4)) == Egress::BULK)&&(eg.classify(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6)) == Egress::BULK));
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing traffic class and ECN marking of frames... "; std::cout.flush();
+	{
+		uint8_t ip4[20] = { 0x45,0x00,0x00,0x54,0x1c,0x46,0x40,0x00,0x40,0x01,0x00,0x00,0xc0,0xa8,0x00,0x01,0xc0,0xa8,0x00,0xc7 };
+		uint8_t ip6[40];
+		memset(ip6,0,sizeof(ip6));
+		ip4[1] = (uint8_t)((46 << 2) | 2); // EF, ECT(0)
+		uint32_t sum = 0;
+		for(unsigned int i=0;i<20;i+=2)
+			sum += ((uint32_t)ip4[i] << 8) | (uint32_t)ip4[i + 1];
+		while (sum >> 16)
+			sum = (sum & 0xffff) + (sum >> 16);
+		ip4[10] = (uint8_t)((~sum >> 8) & 0xff);
+		ip4[11] = (uint8_t)(~sum & 0xff);
+		ip6[0] = (uint8_t)(0x60 | (46 >> 2));
+		ip6[1] = (uint8_t)(((46 & 3) << 6) | (1 << 4)); // EF, ECT(1)
+		bool ok = ((Egress::trafficClass(ZT_ETHERTYPE_IPV4,ip4,sizeof(ip4)) == ((46 << 2) | 2))&&(Egress::trafficClass(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6)) == ((46 << 2) | 1)));
+		ok &= (Egress::trafficClass(ZT_ETHERTYPE_ARP,ip4,sizeof(ip4)) == 0);
+		ok &= ((Egress::markCongestion(ZT_ETHERTYPE_IPV4,ip4,sizeof(ip4)))&&(Egress::markCongestion(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6))));
+		ok &= ((Egress::trafficClass(ZT_ETHERTYPE_IPV4,ip4,sizeof(ip4)) == ((46 << 2) | 3))&&(Egress::trafficClass(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6)) == ((46 << 2) | 3)));
+		sum = 0;
+		for(unsigned int i=0;i<20;i+=2)
+			sum += ((uint32_t)ip4[i] << 8) | (uint32_t)ip4[i + 1];
+		while (sum >> 16)
+			sum = (sum & 0xffff) + (sum >> 16);
+		ok &= (sum == 0xffff); // header checksum still checks out
+		ok &= (!Egress::markCongestion(ZT_ETHERTYPE_IPV4,ip4,sizeof(ip4))); // already CE
+		ip6[1] &= 0xcf;
+		ok &= ((!Egress::markCongestion(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6)))&&(Egress::trafficClass(ZT_ETHERTYPE_IPV6,ip6,sizeof(ip6)) == (46 << 2))); // Not-ECT is left alone
+		if (!ok) {
+			std::cout << "FAILED!" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[other] Testing/fuzzing Dictionary... "; std::cout.flush();
 	for(int k=0;k<1000;++k) {
 		Dictionary<8194> *test = new Dictionary<8194>();
@@ -909,6 +3159,43 @@ static int testOther()
 				return -1;
 			}
 		}
+		const Dictionary<8194>::Index idx(*test);
+		for(unsigned int q=0;q<32;++q) {
+			char tmp[128],tmp2[128];
+			const int r = (int)(rand() % 130);
+			if ((idx.get(key[q],tmp,r) != test->get(key[q],tmp2,r))||((r)&&(memcmp(tmp,tmp2,strlen(tmp2) + 1)))) {
+				std::cout << "FAILED (index value for '" << key[q] << "' differs)!" << std::endl;
+				return -1;
+			}
+		}
+		delete test;
+	}
+	{
+		Dictionary<8194> *test = new Dictionary<8194>();
+		char k[16];
+		for(unsigned int q=0;q<(ZT_DICTIONARY_INDEX_MAX_ENTRIES * 2);++q)
+			test->add(Utils::hex((uint32_t)q,k),(uint64_t)q + 1);
+		test->add("1",(uint64_t)12345); // duplicate, the first should win
+		const Dictionary<8194>::Index idx(*test);
+		for(unsigned int q=0;q<(ZT_DICTIONARY_INDEX_MAX_ENTRIES * 2);++q) {
+			if (idx.getUI(Utils::hex((uint32_t)q,k)) != ((uint64_t)q + 1)) {
+				std::cout << "FAILED (index lookup of key " << q << ")!" << std::endl;
+				return -1;
+			}
+		}
+		if ((idx.size() != ZT_DICTIONARY_INDEX_MAX_ENTRIES)||(idx.contains("nope"))) {
+			std::cout << "FAILED (index overflow)!" << std::endl;
+			return -1;
+		}
+		const std::string text(test->data(),test->sizeBytes());
+		const Dictionary<8194>::Index tidx(text.c_str(),(unsigned int)text.length() + 1);
+		const char *v = (const char *)0;
+		char h[32];
+		Utils::hex((uint64_t)0x80,h);
+		if ((tidx.getUI("1") != 12345)||(tidx.getUI("0000007f") != 0x80)||(tidx.getEscaped("0000007f",v) != (int)strlen(h))||(memcmp(v,h,strlen(h)))||(tidx.getEscaped("nope",v) != -1)) {
+			std::cout << "FAILED (index of text outside a dictionary)!" << std::endl;
+			return -1;
+		}
 		delete test;
 	}
 	int foo = 0;
@@ -928,11 +3215,148 @@ static int testOther()
 			char value[8194];
 			*bar += test->get(tmp,value,sizeof(value));
 		}
+		const Dictionary<8194>::Index idx(*test);
+		for(unsigned int q=0;q<32;++q) {
+			// Keys from random places in the junk, so some start lines and are found
+			char key[128],value[8194],value2[8194];
+			const char *p = test->data() + (rand() % 8194);
+			unsigned int kl = 0;
+			while ((kl < 127)&&(p < (test->data() + 8194))&&(*p)&&(*p != 13)&&(*p != 10)&&(*p != '='))
+				key[kl++] = *(p++);
+			key[kl] = (char)0;
+			const int r = idx.get(key,value,sizeof(value));
+			if ((r != test->get(key,value2,sizeof(value2)))||((r > 0)&&(memcmp(value,value2,r)))) {
+				std::cout << "FAILED (index differs on junk)!" << std::endl;
+				return -1;
+			}
+		}
 		delete test;
 		delete[] tmp;
 	}
 	std::cout << "PASS (junk value to prevent optimization-out of test: " << foo << ")" << std::endl;
 
+	std::cout << "[other] Testing Buffer::Writer and Buffer::Reader... "; std::cout.flush();
+	{
+		Buffer<32> a,b;
+		a.append((uint8_t)0x12);
+		a.append((uint64_t)0x0102030405060708ULL);
+		MAC(0xaabbccddeeffULL).appendTo(a);
+		a.append((uint16_t)0x86dd);
+		b.append((uint8_t)0x12);
+		{
+			Buffer<32>::Writer w(b,8 + 6 + 2);
+			w.put((uint64_t)0x0102030405060708ULL);
+			MAC(0xaabbccddeeffULL).copyTo(w.field(6),6);
+			w.put((uint16_t)0x86dd);
+		}
+		if (a != b) {
+			std::cout << "FAILED (writer output differs from append())" << std::endl;
+			return -1;
+		}
+		Buffer<32>::Reader r(b,1,8 + 6 + 2);
+		const uint64_t v = r.get<uint64_t>();
+		const MAC m(r.field(6),6);
+		if ((v != 0x0102030405060708ULL)||(m.toInt() != 0xaabbccddeeffULL)||(r.get<uint16_t>() != 0x86dd)) {
+			std::cout << "FAILED (reader returned wrong values)" << std::endl;
+			return -1;
+		}
+		unsigned int threw = 0;
+		try {
+			Buffer<32>::Writer w(b,32);
+		} catch ( ... ) {
+			++threw;
+		}
+		try {
+			Buffer<32>::Reader r2(b,1,32);
+		} catch ( ... ) {
+			++threw;
+		}
+		if ((threw != 2)||(b.size() != 17)) {
+			std::cout << "FAILED (out of bounds reservation accepted)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing network config deltas... "; std::cout.flush();
+	{
+		NetworkConfig *base = new NetworkConfig();
+		base->networkId = 0x8056c2e21c000001ULL;
+		base->timestamp = 1000;
+		base->revision = 1;
+		base->issuedTo = Address(0x1122334455ULL);
+		base->type = ZT_NETWORK_TYPE_PRIVATE;
+		base->mtu = ZT_DEFAULT_MTU;
+		for(unsigned int i=0;i<64;++i) {
+			base->rules[base->ruleCount].t = (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+			base->rules[base->ruleCount++].v.etherType = (uint16_t)(0x0800 + i);
+			base->rules[base->ruleCount++].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+		}
+		uint64_t have[ZT_NETWORKCONFIG_DELTA_BLOBS];
+		base->blobHashes(have);
+
+		NetworkConfig *next = new NetworkConfig(*base);
+		next->timestamp = 2000;
+		NetworkConfig *got = new NetworkConfig();
+		NetworkConfig *empty = new NetworkConfig();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *full = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		next->toDictionary(*full,false);
+		if ((!next->toDictionary(*d,false,have))||(d->contains(ZT_NETWORKCONFIG_DICT_KEY_RULES))||(!d->contains(ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEEP))||(d->sizeBytes() >= full->sizeBytes())) {
+			std::cout << "FAILED (unchanged rules were sent)" << std::endl;
+			return -1;
+		}
+		if ((!got->fromDictionary(*d,*base))||(!(*got == *next))) {
+			std::cout << "FAILED (delta not applied)" << std::endl;
+			return -1;
+		}
+		{
+			// As reassembled from config chunks, with nothing but the text itself
+			const std::string text(d->data(),d->sizeBytes());
+			NetworkConfig assembled(true);
+			if ((!assembled.fromDictionary(text.c_str(),(unsigned int)text.length() + 1,*base))||(!(assembled == *next))) {
+				std::cout << "FAILED (delta not applied from assembled text)" << std::endl;
+				return -1;
+			}
+		}
+		if (got->fromDictionary(*d,*empty)) {
+			std::cout << "FAILED (delta applied without its base)" << std::endl;
+			return -1;
+		}
+		next->rules[0].v.etherType = 0x86dd;
+		if ((!next->toDictionary(*d,false,have))||(!d->contains(ZT_NETWORKCONFIG_DICT_KEY_RULES))||(!got->fromDictionary(*d,*base))||(!(*got == *next))) {
+			std::cout << "FAILED (changed rules were not sent)" << std::endl;
+			return -1;
+		}
+		delete full;
+		delete d;
+		delete empty;
+		delete got;
+		delete next;
+		delete base;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing credential templates... "; std::cout.flush();
+	{
+		NetworkConfig *nc = new NetworkConfig();
+		if (!Membership::CredentialTemplate(*nc).com().empty()) {
+			std::cout << "FAILED (template of config without COM has one)" << std::endl;
+			return -1;
+		}
+		nc->networkId = 0x8056c2e21c000001ULL;
+		nc->com = CertificateOfMembership(1000,100,nc->networkId,Address(0x1122334455ULL));
+		Buffer<ZT_PROTO_MAX_PACKET_LENGTH> b;
+		nc->com.serialize(b);
+		const Membership::CredentialTemplate t(*nc);
+		if ((t.com().size() != b.size())||(memcmp(t.com().data(),b.data(),b.size()) != 0)) {
+			std::cout << "FAILED (COM serialized differently)" << std::endl;
+			return -1;
+		}
+		delete nc;
+	}
+	std::cout << "PASS" << std::endl;
+
 	return 0;
 }
 
@@ -943,6 +3367,7 @@ static int testOther()
 #define ZT_TEST_PHY_TCP_MESSAGE_SIZE 1000000
 #define ZT_TEST_PHY_TIMEOUT_MS 20000
 static unsigned long phyTestUdpPacketCount = 0;
+static unsigned int phyTestUdpLastTos = 0;
 static unsigned long phyTestTcpByteCount = 0;
 static unsigned long phyTestTcpConnectSuccessCount = 0;
 static unsigned long phyTestTcpConnectFailCount = 0;
@@ -951,9 +3376,10 @@ struct TestPhyHandlers;
 static Phy<TestPhyHandlers *> *testPhyInstance = (Phy<TestPhyHandlers *> *)0;
 struct TestPhyHandlers
 {
-	inline void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
+	inline void phyOnDatagrams(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *datagrams,unsigned int count)
 	{
-		++phyTestUdpPacketCount;
+		phyTestUdpPacketCount += count;
+		phyTestUdpLastTos = datagrams[count - 1].tos;
 	}
 
 	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
@@ -1045,7 +3471,7 @@ static int testPhy()
 	unsigned long phyTestTcpInvalidConnectionsAttempted = 0;
 
 	std::cout << "[phy] Testing UDP send/receive... "; std::cout.flush();
-	uint64_t timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+	int64_t timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
 	while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
 		if (phyTestUdpPacketsSent < ZT_TEST_PHY_NUM_UDP_PACKETS) {
 			if (!testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload))) {
@@ -1057,6 +3483,148 @@ static int testPhy()
 	}
 	std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
 
+	std::cout << "[phy] Testing batched UDP send/receive (" << ((testPhyInstance->setUdpOffload(udpListenSock)) ? "with" : "without") << " GRO/GSO)... "; std::cout.flush();
+	PhyDatagram udpTestBatch[64];
+	for(unsigned int i=0;i<64;++i) {
+		udpTestBatch[i].address = (const struct sockaddr *)&bindaddr;
+		udpTestBatch[i].data = udpTestPayload;
+		udpTestBatch[i].len = sizeof(udpTestPayload);
+		udpTestBatch[i].tos = 0;
+	}
+	phyTestUdpPacketCount = 0;
+	phyTestUdpPacketsSent = 0;
+	timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+	while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
+		if (phyTestUdpPacketsSent < ZT_TEST_PHY_NUM_UDP_PACKETS) {
+			if (testPhyInstance->udpSendBatch(udpListenSock,udpTestBatch,64) != 64) {
+				std::cout << "FAILED." << std::endl;
+				return -1;
+			} else phyTestUdpPacketsSent += 64;
+		}
+		testPhyInstance->poll(100);
+	}
+	std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
+
+	std::cout << "[phy] Testing UDP traffic class... "; std::cout.flush();
+	if (!testPhyInstance->setUdpTrafficClass(udpListenSock)) {
+		std::cout << "not available, skipped" << std::endl;
+	} else {
+		const unsigned int tos = (46 << 2) | 2; // EF, ECT(0)
+		phyTestUdpLastTos = 0;
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt)&&(phyTestUdpLastTos != tos)) {
+			testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload),tos);
+			testPhyInstance->poll(100);
+		}
+		if (phyTestUdpLastTos != tos) {
+			std::cout << "FAILED (got " << phyTestUdpLastTos << ")." << std::endl;
+			return -1;
+		}
+		std::cout << "OK" << std::endl;
+	}
+
+	std::cout << "[phy] Testing UDP drop counting and buffer growth... "; std::cout.flush();
+	{
+		struct sockaddr_in dropAddr;
+		memcpy(&dropAddr,&bindaddr,sizeof(dropAddr));
+		dropAddr.sin_port = Utils::hton((uint16_t)60008);
+		PhySocket *dropSock = testPhyInstance->udpBind((const struct sockaddr *)&dropAddr,(void *)0,65536);
+		if (!dropSock) {
+			std::cout << "FAILED (bind)." << std::endl;
+			return -1;
+		}
+		if (!testPhyInstance->setUdpBufferCeiling(dropSock,1048576)) {
+			std::cout << "not available, skipped" << std::endl;
+		} else {
+			// Overflow its receive buffer without polling, then send a few more so a receive reports the drops
+			for(unsigned int i=0;i<2000;++i)
+				testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&dropAddr,udpTestPayload,sizeof(udpTestPayload));
+			timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+			while ((OSUtils::now() < timeoutAt)&&(Phy<TestPhyHandlers *>::udpDrops(dropSock) == 0)) {
+				testPhyInstance->poll(10);
+				testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&dropAddr,udpTestPayload,sizeof(udpTestPayload));
+			}
+			const uint64_t drops = Phy<TestPhyHandlers *>::udpDrops(dropSock);
+			const int bs = Phy<TestPhyHandlers *>::udpBufferSize(dropSock);
+			if ((drops == 0)||(bs <= 65536)||(bs > 1048576)) {
+				std::cout << "FAILED (" << drops << " drops, buffer " << bs << ")." << std::endl;
+				return -1;
+			}
+			std::cout << drops << " drops, buffer grew to " << bs << ", OK" << std::endl;
+		}
+		testPhyInstance->close(dropSock,false);
+	}
+
+	std::cout << "[phy] Testing io_uring UDP send/receive... "; std::cout.flush();
+	{
+		Phy<TestPhyHandlers *> uringPhy(&testPhyHandlers,false,true);
+		if (!uringPhy.enableIoUring()) {
+			std::cout << "not available, skipped" << std::endl;
+		} else {
+			struct sockaddr_in uringAddr;
+			memcpy(&uringAddr,&bindaddr,sizeof(uringAddr));
+			uringAddr.sin_port = Utils::hton((uint16_t)60006);
+			PhySocket *uringSock = uringPhy.udpBind((const struct sockaddr *)&uringAddr);
+			if (!uringSock) {
+				std::cout << "FAILED (bind)." << std::endl;
+				return -1;
+			}
+			for(unsigned int i=0;i<64;++i)
+				udpTestBatch[i].address = (const struct sockaddr *)&uringAddr;
+			phyTestUdpPacketCount = 0;
+			phyTestUdpPacketsSent = 0;
+			timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+			while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
+				if (phyTestUdpPacketsSent < ZT_TEST_PHY_NUM_UDP_PACKETS)
+					phyTestUdpPacketsSent += uringPhy.udpSendBatch(uringSock,udpTestBatch,64);
+				uringPhy.poll(100);
+			}
+			if (phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS) {
+				std::cout << "got " << phyTestUdpPacketCount << " packets, FAILED." << std::endl;
+				return -1;
+			}
+			std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
+			uringPhy.close(uringSock,false);
+			uringPhy.poll(1);
+		}
+	}
+
+	std::cout << "[phy] Testing AF_XDP UDP receive on lo... "; std::cout.flush();
+	{
+		Phy<TestPhyHandlers *> xdpPhy(&testPhyHandlers,false,true);
+		if (!xdpPhy.xdpAttach("lo",1)) {
+			std::cout << "not available or not permitted, skipped" << std::endl;
+		} else {
+			struct sockaddr_in xdpAddr;
+			memcpy(&xdpAddr,&bindaddr,sizeof(xdpAddr));
+			xdpAddr.sin_port = Utils::hton((uint16_t)60007);
+			PhySocket *xdpSock = xdpPhy.udpBind((const struct sockaddr *)&xdpAddr);
+			if (!xdpSock) {
+				std::cout << "FAILED (bind)." << std::endl;
+				return -1;
+			}
+			// Sent through the kernel from another Phy, since loopback drops frames
+			// written straight to it with 127.0.0.1 as their source
+			phyTestUdpPacketCount = 0;
+			phyTestUdpPacketsSent = 0;
+			timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+			while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
+				for(unsigned int i=0;(i<64)&&(phyTestUdpPacketsSent < (ZT_TEST_PHY_NUM_UDP_PACKETS * 2));++i) { // allows for receive ring overruns
+					if (testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&xdpAddr,udpTestPayload,sizeof(udpTestPayload)))
+						++phyTestUdpPacketsSent;
+				}
+				xdpPhy.poll(100);
+			}
+			if (phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS) {
+				std::cout << "got " << phyTestUdpPacketCount << " packets, FAILED." << std::endl;
+				return -1;
+			}
+			std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
+			xdpPhy.close(xdpSock,false);
+			xdpPhy.poll(1);
+		}
+	}
+
 	std::cout << "[phy] Testing TCP... "; std::cout.flush();
 	timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
 	while ((OSUtils::now() < timeoutAt)&&(phyTestTcpByteCount < (ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS * ZT_TEST_PHY_TCP_MESSAGE_SIZE))) {
@@ -28,12 +28,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <ctype.h>
 
 #include <string>
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <functional>
 #include <list>
+#include <queue>
+#include <thread>
 
 #include "../version.h"
 #include "../include/ZeroTierOne.h"
@@ -43,12 +47,15 @@
 #include "../node/Node.hpp"
 #include "../node/Utils.hpp"
 #include "../node/InetAddress.hpp"
+#include "../node/PrefixTrie.hpp"
 #include "../node/MAC.hpp"
 #include "../node/Identity.hpp"
 #include "../node/World.hpp"
 #include "../node/Salsa20.hpp"
 #include "../node/Poly1305.hpp"
 #include "../node/SHA512.hpp"
+#include "../node/FrameCapture.hpp"
+#include "../node/TopTalkers.hpp"
 
 #include "../osdep/Phy.hpp"
 #include "../osdep/Thread.hpp"
@@ -56,7 +63,14 @@
 #include "../osdep/Http.hpp"
 #include "../osdep/PortMapper.hpp"
 #include "../osdep/Binder.hpp"
+#include "../osdep/InterfaceMonitor.hpp"
 #include "../osdep/ManagedRoute.hpp"
+#include "../osdep/BlockingQueue.hpp"
+#include "../osdep/WireRecorder.hpp"
+#include "../osdep/IpfixExporter.hpp"
+#include "../osdep/WriteBehindStore.hpp"
+#include "../osdep/PeerStateFile.hpp"
+#include "../osdep/ByteRing.hpp"
 
 #include "OneService.hpp"
 #include "SoftwareUpdater.hpp"
@@ -73,6 +87,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <ifaddrs.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 #ifdef ZT_USE_SYSTEM_HTTP_PARSER
@@ -144,6 +161,12 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // How often to check for new multicast subscriptions on a tap device
 #define ZT_TAP_CHECK_MULTICAST_INTERVAL 5000
 
+// How often to check all taps for new multicast subscriptions when the OS reports membership changes as they happen
+#define ZT_TAP_MONITORED_CHECK_MULTICAST_INTERVAL 60000
+
+// How often to bring tap kernel filters in line with network rules (with tapFilter)
+#define ZT_TAP_CHECK_FILTER_INTERVAL 5000
+
 // TCP fallback relay (run by ZeroTier, Inc. -- this will eventually go away)
 #define ZT_TCP_FALLBACK_RELAY "204.80.128.1/443"
 
@@ -153,15 +176,43 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // Attempt to engage TCP fallback after this many ms of no reply to packets sent to global-scope IPs
 #define ZT_TCP_FALLBACK_AFTER 60000
 
+// Parallel TCP fallback tunnels by default (see "tcpFallbackTunnels") and at most
+#define ZT_TCP_FALLBACK_TUNNELS 2
+#define ZT_TCP_FALLBACK_MAX_TUNNELS 8
+
+// A tunnel's queue is held to about this many ms of data at the rate the relay has
+// been taking it, within these bounds in bytes. Datagrams that don't fit are dropped.
+#define ZT_TCP_FALLBACK_QUEUE_DELAY 100
+#define ZT_TCP_FALLBACK_MIN_QUEUE 65536
+#define ZT_TCP_FALLBACK_MAX_QUEUE 1048576
+
 // How often to check for local interface addresses
 #define ZT_LOCAL_INTERFACE_CHECK_INTERVAL 60000
 
+// Delay after an OS interface or address change notification before rebinding, so bursts of changes are handled together
+#define ZT_INTERFACE_CHANGE_SETTLE_DELAY 1000
+
+// Period between binding refreshes when interface changes are reported by the OS (a safety net for missed notifications)
+#define ZT_MONITORED_BINDER_REFRESH_PERIOD 300000
+
 // Maximum write buffer size for outgoing TCP connections (sanity limit)
 #define ZT_TCP_MAX_WRITEQ_SIZE 33554432
 
+// How often trace events captured to a file are written out
+#define ZT_TRACE_DRAIN_PERIOD 1000
+
+// Trace records read from the core at a time
+#define ZT_TRACE_READ_BATCH 1024
+
 // TCP activity timeout
 #define ZT_TCP_ACTIVITY_TIMEOUT 60000
 
+// Maximum threads bringing up ports for networks restored from networks.d at startup
+#define ZT_NETWORK_RESTORE_THREADS 8
+
+// Maximum "busyPoll" spin in microseconds
+#define ZT_BUSY_POLL_MAX 100000
+
 namespace ZeroTier {
 
 namespace {
@@ -188,6 +239,15 @@ static std::string _trimString(const std::string &s)
 	return s.substr(start,end - start);
 }
 
+static ZT_MultipathMode _multipathModeFromString(const std::string &s)
+{
+	if (s == "flow")
+		return ZT_MULTIPATH_FLOW_HASH;
+	if (s == "balance")
+		return ZT_MULTIPATH_BALANCE;
+	return ZT_MULTIPATH_NONE;
+}
+
 static void _networkToJson(nlohmann::json &nj,const ZT_VirtualNetworkConfig *nc,const std::string &portDeviceName,const OneService::NetworkSettings &localSettings)
 {
 	char tmp[256];
@@ -220,6 +280,8 @@ static void _networkToJson(nlohmann::json &nj,const ZT_VirtualNetworkConfig *nc,
 	nj["broadcastEnabled"] = (bool)(nc->broadcastEnabled != 0);
 	nj["portError"] = nc->portError;
 	nj["netconfRevision"] = nc->netconfRevision;
+	nj["filterCacheHits"] = nc->filterCacheHits;
+	nj["filterCacheMisses"] = nc->filterCacheMisses;
 	nj["portDeviceName"] = portDeviceName;
 	nj["allowManaged"] = localSettings.allowManaged;
 	nj["allowGlobal"] = localSettings.allowGlobal;
@@ -245,16 +307,21 @@ static void _networkToJson(nlohmann::json &nj,const ZT_VirtualNetworkConfig *nc,
 	nj["routes"] = ra;
 }
 
+static const char *_peerRoleName(const enum ZT_PeerRole role)
+{
+	switch(role) {
+		case ZT_PEER_ROLE_LEAF: return "LEAF";
+		case ZT_PEER_ROLE_MOON: return "MOON";
+		case ZT_PEER_ROLE_PLANET: return "PLANET";
+	}
+	return "";
+}
+
 static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 {
 	char tmp[256];
 
-	const char *prole = "";
-	switch(peer->role) {
-		case ZT_PEER_ROLE_LEAF: prole = "LEAF"; break;
-		case ZT_PEER_ROLE_MOON: prole = "MOON"; break;
-		case ZT_PEER_ROLE_PLANET: prole = "PLANET"; break;
-	}
+	const char *prole = _peerRoleName(peer->role);
 
 	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",peer->address);
 	pj["address"] = tmp;
@@ -265,6 +332,12 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 	pj["version"] = tmp;
 	pj["latency"] = peer->latency;
 	pj["role"] = prole;
+	pj["packetsIn"] = peer->packetsIn;
+	pj["bytesIn"] = peer->bytesIn;
+	pj["relayedPacketsIn"] = peer->relayedPacketsIn;
+	pj["packetsOut"] = peer->packetsOut;
+	pj["bytesOut"] = peer->bytesOut;
+	pj["relayedPacketsOut"] = peer->relayedPacketsOut;
 
 	nlohmann::json pa = nlohmann::json::array();
 	for(unsigned int i=0;i<peer->pathCount;++i) {
@@ -278,11 +351,81 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		j["active"] = (bool)(peer->paths[i].expired == 0);
 		j["expired"] = (bool)(peer->paths[i].expired != 0);
 		j["preferred"] = (bool)(peer->paths[i].preferred != 0);
+		j["latency"] = peer->paths[i].latency;
+		j["jitter"] = peer->paths[i].jitter;
+		j["packetLoss"] = peer->paths[i].packetLoss;
+		j["throughputIn"] = peer->paths[i].throughputIn;
+		j["throughputOut"] = peer->paths[i].throughputOut;
+		j["packetsIn"] = peer->paths[i].packetsIn;
+		j["bytesIn"] = peer->paths[i].bytesIn;
+		j["fragmentsIn"] = peer->paths[i].fragmentsIn;
+		j["packetsOut"] = peer->paths[i].packetsOut;
+		j["bytesOut"] = peer->paths[i].bytesOut;
+		j["fragmentsOut"] = peer->paths[i].fragmentsOut;
 		pa.push_back(j);
 	}
 	pj["paths"] = pa;
 }
 
+// Peer list filters from URL arguments: ?role=LEAF|MOON|PLANET, ?active=1 for peers with a live path, ?address= for an address prefix
+static bool _peerMatches(const ZT_Peer *peer,const std::map<std::string,std::string> &urlArgs)
+{
+	std::map<std::string,std::string>::const_iterator a(urlArgs.find("role"));
+	if (a != urlArgs.end()) {
+		const char *const role = _peerRoleName(peer->role);
+		if (a->second.length() != strlen(role))
+			return false;
+		for(std::string::size_type i=0;i<a->second.length();++i) {
+			if (toupper((unsigned char)a->second[i]) != (int)role[i])
+				return false;
+		}
+	}
+
+	a = urlArgs.find("active");
+	if ((a != urlArgs.end())&&((a->second == "1")||(a->second == "true"))) {
+		bool active = false;
+		for(unsigned int i=0;i<peer->pathCount;++i) {
+			if (!peer->paths[i].expired) {
+				active = true;
+				break;
+			}
+		}
+		if (!active)
+			return false;
+	}
+
+	a = urlArgs.find("address");
+	if (a != urlArgs.end()) {
+		char tmp[16];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",peer->address);
+		if (a->second.length() > 10)
+			return false;
+		for(std::string::size_type i=0;i<a->second.length();++i) {
+			if (tolower((unsigned char)a->second[i]) != (int)tmp[i])
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Append one element of a JSON array that is serialized an element at a time, formatted as OSUtils::jsonDump() formats a whole array
+static void _jsonArrayAppend(std::string &out,const nlohmann::json &j,unsigned long &count)
+{
+	const std::string e(OSUtils::jsonDump(j));
+	out.append((count++ == 0) ? "[\n " : ",\n ");
+	for(std::string::const_iterator c(e.begin());c!=e.end();++c) {
+		out.push_back(*c);
+		if (*c == '\n')
+			out.push_back(' ');
+	}
+}
+
+static void _jsonArrayEnd(std::string &out,const unsigned long count)
+{
+	out.append((count) ? "\n]" : "[]");
+}
+
 static void _moonToJson(nlohmann::json &mj,const World &world)
 {
 	char tmp[4096];
@@ -305,6 +448,25 @@ static void _moonToJson(nlohmann::json &mj,const World &world)
 	mj["waiting"] = false;
 }
 
+static void _objectPoolToJson(nlohmann::json &pj,const ZT_ObjectPoolStats &st)
+{
+	pj["objects"] = st.objects;
+	pj["capacity"] = st.capacity;
+	pj["bytes"] = st.bytes;
+	pj["slabsReleased"] = st.slabsReleased;
+}
+
+static void _hugePagesToJson(nlohmann::json &hj,const ZT_HugePageStats &st)
+{
+	static const char *const modes[3] = { "off","transparent","explicit" };
+	hj["mode"] = modes[(unsigned int)st.mode % 3];
+	hj["explicitBytes"] = st.explicitBytes;
+	hj["transparentBytes"] = st.transparentBytes;
+	hj["allocatedBytes"] = st.allocatedBytes;
+	hj["fallbacks"] = st.fallbacks;
+	hj["anonHugePagesBytes"] = OSUtils::anonHugePageBytes();
+}
+
 class OneServiceImpl;
 
 static int SnodeVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf);
@@ -312,10 +474,29 @@ static void SnodeEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event
 static void SnodeStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len);
 static int SnodeStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen);
 static int SnodeWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl);
+static int SnodeWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count);
 static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr);
 static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result);
+static int SnodeHostedVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf);
+static void SnodeHostedEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData);
+static void SnodeHostedStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len);
+static int SnodeHostedStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen);
+static int SnodeHostedWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl);
+static int SnodeHostedWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count);
+static void SnodeHostedVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+static int SnodeHostedPathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr);
+static int SnodeHostedPathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result);
+static void SclusterSendFunction(void *uptr,unsigned int memberId,const void *data,unsigned int len);
+static int SclusterAddressToLocationFunction(void *uptr,const struct sockaddr_storage *addr,int *x,int *y,int *z);
+#ifdef ZT_USE_MINIUPNPC
+static void SportMapperChangedFunction(void *uptr);
+#endif
+#ifdef ZT_SDK
 static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+#else
+static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const ZT_VirtualNetworkFrame *frames,unsigned int count);
+#endif
 
 static int ShttpOnMessageBegin(http_parser *parser);
 static int ShttpOnUrl(http_parser *parser,const char *ptr,size_t length);
@@ -380,8 +561,14 @@ struct TcpConnection
 	std::map< std::string,std::string > headers;
 
 	std::string readq;
-	std::string writeq;
+	ByteRing writeq;
 	Mutex writeq_m;
+
+	// Used for TCP fallback tunnels
+	bool flushPending; // written to an empty queue, to be sent by _tcpFallbackFlush()
+	int64_t drainStart; // start of the current drain rate sample, 0 while the queue is empty
+	unsigned long drainBytes; // bytes sent in the current sample
+	unsigned long drainRate; // bytes per second the relay has taken while we were backlogged
 };
 
 class OneServiceImpl : public OneService
@@ -392,6 +579,8 @@ public:
 	const std::string _homePath;
 	std::string _authToken;
 	std::string _controllerDbPath;
+	unsigned int _controllerPushRate;
+	std::string _controllerInstanceId;
 	const std::string _networksPath;
 	const std::string _moonsPath;
 
@@ -410,10 +599,9 @@ public:
 	json _localConfig;
 	Hashtable< uint64_t,std::vector<InetAddress> > _v4Hints;
 	Hashtable< uint64_t,std::vector<InetAddress> > _v6Hints;
-	Hashtable< uint64_t,std::vector<InetAddress> > _v4Blacklists;
-	Hashtable< uint64_t,std::vector<InetAddress> > _v6Blacklists;
-	std::vector< InetAddress > _globalV4Blacklist;
-	std::vector< InetAddress > _globalV6Blacklist;
+	Hashtable< uint64_t,PrefixTrie<bool> > _blacklists;
+	std::vector<uint64_t> _multipathPeers; // peers given their own multipathMode in local.conf
+	PrefixTrie<bool> _globalBlacklist;
 	std::vector< InetAddress > _allowManagementFrom;
 	std::vector< std::string > _interfacePrefixBlacklist;
 	Mutex _localConfig_m;
@@ -431,6 +619,7 @@ public:
 	 */
 	unsigned int _ports[3];
 	Binder _binder;
+	InterfaceMonitor _ifMonitor;
 
 	// Time we last received a packet from a global address
 	uint64_t _lastDirectReceiveFromGlobal;
@@ -441,14 +630,57 @@ public:
 	// Last potential sleep/wake event
 	uint64_t _lastRestart;
 
+	// Milliseconds between writes of state.snapshot, which is also written at exit and restored at start, or 0 if off
+	int64_t _stateSnapshotInterval;
+
+	// Trace capture started through POST /trace, drained to trace.log if a file was requested
+	FILE *_traceFile;
+	int64_t _traceUntil; // 0 if capture runs until DELETE /trace
+	uint64_t _traceDropped;
+	bool _traceCapturing;
+
+	// Received datagrams recorded through POST /record for offline replay
+	WireRecorder _wireRecorder;
+
+	// Sampled flows through network rules sent to an IPFIX collector if "flowExport" is set in local.conf
+	IpfixExporter _ipfix;
+
+	// Root cluster backplane if "cluster" is set in local.conf. Peers are located
+	// for redirection by the most specific matching network in _clusterLocations.
+	struct ClusterLocation
+	{
+		InetAddress net;
+		int x,y,z;
+	};
+	PhySocket *_clusterBackplane;
+	InetAddress _clusterMembers[ZT_CLUSTER_MAX_MEMBERS]; // backplane address of each other member by ID
+	std::vector< ClusterLocation > _clusterLocations; // most specific first
+
 	// Deadline for the next background task service function
 	volatile int64_t _nextBackgroundTaskDeadline;
 
+	// Extra identities from hosted.d, sharing our sockets, threads and planet
+	struct HostedNode
+	{
+		OneServiceImpl *service;
+		std::string homePath;
+		Node *node;
+		volatile int64_t nextBackgroundTaskDeadline;
+		volatile int64_t scheduled; // deadline queued in _hostedTimers, 0 while the main loop is running its tasks
+	};
+	typedef std::pair< int64_t,HostedNode * > HostedTimer;
+	bool _hostedNodesEnabled;
+	std::vector< HostedNode * > _hostedNodes;
+	Hashtable< uint64_t,HostedNode * > _hostedByAddress; // filled before any packets arrive and only read after
+	std::priority_queue< HostedTimer,std::vector< HostedTimer >,std::greater< HostedTimer > > _hostedTimers; // soonest first
+	Mutex _hostedTimers_m;
+
 	// Configured networks
 	struct NetworkState
 	{
 		NetworkState() :
-			tap((EthernetTap *)0)
+			tap((EthernetTap *)0),
+			restoring(false)
 		{
 			// Real defaults are in network 'up' code in network event handler
 			settings.allowManaged = true;
@@ -461,14 +693,27 @@ public:
 		std::vector<InetAddress> managedIps;
 		std::list< SharedPtr<ManagedRoute> > managedRoutes;
 		NetworkSettings settings;
+		bool restoring; // port is being brought up by a restore thread
 	};
 	std::map<uint64_t,NetworkState> _nets;
 	Mutex _nets_m;
 
+	// Networks joined from networks.d at startup have their ports brought up
+	// on these threads so a node in many networks isn't ready only after
+	// setting each one up in turn. The queue and flag are locked by _nets_m.
+	std::vector< std::thread > _restoreThreads;
+	std::vector< std::pair<uint64_t,void **> > _restoreQueue;
+	bool _restoring;
+
 	// Active TCP/IP connections
 	std::vector< TcpConnection * > _tcpConnections;
 	Mutex _tcpConnections_m;
-	TcpConnection *_tcpFallbackTunnel;
+
+	// Connected TCP fallback tunnels, which datagrams are spread across by destination
+	std::vector< TcpConnection * > _tcpFallbackTunnels;
+	unsigned int _tcpFallbackConnecting; // tunnels whose connect hasn't completed
+	unsigned int _tcpFallbackTunnelCount; // tunnels wanted
+	Mutex _tcpFallbackTunnels_m;
 
 	// Termination status information
 	ReasonForTermination _termReason;
@@ -481,6 +726,62 @@ public:
 	PortMapper *_portMapper;
 #endif
 
+	// Received packet processing threads, if "concurrency" is more than one.
+	// Datagrams are sharded by remote address so each path (and therefore
+	// almost always each peer) is processed in order on one thread.
+	struct RxDatagram
+	{
+		int64_t sock;
+		struct sockaddr_storage from;
+		unsigned int len;
+		unsigned int tos;
+		uint8_t data[1]; // actually len bytes
+	};
+	unsigned int _concurrency;
+	std::vector< BlockingQueue<RxDatagram *> * > _rxQueues;
+	std::vector< std::thread > _rxThreads;
+
+	// CPUs threads are pinned to from "cpuAffinity" in local.conf, taken in turn
+	// by each thread of a kind (tap readers and crypto workers are set up elsewhere)
+	std::vector<unsigned int> _ioCpus;
+	std::vector<unsigned int> _rxCpus;
+	std::vector<unsigned int> _udpCpus;
+	std::vector<unsigned int> _controllerCpus;
+
+	// On Linux each bound address can instead get a group of SO_REUSEPORT UDP
+	// sockets, one in each of these Phy<> instances, each polled by its own
+	// thread so the kernel spreads flows across cores. A thread holds its lock
+	// while polling, and binding refreshes pause them all to modify their Phy<>.
+	struct UdpThread
+	{
+		UdpThread(OneServiceImpl *s) : phy(s,false,true),cpu(-1) {}
+		Phy<OneServiceImpl *> phy;
+		Mutex lock;
+		std::thread thread;
+		int cpu; // CPU this thread is pinned to or -1
+	};
+	unsigned int _udpSocketsPerAddress;
+	bool _ioUring; // UDP and tap I/O on io_uring instead of epoll and select()
+	bool _rio; // UDP I/O through Registered I/O instead of select() on Windows
+	std::string _xdpInterface; // if set, UDP ports are steered into AF_XDP on this interface
+	unsigned int _xdpQueues;
+	unsigned long _busyPoll; // microseconds I/O threads spin before waiting
+	bool _socketBusyPoll; // also set SO_BUSY_POLL on UDP sockets
+	bool _tapFilter; // drop frames rules would drop in the kernel before taps are read (Linux)
+	unsigned int _underlayTos; // bits of frames' traffic class set on the UDP carrying them (underlayDscp, underlayEcn)
+	std::vector< UdpThread * > _udpThreads;
+	std::vector< Phy<OneServiceImpl *> * > _udpPhys;
+	volatile bool _udpThreadsPaused;
+	volatile bool _udpThreadsRun;
+
+	// Peers, network configs, etc. are written by this on its own thread
+	WriteBehindStore _stateStore;
+
+#ifndef __WINDOWS__
+	// Peers are kept here instead of in peers.d if "peerStateFile" is set in local.conf
+	PeerStateFile _peerStateFile;
+#endif
+
 	// Set to false to force service to stop
 	volatile bool _run;
 	Mutex _run_m;
@@ -490,6 +791,7 @@ public:
 	OneServiceImpl(const char *hp,unsigned int port) :
 		_homePath((hp) ? hp : ".")
 		,_controllerDbPath(_homePath + ZT_PATH_SEPARATOR_S "controller.d")
+		,_controllerPushRate(0)
 		,_networksPath(_homePath + ZT_PATH_SEPARATOR_S "networks.d")
 		,_moonsPath(_homePath + ZT_PATH_SEPARATOR_S "moons.d")
 		,_controller((EmbeddedNetworkController *)0)
@@ -506,13 +808,33 @@ public:
 		,_lastSendToGlobalV4(0)
 #endif
 		,_lastRestart(0)
+		,_stateSnapshotInterval(0)
+		,_traceFile((FILE *)0)
+		,_traceUntil(0)
+		,_traceDropped(0)
+		,_traceCapturing(false)
+		,_clusterBackplane((PhySocket *)0)
 		,_nextBackgroundTaskDeadline(0)
-		,_tcpFallbackTunnel((TcpConnection *)0)
+		,_hostedNodesEnabled(false)
+		,_restoring(false)
+		,_tcpFallbackConnecting(0)
+		,_tcpFallbackTunnelCount(ZT_TCP_FALLBACK_TUNNELS)
 		,_termReason(ONE_STILL_RUNNING)
 		,_portMappingEnabled(true)
 #ifdef ZT_USE_MINIUPNPC
 		,_portMapper((PortMapper *)0)
 #endif
+		,_concurrency(1)
+		,_udpSocketsPerAddress(1)
+		,_ioUring(false)
+		,_rio(false)
+		,_xdpQueues(1)
+		,_busyPoll(0)
+		,_socketBusyPoll(false)
+		,_tapFilter(false)
+		,_underlayTos(0)
+		,_udpThreadsPaused(false)
+		,_udpThreadsRun(true)
 		,_run(true)
 	{
 		_ports[0] = 0;
@@ -522,9 +844,15 @@ public:
 
 	virtual ~OneServiceImpl()
 	{
-		_binder.closeAll(_phy);
+		_binder.closeAll(_phy,(_udpPhys.empty()) ? (Phy<OneServiceImpl *> *const *)0 : _udpPhys.data(),(unsigned int)_udpPhys.size());
+		for(std::vector< UdpThread * >::iterator t(_udpThreads.begin());t!=_udpThreads.end();++t)
+			delete *t;
 		_phy.close(_localControlSocket4);
 		_phy.close(_localControlSocket6);
+		if (_clusterBackplane)
+			_phy.close(_clusterBackplane);
+		if (_traceFile)
+			fclose(_traceFile);
 #ifdef ZT_USE_MINIUPNPC
 		delete _portMapper;
 #endif
@@ -556,7 +884,7 @@ public:
 
 			{
 				struct ZT_Node_Callbacks cb;
-				cb.version = 0;
+				cb.version = 3;
 				cb.stateGetFunction = SnodeStateGetFunction;
 				cb.statePutFunction = SnodeStatePutFunction;
 				cb.wirePacketSendFunction = SnodeWirePacketSendFunction;
@@ -565,6 +893,8 @@ public:
 				cb.eventCallback = SnodeEventCallback;
 				cb.pathCheckFunction = SnodePathCheckFunction;
 				cb.pathLookupFunction = SnodePathLookupFunction;
+				cb.wirePacketBatchSendFunction = SnodeWirePacketBatchSendFunction;
+				cb.virtualNetworkFrameBufferFunction = (ZT_VirtualNetworkFrameBufferFunction)0;
 				_node = new Node(this,(void *)0,&cb,OSUtils::now());
 			}
 
@@ -638,6 +968,25 @@ public:
 					if (cdbp.length() > 0)
 						_controllerDbPath = cdbp;
 
+					// Maximum config pushes per second after a network changes (0 for default)
+					_controllerPushRate = (unsigned int)OSUtils::jsonInt(settings["controllerPushRate"],0ULL);
+
+					// Name of this instance if several controllers share this identity and database
+					_controllerInstanceId = OSUtils::jsonString(settings["controllerInstanceId"],"");
+
+#ifndef __WINDOWS__
+					// Keep peers in one mapped file instead of a file each in peers.d
+					if (OSUtils::jsonBool(settings["peerStateFile"],false)) {
+						if (!_peerStateFile.open((_homePath + ZT_PATH_SEPARATOR_S "peers.dat").c_str()))
+							fprintf(stderr,"WARNING: unable to open peers.dat, using peers.d" ZT_EOL_S);
+					}
+#endif
+
+					// Run as a member of a root cluster
+					json &cluster = settings["cluster"];
+					if (cluster.is_object())
+						_initCluster(cluster);
+
 					// Bind to wildcard instead of to specific interfaces (disables full tunnel capability)
 					json &bind = settings["bind"];
 					if (bind.is_array()) {
@@ -661,6 +1010,8 @@ public:
 
 			// Apply other runtime configuration from local.conf
 			applyLocalConfig();
+			if ((!_ioCpus.empty())&&(!Utils::pinThread(_ioCpus[0])))
+				fprintf(stderr,"WARNING: unable to pin service thread to CPU %u" ZT_EOL_S,_ioCpus[0]);
 
 			// Make sure we can use the primary port, and hunt for one if configured to do so
 			const int portTrials = (_primaryPort == 0) ? 256 : 1; // if port is 0, pick random
@@ -740,7 +1091,7 @@ public:
 					if (_ports[2]) {
 						char uniqueName[64];
 						OSUtils::ztsnprintf(uniqueName,sizeof(uniqueName),"ZeroTier/%.10llx@%u",_node->address(),_ports[2]);
-						_portMapper = new PortMapper(_ports[2],uniqueName);
+						_portMapper = new PortMapper(_ports[2],uniqueName,SportMapperChangedFunction,this);
 					}
 				}
 			}
@@ -751,16 +1102,28 @@ public:
 
 			// Network controller is now enabled by default for desktop and server
 			_controller = new EmbeddedNetworkController(_node,_controllerDbPath.c_str());
+			_controller->setPushRate(_controllerPushRate);
+			_controller->setInstanceId(_controllerInstanceId);
+			_controller->setWorkerCpus(_controllerCpus);
 			_node->setNetconfMaster((void *)_controller);
 
-			// Join existing networks in networks.d
+			// Join existing networks in networks.d, which run on their cached configs right
+			// away while restore threads bring up their ports side by side
 			{
 				std::vector<std::string> networksDotD(OSUtils::listDirectory((_homePath + ZT_PATH_SEPARATOR_S "networks.d").c_str()));
+				_nets_m.lock();
+				_restoring = true;
+				_nets_m.unlock();
 				for(std::vector<std::string>::iterator f(networksDotD.begin());f!=networksDotD.end();++f) {
 					std::size_t dot = f->find_last_of('.');
 					if ((dot == 16)&&(f->substr(16) == ".conf"))
 						_node->join(Utils::hexStrToU64(f->substr(0,dot).c_str()),(void *)0,(void *)0);
 				}
+				Mutex::Lock _l(_nets_m);
+				_restoring = false;
+				const unsigned long rt = std::min((unsigned long)_restoreQueue.size(),(unsigned long)ZT_NETWORK_RESTORE_THREADS);
+				for(unsigned long i=0;i<rt;++i)
+					_restoreThreads.push_back(std::thread(&OneServiceImpl::_restoreThreadMain,this));
 			}
 
 			// Orbit existing moons in moons.d
@@ -773,15 +1136,60 @@ public:
 				}
 			}
 
+			if (_hostedNodesEnabled)
+				_startHostedNodes();
+
+			// Start receive threads if configured to use them
+			if (_concurrency > 1) {
+				for(unsigned int t=0;t<_concurrency;++t) {
+					_rxQueues.push_back(new BlockingQueue<RxDatagram *>());
+					_rxThreads.push_back(std::thread(&OneServiceImpl::_rxThreadMain,this,_rxQueues.back(),(_rxCpus.empty()) ? -1 : (int)_rxCpus[t % _rxCpus.size()]));
+				}
+			}
+#ifdef __LINUX__
+			if ((_ioUring)&&(!_phy.enableIoUring()))
+				fprintf(stderr,"WARNING: io_uring is not available, using epoll for UDP I/O" ZT_EOL_S);
+			if ((_xdpInterface.length() > 0)&&(!_phy.xdpAttach(_xdpInterface.c_str(),_xdpQueues)))
+				fprintf(stderr,"WARNING: unable to use AF_XDP on %s, using normal UDP sockets" ZT_EOL_S,_xdpInterface.c_str());
+			if (_udpSocketsPerAddress > 1) {
+				// With CPUs set, socket k of each group is polled on the k-th CPU and gets
+				// the datagrams the kernel received there
+				std::vector<unsigned int> groupCpus;
+				for(unsigned int t=0;(t<_udpSocketsPerAddress)&&(!_udpCpus.empty());++t)
+					groupCpus.push_back(_udpCpus[t % _udpCpus.size()]);
+				for(unsigned int t=0;t<_udpSocketsPerAddress;++t) {
+					_udpThreads.push_back(new UdpThread(this));
+					_udpThreads.back()->cpu = (groupCpus.empty()) ? -1 : (int)groupCpus[t];
+					_udpThreads.back()->phy.setReusePortCpus(groupCpus);
+					_udpThreads.back()->phy.setBusyPoll(_busyPoll,_socketBusyPoll);
+					if (_ioUring)
+						_udpThreads.back()->phy.enableIoUring();
+					_udpPhys.push_back(&(_udpThreads.back()->phy));
+				}
+				for(std::vector< UdpThread * >::iterator t(_udpThreads.begin());t!=_udpThreads.end();++t)
+					(*t)->thread = std::thread(&OneServiceImpl::_udpThreadMain,this,*t);
+			}
+#endif
+#ifdef __WINDOWS__
+			if ((_rio)&&(!_phy.enableRio()))
+				fprintf(stderr,"WARNING: Registered I/O is not available, using select() for UDP I/O" ZT_EOL_S);
+#endif
+
 			// Main I/O loop
 			_nextBackgroundTaskDeadline = 0;
 			int64_t clockShouldBe = OSUtils::now();
 			_lastRestart = clockShouldBe;
 			int64_t lastTapMulticastGroupCheck = 0;
+			int64_t lastTapFilterCheck = 0;
 			int64_t lastBindRefresh = 0;
 			int64_t lastUpdateCheck = clockShouldBe;
 			int64_t lastCleanedPeersDb = 0;
-			int64_t lastLocalInterfaceAddressCheck = (clockShouldBe - ZT_LOCAL_INTERFACE_CHECK_INTERVAL) + 15000; // do this in 15s to give portmapper time to configure and other things time to settle
+			int64_t lastStateSnapshot = clockShouldBe;
+			bool stateSnapshotRestored = false;
+			int64_t lastTraceDrain = 0;
+			int64_t lastLocalInterfaceAddressCheck = (clockShouldBe - ZT_LOCAL_INTERFACE_CHECK_INTERVAL) + 15000; // do this in 15s to give other things time to settle, the port mapper brings it forward when it has a mapping
+			int64_t interfaceChangedAt = 0;
+			bool interfacesMonitored = _ifMonitor.start(_phy);
 			for(;;) {
 				_run_m.lock();
 				if (!_run) {
@@ -794,7 +1202,7 @@ public:
 					_run_m.unlock();
 				}
 
-				const int64_t now = OSUtils::now();
+				const int64_t now = OSUtils::updateCoarseNow();
 
 				// Attempt to detect sleep/wake events by detecting delay overruns
 				bool restarted = false;
@@ -810,16 +1218,35 @@ public:
 						_updater->apply();
 				}
 
+				// Note interface and address changes reported by the OS, reopening the notification socket if it was lost
+				if ((interfacesMonitored)&&(!_ifMonitor.socket())) {
+					interfacesMonitored = _ifMonitor.start(_phy);
+					lastTapMulticastGroupCheck = 0; // multicast changes may have been missed too
+				}
+				if (_ifMonitor.changed())
+					interfaceChangedAt = now;
+				const bool interfacesChanged = ((interfaceChangedAt > 0)&&((now - interfaceChangedAt) >= ZT_INTERFACE_CHANGE_SETTLE_DELAY));
+
 				// Refresh bindings in case device's interfaces have changed, and also sync routes to update any shadow routes (e.g. shadow default)
-				if (((now - lastBindRefresh) >= ZT_BINDER_REFRESH_PERIOD)||(restarted)) {
+				if (((now - lastBindRefresh) >= ((interfacesMonitored) ? ZT_MONITORED_BINDER_REFRESH_PERIOD : ZT_BINDER_REFRESH_PERIOD))||(restarted)||(interfacesChanged)) {
 					lastBindRefresh = now;
+					if (interfacesChanged) {
+						interfaceChangedAt = 0;
+						lastLocalInterfaceAddressCheck = now - ZT_LOCAL_INTERFACE_CHECK_INTERVAL; // also tell the core about new addresses below
+					}
+#ifdef ZT_USE_MINIUPNPC
+					if ((_portMapper)&&((interfacesChanged)||(restarted)))
+						_portMapper->networkChanged();
+#endif
 					unsigned int p[3];
 					unsigned int pc = 0;
 					for(int i=0;i<3;++i) {
 						if (_ports[i])
 							p[pc++] = _ports[i];
 					}
-					_binder.refresh(_phy,p,pc,explicitBind,*this);
+					_pauseUdpThreads();
+					_binder.refresh(_phy,p,pc,explicitBind,*this,(_udpPhys.empty()) ? (Phy<OneServiceImpl *> *const *)0 : _udpPhys.data(),(unsigned int)_udpPhys.size());
+					_resumeUdpThreads();
 					{
 						Mutex::Lock _l(_nets_m);
 						for(std::map<uint64_t,NetworkState>::iterator n(_nets.begin());n!=_nets.end();++n) {
@@ -829,26 +1256,45 @@ public:
 					}
 				}
 
+				// Restore the state snapshot once sockets are bound, so restored peers' HELLOs go out
+				if (!stateSnapshotRestored) {
+					stateSnapshotRestored = true;
+					if (_stateSnapshotInterval > 0)
+						_restoreStateSnapshot(now);
+				}
+
 				// Run background task processor in core if it's time to do so
 				int64_t dl = _nextBackgroundTaskDeadline;
 				if (dl <= now) {
 					_node->processBackgroundTasks((void *)0,now,&_nextBackgroundTaskDeadline);
 					dl = _nextBackgroundTaskDeadline;
 				}
+				if (!_hostedNodes.empty())
+					dl = std::min(dl,_runHostedNodes(now));
 
-				// Close TCP fallback tunnel if we have direct UDP
-				if ((_tcpFallbackTunnel)&&((now - _lastDirectReceiveFromGlobal) < (ZT_TCP_FALLBACK_AFTER / 2)))
-					_phy.close(_tcpFallbackTunnel->sock);
+				// Close TCP fallback tunnels if we have direct UDP
+				if ((now - _lastDirectReceiveFromGlobal) < (ZT_TCP_FALLBACK_AFTER / 2)) {
+					std::vector< TcpConnection * > tunnels;
+					{
+						Mutex::Lock _l(_tcpFallbackTunnels_m);
+						tunnels = _tcpFallbackTunnels;
+					}
+					for(std::vector< TcpConnection * >::const_iterator t(tunnels.begin());t!=tunnels.end();++t)
+						_phy.close((*t)->sock);
+				}
 
-				// Sync multicast group memberships
-				if ((now - lastTapMulticastGroupCheck) >= ZT_TAP_CHECK_MULTICAST_INTERVAL) {
-					lastTapMulticastGroupCheck = now;
+				// Sync multicast group memberships of all taps periodically, or right away for taps the OS reported changes on
+				std::set<std::string> mgChangedDevices;
+				const bool mgSweep = ((now - lastTapMulticastGroupCheck) >= ((_ifMonitor.multicastMonitored()) ? ZT_TAP_MONITORED_CHECK_MULTICAST_INTERVAL : ZT_TAP_CHECK_MULTICAST_INTERVAL));
+				if ((_ifMonitor.multicastChanged(mgChangedDevices))||(mgSweep)) {
+					if (mgSweep)
+						lastTapMulticastGroupCheck = now;
 					std::vector< std::pair< uint64_t,std::pair< std::vector<MulticastGroup>,std::vector<MulticastGroup> > > > mgChanges;
 					{
 						Mutex::Lock _l(_nets_m);
 						mgChanges.reserve(_nets.size() + 1);
 						for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
-							if (n->second.tap) {
+							if ((n->second.tap)&&((mgSweep)||(mgChangedDevices.count(n->second.tap->deviceName()) > 0))) {
 								mgChanges.push_back(std::pair< uint64_t,std::pair< std::vector<MulticastGroup>,std::vector<MulticastGroup> > >(n->first,std::pair< std::vector<MulticastGroup>,std::vector<MulticastGroup> >()));
 								n->second.tap->scanMulticastGroups(mgChanges.back().second.first,mgChanges.back().second.second);
 							}
@@ -862,7 +1308,24 @@ public:
 					}
 				}
 
-				// Sync information about physical network interfaces
+#if defined(__LINUX__) && !defined(ZT_SDK) && !defined(ZT_USE_TEST_TAP)
+				// Keep each tap's kernel filter in line with its network's rules, which taps only reload when they change
+				if ((_tapFilter)&&((now - lastTapFilterCheck) >= ZT_TAP_CHECK_FILTER_INTERVAL)) {
+					lastTapFilterCheck = now;
+					std::vector<ZT_VirtualNetworkRule> rules(ZT_MAX_NETWORK_RULES + 16);
+					Mutex::Lock _l(_nets_m);
+					for(std::map<uint64_t,NetworkState>::const_iterator n(_nets.begin());n!=_nets.end();++n) {
+						if (n->second.tap)
+							n->second.tap->setFilter(rules.data(),_node->tapFilter(n->first,rules.data(),(unsigned int)rules.size()));
+					}
+				}
+#endif
+
+				// Sync information about physical network interfaces, right away if the port mapper has new mappings
+#ifdef ZT_USE_MINIUPNPC
+				if ((_portMapper)&&(_portMapper->changed()))
+					lastLocalInterfaceAddressCheck = now - ZT_LOCAL_INTERFACE_CHECK_INTERVAL;
+#endif
 				if ((now - lastLocalInterfaceAddressCheck) >= ZT_LOCAL_INTERFACE_CHECK_INTERVAL) {
 					lastLocalInterfaceAddressCheck = now;
 
@@ -881,13 +1344,33 @@ public:
 						_node->addLocalInterfaceAddress(reinterpret_cast<const struct sockaddr_storage *>(&(*i)));
 				}
 
+				// Write out captured trace events and end timed captures
+				if ((_traceFile)&&((now - lastTraceDrain) >= ZT_TRACE_DRAIN_PERIOD)) {
+					lastTraceDrain = now;
+					_traceDrain(_traceFile,(json *)0,~((unsigned long)0));
+				}
+				if ((_traceUntil > 0)&&(now >= _traceUntil))
+					_traceStop();
+
+				if ((_stateSnapshotInterval > 0)&&((now - lastStateSnapshot) >= _stateSnapshotInterval)) {
+					lastStateSnapshot = now;
+					_saveStateSnapshot();
+				}
+
 				// Clean peers.d periodically
 				if ((now - lastCleanedPeersDb) >= 3600000) {
 					lastCleanedPeersDb = now;
 					OSUtils::cleanDirectory((_homePath + ZT_PATH_SEPARATOR_S "peers.d").c_str(),now - 2592000000LL); // delete older than 30 days
+#ifndef __WINDOWS__
+					_peerStateFile.expire(now - 2592000000LL);
+#endif
 				}
 
-				const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
+				unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
+				if ((interfaceChangedAt > 0)&&(delay > ZT_INTERFACE_CHANGE_SETTLE_DELAY))
+					delay = ZT_INTERFACE_CHANGE_SETTLE_DELAY;
+				if (((_traceFile)||(_traceUntil > 0))&&(delay > ZT_TRACE_DRAIN_PERIOD))
+					delay = ZT_TRACE_DRAIN_PERIOD;
 				clockShouldBe = now + (uint64_t)delay;
 				_phy.poll(delay);
 			}
@@ -901,12 +1384,35 @@ public:
 			_fatalErrorMessage = "unexpected exception in main thread: unknown exception";
 		}
 
+		// UDP socket group threads feed the receive threads, so stop them first
+		// (their sockets stay open until closeAll() in the destructor)
+		_udpThreadsRun = false;
+		for(std::vector< UdpThread * >::iterator t(_udpThreads.begin());t!=_udpThreads.end();++t)
+			(*t)->phy.whack();
+		for(std::vector< UdpThread * >::iterator t(_udpThreads.begin());t!=_udpThreads.end();++t) {
+			if ((*t)->thread.joinable())
+				(*t)->thread.join();
+		}
+
+		// A NULL datagram tells each receive thread to exit once its queue is drained
+		for(std::vector< BlockingQueue<RxDatagram *> * >::iterator q(_rxQueues.begin());q!=_rxQueues.end();++q)
+			(*q)->post((RxDatagram *)0);
+		for(std::vector< std::thread >::iterator t(_rxThreads.begin());t!=_rxThreads.end();++t)
+			t->join();
+		_rxThreads.clear();
+		for(std::vector< BlockingQueue<RxDatagram *> * >::iterator q(_rxQueues.begin());q!=_rxQueues.end();++q)
+			delete *q;
+		_rxQueues.clear();
+
 		try {
 			Mutex::Lock _l(_tcpConnections_m);
 			while (!_tcpConnections.empty())
 				_phy.close((*_tcpConnections.begin())->sock);
 		} catch ( ... ) {}
 
+		for(std::vector< std::thread >::iterator t(_restoreThreads.begin());t!=_restoreThreads.end();++t)
+			t->join();
+		_restoreThreads.clear();
 		{
 			Mutex::Lock _l(_nets_m);
 			for(std::map<uint64_t,NetworkState>::iterator n(_nets.begin());n!=_nets.end();++n)
@@ -914,14 +1420,192 @@ public:
 			_nets.clear();
 		}
 
+		if (_stateSnapshotInterval > 0)
+			_saveStateSnapshot();
+
+		_ipfix.stop();
 		delete _updater;
 		_updater = (SoftwareUpdater *)0;
+		_hostedByAddress.clear();
+		for(std::vector< HostedNode * >::iterator h(_hostedNodes.begin());h!=_hostedNodes.end();++h) {
+			delete (*h)->node;
+			delete *h;
+		}
+		_hostedNodes.clear();
 		delete _node;
 		_node = (Node *)0;
+		_stateStore.flush();
+#ifndef __WINDOWS__
+		_peerStateFile.close();
+#endif
 
 		return _termReason;
 	}
 
+	// Creates a node for each directory in hosted.d, which holds that node's identity, networks.d, moons.d and peers.d
+	inline void _startHostedNodes()
+	{
+		struct ZT_Node_Callbacks cb;
+		cb.version = 3;
+		cb.stateGetFunction = SnodeHostedStateGetFunction;
+		cb.statePutFunction = SnodeHostedStatePutFunction;
+		cb.wirePacketSendFunction = SnodeHostedWirePacketSendFunction;
+		cb.virtualNetworkFrameFunction = SnodeHostedVirtualNetworkFrameFunction;
+		cb.virtualNetworkConfigFunction = SnodeHostedVirtualNetworkConfigFunction;
+		cb.eventCallback = SnodeHostedEventCallback;
+		cb.pathCheckFunction = SnodeHostedPathCheckFunction;
+		cb.pathLookupFunction = SnodeHostedPathLookupFunction;
+		cb.wirePacketBatchSendFunction = SnodeHostedWirePacketBatchSendFunction;
+		cb.virtualNetworkFrameBufferFunction = (ZT_VirtualNetworkFrameBufferFunction)0;
+
+		const std::string hostedPath(_homePath + ZT_PATH_SEPARATOR_S "hosted.d");
+		const int64_t now = OSUtils::now();
+		std::vector<std::string> names(OSUtils::listDirectory(hostedPath.c_str(),true));
+		std::sort(names.begin(),names.end());
+		for(std::vector<std::string>::iterator name(names.begin());name!=names.end();++name) {
+			HostedNode *const h = new HostedNode();
+			h->service = this;
+			h->homePath = hostedPath + ZT_PATH_SEPARATOR_S + *name;
+			h->node = (Node *)0;
+			h->nextBackgroundTaskDeadline = 0;
+			h->scheduled = now;
+			if (!OSUtils::fileExists((h->homePath + ZT_PATH_SEPARATOR_S ".").c_str())) { // not a directory
+				delete h;
+				continue;
+			}
+			try {
+				h->node = new Node(h,(void *)0,&cb,now);
+			} catch ( ... ) {
+				fprintf(stderr,"WARNING: unable to start hosted node %s" ZT_EOL_S,name->c_str());
+				delete h;
+				continue;
+			}
+			const uint64_t address = h->node->address();
+			if ((address == _node->address())||(_hostedByAddress.contains(address))) {
+				fprintf(stderr,"WARNING: hosted node %s has the same address (%.10llx) as another node on this host, not starting it" ZT_EOL_S,name->c_str(),(unsigned long long)address);
+				delete h->node;
+				delete h;
+				continue;
+			}
+			_hostedByAddress.set(address,h);
+			_hostedNodes.push_back(h);
+
+			std::vector<std::string> networksDotD(OSUtils::listDirectory((h->homePath + ZT_PATH_SEPARATOR_S "networks.d").c_str()));
+			for(std::vector<std::string>::iterator f(networksDotD.begin());f!=networksDotD.end();++f) {
+				std::size_t dot = f->find_last_of('.');
+				if ((dot == 16)&&(f->substr(16) == ".conf"))
+					h->node->join(Utils::hexStrToU64(f->substr(0,dot).c_str()),(void *)0,(void *)0);
+			}
+			std::vector<std::string> moonsDotD(OSUtils::listDirectory((h->homePath + ZT_PATH_SEPARATOR_S "moons.d").c_str()));
+			for(std::vector<std::string>::iterator f(moonsDotD.begin());f!=moonsDotD.end();++f) {
+				std::size_t dot = f->find_last_of('.');
+				if ((dot == 16)&&(f->substr(16) == ".moon"))
+					h->node->orbit((void *)0,Utils::hexStrToU64(f->substr(0,dot).c_str()),0);
+			}
+
+			Mutex::Lock _l(_hostedTimers_m);
+			_hostedTimers.push(HostedTimer(now,h));
+		}
+	}
+
+	// Runs background tasks of hosted nodes that are due, returning the soonest deadline left
+	inline int64_t _runHostedNodes(const int64_t now)
+	{
+		std::vector< HostedNode * > due;
+		{
+			Mutex::Lock _l(_hostedTimers_m);
+			while ((!_hostedTimers.empty())&&(_hostedTimers.top().first <= now)) {
+				HostedNode *const h = _hostedTimers.top().second;
+				if (_hostedTimers.top().first == h->scheduled) { // else a packet moved it earlier and this entry is stale
+					h->scheduled = 0;
+					due.push_back(h);
+				}
+				_hostedTimers.pop();
+			}
+		}
+		for(std::vector< HostedNode * >::iterator h(due.begin());h!=due.end();++h)
+			(*h)->node->processBackgroundTasks((void *)0,now,&((*h)->nextBackgroundTaskDeadline));
+		Mutex::Lock _l(_hostedTimers_m);
+		for(std::vector< HostedNode * >::iterator h(due.begin());h!=due.end();++h) {
+			(*h)->scheduled = std::max((int64_t)(*h)->nextBackgroundTaskDeadline,now + 1);
+			_hostedTimers.push(HostedTimer((*h)->scheduled,*h));
+		}
+		return _hostedTimers.top().first;
+	}
+
+	// Queues a hosted node again if handling a packet brought its deadline forward
+	inline void _rescheduleHostedNode(HostedNode *const h)
+	{
+		if ((h->scheduled)&&(h->nextBackgroundTaskDeadline < h->scheduled)) {
+			Mutex::Lock _l(_hostedTimers_m);
+			if ((h->scheduled)&&(h->nextBackgroundTaskDeadline < h->scheduled)) {
+				h->scheduled = h->nextBackgroundTaskDeadline;
+				_hostedTimers.push(HostedTimer(h->scheduled,h));
+			}
+		}
+	}
+
+	// Hosted node a packet or fragment is for, or NULL if it's for us or someone we might relay to
+	inline HostedNode *_hostedNodeFor(const void *data,const unsigned int len) const
+	{
+		if ((_hostedNodes.empty())||(len < ZT_PROTO_MIN_FRAGMENT_LENGTH)) // packets and fragments have the destination in the same place
+			return (HostedNode *)0;
+		HostedNode *const *const h = _hostedByAddress.get(Address(reinterpret_cast<const uint8_t *>(data) + ZT_PACKET_IDX_DEST,ZT_ADDRESS_LENGTH).toInt());
+		return (h) ? *h : (HostedNode *)0;
+	}
+
+	// Write the core's state to state.snapshot, through a temporary file so a crash never leaves half of one
+	inline void _saveStateSnapshot()
+	{
+		ZT_StateSnapshot *const ss = _node->snapshot();
+		if (!ss)
+			return;
+		const std::string path(_homePath + ZT_PATH_SEPARATOR_S "state.snapshot");
+		const std::string tmp(path + ".tmp");
+		if (OSUtils::writeFile(tmp.c_str(),ss->data,(unsigned int)ss->size)) {
+			OSUtils::lockDownFile(tmp.c_str(),false);
+			if (!OSUtils::rename(tmp.c_str(),path.c_str())) {
+				OSUtils::rm(tmp.c_str());
+				fprintf(stderr,"WARNING: unable to write to file: %s (unable to rename)" ZT_EOL_S,path.c_str());
+			}
+		} else {
+			fprintf(stderr,"WARNING: unable to write to file: %s" ZT_EOL_S,tmp.c_str());
+		}
+		_node->freeQueryResult((void *)ss);
+	}
+
+	// Restore state.snapshot if there is one, mapping it rather than reading it where we can
+	inline void _restoreStateSnapshot(const int64_t now)
+	{
+		const std::string path(_homePath + ZT_PATH_SEPARATOR_S "state.snapshot");
+		ZT_StateSnapshot restored;
+		ZT_ResultCode rc;
+#ifdef __WINDOWS__
+		std::string buf;
+		if (!OSUtils::readFile(path.c_str(),buf))
+			return;
+		rc = _node->restoreSnapshot((void *)0,now,buf.data(),(unsigned long)buf.length(),&restored);
+#else
+		const int fd = ::open(path.c_str(),O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if ((fstat(fd,&st) != 0)||(st.st_size <= 0)) {
+			::close(fd);
+			return;
+		}
+		void *const m = ::mmap((void *)0,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		::close(fd);
+		if (m == MAP_FAILED)
+			return;
+		::madvise(m,(size_t)st.st_size,MADV_SEQUENTIAL);
+		rc = _node->restoreSnapshot((void *)0,now,m,(unsigned long)st.st_size,&restored);
+		::munmap(m,(size_t)st.st_size);
+#endif
+		if (rc == ZT_RESULT_ERROR_BAD_PARAMETER)
+			fprintf(stderr,"WARNING: ignoring %s (invalid or not from this identity)" ZT_EOL_S,path.c_str());
+	}
+
 	virtual ReasonForTermination reasonForTermination() const
 	{
 		Mutex::Lock _l(_termReason_m);
@@ -943,6 +1627,723 @@ public:
 		else return std::string();
 	}
 
+	// Frames the network's tap dropped because its output queue was full
+	inline uint64_t _portOutputDrops(uint64_t nwid) const
+	{
+#if defined(__LINUX__) && !defined(ZT_SDK) && !defined(ZT_USE_TEST_TAP)
+		Mutex::Lock _l(_nets_m);
+		std::map<uint64_t,NetworkState>::const_iterator n(_nets.find(nwid));
+		if ((n != _nets.end())&&(n->second.tap))
+			return n->second.tap->outputDrops();
+#endif
+		return 0;
+	}
+
+	// Describe a captured trace record for GET /trace and the trace file
+	static inline void _traceRecordToJson(nlohmann::json &j,const ZT_TraceRecord &r)
+	{
+		char tmp[256];
+		j["timestamp"] = r.timestamp;
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.4x",r.event);
+		j["event"] = tmp;
+		if (r.networkId) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)r.networkId);
+			j["nwid"] = tmp;
+		}
+		if (r.packetId) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)r.packetId);
+			j["packetId"] = tmp;
+		}
+		if (r.address) {
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)r.address);
+			j["address"] = tmp;
+		}
+		if (r.physicalAddress.ss_family)
+			j["physicalAddress"] = reinterpret_cast<const InetAddress *>(&(r.physicalAddress))->toString(tmp);
+		if (r.sourceMac)
+			j["sourceMac"] = MAC(r.sourceMac).toString(tmp);
+		if (r.destMac)
+			j["destMac"] = MAC(r.destMac).toString(tmp);
+		if (r.verb)
+			j["verb"] = r.verb;
+		if (r.hops)
+			j["hops"] = r.hops;
+		if (r.length)
+			j["length"] = r.length;
+		if (r.value)
+			j["value"] = r.value;
+		if (r.reason)
+			j["reason"] = r.reason;
+	}
+
+	// Read captured trace records into a JSON array and/or append them to a file as JSON lines
+	inline unsigned long _traceDrain(FILE *f,nlohmann::json *records,const unsigned long max)
+	{
+		std::vector<ZT_TraceRecord> buf(ZT_TRACE_READ_BATCH);
+		unsigned long total = 0;
+		while (total < max) {
+			const unsigned long n = _node->readTrace(buf.data(),std::min((unsigned long)ZT_TRACE_READ_BATCH,max - total),&_traceDropped);
+			for(unsigned long i=0;i<n;++i) {
+				nlohmann::json j;
+				_traceRecordToJson(j,buf[i]);
+				if (f)
+					fprintf(f,"%s\n",OSUtils::jsonDump(j,-1).c_str());
+				if (records)
+					records->push_back(j);
+			}
+			total += n;
+			if (n < ZT_TRACE_READ_BATCH)
+				break;
+		}
+		if ((f)&&(total))
+			fflush(f);
+		return total;
+	}
+
+	// End trace capture started via POST /trace, writing out anything still buffered
+	inline void _traceStop()
+	{
+		_node->setTraceCapture(0,0,0);
+		_traceCapturing = false;
+		_traceUntil = 0;
+		if (_traceFile) {
+			_traceDrain(_traceFile,(nlohmann::json *)0,~((unsigned long)0));
+			fclose(_traceFile);
+			_traceFile = (FILE *)0;
+		}
+	}
+
+	// Capture settings and counts for /capture/status and POST /capture
+	static inline void _frameCaptureToJson(nlohmann::json &j,const ZT_FrameCapture *fc)
+	{
+		char tmp[32];
+		j["capturing"] = (fc->capturing != 0);
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)fc->networkId);
+		j["network"] = tmp;
+		j["maxFrames"] = fc->maxFrames;
+		j["snapLength"] = fc->snapLength;
+		j["frames"] = fc->frames;
+		j["overwritten"] = fc->overwritten;
+	}
+
+	// Recording state for GET, POST and DELETE /record
+	inline void _wireRecorderToJson(nlohmann::json &j)
+	{
+		std::string path;
+		int64_t start = 0;
+		uint64_t packets = 0,bytes = 0,maxBytes = 0;
+		j["recording"] = _wireRecorder.status(path,start,packets,bytes,maxBytes);
+		j["path"] = path;
+		j["start"] = start;
+		j["packets"] = packets;
+		j["bytes"] = bytes;
+		j["maxBytes"] = maxBytes;
+	}
+
+	// Join a root cluster as described by "cluster" in local.conf settings
+	inline void _initCluster(json &cluster)
+	{
+		const unsigned int myId = (unsigned int)OSUtils::jsonInt(cluster["id"],(uint64_t)ZT_CLUSTER_MAX_MEMBERS);
+		const InetAddress backplane(OSUtils::jsonString(cluster["backplane"],"").c_str());
+		if ((myId >= ZT_CLUSTER_MAX_MEMBERS)||((backplane.ss_family != AF_INET)&&(backplane.ss_family != AF_INET6))) {
+			fprintf(stderr,"WARNING: cluster needs an id from 0 to %u and a backplane IP/port, not clustering" ZT_EOL_S,(unsigned int)ZT_CLUSTER_MAX_MEMBERS - 1);
+			return;
+		}
+
+		std::vector<InetAddress> endpoints;
+		json &eps = cluster["endpoints"];
+		if (eps.is_array()) {
+			for(unsigned long i=0;i<eps.size();++i) {
+				const InetAddress ep(OSUtils::jsonString(eps[i],"").c_str());
+				if (((ep.ss_family == AF_INET)||(ep.ss_family == AF_INET6))&&(ep.port() != 0)&&(endpoints.size() < ZT_CLUSTER_MAX_ZT_PHYSICAL_ADDRESSES))
+					endpoints.push_back(ep);
+			}
+		}
+		if (endpoints.empty()) {
+			fprintf(stderr,"WARNING: cluster has no ZeroTier endpoints for this member, not clustering" ZT_EOL_S);
+			return;
+		}
+
+		int loc[3] = { 0,0,0 };
+		json &location = cluster["location"];
+		if ((location.is_array())&&(location.size() == 3)) {
+			for(unsigned int k=0;k<3;++k)
+				loc[k] = (location[k].is_number()) ? (int)location[k] : 0;
+		}
+
+		json &locations = cluster["locations"];
+		if (locations.is_object()) {
+			for(json::iterator l(locations.begin());l!=locations.end();++l) {
+				ClusterLocation cl;
+				cl.net = InetAddress(l.key().c_str());
+				if (((cl.net.ss_family == AF_INET)||(cl.net.ss_family == AF_INET6))&&(l.value().is_array())&&(l.value().size() == 3)) {
+					cl.x = (l.value()[0].is_number()) ? (int)l.value()[0] : 0;
+					cl.y = (l.value()[1].is_number()) ? (int)l.value()[1] : 0;
+					cl.z = (l.value()[2].is_number()) ? (int)l.value()[2] : 0;
+					_clusterLocations.push_back(cl);
+				}
+			}
+			std::sort(_clusterLocations.begin(),_clusterLocations.end(),[](const ClusterLocation &a,const ClusterLocation &b) { return (a.net.netmaskBits() > b.net.netmaskBits()); });
+		}
+
+		_clusterBackplane = _phy.udpBind(reinterpret_cast<const struct sockaddr *>(&backplane),(void *)0,ZT_UDP_DESIRED_BUF_SIZE);
+		if (!_clusterBackplane) {
+			char tmp[64];
+			fprintf(stderr,"WARNING: unable to bind cluster backplane to %s, not clustering" ZT_EOL_S,backplane.toString(tmp));
+			_clusterLocations.clear();
+			return;
+		}
+		if (_node->clusterInit(myId,endpoints,loc[0],loc[1],loc[2],SclusterSendFunction,this,(_clusterLocations.empty()) ? (int (*)(void *,const struct sockaddr_storage *,int *,int *,int *))0 : SclusterAddressToLocationFunction,this) != ZT_RESULT_OK) {
+			fprintf(stderr,"WARNING: unable to initialize cluster, not clustering" ZT_EOL_S);
+			_phy.close(_clusterBackplane);
+			_clusterBackplane = (PhySocket *)0;
+			_clusterLocations.clear();
+			return;
+		}
+
+		json &members = cluster["members"];
+		if (members.is_object()) {
+			for(json::iterator m(members.begin());m!=members.end();++m) {
+				const unsigned int id = (unsigned int)Utils::strToU64(m.key().c_str());
+				const InetAddress mbp(OSUtils::jsonString(m.value(),"").c_str());
+				if ((id < ZT_CLUSTER_MAX_MEMBERS)&&(id != myId)&&((mbp.ss_family == AF_INET)||(mbp.ss_family == AF_INET6))) {
+					_clusterMembers[id] = mbp;
+					_node->clusterAddMember(id);
+				}
+			}
+		}
+	}
+
+	// Cluster status for GET /cluster
+	inline bool _clusterToJson(nlohmann::json &j)
+	{
+		char tmp[64];
+		ZT_ClusterStatus *const cs = (ZT_ClusterStatus *)malloc(sizeof(ZT_ClusterStatus)); // large, keep off the stack
+		if (!cs)
+			return false;
+		if (!_node->clusterStatus(cs)) {
+			free(cs);
+			return false;
+		}
+		j["myId"] = cs->myId;
+		j["clusterSize"] = cs->clusterSize;
+		j["remotePeers"] = cs->remotePeers;
+		j["relayed"] = cs->relayed;
+		j["relayDropped"] = cs->relayDropped;
+		json &members = j["members"];
+		members = json::array();
+		for(unsigned int i=0;i<cs->clusterSize;++i) {
+			const ZT_ClusterMemberStatus &ms = cs->members[i];
+			json mj;
+			mj["id"] = ms.id;
+			mj["msSinceLastHeartbeat"] = ms.msSinceLastHeartbeat;
+			mj["alive"] = (ms.alive != 0);
+			mj["location"] = json::array({ ms.x,ms.y,ms.z });
+			mj["peers"] = ms.peers;
+			mj["redirected"] = ms.redirected;
+			json &eps = mj["endpoints"];
+			eps = json::array();
+			for(unsigned int k=0;k<ms.numZeroTierPhysicalEndpoints;++k)
+				eps.push_back(reinterpret_cast<const InetAddress *>(&(ms.zeroTierPhysicalEndpoints[k]))->toString(tmp));
+			members.push_back(mj);
+		}
+		free(cs);
+		return true;
+	}
+
+	// Approximate memory by subsystem for GET /memory
+	inline void _memoryToJson(nlohmann::json &j)
+	{
+		char tmp[64];
+		ZT_MemoryUsage mu;
+		_node->memoryUsage(&mu);
+
+		json &topology = j["topology"];
+		topology["peers"] = mu.peers;
+		topology["peerBytes"] = mu.peerBytes;
+		topology["peersEvicted"] = mu.peersEvicted;
+		topology["coldPeers"] = mu.coldPeers;
+		topology["coldPeerBytes"] = mu.coldPeerBytes;
+		topology["peersPromoted"] = mu.peersPromoted;
+		topology["paths"] = mu.paths;
+		topology["pathBytes"] = mu.pathBytes;
+		_objectPoolToJson(topology["peerPool"],mu.peerPool);
+		_objectPoolToJson(topology["pathPool"],mu.pathPool);
+
+		json &sw = j["switch"];
+		sw["rxQueueEntries"] = mu.rxQueueEntries;
+		sw["rxQueueBytes"] = mu.rxQueueBytes;
+		sw["txQueueEntries"] = mu.txQueueEntries;
+		sw["txQueueBytes"] = mu.txQueueBytes;
+
+		json &mc = j["multicaster"];
+		mc["groups"] = mu.multicastGroups;
+		mc["members"] = mu.multicastMembers;
+		mc["bytes"] = mu.multicastBytes;
+		mc["membersEvicted"] = mu.multicastMembersEvicted;
+
+		json networks = json::array();
+		ZT_VirtualNetworkList *nws = _node->networks();
+		if (nws) {
+			for(unsigned long i=0;i<nws->networkCount;++i) {
+				ZT_NetworkMemoryUsage nmu;
+				if (!_node->networkMemoryUsage(nws->networks[i].nwid,&nmu))
+					continue;
+				json nj;
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nmu.nwid);
+				nj["nwid"] = tmp;
+				nj["members"] = nmu.members;
+				nj["memberBytes"] = nmu.memberBytes;
+				nj["flows"] = nmu.flows;
+				nj["flowBytes"] = nmu.flowBytes;
+				nj["bridgeRoutes"] = nmu.bridgeRoutes;
+				nj["bridgeRouteBytes"] = nmu.bridgeRouteBytes;
+				nj["multicastGroups"] = nmu.multicastGroups;
+				nj["bytes"] = nmu.bytes;
+				networks.push_back(nj);
+			}
+			_node->freeQueryResult((void *)nws);
+		}
+		j["networks"] = networks;
+		j["networkBytes"] = mu.networkBytes;
+
+		uint64_t cn = 0,cm = 0,cb = 0;
+		if ((_controller)&&(_controller->memoryUsage(cn,cm,cb))) {
+			json &cj = j["controller"];
+			cj["networks"] = cn;
+			cj["members"] = cm;
+			cj["bytes"] = cb;
+		} else {
+			j["controller"] = json();
+		}
+
+		j["totalBytes"] = mu.peerBytes + mu.pathBytes + mu.rxQueueBytes + mu.txQueueBytes + mu.multicastBytes + mu.networkBytes + cb;
+
+		_hugePagesToJson(j["hugePages"],mu.hugePages);
+	}
+
+	// Append one Prometheus text format sample
+	static inline void _metric(std::string &out,const char *name,const char *labels,const uint64_t value)
+	{
+		char tmp[256];
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%s%s%s%s %llu\n",name,(labels) ? "{" : "",(labels) ? labels : "",(labels) ? "}" : "",(unsigned long long)value);
+		out.append(tmp);
+	}
+
+	// Append HELP and TYPE lines that precede a metric's samples
+	static inline void _metricHeader(std::string &out,const char *name,const char *type,const char *help)
+	{
+		out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+		out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+	}
+
+	// Render node counters and gauges plus per-network tap drops for GET /metrics
+	inline void _metricsText(std::string &out)
+	{
+		static const char *const verbNames[ZT_METRICS_VERB_COUNT] = {
+			"NOP","HELLO","ERROR","OK","WHOIS","RENDEZVOUS","FRAME","EXT_FRAME",
+			"ECHO","MULTICAST_LIKE","NETWORK_CREDENTIALS","NETWORK_CONFIG_REQUEST","NETWORK_CONFIG","MULTICAST_GATHER","MULTICAST_FRAME",(const char *)0,
+			"PUSH_DIRECT_PATHS",(const char *)0,(const char *)0,(const char *)0,"USER_MESSAGE","REMOTE_TRACE","MULTI_FRAME","RELAY_OFFER",
+			(const char *)0,(const char *)0,(const char *)0,(const char *)0,(const char *)0,(const char *)0,(const char *)0,(const char *)0
+		};
+		static const char *const dropNames[ZT_METRICS_DROP_REASON_COUNT] = {
+			"mac_failed","invalid","hello","network_access_denied","frame_in","frame_out","relay_hops","rx_queue","egress_queue","rate_limit","overload"
+		};
+		static const char *const verbMetrics[4][2] = {
+			{ "zerotier_packets_in_total","Authenticated packets received by verb" },
+			{ "zerotier_packet_bytes_in_total","Bytes of authenticated packets received by verb" },
+			{ "zerotier_packets_out_total","Packets sent by verb" },
+			{ "zerotier_packet_bytes_out_total","Bytes of packets sent by verb" }
+		};
+
+		ZT_Metrics m;
+		_node->metrics(&m);
+		char labels[128];
+
+		const uint64_t *const byVerb[4] = { m.packetsIn,m.bytesIn,m.packetsOut,m.bytesOut };
+		for(unsigned int k=0;k<4;++k) {
+			_metricHeader(out,verbMetrics[k][0],"counter",verbMetrics[k][1]);
+			for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v) {
+				if (verbNames[v])
+					OSUtils::ztsnprintf(labels,sizeof(labels),"verb=\"%s\"",verbNames[v]);
+				else if (byVerb[k][v])
+					OSUtils::ztsnprintf(labels,sizeof(labels),"verb=\"0x%.2x\"",v);
+				else continue;
+				_metric(out,verbMetrics[k][0],labels,byVerb[k][v]);
+			}
+		}
+
+		_metricHeader(out,"zerotier_drops_total","counter","Packets and frames dropped by reason");
+		for(unsigned int r=0;r<ZT_METRICS_DROP_REASON_COUNT;++r) {
+			OSUtils::ztsnprintf(labels,sizeof(labels),"reason=\"%s\"",dropNames[r]);
+			_metric(out,"zerotier_drops_total",labels,m.drops[r]);
+		}
+
+		_metricHeader(out,"zerotier_filter_results_total","counter","Rule evaluations by direction and result");
+		_metric(out,"zerotier_filter_results_total","direction=\"in\",result=\"accept\"",m.filterInAccepted);
+		_metric(out,"zerotier_filter_results_total","direction=\"in\",result=\"drop\"",m.filterInDropped);
+		_metric(out,"zerotier_filter_results_total","direction=\"out\",result=\"accept\"",m.filterOutAccepted);
+		_metric(out,"zerotier_filter_results_total","direction=\"out\",result=\"drop\"",m.filterOutDropped);
+
+		_metricHeader(out,"zerotier_relayed_packets_total","counter","Packets and fragments relayed for other nodes");
+		_metric(out,"zerotier_relayed_packets_total",(const char *)0,m.relayedPackets);
+		_metricHeader(out,"zerotier_relayed_bytes_total","counter","Bytes relayed for other nodes");
+		_metric(out,"zerotier_relayed_bytes_total",(const char *)0,m.relayedBytes);
+		_metricHeader(out,"zerotier_relay_cache_total","counter","Relay best path cache lookups by result");
+		_metric(out,"zerotier_relay_cache_total","result=\"hit\"",m.relayCacheHits);
+		_metric(out,"zerotier_relay_cache_total","result=\"miss\"",m.relayCacheMisses);
+
+		_metricHeader(out,"zerotier_multicast_frames_total","counter","Multicast frames sent");
+		_metric(out,"zerotier_multicast_frames_total",(const char *)0,m.multicastFrames);
+		_metricHeader(out,"zerotier_multicast_recipients_total","counter","Recipients multicast frames were sent to");
+		_metric(out,"zerotier_multicast_recipients_total",(const char *)0,m.multicastRecipients);
+
+		_metricHeader(out,"zerotier_fec_parity_sent_total","counter","FEC parity fragments sent on lossy paths");
+		_metric(out,"zerotier_fec_parity_sent_total",(const char *)0,m.fecParitySent);
+		_metricHeader(out,"zerotier_fec_recovered_total","counter","Packets rebuilt from FEC parity after losing a fragment");
+		_metric(out,"zerotier_fec_recovered_total",(const char *)0,m.fecRecovered);
+
+		_metricHeader(out,"zerotier_admission_shed_total","counter","Work for unknown peers shed over the admission budget by class");
+		for(unsigned int k=0;k<3;++k) {
+			static const char *const admissionClasses[3] = { "whois","agree","validate" };
+			char labels[64];
+			OSUtils::ztsnprintf(labels,sizeof(labels),"class=\"%s\"",admissionClasses[k]);
+			_metric(out,"zerotier_admission_shed_total",labels,m.admissionShed[k]);
+		}
+		_metricHeader(out,"zerotier_admission_cpu_seconds_total","counter","Time spent on admitted work for unknown peers");
+		{
+			char tmp[128];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_admission_cpu_seconds_total %.6f\n",(double)m.admissionMicroseconds / 1000000.0);
+			out.append(tmp);
+		}
+
+		_metricHeader(out,"zerotier_crypto_seconds_total","counter","Estimated time spent encrypting and decrypting packets (sampled)");
+		for(unsigned int k=0;k<2;++k) {
+			char tmp[128];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_crypto_seconds_total{op=\"%s\"} %.9f\n",(k) ? "decrypt" : "encrypt",(double)((k) ? m.cryptoDecryptNanoseconds : m.cryptoEncryptNanoseconds) / 1000000000.0);
+			out.append(tmp);
+		}
+
+		_metricHeader(out,"zerotier_packet_decode_seconds","histogram","Time to decrypt, decompress and handle authenticated packets by verb");
+		for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v) {
+			if (!verbNames[v])
+				continue;
+			char tmp[192];
+			uint64_t count = 0;
+			for(unsigned int b=0;b<ZT_METRICS_LATENCY_BUCKETS;++b) {
+				count += m.decodeLatency[v][b];
+				if (b == (ZT_METRICS_LATENCY_BUCKETS - 1))
+					OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_packet_decode_seconds_bucket{verb=\"%s\",le=\"+Inf\"} %llu\n",verbNames[v],(unsigned long long)count);
+				else OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_packet_decode_seconds_bucket{verb=\"%s\",le=\"%g\"} %llu\n",verbNames[v],(double)(1ULL << b) / 1000000.0,(unsigned long long)count);
+				out.append(tmp);
+			}
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_packet_decode_seconds_sum{verb=\"%s\"} %.9f\nzerotier_packet_decode_seconds_count{verb=\"%s\"} %llu\n",verbNames[v],(double)m.decodeNanoseconds[v] / 1000000000.0,verbNames[v],(unsigned long long)count);
+			out.append(tmp);
+		}
+
+		_metricHeader(out,"zerotier_peer_key_cache_total","counter","Peers loaded from the peer cache by whether key agreement was skipped");
+		_metric(out,"zerotier_peer_key_cache_total","result=\"hit\"",m.peerKeyCacheHits);
+		_metric(out,"zerotier_peer_key_cache_total","result=\"miss\"",m.peerKeyCacheMisses);
+
+		_metricHeader(out,"zerotier_identity_cache_total","counter","Identity validations by whether the validation cache let them be skipped");
+		_metric(out,"zerotier_identity_cache_total","result=\"hit\"",m.identityCacheHits);
+		_metric(out,"zerotier_identity_cache_total","result=\"miss\"",m.identityCacheMisses);
+
+		_metricHeader(out,"zerotier_rx_queue_entries","gauge","Fragment reassembly queue entries allocated");
+		_metric(out,"zerotier_rx_queue_entries",(const char *)0,m.rxQueueSize);
+		_metricHeader(out,"zerotier_peers","gauge","Peers currently known");
+		_metric(out,"zerotier_peers",(const char *)0,m.peers);
+		_metricHeader(out,"zerotier_paths","gauge","Physical paths currently known");
+		_metric(out,"zerotier_paths",(const char *)0,m.paths);
+		_metricHeader(out,"zerotier_hosted_nodes","gauge","Nodes from hosted.d running in this process besides this one");
+		_metric(out,"zerotier_hosted_nodes",(const char *)0,_hostedNodes.size());
+
+		static const char *const netMetrics[4][2] = {
+			{ "zerotier_network_frames_in_total","Frames delivered to the network's virtual port" },
+			{ "zerotier_network_bytes_in_total","Bytes of frames delivered to the network's virtual port" },
+			{ "zerotier_network_frames_out_total","Frames read from the network's virtual port" },
+			{ "zerotier_network_bytes_out_total","Bytes of frames read from the network's virtual port" }
+		};
+		for(unsigned int k=0;k<4;++k) {
+			_metricHeader(out,netMetrics[k][0],"counter",netMetrics[k][1]);
+			for(unsigned int i=0;i<m.networkCount;++i) {
+				const ZT_NetworkMetrics &nm = m.networks[i];
+				const uint64_t v[4] = { nm.framesIn,nm.bytesIn,nm.framesOut,nm.bytesOut };
+				OSUtils::ztsnprintf(labels,sizeof(labels),"network=\"%.16llx\"",(unsigned long long)nm.networkId);
+				_metric(out,netMetrics[k][0],labels,v[k]);
+			}
+		}
+
+		std::vector<ZT_RateLimitStats> limits(1024);
+		limits.resize(_node->rateLimitStats(limits.data(),(unsigned int)limits.size()));
+		if (!limits.empty()) {
+			static const char *const limitMetrics[3][2] = {
+				{ "zerotier_rate_limit_packets_total","Packets covered by a network or member rate limit by result" },
+				{ "zerotier_rate_limit_bytes_total","Bytes covered by a network or member rate limit by result" },
+				{ "zerotier_rate_limit_bytes_per_second","Network or member rate limit" }
+			};
+			for(unsigned int k=0;k<3;++k) {
+				_metricHeader(out,limitMetrics[k][0],(k < 2) ? "counter" : "gauge",limitMetrics[k][1]);
+				for(std::vector<ZT_RateLimitStats>::const_iterator l(limits.begin());l!=limits.end();++l) {
+					char who[64];
+					if (l->networkId)
+						OSUtils::ztsnprintf(who,sizeof(who),"network=\"%.16llx\"",(unsigned long long)l->networkId);
+					else OSUtils::ztsnprintf(who,sizeof(who),"member=\"%.10llx\"",(unsigned long long)l->address);
+					if (k == 2) {
+						_metric(out,limitMetrics[k][0],who,l->rate);
+					} else {
+						const uint64_t v[3] = { (k) ? l->bytesPassed : l->packetsPassed,(k) ? l->bytesDelayed : l->packetsDelayed,(k) ? l->bytesDropped : l->packetsDropped };
+						static const char *const results[3] = { "passed","delayed","dropped" };
+						for(unsigned int r=0;r<3;++r) {
+							OSUtils::ztsnprintf(labels,sizeof(labels),"%s,result=\"%s\"",who,results[r]);
+							_metric(out,limitMetrics[k][0],labels,v[r]);
+						}
+					}
+				}
+			}
+		}
+
+		_metricHeader(out,"zerotier_port_output_drops_total","counter","Frames dropped because a virtual port's output queue was full");
+		ZT_VirtualNetworkList *nws = _node->networks();
+		if (nws) {
+			for(unsigned long i=0;i<nws->networkCount;++i) {
+				OSUtils::ztsnprintf(labels,sizeof(labels),"network=\"%.16llx\"",(unsigned long long)nws->networks[i].nwid);
+				_metric(out,"zerotier_port_output_drops_total",labels,_portOutputDrops(nws->networks[i].nwid));
+			}
+			_node->freeQueryResult((void *)nws);
+		}
+
+		std::vector<Binder::UdpSocketStats> udpStats;
+		_binder.udpSocketStats<OneServiceImpl *>(udpStats);
+		_metricHeader(out,"zerotier_udp_socket_drops_total","counter","Datagrams the OS dropped because a UDP socket's receive buffer was full (Linux only)");
+		for(std::vector<Binder::UdpSocketStats>::const_iterator u(udpStats.begin());u!=udpStats.end();++u) {
+			char a[64];
+			OSUtils::ztsnprintf(labels,sizeof(labels),"address=\"%s\",socket=\"%u\"",u->address.toString(a),u->socket);
+			_metric(out,"zerotier_udp_socket_drops_total",labels,u->drops);
+		}
+		_metricHeader(out,"zerotier_udp_socket_buffer_bytes","gauge","Receive and send buffer size of a UDP socket");
+		for(std::vector<Binder::UdpSocketStats>::const_iterator u(udpStats.begin());u!=udpStats.end();++u) {
+			char a[64];
+			OSUtils::ztsnprintf(labels,sizeof(labels),"address=\"%s\",socket=\"%u\"",u->address.toString(a),u->socket);
+			_metric(out,"zerotier_udp_socket_buffer_bytes",labels,(uint64_t)u->bufferSize);
+		}
+
+		// Only builds with ZT_MUTEX_PROFILING report any locks
+		std::vector<ZT_LockProfile> locks(256);
+		locks.resize(_node->lockProfiles(locks.data(),(unsigned int)locks.size()));
+		if (!locks.empty()) {
+			_metricHeader(out,"zerotier_lock_acquisitions_total","counter","Times locks with this name were acquired");
+			for(std::vector<ZT_LockProfile>::const_iterator l(locks.begin());l!=locks.end();++l) {
+				OSUtils::ztsnprintf(labels,sizeof(labels),"lock=\"%s\"",l->name);
+				_metric(out,"zerotier_lock_acquisitions_total",labels,l->acquisitions);
+			}
+			_metricHeader(out,"zerotier_lock_contended_total","counter","Acquisitions that had to wait for another holder");
+			for(std::vector<ZT_LockProfile>::const_iterator l(locks.begin());l!=locks.end();++l) {
+				OSUtils::ztsnprintf(labels,sizeof(labels),"lock=\"%s\"",l->name);
+				_metric(out,"zerotier_lock_contended_total",labels,l->contended);
+			}
+			_metricHeader(out,"zerotier_lock_wait_seconds_total","counter","Time spent waiting in contended acquisitions");
+			for(std::vector<ZT_LockProfile>::const_iterator l(locks.begin());l!=locks.end();++l) {
+				char tmp[192];
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_lock_wait_seconds_total{lock=\"%s\"} %.9f\n",l->name,(double)l->waitNanoseconds / 1000000000.0);
+				out.append(tmp);
+			}
+			_metricHeader(out,"zerotier_lock_hold_seconds","histogram","Time locks were held");
+			for(std::vector<ZT_LockProfile>::const_iterator l(locks.begin());l!=locks.end();++l) {
+				char tmp[192];
+				uint64_t count = 0;
+				for(unsigned int b=0;b<ZT_LOCK_PROFILE_HOLD_BUCKETS;++b) {
+					count += l->hold[b];
+					if (b == (ZT_LOCK_PROFILE_HOLD_BUCKETS - 1))
+						OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_lock_hold_seconds_bucket{lock=\"%s\",le=\"+Inf\"} %llu\n",l->name,(unsigned long long)count);
+					else OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_lock_hold_seconds_bucket{lock=\"%s\",le=\"%g\"} %llu\n",l->name,(double)(128ULL << b) / 1000000000.0,(unsigned long long)count);
+					out.append(tmp);
+				}
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"zerotier_lock_hold_seconds_sum{lock=\"%s\"} %.9f\nzerotier_lock_hold_seconds_count{lock=\"%s\"} %llu\n",l->name,(double)l->holdNanoseconds / 1000000000.0,l->name,(unsigned long long)count);
+				out.append(tmp);
+			}
+		}
+	}
+
+	// Rule set hits, evaluation cost and suggested order for GET /metrics/rules
+	inline bool _ruleCountersToJson(nlohmann::json &res,uint64_t nwid)
+	{
+		ZT_RuleCountersList *const rl = _node->ruleCounters(nwid);
+		if (!rl)
+			return false;
+		res["clock"] = OSUtils::now();
+		nlohmann::json &ll = res["lists"] = nlohmann::json::array();
+		char tmp[32];
+		for(unsigned long i=0;i<rl->listCount;++i) {
+			const ZT_RuleListCounters &l = rl->lists[i];
+			nlohmann::json lj;
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)l.networkId);
+			lj["nwid"] = tmp;
+			if (l.capability)
+				lj["capability"] = l.capabilityId;
+			else lj["capability"] = nlohmann::json();
+			lj["evaluations"] = l.evaluations;
+			lj["entriesEvaluated"] = l.entriesEvaluated;
+			bool reorder = false;
+			nlohmann::json &sl = lj["sets"] = nlohmann::json::array();
+			for(unsigned int s=0;s<l.setCount;++s) {
+				nlohmann::json sj;
+				sj["first"] = l.sets[s].first;
+				sj["action"] = l.sets[s].action;
+				sj["hits"] = l.sets[s].hits;
+				sj["suggestedPosition"] = l.sets[s].suggestedPosition;
+				reorder |= (l.sets[s].suggestedPosition != s);
+				sl.push_back(sj);
+			}
+			lj["reorder"] = reorder;
+			ll.push_back(lj);
+		}
+		_node->freeQueryResult((void *)rl);
+		return true;
+	}
+
+	// Heaviest members, flows, Ethernet types and relay destinations for GET /metrics/talkers
+	inline void _topTalkersToJson(nlohmann::json &res,uint64_t nwid)
+	{
+		static const char *const typeNames[4] = { "member","flow","etherType","relay" };
+
+		unsigned long networks = 1;
+		if (!nwid) {
+			ZT_VirtualNetworkList *nws = _node->networks();
+			if (nws) {
+				networks = nws->networkCount;
+				_node->freeQueryResult((void *)nws);
+			}
+		}
+		std::vector<ZT_TopTalker> talkers(((networks * 3) + 1) * ZT_TOPTALKERS_SIZE); // each network's three kinds plus relays
+		talkers.resize(_node->topTalkers(nwid,talkers.data(),(unsigned int)talkers.size()));
+
+		res["clock"] = OSUtils::now();
+		nlohmann::json &tl = res["talkers"] = nlohmann::json::array();
+		char tmp[128];
+		for(std::vector<ZT_TopTalker>::const_iterator t(talkers.begin());t!=talkers.end();++t) {
+			nlohmann::json tj;
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)t->networkId);
+			tj["nwid"] = tmp;
+			tj["type"] = typeNames[(unsigned int)t->type & 3];
+			switch(t->type) {
+				case ZT_TOP_TALKER_MEMBER:
+				case ZT_TOP_TALKER_RELAY:
+					OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)t->key);
+					tj["address"] = tmp;
+					break;
+				case ZT_TOP_TALKER_FLOW:
+					tj["source"] = reinterpret_cast<const InetAddress *>(&(t->source))->toString(tmp);
+					tj["destination"] = reinterpret_cast<const InetAddress *>(&(t->destination))->toString(tmp);
+					tj["protocol"] = t->protocol;
+					break;
+				case ZT_TOP_TALKER_ETHERTYPE:
+					OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.4x",(unsigned int)t->key);
+					tj["etherType"] = tmp;
+					break;
+			}
+			tj["since"] = t->since;
+			tj["frames"] = t->frames;
+			tj["bytes"] = t->bytes;
+			tj["bytesError"] = t->bytesError;
+			tl.push_back(tj);
+		}
+	}
+
+	// Raw counters for GET /metrics/top; zerotier-cli top polls this and computes rates itself
+	inline void _metricsTopToJson(nlohmann::json &res,unsigned long maxPeers)
+	{
+		static const char *const dropNames[ZT_METRICS_DROP_REASON_COUNT] = {
+			"mac_failed","invalid","hello","network_access_denied","frame_in","frame_out","relay_hops","rx_queue","egress_queue","rate_limit","overload"
+		};
+
+		ZT_Metrics m;
+		_node->metrics(&m);
+		ZT_MemoryUsage mu;
+		_node->memoryUsage(&mu);
+
+		uint64_t t[4] = { 0,0,0,0 };
+		for(unsigned int v=0;v<ZT_METRICS_VERB_COUNT;++v) {
+			t[0] += m.packetsIn[v];
+			t[1] += m.bytesIn[v];
+			t[2] += m.packetsOut[v];
+			t[3] += m.bytesOut[v];
+		}
+
+		res["clock"] = OSUtils::now();
+		res["packetsIn"] = t[0];
+		res["bytesIn"] = t[1];
+		res["packetsOut"] = t[2];
+		res["bytesOut"] = t[3];
+		res["relayedPackets"] = m.relayedPackets;
+		res["relayedBytes"] = m.relayedBytes;
+		res["cryptoEncryptNs"] = m.cryptoEncryptNanoseconds;
+		res["cryptoDecryptNs"] = m.cryptoDecryptNanoseconds;
+		res["rxQueueEntries"] = m.rxQueueSize;
+		res["rxQueueBytes"] = mu.rxQueueBytes;
+		res["txQueueBytes"] = mu.txQueueBytes;
+		res["peerCount"] = m.peers;
+		res["pathCount"] = m.paths;
+
+		nlohmann::json &drops = res["drops"] = nlohmann::json::object();
+		for(unsigned int r=0;r<ZT_METRICS_DROP_REASON_COUNT;++r)
+			drops[dropNames[r]] = m.drops[r];
+
+		nlohmann::json &nws = res["networks"] = nlohmann::json::array();
+		char tmp[64];
+		for(unsigned int i=0;i<m.networkCount;++i) {
+			const ZT_NetworkMetrics &nm = m.networks[i];
+			nlohmann::json n;
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nm.networkId);
+			n["id"] = tmp;
+			n["framesIn"] = nm.framesIn;
+			n["bytesIn"] = nm.bytesIn;
+			n["framesOut"] = nm.framesOut;
+			n["bytesOut"] = nm.bytesOut;
+			nws.push_back(n);
+		}
+
+		// Busiest peers by lifetime bytes; the CLI keeps the previous sample to rank by rate
+		nlohmann::json &peers = res["peers"] = nlohmann::json::array();
+		ZT_PeerList *pl = _node->peers();
+		if (pl) {
+			std::vector< std::pair<uint64_t,const ZT_Peer *> > busiest;
+			busiest.reserve(pl->peerCount);
+			for(unsigned long i=0;i<pl->peerCount;++i)
+				busiest.push_back(std::pair<uint64_t,const ZT_Peer *>(pl->peers[i].bytesIn + pl->peers[i].bytesOut,&(pl->peers[i])));
+			if (busiest.size() > maxPeers) {
+				std::nth_element(busiest.begin(),busiest.begin() + maxPeers,busiest.end(),std::greater< std::pair<uint64_t,const ZT_Peer *> >());
+				busiest.resize(maxPeers);
+			}
+			for(std::vector< std::pair<uint64_t,const ZT_Peer *> >::const_iterator b(busiest.begin());b!=busiest.end();++b) {
+				const ZT_Peer *const p = b->second;
+				nlohmann::json pj;
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)p->address);
+				pj["address"] = tmp;
+				pj["packetsIn"] = p->packetsIn;
+				pj["bytesIn"] = p->bytesIn;
+				pj["relayedPacketsIn"] = p->relayedPacketsIn;
+				pj["packetsOut"] = p->packetsOut;
+				pj["bytesOut"] = p->bytesOut;
+				pj["relayedPacketsOut"] = p->relayedPacketsOut;
+				peers.push_back(pj);
+			}
+			_node->freeQueryResult((void *)pl);
+		}
+
+		nlohmann::json &lj = res["locks"] = nlohmann::json::array();
+		std::vector<ZT_LockProfile> locks(256);
+		locks.resize(_node->lockProfiles(locks.data(),(unsigned int)locks.size()));
+		for(std::vector<ZT_LockProfile>::const_iterator l(locks.begin());l!=locks.end();++l) {
+			nlohmann::json lk;
+			lk["name"] = l->name;
+			lk["acquisitions"] = l->acquisitions;
+			lk["contended"] = l->contended;
+			lk["waitNs"] = l->waitNanoseconds;
+			lj.push_back(lk);
+		}
+	}
+
 #ifdef ZT_SDK
 	virtual void leave(const uint64_t hp)
 	{
@@ -1067,6 +2468,17 @@ public:
 			return 404;
 		}
 
+		// Lists can be paged with ?offset= (entries to skip) and ?limit= (maximum entries to return)
+		unsigned long listOffset = 0,listLimit = ~((unsigned long)0);
+		{
+			std::map<std::string,std::string>::const_iterator a(urlArgs.find("offset"));
+			if (a != urlArgs.end())
+				listOffset = Utils::strToULong(a->second.c_str());
+			a = urlArgs.find("limit");
+			if (a != urlArgs.end())
+				listLimit = Utils::strToULong(a->second.c_str());
+		}
+
 		bool isAuth = false;
 		{
 			std::map<std::string,std::string>::const_iterator ah(headers.find("x-zt1-auth"));
@@ -1137,7 +2549,18 @@ public:
 					res["address"] = tmp;
 					res["publicIdentity"] = status.publicIdentity;
 					res["online"] = (bool)(status.online != 0);
-					res["tcpFallbackActive"] = (_tcpFallbackTunnel != (TcpConnection *)0);
+					switch(status.natType) {
+						case ZT_NAT_TYPE_CONE:            res["natType"] = "CONE"; break;
+						case ZT_NAT_TYPE_PORT_PRESERVING: res["natType"] = "PORT_PRESERVING"; break;
+						case ZT_NAT_TYPE_SEQUENTIAL:      res["natType"] = "SEQUENTIAL"; break;
+						case ZT_NAT_TYPE_RANDOM:          res["natType"] = "RANDOM"; break;
+						default:                          res["natType"] = "UNKNOWN"; break;
+					}
+					{
+						Mutex::Lock _l(_tcpFallbackTunnels_m);
+						res["tcpFallbackActive"] = (!_tcpFallbackTunnels.empty());
+						res["tcpFallbackTunnels"] = (unsigned long)_tcpFallbackTunnels.size();
+					}
 					res["versionMajor"] = ZEROTIER_ONE_VERSION_MAJOR;
 					res["versionMinor"] = ZEROTIER_ONE_VERSION_MINOR;
 					res["versionRev"] = ZEROTIER_ONE_VERSION_REVISION;
@@ -1165,6 +2588,19 @@ public:
 					const World planet(_node->planet());
 					res["planetWorldId"] = planet.id();
 					res["planetWorldTimestamp"] = planet.timestamp();
+					{
+						ZT_MemoryUsage mu;
+						_node->memoryUsage(&mu);
+						json &mem = res["memory"];
+						mem["peers"] = mu.peers;
+						mem["paths"] = mu.paths;
+						mem["peerBytes"] = mu.peerBytes;
+						mem["pathBytes"] = mu.pathBytes;
+						mem["bytesPerPeer"] = mu.bytesPerPeer;
+						mem["bytesPerPath"] = mu.bytesPerPath;
+						_objectPoolToJson(mem["peerPool"],mu.peerPool);
+						_objectPoolToJson(mem["pathPool"],mu.pathPool);
+					}
 
 					scode = 200;
 				} else if (ps[0] == "moon") {
@@ -1197,16 +2633,19 @@ public:
 					ZT_VirtualNetworkList *nws = _node->networks();
 					if (nws) {
 						if (ps.size() == 1) {
-							// Return [array] of all networks
+							// Return [array] of all networks, serialized one at a time
 
-							res = nlohmann::json::array();
-							for(unsigned long i=0;i<nws->networkCount;++i) {
+							unsigned long count = 0;
+							for(unsigned long i=listOffset;(i<nws->networkCount)&&(count<listLimit);++i) {
 								OneService::NetworkSettings localSettings;
 								getNetworkSettings(nws->networks[i].nwid,localSettings);
 								nlohmann::json nj;
 								_networkToJson(nj,&(nws->networks[i]),portDeviceName(nws->networks[i].nwid),localSettings);
-								res.push_back(nj);
+								nj["portOutputDrops"] = _portOutputDrops(nws->networks[i].nwid);
+								_jsonArrayAppend(responseBody,nj,count);
 							}
+							_jsonArrayEnd(responseBody,count);
+							responseContentType = "application/json";
 
 							scode = 200;
 						} else if (ps.size() == 2) {
@@ -1218,6 +2657,7 @@ public:
 									OneService::NetworkSettings localSettings;
 									getNetworkSettings(nws->networks[i].nwid,localSettings);
 									_networkToJson(res,&(nws->networks[i]),portDeviceName(nws->networks[i].nwid),localSettings);
+									res["portOutputDrops"] = _portOutputDrops(nws->networks[i].nwid);
 									scode = 200;
 									break;
 								}
@@ -1226,18 +2666,68 @@ public:
 						} else scode = 404;
 						_node->freeQueryResult((void *)nws);
 					} else scode = 500;
+				} else if (ps[0] == "trace") {
+					// Drain captured events (a capture to file gets whatever is left)
+					json &records = res["records"];
+					records = json::array();
+					_traceDrain((FILE *)0,&records,std::min(listLimit,(unsigned long)65536));
+					res["capturing"] = _traceCapturing;
+					res["dropped"] = _traceDropped;
+					scode = 200;
+				} else if (ps[0] == "capture") {
+					// Frames as pcapng, or with /capture/status just the capture settings
+					ZT_FrameCapture *fc = _node->readFrameCapture((ps.size() == 1)&&(urlArgs["clear"] == "1"));
+					if (fc) {
+						if (ps.size() == 1) {
+							responseBody.assign(reinterpret_cast<const char *>(fc->data),fc->size);
+							responseContentType = "application/x-pcapng";
+							scode = 200;
+						} else if (ps[1] == "status") {
+							_frameCaptureToJson(res,fc);
+							scode = 200;
+						} // else 404
+						_node->freeQueryResult((void *)fc);
+					} else scode = 500;
+				} else if (ps[0] == "record") {
+					_wireRecorderToJson(res);
+					scode = 200;
+				} else if (ps[0] == "memory") {
+					_memoryToJson(res);
+					scode = 200;
+				} else if (ps[0] == "cluster") {
+					scode = (_clusterToJson(res)) ? 200 : 404;
+				} else if (ps[0] == "metrics") {
+					if (ps.size() == 1) {
+						// Prometheus text format, which also keeps jsonp from applying
+						_metricsText(responseBody);
+						responseContentType = "text/plain; version=0.0.4";
+						scode = 200;
+					} else if ((ps.size() == 2)&&(ps[1] == "top")) {
+						_metricsTopToJson(res,(urlArgs.count("limit")) ? listLimit : 256);
+						scode = 200;
+					} else if ((ps.size() == 2)&&(ps[1] == "talkers")) {
+						_topTalkersToJson(res,(urlArgs.count("network")) ? Utils::hexStrToU64(urlArgs["network"].c_str()) : 0);
+						scode = 200;
+					} else if ((ps.size() == 2)&&(ps[1] == "rules")) {
+						scode = (_ruleCountersToJson(res,(urlArgs.count("network")) ? Utils::hexStrToU64(urlArgs["network"].c_str()) : 0)) ? 200 : 500;
+					} else scode = 404;
 				} else if (ps[0] == "peer") {
 					ZT_PeerList *pl = _node->peers();
 					if (pl) {
 						if (ps.size() == 1) {
-							// Return [array] of all peers
+							// Return [array] of peers matching any filters, serialized one at a time so a
+							// large peer list never exists as a single JSON document in memory
 
-							res = nlohmann::json::array();
-							for(unsigned long i=0;i<pl->peerCount;++i) {
+							unsigned long matched = 0,count = 0;
+							for(unsigned long i=0;(i<pl->peerCount)&&(count<listLimit);++i) {
+								if ((!_peerMatches(&(pl->peers[i]),urlArgs))||(matched++ < listOffset))
+									continue;
 								nlohmann::json pj;
 								_peerToJson(pj,&(pl->peers[i]));
-								res.push_back(pj);
+								_jsonArrayAppend(responseBody,pj,count);
 							}
+							_jsonArrayEnd(responseBody,count);
+							responseContentType = "application/json";
 
 							scode = 200;
 						} else if (ps.size() == 2) {
@@ -1265,7 +2755,64 @@ public:
 		} else if ((httpMethod == HTTP_POST)||(httpMethod == HTTP_PUT)) {
 			if (isAuth) {
 
-				if (ps[0] == "moon") {
+				if (ps[0] == "trace") {
+					// Start or change trace capture, e.g. {"sampleRate":1,"maxPerSecond":1000,"duration":60,"file":true}
+					try {
+						json j(OSUtils::jsonParse(body));
+						if (j.is_object()) {
+							const unsigned int event = (unsigned int)OSUtils::jsonIntHex(j["event"],0ULL);
+							const unsigned int sampleRate = (unsigned int)std::min(OSUtils::jsonInt(j["sampleRate"],1ULL),(uint64_t)0xffffffff);
+							const unsigned int maxPerSecond = (unsigned int)std::min(OSUtils::jsonInt(j["maxPerSecond"],0ULL),(uint64_t)0xffffffff);
+							const uint64_t duration = std::min(OSUtils::jsonInt(j["duration"],0ULL),(uint64_t)86400);
+							if ((!event)&&(!sampleRate)) {
+								_traceStop();
+							} else {
+								if ((OSUtils::jsonBool(j["file"],false))&&(!_traceFile))
+									_traceFile = fopen((_homePath + ZT_PATH_SEPARATOR_S "trace.log").c_str(),"a");
+								_node->setTraceCapture(event,sampleRate,maxPerSecond);
+								_traceCapturing = true;
+								_traceUntil = (duration) ? (OSUtils::now() + (int64_t)(duration * 1000)) : 0;
+							}
+							res["capturing"] = _traceCapturing;
+							res["file"] = (_traceFile) ? true : false;
+							res["duration"] = duration;
+							scode = 200;
+						} else scode = 400;
+					} catch ( ... ) {
+						scode = 400;
+					}
+				} else if (ps[0] == "capture") {
+					// Start or restart frame capture, e.g. {"network":"8056c2e21c000001","maxFrames":4096,"snapLength":256}
+					try {
+						json j(OSUtils::jsonParse(body));
+						if (j.is_object()) {
+							_node->setFrameCapture(
+								OSUtils::jsonIntHex(j["network"],0ULL),
+								(unsigned int)std::min(OSUtils::jsonInt(j["maxFrames"],(uint64_t)ZT_FRAME_CAPTURE_DEFAULT_FRAMES),(uint64_t)ZT_FRAME_CAPTURE_MAX_FRAMES),
+								(unsigned int)std::min(OSUtils::jsonInt(j["snapLength"],(uint64_t)ZT_FRAME_CAPTURE_DEFAULT_SNAPLEN),(uint64_t)ZT_FRAME_CAPTURE_MAX_SNAPLEN));
+							ZT_FrameCapture *fc = _node->readFrameCapture(false);
+							if (fc) {
+								_frameCaptureToJson(res,fc);
+								_node->freeQueryResult((void *)fc);
+								scode = 200;
+							} else scode = 500;
+						} else scode = 400;
+					} catch ( ... ) {
+						scode = 400;
+					}
+				} else if (ps[0] == "record") {
+					// Start recording received datagrams to wire.rec for replay, e.g. {"maxBytes":104857600}
+					try {
+						json j((body.length() > 0) ? OSUtils::jsonParse(body) : json::object());
+						const uint64_t maxBytes = (j.is_object()) ? OSUtils::jsonInt(j["maxBytes"],0ULL) : 0ULL;
+						if (_wireRecorder.start((_homePath + ZT_PATH_SEPARATOR_S "wire.rec").c_str(),_node->address(),OSUtils::now(),maxBytes)) {
+							_wireRecorderToJson(res);
+							scode = 200;
+						} else scode = 500;
+					} catch ( ... ) {
+						scode = 400;
+					}
+				} else if (ps[0] == "moon") {
 					if (ps.size() == 2) {
 
 						uint64_t seed = 0;
@@ -1330,6 +2877,7 @@ public:
 
 									setNetworkSettings(nws->networks[i].nwid,localSettings);
 									_networkToJson(res,&(nws->networks[i]),portDeviceName(nws->networks[i].nwid),localSettings);
+									res["portOutputDrops"] = _portOutputDrops(nws->networks[i].nwid);
 
 									scode = 200;
 									break;
@@ -1349,7 +2897,19 @@ public:
 		} else if (httpMethod == HTTP_DELETE) {
 			if (isAuth) {
 
-				if (ps[0] == "moon") {
+				if (ps[0] == "trace") {
+					_traceStop();
+					res["result"] = true;
+					scode = 200;
+				} else if (ps[0] == "capture") {
+					_node->setFrameCapture(0,0,0);
+					res["result"] = true;
+					scode = 200;
+				} else if (ps[0] == "record") {
+					_wireRecorder.stop();
+					_wireRecorderToJson(res);
+					scode = 200;
+				} else if (ps[0] == "moon") {
 					if (ps.size() == 2) {
 						_node->deorbit((void *)0,Utils::hexStrToU64(ps[1].c_str()));
 						res["result"] = true;
@@ -1403,6 +2963,20 @@ public:
 	}
 
 	// Must be called after _localConfig is read or modified
+	// CPUs for one kind of thread from "cpuAffinity" in local.conf settings, empty if not set
+	static inline std::vector<unsigned int> _cpuAffinity(const json &settings,const char *kind)
+	{
+		if (settings.is_object()) {
+			json::const_iterator a(settings.find("cpuAffinity"));
+			if ((a != settings.end())&&(a->is_object())) {
+				json::const_iterator k(a->find(kind));
+				if (k != a->end())
+					return OSUtils::cpuList(OSUtils::jsonString(*k,"").c_str());
+			}
+		}
+		return std::vector<unsigned int>();
+	}
+
 	void applyLocalConfig()
 	{
 		Mutex::Lock _l(_localConfig_m);
@@ -1410,8 +2984,56 @@ public:
 
 		_v4Hints.clear();
 		_v6Hints.clear();
-		_v4Blacklists.clear();
-		_v6Blacklists.clear();
+		_blacklists.clear();
+
+		// Peers no longer in virtual[] go back to following the default
+		const ZT_MultipathMode multipathDefault = _multipathModeFromString(OSUtils::jsonString(lc["settings"]["multipathMode"],"none"));
+		_node->setMultipathMode(0,multipathDefault);
+		for(std::vector<uint64_t>::const_iterator a(_multipathPeers.begin());a!=_multipathPeers.end();++a)
+			_node->setMultipathMode(*a,multipathDefault);
+		_multipathPeers.clear();
+		_node->setUpstreamLatencyHint(0,0);
+		_node->setMemberRateLimit(0,0);
+
+		const unsigned int ffInterval = (unsigned int)OSUtils::jsonInt(lc["settings"]["fastFailoverInterval"],0ULL);
+		const unsigned int ffMissed = (unsigned int)OSUtils::jsonInt(lc["settings"]["fastFailoverMissedProbes"],(uint64_t)ZT_FAST_FAILOVER_DEFAULT_MISSED_PROBES);
+		if (_node->setFastFailover((ffInterval) ? std::max(ffInterval,(unsigned int)ZT_FAST_FAILOVER_MIN_INTERVAL) : 0,std::max(ffMissed,1U)) != ZT_RESULT_OK)
+			fprintf(stderr,"WARNING: invalid fast failover settings in local.conf" ZT_EOL_S);
+		_node->setAdaptiveKeepalive(OSUtils::jsonBool(lc["settings"]["adaptiveKeepalive"],false));
+		_node->setForwardErrorCorrection(OSUtils::jsonBool(lc["settings"]["forwardErrorCorrection"],false));
+		_node->setFrameAggregation(OSUtils::jsonBool(lc["settings"]["frameAggregation"],false));
+		_underlayTos = ((OSUtils::jsonBool(lc["settings"]["underlayDscp"],false)) ? 0xfc : 0) | ((OSUtils::jsonBool(lc["settings"]["underlayEcn"],false)) ? 0x03 : 0);
+		_binder.setUdpBufferCeiling((int)std::min(OSUtils::jsonInt(lc["settings"]["udpBufferCeiling"],(uint64_t)ZT_UDP_MAX_BUF_SIZE),(uint64_t)0x40000000ULL)); // applies to sockets bound after this
+		_node->setRelayCapacity(OSUtils::jsonInt(lc["settings"]["relayCapacity"],0ULL) * 125ULL); // kbit/s to bytes/s
+		_node->setPathPacing(OSUtils::jsonBool(lc["settings"]["pathPacing"],false));
+		_node->setColdPeerTimeout((int64_t)OSUtils::jsonInt(lc["settings"]["coldPeerTimeout"],0ULL) * 1000LL);
+		_stateSnapshotInterval = (int64_t)OSUtils::jsonInt(lc["settings"]["stateSnapshotInterval"],0ULL) * 1000LL;
+		_hostedNodesEnabled = OSUtils::jsonBool(lc["settings"]["hostedNodes"],false); // read at startup only
+		_node->setMemoryLimits((unsigned long)OSUtils::jsonInt(lc["settings"]["maxPeers"],(uint64_t)ZT_MAX_PEERS),(unsigned long)OSUtils::jsonInt(lc["settings"]["maxMulticastMembers"],(uint64_t)ZT_MAX_MULTICAST_MEMBERS));
+		_node->setBridgeRouteLimits((unsigned long)OSUtils::jsonInt(lc["settings"]["maxBridgeRoutes"],(uint64_t)ZT_MAX_BRIDGE_ROUTES),(unsigned long)OSUtils::jsonInt(lc["settings"]["maxBridgeRoutesPerBridge"],(uint64_t)ZT_MAX_BRIDGE_ROUTES_PER_BRIDGE));
+		_node->setAdmissionBudget(OSUtils::jsonInt(lc["settings"]["admissionBudget"],0ULL) * 1000ULL); // ms to microseconds of CPU per second
+		_node->setIdentityCacheSize((unsigned long)OSUtils::jsonInt(lc["settings"]["identityCacheSize"],(uint64_t)ZT_IDENTITY_VALIDATION_CACHE_SIZE));
+		const std::vector<unsigned int> cryptoCpus(_cpuAffinity(lc["settings"],"crypto"));
+		_node->setCryptoWorkerCpus((cryptoCpus.empty()) ? (const unsigned int *)0 : cryptoCpus.data(),(unsigned int)cryptoCpus.size());
+		_node->setCryptoWorkers((unsigned int)std::min(OSUtils::jsonInt(lc["settings"]["cryptoWorkers"],0ULL),(uint64_t)ZT_CRYPTO_WORKERS_MAX_THREADS));
+		const std::string hugePages(OSUtils::jsonString(lc["settings"]["hugePages"],"off"));
+		if (hugePages == "explicit")
+			_node->setHugePages(ZT_HUGE_PAGES_EXPLICIT);
+		else if (hugePages == "transparent")
+			_node->setHugePages(ZT_HUGE_PAGES_TRANSPARENT);
+		else _node->setHugePages(ZT_HUGE_PAGES_OFF);
+
+		uint64_t interactiveDscp = 0;
+		json &dscps = lc["settings"]["egressInteractiveDscp"];
+		if (dscps.is_array()) {
+			for(unsigned long i=0;i<dscps.size();++i) {
+				const uint64_t dscp = OSUtils::jsonInt(dscps[i],64ULL);
+				if (dscp < 64)
+					interactiveDscp |= (1ULL << dscp);
+			}
+		}
+		_node->setEgressRate(OSUtils::jsonInt(lc["settings"]["egressRate"],0ULL) * 125ULL,interactiveDscp); // kbit/s to bytes/s
+
 		json &virt = lc["virtual"];
 		if (virt.is_object()) {
 			for(json::iterator v(virt.begin());v!=virt.end();++v) {
@@ -1422,8 +3044,7 @@ public:
 						const uint64_t ztaddr2 = ztaddr.toInt();
 						std::vector<InetAddress> &v4h = _v4Hints[ztaddr2];
 						std::vector<InetAddress> &v6h = _v6Hints[ztaddr2];
-						std::vector<InetAddress> &v4b = _v4Blacklists[ztaddr2];
-						std::vector<InetAddress> &v6b = _v6Blacklists[ztaddr2];
+						PrefixTrie<bool> &bl = _blacklists[ztaddr2];
 
 						json &tryAddrs = v.value()["try"];
 						if (tryAddrs.is_array()) {
@@ -1438,37 +3059,41 @@ public:
 						json &blAddrs = v.value()["blacklist"];
 						if (blAddrs.is_array()) {
 							for(unsigned long i=0;i<blAddrs.size();++i) {
-								const InetAddress ip(OSUtils::jsonString(blAddrs[i],"").c_str());
-								if (ip.ss_family == AF_INET)
-									v4b.push_back(ip);
-								else if (ip.ss_family == AF_INET6)
-									v6b.push_back(ip);
+								bl.add(InetAddress(OSUtils::jsonString(blAddrs[i],"").c_str()),true);
 							}
 						}
 
+						const unsigned int latencyHint = (unsigned int)OSUtils::jsonInt(v.value()["latencyHint"],0ULL);
+						if (latencyHint)
+							_node->setUpstreamLatencyHint(ztaddr2,latencyHint);
+
+						const uint64_t rateLimit = OSUtils::jsonInt(v.value()["rateLimit"],0ULL);
+						if (rateLimit)
+							_node->setMemberRateLimit(ztaddr2,rateLimit * 125ULL); // kbit/s to bytes/s
+
+						json &mpm = v.value()["multipathMode"];
+						if (mpm.is_string()) {
+							_node->setMultipathMode(ztaddr2,_multipathModeFromString(OSUtils::jsonString(mpm,"none")));
+							_multipathPeers.push_back(ztaddr2);
+						}
+
 						if (v4h.empty()) _v4Hints.erase(ztaddr2);
 						if (v6h.empty()) _v6Hints.erase(ztaddr2);
-						if (v4b.empty()) _v4Blacklists.erase(ztaddr2);
-						if (v6b.empty()) _v6Blacklists.erase(ztaddr2);
+						if (bl.empty()) _blacklists.erase(ztaddr2);
 					}
 				}
 			}
 		}
 
-		_globalV4Blacklist.clear();
-		_globalV6Blacklist.clear();
+		_globalBlacklist.clear();
 		json &physical = lc["physical"];
 		if (physical.is_object()) {
 			for(json::iterator phy(physical.begin());phy!=physical.end();++phy) {
 				const InetAddress net(OSUtils::jsonString(phy.key(),"").c_str());
 				if ((net)&&(net.netmaskBits() > 0)) {
 					if (phy.value().is_object()) {
-						if (OSUtils::jsonBool(phy.value()["blacklist"],false)) {
-							if (net.ss_family == AF_INET)
-								_globalV4Blacklist.push_back(net);
-							else if (net.ss_family == AF_INET6)
-								_globalV6Blacklist.push_back(net);
-						}
+						if (OSUtils::jsonBool(phy.value()["blacklist"],false))
+							_globalBlacklist.add(net,true);
 					}
 				}
 			}
@@ -1481,7 +3106,47 @@ public:
 
 		_primaryPort = (unsigned int)OSUtils::jsonInt(settings["primaryPort"],(uint64_t)_primaryPort) & 0xffff;
 		_allowTcpFallbackRelay = OSUtils::jsonBool(settings["allowTcpFallbackRelay"],true);
+		{
+			Mutex::Lock _l(_tcpFallbackTunnels_m);
+			_tcpFallbackTunnelCount = std::max(1U,std::min((unsigned int)OSUtils::jsonInt(settings["tcpFallbackTunnels"],(uint64_t)ZT_TCP_FALLBACK_TUNNELS),(unsigned int)ZT_TCP_FALLBACK_MAX_TUNNELS));
+		}
 		_portMappingEnabled = OSUtils::jsonBool(settings["portMappingEnabled"],true);
+		_ioCpus = _cpuAffinity(settings,"io");
+		_controllerCpus = _cpuAffinity(settings,"controller");
+		if (_rxThreads.empty()) { // can't be changed once threads are running
+			_rxCpus = _cpuAffinity(settings,"rx");
+			_concurrency = (unsigned int)OSUtils::jsonInt(settings["concurrency"],1ULL);
+			if (!_concurrency)
+				_concurrency = (_rxCpus.empty()) ? std::max(1U,std::thread::hardware_concurrency()) : (unsigned int)_rxCpus.size();
+			_concurrency = std::min(_concurrency,64U);
+		}
+		if (_udpThreads.empty()) { // likewise
+			_udpCpus = _cpuAffinity(settings,"udp");
+			_udpSocketsPerAddress = (unsigned int)OSUtils::jsonInt(settings["udpSocketsPerAddress"],1ULL);
+			if (!_udpSocketsPerAddress)
+				_udpSocketsPerAddress = (_udpCpus.empty()) ? std::max(1U,std::thread::hardware_concurrency()) : (unsigned int)_udpCpus.size();
+			_udpSocketsPerAddress = std::min(_udpSocketsPerAddress,(unsigned int)ZT_BINDER_MAX_UDP_SOCKETS_PER_BINDING);
+			_ioUring = OSUtils::jsonBool(settings["ioUring"],false);
+			_rio = OSUtils::jsonBool(settings["rio"],false);
+			_xdpInterface = OSUtils::jsonString(settings["xdpInterface"],"");
+			_xdpQueues = std::max(1U,std::min((unsigned int)OSUtils::jsonInt(settings["xdpQueues"],1ULL),64U));
+			_busyPoll = (unsigned long)std::min(OSUtils::jsonInt(settings["busyPoll"],0ULL),(uint64_t)ZT_BUSY_POLL_MAX);
+			_socketBusyPoll = OSUtils::jsonBool(settings["socketBusyPoll"],false);
+			_phy.setBusyPoll(_busyPoll,_socketBusyPoll);
+#if defined(__LINUX__) && !defined(ZT_SDK) && !defined(ZT_USE_TEST_TAP)
+			LinuxEthernetTap::setIoUring(_ioUring);
+			LinuxEthernetTap::setQueues((unsigned int)OSUtils::jsonInt(settings["tapQueues"],1ULL));
+			LinuxEthernetTap::setOffload(OSUtils::jsonBool(settings["tapOffload"],false));
+			LinuxEthernetTap::setOutputQueue((unsigned int)std::min(OSUtils::jsonInt(settings["tapOutputQueue"],0ULL),(uint64_t)65536));
+			LinuxEthernetTap::setCpus(_cpuAffinity(settings,"tap"));
+			LinuxEthernetTap::setBusyPoll(_busyPoll);
+			LinuxEthernetTap::setThreads((unsigned int)OSUtils::jsonInt(settings["tapThreads"],0ULL));
+			_tapFilter = OSUtils::jsonBool(settings["tapFilter"],false);
+#endif
+#if defined(__FreeBSD__) && !defined(ZT_SDK) && !defined(ZT_USE_TEST_TAP)
+			BSDEthernetTap::setNetmap(OSUtils::jsonBool(settings["tapNetmap"],false));
+#endif
+		}
 
 #ifndef ZT_SDK
 		const std::string up(OSUtils::jsonString(settings["softwareUpdate"],ZT_SOFTWARE_UPDATE_DEFAULT));
@@ -1516,6 +3181,15 @@ public:
 					_allowManagementFrom.push_back(nw);
 			}
 		}
+
+		json &fe = settings["flowExport"];
+		if (fe.is_object()) {
+			const std::string collector(OSUtils::jsonString(fe["collector"],""));
+			if (!_ipfix.start(reinterpret_cast<ZT_Node *>(_node),InetAddress(collector.c_str()),(unsigned int)OSUtils::jsonInt(fe["sampleRate"],(uint64_t)ZT_IPFIX_DEFAULT_SAMPLE_RATE),(uint32_t)OSUtils::jsonInt(fe["observationDomain"],0ULL),(uint32_t)OSUtils::jsonInt(fe["enterpriseNumber"],0ULL)))
+				fprintf(stderr,"WARNING: unable to export flows to collector %s" ZT_EOL_S,collector.c_str());
+		} else {
+			_ipfix.stop();
+		}
 	}
 
 	// Checks if a managed IP or route target is allowed
@@ -1561,7 +3235,152 @@ public:
 	}
 
 	// Apply or update managed IPs for a configured network (be sure n.tap exists)
-	void syncManagedStuff(NetworkState &n,bool syncIps,bool syncRoutes)
+	// Create a network's tap, throwing on failure
+	inline EthernetTap *_newTap(const uint64_t nwid,const ZT_VirtualNetworkConfig *nwc)
+	{
+		char friendlyName[128];
+		OSUtils::ztsnprintf(friendlyName,sizeof(friendlyName),"ZeroTier One [%.16llx]",nwid);
+		return new EthernetTap(
+			_homePath.c_str(),
+			MAC(nwc->mac),
+			nwc->mtu,
+			(unsigned int)ZT_IF_METRIC,
+			nwid,
+			friendlyName,
+			StapFrameHandler,
+			(void *)this);
+	}
+
+	// Read a network's settings from its networks.d/<NETWORKID>.local.conf, if any
+	inline void _loadNetworkSettings(const uint64_t nwid,NetworkSettings &settings)
+	{
+		char nlcpath[256];
+		OSUtils::ztsnprintf(nlcpath,sizeof(nlcpath),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.local.conf",_homePath.c_str(),nwid);
+		std::string nlcbuf;
+		if (OSUtils::readFile(nlcpath,nlcbuf)) {
+			Dictionary<4096> nc;
+			nc.load(nlcbuf.c_str());
+			Buffer<1024> allowManaged;
+			if (nc.get("allowManaged", allowManaged) && allowManaged.size() != 0) {
+				std::string addresses (allowManaged.begin(), allowManaged.size());
+				if (allowManaged.size() <= 5) { // untidy parsing for backward compatibility
+					if (allowManaged[0] == '1' || allowManaged[0] == 't' || allowManaged[0] == 'T') {
+						settings.allowManaged = true;
+					} else {
+						settings.allowManaged = false;
+					}
+				} else {
+					// this should be a list of IP addresses
+					settings.allowManaged = true;
+					size_t pos = 0;
+					while (true) {
+						size_t nextPos = addresses.find(',', pos);
+						std::string address = addresses.substr(pos, (nextPos == std::string::npos ? addresses.size() : nextPos) - pos);
+						settings.allowManagedWhitelist.push_back(InetAddress(address.c_str()));
+						if (nextPos == std::string::npos) break;
+						pos = nextPos + 1;
+					}
+				}
+			} else {
+				settings.allowManaged = true;
+			}
+			settings.allowGlobal = nc.getB("allowGlobal", false);
+			settings.allowDefault = nc.getB("allowDefault", false);
+		}
+	}
+
+	inline void _logPortError(const uint64_t nwid,const char *what)
+	{
+#ifdef __WINDOWS__
+		FILE *tapFailLog = fopen((_homePath + ZT_PATH_SEPARATOR_S"port_error_log.txt").c_str(),"a");
+		if (tapFailLog) {
+			fprintf(tapFailLog,"%.16llx: %s" ZT_EOL_S,(unsigned long long)nwid,what);
+			fclose(tapFailLog);
+		}
+#else
+		fprintf(stderr,"ERROR: unable to configure virtual network port: %s" ZT_EOL_S,what);
+#endif
+	}
+
+	static inline void _waitForTap(EthernetTap *tap)
+	{
+#if defined(__WINDOWS__) && !defined(ZT_SDK)
+		// wait for up to 5 seconds for the WindowsEthernetTap to actually be initialized
+		//
+		// without WindowsEthernetTap::isInitialized() returning true, the won't actually
+		// be online yet and setting managed routes on it will fail.
+		const int MAX_SLEEP_COUNT = 500;
+		for (int i = 0; !tap->isInitialized() && i < MAX_SLEEP_COUNT; i++) {
+			Sleep(10);
+		}
+#endif
+	}
+
+	// Bring up ports for networks queued by nodeVirtualNetworkConfigFunction() during startup
+	void _restoreThreadMain()
+	{
+		for(;;) {
+			std::pair<uint64_t,void **> r;
+			NetworkState *const tmp = new NetworkState();
+			{
+				Mutex::Lock _l(_nets_m);
+				if (_restoreQueue.empty()) {
+					delete tmp;
+					return;
+				}
+				r = _restoreQueue.back();
+				_restoreQueue.pop_back();
+				std::map<uint64_t,NetworkState>::const_iterator n(_nets.find(r.first));
+				if ((n == _nets.end())||(!n->second.restoring)) { // left while queued
+					delete tmp;
+					continue;
+				}
+				ZT_FAST_MEMCPY(&(tmp->config),&(n->second.config),sizeof(ZT_VirtualNetworkConfig));
+			}
+
+			// Set up the port, IPs and routes with nothing locked so other networks can do the same
+			try {
+				tmp->tap = _newTap(r.first,&(tmp->config));
+				_loadNetworkSettings(r.first,tmp->settings);
+				_waitForTap(tmp->tap);
+				syncManagedStuff(*tmp,true,true);
+				tmp->tap->setMtu(tmp->config.mtu);
+			} catch (std::exception &exc) {
+				_logPortError(r.first,exc.what());
+			} catch ( ... ) {}
+
+			{
+				Mutex::Lock _l(_nets_m);
+				std::map<uint64_t,NetworkState>::iterator n(_nets.find(r.first));
+				if ((n != _nets.end())&&(n->second.restoring)) {
+					NetworkState &ns = n->second;
+					ns.restoring = false;
+					if (tmp->tap) {
+						ns.tap = tmp->tap;
+						tmp->tap = (EthernetTap *)0;
+						ns.settings = tmp->settings;
+						ns.managedIps.swap(tmp->managedIps);
+						ns.managedRoutes.swap(tmp->managedRoutes);
+						*(r.second) = (void *)&ns;
+						if (memcmp(&(ns.config),&(tmp->config),sizeof(ZT_VirtualNetworkConfig)) != 0) { // updated while we were working
+							syncManagedStuff(ns,true,true);
+							ns.tap->setMtu(ns.config.mtu);
+						}
+					} else {
+						_nets.erase(n);
+					}
+				}
+			}
+
+			// Anything left here belongs to a network that was left meanwhile
+			delete tmp->tap;
+			delete tmp;
+		}
+	}
+
+	// Routes already applied are synced again unless resyncRoutes is false, which
+	// is for config updates that only add or remove routes and can leave the rest alone
+	void syncManagedStuff(NetworkState &n,bool syncIps,bool syncRoutes,bool resyncRoutes = true)
 	{
 		char ipbuf[64];
 
@@ -1651,7 +3470,8 @@ public:
 				for(std::list< SharedPtr<ManagedRoute> >::iterator mr(n.managedRoutes.begin());mr!=n.managedRoutes.end();++mr) {
 					if ( ((*mr)->target() == *target) && ( ((via->ss_family == target->ss_family)&&((*mr)->via().ipsEqual(*via))) || (tapdev == (*mr)->device()) ) ) {
 						haveRoute = true;
-						(*mr)->sync();
+						if (resyncRoutes)
+							(*mr)->sync();
 						break;
 					}
 				}
@@ -1670,15 +3490,134 @@ public:
 	// Handlers for Node and Phy<> callbacks
 	// =========================================================================
 
-	inline void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
+	inline void phyOnDatagrams(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *datagrams,unsigned int count)
+	{
+		if ((sock == _clusterBackplane)&&(sock)) {
+			for(unsigned int i=0;i<count;++i) {
+				const InetAddress &from = *reinterpret_cast<const InetAddress *>(datagrams[i].address);
+				for(unsigned int m=0;m<ZT_CLUSTER_MAX_MEMBERS;++m) {
+					if (_clusterMembers[m] == from) {
+						_node->clusterHandleIncomingMessage((void *)0,datagrams[i].data,(unsigned int)datagrams[i].len);
+						break;
+					}
+				}
+			}
+			return;
+		}
+		const int64_t now = OSUtils::updateCoarseNow(); // one clock read for the whole batch
+		for(unsigned int i=0;i<count;++i) {
+			if ((datagrams[i].len >= 16)&&(reinterpret_cast<const InetAddress *>(datagrams[i].address)->ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
+				_lastDirectReceiveFromGlobal = now;
+				break;
+			}
+		}
+		const unsigned int rxTos = ((_underlayTos & 3) != 0) ? 0xff : 0; // only ECN is used on receive
+		if (!_rxQueues.empty()) {
+			for(unsigned int i=0;i<count;++i) {
+				RxDatagram *const d = (RxDatagram *)malloc(sizeof(RxDatagram) + datagrams[i].len);
+				if (d) {
+					d->sock = reinterpret_cast<int64_t>(sock);
+					ZT_FAST_MEMCPY(&(d->from),datagrams[i].address,sizeof(struct sockaddr_storage)); // Phy<> uses sockaddr_storage, so it'll always be that big
+					d->len = (unsigned int)datagrams[i].len;
+					d->tos = datagrams[i].tos & rxTos;
+					ZT_FAST_MEMCPY(d->data,datagrams[i].data,datagrams[i].len);
+					_rxQueues[reinterpret_cast<const InetAddress *>(datagrams[i].address)->hashCode() % _rxQueues.size()]->post(d);
+				}
+			}
+			return;
+		}
+		if (count == 1) {
+			_processWirePacket(now,reinterpret_cast<int64_t>(sock),reinterpret_cast<const struct sockaddr_storage *>(datagrams[0].address),datagrams[0].data,(unsigned int)datagrams[0].len,datagrams[0].tos & rxTos);
+			return;
+		}
+		// Whole batch goes to the core in one call so replies go out together too
+		ZT_WirePacket packets[ZT_PHY_UDP_BATCH_SIZE];
+		unsigned int n = 0;
+		for(unsigned int i=0;i<count;++i) {
+			ZT_WirePacket &p = packets[n++];
+			p.localSocket = reinterpret_cast<int64_t>(sock);
+			ZT_FAST_MEMCPY(&(p.address),datagrams[i].address,sizeof(struct sockaddr_storage));
+			p.data = datagrams[i].data;
+			p.length = (unsigned int)datagrams[i].len;
+			p.ttl = 0;
+			p.tos = datagrams[i].tos & rxTos;
+			if (n == ZT_PHY_UDP_BATCH_SIZE) {
+				_processWirePackets(now,packets,n);
+				n = 0;
+			}
+		}
+		if (n)
+			_processWirePackets(now,packets,n);
+	}
+
+	void _rxThreadMain(BlockingQueue<RxDatagram *> *q,int cpu)
+	{
+		if (cpu >= 0)
+			Utils::pinThread((unsigned int)cpu);
+		RxDatagram *d;
+		while ((q->get(d))&&(d)) {
+			_processWirePacket(OSUtils::coarseNow(),d->sock,&(d->from),d->data,d->len,d->tos); // queued moments ago by phyOnDatagrams()
+			free(d);
+		}
+	}
+
+	void _udpThreadMain(UdpThread *t)
+	{
+		// Receive buffers are allocated on first poll(), so after this they're on this CPU's NUMA node
+		if (t->cpu >= 0)
+			Utils::pinThread((unsigned int)t->cpu);
+		while (_udpThreadsRun) {
+			if (_udpThreadsPaused) {
+				Thread::sleep(1);
+				continue;
+			}
+			Mutex::Lock _l(t->lock);
+			t->phy.poll(1000);
+		}
+	}
+
+	// Stops UDP socket group threads polling so their Phy<> can be modified
+	inline void _pauseUdpThreads()
 	{
-		if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(from)->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
-			_lastDirectReceiveFromGlobal = OSUtils::now();
+		_udpThreadsPaused = true;
+		for(std::vector< UdpThread * >::iterator t(_udpThreads.begin());t!=_udpThreads.end();++t) {
+			(*t)->phy.whack();
+			(*t)->lock.lock();
+		}
+	}
+
+	inline void _resumeUdpThreads()
+	{
+		for(std::vector< UdpThread * >::iterator t(_udpThreads.begin());t!=_udpThreads.end();++t)
+			(*t)->lock.unlock();
+		_udpThreadsPaused = false;
+	}
+
+	inline void _processWirePacket(const int64_t now,const int64_t sock,const struct sockaddr_storage *from,const void *data,unsigned int len,unsigned int tos)
+	{
+		if (tos) { // only the batch call takes a traffic class
+			ZT_WirePacket p;
+			p.localSocket = sock;
+			ZT_FAST_MEMCPY(&(p.address),from,sizeof(struct sockaddr_storage));
+			p.data = data;
+			p.length = len;
+			p.ttl = 0;
+			p.tos = tos;
+			_processWirePackets(now,&p,1);
+			return;
+		}
+		_wireRecorder.record(now,sock,from,data,len);
+		HostedNode *const h = _hostedNodeFor(data,len);
+		if (h) {
+			h->node->processWirePacket((void *)0,now,sock,from,data,len,&(h->nextBackgroundTaskDeadline));
+			_rescheduleHostedNode(h);
+			return;
+		}
 		const ZT_ResultCode rc = _node->processWirePacket(
 			(void *)0,
-			OSUtils::now(),
-			reinterpret_cast<int64_t>(sock),
-			reinterpret_cast<const struct sockaddr_storage *>(from), // Phy<> uses sockaddr_storage, so it'll always be that big
+			now,
+			sock,
+			from,
 			data,
 			len,
 			&_nextBackgroundTaskDeadline);
@@ -1692,6 +3631,53 @@ public:
 		}
 	}
 
+	inline void _processWirePackets(const int64_t now,const ZT_WirePacket *packets,unsigned int count)
+	{
+#if defined(__LINUX__) && !defined(ZT_SDK) && !defined(ZT_USE_TEST_TAP)
+		LinuxEthernetTap::PutBatch pb; // lets TCP segments in this batch reach the tap as one frame
+#endif
+		if (_wireRecorder.active()) {
+			for(unsigned int i=0;i<count;++i)
+				_wireRecorder.record(now,packets[i].localSocket,&(packets[i].address),packets[i].data,packets[i].length);
+		}
+		if (!_hostedNodes.empty()) {
+			// Packets for hosted nodes are handed over one at a time, and runs of the rest still go to our node as one batch
+			unsigned int start = 0;
+			for(unsigned int i=0;i<count;++i) {
+				HostedNode *const h = _hostedNodeFor(packets[i].data,packets[i].length);
+				if (h) {
+					if (i > start)
+						_processOwnWirePackets(now,packets + start,i - start);
+					h->node->processWirePackets((void *)0,now,packets + i,1,&(h->nextBackgroundTaskDeadline));
+					_rescheduleHostedNode(h);
+					start = i + 1;
+				}
+			}
+			if (start < count)
+				_processOwnWirePackets(now,packets + start,count - start);
+		} else {
+			_processOwnWirePackets(now,packets,count);
+		}
+	}
+
+	inline void _processOwnWirePackets(const int64_t now,const ZT_WirePacket *packets,unsigned int count)
+	{
+		const ZT_ResultCode rc = _node->processWirePackets(
+			(void *)0,
+			now,
+			packets,
+			count,
+			&_nextBackgroundTaskDeadline);
+		if (ZT_ResultCode_isFatal(rc)) {
+			char tmp[256];
+			OSUtils::ztsnprintf(tmp,sizeof(tmp),"fatal error code from processWirePackets: %d",(int)rc);
+			Mutex::Lock _l(_termReason_m);
+			_termReason = ONE_UNRECOVERABLE_ERROR;
+			_fatalErrorMessage = tmp;
+			this->terminate();
+		}
+	}
+
 	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
 	{
 		if (!success) {
@@ -1707,10 +3693,11 @@ public:
 		tc->sock = sock;
 
 		if (tc->type == TcpConnection::TCP_TUNNEL_OUTGOING) {
-			if (_tcpFallbackTunnel)
-				_phy.close(_tcpFallbackTunnel->sock);
-			_tcpFallbackTunnel = tc;
 			_phy.streamSend(sock,ZT_TCP_TUNNEL_HELLO,sizeof(ZT_TCP_TUNNEL_HELLO));
+			Mutex::Lock _l(_tcpFallbackTunnels_m);
+			if (_tcpFallbackConnecting)
+				--_tcpFallbackConnecting;
+			_tcpFallbackTunnels.push_back(tc);
 		} else {
 			_phy.close(sock,true);
 		}
@@ -1732,7 +3719,7 @@ public:
 			tc->parent = this;
 			tc->sock = sockN;
 			tc->remoteAddr = from;
-			tc->lastReceive = OSUtils::now();
+			tc->lastReceive = OSUtils::coarseNow();
 			http_parser_init(&(tc->parser),HTTP_REQUEST);
 			tc->parser.data = (void *)tc;
 			tc->messageSize = 0;
@@ -1745,8 +3732,13 @@ public:
 	{
 		TcpConnection *tc = (TcpConnection *)*uptr;
 		if (tc) {
-			if (tc == _tcpFallbackTunnel) {
-				_tcpFallbackTunnel = (TcpConnection *)0;
+			if (tc->type == TcpConnection::TCP_TUNNEL_OUTGOING) {
+				Mutex::Lock _l(_tcpFallbackTunnels_m);
+				std::vector< TcpConnection * >::iterator t(std::find(_tcpFallbackTunnels.begin(),_tcpFallbackTunnels.end(),tc));
+				if (t != _tcpFallbackTunnels.end())
+					_tcpFallbackTunnels.erase(t);
+				else if (_tcpFallbackConnecting) // connect failed
+					--_tcpFallbackConnecting;
 			}
 			{
 				Mutex::Lock _l(_tcpConnections_m);
@@ -1761,7 +3753,8 @@ public:
 		try {
 			if (!len) return; // sanity check, should never happen
 			TcpConnection *tc = reinterpret_cast<TcpConnection *>(*uptr);
-			tc->lastReceive = OSUtils::now();
+			const int64_t now = OSUtils::updateCoarseNow();
+			tc->lastReceive = now;
 			switch(tc->type) {
 
 				case TcpConnection::TCP_UNCATEGORIZED_INCOMING:
@@ -1856,9 +3849,10 @@ public:
 
 								if (from) {
 									InetAddress fakeTcpLocalInterfaceAddress((uint32_t)0xffffffff,0xffff);
+									_wireRecorder.record(now,-1,reinterpret_cast<struct sockaddr_storage *>(&from),data,plen);
 									const ZT_ResultCode rc = _node->processWirePacket(
 										(void *)0,
-										OSUtils::now(),
+										now,
 										-1,
 										reinterpret_cast<struct sockaddr_storage *>(&from),
 										data,
@@ -1896,18 +3890,29 @@ public:
 		bool closeit = false;
 		{
 			Mutex::Lock _l(tc->writeq_m);
-			if (tc->writeq.length() > 0) {
-				long sent = (long)_phy.streamSend(sock,tc->writeq.data(),(unsigned long)tc->writeq.length(),true);
-				if (sent > 0) {
-					if ((unsigned long)sent >= (unsigned long)tc->writeq.length()) {
-						tc->writeq.clear();
-						_phy.setNotifyWritable(sock,false);
-
-						if (tc->type == TcpConnection::TCP_HTTP_INCOMING)
-							closeit = true; // HTTP keep alive not supported
-					} else {
-						tc->writeq.erase(tc->writeq.begin(),tc->writeq.begin() + sent);
-					}
+			tc->flushPending = false;
+			if (!tc->writeq.empty()) {
+				// At most two sends, since the queue may wrap around the end of the ring
+				unsigned long total = 0;
+				for(int k=0;(k<2)&&(!tc->writeq.empty());++k) {
+					unsigned long len = 0;
+					const char *const d = tc->writeq.front(len);
+					const long sent = (long)_phy.streamSend(sock,d,len,true);
+					if (sent <= 0)
+						break;
+					tc->writeq.consume((unsigned long)sent);
+					total += (unsigned long)sent;
+					if ((unsigned long)sent < len)
+						break;
+				}
+				if (tc->type == TcpConnection::TCP_TUNNEL_OUTGOING)
+					_tcpFallbackDrained(tc,total);
+				if (tc->writeq.empty()) {
+					tc->writeq.clear();
+					_phy.setNotifyWritable(sock,false);
+
+					if (tc->type == TcpConnection::TCP_HTTP_INCOMING)
+						closeit = true; // HTTP keep alive not supported
 				}
 			} else {
 				_phy.setNotifyWritable(sock,false);
@@ -1919,8 +3924,18 @@ public:
 
 	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
 	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
-	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
-	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr)
+	{
+		if (*uptr == (void *)&_ifMonitor)
+			_ifMonitor.closed();
+	}
+
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+	{
+		if (*uptr == (void *)&_ifMonitor)
+			_ifMonitor.received(data,len);
+	}
+
 	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip_invoked) {}
 
 	inline int nodeVirtualNetworkConfigFunction(uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwc)
@@ -1931,65 +3946,20 @@ public:
 		switch(op) {
 
 			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP:
+				if ((_restoring)&&(!n.tap)) {
+					// Joined from networks.d at startup, so a restore thread brings the port up
+					ZT_FAST_MEMCPY(&(n.config),nwc,sizeof(ZT_VirtualNetworkConfig));
+					n.restoring = true;
+					_restoreQueue.push_back(std::pair<uint64_t,void **>(nwid,nuptr));
+					break;
+				}
 				if (!n.tap) {
 					try {
-						char friendlyName[128];
-						OSUtils::ztsnprintf(friendlyName,sizeof(friendlyName),"ZeroTier One [%.16llx]",nwid);
-
-						n.tap = new EthernetTap(
-							_homePath.c_str(),
-							MAC(nwc->mac),
-							nwc->mtu,
-							(unsigned int)ZT_IF_METRIC,
-							nwid,
-							friendlyName,
-							StapFrameHandler,
-							(void *)this);
+						n.tap = _newTap(nwid,nwc);
 						*nuptr = (void *)&n;
-
-						char nlcpath[256];
-						OSUtils::ztsnprintf(nlcpath,sizeof(nlcpath),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.local.conf",_homePath.c_str(),nwid);
-						std::string nlcbuf;
-						if (OSUtils::readFile(nlcpath,nlcbuf)) {
-							Dictionary<4096> nc;
-							nc.load(nlcbuf.c_str());
-							Buffer<1024> allowManaged;
-							if (nc.get("allowManaged", allowManaged) && allowManaged.size() != 0) {
-								std::string addresses (allowManaged.begin(), allowManaged.size());
-								if (allowManaged.size() <= 5) { // untidy parsing for backward compatibility
-									if (allowManaged[0] == '1' || allowManaged[0] == 't' || allowManaged[0] == 'T') {
-										n.settings.allowManaged = true;
-									} else {
-										n.settings.allowManaged = false;
-									}
-								} else {
-									// this should be a list of IP addresses
-									n.settings.allowManaged = true;
-									size_t pos = 0;
-									while (true) {
-										size_t nextPos = addresses.find(',', pos);
-										std::string address = addresses.substr(pos, (nextPos == std::string::npos ? addresses.size() : nextPos) - pos);
-										n.settings.allowManagedWhitelist.push_back(InetAddress(address.c_str()));
-										if (nextPos == std::string::npos) break;
-										pos = nextPos + 1;
-									}
-								}
-							} else {
-								n.settings.allowManaged = true;
-							}
-							n.settings.allowGlobal = nc.getB("allowGlobal", false);
-							n.settings.allowDefault = nc.getB("allowDefault", false);
-						}
+						_loadNetworkSettings(nwid,n.settings);
 					} catch (std::exception &exc) {
-#ifdef __WINDOWS__
-						FILE *tapFailLog = fopen((_homePath + ZT_PATH_SEPARATOR_S"port_error_log.txt").c_str(),"a");
-						if (tapFailLog) {
-							fprintf(tapFailLog,"%.16llx: %s" ZT_EOL_S,(unsigned long long)nwid,exc.what());
-							fclose(tapFailLog);
-						}
-#else
-						fprintf(stderr,"ERROR: unable to configure virtual network port: %s" ZT_EOL_S,exc.what());
-#endif
+						_logPortError(nwid,exc.what());
 						_nets.erase(nwid);
 						return -999;
 					} catch ( ... ) {
@@ -1998,26 +3968,28 @@ public:
 				}
 				// After setting up tap, fall through to CONFIG_UPDATE since we also want to do this...
 
-			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE:
+			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_CONFIG_UPDATE: {
+				// On an update only what changed touches the OS; a new port gets everything
+				const unsigned int changes = (op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP) ? (unsigned int)ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ALL : nwc->changes;
 				ZT_FAST_MEMCPY(&(n.config),nwc,sizeof(ZT_VirtualNetworkConfig));
+				if (n.restoring)
+					break; // the restore thread applies it
 				if (n.tap) { // sanity check
-#if defined(__WINDOWS__) && !defined(ZT_SDK)
-					// wait for up to 5 seconds for the WindowsEthernetTap to actually be initialized
-					//
-					// without WindowsEthernetTap::isInitialized() returning true, the won't actually
-					// be online yet and setting managed routes on it will fail.
-					const int MAX_SLEEP_COUNT = 500;
-					for (int i = 0; !n.tap->isInitialized() && i < MAX_SLEEP_COUNT; i++) {
-						Sleep(10);
+					if ((changes & (ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ADDRESSES|ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ROUTES|ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_MTU)) != 0) {
+						_waitForTap(n.tap);
+						// Routes depend on managed IPs, so new IPs mean a full route sync
+						if ((changes & ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ADDRESSES) != 0)
+							syncManagedStuff(n,true,true);
+						else if ((changes & ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_ROUTES) != 0)
+							syncManagedStuff(n,false,true,false);
+						if ((changes & ZT_VIRTUAL_NETWORK_CONFIG_CHANGED_MTU) != 0)
+							n.tap->setMtu(nwc->mtu);
 					}
-#endif
-					syncManagedStuff(n,true,true);
-					n.tap->setMtu(nwc->mtu);
 				} else {
 					_nets.erase(nwid);
 					return -999; // tap init failed
 				}
-				break;
+			}	break;
 
 			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DOWN:
 			case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY:
@@ -2082,98 +4054,109 @@ public:
 	}
 
 	inline void nodeStatePutFunction(enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
+	{
+#ifndef __WINDOWS__
+		if ((type == ZT_STATE_OBJECT_PEER)&&(_peerStateFile.isOpen())) {
+			if ((len >= 0)&&(_peerStateFile.put(id[0],OSUtils::coarseNow(),data,len)))
+				return;
+			_peerStateFile.put(id[0],0,(const void *)0,-1); // deleted or too large for a slot, so fall through to peers.d
+		}
+#endif
+
+		_statePut(_homePath,type,id,data,len);
+	}
+
+	// Hosted nodes share our planet, so their home path only differs for other objects
+	inline void _statePut(const std::string &home,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
 	{
 		char p[1024];
-		FILE *f;
 		bool secure = false;
 		char dirname[1024];
 		dirname[0] = 0;
 
 		switch(type) {
 			case ZT_STATE_OBJECT_IDENTITY_PUBLIC:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",home.c_str());
 				break;
 			case ZT_STATE_OBJECT_IDENTITY_SECRET:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",home.c_str());
 				secure = true;
 				break;
 			case ZT_STATE_OBJECT_PLANET:
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",_homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_MOON:
-				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "moons.d",_homePath.c_str());
+				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "moons.d",home.c_str());
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.16llx.moon",dirname,(unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_NETWORK_CONFIG:
-				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "networks.d",_homePath.c_str());
+				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "networks.d",home.c_str());
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.16llx.conf",dirname,(unsigned long long)id[0]);
 				secure = true;
 				break;
 			case ZT_STATE_OBJECT_PEER:
-				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "peers.d",_homePath.c_str());
+				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "peers.d",home.c_str());
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.10llx.peer",dirname,(unsigned long long)id[0]);
 				break;
+			case ZT_STATE_OBJECT_WARM_PATHS:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "warm.paths",home.c_str());
+				break;
 			default:
 				return;
 		}
 
-		if (len >= 0) {
-			// Check to see if we've already written this first. This reduces
-			// redundant writes and I/O overhead on most platforms and has
-			// little effect on others.
-			f = fopen(p,"rb");
-			if (f) {
-				char buf[65535];
-				long l = (long)fread(buf,1,sizeof(buf),f);
-				fclose(f);
-				if ((l == (long)len)&&(memcmp(data,buf,l) == 0))
-					return;
-			}
+		_stateStore.put(std::string(p),std::string(dirname),data,len,secure);
 
-			f = fopen(p,"wb");
-			if ((!f)&&(dirname[0])) { // create subdirectory if it does not exist
-				OSUtils::mkdir(dirname);
-				f = fopen(p,"wb");
-			}
-			if (f) {
-				if (fwrite(data,len,1,f) != 1)
-					fprintf(stderr,"WARNING: unable to write to file: %s (I/O error)" ZT_EOL_S,p);
-				fclose(f);
-				if (secure)
-					OSUtils::lockDownFile(p,false);
-			} else {
-				fprintf(stderr,"WARNING: unable to write to file: %s (unable to open)" ZT_EOL_S,p);
-			}
-		} else {
-			OSUtils::rm(p);
-		}
+		// Losing a newly generated identity to a crash would change our address, so don't return until it's written
+		if ((type == ZT_STATE_OBJECT_IDENTITY_PUBLIC)||(type == ZT_STATE_OBJECT_IDENTITY_SECRET))
+			_stateStore.flush();
 	}
 
 	inline int nodeStateGetFunction(enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+	{
+#ifndef __WINDOWS__
+		if ((type == ZT_STATE_OBJECT_PEER)&&(_peerStateFile.isOpen())) {
+			const int n = _peerStateFile.get(id[0],data,maxlen);
+			if (n >= 0)
+				return n;
+			// Not there, so fall back to peers.d (oversized records and peers saved before the file was enabled)
+		}
+#endif
+
+		return _stateGet(_homePath,type,id,data,maxlen);
+	}
+
+	inline int _stateGet(const std::string &home,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
 	{
 		char p[4096];
 		switch(type) {
 			case ZT_STATE_OBJECT_IDENTITY_PUBLIC:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.public",home.c_str());
 				break;
 			case ZT_STATE_OBJECT_IDENTITY_SECRET:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",_homePath.c_str());
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identity.secret",home.c_str());
 				break;
 			case ZT_STATE_OBJECT_PLANET:
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "planet",_homePath.c_str());
 				break;
 			case ZT_STATE_OBJECT_MOON:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d" ZT_PATH_SEPARATOR_S "%.16llx.moon",_homePath.c_str(),(unsigned long long)id[0]);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "moons.d" ZT_PATH_SEPARATOR_S "%.16llx.moon",home.c_str(),(unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_NETWORK_CONFIG:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.conf",_homePath.c_str(),(unsigned long long)id[0]);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.conf",home.c_str(),(unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_PEER:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d" ZT_PATH_SEPARATOR_S "%.10llx.peer",_homePath.c_str(),(unsigned long long)id[0]);
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d" ZT_PATH_SEPARATOR_S "%.10llx.peer",home.c_str(),(unsigned long long)id[0]);
+				break;
+			case ZT_STATE_OBJECT_WARM_PATHS:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "warm.paths",home.c_str());
 				break;
 			default:
 				return -1;
 		}
+		const int pending = _stateStore.get(std::string(p),data,maxlen);
+		if (pending != -2)
+			return pending;
 		FILE *f = fopen(p,"rb");
 		if (f) {
 			int n = (int)fread(data,1,maxlen,f);
@@ -2184,9 +4167,11 @@ public:
 		return -1;
 	}
 
-	inline int nodeWirePacketSendFunction(const int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
-	{
 #ifdef ZT_TCP_FALLBACK_RELAY
+	// Queues a datagram on a TCP fallback tunnel, and sends it right away unless
+	// flush is false, in which case _tcpFallbackFlush() must be called after.
+	inline void _tcpFallbackSend(const struct sockaddr_storage *addr,const void *data,unsigned int len,const bool flush = true)
+	{
 		if(_allowTcpFallbackRelay) {
 			if (addr->ss_family == AF_INET) {
 				// TCP fallback tunnel support, currently IPv4 only
@@ -2194,34 +4179,53 @@ public:
 					// Engage TCP tunnel fallback if we haven't received anything valid from a global
 					// IP address in ZT_TCP_FALLBACK_AFTER milliseconds. If we do start getting
 					// valid direct traffic we'll stop using it and close the socket after a while.
-					const int64_t now = OSUtils::now();
+					const int64_t now = OSUtils::coarseNow();
 					if (((now - _lastDirectReceiveFromGlobal) > ZT_TCP_FALLBACK_AFTER)&&((now - _lastRestart) > ZT_TCP_FALLBACK_AFTER)) {
-						if (_tcpFallbackTunnel) {
-							bool flushNow = false;
-							{
-								Mutex::Lock _l(_tcpFallbackTunnel->writeq_m);
-								if (_tcpFallbackTunnel->writeq.size() < (1024 * 64)) {
-									if (_tcpFallbackTunnel->writeq.length() == 0) {
-										_phy.setNotifyWritable(_tcpFallbackTunnel->sock,true);
-										flushNow = true;
-									}
+						bool connectNew = false;
+						{
+							Mutex::Lock _l(_tcpFallbackTunnels_m);
+							if (!_tcpFallbackTunnels.empty()) {
+								// Each destination sticks to one tunnel so its datagrams stay in order
+								const struct sockaddr_in *const sin = reinterpret_cast<const struct sockaddr_in *>(addr);
+								const uint32_t h = (uint32_t)sin->sin_addr.s_addr ^ ((uint32_t)sin->sin_port * 0x9e3779b1);
+								TcpConnection *const tunnel = _tcpFallbackTunnels[(unsigned long)(((h >> 16) ^ h) % (uint32_t)_tcpFallbackTunnels.size())];
+
+								bool flushNow = false;
+								{
+									Mutex::Lock _l2(tunnel->writeq_m);
 									const unsigned long mlen = len + 7;
-									_tcpFallbackTunnel->writeq.push_back((char)0x17);
-									_tcpFallbackTunnel->writeq.push_back((char)0x03);
-									_tcpFallbackTunnel->writeq.push_back((char)0x03); // fake TLS 1.2 header
-									_tcpFallbackTunnel->writeq.push_back((char)((mlen >> 8) & 0xff));
-									_tcpFallbackTunnel->writeq.push_back((char)(mlen & 0xff));
-									_tcpFallbackTunnel->writeq.push_back((char)4); // IPv4
-									_tcpFallbackTunnel->writeq.append(reinterpret_cast<const char *>(reinterpret_cast<const void *>(&(reinterpret_cast<const struct sockaddr_in *>(addr)->sin_addr.s_addr))),4);
-									_tcpFallbackTunnel->writeq.append(reinterpret_cast<const char *>(reinterpret_cast<const void *>(&(reinterpret_cast<const struct sockaddr_in *>(addr)->sin_port))),2);
-									_tcpFallbackTunnel->writeq.append((const char *)data,len);
+									if ((tunnel->writeq.size() + mlen + 5) <= _tcpFallbackQueueLimit(tunnel)) {
+										if ((tunnel->writeq.empty())&&(!tunnel->flushPending)) {
+											_phy.setNotifyWritable(tunnel->sock,true);
+											tunnel->flushPending = true;
+											flushNow = flush;
+										}
+										char hdr[12];
+										hdr[0] = (char)0x17;
+										hdr[1] = (char)0x03;
+										hdr[2] = (char)0x03; // fake TLS 1.2 header
+										hdr[3] = (char)((mlen >> 8) & 0xff);
+										hdr[4] = (char)(mlen & 0xff);
+										hdr[5] = (char)4; // IPv4
+										memcpy(hdr + 6,&(sin->sin_addr.s_addr),4);
+										memcpy(hdr + 10,&(sin->sin_port),2);
+										tunnel->writeq.append(hdr,12);
+										tunnel->writeq.append(data,len);
+									}
+								}
+								if (flushNow) { // under _tcpFallbackTunnels_m so the tunnel can't be deleted meanwhile
+									void *tmpptr = (void *)tunnel;
+									phyOnTcpWritable(tunnel->sock,&tmpptr);
 								}
 							}
-							if (flushNow) {
-								void *tmpptr = (void *)_tcpFallbackTunnel;
-								phyOnTcpWritable(_tcpFallbackTunnel->sock,&tmpptr);
+							if ((_tcpFallbackTunnels.size() + _tcpFallbackConnecting) < _tcpFallbackTunnelCount) {
+								if ((!_tcpFallbackTunnels.empty())||(((now - _lastSendToGlobalV4) < ZT_TCP_FALLBACK_AFTER)&&((now - _lastSendToGlobalV4) > (ZT_PING_CHECK_INVERVAL / 2)))) {
+									++_tcpFallbackConnecting;
+									connectNew = true;
+								}
 							}
-						} else if (((now - _lastSendToGlobalV4) < ZT_TCP_FALLBACK_AFTER)&&((now - _lastSendToGlobalV4) > (ZT_PING_CHECK_INVERVAL / 2))) {
+						}
+						if (connectNew) { // outside the lock since the connect handler can be called right away
 							const InetAddress addr(ZT_TCP_FALLBACK_RELAY);
 							TcpConnection *tc = new TcpConnection();
 							{
@@ -2230,18 +4234,89 @@ public:
 							}
 							tc->type = TcpConnection::TCP_TUNNEL_OUTGOING;
 							tc->remoteAddr = addr;
-							tc->lastReceive = OSUtils::now();
+							tc->lastReceive = OSUtils::coarseNow();
 							tc->parent = this;
 							tc->sock = (PhySocket *)0; // set in connect handler
 							tc->messageSize = 0;
 							bool connected = false;
-							_phy.tcpConnect(reinterpret_cast<const struct sockaddr *>(&addr),connected,(void *)tc,true);
+							if (!_phy.tcpConnect(reinterpret_cast<const struct sockaddr *>(&addr),connected,(void *)tc,true)) {
+								// No handler is called if there's no socket at all
+								{
+									Mutex::Lock _l(_tcpConnections_m);
+									_tcpConnections.erase(std::remove(_tcpConnections.begin(),_tcpConnections.end(),tc),_tcpConnections.end());
+								}
+								delete tc;
+								Mutex::Lock _l(_tcpFallbackTunnels_m);
+								if (_tcpFallbackConnecting)
+									--_tcpFallbackConnecting;
+							}
 						}
 					}
 					_lastSendToGlobalV4 = now;
 				}
 			}
 		}
+	}
+
+	// Sends what _tcpFallbackSend() queued on empty tunnels with flush false, one write per tunnel
+	inline void _tcpFallbackFlush()
+	{
+		Mutex::Lock _l(_tcpFallbackTunnels_m);
+		for(std::vector< TcpConnection * >::const_iterator t(_tcpFallbackTunnels.begin());t!=_tcpFallbackTunnels.end();++t) {
+			bool pending;
+			{
+				Mutex::Lock _l2((*t)->writeq_m);
+				pending = ((*t)->flushPending)&&(!(*t)->writeq.empty());
+			}
+			if (pending) {
+				void *tmpptr = (void *)(*t);
+				phyOnTcpWritable((*t)->sock,&tmpptr);
+			}
+		}
+	}
+
+	// Queue limit for a tunnel from the rate it has been draining at (writeq_m must be held)
+	static inline unsigned long _tcpFallbackQueueLimit(const TcpConnection *tc)
+	{
+		const unsigned long l = (unsigned long)(((uint64_t)tc->drainRate * ZT_TCP_FALLBACK_QUEUE_DELAY) / 1000);
+		return std::max((unsigned long)ZT_TCP_FALLBACK_MIN_QUEUE,std::min(l,(unsigned long)ZT_TCP_FALLBACK_MAX_QUEUE));
+	}
+
+	// Updates a tunnel's drain rate after a write (writeq_m must be held). Only
+	// time spent backlogged counts, since an idle tunnel says nothing about capacity.
+	static inline void _tcpFallbackDrained(TcpConnection *tc,const unsigned long sent)
+	{
+		const int64_t now = OSUtils::coarseNow();
+		if (tc->drainStart) {
+			tc->drainBytes += sent;
+			const int64_t elapsed = now - tc->drainStart;
+			if (elapsed >= 250) {
+				const unsigned long rate = (unsigned long)(((uint64_t)tc->drainBytes * 1000) / (uint64_t)elapsed);
+				tc->drainRate = (tc->drainRate) ? ((tc->drainRate * 3) + rate) / 4 : rate;
+				tc->drainStart = now;
+				tc->drainBytes = 0;
+			}
+		}
+		if (tc->writeq.empty()) {
+			tc->drainStart = 0;
+			tc->drainBytes = 0;
+		} else if (!tc->drainStart) {
+			tc->drainStart = now;
+		}
+	}
+#endif
+
+	inline int nodeWirePacketSendFunction(const int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+	{
+		// Path MTU probes must not be fragmented, and only make sense on the socket they're probing
+		if ((ttl & ZT_WIRE_PACKET_DONT_FRAGMENT) != 0) {
+			if ((localSocket != -1)&&(localSocket != 0)&&(_binder.isUdpSocketValid((PhySocket *)((uintptr_t)localSocket))))
+				return ((_phy.udpSendDontFragment((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len)) ? 0 : -1);
+			return -1;
+		}
+
+#ifdef ZT_TCP_FALLBACK_RELAY
+		_tcpFallbackSend(addr,data,len);
 #endif // ZT_TCP_FALLBACK_RELAY
 
 		// Even when relaying we still send via UDP. This way if UDP starts
@@ -2258,6 +4333,41 @@ public:
 		}
 	}
 
+	inline void nodeWirePacketBatchSendFunction(const ZT_WirePacket *packets,unsigned int count)
+	{
+		// Consecutive packets from the same socket go out with one udpSendBatch(),
+		// anything needing a TTL or sent from all sockets takes the single packet path.
+		PhyDatagram batch[ZT_PHY_UDP_BATCH_SIZE];
+		PhySocket *batchSock = (PhySocket *)0;
+		unsigned int n = 0;
+		for(unsigned int i=0;i<count;++i) {
+			const ZT_WirePacket &p = packets[i];
+			PhySocket *const sock = (PhySocket *)((uintptr_t)p.localSocket);
+			if ((n)&&((sock != batchSock)||(n == ZT_PHY_UDP_BATCH_SIZE))) {
+				_phy.udpSendBatch(batchSock,batch,n);
+				n = 0;
+			}
+			if ((p.ttl)||(p.localSocket == -1)||(p.localSocket == 0)||(!_binder.isUdpSocketValid(sock))) {
+				nodeWirePacketSendFunction(p.localSocket,&(p.address),p.data,p.length,p.ttl);
+				continue;
+			}
+#ifdef ZT_TCP_FALLBACK_RELAY
+			_tcpFallbackSend(&(p.address),p.data,p.length,false);
+#endif
+			batchSock = sock;
+			PhyDatagram &d = batch[n++];
+			d.address = (const struct sockaddr *)&(p.address);
+			d.data = p.data;
+			d.len = p.length;
+			d.tos = p.tos & _underlayTos;
+		}
+		if (n)
+			_phy.udpSendBatch(batchSock,batch,n);
+#ifdef ZT_TCP_FALLBACK_RELAY
+		_tcpFallbackFlush();
+#endif
+	}
+
 	inline void nodeVirtualNetworkFrameFunction(uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
 		NetworkState *n = reinterpret_cast<NetworkState *>(*nuptr);
@@ -2266,6 +4376,18 @@ public:
 		n->tap->put(MAC(sourceMac),MAC(destMac),etherType,data,len);
 	}
 
+	inline void hostedEventCallback(HostedNode &h,enum ZT_Event event,const void *metaData)
+	{
+		if (event == ZT_EVENT_FATAL_ERROR_IDENTITY_COLLISION)
+			fprintf(stderr,"WARNING: hosted node %s: identity collision, another node is using its address" ZT_EOL_S,h.homePath.c_str());
+	}
+
+	inline void hostedStatePutFunction(HostedNode &h,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
+	{
+		if (type != ZT_STATE_OBJECT_PLANET) // our node keeps the planet up to date for everyone
+			_statePut(h.homePath,type,id,data,len);
+	}
+
 	inline int nodePathCheckFunction(uint64_t ztaddr,const int64_t localSocket,const struct sockaddr_storage *remoteAddr)
 	{
 		// Make sure we're not trying to do ZeroTier-over-ZeroTier
@@ -2290,30 +4412,13 @@ public:
 		 * revisit if we see recursion problems. */
 
 		// Check blacklists
-		const Hashtable< uint64_t,std::vector<InetAddress> > *blh = (const Hashtable< uint64_t,std::vector<InetAddress> > *)0;
-		const std::vector<InetAddress> *gbl = (const std::vector<InetAddress> *)0;
-		if (remoteAddr->ss_family == AF_INET) {
-			blh = &_v4Blacklists;
-			gbl = &_globalV4Blacklist;
-		} else if (remoteAddr->ss_family == AF_INET6) {
-			blh = &_v6Blacklists;
-			gbl = &_globalV6Blacklist;
-		}
-		if (blh) {
+		{
 			Mutex::Lock _l(_localConfig_m);
-			const std::vector<InetAddress> *l = blh->get(ztaddr);
-			if (l) {
-				for(std::vector<InetAddress>::const_iterator a(l->begin());a!=l->end();++a) {
-					if (a->containsAddress(*reinterpret_cast<const InetAddress *>(remoteAddr)))
-						return 0;
-				}
-			}
-		}
-		if (gbl) {
-			for(std::vector<InetAddress>::const_iterator a(gbl->begin());a!=gbl->end();++a) {
-				if (a->containsAddress(*reinterpret_cast<const InetAddress *>(remoteAddr)))
-					return 0;
-			}
+			const PrefixTrie<bool> *const bl = _blacklists.get(ztaddr);
+			if ((bl)&&(bl->contains(*reinterpret_cast<const InetAddress *>(remoteAddr))))
+				return 0;
+			if (_globalBlacklist.contains(*reinterpret_cast<const InetAddress *>(remoteAddr)))
+				return 0;
 		}
 		return 1;
 	}
@@ -2335,10 +4440,37 @@ public:
 		} else return 0;
 	}
 
+	inline void clusterSendFunction(unsigned int memberId,const void *data,unsigned int len)
+	{
+		if ((_clusterBackplane)&&(memberId < ZT_CLUSTER_MAX_MEMBERS)&&(_clusterMembers[memberId]))
+			_phy.udpSend(_clusterBackplane,reinterpret_cast<const struct sockaddr *>(&(_clusterMembers[memberId])),data,len);
+	}
+
+	inline int clusterAddressToLocationFunction(const struct sockaddr_storage *addr,int *x,int *y,int *z)
+	{
+		const InetAddress &a = *reinterpret_cast<const InetAddress *>(addr);
+		for(std::vector<ClusterLocation>::const_iterator l(_clusterLocations.begin());l!=_clusterLocations.end();++l) {
+			if (l->net.containsAddress(a)) {
+				*x = l->x;
+				*y = l->y;
+				*z = l->z;
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+#ifdef ZT_SDK
 	inline void tapFrameHandler(uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
-		_node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
+		_node->processVirtualNetworkFrame((void *)0,OSUtils::updateCoarseNow(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
+	}
+#else
+	inline void tapFramesHandler(uint64_t nwid,const ZT_VirtualNetworkFrame *frames,unsigned int count)
+	{
+		_node->processVirtualNetworkFrames((void *)0,OSUtils::updateCoarseNow(),nwid,frames,count,&_nextBackgroundTaskDeadline);
 	}
+#endif
 
 	inline void onHttpRequestToServer(TcpConnection *tc)
 	{
@@ -2380,9 +4512,10 @@ public:
 			(unsigned long)data.length());
 		{
 			Mutex::Lock _l(tc->writeq_m);
-			tc->writeq = tmpn;
+			tc->writeq.clear();
+			tc->writeq.append(tmpn,(unsigned long)strlen(tmpn));
 			if (tc->parser.method != HTTP_HEAD)
-				tc->writeq.append(data);
+				tc->writeq.append(data.data(),(unsigned long)data.length());
 		}
 
 		_phy.setNotifyWritable(tc->sock,true);
@@ -2418,20 +4551,10 @@ public:
 			}
 		}
 		{
-			// Check global blacklists
-			const std::vector<InetAddress> *gbl = (const std::vector<InetAddress> *)0;
-			if (ifaddr.ss_family == AF_INET) {
-				gbl = &_globalV4Blacklist;
-			} else if (ifaddr.ss_family == AF_INET6) {
-				gbl = &_globalV6Blacklist;
-			}
-			if (gbl) {
-				Mutex::Lock _l(_localConfig_m);
-				for(std::vector<InetAddress>::const_iterator a(gbl->begin());a!=gbl->end();++a) {
-					if (a->containsAddress(ifaddr))
-						return false;
-				}
-			}
+			// Check global blacklist
+			Mutex::Lock _l(_localConfig_m);
+			if (_globalBlacklist.contains(ifaddr))
+				return false;
 		}
 		{
 			Mutex::Lock _l(_nets_m);
@@ -2495,14 +4618,47 @@ static int SnodeStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_Sta
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeStateGetFunction(type,id,data,maxlen); }
 static int SnodeWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketSendFunction(localSocket,addr,data,len,ttl); }
+static int SnodeWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->nodeWirePacketBatchSendFunction(packets,count); return 0; }
 static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 { reinterpret_cast<OneServiceImpl *>(uptr)->nodeVirtualNetworkFrameFunction(nwid,nuptr,sourceMac,destMac,etherType,vlanId,data,len); }
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodePathCheckFunction(ztaddr,localSocket,remoteAddr); }
 static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result)
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodePathLookupFunction(ztaddr,family,result); }
+static int SnodeHostedVirtualNetworkConfigFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf)
+{ return 0; } // hosted nodes have no virtual ports
+static void SnodeHostedEventCallback(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData)
+{ OneServiceImpl::HostedNode *const h = reinterpret_cast<OneServiceImpl::HostedNode *>(uptr); h->service->hostedEventCallback(*h,event,metaData); }
+static void SnodeHostedStatePutFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
+{ OneServiceImpl::HostedNode *const h = reinterpret_cast<OneServiceImpl::HostedNode *>(uptr); h->service->hostedStatePutFunction(*h,type,id,data,len); }
+static int SnodeHostedStateGetFunction(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{ OneServiceImpl::HostedNode *const h = reinterpret_cast<OneServiceImpl::HostedNode *>(uptr); return h->service->_stateGet(h->homePath,type,id,data,maxlen); }
+static int SnodeHostedWirePacketSendFunction(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+{ return reinterpret_cast<OneServiceImpl::HostedNode *>(uptr)->service->nodeWirePacketSendFunction(localSocket,addr,data,len,ttl); }
+static int SnodeHostedWirePacketBatchSendFunction(ZT_Node *node,void *uptr,void *tptr,const ZT_WirePacket *packets,unsigned int count)
+{ reinterpret_cast<OneServiceImpl::HostedNode *>(uptr)->service->nodeWirePacketBatchSendFunction(packets,count); return 0; }
+static void SnodeHostedVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
+{}
+static int SnodeHostedPathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr)
+{ return reinterpret_cast<OneServiceImpl::HostedNode *>(uptr)->service->nodePathCheckFunction(ztaddr,localSocket,remoteAddr); }
+static int SnodeHostedPathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result)
+{ return reinterpret_cast<OneServiceImpl::HostedNode *>(uptr)->service->nodePathLookupFunction(ztaddr,family,result); }
+static void SclusterSendFunction(void *uptr,unsigned int memberId,const void *data,unsigned int len)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->clusterSendFunction(memberId,data,len); }
+static int SclusterAddressToLocationFunction(void *uptr,const struct sockaddr_storage *addr,int *x,int *y,int *z)
+{ return reinterpret_cast<OneServiceImpl *>(uptr)->clusterAddressToLocationFunction(addr,x,y,z); }
+#ifdef ZT_USE_MINIUPNPC
+static void SportMapperChangedFunction(void *uptr)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->_phy.whack(); }
+#endif
+#ifdef ZT_SDK
 static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 { reinterpret_cast<OneServiceImpl *>(uptr)->tapFrameHandler(nwid,from,to,etherType,vlanId,data,len); }
+#else
+static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const ZT_VirtualNetworkFrame *frames,unsigned int count)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->tapFramesHandler(nwid,frames,count); }
+#endif
 
 static int ShttpOnMessageBegin(http_parser *parser)
 {
@@ -29,6 +29,9 @@
 #include <string.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <unordered_map>
+
 #include "../node/Constants.hpp"
 #include "../version.h"
 
@@ -55,8 +58,82 @@
 
 #include "../osdep/OSUtils.hpp"
 
+// Delta ops: copy <[4] base offset> <[4] length> bytes from the base, or add <[4] length> literal bytes
+#define ZT_SOFTWARE_UPDATE_DELTA_OP_COPY 1
+#define ZT_SOFTWARE_UPDATE_DELTA_OP_ADD 2
+
 namespace ZeroTier {
 
+static inline unsigned long _u32(const void *p)
+{
+	const uint8_t *const b = reinterpret_cast<const uint8_t *>(p);
+	return (((unsigned long)b[0] << 24)|((unsigned long)b[1] << 16)|((unsigned long)b[2] << 8)|(unsigned long)b[3]);
+}
+
+static inline void _appendU32(std::string &s,const unsigned long n)
+{
+	s.push_back((char)((n >> 24) & 0xff));
+	s.push_back((char)((n >> 16) & 0xff));
+	s.push_back((char)((n >> 8) & 0xff));
+	s.push_back((char)(n & 0xff));
+}
+
+static inline std::string _hexStr(const void *d,const unsigned int l)
+{
+	char buf[(ZT_SHA512_DIGEST_LEN * 2) + 2];
+	return std::string(Utils::hex(d,std::min(l,(unsigned int)ZT_SHA512_DIGEST_LEN),buf));
+}
+
+static inline unsigned long _chunkCount(const unsigned long length)
+{
+	return ((length + (ZT_SOFTWARE_UPDATE_CHUNK_SIZE - 1)) / ZT_SOFTWARE_UPDATE_CHUNK_SIZE);
+}
+
+static inline bool _chunkOk(const std::string &chunkHashes,const unsigned long c,const void *data,const unsigned int len)
+{
+	uint8_t sha512[ZT_SHA512_DIGEST_LEN];
+	SHA512::hash(sha512,data,len);
+	return (memcmp(sha512,chunkHashes.data() + (c * ZT_SOFTWARE_UPDATE_INDEX_HASH_LEN),ZT_SOFTWARE_UPDATE_INDEX_HASH_LEN) == 0);
+}
+
+static void _chunkIndex(const std::string &obj,std::string &idx)
+{
+	idx.clear();
+	for(unsigned long i=0;i<(unsigned long)obj.length();i+=ZT_SOFTWARE_UPDATE_CHUNK_SIZE) {
+		uint8_t sha512[ZT_SHA512_DIGEST_LEN];
+		SHA512::hash(sha512,obj.data() + i,(unsigned int)std::min((unsigned long)ZT_SOFTWARE_UPDATE_CHUNK_SIZE,(unsigned long)obj.length() - i));
+		idx.append(reinterpret_cast<const char *>(sha512),ZT_SOFTWARE_UPDATE_INDEX_HASH_LEN);
+	}
+}
+
+// Keep an object to serve and return its hash and size for update meta-data
+static nlohmann::json _storeObject(std::map< std::array<uint8_t,16>,std::string > &objects,const std::string &obj)
+{
+	uint8_t sha512[ZT_SHA512_DIGEST_LEN];
+	SHA512::hash(sha512,obj.data(),(unsigned int)obj.length());
+	std::array<uint8_t,16> shakey;
+	memcpy(shakey.data(),sha512,16);
+	objects[shakey] = obj;
+	nlohmann::json d;
+	d[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH] = _hexStr(sha512,ZT_SHA512_DIGEST_LEN);
+	d[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE] = obj.length();
+	return d;
+}
+
+static bool _readChunk(const std::string &path,const unsigned long idx,std::string &chunk)
+{
+	FILE *f = fopen(path.c_str(),"rb");
+	if (!f)
+		return false;
+	chunk.resize(ZT_SOFTWARE_UPDATE_CHUNK_SIZE);
+	size_t n = 0;
+	if (fseek(f,(long)idx,SEEK_SET) == 0)
+		n = fread(&(chunk[0]),1,ZT_SOFTWARE_UPDATE_CHUNK_SIZE,f);
+	fclose(f);
+	chunk.resize(n);
+	return (n > 0);
+}
+
 static int _compareVersion(unsigned int maj1,unsigned int min1,unsigned int rev1,unsigned int b1,unsigned int maj2,unsigned int min2,unsigned int rev2,unsigned int b2)
 {
 	if (maj1 > maj2) {
@@ -93,9 +170,22 @@ SoftwareUpdater::SoftwareUpdater(Node &node,const std::string &homePath) :
 	_channel(ZT_SOFTWARE_UPDATE_DEFAULT_CHANNEL),
 	_distLog((FILE *)0),
 	_latestValid(false),
+	_haveBase(false),
+	_downloadStage(DOWNLOAD_NONE),
+	_downloadDelta(false),
+	_deltaFailed(false),
+	_downloadObjectLength(0),
 	_downloadLength(0)
 {
 	OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME).c_str());
+
+	std::string base;
+	if ((OSUtils::readFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BASE_FILENAME).c_str(),base))&&(base.length() > 0)) {
+		uint8_t sha512[ZT_SHA512_DIGEST_LEN];
+		SHA512::hash(sha512,base.data(),(unsigned int)base.length());
+		memcpy(_baseHashPrefix.data(),sha512,16);
+		_haveBase = true;
+	}
 }
 
 SoftwareUpdater::~SoftwareUpdater()
@@ -107,6 +197,9 @@ SoftwareUpdater::~SoftwareUpdater()
 void SoftwareUpdater::setUpdateDistribution(bool distribute)
 {
 	_dist.clear();
+	_distObjects.clear();
+	_distDeltas.clear();
+	_distHolders.clear();
 	if (distribute) {
 		_distLog = fopen((_homePath + ZT_PATH_SEPARATOR_S "update-dist.log").c_str(),"a");
 
@@ -130,6 +223,9 @@ void SoftwareUpdater::setUpdateDistribution(bool distribute)
 							SHA512::hash(sha512.data(),d.bin.data(),(unsigned int)d.bin.length());
 							if (!memcmp(sha512.data(),metaHash.data(),ZT_SHA512_DIGEST_LEN)) { // double check that hash in JSON is correct
 								d.meta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE] = d.bin.length(); // override with correct value -- setting this in meta json is optional
+								std::string idx;
+								_chunkIndex(d.bin,idx);
+								d.index = _storeObject(_distObjects,idx);
 								std::array<uint8_t,16> shakey;
 								memcpy(shakey.data(),sha512.data(),16);
 								_dist[shakey] = d;
@@ -175,7 +271,17 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 					if (v == VERB_GET_LATEST) {
 
 						if (_dist.size() > 0) {
-							const nlohmann::json *latest = (const nlohmann::json *)0;
+							// Remember who can serve the image they're running to nodes updating to it
+							const std::string have(OSUtils::jsonBinFromHex(req[ZT_SOFTWARE_UPDATE_JSON_HAVE]));
+							std::array<uint8_t,16> haveKey;
+							if (have.length() == 16) {
+								memcpy(haveKey.data(),have.data(),16);
+								if (_dist.find(haveKey) != _dist.end())
+									_distHolders[haveKey][origin] = OSUtils::now();
+							}
+
+							const _D *latest = (const _D *)0;
+							std::array<uint8_t,16> latestKey;
 							const std::string expectedSigner = OSUtils::jsonString(req[ZT_SOFTWARE_UPDATE_JSON_EXPECT_SIGNED_BY],"");
 							unsigned int bestVMaj = rvMaj;
 							unsigned int bestVMin = rvMin;
@@ -202,7 +308,8 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 									const unsigned int dvRev = (unsigned int)OSUtils::jsonInt(d->second.meta[ZT_SOFTWARE_UPDATE_JSON_VERSION_REVISION],0);
 									const unsigned int dvBld = (unsigned int)OSUtils::jsonInt(d->second.meta[ZT_SOFTWARE_UPDATE_JSON_VERSION_BUILD],0);
 									if (_compareVersion(dvMaj,dvMin,dvRev,dvBld,bestVMaj,bestVMin,bestVRev,bestVBld) > 0) {
-										latest = &(d->second.meta);
+										latest = &(d->second);
+										latestKey = d->first;
 										bestVMaj = dvMaj;
 										bestVMin = dvMin;
 										bestVRev = dvRev;
@@ -211,9 +318,42 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 								}
 							}
 							if (latest) {
+								nlohmann::json lm(latest->meta);
+								lm[ZT_SOFTWARE_UPDATE_JSON_INDEX] = latest->index;
+
+								// A few random peers that have this image to fetch chunks from too
+								const int64_t now = OSUtils::now();
+								std::vector<uint64_t> holders;
+								std::map<uint64_t,int64_t> &h = _distHolders[latestKey];
+								for(std::map<uint64_t,int64_t>::iterator i(h.begin());i!=h.end();) {
+									if ((now - i->second) >= ZT_SOFTWARE_UPDATE_SOURCE_TIMEOUT) {
+										h.erase(i++);
+									} else {
+										if (i->first != origin)
+											holders.push_back(i->first);
+										++i;
+									}
+								}
+								if (!holders.empty()) {
+									nlohmann::json &sources = lm[ZT_SOFTWARE_UPDATE_JSON_SOURCES];
+									sources = nlohmann::json::array();
+									for(unsigned long i=0;((i<holders.size())&&(i<ZT_SOFTWARE_UPDATE_MAX_SOURCES));++i) {
+										std::swap(holders[i],holders[i + (unsigned long)(_node.prng() % (uint64_t)(holders.size() - i))]);
+										char tmp[24];
+										OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)holders[i]);
+										sources.push_back(tmp);
+									}
+								}
+
+								if (have.length() == 16) {
+									const nlohmann::json *delta = _distDelta(haveKey,latestKey);
+									if (delta)
+										lm[ZT_SOFTWARE_UPDATE_JSON_DELTA] = *delta;
+								}
+
 								std::string lj;
 								lj.push_back((char)VERB_LATEST);
-								lj.append(OSUtils::jsonDump(*latest));
+								lj.append(OSUtils::jsonDump(lm));
 								_node.sendUserMessage((void *)0,origin,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,lj.data(),(unsigned int)lj.length());
 								if (_distLog) {
 									fprintf(_distLog,"%.10llx GET_LATEST %u.%u.%u_%u platform %u arch %u vendor %u channel %s -> LATEST %u.%u.%u_%u" ZT_EOL_S,(unsigned long long)origin,rvMaj,rvMin,rvRev,rvBld,rvPlatform,rvArch,rvVendor,rvChannel.c_str(),bestVMaj,bestVMin,bestVRev,bestVBld);
@@ -230,22 +370,20 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 							const unsigned long len = (unsigned long)OSUtils::jsonInt(req[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE],0);
 							const std::string hash = OSUtils::jsonBinFromHex(req[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH]);
 							if ((len <= ZT_SOFTWARE_UPDATE_MAX_SIZE)&&(hash.length() >= 16)) {
-								if (_latestMeta != req) {
+								if (OSUtils::jsonString(_latestMeta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH],"") != OSUtils::jsonString(req[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH],"")) {
 									_latestMeta = req;
 									_latestValid = false;
 									OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME).c_str());
 									_download = std::string();
 									memcpy(_downloadHashPrefix.data(),hash.data(),16);
 									_downloadLength = len;
+									_startDownload();
+								} else if ((_downloadStage == DOWNLOAD_DATA)&&(!_downloadDelta)&&(!_fetch.chunkHashes.empty())) {
+									_addSources(req[ZT_SOFTWARE_UPDATE_JSON_SOURCES]);
 								}
 
-								if ((_downloadLength > 0)&&(_download.length() < _downloadLength)) {
-									Buffer<128> gd;
-									gd.append((uint8_t)VERB_GET_DATA);
-									gd.append(_downloadHashPrefix.data(),16);
-									gd.append((uint32_t)_download.length());
-									_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
-								}
+								if (_downloadStage != DOWNLOAD_NONE)
+									_request(OSUtils::now());
 							}
 						}
 					}
@@ -254,41 +392,65 @@ void SoftwareUpdater::handleSoftwareUpdateUserMessage(uint64_t origin,const void
 			}	break;
 
 			case VERB_GET_DATA:
-				if ((len >= 21)&&(_dist.size() > 0)) {
-					unsigned long idx = (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 17) << 24;
-					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 18) << 16;
-					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 19) << 8;
-					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 20);
+				if (len >= 21) {
+					const unsigned long idx = _u32(reinterpret_cast<const uint8_t *>(data) + 17);
 					std::array<uint8_t,16> shakey;
 					memcpy(shakey.data(),reinterpret_cast<const uint8_t *>(data) + 1,16);
+
+					// Serve updates, indexes, and deltas we distribute, or the image we're running or about to install
+					std::string chunk;
+					const std::string *obj = (const std::string *)0;
 					std::map< std::array<uint8_t,16>,_D >::iterator d(_dist.find(shakey));
-					if ((d != _dist.end())&&(idx < (unsigned long)d->second.bin.length())) {
+					if (d != _dist.end()) {
+						obj = &(d->second.bin);
+					} else {
+						std::map< std::array<uint8_t,16>,std::string >::iterator o(_distObjects.find(shakey));
+						if (o != _distObjects.end())
+							obj = &(o->second);
+					}
+					if (obj) {
+						if (idx < (unsigned long)obj->length())
+							chunk.assign(obj->data() + idx,std::min((unsigned long)ZT_SOFTWARE_UPDATE_CHUNK_SIZE,(unsigned long)(obj->length() - idx)));
+					} else if ((_haveBase)&&(shakey == _baseHashPrefix)) {
+						_readChunk(_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BASE_FILENAME,idx,chunk);
+					} else if ((_latestValid)&&(shakey == _downloadHashPrefix)) {
+						_readChunk(_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME,idx,chunk);
+					}
+
+					if (!chunk.empty()) {
 						Buffer<ZT_SOFTWARE_UPDATE_CHUNK_SIZE + 128> buf;
 						buf.append((uint8_t)VERB_DATA);
 						buf.append(reinterpret_cast<const uint8_t *>(data) + 1,16);
 						buf.append((uint32_t)idx);
-						buf.append(d->second.bin.data() + idx,std::min((unsigned long)ZT_SOFTWARE_UPDATE_CHUNK_SIZE,(unsigned long)(d->second.bin.length() - idx)));
+						buf.append(chunk.data(),(unsigned int)chunk.length());
 						_node.sendUserMessage((void *)0,origin,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,buf.data(),buf.size());
 					}
 				}
 				break;
 
 			case VERB_DATA:
-				if ((len >= 21)&&(_downloadLength > 0)&&(!memcmp(_downloadHashPrefix.data(),reinterpret_cast<const uint8_t *>(data) + 1,16))) {
-					unsigned long idx = (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 17) << 24;
-					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 18) << 16;
-					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 19) << 8;
-					idx |= (unsigned long)*(reinterpret_cast<const uint8_t *>(data) + 20);
-					if (idx == (unsigned long)_download.length()) {
-						_download.append(reinterpret_cast<const char *>(data) + 21,len - 21);
-						if (_download.length() < _downloadLength) {
-							Buffer<128> gd;
-							gd.append((uint8_t)VERB_GET_DATA);
-							gd.append(_downloadHashPrefix.data(),16);
-							gd.append((uint32_t)_download.length());
-							_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
+				if ((len >= 21)&&(_downloadStage != DOWNLOAD_NONE)&&(!memcmp(_fetch.hashPrefix.data(),reinterpret_cast<const uint8_t *>(data) + 1,16))) {
+					const unsigned long idx = _u32(reinterpret_cast<const uint8_t *>(data) + 17);
+					const unsigned long c = idx / ZT_SOFTWARE_UPDATE_CHUNK_SIZE;
+					const unsigned int clen = len - 21;
+					std::vector<uint64_t>::iterator src(std::find(_fetch.sources.begin(),_fetch.sources.end(),origin));
+					if ((src != _fetch.sources.end())&&((idx % ZT_SOFTWARE_UPDATE_CHUNK_SIZE) == 0)&&(c < (unsigned long)_fetch.have.size())&&(!_fetch.have[c])&&(clen == std::min((unsigned long)ZT_SOFTWARE_UPDATE_CHUNK_SIZE,_fetch.length - idx))) {
+						if ((_fetch.chunkHashes.empty())||(_chunkOk(_fetch.chunkHashes,c,reinterpret_cast<const uint8_t *>(data) + 21,clen))) {
+							memcpy(&(_fetch.data[idx]),reinterpret_cast<const uint8_t *>(data) + 21,clen);
+							_fetch.have[c] = true;
+							_fetch.dirty = true;
+							_fetch.inflight.erase(c);
+							if (++_fetch.received == (unsigned long)_fetch.have.size())
+								_fetched();
+						} else if (origin != ZT_SOFTWARE_UPDATE_SERVICE) {
+							// Never ask a peer that sent a bad chunk for anything again
+							_fetch.sources.erase(src);
+							_fetch.inflight.erase(c);
+							_fetch.retry.push_back(c);
 						}
 					}
+					if (_downloadStage != DOWNLOAD_NONE)
+						_request(OSUtils::now());
 				}
 				break;
 
@@ -311,6 +473,10 @@ bool SoftwareUpdater::check(const int64_t now)
 {
 	if ((now - _lastCheckTime) >= ZT_SOFTWARE_UPDATE_CHECK_PERIOD) {
 		_lastCheckTime = now;
+		char have[64];
+		have[0] = (char)0;
+		if (_haveBase)
+			OSUtils::ztsnprintf(have,sizeof(have),",\"" ZT_SOFTWARE_UPDATE_JSON_HAVE "\":\"%s\"",_hexStr(_baseHashPrefix.data(),16).c_str());
 		char tmp[512];
 		const unsigned int len = OSUtils::ztsnprintf(tmp,sizeof(tmp),
 			"%c{\"" ZT_SOFTWARE_UPDATE_JSON_VERSION_MAJOR "\":%d,"
@@ -321,7 +487,7 @@ bool SoftwareUpdater::check(const int64_t now)
 			"\"" ZT_SOFTWARE_UPDATE_JSON_PLATFORM "\":%d,"
 			"\"" ZT_SOFTWARE_UPDATE_JSON_ARCHITECTURE "\":%d,"
 			"\"" ZT_SOFTWARE_UPDATE_JSON_VENDOR "\":%d,"
-			"\"" ZT_SOFTWARE_UPDATE_JSON_CHANNEL "\":\"%s\"}",
+			"\"" ZT_SOFTWARE_UPDATE_JSON_CHANNEL "\":\"%s\"%s}",
 			(char)VERB_GET_LATEST,
 			ZEROTIER_ONE_VERSION_MAJOR,
 			ZEROTIER_ONE_VERSION_MINOR,
@@ -331,7 +497,8 @@ bool SoftwareUpdater::check(const int64_t now)
 			ZT_BUILD_PLATFORM,
 			ZT_BUILD_ARCHITECTURE,
 			(int)ZT_VENDOR_ZEROTIER,
-			_channel.c_str());
+			_channel.c_str(),
+			have);
 		_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,tmp,len);
 	}
 
@@ -339,7 +506,7 @@ bool SoftwareUpdater::check(const int64_t now)
 		return true;
 
 	if (_downloadLength > 0) {
-		if (_download.length() >= _downloadLength) {
+		if (_downloadStage == DOWNLOAD_NONE) {
 			// This is the very important security validation part that makes sure
 			// this software update doesn't have cooties.
 
@@ -358,6 +525,7 @@ bool SoftwareUpdater::check(const int64_t now)
 						if (OSUtils::writeFile(binPath.c_str(),_download)) {
 							OSUtils::lockDownFile(binPath.c_str(),false);
 							_latestValid = true;
+							_deltaFailed = false;
 							_download = std::string();
 							_downloadLength = 0;
 							return true;
@@ -366,18 +534,21 @@ bool SoftwareUpdater::check(const int64_t now)
 				}
 			} catch ( ... ) {} // any exception equals verification failure
 
-			// If we get here, checks failed.
+			// If we get here, checks failed. Don't try the same delta again.
+			if (_downloadDelta)
+				_deltaFailed = true;
 			OSUtils::rm(binPath.c_str());
 			_latestMeta = nlohmann::json();
 			_latestValid = false;
 			_download = std::string();
 			_downloadLength = 0;
+			_resetDownload();
 		} else {
-			Buffer<128> gd;
-			gd.append((uint8_t)VERB_GET_DATA);
-			gd.append(_downloadHashPrefix.data(),16);
-			gd.append((uint32_t)_download.length());
-			_node.sendUserMessage((void *)0,ZT_SOFTWARE_UPDATE_SERVICE,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
+			_request(now);
+			if ((_fetch.dirty)&&(!_fetch.chunkHashes.empty())) {
+				_fetch.dirty = false;
+				OSUtils::writeFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PART_FILENAME).c_str(),_fetch.data);
+			}
 		}
 	}
 
@@ -388,6 +559,13 @@ void SoftwareUpdater::apply()
 {
 	std::string updatePath(_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BIN_FILENAME);
 	if ((_latestMeta.is_object())&&(_latestValid)&&(OSUtils::fileExists(updatePath.c_str(),false))) {
+		// Keep this image to fetch the next update as a delta against and to serve to peers
+		std::string img;
+		if ((OSUtils::readFile(updatePath.c_str(),img))&&(OSUtils::writeFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BASE_FILENAME).c_str(),img))) {
+			_baseHashPrefix = _downloadHashPrefix;
+			_haveBase = true;
+		}
+
 #ifdef __WINDOWS__
 		std::string cmdArgs(OSUtils::jsonString(_latestMeta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_EXEC_ARGS],""));
 		if (cmdArgs.length() > 0) {
@@ -436,4 +614,293 @@ void SoftwareUpdater::apply()
 	}
 }
 
+void SoftwareUpdater::makeDelta(const std::string &base,const std::string &target,std::string &delta)
+{
+	// Index every block-aligned window of the base by a polynomial rolling hash,
+	// then roll a window over the target and copy runs that match from the base.
+	static const uint64_t P = 0x100000001b3ULL;
+	const unsigned long B = ZT_SOFTWARE_UPDATE_DELTA_BLOCK;
+	uint64_t pB1 = 1; // P^(B-1)
+	for(unsigned long i=1;i<B;++i)
+		pB1 *= P;
+	const uint8_t *const bp = reinterpret_cast<const uint8_t *>(base.data());
+	const uint8_t *const tp = reinterpret_cast<const uint8_t *>(target.data());
+	const unsigned long bl = (unsigned long)base.length();
+	const unsigned long tl = (unsigned long)target.length();
+
+	std::unordered_map<uint64_t,unsigned long> blocks;
+	for(unsigned long o=0;(o+B)<=bl;o+=B) {
+		uint64_t h = 0;
+		for(unsigned long j=0;j<B;++j)
+			h = (h * P) + bp[o + j];
+		blocks.emplace(h,o);
+	}
+
+	delta.clear();
+	unsigned long lit = 0; // start of bytes not yet in the delta
+	unsigned long i = 0;
+	uint64_t h = 0;
+	bool haveHash = false;
+	while ((i + B) <= tl) {
+		if (!haveHash) {
+			h = 0;
+			for(unsigned long j=0;j<B;++j)
+				h = (h * P) + tp[i + j];
+			haveHash = true;
+		}
+		std::unordered_map<uint64_t,unsigned long>::const_iterator b(blocks.find(h));
+		if ((b != blocks.end())&&(!memcmp(bp + b->second,tp + i,B))) {
+			unsigned long bo = b->second;
+			unsigned long n = B;
+			while ((i > lit)&&(bo > 0)&&(bp[bo - 1] == tp[i - 1])) {
+				--i;
+				--bo;
+				++n;
+			}
+			while (((i + n) < tl)&&((bo + n) < bl)&&(bp[bo + n] == tp[i + n]))
+				++n;
+			if (i > lit) {
+				delta.push_back((char)ZT_SOFTWARE_UPDATE_DELTA_OP_ADD);
+				_appendU32(delta,i - lit);
+				delta.append(target.data() + lit,i - lit);
+			}
+			delta.push_back((char)ZT_SOFTWARE_UPDATE_DELTA_OP_COPY);
+			_appendU32(delta,bo);
+			_appendU32(delta,n);
+			i += n;
+			lit = i;
+			haveHash = false;
+		} else {
+			if ((i + B) < tl)
+				h = ((h - (tp[i] * pB1)) * P) + tp[i + B];
+			++i;
+		}
+	}
+	if (tl > lit) {
+		delta.push_back((char)ZT_SOFTWARE_UPDATE_DELTA_OP_ADD);
+		_appendU32(delta,tl - lit);
+		delta.append(target.data() + lit,tl - lit);
+	}
+}
+
+bool SoftwareUpdater::applyDelta(const std::string &base,const std::string &delta,std::string &target)
+{
+	target.clear();
+	const uint8_t *const d = reinterpret_cast<const uint8_t *>(delta.data());
+	const unsigned long dl = (unsigned long)delta.length();
+	unsigned long p = 0;
+	while (p < dl) {
+		const uint8_t op = d[p++];
+		if ((op == ZT_SOFTWARE_UPDATE_DELTA_OP_COPY)&&((p + 8) <= dl)) {
+			const unsigned long o = _u32(d + p);
+			const unsigned long n = _u32(d + p + 4);
+			p += 8;
+			if ((o > (unsigned long)base.length())||(n > ((unsigned long)base.length() - o)))
+				return false;
+			target.append(base.data() + o,n);
+		} else if ((op == ZT_SOFTWARE_UPDATE_DELTA_OP_ADD)&&((p + 4) <= dl)) {
+			const unsigned long n = _u32(d + p);
+			p += 4;
+			if (n > (dl - p))
+				return false;
+			target.append(delta.data() + p,n);
+			p += n;
+		} else {
+			return false;
+		}
+		if (target.length() > ZT_SOFTWARE_UPDATE_MAX_SIZE)
+			return false;
+	}
+	return true;
+}
+
+void SoftwareUpdater::_startDownload()
+{
+	_resetDownload();
+
+	// Fetch a delta if the update service has one against the image we have, otherwise the whole image
+	nlohmann::json delta(_latestMeta[ZT_SOFTWARE_UPDATE_JSON_DELTA]);
+	_downloadDelta = false;
+	if ((!_deltaFailed)&&(_haveBase)&&(delta.is_object())) {
+		const std::string from(OSUtils::jsonBinFromHex(delta[ZT_SOFTWARE_UPDATE_JSON_DELTA_FROM]));
+		_downloadDelta = ( (from.length() == 16)&&(!memcmp(from.data(),_baseHashPrefix.data(),16)) &&
+		                   (OSUtils::jsonBinFromHex(delta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH]).length() == ZT_SHA512_DIGEST_LEN) &&
+		                   (OSUtils::jsonInt(delta[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE],0) <= ZT_SOFTWARE_UPDATE_MAX_SIZE) );
+	}
+	nlohmann::json &obj = (_downloadDelta) ? delta : _latestMeta;
+	_downloadObjectHash = OSUtils::jsonBinFromHex(obj[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH]);
+	_downloadObjectLength = (unsigned long)OSUtils::jsonInt(obj[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE],0);
+
+	nlohmann::json index(obj[ZT_SOFTWARE_UPDATE_JSON_INDEX]);
+	_downloadIndexHash = OSUtils::jsonBinFromHex(index[ZT_SOFTWARE_UPDATE_JSON_UPDATE_HASH]);
+	const unsigned long indexLength = (unsigned long)OSUtils::jsonInt(index[ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE],0);
+	if ((_downloadIndexHash.length() == ZT_SHA512_DIGEST_LEN)&&(indexLength == (_chunkCount(_downloadObjectLength) * ZT_SOFTWARE_UPDATE_INDEX_HASH_LEN))) {
+		_downloadStage = DOWNLOAD_INDEX;
+		_fetchObject(_downloadIndexHash,indexLength,std::string(),false);
+	} else {
+		// Chunks can't be checked one by one without an index, so they all come from the update service
+		_downloadStage = DOWNLOAD_DATA;
+		_fetchObject(_downloadObjectHash,_downloadObjectLength,std::string(),false);
+	}
+	if (_fetch.received == (unsigned long)_fetch.have.size())
+		_fetched();
+}
+
+void SoftwareUpdater::_fetchObject(const std::string &hash,unsigned long length,const std::string &chunkHashes,bool fromPeers)
+{
+	_fetch = _Fetch();
+	memcpy(_fetch.hashPrefix.data(),hash.data(),16);
+	_fetch.length = length;
+	_fetch.data.assign(length,(char)0);
+	_fetch.chunkHashes = chunkHashes;
+	_fetch.have.resize(_chunkCount(length),false);
+	_fetch.sources.push_back(ZT_SOFTWARE_UPDATE_SERVICE);
+	if (!chunkHashes.empty()) {
+		if (fromPeers)
+			_addSources(_latestMeta[ZT_SOFTWARE_UPDATE_JSON_SOURCES]);
+
+		// Reuse whatever chunks of an earlier attempt at this object check out
+		std::string part;
+		if ((OSUtils::readFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PART_FILENAME).c_str(),part))&&((unsigned long)part.length() == length)) {
+			for(unsigned long c=0;c<(unsigned long)_fetch.have.size();++c) {
+				const unsigned long o = c * ZT_SOFTWARE_UPDATE_CHUNK_SIZE;
+				const unsigned int clen = (unsigned int)std::min((unsigned long)ZT_SOFTWARE_UPDATE_CHUNK_SIZE,length - o);
+				if (_chunkOk(chunkHashes,c,part.data() + o,clen)) {
+					memcpy(&(_fetch.data[o]),part.data() + o,clen);
+					_fetch.have[c] = true;
+					++_fetch.received;
+				}
+			}
+		}
+	}
+}
+
+void SoftwareUpdater::_addSources(const nlohmann::json &sources)
+{
+	if (!sources.is_array())
+		return;
+	for(unsigned long i=0;i<(unsigned long)sources.size();++i) {
+		const uint64_t a = Utils::hexStrToU64(OSUtils::jsonString(sources[i],"").c_str()) & 0xffffffffffULL;
+		if ((a)&&(a != _node.address())&&(std::find(_fetch.sources.begin(),_fetch.sources.end(),a) == _fetch.sources.end()))
+			_fetch.sources.push_back(a);
+	}
+}
+
+void SoftwareUpdater::_request(const int64_t now)
+{
+	// Chunks not answered in time get asked for again from the next source, and peers that keep not answering are dropped
+	for(std::map< unsigned long,std::pair<int64_t,uint64_t> >::iterator i(_fetch.inflight.begin());i!=_fetch.inflight.end();) {
+		if ((now - i->second.first) >= ZT_SOFTWARE_UPDATE_CHUNK_TIMEOUT) {
+			const uint64_t src = i->second.second;
+			if ((src != ZT_SOFTWARE_UPDATE_SERVICE)&&(++_fetch.strikes[src] >= ZT_SOFTWARE_UPDATE_MAX_SOURCE_STRIKES)) {
+				std::vector<uint64_t>::iterator s(std::find(_fetch.sources.begin(),_fetch.sources.end(),src));
+				if (s != _fetch.sources.end())
+					_fetch.sources.erase(s);
+			}
+			_fetch.retry.push_back(i->first);
+			_fetch.inflight.erase(i++);
+		} else ++i;
+	}
+
+	while (_fetch.inflight.size() < ZT_SOFTWARE_UPDATE_MAX_INFLIGHT) {
+		unsigned long c;
+		if (!_fetch.retry.empty()) {
+			c = _fetch.retry.back();
+			_fetch.retry.pop_back();
+			if ((_fetch.have[c])||(_fetch.inflight.count(c)))
+				continue;
+		} else {
+			while ((_fetch.nextChunk < (unsigned long)_fetch.have.size())&&(_fetch.have[_fetch.nextChunk]))
+				++_fetch.nextChunk;
+			if (_fetch.nextChunk >= (unsigned long)_fetch.have.size())
+				break;
+			c = _fetch.nextChunk++;
+		}
+
+		const uint64_t src = _fetch.sources[_fetch.nextSource++ % _fetch.sources.size()];
+		_fetch.inflight[c] = std::pair<int64_t,uint64_t>(now,src);
+		Buffer<128> gd;
+		gd.append((uint8_t)VERB_GET_DATA);
+		gd.append(_fetch.hashPrefix.data(),16);
+		gd.append((uint32_t)(c * ZT_SOFTWARE_UPDATE_CHUNK_SIZE));
+		_node.sendUserMessage((void *)0,src,ZT_SOFTWARE_UPDATE_USER_MESSAGE_TYPE,gd.data(),gd.size());
+	}
+}
+
+void SoftwareUpdater::_fetched()
+{
+	uint8_t sha512[ZT_SHA512_DIGEST_LEN];
+
+	if (_downloadStage == DOWNLOAD_INDEX) {
+		SHA512::hash(sha512,_fetch.data.data(),(unsigned int)_fetch.data.length());
+		if (memcmp(sha512,_downloadIndexHash.data(),ZT_SHA512_DIGEST_LEN) != 0) {
+			_resetDownload();
+			return;
+		}
+		const std::string chunkHashes(_fetch.data);
+		_downloadStage = DOWNLOAD_DATA;
+		_fetchObject(_downloadObjectHash,_downloadObjectLength,chunkHashes,!_downloadDelta);
+		if (_fetch.received == (unsigned long)_fetch.have.size())
+			_fetched();
+		return;
+	}
+
+	OSUtils::rm((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_PART_FILENAME).c_str());
+	if (_downloadDelta) {
+		SHA512::hash(sha512,_fetch.data.data(),(unsigned int)_fetch.data.length());
+		std::string base;
+		if ( (memcmp(sha512,_downloadObjectHash.data(),ZT_SHA512_DIGEST_LEN) != 0) ||
+		     (!OSUtils::readFile((_homePath + ZT_PATH_SEPARATOR_S ZT_SOFTWARE_UPDATE_BASE_FILENAME).c_str(),base)) ||
+		     (!applyDelta(base,_fetch.data,_download)) ) {
+			// Fall back to fetching the whole image
+			_deltaFailed = true;
+			_download = std::string();
+			_startDownload();
+			return;
+		}
+	} else {
+		_download.swap(_fetch.data);
+	}
+	_fetch = _Fetch();
+	_downloadStage = DOWNLOAD_NONE; // check() verifies the image
+}
+
+void SoftwareUpdater::_resetDownload()
+{
+	_fetch = _Fetch();
+	_downloadStage = DOWNLOAD_NONE;
+	_downloadDelta = false;
+}
+
+const nlohmann::json *SoftwareUpdater::_distDelta(const std::array<uint8_t,16> &from,const std::array<uint8_t,16> &to)
+{
+	if (from == to)
+		return (const nlohmann::json *)0;
+	const std::pair< std::array<uint8_t,16>,std::array<uint8_t,16> > k(from,to);
+	std::map< std::pair< std::array<uint8_t,16>,std::array<uint8_t,16> >,nlohmann::json >::iterator d(_distDeltas.find(k));
+	if (d == _distDeltas.end()) {
+		std::map< std::array<uint8_t,16>,_D >::const_iterator base(_dist.find(from));
+		std::map< std::array<uint8_t,16>,_D >::const_iterator target(_dist.find(to));
+		if ((base == _dist.end())||(target == _dist.end()))
+			return (const nlohmann::json *)0;
+
+		// Made on first request and kept, including when it's not enough smaller than the image to bother with
+		d = _distDeltas.insert(std::make_pair(k,nlohmann::json())).first;
+		std::string delta;
+		makeDelta(base->second.bin,target->second.bin,delta);
+		if ((delta.length() * 4) < (target->second.bin.length() * 3)) {
+			std::string idx;
+			_chunkIndex(delta,idx);
+			d->second = _storeObject(_distObjects,delta);
+			d->second[ZT_SOFTWARE_UPDATE_JSON_DELTA_FROM] = _hexStr(from.data(),16);
+			d->second[ZT_SOFTWARE_UPDATE_JSON_INDEX] = _storeObject(_distObjects,idx);
+		}
+		if (_distLog) {
+			fprintf(_distLog,".......... DELTA: %s -> %s is %u bytes (image is %u bytes)" ZT_EOL_S,_hexStr(from.data(),16).c_str(),_hexStr(to.data(),16).c_str(),(unsigned int)delta.length(),(unsigned int)target->second.bin.length());
+			fflush(_distLog);
+		}
+	}
+	return (d->second.is_object()) ? &(d->second) : (const nlohmann::json *)0;
+}
+
 } // namespace ZeroTier
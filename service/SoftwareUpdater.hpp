@@ -79,11 +79,56 @@
  */
 #define ZT_SOFTWARE_UPDATE_DEFAULT_CHANNEL "release"
 
+/**
+ * Chunks requested at once while downloading, spread over all sources
+ */
+#define ZT_SOFTWARE_UPDATE_MAX_INFLIGHT 16
+
+/**
+ * Re-request a chunk, from the next source if there is one, after this long (ms) without it
+ */
+#define ZT_SOFTWARE_UPDATE_CHUNK_TIMEOUT 5000
+
+/**
+ * Timeouts after which a peer is no longer asked for chunks
+ */
+#define ZT_SOFTWARE_UPDATE_MAX_SOURCE_STRIKES 3
+
+/**
+ * Most peers to offer to each node as additional sources for an update
+ */
+#define ZT_SOFTWARE_UPDATE_MAX_SOURCES 8
+
+/**
+ * How long (ms) a peer that said it has an image is offered as a source for it
+ */
+#define ZT_SOFTWARE_UPDATE_SOURCE_TIMEOUT (ZT_SOFTWARE_UPDATE_CHECK_PERIOD * 3)
+
+/**
+ * Bytes of each chunk's SHA512 in a chunk hash index
+ */
+#define ZT_SOFTWARE_UPDATE_INDEX_HASH_LEN 8
+
+/**
+ * Size of the blocks deltas look for in the base image
+ */
+#define ZT_SOFTWARE_UPDATE_DELTA_BLOCK 64
+
 /**
  * Filename for latest update's binary image
  */
 #define ZT_SOFTWARE_UPDATE_BIN_FILENAME "latest-update.exe"
 
+/**
+ * Filename for the last applied update's image, used as a delta base and served to peers
+ */
+#define ZT_SOFTWARE_UPDATE_BASE_FILENAME "update-base.bin"
+
+/**
+ * Filename for chunks of an unfinished download, reused if their hashes check out
+ */
+#define ZT_SOFTWARE_UPDATE_PART_FILENAME "latest-update.part"
+
 #define ZT_SOFTWARE_UPDATE_JSON_VERSION_MAJOR "vMajor"
 #define ZT_SOFTWARE_UPDATE_JSON_VERSION_MINOR "vMinor"
 #define ZT_SOFTWARE_UPDATE_JSON_VERSION_REVISION "vRev"
@@ -99,6 +144,11 @@
 #define ZT_SOFTWARE_UPDATE_JSON_UPDATE_SIZE "size"
 #define ZT_SOFTWARE_UPDATE_JSON_UPDATE_EXEC_ARGS "execArgs"
 #define ZT_SOFTWARE_UPDATE_JSON_UPDATE_URL "url"
+#define ZT_SOFTWARE_UPDATE_JSON_HAVE "have"
+#define ZT_SOFTWARE_UPDATE_JSON_SOURCES "sources"
+#define ZT_SOFTWARE_UPDATE_JSON_INDEX "index"
+#define ZT_SOFTWARE_UPDATE_JSON_DELTA "delta"
+#define ZT_SOFTWARE_UPDATE_JSON_DELTA_FROM "from"
 
 namespace ZeroTier {
 
@@ -112,16 +162,31 @@ class SoftwareUpdater
 public:
 	/**
 	 * Each message begins with an 8-bit message verb
+	 *
+	 * Besides updates themselves, distributors serve a chunk hash index for
+	 * each image (the first ZT_SOFTWARE_UPDATE_INDEX_HASH_LEN bytes of each
+	 * chunk's SHA512) and deltas from older images they also have. These are
+	 * fetched with GET_DATA like any other data object. With an index, chunks
+	 * can be taken from peers that have the image, since each is checked as
+	 * it arrives.
 	 */
 	enum MessageVerb
 	{
 		/**
 		 * Payload: JSON containing current system platform, version, etc.
+		 *
+		 * If present, "have" is the hex first 128 bits of the hash of the
+		 * image of the installed version, which the sender will serve.
 		 */
 		VERB_GET_LATEST = 1,
 
 		/**
 		 * Payload: JSON describing latest update for this target. (No response is sent if there is none.)
+		 *
+		 * Distributors add "index" (hash and size of the chunk hash index),
+		 * "sources" (hex addresses of peers with the image), and if the
+		 * sender has an image they have too "delta" (from, hash, size, and
+		 * its own index).
 		 */
 		VERB_LATEST = 2,
 
@@ -189,7 +254,62 @@ public:
 	 */
 	inline void setChannel(const std::string &channel) { _channel = channel; }
 
+	/**
+	 * Compute a delta that rebuilds one image from another
+	 *
+	 * @param base Image the receiver has
+	 * @param target Image to rebuild
+	 * @param delta Filled with delta
+	 */
+	static void makeDelta(const std::string &base,const std::string &target,std::string &delta);
+
+	/**
+	 * Rebuild an image from a base image and a delta
+	 *
+	 * @param base Image the delta was made against
+	 * @param delta Delta
+	 * @param target Filled with rebuilt image
+	 * @return False if delta is invalid for this base
+	 */
+	static bool applyDelta(const std::string &base,const std::string &delta,std::string &target);
+
 private:
+	// An object being fetched in chunks, from several sources at once if we know of any
+	struct _Fetch
+	{
+		_Fetch() : length(0),received(0),nextChunk(0),nextSource(0),dirty(false) { hashPrefix.fill(0); }
+
+		std::array<uint8_t,16> hashPrefix;
+		unsigned long length;
+		std::string data;
+		std::string chunkHashes; // empty if chunks can't be checked, in which case only the update service is asked
+		std::vector<bool> have;
+		unsigned long received;
+		unsigned long nextChunk; // next never requested chunk
+		std::vector<unsigned long> retry; // chunks to request again
+		std::map< unsigned long,std::pair<int64_t,uint64_t> > inflight; // chunk -> (time requested, source)
+		std::vector<uint64_t> sources;
+		std::map< uint64_t,unsigned int > strikes;
+		unsigned long nextSource;
+		bool dirty; // received chunks not yet cached on disk
+	};
+
+	enum _DownloadStage
+	{
+		DOWNLOAD_NONE = 0,
+		DOWNLOAD_INDEX = 1,
+		DOWNLOAD_DATA = 2
+	};
+
+	void _startDownload();
+	void _fetchObject(const std::string &hash,unsigned long length,const std::string &chunkHashes,bool fromPeers);
+	void _addSources(const nlohmann::json &sources);
+	void _request(const int64_t now);
+	void _fetched();
+	void _resetDownload();
+	const nlohmann::json *_distDelta(const std::array<uint8_t,16> &from,const std::array<uint8_t,16> &to);
+
+
 	Node &_node;
 	uint64_t _lastCheckTime;
 	std::string _homePath;
@@ -201,12 +321,27 @@ private:
 	{
 		nlohmann::json meta;
 		std::string bin;
+		nlohmann::json index; // hash and size of chunk hash index
 	};
 	std::map< std::array<uint8_t,16>,_D > _dist; // key is first 16 bytes of hash
+	std::map< std::array<uint8_t,16>,std::string > _distObjects; // chunk hash indexes and deltas, key is first 16 bytes of hash
+	std::map< std::pair< std::array<uint8_t,16>,std::array<uint8_t,16> >,nlohmann::json > _distDeltas; // (from,to) -> delta description, or null if not worth sending
+	std::map< std::array<uint8_t,16>,std::map<uint64_t,int64_t> > _distHolders; // image -> nodes that said they have it, and when
 
 	nlohmann::json _latestMeta;
 	bool _latestValid;
 
+	bool _haveBase;
+	std::array<uint8_t,16> _baseHashPrefix;
+
+	int _downloadStage;
+	bool _downloadDelta;
+	bool _deltaFailed;
+	std::string _downloadIndexHash;
+	std::string _downloadObjectHash; // full hash of the delta or image fetched after its index
+	unsigned long _downloadObjectLength;
+	_Fetch _fetch;
+
 	std::string _download;
 	std::array<uint8_t,16> _downloadHashPrefix;
 	unsigned long _downloadLength;
@@ -0,0 +1,904 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+/*
+ * In-process network simulator for scaling tests.
+ *
+ * Many unmodified Nodes run in one process on a virtual clock: roots on a
+ * private planet, a controller node running EmbeddedNetworkController with
+ * an in-memory database, and leaves that all join one public network on
+ * it. Nodes talk over a virtual wire with configurable one-way latency,
+ * jitter, loss and leaf uplink bandwidth, and a share of the leaves sit
+ * behind NATs with cone, port restricted or symmetric behavior. Identities
+ * and the planet are served from memory and state nodes would persist is
+ * discarded.
+ *
+ * Time runs as fast as the nodes can process events, except while leaves
+ * are still waiting for their network configs. The controller answers from
+ * its own threads in real time, so until every leaf is configured the
+ * clock runs no faster than real time whenever nothing else is due.
+ *
+ * Once every leaf is configured (the convergence time), each leaf sends a
+ * small frame to a few random other leaves every second and one leaf sends
+ * a broadcast. At the end a JSON report gives convergence times, root CPU
+ * per peer, the WHOIS, gather and other verb load served, wire totals and
+ * memory use.
+ *
+ * Usage: zerotier-simulator [<options>]
+ *
+ *   -r <roots>      Roots in the planet (default 2, at most 4)
+ *   -n <leaves>     Leaves joining the network (default 100)
+ *   -d <seconds>    Simulated time to run after convergence (default 60)
+ *   -w <seconds>    Simulated time to wait for convergence (default 300)
+ *   -S <seconds>    Leaves start at random times over this long (default 0)
+ *   -l <ms>         One-way wire latency (default 20)
+ *   -j <ms>         Extra random latency up to this much (default 0)
+ *   -L <percent>    Packet loss (default 0)
+ *   -b <kbit/s>     Leaf uplink bandwidth (default unlimited)
+ *   -m <bytes>      Largest UDP payload the wire carries (default 1472)
+ *   -N <percent>    Leaves behind a NAT (default 0)
+ *   -T <type>       NAT type: cone, restricted or symmetric (default restricted)
+ *   -u <peers>      Leaves each leaf sends unicast frames to (default 1)
+ *   -s <seed>       Random seed for topology and wire behavior (default 1)
+ *   -i <file>       Identity cache, read if present and extended as needed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef __WINDOWS__
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "include/ZeroTierOne.h"
+
+#include "node/Constants.hpp"
+#include "node/Utils.hpp"
+#include "node/Identity.hpp"
+#include "node/InetAddress.hpp"
+#include "node/MAC.hpp"
+#include "node/Packet.hpp"
+#include "node/World.hpp"
+#include "node/C25519.hpp"
+#include "node/Node.hpp"
+
+#include "controller/EmbeddedNetworkController.hpp"
+
+#include "osdep/OSUtils.hpp"
+
+#include "version.h"
+
+#define ZT_SIMULATOR_MAX_LEAVES 1000000
+#define ZT_SIMULATOR_MAX_TARGETS 64
+
+// Leaves send a frame to each of their unicast targets this often once converged
+#define ZT_SIMULATOR_FRAME_INTERVAL_MS 1000
+#define ZT_SIMULATOR_FRAME_BYTES 128
+
+// While leaves wait for configs the clock advances in steps this long when nothing else is due
+#define ZT_SIMULATOR_IDLE_STEP_MS 1
+
+// A bandwidth limited uplink drops packets that would wait longer than this to be sent
+#define ZT_SIMULATOR_MAX_QUEUE_MS 250
+
+// Node addresses start here, each in its own /24 since nodes rate limit HELLOs per /24
+#define ZT_SIMULATOR_IP_BASE 0x0b000001
+#define ZT_SIMULATOR_PORT 9993
+
+// First external port a NAT maps to, and how many it hands out before wrapping
+#define ZT_SIMULATOR_NAT_PORT_BASE 20000
+#define ZT_SIMULATOR_NAT_PORTS 40000
+
+#define ZT_SIMULATOR_PLANET_ID 0x73696d756c61746fULL
+
+using namespace ZeroTier;
+
+enum SimRole
+{
+	SIM_ROLE_ROOT = 0,
+	SIM_ROLE_CONTROLLER = 1,
+	SIM_ROLE_LEAF = 2
+};
+
+enum SimNat
+{
+	SIM_NAT_NONE = 0,
+	SIM_NAT_CONE = 1,       // one mapping, anyone may send in
+	SIM_NAT_RESTRICTED = 2, // one mapping, only endpoints sent to may send in
+	SIM_NAT_SYMMETRIC = 3   // a mapping per destination, only it may send in
+};
+
+static unsigned int simRoots = 2;
+static unsigned int simLeaves = 100;
+static int64_t simDurationMs = 60000;
+static int64_t simConvergeMs = 300000;
+static int64_t simSpreadMs = 0;
+static unsigned int simLatencyMs = 20;
+static unsigned int simJitterMs = 0;
+static double simLossPercent = 0.0;
+static uint64_t simBandwidthBits = 0;
+static unsigned int simMtu = 1472; // a 1500 byte Ethernet MTU less IPv4 and UDP headers
+static double simNatPercent = 0.0;
+static SimNat simNatType = SIM_NAT_RESTRICTED;
+static unsigned int simTargets = 1;
+static uint64_t simSeed = 1;
+static const char *simIdentityCache = (const char *)0;
+
+static inline uint64_t nowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline uint64_t simEndpoint(const uint32_t ip,const unsigned int port) { return (((uint64_t)ip << 16) | (uint64_t)(port & 0xffff)); }
+
+struct Simulation;
+
+struct SimNode
+{
+	Simulation *sim;
+	unsigned int index;
+	SimRole role;
+	SimNat nat;
+	ZT_Node *node;
+	Identity id;
+	std::string secret; // identity.secret served by stateGet
+	std::string pub;
+	uint32_t ip;
+	int64_t startAt;
+	int64_t configuredAt; // -1 until the network is up
+	int64_t deadline; // next background task deadline
+	bool joined;
+	uint64_t framesReceived;
+	uint64_t broadcastsReceived;
+	std::vector<unsigned int> targets;
+
+	// Guarded by the simulation's wire lock
+	uint64_t txFreeAtUs; // when the uplink will have sent everything queued
+	uint16_t nextPort;
+	std::unordered_map<uint64_t,uint16_t> natOut; // symmetric: destination to mapped port
+	std::unordered_map<uint16_t,uint64_t> natIn; // symmetric: mapped port to destination
+	std::unordered_set<uint64_t> natSent; // restricted: endpoints sent to
+};
+
+struct SimPacket
+{
+	int64_t at;
+	uint64_t seq;
+	unsigned int to;
+	unsigned int toPort;
+	uint64_t from; // source endpoint after the sender's NAT
+	std::string data;
+};
+
+struct SimPacketLater
+{
+	inline bool operator()(const SimPacket *a,const SimPacket *b) const { return ((a->at > b->at)||((a->at == b->at)&&(a->seq > b->seq))); }
+};
+
+enum SimTimerType
+{
+	SIM_TIMER_BACKGROUND = 0,
+	SIM_TIMER_FRAMES = 1
+};
+
+struct SimTimer
+{
+	SimTimer(const int64_t a,const unsigned int i,const SimTimerType t) : at(a),index(i),type(t) {}
+	int64_t at;
+	unsigned int index;
+	SimTimerType type;
+	inline bool operator<(const SimTimer &t) const { return (at > t.at); } // for a min-heap
+};
+
+struct SimWireStats
+{
+	SimWireStats() { memset(this,0,sizeof(SimWireStats)); }
+	uint64_t packets[3]; // sent, by sender role
+	uint64_t bytes[3];
+	uint64_t delivered[3]; // delivered, by receiver role
+	uint64_t deliveredBytes[3];
+	uint64_t lossDrops;
+	uint64_t queueDrops;
+	uint64_t mtuDrops;
+	uint64_t natDrops;
+	uint64_t unreachable;
+};
+
+struct Simulation
+{
+	Simulation() :
+		nwid(0),
+		now(0),
+		seq(0),
+		rng(0),
+		configured(0),
+		controller((EmbeddedNetworkController *)0),
+		sending(false),
+		rootNs(0),
+		framesSent(0),
+		framesReceived(0),
+		broadcastsReceived(0) {}
+
+	std::vector<SimNode> nodes;
+	std::string planet;
+	uint64_t nwid;
+	std::atomic<int64_t> now;
+
+	// Packets in flight, pushed by any thread (the controller answers from its own)
+	std::mutex wireLock;
+	std::condition_variable wireCond;
+	std::vector<SimPacket *> wire; // heap ordered by SimPacketLater
+	uint64_t seq;
+	uint64_t rng; // wire randomness, guarded by wireLock
+	SimWireStats stats;
+
+	// Everything from here is touched only by the main thread
+	std::vector<SimTimer> timers; // heap
+	unsigned int configured;
+	EmbeddedNetworkController *controller;
+	bool sending;
+	uint64_t rootNs; // real time spent in calls into roots
+	uint64_t framesSent;
+	uint64_t framesReceived;
+	uint64_t broadcastsReceived;
+};
+
+static inline uint64_t simRandom(uint64_t &s)
+{
+	// xorshift64*
+	s ^= s >> 12;
+	s ^= s << 25;
+	s ^= s >> 27;
+	return s * 0x2545f4914f6cdd1dULL;
+}
+
+static inline void simTimer(Simulation &sim,const int64_t at,const unsigned int index,const SimTimerType type)
+{
+	sim.timers.push_back(SimTimer(at,index,type));
+	std::push_heap(sim.timers.begin(),sim.timers.end());
+}
+
+// Lowers a node's background task deadline if a call asked for an earlier one
+static inline void simDeadline(Simulation &sim,SimNode &n,const int64_t dl)
+{
+	const int64_t d = std::max(dl,sim.now.load(std::memory_order_relaxed));
+	if (d < n.deadline) {
+		n.deadline = d;
+		simTimer(sim,d,n.index,SIM_TIMER_BACKGROUND);
+	}
+}
+
+static int simStateGet(ZT_Node *,void *uptr,void *,enum ZT_StateObjectType type,const uint64_t [2],void *data,unsigned int maxlen)
+{
+	const SimNode *const n = reinterpret_cast<const SimNode *>(uptr);
+	const std::string *s;
+	switch(type) {
+		case ZT_STATE_OBJECT_IDENTITY_SECRET: s = &(n->secret); break;
+		case ZT_STATE_OBJECT_IDENTITY_PUBLIC: s = &(n->pub); break;
+		case ZT_STATE_OBJECT_PLANET: s = &(n->sim->planet); break;
+		default: return -1;
+	}
+	if ((s->length() == 0)||(s->length() > maxlen))
+		return -1;
+	memcpy(data,s->data(),s->length());
+	return (int)s->length();
+}
+static void simStatePut(ZT_Node *,void *,void *,enum ZT_StateObjectType,const uint64_t [2],const void *,int) {}
+
+static int simWireSend(ZT_Node *,void *uptr,void *,int64_t,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int)
+{
+	SimNode *const src = reinterpret_cast<SimNode *>(uptr);
+	Simulation &sim = *(src->sim);
+	const InetAddress &to = *reinterpret_cast<const InetAddress *>(addr);
+	if (to.ss_family != AF_INET)
+		return -1;
+	const uint32_t ip = Utils::ntoh(*reinterpret_cast<const uint32_t *>(to.rawIpData()));
+	const unsigned int port = to.port();
+	const int64_t now = sim.now.load(std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> l(sim.wireLock);
+	sim.stats.packets[src->role] += 1;
+	sim.stats.bytes[src->role] += len;
+
+	if ((ip < ZT_SIMULATOR_IP_BASE)||((ip & 0xff) != (ZT_SIMULATOR_IP_BASE & 0xff))||(((ip - ZT_SIMULATOR_IP_BASE) >> 8) >= sim.nodes.size())) {
+		++sim.stats.unreachable;
+		return 0;
+	}
+
+	// Map the source through its NAT, if any
+	const uint64_t remote = simEndpoint(ip,port);
+	unsigned int sport = ZT_SIMULATOR_PORT;
+	switch(src->nat) {
+		case SIM_NAT_NONE:
+			break;
+		case SIM_NAT_CONE:
+			sport = ZT_SIMULATOR_NAT_PORT_BASE;
+			break;
+		case SIM_NAT_RESTRICTED:
+			sport = ZT_SIMULATOR_NAT_PORT_BASE;
+			src->natSent.insert(remote);
+			break;
+		case SIM_NAT_SYMMETRIC: {
+			std::unordered_map<uint64_t,uint16_t>::const_iterator m(src->natOut.find(remote));
+			if (m == src->natOut.end()) {
+				sport = ZT_SIMULATOR_NAT_PORT_BASE + (src->nextPort++ % ZT_SIMULATOR_NAT_PORTS);
+				src->natOut[remote] = (uint16_t)sport;
+				src->natIn[(uint16_t)sport] = remote;
+			} else sport = m->second;
+		}	break;
+	}
+
+	if (len > simMtu) {
+		++sim.stats.mtuDrops;
+		return 0;
+	}
+	if ((simLossPercent > 0.0)&&(((double)(simRandom(sim.rng) % 1000000) / 10000.0) < simLossPercent)) {
+		++sim.stats.lossDrops;
+		return 0;
+	}
+
+	int64_t at = now;
+	if ((simBandwidthBits)&&(src->role == SIM_ROLE_LEAF)) {
+		const uint64_t nowUs = (uint64_t)now * 1000ULL;
+		const uint64_t startUs = std::max(nowUs,src->txFreeAtUs);
+		if ((startUs - nowUs) > (ZT_SIMULATOR_MAX_QUEUE_MS * 1000ULL)) {
+			++sim.stats.queueDrops;
+			return 0;
+		}
+		src->txFreeAtUs = startUs + (((uint64_t)len * 8000000ULL) / simBandwidthBits);
+		at = (int64_t)(src->txFreeAtUs / 1000ULL);
+	}
+	at += (int64_t)simLatencyMs;
+	if (simJitterMs)
+		at += (int64_t)(simRandom(sim.rng) % simJitterMs);
+
+	SimPacket *const p = new SimPacket();
+	p->at = at;
+	p->seq = sim.seq++;
+	p->to = (ip - ZT_SIMULATOR_IP_BASE) >> 8;
+	p->toPort = port;
+	p->from = simEndpoint(src->ip,sport);
+	p->data.assign(reinterpret_cast<const char *>(data),len);
+	sim.wire.push_back(p);
+	std::push_heap(sim.wire.begin(),sim.wire.end(),SimPacketLater());
+	sim.wireCond.notify_one();
+	return 0;
+}
+
+static void simFrame(ZT_Node *,void *uptr,void *,uint64_t,void **,uint64_t,uint64_t dstMac,unsigned int,unsigned int,const void *,unsigned int)
+{
+	SimNode *const n = reinterpret_cast<SimNode *>(uptr);
+	if (dstMac == 0xffffffffffffULL) {
+		if (!n->broadcastsReceived++)
+			++n->sim->broadcastsReceived;
+	} else {
+		++n->framesReceived;
+		++n->sim->framesReceived;
+	}
+}
+
+static int simNetworkConfig(ZT_Node *,void *uptr,void *,uint64_t,void **,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nc)
+{
+	SimNode *const n = reinterpret_cast<SimNode *>(uptr);
+	if ((nc)&&(op != ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY)&&(nc->status == ZT_NETWORK_STATUS_OK)&&(n->configuredAt < 0)) {
+		n->configuredAt = n->sim->now.load(std::memory_order_relaxed);
+		++n->sim->configured;
+	}
+	return 0;
+}
+
+static void simEvent(ZT_Node *,void *,void *,enum ZT_Event,const void *) {}
+
+// Takes the next packet due by now off the wire, applying the receiver's NAT, or returns NULL
+static SimPacket *simNextPacket(Simulation &sim,const int64_t now)
+{
+	std::lock_guard<std::mutex> l(sim.wireLock);
+	while ((!sim.wire.empty())&&(sim.wire.front()->at <= now)) {
+		std::pop_heap(sim.wire.begin(),sim.wire.end(),SimPacketLater());
+		SimPacket *const p = sim.wire.back();
+		sim.wire.pop_back();
+		const SimNode &n = sim.nodes[p->to];
+		bool pass = false;
+		switch(n.nat) {
+			case SIM_NAT_NONE:
+				pass = (p->toPort == ZT_SIMULATOR_PORT);
+				break;
+			case SIM_NAT_CONE:
+				pass = (p->toPort == ZT_SIMULATOR_NAT_PORT_BASE);
+				break;
+			case SIM_NAT_RESTRICTED:
+				pass = ((p->toPort == ZT_SIMULATOR_NAT_PORT_BASE)&&(n.natSent.count(p->from) > 0));
+				break;
+			case SIM_NAT_SYMMETRIC: {
+				std::unordered_map<uint16_t,uint64_t>::const_iterator m(n.natIn.find((uint16_t)p->toPort));
+				pass = ((m != n.natIn.end())&&(m->second == p->from));
+			}	break;
+		}
+		if (pass) {
+			sim.stats.delivered[n.role] += 1;
+			sim.stats.deliveredBytes[n.role] += p->data.length();
+			return p;
+		}
+		++sim.stats.natDrops;
+		delete p;
+	}
+	return (SimPacket *)0;
+}
+
+static void simSendFrames(Simulation &sim,SimNode &n,const int64_t now)
+{
+	// IPv4 UDP, contents don't matter since the network accepts everything
+	uint8_t frame[ZT_SIMULATOR_FRAME_BYTES];
+	memset(frame,0,sizeof(frame));
+	frame[0] = 0x45;
+	frame[3] = ZT_SIMULATOR_FRAME_BYTES;
+	frame[8] = 64;
+	frame[9] = 0x11;
+	const MAC src(n.id.address(),sim.nwid);
+	volatile int64_t dl = n.deadline;
+	for(std::vector<unsigned int>::const_iterator t(n.targets.begin());t!=n.targets.end();++t) {
+		const MAC dst(sim.nodes[*t].id.address(),sim.nwid);
+		ZT_Node_processVirtualNetworkFrame(n.node,(void *)0,now,sim.nwid,src.toInt(),dst.toInt(),ZT_ETHERTYPE_IPV4,0,frame,sizeof(frame),&dl);
+		++sim.framesSent;
+	}
+	simDeadline(sim,n,dl);
+}
+
+/*
+ * Runs the simulation until the given time, or until every leaf is
+ * configured if converging (in which case idle time passes in real time,
+ * since that's how the controller answers).
+ */
+static void simRun(Simulation &sim,const int64_t until,const bool converging)
+{
+	for(;;) {
+		const int64_t now = sim.now.load(std::memory_order_relaxed);
+		if ((now >= until)||((converging)&&(sim.configured >= simLeaves)))
+			return;
+
+		SimPacket *const p = simNextPacket(sim,now);
+		if (p) {
+			SimNode &n = sim.nodes[p->to];
+			const InetAddress from(Utils::hton((uint32_t)(p->from >> 16)),(unsigned int)(p->from & 0xffff));
+			volatile int64_t dl = n.deadline;
+			const uint64_t start = (n.role == SIM_ROLE_ROOT) ? nowNs() : 0;
+			ZT_Node_processWirePacket(n.node,(void *)0,now,1,reinterpret_cast<const struct sockaddr_storage *>(&from),p->data.data(),(unsigned int)p->data.length(),&dl);
+			if (start)
+				sim.rootNs += nowNs() - start;
+			simDeadline(sim,n,dl);
+			delete p;
+			continue;
+		}
+
+		if ((!sim.timers.empty())&&(sim.timers.front().at <= now)) {
+			std::pop_heap(sim.timers.begin(),sim.timers.end());
+			const SimTimer t(sim.timers.back());
+			sim.timers.pop_back();
+			SimNode &n = sim.nodes[t.index];
+			if (t.type == SIM_TIMER_BACKGROUND) {
+				if (t.at != n.deadline)
+					continue; // superseded by an earlier deadline
+				if ((n.role == SIM_ROLE_LEAF)&&(!n.joined)) {
+					ZT_Node_join(n.node,sim.nwid,(void *)&n,(void *)0);
+					n.joined = true;
+				}
+				volatile int64_t dl = 0;
+				const uint64_t start = (n.role == SIM_ROLE_ROOT) ? nowNs() : 0;
+				ZT_Node_processBackgroundTasks(n.node,(void *)0,now,&dl);
+				if (start)
+					sim.rootNs += nowNs() - start;
+				n.deadline = std::max((int64_t)dl,now + 1);
+				simTimer(sim,n.deadline,n.index,SIM_TIMER_BACKGROUND);
+			} else if (sim.sending) {
+				simSendFrames(sim,n,now);
+				simTimer(sim,t.at + ZT_SIMULATOR_FRAME_INTERVAL_MS,t.index,SIM_TIMER_FRAMES);
+			}
+			continue;
+		}
+
+		int64_t next = until;
+		{
+			std::unique_lock<std::mutex> l(sim.wireLock);
+			if (!sim.wire.empty())
+				next = std::min(next,sim.wire.front()->at);
+			if (!sim.timers.empty())
+				next = std::min(next,sim.timers.front().at);
+			if ((converging)&&(next > (now + ZT_SIMULATOR_IDLE_STEP_MS))) {
+				sim.wireCond.wait_for(l,std::chrono::milliseconds(ZT_SIMULATOR_IDLE_STEP_MS));
+				next = now + ZT_SIMULATOR_IDLE_STEP_MS;
+			}
+		}
+		sim.now.store(std::max(next,now + 1),std::memory_order_relaxed);
+	}
+}
+
+// Fills ids from the cache file if any, generating (on all cores) and caching whatever is missing
+static void simIdentities(std::vector<Identity> &ids,const unsigned int count)
+{
+	if (simIdentityCache) {
+		FILE *f = fopen(simIdentityCache,"r");
+		if (f) {
+			char line[1024];
+			while ((ids.size() < count)&&(fgets(line,sizeof(line),f))) {
+				line[strcspn(line,"\r\n")] = (char)0;
+				Identity id;
+				if ((id.fromString(line))&&(id.hasPrivate()))
+					ids.push_back(id);
+			}
+			fclose(f);
+		}
+	}
+
+	const unsigned int have = (unsigned int)ids.size();
+	if (have >= count)
+		return;
+	ids.resize(count);
+	std::atomic<unsigned int> next(have);
+	std::vector<std::thread> threads;
+	for(unsigned int t=0,tc=std::max(std::thread::hardware_concurrency(),1U);t<tc;++t) {
+		threads.push_back(std::thread([&ids,&next,count]() {
+			for(unsigned int i=next++;i<count;i=next++)
+				ids[i].generate();
+		}));
+	}
+	for(std::vector<std::thread>::iterator t(threads.begin());t!=threads.end();++t)
+		t->join();
+
+	if (simIdentityCache) {
+		FILE *f = fopen(simIdentityCache,"a");
+		if (f) {
+			char tmp[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+			for(unsigned int i=have;i<count;++i)
+				fprintf(f,"%s\n",ids[i].toString(true,tmp));
+			fclose(f);
+		}
+	}
+}
+
+static uint64_t simMaxRssKb()
+{
+#ifdef __WINDOWS__
+	return 0;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF,&ru) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (uint64_t)ru.ru_maxrss / 1024; // bytes on macOS
+#else
+	return (uint64_t)ru.ru_maxrss;
+#endif
+#endif
+}
+
+static void simPrintVerbs(const char *name,const ZT_Metrics &a,const ZT_Metrics &b)
+{
+	printf("  \"%s\":{\"hello\":%llu,\"whois\":%llu,\"rendezvous\":%llu,\"multicastLike\":%llu,\"multicastGather\":%llu,\"networkConfigRequest\":%llu,\"frame\":%llu,\"extFrame\":%llu},\n",
+		name,
+		(unsigned long long)(b.packetsIn[Packet::VERB_HELLO] - a.packetsIn[Packet::VERB_HELLO]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_WHOIS] - a.packetsIn[Packet::VERB_WHOIS]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_RENDEZVOUS] - a.packetsIn[Packet::VERB_RENDEZVOUS]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_MULTICAST_LIKE] - a.packetsIn[Packet::VERB_MULTICAST_LIKE]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_MULTICAST_GATHER] - a.packetsIn[Packet::VERB_MULTICAST_GATHER]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_NETWORK_CONFIG_REQUEST] - a.packetsIn[Packet::VERB_NETWORK_CONFIG_REQUEST]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_FRAME] - a.packetsIn[Packet::VERB_FRAME]),
+		(unsigned long long)(b.packetsIn[Packet::VERB_EXT_FRAME] - a.packetsIn[Packet::VERB_EXT_FRAME]));
+}
+
+int main(int argc,char **argv)
+{
+	for(int i=1;i<argc;++i) {
+		if ((!strcmp(argv[i],"-r"))&&((i + 1) < argc)) {
+			simRoots = (unsigned int)std::min(ZT_WORLD_MAX_ROOTS,std::max(1,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-n"))&&((i + 1) < argc)) {
+			simLeaves = (unsigned int)std::min(ZT_SIMULATOR_MAX_LEAVES,std::max(2,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-d"))&&((i + 1) < argc)) {
+			simDurationMs = (int64_t)std::max(0,atoi(argv[++i])) * 1000;
+		} else if ((!strcmp(argv[i],"-w"))&&((i + 1) < argc)) {
+			simConvergeMs = (int64_t)std::max(1,atoi(argv[++i])) * 1000;
+		} else if ((!strcmp(argv[i],"-S"))&&((i + 1) < argc)) {
+			simSpreadMs = (int64_t)std::max(0,atoi(argv[++i])) * 1000;
+		} else if ((!strcmp(argv[i],"-l"))&&((i + 1) < argc)) {
+			simLatencyMs = (unsigned int)std::max(0,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-j"))&&((i + 1) < argc)) {
+			simJitterMs = (unsigned int)std::max(0,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-L"))&&((i + 1) < argc)) {
+			simLossPercent = std::min(100.0,std::max(0.0,atof(argv[++i])));
+		} else if ((!strcmp(argv[i],"-b"))&&((i + 1) < argc)) {
+			simBandwidthBits = (uint64_t)std::max(0,atoi(argv[++i])) * 1000ULL;
+		} else if ((!strcmp(argv[i],"-m"))&&((i + 1) < argc)) {
+			simMtu = (unsigned int)std::min(ZT_MAX_PHYSMTU,std::max(576,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-N"))&&((i + 1) < argc)) {
+			simNatPercent = std::min(100.0,std::max(0.0,atof(argv[++i])));
+		} else if ((!strcmp(argv[i],"-T"))&&((i + 1) < argc)) {
+			++i;
+			if (!strcmp(argv[i],"cone"))
+				simNatType = SIM_NAT_CONE;
+			else if (!strcmp(argv[i],"symmetric"))
+				simNatType = SIM_NAT_SYMMETRIC;
+			else simNatType = SIM_NAT_RESTRICTED;
+		} else if ((!strcmp(argv[i],"-u"))&&((i + 1) < argc)) {
+			simTargets = (unsigned int)std::min(ZT_SIMULATOR_MAX_TARGETS,std::max(0,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-s"))&&((i + 1) < argc)) {
+			simSeed = Utils::strToU64(argv[++i]);
+		} else if ((!strcmp(argv[i],"-i"))&&((i + 1) < argc)) {
+			simIdentityCache = argv[++i];
+		} else {
+			fprintf(stderr,"Usage: %s [-r <roots>] [-n <leaves>] [-d <seconds>] [-w <seconds>] [-S <seconds>] [-l <ms>] [-j <ms>] [-L <percent>] [-b <kbit/s>] [-m <bytes>] [-N <percent>] [-T cone|restricted|symmetric] [-u <peers>] [-s <seed>] [-i <identity cache>]" ZT_EOL_S,argv[0]);
+			return 1;
+		}
+	}
+	simTargets = std::min(simTargets,simLeaves - 1);
+
+	Simulation *const simp = new Simulation();
+	Simulation &sim = *simp;
+	uint64_t rng = simSeed ^ 0x9e3779b97f4a7c15ULL;
+	sim.rng = simRandom(rng) | 1;
+	const unsigned int nodeCount = simRoots + 1 + simLeaves;
+
+	const uint64_t setupStart = nowNs();
+	std::vector<Identity> ids;
+	simIdentities(ids,nodeCount);
+	const uint64_t identityNs = nowNs() - setupStart;
+
+	// A private planet whose roots are the first nodes
+	std::vector<World::Root> roots;
+	for(unsigned int i=0;i<simRoots;++i) {
+		roots.push_back(World::Root());
+		roots.back().identity = ids[i]; // serialized without its secret
+		roots.back().stableEndpoints.push_back(InetAddress(Utils::hton((uint32_t)(ZT_SIMULATOR_IP_BASE + (i << 8))),ZT_SIMULATOR_PORT));
+	}
+	{
+		const C25519::Pair planetKey(C25519::generate());
+		const World planet(World::make(World::TYPE_PLANET,ZT_SIMULATOR_PLANET_ID,1,planetKey.pub,roots,planetKey));
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> tmp;
+		planet.serialize(tmp,false);
+		sim.planet.assign(reinterpret_cast<const char *>(tmp.data()),tmp.size());
+	}
+	sim.nwid = (ids[simRoots].address().toInt() << 24) | 0x000001ULL;
+
+	ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.stateGetFunction = simStateGet;
+	cb.statePutFunction = simStatePut;
+	cb.wirePacketSendFunction = simWireSend;
+	cb.virtualNetworkFrameFunction = simFrame;
+	cb.virtualNetworkConfigFunction = simNetworkConfig;
+	cb.eventCallback = simEvent;
+
+	const int64_t start = OSUtils::now();
+	sim.now = start;
+	const uint64_t rssBeforeKb = simMaxRssKb();
+	unsigned int natted = 0;
+	sim.nodes.resize(nodeCount);
+	for(unsigned int i=0;i<nodeCount;++i) {
+		SimNode &n = sim.nodes[i];
+		n.sim = &sim;
+		n.index = i;
+		n.role = (i < simRoots) ? SIM_ROLE_ROOT : ((i == simRoots) ? SIM_ROLE_CONTROLLER : SIM_ROLE_LEAF);
+		n.nat = SIM_NAT_NONE;
+		if ((n.role == SIM_ROLE_LEAF)&&(((double)(simRandom(rng) % 1000000) / 10000.0) < simNatPercent)) {
+			n.nat = simNatType;
+			++natted;
+		}
+		n.node = (ZT_Node *)0;
+		n.id = ids[i];
+		char tmp[ZT_IDENTITY_STRING_BUFFER_LENGTH];
+		n.secret = n.id.toString(true,tmp);
+		n.pub = n.id.toString(false,tmp);
+		n.ip = ZT_SIMULATOR_IP_BASE + (i << 8);
+		n.startAt = ((n.role == SIM_ROLE_LEAF)&&(simSpreadMs > 0)) ? (start + (int64_t)(simRandom(rng) % (uint64_t)simSpreadMs)) : start;
+		n.configuredAt = -1;
+		n.deadline = n.startAt;
+		n.joined = false;
+		n.framesReceived = 0;
+		n.broadcastsReceived = 0;
+		n.txFreeAtUs = 0;
+		n.nextPort = (uint16_t)(simRandom(rng) % ZT_SIMULATOR_NAT_PORTS);
+		if (ZT_Node_new(&(n.node),(void *)&n,(void *)0,&cb,start) != ZT_RESULT_OK) {
+			fprintf(stderr,"FATAL: unable to create node %u" ZT_EOL_S,i);
+			return 1;
+		}
+		simTimer(sim,n.deadline,i,SIM_TIMER_BACKGROUND);
+	}
+	const uint64_t rssAfterKb = simMaxRssKb();
+	ids.clear();
+
+	SimNode &cn = sim.nodes[simRoots];
+	sim.controller = new EmbeddedNetworkController(reinterpret_cast<Node *>(cn.node),"memory:");
+	ZT_Node_setNetconfMaster(cn.node,(void *)sim.controller);
+	{
+		char nwids[24];
+		OSUtils::ztsnprintf(nwids,sizeof(nwids),"%.16llx",(unsigned long long)sim.nwid);
+		std::vector<std::string> path;
+		path.push_back("network");
+		path.push_back(nwids);
+		std::map<std::string,std::string> args,headers;
+		std::string body("{\"name\":\"simulator\",\"private\":false}"),responseBody,responseContentType;
+		if (sim.controller->handleControlPlaneHttpPOST(path,args,headers,body,responseBody,responseContentType) != 200) {
+			fprintf(stderr,"FATAL: unable to create network %s" ZT_EOL_S,nwids);
+			return 1;
+		}
+	}
+
+	for(unsigned int i=simRoots+1;i<nodeCount;++i) {
+		SimNode &n = sim.nodes[i];
+		while (n.targets.size() < simTargets) {
+			const unsigned int t = simRoots + 1 + (unsigned int)(simRandom(rng) % simLeaves);
+			if ((t != i)&&(std::find(n.targets.begin(),n.targets.end(),t) == n.targets.end()))
+				n.targets.push_back(t);
+		}
+	}
+
+	ZT_Metrics *const m0 = new ZT_Metrics();
+	ZT_Metrics *const m1 = new ZT_Metrics();
+	ZT_Metrics *const m2 = new ZT_Metrics();
+	ZT_Node_metrics(cn.node,m0);
+
+	// Phase one: everyone starts and leaves get their configs
+	const uint64_t convergeStart = nowNs();
+	simRun(sim,start + simSpreadMs + simConvergeMs,true);
+	const uint64_t convergeNs = nowNs() - convergeStart;
+	const int64_t converged = sim.now.load();
+	const uint64_t convergeRootNs = sim.rootNs;
+	ZT_Node_metrics(cn.node,m1);
+	SimWireStats convergeStats;
+	{
+		std::lock_guard<std::mutex> l(sim.wireLock);
+		convergeStats = sim.stats;
+	}
+
+	std::vector<int64_t> configTimes;
+	for(unsigned int i=simRoots+1;i<nodeCount;++i) {
+		if (sim.nodes[i].configuredAt >= 0)
+			configTimes.push_back(sim.nodes[i].configuredAt - sim.nodes[i].startAt);
+	}
+	std::sort(configTimes.begin(),configTimes.end());
+
+	// Phase two: steady state with unicast traffic and one broadcast
+	sim.rootNs = 0;
+	sim.sending = true;
+	for(unsigned int i=simRoots+1;i<nodeCount;++i) {
+		if (!sim.nodes[i].targets.empty())
+			simTimer(sim,converged + (int64_t)(simRandom(rng) % ZT_SIMULATOR_FRAME_INTERVAL_MS),i,SIM_TIMER_FRAMES);
+	}
+	{
+		SimNode &b = sim.nodes[simRoots + 1];
+		uint8_t frame[ZT_SIMULATOR_FRAME_BYTES];
+		memset(frame,0,sizeof(frame));
+		volatile int64_t dl = b.deadline;
+		ZT_Node_processVirtualNetworkFrame(b.node,(void *)0,converged,sim.nwid,MAC(b.id.address(),sim.nwid).toInt(),0xffffffffffffULL,ZT_ETHERTYPE_IPV4,0,frame,sizeof(frame),&dl);
+		simDeadline(sim,b,dl);
+	}
+	const uint64_t steadyStart = nowNs();
+	simRun(sim,converged + simDurationMs,false);
+	sim.sending = false;
+	const uint64_t steadyNs = nowNs() - steadyStart;
+	const int64_t steadyMs = sim.now.load() - converged;
+	ZT_Node_metrics(cn.node,m2);
+	SimWireStats stats;
+	{
+		std::lock_guard<std::mutex> l(sim.wireLock);
+		stats = sim.stats;
+	}
+
+	// Root peer counts, and how leaves reach the leaves they send to
+	uint64_t rootPeers = 0;
+	for(unsigned int i=0;i<simRoots;++i) {
+		ZT_PeerList *pl = ZT_Node_peers(sim.nodes[i].node);
+		if (pl) {
+			rootPeers += pl->peerCount;
+			ZT_Node_freeQueryResult(sim.nodes[i].node,pl);
+		}
+	}
+	uint64_t pairs = 0,directPairs = 0,unicastOut = 0,unicastRelayedOut = 0;
+	for(unsigned int i=simRoots+1;i<nodeCount;++i) {
+		SimNode &n = sim.nodes[i];
+		if (n.targets.empty())
+			continue;
+		pairs += n.targets.size();
+		ZT_PeerList *pl = ZT_Node_peers(n.node);
+		if (!pl)
+			continue;
+		for(unsigned long p=0;p<pl->peerCount;++p) {
+			for(std::vector<unsigned int>::const_iterator t(n.targets.begin());t!=n.targets.end();++t) {
+				if (pl->peers[p].address == sim.nodes[*t].id.address().toInt()) {
+					unicastOut += pl->peers[p].packetsOut;
+					unicastRelayedOut += pl->peers[p].relayedPacketsOut;
+					for(unsigned int k=0;k<pl->peers[p].pathCount;++k) {
+						if (!pl->peers[p].paths[k].expired) {
+							++directPairs;
+							break;
+						}
+					}
+				}
+			}
+		}
+		ZT_Node_freeQueryResult(n.node,pl);
+	}
+
+	printf("{\n  \"version\":\"%d.%d.%d\",\n",ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION);
+	printf("  \"roots\":%u,\n  \"leaves\":%u,\n  \"nattedLeaves\":%u,\n  \"natType\":\"%s\",\n  \"latencyMs\":%u,\n  \"jitterMs\":%u,\n  \"lossPercent\":%.3f,\n  \"leafUplinkKbps\":%llu,\n  \"wireMtu\":%u,\n  \"seed\":%llu,\n  \"identitySetupMs\":%llu,\n",
+		simRoots,simLeaves,natted,(simNatType == SIM_NAT_CONE) ? "cone" : ((simNatType == SIM_NAT_SYMMETRIC) ? "symmetric" : "restricted"),
+		simLatencyMs,simJitterMs,simLossPercent,(unsigned long long)(simBandwidthBits / 1000ULL),simMtu,(unsigned long long)simSeed,(unsigned long long)(identityNs / 1000000ULL));
+	printf("  \"convergence\":{\"configured\":%u,\"simulatedMs\":%lld,\"realMs\":%llu,\"medianConfigMs\":%lld,\"p99ConfigMs\":%lld,\"rootCpuMs\":%.3f,\"wirePackets\":%llu},\n",
+		sim.configured,(long long)(converged - start),(unsigned long long)(convergeNs / 1000000ULL),
+		(long long)((configTimes.empty()) ? -1 : configTimes[configTimes.size() / 2]),
+		(long long)((configTimes.empty()) ? -1 : configTimes[std::min(configTimes.size() - 1,(configTimes.size() * 99) / 100)]),
+		(double)convergeRootNs / 1000000.0,
+		(unsigned long long)(convergeStats.packets[0] + convergeStats.packets[1] + convergeStats.packets[2]));
+	simPrintVerbs("convergenceVerbsReceived",*m0,*m1);
+	printf("  \"steady\":{\"simulatedMs\":%lld,\"realMs\":%llu,\"framesSent\":%llu,\"framesReceived\":%llu,\"pairs\":%llu,\"directPairs\":%llu,\"unicastPacketsOut\":%llu,\"unicastRelayedOut\":%llu,\"broadcastReceivers\":%llu},\n",
+		(long long)steadyMs,(unsigned long long)(steadyNs / 1000000ULL),
+		(unsigned long long)sim.framesSent,(unsigned long long)sim.framesReceived,
+		(unsigned long long)pairs,(unsigned long long)directPairs,(unsigned long long)unicastOut,(unsigned long long)unicastRelayedOut,
+		(unsigned long long)sim.broadcastsReceived);
+	simPrintVerbs("steadyVerbsReceived",*m1,*m2);
+	printf("  \"root\":{\"peers\":%llu,\"steadyCpuNsPerPeerSecond\":%.1f,\"packetsIn\":%llu,\"bytesIn\":%llu,\"packetsOut\":%llu,\"bytesOut\":%llu},\n",
+		(unsigned long long)rootPeers,
+		((rootPeers)&&(steadyMs > 0)) ? ((double)sim.rootNs / ((double)rootPeers * ((double)steadyMs / 1000.0))) : 0.0,
+		(unsigned long long)stats.delivered[SIM_ROLE_ROOT],(unsigned long long)stats.deliveredBytes[SIM_ROLE_ROOT],
+		(unsigned long long)stats.packets[SIM_ROLE_ROOT],(unsigned long long)stats.bytes[SIM_ROLE_ROOT]);
+	printf("  \"controller\":{\"packetsIn\":%llu,\"bytesIn\":%llu,\"packetsOut\":%llu,\"bytesOut\":%llu},\n",
+		(unsigned long long)stats.delivered[SIM_ROLE_CONTROLLER],(unsigned long long)stats.deliveredBytes[SIM_ROLE_CONTROLLER],
+		(unsigned long long)stats.packets[SIM_ROLE_CONTROLLER],(unsigned long long)stats.bytes[SIM_ROLE_CONTROLLER]);
+	printf("  \"wire\":{\"packets\":%llu,\"bytes\":%llu,\"lossDrops\":%llu,\"queueDrops\":%llu,\"mtuDrops\":%llu,\"natDrops\":%llu,\"unreachable\":%llu},\n",
+		(unsigned long long)(stats.packets[0] + stats.packets[1] + stats.packets[2]),(unsigned long long)(stats.bytes[0] + stats.bytes[1] + stats.bytes[2]),
+		(unsigned long long)stats.lossDrops,(unsigned long long)stats.queueDrops,(unsigned long long)stats.mtuDrops,(unsigned long long)stats.natDrops,(unsigned long long)stats.unreachable);
+	printf("  \"memory\":{\"maxRssKb\":%llu,\"nodeCreationKb\":%llu,\"bytesPerNode\":%llu}\n}\n",
+		(unsigned long long)simMaxRssKb(),(unsigned long long)(rssAfterKb - rssBeforeKb),(unsigned long long)(((rssAfterKb - rssBeforeKb) * 1024ULL) / nodeCount));
+	fflush(stdout);
+	const int rc = (sim.configured >= simLeaves) ? 0 : 2;
+
+	ZT_Node_setNetconfMaster(cn.node,(void *)0);
+	delete sim.controller;
+	for(std::vector<SimNode>::iterator n(sim.nodes.begin());n!=sim.nodes.end();++n)
+		ZT_Node_delete(n->node);
+	for(std::vector<SimPacket *>::iterator p(sim.wire.begin());p!=sim.wire.end();++p)
+		delete *p;
+	delete m0;
+	delete m1;
+	delete m2;
+	delete simp;
+
+	return rc;
+}
@@ -0,0 +1,622 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+/*
+ * TCP fallback relay.
+ *
+ * Accepts the TCP tunnels nodes open when they can't reach the Internet
+ * over UDP (see _tcpFallbackSend() in service/OneService.cpp) and relays
+ * the datagrams in them to and from UDP. Each tunnel gets its own UDP
+ * socket on an ephemeral port, so replies come back to the right client
+ * without any lookup. Tunnel messages look like TLS 1.2 application data
+ * records:
+ *
+ *   <[3] 0x17 0x03 0x03> <[2] length> <[1] address type> <address> <payload>
+ *
+ * The address type is 4 (IPv4 address and port, 6 bytes) or 6 (IPv6
+ * address and port, 18 bytes), and is the destination on the way in and the
+ * source on the way out. A 4-byte message is the client's version hello.
+ *
+ * Everything runs in one thread on Phy<>, which uses epoll on Linux and
+ * kqueue on BSD and macOS. All messages parsed from one TCP read go out in
+ * one udpSendBatch() (sendmmsg() where available), and all datagrams from
+ * one receive batch go back in one write. Output a client isn't reading is
+ * queued up to a limit per connection, past which new datagrams are
+ * dropped. Each connection takes two descriptors, so the descriptor limit
+ * is raised as far as allowed on startup. With many clients also widen
+ * net.ipv4.ip_local_port_range, since each holds an ephemeral UDP port.
+ *
+ * Usage: zerotier-tcp-proxy [<options>]
+ *
+ *   -p <port>       TCP port to listen on (default 443)
+ *   -b <address>    Address to listen on (default all IPv4 and IPv6)
+ *   -c <count>      Most connections at once (default 65536)
+ *   -q <bytes>      Most output queued for one connection (default 262144)
+ *   -t <seconds>    Close connections that send nothing for this long (default 180)
+ *   -s <path>       Write statistics for every connection here as JSON
+ *   -i <seconds>    Statistics interval (default 10)
+ *   -a              Relay to any address, not just global ones
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+
+#ifndef __WINDOWS__
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+
+#include "../node/Constants.hpp"
+#include "../node/InetAddress.hpp"
+
+#include "../osdep/OSUtils.hpp"
+#include "../osdep/Phy.hpp"
+#include "../osdep/ByteRing.hpp"
+
+#include "../ext/json/json.hpp"
+
+#include "../version.h"
+
+#define ZT_TCP_PROXY_PORT 443
+#define ZT_TCP_PROXY_MAX_CONNECTIONS 65536
+#define ZT_TCP_PROXY_QUEUE_LIMIT 262144
+#define ZT_TCP_PROXY_TIMEOUT 180
+#define ZT_TCP_PROXY_STATS_INTERVAL 10
+
+// Header of a tunnel message plus the longest address
+#define ZT_TCP_PROXY_MAX_HEADER (5 + 19)
+
+// Largest UDP socket buffers asked for
+#define ZT_TCP_PROXY_UDP_BUFFER_SIZE 262144
+
+using namespace ZeroTier;
+
+namespace {
+
+class TcpProxy;
+typedef Phy<TcpProxy *> TcpProxyPhy;
+
+struct TcpProxyClient
+{
+	PhySocket *tcp;
+	PhySocket *udp4; // bound on first use
+	PhySocket *udp6;
+	InetAddress from;
+	std::string readq; // partial message left over from the last read
+	ByteRing writeq; // output the client hasn't taken yet
+	int64_t connected;
+	int64_t lastReceive;
+	uint64_t tcpBytesIn;
+	uint64_t tcpBytesOut;
+	uint64_t udpPacketsOut; // relayed from the client
+	uint64_t udpPacketsIn; // relayed to the client
+	uint64_t dropped; // datagrams to the client dropped with the queue full
+	uint64_t invalid; // messages from the client that couldn't be relayed
+	unsigned long queuedPeak;
+	unsigned int version[3];
+	bool hello;
+};
+
+class TcpProxy
+{
+public:
+	TcpProxy() :
+		phy(this,false,true),
+		queueLimit(ZT_TCP_PROXY_QUEUE_LIMIT),
+		maxConnections(ZT_TCP_PROXY_MAX_CONNECTIONS),
+		anyScope(false),
+		accepted(0),
+		closed(0),
+		refused(0),
+		relayedOut(0),
+		relayedIn(0),
+		dropped(0),
+		invalid(0)
+	{
+	}
+
+	~TcpProxy()
+	{
+		for(std::unordered_set<TcpProxyClient *>::iterator c(clients.begin());c!=clients.end();++c)
+			delete *c;
+	}
+
+	inline void phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from)
+	{
+		if ((!from)||(clients.size() >= maxConnections)) {
+			++refused;
+			phy.close(sockN,false);
+			return;
+		}
+		TcpProxyClient *const c = new TcpProxyClient();
+		c->tcp = sockN;
+		c->from = from;
+		c->connected = c->lastReceive = OSUtils::coarseNow();
+		clients.insert(c);
+		++accepted;
+		*uptrN = (void *)c;
+	}
+
+	inline void phyOnTcpClose(PhySocket *sock,void **uptr)
+	{
+		TcpProxyClient *const c = reinterpret_cast<TcpProxyClient *>(*uptr);
+		if (!c)
+			return;
+		*uptr = (void *)0;
+		phy.close(c->udp4,false);
+		phy.close(c->udp6,false);
+		clients.erase(c);
+		++closed;
+		delete c;
+	}
+
+	inline void phyOnTcpData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+	{
+		TcpProxyClient *const c = reinterpret_cast<TcpProxyClient *>(*uptr);
+		if (!c)
+			return;
+		c->lastReceive = OSUtils::coarseNow();
+		c->tcpBytesIn += len;
+
+		// Messages are parsed where they are and only a trailing partial one is copied
+		const char *p = reinterpret_cast<const char *>(data);
+		unsigned long l = len;
+		if (!c->readq.empty()) {
+			c->readq.append(p,l);
+			p = c->readq.data();
+			l = (unsigned long)c->readq.length();
+		}
+
+		PhyDatagram batch[ZT_PHY_UDP_BATCH_SIZE];
+		struct sockaddr_storage to[ZT_PHY_UDP_BATCH_SIZE];
+		PhySocket *batchSock = (PhySocket *)0;
+		unsigned int count = 0;
+
+		while (l >= 5) {
+			if ((p[0] != 0x17)||(p[1] != 0x03)||(p[2] != 0x03)) {
+				phy.close(sock); // not a tunnel
+				return;
+			}
+			const unsigned long mlen = ((((unsigned long)p[3]) & 0xff) << 8) | (((unsigned long)p[4]) & 0xff);
+			if (l < (mlen + 5))
+				break;
+			const char *const m = p + 5;
+			p += mlen + 5;
+			l -= mlen + 5;
+
+			if (mlen == 4) {
+				c->version[0] = (unsigned int)m[0] & 0xff;
+				c->version[1] = (unsigned int)m[1] & 0xff;
+				c->version[2] = ((((unsigned int)m[2]) & 0xff) << 8) | (((unsigned int)m[3]) & 0xff);
+				c->hello = true;
+				continue;
+			}
+
+			InetAddress dest;
+			unsigned long alen = 0;
+			if ((mlen >= 7)&&(m[0] == 4)) {
+				dest.set(m + 1,4,((((unsigned int)m[5]) & 0xff) << 8) | (((unsigned int)m[6]) & 0xff));
+				alen = 7;
+			} else if ((mlen >= 19)&&(m[0] == 6)) {
+				dest.set(m + 1,16,((((unsigned int)m[17]) & 0xff) << 8) | (((unsigned int)m[18]) & 0xff));
+				alen = 19;
+			}
+			if ((!alen)||(mlen == alen)||(!dest.port())||((!anyScope)&&(dest.ipScope() != InetAddress::IP_SCOPE_GLOBAL))) {
+				++c->invalid;
+				++invalid;
+				continue;
+			}
+
+			PhySocket *const us = _udp(c,dest.ss_family);
+			if (!us) {
+				++c->invalid;
+				++invalid;
+				continue;
+			}
+			if ((count == ZT_PHY_UDP_BATCH_SIZE)||((count)&&(us != batchSock))) {
+				relayedOut += phy.udpSendBatch(batchSock,batch,count);
+				count = 0;
+			}
+			batchSock = us;
+			memcpy(&(to[count]),&dest,sizeof(struct sockaddr_storage));
+			batch[count].address = reinterpret_cast<const struct sockaddr *>(&(to[count]));
+			batch[count].data = m + alen;
+			batch[count].len = mlen - alen;
+			++count;
+			++c->udpPacketsOut;
+		}
+		if (count)
+			relayedOut += phy.udpSendBatch(batchSock,batch,count);
+
+		// Keep what's left, which may be in readq itself
+		if (l) {
+			if (c->readq.empty())
+				c->readq.assign(p,l);
+			else c->readq.erase(0,c->readq.length() - l);
+		} else c->readq.clear();
+	}
+
+	inline void phyOnTcpWritable(PhySocket *sock,void **uptr)
+	{
+		TcpProxyClient *const c = reinterpret_cast<TcpProxyClient *>(*uptr);
+		if (c)
+			_flush(c);
+	}
+
+	inline void phyOnDatagrams(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const PhyDatagram *datagrams,unsigned int count)
+	{
+		TcpProxyClient *const c = reinterpret_cast<TcpProxyClient *>(*uptr);
+		if (!c)
+			return;
+
+		// While nothing is queued datagrams are framed into scratch and written
+		// together, so connections that keep up never allocate a queue
+		unsigned long slen = 0;
+		for(unsigned int i=0;i<count;++i) {
+			const PhyDatagram &d = datagrams[i];
+			char hdr[ZT_TCP_PROXY_MAX_HEADER];
+			unsigned long hlen;
+			if (d.address->sa_family == AF_INET) {
+				const struct sockaddr_in *const sin = reinterpret_cast<const struct sockaddr_in *>(d.address);
+				hdr[5] = 4;
+				memcpy(hdr + 6,&(sin->sin_addr.s_addr),4);
+				memcpy(hdr + 10,&(sin->sin_port),2);
+				hlen = 12;
+			} else if (d.address->sa_family == AF_INET6) {
+				const struct sockaddr_in6 *const sin6 = reinterpret_cast<const struct sockaddr_in6 *>(d.address);
+				hdr[5] = 6;
+				memcpy(hdr + 6,sin6->sin6_addr.s6_addr,16);
+				memcpy(hdr + 22,&(sin6->sin6_port),2);
+				hlen = 24;
+			} else continue;
+			const unsigned long mlen = (hlen - 5) + d.len;
+			if (mlen > 0xffff)
+				continue;
+			hdr[0] = (char)0x17;
+			hdr[1] = (char)0x03;
+			hdr[2] = (char)0x03;
+			hdr[3] = (char)((mlen >> 8) & 0xff);
+			hdr[4] = (char)(mlen & 0xff);
+
+			if ((slen + hlen + d.len) > sizeof(_scratch)) {
+				if (!_write(c,_scratch,slen))
+					return; // closed, c is gone
+				slen = 0;
+			}
+			if (c->writeq.empty()) {
+				memcpy(_scratch + slen,hdr,hlen);
+				memcpy(_scratch + slen + hlen,d.data,d.len);
+				slen += hlen + d.len;
+			} else if ((c->writeq.size() + hlen + d.len) <= queueLimit) {
+				c->writeq.append(hdr,hlen);
+				c->writeq.append(d.data,d.len);
+			} else {
+				++c->dropped;
+				++dropped;
+				continue;
+			}
+			++c->udpPacketsIn;
+			++relayedIn;
+		}
+
+		if (slen) {
+			if (!_write(c,_scratch,slen))
+				return;
+			if (!c->writeq.empty())
+				phy.setNotifyWritable(c->tcp,true);
+		} else if (!c->writeq.empty()) {
+			c->queuedPeak = std::max(c->queuedPeak,c->writeq.size());
+			_flush(c);
+		}
+	}
+
+	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success) {}
+	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
+	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool lwip) {}
+
+	/**
+	 * Close connections that have sent nothing since before a given time
+	 *
+	 * @param before Cutoff
+	 */
+	inline void expire(const int64_t before)
+	{
+		std::vector<PhySocket *> idle;
+		for(std::unordered_set<TcpProxyClient *>::const_iterator c(clients.begin());c!=clients.end();++c) {
+			if ((*c)->lastReceive < before)
+				idle.push_back((*c)->tcp);
+		}
+		for(std::vector<PhySocket *>::const_iterator s(idle.begin());s!=idle.end();++s)
+			phy.close(*s,true);
+	}
+
+	/**
+	 * @param now Current time
+	 * @return Totals and each connection's counters and queue
+	 */
+	inline nlohmann::json stats(const int64_t now) const
+	{
+		nlohmann::json j;
+		j["clock"] = now;
+		j["connections"] = (uint64_t)clients.size();
+		j["accepted"] = accepted;
+		j["closed"] = closed;
+		j["refused"] = refused;
+		j["relayedOut"] = relayedOut;
+		j["relayedIn"] = relayedIn;
+		j["dropped"] = dropped;
+		j["invalid"] = invalid;
+		j["queueLimit"] = (uint64_t)queueLimit;
+
+		nlohmann::json cl = nlohmann::json::array();
+		char tmp[64];
+		for(std::unordered_set<TcpProxyClient *>::const_iterator ci(clients.begin());ci!=clients.end();++ci) {
+			const TcpProxyClient &c = **ci;
+			nlohmann::json cj;
+			cj["address"] = c.from.toString(tmp);
+			if (c.hello) {
+				OSUtils::ztsnprintf(tmp,sizeof(tmp),"%u.%u.%u",c.version[0],c.version[1],c.version[2]);
+				cj["version"] = tmp;
+			} else cj["version"] = nlohmann::json();
+			cj["age"] = now - c.connected;
+			cj["idle"] = now - c.lastReceive;
+			cj["tcpBytesIn"] = c.tcpBytesIn;
+			cj["tcpBytesOut"] = c.tcpBytesOut;
+			cj["udpPacketsOut"] = c.udpPacketsOut;
+			cj["udpPacketsIn"] = c.udpPacketsIn;
+			cj["queued"] = (uint64_t)c.writeq.size();
+			cj["queuedPeak"] = (uint64_t)c.queuedPeak;
+			cj["dropped"] = c.dropped;
+			cj["invalid"] = c.invalid;
+			cl.push_back(cj);
+		}
+		j["clients"] = cl;
+		return j;
+	}
+
+	/**
+	 * @return Bytes queued across all connections
+	 */
+	inline uint64_t queued() const
+	{
+		uint64_t q = 0;
+		for(std::unordered_set<TcpProxyClient *>::const_iterator c(clients.begin());c!=clients.end();++c)
+			q += (*c)->writeq.size();
+		return q;
+	}
+
+	TcpProxyPhy phy;
+	std::unordered_set<TcpProxyClient *> clients;
+	unsigned long queueLimit;
+	unsigned long maxConnections;
+	bool anyScope;
+
+	uint64_t accepted;
+	uint64_t closed;
+	uint64_t refused;
+	uint64_t relayedOut;
+	uint64_t relayedIn;
+	uint64_t dropped;
+	uint64_t invalid;
+
+private:
+	// UDP socket of a client for an address family, bound on first use
+	inline PhySocket *_udp(TcpProxyClient *c,const int family)
+	{
+		PhySocket *&s = (family == AF_INET6) ? c->udp6 : c->udp4;
+		if (!s) {
+			static const uint8_t zero[16] = { 0 };
+			const InetAddress any(zero,(family == AF_INET6) ? 16 : 4,0);
+			s = phy.udpBind(reinterpret_cast<const struct sockaddr *>(&any),(void *)c,ZT_TCP_PROXY_UDP_BUFFER_SIZE);
+		}
+		return s;
+	}
+
+	// Writes output while nothing is queued, queueing whatever the socket doesn't
+	// take (all of it, since the rest of a message can't be dropped). Returns
+	// false if the connection was closed and c deleted.
+	inline bool _write(TcpProxyClient *c,const char *data,unsigned long len)
+	{
+		const long n = phy.streamSend(c->tcp,data,len);
+		if (n < 0)
+			return false;
+		c->tcpBytesOut += (uint64_t)n;
+		if ((unsigned long)n < len) {
+			c->writeq.append(data + n,len - (unsigned long)n);
+			c->queuedPeak = std::max(c->queuedPeak,c->writeq.size());
+		}
+		return true;
+	}
+
+	// Writes as much of the queue as the socket takes, after which c may be gone
+	inline void _flush(TcpProxyClient *c)
+	{
+		for(int k=0;k<2;++k) { // at most twice, once per piece of the ring
+			unsigned long fl = 0;
+			const char *const f = c->writeq.front(fl);
+			if (!fl)
+				break;
+			const long n = phy.streamSend(c->tcp,f,fl);
+			if (n < 0)
+				return;
+			c->writeq.consume((unsigned long)n);
+			c->tcpBytesOut += (uint64_t)n;
+			if ((unsigned long)n < fl)
+				break;
+		}
+		if (c->writeq.empty()) {
+			c->writeq.clear();
+			phy.setNotifyWritable(c->tcp,false);
+		} else {
+			phy.setNotifyWritable(c->tcp,true);
+		}
+	}
+
+	char _scratch[ZT_PHY_RECV_BUFFER_SIZE];
+};
+
+static volatile bool run = true;
+
+static void sighandlerQuit(int sig)
+{
+	run = false;
+}
+
+} // anonymous namespace
+
+int main(int argc,char **argv)
+{
+	unsigned int port = ZT_TCP_PROXY_PORT;
+	const char *bindAddress = (const char *)0;
+	unsigned long maxConnections = ZT_TCP_PROXY_MAX_CONNECTIONS;
+	unsigned long queueLimit = ZT_TCP_PROXY_QUEUE_LIMIT;
+	int64_t timeout = (int64_t)ZT_TCP_PROXY_TIMEOUT * 1000;
+	const char *statsPath = (const char *)0;
+	int64_t statsInterval = (int64_t)ZT_TCP_PROXY_STATS_INTERVAL * 1000;
+	bool anyScope = false;
+
+	for(int i=1;i<argc;++i) {
+		if ((!strcmp(argv[i],"-p"))&&((i + 1) < argc)) {
+			port = (unsigned int)std::min(65535,std::max(1,atoi(argv[++i])));
+		} else if ((!strcmp(argv[i],"-b"))&&((i + 1) < argc)) {
+			bindAddress = argv[++i];
+		} else if ((!strcmp(argv[i],"-c"))&&((i + 1) < argc)) {
+			maxConnections = (unsigned long)std::max(1,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-q"))&&((i + 1) < argc)) {
+			queueLimit = (unsigned long)std::max(65536,atoi(argv[++i]));
+		} else if ((!strcmp(argv[i],"-t"))&&((i + 1) < argc)) {
+			timeout = (int64_t)std::max(1,atoi(argv[++i])) * 1000;
+		} else if ((!strcmp(argv[i],"-s"))&&((i + 1) < argc)) {
+			statsPath = argv[++i];
+		} else if ((!strcmp(argv[i],"-i"))&&((i + 1) < argc)) {
+			statsInterval = (int64_t)std::max(1,atoi(argv[++i])) * 1000;
+		} else if (!strcmp(argv[i],"-a")) {
+			anyScope = true;
+		} else {
+			fprintf(stderr,"Usage: %s [-p <port>] [-b <address>] [-c <connections>] [-q <bytes>] [-t <seconds>] [-s <stats path>] [-i <seconds>] [-a]" ZT_EOL_S,argv[0]);
+			return 1;
+		}
+	}
+
+#ifndef __WINDOWS__
+	signal(SIGPIPE,SIG_IGN);
+	signal(SIGHUP,SIG_IGN);
+	signal(SIGINT,&sighandlerQuit);
+	signal(SIGTERM,&sighandlerQuit);
+
+	// Two descriptors per connection plus a few
+	{
+		struct rlimit rl;
+		if (getrlimit(RLIMIT_NOFILE,&rl) == 0) {
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE,&rl);
+			getrlimit(RLIMIT_NOFILE,&rl);
+			if ((rl.rlim_cur != RLIM_INFINITY)&&(((uint64_t)maxConnections * 2 + 16) > (uint64_t)rl.rlim_cur)) {
+				maxConnections = (rl.rlim_cur > 32) ? (unsigned long)((rl.rlim_cur - 16) / 2) : 8;
+				fprintf(stderr,"WARNING: descriptor limit is %llu, so at most %lu connections will be accepted" ZT_EOL_S,(unsigned long long)rl.rlim_cur,maxConnections);
+			}
+		}
+	}
+#endif
+
+	TcpProxy *const proxy = new TcpProxy();
+	proxy->maxConnections = maxConnections;
+	proxy->queueLimit = queueLimit;
+	proxy->anyScope = anyScope;
+
+	unsigned int listeners = 0;
+	if (bindAddress) {
+		InetAddress a(bindAddress);
+		if (a) {
+			a.setPort(port);
+			if (proxy->phy.tcpListen(reinterpret_cast<const struct sockaddr *>(&a)))
+				++listeners;
+		}
+	} else {
+		InetAddress a4((uint32_t)0,port);
+		if (proxy->phy.tcpListen(reinterpret_cast<const struct sockaddr *>(&a4)))
+			++listeners;
+		static const uint8_t zero[16] = { 0 };
+		InetAddress a6(zero,16,port);
+		if (proxy->phy.tcpListen(reinterpret_cast<const struct sockaddr *>(&a6)))
+			++listeners;
+	}
+	if (!listeners) {
+		fprintf(stderr,"%s: FATAL: unable to listen on TCP port %u" ZT_EOL_S,argv[0],port);
+		delete proxy;
+		return 1;
+	}
+	printf("zerotier-tcp-proxy %d.%d.%d listening on TCP port %u, up to %lu connections with %lu bytes queued each" ZT_EOL_S,ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION,port,maxConnections,queueLimit);
+	fflush(stdout);
+
+	int64_t lastExpire = OSUtils::updateCoarseNow();
+	int64_t lastStats = lastExpire;
+	uint64_t lastOut = 0,lastIn = 0,lastDropped = 0;
+	while (run) {
+		proxy->phy.poll(1000);
+		const int64_t now = OSUtils::updateCoarseNow();
+
+		if ((now - lastExpire) >= 1000) {
+			lastExpire = now;
+			proxy->expire(now - timeout);
+		}
+
+		if ((now - lastStats) >= statsInterval) {
+			const double secs = (double)(now - lastStats) / 1000.0;
+			lastStats = now;
+			printf("%lu connections, %.0f packets/s out, %.0f packets/s in, %llu bytes queued, %llu dropped" ZT_EOL_S,
+				(unsigned long)proxy->clients.size(),
+				(double)(proxy->relayedOut - lastOut) / secs,
+				(double)(proxy->relayedIn - lastIn) / secs,
+				(unsigned long long)proxy->queued(),
+				(unsigned long long)(proxy->dropped - lastDropped));
+			fflush(stdout);
+			lastOut = proxy->relayedOut;
+			lastIn = proxy->relayedIn;
+			lastDropped = proxy->dropped;
+			if (statsPath) {
+				// Written aside and renamed into place so readers never see part of it
+				const std::string tmp(std::string(statsPath) + ".tmp");
+				if (OSUtils::writeFile(tmp.c_str(),OSUtils::jsonDump(proxy->stats(now))))
+					rename(tmp.c_str(),statsPath);
+			}
+		}
+	}
+
+	delete proxy;
+	return 0;
+}